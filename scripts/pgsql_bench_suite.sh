@@ -0,0 +1,200 @@
+#!/usr/bin/env bash
+
+# Pooler benchmark suite.
+#
+# Starts odyssey from the build directory in front of a running
+# PostgreSQL, runs odyssey_stress scenarios and records throughput,
+# latency percentiles and peak odyssey RSS of each one. Results are
+# compared with a stored baseline, the script fails when any value
+# regressed by more than BENCH_TOLERANCE percent.
+#
+# usage: pgsql_bench_suite.sh [-b build] [-B baseline] [-o results] [-t secs] [-R] [scenario...]
+#
+#   -b <build>     build directory with sources/odyssey and stress/odyssey_stress
+#   -B <baseline>  baseline file (default <build>/bench_baseline.tsv)
+#   -o <results>   results file (default <build>/bench_results.tsv)
+#   -t <secs>      time to run each scenario (default 10)
+#   -R             record the results as the new baseline
+#
+# PostgreSQL is taken from PGHOST, PGPORT, PGUSER and PGDATABASE,
+# BENCH_THREADS sets the number of odyssey_stress load threads.
+
+set -e
+
+BUILD=build
+BASELINE=
+RESULTS=
+TIME=10
+RECORD=0
+while getopts "b:B:o:t:R" opt; do
+  case "$opt" in
+    b ) BUILD=$OPTARG;;
+    B ) BASELINE=$OPTARG;;
+    o ) RESULTS=$OPTARG;;
+    t ) TIME=$OPTARG;;
+    R ) RECORD=1;;
+    * ) sed -n '11,20p' "$0" | cut -c3-; exit 1;;
+  esac
+done
+shift $((OPTIND - 1))
+
+BASELINE=${BASELINE:-$BUILD/bench_baseline.tsv}
+RESULTS=${RESULTS:-$BUILD/bench_results.tsv}
+TOLERANCE=${BENCH_TOLERANCE:-10}
+PORT=${BENCH_PORT:-6433}
+THREADS=${BENCH_THREADS:-1}
+PGHOST=${PGHOST:-127.0.0.1}
+PGPORT=${PGPORT:-5432}
+PGUSER=${PGUSER:-`whoami`}
+PGDATABASE=${PGDATABASE:-postgres}
+
+ODYSSEY=$BUILD/sources/odyssey
+STRESS=$BUILD/stress/odyssey_stress
+for bin in $ODYSSEY $STRESS; do
+  if [[ ! -x $bin ]]; then
+    echo "ERROR: $bin not found, build the project first."
+    exit 1
+  fi
+done
+
+# name and odyssey_stress arguments of every scenario
+declare -A scenarios=(
+  [login_storm]="-c 32 -C 1"
+  [tx_saturation]="-c 256"
+  [wide_result]="-c 8 -q 'select generate_series(1,10000)'"
+  [copy_out]="-c 4 -q 'copy (select generate_series(1,100000)) to stdout'"
+  [tls_handshake]="-c 16 -C 1 -s"
+  [idle_clients]="-c 8 -i 2000 -r 2000"
+)
+declare -a order=(login_storm tx_saturation wide_result copy_out tls_handshake idle_clients)
+if [[ $# -gt 0 ]]; then
+  order=("$@")
+fi
+
+TMP=`mktemp -d`
+ODYSSEY_PID=
+
+cleanup () {
+  if [[ -n $ODYSSEY_PID ]]; then
+    kill $ODYSSEY_PID 2>/dev/null || true
+    wait $ODYSSEY_PID 2>/dev/null || true
+  fi
+  rm -rf $TMP
+}
+trap cleanup EXIT
+
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost \
+  -keyout $TMP/server.key -out $TMP/server.crt >/dev/null 2>&1
+
+cat > $TMP/odyssey.conf <<EOF
+daemonize no
+log_to_stdout no
+log_file "$TMP/odyssey.log"
+log_format "%p %t %l [%i %s] (%c) %m\n"
+workers 4
+listen {
+	host "127.0.0.1"
+	port $PORT
+	tls "allow"
+	tls_cert_file "$TMP/server.crt"
+	tls_key_file "$TMP/server.key"
+}
+storage "postgres_server" {
+	type "remote"
+	host "$PGHOST"
+	port $PGPORT
+}
+database default {
+	user default {
+		authentication "none"
+		storage "postgres_server"
+		storage_user "$PGUSER"
+		pool "transaction"
+		pool_size 16
+	}
+}
+EOF
+
+# idle clients need descriptors on both sides
+ulimit -n 65536 2>/dev/null || true
+
+echo "Start Odyssey"
+$ODYSSEY $TMP/odyssey.conf &
+ODYSSEY_PID=$!
+sleep 1
+if ! kill -0 $ODYSSEY_PID 2>/dev/null; then
+  echo "ERROR: odyssey failed to start"
+  cat $TMP/odyssey.log 2>/dev/null || true
+  exit 1
+fi
+
+number () {
+  grep -o "\"$1\": [0-9.]*" $2 | head -1 | awk '{ print $2 }'
+}
+
+printf "# scenario\tqps\tcps\tmbps\tp50_us\tp99_us\tp999_us\trss_kb\terrors\n" > $RESULTS
+for name in "${order[@]}"; do
+  if [[ -z ${scenarios[$name]} ]]; then
+    echo "ERROR: unknown scenario $name"
+    exit 1
+  fi
+  echo "scenario $name"
+  eval "$STRESS -h 127.0.0.1 -p $PORT -u $PGUSER -d $PGDATABASE -t $TIME -T $THREADS \
+        -j $TMP/$name.json ${scenarios[$name]}" > $TMP/$name.out &
+  pid=$!
+
+  # peak resident set of odyssey during the scenario
+  rss=0
+  while kill -0 $pid 2>/dev/null; do
+    cur=`awk '/^VmRSS/ { print $2 }' /proc/$ODYSSEY_PID/status`
+    if [[ $cur -gt $rss ]]; then
+      rss=$cur
+    fi
+    sleep 0.2
+  done
+  wait $pid
+
+  json=$TMP/$name.json
+  grep '"query": {' $json | tr ',' '\n' > $TMP/$name.query
+  errors=$((`number errors $json` + `number connect_errors $json`))
+  mbps=`awk -v b=\`number recv_bytes $json\` -v d=\`number duration $json\` \
+        'BEGIN { printf "%.2f", b / d / (1024 * 1024) }'`
+  printf "%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n" $name \
+    `number qps $json` `number cps $json` $mbps \
+    `number p50_us $TMP/$name.query` `number p99_us $TMP/$name.query` \
+    `number p999_us $TMP/$name.query` $rss $errors >> $RESULTS
+done
+
+column -t $RESULTS 2>/dev/null || cat $RESULTS
+
+if [[ $RECORD -eq 1 ]]; then
+  cp $RESULTS $BASELINE
+  echo "baseline recorded to $BASELINE"
+  exit 0
+fi
+
+if [[ ! -f $BASELINE ]]; then
+  echo "no baseline at $BASELINE, run with -R to record one"
+  exit 0
+fi
+
+# throughput must not drop, latency and memory must not grow
+awk -v tol=$TOLERANCE '
+  BEGIN { FS = "\t"; split("qps cps mbps p50_us p99_us p999_us rss_kb", colname, " ") }
+  /^#/ { next }
+  NR == FNR { for (i = 2; i <= 8; i++) base[$1, i] = $i; next }
+  {
+    for (i = 2; i <= 8; i++) {
+      if (! (($1, i) in base) || base[$1, i] == 0)
+        continue
+      change = ($i - base[$1, i]) * 100 / base[$1, i]
+      if (i > 4)
+        change = -change
+      if (change < -tol) {
+        printf "REGRESSION %s %s: %s -> %s (%.1f%%)\n", $1, colname[i - 1], base[$1, i], $i, change
+        failed = 1
+      }
+    }
+  }
+  END { exit failed }
+' $BASELINE $RESULTS && echo "no regressions against $BASELINE"
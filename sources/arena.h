@@ -0,0 +1,98 @@
+#ifndef ODYSSEY_ARENA_H
+#define ODYSSEY_ARENA_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+/* bump allocator for short lived allocations, everything is
+ * released at once by od_arena_free() */
+
+typedef struct od_arena_chunk od_arena_chunk_t;
+typedef struct od_arena       od_arena_t;
+
+#define OD_ARENA_CHUNK 4096
+
+struct od_arena_chunk
+{
+	od_arena_chunk_t *next;
+	size_t            size;
+	size_t            pos;
+	char              data[];
+};
+
+struct od_arena
+{
+	od_arena_chunk_t *chunk;
+};
+
+static inline void
+od_arena_init(od_arena_t *arena)
+{
+	arena->chunk = NULL;
+}
+
+static inline void
+od_arena_free(od_arena_t *arena)
+{
+	od_arena_chunk_t *chunk = arena->chunk;
+	while (chunk) {
+		od_arena_chunk_t *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	arena->chunk = NULL;
+}
+
+static inline void*
+od_arena_alloc(od_arena_t *arena, size_t size)
+{
+	size = (size + 7) & ~(size_t)7;
+	od_arena_chunk_t *chunk = arena->chunk;
+	if (od_unlikely(chunk == NULL || chunk->size - chunk->pos < size)) {
+		size_t chunk_size = OD_ARENA_CHUNK - sizeof(od_arena_chunk_t);
+		if (size > chunk_size)
+			chunk_size = size;
+		chunk = malloc(sizeof(od_arena_chunk_t) + chunk_size);
+		if (chunk == NULL)
+			return NULL;
+		chunk->size = chunk_size;
+		chunk->pos  = 0;
+		chunk->next = arena->chunk;
+		arena->chunk = chunk;
+	}
+	void *ptr = chunk->data + chunk->pos;
+	chunk->pos += size;
+	return ptr;
+}
+
+static inline void*
+od_arena_memdup(od_arena_t *arena, const void *data, size_t size)
+{
+	void *ptr = od_arena_alloc(arena, size);
+	if (ptr == NULL)
+		return NULL;
+	memcpy(ptr, data, size);
+	return ptr;
+}
+
+static inline char*
+od_arena_strndup(od_arena_t *arena, const char *string, size_t len)
+{
+	char *ptr = od_arena_alloc(arena, len + 1);
+	if (ptr == NULL)
+		return NULL;
+	memcpy(ptr, string, len);
+	ptr[len] = 0;
+	return ptr;
+}
+
+static inline char*
+od_arena_strdup(od_arena_t *arena, const char *string)
+{
+	return od_arena_memdup(arena, string, strlen(string) + 1);
+}
+
+#endif /* ODYSSEY_ARENA_H */
@@ -52,6 +52,13 @@ od_atomic_u32_xor(od_atomic_u32_t *atomic, uint32_t value)
 	return __sync_xor_and_fetch(atomic, value);
 }
 
+static inline void
+od_atomic_u32_set(od_atomic_u32_t *atomic, uint32_t value)
+{
+	__sync_synchronize();
+	*atomic = value;
+}
+
 static inline uint64_t
 od_atomic_u64_of(od_atomic_u64_t *atomic)
 {
@@ -82,4 +89,11 @@ od_atomic_u64_sub(od_atomic_u64_t *atomic, uint64_t value)
 	return __sync_sub_and_fetch(atomic, value);
 }
 
+static inline void
+od_atomic_u64_set(od_atomic_u64_t *atomic, uint64_t value)
+{
+	__sync_synchronize();
+	*atomic = value;
+}
+
 #endif /* ODYSSEY_ATOMIC_H */
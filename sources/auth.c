@@ -13,6 +13,7 @@
 #include <ctype.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <pwd.h>
 
 #include <machinarium.h>
 #include <kiwi.h>
@@ -75,7 +76,7 @@ od_auth_frontend_cleartext(od_client_t *client)
 	/* support PAM authentication */
 	if (client->rule->auth_pam_service)
 	{
-		rc = od_pam_auth(client->rule->auth_pam_service,
+		rc = od_pam_auth(client->global, client->rule,
 		                 &client->startup.user,
 		                 &client_token);
 		kiwi_password_free(&client_token);
@@ -93,11 +94,13 @@ od_auth_frontend_cleartext(od_client_t *client)
 	{
 		char peer[128];
 		od_getpeername(client->io.io, peer, sizeof(peer), 1, 0);
+		od_client_wait(client, OD_CLIENT_WAIT_AUTH_QUERY);
 		rc = od_auth_query(client->global,
 		                   client->rule,
 		                   peer,
 		                   &client->startup.user,
 		                   &client_password);
+		od_client_wait(client, OD_CLIENT_WAIT_AUTH);
 		if (rc == -1) {
 			od_error(&instance->logger, "auth", client, NULL,
 			         "failed to make auth_query");
@@ -211,11 +214,13 @@ od_auth_frontend_md5(od_client_t *client)
 	{
 		char peer[128];
 		od_getpeername(client->io.io, peer, sizeof(peer), 1, 0);
+		od_client_wait(client, OD_CLIENT_WAIT_AUTH_QUERY);
 		rc = od_auth_query(client->global,
 		                   client->rule,
 		                   peer,
 		                   &client->startup.user,
 		                   &query_password);
+		od_client_wait(client, OD_CLIENT_WAIT_AUTH);
 		if (rc == -1) {
 			od_error(&instance->logger, "auth", client, NULL,
 			         "failed to make auth_query");
@@ -324,23 +329,32 @@ od_auth_frontend_scram_sha_256(od_client_t *client)
 	/* read the SASLInitialResponse */
 	char* mechanism;
 	char* auth_data;
+	uint32_t auth_data_len;
 	rc = kiwi_be_read_authentication_sasl_initial(machine_msg_data(msg),
 											      machine_msg_size(msg),
-											      &mechanism, &auth_data);
+											      &mechanism, &auth_data,
+											      &auth_data_len);
 	if (rc == -1) {
 		od_frontend_error(client, KIWI_INVALID_AUTHORIZATION_SPECIFICATION,
 			              "malformed SASLInitialResponse message");
-
+		machine_msg_free(msg);
 		return -1;
 	}
 
 	if (strcmp(mechanism, "SCRAM-SHA-256") != 0) {
 		od_frontend_error(client, KIWI_INVALID_AUTHORIZATION_SPECIFICATION,
 			              "unsupported SASL authorization mechanism");
-
+		machine_msg_free(msg);
 		return -1;
 	}
 
+	/* auth data is not terminated in the message, copy it to the
+	 * login arena */
+	auth_data = od_arena_strndup(&client->arena, auth_data, auth_data_len);
+	machine_msg_free(msg);
+	if (auth_data == NULL)
+		return -1;
+
 	/* use remote or local password source */
 	kiwi_password_t query_password;
 	kiwi_password_init(&query_password);
@@ -348,18 +362,19 @@ od_auth_frontend_scram_sha_256(od_client_t *client)
 	if (client->rule->auth_query) {
 		char peer[128];
 		od_getpeername(client->io.io, peer, sizeof(peer), 1, 0);
+		od_client_wait(client, OD_CLIENT_WAIT_AUTH_QUERY);
 		rc = od_auth_query(client->global,
 		                   client->rule,
 		                   peer,
 		                   &client->startup.user,
 		                   &query_password);
+		od_client_wait(client, OD_CLIENT_WAIT_AUTH);
 		if (rc == -1) {
 			od_error(&instance->logger, "auth", client, NULL,
 			         "failed to make auth_query");
 			od_frontend_error(client, KIWI_INVALID_AUTHORIZATION_SPECIFICATION,
 			                  "failed to make auth query");
 			kiwi_password_free(&query_password);
-			machine_msg_free(msg);
 			return -1;
 		}
 
@@ -369,9 +384,15 @@ od_auth_frontend_scram_sha_256(od_client_t *client)
 			       client->startup.database.value,
 			       client->startup.user.value,peer);
 			od_frontend_error(client, KIWI_INVALID_PASSWORD, "incorrect user");
-			machine_msg_free(msg);
 			return -1;
 		}
+		char *password;
+		password = od_arena_memdup(&client->arena, query_password.password,
+		                           query_password.password_len);
+		kiwi_password_free(&query_password);
+		if (password == NULL)
+			return -1;
+		query_password.password = password;
 		query_password.password_len--;
 	} else {
 		query_password.password_len = client->rule->password_len;
@@ -380,6 +401,7 @@ od_auth_frontend_scram_sha_256(od_client_t *client)
 
 	od_scram_state_t scram_state;
 	od_scram_state_init(&scram_state);
+	scram_state.arena = &client->arena;
 
 	/* try to parse authentication data */
 	rc = od_scram_read_client_first_message(&scram_state, auth_data);
@@ -413,7 +435,9 @@ od_auth_frontend_scram_sha_256(od_client_t *client)
 
 	rc = od_scram_parse_verifier(&scram_state, query_password.password);
 	if (rc == -1)
-		rc = od_scram_init_from_plain_password(&scram_state, query_password.password);
+		rc = od_scram_init_from_plain_password(&scram_state,
+		                                       client->startup.user.value,
+		                                       query_password.password);
 
 	if (rc == -1) {
 		od_frontend_error(client, KIWI_INVALID_AUTHORIZATION_SPECIFICATION,
@@ -424,7 +448,6 @@ od_auth_frontend_scram_sha_256(od_client_t *client)
 
 	msg = od_scram_create_server_first_message(&scram_state);
 	if (msg == NULL) {
-		kiwi_password_free(&query_password);
 		od_scram_state_free(&scram_state);
 
 		return -1;
@@ -462,15 +485,20 @@ od_auth_frontend_scram_sha_256(od_client_t *client)
 	/* read the SASLResponse */
 	rc = kiwi_be_read_authentication_sasl(machine_msg_data(msg),
 										  machine_msg_size(msg),
-										  &auth_data);
+										  &auth_data, &auth_data_len);
 
 	if (rc == -1) {
 		od_frontend_error(client, KIWI_INVALID_AUTHORIZATION_SPECIFICATION,
 			              "malformed client SASLResponse");
-
+		machine_msg_free(msg);
 		return -1;
 	}
 
+	auth_data = od_arena_strndup(&client->arena, auth_data, auth_data_len);
+	machine_msg_free(msg);
+	if (auth_data == NULL)
+		return -1;
+
 	char* final_nonce;
 	char* client_proof;
 	rc = od_scram_read_client_final_message(&scram_state, auth_data,
@@ -502,7 +530,6 @@ od_auth_frontend_scram_sha_256(od_client_t *client)
 	/* SASLFinal Message */
 	msg = od_scram_create_server_final_message(&scram_state);
 	if (msg == NULL) {
-		kiwi_password_free(&query_password);
 		od_scram_state_free(&scram_state);
 
 		return -1;
@@ -558,6 +585,57 @@ od_auth_frontend_cert(od_client_t *client)
 	return -1;
 }
 
+static inline int
+od_auth_frontend_peer(od_client_t *client)
+{
+	od_instance_t *instance = client->global->instance;
+
+	/* mux streams are socket pairs of odyssey itself */
+	if (client->config_listen->host || client->mux) {
+		od_error(&instance->logger, "auth", client, NULL,
+		         "peer authentication requires unix socket connection");
+		od_frontend_error(client, KIWI_INVALID_AUTHORIZATION_SPECIFICATION,
+		                  "peer authentication requires unix socket connection");
+		return -1;
+	}
+
+	/* compare name of the connected process user */
+	uid_t uid;
+	gid_t gid;
+	int rc;
+	rc = machine_getpeereid(client->io.io, &uid, &gid);
+	if (rc == -1) {
+		od_error(&instance->logger, "auth", client, NULL,
+		         "failed to get peer credentials: %s",
+		         od_io_error(&client->io));
+		od_frontend_error(client, KIWI_INVALID_AUTHORIZATION_SPECIFICATION,
+		                  "failed to get peer credentials");
+		return -1;
+	}
+	struct passwd pw;
+	struct passwd *pw_result = NULL;
+	char pw_buf[1024];
+	rc = getpwuid_r(uid, &pw, pw_buf, sizeof(pw_buf), &pw_result);
+	if (rc != 0 || pw_result == NULL) {
+		od_error(&instance->logger, "auth", client, NULL,
+		         "could not look up local user ID %d", (int)uid);
+		od_frontend_error(client, KIWI_INVALID_AUTHORIZATION_SPECIFICATION,
+		                  "peer authentication failed for user \"%s\"",
+		                  client->startup.user.value);
+		return -1;
+	}
+	if (strcmp(pw.pw_name, client->startup.user.value) != 0) {
+		od_error(&instance->logger, "auth", client, NULL,
+		         "peer user '%s' does not match '%s'",
+		         pw.pw_name, client->startup.user.value);
+		od_frontend_error(client, KIWI_INVALID_AUTHORIZATION_SPECIFICATION,
+		                  "peer authentication failed for user \"%s\"",
+		                  client->startup.user.value);
+		return -1;
+	}
+	return 0;
+}
+
 static inline int
 od_auth_frontend_block(od_client_t *client)
 {
@@ -573,7 +651,7 @@ od_auth_frontend_block(od_client_t *client)
 
 int od_auth_frontend(od_client_t *client)
 {
-	od_instance_t *instance = client->global->instance;
+	od_client_wait(client, OD_CLIENT_WAIT_AUTH);
 
 	/* authentication mode */
 	int rc;
@@ -598,6 +676,11 @@ int od_auth_frontend(od_client_t *client)
 		if (rc == -1)
 			return -1;
 		break;
+	case OD_RULE_AUTH_PEER:
+		rc = od_auth_frontend_peer(client);
+		if (rc == -1)
+			return -1;
+		break;
 	case OD_RULE_AUTH_BLOCK:
 		od_auth_frontend_block(client);
 		return -1;
@@ -608,18 +691,10 @@ int od_auth_frontend(od_client_t *client)
 		break;
 	}
 
-	/* pass */
-	machine_msg_t *msg;
-	msg = kiwi_be_write_authentication_ok(NULL);
-	if (msg == NULL)
-		return -1;
-	rc = od_write(&client->io, msg);
-	if (rc == -1) {
-		od_error(&instance->logger, "auth", client, NULL,
-		         "write error: %s",
-		         od_io_error(&client->io));
-		return -1;
-	}
+	/* login allocations are not needed past authentication */
+	od_arena_free(&client->arena);
+
+	/* pass, authentication ok is sent with the login response */
 	return 0;
 }
 
@@ -691,17 +766,11 @@ od_auth_backend_md5(od_server_t *server, char salt[4])
 		user_len = route->rule->user_name_len;
 	}
 
-	/* use storage or user password */
-	char *password;
-	int   password_len;
-	if (route->rule->storage_password) {
-		password = route->rule->storage_password;
-		password_len = route->rule->storage_password_len;
-	} else
-	if (route->rule->password) {
-		password = route->rule->password;
-		password_len = route->rule->password_len;
-	} else {
+	/* md5 of storage or user password and user, derived on
+	 * config load */
+	char *password = route->rule->server_password_md5;
+	int   password_len = 35;
+	if (password == NULL) {
 		od_error(&instance->logger, "auth", NULL, server,
 		         "password required for route '%s.%s'",
 		         route->rule->db_name,
@@ -811,14 +880,9 @@ od_auth_backend_sasl_continue(od_server_t *server, char *auth_data)
 		return -1;
 	}
 
-	/* use storage or user password */
-	char *password;
-
-	if (route->rule->storage_password) {
-		password = route->rule->storage_password;
-	} else if (route->rule->password) {
-		password = route->rule->password;
-	} else {
+	/* SASLprep of storage or user password, derived on config load */
+	char *password = route->rule->server_password_sasl;
+	if (password == NULL) {
 		od_error(&instance->logger, "auth", NULL, server,
 		         "password required for route '%s.%s'",
 		         route->rule->db_name, route->rule->user_name);
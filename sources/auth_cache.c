@@ -0,0 +1,388 @@
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+static inline uint32_t
+od_auth_cache_hash(char *key, int key_len)
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261U;
+	int i;
+	for (i = 0; i < key_len; i++) {
+		hash ^= (uint8_t)key[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+void
+od_auth_cache_init(od_auth_cache_t *cache)
+{
+	memset(cache->buckets, 0, sizeof(cache->buckets));
+	od_list_init(&cache->lru);
+	cache->count = 0;
+	cache->count_negative = 0;
+	cache->hits = 0;
+	cache->misses = 0;
+	od_list_init(&cache->flights);
+	cache->coalesced = 0;
+	pthread_mutex_init(&cache->lock, NULL);
+}
+
+static inline void
+od_auth_cache_entry_free(od_auth_cache_entry_t *entry)
+{
+	if (entry->password) {
+		memset(entry->password, 0, entry->password_len);
+		free(entry->password);
+	}
+	free(entry->key);
+	free(entry);
+}
+
+static inline void
+od_auth_cache_unlink(od_auth_cache_t *cache, od_auth_cache_entry_t *entry)
+{
+	od_auth_cache_entry_t **pos;
+	pos = &cache->buckets[entry->hash % OD_AUTH_CACHE_BUCKETS];
+	while (*pos != entry)
+		pos = &(*pos)->next;
+	*pos = entry->next;
+	od_list_unlink(&entry->link);
+	cache->count--;
+	if (entry->password == NULL)
+		cache->count_negative--;
+	od_auth_cache_entry_free(entry);
+}
+
+static inline void
+od_auth_cache_clear(od_auth_cache_t *cache)
+{
+	od_list_t *i, *n;
+	od_list_foreach_safe(&cache->lru, i, n) {
+		od_auth_cache_entry_t *entry;
+		entry = od_container_of(i, od_auth_cache_entry_t, link);
+		od_auth_cache_entry_free(entry);
+	}
+	memset(cache->buckets, 0, sizeof(cache->buckets));
+	od_list_init(&cache->lru);
+	cache->count = 0;
+	cache->count_negative = 0;
+}
+
+void
+od_auth_cache_free(od_auth_cache_t *cache)
+{
+	od_auth_cache_clear(cache);
+	pthread_mutex_destroy(&cache->lock);
+}
+
+void
+od_auth_cache_reset(od_auth_cache_t *cache)
+{
+	pthread_mutex_lock(&cache->lock);
+	od_auth_cache_clear(cache);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+static inline od_auth_cache_entry_t*
+od_auth_cache_find(od_auth_cache_t *cache, uint32_t hash,
+                   char *key, int key_len)
+{
+	od_auth_cache_entry_t *entry;
+	entry = cache->buckets[hash % OD_AUTH_CACHE_BUCKETS];
+	for (; entry; entry = entry->next) {
+		if (entry->hash == hash && entry->key_len == key_len &&
+		    memcmp(entry->key, key, key_len) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+int
+od_auth_cache_get(od_auth_cache_t *cache, char *key, int key_len,
+                  uint64_t now, kiwi_password_t *password)
+{
+	uint32_t hash = od_auth_cache_hash(key, key_len);
+	int rc = 0;
+	pthread_mutex_lock(&cache->lock);
+	od_auth_cache_entry_t *entry;
+	entry = od_auth_cache_find(cache, hash, key, key_len);
+	if (entry && entry->expire <= now) {
+		od_auth_cache_unlink(cache, entry);
+		entry = NULL;
+	}
+	if (entry == NULL) {
+		cache->misses++;
+		pthread_mutex_unlock(&cache->lock);
+		return 0;
+	}
+	/* negative entry */
+	password->password = NULL;
+	password->password_len = 0;
+	if (entry->password) {
+		password->password = malloc(entry->password_len);
+		if (password->password == NULL) {
+			rc = -1;
+			goto done;
+		}
+		memcpy(password->password, entry->password, entry->password_len);
+		password->password_len = entry->password_len;
+	}
+	/* move to the head of lru */
+	od_list_unlink(&entry->link);
+	od_list_push(&cache->lru, &entry->link);
+	cache->hits++;
+	rc = 1;
+done:
+	pthread_mutex_unlock(&cache->lock);
+	return rc;
+}
+
+int
+od_auth_cache_set(od_auth_cache_t *cache, char *key, int key_len,
+                  uint64_t expire, int max, kiwi_password_t *password)
+{
+	od_auth_cache_entry_t *entry;
+	entry = malloc(sizeof(*entry));
+	if (entry == NULL)
+		return -1;
+	memset(entry, 0, sizeof(*entry));
+	entry->key = malloc(key_len);
+	if (entry->key == NULL) {
+		free(entry);
+		return -1;
+	}
+	memcpy(entry->key, key, key_len);
+	entry->key_len = key_len;
+	entry->hash = od_auth_cache_hash(key, key_len);
+	entry->expire = expire;
+	if (password->password) {
+		entry->password = malloc(password->password_len);
+		if (entry->password == NULL) {
+			free(entry->key);
+			free(entry);
+			return -1;
+		}
+		memcpy(entry->password, password->password, password->password_len);
+		entry->password_len = password->password_len;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+
+	/* replace previous result */
+	od_auth_cache_entry_t *prev;
+	prev = od_auth_cache_find(cache, entry->hash, key, key_len);
+	if (prev)
+		od_auth_cache_unlink(cache, prev);
+
+	/* evict least recently used entries */
+	while (cache->count > 0 && cache->count >= max) {
+		od_auth_cache_entry_t *last;
+		last = od_container_of(cache->lru.prev, od_auth_cache_entry_t, link);
+		od_auth_cache_unlink(cache, last);
+	}
+
+	od_auth_cache_entry_t **bucket;
+	bucket = &cache->buckets[entry->hash % OD_AUTH_CACHE_BUCKETS];
+	entry->next = *bucket;
+	*bucket = entry;
+	od_list_init(&entry->link);
+	od_list_push(&cache->lru, &entry->link);
+	cache->count++;
+	if (entry->password == NULL)
+		cache->count_negative++;
+
+	pthread_mutex_unlock(&cache->lock);
+	return 0;
+}
+
+void
+od_auth_cache_stat(od_auth_cache_t *cache, int *count, int *count_negative,
+                   uint64_t *hits, uint64_t *misses, uint64_t *coalesced)
+{
+	pthread_mutex_lock(&cache->lock);
+	*count = cache->count;
+	*count_negative = cache->count_negative;
+	*hits = cache->hits;
+	*misses = cache->misses;
+	*coalesced = cache->coalesced;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+static inline void
+od_auth_flight_unref(od_auth_cache_t *cache, od_auth_flight_t *flight)
+{
+	pthread_mutex_lock(&cache->lock);
+	int refs = --flight->refs;
+	pthread_mutex_unlock(&cache->lock);
+	if (refs > 0)
+		return;
+	if (flight->password) {
+		memset(flight->password, 0, flight->password_len);
+		free(flight->password);
+	}
+	machine_channel_free(flight->channel);
+	free(flight->key);
+	free(flight);
+}
+
+static inline od_auth_flight_t*
+od_auth_flight_find(od_auth_cache_t *cache, char *key, int key_len)
+{
+	od_list_t *i;
+	od_list_foreach(&cache->flights, i) {
+		od_auth_flight_t *flight;
+		flight = od_container_of(i, od_auth_flight_t, link);
+		if (flight->key_len == key_len &&
+		    memcmp(flight->key, key, key_len) == 0)
+			return flight;
+	}
+	return NULL;
+}
+
+static inline od_auth_flight_t*
+od_auth_flight_attach(od_auth_cache_t *cache, od_auth_flight_t *flight)
+{
+	flight->refs++;
+	flight->waiters++;
+	cache->coalesced++;
+	return flight;
+}
+
+/* join lookup of the key in progress or start a new one,
+ * the starting caller becomes the leader and must call
+ * od_auth_flight_done() */
+od_auth_flight_t*
+od_auth_flight_join(od_auth_cache_t *cache, char *key, int key_len,
+                    int *is_leader)
+{
+	*is_leader = 0;
+	od_auth_flight_t *flight;
+	pthread_mutex_lock(&cache->lock);
+	flight = od_auth_flight_find(cache, key, key_len);
+	if (flight) {
+		od_auth_flight_attach(cache, flight);
+		pthread_mutex_unlock(&cache->lock);
+		return flight;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	od_auth_flight_t *new_flight;
+	new_flight = malloc(sizeof(*new_flight));
+	if (new_flight == NULL)
+		return NULL;
+	memset(new_flight, 0, sizeof(*new_flight));
+	new_flight->key = malloc(key_len);
+	if (new_flight->key == NULL) {
+		free(new_flight);
+		return NULL;
+	}
+	memcpy(new_flight->key, key, key_len);
+	new_flight->key_len = key_len;
+	new_flight->refs = 1;
+	/* waiters may run on other workers */
+	new_flight->channel = machine_channel_create(1);
+	if (new_flight->channel == NULL) {
+		free(new_flight->key);
+		free(new_flight);
+		return NULL;
+	}
+	od_list_init(&new_flight->link);
+
+	/* other lookup could have started meanwhile */
+	pthread_mutex_lock(&cache->lock);
+	flight = od_auth_flight_find(cache, key, key_len);
+	if (flight) {
+		od_auth_flight_attach(cache, flight);
+	} else {
+		od_list_append(&cache->flights, &new_flight->link);
+		*is_leader = 1;
+	}
+	pthread_mutex_unlock(&cache->lock);
+	if (*is_leader)
+		return new_flight;
+	machine_channel_free(new_flight->channel);
+	free(new_flight->key);
+	free(new_flight);
+	return flight;
+}
+
+int
+od_auth_flight_wait(od_auth_cache_t *cache, od_auth_flight_t *flight,
+                    kiwi_password_t *password)
+{
+	machine_msg_t *msg;
+	msg = machine_channel_read(flight->channel, UINT32_MAX);
+	if (msg == NULL) {
+		od_auth_flight_unref(cache, flight);
+		return -1;
+	}
+	machine_msg_free(msg);
+
+	/* result is not changed after done */
+	int rc = flight->rc;
+	password->password = NULL;
+	password->password_len = 0;
+	if (rc == 0 && flight->password) {
+		password->password = malloc(flight->password_len);
+		if (password->password == NULL) {
+			rc = -1;
+		} else {
+			memcpy(password->password, flight->password,
+			       flight->password_len);
+			password->password_len = flight->password_len;
+		}
+	}
+	od_auth_flight_unref(cache, flight);
+	return rc;
+}
+
+void
+od_auth_flight_done(od_auth_cache_t *cache, od_auth_flight_t *flight,
+                    int rc, kiwi_password_t *password)
+{
+	flight->rc = rc;
+	if (rc == 0 && password->password) {
+		flight->password = malloc(password->password_len);
+		if (flight->password == NULL) {
+			flight->rc = -1;
+		} else {
+			memcpy(flight->password, password->password,
+			       password->password_len);
+			flight->password_len = password->password_len;
+		}
+	}
+
+	/* no one joins after the flight is unlinked */
+	pthread_mutex_lock(&cache->lock);
+	od_list_unlink(&flight->link);
+	int waiters = flight->waiters;
+	pthread_mutex_unlock(&cache->lock);
+
+	while (waiters-- > 0) {
+		machine_msg_t *msg;
+		msg = machine_msg_create(0);
+		if (msg == NULL)
+			break;
+		machine_channel_write(flight->channel, msg);
+	}
+	od_auth_flight_unref(cache, flight);
+}
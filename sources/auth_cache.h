@@ -0,0 +1,78 @@
+#ifndef ODYSSEY_AUTH_CACHE_H
+#define ODYSSEY_AUTH_CACHE_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_auth_cache_entry od_auth_cache_entry_t;
+typedef struct od_auth_flight      od_auth_flight_t;
+typedef struct od_auth_cache       od_auth_cache_t;
+
+#define OD_AUTH_CACHE_BUCKETS 256
+
+/* Cache of auth_query results. Entries without password
+ * are negative: auth_query returned no rows for the user.
+ *
+ * Shared by all workers, protected by the mutex.
+*/
+
+struct od_auth_cache_entry
+{
+	char                  *key;
+	int                    key_len;
+	uint32_t               hash;
+	char                  *password;
+	int                    password_len;
+	uint64_t               expire;
+	od_auth_cache_entry_t *next;
+	od_list_t              link;
+};
+
+/* lookup in progress: concurrent lookups of the same key
+ * wait for the result of the first one instead of running
+ * their own */
+struct od_auth_flight
+{
+	char              *key;
+	int                key_len;
+	int                refs;
+	int                waiters;
+	int                rc;
+	char              *password;
+	int                password_len;
+	machine_channel_t *channel;
+	od_list_t          link;
+};
+
+struct od_auth_cache
+{
+	pthread_mutex_t        lock;
+	od_auth_cache_entry_t *buckets[OD_AUTH_CACHE_BUCKETS];
+	od_list_t              lru;
+	int                    count;
+	int                    count_negative;
+	uint64_t               hits;
+	uint64_t               misses;
+	od_list_t              flights;
+	uint64_t               coalesced;
+};
+
+void od_auth_cache_init(od_auth_cache_t*);
+void od_auth_cache_free(od_auth_cache_t*);
+void od_auth_cache_reset(od_auth_cache_t*);
+int  od_auth_cache_get(od_auth_cache_t*, char*, int, uint64_t, kiwi_password_t*);
+int  od_auth_cache_set(od_auth_cache_t*, char*, int, uint64_t, int,
+                       kiwi_password_t*);
+void od_auth_cache_stat(od_auth_cache_t*, int*, int*, uint64_t*, uint64_t*,
+                        uint64_t*);
+
+od_auth_flight_t*
+     od_auth_flight_join(od_auth_cache_t*, char*, int, int*);
+int  od_auth_flight_wait(od_auth_cache_t*, od_auth_flight_t*, kiwi_password_t*);
+void od_auth_flight_done(od_auth_cache_t*, od_auth_flight_t*, int,
+                         kiwi_password_t*);
+
+#endif /* ODYSSEY_AUTH_CACHE_H */
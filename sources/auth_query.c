@@ -186,13 +186,29 @@ od_auth_query_format(od_rule_t *rule, kiwi_var_t *user, char *peer,
 	return dst_pos - output;
 }
 
-int
-od_auth_query(od_global_t *global, od_rule_t *rule, char *peer,
-              kiwi_var_t *user,
-              kiwi_password_t *password)
+static inline int
+od_auth_query_cache_key(od_rule_t *rule, kiwi_var_t *user, char *peer,
+                        char *output, int output_len)
+{
+	/* peer is a part of the key only when the query depends on it */
+	int peer_len = 0;
+	if (strstr(rule->auth_query, "%h"))
+		peer_len = strlen(peer) + 1;
+	if (user->value_len + peer_len > output_len)
+		return -1;
+	memcpy(output, user->value, user->value_len);
+	memcpy(output + user->value_len, peer, peer_len);
+	return user->value_len + peer_len;
+}
+
+static inline int
+od_auth_query_run(od_global_t *global, od_rule_t *rule, char *peer,
+                  kiwi_var_t *user,
+                  kiwi_password_t *password)
 {
 	od_instance_t *instance = global->instance;
 	od_router_t *router = global->router;
+	int rc;
 
 	/* create internal auth client */
 	od_client_t *auth_client;
@@ -235,7 +251,6 @@ od_auth_query(od_global_t *global, od_rule_t *rule, char *peer,
 	         server->id.id);
 
 	/* connect to server, if necessary */
-	int rc;
 	if (server->io.io == NULL) {
 		rc = od_backend_connect(server, "auth_query", NULL);
 		if (rc == -1) {
@@ -265,3 +280,59 @@ od_auth_query(od_global_t *global, od_rule_t *rule, char *peer,
 	od_client_free(auth_client);
 	return 0;
 }
+
+int
+od_auth_query(od_global_t *global, od_rule_t *rule, char *peer,
+              kiwi_var_t *user,
+              kiwi_password_t *password)
+{
+	od_instance_t *instance = global->instance;
+	od_auth_cache_t *cache = &rule->auth_query_cache;
+	int rc;
+
+	char key[512];
+	int  key_len;
+	key_len = od_auth_query_cache_key(rule, user, peer, key, sizeof(key));
+
+	/* use cached result, if possible */
+	if (key_len != -1 && rule->auth_query_cache_ttl > 0) {
+		rc = od_auth_cache_get(cache, key, key_len, machine_time_ms(),
+		                       password);
+		if (rc == 1) {
+			od_debug(&instance->logger, "auth_query", NULL, NULL,
+			         "cache hit for '%s'", user->value);
+			return 0;
+		}
+		if (rc == -1)
+			return -1;
+	}
+
+	/* wait for the result of the same lookup started by other
+	 * client instead of running the query again */
+	od_auth_flight_t *flight = NULL;
+	if (key_len != -1) {
+		int is_leader;
+		flight = od_auth_flight_join(cache, key, key_len, &is_leader);
+		if (flight && ! is_leader) {
+			od_debug(&instance->logger, "auth_query", NULL, NULL,
+			         "waiting for concurrent lookup of '%s'", user->value);
+			return od_auth_flight_wait(cache, flight, password);
+		}
+	}
+
+	rc = od_auth_query_run(global, rule, peer, user, password);
+
+	/* cache result, query errors are never cached */
+	if (rc == 0 && key_len != -1 && rule->auth_query_cache_ttl > 0) {
+		int ttl = rule->auth_query_cache_ttl;
+		if (password->password == NULL)
+			ttl = rule->auth_query_cache_negative_ttl;
+		if (ttl > 0)
+			od_auth_cache_set(cache, key, key_len,
+			                  machine_time_ms() + (uint64_t)ttl * 1000,
+			                  rule->auth_query_cache_max, password);
+	}
+	if (flight)
+		od_auth_flight_done(cache, flight, rc, password);
+	return rc;
+}
@@ -14,6 +14,8 @@
 #include <inttypes.h>
 #include <assert.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include <machinarium.h>
 #include <kiwi.h>
@@ -26,11 +28,9 @@ od_backend_close(od_server_t *server)
 	assert(server->io.io == NULL);
 	assert(server->tls == NULL);
 	server->is_transaction = 0;
-	server->idle_time = 0;
+	server->idle_since = 0;
 	kiwi_key_init(&server->key);
 	kiwi_key_init(&server->key_client);
-	od_relay_free(&server->relay);
-	od_io_free(&server->io);
 	od_server_free(server);
 }
 
@@ -47,7 +47,7 @@ od_backend_terminate(od_server_t *server)
 void
 od_backend_close_connection(od_server_t *server)
 {
-	if (machine_connected(server->io.io))
+	if (server->io.io && machine_connected(server->io.io))
 		od_backend_terminate(server);
 
 	od_io_close(&server->io);
@@ -57,10 +57,11 @@ od_backend_close_connection(od_server_t *server)
 		server->error_connect = NULL;
 	}
 
-	if (server->tls) {
-		machine_tls_free(server->tls);
-		server->tls = NULL;
-	}
+	/* tls handler is owned by storage */
+	server->tls = NULL;
+
+	/* statements are gone with the connection */
+	od_prepared_server_reset(&server->prepared);
 }
 
 void
@@ -115,7 +116,8 @@ od_backend_ready(od_server_t *server, char *data, uint32_t size)
 }
 
 static inline int
-od_backend_startup(od_server_t *server, kiwi_params_t *route_params)
+od_backend_startup(od_server_t *server, od_rule_storage_t *storage,
+                   kiwi_params_t *route_params, uint32_t timeout)
 {
 	od_instance_t *instance = server->global->instance;
 	od_route_t *route = server->route;
@@ -149,12 +151,26 @@ od_backend_startup(od_server_t *server, kiwi_params_t *route_params)
 		return -1;
 	}
 
+	/* the rest of the session is compressed, the startup packet
+	 * is sent as is so the peer can tell what to expect. Mux links
+	 * are compressed as a whole */
+	if (storage->compression &&
+	    storage->storage_type == OD_RULE_STORAGE_REMOTE) {
+		rc = machine_set_compression(server->io.io, OD_IO_COMPRESSION_LEVEL);
+		if (rc == -1) {
+			od_error(&instance->logger, "startup", NULL, server,
+			         "failed to enable compression: %s",
+			         od_io_error(&server->io));
+			return -1;
+		}
+	}
+
 	/* update request count and sync state */
 	od_server_sync_request(server, 1);
 
 	while (1)
 	{
-		msg = od_read(&server->io, UINT32_MAX);
+		msg = od_read(&server->io, timeout);
 		if (msg == NULL) {
 			od_error(&instance->logger, "startup", NULL, server,
 			         "read error: %s",
@@ -235,25 +251,61 @@ od_backend_startup(od_server_t *server, kiwi_params_t *route_params)
 	return 0;
 }
 
-static inline int
-od_backend_connect_to(od_server_t *server, char *context,
-                      od_rule_storage_t *storage)
+int
+od_backend_connect_socket(od_server_t *server, char *context,
+                          od_rule_storage_t *storage, uint32_t timeout)
 {
 	od_instance_t *instance = server->global->instance;
 	assert(server->io.io == NULL);
 
+	/* storage host chosen for the connection */
+	char *host = NULL;
+	int   port = storage->port;
+	if (storage->endpoints_count > 0 && server->endpoint == -1) {
+		od_error(&instance->logger, context, server->client, server,
+		         "no storage host available for '%s'",
+		         storage->target_session_attrs ?
+		         storage->target_session_attrs : "any");
+		return -1;
+	}
+	if (server->endpoint >= 0) {
+		host = storage->endpoints[server->endpoint].host;
+		port = storage->endpoints[server->endpoint].port;
+	}
+
+	/* unix socket in unix_socket_dir or in the directory set as host */
+	int is_unix = host == NULL || host[0] == '/';
+
 	/* create io handle */
 	machine_io_t *io;
 	io = machine_io_create();
 	if (io == NULL)
 		return -1;
 
-	/* set network options */
-	machine_set_nodelay(io, instance->config.nodelay);
-	if (instance->config.keepalive > 0)
-		machine_set_keepalive(io, 1, instance->config.keepalive);
+	/* set network options, local connections need neither tcp
+	 * options nor tls, relay throughput is bound by socket buffers */
+	int sndbuf = storage->sndbuf;
+	int rcvbuf = storage->rcvbuf;
+	if (is_unix) {
+		if (sndbuf == 0)
+			sndbuf = OD_IO_UNIX_BUFSIZE;
+		if (rcvbuf == 0)
+			rcvbuf = OD_IO_UNIX_BUFSIZE;
+	} else {
+		machine_set_nodelay(io, instance->config.nodelay);
+		if (instance->config.keepalive > 0)
+			machine_set_keepalive(io, 1, instance->config.keepalive);
+		machine_set_notsent_lowat(io, storage->tcp_notsent_lowat);
+		machine_set_user_timeout(io, storage->tcp_user_timeout);
+		machine_set_quickack(io, storage->tcp_quickack);
+		machine_set_fastopen_connect(io, storage->tcp_fastopen_connect);
+	}
+	machine_set_bufsize(io, sndbuf, rcvbuf);
+	machine_set_busy_poll(io, storage->busy_poll);
+	machine_set_zerocopy(io, storage->zerocopy_threshold);
 	int rc;
-	rc = od_io_prepare(&server->io, io, instance->config.readahead);
+	rc = od_io_prepare(&server->io, io, instance->config.readahead,
+	                   instance->config.readahead_ring);
 	if (rc == -1) {
 		od_error(&instance->logger, context, NULL, server,
 		         "failed to set server io");
@@ -263,10 +315,18 @@ od_backend_connect_to(od_server_t *server, char *context,
 	}
 
 	/* set tls options */
-	if (storage->tls_mode != OD_RULE_TLS_DISABLE) {
-		server->tls = od_tls_backend(storage);
-		if (server->tls == NULL)
-			return -1;
+	if (storage->tls_mode != OD_RULE_TLS_DISABLE && ! is_unix) {
+		/* tls handler is shared by storage connections, which
+		 * allows to resume tls session on reconnect */
+		if (storage->tls_handler == NULL) {
+			machine_tls_t *tls;
+			tls = od_tls_backend(storage);
+			if (tls == NULL)
+				return -1;
+			if (! __sync_bool_compare_and_swap(&storage->tls_handler, NULL, tls))
+				machine_tls_free(tls);
+		}
+		server->tls = storage->tls_handler;
 	}
 
 	uint64_t time_connect_start = 0;
@@ -276,41 +336,55 @@ od_backend_connect_to(od_server_t *server, char *context,
 	struct sockaddr_un   saddr_un;
 	struct sockaddr_in   saddr_v4;
 	struct sockaddr_in6  saddr_v6;
+	struct sockaddr_storage saddr_cached;
 	struct sockaddr     *saddr;
 	struct addrinfo *ai = NULL;
 
 	/* resolve server address */
-	if (storage->host)
+	if (! is_unix)
 	{
 		/* assume IPv6 or IPv4 is specified */
 		int rc_resolve = -1;
-		if (strchr(storage->host, ':')) {
+		if (strchr(host, ':')) {
 			/* v6 */
 			memset(&saddr_v6, 0, sizeof(saddr_v6));
 			saddr_v6.sin6_family = AF_INET6;
-			saddr_v6.sin6_port   = htons(storage->port);
-			rc_resolve = inet_pton(AF_INET6, storage->host, &saddr_v6.sin6_addr);
+			saddr_v6.sin6_port   = htons(port);
+			rc_resolve = inet_pton(AF_INET6, host, &saddr_v6.sin6_addr);
 			saddr = (struct sockaddr*)&saddr_v6;
 		} else {
 			/* v4 or hostname */
 			memset(&saddr_v4, 0, sizeof(saddr_v4));
 			saddr_v4.sin_family = AF_INET;
-			saddr_v4.sin_port   = htons(storage->port);
-			rc_resolve = inet_pton(AF_INET, storage->host, &saddr_v4.sin_addr);
+			saddr_v4.sin_port   = htons(port);
+			rc_resolve = inet_pton(AF_INET, host, &saddr_v4.sin_addr);
 			saddr = (struct sockaddr*)&saddr_v4;
 		}
 
+		/* use addresses cached by the system */
+		if (rc_resolve != 1 && instance->config.dns_cache_ttl > 0) {
+			od_system_t *system = server->global->system;
+			rc = od_dns_cache_resolve(&system->dns, host, port, &saddr_cached);
+			if (rc == -1) {
+				od_error(&instance->logger, context, NULL, server,
+				         "failed to resolve %s:%d",
+				         host,
+				         port);
+				return -1;
+			}
+			saddr = (struct sockaddr*)&saddr_cached;
+		} else
 		/* schedule getaddrinfo() execution */
 		if (rc_resolve != 1) {
-			char port[16];
-			od_snprintf(port, sizeof(port), "%d", storage->port);
+			char port_str[16];
+			od_snprintf(port_str, sizeof(port_str), "%d", port);
 
-			rc = machine_getaddrinfo(storage->host, port, NULL, &ai, 0);
+			rc = machine_getaddrinfo(host, port_str, NULL, &ai, 0);
 			if (rc != 0) {
 				od_error(&instance->logger, context, NULL, server,
 				         "failed to resolve %s:%d",
-				         storage->host,
-				         storage->port);
+				         host,
+				         port);
 				return -1;
 			}
 			assert(ai != NULL);
@@ -323,8 +397,8 @@ od_backend_connect_to(od_server_t *server, char *context,
 		saddr = (struct sockaddr*)&saddr_un;
 		od_snprintf(saddr_un.sun_path, sizeof(saddr_un.sun_path),
 		            "%s/.s.PGSQL.%d",
-		            instance->config.unix_socket_dir,
-		            storage->port);
+		            host ? host : instance->config.unix_socket_dir,
+		            port);
 	}
 
 	uint64_t time_resolve = 0;
@@ -332,14 +406,14 @@ od_backend_connect_to(od_server_t *server, char *context,
 		time_resolve = machine_time_us() - time_connect_start;
 
 	/* connect to server */
-	rc = machine_connect(server->io.io, saddr, UINT32_MAX);
+	rc = machine_connect(server->io.io, saddr, timeout);
 	if (ai)
 		freeaddrinfo(ai);
 	if (rc == -1) {
-		if (storage->host) {
+		if (! is_unix) {
 			od_error(&instance->logger, context, server->client, server,
-			         "failed to connect to %s:%d", storage->host,
-			         storage->port);
+			         "failed to connect to %s:%d", host,
+			         port);
 		} else {
 			od_error(&instance->logger, context, server->client, server,
 			         "failed to connect to %s", saddr_un.sun_path);
@@ -348,7 +422,7 @@ od_backend_connect_to(od_server_t *server, char *context,
 	}
 
 	/* do tls handshake */
-	if (storage->tls_mode != OD_RULE_TLS_DISABLE) {
+	if (storage->tls_mode != OD_RULE_TLS_DISABLE && ! is_unix) {
 		rc = od_tls_backend_connect(server, &instance->logger, storage);
 		if (rc == -1)
 			return -1;
@@ -360,11 +434,11 @@ od_backend_connect_to(od_server_t *server, char *context,
 
 	/* log server connection */
 	if (instance->config.log_session) {
-		if (storage->host) {
+		if (! is_unix) {
 			od_log(&instance->logger, context, server->client, server,
 			       "new server connection %s:%d (connect time: %d usec, resolve time: %d usec)",
-			       storage->host,
-			       storage->port,
+			       host,
+			       port,
 			       (int)time_connect,
 			       (int)time_resolve);
 		} else {
@@ -379,34 +453,143 @@ od_backend_connect_to(od_server_t *server, char *context,
 	return 0;
 }
 
+static inline int
+od_backend_connect_to(od_server_t *server, char *context,
+                      od_rule_storage_t *storage, uint32_t timeout)
+{
+	/* logical connection over a link shared with other servers */
+	if (storage->storage_type == OD_RULE_STORAGE_MUX)
+		return od_mux_connect(server, context, storage, timeout);
+	return od_backend_connect_socket(server, context, storage, timeout);
+}
+
+static inline void
+od_backend_connect_account(od_server_t *server, int rc, uint64_t time_start)
+{
+	/* update connect time or errors of the storage host */
+	if (server->endpoint == -1)
+		return;
+	od_route_t *route = server->route;
+	uint64_t now = machine_time_us();
+	od_route_lock(route, OD_LOCK_ATTACH);
+	if (rc == -1)
+		od_server_pool_endpoint_failed(&route->server_pool, server->endpoint, now);
+	else
+		od_server_pool_endpoint_connected(&route->server_pool, server->endpoint,
+		                                  now - time_start);
+	od_route_unlock(route);
+}
+
+static inline void
+od_backend_connect_breaker(od_server_t *server, char *context,
+                           od_rule_storage_t *storage, int rc)
+{
+	/* storage is considered alive when it has replied, even with error */
+	if (rc == 0 || server->error_connect) {
+		od_breaker_success(&storage->breaker);
+		return;
+	}
+	od_instance_t *instance = server->global->instance;
+	uint64_t window;
+	window = od_breaker_failure(&storage->breaker, machine_time_us(),
+	                            storage->breaker_threshold,
+	                            storage->breaker_backoff * 1000ull,
+	                            storage->breaker_backoff_max * 1000ull);
+	if (window)
+		od_error(&instance->logger, context, server->client, server,
+		         "storage '%s' is failing, connects are rejected for %d ms",
+		         storage->name, (int)(window / 1000));
+}
+
 int
 od_backend_connect(od_server_t *server, char *context, kiwi_params_t *route_params)
 {
+	od_instance_t *instance = server->global->instance;
 	od_route_t *route = server->route;
 	assert(route != NULL);
+	if (server->client)
+		od_client_wait(server->client, OD_CLIENT_WAIT_CONNECT);
 
 	od_rule_storage_t *storage;
-	storage = route->rule->storage;
+	storage = od_route_storage(route);
+
+	/* fail fast, while circuit breaker of the storage is open */
+	if (storage->breaker_threshold) {
+		uint64_t left = 0;
+		if (! od_breaker_allow(&storage->breaker, machine_time_us(), &left)) {
+			od_debug(&instance->logger, context, server->client, server,
+			         "storage '%s' is failing, connect rejected (%d ms left)",
+			         storage->name, (int)(left / 1000));
+			return -1;
+		}
+	}
+
+	/* choose storage host */
+	if (storage->endpoints_count > 0) {
+		od_route_lock(route, OD_LOCK_ATTACH);
+		server->endpoint = od_server_pool_endpoint_select(&route->server_pool,
+		                                                  storage,
+		                                                  machine_time_us());
+		od_route_unlock(route);
+	}
+	uint64_t time_start = machine_time_us();
 
 	/* connect to server */
+	od_trace1(backend__connect__start, server->id.id_a);
 	int rc;
-	rc = od_backend_connect_to(server, context, storage);
-	if (rc == -1)
+	rc = od_backend_connect_to(server, context, storage, UINT32_MAX);
+	if (rc == -1) {
+		od_trace2(backend__connect__done, server->id.id_a, rc);
+		od_backend_connect_account(server, rc, time_start);
+		if (storage->breaker_threshold)
+			od_backend_connect_breaker(server, context, storage, rc);
 		return -1;
+	}
+	od_readahead_set_bounds(&server->io.readahead,
+	                        route->rule->readahead_min,
+	                        route->rule->readahead_max);
+
+	/* recycle the connection after server_lifetime, shortened by up
+	 * to a tenth so servers opened together do not close at once */
+	if (route->rule->server_lifetime) {
+		uint64_t lifetime = route->rule->server_lifetime * 1000000ull;
+		server->lifetime_end = time_start + lifetime -
+		                       machine_lrand48() % (lifetime / 10 + 1);
+	}
 
 	/* send startup and do initial configuration */
-	rc = od_backend_startup(server, route_params);
+	rc = od_backend_startup(server, storage, route_params, UINT32_MAX);
+	od_trace2(backend__connect__done, server->id.id_a, rc);
+	od_backend_connect_account(server, rc, time_start);
+	if (storage->breaker_threshold)
+		od_backend_connect_breaker(server, context, storage, rc);
 	return rc;
 }
 
+int
+od_backend_connect_endpoint(od_server_t *server, char *context,
+                            od_rule_storage_t *storage, int endpoint,
+                            uint32_t timeout)
+{
+	/* connect to the storage host directly, server is not accounted
+	 * in the route server pool */
+	server->endpoint = endpoint;
+	int rc;
+	rc = od_backend_connect_to(server, context, storage, timeout);
+	if (rc == -1)
+		return -1;
+	return od_backend_startup(server, storage, NULL, timeout);
+}
+
 int
 od_backend_connect_cancel(od_server_t *server, od_rule_storage_t *storage,
-                          kiwi_key_t *key)
+                          int endpoint, kiwi_key_t *key, uint32_t timeout)
 {
 	od_instance_t *instance = server->global->instance;
-	/* connect to server */
+	/* connect to the host of the cancelled server */
+	server->endpoint = endpoint;
 	int rc;
-	rc = od_backend_connect_to(server, "cancel", storage);
+	rc = od_backend_connect_to(server, "cancel", storage, timeout);
 	if (rc == -1)
 		return -1;
 	/* send cancel request */
@@ -450,11 +633,16 @@ od_backend_update_parameter(od_server_t *server, char *context,
 	         "%.*s = %.*s",
 	         name_len, name, value_len, value);
 
-	if (server_only)
+	if (server_only) {
 		kiwi_vars_update(&server->vars, name, name_len, value, value_len);
-	else
+		/* server state may not match client parameters anymore */
+		server->deploy_hash = 0;
+	} else {
 		kiwi_vars_update_both(&client->vars, &server->vars, name, name_len,
 		                      value, value_len);
+		if (server->deploy_hash)
+			server->deploy_hash = client->vars.hash;
+	}
 	return 0;
 }
 
@@ -535,3 +723,24 @@ od_backend_query(od_server_t *server, char *context, char *query, int len, uint3
 	rc = od_backend_ready_wait(server, context, 1, timeout);
 	return rc;
 }
+
+int
+od_backend_tcp_info(od_server_t *server, od_server_pool_tcp_t *sample)
+{
+	/* unix socket and multiplexed connections have no TCP_INFO */
+	if (server->io.io == NULL)
+		return -1;
+	struct tcp_info info;
+	socklen_t info_len = sizeof(info);
+	int rc;
+	rc = getsockopt(machine_fd(server->io.io), IPPROTO_TCP, TCP_INFO,
+	                &info, &info_len);
+	if (rc == -1)
+		return -1;
+	sample->rtt     = info.tcpi_rtt;
+	sample->rttvar  = info.tcpi_rttvar;
+	sample->cwnd    = info.tcpi_snd_cwnd;
+	sample->retrans = info.tcpi_total_retrans - server->tcp_retrans;
+	server->tcp_retrans = info.tcpi_total_retrans;
+	return 0;
+}
@@ -8,7 +8,10 @@
 */
 
 int  od_backend_connect(od_server_t*, char*, kiwi_params_t*);
-int  od_backend_connect_cancel(od_server_t*, od_rule_storage_t*, kiwi_key_t*);
+int  od_backend_connect_socket(od_server_t*, char*, od_rule_storage_t*, uint32_t);
+int  od_backend_connect_endpoint(od_server_t*, char*, od_rule_storage_t*, int, uint32_t);
+int  od_backend_connect_cancel(od_server_t*, od_rule_storage_t*, int, kiwi_key_t*,
+                               uint32_t);
 void od_backend_close_connection(od_server_t*);
 void od_backend_close(od_server_t*);
 void od_backend_error(od_server_t*, char*, char*, uint32_t);
@@ -16,5 +19,6 @@ int  od_backend_update_parameter(od_server_t*, char*, char*, uint32_t, int);
 int  od_backend_ready(od_server_t*, char*, uint32_t);
 int  od_backend_ready_wait(od_server_t*, char*, int, uint32_t);
 int  od_backend_query(od_server_t*, char*, char*, int, uint32_t);
+int  od_backend_tcp_info(od_server_t*, od_server_pool_tcp_t*);
 
 #endif /* ODYSSEY_BACKEND_H */
@@ -0,0 +1,234 @@
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+static inline int
+od_backlog_kernel(uint64_t *overflows, uint64_t *drops)
+{
+	/* TcpExt section is a line of names followed by a line of values */
+	FILE *file = fopen("/proc/net/netstat", "r");
+	if (file == NULL)
+		return -1;
+	char names[4096];
+	char values[4096];
+	int found = 0;
+	while (fgets(names, sizeof(names), file)) {
+		if (strncmp(names, "TcpExt:", 7) != 0)
+			continue;
+		if (fgets(values, sizeof(values), file) == NULL)
+			break;
+		found = 1;
+		break;
+	}
+	fclose(file);
+	if (! found)
+		return -1;
+
+	int matched = 0;
+	char *name_pos;
+	char *value_pos;
+	char *name  = strtok_r(names, " \n", &name_pos);
+	char *value = strtok_r(values, " \n", &value_pos);
+	while (name && value) {
+		if (strcmp(name, "ListenOverflows") == 0) {
+			*overflows = strtoull(value, NULL, 10);
+			matched++;
+		} else
+		if (strcmp(name, "ListenDrops") == 0) {
+			*drops = strtoull(value, NULL, 10);
+			matched++;
+		}
+		name  = strtok_r(NULL, " \n", &name_pos);
+		value = strtok_r(NULL, " \n", &value_pos);
+	}
+	if (matched != 2)
+		return -1;
+	return 0;
+}
+
+static inline od_backlog_listen_t*
+od_backlog_listen_of(od_backlog_t *backlog, od_config_listen_t *config)
+{
+	od_list_t *i;
+	od_list_foreach(&backlog->listens, i) {
+		od_backlog_listen_t *listen;
+		listen = od_container_of(i, od_backlog_listen_t, link);
+		if (listen->port == config->port &&
+		    strcmp(listen->host, config->host) == 0)
+			return listen;
+	}
+	od_backlog_listen_t *listen = malloc(sizeof(od_backlog_listen_t));
+	if (listen == NULL)
+		return NULL;
+	memset(listen, 0, sizeof(od_backlog_listen_t));
+	listen->hgram = od_hgram_allocate(OD_BACKLOG_HGRAM_PRECISION);
+	if (listen->hgram == NULL) {
+		free(listen);
+		return NULL;
+	}
+	od_snprintf(listen->host, sizeof(listen->host), "%s", config->host);
+	listen->port = config->port;
+	od_list_init(&listen->link);
+	od_list_append(&backlog->listens, &listen->link);
+	return listen;
+}
+
+static inline void
+od_backlog_sample(od_backlog_t *backlog)
+{
+	od_system_t *system = backlog->global->system;
+
+	/* sum depth of the sockets of each listen, the listen is full
+	 * when any of its sockets is */
+	od_list_t *i;
+	od_list_foreach(&backlog->listens, i) {
+		od_backlog_listen_t *listen;
+		listen = od_container_of(i, od_backlog_listen_t, link);
+		listen->depth   = 0;
+		listen->backlog = 0;
+		listen->is_full = 0;
+	}
+	od_list_foreach(&system->servers, i) {
+		od_system_server_t *server;
+		server = od_container_of(i, od_system_server_t, link);
+		if (server->config->host == NULL)
+			continue;
+		int fd = machine_fd(server->io);
+		if (fd == -1)
+			continue;
+		struct tcp_info info;
+		socklen_t info_len = sizeof(info);
+		int rc;
+		rc = getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &info_len);
+		if (rc == -1 || info.tcpi_state != TCP_LISTEN)
+			continue;
+		od_backlog_listen_t *listen;
+		listen = od_backlog_listen_of(backlog, server->config);
+		if (listen == NULL)
+			continue;
+		listen->depth   += info.tcpi_unacked;
+		listen->backlog += info.tcpi_sacked;
+		if (info.tcpi_unacked >= info.tcpi_sacked)
+			listen->is_full = 1;
+	}
+	od_list_foreach(&backlog->listens, i) {
+		od_backlog_listen_t *listen;
+		listen = od_container_of(i, od_backlog_listen_t, link);
+		listen->samples++;
+		od_hgram_add_data_point(listen->hgram, listen->depth);
+		if (listen->depth > listen->depth_max)
+			listen->depth_max = listen->depth;
+		if (listen->is_full)
+			listen->full++;
+	}
+
+	uint64_t overflows;
+	uint64_t drops;
+	if (backlog->kernel && od_backlog_kernel(&overflows, &drops) == 0) {
+		backlog->overflows = overflows - backlog->overflows_start;
+		backlog->drops     = drops - backlog->drops_start;
+	}
+}
+
+static inline void
+od_backlog(void *arg)
+{
+	od_backlog_t *backlog = arg;
+	od_instance_t *instance = backlog->global->instance;
+	for (;;)
+	{
+		machine_sleep(instance->config.accept_stats_interval);
+		if (od_system_is_draining(backlog->global))
+			break;
+		pthread_mutex_lock(&backlog->lock);
+		od_backlog_sample(backlog);
+		pthread_mutex_unlock(&backlog->lock);
+	}
+}
+
+int
+od_backlog_start(od_global_t *global)
+{
+	/* run by the system machine once listen servers are started */
+	od_instance_t *instance = global->instance;
+	od_system_t *system = global->system;
+	od_backlog_t *backlog = &system->backlog;
+	backlog->global = global;
+	if (instance->config.accept_stats_interval == 0)
+		return 0;
+
+	int rc;
+	rc = od_backlog_kernel(&backlog->overflows_start, &backlog->drops_start);
+	backlog->kernel = rc == 0;
+
+	int64_t coroutine_id;
+	coroutine_id = machine_coroutine_create(od_backlog, backlog);
+	if (coroutine_id == -1) {
+		od_error(&instance->logger, "system", NULL, NULL,
+		         "failed to start accept stats coroutine");
+		return -1;
+	}
+	return 0;
+}
+
+void
+od_backlog_login(od_client_t *client)
+{
+	/* startup to authentication latency, recorded by the worker
+	 * which authenticated the client */
+	if (client->worker_id == -1 || client->time_startup == 0)
+		return;
+	od_worker_t *worker;
+	worker = od_worker_pool_get(client->global->worker_pool, client->worker_id);
+	if (worker->login_hgram == NULL)
+		return;
+	od_hgram_add_data_point(worker->login_hgram,
+	                        machine_time_us() - client->time_startup);
+}
+
+int
+od_backlog_merge(od_global_t *global, struct od_hgram **accept,
+                 struct od_hgram **login)
+{
+	/* sum of worker histograms since start */
+	od_worker_pool_t *worker_pool = global->worker_pool;
+	*accept = od_hgram_allocate(OD_BACKLOG_HGRAM_PRECISION);
+	*login  = od_hgram_allocate(OD_BACKLOG_HGRAM_PRECISION);
+	if (*accept == NULL || *login == NULL) {
+		if (*accept)
+			od_hgram_free(*accept);
+		if (*login)
+			od_hgram_free(*login);
+		return -1;
+	}
+	int i;
+	for (i = 0; i < od_worker_pool_total(worker_pool); i++) {
+		od_worker_t *worker = od_worker_pool_get(worker_pool, i);
+		if (worker->accept_hgram)
+			od_hgram_merge(*accept, worker->accept_hgram);
+		if (worker->login_hgram)
+			od_hgram_merge(*login, worker->login_hgram);
+	}
+	od_hgram_freeze(*accept, NULL, 0);
+	od_hgram_freeze(*login, NULL, 0);
+	return 0;
+}
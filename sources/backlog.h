@@ -0,0 +1,71 @@
+#ifndef ODYSSEY_BACKLOG_H
+#define ODYSSEY_BACKLOG_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_backlog_listen od_backlog_listen_t;
+typedef struct od_backlog        od_backlog_t;
+
+/* Accept path statistics, enabled by accept_stats_interval.
+ *
+ * The system machine samples accept queue depth of every tcp
+ * listen socket with TCP_INFO, where a listening socket reports
+ * queued connections as unacked and its backlog as sacked. Samples
+ * of the sockets of one listen are summed. Kernel ListenOverflows
+ * and ListenDrops are read from /proc/net/netstat for the whole
+ * host, reported since start.
+ *
+ * Accept to worker start and startup to authentication times are
+ * recorded by workers into their own histograms. */
+
+/* depth in connections, latencies in microseconds */
+#define OD_BACKLOG_HGRAM_PRECISION 4
+
+struct od_backlog_listen
+{
+	char             host[64];
+	int              port;
+	uint32_t         depth;
+	uint32_t         depth_max;
+	uint32_t         backlog;
+	int              is_full;
+	uint64_t         samples;
+	uint64_t         full;
+	struct od_hgram *hgram;
+	od_list_t        link;
+};
+
+struct od_backlog
+{
+	pthread_mutex_t lock;
+	od_list_t       listens;
+	int             kernel;
+	uint64_t        overflows_start;
+	uint64_t        drops_start;
+	uint64_t        overflows;
+	uint64_t        drops;
+	od_global_t    *global;
+};
+
+static inline void
+od_backlog_init(od_backlog_t *backlog)
+{
+	pthread_mutex_init(&backlog->lock, NULL);
+	od_list_init(&backlog->listens);
+	backlog->kernel          = 0;
+	backlog->overflows_start = 0;
+	backlog->drops_start     = 0;
+	backlog->overflows       = 0;
+	backlog->drops           = 0;
+	backlog->global          = NULL;
+}
+
+int  od_backlog_start(od_global_t*);
+void od_backlog_login(od_client_t*);
+int  od_backlog_merge(od_global_t*, struct od_hgram**, struct od_hgram**);
+
+#endif /* ODYSSEY_BACKLOG_H */
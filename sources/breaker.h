@@ -0,0 +1,110 @@
+#ifndef ODYSSEY_BREAKER_H
+#define ODYSSEY_BREAKER_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+/* Circuit breaker of storage connects. After threshold consecutive
+ * failures connects fail fast until the backoff window ends, then a
+ * single probe connect is let through. A failed probe doubles the
+ * window up to the max, a successful connect closes the breaker.
+*/
+
+typedef struct od_breaker od_breaker_t;
+
+struct od_breaker
+{
+	pthread_mutex_t lock;
+	int             failures;
+	int             probe;
+	uint64_t        backoff;
+	uint64_t        open_until;
+};
+
+static inline void
+od_breaker_init(od_breaker_t *breaker)
+{
+	pthread_mutex_init(&breaker->lock, NULL);
+	breaker->failures   = 0;
+	breaker->probe      = 0;
+	breaker->backoff    = 0;
+	breaker->open_until = 0;
+}
+
+static inline void
+od_breaker_free(od_breaker_t *breaker)
+{
+	pthread_mutex_destroy(&breaker->lock);
+}
+
+static inline int
+od_breaker_allow(od_breaker_t *breaker, uint64_t now, uint64_t *left)
+{
+	/* closed breaker is checked without the lock */
+	if (od_likely(breaker->backoff == 0))
+		return 1;
+	int rc = 1;
+	pthread_mutex_lock(&breaker->lock);
+	if (breaker->backoff == 0) {
+		/* closed meanwhile */
+	} else
+	if (now < breaker->open_until) {
+		*left = breaker->open_until - now;
+		rc = 0;
+	} else
+	if (breaker->probe) {
+		*left = 0;
+		rc = 0;
+	} else {
+		breaker->probe = 1;
+	}
+	pthread_mutex_unlock(&breaker->lock);
+	return rc;
+}
+
+static inline void
+od_breaker_success(od_breaker_t *breaker)
+{
+	if (od_likely(breaker->failures == 0 && breaker->backoff == 0))
+		return;
+	pthread_mutex_lock(&breaker->lock);
+	breaker->failures   = 0;
+	breaker->probe      = 0;
+	breaker->backoff    = 0;
+	breaker->open_until = 0;
+	pthread_mutex_unlock(&breaker->lock);
+}
+
+/* returns backoff window in microseconds, if the breaker has opened */
+static inline uint64_t
+od_breaker_failure(od_breaker_t *breaker, uint64_t now, int threshold,
+                   uint64_t backoff_min, uint64_t backoff_max)
+{
+	uint64_t window = 0;
+	pthread_mutex_lock(&breaker->lock);
+	breaker->failures++;
+	if (breaker->probe || (breaker->backoff == 0 &&
+	                       breaker->failures >= threshold)) {
+		if (breaker->backoff == 0)
+			breaker->backoff = backoff_min;
+		else
+			breaker->backoff *= 2;
+		if (breaker->backoff > backoff_max)
+			breaker->backoff = backoff_max;
+		if (breaker->backoff == 0)
+			breaker->backoff = 1;
+		/* half of the window is random, so routes of a recovered
+		 * storage do not probe it at once */
+		window = breaker->backoff / 2 +
+		         machine_lrand48() % (breaker->backoff / 2 + 1);
+		breaker->open_until = now + window;
+		breaker->probe = 0;
+	}
+	pthread_mutex_unlock(&breaker->lock);
+	return window;
+}
+
+#endif /* ODYSSEY_BREAKER_H */
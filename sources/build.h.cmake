@@ -14,5 +14,6 @@
 
 #cmakedefine PAM_FOUND 1
 #cmakedefine PG_VERSION_NUM @PG_VERSION_NUM@
+#cmakedefine OD_USDT 1
 
 #endif /* ODYSSEY_BUILD_H */
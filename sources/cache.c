@@ -0,0 +1,68 @@
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+od_cache_t od_cache_client =
+{
+	.lock      = PTHREAD_MUTEX_INITIALIZER,
+	.list      = { &od_cache_client.list, &od_cache_client.list },
+	.count     = 0,
+	.count_max = 0
+};
+
+od_cache_t od_cache_server =
+{
+	.lock      = PTHREAD_MUTEX_INITIALIZER,
+	.list      = { &od_cache_server.list, &od_cache_server.list },
+	.count     = 0,
+	.count_max = 0
+};
+
+void
+od_cache_set_size(od_cache_t *cache, int count_max)
+{
+	pthread_mutex_lock(&cache->lock);
+	cache->count_max = count_max;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+od_list_t*
+od_cache_pop(od_cache_t *cache)
+{
+	od_list_t *node = NULL;
+	pthread_mutex_lock(&cache->lock);
+	if (cache->count > 0) {
+		node = cache->list.next;
+		od_list_unlink(node);
+		cache->count--;
+	}
+	pthread_mutex_unlock(&cache->lock);
+	return node;
+}
+
+int
+od_cache_push(od_cache_t *cache, od_list_t *node)
+{
+	pthread_mutex_lock(&cache->lock);
+	if (cache->count >= cache->count_max) {
+		pthread_mutex_unlock(&cache->lock);
+		return -1;
+	}
+	od_list_init(node);
+	od_list_append(&cache->list, node);
+	cache->count++;
+	pthread_mutex_unlock(&cache->lock);
+	return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef ODYSSEY_CACHE_H
+#define ODYSSEY_CACHE_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_cache od_cache_t;
+
+/* Cache of freed client and server objects.
+ *
+ * Objects are allocated by the system thread and freed by workers,
+ * so the cache is shared and protected by the mutex. Objects are linked
+ * by their own list node, which is not in use after free.
+*/
+
+struct od_cache
+{
+	pthread_mutex_t lock;
+	od_list_t       list;
+	int             count;
+	int             count_max;
+};
+
+static inline void
+od_cache_cond_reset(machine_cond_t *cond)
+{
+	if (cond == NULL)
+		return;
+	machine_cond_propagate(cond, NULL);
+	machine_cond_try(cond);
+}
+
+extern od_cache_t od_cache_client;
+extern od_cache_t od_cache_server;
+
+void       od_cache_set_size(od_cache_t*, int);
+od_list_t *od_cache_pop(od_cache_t*);
+int        od_cache_push(od_cache_t*, od_list_t*);
+
+#endif /* ODYSSEY_CACHE_H */
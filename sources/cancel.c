@@ -18,11 +18,20 @@
 #include <kiwi.h>
 #include <odyssey.h>
 
-int
-od_cancel(od_global_t *global,
-          od_rule_storage_t *storage,
-          kiwi_key_t *key,
-          od_id_t *server_id)
+typedef struct
+{
+	od_rule_storage_t *storage;
+	int                endpoint;
+	kiwi_key_t         key;
+	od_id_t            id;
+} od_cancel_request_t;
+
+static inline int
+od_cancel_send(od_global_t *global,
+               od_rule_storage_t *storage,
+               int endpoint,
+               kiwi_key_t *key,
+               od_id_t *server_id)
 {
 	od_instance_t *instance = global->instance;
 	od_log(&instance->logger, "cancel", NULL, NULL,
@@ -32,8 +41,195 @@ od_cancel(od_global_t *global,
 	od_server_t server;
 	od_server_init(&server);
 	server.global = global;
-	od_backend_connect_cancel(&server, storage, key);
+	int rc;
+	rc = od_backend_connect_cancel(&server, storage, endpoint, key,
+	                               OD_CANCEL_TIMEOUT);
 	od_backend_close_connection(&server);
 	od_backend_close(&server);
+	return rc;
+}
+
+static inline od_cancel_storage_t*
+od_cancel_storage_of(od_cancel_t *cancel, od_cancel_request_t *request)
+{
+	od_list_t *i;
+	od_list_foreach(&cancel->storages, i) {
+		od_cancel_storage_t *state;
+		state = od_container_of(i, od_cancel_storage_t, link);
+		if (strcmp(state->storage->name, request->storage->name) == 0)
+			return state;
+	}
+
+	/* first cancel to the storage, keep its copy */
+	od_cancel_storage_t *state;
+	state = malloc(sizeof(od_cancel_storage_t));
+	if (state == NULL)
+		return NULL;
+	state->storage = request->storage;
+	state->refs    = 0;
+	state->tokens  = 0;
+	state->time    = 0;
+	od_list_init(&state->link);
+	od_list_append(&cancel->storages, &state->link);
+	request->storage = NULL;
+	return state;
+}
+
+static inline int
+od_cancel_recent(od_cancel_t *cancel, od_cancel_storage_t *state,
+                 od_cancel_request_t *request)
+{
+	uint64_t now = machine_time_us();
+	int i;
+	for (i = 0; i < OD_CANCEL_RECENT_MAX; i++) {
+		od_cancel_recent_t *recent = &cancel->recent[i];
+		if (recent->storage == state &&
+		    recent->endpoint == request->endpoint &&
+		    kiwi_key_cmp(&recent->key, &request->key) &&
+		    now - recent->time < OD_CANCEL_RECENT_WINDOW)
+			return 1;
+	}
+	od_cancel_recent_t *recent = &cancel->recent[cancel->recent_pos];
+	recent->time     = now;
+	recent->storage  = state;
+	recent->endpoint = request->endpoint;
+	recent->key      = request->key;
+	cancel->recent_pos = (cancel->recent_pos + 1) % OD_CANCEL_RECENT_MAX;
+	return 0;
+}
+
+static inline void
+od_cancel_process(od_global_t *global, od_cancel_request_t *request)
+{
+	od_instance_t *instance = global->instance;
+	od_system_t *system = global->system;
+	od_cancel_t *cancel = &system->cancel;
+
+	od_cancel_storage_t *state;
+	state = od_cancel_storage_of(cancel, request);
+	if (state == NULL) {
+		od_error(&instance->logger, "cancel", NULL, NULL,
+		         "failed to allocate cancel storage");
+		goto done;
+	}
+
+	/* the same server may be cancelled by both client and query timeout */
+	if (od_cancel_recent(cancel, state, request)) {
+		od_debug(&instance->logger, "cancel", NULL, NULL,
+		         "cancel for %s%.*s is already sent",
+		         request->id.id_prefix,
+		         sizeof(request->id.id), request->id.id);
+		goto done;
+	}
+
+	/* storage copy of the request has the current configuration,
+	 * cancel_rate is not compared on reload */
+	od_rule_storage_t *storage;
+	storage = request->storage ? request->storage : state->storage;
+	if (storage->cancel_rate > 0 &&
+	    ! od_route_take(&state->tokens, &state->time, storage->cancel_rate)) {
+		od_log(&instance->logger, "cancel", NULL, NULL,
+		       "storage '%s': cancel rate limit reached, skip cancel for %s%.*s",
+		       storage->name,
+		       request->id.id_prefix,
+		       sizeof(request->id.id), request->id.id);
+		goto done;
+	}
+
+	/* connect using the kept storage copy, its tls handler allows to
+	 * resume tls session. Replace it once the configuration changes and
+	 * no cancel is in progress */
+	storage = state->storage;
+	if (request->storage &&
+	    ! od_rules_storage_compare(state->storage, request->storage)) {
+		if (state->refs == 0) {
+			od_rules_storage_free(state->storage);
+			state->storage = request->storage;
+			request->storage = NULL;
+			storage = state->storage;
+		} else {
+			storage = request->storage;
+		}
+	}
+
+	state->refs++;
+	od_cancel_send(global, storage, request->endpoint, &request->key,
+	               &request->id);
+	state->refs--;
+
+done:
+	if (request->storage)
+		od_rules_storage_free(request->storage);
+}
+
+static void
+od_cancel_dispatcher(void *arg)
+{
+	od_global_t *global = arg;
+	od_system_t *system = global->system;
+	od_cancel_t *cancel = &system->cancel;
+	for (;;) {
+		machine_msg_t *msg;
+		msg = machine_channel_read(cancel->channel, UINT32_MAX);
+		if (msg == NULL)
+			break;
+		od_cancel_process(global, machine_msg_data(msg));
+		machine_msg_free(msg);
+	}
+}
+
+int
+od_cancel_start(od_global_t *global)
+{
+	od_instance_t *instance = global->instance;
+	od_system_t *system = global->system;
+	od_cancel_t *cancel = &system->cancel;
+	cancel->channel = machine_channel_create(1);
+	if (cancel->channel == NULL) {
+		od_error(&instance->logger, "cancel", NULL, NULL,
+		         "failed to create cancel channel");
+		return -1;
+	}
+	int i;
+	for (i = 0; i < OD_CANCEL_WORKERS; i++) {
+		int64_t coroutine_id;
+		coroutine_id = machine_coroutine_create(od_cancel_dispatcher, global);
+		if (coroutine_id == -1) {
+			od_error(&instance->logger, "cancel", NULL, NULL,
+			         "failed to start cancel coroutine");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int
+od_cancel(od_global_t *global,
+          od_rule_storage_t *storage,
+          int endpoint,
+          kiwi_key_t *key,
+          od_id_t *server_id)
+{
+	od_system_t *system = global->system;
+	od_cancel_t *cancel = &system->cancel;
+	if (cancel->channel == NULL)
+		return od_cancel_send(global, storage, endpoint, key, server_id);
+
+	/* queue the request to the system machine, storage is copied since
+	 * the route can be gone by the time it is sent */
+	machine_msg_t *msg;
+	msg = machine_msg_create(sizeof(od_cancel_request_t));
+	if (msg == NULL)
+		return -1;
+	od_cancel_request_t *request = machine_msg_data(msg);
+	request->storage = od_rules_storage_copy(storage);
+	if (request->storage == NULL) {
+		machine_msg_free(msg);
+		return -1;
+	}
+	request->endpoint = endpoint;
+	request->key      = *key;
+	request->id       = *server_id;
+	machine_channel_write(cancel->channel, msg);
 	return 0;
 }
@@ -7,6 +7,55 @@
  * Scalable PostgreSQL connection pooler.
 */
 
-int od_cancel(od_global_t*, od_rule_storage_t*, kiwi_key_t*, od_id_t*);
+typedef struct od_cancel_storage od_cancel_storage_t;
+typedef struct od_cancel_recent  od_cancel_recent_t;
+typedef struct od_cancel         od_cancel_t;
+
+/* coroutines sending cancel requests */
+#define OD_CANCEL_WORKERS 4
+
+/* repeated cancels of the same server within the window are dropped */
+#define OD_CANCEL_RECENT_MAX    256
+#define OD_CANCEL_RECENT_WINDOW 100000
+
+/* connect timeout of a cancel connection in milliseconds */
+#define OD_CANCEL_TIMEOUT 5000
+
+struct od_cancel_storage
+{
+	od_rule_storage_t *storage;
+	int                refs;
+	od_atomic_u64_t    tokens;
+	od_atomic_u64_t    time;
+	od_list_t          link;
+};
+
+struct od_cancel_recent
+{
+	uint64_t             time;
+	od_cancel_storage_t *storage;
+	int                  endpoint;
+	kiwi_key_t           key;
+};
+
+struct od_cancel
+{
+	machine_channel_t  *channel;
+	od_list_t           storages;
+	od_cancel_recent_t  recent[OD_CANCEL_RECENT_MAX];
+	int                 recent_pos;
+};
+
+static inline void
+od_cancel_init(od_cancel_t *cancel)
+{
+	cancel->channel = NULL;
+	od_list_init(&cancel->storages);
+	memset(cancel->recent, 0, sizeof(cancel->recent));
+	cancel->recent_pos = 0;
+}
+
+int od_cancel_start(od_global_t*);
+int od_cancel(od_global_t*, od_rule_storage_t*, int, kiwi_key_t*, od_id_t*);
 
 #endif /* ODYSSEY_CANCEL_H */
@@ -0,0 +1,44 @@
+#ifndef ODYSSEY_CAPTURE_H
+#define ODYSSEY_CAPTURE_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+/* workload capture is a magic string followed by records in
+ * host byte order. A session is a start record with database
+ * and user names, client protocol messages as they were read
+ * by the relay, and an end record. Sessions of all workers are
+ * interleaved and ordered by time only per session. The file
+ * is replayed by odyssey_replay */
+
+#define OD_CAPTURE_MAGIC       "odycap01"
+#define OD_CAPTURE_MAGIC_LEN   8
+
+/* larger messages are not kept, the record has the header
+ * of the message only and is skipped by replay */
+#define OD_CAPTURE_MESSAGE_MAX 8192
+
+typedef struct od_capture_record od_capture_record_t;
+
+typedef enum
+{
+	OD_CAPTURE_START,
+	OD_CAPTURE_SESSION,
+	OD_CAPTURE_MESSAGE,
+	OD_CAPTURE_TRUNCATED,
+	OD_CAPTURE_END
+} od_capture_type_t;
+
+struct od_capture_record
+{
+	uint32_t size;
+	uint16_t type;
+	uint16_t reserved;
+	uint64_t session;
+	uint64_t time;
+};
+
+#endif /* ODYSSEY_CAPTURE_H */
@@ -10,6 +10,9 @@
 typedef struct od_client_ctl od_client_ctl_t;
 typedef struct od_client     od_client_t;
 
+/* longest query text kept until the query completes */
+#define OD_CLIENT_LOG_QUERY_MAX 1024
+
 typedef enum
 {
 	OD_CLIENT_UNDEF,
@@ -18,10 +21,29 @@ typedef enum
 	OD_CLIENT_QUEUE
 } od_client_state_t;
 
+/* what a routed client is waiting for, shown by SHOW CLIENTS. States
+ * from deploy on are not recorded, they are derived from the attached
+ * server when shown */
+typedef enum
+{
+	OD_CLIENT_WAIT_NONE,
+	OD_CLIENT_WAIT_AUTH,
+	OD_CLIENT_WAIT_AUTH_QUERY,
+	OD_CLIENT_WAIT_POOL,
+	OD_CLIENT_WAIT_CONNECT,
+	OD_CLIENT_WAIT_RESET,
+	OD_CLIENT_WAIT_CLIENT,
+	OD_CLIENT_WAIT_DEPLOY,
+	OD_CLIENT_WAIT_QUERY,
+	OD_CLIENT_WAIT_WRITE
+} od_client_wait_t;
+
 typedef enum
 {
 	OD_CLIENT_OP_NONE = 0,
-	OD_CLIENT_OP_KILL = 1
+	OD_CLIENT_OP_KILL = 1,
+	OD_CLIENT_OP_RESTART = 2,
+	OD_CLIENT_OP_MIGRATE = 4
 } od_clientop_t;
 
 struct od_client_ctl
@@ -31,27 +53,69 @@ struct od_client_ctl
 
 struct od_client
 {
+	/* fields used by relay, attach and detach come first, startup
+	 * parameters and vars are only read on setup and reset */
 	od_client_state_t   state;
-	od_id_t             id;
 	od_client_ctl_t     ctl;
-	uint64_t            coroutine_id;
-	machine_tls_t      *tls;
-	od_io_t             io;
+	int                 worker_id;
+	od_server_t        *server;
+	void               *route;
+	void               *route_write;
+	void               *route_read;
+	od_rule_t          *rule;
+	od_global_t        *global;
 	machine_cond_t     *cond;
+	machine_channel_t  *wait_channel;
+	machine_channel_t  *pipeline_channel;
+	machine_channel_t  *listen_channel;
+	struct od_walrelay_sub *wal_sub;
+	machine_notify_t   *notify;
+	od_list_t           link_pool;
+	uint64_t            cpu_time;
+	uint64_t            cpu_wait;
+	uint64_t            cpu_switch;
+	od_io_t             io;
 	od_relay_t          relay;
-	machine_io_t       *notify_io;
-	od_rule_t          *rule;
+	od_spool_t          spool;
+	int                 quota;
+	int                 mux;
+	machine_tls_t      *tls;
+	char               *log_query;
+	int                 log_query_len;
+	int                 query_cache_id;
+	machine_msg_t      *query_cache_reply;
+	od_fingerprint_t   *fingerprint;
+	uint64_t            top_query;
+	char                top_query_text[OD_TOP_TEXT];
+	int                 top_query_len;
+	uint64_t            top_bytes;
+	uint64_t            top_bytes_start;
+	char                top_addr[OD_TOP_TEXT];
+	int                 top_addr_len;
+	od_prepared_client_t prepared;
+	od_client_wait_t    wait;
+	uint64_t            wait_start;
+	machine_msg_t      *span;
+	int                 span_skip;
+	int                 capture;
+	od_id_t             id;
+	uint64_t            coroutine_id;
 	od_config_listen_t *config_listen;
+	od_atomic_u32_t    *worker_clients;
 	uint64_t            time_accept;
+	uint64_t            time_startup;
 	uint64_t            time_setup;
-	kiwi_be_startup_t   startup;
-	kiwi_vars_t         vars;
+	uint64_t            cpu_sample_time;
+	uint64_t            cpu_sample_wait;
+	uint64_t            cpu_sample_switch;
 	kiwi_key_t          key;
-	od_server_t        *server;
-	void               *route;
-	od_global_t        *global;
-	od_list_t           link_pool;
+	od_arena_t          arena;
+	od_list_t           link_index;
 	od_list_t           link;
+	kiwi_be_startup_t   startup;
+	kiwi_vars_t         vars;
+	int                 track_set;
+	kiwi_query_set_t    track_set_query;
 };
 
 static inline void
@@ -61,28 +125,111 @@ od_client_init(od_client_t *client)
 	client->coroutine_id  = 0;
 	client->tls           = NULL;
 	client->cond          = NULL;
+	client->wait_channel  = NULL;
+	client->pipeline_channel = NULL;
+	client->listen_channel = NULL;
+	client->wal_sub = NULL;
 	client->rule          = NULL;
 	client->config_listen = NULL;
+	client->mux           = 0;
+	client->capture       = 0;
 	client->server        = NULL;
+	client->quota         = 0;
 	client->route         = NULL;
+	client->route_write   = NULL;
+	client->route_read    = NULL;
 	client->global        = NULL;
+	client->worker_clients = NULL;
+	client->worker_id     = -1;
 	client->time_accept   = 0;
+	client->time_startup  = 0;
 	client->time_setup    = 0;
-	client->notify_io     = NULL;
+	client->cpu_time      = 0;
+	client->cpu_wait      = 0;
+	client->cpu_switch    = 0;
+	client->cpu_sample_time   = 0;
+	client->cpu_sample_wait   = 0;
+	client->cpu_sample_switch = 0;
+	client->notify        = NULL;
 	client->ctl.op        = OD_CLIENT_OP_NONE;
 	kiwi_be_startup_init(&client->startup);
 	kiwi_vars_init(&client->vars);
+	client->track_set     = 0;
+	od_arena_init(&client->arena);
+	od_list_init(&client->link_index);
+	od_prepared_client_init(&client->prepared);
+	client->log_query     = NULL;
+	client->log_query_len = 0;
+	client->query_cache_id    = -1;
+	client->query_cache_reply = NULL;
+	client->fingerprint       = NULL;
+	client->top_query         = 0;
+	client->top_query_len     = 0;
+	client->top_bytes         = 0;
+	client->top_bytes_start   = 0;
+	client->top_addr_len      = 0;
+	client->wait              = OD_CLIENT_WAIT_NONE;
+	client->wait_start        = 0;
+	client->span              = NULL;
+	client->span_skip         = 0;
 	kiwi_key_init(&client->key);
 	od_io_init(&client->io);
 	od_relay_init(&client->relay, &client->io);
+	od_spool_init(&client->spool);
 	od_list_init(&client->link_pool);
 	od_list_init(&client->link);
 }
 
+static inline void
+od_client_wait_at(od_client_t *client, od_client_wait_t wait, uint64_t time_us)
+{
+	/* read by console without locks, for display only */
+	client->wait       = wait;
+	client->wait_start = time_us;
+}
+
+static inline void
+od_client_wait(od_client_t *client, od_client_wait_t wait)
+{
+	od_client_wait_at(client, wait, machine_time_us());
+}
+
+static inline char*
+od_client_wait_name(od_client_wait_t wait)
+{
+	switch (wait) {
+	case OD_CLIENT_WAIT_NONE:       return "";
+	case OD_CLIENT_WAIT_AUTH:       return "auth";
+	case OD_CLIENT_WAIT_AUTH_QUERY: return "auth_query";
+	case OD_CLIENT_WAIT_POOL:       return "pool";
+	case OD_CLIENT_WAIT_CONNECT:    return "server_connect";
+	case OD_CLIENT_WAIT_RESET:      return "reset";
+	case OD_CLIENT_WAIT_CLIENT:     return "client";
+	case OD_CLIENT_WAIT_DEPLOY:     return "deploy";
+	case OD_CLIENT_WAIT_QUERY:      return "server_query";
+	case OD_CLIENT_WAIT_WRITE:      return "client_write";
+	}
+	return "";
+}
+
 static inline od_client_t*
 od_client_allocate(void)
 {
-	od_client_t *client = malloc(sizeof(*client));
+	od_client_t *client;
+	od_list_t *cached = od_cache_pop(&od_cache_client);
+	if (cached) {
+		/* reuse conditions of the cached client */
+		client = od_container_of(cached, od_client_t, link);
+		machine_cond_t *cond     = client->cond;
+		machine_cond_t *on_read  = client->io.on_read;
+		machine_cond_t *on_write = client->io.on_write;
+		od_client_init(client);
+		client->cond        = cond;
+		client->io.on_read  = on_read;
+		client->io.on_write = on_write;
+		return client;
+	}
+	client = malloc(sizeof(*client));
 	if (client == NULL)
 		return NULL;
 	od_client_init(client);
@@ -93,6 +240,29 @@ static inline void
 od_client_free(od_client_t *client)
 {
 	od_relay_free(&client->relay);
+	od_spool_free(&client->spool);
+	od_io_reuse(&client->io);
+	if (client->wait_channel)
+		machine_channel_free(client->wait_channel);
+	if (client->pipeline_channel)
+		machine_channel_free(client->pipeline_channel);
+	if (client->listen_channel)
+		machine_channel_free(client->listen_channel);
+	if (client->worker_clients)
+		od_atomic_u32_dec(client->worker_clients);
+	kiwi_vars_free(&client->vars);
+	od_arena_free(&client->arena);
+	od_prepared_client_free(&client->prepared);
+	if (client->log_query)
+		free(client->log_query);
+	if (client->query_cache_reply)
+		machine_msg_free(client->query_cache_reply);
+	if (client->span)
+		machine_msg_free(client->span);
+
+	od_cache_cond_reset(client->cond);
+	if (od_cache_push(&od_cache_client, &client->link) == 0)
+		return;
 	od_io_free(&client->io);
 	if (client->cond)
 		machine_cond_free(client->cond);
@@ -102,15 +272,13 @@ od_client_free(od_client_t *client)
 static inline void
 od_client_notify_read(od_client_t *client)
 {
-	uint64_t value;
-	machine_read_raw(client->notify_io, &value, sizeof(value));
+	machine_notify_read(client->notify);
 }
 
 static inline void
 od_client_notify(od_client_t *client)
 {
-	uint64_t value = 1;
-	machine_write_raw(client->notify_io, &value, sizeof(value));
+	machine_notify_signal(client->notify);
 }
 
 static inline uint32_t
@@ -138,4 +306,18 @@ od_client_kill(od_client_t *client)
 	od_client_notify(client);
 }
 
+static inline void
+od_client_restart(od_client_t *client)
+{
+	od_client_ctl_set(client, OD_CLIENT_OP_RESTART);
+	od_client_notify(client);
+}
+
+static inline void
+od_client_migrate(od_client_t *client)
+{
+	od_client_ctl_set(client, OD_CLIENT_OP_MIGRATE);
+	od_client_notify(client);
+}
+
 #endif /* ODYSSEY_CLIENT_H */
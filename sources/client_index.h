@@ -0,0 +1,106 @@
+#ifndef ODYSSEY_CLIENT_INDEX_H
+#define ODYSSEY_CLIENT_INDEX_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+/* Routed clients are indexed by id, so console kill and lookups do
+ * not scan every route. Buckets are protected by shard locks, a
+ * client is removed from the index before it is unrouted.
+*/
+
+#define OD_CLIENT_INDEX_BUCKETS 16384
+#define OD_CLIENT_INDEX_SHARDS  64
+
+typedef int (*od_client_index_cb_t)(od_client_t*, void**);
+
+typedef struct
+{
+	pthread_mutex_t locks[OD_CLIENT_INDEX_SHARDS];
+	od_list_t       buckets[OD_CLIENT_INDEX_BUCKETS];
+} od_client_index_t;
+
+static inline void
+od_client_index_init(od_client_index_t *index)
+{
+	int i;
+	for (i = 0; i < OD_CLIENT_INDEX_SHARDS; i++)
+		pthread_mutex_init(&index->locks[i], NULL);
+	for (i = 0; i < OD_CLIENT_INDEX_BUCKETS; i++)
+		od_list_init(&index->buckets[i]);
+}
+
+static inline void
+od_client_index_free(od_client_index_t *index)
+{
+	int i;
+	for (i = 0; i < OD_CLIENT_INDEX_SHARDS; i++)
+		pthread_mutex_destroy(&index->locks[i]);
+}
+
+static inline uint32_t
+od_client_index_hash(od_id_t *id)
+{
+	/* console ids are parsed from text, only id chars are set */
+	uint32_t hash = 2166136261U;
+	unsigned int i;
+	for (i = 0; i < sizeof(id->id); i++)
+		hash = (hash ^ (uint8_t)id->id[i]) * 16777619U;
+	return hash & (OD_CLIENT_INDEX_BUCKETS - 1);
+}
+
+static inline pthread_mutex_t*
+od_client_index_lock(od_client_index_t *index, uint32_t hash)
+{
+	return &index->locks[hash & (OD_CLIENT_INDEX_SHARDS - 1)];
+}
+
+static inline void
+od_client_index_add(od_client_index_t *index, od_client_t *client)
+{
+	uint32_t hash = od_client_index_hash(&client->id);
+	pthread_mutex_t *lock = od_client_index_lock(index, hash);
+	pthread_mutex_lock(lock);
+	od_list_append(&index->buckets[hash], &client->link_index);
+	pthread_mutex_unlock(lock);
+}
+
+static inline void
+od_client_index_remove(od_client_index_t *index, od_client_t *client)
+{
+	uint32_t hash = od_client_index_hash(&client->id);
+	pthread_mutex_t *lock = od_client_index_lock(index, hash);
+	pthread_mutex_lock(lock);
+	od_list_unlink(&client->link_index);
+	od_list_init(&client->link_index);
+	pthread_mutex_unlock(lock);
+}
+
+static inline int
+od_client_index_find(od_client_index_t *index, od_id_t *id,
+                     od_client_index_cb_t callback,
+                     void **argv)
+{
+	/* client can not be unrouted or freed while the callback runs */
+	uint32_t hash = od_client_index_hash(id);
+	pthread_mutex_t *lock = od_client_index_lock(index, hash);
+	pthread_mutex_lock(lock);
+	od_list_t *i;
+	od_list_foreach(&index->buckets[hash], i) {
+		od_client_t *client;
+		client = od_container_of(i, od_client_t, link_index);
+		if (! od_id_cmp(&client->id, id))
+			continue;
+		int rc;
+		rc = callback(client, argv);
+		pthread_mutex_unlock(lock);
+		return rc;
+	}
+	pthread_mutex_unlock(lock);
+	return -1;
+}
+
+#endif /* ODYSSEY_CLIENT_INDEX_H */
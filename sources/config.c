@@ -22,6 +22,7 @@ void
 od_config_init(od_config_t *config)
 {
 	config->daemonize            = 0;
+	config->embedded             = 0;
 	config->priority             = 0;
 	config->log_debug            = 0;
 	config->log_to_stdout        = 1;
@@ -31,25 +32,90 @@ od_config_init(od_config_t *config)
 	config->log_file             = NULL;
 	config->log_stats            = 1;
 	config->stats_interval       = 3;
+	config->query_fingerprint    = 0;
+	config->query_fingerprint_max = 1000;
+	config->top_size             = 0;
+	config->accept_stats_interval = 0;
+	config->stats_shm            = NULL;
+	config->stats_shm_routes     = 1024;
+	config->metrics_host         = NULL;
+	config->metrics_port         = 0;
+	config->span_host            = NULL;
+	config->span_port            = 0;
+	config->span_parameter       = NULL;
+	config->span_sample_rate     = 100;
+	config->span_queue           = 10000;
+	config->mirror_queue         = 0;
+	config->fleet_host           = NULL;
+	config->fleet_port           = 0;
+	config->fleet_peers          = NULL;
+	config->fleet_interval       = 1000;
+	config->fleet_timeout        = 3000;
 	config->log_format           = NULL;
+	config->log_binary_file      = NULL;
+	config->capture_file         = NULL;
 	config->pid_file             = NULL;
 	config->unix_socket_dir      = NULL;
 	config->unix_socket_mode     = NULL;
+	config->online_restart_socket = NULL;
+	config->tls_engine           = NULL;
 	config->log_syslog           = 0;
 	config->log_syslog_ident     = NULL;
 	config->log_syslog_facility  = NULL;
+	config->log_async            = 0;
+	config->log_async_buffer     = 1048576;
+	config->log_async_block      = 0;
 	config->readahead            = 8192;
+	config->readahead_ring       = 0;
+	config->relay_splice         = 0;
+	config->relay_coalesce       = 0;
+	config->relay_buffer_max     = 1048576;
+	config->relay_watermark_high = 262144;
+	config->relay_watermark_low  = 65536;
+	config->relay_memory_max     = 0;
+	config->relay_read_budget    = 1048576;
+	config->relay_spool          = 0;
+	config->relay_spool_memory   = 1048576;
+	config->relay_spool_dir      = NULL;
 	config->nodelay              = 1;
 	config->keepalive            = 7200;
 	config->workers              = 1;
+	config->workers_max          = 0;
+	config->handshake_workers    = 0;
+	config->reuseport            = 0;
+	config->reuseport_cpu        = 0;
+	config->client_placement     = NULL;
+	config->worker_cpus          = NULL;
+	config->worker_groups        = NULL;
+	config->system_cpus          = NULL;
+	config->tls_ticket_rotate    = 3600;
 	config->resolvers            = 1;
+	config->dns_cache_ttl        = 0;
 	config->client_max_set       = 0;
 	config->client_max           = 0;
 	config->client_max_routing   = 0;
+	config->client_overload      = NULL;
+	config->client_overload_latency = 0;
+	config->client_idle_release  = 1000;
 	config->server_login_retry   = 1;
+	config->server_connect_async = 0;
+	config->track_parameters     = NULL;
 	config->cache_coroutine      = 0;
+	config->cache_client         = 0;
+	config->cache_server         = 0;
 	config->cache_msg_gc_size    = 0;
+	config->cache_msg_class_limit = 0;
 	config->coroutine_stack_size = 4;
+	config->coroutine_stack_hugepages = 0;
+	config->coroutine_stack_watermark = 0;
+	config->coroutine_accounting = 0;
+	config->lock_stats           = 0;
+	config->poller               = NULL;
+	config->poll_spin            = 0;
+	config->watchdog_stall       = 0;
+	config->clock_source         = NULL;
+	config->resolver             = NULL;
+	config->pam_workers          = 2;
 	od_list_init(&config->listen);
 }
 
@@ -57,8 +123,13 @@ void
 od_config_reload(od_config_t *current_config, od_config_t *new_config)
 {
 	current_config->client_max = new_config->client_max;
+	current_config->workers = new_config->workers;
 	current_config->client_max_routing = new_config->client_max_routing;
+	current_config->client_overload_latency = new_config->client_overload_latency;
+	current_config->client_idle_release = new_config->client_idle_release;
 	current_config->server_login_retry = new_config->server_login_retry;
+	current_config->server_connect_async = new_config->server_connect_async;
+	current_config->dns_cache_ttl = new_config->dns_cache_ttl;
 }
 
 static void
@@ -77,14 +148,54 @@ od_config_free(od_config_t *config)
 		free(config->log_file);
 	if (config->log_format)
 		free(config->log_format);
+	if (config->log_binary_file)
+		free(config->log_binary_file);
+	if (config->capture_file)
+		free(config->capture_file);
 	if (config->pid_file)
 		free(config->pid_file);
+	if (config->stats_shm)
+		free(config->stats_shm);
+	if (config->metrics_host)
+		free(config->metrics_host);
+	if (config->span_host)
+		free(config->span_host);
+	if (config->span_parameter)
+		free(config->span_parameter);
+	if (config->fleet_host)
+		free(config->fleet_host);
+	if (config->fleet_peers)
+		free(config->fleet_peers);
 	if (config->unix_socket_dir)
 		free(config->unix_socket_dir);
+	if (config->relay_spool_dir)
+		free(config->relay_spool_dir);
+	if (config->online_restart_socket)
+		free(config->online_restart_socket);
+	if (config->tls_engine)
+		free(config->tls_engine);
 	if (config->log_syslog_ident)
 		free(config->log_syslog_ident);
 	if (config->log_syslog_facility)
 		free(config->log_syslog_facility);
+	if (config->poller)
+		free(config->poller);
+	if (config->clock_source)
+		free(config->clock_source);
+	if (config->resolver)
+		free(config->resolver);
+	if (config->client_overload)
+		free(config->client_overload);
+	if (config->client_placement)
+		free(config->client_placement);
+	if (config->worker_cpus)
+		free(config->worker_cpus);
+	if (config->worker_groups)
+		free(config->worker_groups);
+	if (config->system_cpus)
+		free(config->system_cpus);
+	if (config->track_parameters)
+		free(config->track_parameters);
 }
 
 od_config_listen_t*
@@ -98,6 +209,9 @@ od_config_listen_add(od_config_t *config)
 	listen->port = 6432;
 	listen->backlog = 128;
 	listen->client_login_timeout = 15000;
+	listen->tls_session_cache = 20480;
+	listen->tls_session_timeout = 300;
+	listen->tls_verify_timeout = 300;
 	od_list_init(&listen->link);
 	od_list_append(&config->listen, &listen->link);
 	return listen;
@@ -118,9 +232,100 @@ od_config_listen_free(od_config_listen_t *config)
 		free(config->tls_cert_file);
 	if (config->tls_protocols)
 		free(config->tls_protocols);
+	if (config->worker_group)
+		free(config->worker_group);
 	free(config);
 }
 
+int
+od_config_cpus_parse(char *list, int *cpus, int max)
+{
+	/* comma separated cpu numbers and ranges, like "0,2,4-7" */
+	int count = 0;
+	char *pos = list;
+	for (;;) {
+		if (! isdigit(*pos))
+			return -1;
+		long first = strtol(pos, &pos, 10);
+		long last = first;
+		if (*pos == '-') {
+			pos++;
+			if (! isdigit(*pos))
+				return -1;
+			last = strtol(pos, &pos, 10);
+		}
+		if (last < first || last >= max)
+			return -1;
+		for (; first <= last; first++) {
+			if (count == max)
+				return -1;
+			cpus[count++] = first;
+		}
+		if (*pos == 0)
+			break;
+		if (*pos != ',')
+			return -1;
+		pos++;
+	}
+	return count;
+}
+
+int
+od_config_worker_groups_parse(char *list, od_config_worker_group_t *groups,
+                              int max)
+{
+	/* comma separated names and worker counts, like "oltp:4,olap:2" */
+	int count = 0;
+	char *pos = list;
+	for (;;) {
+		char *name = pos;
+		while (isalnum(*pos) || *pos == '_' || *pos == '-')
+			pos++;
+		int name_len = pos - name;
+		if (name_len == 0 || name_len >= OD_CONFIG_WORKER_GROUP_NAME)
+			return -1;
+		if (*pos != ':' || ! isdigit(pos[1]))
+			return -1;
+		pos++;
+		long workers = strtol(pos, &pos, 10);
+		if (workers <= 0 || count == max)
+			return -1;
+		int i;
+		for (i = 0; i < count; i++) {
+			if (strncmp(groups[i].name, name, name_len) == 0 &&
+			    groups[i].name[name_len] == 0)
+				return -1;
+		}
+		memcpy(groups[count].name, name, name_len);
+		groups[count].name[name_len] = 0;
+		groups[count].count = workers;
+		count++;
+		if (*pos == 0)
+			break;
+		if (*pos != ',')
+			return -1;
+		pos++;
+	}
+	return count;
+}
+
+int
+od_config_worker_group_exists(od_config_t *config, char *name)
+{
+	if (config->worker_groups == NULL)
+		return 0;
+	od_config_worker_group_t groups[OD_CONFIG_WORKER_GROUPS_MAX];
+	int count;
+	count = od_config_worker_groups_parse(config->worker_groups, groups,
+	                                      OD_CONFIG_WORKER_GROUPS_MAX);
+	int i;
+	for (i = 0; i < count; i++) {
+		if (strcmp(groups[i].name, name) == 0)
+			return 1;
+	}
+	return 0;
+}
+
 int
 od_config_validate(od_config_t *config, od_logger_t *logger)
 {
@@ -130,24 +335,260 @@ od_config_validate(od_config_t *config, od_logger_t *logger)
 		return -1;
 	}
 
+	/* workers_max */
+	if (config->workers_max < config->workers) {
+		od_error(logger, "config", NULL, NULL,
+		         "workers_max is less than workers");
+		return -1;
+	}
+
+	/* handshake_workers */
+	if (config->handshake_workers < 0) {
+		od_error(logger, "config", NULL, NULL, "bad handshake_workers number");
+		return -1;
+	}
+
+	/* query_fingerprint_max */
+	if (config->query_fingerprint && config->query_fingerprint_max <= 0) {
+		od_error(logger, "config", NULL, NULL,
+		         "bad query_fingerprint_max number");
+		return -1;
+	}
+
+	/* top_size */
+	if (config->top_size < 0) {
+		od_error(logger, "config", NULL, NULL, "bad top_size number");
+		return -1;
+	}
+
+	/* accept_stats_interval */
+	if (config->accept_stats_interval < 0) {
+		od_error(logger, "config", NULL, NULL,
+		         "bad accept_stats_interval number");
+		return -1;
+	}
+
+	/* stats_shm_routes */
+	if (config->stats_shm && config->stats_shm_routes <= 0) {
+		od_error(logger, "config", NULL, NULL,
+		         "bad stats_shm_routes number");
+		return -1;
+	}
+
 	/* resolvers */
 	if (config->resolvers <= 0) {
 		od_error(logger, "config", NULL, NULL, "bad resolvers number");
 		return -1;
 	}
 
+	/* dns_cache_ttl */
+	if (config->dns_cache_ttl < 0) {
+		od_error(logger, "config", NULL, NULL, "bad dns_cache_ttl number");
+		return -1;
+	}
+
+	/* relay_watermark_high, relay_watermark_low */
+	if (config->relay_watermark_high < 0 || config->relay_watermark_low < 0 ||
+	    (config->relay_watermark_high > 0 &&
+	     config->relay_watermark_low > config->relay_watermark_high)) {
+		od_error(logger, "config", NULL, NULL,
+		         "bad relay_watermark_high or relay_watermark_low");
+		return -1;
+	}
+
+	/* relay_memory_max */
+	if (config->relay_memory_max < 0) {
+		od_error(logger, "config", NULL, NULL, "bad relay_memory_max");
+		return -1;
+	}
+
+	/* relay_read_budget */
+	if (config->relay_read_budget < 0) {
+		od_error(logger, "config", NULL, NULL, "bad relay_read_budget");
+		return -1;
+	}
+
+	/* relay_spool, relay_spool_memory */
+	if (config->relay_spool < 0 || config->relay_spool_memory < 0) {
+		od_error(logger, "config", NULL, NULL,
+		         "bad relay_spool or relay_spool_memory");
+		return -1;
+	}
+
 	/* coroutine_stack_size */
 	if (config->coroutine_stack_size < 4) {
 		od_error(logger, "config", NULL, NULL, "bad coroutine_stack_size number");
 		return -1;
 	}
 
+	/* client_placement */
+	if (config->client_placement) {
+		if (strcmp(config->client_placement, "round_robin") != 0 &&
+		    strcmp(config->client_placement, "least_loaded") != 0 &&
+		    strcmp(config->client_placement, "route") != 0) {
+			od_error(logger, "config", NULL, NULL, "unknown client_placement");
+			return -1;
+		}
+	}
+
+	/* reuseport_cpu */
+	if (config->reuseport_cpu &&
+	    (! config->reuseport || config->worker_cpus == NULL)) {
+		od_error(logger, "config", NULL, NULL,
+		         "reuseport_cpu requires reuseport and worker_cpus");
+		return -1;
+	}
+
+	/* worker_cpus, system_cpus */
+	int cpus[OD_CONFIG_CPUS_MAX];
+	int rc;
+	if (config->worker_cpus) {
+		rc = od_config_cpus_parse(config->worker_cpus, cpus, OD_CONFIG_CPUS_MAX);
+		if (rc == -1) {
+			od_error(logger, "config", NULL, NULL, "bad worker_cpus list");
+			return -1;
+		}
+	}
+	if (config->system_cpus) {
+		rc = od_config_cpus_parse(config->system_cpus, cpus, OD_CONFIG_CPUS_MAX);
+		if (rc == -1) {
+			od_error(logger, "config", NULL, NULL, "bad system_cpus list");
+			return -1;
+		}
+	}
+
+	/* worker_groups */
+	if (config->worker_groups) {
+		od_config_worker_group_t groups[OD_CONFIG_WORKER_GROUPS_MAX];
+		rc = od_config_worker_groups_parse(config->worker_groups, groups,
+		                                   OD_CONFIG_WORKER_GROUPS_MAX);
+		if (rc == -1) {
+			od_error(logger, "config", NULL, NULL, "bad worker_groups list");
+			return -1;
+		}
+		int total = 0;
+		int i;
+		for (i = 0; i < rc; i++)
+			total += groups[i].count;
+		if (total >= config->workers) {
+			od_error(logger, "config", NULL, NULL,
+			         "worker_groups must leave workers for other clients");
+			return -1;
+		}
+	}
+
+	/* poller */
+	if (config->poller) {
+		if (strcmp(config->poller, "epoll") != 0 &&
+		    strcmp(config->poller, "io_uring") != 0) {
+			od_error(logger, "config", NULL, NULL, "unknown poller");
+			return -1;
+		}
+	}
+
+	/* poll_spin */
+	if (config->poll_spin < 0) {
+		od_error(logger, "config", NULL, NULL, "bad poll_spin");
+		return -1;
+	}
+
+	/* watchdog_stall */
+	if (config->watchdog_stall < 0) {
+		od_error(logger, "config", NULL, NULL, "bad watchdog_stall");
+		return -1;
+	}
+
+	/* clock_source */
+	if (config->clock_source) {
+		if (strcmp(config->clock_source, "monotonic") != 0 &&
+		    strcmp(config->clock_source, "coarse") != 0 &&
+		    strcmp(config->clock_source, "tsc") != 0) {
+			od_error(logger, "config", NULL, NULL, "unknown clock_source");
+			return -1;
+		}
+	}
+
+	/* client_overload */
+	if (config->client_overload) {
+		if (strcmp(config->client_overload, "hold") != 0 &&
+		    strcmp(config->client_overload, "reject") != 0) {
+			od_error(logger, "config", NULL, NULL, "unknown client_overload mode");
+			return -1;
+		}
+	}
+	if (config->client_overload_latency < 0) {
+		od_error(logger, "config", NULL, NULL, "bad client_overload_latency");
+		return -1;
+	}
+
+	/* pam_workers */
+	if (config->pam_workers <= 0) {
+		od_error(logger, "config", NULL, NULL, "bad pam_workers number");
+		return -1;
+	}
+
+	/* resolver */
+	if (config->resolver) {
+		if (strcmp(config->resolver, "thread") != 0 &&
+		    strcmp(config->resolver, "async") != 0) {
+			od_error(logger, "config", NULL, NULL, "unknown resolver");
+			return -1;
+		}
+	}
+
 	/* log format */
 	if (config->log_format == NULL) {
 		od_error(logger, "config", NULL, NULL, "log is not defined");
 		return -1;
 	}
 
+	/* async log buffer has to fit several log lines */
+	if (config->log_async && config->log_async_buffer < 16384) {
+		od_error(logger, "config", NULL, NULL,
+		         "log_async_buffer must be at least 16384 bytes");
+		return -1;
+	}
+
+	/* metrics */
+	if (config->metrics_port < 0 || config->metrics_port > 65535) {
+		od_error(logger, "config", NULL, NULL, "bad metrics_port");
+		return -1;
+	}
+
+	/* spans */
+	if (config->span_port < 0 || config->span_port > 65535) {
+		od_error(logger, "config", NULL, NULL, "bad span_port");
+		return -1;
+	}
+	if (config->span_sample_rate < 0 || config->span_sample_rate > 100) {
+		od_error(logger, "config", NULL, NULL,
+		         "span_sample_rate must be between 0 and 100");
+		return -1;
+	}
+	if (config->span_port && config->span_queue <= 0) {
+		od_error(logger, "config", NULL, NULL, "bad span_queue number");
+		return -1;
+	}
+
+	/* mirror */
+	if (config->mirror_queue < 0) {
+		od_error(logger, "config", NULL, NULL, "bad mirror_queue number");
+		return -1;
+	}
+
+	/* fleet */
+	if (config->fleet_port < 0 || config->fleet_port > 65535) {
+		od_error(logger, "config", NULL, NULL, "bad fleet_port");
+		return -1;
+	}
+	if (config->fleet_port &&
+	    (config->fleet_interval <= 0 ||
+	     config->fleet_timeout < config->fleet_interval)) {
+		od_error(logger, "config", NULL, NULL,
+		         "fleet_timeout must not be less than fleet_interval");
+		return -1;
+	}
+
 	/* unix_socket_mode */
 	if (config->unix_socket_dir) {
 		if (config->unix_socket_mode == NULL) {
@@ -156,8 +597,8 @@ od_config_validate(od_config_t *config, od_logger_t *logger)
 		}
 	}
 
-	/* listen */
-	if (od_list_empty(&config->listen)) {
+	/* listen, embedded instance may serve in-process clients only */
+	if (od_list_empty(&config->listen) && ! config->embedded) {
 		od_error(logger, "config", NULL, NULL, "no listen servers defined");
 		return -1;
 	}
@@ -196,6 +637,31 @@ od_config_validate(od_config_t *config, od_logger_t *logger)
 				return -1;
 			}
 		}
+		if (listen->tls_session_cache < 0 || listen->tls_session_timeout <= 0) {
+			od_error(logger, "config", NULL, NULL,
+			         "bad tls_session_cache or tls_session_timeout");
+			return -1;
+		}
+		if (listen->tls_verify_cache < 0 || listen->tls_verify_timeout <= 0) {
+			od_error(logger, "config", NULL, NULL,
+			         "bad tls_verify_cache or tls_verify_timeout");
+			return -1;
+		}
+		if (listen->sndbuf < 0 || listen->rcvbuf < 0 ||
+		    listen->tcp_notsent_lowat < 0 || listen->tcp_user_timeout < 0 ||
+		    listen->busy_poll < 0 || listen->tcp_fastopen < 0 ||
+		    listen->zerocopy_threshold < 0) {
+			od_error(logger, "config", NULL, NULL,
+			         "bad listen socket options");
+			return -1;
+		}
+		if (listen->worker_group &&
+		    ! od_config_worker_group_exists(config, listen->worker_group)) {
+			od_error(logger, "config", NULL, NULL,
+			         "listen worker_group '%s' is not defined",
+			         listen->worker_group);
+			return -1;
+		}
 	}
 
 	return 0;
@@ -223,12 +689,24 @@ od_config_print(od_config_t *config, od_logger_t *logger)
 		od_log(logger, "config", NULL, NULL,
 		       "unix_socket_mode     %s", config->unix_socket_mode);
 	}
+	if (config->online_restart_socket)
+		od_log(logger, "config", NULL, NULL,
+		       "online_restart_socket %s", config->online_restart_socket);
+	if (config->tls_engine)
+		od_log(logger, "config", NULL, NULL,
+		       "tls_engine           %s", config->tls_engine);
 	if (config->log_format)
 		od_log(logger, "config", NULL, NULL,
 		       "log_format           %s", config->log_format);
 	if (config->log_file)
 		od_log(logger, "config", NULL, NULL,
 		       "log_file             %s", config->log_file);
+	if (config->log_binary_file)
+		od_log(logger, "config", NULL, NULL,
+		       "log_binary_file      %s", config->log_binary_file);
+	if (config->capture_file)
+		od_log(logger, "config", NULL, NULL,
+		       "capture_file         %s", config->capture_file);
 	od_log(logger, "config", NULL, NULL,
 	       "log_to_stdout        %s",
 	       od_config_yes_no(config->log_to_stdout));
@@ -241,6 +719,16 @@ od_config_print(od_config_t *config, od_logger_t *logger)
 	if (config->log_syslog_facility)
 		od_log(logger, "config", NULL, NULL,
 		       "log_syslog_facility  %s", config->log_syslog_facility);
+	od_log(logger, "config", NULL, NULL,
+	       "log_async            %s",
+	       od_config_yes_no(config->log_async));
+	if (config->log_async) {
+		od_log(logger, "config", NULL, NULL,
+		       "log_async_buffer     %d", config->log_async_buffer);
+		od_log(logger, "config", NULL, NULL,
+		       "log_async_block      %s",
+		       od_config_yes_no(config->log_async_block));
+	}
 	od_log(logger, "config", NULL, NULL,
 	       "log_debug            %s",
 	       od_config_yes_no(config->log_debug));
@@ -258,8 +746,91 @@ od_config_print(od_config_t *config, od_logger_t *logger)
 	       od_config_yes_no(config->log_stats));
 	od_log(logger, "config", NULL, NULL,
 	       "stats_interval       %d", config->stats_interval);
+	if (config->query_fingerprint)
+		od_log(logger, "config", NULL, NULL,
+		       "query_fingerprint    %d", config->query_fingerprint_max);
+	if (config->top_size)
+		od_log(logger, "config", NULL, NULL,
+		       "top_size             %d", config->top_size);
+	if (config->accept_stats_interval)
+		od_log(logger, "config", NULL, NULL,
+		       "accept_stats_interval %d", config->accept_stats_interval);
+	if (config->stats_shm) {
+		od_log(logger, "config", NULL, NULL,
+		       "stats_shm            %s", config->stats_shm);
+		od_log(logger, "config", NULL, NULL,
+		       "stats_shm_routes     %d", config->stats_shm_routes);
+	}
+	if (config->metrics_port) {
+		od_log(logger, "config", NULL, NULL,
+		       "metrics_host         %s",
+		       config->metrics_host ? config->metrics_host : "127.0.0.1");
+		od_log(logger, "config", NULL, NULL,
+		       "metrics_port         %d", config->metrics_port);
+	}
+	if (config->span_port) {
+		od_log(logger, "config", NULL, NULL,
+		       "span_host            %s",
+		       config->span_host ? config->span_host : "127.0.0.1");
+		od_log(logger, "config", NULL, NULL,
+		       "span_port            %d", config->span_port);
+		od_log(logger, "config", NULL, NULL,
+		       "span_parameter       %s",
+		       config->span_parameter ? config->span_parameter :
+		                                "application_name");
+		od_log(logger, "config", NULL, NULL,
+		       "span_sample_rate     %d", config->span_sample_rate);
+		od_log(logger, "config", NULL, NULL,
+		       "span_queue           %d", config->span_queue);
+	}
+	if (config->mirror_queue)
+		od_log(logger, "config", NULL, NULL,
+		       "mirror_queue         %d", config->mirror_queue);
+	if (config->fleet_port) {
+		od_log(logger, "config", NULL, NULL,
+		       "fleet_host           %s",
+		       config->fleet_host ? config->fleet_host : "127.0.0.1");
+		od_log(logger, "config", NULL, NULL,
+		       "fleet_port           %d", config->fleet_port);
+		if (config->fleet_peers)
+			od_log(logger, "config", NULL, NULL,
+			       "fleet_peers          %s", config->fleet_peers);
+		od_log(logger, "config", NULL, NULL,
+		       "fleet_interval       %d", config->fleet_interval);
+		od_log(logger, "config", NULL, NULL,
+		       "fleet_timeout        %d", config->fleet_timeout);
+	}
 	od_log(logger, "config", NULL, NULL,
 	       "readahead            %d", config->readahead);
+	od_log(logger, "config", NULL, NULL,
+	       "readahead_ring       %s",
+	       od_config_yes_no(config->readahead_ring));
+	od_log(logger, "config", NULL, NULL,
+	       "relay_splice         %s",
+	       od_config_yes_no(config->relay_splice));
+	od_log(logger, "config", NULL, NULL,
+	       "relay_coalesce       %s",
+	       od_config_yes_no(config->relay_coalesce));
+	od_log(logger, "config", NULL, NULL,
+	       "relay_buffer_max     %d", config->relay_buffer_max);
+	od_log(logger, "config", NULL, NULL,
+	       "relay_watermark_high %d", config->relay_watermark_high);
+	od_log(logger, "config", NULL, NULL,
+	       "relay_watermark_low  %d", config->relay_watermark_low);
+	if (config->relay_memory_max)
+		od_log(logger, "config", NULL, NULL,
+		       "relay_memory_max     %" PRId64, config->relay_memory_max);
+	od_log(logger, "config", NULL, NULL,
+	       "relay_read_budget    %d", config->relay_read_budget);
+	if (config->relay_spool) {
+		od_log(logger, "config", NULL, NULL,
+		       "relay_spool          %d", config->relay_spool);
+		od_log(logger, "config", NULL, NULL,
+		       "relay_spool_memory   %d", config->relay_spool_memory);
+		if (config->relay_spool_dir)
+			od_log(logger, "config", NULL, NULL,
+			       "relay_spool_dir      %s", config->relay_spool_dir);
+	}
 	od_log(logger, "config", NULL, NULL,
 	       "nodelay              %s",
 	       od_config_yes_no(config->nodelay));
@@ -270,18 +841,98 @@ od_config_print(od_config_t *config, od_logger_t *logger)
 		       "client_max           %d", config->client_max);
 	od_log(logger, "config", NULL, NULL,
 	       "client_max_routing   %d", config->client_max_routing);
+	if (config->client_overload)
+		od_log(logger, "config", NULL, NULL,
+		       "client_overload      %s", config->client_overload);
+	if (config->client_overload_latency)
+		od_log(logger, "config", NULL, NULL,
+		       "client_overload_latency %d", config->client_overload_latency);
+	od_log(logger, "config", NULL, NULL,
+	       "client_idle_release  %d", config->client_idle_release);
 	od_log(logger, "config", NULL, NULL,
 	       "server_login_retry   %d", config->server_login_retry);
+	od_log(logger, "config", NULL, NULL,
+	       "server_connect_async %s",
+	       od_config_yes_no(config->server_connect_async));
+	if (config->track_parameters)
+		od_log(logger, "config", NULL, NULL,
+		       "track_parameters     %s", config->track_parameters);
 	od_log(logger, "config", NULL, NULL,
 	       "cache_msg_gc_size    %d", config->cache_msg_gc_size);
+	od_log(logger, "config", NULL, NULL,
+	       "cache_msg_class_limit %d", config->cache_msg_class_limit);
 	od_log(logger, "config", NULL, NULL,
 	       "cache_coroutine      %d", config->cache_coroutine);
+	od_log(logger, "config", NULL, NULL,
+	       "cache_client         %d", config->cache_client);
+	od_log(logger, "config", NULL, NULL,
+	       "cache_server         %d", config->cache_server);
 	od_log(logger, "config", NULL, NULL,
 	       "coroutine_stack_size %d", config->coroutine_stack_size);
+	od_log(logger, "config", NULL, NULL,
+	       "coroutine_stack_hugepages %s",
+	       od_config_yes_no(config->coroutine_stack_hugepages));
+	if (config->coroutine_stack_watermark)
+		od_log(logger, "config", NULL, NULL,
+		       "coroutine_stack_watermark yes");
+	od_log(logger, "config", NULL, NULL,
+	       "coroutine_accounting %s",
+	       od_config_yes_no(config->coroutine_accounting));
+	if (config->lock_stats)
+		od_log(logger, "config", NULL, NULL,
+		       "lock_stats           %s",
+		       od_config_yes_no(config->lock_stats));
 	od_log(logger, "config", NULL, NULL,
 	       "workers              %d", config->workers);
+	if (config->workers_max != config->workers)
+		od_log(logger, "config", NULL, NULL,
+		       "workers_max          %d", config->workers_max);
+	if (config->handshake_workers)
+		od_log(logger, "config", NULL, NULL,
+		       "handshake_workers    %d", config->handshake_workers);
+	od_log(logger, "config", NULL, NULL,
+	       "reuseport            %s",
+	       od_config_yes_no(config->reuseport));
+	if (config->reuseport_cpu)
+		od_log(logger, "config", NULL, NULL,
+		       "reuseport_cpu        %s",
+		       od_config_yes_no(config->reuseport_cpu));
+	if (config->client_placement)
+		od_log(logger, "config", NULL, NULL,
+		       "client_placement     %s", config->client_placement);
+	if (config->worker_cpus)
+		od_log(logger, "config", NULL, NULL,
+		       "worker_cpus          %s", config->worker_cpus);
+	if (config->worker_groups)
+		od_log(logger, "config", NULL, NULL,
+		       "worker_groups        %s", config->worker_groups);
+	if (config->system_cpus)
+		od_log(logger, "config", NULL, NULL,
+		       "system_cpus          %s", config->system_cpus);
+	od_log(logger, "config", NULL, NULL,
+	       "tls_ticket_rotate    %d", config->tls_ticket_rotate);
 	od_log(logger, "config", NULL, NULL,
 	       "resolvers            %d", config->resolvers);
+	if (config->dns_cache_ttl)
+		od_log(logger, "config", NULL, NULL,
+		       "dns_cache_ttl        %d", config->dns_cache_ttl);
+	if (config->poller)
+		od_log(logger, "config", NULL, NULL,
+		       "poller               %s", config->poller);
+	if (config->poll_spin)
+		od_log(logger, "config", NULL, NULL,
+		       "poll_spin            %d", config->poll_spin);
+	if (config->watchdog_stall)
+		od_log(logger, "config", NULL, NULL,
+		       "watchdog_stall       %d", config->watchdog_stall);
+	if (config->clock_source)
+		od_log(logger, "config", NULL, NULL,
+		       "clock_source         %s", config->clock_source);
+	if (config->resolver)
+		od_log(logger, "config", NULL, NULL,
+		       "resolver             %s", config->resolver);
+	od_log(logger, "config", NULL, NULL,
+	       "pam_workers          %d", config->pam_workers);
 	od_log(logger, "config", NULL, NULL, "");
 	od_list_t *i;
 	od_list_foreach(&config->listen, i)
@@ -310,6 +961,57 @@ od_config_print(od_config_t *config, od_logger_t *logger)
 		if (listen->tls_protocols)
 			od_log(logger, "config", NULL, NULL,
 			       "  tls_protocols %s", listen->tls_protocols);
+		if (listen->tls) {
+			od_log(logger, "config", NULL, NULL,
+			       "  tls_session_cache   %d", listen->tls_session_cache);
+			od_log(logger, "config", NULL, NULL,
+			       "  tls_session_timeout %d", listen->tls_session_timeout);
+			if (listen->tls_verify_cache) {
+				od_log(logger, "config", NULL, NULL,
+				       "  tls_verify_cache    %d", listen->tls_verify_cache);
+				od_log(logger, "config", NULL, NULL,
+				       "  tls_verify_timeout  %d", listen->tls_verify_timeout);
+			}
+			od_log(logger, "config", NULL, NULL,
+			       "  tls_ktls            %s",
+			       od_config_yes_no(listen->tls_ktls));
+			od_log(logger, "config", NULL, NULL,
+			       "  tls_async           %s",
+			       od_config_yes_no(listen->tls_async));
+		}
+		if (listen->compression)
+			od_log(logger, "config", NULL, NULL,
+			       "  compression yes");
+		if (listen->mux)
+			od_log(logger, "config", NULL, NULL,
+			       "  mux         yes");
+		if (listen->sndbuf)
+			od_log(logger, "config", NULL, NULL,
+			       "  sndbuf           %d", listen->sndbuf);
+		if (listen->rcvbuf)
+			od_log(logger, "config", NULL, NULL,
+			       "  rcvbuf           %d", listen->rcvbuf);
+		if (listen->tcp_notsent_lowat)
+			od_log(logger, "config", NULL, NULL,
+			       "  tcp_notsent_lowat%d", listen->tcp_notsent_lowat);
+		if (listen->tcp_user_timeout)
+			od_log(logger, "config", NULL, NULL,
+			       "  tcp_user_timeout %d", listen->tcp_user_timeout);
+		if (listen->tcp_quickack)
+			od_log(logger, "config", NULL, NULL,
+			       "  tcp_quickack     yes");
+		if (listen->tcp_fastopen)
+			od_log(logger, "config", NULL, NULL,
+			       "  tcp_fastopen     %d", listen->tcp_fastopen);
+		if (listen->busy_poll)
+			od_log(logger, "config", NULL, NULL,
+			       "  busy_poll        %d", listen->busy_poll);
+		if (listen->zerocopy_threshold)
+			od_log(logger, "config", NULL, NULL,
+			       "  zerocopy_threshold %d", listen->zerocopy_threshold);
+		if (listen->worker_group)
+			od_log(logger, "config", NULL, NULL,
+			       "  worker_group     %s", listen->worker_group);
 		od_log(logger, "config", NULL, NULL, "");
 	}
 }
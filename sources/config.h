@@ -7,8 +7,14 @@
  * Scalable PostgreSQL connection pooler.
 */
 
-typedef struct od_config_listen od_config_listen_t;
-typedef struct od_config        od_config_t;
+typedef struct od_config_listen       od_config_listen_t;
+typedef struct od_config_worker_group od_config_worker_group_t;
+typedef struct od_config              od_config_t;
+
+#define OD_CONFIG_CPUS_MAX 1024
+
+#define OD_CONFIG_WORKER_GROUPS_MAX 16
+#define OD_CONFIG_WORKER_GROUP_NAME 64
 
 typedef enum
 {
@@ -30,13 +36,37 @@ struct od_config_listen
 	char             *tls_key_file;
 	char             *tls_cert_file;
 	char             *tls_protocols;
+	int               tls_session_cache;
+	int               tls_session_timeout;
+	int               tls_verify_cache;
+	int               tls_verify_timeout;
+	int               tls_ktls;
+	int               tls_async;
+	int               compression;
+	int               mux;
+	int               sndbuf;
+	int               rcvbuf;
+	int               tcp_notsent_lowat;
+	int               tcp_user_timeout;
+	int               tcp_quickack;
+	int               tcp_fastopen;
+	int               zerocopy_threshold;
+	int               busy_poll;
 	int               client_login_timeout;
+	char             *worker_group;
 	od_list_t         link;
 };
 
+struct od_config_worker_group
+{
+	char name[OD_CONFIG_WORKER_GROUP_NAME];
+	int  count;
+};
+
 struct od_config
 {
 	int        daemonize;
+	int        embedded;
 	int        priority;
 	int        log_to_stdout;
 	int        log_debug;
@@ -45,33 +75,98 @@ struct od_config
 	int        log_query;
 	char      *log_file;
 	char      *log_format;
+	char      *log_binary_file;
+	char      *capture_file;
 	int        log_stats;
 	int        log_syslog;
 	char      *log_syslog_ident;
 	char      *log_syslog_facility;
+	int        log_async;
+	int        log_async_buffer;
+	int        log_async_block;
 	int        stats_interval;
+	int        query_fingerprint;
+	int        query_fingerprint_max;
+	int        top_size;
+	int        accept_stats_interval;
+	char      *stats_shm;
+	int        stats_shm_routes;
+	char      *metrics_host;
+	int        metrics_port;
+	char      *span_host;
+	int        span_port;
+	char      *span_parameter;
+	int        span_sample_rate;
+	int        span_queue;
+	int        mirror_queue;
+	char      *fleet_host;
+	int        fleet_port;
+	char      *fleet_peers;
+	int        fleet_interval;
+	int        fleet_timeout;
 	char      *pid_file;
 	char      *unix_socket_dir;
 	char      *unix_socket_mode;
+	char      *online_restart_socket;
+	char      *tls_engine;
 	int        readahead;
+	int        readahead_ring;
+	int        relay_splice;
+	int        relay_coalesce;
+	int        relay_buffer_max;
+	int        relay_watermark_high;
+	int        relay_watermark_low;
+	int64_t    relay_memory_max;
+	int        relay_read_budget;
+	int        relay_spool;
+	int        relay_spool_memory;
+	char      *relay_spool_dir;
 	int        nodelay;
 	int        keepalive;
 	int        workers;
+	int        workers_max;
+	int        handshake_workers;
+	int        reuseport;
+	int        reuseport_cpu;
+	char      *client_placement;
+	char      *worker_cpus;
+	char      *worker_groups;
+	char      *system_cpus;
+	int        tls_ticket_rotate;
 	int        resolvers;
+	int        dns_cache_ttl;
 	int        client_max_set;
 	int        client_max;
 	int        client_max_routing;
+	char      *client_overload;
+	int        client_overload_latency;
+	int        client_idle_release;
 	int        server_login_retry;
+	int        server_connect_async;
+	char      *track_parameters;
 	int        cache_coroutine;
+	int        cache_client;
+	int        cache_server;
 	int        cache_msg_gc_size;
+	int        cache_msg_class_limit;
 	int        coroutine_stack_size;
+	int        coroutine_stack_hugepages;
+	int        coroutine_stack_watermark;
+	int        coroutine_accounting;
+	int        lock_stats;
+	char      *poller;
+	int        poll_spin;
+	int        watchdog_stall;
+	char      *clock_source;
+	char      *resolver;
+	int        pam_workers;
 	od_list_t  listen;
 };
 
 static inline int
 od_config_is_multi_workers(od_config_t *config)
 {
-	return config->workers > 1;
+	return config->workers_max > 1 || config->handshake_workers > 0;
 }
 
 void od_config_init(od_config_t*);
@@ -79,6 +174,9 @@ void od_config_free(od_config_t*);
 void od_config_reload(od_config_t*, od_config_t*);
 int  od_config_validate(od_config_t*, od_logger_t*);
 void od_config_print(od_config_t*, od_logger_t*);
+int  od_config_cpus_parse(char*, int*, int);
+int  od_config_worker_groups_parse(char*, od_config_worker_group_t*, int);
+int  od_config_worker_group_exists(od_config_t*, char*);
 
 od_config_listen_t*
 od_config_listen_add(od_config_t*);
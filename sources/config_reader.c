@@ -38,14 +38,39 @@ enum
 	OD_LLOG_QUERY,
 	OD_LLOG_FILE,
 	OD_LLOG_FORMAT,
+	OD_LLOG_BINARY_FILE,
+	OD_LCAPTURE_FILE,
 	OD_LLOG_STATS,
 	OD_LPID_FILE,
 	OD_LUNIX_SOCKET_DIR,
 	OD_LUNIX_SOCKET_MODE,
+	OD_LONLINE_RESTART_SOCKET,
 	OD_LLOG_SYSLOG,
 	OD_LLOG_SYSLOG_IDENT,
 	OD_LLOG_SYSLOG_FACILITY,
+	OD_LLOG_ASYNC,
+	OD_LLOG_ASYNC_BUFFER,
+	OD_LLOG_ASYNC_BLOCK,
 	OD_LSTATS_INTERVAL,
+	OD_LQUERY_FINGERPRINT,
+	OD_LQUERY_FINGERPRINT_MAX,
+	OD_LTOP_SIZE,
+	OD_LACCEPT_STATS_INTERVAL,
+	OD_LSTATS_SHM,
+	OD_LSTATS_SHM_ROUTES,
+	OD_LMETRICS_HOST,
+	OD_LMETRICS_PORT,
+	OD_LSPAN_HOST,
+	OD_LSPAN_PORT,
+	OD_LSPAN_PARAMETER,
+	OD_LSPAN_SAMPLE_RATE,
+	OD_LSPAN_QUEUE,
+	OD_LMIRROR_QUEUE,
+	OD_LFLEET_HOST,
+	OD_LFLEET_PORT,
+	OD_LFLEET_PEERS,
+	OD_LFLEET_INTERVAL,
+	OD_LFLEET_TIMEOUT,
 	OD_LLISTEN,
 	OD_LHOST,
 	OD_LPORT,
@@ -53,19 +78,59 @@ enum
 	OD_LNODELAY,
 	OD_LKEEPALIVE,
 	OD_LREADAHEAD,
+	OD_LREADAHEAD_RING,
+	OD_LRELAY_SPLICE,
+	OD_LRELAY_COALESCE,
+	OD_LRELAY_BUFFER_MAX,
+	OD_LRELAY_WATERMARK_HIGH,
+	OD_LRELAY_WATERMARK_LOW,
+	OD_LRELAY_MEMORY_MAX,
+	OD_LRELAY_READ_BUDGET,
+	OD_LRELAY_SPOOL,
+	OD_LRELAY_SPOOL_MEMORY,
+	OD_LRELAY_SPOOL_DIR,
 	OD_LWORKERS,
+	OD_LWORKERS_MAX,
+	OD_LHANDSHAKE_WORKERS,
+	OD_LREUSEPORT,
+	OD_LREUSEPORT_CPU,
+	OD_LCLIENT_PLACEMENT,
+	OD_LWORKER_CPUS,
+	OD_LWORKER_GROUPS,
+	OD_LWORKER_GROUP,
+	OD_LSYSTEM_CPUS,
 	OD_LRESOLVERS,
+	OD_LDNS_CACHE_TTL,
 	OD_LPIPELINE,
 	OD_LPACKET_READ_SIZE,
 	OD_LPACKET_WRITE_QUEUE,
 	OD_LCACHE,
 	OD_LCACHE_CHUNK,
 	OD_LCACHE_MSG_GC_SIZE,
+	OD_LCACHE_MSG_CLASS_LIMIT,
 	OD_LCACHE_COROUTINE,
+	OD_LCACHE_CLIENT,
+	OD_LCACHE_SERVER,
 	OD_LCOROUTINE_STACK_SIZE,
+	OD_LCOROUTINE_STACK_HUGEPAGES,
+	OD_LCOROUTINE_STACK_WATERMARK,
+	OD_LCOROUTINE_ACCOUNTING,
+	OD_LLOCK_STATS,
+	OD_LPOLLER,
+	OD_LPOLL_SPIN,
+	OD_LWATCHDOG_STALL,
+	OD_LCLOCK_SOURCE,
+	OD_LRESOLVER,
+	OD_LPAM_WORKERS,
 	OD_LCLIENT_MAX,
+	OD_LMEMORY_MAX,
 	OD_LCLIENT_MAX_ROUTING,
+	OD_LCLIENT_OVERLOAD,
+	OD_LCLIENT_OVERLOAD_LATENCY,
+	OD_LCLIENT_IDLE_RELEASE,
 	OD_LSERVER_LOGIN_RETRY,
+	OD_LSERVER_CONNECT_ASYNC,
+	OD_LTRACK_PARAMETERS,
 	OD_LCLIENT_LOGIN_TIMEOUT,
 	OD_LCLIENT_FWD_ERROR,
 	OD_LAPPLICATION_NAME_ADD_HOST,
@@ -74,30 +139,117 @@ enum
 	OD_LTLS_KEY_FILE,
 	OD_LTLS_CERT_FILE,
 	OD_LTLS_PROTOCOLS,
+	OD_LTLS_SESSION_CACHE,
+	OD_LTLS_SESSION_TIMEOUT,
+	OD_LTLS_VERIFY_CACHE,
+	OD_LTLS_VERIFY_TIMEOUT,
+	OD_LTLS_KTLS,
+	OD_LTLS_DIRECT,
+	OD_LTLS_ASYNC,
+	OD_LTLS_ENGINE,
+	OD_LCOMPRESSION,
+	OD_LMUX,
+	OD_LMUX_LINKS,
+	OD_LSNDBUF,
+	OD_LRCVBUF,
+	OD_LTCP_NOTSENT_LOWAT,
+	OD_LTCP_USER_TIMEOUT,
+	OD_LTCP_QUICKACK,
+	OD_LTCP_FASTOPEN,
+	OD_LTCP_FASTOPEN_CONNECT,
+	OD_LBUSY_POLL,
+	OD_LZEROCOPY_THRESHOLD,
+	OD_LTLS_TICKET_ROTATE,
 	OD_LSTORAGE,
 	OD_LTYPE,
 	OD_LSERVERS_MAX_ROUTING,
+	OD_LSERVER_MAX,
+	OD_LCANCEL_RATE,
+	OD_LBREAKER_THRESHOLD,
+	OD_LBREAKER_BACKOFF,
+	OD_LBREAKER_BACKOFF_MAX,
+	OD_LLOAD_BALANCE,
+	OD_LTARGET_SESSION_ATTRS,
+	OD_LHEALTH_CHECK_INTERVAL,
+	OD_LHEALTH_CHECK_TIMEOUT,
+	OD_LHEALTH_CHECK_MAX_LAG,
+	OD_LHEALTH_CHECK_MAX_RTT,
+	OD_LTCP_INFO_INTERVAL,
+	OD_LHEALTH_CHECK_DB,
+	OD_LHEALTH_CHECK_USER,
 	OD_LDEFAULT,
 	OD_LDATABASE,
 	OD_LUSER,
 	OD_LPASSWORD,
 	OD_LPOOL,
 	OD_LPOOL_SIZE,
+	OD_LPOOL_MIN_SIZE,
 	OD_LPOOL_TIMEOUT,
+	OD_LPOOL_RESERVE_SIZE,
+	OD_LPOOL_RESERVE_TIMEOUT,
 	OD_LPOOL_TTL,
+	OD_LPOOL_CHECK_IDLE,
+	OD_LPOOL_RATE,
+	OD_LPOOL_ACTIVE_MAX,
+	OD_LPOOL_FLEET_MAX,
+	OD_LPOOL_BATCH,
+	OD_LPOOL_BATCH_WEIGHT,
+	OD_LPOOL_SHARED,
+	OD_LCLIENT_IDLE_TIMEOUT,
+	OD_LCLIENT_IDLE_IN_TRANSACTION_TIMEOUT,
+	OD_LQUERY_TIMEOUT,
+	OD_LREADAHEAD_MIN,
+	OD_LREADAHEAD_MAX,
 	OD_LPOOL_DISCARD,
+	OD_LPOOL_DISCARD_TRACK,
+	OD_LPOOL_LISTEN,
+	OD_LPOOL_WAL_RELAY,
+	OD_LPOOL_WAL_RELAY_SIZE,
+	OD_LPOOL_WAL_RELAY_DIR,
 	OD_LPOOL_CANCEL,
 	OD_LPOOL_ROLLBACK,
+	OD_LPOOL_TRACK_SET,
+	OD_LPOOL_PASSTHROUGH,
+	OD_LPOOL_ADAPTIVE,
+	OD_LPOOL_SELECT,
+	OD_LSERVER_LIFETIME,
+	OD_LPOOL_CODEL_TARGET,
+	OD_LPOOL_CODEL_INTERVAL,
+	OD_LPOOL_PREPARED_STATEMENTS,
+	OD_LPOOL_PREPARED_STATEMENTS_MAX,
+	OD_LPOOL_PIPELINE,
+	OD_LPOOL_PIPELINE_DEPTH,
 	OD_LSTORAGE_DB,
 	OD_LSTORAGE_USER,
 	OD_LSTORAGE_PASSWORD,
+	OD_LSTORAGE_READ,
+	OD_LSTORAGE_READ_EXCLUDE,
+	OD_LSTORAGE_MIRROR,
+	OD_LSTORAGE_MIRROR_SAMPLE,
+	OD_LSTORAGE_MIRROR_POOL_SIZE,
+	OD_LSTORAGE_SHARDS,
+	OD_LSHARD_KEY,
+	OD_LSHARD_PARAMETER,
 	OD_LAUTHENTICATION,
 	OD_LAUTH_COMMON_NAME,
 	OD_LAUTH_PAM_SERVICE,
+	OD_LAUTH_PAM_CACHE_TTL,
 	OD_LAUTH_QUERY,
 	OD_LAUTH_QUERY_DB,
 	OD_LAUTH_QUERY_USER,
+	OD_LAUTH_QUERY_CACHE_TTL,
+	OD_LAUTH_QUERY_CACHE_NEGATIVE_TTL,
+	OD_LAUTH_QUERY_CACHE_MAX,
 	OD_LQUANTILES,
+	OD_LQUANTILES_PRECISION,
+	OD_LLOG_QUERY_SAMPLE,
+	OD_LLOG_QUERY_SAMPLE_RANDOM,
+	OD_LCAPTURE_SAMPLE,
+	OD_LLOG_QUERY_RATE,
+	OD_LLOG_QUERY_MIN_DURATION,
+	OD_LQUERY_CACHE,
+	OD_LQUERY_CACHE_TTL,
+	OD_LQUERY_CACHE_SIZE,
 };
 
 typedef struct
@@ -123,6 +275,7 @@ od_config_keywords[] =
 	od_keyword("pid_file",             OD_LPID_FILE),
 	od_keyword("unix_socket_dir",      OD_LUNIX_SOCKET_DIR),
 	od_keyword("unix_socket_mode",     OD_LUNIX_SOCKET_MODE),
+	od_keyword("online_restart_socket", OD_LONLINE_RESTART_SOCKET),
 	od_keyword("log_debug",            OD_LLOG_DEBUG),
 	od_keyword("log_to_stdout",        OD_LLOG_TO_STDOUT),
 	od_keyword("log_config",           OD_LLOG_CONFIG),
@@ -130,32 +283,96 @@ od_config_keywords[] =
 	od_keyword("log_query",            OD_LLOG_QUERY),
 	od_keyword("log_file",             OD_LLOG_FILE),
 	od_keyword("log_format",           OD_LLOG_FORMAT),
+	od_keyword("log_binary_file",      OD_LLOG_BINARY_FILE),
+	od_keyword("capture_file",         OD_LCAPTURE_FILE),
 	od_keyword("log_stats",            OD_LLOG_STATS),
 	od_keyword("log_syslog",           OD_LLOG_SYSLOG),
 	od_keyword("log_syslog_ident",     OD_LLOG_SYSLOG_IDENT),
 	od_keyword("log_syslog_facility",  OD_LLOG_SYSLOG_FACILITY),
+	od_keyword("log_async",            OD_LLOG_ASYNC),
+	od_keyword("log_async_buffer",     OD_LLOG_ASYNC_BUFFER),
+	od_keyword("log_async_block",      OD_LLOG_ASYNC_BLOCK),
 	od_keyword("stats_interval",       OD_LSTATS_INTERVAL),
+	od_keyword("query_fingerprint",    OD_LQUERY_FINGERPRINT),
+	od_keyword("query_fingerprint_max", OD_LQUERY_FINGERPRINT_MAX),
+	od_keyword("top_size",             OD_LTOP_SIZE),
+	od_keyword("accept_stats_interval", OD_LACCEPT_STATS_INTERVAL),
+	od_keyword("stats_shm",            OD_LSTATS_SHM),
+	od_keyword("stats_shm_routes",     OD_LSTATS_SHM_ROUTES),
+	od_keyword("metrics_host",         OD_LMETRICS_HOST),
+	od_keyword("metrics_port",         OD_LMETRICS_PORT),
+	od_keyword("span_host",            OD_LSPAN_HOST),
+	od_keyword("span_port",            OD_LSPAN_PORT),
+	od_keyword("span_parameter",       OD_LSPAN_PARAMETER),
+	od_keyword("span_sample_rate",     OD_LSPAN_SAMPLE_RATE),
+	od_keyword("span_queue",           OD_LSPAN_QUEUE),
+	od_keyword("mirror_queue",         OD_LMIRROR_QUEUE),
+	od_keyword("fleet_host",           OD_LFLEET_HOST),
+	od_keyword("fleet_port",           OD_LFLEET_PORT),
+	od_keyword("fleet_peers",          OD_LFLEET_PEERS),
+	od_keyword("fleet_interval",       OD_LFLEET_INTERVAL),
+	od_keyword("fleet_timeout",        OD_LFLEET_TIMEOUT),
 	/* listen */
 	od_keyword("listen",               OD_LLISTEN),
 	od_keyword("host",                 OD_LHOST),
 	od_keyword("port",                 OD_LPORT),
 	od_keyword("backlog",              OD_LBACKLOG),
 	od_keyword("nodelay",              OD_LNODELAY),
+	od_keyword("relay_splice",         OD_LRELAY_SPLICE),
+	od_keyword("relay_coalesce",       OD_LRELAY_COALESCE),
+	od_keyword("relay_buffer_max",     OD_LRELAY_BUFFER_MAX),
+	od_keyword("relay_watermark_high", OD_LRELAY_WATERMARK_HIGH),
+	od_keyword("relay_watermark_low",  OD_LRELAY_WATERMARK_LOW),
+	od_keyword("relay_memory_max",     OD_LRELAY_MEMORY_MAX),
+	od_keyword("relay_read_budget",    OD_LRELAY_READ_BUDGET),
+	od_keyword("relay_spool",          OD_LRELAY_SPOOL),
+	od_keyword("relay_spool_memory",   OD_LRELAY_SPOOL_MEMORY),
+	od_keyword("relay_spool_dir",      OD_LRELAY_SPOOL_DIR),
 	od_keyword("keepalive",            OD_LKEEPALIVE),
 	od_keyword("readahead",            OD_LREADAHEAD),
+	od_keyword("readahead_ring",       OD_LREADAHEAD_RING),
 	od_keyword("workers",              OD_LWORKERS),
+	od_keyword("workers_max",          OD_LWORKERS_MAX),
+	od_keyword("handshake_workers",    OD_LHANDSHAKE_WORKERS),
+	od_keyword("reuseport",            OD_LREUSEPORT),
+	od_keyword("reuseport_cpu",        OD_LREUSEPORT_CPU),
+	od_keyword("client_placement",     OD_LCLIENT_PLACEMENT),
+	od_keyword("worker_cpus",          OD_LWORKER_CPUS),
+	od_keyword("worker_groups",        OD_LWORKER_GROUPS),
+	od_keyword("worker_group",         OD_LWORKER_GROUP),
+	od_keyword("system_cpus",          OD_LSYSTEM_CPUS),
 	od_keyword("resolvers",            OD_LRESOLVERS),
+	od_keyword("dns_cache_ttl",        OD_LDNS_CACHE_TTL),
 	od_keyword("pipeline",             OD_LPIPELINE),
 	od_keyword("packet_read_size",     OD_LPACKET_READ_SIZE),
 	od_keyword("packet_write_queue",   OD_LPACKET_WRITE_QUEUE),
 	od_keyword("cache",                OD_LCACHE),
 	od_keyword("cache_chunk",          OD_LCACHE_CHUNK),
 	od_keyword("cache_msg_gc_size",    OD_LCACHE_MSG_GC_SIZE),
+	od_keyword("cache_msg_class_limit", OD_LCACHE_MSG_CLASS_LIMIT),
 	od_keyword("cache_coroutine",      OD_LCACHE_COROUTINE),
+	od_keyword("cache_client",         OD_LCACHE_CLIENT),
+	od_keyword("cache_server",         OD_LCACHE_SERVER),
 	od_keyword("coroutine_stack_size", OD_LCOROUTINE_STACK_SIZE),
+	od_keyword("coroutine_stack_hugepages", OD_LCOROUTINE_STACK_HUGEPAGES),
+	od_keyword("coroutine_stack_watermark", OD_LCOROUTINE_STACK_WATERMARK),
+	od_keyword("coroutine_accounting", OD_LCOROUTINE_ACCOUNTING),
+	od_keyword("lock_stats",           OD_LLOCK_STATS),
+	od_keyword("poller",               OD_LPOLLER),
+	od_keyword("poll_spin",            OD_LPOLL_SPIN),
+	od_keyword("watchdog_stall",       OD_LWATCHDOG_STALL),
+	od_keyword("clock_source",         OD_LCLOCK_SOURCE),
+	od_keyword("resolver",             OD_LRESOLVER),
+	od_keyword("pam_workers",          OD_LPAM_WORKERS),
 	od_keyword("client_max",           OD_LCLIENT_MAX),
 	od_keyword("client_max_routing",   OD_LCLIENT_MAX_ROUTING),
+	od_keyword("memory_max",           OD_LMEMORY_MAX),
+	od_keyword("client_overload",      OD_LCLIENT_OVERLOAD),
+	od_keyword("client_overload_latency", OD_LCLIENT_OVERLOAD_LATENCY),
+	od_keyword("client_idle_release",  OD_LCLIENT_IDLE_RELEASE),
 	od_keyword("server_login_retry",   OD_LSERVER_LOGIN_RETRY),
+	od_keyword("server_connect_async", OD_LSERVER_CONNECT_ASYNC),
+	od_keyword("track_parameters",     OD_LTRACK_PARAMETERS),
 	od_keyword("client_login_timeout", OD_LCLIENT_LOGIN_TIMEOUT),
 	od_keyword("client_fwd_error",     OD_LCLIENT_FWD_ERROR),
 	od_keyword("application_name_add_host",     OD_LAPPLICATION_NAME_ADD_HOST),
@@ -164,10 +381,45 @@ od_config_keywords[] =
 	od_keyword("tls_key_file",         OD_LTLS_KEY_FILE),
 	od_keyword("tls_cert_file",        OD_LTLS_CERT_FILE),
 	od_keyword("tls_protocols",        OD_LTLS_PROTOCOLS),
+	od_keyword("tls_session_cache",    OD_LTLS_SESSION_CACHE),
+	od_keyword("tls_session_timeout",  OD_LTLS_SESSION_TIMEOUT),
+	od_keyword("tls_verify_cache",     OD_LTLS_VERIFY_CACHE),
+	od_keyword("tls_verify_timeout",   OD_LTLS_VERIFY_TIMEOUT),
+	od_keyword("tls_ticket_rotate",    OD_LTLS_TICKET_ROTATE),
+	od_keyword("tls_ktls",             OD_LTLS_KTLS),
+	od_keyword("tls_direct",           OD_LTLS_DIRECT),
+	od_keyword("tls_async",            OD_LTLS_ASYNC),
+	od_keyword("tls_engine",           OD_LTLS_ENGINE),
+	od_keyword("compression",          OD_LCOMPRESSION),
+	od_keyword("mux",                  OD_LMUX),
+	od_keyword("mux_links",            OD_LMUX_LINKS),
+	od_keyword("sndbuf",               OD_LSNDBUF),
+	od_keyword("rcvbuf",               OD_LRCVBUF),
+	od_keyword("tcp_notsent_lowat",    OD_LTCP_NOTSENT_LOWAT),
+	od_keyword("tcp_user_timeout",     OD_LTCP_USER_TIMEOUT),
+	od_keyword("tcp_quickack",         OD_LTCP_QUICKACK),
+	od_keyword("tcp_fastopen",         OD_LTCP_FASTOPEN),
+	od_keyword("tcp_fastopen_connect", OD_LTCP_FASTOPEN_CONNECT),
+	od_keyword("busy_poll",            OD_LBUSY_POLL),
+	od_keyword("zerocopy_threshold",   OD_LZEROCOPY_THRESHOLD),
 	/* storage */
 	od_keyword("storage",              OD_LSTORAGE),
 	od_keyword("type",                 OD_LTYPE),
 	od_keyword("server_max_routing",   OD_LSERVERS_MAX_ROUTING),
+	od_keyword("server_max",           OD_LSERVER_MAX),
+	od_keyword("cancel_rate",          OD_LCANCEL_RATE),
+	od_keyword("breaker_threshold",    OD_LBREAKER_THRESHOLD),
+	od_keyword("breaker_backoff",      OD_LBREAKER_BACKOFF),
+	od_keyword("breaker_backoff_max",  OD_LBREAKER_BACKOFF_MAX),
+	od_keyword("load_balance",         OD_LLOAD_BALANCE),
+	od_keyword("target_session_attrs", OD_LTARGET_SESSION_ATTRS),
+	od_keyword("health_check_interval", OD_LHEALTH_CHECK_INTERVAL),
+	od_keyword("health_check_timeout", OD_LHEALTH_CHECK_TIMEOUT),
+	od_keyword("health_check_max_lag", OD_LHEALTH_CHECK_MAX_LAG),
+	od_keyword("health_check_max_rtt", OD_LHEALTH_CHECK_MAX_RTT),
+	od_keyword("tcp_info_interval",    OD_LTCP_INFO_INTERVAL),
+	od_keyword("health_check_db",      OD_LHEALTH_CHECK_DB),
+	od_keyword("health_check_user",    OD_LHEALTH_CHECK_USER),
 	od_keyword("default",              OD_LDEFAULT),
 	/* database */
 	od_keyword("database",             OD_LDATABASE),
@@ -175,21 +427,73 @@ od_config_keywords[] =
 	od_keyword("password",             OD_LPASSWORD),
 	od_keyword("pool",                 OD_LPOOL),
 	od_keyword("pool_size",            OD_LPOOL_SIZE),
+	od_keyword("pool_min_size",        OD_LPOOL_MIN_SIZE),
 	od_keyword("pool_timeout",         OD_LPOOL_TIMEOUT),
+	od_keyword("pool_reserve_size",    OD_LPOOL_RESERVE_SIZE),
+	od_keyword("pool_reserve_timeout", OD_LPOOL_RESERVE_TIMEOUT),
 	od_keyword("pool_ttl",             OD_LPOOL_TTL),
+	od_keyword("pool_check_idle",      OD_LPOOL_CHECK_IDLE),
+	od_keyword("pool_rate",            OD_LPOOL_RATE),
+	od_keyword("pool_active_max",      OD_LPOOL_ACTIVE_MAX),
+	od_keyword("pool_fleet_max",       OD_LPOOL_FLEET_MAX),
+	od_keyword("pool_batch",           OD_LPOOL_BATCH),
+	od_keyword("pool_batch_weight",    OD_LPOOL_BATCH_WEIGHT),
+	od_keyword("pool_shared",          OD_LPOOL_SHARED),
+	od_keyword("client_idle_timeout",  OD_LCLIENT_IDLE_TIMEOUT),
+	od_keyword("client_idle_in_transaction_timeout", OD_LCLIENT_IDLE_IN_TRANSACTION_TIMEOUT),
+	od_keyword("query_timeout",        OD_LQUERY_TIMEOUT),
+	od_keyword("readahead_min",        OD_LREADAHEAD_MIN),
+	od_keyword("readahead_max",        OD_LREADAHEAD_MAX),
 	od_keyword("pool_discard",         OD_LPOOL_DISCARD),
+	od_keyword("pool_discard_track",   OD_LPOOL_DISCARD_TRACK),
+	od_keyword("pool_listen",          OD_LPOOL_LISTEN),
+	od_keyword("pool_wal_relay",       OD_LPOOL_WAL_RELAY),
+	od_keyword("pool_wal_relay_size",  OD_LPOOL_WAL_RELAY_SIZE),
+	od_keyword("pool_wal_relay_dir",   OD_LPOOL_WAL_RELAY_DIR),
 	od_keyword("pool_cancel",          OD_LPOOL_CANCEL),
 	od_keyword("pool_rollback",        OD_LPOOL_ROLLBACK),
+	od_keyword("pool_track_set",       OD_LPOOL_TRACK_SET),
+	od_keyword("pool_passthrough",     OD_LPOOL_PASSTHROUGH),
+	od_keyword("pool_adaptive",        OD_LPOOL_ADAPTIVE),
+	od_keyword("pool_select",          OD_LPOOL_SELECT),
+	od_keyword("server_lifetime",      OD_LSERVER_LIFETIME),
+	od_keyword("pool_codel_target",    OD_LPOOL_CODEL_TARGET),
+	od_keyword("pool_codel_interval",  OD_LPOOL_CODEL_INTERVAL),
+	od_keyword("pool_prepared_statements", OD_LPOOL_PREPARED_STATEMENTS),
+	od_keyword("pool_prepared_statements_max", OD_LPOOL_PREPARED_STATEMENTS_MAX),
+	od_keyword("pool_pipeline", OD_LPOOL_PIPELINE),
+	od_keyword("pool_pipeline_depth", OD_LPOOL_PIPELINE_DEPTH),
 	od_keyword("storage_db",           OD_LSTORAGE_DB),
 	od_keyword("storage_user",         OD_LSTORAGE_USER),
 	od_keyword("storage_password",     OD_LSTORAGE_PASSWORD),
+	od_keyword("storage_read",         OD_LSTORAGE_READ),
+	od_keyword("storage_read_exclude", OD_LSTORAGE_READ_EXCLUDE),
+	od_keyword("storage_mirror",       OD_LSTORAGE_MIRROR),
+	od_keyword("storage_mirror_sample", OD_LSTORAGE_MIRROR_SAMPLE),
+	od_keyword("storage_mirror_pool_size", OD_LSTORAGE_MIRROR_POOL_SIZE),
+	od_keyword("storage_shards",       OD_LSTORAGE_SHARDS),
+	od_keyword("shard_key",            OD_LSHARD_KEY),
+	od_keyword("shard_parameter",      OD_LSHARD_PARAMETER),
 	od_keyword("authentication",       OD_LAUTHENTICATION),
 	od_keyword("auth_common_name",     OD_LAUTH_COMMON_NAME),
 	od_keyword("auth_query",           OD_LAUTH_QUERY),
 	od_keyword("auth_query_db",        OD_LAUTH_QUERY_DB),
 	od_keyword("auth_query_user",      OD_LAUTH_QUERY_USER),
+	od_keyword("auth_query_cache_ttl", OD_LAUTH_QUERY_CACHE_TTL),
+	od_keyword("auth_query_cache_negative_ttl", OD_LAUTH_QUERY_CACHE_NEGATIVE_TTL),
+	od_keyword("auth_query_cache_max", OD_LAUTH_QUERY_CACHE_MAX),
 	od_keyword("auth_pam_service",     OD_LAUTH_PAM_SERVICE),
+	od_keyword("auth_pam_cache_ttl",   OD_LAUTH_PAM_CACHE_TTL),
 	od_keyword("quantiles", OD_LQUANTILES),
+	od_keyword("quantiles_precision", OD_LQUANTILES_PRECISION),
+	od_keyword("log_query_sample",     OD_LLOG_QUERY_SAMPLE),
+	od_keyword("log_query_sample_random", OD_LLOG_QUERY_SAMPLE_RANDOM),
+	od_keyword("capture_sample",       OD_LCAPTURE_SAMPLE),
+	od_keyword("log_query_rate",       OD_LLOG_QUERY_RATE),
+	od_keyword("log_query_min_duration", OD_LLOG_QUERY_MIN_DURATION),
+	od_keyword("query_cache",          OD_LQUERY_CACHE),
+	od_keyword("query_cache_ttl",      OD_LQUERY_CACHE_TTL),
+	od_keyword("query_cache_size",     OD_LQUERY_CACHE_SIZE),
 	{ 0, 0, 0 }
 };
 
@@ -324,10 +628,11 @@ od_config_reader_quantiles(od_config_reader_t *reader, char *value, double **qua
             return false;
         }
         *count += 1;
-        while (*c != ',') {
+        while (*c && *c != ',') {
             c++;
         }
-        c++;
+        if (*c)
+            c++;
     }
     return true;
 }
@@ -373,6 +678,21 @@ od_config_reader_number(od_config_reader_t *reader, int *number)
 	return true;
 }
 
+static bool
+od_config_reader_number64(od_config_reader_t *reader, int64_t *number)
+{
+	od_token_t token;
+	int rc;
+	rc = od_parser_next(&reader->parser, &token);
+	if (rc != OD_PARSER_NUM) {
+		od_parser_push(&reader->parser, &token);
+		od_config_reader_error(reader, &token, "expected 'number'");
+		return false;
+	}
+	*number = token.value.num;
+	return true;
+}
+
 static bool
 od_config_reader_yes_no(od_config_reader_t *reader, int *value)
 {
@@ -489,6 +809,91 @@ od_config_reader_listen(od_config_reader_t *reader)
 			if (! od_config_reader_string(reader, &listen->tls_protocols))
 				return -1;
 			continue;
+		/* tls_session_cache */
+		case OD_LTLS_SESSION_CACHE:
+			if (! od_config_reader_number(reader, &listen->tls_session_cache))
+				return -1;
+			continue;
+		/* tls_session_timeout */
+		case OD_LTLS_SESSION_TIMEOUT:
+			if (! od_config_reader_number(reader, &listen->tls_session_timeout))
+				return -1;
+			continue;
+		/* tls_verify_cache */
+		case OD_LTLS_VERIFY_CACHE:
+			if (! od_config_reader_number(reader, &listen->tls_verify_cache))
+				return -1;
+			continue;
+		/* tls_verify_timeout */
+		case OD_LTLS_VERIFY_TIMEOUT:
+			if (! od_config_reader_number(reader, &listen->tls_verify_timeout))
+				return -1;
+			continue;
+		/* tls_ktls */
+		case OD_LTLS_KTLS:
+			if (! od_config_reader_yes_no(reader, &listen->tls_ktls))
+				return -1;
+			continue;
+		/* tls_async */
+		case OD_LTLS_ASYNC:
+			if (! od_config_reader_yes_no(reader, &listen->tls_async))
+				return -1;
+			continue;
+		/* compression */
+		case OD_LCOMPRESSION:
+			if (! od_config_reader_yes_no(reader, &listen->compression))
+				return -1;
+			continue;
+		/* mux */
+		case OD_LMUX:
+			if (! od_config_reader_yes_no(reader, &listen->mux))
+				return -1;
+			continue;
+		/* sndbuf */
+		case OD_LSNDBUF:
+			if (! od_config_reader_number(reader, &listen->sndbuf))
+				return -1;
+			continue;
+		/* rcvbuf */
+		case OD_LRCVBUF:
+			if (! od_config_reader_number(reader, &listen->rcvbuf))
+				return -1;
+			continue;
+		/* tcp_notsent_lowat */
+		case OD_LTCP_NOTSENT_LOWAT:
+			if (! od_config_reader_number(reader, &listen->tcp_notsent_lowat))
+				return -1;
+			continue;
+		/* tcp_user_timeout */
+		case OD_LTCP_USER_TIMEOUT:
+			if (! od_config_reader_number(reader, &listen->tcp_user_timeout))
+				return -1;
+			continue;
+		/* tcp_quickack */
+		case OD_LTCP_QUICKACK:
+			if (! od_config_reader_yes_no(reader, &listen->tcp_quickack))
+				return -1;
+			continue;
+		/* tcp_fastopen */
+		case OD_LTCP_FASTOPEN:
+			if (! od_config_reader_number(reader, &listen->tcp_fastopen))
+				return -1;
+			continue;
+		/* busy_poll */
+		case OD_LBUSY_POLL:
+			if (! od_config_reader_number(reader, &listen->busy_poll))
+				return -1;
+			continue;
+		/* zerocopy_threshold */
+		case OD_LZEROCOPY_THRESHOLD:
+			if (! od_config_reader_number(reader, &listen->zerocopy_threshold))
+				return -1;
+			continue;
+		/* worker_group */
+		case OD_LWORKER_GROUP:
+			if (! od_config_reader_string(reader, &listen->worker_group))
+				return -1;
+			continue;
 		default:
 			od_config_reader_error(reader, &token, "unexpected parameter");
 			return -1;
@@ -554,6 +959,46 @@ od_config_reader_storage(od_config_reader_t *reader)
 			if (! od_config_reader_number(reader, &storage->port))
 				return -1;
 			continue;
+		/* load_balance */
+		case OD_LLOAD_BALANCE:
+			if (! od_config_reader_string(reader, &storage->load_balance))
+				return -1;
+			continue;
+		/* target_session_attrs */
+		case OD_LTARGET_SESSION_ATTRS:
+			if (! od_config_reader_string(reader, &storage->target_session_attrs))
+				return -1;
+			continue;
+		/* health_check_interval */
+		case OD_LHEALTH_CHECK_INTERVAL:
+			if (! od_config_reader_number(reader, &storage->health_check_interval))
+				return -1;
+			continue;
+		/* health_check_timeout */
+		case OD_LHEALTH_CHECK_TIMEOUT:
+			if (! od_config_reader_number(reader, &storage->health_check_timeout))
+				return -1;
+			continue;
+		/* health_check_max_lag */
+		case OD_LHEALTH_CHECK_MAX_LAG:
+			if (! od_config_reader_number(reader, &storage->health_check_max_lag))
+				return -1;
+			continue;
+		/* health_check_max_rtt */
+		case OD_LHEALTH_CHECK_MAX_RTT:
+			if (! od_config_reader_number(reader, &storage->health_check_max_rtt))
+				return -1;
+			continue;
+		/* health_check_db */
+		case OD_LHEALTH_CHECK_DB:
+			if (! od_config_reader_string(reader, &storage->health_check_db))
+				return -1;
+			continue;
+		/* health_check_user */
+		case OD_LHEALTH_CHECK_USER:
+			if (! od_config_reader_string(reader, &storage->health_check_user))
+				return -1;
+			continue;
 		/* tls */
 		case OD_LTLS:
 			if (! od_config_reader_string(reader, &storage->tls))
@@ -579,11 +1024,106 @@ od_config_reader_storage(od_config_reader_t *reader)
 			if (! od_config_reader_string(reader, &storage->tls_protocols))
 				return -1;
 			continue;
+		/* tls_ktls */
+		case OD_LTLS_KTLS:
+			if (! od_config_reader_yes_no(reader, &storage->tls_ktls))
+				return -1;
+			continue;
+		/* tls_async */
+		case OD_LTLS_ASYNC:
+			if (! od_config_reader_yes_no(reader, &storage->tls_async))
+				return -1;
+			continue;
+		/* tls_direct */
+		case OD_LTLS_DIRECT:
+			if (! od_config_reader_yes_no(reader, &storage->tls_direct))
+				return -1;
+			continue;
+		/* compression */
+		case OD_LCOMPRESSION:
+			if (! od_config_reader_yes_no(reader, &storage->compression))
+				return -1;
+			continue;
 				/* server_max_routing */
 		case OD_LSERVERS_MAX_ROUTING:
 			if (! od_config_reader_number(reader, &storage->server_max_routing))
 				return -1;
 			continue;
+		/* server_max */
+		case OD_LSERVER_MAX:
+			if (! od_config_reader_number(reader, &storage->server_max))
+				return -1;
+			continue;
+		/* cancel_rate */
+		case OD_LCANCEL_RATE:
+			if (! od_config_reader_number(reader, &storage->cancel_rate))
+				return -1;
+			continue;
+		/* breaker_threshold */
+		case OD_LBREAKER_THRESHOLD:
+			if (! od_config_reader_number(reader, &storage->breaker_threshold))
+				return -1;
+			continue;
+		/* breaker_backoff */
+		case OD_LBREAKER_BACKOFF:
+			if (! od_config_reader_number(reader, &storage->breaker_backoff))
+				return -1;
+			continue;
+		/* breaker_backoff_max */
+		case OD_LBREAKER_BACKOFF_MAX:
+			if (! od_config_reader_number(reader, &storage->breaker_backoff_max))
+				return -1;
+			continue;
+		/* mux_links */
+		case OD_LMUX_LINKS:
+			if (! od_config_reader_number(reader, &storage->mux_links))
+				return -1;
+			continue;
+		/* sndbuf */
+		case OD_LSNDBUF:
+			if (! od_config_reader_number(reader, &storage->sndbuf))
+				return -1;
+			continue;
+		/* rcvbuf */
+		case OD_LRCVBUF:
+			if (! od_config_reader_number(reader, &storage->rcvbuf))
+				return -1;
+			continue;
+		/* tcp_notsent_lowat */
+		case OD_LTCP_NOTSENT_LOWAT:
+			if (! od_config_reader_number(reader, &storage->tcp_notsent_lowat))
+				return -1;
+			continue;
+		/* tcp_user_timeout */
+		case OD_LTCP_USER_TIMEOUT:
+			if (! od_config_reader_number(reader, &storage->tcp_user_timeout))
+				return -1;
+			continue;
+		/* tcp_quickack */
+		case OD_LTCP_QUICKACK:
+			if (! od_config_reader_yes_no(reader, &storage->tcp_quickack))
+				return -1;
+			continue;
+		/* tcp_fastopen_connect */
+		case OD_LTCP_FASTOPEN_CONNECT:
+			if (! od_config_reader_yes_no(reader, &storage->tcp_fastopen_connect))
+				return -1;
+			continue;
+		/* busy_poll */
+		case OD_LBUSY_POLL:
+			if (! od_config_reader_number(reader, &storage->busy_poll))
+				return -1;
+			continue;
+		/* zerocopy_threshold */
+		case OD_LZEROCOPY_THRESHOLD:
+			if (! od_config_reader_number(reader, &storage->zerocopy_threshold))
+				return -1;
+			continue;
+		/* tcp_info_interval */
+		case OD_LTCP_INFO_INTERVAL:
+			if (! od_config_reader_number(reader, &storage->tcp_info_interval))
+				return -1;
+			continue;
 		default:
 			od_config_reader_error(reader, &token, "unexpected parameter");
 			return -1;
@@ -617,7 +1157,8 @@ od_config_reader_route(od_config_reader_t *reader, char *db_name, int db_name_le
 
 	/* ensure route does not exists and add new route */
 	od_rule_t *route;
-	route = od_rules_match(reader->rules, db_name, user_name);
+	route = od_rules_match(reader->rules, db_is_default ? NULL : db_name,
+	                       user_is_default ? NULL : user_name);
 	if (route) {
 		od_errorf(reader->error, "route '%s.%s': is redefined",
 		          db_name, user_name);
@@ -640,6 +1181,8 @@ od_config_reader_route(od_config_reader_t *reader, char *db_name, int db_name_le
 	route->db_name = strdup(db_name);
 	if (route->db_name == NULL)
 		return -1;
+	if (od_rules_index_add(reader->rules, route) == -1)
+		return -1;
 
 	/* { */
 	if (! od_config_reader_symbol(reader, '{'))
@@ -699,6 +1242,11 @@ od_config_reader_route(od_config_reader_t *reader, char *db_name, int db_name_le
 			if (! od_config_reader_string(reader, &route->auth_pam_service))
 				return -1;
 			break;
+		/* auth_pam_cache_ttl */
+		case OD_LAUTH_PAM_CACHE_TTL:
+			if (! od_config_reader_number(reader, &route->auth_pam_cache_ttl))
+				return -1;
+			break;
 		/* auth_query */
 		case OD_LAUTH_QUERY:
 			if (! od_config_reader_string(reader, &route->auth_query))
@@ -714,6 +1262,21 @@ od_config_reader_route(od_config_reader_t *reader, char *db_name, int db_name_le
 			if (! od_config_reader_string(reader, &route->auth_query_user))
 				return -1;
 			break;
+		/* auth_query_cache_ttl */
+		case OD_LAUTH_QUERY_CACHE_TTL:
+			if (! od_config_reader_number(reader, &route->auth_query_cache_ttl))
+				return -1;
+			break;
+		/* auth_query_cache_negative_ttl */
+		case OD_LAUTH_QUERY_CACHE_NEGATIVE_TTL:
+			if (! od_config_reader_number(reader, &route->auth_query_cache_negative_ttl))
+				return -1;
+			break;
+		/* auth_query_cache_max */
+		case OD_LAUTH_QUERY_CACHE_MAX:
+			if (! od_config_reader_number(reader, &route->auth_query_cache_max))
+				return -1;
+			break;
 		/* password */
 		case OD_LPASSWORD:
 			if (! od_config_reader_string(reader, &route->password))
@@ -731,6 +1294,26 @@ od_config_reader_route(od_config_reader_t *reader, char *db_name, int db_name_le
 				return -1;
 			route->client_max_set = 1;
 			continue;
+		/* memory_max */
+		case OD_LMEMORY_MAX:
+			if (! od_config_reader_number64(reader, &route->memory_max))
+				return -1;
+			continue;
+		/* client_idle_timeout */
+		case OD_LCLIENT_IDLE_TIMEOUT:
+			if (! od_config_reader_number(reader, &route->client_idle_timeout))
+				return -1;
+			continue;
+		/* client_idle_in_transaction_timeout */
+		case OD_LCLIENT_IDLE_IN_TRANSACTION_TIMEOUT:
+			if (! od_config_reader_number(reader, &route->client_idle_in_transaction_timeout))
+				return -1;
+			continue;
+		/* query_timeout */
+		case OD_LQUERY_TIMEOUT:
+			if (! od_config_reader_number(reader, &route->query_timeout))
+				return -1;
+			continue;
 		/* client_fwd_error */
 		case OD_LCLIENT_FWD_ERROR:
 			if (! od_config_reader_yes_no(reader, &route->client_fwd_error))
@@ -742,10 +1325,18 @@ od_config_reader_route(od_config_reader_t *reader, char *db_name, int db_name_le
 			char *quantiles_str = NULL;
 			if (! od_config_reader_string(reader, &quantiles_str))
 				return -1;
-			if (!od_config_reader_quantiles(reader, quantiles_str, &route->quantiles, &route->quantiles_count))
+			if (!od_config_reader_quantiles(reader, quantiles_str, &route->quantiles, &route->quantiles_count)) {
+				free(quantiles_str);
 				return -1;
+			}
+			free(quantiles_str);
 		}
-		break;
+		continue;
+		/* quantiles_precision */
+		case OD_LQUANTILES_PRECISION:
+			if (! od_config_reader_number(reader, &route->quantiles_precision))
+				return -1;
+			continue;
 		/* application_name_add_host */
 		case OD_LAPPLICATION_NAME_ADD_HOST:
 			if (! od_config_reader_yes_no(reader, &route->application_name_add_host))
@@ -761,16 +1352,96 @@ od_config_reader_route(od_config_reader_t *reader, char *db_name, int db_name_le
 			if (! od_config_reader_number(reader, &route->pool_size))
 				return -1;
 			continue;
+		/* pool_min_size */
+		case OD_LPOOL_MIN_SIZE:
+			if (! od_config_reader_number(reader, &route->pool_min_size))
+				return -1;
+			continue;
+		/* pool_select */
+		case OD_LPOOL_SELECT:
+			if (! od_config_reader_string(reader, &route->pool_select_sz))
+				return -1;
+			continue;
 		/* pool_timeout */
 		case OD_LPOOL_TIMEOUT:
 			if (! od_config_reader_number(reader, &route->pool_timeout))
 				return -1;
 			continue;
+		/* pool_reserve_size */
+		case OD_LPOOL_RESERVE_SIZE:
+			if (! od_config_reader_number(reader, &route->pool_reserve_size))
+				return -1;
+			continue;
+		/* pool_reserve_timeout */
+		case OD_LPOOL_RESERVE_TIMEOUT:
+			if (! od_config_reader_number(reader, &route->pool_reserve_timeout))
+				return -1;
+			continue;
+		/* pool_codel_target */
+		case OD_LPOOL_CODEL_TARGET:
+			if (! od_config_reader_number(reader, &route->pool_codel_target))
+				return -1;
+			continue;
+		/* pool_codel_interval */
+		case OD_LPOOL_CODEL_INTERVAL:
+			if (! od_config_reader_number(reader, &route->pool_codel_interval))
+				return -1;
+			continue;
 		/* pool_ttl */
 		case OD_LPOOL_TTL:
 			if (! od_config_reader_number(reader, &route->pool_ttl))
 				return -1;
 			continue;
+		/* server_lifetime */
+		case OD_LSERVER_LIFETIME:
+			if (! od_config_reader_number(reader, &route->server_lifetime))
+				return -1;
+			continue;
+		/* pool_check_idle */
+		case OD_LPOOL_CHECK_IDLE:
+			if (! od_config_reader_number(reader, &route->pool_check_idle))
+				return -1;
+			continue;
+		/* pool_rate */
+		case OD_LPOOL_RATE:
+			if (! od_config_reader_number(reader, &route->pool_rate))
+				return -1;
+			continue;
+		/* pool_active_max */
+		case OD_LPOOL_ACTIVE_MAX:
+			if (! od_config_reader_number(reader, &route->pool_active_max))
+				return -1;
+			continue;
+		/* pool_fleet_max */
+		case OD_LPOOL_FLEET_MAX:
+			if (! od_config_reader_number(reader, &route->pool_fleet_max))
+				return -1;
+			continue;
+		/* pool_batch */
+		case OD_LPOOL_BATCH:
+			if (! od_config_reader_string(reader, &route->pool_batch))
+				return -1;
+			continue;
+		/* pool_batch_weight */
+		case OD_LPOOL_BATCH_WEIGHT:
+			if (! od_config_reader_number(reader, &route->pool_batch_weight))
+				return -1;
+			continue;
+		/* pool_shared */
+		case OD_LPOOL_SHARED:
+			if (! od_config_reader_yes_no(reader, &route->pool_shared))
+				return -1;
+			continue;
+		/* readahead_min */
+		case OD_LREADAHEAD_MIN:
+			if (! od_config_reader_number(reader, &route->readahead_min))
+				return -1;
+			continue;
+		/* readahead_max */
+		case OD_LREADAHEAD_MAX:
+			if (! od_config_reader_number(reader, &route->readahead_max))
+				return -1;
+			continue;
 		/* storage_database */
 		case OD_LSTORAGE_DB:
 			if (! od_config_reader_string(reader, &route->storage_db))
@@ -788,11 +1459,76 @@ od_config_reader_route(od_config_reader_t *reader, char *db_name, int db_name_le
 				return -1;
 			route->storage_password_len = strlen(route->storage_password);
 			continue;
+		/* storage_read */
+		case OD_LSTORAGE_READ:
+			if (! od_config_reader_string(reader, &route->storage_read_name))
+				return -1;
+			continue;
+		/* storage_read_exclude */
+		case OD_LSTORAGE_READ_EXCLUDE:
+			if (! od_config_reader_string(reader, &route->storage_read_exclude))
+				return -1;
+			continue;
+		/* storage_mirror */
+		case OD_LSTORAGE_MIRROR:
+			if (! od_config_reader_string(reader, &route->storage_mirror_name))
+				return -1;
+			continue;
+		/* storage_mirror_sample */
+		case OD_LSTORAGE_MIRROR_SAMPLE:
+			if (! od_config_reader_number(reader, &route->storage_mirror_sample))
+				return -1;
+			continue;
+		/* storage_mirror_pool_size */
+		case OD_LSTORAGE_MIRROR_POOL_SIZE:
+			if (! od_config_reader_number(reader, &route->storage_mirror_pool_size))
+				return -1;
+			continue;
+		/* storage_shards */
+		case OD_LSTORAGE_SHARDS:
+			if (! od_config_reader_string(reader, &route->storage_shards_names))
+				return -1;
+			continue;
+		/* shard_key */
+		case OD_LSHARD_KEY:
+			if (! od_config_reader_string(reader, &route->shard_key_sz))
+				return -1;
+			continue;
+		/* shard_parameter */
+		case OD_LSHARD_PARAMETER:
+			if (! od_config_reader_string(reader, &route->shard_parameter))
+				return -1;
+			continue;
 		/* pool_discard */
 		case OD_LPOOL_DISCARD:
 			if (! od_config_reader_yes_no(reader, &route->pool_discard))
 				return -1;
 			continue;
+		/* pool_discard_track */
+		case OD_LPOOL_DISCARD_TRACK:
+			if (! od_config_reader_yes_no(reader, &route->pool_discard_track))
+				return -1;
+			continue;
+		/* pool_listen */
+		case OD_LPOOL_LISTEN:
+			if (! od_config_reader_yes_no(reader, &route->pool_listen))
+				return -1;
+			continue;
+		/* pool_wal_relay */
+		case OD_LPOOL_WAL_RELAY:
+			if (! od_config_reader_yes_no(reader, &route->pool_wal_relay))
+				return -1;
+			continue;
+		/* pool_wal_relay_size */
+		case OD_LPOOL_WAL_RELAY_SIZE:
+			if (! od_config_reader_number64(reader, &route->pool_wal_relay_size))
+				return -1;
+			continue;
+		/* pool_wal_relay_dir */
+		case OD_LPOOL_WAL_RELAY_DIR:
+			if (! od_config_reader_string(reader, &route->pool_wal_relay_dir))
+				return -1;
+			continue;
 		/* pool_cancel */
 		case OD_LPOOL_CANCEL:
 			if (! od_config_reader_yes_no(reader, &route->pool_cancel))
@@ -803,11 +1539,91 @@ od_config_reader_route(od_config_reader_t *reader, char *db_name, int db_name_le
 			if (! od_config_reader_yes_no(reader, &route->pool_rollback))
 				return -1;
 			continue;
+		/* pool_track_set */
+		case OD_LPOOL_TRACK_SET:
+			if (! od_config_reader_yes_no(reader, &route->pool_track_set))
+				return -1;
+			continue;
+		/* pool_passthrough */
+		case OD_LPOOL_PASSTHROUGH:
+			if (! od_config_reader_yes_no(reader, &route->pool_passthrough))
+				return -1;
+			continue;
+		/* pool_adaptive */
+		case OD_LPOOL_ADAPTIVE:
+			if (! od_config_reader_yes_no(reader, &route->pool_adaptive))
+				return -1;
+			continue;
+		/* pool_prepared_statements */
+		case OD_LPOOL_PREPARED_STATEMENTS:
+			if (! od_config_reader_yes_no(reader, &route->pool_prepared_statements))
+				return -1;
+			continue;
+		/* pool_prepared_statements_max */
+		case OD_LPOOL_PREPARED_STATEMENTS_MAX:
+			if (! od_config_reader_number(reader, &route->pool_prepared_statements_max))
+				return -1;
+			continue;
+		/* pool_pipeline */
+		case OD_LPOOL_PIPELINE:
+			if (! od_config_reader_yes_no(reader, &route->pool_pipeline))
+				return -1;
+			continue;
+		/* pool_pipeline_depth */
+		case OD_LPOOL_PIPELINE_DEPTH:
+			if (! od_config_reader_number(reader, &route->pool_pipeline_depth))
+				return -1;
+			continue;
 		/* log_debug */
 		case OD_LLOG_DEBUG:
 			if (! od_config_reader_yes_no(reader, &route->log_debug))
 				return -1;
 			continue;
+		/* log_query_sample */
+		case OD_LLOG_QUERY_SAMPLE:
+			if (! od_config_reader_number(reader, &route->log_query_sample))
+				return -1;
+			continue;
+		/* log_query_sample_random */
+		case OD_LLOG_QUERY_SAMPLE_RANDOM:
+			if (! od_config_reader_yes_no(reader, &route->log_query_sample_random))
+				return -1;
+			continue;
+		/* capture_sample */
+		case OD_LCAPTURE_SAMPLE:
+			if (! od_config_reader_number(reader, &route->capture_sample))
+				return -1;
+			continue;
+		/* worker_group */
+		case OD_LWORKER_GROUP:
+			if (! od_config_reader_string(reader, &route->worker_group))
+				return -1;
+			continue;
+		/* log_query_rate */
+		case OD_LLOG_QUERY_RATE:
+			if (! od_config_reader_number(reader, &route->log_query_rate))
+				return -1;
+			continue;
+		/* log_query_min_duration */
+		case OD_LLOG_QUERY_MIN_DURATION:
+			if (! od_config_reader_number(reader, &route->log_query_min_duration))
+				return -1;
+			continue;
+		/* query_cache */
+		case OD_LQUERY_CACHE:
+			if (! od_config_reader_string(reader, &route->query_cache))
+				return -1;
+			continue;
+		/* query_cache_ttl */
+		case OD_LQUERY_CACHE_TTL:
+			if (! od_config_reader_number(reader, &route->query_cache_ttl))
+				return -1;
+			continue;
+		/* query_cache_size */
+		case OD_LQUERY_CACHE_SIZE:
+			if (! od_config_reader_number(reader, &route->query_cache_size))
+				return -1;
+			continue;
 		default:
 			od_config_reader_error(reader, &token, "unexpected parameter");
 			return -1;
@@ -952,6 +1768,16 @@ od_config_reader_parse(od_config_reader_t *reader)
 			if (! od_config_reader_string(reader, &config->unix_socket_mode))
 				return -1;
 			continue;
+		/* tls_engine */
+		case OD_LTLS_ENGINE:
+			if (! od_config_reader_string(reader, &config->tls_engine))
+				return -1;
+			continue;
+		/* online_restart_socket */
+		case OD_LONLINE_RESTART_SOCKET:
+			if (! od_config_reader_string(reader, &config->online_restart_socket))
+				return -1;
+			continue;
 		/* log_debug */
 		case OD_LLOG_DEBUG:
 			if (! od_config_reader_yes_no(reader, &config->log_debug))
@@ -992,6 +1818,16 @@ od_config_reader_parse(od_config_reader_t *reader)
 			if (! od_config_reader_string(reader, &config->log_file))
 				return -1;
 			continue;
+		/* log_binary_file */
+		case OD_LLOG_BINARY_FILE:
+			if (! od_config_reader_string(reader, &config->log_binary_file))
+				return -1;
+			continue;
+		/* capture_file */
+		case OD_LCAPTURE_FILE:
+			if (! od_config_reader_string(reader, &config->capture_file))
+				return -1;
+			continue;
 		/* log_syslog */
 		case OD_LLOG_SYSLOG:
 			if (! od_config_reader_yes_no(reader, &config->log_syslog))
@@ -1007,11 +1843,121 @@ od_config_reader_parse(od_config_reader_t *reader)
 			if (! od_config_reader_string(reader, &config->log_syslog_facility))
 				return -1;
 			continue;
+		/* log_async */
+		case OD_LLOG_ASYNC:
+			if (! od_config_reader_yes_no(reader, &config->log_async))
+				return -1;
+			continue;
+		/* log_async_buffer */
+		case OD_LLOG_ASYNC_BUFFER:
+			if (! od_config_reader_number(reader, &config->log_async_buffer))
+				return -1;
+			continue;
+		/* log_async_block */
+		case OD_LLOG_ASYNC_BLOCK:
+			if (! od_config_reader_yes_no(reader, &config->log_async_block))
+				return -1;
+			continue;
 		/* stats_interval */
 		case OD_LSTATS_INTERVAL:
 			if (! od_config_reader_number(reader, &config->stats_interval))
 				return -1;
 			continue;
+		/* query_fingerprint */
+		case OD_LQUERY_FINGERPRINT:
+			if (! od_config_reader_yes_no(reader, &config->query_fingerprint))
+				return -1;
+			continue;
+		/* query_fingerprint_max */
+		case OD_LQUERY_FINGERPRINT_MAX:
+			if (! od_config_reader_number(reader, &config->query_fingerprint_max))
+				return -1;
+			continue;
+		/* top_size */
+		case OD_LTOP_SIZE:
+			if (! od_config_reader_number(reader, &config->top_size))
+				return -1;
+			continue;
+		/* accept_stats_interval */
+		case OD_LACCEPT_STATS_INTERVAL:
+			if (! od_config_reader_number(reader, &config->accept_stats_interval))
+				return -1;
+			continue;
+		/* stats_shm */
+		case OD_LSTATS_SHM:
+			if (! od_config_reader_string(reader, &config->stats_shm))
+				return -1;
+			continue;
+		/* stats_shm_routes */
+		case OD_LSTATS_SHM_ROUTES:
+			if (! od_config_reader_number(reader, &config->stats_shm_routes))
+				return -1;
+			continue;
+		/* metrics_host */
+		case OD_LMETRICS_HOST:
+			if (! od_config_reader_string(reader, &config->metrics_host))
+				return -1;
+			continue;
+		/* metrics_port */
+		case OD_LMETRICS_PORT:
+			if (! od_config_reader_number(reader, &config->metrics_port))
+				return -1;
+			continue;
+		/* span_host */
+		case OD_LSPAN_HOST:
+			if (! od_config_reader_string(reader, &config->span_host))
+				return -1;
+			continue;
+		/* span_port */
+		case OD_LSPAN_PORT:
+			if (! od_config_reader_number(reader, &config->span_port))
+				return -1;
+			continue;
+		/* span_parameter */
+		case OD_LSPAN_PARAMETER:
+			if (! od_config_reader_string(reader, &config->span_parameter))
+				return -1;
+			continue;
+		/* span_sample_rate */
+		case OD_LSPAN_SAMPLE_RATE:
+			if (! od_config_reader_number(reader, &config->span_sample_rate))
+				return -1;
+			continue;
+		/* span_queue */
+		case OD_LSPAN_QUEUE:
+			if (! od_config_reader_number(reader, &config->span_queue))
+				return -1;
+			continue;
+		/* mirror_queue */
+		case OD_LMIRROR_QUEUE:
+			if (! od_config_reader_number(reader, &config->mirror_queue))
+				return -1;
+			continue;
+		/* fleet_host */
+		case OD_LFLEET_HOST:
+			if (! od_config_reader_string(reader, &config->fleet_host))
+				return -1;
+			continue;
+		/* fleet_port */
+		case OD_LFLEET_PORT:
+			if (! od_config_reader_number(reader, &config->fleet_port))
+				return -1;
+			continue;
+		/* fleet_peers */
+		case OD_LFLEET_PEERS:
+			if (! od_config_reader_string(reader, &config->fleet_peers))
+				return -1;
+			continue;
+		/* fleet_interval */
+		case OD_LFLEET_INTERVAL:
+			if (! od_config_reader_number(reader, &config->fleet_interval))
+				return -1;
+			continue;
+		/* fleet_timeout */
+		case OD_LFLEET_TIMEOUT:
+			if (! od_config_reader_number(reader, &config->fleet_timeout))
+				return -1;
+			continue;
 		/* client_max */
 		case OD_LCLIENT_MAX:
 			if (! od_config_reader_number(reader, &config->client_max))
@@ -1023,16 +1969,96 @@ od_config_reader_parse(od_config_reader_t *reader)
 			if (! od_config_reader_number(reader, &config->client_max_routing))
 				return -1;
 			continue;
+		/* client_overload */
+		case OD_LCLIENT_OVERLOAD:
+			if (! od_config_reader_string(reader, &config->client_overload))
+				return -1;
+			continue;
+		/* client_overload_latency */
+		case OD_LCLIENT_OVERLOAD_LATENCY:
+			if (! od_config_reader_number(reader, &config->client_overload_latency))
+				return -1;
+			continue;
+		/* client_idle_release */
+		case OD_LCLIENT_IDLE_RELEASE:
+			if (! od_config_reader_number(reader, &config->client_idle_release))
+				return -1;
+			continue;
 		/* server_login_retry */
 		case OD_LSERVER_LOGIN_RETRY:
 			if (! od_config_reader_number(reader, &config->server_login_retry))
 				return -1;
 			continue;
+		/* server_connect_async */
+		case OD_LSERVER_CONNECT_ASYNC:
+			if (! od_config_reader_yes_no(reader, &config->server_connect_async))
+				return -1;
+			continue;
+		/* track_parameters */
+		case OD_LTRACK_PARAMETERS:
+			if (! od_config_reader_string(reader, &config->track_parameters))
+				return -1;
+			continue;
 		/* readahead */
 		case OD_LREADAHEAD:
 			if (! od_config_reader_number(reader, &config->readahead))
 				return -1;
 			continue;
+		/* readahead_ring */
+		case OD_LREADAHEAD_RING:
+			if (! od_config_reader_yes_no(reader, &config->readahead_ring))
+				return -1;
+			continue;
+		/* relay_splice */
+		case OD_LRELAY_SPLICE:
+			if (! od_config_reader_yes_no(reader, &config->relay_splice))
+				return -1;
+			continue;
+		/* relay_coalesce */
+		case OD_LRELAY_COALESCE:
+			if (! od_config_reader_yes_no(reader, &config->relay_coalesce))
+				return -1;
+			continue;
+		/* relay_buffer_max */
+		case OD_LRELAY_BUFFER_MAX:
+			if (! od_config_reader_number(reader, &config->relay_buffer_max))
+				return -1;
+			continue;
+		/* relay_watermark_high */
+		case OD_LRELAY_WATERMARK_HIGH:
+			if (! od_config_reader_number(reader, &config->relay_watermark_high))
+				return -1;
+			continue;
+		/* relay_watermark_low */
+		case OD_LRELAY_WATERMARK_LOW:
+			if (! od_config_reader_number(reader, &config->relay_watermark_low))
+				return -1;
+			continue;
+		/* relay_memory_max */
+		case OD_LRELAY_MEMORY_MAX:
+			if (! od_config_reader_number64(reader, &config->relay_memory_max))
+				return -1;
+			continue;
+		/* relay_read_budget */
+		case OD_LRELAY_READ_BUDGET:
+			if (! od_config_reader_number(reader, &config->relay_read_budget))
+				return -1;
+			continue;
+		/* relay_spool */
+		case OD_LRELAY_SPOOL:
+			if (! od_config_reader_number(reader, &config->relay_spool))
+				return -1;
+			continue;
+		/* relay_spool_memory */
+		case OD_LRELAY_SPOOL_MEMORY:
+			if (! od_config_reader_number(reader, &config->relay_spool_memory))
+				return -1;
+			continue;
+		/* relay_spool_dir */
+		case OD_LRELAY_SPOOL_DIR:
+			if (! od_config_reader_string(reader, &config->relay_spool_dir))
+				return -1;
+			continue;
 		/* nodelay */
 		case OD_LNODELAY:
 			if (! od_config_reader_yes_no(reader, &config->nodelay))
@@ -1048,11 +2074,61 @@ od_config_reader_parse(od_config_reader_t *reader)
 			if (! od_config_reader_number(reader, &config->workers))
 				return -1;
 			continue;
+		/* workers_max */
+		case OD_LWORKERS_MAX:
+			if (! od_config_reader_number(reader, &config->workers_max))
+				return -1;
+			continue;
+		/* handshake_workers */
+		case OD_LHANDSHAKE_WORKERS:
+			if (! od_config_reader_number(reader, &config->handshake_workers))
+				return -1;
+			continue;
+		/* reuseport */
+		case OD_LREUSEPORT:
+			if (! od_config_reader_yes_no(reader, &config->reuseport))
+				return -1;
+			continue;
+		/* reuseport_cpu */
+		case OD_LREUSEPORT_CPU:
+			if (! od_config_reader_yes_no(reader, &config->reuseport_cpu))
+				return -1;
+			continue;
+		/* client_placement */
+		case OD_LCLIENT_PLACEMENT:
+			if (! od_config_reader_string(reader, &config->client_placement))
+				return -1;
+			continue;
+		/* worker_cpus */
+		case OD_LWORKER_CPUS:
+			if (! od_config_reader_string(reader, &config->worker_cpus))
+				return -1;
+			continue;
+		/* worker_groups */
+		case OD_LWORKER_GROUPS:
+			if (! od_config_reader_string(reader, &config->worker_groups))
+				return -1;
+			continue;
+		/* system_cpus */
+		case OD_LSYSTEM_CPUS:
+			if (! od_config_reader_string(reader, &config->system_cpus))
+				return -1;
+			continue;
+		/* tls_ticket_rotate */
+		case OD_LTLS_TICKET_ROTATE:
+			if (! od_config_reader_number(reader, &config->tls_ticket_rotate))
+				return -1;
+			continue;
 		/* resolvers */
 		case OD_LRESOLVERS:
 			if (! od_config_reader_number(reader, &config->resolvers))
 				return -1;
 			continue;
+		/* dns_cache_ttl */
+		case OD_LDNS_CACHE_TTL:
+			if (! od_config_reader_number(reader, &config->dns_cache_ttl))
+				return -1;
+			continue;
 		/* pipeline */
 		/* cache */
 		/* cache_chunk */
@@ -1073,16 +2149,81 @@ od_config_reader_parse(od_config_reader_t *reader)
 			if (! od_config_reader_number(reader, &config->cache_msg_gc_size))
 				return -1;
 			continue;
+		/* cache_msg_class_limit */
+		case OD_LCACHE_MSG_CLASS_LIMIT:
+			if (! od_config_reader_number(reader, &config->cache_msg_class_limit))
+				return -1;
+			continue;
 		/* cache_coroutine */
 		case OD_LCACHE_COROUTINE:
 			if (! od_config_reader_number(reader, &config->cache_coroutine))
 				return -1;
 			continue;
+		/* cache_client */
+		case OD_LCACHE_CLIENT:
+			if (! od_config_reader_number(reader, &config->cache_client))
+				return -1;
+			continue;
+		/* cache_server */
+		case OD_LCACHE_SERVER:
+			if (! od_config_reader_number(reader, &config->cache_server))
+				return -1;
+			continue;
 		/* coroutine_stack_size */
 		case OD_LCOROUTINE_STACK_SIZE:
 			if (! od_config_reader_number(reader, &config->coroutine_stack_size))
 				return -1;
 			continue;
+		/* coroutine_stack_hugepages */
+		case OD_LCOROUTINE_STACK_HUGEPAGES:
+			if (! od_config_reader_yes_no(reader, &config->coroutine_stack_hugepages))
+				return -1;
+			continue;
+		/* coroutine_stack_watermark */
+		case OD_LCOROUTINE_STACK_WATERMARK:
+			if (! od_config_reader_yes_no(reader, &config->coroutine_stack_watermark))
+				return -1;
+			continue;
+		/* coroutine_accounting */
+		case OD_LCOROUTINE_ACCOUNTING:
+			if (! od_config_reader_yes_no(reader, &config->coroutine_accounting))
+				return -1;
+			continue;
+		/* lock_stats */
+		case OD_LLOCK_STATS:
+			if (! od_config_reader_yes_no(reader, &config->lock_stats))
+				return -1;
+			continue;
+		/* poller */
+		case OD_LPOLLER:
+			if (! od_config_reader_string(reader, &config->poller))
+				return -1;
+			continue;
+		/* poll_spin */
+		case OD_LPOLL_SPIN:
+			if (! od_config_reader_number(reader, &config->poll_spin))
+				return -1;
+			continue;
+		/* watchdog_stall */
+		case OD_LWATCHDOG_STALL:
+			if (! od_config_reader_number(reader, &config->watchdog_stall))
+				return -1;
+			continue;
+		/* clock_source */
+		case OD_LCLOCK_SOURCE:
+			if (! od_config_reader_string(reader, &config->clock_source))
+				return -1;
+			continue;
+		/* resolver */
+		case OD_LRESOLVER:
+			if (! od_config_reader_string(reader, &config->resolver))
+				return -1;
+			continue;
+		/* pam_workers */
+		case OD_LPAM_WORKERS:
+			if (! od_config_reader_number(reader, &config->pam_workers))
+				return -1;
+			continue;
 		/* listen */
 		case OD_LLISTEN:
 			rc = od_config_reader_listen(reader);
@@ -1128,5 +2269,7 @@ od_config_reader_import(od_config_t *config, od_rules_t *rules, od_error_t *erro
 
 	if (!config->client_max_routing)
 		config->client_max_routing = config->workers * 16;
+	if (!config->workers_max)
+		config->workers_max = config->workers;
 	return rc;
 }
@@ -13,6 +13,8 @@
 #include <ctype.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <signal.h>
+#include <unistd.h>
 
 #include <machinarium.h>
 #include <kiwi.h>
@@ -28,7 +30,27 @@ enum
 	OD_LLISTS,
 	OD_LSET,
 	OD_LPOOLS,
-	OD_LDATABASES
+	OD_LDATABASES,
+	OD_LAUTH_CACHE,
+	OD_LDATABASE,
+	OD_LUSER,
+	OD_LLIMIT,
+	OD_LWORKERS,
+	OD_LRESET,
+	OD_LQUERY_CACHE,
+	OD_LRELOAD,
+	OD_LMEMORY,
+	OD_LPAUSE,
+	OD_LRESUME,
+	OD_LFINGERPRINTS,
+	OD_LTOP,
+	OD_LRATES,
+	OD_LFLEET,
+	OD_LIO,
+	OD_LLOCKS,
+	OD_LMIRROR,
+	OD_LACCEPT,
+	OD_LSTACKS
 };
 
 static od_keyword_t
@@ -43,6 +65,26 @@ od_console_keywords[] =
 	od_keyword("set",         OD_LSET),
 	od_keyword("pools",       OD_LPOOLS),
 	od_keyword("databases",   OD_LDATABASES),
+	od_keyword("auth_cache",  OD_LAUTH_CACHE),
+	od_keyword("database",    OD_LDATABASE),
+	od_keyword("user",        OD_LUSER),
+	od_keyword("limit",       OD_LLIMIT),
+	od_keyword("workers",     OD_LWORKERS),
+	od_keyword("reset",       OD_LRESET),
+	od_keyword("query_cache", OD_LQUERY_CACHE),
+	od_keyword("reload",      OD_LRELOAD),
+	od_keyword("memory",      OD_LMEMORY),
+	od_keyword("pause",       OD_LPAUSE),
+	od_keyword("resume",      OD_LRESUME),
+	od_keyword("fingerprints", OD_LFINGERPRINTS),
+	od_keyword("top",         OD_LTOP),
+	od_keyword("rates",       OD_LRATES),
+	od_keyword("fleet",       OD_LFLEET),
+	od_keyword("io",          OD_LIO),
+	od_keyword("locks",       OD_LLOCKS),
+	od_keyword("mirror",      OD_LMIRROR),
+	od_keyword("accept",      OD_LACCEPT),
+	od_keyword("stacks",      OD_LSTACKS),
 	{ 0, 0, 0 }
 };
 
@@ -62,76 +104,60 @@ od_console_show_stats_add(machine_msg_t *stream,
 	rc = kiwi_be_write_data_row_add(stream, offset, database, database_len);
 	if (rc == -1)
 		return -1;
-	char data[64];
-	int  data_len;
 	/* total_xact_count */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, total->count_tx);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, total->count_tx);
 	if (rc == -1)
 		return -1;
 	/* total_query_count */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, total->count_query);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, total->count_query);
 	if (rc == -1)
 		return -1;
 	/* total_received */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, total->recv_client);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, total->recv_client);
 	if (rc == -1)
 		return -1;
 	/* total_sent */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, total->recv_server);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, total->recv_server);
 	if (rc == -1)
 		return -1;
 	/* total_xact_time */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, total->tx_time);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, total->tx_time);
 	if (rc == -1)
 		return -1;
 	/* total_query_time */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, total->query_time);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, total->query_time);
 	if (rc == -1)
 		return -1;
 	/* total_wait_time */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, 0);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, total->wait_time);
 	if (rc == -1)
 		return -1;
 	/* avg_xact_count */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, avg->count_tx);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, avg->count_tx);
 	if (rc == -1)
 		return -1;
 	/* avg_query_count */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, avg->count_query);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, avg->count_query);
 	if (rc == -1)
 		return -1;
 	/* avg_recv */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, avg->recv_client);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, avg->recv_client);
 	if (rc == -1)
 		return -1;
 	/* avg_sent */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, avg->recv_server);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, avg->recv_server);
 	if (rc == -1)
 		return -1;
 	/* avg_xact_time */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, avg->tx_time);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, avg->tx_time);
 	if (rc == -1)
 		return -1;
 	/* avg_query_time */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, avg->query_time);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, avg->query_time);
 	if (rc == -1)
 		return -1;
 	/* avg_wait_time */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, 0);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, avg->wait_time);
 	if (rc == -1)
 		return -1;
 	return 0;
@@ -198,7 +224,7 @@ od_console_show_pools_add_cb(od_route_t *route, void **argv)
 	if (msg == NULL)
 		return -1;
 
-	od_route_lock(route);
+	od_route_lock(route, OD_LOCK_CONSOLE);
 	int rc;
 	rc = kiwi_be_write_data_row_add(stream, offset, route->id.database,
 	                                route->id.database_len - 1);
@@ -208,52 +234,42 @@ od_console_show_pools_add_cb(od_route_t *route, void **argv)
 	                                route->id.user_len - 1);
 	if (rc == -1)
 		goto error;
-	char data[64];
-	int  data_len;
 
 	/* cl_active */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, route->client_pool.count_active);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, route->client_pool.count_active);
 	if (rc == -1)
 		goto error;
 	/* cl_waiting */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, route->client_pool.count_pending);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, route->client_pool.count_pending);
 	if (rc == -1)
 		goto error;
 	/* sv_active */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, route->server_pool.count_active);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, route->server_pool.count_active);
 	if (rc == -1)
 		goto error;
 	/* sv_idle */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, route->server_pool.count_idle);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, route->server_pool.count_idle);
 	if (rc == -1)
 		goto error;
 	/* sv_used */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, 0);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, 0);
 	if (rc == -1)
 		goto error;
 	/* sv_tested */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, 0);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, 0);
 	if (rc == -1)
 		goto error;
 	/* sv_login */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, 0);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, 0);
 	if (rc == -1)
 		goto error;
 	/* maxwait */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, 0);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	uint64_t max_wait = od_route_max_wait(route);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, max_wait / 1000000);
 	if (rc == -1)
 		goto error;
 	/* maxwait_us */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, 0);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, max_wait % 1000000);
 	if (rc == -1)
 		goto error;
 
@@ -263,10 +279,44 @@ od_console_show_pools_add_cb(od_route_t *route, void **argv)
 		rc = kiwi_be_write_data_row_add(stream, offset, "session", 7);
 	if (route->rule->pool == OD_RULE_POOL_TRANSACTION)
 		rc = kiwi_be_write_data_row_add(stream, offset, "transaction", 11);
+	if (route->rule->pool == OD_RULE_POOL_STATEMENT)
+		rc = kiwi_be_write_data_row_add(stream, offset, "statement", 9);
+	if (rc == -1)
+		goto error;
+	/* cl_waiting_peak, longest wait queue of the last stats interval */
+	rc = kiwi_be_write_data_row_add_i64(stream, offset, route->count_waiters_peak);
+	if (rc == -1)
+		goto error;
+	/* pool_limit, servers in use allowed by pool_adaptive */
+	int pool_limit = route->rule->pool_size;
+	if (route->rule->pool_adaptive)
+		pool_limit = route->pool_limit;
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, pool_limit);
 	if (rc == -1)
 		goto error;
 
 	od_route_unlock(route);
+
+	/* wait totals */
+	od_stat_t stat;
+	od_stat_init(&stat);
+	od_route_stat_sum(route, &stat);
+	/* total_wait_count */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, stat.count_wait);
+	if (rc == -1)
+		return -1;
+	/* total_wait_time */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, stat.wait_time);
+	if (rc == -1)
+		return -1;
+	/* total_wait_timeouts */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, stat.count_wait_timeout);
+	if (rc == -1)
+		return -1;
+	/* total_routing_waits */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, stat.count_wait_routing);
+	if (rc == -1)
+		return -1;
 	return 0;
 error:
 	od_route_unlock(route);
@@ -283,14 +333,14 @@ od_console_show_databases_add_cb(od_route_t *route, void **argv)
 	if (msg == NULL)
 		return -1;
 
-	od_route_lock(route);
+	od_route_lock(route, OD_LOCK_CONSOLE);
 	int rc;
 	rc = kiwi_be_write_data_row_add(stream, offset, route->id.database,
 									route->id.database_len - 1);
 	if (rc == -1)
 		goto error;
 	od_rule_t *rule = route->rule;
-	od_rule_storage_t *storage = rule->storage;
+	od_rule_storage_t *storage = od_route_storage(route);
 
 	char *host = storage->host;
 	if (!host)
@@ -299,12 +349,9 @@ od_console_show_databases_add_cb(od_route_t *route, void **argv)
 									strlen(host));
 	if (rc == -1)
 		goto error;
-	char data[64];
-	int  data_len;
 
 	/* port */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, storage->port);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, storage->port);
 	if (rc == -1)
 		goto error;
 
@@ -320,14 +367,12 @@ od_console_show_databases_add_cb(od_route_t *route, void **argv)
 		goto error;
 
 	/* pool_size */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, rule->pool_size);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, rule->pool_size);
 	if (rc == -1)
 		goto error;
 
 	/* reserve_pool */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, 0);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, 0);
 	if (rc == -1)
 		goto error;
 
@@ -337,32 +382,31 @@ od_console_show_databases_add_cb(od_route_t *route, void **argv)
 		rc = kiwi_be_write_data_row_add(stream, offset, "session", 7);
 	if (rule->pool == OD_RULE_POOL_TRANSACTION)
 		rc = kiwi_be_write_data_row_add(stream, offset, "transaction", 11);
+	if (rule->pool == OD_RULE_POOL_STATEMENT)
+		rc = kiwi_be_write_data_row_add(stream, offset, "statement", 9);
 	if (rc == -1)
 		goto error;
 
 	/* max_connections */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, rule->client_max);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, rule->client_max);
 	if (rc == -1)
 		goto error;
 
 	/* current_connections */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, route->client_pool.count_active
-											+ route->client_pool.count_pending
-											+ route->client_pool.count_queue);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset,
+	                                    route->client_pool.count_active +
+	                                    route->client_pool.count_pending +
+	                                    route->client_pool.count_queue);
 	if (rc == -1)
 		goto error;
 
 	/* paused */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, 0);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, route->paused);
 	if (rc == -1)
 		goto error;
 
 	/* disabled */
-	data_len = od_snprintf(data, sizeof(data), "%" PRIu64, 0);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, 0);
 	if (rc == -1)
 		goto error;
 
@@ -416,7 +460,7 @@ od_console_show_pools(od_client_t *client, machine_msg_t *stream)
 
 	machine_msg_t *msg;
 	msg = kiwi_be_write_row_descriptionf(stream,
-	                                     "ssllllllllls",
+	                                     "sslllllllllsllllll",
 	                                     "database",
 	                                     "user",
 	                                     "cl_active",
@@ -428,7 +472,13 @@ od_console_show_pools(od_client_t *client, machine_msg_t *stream)
 	                                     "sv_login",
 	                                     "maxwait",
 	                                     "maxwait_us",
-	                                     "pool_mode");
+	                                     "pool_mode",
+	                                     "cl_waiting_peak",
+	                                     "pool_limit",
+	                                     "total_wait_count",
+	                                     "total_wait_time",
+	                                     "total_wait_timeouts",
+	                                     "total_routing_waits");
 	if (msg == NULL)
 		return -1;
 
@@ -445,141 +495,313 @@ od_console_show_pools(od_client_t *client, machine_msg_t *stream)
 	return 0;
 }
 
+/* SHOW CLIENTS and SHOW SERVERS copy rows of one route at a time
+ * under the route lock, format them after the lock is released
+ * and send the reply in chunks instead of building it whole. */
+
+#define OD_CONSOLE_CHUNK (64 * 1024)
+
+typedef struct
+{
+	char *type;
+	char *state;
+	char  user[KIWI_MAX_VAR_SIZE];
+	char  database[KIWI_MAX_VAR_SIZE];
+	char  addr[64];
+	char  port[16];
+	char  local_addr[64];
+	char  local_port[16];
+	char  ptr[64];
+	int   accounted;
+	uint64_t cpu_time;
+	uint64_t cpu_wait;
+	uint64_t cpu_switch;
+	char *wait_state;
+	uint64_t wait;
+} od_console_row_t;
+
+typedef struct
+{
+	od_console_row_t *rows;
+	int               count;
+	int               size;
+} od_console_rows_t;
+
+typedef struct
+{
+	char *database;
+	int   database_len;
+	char *user;
+	int   user_len;
+	int   limit;
+	int   count;
+} od_console_filter_t;
+
 static inline int
-od_console_show_servers_server_cb(od_server_t *server, void **argv)
+od_console_rows_reserve(od_console_rows_t *rows, int count)
 {
-	od_route_t *route = server->route;
+	rows->count = 0;
+	if (count <= rows->size)
+		return 0;
+	od_console_row_t *ptr;
+	ptr = realloc(rows->rows, sizeof(od_console_row_t) * count);
+	if (ptr == NULL)
+		return -1;
+	rows->rows = ptr;
+	rows->size = count;
+	return 0;
+}
+
+static inline int
+od_console_filter_read(od_console_filter_t *filter, od_parser_t *parser)
+{
+	memset(filter, 0, sizeof(*filter));
+	filter->limit = -1;
+
+	/* [database <name>] [user <name>] [limit <count>] */
+	for (;;)
+	{
+		od_token_t token;
+		int rc;
+		rc = od_parser_next(parser, &token);
+		if (rc == OD_PARSER_EOF)
+			return 0;
+		if (rc == OD_PARSER_SYMBOL && token.value.num == ';')
+			return 0;
+		if (rc != OD_PARSER_KEYWORD)
+			return -1;
+		od_keyword_t *keyword;
+		keyword = od_keyword_match(od_console_keywords, &token);
+		if (keyword == NULL)
+			return -1;
+		switch (keyword->id) {
+		case OD_LDATABASE:
+		case OD_LUSER:
+			rc = od_parser_next(parser, &token);
+			if (rc != OD_PARSER_KEYWORD && rc != OD_PARSER_STRING)
+				return -1;
+			if (keyword->id == OD_LDATABASE) {
+				filter->database     = token.value.string.pointer;
+				filter->database_len = token.value.string.size;
+			} else {
+				filter->user     = token.value.string.pointer;
+				filter->user_len = token.value.string.size;
+			}
+			break;
+		case OD_LLIMIT:
+			rc = od_parser_next(parser, &token);
+			if (rc != OD_PARSER_NUM)
+				return -1;
+			filter->limit = token.value.num;
+			break;
+		default:
+			return -1;
+		}
+	}
+}
+
+static inline int
+od_console_filter_match(od_console_filter_t *filter,
+                        char *database, int database_len,
+                        char *user, int user_len)
+{
+	if (filter->database) {
+		if (filter->database_len != database_len ||
+		    memcmp(filter->database, database, database_len) != 0)
+			return 0;
+	}
+	if (filter->user) {
+		if (filter->user_len != user_len ||
+		    memcmp(filter->user, user, user_len) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+static inline int
+od_console_filter_done(od_console_filter_t *filter)
+{
+	return filter->limit != -1 && filter->count >= filter->limit;
+}
+
+static inline int
+od_console_flush(od_client_t *client, machine_msg_t **stream)
+{
+	if (machine_msg_size(*stream) < OD_CONSOLE_CHUNK)
+		return 0;
+	int rc;
+	rc = od_write(&client->io, *stream);
+	*stream = machine_msg_create(0);
+	if (*stream == NULL)
+		return -1;
+	return rc;
+}
 
+static inline int
+od_console_write_row(machine_msg_t *stream, od_console_row_t *row)
+{
 	int offset;
-	machine_msg_t *stream = argv[0];
 	machine_msg_t *msg;
 	msg = kiwi_be_write_data_row(stream, &offset);
 	if (msg == NULL)
 		return -1;
-	/* type */
-	char data[64];
-	int  data_len;
-	data_len = od_snprintf(data, sizeof(data), "S");
 	int rc;
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	/* type */
+	rc = kiwi_be_write_data_row_add(stream, offset, row->type, 1);
 	if (rc == -1)
 		return -1;
 	/* user */
-	rc = kiwi_be_write_data_row_add(stream, offset,
-	                                route->id.user,
-	                                route->id.user_len - 1);
+	rc = kiwi_be_write_data_row_add(stream, offset, row->user,
+	                                strlen(row->user));
 	if (rc == -1)
 		return -1;
 	/* database */
-	rc = kiwi_be_write_data_row_add(stream, offset,
-	                                route->id.database,
-	                                route->id.database_len - 1);
+	rc = kiwi_be_write_data_row_add(stream, offset, row->database,
+	                                strlen(row->database));
 	if (rc == -1)
 		return -1;
 	/* state */
-	char *state = "";
-	if (server->state == OD_SERVER_IDLE)
-		state = "idle";
-	else
-	if (server->state == OD_SERVER_ACTIVE)
-		state = "active";
-	rc = kiwi_be_write_data_row_add(stream, offset, state, strlen(state));
+	rc = kiwi_be_write_data_row_add(stream, offset, row->state,
+	                                strlen(row->state));
 	if (rc == -1)
 		return -1;
 	/* addr */
-	od_getpeername(server->io.io, data, sizeof(data), 1, 0);
-	data_len = strlen(data);
-	rc = kiwi_be_write_data_row_add(msg, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add(stream, offset, row->addr,
+	                                strlen(row->addr));
 	if (rc == -1)
 		return -1;
 	/* port */
-	od_getpeername(server->io.io, data, sizeof(data), 0, 1);
-	data_len = strlen(data);
-	rc = kiwi_be_write_data_row_add(msg, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add(stream, offset, row->port,
+	                                strlen(row->port));
 	if (rc == -1)
 		return -1;
 	/* local_addr */
-	od_getsockname(server->io.io, data, sizeof(data), 1, 0);
-	data_len = strlen(data);
-	rc = kiwi_be_write_data_row_add(msg, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add(stream, offset, row->local_addr,
+	                                strlen(row->local_addr));
 	if (rc == -1)
 		return -1;
 	/* local_port */
-	od_getsockname(server->io.io, data, sizeof(data), 0, 1);
-	data_len = strlen(data);
-	rc = kiwi_be_write_data_row_add(msg, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add(stream, offset, row->local_port,
+	                                strlen(row->local_port));
 	if (rc == -1)
 		return -1;
 	/* connect_time */
-	rc = kiwi_be_write_data_row_add(msg, offset, NULL, -1);
+	rc = kiwi_be_write_data_row_add(stream, offset, NULL, -1);
 	if (rc == -1)
 		return -1;
 	/* request_time */
-	rc = kiwi_be_write_data_row_add(msg, offset, NULL, -1);
+	rc = kiwi_be_write_data_row_add(stream, offset, NULL, -1);
 	if (rc == -1)
 		return -1;
 	/* wait */
-	data_len = od_snprintf(data, sizeof(data), "0");
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, row->wait / 1000000);
 	if (rc == -1)
 		return -1;
 	/* wait_us */
-	data_len = od_snprintf(data, sizeof(data), "0");
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, row->wait % 1000000);
 	if (rc == -1)
 		return -1;
 	/* ptr */
-	data_len = od_snprintf(data, sizeof(data), "%s%.*s",
-	                       server->id.id_prefix,
-	                       (signed)sizeof(server->id.id), server->id.id);
-	rc = kiwi_be_write_data_row_add(msg, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add(stream, offset, row->ptr,
+	                                strlen(row->ptr));
 	if (rc == -1)
 		return -1;
 	/* link */
-	data_len = od_snprintf(data, sizeof(data), "%s", "");
-	rc = kiwi_be_write_data_row_add(msg, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add(stream, offset, "", 0);
 	if (rc == -1)
 		return -1;
 	/* remote_pid */
-	data_len = od_snprintf(data, sizeof(data), "0");
-	rc = kiwi_be_write_data_row_add(msg, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add(stream, offset, "0", 1);
 	if (rc == -1)
 		return -1;
 	/* tls */
-	data_len = od_snprintf(data, sizeof(data), "%s", "");
-	rc = kiwi_be_write_data_row_add(msg, offset, data, data_len);
+	rc = kiwi_be_write_data_row_add(stream, offset, "", 0);
+	if (rc == -1)
+		return -1;
+	/* cpu_time, cpu_wait, switches */
+	uint64_t cpu[] = { row->cpu_time, row->cpu_wait, row->cpu_switch };
+	int i;
+	for (i = 0; i < 3; i++) {
+		if (! row->accounted) {
+			rc = kiwi_be_write_data_row_add(stream, offset, NULL, -1);
+		} else {
+			rc = kiwi_be_write_data_row_add_u64(stream, offset, cpu[i]);
+		}
+		if (rc == -1)
+			return -1;
+	}
+	/* wait_state */
+	rc = kiwi_be_write_data_row_add(stream, offset, row->wait_state,
+	                                strlen(row->wait_state));
 	if (rc == -1)
 		return -1;
 	return 0;
 }
 
 static inline int
-od_console_show_servers_cb(od_route_t *route, void **argv)
+od_console_write_rows(od_client_t *client, machine_msg_t **stream,
+                      od_console_rows_t *rows,
+                      od_console_filter_t *filter)
 {
-	od_route_lock(route);
-
-	od_server_pool_foreach(&route->server_pool,
-	                       OD_SERVER_ACTIVE,
-	                       od_console_show_servers_server_cb,
-	                       argv);
+	int i;
+	for (i = 0; i < rows->count; i++)
+	{
+		if (od_console_filter_done(filter))
+			break;
+		int rc;
+		rc = od_console_write_row(*stream, &rows->rows[i]);
+		if (rc == -1)
+			return -1;
+		filter->count++;
+		rc = od_console_flush(client, stream);
+		if (rc == -1)
+			return -1;
+	}
+	return 0;
+}
 
-	od_server_pool_foreach(&route->server_pool,
-	                       OD_SERVER_IDLE,
-	                       od_console_show_servers_server_cb,
-	                       argv);
+static inline void
+od_console_row_set_io(od_console_row_t *row, machine_io_t *io)
+{
+	od_getpeername(io, row->addr, sizeof(row->addr), 1, 0);
+	od_getpeername(io, row->port, sizeof(row->port), 0, 1);
+	od_getsockname(io, row->local_addr, sizeof(row->local_addr), 1, 0);
+	od_getsockname(io, row->local_port, sizeof(row->local_port), 0, 1);
+}
 
-	od_route_unlock(route);
-	return 0;
+static inline void
+od_console_row_set_wait(od_console_row_t *row, od_client_t *client)
+{
+	/* route is locked, so the attached server is not released */
+	od_client_wait_t wait = client->wait;
+	uint64_t wait_start = client->wait_start;
+	od_server_t *server = client->server;
+	if (server && wait == OD_CLIENT_WAIT_CLIENT) {
+		if (od_server_in_deploy(server)) {
+			wait = OD_CLIENT_WAIT_DEPLOY;
+		} else
+		if (server->relay.write_wait_start) {
+			wait = OD_CLIENT_WAIT_WRITE;
+			wait_start = server->relay.write_wait_start;
+		} else
+		if (server->stats_state.query_time_start) {
+			wait = OD_CLIENT_WAIT_QUERY;
+			wait_start = server->stats_state.query_time_start;
+		}
+	}
+	row->wait_state = od_client_wait_name(wait);
+	row->wait = 0;
+	uint64_t now = machine_time_us();
+	if (wait_start && now > wait_start)
+		row->wait = now - wait_start;
 }
 
 static inline int
-od_console_show_servers(od_client_t *client, machine_msg_t *stream)
+od_console_row_description(machine_msg_t *stream)
 {
-	od_router_t *router = client->global->router;
-
 	machine_msg_t *msg;
 	msg = kiwi_be_write_row_descriptionf(stream,
-	                                     "sssssdsdssddssds",
+	                                     "sssssdsdssddssdsllls",
 	                                     "type",
 	                                     "user",
 	                                     "database",
@@ -595,180 +817,1202 @@ od_console_show_servers(od_client_t *client, machine_msg_t *stream)
 	                                     "ptr",
 	                                     "link",
 	                                     "remote_pid",
-	                                     "tls");
-	if (msg == NULL)
-		return -1;
-
-	void *argv[] = { stream };
-	od_router_foreach(router, od_console_show_servers_cb, argv);
-
-	msg = kiwi_be_write_complete(stream, "SHOW", 5);
+	                                     "tls",
+	                                     "cpu_time",
+	                                     "cpu_wait",
+	                                     "switches",
+	                                     "wait_state");
 	if (msg == NULL)
 		return -1;
-
 	return 0;
 }
 
+typedef int (*od_console_snapshot_t)(od_route_t*, od_console_rows_t*,
+                                     od_console_filter_t*);
+
 static inline int
-od_console_show_clients_callback(od_client_t *client, void **argv)
+od_console_show_rows(od_client_t *client, machine_msg_t **stream,
+                     od_parser_t *parser,
+                     od_console_snapshot_t snapshot)
 {
-	int offset;
-	machine_msg_t *stream = argv[0];
-	machine_msg_t *msg;
-	msg = kiwi_be_write_data_row(stream, &offset);
-	if (msg == NULL)
-		return -1;
-	char data[64];
-	int  data_len;
-	/* type */
-	data_len = od_snprintf(data, sizeof(data), "C");
+	od_router_t *router = client->global->router;
+
+	od_console_filter_t filter;
 	int rc;
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
-	if (rc == -1)
-		return -1;
-	/* user */
-	rc = kiwi_be_write_data_row_add(stream, offset, client->startup.user.value,
-	                                client->startup.user.value_len - 1);
-	if (rc == -1)
-		return -1;
-	/* database */
-	rc = kiwi_be_write_data_row_add(stream, offset, client->startup.database.value,
-	                                client->startup.database.value_len - 1);
-	if (rc == -1)
-		return -1;
-	/* state */
-	char *state = "";
-	if (client->state == OD_CLIENT_ACTIVE)
-		state = "active";
-	else
-	if (client->state == OD_CLIENT_PENDING)
-		state = "pending";
-	else
-	if (client->state == OD_CLIENT_QUEUE)
-		state = "queue";
-	rc = kiwi_be_write_data_row_add(stream, offset, state, strlen(state));
-	if (rc == -1)
-		return -1;
-	/* addr */
-	od_getpeername(client->io.io, data, sizeof(data), 1, 0);
-	data_len = strlen(data);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
-	if (rc == -1)
-		return -1;
-	/* port */
-	od_getpeername(client->io.io, data, sizeof(data), 0, 1);
-	data_len = strlen(data);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
-	if (rc == -1)
-		return -1;
-	/* local_addr */
-	od_getsockname(client->io.io, data, sizeof(data), 1, 0);
-	data_len = strlen(data);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
-	if (rc == -1)
-		return -1;
-	/* local_port */
-	od_getsockname(client->io.io, data, sizeof(data), 0, 1);
-	data_len = strlen(data);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
-	if (rc == -1)
-		return -1;
-	/* connect_time */
-	rc = kiwi_be_write_data_row_add(stream, offset, NULL, -1);
-	if (rc == -1)
-		return -1;
-	/* request_time */
-	rc = kiwi_be_write_data_row_add(stream, offset, NULL, -1);
-	if (rc == -1)
-		return -1;
-	/* wait */
-	data_len = od_snprintf(data, sizeof(data), "0");
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
-	if (rc == -1)
-		return -1;
-	/* wait_us */
-	data_len = od_snprintf(data, sizeof(data), "0");
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	rc = od_console_filter_read(&filter, parser);
 	if (rc == -1)
 		return -1;
-	/* ptr */
-	data_len = od_snprintf(data, sizeof(data), "%s%.*s",
-	                       client->id.id_prefix,
-	                       (signed)sizeof(client->id.id), client->id.id);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+
+	rc = od_console_row_description(*stream);
 	if (rc == -1)
 		return -1;
-	/* link */
-	data_len = od_snprintf(data, sizeof(data), "%s", "");
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
-	if (rc == -1)
+
+	int count;
+	od_route_t **routes;
+	routes = od_route_pool_pin(&router->route_pool, &count);
+	if (routes == NULL)
 		return -1;
-	/* remote_pid */
-	data_len = od_snprintf(data, sizeof(data), "0");
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+
+	od_console_rows_t rows;
+	memset(&rows, 0, sizeof(rows));
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		if (od_console_filter_done(&filter))
+			break;
+		od_route_t *route = routes[i];
+		od_route_lock(route, OD_LOCK_CONSOLE);
+		rc = snapshot(route, &rows, &filter);
+		od_route_unlock(route);
+		if (rc == -1)
+			break;
+		rc = od_console_write_rows(client, stream, &rows, &filter);
+		if (rc == -1)
+			break;
+	}
+	od_route_pool_unpin(routes, count);
+	free(rows.rows);
 	if (rc == -1)
 		return -1;
-	/* tls */
-	data_len = od_snprintf(data, sizeof(data), "%s", "");
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
-	if (rc == -1)
+
+	machine_msg_t *msg;
+	msg = kiwi_be_write_complete(*stream, "SHOW", 5);
+	if (msg == NULL)
 		return -1;
 	return 0;
 }
 
 static inline int
-od_console_show_clients_cb(od_route_t *route, void **argv)
+od_console_show_servers_server_cb(od_server_t *server, void **argv)
 {
-	od_route_lock(route);
+	od_route_t *route = server->route;
+	od_console_rows_t *rows = argv[0];
 
-	od_client_pool_foreach(&route->client_pool,
-	                       OD_CLIENT_ACTIVE,
-	                       od_console_show_clients_callback,
-	                       argv);
+	od_console_row_t *row = &rows->rows[rows->count++];
+	row->type = "S";
+	row->state = "";
+	if (server->state == OD_SERVER_IDLE)
+		row->state = "idle";
+	else
+	if (server->state == OD_SERVER_ACTIVE)
+		row->state = "active";
+	od_snprintf(row->user, sizeof(row->user), "%.*s",
+	            route->id.user_len - 1, route->id.user);
+	od_snprintf(row->database, sizeof(row->database), "%.*s",
+	            route->id.database_len - 1, route->id.database);
+	od_console_row_set_io(row, server->io.io);
+	od_snprintf(row->ptr, sizeof(row->ptr), "%s%.*s",
+	            server->id.id_prefix,
+	            (signed)sizeof(server->id.id), server->id.id);
+	row->accounted  = 0;
+	row->wait_state = "";
+	row->wait       = 0;
+	return 0;
+}
 
-	od_client_pool_foreach(&route->client_pool,
-	                       OD_CLIENT_PENDING,
-	                       od_console_show_clients_callback,
-	                       argv);
+static inline int
+od_console_show_servers_cb(od_route_t *route, od_console_rows_t *rows,
+                           od_console_filter_t *filter)
+{
+	rows->count = 0;
+	if (! od_console_filter_match(filter,
+	                              route->id.database,
+	                              route->id.database_len - 1,
+	                              route->id.user,
+	                              route->id.user_len - 1))
+		return 0;
 
-	od_client_pool_foreach(&route->client_pool,
-	                       OD_CLIENT_QUEUE,
-	                       od_console_show_clients_callback,
+	int rc;
+	rc = od_console_rows_reserve(rows, od_server_pool_total(&route->server_pool));
+	if (rc == -1)
+		return -1;
+
+	void *argv[] = { rows };
+	od_server_pool_foreach(&route->server_pool,
+	                       OD_SERVER_ACTIVE,
+	                       od_console_show_servers_server_cb,
 	                       argv);
 
-	od_route_unlock(route);
+	od_server_pool_foreach(&route->server_pool,
+	                       OD_SERVER_IDLE,
+	                       od_console_show_servers_server_cb,
+	                       argv);
 	return 0;
 }
 
 static inline int
-od_console_show_clients(od_client_t *client, machine_msg_t *stream)
+od_console_show_servers(od_client_t *client, machine_msg_t **stream,
+                        od_parser_t *parser)
 {
-	od_router_t *router = client->global->router;
+	return od_console_show_rows(client, stream, parser,
+	                            od_console_show_servers_cb);
+}
 
-	machine_msg_t *msg;
-	msg = kiwi_be_write_row_descriptionf(stream,
-	                                     "sssssdsdssddssds",
-	                                     "type",
+static inline int
+od_console_show_clients_callback(od_client_t *client, void **argv)
+{
+	od_console_rows_t *rows = argv[0];
+	od_console_filter_t *filter = argv[1];
+
+	kiwi_var_t *user = &client->startup.user;
+	kiwi_var_t *database = &client->startup.database;
+	if (! od_console_filter_match(filter,
+	                              database->value, database->value_len - 1,
+	                              user->value, user->value_len - 1))
+		return 0;
+
+	od_console_row_t *row = &rows->rows[rows->count++];
+	row->type = "C";
+	row->state = "";
+	if (client->state == OD_CLIENT_ACTIVE)
+		row->state = "active";
+	else
+	if (client->state == OD_CLIENT_PENDING)
+		row->state = "pending";
+	else
+	if (client->state == OD_CLIENT_QUEUE)
+		row->state = "queue";
+	od_snprintf(row->user, sizeof(row->user), "%.*s",
+	            user->value_len - 1, user->value);
+	od_snprintf(row->database, sizeof(row->database), "%.*s",
+	            database->value_len - 1, database->value);
+	od_console_row_set_io(row, client->io.io);
+	od_snprintf(row->ptr, sizeof(row->ptr), "%s%.*s",
+	            client->id.id_prefix,
+	            (signed)sizeof(client->id.id), client->id.id);
+	od_instance_t *instance = client->global->instance;
+	row->accounted  = instance->config.coroutine_accounting;
+	row->cpu_time   = client->cpu_time;
+	row->cpu_wait   = client->cpu_wait;
+	row->cpu_switch = client->cpu_switch;
+	od_console_row_set_wait(row, client);
+	return 0;
+}
+
+static inline int
+od_console_show_clients_cb(od_route_t *route, od_console_rows_t *rows,
+                           od_console_filter_t *filter)
+{
+	int rc;
+	rc = od_console_rows_reserve(rows, od_client_pool_total(&route->client_pool));
+	if (rc == -1)
+		return -1;
+
+	void *argv[] = { rows, filter };
+	od_client_pool_foreach(&route->client_pool,
+	                       OD_CLIENT_ACTIVE,
+	                       od_console_show_clients_callback,
+	                       argv);
+
+	od_client_pool_foreach(&route->client_pool,
+	                       OD_CLIENT_PENDING,
+	                       od_console_show_clients_callback,
+	                       argv);
+
+	od_client_pool_foreach(&route->client_pool,
+	                       OD_CLIENT_QUEUE,
+	                       od_console_show_clients_callback,
+	                       argv);
+	return 0;
+}
+
+static inline int
+od_console_show_clients(od_client_t *client, machine_msg_t **stream,
+                        od_parser_t *parser)
+{
+	return od_console_show_rows(client, stream, parser,
+	                            od_console_show_clients_cb);
+}
+
+static inline int
+od_console_show_lists_add(machine_msg_t *stream, char *list, int items)
+{
+	int offset;
+	machine_msg_t *msg;
+	msg = kiwi_be_write_data_row(stream, &offset);
+	if (msg == NULL)
+		return -1;
+	/* list */
+	int rc;
+	rc = kiwi_be_write_data_row_add(stream, offset, list, strlen(list));
+	if (rc == -1)
+		return -1;
+	/* items */
+	rc = kiwi_be_write_data_row_add_i64(stream, offset, items);
+	if (rc == -1)
+		return -1;
+	return 0;
+}
+
+static inline int
+od_console_show_lists_cb(od_route_t *route, void **argv)
+{
+	od_route_lock(route, OD_LOCK_CONSOLE);
+
+	int *used_servers = argv[0];
+	(*used_servers) += route->server_pool.count_active;
+	(*used_servers) += route->server_pool.count_idle;
+
+	od_route_unlock(route);
+	return 0;
+}
+
+static inline int
+od_console_show_lists(od_client_t *client, machine_msg_t *stream)
+{
+	od_router_t *router = client->global->router;
+
+	/* Gather router information.
+
+	   router_used_servers can be inconsistent here, since it depends on
+	   separate route locks.
+	*/
+	int router_used_servers = 0;
+	int router_pools        = od_route_pool_count(&router->route_pool);
+	int router_clients      = od_atomic_u32_of(&router->clients);
+
+	void *argv[] = { &router_used_servers };
+	od_router_foreach(router, od_console_show_lists_cb, argv);
+
+	machine_msg_t *msg;
+	msg = kiwi_be_write_row_descriptionf(stream, "sd", "list", "items");
+	if (msg == NULL)
+		return -1;
+	int rc;
+	/* databases */
+	rc = od_console_show_lists_add(stream, "databases", 0);
+	if (rc == -1)
+		return -1;
+	/* users */
+	rc = od_console_show_lists_add(stream, "users", 0);
+	if (rc == -1)
+		return -1;
+	/* pools */
+	rc = od_console_show_lists_add(stream, "pools", router_pools);
+	if (rc == -1)
+		return -1;
+	/* free_clients */
+	rc = od_console_show_lists_add(stream, "free_clients", 0);
+	if (rc == -1)
+		return -1;
+	/* used_clients */
+	rc = od_console_show_lists_add(stream, "used_clients", router_clients);
+	if (rc == -1)
+		return -1;
+	/* login_clients */
+	rc = od_console_show_lists_add(stream, "login_clients", 0);
+	if (rc == -1)
+		return -1;
+	/* free_servers */
+	rc = od_console_show_lists_add(stream, "free_servers", 0);
+	if (rc == -1)
+		return -1;
+	/* used_servers */
+	rc = od_console_show_lists_add(stream, "used_servers", router_used_servers);
+	if (rc == -1)
+		return -1;
+	/* dns_names */
+	rc = od_console_show_lists_add(stream, "dns_names", 0);
+	if (rc == -1)
+		return -1;
+	/* dns_zones */
+	rc = od_console_show_lists_add(stream, "dns_zones", 0);
+	if (rc == -1)
+		return -1;
+	/* dns_queries */
+	rc = od_console_show_lists_add(stream, "dns_queries", 0);
+	if (rc == -1)
+		return -1;
+	/* dns_pending */
+	rc = od_console_show_lists_add(stream, "dns_pending", 0);
+	if (rc == -1)
+		return -1;
+	/* msg_cache_<size>, cached messages per size class of this worker */
+	int id;
+	for (id = 0;; id++) {
+		uint64_t class_size;
+		uint64_t msg_allocated;
+		uint64_t msg_cache_gc_count;
+		uint64_t msg_cache_count;
+		uint64_t msg_cache_size;
+		rc = machine_stat_msg_class(id, &class_size, &msg_allocated,
+		                            &msg_cache_gc_count, &msg_cache_count,
+		                            &msg_cache_size);
+		if (rc == -1)
+			break;
+		char list[64];
+		od_snprintf(list, sizeof(list), "msg_cache_%" PRIu64, class_size);
+		rc = od_console_show_lists_add(stream, list, (int)msg_cache_count);
+		if (rc == -1)
+			return -1;
+	}
+	msg = kiwi_be_write_complete(stream, "SHOW", 5);
+	if (msg == NULL)
+		return -1;
+	return 0;
+}
+
+static inline int
+od_console_show_auth_cache_add(machine_msg_t *stream, od_rule_t *rule)
+{
+	int      count;
+	int      count_negative;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t coalesced;
+	od_auth_cache_stat(&rule->auth_query_cache, &count, &count_negative,
+	                   &hits, &misses, &coalesced);
+
+	int offset;
+	machine_msg_t *msg;
+	msg = kiwi_be_write_data_row(stream, &offset);
+	if (msg == NULL)
+		return -1;
+	/* database */
+	int rc;
+	rc = kiwi_be_write_data_row_add(stream, offset, rule->db_name,
+	                                rule->db_name_len);
+	if (rc == -1)
+		return -1;
+	/* user */
+	rc = kiwi_be_write_data_row_add(stream, offset, rule->user_name,
+	                                rule->user_name_len);
+	if (rc == -1)
+		return -1;
+	/* ttl */
+	rc = kiwi_be_write_data_row_add_i64(stream, offset, rule->auth_query_cache_ttl);
+	if (rc == -1)
+		return -1;
+	/* negative_ttl */
+	rc = kiwi_be_write_data_row_add_i64(stream, offset,
+	                                    rule->auth_query_cache_negative_ttl);
+	if (rc == -1)
+		return -1;
+	/* entries */
+	rc = kiwi_be_write_data_row_add_i64(stream, offset, count);
+	if (rc == -1)
+		return -1;
+	/* negative */
+	rc = kiwi_be_write_data_row_add_i64(stream, offset, count_negative);
+	if (rc == -1)
+		return -1;
+	/* hits */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, hits);
+	if (rc == -1)
+		return -1;
+	/* misses */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, misses);
+	if (rc == -1)
+		return -1;
+	/* coalesced */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, coalesced);
+	if (rc == -1)
+		return -1;
+	return 0;
+}
+
+static inline int
+od_console_show_auth_cache(od_client_t *client, machine_msg_t *stream)
+{
+	od_router_t *router = client->global->router;
+
+	machine_msg_t *msg;
+	msg = kiwi_be_write_row_descriptionf(stream,
+	                                     "sslllllll",
+	                                     "database",
+	                                     "user",
+	                                     "ttl",
+	                                     "negative_ttl",
+	                                     "entries",
+	                                     "negative",
+	                                     "hits",
+	                                     "misses",
+	                                     "coalesced");
+	if (msg == NULL)
+		return -1;
+
+	int rc = 0;
+	od_router_lock_read(router, OD_LOCK_CONSOLE);
+	od_list_t *i;
+	od_list_foreach(&router->rules.rules, i) {
+		od_rule_t *rule;
+		rule = od_container_of(i, od_rule_t, link);
+		if (rule->obsolete || rule->auth_query == NULL)
+			continue;
+		rc = od_console_show_auth_cache_add(stream, rule);
+		if (rc == -1)
+			break;
+	}
+	od_router_unlock(router);
+	if (rc == -1)
+		return -1;
+
+	msg = kiwi_be_write_complete(stream, "SHOW", 5);
+	if (msg == NULL)
+		return -1;
+
+	return 0;
+}
+
+static inline int
+od_console_show_query_cache_add(machine_msg_t *stream, od_rule_t *rule)
+{
+	int      count;
+	int      size;
+	uint64_t hits;
+	uint64_t misses;
+	od_query_cache_stat(&rule->query_cache_replies, &count, &size,
+	                    &hits, &misses);
+
+	int offset;
+	machine_msg_t *msg;
+	msg = kiwi_be_write_data_row(stream, &offset);
+	if (msg == NULL)
+		return -1;
+	/* database */
+	int rc;
+	rc = kiwi_be_write_data_row_add(stream, offset, rule->db_name,
+	                                rule->db_name_len);
+	if (rc == -1)
+		return -1;
+	/* user */
+	rc = kiwi_be_write_data_row_add(stream, offset, rule->user_name,
+	                                rule->user_name_len);
+	if (rc == -1)
+		return -1;
+	/* ttl */
+	rc = kiwi_be_write_data_row_add_i64(stream, offset, rule->query_cache_ttl);
+	if (rc == -1)
+		return -1;
+	/* queries */
+	rc = kiwi_be_write_data_row_add_i64(stream, offset,
+	                                    rule->query_cache_replies.count);
+	if (rc == -1)
+		return -1;
+	/* entries */
+	rc = kiwi_be_write_data_row_add_i64(stream, offset, count);
+	if (rc == -1)
+		return -1;
+	/* bytes */
+	rc = kiwi_be_write_data_row_add_i64(stream, offset, size);
+	if (rc == -1)
+		return -1;
+	/* hits */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, hits);
+	if (rc == -1)
+		return -1;
+	/* misses */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, misses);
+	if (rc == -1)
+		return -1;
+	return 0;
+}
+
+static inline int
+od_console_show_query_cache(od_client_t *client, machine_msg_t *stream)
+{
+	od_router_t *router = client->global->router;
+
+	machine_msg_t *msg;
+	msg = kiwi_be_write_row_descriptionf(stream,
+	                                     "ssllllll",
+	                                     "database",
+	                                     "user",
+	                                     "ttl",
+	                                     "queries",
+	                                     "entries",
+	                                     "bytes",
+	                                     "hits",
+	                                     "misses");
+	if (msg == NULL)
+		return -1;
+
+	int rc = 0;
+	od_router_lock_read(router, OD_LOCK_CONSOLE);
+	od_list_t *i;
+	od_list_foreach(&router->rules.rules, i) {
+		od_rule_t *rule;
+		rule = od_container_of(i, od_rule_t, link);
+		if (rule->obsolete || rule->query_cache == NULL)
+			continue;
+		rc = od_console_show_query_cache_add(stream, rule);
+		if (rc == -1)
+			break;
+	}
+	od_router_unlock(router);
+	if (rc == -1)
+		return -1;
+
+	msg = kiwi_be_write_complete(stream, "SHOW", 5);
+	if (msg == NULL)
+		return -1;
+
+	return 0;
+}
+
+static inline int
+od_console_show_memory_add_cb(od_route_t *route, void **argv)
+{
+	int offset;
+	machine_msg_t *stream = argv[0];
+	machine_msg_t *msg;
+	msg = kiwi_be_write_data_row(stream, &offset);
+	if (msg == NULL)
+		return -1;
+
+	od_route_lock(route, OD_LOCK_CONSOLE);
+	int rc;
+	rc = kiwi_be_write_data_row_add(stream, offset, route->id.database,
+	                                route->id.database_len - 1);
+	if (rc == -1)
+		goto error;
+	rc = kiwi_be_write_data_row_add(stream, offset, route->id.user,
+	                                route->id.user_len - 1);
+	if (rc == -1)
+		goto error;
+
+	/* snapshot of the last cron pass */
+	od_route_memory_t *memory = &route->memory;
+	uint64_t values[] = {
+		memory->client_buffers,
+		memory->server_buffers,
+		memory->packets,
+		memory->pending,
+		memory->stats,
+		od_route_memory_total(memory),
+		route->rule->memory_max
+	};
+	size_t i;
+	for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		rc = kiwi_be_write_data_row_add_u64(stream, offset, values[i]);
+		if (rc == -1)
+			goto error;
+	}
+	od_route_unlock(route);
+	return 0;
+error:
+	od_route_unlock(route);
+	return -1;
+}
+
+static inline int
+od_console_show_memory(od_client_t *client, machine_msg_t *stream)
+{
+	od_router_t *router = client->global->router;
+
+	machine_msg_t *msg;
+	msg = kiwi_be_write_row_descriptionf(stream,
+	                                     "sslllllll",
+	                                     "database",
+	                                     "user",
+	                                     "client_buffers",
+	                                     "server_buffers",
+	                                     "packets",
+	                                     "pending",
+	                                     "stats",
+	                                     "total",
+	                                     "memory_max");
+	if (msg == NULL)
+		return -1;
+
+	void *argv[] = { stream };
+	int rc;
+	rc = od_router_foreach(router, od_console_show_memory_add_cb, argv);
+	if (rc == -1)
+		return -1;
+
+	msg = kiwi_be_write_complete(stream, "SHOW", 5);
+	if (msg == NULL)
+		return -1;
+
+	return 0;
+}
+
+static inline int
+od_console_show_rates_add_cb(od_route_t *route, void **argv)
+{
+	machine_msg_t *stream = argv[0];
+
+	/* copy of the last cron update */
+	od_route_lock(route, OD_LOCK_CONSOLE);
+	od_stat_rates_t rates = route->rates;
+	od_route_unlock(route);
+
+	int i;
+	for (i = 0; i < OD_STAT_WINDOW_MAX; i++) {
+		int offset;
+		machine_msg_t *msg;
+		msg = kiwi_be_write_data_row(stream, &offset);
+		if (msg == NULL)
+			return -1;
+		int rc;
+		rc = kiwi_be_write_data_row_add(stream, offset, route->id.database,
+		                                route->id.database_len - 1);
+		if (rc == -1)
+			return -1;
+		rc = kiwi_be_write_data_row_add(stream, offset, route->id.user,
+		                                route->id.user_len - 1);
+		if (rc == -1)
+			return -1;
+		char *window = od_stat_window_name(i);
+		rc = kiwi_be_write_data_row_add(stream, offset, window, strlen(window));
+		if (rc == -1)
+			return -1;
+
+		/* per second rates and average usec of the window */
+		double values[] = {
+			rates.rate[i][OD_STAT_RATE_QUERY],
+			od_stat_rates_avg(&rates, i, OD_STAT_RATE_QUERY_TIME,
+			                  OD_STAT_RATE_QUERY),
+			rates.rate[i][OD_STAT_RATE_TX],
+			od_stat_rates_avg(&rates, i, OD_STAT_RATE_TX_TIME,
+			                  OD_STAT_RATE_TX),
+			rates.rate[i][OD_STAT_RATE_WAIT],
+			od_stat_rates_avg(&rates, i, OD_STAT_RATE_WAIT_TIME,
+			                  OD_STAT_RATE_WAIT),
+			rates.rate[i][OD_STAT_RATE_RECV_CLIENT],
+			rates.rate[i][OD_STAT_RATE_RECV_SERVER]
+		};
+		size_t j;
+		for (j = 0; j < sizeof(values) / sizeof(values[0]); j++) {
+			char data[32];
+			int data_len;
+			data_len = od_snprintf(data, sizeof(data), "%.2f", values[j]);
+			rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+			if (rc == -1)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static inline int
+od_console_show_rates(od_client_t *client, machine_msg_t *stream)
+{
+	od_router_t *router = client->global->router;
+
+	machine_msg_t *msg;
+	msg = kiwi_be_write_row_descriptionf(stream,
+	                                     "sssssssssss",
+	                                     "database",
 	                                     "user",
+	                                     "window",
+	                                     "query_rate",
+	                                     "query_time",
+	                                     "xact_rate",
+	                                     "xact_time",
+	                                     "wait_rate",
+	                                     "wait_time",
+	                                     "recv_client",
+	                                     "recv_server");
+	if (msg == NULL)
+		return -1;
+
+	void *argv[] = { stream };
+	int rc;
+	rc = od_router_foreach(router, od_console_show_rates_add_cb, argv);
+	if (rc == -1)
+		return -1;
+
+	msg = kiwi_be_write_complete(stream, "SHOW", 5);
+	if (msg == NULL)
+		return -1;
+
+	return 0;
+}
+
+static inline int
+od_console_show_fleet_add(machine_msg_t *stream, od_rule_t *rule,
+                          uint64_t peers, uint64_t peers_live)
+{
+	int offset;
+	machine_msg_t *msg;
+	msg = kiwi_be_write_data_row(stream, &offset);
+	if (msg == NULL)
+		return -1;
+	int rc;
+	rc = kiwi_be_write_data_row_add(stream, offset, rule->db_name,
+	                                rule->db_name_len);
+	if (rc == -1)
+		return -1;
+	rc = kiwi_be_write_data_row_add(stream, offset, rule->user_name,
+	                                rule->user_name_len);
+	if (rc == -1)
+		return -1;
+
+	pthread_mutex_lock(&rule->quota_lock);
+	uint64_t waiting = 0;
+	od_list_t *i;
+	od_list_foreach(&rule->quota_waiters, i)
+		waiting++;
+	uint64_t values[] = {
+		rule->pool_fleet_max,
+		rule->quota_fleet,
+		rule->quota_active,
+		waiting,
+		rule->quota_fleet_demand,
+		peers_live,
+		peers
+	};
+	pthread_mutex_unlock(&rule->quota_lock);
+
+	size_t j;
+	for (j = 0; j < sizeof(values) / sizeof(values[0]); j++) {
+		rc = kiwi_be_write_data_row_add_u64(stream, offset, values[j]);
+		if (rc == -1)
+			return -1;
+	}
+	return 0;
+}
+
+static inline int
+od_console_show_fleet(od_client_t *client, machine_msg_t *stream)
+{
+	od_router_t *router = client->global->router;
+	od_system_t *system = client->global->system;
+	od_fleet_t *fleet = &system->fleet;
+
+	machine_msg_t *msg;
+	msg = kiwi_be_write_row_descriptionf(stream,
+	                                     "sslllllll",
 	                                     "database",
-	                                     "state",
-	                                     "addr",
-	                                     "port",
-	                                     "local_addr",
-	                                     "local_port",
-	                                     "connect_time",
-	                                     "request_time",
+	                                     "user",
+	                                     "fleet_max",
+	                                     "share",
+	                                     "active",
+	                                     "waiting",
+	                                     "fleet_demand",
+	                                     "peers_live",
+	                                     "peers");
+	if (msg == NULL)
+		return -1;
+
+	uint64_t peers_live = od_atomic_u32_of(&fleet->peers_live);
+	od_router_lock_read(router, OD_LOCK_CONSOLE);
+	od_list_t *i;
+	od_list_foreach(&router->rules.rules, i) {
+		od_rule_t *rule;
+		rule = od_container_of(i, od_rule_t, link);
+		if (rule->obsolete || rule->pool_fleet_max == 0)
+			continue;
+		int rc;
+		rc = od_console_show_fleet_add(stream, rule, fleet->peers_count,
+		                               peers_live);
+		if (rc == -1) {
+			od_router_unlock(router);
+			return -1;
+		}
+	}
+	od_router_unlock(router);
+
+	msg = kiwi_be_write_complete(stream, "SHOW", 5);
+	if (msg == NULL)
+		return -1;
+	return 0;
+}
+
+static inline int
+od_console_show_workers_add(machine_msg_t *stream, od_worker_t *worker,
+                            char *group)
+{
+	/* published by the worker each second, fields may be of
+	 * different intervals */
+	machine_loop_stat_t *stat = &worker->loop_stat;
+	uint64_t steps = 0;
+	uint64_t spin_us = 0;
+	uint64_t spin_hits = 0;
+	uint64_t wakeups = 0;
+	if (stat->interval_us > 0) {
+		steps = stat->count_step * 1000000 / stat->interval_us;
+		spin_us = stat->spin_us * 1000000 / stat->interval_us;
+		spin_hits = stat->count_spin_hit * 1000000 / stat->interval_us;
+		wakeups = stat->count_wakeup * 1000000 / stat->interval_us;
+	}
+	uint64_t events_avg = 0;
+	if (stat->count_step > 0)
+		events_avg = stat->count_events / stat->count_step;
+
+	uint64_t values[] = {
+		worker->id,
+		od_atomic_u32_of(&worker->clients),
+		worker->clients_processed,
+		steps,
+		events_avg,
+		stat->events_max,
+		stat->ready_avg,
+		stat->ready_max,
+		stat->step_avg_us,
+		stat->step_p99_us,
+		stat->step_max_us,
+		stat->lag_avg_us,
+		stat->lag_p99_us,
+		stat->lag_max_us,
+		spin_us,
+		spin_hits,
+		wakeups,
+		od_atomic_u64_of(&worker->memory)
+	};
+
+	int offset;
+	machine_msg_t *msg;
+	msg = kiwi_be_write_data_row(stream, &offset);
+	if (msg == NULL)
+		return -1;
+	int rc;
+	size_t i;
+	for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		rc = kiwi_be_write_data_row_add_u64(stream, offset, values[i]);
+		if (rc == -1)
+			return -1;
+	}
+	/* group */
+	rc = kiwi_be_write_data_row_add(stream, offset, group, strlen(group));
+	if (rc == -1)
+		return -1;
+	return 0;
+}
+
+static inline int
+od_console_show_workers(od_client_t *client, machine_msg_t *stream)
+{
+	od_worker_pool_t *worker_pool = client->global->worker_pool;
+
+	machine_msg_t *msg;
+	msg = kiwi_be_write_row_descriptionf(stream,
+	                                     "dlllllllllllllllls",
+	                                     "worker",
+	                                     "clients",
+	                                     "clients_processed",
+	                                     "steps",
+	                                     "events_avg",
+	                                     "events_max",
+	                                     "ready_avg",
+	                                     "ready_max",
+	                                     "step_avg_us",
+	                                     "step_p99_us",
+	                                     "step_max_us",
+	                                     "lag_avg_us",
+	                                     "lag_p99_us",
+	                                     "lag_max_us",
+	                                     "spin_us",
+	                                     "spin_hits",
+	                                     "wakeups",
+	                                     "memory",
+	                                     "group");
+	if (msg == NULL)
+		return -1;
+
+	int i;
+	for (i = 0; i < od_worker_pool_total(worker_pool); i++) {
+		char *group = "";
+		int j;
+		for (j = 0; j < worker_pool->groups_count; j++) {
+			if (od_worker_pool_is_member(worker_pool, &worker_pool->groups[j], i))
+				group = worker_pool->groups[j].name;
+		}
+		int rc;
+		rc = od_console_show_workers_add(stream, od_worker_pool_get(worker_pool, i),
+		                                 group);
+		if (rc == -1)
+			return -1;
+	}
+
+	msg = kiwi_be_write_complete(stream, "SHOW", 5);
+	if (msg == NULL)
+		return -1;
+
+	return 0;
+}
+
+static inline int
+od_console_show_io_add(machine_msg_t *stream, od_worker_t *worker)
+{
+	/* counters since the worker start, published each second */
+	machine_io_stat_t *stat = &worker->io_stat;
+	uint64_t read_avg = 0;
+	if (stat->count_read > 0)
+		read_avg = stat->bytes_read / stat->count_read;
+	uint64_t writes = stat->count_write + stat->count_writev;
+	uint64_t write_avg = 0;
+	if (writes > 0)
+		write_avg = stat->bytes_write / writes;
+	uint64_t events_avg = 0;
+	if (stat->count_poll > 0)
+		events_avg = stat->count_poll_events / stat->count_poll;
+
+	uint64_t values[] = {
+		worker->id,
+		stat->count_read,
+		stat->bytes_read,
+		read_avg,
+		stat->count_read_eagain,
+		stat->count_write,
+		stat->count_writev,
+		stat->bytes_write,
+		write_avg,
+		stat->count_write_eagain,
+		stat->count_write_partial,
+		stat->count_splice,
+		stat->bytes_splice,
+		stat->count_poll,
+		stat->count_poll_empty,
+		events_avg
+	};
+
+	int offset;
+	machine_msg_t *msg;
+	msg = kiwi_be_write_data_row(stream, &offset);
+	if (msg == NULL)
+		return -1;
+	size_t i;
+	for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		int rc;
+		rc = kiwi_be_write_data_row_add_u64(stream, offset, values[i]);
+		if (rc == -1)
+			return -1;
+	}
+	return 0;
+}
+
+static inline int
+od_console_show_io(od_client_t *client, machine_msg_t *stream)
+{
+	od_worker_pool_t *worker_pool = client->global->worker_pool;
+
+	machine_msg_t *msg;
+	msg = kiwi_be_write_row_descriptionf(stream,
+	                                     "dlllllllllllllll",
+	                                     "worker",
+	                                     "reads",
+	                                     "read_bytes",
+	                                     "read_avg",
+	                                     "read_eagain",
+	                                     "writes",
+	                                     "writevs",
+	                                     "write_bytes",
+	                                     "write_avg",
+	                                     "write_eagain",
+	                                     "write_partial",
+	                                     "splices",
+	                                     "splice_bytes",
+	                                     "polls",
+	                                     "polls_empty",
+	                                     "poll_events_avg");
+	if (msg == NULL)
+		return -1;
+
+	int i;
+	for (i = 0; i < od_worker_pool_total(worker_pool); i++) {
+		int rc;
+		rc = od_console_show_io_add(stream, od_worker_pool_get(worker_pool, i));
+		if (rc == -1)
+			return -1;
+	}
+
+	msg = kiwi_be_write_complete(stream, "SHOW", 5);
+	if (msg == NULL)
+		return -1;
+
+	return 0;
+}
+
+static inline int
+od_console_show_locks_add(machine_msg_t *stream, int lock, int site,
+                          od_lockstat_site_t *stat)
+{
+	int offset;
+	machine_msg_t *msg;
+	msg = kiwi_be_write_data_row(stream, &offset);
+	if (msg == NULL)
+		return -1;
+	/* lock */
+	char *name = od_lockstat_lock_name(lock);
+	int rc;
+	rc = kiwi_be_write_data_row_add(stream, offset, name, strlen(name));
+	if (rc == -1)
+		return -1;
+	/* site */
+	name = od_lockstat_site_name(site);
+	rc = kiwi_be_write_data_row_add(stream, offset, name, strlen(name));
+	if (rc == -1)
+		return -1;
+	/* count */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, stat->count);
+	if (rc == -1)
+		return -1;
+	/* wait */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, stat->wait);
+	if (rc == -1)
+		return -1;
+	/* wait_p50 */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset,
+	                                    od_hgram_quantile(stat->wait_hgram, 0.5));
+	if (rc == -1)
+		return -1;
+	/* wait_p99 */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset,
+	                                    od_hgram_quantile(stat->wait_hgram, 0.99));
+	if (rc == -1)
+		return -1;
+	/* hold */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, stat->hold);
+	if (rc == -1)
+		return -1;
+	/* hold_p50 */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset,
+	                                    od_hgram_quantile(stat->hold_hgram, 0.5));
+	if (rc == -1)
+		return -1;
+	/* hold_p99 */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset,
+	                                    od_hgram_quantile(stat->hold_hgram, 0.99));
+	if (rc == -1)
+		return -1;
+	return 0;
+}
+
+static inline int
+od_console_show_locks(od_client_t *client, machine_msg_t *stream)
+{
+	(void)client;
+	machine_msg_t *msg;
+	msg = kiwi_be_write_row_descriptionf(stream,
+	                                     "sslllllll",
+	                                     "lock",
+	                                     "site",
+	                                     "count",
 	                                     "wait",
-	                                     "wait_us",
-	                                     "ptr",
-	                                     "link",
-	                                     "remote_pid",
-	                                     "tls");
+	                                     "wait_p50",
+	                                     "wait_p99",
+	                                     "hold",
+	                                     "hold_p50",
+	                                     "hold_p99");
+	if (msg == NULL)
+		return -1;
+
+	/* rows are empty unless lock_stats is enabled */
+	od_lockstat_site_t sum[OD_LOCKSTAT_MAX][OD_LOCK_SITE_MAX];
+	int rc = od_lockstat_merge(sum);
+	if (rc == -1)
+		return -1;
+	int i, j;
+	for (i = 0; i < OD_LOCKSTAT_MAX && rc == 0; i++) {
+		for (j = 0; j < OD_LOCK_SITE_MAX; j++) {
+			if (sum[i][j].count == 0)
+				continue;
+			rc = od_console_show_locks_add(stream, i, j, &sum[i][j]);
+			if (rc == -1)
+				break;
+		}
+	}
+	od_lockstat_merge_free(sum);
+	if (rc == -1)
+		return -1;
+
+	msg = kiwi_be_write_complete(stream, "SHOW", 5);
+	if (msg == NULL)
+		return -1;
+
+	return 0;
+}
+
+static inline int
+od_console_show_mirror_add(machine_msg_t *stream, od_mirror_pool_t *pool)
+{
+	int offset;
+	machine_msg_t *msg;
+	msg = kiwi_be_write_data_row(stream, &offset);
+	if (msg == NULL)
+		return -1;
+	/* database */
+	int rc;
+	rc = kiwi_be_write_data_row_add(stream, offset, pool->database,
+	                                pool->database_len - 1);
+	if (rc == -1)
+		return -1;
+	/* user */
+	rc = kiwi_be_write_data_row_add(stream, offset, pool->user,
+	                                pool->user_len - 1);
+	if (rc == -1)
+		return -1;
+	/* storage */
+	char *name = pool->client->rule->storage_mirror_name;
+	rc = kiwi_be_write_data_row_add(stream, offset, name, strlen(name));
+	if (rc == -1)
+		return -1;
+	/* connections */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, pool->count);
+	if (rc == -1)
+		return -1;
+	/* sent */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, pool->sent);
+	if (rc == -1)
+		return -1;
+	/* dropped */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, pool->dropped);
+	if (rc == -1)
+		return -1;
+	/* errors */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, pool->errors);
+	if (rc == -1)
+		return -1;
+	/* avg_us */
+	uint64_t avg = 0;
+	if (pool->sent > 0)
+		avg = pool->latency_sum / pool->sent;
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, avg);
+	if (rc == -1)
+		return -1;
+	/* p50_us */
+	od_hgram_freeze(pool->latency, NULL, 0);
+	rc = kiwi_be_write_data_row_add_u64(stream, offset,
+	                                    od_hgram_quantile(pool->latency, 0.5));
+	if (rc == -1)
+		return -1;
+	/* p99_us */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset,
+	                                    od_hgram_quantile(pool->latency, 0.99));
+	if (rc == -1)
+		return -1;
+	return 0;
+}
+
+static inline int
+od_console_show_mirror(od_client_t *client, machine_msg_t *stream)
+{
+	od_system_t *system = client->global->system;
+	od_mirror_t *mirror = &system->mirror;
+	machine_msg_t *msg;
+	msg = kiwi_be_write_row_descriptionf(stream,
+	                                     "ssslllllll",
+	                                     "database",
+	                                     "user",
+	                                     "storage",
+	                                     "connections",
+	                                     "sent",
+	                                     "dropped",
+	                                     "errors",
+	                                     "avg_us",
+	                                     "p50_us",
+	                                     "p99_us");
 	if (msg == NULL)
 		return -1;
 
-	void *argv[] = { stream };
-	od_router_foreach(router, od_console_show_clients_cb, argv);
+	/* latency histograms are updated under the lock, freezing
+	 * without a previous state only recounts the total */
+	int rc = 0;
+	pthread_mutex_lock(&mirror->lock);
+	od_list_t *i;
+	od_list_foreach(&mirror->pools, i) {
+		od_mirror_pool_t *pool;
+		pool = od_container_of(i, od_mirror_pool_t, link);
+		rc = od_console_show_mirror_add(stream, pool);
+		if (rc == -1)
+			break;
+	}
+	pthread_mutex_unlock(&mirror->lock);
+	if (rc == -1)
+		return -1;
 
 	msg = kiwi_be_write_complete(stream, "SHOW", 5);
 	if (msg == NULL)
@@ -778,123 +2022,351 @@ od_console_show_clients(od_client_t *client, machine_msg_t *stream)
 }
 
 static inline int
-od_console_show_lists_add(machine_msg_t *stream, char *list, int items)
+od_console_show_accept_add(machine_msg_t *stream, char *listen, char *type,
+                           uint64_t count, uint64_t p50, uint64_t p99,
+                           uint64_t max, uint64_t overflows, uint64_t drops)
 {
 	int offset;
 	machine_msg_t *msg;
 	msg = kiwi_be_write_data_row(stream, &offset);
 	if (msg == NULL)
 		return -1;
-	/* list */
+	/* listen */
 	int rc;
-	rc = kiwi_be_write_data_row_add(stream, offset, list, strlen(list));
+	rc = kiwi_be_write_data_row_add(stream, offset, listen, strlen(listen));
 	if (rc == -1)
 		return -1;
-	/* items */
-	char data[64];
-	int  data_len;
-	data_len = od_snprintf(data, sizeof(data), "%d", items);
-	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
+	/* type */
+	rc = kiwi_be_write_data_row_add(stream, offset, type, strlen(type));
 	if (rc == -1)
 		return -1;
+	uint64_t values[] = { count, p50, p99, max, overflows, drops };
+	size_t i;
+	for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		rc = kiwi_be_write_data_row_add_u64(stream, offset, values[i]);
+		if (rc == -1)
+			return -1;
+	}
 	return 0;
 }
 
 static inline int
-od_console_show_lists_cb(od_route_t *route, void **argv)
+od_console_show_accept(od_client_t *client, machine_msg_t *stream)
 {
-	od_route_lock(route);
+	od_instance_t *instance = client->global->instance;
+	od_system_t *system = client->global->system;
+	od_backlog_t *backlog = &system->backlog;
+	machine_msg_t *msg;
+	msg = kiwi_be_write_row_descriptionf(stream,
+	                                     "ssllllll",
+	                                     "listen",
+	                                     "type",
+	                                     "count",
+	                                     "p50",
+	                                     "p99",
+	                                     "max",
+	                                     "overflows",
+	                                     "drops");
+	if (msg == NULL)
+		return -1;
 
-	int *used_servers = argv[0];
-	(*used_servers) += route->server_pool.count_active;
-	(*used_servers) += route->server_pool.count_idle;
+	/* accept queue depth of each tcp listen, overflows are samples
+	 * taken with a full queue */
+	int rc = 0;
+	pthread_mutex_lock(&backlog->lock);
+	od_list_t *i;
+	od_list_foreach(&backlog->listens, i) {
+		od_backlog_listen_t *listen;
+		listen = od_container_of(i, od_backlog_listen_t, link);
+		char name[96];
+		od_snprintf(name, sizeof(name), "%s:%d", listen->host, listen->port);
+		od_hgram_freeze(listen->hgram, NULL, 0);
+		rc = od_console_show_accept_add(stream, name, "depth",
+		                                listen->samples,
+		                                od_hgram_quantile(listen->hgram, 0.5),
+		                                od_hgram_quantile(listen->hgram, 0.99),
+		                                listen->depth_max,
+		                                listen->full, 0);
+		if (rc == -1)
+			break;
+	}
+	uint64_t overflows = backlog->overflows;
+	uint64_t drops = backlog->drops;
+	pthread_mutex_unlock(&backlog->lock);
+	if (rc == -1)
+		return -1;
+
+	/* latencies in microseconds, kernel counters of the host */
+	if (instance->config.accept_stats_interval > 0) {
+		od_hgram_frozen_t *accept;
+		od_hgram_frozen_t *login;
+		rc = od_backlog_merge(client->global, &accept, &login);
+		if (rc == -1)
+			return -1;
+		rc = od_console_show_accept_add(stream, "*", "accept_us",
+		                                accept->total,
+		                                od_hgram_quantile(accept, 0.5),
+		                                od_hgram_quantile(accept, 0.99),
+		                                od_hgram_quantile(accept, 1.0),
+		                                overflows, drops);
+		if (rc == 0)
+			rc = od_console_show_accept_add(stream, "*", "login_us",
+			                                login->total,
+			                                od_hgram_quantile(login, 0.5),
+			                                od_hgram_quantile(login, 0.99),
+			                                od_hgram_quantile(login, 1.0),
+			                                0, 0);
+		od_hgram_free(accept);
+		od_hgram_free(login);
+		if (rc == -1)
+			return -1;
+	}
+
+	msg = kiwi_be_write_complete(stream, "SHOW", 5);
+	if (msg == NULL)
+		return -1;
 
-	od_route_unlock(route);
 	return 0;
 }
 
 static inline int
-od_console_show_lists(od_client_t *client, machine_msg_t *stream)
+od_console_show_stacks(od_client_t *client, machine_msg_t *stream)
 {
-	od_router_t *router = client->global->router;
-
-	/* Gather router information.
-
-	   router_used_servers can be inconsistent here, since it depends on
-	   separate route locks.
-	*/
-	od_router_lock(router);
+	od_instance_t *instance = client->global->instance;
+	machine_msg_t *msg;
+	msg = kiwi_be_write_row_descriptionf(stream,
+	                                     "sllll",
+	                                     "coroutine",
+	                                     "count",
+	                                     "avg_bytes",
+	                                     "max_bytes",
+	                                     "stack_bytes");
+	if (msg == NULL)
+		return -1;
 
-	int router_used_servers = 0;
-	int router_pools        = router->route_pool.count;
-	int router_clients      = od_atomic_u32_of(&router->clients);
+	/* high-water marks of finished coroutines since start */
+	machine_stack_stat_t stats[64];
+	int count;
+	count = machine_stat_stack(stats, 64);
+	uint64_t stack_size = (uint64_t)instance->config.coroutine_stack_size *
+	                      sysconf(_SC_PAGESIZE);
+	int i;
+	for (i = 0; i < count; i++) {
+		machine_stack_stat_t *stat = &stats[i];
+		int offset;
+		msg = kiwi_be_write_data_row(stream, &offset);
+		if (msg == NULL)
+			return -1;
+		/* coroutine */
+		char name[128];
+		od_stall_function(stat->function, name, sizeof(name));
+		int rc;
+		rc = kiwi_be_write_data_row_add(stream, offset, name, strlen(name));
+		if (rc == -1)
+			return -1;
+		/* count */
+		rc = kiwi_be_write_data_row_add_u64(stream, offset, stat->count);
+		if (rc == -1)
+			return -1;
+		/* avg_bytes */
+		uint64_t avg = 0;
+		if (stat->count > 0)
+			avg = stat->used_sum / stat->count;
+		rc = kiwi_be_write_data_row_add_u64(stream, offset, avg);
+		if (rc == -1)
+			return -1;
+		/* max_bytes */
+		rc = kiwi_be_write_data_row_add_u64(stream, offset, stat->used_max);
+		if (rc == -1)
+			return -1;
+		/* stack_bytes */
+		rc = kiwi_be_write_data_row_add_u64(stream, offset, stack_size);
+		if (rc == -1)
+			return -1;
+	}
 
-	void *argv[] = { &router_used_servers };
-	od_route_pool_foreach(&router->route_pool, od_console_show_lists_cb, argv);
+	msg = kiwi_be_write_complete(stream, "SHOW", 5);
+	if (msg == NULL)
+		return -1;
 
-	od_router_unlock(router);
+	return 0;
+}
 
+static inline int
+od_console_show_fingerprints_add(machine_msg_t *stream,
+                                 od_fingerprint_t *fingerprint)
+{
+	int offset;
 	machine_msg_t *msg;
-	msg = kiwi_be_write_row_descriptionf(stream, "sd", "list", "items");
+	msg = kiwi_be_write_data_row(stream, &offset);
 	if (msg == NULL)
 		return -1;
+	/* fingerprint */
+	char data[32];
+	int  data_len;
+	data_len = od_snprintf(data, sizeof(data), "%016" PRIx64,
+	                       fingerprint->hash);
 	int rc;
-	/* databases */
-	rc = od_console_show_lists_add(stream, "databases", 0);
+	rc = kiwi_be_write_data_row_add(stream, offset, data, data_len);
 	if (rc == -1)
 		return -1;
-	/* users */
-	rc = od_console_show_lists_add(stream, "users", 0);
+	/* query */
+	rc = kiwi_be_write_data_row_add(stream, offset, fingerprint->text,
+	                                fingerprint->text_len);
 	if (rc == -1)
 		return -1;
-	/* pools */
-	rc = od_console_show_lists_add(stream, "pools", router_pools);
+	/* calls */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, fingerprint->count);
 	if (rc == -1)
 		return -1;
-	/* free_clients */
-	rc = od_console_show_lists_add(stream, "free_clients", 0);
+	/* total_time */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, fingerprint->time);
 	if (rc == -1)
 		return -1;
-	/* used_clients */
-	rc = od_console_show_lists_add(stream, "used_clients", router_clients);
+	/* avg_time */
+	uint64_t avg = 0;
+	if (fingerprint->count > 0)
+		avg = fingerprint->time / fingerprint->count;
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, avg);
 	if (rc == -1)
 		return -1;
-	/* login_clients */
-	rc = od_console_show_lists_add(stream, "login_clients", 0);
-	if (rc == -1)
+	/* p50, p95, p99 */
+	double quantiles[] = { 0.5, 0.95, 0.99 };
+	size_t i;
+	for (i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+		rc = kiwi_be_write_data_row_add_u64(stream, offset,
+		                                    od_hgram_quantile(fingerprint->hgram,
+		                                                      quantiles[i]));
+		if (rc == -1)
+			return -1;
+	}
+	return 0;
+}
+
+static inline int
+od_console_show_fingerprints(od_client_t *client, machine_msg_t *stream)
+{
+	od_instance_t *instance = client->global->instance;
+	od_worker_pool_t *worker_pool = client->global->worker_pool;
+
+	machine_msg_t *msg;
+	msg = kiwi_be_write_row_descriptionf(stream,
+	                                     "ssllllll",
+	                                     "fingerprint",
+	                                     "query",
+	                                     "calls",
+	                                     "total_time",
+	                                     "avg_time",
+	                                     "p50_time",
+	                                     "p95_time",
+	                                     "p99_time");
+	if (msg == NULL)
 		return -1;
-	/* free_servers */
-	rc = od_console_show_lists_add(stream, "free_servers", 0);
-	if (rc == -1)
+
+	if (instance->config.query_fingerprint) {
+		od_fingerprints_t fingerprints;
+		od_fingerprints_init(&fingerprints);
+		int rc;
+		rc = od_worker_pool_fingerprints(worker_pool, &fingerprints,
+		                                 instance->config.query_fingerprint_max);
+		int i;
+		for (i = 0; rc == 0 && i < fingerprints.count; i++)
+			rc = od_console_show_fingerprints_add(stream,
+			                                      &fingerprints.entries[i]);
+		od_fingerprints_free(&fingerprints);
+		if (rc == -1)
+			return -1;
+	}
+
+	msg = kiwi_be_write_complete(stream, "SHOW", 5);
+	if (msg == NULL)
 		return -1;
-	/* used_servers */
-	rc = od_console_show_lists_add(stream, "used_servers", router_used_servers);
+
+	return 0;
+}
+
+static inline int
+od_console_show_top_add(machine_msg_t *stream, od_top_type_t type,
+                        od_top_weight_t weight, od_top_entry_t *entry)
+{
+	int offset;
+	machine_msg_t *msg;
+	msg = kiwi_be_write_data_row(stream, &offset);
+	if (msg == NULL)
+		return -1;
+	/* type */
+	char *name = od_top_type_name(type);
+	int rc;
+	rc = kiwi_be_write_data_row_add(stream, offset, name, strlen(name));
 	if (rc == -1)
 		return -1;
-	/* dns_names */
-	rc = od_console_show_lists_add(stream, "dns_names", 0);
+	/* by */
+	name = od_top_weight_name(weight);
+	rc = kiwi_be_write_data_row_add(stream, offset, name, strlen(name));
 	if (rc == -1)
 		return -1;
-	/* dns_zones */
-	rc = od_console_show_lists_add(stream, "dns_zones", 0);
+	/* key */
+	rc = kiwi_be_write_data_row_add(stream, offset, entry->text,
+	                                entry->text_len);
 	if (rc == -1)
 		return -1;
-	/* dns_queries */
-	rc = od_console_show_lists_add(stream, "dns_queries", 0);
+	/* value */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, entry->value);
 	if (rc == -1)
 		return -1;
-	/* dns_pending */
-	rc = od_console_show_lists_add(stream, "dns_pending", 0);
+	/* error */
+	rc = kiwi_be_write_data_row_add_u64(stream, offset, entry->error);
 	if (rc == -1)
 		return -1;
+	return 0;
+}
+
+static inline int
+od_console_show_top(od_client_t *client, machine_msg_t *stream)
+{
+	od_instance_t *instance = client->global->instance;
+	od_worker_pool_t *worker_pool = client->global->worker_pool;
+
+	machine_msg_t *msg;
+	msg = kiwi_be_write_row_descriptionf(stream,
+	                                     "sssll",
+	                                     "type",
+	                                     "by",
+	                                     "key",
+	                                     "value",
+	                                     "error");
+	if (msg == NULL)
+		return -1;
+
+	int size = instance->config.top_size;
+	if (size > 0) {
+		od_top_t top;
+		od_top_init(&top);
+		int rc;
+		rc = od_worker_pool_top(worker_pool, &top, size);
+		int i, j, k;
+		for (i = 0; rc == 0 && i < OD_TOP_MAX; i++) {
+			for (j = 0; rc == 0 && j < OD_TOP_WEIGHT_MAX; j++) {
+				od_top_summary_t *summary = &top.summary[i][j];
+				for (k = 0; rc == 0 && k < summary->count && k < size; k++)
+					rc = od_console_show_top_add(stream, i, j,
+					                             &summary->entries[k]);
+			}
+		}
+		od_top_free(&top);
+		if (rc == -1)
+			return -1;
+	}
+
 	msg = kiwi_be_write_complete(stream, "SHOW", 5);
 	if (msg == NULL)
 		return -1;
+
 	return 0;
 }
 
 static inline int
-od_console_show(od_client_t *client, machine_msg_t *stream, od_parser_t *parser)
+od_console_show(od_client_t *client, machine_msg_t **stream, od_parser_t *parser)
 {
 	od_token_t token;
 	int rc;
@@ -912,17 +2384,43 @@ od_console_show(od_client_t *client, machine_msg_t *stream, od_parser_t *parser)
 		return -1;
 	switch (keyword->id) {
 	case OD_LSTATS:
-		return od_console_show_stats(client, stream);
+		return od_console_show_stats(client, *stream);
 	case OD_LPOOLS:
-		return od_console_show_pools(client, stream);
+		return od_console_show_pools(client, *stream);
 	case OD_LDATABASES:
-		return od_console_show_databases(client, stream);
+		return od_console_show_databases(client, *stream);
 	case OD_LSERVERS:
-		return od_console_show_servers(client, stream);
+		return od_console_show_servers(client, stream, parser);
 	case OD_LCLIENTS:
-		return od_console_show_clients(client, stream);
+		return od_console_show_clients(client, stream, parser);
 	case OD_LLISTS:
-		return od_console_show_lists(client, stream);
+		return od_console_show_lists(client, *stream);
+	case OD_LAUTH_CACHE:
+		return od_console_show_auth_cache(client, *stream);
+	case OD_LWORKERS:
+		return od_console_show_workers(client, *stream);
+	case OD_LQUERY_CACHE:
+		return od_console_show_query_cache(client, *stream);
+	case OD_LMEMORY:
+		return od_console_show_memory(client, *stream);
+	case OD_LFINGERPRINTS:
+		return od_console_show_fingerprints(client, *stream);
+	case OD_LTOP:
+		return od_console_show_top(client, *stream);
+	case OD_LRATES:
+		return od_console_show_rates(client, *stream);
+	case OD_LFLEET:
+		return od_console_show_fleet(client, *stream);
+	case OD_LIO:
+		return od_console_show_io(client, *stream);
+	case OD_LLOCKS:
+		return od_console_show_locks(client, *stream);
+	case OD_LMIRROR:
+		return od_console_show_mirror(client, *stream);
+	case OD_LACCEPT:
+		return od_console_show_accept(client, *stream);
+	case OD_LSTACKS:
+		return od_console_show_stacks(client, *stream);
 	}
 	return -1;
 }
@@ -945,6 +2443,134 @@ od_console_kill_client(od_client_t *client, machine_msg_t *stream, od_parser_t *
 	return 0;
 }
 
+static inline int
+od_console_reset(od_client_t *client, machine_msg_t *stream, od_parser_t *parser)
+{
+	od_router_t *router = client->global->router;
+	od_token_t token;
+	int rc;
+	rc = od_parser_next(parser, &token);
+	if (rc != OD_PARSER_KEYWORD)
+		return -1;
+	od_keyword_t *keyword;
+	keyword = od_keyword_match(od_console_keywords, &token);
+	if (keyword == NULL || keyword->id != OD_LQUERY_CACHE)
+		return -1;
+
+	/* drop cached replies of all rules */
+	od_router_lock_read(router, OD_LOCK_CONSOLE);
+	od_list_t *i;
+	od_list_foreach(&router->rules.rules, i) {
+		od_rule_t *rule;
+		rule = od_container_of(i, od_rule_t, link);
+		if (rule->query_cache)
+			od_query_cache_reset(&rule->query_cache_replies);
+	}
+	od_router_unlock(router);
+
+	machine_msg_t *msg;
+	msg = kiwi_be_write_complete(stream, "RESET", 6);
+	if (msg == NULL)
+		return -1;
+	return 0;
+}
+
+static inline int
+od_console_reload(od_client_t *client, machine_msg_t *stream)
+{
+	od_instance_t *instance = client->global->instance;
+	od_log(&instance->logger, "console", client, NULL,
+	       "reload requested");
+
+	/* config is imported by the housekeeping signal handler, as on SIGHUP */
+	int rc;
+	rc = kill(getpid(), SIGHUP);
+	if (rc == -1)
+		return -1;
+
+	machine_msg_t *msg;
+	msg = kiwi_be_write_complete(stream, "RELOAD", 7);
+	if (msg == NULL)
+		return -1;
+	return 0;
+}
+
+static inline int
+od_console_database(od_parser_t *parser, char *database, int size)
+{
+	/* optional database name, empty if not set */
+	database[0] = 0;
+	od_token_t token;
+	int rc;
+	rc = od_parser_next(parser, &token);
+	if (rc == OD_PARSER_EOF)
+		return 0;
+	if (rc == OD_PARSER_SYMBOL && token.value.num == ';')
+		return 0;
+	if (rc != OD_PARSER_KEYWORD && rc != OD_PARSER_STRING)
+		return -1;
+	if (token.value.string.size >= size)
+		return -1;
+	memcpy(database, token.value.string.pointer, token.value.string.size);
+	database[token.value.string.size] = 0;
+	return 0;
+}
+
+static inline int
+od_console_pause(od_client_t *client, machine_msg_t *stream, od_parser_t *parser)
+{
+	od_instance_t *instance = client->global->instance;
+	od_router_t *router = client->global->router;
+	char database[64];
+	int rc;
+	rc = od_console_database(parser, database, sizeof(database));
+	if (rc == -1)
+		return -1;
+	od_log(&instance->logger, "console", client, NULL,
+	       "pause %s requested", *database ? database : "all databases");
+
+	rc = od_router_pause(router, *database ? database : NULL);
+	if (rc == -1)
+		return -1;
+
+	/* wait for active transactions to finish and idle servers
+	 * to be closed */
+	while (od_router_pause_servers(router) > 0)
+		machine_sleep(100);
+
+	od_log(&instance->logger, "console", client, NULL,
+	       "pause %s done", *database ? database : "all databases");
+
+	machine_msg_t *msg;
+	msg = kiwi_be_write_complete(stream, "PAUSE", 6);
+	if (msg == NULL)
+		return -1;
+	return 0;
+}
+
+static inline int
+od_console_resume(od_client_t *client, machine_msg_t *stream, od_parser_t *parser)
+{
+	od_instance_t *instance = client->global->instance;
+	od_router_t *router = client->global->router;
+	char database[64];
+	int rc;
+	rc = od_console_database(parser, database, sizeof(database));
+	if (rc == -1)
+		return -1;
+
+	rc = od_router_resume(router, *database ? database : NULL);
+	od_log(&instance->logger, "console", client, NULL,
+	       "resume %s (%d pauses removed)",
+	       *database ? database : "all databases", rc);
+
+	machine_msg_t *msg;
+	msg = kiwi_be_write_complete(stream, "RESUME", 7);
+	if (msg == NULL)
+		return -1;
+	return 0;
+}
+
 static inline int
 od_console_set(od_client_t *client, machine_msg_t *stream)
 {
@@ -958,7 +2584,7 @@ od_console_set(od_client_t *client, machine_msg_t *stream)
 }
 
 int
-od_console_query(od_client_t *client, machine_msg_t *stream,
+od_console_query(od_client_t *client, machine_msg_t **stream,
                  char    *query_data,
                  uint32_t query_data_size)
 {
@@ -972,7 +2598,7 @@ od_console_query(od_client_t *client, machine_msg_t *stream,
 	if (rc == -1) {
 		od_error(&instance->logger, "console", client, NULL,
 		         "bad console command");
-		msg = od_frontend_errorf(client, stream, KIWI_SYNTAX_ERROR,
+		msg = od_frontend_errorf(client, *stream, KIWI_SYNTAX_ERROR,
 		                         "bad console command");
 		if (msg == NULL)
 			return -1;
@@ -984,6 +2610,10 @@ od_console_query(od_client_t *client, machine_msg_t *stream,
 		od_debug(&instance->logger, "console", client, NULL,
 		         "%.*s", query_len, query);
 
+	/* query text is sent null-terminated */
+	if (query_len > 0 && query[query_len - 1] == '\0')
+		query_len--;
+
 	od_parser_t parser;
 	od_parser_init(&parser, query, query_len);
 
@@ -1007,12 +2637,32 @@ od_console_query(od_client_t *client, machine_msg_t *stream,
 			goto bad_query;
 		break;
 	case OD_LKILL_CLIENT:
-		rc = od_console_kill_client(client, stream, &parser);
+		rc = od_console_kill_client(client, *stream, &parser);
 		if (rc == -1)
 			goto bad_query;
 		break;
 	case OD_LSET:
-		rc = od_console_set(client, stream);
+		rc = od_console_set(client, *stream);
+		if (rc == -1)
+			goto bad_query;
+		break;
+	case OD_LRESET:
+		rc = od_console_reset(client, *stream, &parser);
+		if (rc == -1)
+			goto bad_query;
+		break;
+	case OD_LRELOAD:
+		rc = od_console_reload(client, *stream);
+		if (rc == -1)
+			goto bad_query;
+		break;
+	case OD_LPAUSE:
+		rc = od_console_pause(client, *stream, &parser);
+		if (rc == -1)
+			goto bad_query;
+		break;
+	case OD_LRESUME:
+		rc = od_console_resume(client, *stream, &parser);
 		if (rc == -1)
 			goto bad_query;
 		break;
@@ -1023,10 +2673,13 @@ od_console_query(od_client_t *client, machine_msg_t *stream,
 	return 0;
 
 bad_query:
+	if (*stream == NULL)
+		return -1;
+
 	od_error(&instance->logger, "console", client, NULL,
 	         "console command error: %.*s", query_len, query);
 
-	msg = od_frontend_errorf(client, stream, KIWI_SYNTAX_ERROR,
+	msg = od_frontend_errorf(client, *stream, KIWI_SYNTAX_ERROR,
 	                         "console command error: %.*s",
 	                         query_len, query);
 	if (msg == NULL)
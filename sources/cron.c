@@ -13,6 +13,7 @@
 #include <ctype.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <errno.h>
 
 #include <machinarium.h>
 #include <kiwi.h>
@@ -23,7 +24,16 @@ od_cron_stat_cb(od_route_t *route, od_stat_t *current, od_stat_t *avg,
                 void **argv)
 {
 	od_instance_t *instance = argv[0];
-	(void)current;
+	od_metrics_t *metrics = argv[1];
+	int *log = argv[2];
+	od_stats_shm_t *stats_shm = argv[3];
+
+	if (metrics)
+		od_metrics_route(metrics, route, current, avg);
+	if (stats_shm)
+		od_stats_shm_route(stats_shm, route, current);
+	if (! *log)
+		return 0;
 
 	struct {
 		int      database_len;
@@ -34,6 +44,12 @@ od_cron_stat_cb(od_route_t *route, od_stat_t *current, od_stat_t *avg,
 		int      client_pool_total;
 		int      server_pool_active;
 		int      server_pool_idle;
+		int      count_waiters;
+		int      count_waiters_peak;
+		uint64_t max_wait;
+		uint64_t avg_wait_time;
+		uint64_t count_wait_timeout;
+		uint64_t count_wait_routing;
 		uint64_t avg_count_tx;
 		uint64_t avg_tx_time;
 		uint64_t avg_count_query;
@@ -42,7 +58,7 @@ od_cron_stat_cb(od_route_t *route, od_stat_t *current, od_stat_t *avg,
 		uint64_t avg_recv_server;
 	} info;
 
-	od_route_lock(route);
+	od_route_lock(route, OD_LOCK_STAT);
 
 	info.database_len = route->id.database_len - 1;
 	if (info.database_len > (int)sizeof(info.database))
@@ -59,6 +75,12 @@ od_cron_stat_cb(od_route_t *route, od_stat_t *current, od_stat_t *avg,
 	info.client_pool_total  = od_client_pool_total(&route->client_pool);
 	info.server_pool_active = route->server_pool.count_active;
 	info.server_pool_idle   = route->server_pool.count_idle;
+	info.count_waiters      = route->count_waiters;
+	info.count_waiters_peak = route->count_waiters_peak;
+	info.max_wait           = od_route_max_wait(route);
+	info.avg_wait_time      = avg->wait_time;
+	info.count_wait_timeout = avg->count_wait_timeout;
+	info.count_wait_routing = avg->count_wait_routing;
 
 	info.avg_count_query    = avg->count_query;
 	info.avg_count_tx       = avg->count_tx;
@@ -73,6 +95,8 @@ od_cron_stat_cb(od_route_t *route, od_stat_t *current, od_stat_t *avg,
 	       "[%.*s.%.*s%s] %d clients, "
 	       "%d active servers, "
 	       "%d idle servers, "
+	       "%d waiting clients (peak %d, max %" PRIu64 " usec, avg %" PRIu64 " usec, "
+	       "%" PRIu64 " timeouts, %" PRIu64 " routing waits) "
 	       "%" PRIu64 " transactions/sec (%" PRIu64 " usec) "
 	       "%" PRIu64 " queries/sec (%"  PRIu64 " usec) "
 	       "%" PRIu64 " in bytes/sec, "
@@ -85,6 +109,12 @@ od_cron_stat_cb(od_route_t *route, od_stat_t *current, od_stat_t *avg,
 	       info.client_pool_total,
 	       info.server_pool_active,
 	       info.server_pool_idle,
+	       info.count_waiters,
+	       info.count_waiters_peak,
+	       info.max_wait,
+	       info.avg_wait_time,
+	       info.count_wait_timeout,
+	       info.count_wait_routing,
 	       info.avg_count_tx,
 	       info.avg_tx_time,
 	       info.avg_count_query,
@@ -92,32 +122,65 @@ od_cron_stat_cb(od_route_t *route, od_stat_t *current, od_stat_t *avg,
 	       info.avg_recv_client,
 	       info.avg_recv_server);
 
+	/* time of queries by type, split into the wait for a server,
+	 * the server and the client reading replies */
+	for (int i = 0; i < OD_STAT_QUERY_MAX; i++) {
+		od_stat_query_t *query = &avg->type[i];
+		if (query->count == 0 && query->time[OD_STAT_PHASE_SERVER] == 0)
+			continue;
+		od_log(&instance->logger, "stats", NULL, NULL,
+		       "%s queries %" PRIu64 "/sec, wait %" PRIu64 " usec, "
+		       "server %" PRIu64 " usec, client %" PRIu64 " usec",
+		       od_stat_query_type_name(i),
+		       query->count,
+		       query->time[OD_STAT_PHASE_WAIT],
+		       query->time[OD_STAT_PHASE_SERVER],
+		       query->time[OD_STAT_PHASE_CLIENT]);
+	}
+
+	/* worker time used by clients of the route, in usec per second */
+	if (instance->config.coroutine_accounting &&
+	    (avg->cpu_time > 0 || avg->count_switch > 0)) {
+		od_log(&instance->logger, "stats", NULL, NULL,
+		       "cpu %" PRIu64 " usec/sec, cpu wait %" PRIu64 " usec/sec, "
+		       "%" PRIu64 " switches/sec",
+		       avg->cpu_time,
+		       avg->cpu_wait,
+		       avg->count_switch);
+	}
+
 	for (int i = 0; i < route->rule->quantiles_count; i++) {
 		double quantile = route->rule->quantiles[i];
 		uint64_t query_quantile = 0;
 		uint64_t transaction_quantile = 0;
+		uint64_t wait_quantile = 0;
 
 		if (avg->query_hgram)
 			query_quantile = od_hgram_quantile(avg->query_hgram, quantile);
 		if (avg->transaction_hgram)
 			transaction_quantile = od_hgram_quantile(avg->transaction_hgram, quantile);
+		if (avg->wait_hgram)
+			wait_quantile = od_hgram_quantile(avg->wait_hgram, quantile);
 
 		od_log(&instance->logger, "stats", NULL, NULL,
-			"quantile %lf for queries %" PRIu64 " usec, for transactions %" PRIu64" usec",
-				quantile, query_quantile, transaction_quantile);
+			"quantile %lf for queries %" PRIu64 " usec, for transactions %" PRIu64" usec, "
+			"for waits %" PRIu64 " usec",
+				quantile, query_quantile, transaction_quantile, wait_quantile);
 	}
 
 	return 0;
 }
 
 static inline void
-od_cron_stat(od_cron_t *cron)
+od_cron_stat(od_cron_t *cron, int update)
 {
 	od_router_t *router = cron->global->router;
 	od_instance_t *instance = cron->global->instance;
 	od_worker_pool_t *worker_pool = cron->global->worker_pool;
+	od_metrics_t *metrics = cron->global->metrics;
 
-	if (instance->config.log_stats)
+	int log = update && instance->config.log_stats;
+	if (log)
 	{
 		/* system worker stats */
 		uint64_t count_coroutine = 0;
@@ -126,6 +189,8 @@ od_cron_stat(od_cron_t *cron)
 		uint64_t msg_cache_count = 0;
 		uint64_t msg_cache_gc_count = 0;
 		uint64_t msg_cache_size = 0;
+		uint64_t msg_remote_count = 0;
+		uint64_t msg_returned_count = 0;
 		od_atomic_u64_t startup_errors = od_atomic_u64_of(&cron->startup_errors);
 		cron->startup_errors = 0;
 		machine_stat(&count_coroutine,
@@ -133,49 +198,134 @@ od_cron_stat(od_cron_t *cron)
 		             &msg_allocated,
 		             &msg_cache_count,
 		             &msg_cache_gc_count,
-		             &msg_cache_size);
+		             &msg_cache_size,
+		             &msg_remote_count,
+		             &msg_returned_count);
 		od_log(&instance->logger, "stats", NULL, NULL,
-		       "system worker: msg (%" PRIu64 " allocated, %" PRIu64 " cached, %" PRIu64 " freed, %" PRIu64 " cache_size), "
+		       "system worker: msg (%" PRIu64 " allocated, %" PRIu64 " cached, %" PRIu64 " freed, %" PRIu64 " cache_size, "
+		       "%" PRIu64 " remote freed, %" PRIu64 " returned), "
 		       "coroutines (%" PRIu64 " active, %"PRIu64 " cached) startup errors %" PRIu64,
 		       msg_allocated,
 		       msg_cache_count,
 		       msg_cache_gc_count,
 		       msg_cache_size,
+		       msg_remote_count,
+		       msg_returned_count,
 		       count_coroutine,
 		       count_coroutine_cache,
 			   startup_errors);
 
 		/* request stats per worker */
 		int i;
-		for (i = 0; i < worker_pool->count; i++) {
-			od_worker_t *worker = &worker_pool->pool[i];
+		for (i = 0; i < od_worker_pool_total(worker_pool); i++) {
+			od_worker_t *worker = od_worker_pool_get(worker_pool, i);
 			machine_msg_t *msg;
 			msg = machine_msg_create(0);
 			machine_msg_set_type(msg, OD_MSG_STAT);
 			machine_channel_write(worker->task_channel, msg);
 		}
 
+		uint64_t overload_rejects = od_atomic_u64_of(&cron->overload_rejects);
+		cron->overload_rejects = 0;
 		od_log(&instance->logger, "stats", NULL, NULL,
-		       "clients %d", od_atomic_u32_of(&router->clients));
+		       "clients %d, routing %d, login time %" PRIu64 " usec, overload rejects %" PRIu64
+		       ", relay memory %" PRIu64,
+		       od_atomic_u32_of(&router->clients),
+		       od_atomic_u32_of(&router->clients_routing),
+		       od_atomic_u64_of(&router->login_time),
+		       overload_rejects,
+		       od_atomic_u64_of(&router->relay_memory));
 	}
 
+	/* memory of route connections, summed by worker */
+	if (update) {
+		int workers_count = od_worker_pool_total(worker_pool);
+		uint64_t *workers = calloc(workers_count, sizeof(uint64_t));
+		if (workers) {
+			od_route_pool_memory(&router->route_pool, workers, workers_count);
+			int i;
+			for (i = 0; i < workers_count; i++) {
+				od_worker_t *worker = od_worker_pool_get(worker_pool, i);
+				od_atomic_u64_set(&worker->memory, workers[i]);
+			}
+			free(workers);
+		}
+	}
+
+	/* render metrics snapshot along with the routes pass */
+	if (od_metrics_enabled(metrics)) {
+		if (od_metrics_begin(metrics) == -1)
+			metrics = NULL;
+	} else {
+		metrics = NULL;
+	}
+	od_stats_shm_t *stats_shm = NULL;
+	if (update && od_stats_shm_enabled(&cron->stats_shm)) {
+		stats_shm = &cron->stats_shm;
+		od_stats_shm_begin(stats_shm);
+	}
 	/* update stats per route and print info */
 	od_route_pool_stat_cb_t stat_cb;
 	stat_cb = od_cron_stat_cb;
-	if (! instance->config.log_stats)
+	if (! log && metrics == NULL && stats_shm == NULL)
 		stat_cb = NULL;
-	void *argv[] = { instance };
-	od_router_stat(router, cron->stat_time_us, 1, stat_cb, argv);
+	void *argv[] = { instance, metrics, &log, stats_shm };
+	od_router_stat(router, cron->stat_time_us, update, stat_cb, argv);
+
+	if (metrics)
+		od_metrics_end(metrics);
+	if (stats_shm)
+		od_stats_shm_end(stats_shm, cron->global);
 
 	/* update current stat time mark */
-	cron->stat_time_us = machine_time_us();
+	if (update)
+		cron->stat_time_us = machine_time_us();
+}
+
+static inline void
+od_cron_close(od_cron_t *cron, od_list_t *expire_list)
+{
+	od_instance_t *instance = cron->global->instance;
+
+	od_list_t *i, *n;
+	od_list_foreach_safe(expire_list, i, n) {
+		od_server_t *server;
+		server = od_container_of(i, od_server_t, link);
+		server->route = NULL;
+
+		/* server io is kept attached to the worker loop, which
+		 * is the only one allowed to close it */
+		if (server->io_worker != -1) {
+			od_worker_pool_t *worker_pool = cron->global->worker_pool;
+			od_worker_t *worker = od_worker_pool_get(worker_pool, server->io_worker);
+			machine_msg_t *msg;
+			msg = machine_msg_create(sizeof(od_server_t*));
+			if (msg == NULL) {
+				od_error(&instance->logger, "expire", NULL, server,
+				         "failed to pass server to worker[%d]",
+				         server->io_worker);
+				continue;
+			}
+			machine_msg_set_type(msg, OD_MSG_SERVER_CLOSE);
+			memcpy(machine_msg_data(msg), &server, sizeof(od_server_t*));
+			machine_channel_write(worker->task_channel, msg);
+			continue;
+		}
+
+		od_debug(&instance->logger, "expire", NULL, server,
+		         "closing idle server connection (%d secs)",
+		         od_server_idle_time(server, machine_time_us()));
+		if (! od_config_is_multi_workers(&instance->config))
+			od_io_attach(&server->io);
+		od_backend_close_connection(server);
+		od_backend_close(server);
+	}
 }
 
 static inline void
 od_cron_expire(od_cron_t *cron)
 {
 	od_router_t *router = cron->global->router;
-	od_instance_t *instance = cron->global->instance;
 
 	/* collect and close expired idle servers */
 	od_list_t expire_list;
@@ -184,44 +334,111 @@ od_cron_expire(od_cron_t *cron)
 	int rc;
 	rc = od_router_expire(router, &expire_list);
 	if (rc > 0)
-	{
-		od_list_t *i, *n;
-		od_list_foreach_safe(&expire_list, i, n) {
-			od_server_t *server;
-			server = od_container_of(i, od_server_t, link);
-			od_debug(&instance->logger, "expire", NULL, server,
-			         "closing idle server connection (%d secs)",
-			         server->idle_time);
-			server->route = NULL;
-			if (! od_config_is_multi_workers(&instance->config))
-				od_io_attach(&server->io);
-			od_backend_close_connection(server);
-			od_backend_close(server);
-		}
-	}
+		od_cron_close(cron, &expire_list);
 
 	/* cleanup unused dynamic or obsolete routes */
 	od_router_gc(router);
 }
 
-static void
+static inline void
+od_cron_prewarm(od_cron_t *cron)
+{
+	od_router_t *router = cron->global->router;
+	od_instance_t *instance = cron->global->instance;
+	od_worker_pool_t *worker_pool = cron->global->worker_pool;
+
+	/* keep pool_min_size servers connected, connections are
+	 * established by workers in background */
+	od_router_prewarm_routes(router, &instance->config);
+
+	od_server_t *servers[64];
+	int count;
+	count = od_router_prewarm(router, cron->global, servers,
+	                          sizeof(servers) / sizeof(servers[0]));
+	int i;
+	for (i = 0; i < count; i++) {
+		od_server_t *server = servers[i];
+		od_worker_t *worker;
+		worker = od_worker_pool_route(worker_pool, server->route);
+		server->pool_worker = worker->id;
+		od_atomic_u32_inc(&router->servers_routing);
+		int rc;
+		rc = od_worker_pool_connect(worker_pool, server);
+		if (rc == -1) {
+			od_router_routing_done(router);
+			od_router_drop(router, server);
+		}
+	}
+}
+
+static inline void
+od_cron_check(od_cron_t *cron)
+{
+	od_router_t *router = cron->global->router;
+	od_worker_pool_t *worker_pool = cron->global->worker_pool;
+
+	/* validate servers idle for pool_check_idle seconds, the check
+	 * is done by the worker which owns the server io */
+	od_server_t *servers[64];
+	int count;
+	count = od_router_check(router, servers,
+	                        sizeof(servers) / sizeof(servers[0]));
+	int i;
+	for (i = 0; i < count; i++) {
+		od_server_t *server = servers[i];
+		int rc;
+		rc = od_worker_pool_check(worker_pool, server);
+		if (rc == -1) {
+			/* server io may be attached to a worker loop, put it
+			 * back unchecked */
+			od_route_t *route = server->route;
+			od_route_lock(route, OD_LOCK_OTHER);
+			od_server_pool_set(&route->server_pool, server, OD_SERVER_IDLE);
+			od_route_signal(route);
+			od_route_unlock(route);
+		}
+	}
+}
+
+void
 od_cron(void *arg)
 {
 	od_cron_t *cron = arg;
 	od_instance_t *instance = cron->global->instance;
 
+	machine_set_priority(MACHINE_PRIORITY_LOW);
 	cron->stat_time_us = machine_time_us();
 
 	int stats_tick = 0;
+	int tickets_tick = 0;
 	for (;;)
 	{
 		/* mark and sweep expired idle server connections */
 		od_cron_expire(cron);
 
+		/* open servers up to pool_min_size */
+		od_cron_prewarm(cron);
+
+		/* adapt pool_adaptive limits to server latency */
+		od_router_adapt(cron->global->router);
+
+		/* evict dead idle server connections */
+		od_cron_check(cron);
+
 		/* update statistics */
 		if (++stats_tick >= instance->config.stats_interval) {
-			od_cron_stat(cron);
+			od_cron_stat(cron, 1);
 			stats_tick = 0;
+		} else {
+			/* keep metrics up to date between stats updates */
+			od_cron_stat(cron, 0);
+		}
+
+		/* rotate tls session ticket keys */
+		if (instance->config.tls_ticket_rotate > 0 &&
+		    ++tickets_tick >= instance->config.tls_ticket_rotate) {
+			machine_tls_rotate_tickets();
+			tickets_tick = 0;
 		}
 
 		/* 1 second soft interval */
@@ -229,12 +446,33 @@ od_cron(void *arg)
 	}
 }
 
+void
+od_cron_failover(od_cron_t *cron)
+{
+	od_router_t *router = cron->global->router;
+
+	/* storage host role has changed: close idle servers of hosts
+	 * which are not suitable anymore and open replacements in
+	 * background without waiting for the next tick */
+	od_list_t expire_list;
+	od_list_init(&expire_list);
+
+	int rc;
+	rc = od_router_expire_hosts(router, &expire_list);
+	if (rc > 0)
+		od_cron_close(cron, &expire_list);
+
+	od_cron_prewarm(cron);
+}
+
 void
 od_cron_init(od_cron_t *cron)
 {
 	cron->stat_time_us = 0;
 	cron->global = NULL;
 	cron->startup_errors = 0;
+	cron->overload_rejects = 0;
+	od_stats_shm_init(&cron->stats_shm);
 }
 
 int
@@ -242,6 +480,19 @@ od_cron_start(od_cron_t *cron, od_global_t *global)
 {
 	cron->global = global;
 	od_instance_t *instance = global->instance;
+	if (instance->config.stats_shm) {
+		/* sized for every worker the pool can grow to */
+		int workers = instance->config.workers_max +
+		              instance->config.handshake_workers;
+		int rc;
+		rc = od_stats_shm_open(&cron->stats_shm, instance->config.stats_shm,
+		                       workers, instance->config.stats_shm_routes);
+		if (rc == -1) {
+			od_error(&instance->logger, "cron", NULL, NULL,
+			         "failed to create stats segment '%s': %s",
+			         instance->config.stats_shm, strerror(errno));
+		}
+	}
 	int64_t coroutine_id;
 	coroutine_id = machine_coroutine_create(od_cron, cron);
 	if (coroutine_id == -1) {
@@ -14,9 +14,13 @@ struct od_cron
 	uint64_t     stat_time_us;
 	od_global_t *global;
 	od_atomic_u64_t startup_errors;
+	od_atomic_u64_t overload_rejects;
+	od_stats_shm_t  stats_shm;
 };
 
 void od_cron_init(od_cron_t*);
 int  od_cron_start(od_cron_t*, od_global_t*);
+void od_cron(void*);
+void od_cron_failover(od_cron_t*);
 
 #endif /* ODYSSEY_CRON_H */
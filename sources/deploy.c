@@ -27,31 +27,48 @@ int od_deploy(od_client_t *client, char *context)
 	if (route->id.physical_rep || route->id.logical_rep)
 		return 0;
 
+	/* server is already configured for the same client
+	 * parameters */
+	if (server->deploy_hash == client->vars.hash)
+		return 0;
+
 	/* compare and set options which are differs from server */
 	int  query_count;
 	query_count = 0;
 
-	char query[512];
+	/* SET query is written in place of the message */
+	machine_msg_t *msg;
+	int offset;
+	msg = kiwi_write_begin(NULL, KIWI_FE_QUERY, &offset);
+	if (msg == NULL)
+		return -1;
+	char *query;
+	query = machine_msg_reserve(msg, OD_DEPLOY_QUERY_MAX);
+	if (query == NULL) {
+		machine_msg_free(msg);
+		return -1;
+	}
 	int  query_size;
 	query_size  = kiwi_vars_cas(&client->vars, &server->vars, query,
-	                            sizeof(query) - 1);
+	                            OD_DEPLOY_QUERY_MAX - 1);
 	if (query_size > 0)
 	{
 		query[query_size] = 0;
 		query_size++;
-		machine_msg_t *msg;
-		msg = kiwi_fe_write_query(NULL, query, query_size);
-		if (msg == NULL)
-			return -1;
+		od_debug(&instance->logger, context, client, server,
+		         "deploy: %s", query);
+		machine_msg_write(msg, NULL, query_size);
+		kiwi_write_end(msg, offset);
 		int rc;
 		rc = od_write(&server->io, msg);
 		if (rc == -1)
 			return -1;
 		query_count++;
-
-		od_debug(&instance->logger, context, client, server,
-		         "deploy: %s", query);
+		server->is_dirty |= OD_RESET_SET;
+	} else {
+		machine_msg_free(msg);
 	}
 
+	server->deploy_hash = client->vars.hash;
 	return query_count;
 }
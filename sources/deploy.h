@@ -7,6 +7,9 @@
  * Scalable PostgreSQL connection pooler.
 */
 
+/* longest SET query sent to configure a server */
+#define OD_DEPLOY_QUERY_MAX 2048
+
 int od_deploy(od_client_t*, char*);
 
 #endif /* ODYSSEY_DEPLOY_H */
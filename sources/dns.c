@@ -92,3 +92,195 @@ od_getsockname(machine_io_t *io, char *buf, int size, int add_addr, int add_port
 	}
 	return od_getsockaddrname((struct sockaddr*)&sa, buf, size, add_addr, add_port);
 }
+
+void
+od_dns_cache_init(od_dns_cache_t *cache)
+{
+	pthread_mutex_init(&cache->lock, NULL);
+	od_list_init(&cache->entries);
+}
+
+static inline od_dns_entry_t*
+od_dns_cache_find(od_dns_cache_t *cache, char *host, int port)
+{
+	od_list_t *i;
+	od_list_foreach(&cache->entries, i) {
+		od_dns_entry_t *entry;
+		entry = od_container_of(i, od_dns_entry_t, link);
+		if (entry->port == port && strcmp(entry->host, host) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+static inline int
+od_dns_cache_getaddrinfo(char *host, int port,
+                         struct sockaddr_storage *addrs)
+{
+	char port_str[16];
+	od_snprintf(port_str, sizeof(port_str), "%d", port);
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family   = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *ai = NULL;
+	int rc;
+	rc = machine_getaddrinfo(host, port_str, &hints, &ai, 0);
+	if (rc != 0)
+		return -1;
+	/* rotate only addresses of the preferred family, so dual-stack
+	 * hosts are connected the same way as without the cache */
+	int count = 0;
+	struct addrinfo *next;
+	for (next = ai; next && count < OD_DNS_ADDRS_MAX; next = next->ai_next) {
+		if (next->ai_family != ai->ai_family ||
+		    next->ai_addrlen > sizeof(struct sockaddr_storage))
+			continue;
+		memset(&addrs[count], 0, sizeof(struct sockaddr_storage));
+		memcpy(&addrs[count], next->ai_addr, next->ai_addrlen);
+		count++;
+	}
+	freeaddrinfo(ai);
+	if (count == 0)
+		return -1;
+	return count;
+}
+
+static inline void
+od_dns_cache_next(od_dns_entry_t *entry, struct sockaddr_storage *addr)
+{
+	/* rotate addresses of the host between connections */
+	*addr = entry->addrs[entry->addrs_next % entry->addrs_count];
+	entry->addrs_next++;
+	entry->time_used = machine_time_us();
+}
+
+int
+od_dns_cache_resolve(od_dns_cache_t *cache, char *host, int port,
+                     struct sockaddr_storage *addr)
+{
+	od_dns_entry_t *entry;
+	pthread_mutex_lock(&cache->lock);
+	entry = od_dns_cache_find(cache, host, port);
+	if (entry) {
+		od_dns_cache_next(entry, addr);
+		pthread_mutex_unlock(&cache->lock);
+		return 0;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	/* first connection to the host */
+	struct sockaddr_storage addrs[OD_DNS_ADDRS_MAX];
+	int count;
+	count = od_dns_cache_getaddrinfo(host, port, addrs);
+	if (count == -1)
+		return -1;
+
+	pthread_mutex_lock(&cache->lock);
+	entry = od_dns_cache_find(cache, host, port);
+	if (entry == NULL) {
+		entry = malloc(sizeof(od_dns_entry_t));
+		if (entry == NULL) {
+			pthread_mutex_unlock(&cache->lock);
+			*addr = addrs[0];
+			return 0;
+		}
+		entry->host = strdup(host);
+		if (entry->host == NULL) {
+			free(entry);
+			pthread_mutex_unlock(&cache->lock);
+			*addr = addrs[0];
+			return 0;
+		}
+		entry->port = port;
+		entry->addrs_next = 0;
+		od_list_init(&entry->link);
+		od_list_append(&cache->entries, &entry->link);
+	}
+	memcpy(entry->addrs, addrs, sizeof(struct sockaddr_storage) * count);
+	entry->addrs_count  = count;
+	entry->time_resolve = machine_time_us();
+	od_dns_cache_next(entry, addr);
+	pthread_mutex_unlock(&cache->lock);
+	return 0;
+}
+
+static inline od_dns_entry_t*
+od_dns_cache_expired(od_dns_cache_t *cache, uint64_t now, uint64_t ttl)
+{
+	od_dns_entry_t *expired = NULL;
+	od_list_t *i, *n;
+	pthread_mutex_lock(&cache->lock);
+	od_list_foreach_safe(&cache->entries, i, n) {
+		od_dns_entry_t *entry;
+		entry = od_container_of(i, od_dns_entry_t, link);
+		if (entry->time_used < now &&
+		    now - entry->time_used >= ttl * OD_DNS_IDLE_TTLS) {
+			od_list_unlink(&entry->link);
+			free(entry->host);
+			free(entry);
+			continue;
+		}
+		if (expired == NULL && entry->time_resolve < now &&
+		    now - entry->time_resolve >= ttl) {
+			/* retried after ttl on resolve error */
+			entry->time_resolve = now;
+			expired = entry;
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+	return expired;
+}
+
+static void
+od_dns_cache_refresh(void *arg)
+{
+	od_global_t *global = arg;
+	od_instance_t *instance = global->instance;
+	od_system_t *system = global->system;
+	od_dns_cache_t *cache = &system->dns;
+	machine_set_priority(MACHINE_PRIORITY_LOW);
+	for (;;) {
+		machine_sleep(1000);
+		uint64_t ttl = instance->config.dns_cache_ttl * 1000000ULL;
+		if (ttl == 0)
+			continue;
+
+		/* entries are freed only here, so host stays valid while
+		 * resolving without the lock */
+		od_dns_entry_t *entry;
+		uint64_t now = machine_time_us();
+		while ((entry = od_dns_cache_expired(cache, now, ttl))) {
+			struct sockaddr_storage addrs[OD_DNS_ADDRS_MAX];
+			int count;
+			count = od_dns_cache_getaddrinfo(entry->host, entry->port, addrs);
+			if (count == -1) {
+				od_error(&instance->logger, "dns", NULL, NULL,
+				         "failed to resolve %s:%d, using last known addresses",
+				         entry->host, entry->port);
+				continue;
+			}
+			pthread_mutex_lock(&cache->lock);
+			memcpy(entry->addrs, addrs, sizeof(struct sockaddr_storage) * count);
+			entry->addrs_count = count;
+			pthread_mutex_unlock(&cache->lock);
+			od_debug(&instance->logger, "dns", NULL, NULL,
+			         "%s:%d resolved to %d addresses",
+			         entry->host, entry->port, count);
+		}
+	}
+}
+
+int
+od_dns_cache_start(od_global_t *global)
+{
+	od_instance_t *instance = global->instance;
+	int64_t coroutine_id;
+	coroutine_id = machine_coroutine_create(od_dns_cache_refresh, global);
+	if (coroutine_id == -1) {
+		od_error(&instance->logger, "dns", NULL, NULL,
+		         "failed to start dns cache coroutine");
+		return -1;
+	}
+	return 0;
+}
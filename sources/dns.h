@@ -7,6 +7,41 @@
  * Scalable PostgreSQL connection pooler.
 */
 
+typedef struct od_dns_entry od_dns_entry_t;
+typedef struct od_dns_cache od_dns_cache_t;
+
+#define OD_DNS_ADDRS_MAX 8
+
+/* entries not used for the number of ttls are dropped */
+#define OD_DNS_IDLE_TTLS 10
+
+/* Resolved storage hosts, shared by all workers and protected
+ * by the mutex. Entries are refreshed and dropped only by the
+ * refresh coroutine of the system machine.
+*/
+
+struct od_dns_entry
+{
+	char                    *host;
+	int                      port;
+	struct sockaddr_storage  addrs[OD_DNS_ADDRS_MAX];
+	int                      addrs_count;
+	uint32_t                 addrs_next;
+	uint64_t                 time_resolve;
+	uint64_t                 time_used;
+	od_list_t                link;
+};
+
+struct od_dns_cache
+{
+	pthread_mutex_t lock;
+	od_list_t       entries;
+};
+
+void od_dns_cache_init(od_dns_cache_t*);
+int  od_dns_cache_resolve(od_dns_cache_t*, char*, int, struct sockaddr_storage*);
+int  od_dns_cache_start(od_global_t*);
+
 int od_getaddrname(struct addrinfo*, char*, int, int, int);
 int od_getpeername(machine_io_t*, char*, int, int, int);
 int od_getsockname(machine_io_t*, char*, int, int, int);
@@ -0,0 +1,208 @@
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+od_embed_t*
+od_embed_create(void)
+{
+	od_embed_t *embed = malloc(sizeof(od_embed_t));
+	if (embed == NULL)
+		return NULL;
+	memset(embed, 0, sizeof(od_embed_t));
+	embed->notify = machine_notify_create();
+	if (embed->notify == NULL) {
+		free(embed);
+		return NULL;
+	}
+	od_instance_init(&embed->instance);
+	embed->instance.embed = embed;
+	od_system_init(&embed->system);
+	od_router_init(&embed->router);
+	od_cron_init(&embed->cron);
+	od_worker_pool_init(&embed->worker_pool);
+	od_metrics_init(&embed->metrics);
+	od_global_init(&embed->global, &embed->instance, &embed->system,
+	               &embed->router, &embed->cron, &embed->worker_pool,
+	               &embed->metrics);
+
+	/* in-process clients get options of a plain unix socket listen */
+	od_config_listen_t *listen = &embed->listen;
+	listen->tls_mode = OD_CONFIG_TLS_DISABLE;
+	listen->client_login_timeout = 15000;
+	od_list_init(&listen->link);
+
+	pthread_mutex_init(&embed->lock, NULL);
+	embed->pending       = NULL;
+	embed->pending_count = 0;
+	embed->pending_size  = 0;
+	return embed;
+}
+
+int
+od_embed_start(od_embed_t *embed, char *config_file)
+{
+	od_instance_t *instance = &embed->instance;
+	instance->config_file = config_file;
+	instance->config.embedded = 1;
+
+	od_log(&instance->logger, "startup", NULL, NULL,
+	       "Starting embedded Odyssey");
+
+	/* machine threads inherit the mask of the caller, other
+	 * signals are left to the application */
+	sigset_t mask;
+	sigset_t mask_prev;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &mask, &mask_prev);
+	int rc;
+	rc = od_instance_start(instance, &embed->global);
+	pthread_sigmask(SIG_SETMASK, &mask_prev, NULL);
+	return rc;
+}
+
+int
+od_embed_connect(od_embed_t *embed)
+{
+	/* called by application threads, the pooler end is passed
+	 * to the system machine */
+	int fds[2];
+	int rc;
+	rc = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+	if (rc == -1)
+		return -1;
+	pthread_mutex_lock(&embed->lock);
+	if (embed->pending_count == embed->pending_size) {
+		int size = embed->pending_size * 2;
+		if (size == 0)
+			size = OD_WORKER_POOL_FEED_MAX;
+		int *pending = realloc(embed->pending, sizeof(int) * size);
+		if (pending == NULL) {
+			pthread_mutex_unlock(&embed->lock);
+			close(fds[0]);
+			close(fds[1]);
+			errno = ENOMEM;
+			return -1;
+		}
+		embed->pending      = pending;
+		embed->pending_size = size;
+	}
+	embed->pending[embed->pending_count] = fds[1];
+	embed->pending_count++;
+	pthread_mutex_unlock(&embed->lock);
+	machine_notify_signal(embed->notify);
+	return fds[0];
+}
+
+static inline int
+od_embed_take(od_embed_t *embed, int *fds, int max)
+{
+	pthread_mutex_lock(&embed->lock);
+	int count = embed->pending_count;
+	if (count > max)
+		count = max;
+	memcpy(fds, embed->pending, sizeof(int) * count);
+	embed->pending_count -= count;
+	memmove(embed->pending, embed->pending + count,
+	        sizeof(int) * embed->pending_count);
+	pthread_mutex_unlock(&embed->lock);
+	return count;
+}
+
+static inline void
+od_embed_accept(void *arg)
+{
+	od_embed_t *embed = arg;
+	od_instance_t *instance = &embed->instance;
+	od_router_t *router = &embed->router;
+	od_worker_pool_t *worker_pool = &embed->worker_pool;
+
+	machine_cond_t *cond;
+	cond = machine_cond_create();
+	if (cond == NULL) {
+		od_error(&instance->logger, "embed", NULL, NULL,
+		         "failed to create condition");
+		return;
+	}
+	machine_notify_start(embed->notify, cond);
+
+	for (;;)
+	{
+		machine_cond_wait(cond, UINT32_MAX);
+		machine_notify_read(embed->notify);
+
+		int fds[OD_WORKER_POOL_FEED_MAX];
+		int count;
+		while ((count = od_embed_take(embed, fds, OD_WORKER_POOL_FEED_MAX)) > 0)
+		{
+			od_client_t *clients[OD_WORKER_POOL_FEED_MAX];
+			int clients_count = 0;
+			int i;
+			for (i = 0; i < count; i++)
+			{
+				machine_io_t *io;
+				io = machine_io_create();
+				if (io == NULL) {
+					close(fds[i]);
+					continue;
+				}
+				int rc;
+				rc = machine_connect_fd(io, fds[i]);
+				if (rc == -1) {
+					od_error(&instance->logger, "embed", NULL, NULL,
+					         "failed to set up client socket: %s",
+					         machine_error(io));
+					machine_io_free(io);
+					continue;
+				}
+				od_client_t *client;
+				client = od_system_client(&embed->global, &embed->listen,
+				                          NULL, io);
+				if (client == NULL)
+					continue;
+				od_atomic_u32_inc(&router->clients_routing);
+				clients[clients_count] = client;
+				clients_count++;
+			}
+			if (clients_count > 0)
+				od_worker_pool_feed(worker_pool,
+				                    od_worker_pool_group(worker_pool,
+				                                         embed->listen.worker_group),
+				                    clients, clients_count);
+		}
+	}
+}
+
+int
+od_embed_serve(od_embed_t *embed)
+{
+	/* run by the system machine once workers are started */
+	int64_t coroutine_id;
+	coroutine_id = machine_coroutine_create(od_embed_accept, embed);
+	if (coroutine_id == -1) {
+		od_error(&embed->instance.logger, "embed", NULL, NULL,
+		         "failed to start in-process client endpoint");
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef ODYSSEY_EMBED_H
+#define ODYSSEY_EMBED_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_embed od_embed_t;
+
+/* Odyssey linked into an application (libodyssey). The instance is
+ * started from a config file on its own machinarium machines and
+ * lives until the process exits. od_embed_connect() may be called by
+ * any application thread: it returns one end of a socket pair, the
+ * other end becomes a client of the pooler as if accepted by a unix
+ * socket listen, so the application talks the PostgreSQL protocol to
+ * pooled server connections without a network hop. Listens of the
+ * config, if any, are served as usual.
+ *
+ * Signals are left to the application, configuration is not reloaded
+ * on SIGHUP and the instance is never daemonized. */
+
+struct od_embed
+{
+	od_instance_t       instance;
+	od_system_t         system;
+	od_router_t         router;
+	od_cron_t           cron;
+	od_worker_pool_t    worker_pool;
+	od_metrics_t        metrics;
+	od_global_t         global;
+	od_config_listen_t  listen;
+	pthread_mutex_t     lock;
+	int                *pending;
+	int                 pending_count;
+	int                 pending_size;
+	machine_notify_t   *notify;
+};
+
+od_embed_t *od_embed_create(void);
+int         od_embed_start(od_embed_t*, char*);
+int         od_embed_connect(od_embed_t*);
+int         od_embed_serve(od_embed_t*);
+
+#endif /* ODYSSEY_EMBED_H */
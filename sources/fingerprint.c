@@ -0,0 +1,389 @@
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+typedef struct
+{
+	uint64_t hash;
+	char    *text;
+	int      text_len;
+	int      space;
+	int      comma;
+	int      placeholder;
+} od_fingerprint_out_t;
+
+static inline void
+od_fingerprint_put(od_fingerprint_out_t *out, char chr)
+{
+	/* fnv-1a */
+	out->hash = (out->hash ^ (uint8_t)chr) * 1099511628211ULL;
+	if (out->text_len < OD_FINGERPRINT_TEXT)
+		out->text[out->text_len++] = chr;
+}
+
+static inline void
+od_fingerprint_flush(od_fingerprint_out_t *out)
+{
+	if (out->comma) {
+		od_fingerprint_put(out, ',');
+		out->comma = 0;
+	}
+	if (out->space) {
+		od_fingerprint_put(out, ' ');
+		out->space = 0;
+	}
+}
+
+static inline void
+od_fingerprint_literal(od_fingerprint_out_t *out)
+{
+	/* literal following another one and a comma is dropped with
+	 * the comma, so lists of any length are the same */
+	if (out->placeholder && out->comma) {
+		out->comma = 0;
+		out->space = 0;
+		return;
+	}
+	od_fingerprint_flush(out);
+	od_fingerprint_put(out, '?');
+	out->placeholder = 1;
+}
+
+static inline int
+od_fingerprint_word_char(char chr)
+{
+	return isalnum((unsigned char)chr) || chr == '_' || chr == '$' ||
+	       (unsigned char)chr >= 0x80;
+}
+
+static inline char*
+od_fingerprint_skip_string(char *pos, char *end, int backslash)
+{
+	/* pos points past the opening quote */
+	while (pos < end) {
+		if (backslash && *pos == '\\') {
+			pos += 2;
+			continue;
+		}
+		if (*pos == '\'') {
+			if (pos + 1 < end && pos[1] == '\'') {
+				pos += 2;
+				continue;
+			}
+			return pos + 1;
+		}
+		pos++;
+	}
+	return end;
+}
+
+static inline char*
+od_fingerprint_skip_dollar(char *pos, char *end)
+{
+	/* $tag$ ... $tag$, pos points to the first '$', returns NULL
+	 * if this is not a dollar quote */
+	char *tag = pos;
+	pos++;
+	while (pos < end && *pos != '$') {
+		if (! od_fingerprint_word_char(*pos))
+			return NULL;
+		pos++;
+	}
+	if (pos == end)
+		return NULL;
+	pos++;
+	int tag_len = pos - tag;
+	while (pos + tag_len <= end) {
+		if (*pos == '$' && memcmp(pos, tag, tag_len) == 0)
+			return pos + tag_len;
+		pos++;
+	}
+	return end;
+}
+
+static inline char*
+od_fingerprint_skip_comment(char *pos, char *end)
+{
+	/* nested block comment, pos points past the opening */
+	int depth = 1;
+	while (pos < end) {
+		if (*pos == '*' && pos + 1 < end && pos[1] == '/') {
+			pos += 2;
+			if (--depth == 0)
+				return pos;
+			continue;
+		}
+		if (*pos == '/' && pos + 1 < end && pos[1] == '*') {
+			pos += 2;
+			depth++;
+			continue;
+		}
+		pos++;
+	}
+	return end;
+}
+
+uint64_t
+od_fingerprint_of(char *query, int query_len, char *text, int *text_len)
+{
+	od_fingerprint_out_t out;
+	out.hash        = 14695981039346656037ULL;
+	out.text        = text;
+	out.text_len    = 0;
+	out.space       = 0;
+	out.comma       = 0;
+	out.placeholder = 0;
+
+	char *pos = query;
+	char *end = query + query_len;
+	while (pos < end)
+	{
+		char chr = *pos;
+		if (chr == '\0')
+			break;
+
+		/* white space and comments */
+		if (isspace((unsigned char)chr)) {
+			out.space = out.text_len > 0 || out.comma;
+			pos++;
+			continue;
+		}
+		if (chr == '-' && pos + 1 < end && pos[1] == '-') {
+			while (pos < end && *pos != '\n')
+				pos++;
+			out.space = out.text_len > 0 || out.comma;
+			continue;
+		}
+		if (chr == '/' && pos + 1 < end && pos[1] == '*') {
+			pos = od_fingerprint_skip_comment(pos + 2, end);
+			out.space = out.text_len > 0 || out.comma;
+			continue;
+		}
+
+		/* literals */
+		if (chr == '\'') {
+			pos = od_fingerprint_skip_string(pos + 1, end, 0);
+			od_fingerprint_literal(&out);
+			continue;
+		}
+		if (isdigit((unsigned char)chr) ||
+		    (chr == '.' && pos + 1 < end && isdigit((unsigned char)pos[1]))) {
+			while (pos < end && (od_fingerprint_word_char(*pos) ||
+			                     *pos == '.'))
+				pos++;
+			od_fingerprint_literal(&out);
+			continue;
+		}
+		if (chr == '$') {
+			if (pos + 1 < end && isdigit((unsigned char)pos[1])) {
+				/* parameter */
+				pos++;
+				while (pos < end && isdigit((unsigned char)*pos))
+					pos++;
+				od_fingerprint_literal(&out);
+				continue;
+			}
+			char *next = od_fingerprint_skip_dollar(pos, end);
+			if (next) {
+				pos = next;
+				od_fingerprint_literal(&out);
+				continue;
+			}
+		}
+
+		/* comma after a literal can start a list */
+		if (chr == ',' && out.placeholder && !out.comma) {
+			out.comma = 1;
+			out.space = 0;
+			pos++;
+			continue;
+		}
+
+		od_fingerprint_flush(&out);
+		out.placeholder = 0;
+
+		/* quoted identifiers are kept as is */
+		if (chr == '"') {
+			od_fingerprint_put(&out, *pos++);
+			while (pos < end) {
+				chr = *pos++;
+				od_fingerprint_put(&out, chr);
+				if (chr == '"')
+					break;
+			}
+			continue;
+		}
+
+		if (od_fingerprint_word_char(chr)) {
+			char *word = pos;
+			while (pos < end && od_fingerprint_word_char(*pos))
+				pos++;
+			/* E'', B'', X'' and N'' strings */
+			if (pos - word == 1 && pos < end && *pos == '\'' &&
+			    strchr("eEbBxXnN", *word)) {
+				int backslash = *word == 'e' || *word == 'E';
+				pos = od_fingerprint_skip_string(pos + 1, end, backslash);
+				od_fingerprint_literal(&out);
+				continue;
+			}
+			for (; word < pos; word++)
+				od_fingerprint_put(&out, tolower((unsigned char)*word));
+			continue;
+		}
+
+		od_fingerprint_put(&out, chr);
+		pos++;
+	}
+	if (out.comma)
+		od_fingerprint_put(&out, ',');
+
+	*text_len = out.text_len;
+	/* zero marks free table entries */
+	if (out.hash == 0)
+		out.hash = 1;
+	return out.hash;
+}
+
+void
+od_fingerprints_init(od_fingerprints_t *fingerprints)
+{
+	fingerprints->entries = NULL;
+	fingerprints->size    = 0;
+	fingerprints->count   = 0;
+	fingerprints->max     = 0;
+	fingerprints->dropped = 0;
+}
+
+int
+od_fingerprints_prepare(od_fingerprints_t *fingerprints, int max)
+{
+	/* open addressing table, kept at most half full */
+	int size = 16;
+	while (size < max * 2)
+		size *= 2;
+	fingerprints->entries = calloc(size, sizeof(od_fingerprint_t));
+	if (fingerprints->entries == NULL)
+		return -1;
+	fingerprints->size = size;
+	fingerprints->max  = max;
+	return 0;
+}
+
+void
+od_fingerprints_free(od_fingerprints_t *fingerprints)
+{
+	if (fingerprints->entries == NULL)
+		return;
+	int i;
+	for (i = 0; i < fingerprints->size; i++) {
+		od_fingerprint_t *fingerprint = &fingerprints->entries[i];
+		if (fingerprint->hgram)
+			od_hgram_free(fingerprint->hgram);
+	}
+	free(fingerprints->entries);
+	od_fingerprints_init(fingerprints);
+}
+
+od_fingerprint_t*
+od_fingerprints_add(od_fingerprints_t *fingerprints, uint64_t hash,
+                    char *text, int text_len)
+{
+	int mask = fingerprints->size - 1;
+	int i = hash & mask;
+	for (;;) {
+		od_fingerprint_t *fingerprint = &fingerprints->entries[i];
+		if (fingerprint->hash == hash)
+			return fingerprint;
+		if (fingerprint->hash == 0)
+			break;
+		i = (i + 1) & mask;
+	}
+	if (fingerprints->count == fingerprints->max) {
+		od_stat_add(&fingerprints->dropped, 1);
+		return NULL;
+	}
+	od_fingerprint_t *fingerprint = &fingerprints->entries[i];
+	fingerprint->hgram = od_hgram_allocate(OD_FINGERPRINT_PRECISION);
+	if (fingerprint->hgram == NULL)
+		return NULL;
+	memcpy(fingerprint->text, text, text_len);
+	fingerprint->text_len = text_len;
+	fingerprints->count++;
+	/* publish for readers */
+	__atomic_store_n(&fingerprint->hash, hash, __ATOMIC_RELEASE);
+	return fingerprint;
+}
+
+int
+od_fingerprints_merge(od_fingerprints_t *dest, od_fingerprints_t *src)
+{
+	/* src is a worker table, updated while it is merged */
+	od_stat_add(&dest->dropped, od_atomic_u64_of(&src->dropped));
+	int i;
+	for (i = 0; i < src->size; i++) {
+		od_fingerprint_t *fingerprint = &src->entries[i];
+		uint64_t hash;
+		hash = __atomic_load_n(&fingerprint->hash, __ATOMIC_ACQUIRE);
+		if (hash == 0)
+			continue;
+		od_fingerprint_t *merged;
+		merged = od_fingerprints_add(dest, hash, fingerprint->text,
+		                             fingerprint->text_len);
+		if (merged == NULL) {
+			if (dest->count < dest->max)
+				return -1;
+			continue;
+		}
+		od_stat_add(&merged->count, od_atomic_u64_of(&fingerprint->count));
+		od_stat_add(&merged->time, od_atomic_u64_of(&fingerprint->time));
+		od_hgram_merge(merged->hgram, fingerprint->hgram);
+	}
+	return 0;
+}
+
+static int
+od_fingerprints_cmp(const void *a, const void *b)
+{
+	const od_fingerprint_t *fa = a;
+	const od_fingerprint_t *fb = b;
+	if (fa->time == fb->time)
+		return 0;
+	return fa->time < fb->time ? 1 : -1;
+}
+
+void
+od_fingerprints_sort(od_fingerprints_t *fingerprints)
+{
+	/* entries are moved to the start of the table in the order of
+	 * total time, the table can only be iterated afterwards */
+	int count = 0;
+	int i;
+	for (i = 0; i < fingerprints->size; i++) {
+		if (fingerprints->entries[i].hash == 0)
+			continue;
+		if (i != count) {
+			fingerprints->entries[count] = fingerprints->entries[i];
+			memset(&fingerprints->entries[i], 0, sizeof(od_fingerprint_t));
+		}
+		count++;
+	}
+	qsort(fingerprints->entries, count, sizeof(od_fingerprint_t),
+	      od_fingerprints_cmp);
+	fingerprints->count = count;
+}
@@ -0,0 +1,74 @@
+#ifndef ODYSSEY_FINGERPRINT_H
+#define ODYSSEY_FINGERPRINT_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_fingerprint       od_fingerprint_t;
+typedef struct od_fingerprints      od_fingerprints_t;
+
+/* start of the normalized query kept for display */
+#define OD_FINGERPRINT_TEXT 128
+
+/* histograms are kept for every fingerprint, so their precision is
+ * lower than of route histograms */
+#define OD_FINGERPRINT_PRECISION 3
+
+/* Query fingerprint is a hash of the normalized query text: literals
+ * and parameters are replaced by '?', lists of them are collapsed,
+ * comments are removed, white space is collapsed and unquoted text is
+ * lower cased.
+ *
+ * Fingerprints are counted in a table of every worker, which has a
+ * single writer. Entries are published by setting their hash last and
+ * are never removed, once the table is full new fingerprints are only
+ * counted as dropped. Readers merge tables of all workers.
+*/
+
+struct od_fingerprint
+{
+	uint64_t        hash;
+	char            text[OD_FINGERPRINT_TEXT];
+	int             text_len;
+	od_atomic_u64_t count;
+	od_atomic_u64_t time;
+	od_hgram_t     *hgram;
+};
+
+struct od_fingerprints
+{
+	od_fingerprint_t *entries;
+	int               size;
+	int               count;
+	int               max;
+	od_atomic_u64_t   dropped;
+};
+
+uint64_t od_fingerprint_of(char*, int, char*, int*);
+
+void od_fingerprints_init(od_fingerprints_t*);
+int  od_fingerprints_prepare(od_fingerprints_t*, int);
+void od_fingerprints_free(od_fingerprints_t*);
+od_fingerprint_t*
+     od_fingerprints_add(od_fingerprints_t*, uint64_t, char*, int);
+int  od_fingerprints_merge(od_fingerprints_t*, od_fingerprints_t*);
+void od_fingerprints_sort(od_fingerprints_t*);
+
+static inline int
+od_fingerprints_enabled(od_fingerprints_t *fingerprints)
+{
+	return fingerprints->entries != NULL;
+}
+
+static inline void
+od_fingerprint_query(od_fingerprint_t *fingerprint, uint64_t time_us)
+{
+	od_stat_add(&fingerprint->count, 1);
+	od_stat_add(&fingerprint->time, time_us);
+	od_hgram_add_data_point(fingerprint->hgram, time_us);
+}
+
+#endif /* ODYSSEY_FINGERPRINT_H */
@@ -0,0 +1,411 @@
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+static inline void
+od_fleet_write32(char *pos, uint32_t value)
+{
+	pos[0] = value >> 24;
+	pos[1] = value >> 16;
+	pos[2] = value >> 8;
+	pos[3] = value;
+}
+
+static inline uint32_t
+od_fleet_read32(char *pos)
+{
+	uint8_t *data = (uint8_t*)pos;
+	return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 |
+	       (uint32_t)data[2] << 8 | (uint32_t)data[3];
+}
+
+static inline void
+od_fleet_write64(char *pos, uint64_t value)
+{
+	od_fleet_write32(pos, value >> 32);
+	od_fleet_write32(pos + 4, value);
+}
+
+static inline uint64_t
+od_fleet_read64(char *pos)
+{
+	return (uint64_t)od_fleet_read32(pos) << 32 | od_fleet_read32(pos + 4);
+}
+
+static inline uint64_t
+od_fleet_key(od_rule_t *rule)
+{
+	/* FNV-1a of database and user names of the rule, defaults
+	 * are hashed as empty names */
+	uint64_t hash = 14695981039346656037ULL;
+	char *names[] = {
+		rule->db_is_default ? "" : rule->db_name,
+		rule->user_is_default ? "" : rule->user_name
+	};
+	int i;
+	for (i = 0; i < 2; i++) {
+		char *pos = names[i];
+		for (;; pos++) {
+			hash ^= (uint8_t)*pos;
+			hash *= 1099511628211ULL;
+			if (*pos == 0)
+				break;
+		}
+	}
+	return hash;
+}
+
+static inline int
+od_fleet_addr_equal(struct sockaddr_storage *a, struct sockaddr_storage *b)
+{
+	if (a->ss_family != b->ss_family)
+		return 0;
+	if (a->ss_family == AF_INET) {
+		struct sockaddr_in *sa = (struct sockaddr_in*)a;
+		struct sockaddr_in *sb = (struct sockaddr_in*)b;
+		return sa->sin_port == sb->sin_port &&
+		       sa->sin_addr.s_addr == sb->sin_addr.s_addr;
+	}
+	if (a->ss_family == AF_INET6) {
+		struct sockaddr_in6 *sa = (struct sockaddr_in6*)a;
+		struct sockaddr_in6 *sb = (struct sockaddr_in6*)b;
+		return sa->sin6_port == sb->sin6_port &&
+		       memcmp(&sa->sin6_addr, &sb->sin6_addr,
+		              sizeof(sa->sin6_addr)) == 0;
+	}
+	return 0;
+}
+
+static inline void
+od_fleet_receive(od_fleet_t *fleet)
+{
+	od_instance_t *instance = fleet->global->instance;
+	char buf[OD_FLEET_HEADER + OD_FLEET_ENTRY * OD_FLEET_RULES];
+	for (;;) {
+		struct sockaddr_storage addr;
+		socklen_t addr_len = sizeof(addr);
+		ssize_t rc;
+		rc = recvfrom(fleet->fd, buf, sizeof(buf), MSG_DONTWAIT,
+		              (struct sockaddr*)&addr, &addr_len);
+		if (rc == -1) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		/* demands are accepted from listed peers only */
+		od_fleet_peer_t *peer = NULL;
+		int i;
+		for (i = 0; i < fleet->peers_count; i++) {
+			if (od_fleet_addr_equal(&fleet->peers[i].addr, &addr)) {
+				peer = &fleet->peers[i];
+				break;
+			}
+		}
+		if (peer == NULL)
+			continue;
+		if (rc < OD_FLEET_HEADER ||
+		    od_fleet_read32(buf) != OD_FLEET_MAGIC ||
+		    (od_fleet_read32(buf + 4) >> 16) != OD_FLEET_VERSION) {
+			od_error(&instance->logger, "fleet", NULL, NULL,
+			         "bad datagram from %s", peer->name);
+			continue;
+		}
+		int count = od_fleet_read32(buf + 4) & 0xffff;
+		if (count > OD_FLEET_RULES ||
+		    rc != OD_FLEET_HEADER + OD_FLEET_ENTRY * count) {
+			od_error(&instance->logger, "fleet", NULL, NULL,
+			         "bad datagram from %s", peer->name);
+			continue;
+		}
+		uint64_t id = od_fleet_read64(buf + 8);
+		if (id == fleet->id)
+			continue;
+		if (peer->id != id) {
+			od_log(&instance->logger, "fleet", NULL, NULL,
+			       "peer %s joined", peer->name);
+			peer->id = id;
+		}
+		char *pos = buf + OD_FLEET_HEADER;
+		for (i = 0; i < count; i++) {
+			peer->entries[i].key    = od_fleet_read64(pos);
+			peer->entries[i].demand = od_fleet_read32(pos + 8);
+			pos += OD_FLEET_ENTRY;
+		}
+		peer->count = count;
+		peer->seen  = machine_time_us();
+	}
+}
+
+static inline int
+od_fleet_share(od_fleet_t *fleet, od_rule_t *rule, uint64_t key, int demand,
+               int *demand_total, int *live)
+{
+	od_instance_t *instance = fleet->global->instance;
+	uint64_t now = machine_time_us();
+	uint64_t timeout = (uint64_t)instance->config.fleet_timeout * 1000;
+	int members = fleet->peers_count + 1;
+	int max = rule->pool_fleet_max;
+
+	/* silent peers keep their static share */
+	int total = demand;
+	int extra_total = demand > 1 ? demand - 1 : 0;
+	int available = max;
+	*live = 1;
+	int i;
+	for (i = 0; i < fleet->peers_count; i++) {
+		od_fleet_peer_t *peer = &fleet->peers[i];
+		if (peer->seen == 0 || now - peer->seen > timeout) {
+			available -= max / members;
+			continue;
+		}
+		(*live)++;
+		int j;
+		for (j = 0; j < peer->count; j++) {
+			if (peer->entries[j].key != key)
+				continue;
+			int peer_demand = peer->entries[j].demand;
+			total += peer_demand;
+			if (peer_demand > 1)
+				extra_total += peer_demand - 1;
+			break;
+		}
+	}
+	*demand_total = total;
+
+	/* every live instance keeps one slot, the rest is split by
+	 * demand over one slot and budget left over equally, so shares
+	 * of the fleet sum up to pool_fleet_max */
+	int rest = available - *live;
+	int extra = demand > 1 ? demand - 1 : 0;
+	if (extra_total <= rest)
+		return 1 + extra + (rest - extra_total) / *live;
+	return 1 + (int)((uint64_t)rest * extra / extra_total);
+}
+
+static inline void
+od_fleet_update(od_fleet_t *fleet)
+{
+	od_router_t *router = fleet->global->router;
+	char *pos = fleet->buf + OD_FLEET_HEADER;
+	int count = 0;
+	int live = 1;
+
+	od_router_lock_read(router, OD_LOCK_OTHER);
+	od_list_t *i;
+	od_list_foreach(&router->rules.rules, i) {
+		od_rule_t *rule;
+		rule = od_container_of(i, od_rule_t, link);
+		if (rule->obsolete || rule->pool_fleet_max == 0)
+			continue;
+		if (count == OD_FLEET_RULES)
+			break;
+		uint64_t key = od_fleet_key(rule);
+
+		pthread_mutex_lock(&rule->quota_lock);
+		int demand = rule->quota_active;
+		od_list_t *j;
+		od_list_foreach(&rule->quota_waiters, j)
+			demand++;
+		int demand_total;
+		rule->quota_fleet = od_fleet_share(fleet, rule, key, demand,
+		                                   &demand_total, &live);
+		rule->quota_fleet_demand = demand_total;
+		od_router_quota_grant(rule);
+		pthread_mutex_unlock(&rule->quota_lock);
+
+		od_fleet_write64(pos, key);
+		od_fleet_write32(pos + 8, demand);
+		pos += OD_FLEET_ENTRY;
+		count++;
+	}
+	od_router_unlock(router);
+
+	od_fleet_write32(fleet->buf, OD_FLEET_MAGIC);
+	od_fleet_write32(fleet->buf + 4, OD_FLEET_VERSION << 16 | count);
+	od_fleet_write64(fleet->buf + 8, fleet->id);
+	fleet->buf_len = pos - fleet->buf;
+	od_atomic_u32_set(&fleet->peers_live, live - 1);
+}
+
+static inline void
+od_fleet_send(od_fleet_t *fleet)
+{
+	int i;
+	for (i = 0; i < fleet->peers_count; i++) {
+		od_fleet_peer_t *peer = &fleet->peers[i];
+		/* lost datagrams are replaced by the next round */
+		sendto(fleet->fd, fleet->buf, fleet->buf_len, MSG_DONTWAIT,
+		       (struct sockaddr*)&peer->addr, peer->addr_len);
+	}
+}
+
+static void
+od_fleet(void *arg)
+{
+	od_fleet_t *fleet = arg;
+	od_instance_t *instance = fleet->global->instance;
+	for (;;) {
+		od_fleet_receive(fleet);
+		od_fleet_update(fleet);
+		od_fleet_send(fleet);
+		machine_sleep(instance->config.fleet_interval);
+	}
+}
+
+static inline int
+od_fleet_resolve(od_instance_t *instance, char *host, char *port,
+                 struct sockaddr_storage *addr, socklen_t *addr_len)
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_DGRAM;
+	struct addrinfo *ai = NULL;
+	int rc;
+	rc = machine_getaddrinfo(host, port, &hints, &ai, UINT32_MAX);
+	if (rc != 0 || ai == NULL) {
+		od_error(&instance->logger, "fleet", NULL, NULL,
+		         "failed to resolve %s:%s", host, port);
+		return -1;
+	}
+	memcpy(addr, ai->ai_addr, ai->ai_addrlen);
+	*addr_len = ai->ai_addrlen;
+	freeaddrinfo(ai);
+	return 0;
+}
+
+static inline int
+od_fleet_peers_parse(od_fleet_t *fleet)
+{
+	/* fleet_peers "host:port, host:port" */
+	od_instance_t *instance = fleet->global->instance;
+	int max = od_fleet_members(instance->config.fleet_peers) - 1;
+	if (max == 0)
+		return 0;
+	fleet->peers = calloc(max, sizeof(od_fleet_peer_t));
+	if (fleet->peers == NULL)
+		return -1;
+	char *peers = strdup(instance->config.fleet_peers);
+	if (peers == NULL)
+		return -1;
+	char *pos = peers;
+	char *item;
+	while ((item = strsep(&pos, ",")) != NULL) {
+		while (isspace(*item))
+			item++;
+		char *end = item + strlen(item);
+		while (end > item && isspace(end[-1]))
+			*--end = 0;
+		if (*item == 0)
+			continue;
+		od_fleet_peer_t *peer = &fleet->peers[fleet->peers_count];
+		peer->name = strdup(item);
+		if (peer->name == NULL)
+			goto error;
+		char *port = strrchr(item, ':');
+		if (port == NULL) {
+			od_error(&instance->logger, "fleet", NULL, NULL,
+			         "fleet peer '%s' has no port", item);
+			free(peer->name);
+			goto error;
+		}
+		*port++ = 0;
+		if (od_fleet_resolve(instance, item, port, &peer->addr,
+		                     &peer->addr_len) == -1) {
+			free(peer->name);
+			goto error;
+		}
+		fleet->peers_count++;
+	}
+	free(peers);
+	return 0;
+
+error:
+	free(peers);
+	return -1;
+}
+
+int
+od_fleet_start(od_global_t *global)
+{
+	od_instance_t *instance = global->instance;
+	od_system_t *system = global->system;
+	od_fleet_t *fleet = &system->fleet;
+	fleet->global = global;
+	if (instance->config.fleet_port == 0)
+		return 0;
+
+	/* an instance restarted at the same address is a new peer */
+	fleet->id = (uint64_t)machine_lrand48() << 32 ^ machine_lrand48() ^
+	            machine_time_us();
+
+	if (od_fleet_peers_parse(fleet) == -1)
+		return -1;
+
+	char *host = instance->config.fleet_host;
+	if (host == NULL)
+		host = "127.0.0.1";
+	char port[16];
+	od_snprintf(port, sizeof(port), "%d", instance->config.fleet_port);
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	if (od_fleet_resolve(instance, host, port, &addr, &addr_len) == -1)
+		return -1;
+
+	fleet->fd = socket(addr.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fleet->fd == -1) {
+		od_error(&instance->logger, "fleet", NULL, NULL,
+		         "failed to create socket: %s", strerror(errno));
+		return -1;
+	}
+	int rc;
+	rc = bind(fleet->fd, (struct sockaddr*)&addr, addr_len);
+	if (rc == -1) {
+		od_error(&instance->logger, "fleet", NULL, NULL,
+		         "failed to bind %s:%s: %s", host, port, strerror(errno));
+		goto error;
+	}
+
+	fleet->buf = malloc(OD_FLEET_HEADER + OD_FLEET_ENTRY * OD_FLEET_RULES);
+	if (fleet->buf == NULL)
+		goto error;
+	fleet->machine = machine_create("fleet", od_fleet, fleet);
+	if (fleet->machine == -1) {
+		od_error(&instance->logger, "fleet", NULL, NULL,
+		         "failed to start fleet machine");
+		goto error;
+	}
+	od_log(&instance->logger, "fleet", NULL, NULL,
+	       "fleet of %d instances, listening on %s:%s",
+	       fleet->peers_count + 1, host, port);
+	return 0;
+
+error:
+	if (fleet->buf) {
+		free(fleet->buf);
+		fleet->buf = NULL;
+	}
+	close(fleet->fd);
+	fleet->fd = -1;
+	return -1;
+}
@@ -0,0 +1,100 @@
+#ifndef ODYSSEY_FLEET_H
+#define ODYSSEY_FLEET_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_fleet_entry od_fleet_entry_t;
+typedef struct od_fleet_peer  od_fleet_peer_t;
+typedef struct od_fleet       od_fleet_t;
+
+/* Instances listed in fleet_peers share pool_fleet_max of a rule.
+ *
+ * Every fleet_interval the fleet machine sends its demand of every
+ * fleet rule, active servers and waiting clients, to all peers in one
+ * UDP datagram and recomputes its own share of the rule from the last
+ * demands of peers. Rules are matched by names of database and user.
+ * A peer not heard for fleet_timeout keeps the static share of
+ * pool_fleet_max / instances, so a lost peer is never overcommitted.
+ * Every live instance keeps one slot, the rest is split by demand. */
+
+#define OD_FLEET_MAGIC   0x4c46444f /* "ODFL" */
+#define OD_FLEET_VERSION 1
+#define OD_FLEET_RULES   256
+
+/* magic, version, count, instance id */
+#define OD_FLEET_HEADER  16
+#define OD_FLEET_ENTRY   12
+
+struct od_fleet_entry
+{
+	uint64_t key;
+	uint32_t demand;
+};
+
+struct od_fleet_peer
+{
+	char                    *name;
+	struct sockaddr_storage  addr;
+	socklen_t                addr_len;
+	uint64_t                 id;
+	uint64_t                 seen;
+	int                      count;
+	od_fleet_entry_t         entries[OD_FLEET_RULES];
+};
+
+struct od_fleet
+{
+	int64_t          machine;
+	int              fd;
+	uint64_t         id;
+	od_fleet_peer_t *peers;
+	int              peers_count;
+	od_atomic_u32_t  peers_live;
+	char            *buf;
+	int              buf_len;
+	od_global_t     *global;
+};
+
+static inline void
+od_fleet_init(od_fleet_t *fleet)
+{
+	fleet->machine     = -1;
+	fleet->fd          = -1;
+	fleet->id          = 0;
+	fleet->peers       = NULL;
+	fleet->peers_count = 0;
+	fleet->peers_live  = 0;
+	fleet->buf         = NULL;
+	fleet->buf_len     = 0;
+	fleet->global      = NULL;
+}
+
+static inline int
+od_fleet_members(char *peers)
+{
+	/* fleet_peers "host:port, host:port" and this instance */
+	int count = 1;
+	if (peers == NULL)
+		return count;
+	int item = 0;
+	char *c;
+	for (c = peers; *c; c++) {
+		if (*c == ',') {
+			item = 0;
+			continue;
+		}
+		if (*c == ' ' || *c == '\t' || item)
+			continue;
+		item = 1;
+		count++;
+	}
+	return count;
+}
+
+int od_fleet_start(od_global_t*);
+
+#endif /* ODYSSEY_FLEET_H */
@@ -18,6 +18,23 @@
 #include <kiwi.h>
 #include <odyssey.h>
 
+/* Per packet work of the relay callbacks which depends on the
+ * configuration. Callbacks are instantiated for the common cases with
+ * the features known at compile time, so they carry no checks for the
+ * disabled ones, and are chosen when the relay starts. */
+typedef enum
+{
+	OD_FRONTEND_DEBUG       = 1 << 0,
+	OD_FRONTEND_LOG_QUERY   = 1 << 1,
+	OD_FRONTEND_QUERY_STATS = 1 << 2,
+	OD_FRONTEND_QUERY_CACHE = 1 << 3,
+	OD_FRONTEND_TRACK_SET   = 1 << 4,
+	OD_FRONTEND_TRANSACTION = 1 << 5,
+	OD_FRONTEND_SPANS       = 1 << 6,
+	OD_FRONTEND_MIRROR      = 1 << 7,
+	OD_FRONTEND_ALL         = (1 << 8) - 1
+} od_frontend_feature_t;
+
 static inline void
 od_frontend_close(od_client_t *client)
 {
@@ -28,10 +45,9 @@ od_frontend_close(od_client_t *client)
 	od_atomic_u32_dec(&router->clients);
 
 	od_io_close(&client->io);
-	if (client->notify_io) {
-		machine_close(client->notify_io);
-		machine_io_free(client->notify_io);
-		client->notify_io = NULL;
+	if (client->notify) {
+		machine_notify_free(client->notify);
+		client->notify = NULL;
 	}
 	od_client_free(client);
 }
@@ -103,21 +119,94 @@ od_frontend_error_is_too_many_connections(od_client_t *client)
 
 #define MAX_STARTUP_ATTEMPTS 7
 
+static inline int
+od_frontend_startup_compression(od_client_t *client)
+{
+	od_instance_t *instance = client->global->instance;
+	if (! client->config_listen->compression || client->startup.is_cancel)
+		return 0;
+	/* mux links are compressed as a whole */
+	if (client->mux)
+		return 0;
+
+	/* peer waits for the startup reply before sending anything
+	 * else, so nothing can be buffered in plain */
+	if (od_readahead_unread(&client->io.readahead) > 0) {
+		od_error(&instance->logger, "startup", client, NULL,
+		         "unexpected data after startup packet");
+		return -1;
+	}
+	int rc;
+	rc = machine_set_compression(client->io.io, OD_IO_COMPRESSION_LEVEL);
+	if (rc == -1) {
+		od_error(&instance->logger, "startup", client, NULL,
+		         "failed to enable compression: %s",
+		         od_io_error(&client->io));
+		return -1;
+	}
+	return 0;
+}
+
+static inline int
+od_frontend_read_startup(od_client_t *client)
+{
+	od_instance_t *instance = client->global->instance;
+	uint32_t timeout = client->config_listen->client_login_timeout;
+
+	/* startup packet is parsed in place in the readahead buffer,
+	 * only values kept by the client are copied */
+	char *data;
+	int rc;
+	rc = od_io_peek(&client->io, sizeof(uint32_t), timeout, &data);
+	if (rc == -1)
+		return -1;
+	if (rc == 0) {
+		uint32_t size;
+		rc = kiwi_validate_startup_header(data, sizeof(uint32_t), &size);
+		if (rc == -1)
+			return -1;
+		size += sizeof(uint32_t);
+		rc = od_io_peek(&client->io, size, timeout, &data);
+		if (rc == -1)
+			return -1;
+		if (rc == 0) {
+			rc = kiwi_be_read_startup(data, size, &client->startup,
+			                          &client->vars,
+			                          instance->config.track_parameters);
+			od_readahead_pos_read_advance(&client->io.readahead, size);
+			return rc;
+		}
+	}
+
+	/* packet larger than the readahead buffer */
+	machine_msg_t *msg;
+	msg = od_read_startup(&client->io, timeout);
+	if (msg == NULL)
+		return -1;
+	rc = kiwi_be_read_startup(machine_msg_data(msg), machine_msg_size(msg),
+	                          &client->startup, &client->vars,
+	                          instance->config.track_parameters);
+	machine_msg_free(msg);
+	return rc;
+}
+
 static int
 od_frontend_startup(od_client_t *client)
 {
 	od_instance_t *instance = client->global->instance;
 	machine_msg_t *msg;
+	client->time_startup = machine_time_us();
+
+	/* direct tls handshake, startup follows encrypted */
+	int direct;
+	direct = od_tls_frontend_direct(client, &instance->logger,
+	                                client->config_listen,
+	                                client->tls);
+	if (direct == -1)
+		return -1;
 
 	for (int startup_attempt = 0; startup_attempt < MAX_STARTUP_ATTEMPTS; startup_attempt++) {
-		msg = od_read_startup(&client->io, client->config_listen->client_login_timeout);
-		if (msg == NULL)
-			goto error;
-
-		int rc = kiwi_be_read_startup(machine_msg_data(msg),
-		                          machine_msg_size(msg),
-		                          &client->startup, &client->vars);
-		machine_msg_free(msg);
+		int rc = od_frontend_read_startup(client);
 		if (rc == -1)
 			goto error;
 
@@ -138,6 +227,15 @@ od_frontend_startup(od_client_t *client)
 		od_debug(&instance->logger, "unsupported protocol (gssapi)", client, NULL, "ignoring");
 	}
 
+	if (direct) {
+		if (client->startup.is_ssl_request) {
+			od_error(&instance->logger, "tls", client, NULL,
+			         "ssl request over direct tls, closing");
+			return -1;
+		}
+		return od_frontend_startup_compression(client);
+	}
+
 	/* client ssl request */
 	int rc = od_tls_frontend_accept(client, &instance->logger,
 	                            client->config_listen,
@@ -146,21 +244,15 @@ od_frontend_startup(od_client_t *client)
 		return -1;
 
 	if (! client->startup.is_ssl_request)
-		return 0;
+		return od_frontend_startup_compression(client);
 
 	/* read startup-cancel message followed after ssl
 	 * negotiation */
 	assert(client->startup.is_ssl_request);
-	msg = od_read_startup(&client->io, client->config_listen->client_login_timeout);
-	if (msg == NULL)
-		return -1;
-	rc = kiwi_be_read_startup(machine_msg_data(msg),
-	                          machine_msg_size(msg),
-	                          &client->startup, &client->vars);
-	machine_msg_free(msg);
+	rc = od_frontend_read_startup(client);
 	if (rc == -1)
 		goto error;
-	return 0;
+	return od_frontend_startup_compression(client);
 
 error:
 	od_debug(&instance->logger, "startup", client, NULL,
@@ -193,7 +285,8 @@ od_frontend_attach(od_client_t *client, char *context, kiwi_params_t *route_para
 		}
 
 		od_server_t *server = client->server;
-		if (server->io.io && !machine_connected(server->io.io)) {
+		if (! server->connect_failed && server->io.io &&
+		    ! machine_connected(server->io.io)) {
 			od_log(&instance->logger, context, client, server,
 			       "server disconnected, close connection and retry attach");
 			od_router_close(router, client);
@@ -205,13 +298,20 @@ od_frontend_attach(od_client_t *client, char *context, kiwi_params_t *route_para
 		         server->id.id);
 
 		/* connect to server, if necessary */
-		if (server->io.io)
-			return OD_OK;
-
 		int rc;
-		od_atomic_u32_inc(&router->servers_routing);
-		rc = od_backend_connect(server, context, route_params);
-		od_atomic_u32_dec(&router->servers_routing);
+		if (server->connect_failed) {
+			/* connection established in background has failed */
+			server->connect_failed = 0;
+			rc = -1;
+		} else {
+			if (server->io.io) {
+				od_client_wait(client, OD_CLIENT_WAIT_CLIENT);
+				return OD_OK;
+			}
+			od_atomic_u32_inc(&router->servers_routing);
+			rc = od_backend_connect(server, context, route_params);
+			od_router_routing_done(router);
+		}
 		if (rc == -1)
 		{
 			/* In case of 'too many connections' error, retry attach attempt by
@@ -228,6 +328,7 @@ od_frontend_attach(od_client_t *client, char *context, kiwi_params_t *route_para
 			return OD_ESERVER_CONNECT;
 		}
 
+		od_client_wait(client, OD_CLIENT_WAIT_CLIENT);
 		return OD_OK;
 	}
 }
@@ -256,7 +357,7 @@ od_frontend_attach_and_deploy(od_client_t *client, char *context)
 }
 
 static inline od_status_t
-od_frontend_setup_params(od_client_t *client)
+od_frontend_setup_params(od_client_t *client, machine_msg_t *stream)
 {
 	od_instance_t *instance = client->global->instance;
 	od_router_t *router = client->global->router;
@@ -285,63 +386,56 @@ od_frontend_setup_params(od_client_t *client)
 			kiwi_params_free(&route_params);
 	}
 
+	/* route params are encoded once, logins copy the block */
+	if (route->params_data == NULL) {
+		rc = od_route_params_prepare(route, &client->vars);
+		if (rc == -1)
+			return OD_EOOM;
+	}
+
 	od_debug(&instance->logger, "setup", client, NULL,
 	         "sending params:");
 
 	/* send parameters set by client or cached by the route */
-	kiwi_param_t *param = route->params.params.list;
-
-	machine_msg_t *stream = machine_msg_create(0);
-	if (stream == NULL)
-		return OD_EOOM;
-
-	while (param)
+	machine_msg_t *msg;
+	int pos = 0;
+	int i;
+	for (i = 0; i < route->params_count; i++)
 	{
-		kiwi_var_type_t type;
-		type = kiwi_vars_find(&client->vars, kiwi_param_name(param),
-		                      param->name_len);
+		od_route_param_t *param = &route->params_index[i];
 		kiwi_var_t *var;
-		var = kiwi_vars_get(&client->vars, type);
-
-		machine_msg_t *msg;
-		if (var) {
-			msg = kiwi_be_write_parameter_status(stream,
-			                                     var->name,
-			                                     var->name_len,
-			                                     var->value,
-			                                     var->value_len);
-
-			od_debug(&instance->logger, "setup", client, NULL,
-			         " %.*s = %.*s",
-			         var->name_len,
-			         var->name,
-			         var->value_len,
-			         var->value);
-		} else {
-			msg = kiwi_be_write_parameter_status(stream,
-			                                     kiwi_param_name(param),
-			                                     param->name_len,
-			                                     kiwi_param_value(param),
-			                                     param->value_len);
-
-			od_debug(&instance->logger, "setup", client, NULL,
-			         " %.*s = %.*s",
-			         param->name_len,
-			         kiwi_param_name(param),
-			         param->value_len,
-			         kiwi_param_value(param));
+		var = kiwi_vars_get(&client->vars, param->type);
+		if (var == NULL)
+			continue;
+		if (param->offset > pos) {
+			rc = machine_msg_write(stream, route->params_data + pos,
+			                       param->offset - pos);
+			if (rc == -1)
+				return OD_EOOM;
 		}
-		if (msg == NULL) {
-			machine_msg_free(stream);
+		pos = param->offset + param->size;
+
+		msg = kiwi_be_write_parameter_status(stream,
+		                                     var->name,
+		                                     var->name_len,
+		                                     var->value,
+		                                     var->value_len);
+		if (msg == NULL)
 			return OD_EOOM;
-		}
 
-		param = param->next;
+		od_debug(&instance->logger, "setup", client, NULL,
+		         " %.*s = %.*s",
+		         var->name_len,
+		         var->name,
+		         var->value_len,
+		         var->value);
+	}
+	if (route->params_size > pos) {
+		rc = machine_msg_write(stream, route->params_data + pos,
+		                       route->params_size - pos);
+		if (rc == -1)
+			return OD_EOOM;
 	}
-
-	rc = od_write(&client->io, stream);
-	if (rc == -1)
-		return OD_ECLIENT_WRITE;
 
 	return OD_OK;
 }
@@ -351,19 +445,27 @@ od_frontend_setup(od_client_t *client)
 {
 	od_instance_t *instance = client->global->instance;
 
+	/* whole login response is sent by a single write */
+	machine_msg_t *stream;
+	stream = kiwi_be_write_authentication_ok(NULL);
+	if (stream == NULL)
+		return OD_EOOM;
+
 	/* set paremeters */
 	od_status_t status;
-	status = od_frontend_setup_params(client);
-	if (status != OD_OK)
+	status = od_frontend_setup_params(client, stream);
+	if (status != OD_OK) {
+		machine_msg_free(stream);
 		return status;
+	}
 
 	/* write key data message */
-	machine_msg_t *stream;
 	machine_msg_t *msg;
-	msg = kiwi_be_write_backend_key_data(NULL, client->key.key_pid, client->key.key);
-	if (msg == NULL)
+	msg = kiwi_be_write_backend_key_data(stream, client->key.key_pid, client->key.key);
+	if (msg == NULL) {
+		machine_msg_free(stream);
 		return OD_EOOM;
-	stream = msg;
+	}
 
 	/* write ready message */
 	msg = kiwi_be_write_ready(stream, 'I');
@@ -391,7 +493,7 @@ static inline od_status_t
 od_frontend_local_setup(od_client_t *client)
 {
 	machine_msg_t *stream;
-	stream = machine_msg_create(0);
+	stream = kiwi_be_write_authentication_ok(NULL);
 	if (stream == NULL)
 		goto error;
 	/* client parameters */
@@ -431,6 +533,10 @@ od_frontend_local(od_client_t *client)
 {
 	od_instance_t *instance = client->global->instance;
 
+	/* console queries must not delay client traffic */
+	machine_set_priority(MACHINE_PRIORITY_LOW);
+	od_client_wait(client, OD_CLIENT_WAIT_CLIENT);
+
 	for (;;)
 	{
 		machine_msg_t *msg;
@@ -458,11 +564,14 @@ od_frontend_local(od_client_t *client)
 		int rc;
 		if (type == KIWI_FE_QUERY)
 		{
-			rc = od_console_query(client, stream, machine_msg_data(msg),
+			/* console may send large replies in parts and
+			 * replace the stream */
+			rc = od_console_query(client, &stream, machine_msg_data(msg),
 			                      machine_msg_size(msg));
 			machine_msg_free(msg);
 			if (rc == -1) {
-				machine_msg_free(stream);
+				if (stream)
+					machine_msg_free(stream);
 				return OD_EOOM;
 			}
 		} else
@@ -498,85 +607,121 @@ od_frontend_local(od_client_t *client)
 	return OD_OK;
 }
 
-static od_status_t
-od_frontend_remote_server(od_relay_t *relay, char *data, int size)
+static inline void
+od_frontend_relay_splice(od_client_t *client, od_server_t *server)
 {
-	od_client_t *client = relay->on_packet_arg;
-	od_server_t *server = client->server;
-	od_route_t *route = client->route;
 	od_instance_t *instance = client->global->instance;
+	od_route_t *route = client->route;
+	/* move copy, replication and passthrough streams between
+	 * sockets without copying them to userspace */
+	int enable = instance->config.relay_splice &&
+	             (server->is_copy || server->is_passthrough ||
+	              route->id.physical_rep || route->id.logical_rep);
+	client->relay.splice = enable;
+	server->relay.splice = enable;
+}
 
-	kiwi_be_type_t type = *data;
-	if (instance->config.log_debug)
-		od_debug(&instance->logger, "main", client, server, "%s",
-		         kiwi_be_type_to_string(type));
-
-	int is_deploy = od_server_in_deploy(server);
-	int is_ready_for_query = 0;
-
-	int rc;
-	switch (type) {
-	case KIWI_BE_ERROR_RESPONSE:
-		od_backend_error(server, "main", data, size);
-		break;
-	case KIWI_BE_PARAMETER_STATUS:
-		rc = od_backend_update_parameter(server, "main", data, size, 0);
-		if (rc == -1)
-			return relay->error_read;
-		break;
-	case KIWI_BE_COPY_IN_RESPONSE:
-	case KIWI_BE_COPY_OUT_RESPONSE:
-		server->is_copy = 1;
-		break;
-	case KIWI_BE_COPY_DONE:
-		server->is_copy = 0;
-		break;
-	case KIWI_BE_READY_FOR_QUERY:
-	{
-		is_ready_for_query = 1;
-		od_backend_ready(server, data, size);
-
-		/* update server stats */
-		int64_t query_time = 0;
-		od_stat_query_end(&route->stats, &server->stats_state,
-		                  server->is_transaction,
-		                  &query_time);
-		if (instance->config.log_debug && query_time > 0) {
-			od_debug(&instance->logger, "main", server->client, server,
-			         "query time: %d microseconds",
-			          query_time);
-		}
-
-		if (is_deploy)
-			server->deploy_sync--;
+static inline void
+od_frontend_relay_mask(od_client_t *client, od_server_t *server)
+{
+	od_instance_t *instance = client->global->instance;
+	od_relay_t *relay = &server->relay;
 
-		break;
-	}
-	default:
-		break;
+	/* all replies are discarded during configuration deploy and
+	 * inspected while reply to a cached query is collected */
+	if (instance->config.log_debug || od_server_in_deploy(server) ||
+	    client->query_cache_id != -1) {
+		od_relay_mask_all(relay);
+		return;
 	}
 
-	/* discard replies during configuration deploy */
-	if (is_deploy)
-		return OD_SKIP;
-
-	/* handle transaction pooling */
-	if (is_ready_for_query) {
-		if (route->rule->pool == OD_RULE_POOL_TRANSACTION &&
-		    !server->is_transaction && !route->id.physical_rep &&
-			!route->id.logical_rep) {
-			return OD_DETACH;
-		}
+	/* replies handled by od_frontend_remote_server() */
+	od_relay_mask_clear(relay);
+	od_relay_mask_set(relay, KIWI_BE_ERROR_RESPONSE);
+	od_relay_mask_set(relay, KIWI_BE_PARAMETER_STATUS);
+	od_relay_mask_set(relay, KIWI_BE_COPY_IN_RESPONSE);
+	od_relay_mask_set(relay, KIWI_BE_COPY_OUT_RESPONSE);
+	od_relay_mask_set(relay, KIWI_BE_COPY_BOTH_RESPONSE);
+	od_relay_mask_set(relay, KIWI_BE_COPY_DONE);
+	od_relay_mask_set(relay, KIWI_BE_READY_FOR_QUERY);
+	od_relay_mask_set(relay, KIWI_BE_PARSE_COMPLETE);
+	od_relay_mask_set(relay, KIWI_BE_CLOSE_COMPLETE);
+
+	/* first result message is the response time of a span query,
+	 * rows are unmasked once it is seen */
+	if (instance->config.span_port) {
+		od_relay_mask_set(relay, KIWI_BE_ROW_DESCRIPTION);
+		od_relay_mask_set(relay, KIWI_BE_DATA_ROW);
+		od_relay_mask_set(relay, KIWI_BE_COMMAND_COMPLETE);
+		od_relay_mask_set(relay, KIWI_BE_BIND_COMPLETE);
+		od_relay_mask_set(relay, KIWI_BE_NO_DATA);
+		od_relay_mask_set(relay, KIWI_BE_PARAMETER_DESCRIPTION);
+		od_relay_mask_set(relay, KIWI_BE_EMPTY_QUERY_RESPONSE);
+		od_relay_mask_set(relay, KIWI_BE_PORTAL_SUSPENDED);
 	}
+}
 
-	return OD_OK;
+static inline void
+od_frontend_passthrough(od_client_t *client, od_server_t *server)
+{
+	/* Session server is not detached until the client disconnects,
+	 * so once it is idle after the first query its replies are
+	 * relayed as raw bytes and only client Terminate is inspected.
+	 *
+	 * Server state is not tracked from now on, the server is closed
+	 * on disconnect and query stats are not collected. */
+	od_instance_t *instance = client->global->instance;
+	od_route_t *route = client->route;
+	od_rule_t *rule = client->rule;
+	if (! rule->pool_passthrough || rule->pool != OD_RULE_POOL_SESSION)
+		return;
+	if (instance->config.log_debug || instance->config.log_query ||
+	    rule->query_cache || route->id.physical_rep || route->id.logical_rep)
+		return;
+	if (! od_server_synchronized(server) || server->sync_pending ||
+	    server->is_copy || od_server_in_deploy(server))
+		return;
+	if (client->relay.packet > 0 || client->relay.packet_full)
+		return;
+
+	server->is_passthrough = 1;
+	server->relay.raw = 1;
+	od_relay_mask_clear(&client->relay);
+	od_relay_mask_set(&client->relay, KIWI_FE_TERMINATE);
+	od_frontend_relay_splice(client, server);
 }
 
-static void od_frontend_log_query(od_instance_t *instance, od_client_t *client, char *data, int size)
+static void
+od_frontend_log_query(od_instance_t *instance, od_client_t *client, char *data, int size)
 {
+	od_route_t *route = client->route;
 	uint32_t query_len;
 	char *query;
 	int rc;
+
+	/* slow queries are logged on completion, keep the first
+	 * one of pipelined queries */
+	if (route->rule->log_query_min_duration > 0) {
+		if (client->log_query_len > 0)
+			return;
+		rc = kiwi_be_read_query(data, size, &query, &query_len);
+		if (rc == -1)
+			return;
+		if (client->log_query == NULL) {
+			client->log_query = malloc(OD_CLIENT_LOG_QUERY_MAX);
+			if (client->log_query == NULL)
+				return;
+		}
+		if (query_len > OD_CLIENT_LOG_QUERY_MAX)
+			query_len = OD_CLIENT_LOG_QUERY_MAX;
+		memcpy(client->log_query, query, query_len);
+		client->log_query_len = query_len;
+		return;
+	}
+
+	if (! od_route_log_query(route))
+		return;
+
 	rc = kiwi_be_read_query(data, size, &query, &query_len);
 	if (rc == -1)
 		return;
@@ -585,132 +730,1883 @@ static void od_frontend_log_query(od_instance_t *instance, od_client_t *client,
 	         "%.*s", query_len, query);
 }
 
-static od_status_t
-od_frontend_remote_client(od_relay_t *relay, char *data, int size)
+/* sessions are sampled once, on login */
+static inline void
+od_frontend_capture_start(od_client_t *client)
 {
-	od_client_t *client = relay->on_packet_arg;
 	od_instance_t *instance = client->global->instance;
-	(void)size;
+	od_rule_t *rule = client->rule;
+	if (instance->config.capture_file == NULL || rule->capture_sample == 0)
+		return;
+	if (rule->capture_sample > 1 &&
+	    machine_lrand48() % rule->capture_sample)
+		return;
+	client->capture = 1;
+
+	/* zero terminated database and user names, database
+	 * defaults to the user name as in postgres */
+	kiwi_var_t *user = &client->startup.user;
+	kiwi_var_t *database = &client->startup.database;
+	if (database->value_len == 0)
+		database = user;
+	char data[2 * KIWI_MAX_VAR_SIZE];
+	memcpy(data, database->value, database->value_len);
+	memcpy(data + database->value_len, user->value, user->value_len);
+
+	od_capture_record_t record;
+	record.type     = OD_CAPTURE_SESSION;
+	record.reserved = 0;
+	record.session  = od_logbin_id(client->id.id_prefix, client->id.id_a,
+	                               client->id.id_b);
+	od_logger_capture(&instance->logger, &record, data,
+	                  database->value_len + user->value_len);
+}
 
-	kiwi_fe_type_t type = *data;
-	if (type == KIWI_FE_TERMINATE)
-		return OD_STOP;
+static inline void
+od_frontend_capture(od_client_t *client, od_capture_type_t type,
+                    char *data, int size)
+{
+	od_instance_t *instance = client->global->instance;
+	od_capture_record_t record;
+	record.type     = type;
+	record.reserved = 0;
+	record.session  = od_logbin_id(client->id.id_prefix, client->id.id_a,
+	                               client->id.id_b);
+	if (type == OD_CAPTURE_MESSAGE) {
+		/* relay passes large messages in parts */
+		uint32_t total;
+		total = sizeof(uint8_t) + kiwi_read_size(data, sizeof(kiwi_header_t));
+		if (total > OD_CAPTURE_MESSAGE_MAX || (uint32_t)size < total) {
+			record.type = OD_CAPTURE_TRUNCATED;
+			size = sizeof(kiwi_header_t);
+		}
+	}
+	od_logger_capture(&instance->logger, &record, data, size);
+}
 
-	/* get server connection from the route pool and write
-	   configuration */
-	od_server_t *server = client->server;
-	assert(server != NULL);
+static inline int
+od_frontend_read_only_query(od_rule_t *rule, char *query, uint32_t query_len)
+{
+	char *end = query + query_len;
+	while (end > query && (end[-1] == 0 || isspace((unsigned char)end[-1])))
+		end--;
 
-	if (instance->config.log_debug)
-		od_debug(&instance->logger, "main", client, server, "%s",
-		         kiwi_fe_type_to_string(type));
+	/* single SELECT statement */
+	if (kiwi_query_classify(query, end - query) != KIWI_QUERY_SELECT)
+		return 0;
+	char *pos = memchr(query, ';', end - query);
+	if (pos && pos != end - 1)
+		return 0;
 
-	switch (type) {
-	case KIWI_FE_COPY_DONE:
-	case KIWI_FE_COPY_FAIL:
-		server->is_copy = 0;
-		break;
-	case KIWI_FE_QUERY:
-		if (instance->config.log_query)
-			od_frontend_log_query(instance, client, data, size);
-	case KIWI_FE_FUNCTION_CALL:
-	case KIWI_FE_SYNC:
-		/* update server sync state */
-		od_server_sync_request(server, 1);
-		break;
-	default:
-		break;
+	/* statements which modify data or take locks, patterns are
+	 * lowercase */
+	int i;
+	for (i = 0; i < rule->storage_read_patterns_count; i++) {
+		char *pattern = rule->storage_read_patterns[i];
+		size_t pattern_len = strlen(pattern);
+		for (pos = query; pos + pattern_len <= end; pos++) {
+			if (strncasecmp(pos, pattern, pattern_len) == 0)
+				return 0;
+		}
 	}
-
-	/* update server stats */
-	od_stat_query_start(&server->stats_state);
-	return OD_OK;
+	return 1;
 }
 
-static void
-od_frontend_remote_server_on_read(od_relay_t *relay, int size)
+static inline int
+od_frontend_read_only(od_rule_t *rule, char *data, int size)
 {
-	od_stat_t *stats = relay->on_read_arg;
-	od_stat_recv_server(stats, size);
+	/* every query pipelined by the client must be read-only, partially
+	 * received queries are routed to the primary storage */
+	if (size == 0)
+		return 0;
+	while (size > 0) {
+		if (size < (int)sizeof(kiwi_header_t) || *data != KIWI_FE_QUERY)
+			return 0;
+		uint32_t packet_size;
+		packet_size = sizeof(uint8_t) + kiwi_read_size(data, size);
+		if (packet_size > (uint32_t)size)
+			return 0;
+		char *query;
+		uint32_t query_len;
+		int rc;
+		rc = kiwi_be_read_query(data, packet_size, &query, &query_len);
+		if (rc == -1)
+			return 0;
+		if (! od_frontend_read_only_query(rule, query, query_len))
+			return 0;
+		data += packet_size;
+		size -= packet_size;
+	}
+	return 1;
 }
 
-static void
-od_frontend_remote_client_on_read(od_relay_t *relay, int size)
+static inline void
+od_frontend_mirror(od_client_t *client, char *data, int size)
 {
-	od_stat_t *stats = relay->on_read_arg;
-	od_stat_recv_client(stats, size);
+	od_rule_t *rule = client->rule;
+	if (rule->storage_mirror_sample > 1 &&
+	    machine_lrand48() % rule->storage_mirror_sample != 0)
+		return;
+
+	/* queries larger than the collected packet limit are skipped */
+	uint32_t packet_size;
+	packet_size = sizeof(uint8_t) + kiwi_read_size(data, size);
+	if (packet_size > (uint32_t)size)
+		return;
+	char *query;
+	uint32_t query_len;
+	int rc;
+	rc = kiwi_be_read_query(data, packet_size, &query, &query_len);
+	if (rc == -1)
+		return;
+	if (! od_frontend_read_only_query(rule, query, query_len))
+		return;
+	od_mirror_query(client, data, packet_size);
 }
 
-static od_status_t
-od_frontend_ctl(od_client_t *client)
+static inline od_status_t
+od_frontend_route_statement(od_client_t *client)
 {
-	uint32_t op = od_client_ctl_of(client);
-	if (op & OD_CLIENT_OP_KILL)
+	/* choose route for the next transaction by the queries already
+	 * sent by the client */
+	od_router_t *router = client->global->router;
+	od_relay_t *relay = &client->relay;
+	od_readahead_t *readahead = &client->io.readahead;
+	if (relay->packet == 0 && od_readahead_unread(readahead) == 0) {
+		od_status_t status;
+		status = od_relay_read(relay);
+		if (status != OD_OK)
+			return status;
+	}
+	od_route_t *route = client->route_write;
+	if (relay->packet == 0 && od_readahead_unread(readahead) > 0 &&
+	    od_frontend_read_only(client->rule, od_readahead_pos_read(readahead),
+	                          od_readahead_unread(readahead)))
+		route = client->route_read;
+	od_router_reroute(router, client, route);
+	return OD_OK;
+}
+
+static inline void
+od_frontend_query_cache_stop(od_client_t *client)
+{
+	if (client->query_cache_reply) {
+		machine_msg_free(client->query_cache_reply);
+		client->query_cache_reply = NULL;
+	}
+	client->query_cache_id = -1;
+	od_server_t *server = client->server;
+	if (server) {
+		server->relay.packet_full_max = 0;
+		od_frontend_relay_mask(client, server);
+	}
+}
+
+static inline void
+od_frontend_query_cache_start(od_client_t *client, od_server_t *server,
+                              char *data, int size)
+{
+	/* a query pipelined after the cached one */
+	if (client->query_cache_id != -1) {
+		od_frontend_query_cache_stop(client);
+		return;
+	}
+
+	/* next ReadyForQuery of the server must be the reply to this
+	 * query, outside of a transaction */
+	if (! od_server_synchronized(server) || server->sync_pending ||
+	    server->is_transaction)
+		return;
+	if ((uint32_t)size != sizeof(uint8_t) + kiwi_read_size(data, size))
+		return;
+	char *query;
+	uint32_t query_len;
+	int rc;
+	rc = kiwi_be_read_query(data, size, &query, &query_len);
+	if (rc == -1)
+		return;
+	int id;
+	id = od_query_cache_match(&client->rule->query_cache_replies, query,
+	                          query_len);
+	if (id == -1)
+		return;
+	client->query_cache_id = id;
+	server->relay.packet_full_max = client->rule->query_cache_size;
+	od_frontend_relay_mask(client, server);
+}
+
+static inline void
+od_frontend_query_cache_collect(od_client_t *client, char *data, int size)
+{
+	od_rule_t *rule = client->rule;
+	kiwi_be_type_t type = *data;
+	int rc;
+	switch (type) {
+	case KIWI_BE_ROW_DESCRIPTION:
+	case KIWI_BE_DATA_ROW:
+	case KIWI_BE_COMMAND_COMPLETE:
+		break;
+	case KIWI_BE_READY_FOR_QUERY:
+		if (client->query_cache_reply &&
+		    size == sizeof(kiwi_header_t) + sizeof(uint8_t) &&
+		    data[sizeof(kiwi_header_t)] == 'I') {
+			uint64_t expire = machine_time_ms() + rule->query_cache_ttl;
+			od_query_cache_set(&rule->query_cache_replies,
+			                   client->query_cache_id,
+			                   machine_msg_data(client->query_cache_reply),
+			                   machine_msg_size(client->query_cache_reply),
+			                   expire);
+		}
+		od_frontend_query_cache_stop(client);
+		return;
+	default:
+		/* errors, notices and parameter changes are not cached */
+		od_frontend_query_cache_stop(client);
+		return;
+	}
+
+	/* packets larger than query_cache_size are relayed in parts */
+	if ((uint32_t)size != sizeof(uint8_t) + kiwi_read_size(data, size)) {
+		od_frontend_query_cache_stop(client);
+		return;
+	}
+	if (client->query_cache_reply == NULL) {
+		client->query_cache_reply = machine_msg_create(0);
+		if (client->query_cache_reply == NULL) {
+			od_frontend_query_cache_stop(client);
+			return;
+		}
+	}
+	if (machine_msg_size(client->query_cache_reply) + size > rule->query_cache_size) {
+		od_frontend_query_cache_stop(client);
+		return;
+	}
+	rc = machine_msg_write(client->query_cache_reply, data, size);
+	if (rc == -1)
+		od_frontend_query_cache_stop(client);
+}
+
+static inline void
+od_frontend_track_reset(od_client_t *client, od_server_t *server,
+                        char *data, int size)
+{
+	/* session state the message may leave on the server, a
+	 * message relayed in parts is not classified */
+	kiwi_fe_type_t type = *data;
+	if ((uint32_t)size != sizeof(uint8_t) + kiwi_read_size(data, size)) {
+		server->is_dirty |= OD_RESET_ALL;
+		return;
+	}
+	char *query;
+	uint32_t query_len;
+	int rc;
+	switch (type) {
+	case KIWI_FE_QUERY:
+		rc = kiwi_be_read_query(data, size, &query, &query_len);
+		break;
+	case KIWI_FE_PARSE:
+	{
+		char *name;
+		uint32_t name_len;
+		rc = kiwi_be_read_parse(data, size, &name, &name_len,
+		                        &query, &query_len);
+		/* statements of pool_prepared_statements are kept */
+		if (rc == 0 && name_len > 1 && !client->rule->pool_prepared_statements)
+			server->is_dirty |= OD_RESET_PREPARE;
+		break;
+	}
+	default:
+		rc = -1;
+		break;
+	}
+	if (rc == -1) {
+		server->is_dirty |= OD_RESET_ALL;
+		return;
+	}
+	od_reset_track(server, query, query_len);
+}
+
+static inline void
+od_frontend_track_set_start(od_client_t *client, od_server_t *server,
+                            char *data, int size)
+{
+	/* SET or RESET sent alone outside of a transaction, the next
+	 * ReadyForQuery of the server after the deploy replies is the
+	 * reply to it */
+	client->track_set = 0;
+	if (server->sync_request - server->sync_reply != (uint64_t)server->deploy_sync ||
+	    server->sync_pending || server->is_transaction)
+		return;
+	if ((uint32_t)size != sizeof(uint8_t) + kiwi_read_size(data, size))
+		return;
+	char *query;
+	uint32_t query_len;
+	int rc;
+	rc = kiwi_be_read_query(data, size, &query, &query_len);
+	if (rc == -1)
+		return;
+	rc = kiwi_query_read_set(query, query_len, &client->track_set_query);
+	if (rc == -1)
+		return;
+	client->track_set = 1;
+}
+
+static inline void
+od_frontend_track_set_end(od_client_t *client, od_server_t *server)
+{
+	/* parameter is set on the server, record it for the client,
+	 * server reports the standard parameters by itself */
+	od_instance_t *instance = client->global->instance;
+	kiwi_query_set_t *set = &client->track_set_query;
+	client->track_set = 0;
+	if (server->is_transaction)
+		return;
+	int rc = 0;
+	if (set->name_len == 0) {
+		kiwi_vars_extra_reset(&client->vars);
+		kiwi_vars_extra_reset(&server->vars);
+	} else
+	if (kiwi_vars_find(&client->vars, set->name, set->name_len) != KIWI_VAR_UNDEF) {
+		return;
+	} else
+	if (set->type == KIWI_QUERY_SET) {
+		rc = kiwi_vars_extra_set(&client->vars, set->name, set->name_len,
+		                         set->value, set->value_len);
+		if (rc == 0)
+			rc = kiwi_vars_extra_set(&server->vars, set->name, set->name_len,
+			                         set->value, set->value_len);
+	} else {
+		kiwi_var_t *var;
+		var = kiwi_vars_extra_find(&client->vars, set->name, set->name_len);
+		if (var && var->type == KIWI_VAR_EXTRA)
+			kiwi_vars_extra_unset(&client->vars, var);
+		var = kiwi_vars_extra_find(&server->vars, set->name, set->name_len);
+		if (var && var->type == KIWI_VAR_EXTRA)
+			kiwi_vars_extra_unset(&server->vars, var);
+	}
+	if (rc == -1) {
+		/* value is too long to be restored, leave it to the
+		 * server reset */
+		od_log(&instance->logger, "main", client, server,
+		       "failed to track parameter %s", set->name);
+		return;
+	}
+	if (server->deploy_hash)
+		server->deploy_hash = client->vars.hash;
+}
+
+static inline od_status_t
+od_frontend_read_pending(od_client_t *client)
+{
+	/* read queries of the client which is not attached, the wait
+	 * is skipped if nothing is received yet */
+	od_relay_t *relay = &client->relay;
+	od_readahead_t *readahead = &client->io.readahead;
+	if (od_readahead_unread(readahead) > 0)
+		return OD_OK;
+	od_status_t status;
+	status = od_relay_read(relay);
+	if (status != OD_OK)
+		return status;
+	if (od_readahead_unread(readahead) > 0)
+		return OD_OK;
+	/* wait for the next query */
+	od_readahead_reuse(readahead);
+	machine_cond_try(relay->src->on_read);
+	return OD_SKIP;
+}
+
+static inline od_status_t
+od_frontend_query_cache(od_client_t *client)
+{
+	/* reply to cached queries received before attach, without
+	 * server connection */
+	od_instance_t *instance = client->global->instance;
+	od_rule_t *rule = client->rule;
+	od_relay_t *relay = &client->relay;
+	od_readahead_t *readahead = &client->io.readahead;
+	od_status_t status;
+	int rc;
+
+	/* reply of a closed server connection was collected */
+	if (client->query_cache_id != -1)
+		od_frontend_query_cache_stop(client);
+
+	for (;;)
+	{
+		if (relay->packet != 0)
+			return OD_OK;
+		status = od_frontend_read_pending(client);
+		if (status != OD_OK)
+			return status;
+		int unread = od_readahead_unread(readahead);
+		char *data = od_readahead_pos_read(readahead);
+		if (unread < (int)sizeof(kiwi_header_t) || *data != KIWI_FE_QUERY)
+			return OD_OK;
+		uint32_t packet_size;
+		packet_size = sizeof(uint8_t) + kiwi_read_size(data, unread);
+		if (packet_size > (uint32_t)unread)
+			return OD_OK;
+		char *query;
+		uint32_t query_len;
+		rc = kiwi_be_read_query(data, packet_size, &query, &query_len);
+		if (rc == -1)
+			return OD_OK;
+		int id;
+		id = od_query_cache_match(&rule->query_cache_replies, query, query_len);
+		if (id == -1)
+			return OD_OK;
+		machine_msg_t *msg;
+		msg = od_query_cache_get(&rule->query_cache_replies, id,
+		                         machine_time_ms());
+		if (msg == NULL)
+			return OD_OK;
+		msg = kiwi_be_write_ready(msg, 'I');
+		if (msg == NULL)
+			return OD_EOOM;
+		if (instance->config.log_debug)
+			od_debug(&instance->logger, "main", client, NULL,
+			         "query cache hit: %.*s", query_len, query);
+		rc = od_write(&client->io, msg);
+		if (rc == -1)
+			return OD_ECLIENT_WRITE;
+		od_readahead_pos_read_advance(readahead, packet_size);
+	}
+}
+
+static inline od_status_t
+od_frontend_listen(od_client_t *client)
+{
+	/* LISTEN and UNLISTEN received before attach are served by
+	 * the notification hub of the route */
+	od_instance_t *instance = client->global->instance;
+	od_relay_t *relay = &client->relay;
+	od_readahead_t *readahead = &client->io.readahead;
+	od_status_t status;
+	int rc;
+	for (;;)
+	{
+		if (relay->packet != 0)
+			return OD_OK;
+		status = od_frontend_read_pending(client);
+		if (status != OD_OK)
+			return status;
+		int unread = od_readahead_unread(readahead);
+		char *data = od_readahead_pos_read(readahead);
+		if (unread < (int)sizeof(kiwi_header_t) || *data != KIWI_FE_QUERY)
+			return OD_OK;
+		uint32_t packet_size;
+		packet_size = sizeof(uint8_t) + kiwi_read_size(data, unread);
+		if (packet_size > (uint32_t)unread)
+			return OD_OK;
+		char *query;
+		uint32_t query_len;
+		rc = kiwi_be_read_query(data, packet_size, &query, &query_len);
+		if (rc == -1)
+			return OD_OK;
+		char name[OD_LISTEN_NAME_MAX];
+		int  name_len;
+		int  unlisten;
+		rc = od_listen_parse(query, query_len, &unlisten, name, &name_len);
+		if (rc == -1)
+			return OD_OK;
+		if (instance->config.log_debug)
+			od_debug(&instance->logger, "main", client, NULL,
+			         "listen: %.*s", query_len, query);
+
+		machine_msg_t *msg;
+		if (unlisten) {
+			od_listen_unsubscribe(client, name_len ? name : NULL, name_len);
+			msg = kiwi_be_write_complete(NULL, "UNLISTEN", 9);
+		} else {
+			status = od_listen_subscribe(client, name, name_len);
+			if (status == OD_ESERVER_CONNECT) {
+				msg = od_frontend_errorf(client, NULL, KIWI_CONNECTION_FAILURE,
+				                         "notification hub is not available");
+			} else
+			if (status != OD_OK) {
+				return status;
+			} else {
+				msg = kiwi_be_write_complete(NULL, "LISTEN", 7);
+			}
+		}
+		if (msg == NULL)
+			return OD_EOOM;
+		msg = kiwi_be_write_ready(msg, 'I');
+		if (msg == NULL)
+			return OD_EOOM;
+		rc = od_write(&client->io, msg);
+		if (rc == -1)
+			return OD_ECLIENT_WRITE;
+		od_readahead_pos_read_advance(readahead, packet_size);
+	}
+}
+
+static inline od_status_t
+od_frontend_walrelay(od_client_t *client)
+{
+	/* IDENTIFY_SYSTEM and START_REPLICATION received before attach
+	 * are served by the wal relay of the route, anything else gets
+	 * a server connection */
+	od_instance_t *instance = client->global->instance;
+	od_relay_t *relay = &client->relay;
+	od_readahead_t *readahead = &client->io.readahead;
+	od_status_t status;
+	int rc;
+	for (;;)
+	{
+		if (relay->packet != 0)
+			return OD_OK;
+		status = od_frontend_read_pending(client);
+		if (status != OD_OK)
+			return status;
+		int unread = od_readahead_unread(readahead);
+		char *data = od_readahead_pos_read(readahead);
+		uint32_t packet_size = 0;
+		if (unread >= (int)sizeof(kiwi_header_t))
+			packet_size = sizeof(uint8_t) + kiwi_read_size(data, unread);
+		if (packet_size == 0 || packet_size > (uint32_t)unread) {
+			/* wait for the rest of the packet */
+			if (od_readahead_left(readahead) == 0)
+				goto attach;
+			status = od_relay_read(relay);
+			if (status != OD_OK)
+				return status;
+			return OD_SKIP;
+		}
+
+		od_walrelay_sub_t *sub = client->wal_sub;
+		if (sub && sub->state == OD_WALRELAY_SUB_STREAM) {
+			switch (*data) {
+			case KIWI_FE_COPY_DATA:
+				od_walrelay_feedback(client, data, packet_size);
+				break;
+			case KIWI_FE_COPY_DONE:
+				status = od_walrelay_stop(client);
+				if (status != OD_OK)
+					return status;
+				break;
+			case KIWI_FE_TERMINATE:
+				return OD_STOP;
+			default:
+				od_frontend_error(client, KIWI_PROTOCOL_VIOLATION,
+				                  "unexpected message type 0x%02x during replication",
+				                  (uint8_t)*data);
+				return OD_STOP;
+			}
+			od_readahead_pos_read_advance(readahead, packet_size);
+			continue;
+		}
+		if (sub && *data == KIWI_FE_TERMINATE)
+			return OD_STOP;
+		if (*data != KIWI_FE_QUERY)
+			goto attach;
+
+		char *query;
+		uint32_t query_len;
+		rc = kiwi_be_read_query(data, packet_size, &query, &query_len);
+		if (rc == -1)
+			goto attach;
+		int start;
+		uint64_t lsn;
+		uint32_t tli;
+		rc = od_walrelay_parse(query, query_len, &start, &lsn, &tli);
+		if (rc == -1)
+			goto attach;
+		if (start)
+			status = od_walrelay_start(client, lsn, tli);
+		else
+			status = od_walrelay_identify(client);
+		if (status == OD_SKIP)
+			return OD_SKIP;
+		if (status == OD_ESERVER_CONNECT)
+			goto attach;
+		if (status != OD_OK)
+			return status;
+		if (instance->config.log_debug)
+			od_debug(&instance->logger, "main", client, NULL,
+			         "wal relay: %.*s", query_len, query);
+		od_readahead_pos_read_advance(readahead, packet_size);
+	}
+
+attach:
+	/* the client stays on its server connection from now on */
+	od_walrelay_unsubscribe(client);
+	return OD_OK;
+}
+
+static inline int
+od_frontend_pipeline_size(od_rule_t *rule, char *data, int size)
+{
+	/* size of the autocommit read-only request of unnamed statement
+	 * and portal: Parse, Bind, optional Describe, Execute and Sync,
+	 * zero if the request can not be pipelined */
+	int pos = 0;
+	int step = 0;
+	while (pos < size && pos <= OD_PIPELINE_REQUEST_MAX)
+	{
+		char *packet = data + pos;
+		int left = size - pos;
+		if (left < (int)sizeof(kiwi_header_t))
+			return 0;
+		uint32_t packet_size;
+		packet_size = sizeof(uint8_t) + kiwi_read_size(packet, left);
+		if (packet_size > (uint32_t)left)
+			return 0;
+		char *body = packet + sizeof(kiwi_header_t);
+		int body_size = packet_size - sizeof(kiwi_header_t);
+		switch (*packet) {
+		case KIWI_FE_PARSE:
+		{
+			if (step != 0)
+				return 0;
+			char *name;
+			uint32_t name_len;
+			char *query;
+			uint32_t query_len;
+			int rc;
+			rc = kiwi_be_read_parse(packet, packet_size, &name, &name_len,
+			                        &query, &query_len);
+			if (rc == -1 || name_len != 1)
+				return 0;
+			if (! od_frontend_read_only_query(rule, query, query_len))
+				return 0;
+			step = 1;
+			break;
+		}
+		case KIWI_FE_BIND:
+			/* unnamed portal and statement */
+			if (step != 1 || body_size < 2 || body[0] != 0 || body[1] != 0)
+				return 0;
+			step = 2;
+			break;
+		case KIWI_FE_DESCRIBE:
+			if (step != 2 || body_size < 2 || body[1] != 0)
+				return 0;
+			step = 3;
+			break;
+		case KIWI_FE_EXECUTE:
+			if ((step != 2 && step != 3) || body_size < 1 || body[0] != 0)
+				return 0;
+			step = 4;
+			break;
+		case KIWI_FE_SYNC:
+			if (step != 4)
+				return 0;
+			pos += packet_size;
+			if (pos > OD_PIPELINE_REQUEST_MAX)
+				return 0;
+			return pos;
+		default:
+			return 0;
+		}
+		pos += packet_size;
+	}
+	return 0;
+}
+
+static inline od_status_t
+od_frontend_pipeline(od_client_t *client)
+{
+	/* requests received before attach are sent to the route
+	 * pipeline shared with other clients */
+	od_relay_t *relay = &client->relay;
+	od_readahead_t *readahead = &client->io.readahead;
+	od_status_t status;
+	for (;;)
+	{
+		if (relay->packet != 0)
+			return OD_OK;
+		status = od_frontend_read_pending(client);
+		if (status != OD_OK)
+			return status;
+		int size;
+		size = od_frontend_pipeline_size(client->rule,
+		                                 od_readahead_pos_read(readahead),
+		                                 od_readahead_unread(readahead));
+		if (size == 0)
+			return OD_OK;
+		status = od_pipeline_request(client, od_readahead_pos_read(readahead),
+		                             size);
+		if (status == OD_UNDEF)
+			return OD_OK;
+		if (status != OD_OK)
+			return status;
+		od_readahead_pos_read_advance(readahead, size);
+	}
+}
+
+static inline void
+od_frontend_log_query_end(od_instance_t *instance, od_client_t *client,
+                          int64_t query_time)
+{
+	od_route_t *route = client->route;
+	int64_t min_duration = route->rule->log_query_min_duration * 1000ll;
+	if (query_time >= min_duration && od_route_log_query(route)) {
+		od_log(&instance->logger, "query", client, NULL,
+		       "%.*s (duration: %" PRId64 " usec)",
+		       client->log_query_len, client->log_query, query_time);
+	}
+	client->log_query_len = 0;
+}
+
+/* charge coroutine run time since the last sample to the client
+ * and its route, samples restart on a new coroutine after the
+ * client moves to another worker */
+static inline void
+od_frontend_account(od_client_t *client)
+{
+	uint64_t time_run, time_wait, count_switch;
+	int rc;
+	rc = machine_stat_coroutine(&time_run, &time_wait, &count_switch);
+	if (rc == -1)
+		return;
+	uint64_t time_diff   = time_run - client->cpu_sample_time;
+	uint64_t wait_diff   = time_wait - client->cpu_sample_wait;
+	uint64_t switch_diff = count_switch - client->cpu_sample_switch;
+	client->cpu_sample_time   = time_run;
+	client->cpu_sample_wait   = time_wait;
+	client->cpu_sample_switch = count_switch;
+	client->cpu_time   += time_diff;
+	client->cpu_wait   += wait_diff;
+	client->cpu_switch += switch_diff;
+	od_route_t *route = client->route;
+	od_stat_cpu(od_route_stat(route, client->worker_id),
+	            time_diff, wait_diff, switch_diff);
+}
+
+static inline void
+od_frontend_top(od_client_t *client, uint64_t query_time)
+{
+	od_worker_t *worker;
+	worker = od_worker_pool_get(client->global->worker_pool,
+	                            client->worker_id);
+	if (! od_top_enabled(&worker->top))
+		return;
+	uint64_t weights[OD_TOP_WEIGHT_MAX];
+	weights[OD_TOP_COUNT] = 1;
+	weights[OD_TOP_BYTES] = client->top_bytes - client->top_bytes_start;
+	weights[OD_TOP_TIME]  = query_time;
+	client->top_bytes_start = client->top_bytes;
+
+	if (client->top_query) {
+		od_top_add(&worker->top, OD_TOP_QUERY, client->top_query,
+		           client->top_query_text, client->top_query_len,
+		           weights);
+		client->top_query = 0;
+	}
+
+	/* clients are tracked by address without port */
+	if (client->top_addr_len == 0) {
+		od_getpeername(client->io.io, client->top_addr,
+		               sizeof(client->top_addr), 1, 0);
+		client->top_addr_len = strlen(client->top_addr);
+	}
+	od_top_add(&worker->top, OD_TOP_CLIENT,
+	           od_top_key(client->top_addr, client->top_addr_len),
+	           client->top_addr, client->top_addr_len, weights);
+
+	char *user = client->startup.user.value;
+	int user_len = client->startup.user.value_len;
+	if (user_len > 0 && user[user_len - 1] == 0)
+		user_len--;
+	od_top_add(&worker->top, OD_TOP_USER, od_top_key(user, user_len),
+	           user, user_len, weights);
+}
+
+static od_always_inline od_status_t
+od_frontend_remote_server_packet(od_relay_t *relay, char *data, int size,
+                                 int features)
+{
+	od_client_t *client = relay->on_packet_arg;
+	od_server_t *server = client->server;
+	od_route_t *route = client->route;
+	od_instance_t *instance = client->global->instance;
+
+	kiwi_be_type_t type = *data;
+	if ((features & OD_FRONTEND_DEBUG) && instance->config.log_debug)
+		od_debug(&instance->logger, "main", client, server, "%s",
+		         kiwi_be_type_to_string(type));
+
+	int is_deploy = od_server_in_deploy(server);
+	int is_ready_for_query = 0;
+
+	if ((features & OD_FRONTEND_SPANS) && !is_deploy) {
+		od_span_query_response(client);
+		if (! instance->config.log_debug && client->query_cache_id == -1)
+			od_relay_mask_unset(relay, KIWI_BE_DATA_ROW);
+	}
+
+	if ((features & OD_FRONTEND_QUERY_CACHE) &&
+	    client->query_cache_id != -1 && !is_deploy)
+		od_frontend_query_cache_collect(client, data, size);
+
+	int rc;
+	switch (type) {
+	case KIWI_BE_ERROR_RESPONSE:
+		if (od_relay_packet_partial(relay))
+			od_error(&instance->logger, "main", client, server,
+			         "error message from server is too large to log");
+		else
+			od_backend_error(server, "main", data, size);
+		od_prepared_server_error(&server->prepared, server->sync_reply);
+		if (! is_deploy)
+			client->track_set = 0;
+		break;
+	case KIWI_BE_PARSE_COMPLETE:
+	case KIWI_BE_CLOSE_COMPLETE:
+	{
+		od_prepared_action_t action;
+		action = od_prepared_server_reply(&server->prepared, type);
+		if (action == OD_PREPARED_REPLY_SKIP)
+			return OD_SKIP;
+		if (action == OD_PREPARED_REPLY_REWRITE)
+			*data = KIWI_BE_PARSE_COMPLETE;
+		break;
+	}
+	case KIWI_BE_PARAMETER_STATUS:
+		if (od_relay_packet_partial(relay))
+			break;
+		rc = od_backend_update_parameter(server, "main", data, size, 0);
+		if (rc == -1)
+			return relay->error_read;
+		break;
+	case KIWI_BE_COPY_IN_RESPONSE:
+	case KIWI_BE_COPY_OUT_RESPONSE:
+		server->is_copy = 1;
+		server->stats_state.query_type = OD_STAT_QUERY_COPY;
+		od_frontend_relay_splice(client, server);
+		break;
+	case KIWI_BE_COPY_DONE:
+		server->is_copy = 0;
+		od_frontend_relay_splice(client, server);
+		break;
+	case KIWI_BE_READY_FOR_QUERY:
+	{
+		is_ready_for_query = 1;
+		od_backend_ready(server, data, size);
+
+		/* replies to configuration deploy are not part of the
+		 * client query */
+		if (is_deploy) {
+			server->deploy_sync--;
+			if (! od_server_in_deploy(server)) {
+				od_frontend_relay_mask(client, server);
+				if (features & OD_FRONTEND_SPANS)
+					od_span_deploy(client);
+			}
+			break;
+		}
+
+		/* update server stats */
+		uint64_t query_start = server->stats_state.query_time_start;
+		int64_t query_time = 0;
+		od_stat_query_end(od_route_stat(route, client->worker_id),
+		                  &server->stats_state,
+		                  server->is_transaction,
+		                  server->relay.write_wait_time,
+		                  &query_time);
+		if (query_time > 0)
+			od_client_wait_at(client, OD_CLIENT_WAIT_CLIENT,
+			                  query_start + query_time);
+		if ((features & OD_FRONTEND_DEBUG) && instance->config.log_debug &&
+		    query_time > 0) {
+			od_debug(&instance->logger, "main", server->client, server,
+			         "query time: %d microseconds",
+			          query_time);
+		}
+		if (features & OD_FRONTEND_QUERY_STATS) {
+			if (client->fingerprint) {
+				if (query_time > 0)
+					od_fingerprint_query(client->fingerprint, query_time);
+				client->fingerprint = NULL;
+			}
+			if (instance->config.top_size && query_time > 0)
+				od_frontend_top(client, query_time);
+		}
+		if ((features & OD_FRONTEND_LOG_QUERY) && client->log_query_len > 0)
+			od_frontend_log_query_end(instance, client, query_time);
+		if ((features & OD_FRONTEND_TRACK_SET) && client->track_set)
+			od_frontend_track_set_end(client, server);
+		if (features & OD_FRONTEND_SPANS)
+			od_span_query_end(client, !server->is_transaction &&
+			                          od_server_synchronized(server) &&
+			                          !server->sync_pending);
+		od_frontend_account(client);
+		od_frontend_passthrough(client, server);
+		break;
+	}
+	default:
+		break;
+	}
+
+	/* discard replies during configuration deploy */
+	if (is_deploy)
+		return OD_SKIP;
+
+	/* handle transaction pooling
+	 *
+	 * Client may pipeline several batches, server is released
+	 * only after ReadyForQuery of the last Sync sent and when
+	 * no extended query messages are waiting for Sync.
+	 *
+	 * In statement pooling a transaction block left open by the
+	 * statement terminates the client, the server is rolled back
+	 * by reset.
+	 */
+	if ((features & OD_FRONTEND_TRANSACTION) && is_ready_for_query) {
+		if (route->id.physical_rep || route->id.logical_rep)
+			return OD_OK;
+		if (route->rule->pool == OD_RULE_POOL_STATEMENT &&
+		    server->is_transaction)
+			return OD_ESTATEMENT_TRANSACTION;
+		if (!server->is_transaction &&
+		    od_server_synchronized(server) && !server->sync_pending) {
+			return OD_DETACH;
+		}
+	}
+
+	return OD_OK;
+}
+
+static inline void
+od_frontend_prepared_name(char *dest, uint64_t hash)
+{
+	od_snprintf(dest, OD_PREPARED_NAME_SIZE, OD_PREPARED_PREFIX "%016" PRIx64,
+	            hash);
+}
+
+static inline od_status_t
+od_frontend_prepared_push(od_server_t *server, uint8_t type,
+                          od_prepared_action_t action, uint64_t hash)
+{
+	int rc;
+	rc = od_prepared_server_push(&server->prepared, type, action, hash,
+	                             server->sync_request);
+	if (rc == -1)
+		return OD_EOOM;
+	return OD_OK;
+}
+
+static inline od_status_t
+od_frontend_prepared_send(od_relay_t *relay, machine_msg_t *msg)
+{
+	if (msg == NULL)
+		return OD_EOOM;
+	int rc;
+	rc = machine_iov_add(relay->iov, msg);
+	if (rc == -1) {
+		machine_msg_free(msg);
+		return OD_EOOM;
+	}
+	return OD_SKIP;
+}
+
+static inline od_status_t
+od_frontend_prepared_add(od_client_t *client, od_server_t *server,
+                         od_relay_t *relay, uint64_t hash)
+{
+	od_route_t *route = client->route;
+	uint64_t evicted;
+	int rc;
+	rc = od_prepared_server_add(&server->prepared, hash,
+	                            route->rule->pool_prepared_statements_max,
+	                            &evicted);
+	if (rc == -1)
+		return OD_EOOM;
+	if (! evicted)
+		return OD_OK;
+
+	/* close least recently used statement on server */
+	char name[OD_PREPARED_NAME_SIZE];
+	od_frontend_prepared_name(name, evicted);
+	machine_msg_t *msg;
+	msg = kiwi_fe_write_close(NULL, 'S', name, sizeof(name));
+	od_status_t status;
+	status = od_frontend_prepared_send(relay, msg);
+	if (status != OD_SKIP)
+		return status;
+	return od_frontend_prepared_push(server, KIWI_BE_CLOSE_COMPLETE,
+	                                 OD_PREPARED_REPLY_SKIP, 0);
+}
+
+/* statement is parsed again on server connection which does
+ * not have it yet, client does not expect ParseComplete for it */
+static inline od_status_t
+od_frontend_prepared_ensure(od_client_t *client, od_server_t *server,
+                            od_relay_t *relay, od_prepared_t *prepared)
+{
+	if (od_prepared_server_has(&server->prepared, prepared->hash))
+		return OD_OK;
+
+	od_status_t status;
+	status = od_frontend_prepared_add(client, server, relay, prepared->hash);
+	if (status != OD_OK)
+		return status;
+
+	machine_msg_t *msg;
+	msg = machine_msg_create(prepared->parse_size);
+	if (msg == NULL)
+		return OD_EOOM;
+	memcpy(machine_msg_data(msg), prepared->parse, prepared->parse_size);
+	status = od_frontend_prepared_send(relay, msg);
+	if (status != OD_SKIP)
+		return status;
+	return od_frontend_prepared_push(server, KIWI_BE_PARSE_COMPLETE,
+	                                 OD_PREPARED_REPLY_SKIP,
+	                                 prepared->hash);
+}
+
+static inline od_status_t
+od_frontend_prepared_parse(od_client_t *client, od_server_t *server,
+                           od_relay_t *relay, char *data, int size)
+{
+	char *name;
+	uint32_t name_len;
+	char *query;
+	uint32_t query_len;
+	int rc;
+	rc = kiwi_be_read_parse(data, size, &name, &name_len, &query, &query_len);
+	if (rc == -1)
+		return OD_OK;
+
+	/* unnamed statement is passed as is */
+	if (name_len == 1)
+		return od_frontend_prepared_push(server, KIWI_BE_PARSE_COMPLETE,
+		                                 OD_PREPARED_REPLY_PASS, 0);
+
+	/* server statement is identified by query and parameter types */
+	int body_size = size - (query - data);
+	uint64_t hash = od_prepared_hash(query, body_size);
+
+	int parse_size = sizeof(kiwi_header_t) + OD_PREPARED_NAME_SIZE + body_size;
+	machine_msg_t *msg;
+	msg = machine_msg_create(parse_size);
+	if (msg == NULL)
+		return OD_EOOM;
+	char *pos = machine_msg_data(msg);
+	kiwi_write8(&pos, KIWI_FE_PARSE);
+	kiwi_write32(&pos, parse_size - sizeof(uint8_t));
+	od_frontend_prepared_name(pos, hash);
+	pos += OD_PREPARED_NAME_SIZE;
+	kiwi_write(&pos, query, body_size);
+
+	od_prepared_t *prepared;
+	prepared = od_prepared_client_add(&client->prepared, name, name_len, hash,
+	                                  machine_msg_data(msg), parse_size);
+	if (prepared == NULL) {
+		machine_msg_free(msg);
+		return OD_EOOM;
+	}
+
+	od_status_t status;
+	if (od_prepared_server_has(&server->prepared, hash)) {
+		/* statement is already prepared on server, close of
+		 * unknown statement is used to reply with ParseComplete
+		 * in order with other replies */
+		machine_msg_free(msg);
+		msg = kiwi_fe_write_close(NULL, 'S', OD_PREPARED_NOOP,
+		                          sizeof(OD_PREPARED_NOOP));
+		status = od_frontend_prepared_send(relay, msg);
+		if (status != OD_SKIP)
+			return status;
+		status = od_frontend_prepared_push(server, KIWI_BE_CLOSE_COMPLETE,
+		                                   OD_PREPARED_REPLY_REWRITE, hash);
+	} else {
+		status = od_frontend_prepared_add(client, server, relay, hash);
+		if (status != OD_OK) {
+			machine_msg_free(msg);
+			return status;
+		}
+		status = od_frontend_prepared_send(relay, msg);
+		if (status != OD_SKIP)
+			return status;
+		status = od_frontend_prepared_push(server, KIWI_BE_PARSE_COMPLETE,
+		                                   OD_PREPARED_REPLY_PASS, hash);
+	}
+	if (status != OD_OK)
+		return status;
+	return OD_SKIP;
+}
+
+static inline od_status_t
+od_frontend_prepared_bind(od_client_t *client, od_server_t *server,
+                          od_relay_t *relay, char *data, int size)
+{
+	uint32_t pos_size = size - sizeof(kiwi_header_t);
+	char *pos = data + sizeof(kiwi_header_t);
+	int rc;
+	char *portal = pos;
+	rc = kiwi_readsz(&pos, &pos_size);
+	if (rc == -1)
+		return OD_OK;
+	int portal_len = pos - portal;
+	char *name = pos;
+	rc = kiwi_readsz(&pos, &pos_size);
+	if (rc == -1)
+		return OD_OK;
+	int name_len = pos - name;
+
+	od_prepared_t *prepared;
+	prepared = od_prepared_client_find(&client->prepared, name, name_len);
+	if (prepared == NULL)
+		return OD_OK;
+
+	od_status_t status;
+	status = od_frontend_prepared_ensure(client, server, relay, prepared);
+	if (status != OD_OK)
+		return status;
+
+	/* parameters of a streamed message follow the rewritten start */
+	int partial = od_relay_packet_partial(relay);
+	int bind_size = size + relay->packet - name_len + OD_PREPARED_NAME_SIZE;
+	int msg_size = bind_size;
+	if (partial)
+		msg_size = pos - data - name_len + OD_PREPARED_NAME_SIZE;
+	machine_msg_t *msg;
+	msg = machine_msg_create(msg_size);
+	if (msg == NULL)
+		return OD_EOOM;
+	char *dest = machine_msg_data(msg);
+	kiwi_write8(&dest, KIWI_FE_BIND);
+	kiwi_write32(&dest, bind_size - sizeof(uint8_t));
+	kiwi_write(&dest, portal, portal_len);
+	od_frontend_prepared_name(dest, prepared->hash);
+	dest += OD_PREPARED_NAME_SIZE;
+	if (! partial) {
+		kiwi_write(&dest, pos, pos_size);
+		return od_frontend_prepared_send(relay, msg);
+	}
+	status = od_frontend_prepared_send(relay, msg);
+	if (status != OD_SKIP)
+		return status;
+	if (pos_size > 0) {
+		rc = machine_iov_add_pointer(relay->iov, pos, pos_size);
+		if (rc == -1)
+			return OD_EOOM;
+	}
+	return OD_REPLACE;
+}
+
+static inline od_status_t
+od_frontend_prepared_describe(od_client_t *client, od_server_t *server,
+                              od_relay_t *relay, char *data, int size)
+{
+	kiwi_fe_type_t type = *data;
+	uint32_t pos_size = size - sizeof(kiwi_header_t);
+	char *pos = data + sizeof(kiwi_header_t);
+	char kind;
+	int rc;
+	rc = kiwi_read8(&kind, &pos, &pos_size);
+	if (rc == -1)
+		goto pass;
+	char *name = pos;
+	rc = kiwi_readsz(&pos, &pos_size);
+	if (rc == -1)
+		goto pass;
+	int name_len = pos - name;
+	if (kind != 'S')
+		goto pass;
+
+	od_prepared_t *prepared;
+	prepared = od_prepared_client_find(&client->prepared, name, name_len);
+	if (prepared == NULL)
+		goto pass;
+
+	machine_msg_t *msg;
+	od_status_t status;
+	if (type == KIWI_FE_CLOSE) {
+		/* server statement can be used by other clients */
+		od_prepared_client_remove(&client->prepared, name, name_len);
+		msg = kiwi_fe_write_close(NULL, 'S', OD_PREPARED_NOOP,
+		                          sizeof(OD_PREPARED_NOOP));
+		status = od_frontend_prepared_send(relay, msg);
+		if (status != OD_SKIP)
+			return status;
+		status = od_frontend_prepared_push(server, KIWI_BE_CLOSE_COMPLETE,
+		                                   OD_PREPARED_REPLY_PASS, 0);
+		if (status != OD_OK)
+			return status;
+		return OD_SKIP;
+	}
+
+	status = od_frontend_prepared_ensure(client, server, relay, prepared);
+	if (status != OD_OK)
+		return status;
+	char server_name[OD_PREPARED_NAME_SIZE];
+	od_frontend_prepared_name(server_name, prepared->hash);
+	msg = kiwi_fe_write_describe(NULL, 'S', server_name, sizeof(server_name));
+	return od_frontend_prepared_send(relay, msg);
+
+pass:
+	if (type == KIWI_FE_CLOSE)
+		return od_frontend_prepared_push(server, KIWI_BE_CLOSE_COMPLETE,
+		                                 OD_PREPARED_REPLY_PASS, 0);
+	return OD_OK;
+}
+
+static inline od_status_t
+od_frontend_prepared(od_client_t *client, od_server_t *server,
+                     od_relay_t *relay, char *data, int size)
+{
+	kiwi_fe_type_t type = *data;
+	switch (type) {
+	case KIWI_FE_PARSE:
+		return od_frontend_prepared_parse(client, server, relay, data, size);
+	case KIWI_FE_BIND:
+		return od_frontend_prepared_bind(client, server, relay, data, size);
+	case KIWI_FE_DESCRIBE:
+	case KIWI_FE_CLOSE:
+		return od_frontend_prepared_describe(client, server, relay, data, size);
+	default:
+		break;
+	}
+	return OD_OK;
+}
+
+static inline void
+od_frontend_fingerprint_start(od_client_t *client, od_server_t *server,
+                              char *data, int size)
+{
+	/* query time is measured from the first message to the next
+	 * ReadyForQuery, it is counted for the first query of it */
+	if (server->stats_state.query_time_start)
+		return;
+	client->fingerprint = NULL;
+	client->top_query = 0;
+	client->top_bytes_start = client->top_bytes;
+	od_worker_t *worker;
+	worker = od_worker_pool_get(client->global->worker_pool,
+	                            client->worker_id);
+	if (! od_fingerprints_enabled(&worker->fingerprints) &&
+	    ! od_top_enabled(&worker->top))
+		return;
+
+	/* start of a streamed packet is normalized */
+	kiwi_fe_type_t type = *data;
+	uint32_t pos_size = size - sizeof(kiwi_header_t);
+	char *pos = data + sizeof(kiwi_header_t);
+	int rc;
+	switch (type) {
+	case KIWI_FE_PARSE:
+		rc = kiwi_readsz(&pos, &pos_size);
+		if (rc == -1)
+			return;
+		break;
+	case KIWI_FE_QUERY:
+		break;
+	default:
+		return;
+	}
+	char text[OD_FINGERPRINT_TEXT];
+	int  text_len;
+	uint64_t hash;
+	hash = od_fingerprint_of(pos, pos_size, text, &text_len);
+	if (od_fingerprints_enabled(&worker->fingerprints))
+		client->fingerprint = od_fingerprints_add(&worker->fingerprints, hash,
+		                                          text, text_len);
+	if (od_top_enabled(&worker->top)) {
+		if (text_len > OD_TOP_TEXT)
+			text_len = OD_TOP_TEXT;
+		memcpy(client->top_query_text, text, text_len);
+		client->top_query_len = text_len;
+		client->top_query = hash;
+	}
+}
+
+static od_always_inline od_status_t
+od_frontend_remote_client_packet(od_relay_t *relay, char *data, int size,
+                                 int features)
+{
+	od_client_t *client = relay->on_packet_arg;
+	od_instance_t *instance = client->global->instance;
+	(void)size;
+
+	kiwi_fe_type_t type = *data;
+	if (od_unlikely(client->capture))
+		od_frontend_capture(client, OD_CAPTURE_MESSAGE, data, size);
+	if (type == KIWI_FE_TERMINATE)
+		return OD_STOP;
+
+	/* get server connection from the route pool and write
+	   configuration */
+	od_server_t *server = client->server;
+	assert(server != NULL);
+
+	if ((features & OD_FRONTEND_DEBUG) && instance->config.log_debug)
+		od_debug(&instance->logger, "main", client, server, "%s",
+		         kiwi_fe_type_to_string(type));
+
+	/* server session state may be changed by the client */
+	if (! client->rule->pool_discard_track)
+		server->is_dirty |= OD_RESET_ALL;
+	else
+	if (type == KIWI_FE_QUERY || type == KIWI_FE_PARSE ||
+	    type == KIWI_FE_FUNCTION_CALL)
+		od_frontend_track_reset(client, server, data, size);
+
+	od_status_t status = OD_OK;
+	od_stat_query_type_t query_type = OD_STAT_QUERY_EXTENDED;
+	switch (type) {
+	case KIWI_FE_COPY_DONE:
+	case KIWI_FE_COPY_FAIL:
+		server->is_copy = 0;
+		od_frontend_relay_splice(client, server);
+		break;
+	case KIWI_FE_QUERY:
+		query_type = OD_STAT_QUERY_SIMPLE;
+		if ((features & OD_FRONTEND_LOG_QUERY) && instance->config.log_query)
+			od_frontend_log_query(instance, client, data, size);
+		if ((features & OD_FRONTEND_QUERY_CACHE) && client->rule->query_cache)
+			od_frontend_query_cache_start(client, server, data, size);
+		if ((features & OD_FRONTEND_TRACK_SET) && client->rule->pool_track_set)
+			od_frontend_track_set_start(client, server, data, size);
+		if ((features & OD_FRONTEND_MIRROR) && client->rule->storage_mirror)
+			od_frontend_mirror(client, data, size);
+		/* fallthrough */
+	case KIWI_FE_FUNCTION_CALL:
+		if (type == KIWI_FE_FUNCTION_CALL)
+			query_type = OD_STAT_QUERY_FUNCTION;
+		/* fallthrough */
+	case KIWI_FE_SYNC:
+		/* update server sync state */
+		od_server_sync_request(server, 1);
+		server->sync_pending = 0;
+		break;
+	case KIWI_FE_PARSE:
+	case KIWI_FE_BIND:
+	case KIWI_FE_DESCRIBE:
+	case KIWI_FE_CLOSE:
+		/* map client statements to the server ones */
+		if (relay->packet_full_extended)
+			status = od_frontend_prepared(client, server, relay, data, size);
+		/* fallthrough */
+	case KIWI_FE_EXECUTE:
+	case KIWI_FE_FLUSH:
+		/* extended query batch is not finished until Sync */
+		server->sync_pending = 1;
+		break;
+	default:
+		break;
+	}
+
+	/* update server stats */
+	if ((features & OD_FRONTEND_QUERY_STATS) &&
+	    (instance->config.query_fingerprint || instance->config.top_size))
+		od_frontend_fingerprint_start(client, server, data, size);
+	if (features & OD_FRONTEND_SPANS) {
+		od_span_query_start(client);
+		od_relay_mask_set(&server->relay, KIWI_BE_DATA_ROW);
+	}
+	od_stat_query_start(&server->stats_state, query_type,
+	                    server->relay.write_wait_time);
+	return status;
+}
+
+/* relay callbacks instantiated with features known at compile time */
+
+static od_status_t
+od_frontend_remote_server(od_relay_t *relay, char *data, int size)
+{
+	return od_frontend_remote_server_packet(relay, data, size,
+	                                        OD_FRONTEND_ALL);
+}
+
+static od_status_t
+od_frontend_remote_server_session(od_relay_t *relay, char *data, int size)
+{
+	return od_frontend_remote_server_packet(relay, data, size, 0);
+}
+
+static od_status_t
+od_frontend_remote_server_transaction(od_relay_t *relay, char *data, int size)
+{
+	return od_frontend_remote_server_packet(relay, data, size,
+	                                        OD_FRONTEND_TRANSACTION);
+}
+
+static od_status_t
+od_frontend_remote_client(od_relay_t *relay, char *data, int size)
+{
+	return od_frontend_remote_client_packet(relay, data, size,
+	                                        OD_FRONTEND_ALL);
+}
+
+static od_status_t
+od_frontend_remote_client_plain(od_relay_t *relay, char *data, int size)
+{
+	return od_frontend_remote_client_packet(relay, data, size, 0);
+}
+
+static void
+od_frontend_remote_server_on_read(od_relay_t *relay, int size)
+{
+	od_stat_t *stats = relay->on_read_arg;
+	od_stat_recv_server(stats, size);
+}
+
+static void
+od_frontend_remote_server_on_read_top(od_relay_t *relay, int size)
+{
+	od_stat_t *stats = relay->on_read_arg;
+	od_stat_recv_server(stats, size);
+	od_client_t *client = relay->on_packet_arg;
+	client->top_bytes += size;
+}
+
+static void
+od_frontend_remote_client_on_read(od_relay_t *relay, int size)
+{
+	od_stat_t *stats = relay->on_read_arg;
+	od_stat_recv_client(stats, size);
+}
+
+static void
+od_frontend_remote_client_on_read_top(od_relay_t *relay, int size)
+{
+	od_stat_t *stats = relay->on_read_arg;
+	od_stat_recv_client(stats, size);
+	od_client_t *client = relay->on_packet_arg;
+	client->top_bytes += size;
+}
+
+static inline int
+od_frontend_relay_features(od_client_t *client, od_rule_t *rule)
+{
+	od_instance_t *instance = client->global->instance;
+	int features = 0;
+	if (instance->config.log_debug)
+		features |= OD_FRONTEND_DEBUG;
+	if (instance->config.log_query)
+		features |= OD_FRONTEND_LOG_QUERY;
+	if (instance->config.query_fingerprint || instance->config.top_size)
+		features |= OD_FRONTEND_QUERY_STATS;
+	if (rule->query_cache)
+		features |= OD_FRONTEND_QUERY_CACHE;
+	if (rule->pool_track_set)
+		features |= OD_FRONTEND_TRACK_SET;
+	if (od_rules_pool_transaction(rule))
+		features |= OD_FRONTEND_TRANSACTION;
+	if (instance->config.span_port)
+		features |= OD_FRONTEND_SPANS;
+	if (rule->storage_mirror)
+		features |= OD_FRONTEND_MIRROR;
+	return features;
+}
+
+static inline void
+od_frontend_relay_limits(od_client_t *client, od_relay_t *relay)
+{
+	od_instance_t *instance = client->global->instance;
+	od_router_t *router = client->global->router;
+	relay->watermark_high = instance->config.relay_watermark_high;
+	relay->watermark_low  = instance->config.relay_watermark_low;
+	relay->memory_total   = &router->relay_memory;
+	relay->memory_max     = instance->config.relay_memory_max;
+	relay->read_budget    = instance->config.relay_read_budget;
+}
+
+static inline void
+od_frontend_relay_spool(od_client_t *client, od_server_t *server)
+{
+	/* results a slow client does not keep up with are spooled, so
+	 * the server is released on ReadyForQuery */
+	od_instance_t *instance = client->global->instance;
+	if (instance->config.relay_spool == 0 ||
+	    ! od_rules_pool_transaction(client->rule))
+		return;
+	client->spool.memory_max      = instance->config.relay_spool_memory;
+	client->spool.dir             = instance->config.relay_spool_dir;
+	server->relay.spool           = &client->spool;
+	server->relay.spool_threshold = instance->config.relay_spool;
+}
+
+static inline od_status_t
+od_frontend_spool_write(od_client_t *client)
+{
+	int rc;
+	rc = od_spool_write(&client->spool, client->io.io);
+	if (rc == -1)
+		return OD_ECLIENT_WRITE;
+	if (od_spool_pending(&client->spool)) {
+		rc = od_io_write_start(&client->io);
+		if (rc == -1)
+			return OD_ECLIENT_WRITE;
+		return OD_OK;
+	}
+	rc = od_io_write_stop(&client->io);
+	if (rc == -1)
+		return OD_ECLIENT_WRITE;
+	/* client data left unread while the spool was drained */
+	machine_cond_signal(client->cond);
+	return OD_OK;
+}
+
+static inline int
+od_frontend_drained(od_client_t *client)
+{
+	/* client can be disconnected without breaking its session
+	 * state only between transactions */
+	if (od_relay_data_pending(&client->relay))
+		return 0;
+	if (od_spool_pending(&client->spool))
+		return 0;
+	od_server_t *server = client->server;
+	if (server == NULL)
+		return 1;
+	if (server->is_passthrough)
+		return 0;
+	return od_server_synchronized(server) &&
+	       !server->sync_pending &&
+	       !server->is_copy &&
+	       !server->is_transaction &&
+	       !od_relay_write_pending(&server->relay);
+}
+
+static inline int
+od_frontend_movable(od_client_t *client)
+{
+	/* client of a removed worker is moved to an active one between
+	 * transactions, when no server connection is attached */
+	od_worker_pool_t *worker_pool = client->global->worker_pool;
+	if (! od_worker_pool_is_removed(worker_pool, client->worker_id))
+		return 0;
+	if (client->server || client->rule->pool_pipeline || client->wal_sub)
+		return 0;
+	if (client->rule->storage->storage_type != OD_RULE_STORAGE_REMOTE)
+		return 0;
+	if (client->relay.packet > 0 || client->relay.packet_skip > 0)
+		return 0;
+	return od_frontend_drained(client);
+}
+
+static od_status_t
+od_frontend_ctl(od_client_t *client)
+{
+	uint32_t op = od_client_ctl_of(client);
+	if (op & OD_CLIENT_OP_KILL)
 	{
 		od_client_ctl_unset(client, OD_CLIENT_OP_KILL);
 		od_client_notify_read(client);
 		return OD_STOP;
 	}
+	if (op & OD_CLIENT_OP_RESTART)
+	{
+		/* notified again by the draining process until the
+		 * client becomes idle */
+		od_client_ctl_unset(client, OD_CLIENT_OP_RESTART);
+		od_client_notify_read(client);
+		if (od_frontend_drained(client))
+			return OD_ECLIENT_RESTART;
+	}
+	if (op & OD_CLIENT_OP_MIGRATE)
+	{
+		/* busy clients are moved on server detach */
+		od_client_ctl_unset(client, OD_CLIENT_OP_MIGRATE);
+		od_client_notify_read(client);
+		if (od_frontend_movable(client))
+			return OD_MIGRATE;
+	}
+	return OD_OK;
+}
+
+static inline void
+od_frontend_release(od_client_t *client)
+{
+	/* client is idle, return relay buffers to the worker and
+	 * unused coroutine stack pages to the system */
+	od_relay_release(&client->relay);
+	if (client->server)
+		od_relay_release(&client->server->relay);
+	machine_stack_release();
+}
+
+static inline int
+od_frontend_idle_timeout(od_client_t *client, od_status_t *status)
+{
+	/* time in milliseconds the client may stay in its current idle
+	 * state, zero if there is no limit or a query is in progress */
+	od_rule_t *rule = client->rule;
+	od_server_t *server = client->server;
+	*status = OD_ECLIENT_IDLE;
+	if (client->wal_sub && client->wal_sub->state == OD_WALRELAY_SUB_STREAM)
+		return 0;
+	if (server == NULL)
+		return rule->client_idle_timeout;
+	if (server->is_passthrough)
+		return 0;
+	if (! od_server_synchronized(server) || server->sync_pending ||
+	    server->is_copy || od_relay_write_pending(&server->relay))
+		return 0;
+	if (server->is_transaction) {
+		*status = OD_ECLIENT_IDLE_IN_TRANSACTION;
+		return rule->client_idle_in_transaction_timeout;
+	}
+	return rule->client_idle_timeout;
+}
+
+static inline od_status_t
+od_frontend_query_timeout(od_client_t *client, uint64_t *start,
+                          uint64_t *sync_reply, int *cancelled,
+                          uint32_t *timeout)
+{
+	/* cancel a query which runs for more than query_timeout, since
+	 * the last reply of pipelined ones, and close the server if it
+	 * does not reply to cancel in query_timeout either */
+	od_instance_t *instance = client->global->instance;
+	od_server_t *server = client->server;
+	if (server == NULL || od_server_synchronized(server)) {
+		*start = 0;
+		*cancelled = 0;
+		return OD_OK;
+	}
+	uint64_t now = machine_time_ms();
+	if (*start == 0 || *sync_reply != server->sync_reply) {
+		*start = now;
+		*sync_reply = server->sync_reply;
+		*cancelled = 0;
+	}
+	uint64_t deadline = *start + client->rule->query_timeout;
+	if (now < deadline) {
+		if (deadline - now < *timeout)
+			*timeout = deadline - now;
+		return OD_OK;
+	}
+	if (*cancelled)
+		return OD_EQUERY_TIMEOUT;
+
+	od_log(&instance->logger, "main", client, server,
+	       "query timeout, cancel");
+	od_route_t *route = client->route;
+	int rc;
+	rc = od_cancel(client->global, od_route_storage(route), server->endpoint,
+	               &server->key, &server->id);
+	if (rc == -1)
+		return OD_EQUERY_TIMEOUT;
+	*start = machine_time_ms();
+	*cancelled = 1;
+	if ((uint32_t)client->rule->query_timeout < *timeout)
+		*timeout = client->rule->query_timeout;
 	return OD_OK;
 }
 
 static od_status_t
 od_frontend_remote(od_client_t *client)
 {
+	od_instance_t *instance = client->global->instance;
 	od_route_t *route = client->route;
 
-	client->cond = machine_cond_create();
-	if (client->cond == NULL)
-		return OD_EOOM;
+	if (client->cond == NULL) {
+		client->cond = machine_cond_create();
+		if (client->cond == NULL)
+			return OD_EOOM;
+	}
 
 	/* enable client notification mechanism */
-	int rc;
-	rc = machine_read_start(client->notify_io, client->cond);
-	if (rc == -1)
-		return OD_ECLIENT_READ;
+	machine_notify_start(client->notify, client->cond);
+	od_client_wait(client, OD_CLIENT_WAIT_CLIENT);
+
+	/* copy data is relayed without callback */
+	if (! instance->config.log_debug)
+		od_relay_mask_unset(&client->relay, KIWI_FE_COPY_DATA);
+
+	/* statements are mapped to server ones in transaction pooling */
+	client->relay.packet_full_extended =
+		od_rules_pool_transaction(route->rule) &&
+		route->rule->pool_prepared_statements;
+	client->relay.packet_full_limit = instance->config.relay_buffer_max;
+	od_frontend_relay_limits(client, &client->relay);
+
+	/* captured messages are passed whole */
+	if (client->capture)
+		client->relay.packet_full_max = OD_CAPTURE_MESSAGE_MAX;
+
+	/* mirrored queries are passed whole */
+	if (route->rule->storage_mirror &&
+	    client->relay.packet_full_max < OD_MIRROR_QUERY_MAX)
+		client->relay.packet_full_max = OD_MIRROR_QUERY_MAX;
+
+	/* specialized callbacks, unless a per packet feature is used */
+	int features = od_frontend_relay_features(client, route->rule);
+	od_relay_on_packet_t on_packet = od_frontend_remote_client_plain;
+	if (features & ~OD_FRONTEND_TRANSACTION)
+		on_packet = od_frontend_remote_client;
+	od_relay_on_read_t on_read = od_frontend_remote_client_on_read;
+	if (instance->config.top_size)
+		on_read = od_frontend_remote_client_on_read_top;
 
 	od_status_t status;
 	status = od_relay_start(&client->relay, client->cond,
 	                        OD_ECLIENT_READ,
 	                        OD_ESERVER_WRITE,
-	                        od_frontend_remote_client_on_read,
-	                        &route->stats,
-	                        od_frontend_remote_client,
+	                        on_read,
+	                        od_route_stat(route, client->worker_id),
+	                        on_packet,
 	                        client);
 	if (status != OD_OK)
 		return status;
 
-	od_server_t *server;
-	for (;;)
-	{
-		machine_cond_wait(client->cond, UINT32_MAX);
+	od_relay_on_packet_t server_on_packet = od_frontend_remote_server;
+	if (! (features & ~OD_FRONTEND_TRANSACTION)) {
+		server_on_packet = od_frontend_remote_server_session;
+		if (features & OD_FRONTEND_TRANSACTION)
+			server_on_packet = od_frontend_remote_server_transaction;
+	}
+	od_relay_on_read_t server_on_read = od_frontend_remote_server_on_read;
+	if (instance->config.top_size)
+		server_on_read = od_frontend_remote_server_on_read_top;
+
+	od_server_t *server;
+	int rc;
+	int released = 0;
+	uint64_t idle_start = 0;
+	uint64_t query_start = 0;
+	uint64_t query_sync = 0;
+	int query_cancelled = 0;
+	for (;;)
+	{
+		uint32_t timeout = UINT32_MAX;
+		if (instance->config.client_idle_release > 0 && !released)
+			timeout = instance->config.client_idle_release;
+
+		/* idle and idle in transaction timeouts, the wait is
+		 * limited by the time left */
+		od_status_t idle_status;
+		int idle_timeout;
+		idle_timeout = od_frontend_idle_timeout(client, &idle_status);
+		if (idle_timeout > 0) {
+			uint64_t now = machine_time_ms();
+			if (idle_start == 0)
+				idle_start = now;
+			uint64_t deadline = idle_start + idle_timeout;
+			if (now >= deadline) {
+				status = idle_status;
+				break;
+			}
+			if (deadline - now < timeout)
+				timeout = deadline - now;
+		} else {
+			idle_start = 0;
+		}
+
+		if (client->rule->query_timeout > 0) {
+			status = od_frontend_query_timeout(client, &query_start,
+			                                   &query_sync,
+			                                   &query_cancelled,
+			                                   &timeout);
+			if (status != OD_OK)
+				break;
+		}
+
+		rc = machine_cond_wait(client->cond, timeout);
+		if (rc == -1) {
+			if (! released)
+				od_frontend_release(client);
+			released = 1;
+			continue;
+		}
+		released = 0;
 
 		/* client operations */
 		status = od_frontend_ctl(client);
 		if (status != OD_OK)
 			break;
 
+		/* notifications are written between transactions */
+		if (client->listen_channel && client->server == NULL) {
+			status = od_listen_deliver(client);
+			if (status != OD_OK)
+				break;
+		}
+
+		/* wal stream of the relay and its pending commands */
+		if (client->wal_sub) {
+			status = od_walrelay_step(client);
+			if (status != OD_OK)
+				break;
+		}
+
+		/* client with a spooled result is not attached to another
+		 * server until the spool is drained */
+		if (od_spool_pending(&client->spool)) {
+			status = od_frontend_spool_write(client);
+			if (status != OD_OK)
+				break;
+			if (client->server == NULL &&
+			    od_spool_pending(&client->spool))
+				continue;
+		}
+
 		server = client->server;
 		/* attach */
 		status = od_relay_step(&client->relay);
 		if (status == OD_ATTACH)
 		{
 			assert(server == NULL);
+			if (client->rule->pool_wal_relay &&
+			    ((od_route_t*)client->route)->id.physical_rep) {
+				status = od_frontend_walrelay(client);
+				if (status == OD_SKIP)
+					continue;
+				if (status != OD_OK)
+					break;
+			}
+			if (client->rule->pool_listen && client->route_read == NULL) {
+				status = od_frontend_listen(client);
+				if (status == OD_SKIP)
+					continue;
+				if (status != OD_OK)
+					break;
+			}
+			if (client->rule->query_cache) {
+				status = od_frontend_query_cache(client);
+				if (status == OD_SKIP)
+					continue;
+				if (status != OD_OK)
+					break;
+			}
+			if (client->rule->pool_pipeline && client->route_read == NULL) {
+				status = od_frontend_pipeline(client);
+				if (status == OD_SKIP)
+					continue;
+				if (status != OD_OK)
+					break;
+			}
+			uint64_t attach_start = machine_time_us();
+			if ((features & OD_FRONTEND_SPANS) && client->span == NULL &&
+			    !client->span_skip)
+				od_span_begin(client, attach_start);
+			if (client->route_read) {
+				status = od_frontend_route_statement(client);
+				if (status != OD_OK)
+					break;
+			}
 			status = od_frontend_attach_and_deploy(client, "main");
 			if (status != OD_OK)
 				break;
 			server = client->server;
+			/* accounted to the query which caused the attach */
+			server->stats_state.wait_time = machine_time_us() - attach_start;
+			if (features & OD_FRONTEND_SPANS)
+				od_span_attach(client, attach_start, machine_time_us());
+			/* coalesce server replies written to client */
+			server->relay.coalesce = instance->config.relay_coalesce;
+			server->relay.packet_full_limit = instance->config.relay_buffer_max;
+			od_frontend_relay_limits(client, &server->relay);
+			od_frontend_relay_mask(client, server);
 			status = od_relay_start(&server->relay, client->cond,
 			                        OD_ESERVER_READ,
 			                        OD_ECLIENT_WRITE,
-			                        od_frontend_remote_server_on_read,
-			                        &route->stats,
-			                        od_frontend_remote_server,
+			                        server_on_read,
+			                        od_route_stat(client->route, client->worker_id),
+			                        server_on_packet,
 			                        client);
 			if (status != OD_OK)
 				break;
 			od_relay_attach(&client->relay, &server->io);
 			od_relay_attach(&server->relay, &client->io);
+			od_frontend_relay_splice(client, server);
+			od_frontend_relay_spool(client, server);
 
 			/* retry read operation after attach */
 			continue;
@@ -726,7 +2622,6 @@ od_frontend_remote(od_client_t *client)
 		if (status == OD_DETACH)
 		{
 			/* write any pending data to server first */
-			od_status_t status;
 			status = od_relay_flush(&server->relay);
 			if (status != OD_OK)
 				break;
@@ -740,28 +2635,53 @@ od_frontend_remote(od_client_t *client)
 				break;
 			}
 
-			/* push server connection back to route pool */
 			od_router_t *router = client->global->router;
 			od_instance_t *instance = client->global->instance;
-			od_router_detach(router, &instance->config, client);
+			if (rc == 0) {
+				/* server can not be reused */
+				od_router_close(router, client);
+			} else {
+				/* push server connection back to route pool */
+				od_router_detach(router, &instance->config, client);
+			}
 			server = NULL;
+
+			if (od_frontend_movable(client)) {
+				status = OD_MIGRATE;
+				break;
+			}
 		} else
 		if (status != OD_OK) {
 			break;
 		}
+
+		/* the server relay stops client writes once its own data
+		 * is written */
+		if (od_spool_pending(&client->spool)) {
+			status = od_frontend_spool_write(client);
+			if (status != OD_OK)
+				break;
+		}
 	}
 
 	if (client->server)
 	{
 		od_server_t *server = client->server;
 
-		od_status_t flush_status;
-		flush_status = od_relay_flush(&server->relay);
+		/* pending data of a shed relay is dropped, the other side
+		 * does not keep up */
+		od_status_t flush_status = OD_OK;
+		if (status != OD_ERELAY_MEMORY)
+			flush_status = od_relay_flush(&server->relay);
 		od_relay_stop(&server->relay);
 		if (flush_status != OD_OK)
 			return flush_status;
 
-		flush_status = od_relay_flush(&client->relay);
+		/* client messages after a rejected transaction block
+		 * are not sent */
+		if (status != OD_ERELAY_MEMORY &&
+		    status != OD_ESTATEMENT_TRANSACTION)
+			flush_status = od_relay_flush(&client->relay);
 		if (flush_status != OD_OK)
 			return flush_status;
 	}
@@ -847,6 +2767,74 @@ od_frontend_cleanup(od_client_t *client, char *context,
 		od_router_detach(router, &instance->config, client);
 		break;
 
+	case OD_ECLIENT_IDLE:
+	case OD_ECLIENT_IDLE_IN_TRANSACTION:
+		/* server is reset to the idle state and put back to the
+		 * pool on idle timeout */
+		if (status == OD_ECLIENT_IDLE) {
+			od_log(&instance->logger, context, client, server,
+			       "client idle timeout, closing");
+			od_frontend_error(client, KIWI_IDLE_SESSION_TIMEOUT,
+			                  "terminating connection due to idle timeout");
+		} else {
+			od_log(&instance->logger, context, client, server,
+			       "client idle in transaction timeout, closing");
+			od_frontend_error(client, KIWI_IDLE_IN_TRANSACTION_SESSION_TIMEOUT,
+			                  "terminating connection due to idle-in-transaction timeout");
+		}
+		if (! client->server)
+			break;
+		rc = od_reset(server);
+		if (rc != 1) {
+			od_router_close(router, client);
+			break;
+		}
+		od_router_detach(router, &instance->config, client);
+		break;
+
+	case OD_ECLIENT_RESTART:
+		/* other process accepts new connections, client is idle
+		 * and asked to reconnect */
+		od_log(&instance->logger, context, client, server,
+		       "online restart, closing");
+		od_frontend_error(client, KIWI_ADMIN_SHUTDOWN,
+		                  "terminating connection due to online restart, reconnect");
+		if (! client->server)
+			break;
+		rc = od_reset(server);
+		if (rc != 1) {
+			od_router_close(router, client);
+			break;
+		}
+		od_router_detach(router, &instance->config, client);
+		break;
+
+	case OD_ESTATEMENT_TRANSACTION:
+		/* transaction block in statement pooling, server is put
+		 * back to the pool if reset rolls it back */
+		od_log(&instance->logger, context, client, server,
+		       "transaction block in statement pooling, closing");
+		od_frontend_error(client, KIWI_FEATURE_NOT_SUPPORTED,
+		                  "transaction blocks are not allowed in statement pooling mode");
+		if (! client->server)
+			break;
+		rc = od_reset(server);
+		if (rc != 1) {
+			od_router_close(router, client);
+			break;
+		}
+		od_router_detach(router, &instance->config, client);
+		break;
+
+	case OD_EQUERY_TIMEOUT:
+		/* server has not replied to cancel */
+		od_log(&instance->logger, context, client, server,
+		       "query cancel timeout, closing");
+		od_frontend_error(client, KIWI_QUERY_CANCELED,
+		                  "canceling statement due to query timeout");
+		od_router_close(router, client);
+		break;
+
 	case OD_ESERVER_CONNECT:
 		/* server attached to client and connection failed */
 		if (server->error_connect && route->rule->client_fwd_error) {
@@ -862,8 +2850,37 @@ od_frontend_cleanup(od_client_t *client, char *context,
 		od_router_close(router, client);
 		break;
 
+	case OD_ERELAY_MEMORY:
+		/* relay buffers are over relay_memory_max and this client
+		 * holds at least relay_watermark_high of them */
+		od_log(&instance->logger, context, client, server,
+		       "relay memory limit reached, closing");
+		if (! client->server)
+			break;
+		od_router_close(router, client);
+		break;
+
+	case OD_EWALRELAY:
+		/* wal stream of the client is dropped from the ring of
+		 * the relay */
+		od_log(&instance->logger, context, client, server,
+		       "replication client is behind the wal relay, closing");
+		od_frontend_error(client, KIWI_CONNECTION_FAILURE,
+		                  "requested WAL is not in the relay anymore, reconnect");
+		break;
+
 	case OD_ESERVER_READ:
 	case OD_ESERVER_WRITE:
+		if (server == NULL) {
+			/* server connection of the failed pipelined request
+			 * is closed by the pipeline */
+			od_log(&instance->logger, context, client, NULL,
+			       "pipeline server disconnected, status %s",
+			       od_status_to_str(status));
+			od_frontend_error(client, KIWI_CONNECTION_FAILURE,
+			                  "remote server read/write error");
+			break;
+		}
 		/* close client connection and close server
 		 * connection in case of server errors */
 		od_log(&instance->logger, context, client, server,
@@ -894,7 +2911,166 @@ static void od_application_name_add_host(od_client_t *client) {
 	od_getpeername(client->io.io, peer_name, sizeof(peer_name), 1, 0); //return code ignored
 
 	int length = od_snprintf(app_name, 256, "%.*s - %s", app_name_var->value_len, app_name_var->value, peer_name);
-	kiwi_var_set(app_name_var, KIWI_VAR_APPLICATION_NAME, app_name, length + 1); //return code ignored
+	kiwi_vars_set(&client->vars, KIWI_VAR_APPLICATION_NAME, app_name, length + 1); //return code ignored
+}
+
+static inline int
+od_frontend_transfer(od_client_t *client, od_worker_t *worker, od_msg_t type)
+{
+	od_instance_t *instance = client->global->instance;
+
+	machine_msg_t *msg;
+	msg = machine_msg_create(sizeof(od_client_t*));
+	if (msg == NULL)
+		return 0;
+	machine_msg_set_type(msg, type);
+	memcpy(machine_msg_data(msg), &client, sizeof(od_client_t*));
+
+	int rc;
+	rc = od_io_detach(&client->io);
+	if (rc == -1) {
+		machine_msg_free(msg);
+		return 0;
+	}
+
+	/* notifications are read by the new worker */
+	machine_notify_stop(client->notify);
+	if (instance->config.log_session)
+		od_log(&instance->logger, "startup", client, NULL,
+		       "moving to worker[%d]", worker->id);
+
+	/* client is accounted by the new worker from now on */
+	od_frontend_account(client);
+	client->cpu_sample_time   = 0;
+	client->cpu_sample_wait   = 0;
+	client->cpu_sample_switch = 0;
+	od_atomic_u32_dec(client->worker_clients);
+	client->worker_clients = NULL;
+	client->worker_id = -1;
+	od_atomic_u32_inc(&worker->clients);
+	machine_channel_write(worker->task_channel, msg);
+	return 1;
+}
+
+static inline int
+od_frontend_emigrate(od_client_t *client)
+{
+	od_worker_pool_t *worker_pool = client->global->worker_pool;
+	od_worker_t *worker;
+	worker = od_worker_pool_relay(worker_pool, client);
+	return od_frontend_transfer(client, worker, OD_MSG_CLIENT_MOVE);
+}
+
+static inline od_status_t
+od_frontend_remote_run(od_client_t *client)
+{
+	for (;;) {
+		od_status_t status;
+		status = od_frontend_remote(client);
+		if (status != OD_MIGRATE)
+			return status;
+		if (od_frontend_emigrate(client))
+			return OD_MIGRATE;
+		/* stay on the removed worker until the next transaction */
+	}
+}
+
+static inline void
+od_frontend_finish(od_client_t *client, od_status_t status)
+{
+	od_router_t *router = client->global->router;
+	od_frontend_cleanup(client, "main", status);
+	od_frontend_account(client);
+	if (client->capture)
+		od_frontend_capture(client, OD_CAPTURE_END, NULL, 0);
+
+	/* stop notifications before the client is freed */
+	if (client->listen_channel)
+		od_listen_unsubscribe(client, NULL, 0);
+	od_walrelay_unsubscribe(client);
+
+	/* detach client from its route */
+	od_router_unroute(router, client);
+
+	/* close frontend connection */
+	od_frontend_close(client);
+}
+
+static inline void
+od_frontend_run(od_client_t *client)
+{
+	/* setup client and run main loop */
+	od_route_t *route = client->route;
+
+	od_status_t status;
+	status = OD_UNDEF;
+	switch (route->rule->storage->storage_type) {
+	case OD_RULE_STORAGE_LOCAL:
+		status = od_frontend_local_setup(client);
+		if (status != OD_OK)
+			break;
+		status = od_frontend_local(client);
+		break;
+
+	case OD_RULE_STORAGE_REMOTE:
+	case OD_RULE_STORAGE_MUX:
+		status = od_frontend_setup(client);
+		if (status != OD_OK)
+			break;
+		od_frontend_capture_start(client);
+		status = od_frontend_remote_run(client);
+		if (status == OD_MIGRATE)
+			return;
+		break;
+	}
+
+	od_frontend_finish(client, status);
+}
+
+static inline void
+od_frontend_main(od_client_t *client)
+{
+	od_router_t *router = client->global->router;
+
+	/* client authentication */
+	int rc;
+	rc = od_auth_frontend(client);
+	od_frontend_account(client);
+	if (rc == 0)
+		od_backlog_login(client);
+	if (rc == -1) {
+		od_router_unroute(router, client);
+		od_frontend_close(client);
+		return;
+	}
+
+	od_frontend_run(client);
+}
+
+static inline int
+od_frontend_migrate(od_client_t *client)
+{
+	od_route_t *route = client->route;
+	od_worker_pool_t *worker_pool = client->global->worker_pool;
+	if (client->worker_id == -1)
+		return 0;
+	od_worker_t *worker;
+	if (worker_pool->placement != OD_WORKER_POOL_ROUTE) {
+		/* client of a listen outside of the rule group */
+		od_worker_group_t *group;
+		group = od_worker_pool_group(worker_pool, route->rule->worker_group);
+		if (group == NULL ||
+		    od_worker_pool_is_member(worker_pool, group, client->worker_id))
+			return 0;
+		worker = od_worker_pool_pick(worker_pool, group);
+		return od_frontend_transfer(client, worker, OD_MSG_CLIENT_MIGRATE);
+	}
+	if (od_worker_pool_count(worker_pool) == 1)
+		return 0;
+	worker = od_worker_pool_route(worker_pool, route);
+	if (worker->id == client->worker_id)
+		return 0;
+	return od_frontend_transfer(client, worker, OD_MSG_CLIENT_MIGRATE);
 }
 
 void
@@ -904,6 +3080,9 @@ od_frontend(void *arg)
 	od_instance_t *instance = client->global->instance;
 	od_router_t *router = client->global->router;
 
+	/* client traffic runs ahead of housekeeping coroutines */
+	machine_set_priority(MACHINE_PRIORITY_HIGH);
+
 	/* log client connection */
 	if (instance->config.log_session) {
 		char peer[128];
@@ -920,18 +3099,7 @@ od_frontend(void *arg)
 		od_error(&instance->logger, "startup", client, NULL,
 		         "failed to transfer client io");
 		od_io_close(&client->io);
-		machine_close(client->notify_io);
-		od_client_free(client);
-		od_atomic_u32_dec(&router->clients_routing);
-		return;
-	}
-
-	rc = machine_io_attach(client->notify_io);
-	if (rc == -1) {
-		od_error(&instance->logger, "startup", client, NULL,
-		         "failed to transfer client notify io");
-		od_io_close(&client->io);
-		machine_close(client->notify_io);
+		machine_notify_free(client->notify);
 		od_client_free(client);
 		od_atomic_u32_dec(&router->clients_routing);
 		return;
@@ -963,8 +3131,8 @@ od_frontend(void *arg)
 		od_router_cancel_init(&cancel);
 		rc = od_router_cancel(router, &client->startup.key, &cancel);
 		if (rc == 0) {
-			od_cancel(client->global, cancel.storage, &cancel.key,
-			          &cancel.id);
+			od_cancel(client->global, cancel.storage, cancel.endpoint,
+			          &cancel.key, &cancel.id);
 			od_router_cancel_free(&cancel);
 		}
 		od_frontend_close(client);
@@ -989,6 +3157,7 @@ od_frontend(void *arg)
 
 	/* routing is over */
 	od_atomic_u32_dec(&router->clients_routing);
+	od_router_login_account(router, machine_time_us() - client->time_accept);
 
 	switch (router_status) {
 	case OD_ROUTER_ERROR:
@@ -1023,6 +3192,13 @@ od_frontend(void *arg)
 		                  "too many connections");
 		od_frontend_close(client);
 		return;
+	case OD_ROUTER_ERROR_LIMIT_MEMORY:
+		od_error(&instance->logger, "startup", client, NULL,
+		         "route memory limit reached, closing");
+		od_frontend_error(client, KIWI_OUT_OF_MEMORY,
+		                  "route memory limit exceeded");
+		od_frontend_close(client);
+		return;
 	case OD_ROUTER_ERROR_REPLICATION:
 		od_error(&instance->logger, "startup", client, NULL,
 		         "invalid value for parameter \"replication\"");
@@ -1030,11 +3206,21 @@ od_frontend(void *arg)
 		                  "invalid value for parameter \"replication\"");
 		od_frontend_close(client);
 		return;
+	case OD_ROUTER_ERROR_SHARD:
+		od_error(&instance->logger, "startup", client, NULL,
+		         "shard key is not set, closing");
+		od_frontend_error(client, KIWI_CONNECTION_FAILURE,
+		                  "shard key parameter is not set");
+		od_frontend_close(client);
+		return;
 	case OD_ROUTER_OK:
 	{
 		od_route_t *route = client->route;
 		if (route->rule->application_name_add_host)
 			od_application_name_add_host(client);
+		od_readahead_set_bounds(&client->io.readahead,
+		                        route->rule->readahead_min,
+		                        route->rule->readahead_max);
 		if (instance->config.log_session) {
 			od_log(&instance->logger, "startup", client, NULL,
 			       "route '%s.%s' to '%s.%s'",
@@ -1050,40 +3236,96 @@ od_frontend(void *arg)
 		break;
 	}
 
-	/* client authentication */
-	rc = od_auth_frontend(client);
-	if (rc == -1) {
+	/* authenticate on the handshake worker and continue on a relay
+	 * worker, so crypto work of logins does not delay relays */
+	od_worker_pool_t *worker_pool = client->global->worker_pool;
+	if (client->worker_id != -1 &&
+	    od_worker_pool_is_handshake(worker_pool, client)) {
+		rc = od_auth_frontend(client);
+		od_frontend_account(client);
+		if (rc == 0)
+			od_backlog_login(client);
+		if (rc == -1) {
+			od_router_unroute(router, client);
+			od_frontend_close(client);
+			return;
+		}
+		od_worker_t *worker;
+		worker = od_worker_pool_relay(worker_pool, client);
+		rc = od_frontend_transfer(client, worker, OD_MSG_CLIENT_RELAY);
+		if (rc == 1)
+			return;
+		/* handshake workers do not own server connections */
+		od_error(&instance->logger, "startup", client, NULL,
+		         "failed to transfer client to relay worker");
+		od_frontend_error(client, KIWI_SYSTEM_ERROR,
+		                  "client routing failed");
 		od_router_unroute(router, client);
 		od_frontend_close(client);
 		return;
 	}
 
-	/* setup client and run main loop */
-	od_route_t *route = client->route;
+	/* continue on the worker which owns the route */
+	rc = od_frontend_migrate(client);
+	if (rc == 1)
+		return;
 
-	od_status_t status;
-	status = OD_UNDEF;
-	switch (route->rule->storage->storage_type) {
-	case OD_RULE_STORAGE_LOCAL:
-		status = od_frontend_local_setup(client);
-		if (status != OD_OK)
-			break;
-		status = od_frontend_local(client);
-		break;
+	od_frontend_main(client);
+}
 
-	case OD_RULE_STORAGE_REMOTE:
-		status = od_frontend_setup(client);
-		if (status != OD_OK)
-			break;
-		status = od_frontend_remote(client);
-		break;
+static inline int
+od_frontend_reattach(od_client_t *client)
+{
+	od_instance_t *instance = client->global->instance;
+	od_router_t *router = client->global->router;
+
+	/* attach routed client io to the new worker event loop */
+	int rc;
+	rc = od_io_attach(&client->io);
+	if (rc == -1) {
+		od_error(&instance->logger, "startup", client, NULL,
+		         "failed to transfer client io");
+		if (client->listen_channel)
+			od_listen_unsubscribe(client, NULL, 0);
+		od_router_unroute(router, client);
+		od_frontend_close(client);
+		return -1;
 	}
+	return 0;
+}
 
-	od_frontend_cleanup(client, "main", status);
+void
+od_frontend_resume(void *arg)
+{
+	od_client_t *client = arg;
+	machine_set_priority(MACHINE_PRIORITY_HIGH);
+	if (od_frontend_reattach(client) == -1)
+		return;
+	od_frontend_main(client);
+}
 
-	/* detach client from its route */
-	od_router_unroute(router, client);
+void
+od_frontend_relay(void *arg)
+{
+	/* client is already authenticated by a handshake worker */
+	od_client_t *client = arg;
+	machine_set_priority(MACHINE_PRIORITY_HIGH);
+	if (od_frontend_reattach(client) == -1)
+		return;
+	od_frontend_run(client);
+}
 
-	/* close frontend connection */
-	od_frontend_close(client);
+void
+od_frontend_move(void *arg)
+{
+	/* client moved from a removed worker between transactions */
+	od_client_t *client = arg;
+	machine_set_priority(MACHINE_PRIORITY_HIGH);
+	if (od_frontend_reattach(client) == -1)
+		return;
+	od_status_t status;
+	status = od_frontend_remote_run(client);
+	if (status == OD_MIGRATE)
+		return;
+	od_frontend_finish(client, status);
 }
@@ -35,5 +35,8 @@ od_frontend_errorf(od_client_t *client, machine_msg_t *stream,
 
 int  od_frontend_error(od_client_t*, char*, char*, ...);
 void od_frontend(void*);
+void od_frontend_resume(void*);
+void od_frontend_relay(void*);
+void od_frontend_move(void*);
 
 #endif /* ODYSSEY_FRONTEND_H */
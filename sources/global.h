@@ -16,6 +16,7 @@ struct od_global
 	void *router;
 	void *cron;
 	void *worker_pool;
+	void *metrics;
 };
 
 static inline void
@@ -24,13 +25,15 @@ od_global_init(od_global_t *global,
                void *system,
                void *router,
                void *cron,
-               void *worker_pool)
+               void *worker_pool,
+               void *metrics)
 {
 	global->instance    = instance;
 	global->system      = system;
 	global->router      = router;
 	global->cron        = cron;
 	global->worker_pool = worker_pool;
+	global->metrics     = metrics;
 }
 
 #endif /* ODYSSEY_GLOBAL_H */
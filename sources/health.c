@@ -0,0 +1,361 @@
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+/* role of the host and replay lag in milliseconds */
+#define OD_HEALTH_QUERY \
+	"select pg_is_in_recovery(), " \
+	"coalesce(extract(epoch from now() - pg_last_xact_replay_timestamp()) * 1000, 0)::int"
+
+/* storages checked at one round, the rest are left to the next one */
+#define OD_HEALTH_ROUND_MAX 64
+
+static inline char*
+od_health_state_of(od_rule_host_state_t state)
+{
+	switch (state) {
+	case OD_RULE_HOST_UNKNOWN: return "unknown";
+	case OD_RULE_HOST_DOWN:    return "down";
+	case OD_RULE_HOST_PRIMARY: return "primary";
+	case OD_RULE_HOST_STANDBY: return "standby";
+	}
+	return "unknown";
+}
+
+static inline int
+od_health_query(od_server_t *server, uint32_t timeout,
+                od_rule_host_state_t *state, int *lag)
+{
+	od_instance_t *instance = server->global->instance;
+
+	machine_msg_t *msg;
+	msg = kiwi_fe_write_query(NULL, OD_HEALTH_QUERY, sizeof(OD_HEALTH_QUERY));
+	if (msg == NULL)
+		return -1;
+	int rc;
+	rc = od_write(&server->io, msg);
+	if (rc == -1) {
+		od_error(&instance->logger, "health", NULL, server,
+		         "write error: %s",
+		         od_io_error(&server->io));
+		return -1;
+	}
+
+	int has_result = 0;
+	for (;;)
+	{
+		msg = od_read(&server->io, timeout);
+		if (msg == NULL) {
+			od_error(&instance->logger, "health", NULL, server,
+			         "read error: %s",
+			         od_io_error(&server->io));
+			return -1;
+		}
+		kiwi_be_type_t type;
+		type = *(char*)machine_msg_data(msg);
+
+		switch (type) {
+		case KIWI_BE_ERROR_RESPONSE:
+			od_backend_error(server, "health", machine_msg_data(msg),
+			                 machine_msg_size(msg));
+			goto error;
+		case KIWI_BE_DATA_ROW:
+		{
+			char *pos = (char*)machine_msg_data(msg) + 1;
+			uint32_t pos_size = machine_msg_size(msg) - 1;
+
+			/* size */
+			uint32_t size;
+			rc = kiwi_read32(&size, &pos, &pos_size);
+			if (kiwi_unlikely(rc == -1))
+				goto error;
+			/* count */
+			uint16_t count;
+			rc = kiwi_read16(&count, &pos, &pos_size);
+			if (kiwi_unlikely(rc == -1))
+				goto error;
+			if (count != 2)
+				goto error;
+
+			/* pg_is_in_recovery */
+			uint32_t len;
+			rc = kiwi_read32(&len, &pos, &pos_size);
+			if (kiwi_unlikely(rc == -1))
+				goto error;
+			if (len != 1)
+				goto error;
+			*state = (*pos == 't') ? OD_RULE_HOST_STANDBY : OD_RULE_HOST_PRIMARY;
+			rc = kiwi_readn(len, &pos, &pos_size);
+			if (kiwi_unlikely(rc == -1))
+				goto error;
+
+			/* lag */
+			rc = kiwi_read32(&len, &pos, &pos_size);
+			if (kiwi_unlikely(rc == -1))
+				goto error;
+			char value[16];
+			if (len >= sizeof(value))
+				goto error;
+			memcpy(value, pos, len);
+			value[len] = 0;
+			*lag = atoi(value);
+			has_result = 1;
+			break;
+		}
+		case KIWI_BE_READY_FOR_QUERY:
+			machine_msg_free(msg);
+			if (! has_result) {
+				od_error(&instance->logger, "health", NULL, server,
+				         "unexpected health check result");
+				return -1;
+			}
+			return 0;
+		default:
+			break;
+		}
+		machine_msg_free(msg);
+	}
+	return 0;
+error:
+	machine_msg_free(msg);
+	return -1;
+}
+
+static inline int
+od_health_check_host(od_global_t *global, od_route_t *route,
+                     od_rule_storage_t *storage, int id)
+{
+	od_instance_t *instance = global->instance;
+	od_rule_storage_endpoint_t *endpoint = &storage->endpoints[id];
+
+	/* dedicated connection, authenticated as the route user */
+	od_server_t server;
+	od_server_init(&server);
+	server.global = global;
+	server.route  = route;
+	od_id_generate(&server.id, "s");
+
+	od_rule_host_state_t state = OD_RULE_HOST_DOWN;
+	int lag = 0;
+	uint32_t timeout = storage->health_check_timeout;
+	int rc;
+	rc = od_backend_connect_endpoint(&server, "health", storage, id, timeout);
+	if (rc == 0)
+		rc = od_health_query(&server, timeout, &state, &lag);
+	if (rc == -1)
+		state = OD_RULE_HOST_DOWN;
+
+	/* round trip as measured by the kernel over the handshake and
+	 * the query, kept from the previous check on failure */
+	uint32_t rtt = endpoint->rtt;
+	od_server_pool_tcp_t tcp;
+	if (rc == 0 && od_backend_tcp_info(&server, &tcp) == 0)
+		rtt = tcp.rtt;
+
+	server.route = NULL;
+	od_backend_close_connection(&server);
+	od_backend_close(&server);
+
+	int changed = endpoint->state != state;
+	if (changed) {
+		od_log(&instance->logger, "health", NULL, NULL,
+		       "storage '%s': %s:%d is %s (was %s)",
+		       storage->name, endpoint->host, endpoint->port,
+		       od_health_state_of(state),
+		       od_health_state_of(endpoint->state));
+	}
+	int slow = od_rules_storage_endpoint_slow(storage, endpoint);
+	endpoint->lag   = lag;
+	endpoint->state = state;
+	endpoint->rtt   = rtt;
+	if (od_rules_storage_endpoint_slow(storage, endpoint) != slow) {
+		od_log(&instance->logger, "health", NULL, NULL,
+		       "storage '%s': %s:%d round trip is %d us%s",
+		       storage->name, endpoint->host, endpoint->port, (int)rtt,
+		       slow ? "" : ", over health_check_max_rtt");
+		changed = 1;
+	}
+	return changed;
+}
+
+static inline int
+od_health_check_storage(od_global_t *global, od_rule_storage_t *storage)
+{
+	od_instance_t *instance = global->instance;
+	od_router_t *router = global->router;
+
+	/* route internal client to authenticate health check
+	 * connections */
+	od_client_t *client;
+	client = od_client_allocate();
+	if (client == NULL)
+		return 0;
+	client->global = global;
+	od_id_generate(&client->id, "h");
+
+	kiwi_var_set(&client->startup.user, KIWI_VAR_UNDEF,
+	             storage->health_check_user,
+	             strlen(storage->health_check_user) + 1);
+
+	kiwi_var_set(&client->startup.database, KIWI_VAR_UNDEF,
+	             storage->health_check_db,
+	             strlen(storage->health_check_db) + 1);
+
+	od_router_status_t status;
+	status = od_router_route(router, &instance->config, client);
+	if (status != OD_ROUTER_OK) {
+		od_error(&instance->logger, "health", client, NULL,
+		         "storage '%s': failed to route health check %s.%s",
+		         storage->name,
+		         storage->health_check_db,
+		         storage->health_check_user);
+		od_client_free(client);
+		return 0;
+	}
+
+	int changed = 0;
+	int id;
+	for (id = 0; id < storage->endpoints_count; id++)
+		changed |= od_health_check_host(global, client->route, storage, id);
+
+	od_router_unroute(router, client);
+	od_client_free(client);
+	return changed;
+}
+
+static inline int
+od_health_storage_match(od_rule_storage_t *a, od_rule_storage_t *b)
+{
+	/* storage copies made from the same declaration */
+	return strcmp(a->name, b->name) == 0 &&
+	       strcmp(a->host, b->host) == 0 &&
+	       a->port == b->port &&
+	       strcmp(a->health_check_db, b->health_check_db) == 0 &&
+	       strcmp(a->health_check_user, b->health_check_user) == 0;
+}
+
+static inline int
+od_health_storage_due(od_rule_storage_t *storage, uint64_t now)
+{
+	if (storage == NULL || ! od_rules_storage_health_check(storage))
+		return 0;
+	return now - storage->health_check_time >=
+	       (uint64_t)storage->health_check_interval * 1000000;
+}
+
+static inline void
+od_health_check(od_global_t *global)
+{
+	od_router_t *router = global->router;
+
+	/* every rule has its own copy of storages, pin rules which are
+	 * due for checks */
+	od_rule_t *rules[OD_HEALTH_ROUND_MAX];
+	od_rule_storage_t *storages[OD_HEALTH_ROUND_MAX];
+	int count = 0;
+	uint64_t now = machine_time_us();
+
+	od_router_lock_read(router, OD_LOCK_OTHER);
+	od_list_t *i;
+	od_list_foreach(&router->rules.rules, i) {
+		od_rule_t *rule;
+		rule = od_container_of(i, od_rule_t, link);
+		if (rule->obsolete)
+			continue;
+		if (count + 2 + rule->storage_shards_count > OD_HEALTH_ROUND_MAX)
+			break;
+		od_rule_storage_t *candidates[] = { rule->storage, rule->storage_read };
+		int k;
+		for (k = 0; k < 2 + rule->storage_shards_count; k++) {
+			od_rule_storage_t *candidate;
+			if (k < 2)
+				candidate = candidates[k];
+			else
+				candidate = rule->storage_shards[k - 2];
+			if (! od_health_storage_due(candidate, now))
+				continue;
+			od_rules_ref(rule);
+			rules[count] = rule;
+			storages[count] = candidate;
+			count++;
+		}
+	}
+	od_router_unlock(router);
+
+	int changed = 0;
+	int j;
+	for (j = 0; j < count; j++) {
+		od_rule_storage_t *storage = storages[j];
+
+		/* hosts of the same storage are checked once */
+		od_rule_storage_t *checked = NULL;
+		int k;
+		for (k = 0; k < j; k++) {
+			if (od_health_storage_match(storages[k], storage)) {
+				checked = storages[k];
+				break;
+			}
+		}
+		if (checked) {
+			int id;
+			for (id = 0; id < storage->endpoints_count; id++) {
+				if (storage->endpoints[id].state != checked->endpoints[id].state)
+					changed = 1;
+				storage->endpoints[id].lag   = checked->endpoints[id].lag;
+				storage->endpoints[id].state = checked->endpoints[id].state;
+				storage->endpoints[id].rtt   = checked->endpoints[id].rtt;
+			}
+		} else {
+			changed |= od_health_check_storage(global, storage);
+		}
+		storage->health_check_time = now;
+	}
+
+	/* obsolete rule is freed by router gc */
+	for (j = 0; j < count; j++)
+		od_rules_unref(rules[j]);
+
+	/* drain servers of hosts which are not suitable anymore */
+	if (changed)
+		od_cron_failover(global->cron);
+}
+
+static void
+od_health(void *arg)
+{
+	od_global_t *global = arg;
+	machine_set_priority(MACHINE_PRIORITY_LOW);
+	for (;;) {
+		od_health_check(global);
+		machine_sleep(1000);
+	}
+}
+
+int
+od_health_start(od_global_t *global)
+{
+	od_instance_t *instance = global->instance;
+	int64_t coroutine_id;
+	coroutine_id = machine_coroutine_create(od_health, global);
+	if (coroutine_id == -1) {
+		od_error(&instance->logger, "health", NULL, NULL,
+		         "failed to start health check coroutine");
+		return -1;
+	}
+	return 0;
+}
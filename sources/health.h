@@ -0,0 +1,12 @@
+#ifndef ODYSSEY_HEALTH_H
+#define ODYSSEY_HEALTH_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+int od_health_start(od_global_t*);
+
+#endif /* ODYSSEY_HEALTH_H */
@@ -3,8 +3,6 @@
  * Odyssey.
  *
  * Scalable PostgreSQL connection pooler.
- *
- * Implementation of reservoir sampling algorithm
 */
 
 #include <stdlib.h>
@@ -20,50 +18,95 @@
 #include <kiwi.h>
 #include <odyssey.h>
 
-void od_hgram_init(od_hgram_t *hgram) {
-	memset(hgram, 0, sizeof(*hgram));
-}
-
-// Probablisticaly add data point, return 1 is point was actually added to data set, 0 otherwise
-int od_hgram_add_data_point(od_hgram_t *hgram, uint64_t point) {
-	uint64_t next_position = __sync_fetch_and_add(&hgram->estimated_size, 1);
-	if (next_position < OD_HGRAM_DATA_POINTS) {
-		hgram->data[next_position] = point;
-		return 1;
+od_hgram_t*
+od_hgram_allocate(int precision)
+{
+	assert(precision > 0 && precision <= OD_HGRAM_PRECISION_MAX);
+	od_hgram_t *hgram = malloc(sizeof(od_hgram_t));
+	if (hgram == NULL)
+		return NULL;
+	hgram->precision = precision;
+	hgram->count     = (OD_HGRAM_BITS - precision + 1) << precision;
+	hgram->total     = 0;
+	hgram->data      = calloc(hgram->count, sizeof(uint32_t));
+	if (hgram->data == NULL) {
+		free(hgram);
+		return NULL;
 	}
-	next_position = machine_lrand48() % next_position;
-	if (next_position < OD_HGRAM_DATA_POINTS){
-		hgram->data[next_position] = point;
-		return 1;
-	}
-	return 0;
+	return hgram;
 }
 
-static int cmpfunc_ui32(const void *a, const void *b) {
-	if (*(uint32_t *) a < *(uint32_t *) b)
-		return 1;
-	if (*(uint32_t *) a > *(uint32_t *) b)
-		return -1;
-	return 0;
+void
+od_hgram_free(od_hgram_t *hgram)
+{
+	free(hgram->data);
+	free(hgram);
 }
 
-// Create static copy of reservoir for analysis
-void od_hgram_freeze(od_hgram_t *hgram, od_hgram_frozen_t *hgram_tmp) {
-	memcpy(hgram_tmp, hgram, sizeof(*hgram));
-	hgram->estimated_size = 0;
+void
+od_hgram_reset(od_hgram_t *hgram)
+{
+	memset(hgram->data, 0, sizeof(uint32_t) * hgram->count);
+	hgram->total = 0;
+}
 
-	qsort(&hgram_tmp->data, OD_HGRAM_DATA_POINTS, sizeof(uint32_t), cmpfunc_ui32);
+void
+od_hgram_merge(od_hgram_t *dst, od_hgram_t *src)
+{
+	assert(dst->precision == src->precision);
+	volatile uint32_t *data = src->data;
+	int i;
+	for (i = 0; i < dst->count; i++)
+		dst->data[i] += data[i];
+}
 
-	if (hgram_tmp->estimated_size > OD_HGRAM_DATA_POINTS) {
-		hgram_tmp->estimated_size = OD_HGRAM_DATA_POINTS;
+void
+od_hgram_freeze(od_hgram_frozen_t *frozen, od_hgram_t *prev, int prev_update)
+{
+	/* frozen holds merged counters, keep only the values added
+	 * since prev was updated, counters are allowed to wrap */
+	frozen->total = 0;
+	int i;
+	for (i = 0; i < frozen->count; i++) {
+		uint32_t count = frozen->data[i];
+		if (prev) {
+			frozen->data[i] = count - prev->data[i];
+			if (prev_update)
+				prev->data[i] = count;
+		}
+		frozen->total += frozen->data[i];
 	}
 }
 
-// Compute quantile withing static copy of reservoir
-uint64_t od_hgram_quantile(od_hgram_frozen_t *frozen, double quantile) {
+static inline uint64_t
+od_hgram_value(od_hgram_t *hgram, int index)
+{
+	int precision = hgram->precision;
+	if (index < (1 << precision))
+		return index;
+	int shift = (index >> precision) - 1;
+	uint64_t sub = index & ((1 << precision) - 1);
+	uint64_t lower = ((1ull << precision) + sub) << shift;
+	/* middle of the bucket */
+	return lower + ((1ull << shift) - 1) / 2;
+}
+
+uint64_t
+od_hgram_quantile(od_hgram_frozen_t *frozen, double quantile)
+{
 	assert(quantile > 0);
 	assert(quantile <= 1);
-	if (frozen->estimated_size == 0)
+	if (frozen->total == 0)
 		return 0;
-	return frozen->data[(size_t) (frozen->estimated_size * (1 - quantile))];
+	uint64_t rank = frozen->total * quantile + 0.5;
+	if (rank == 0)
+		rank = 1;
+	uint64_t count = 0;
+	int i;
+	for (i = 0; i < frozen->count; i++) {
+		count += frozen->data[i];
+		if (count >= rank)
+			return od_hgram_value(frozen, i);
+	}
+	return od_hgram_value(frozen, frozen->count - 1);
 }
@@ -10,19 +10,56 @@
 typedef struct od_hgram od_hgram_t;
 typedef struct od_hgram od_hgram_frozen_t;
 
-#define OD_HGRAM_DATA_POINTS 256
+#define OD_HGRAM_PRECISION_DEFAULT 5
+#define OD_HGRAM_PRECISION_MAX     10
 
-struct od_hgram {
-	uint32_t data[OD_HGRAM_DATA_POINTS];
-	uint64_t estimated_size;
+/* values of 2^36 usec (about 19 hours) and above share the
+ * last bucket */
+#define OD_HGRAM_BITS 36
+
+/* Log-linear histogram: values below 2^precision are counted
+ * exactly, every following power of two is split into
+ * 2^precision buckets, so the error is under 1/2^precision.
+ *
+ * Histogram has a single writer. Counters only grow, readers
+ * merge histograms of all writers and subtract the counters seen
+ * the last time to get the values of the last interval. */
+struct od_hgram
+{
+	int       precision;
+	int       count;
+	uint64_t  total;
+	uint32_t *data;
 };
 
-void od_hgram_init(od_hgram_t *);
+od_hgram_t*
+od_hgram_allocate(int);
+void od_hgram_free(od_hgram_t*);
+void od_hgram_reset(od_hgram_t*);
+
+static inline int
+od_hgram_index(od_hgram_t *hgram, uint64_t value)
+{
+	int precision = hgram->precision;
+	if (value < (1ull << precision))
+		return value;
+	int msb = 63 - __builtin_clzll(value);
+	if (msb >= OD_HGRAM_BITS)
+		return hgram->count - 1;
+	int shift = msb - precision;
+	return ((shift + 1) << precision) +
+	       ((value >> shift) & ((1 << precision) - 1));
+}
 
-int od_hgram_add_data_point(od_hgram_t *, uint64_t);
+static inline void
+od_hgram_add_data_point(od_hgram_t *hgram, uint64_t value)
+{
+	hgram->data[od_hgram_index(hgram, value)]++;
+}
 
-void od_hgram_freeze(od_hgram_t *, od_hgram_frozen_t *);
+void od_hgram_merge(od_hgram_t*, od_hgram_t*);
+void od_hgram_freeze(od_hgram_frozen_t*, od_hgram_t*, int);
 
-uint64_t od_hgram_quantile(od_hgram_frozen_t *, double);
+uint64_t od_hgram_quantile(od_hgram_frozen_t*, double);
 
-#endif //ODYSSEY_HGRAM_H
+#endif /* ODYSSEY_HGRAM_H */
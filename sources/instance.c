@@ -30,14 +30,7 @@ od_instance_init(od_instance_t *instance)
 	od_logger_init(&instance->logger, &instance->pid);
 	od_config_init(&instance->config);
 	instance->config_file = NULL;
-
-	sigset_t mask;
-	sigemptyset(&mask);
-	sigaddset(&mask, SIGINT);
-	sigaddset(&mask, SIGTERM);
-	sigaddset(&mask, SIGHUP);
-	sigaddset(&mask, SIGPIPE);
-	sigprocmask(SIG_BLOCK, &mask, NULL);
+	instance->embed = NULL;
 }
 
 void
@@ -63,40 +56,15 @@ od_usage(od_instance_t *instance, char *path)
 }
 
 int
-od_instance_main(od_instance_t *instance, int argc, char **argv)
+od_instance_start(od_instance_t *instance, od_global_t *global)
 {
-	/* prepare system services */
-	od_system_t      system;
-	od_router_t      router;
-	od_cron_t        cron;
-	od_worker_pool_t worker_pool;
-	od_global_t      global;
-
-	od_log(&instance->logger, "startup", NULL, NULL, "Starting Odyssey");
-
-	od_system_init(&system);
-	od_router_init(&router);
-	od_cron_init(&cron);
-	od_worker_pool_init(&worker_pool);
-	od_global_init(&global, instance, &system, &router, &cron, &worker_pool);
-
-	/* validate command line options */
-	if (argc != 2) {
-		od_usage(instance, argv[0]);
-		return -1;
-	}
-	if (strcmp(argv[1], "-h") == 0 ||
-	    strcmp(argv[1], "--help") == 0) {
-		od_usage(instance, argv[0]);
-		return 0;
-	}
-	instance->config_file = argv[1];
+	od_router_t *router = global->router;
 
 	/* read config file */
 	od_error_t error;
 	od_error_init(&error);
 	int rc;
-	rc = od_config_reader_import(&instance->config, &router.rules, &error, instance->config_file);
+	rc = od_config_reader_import(&instance->config, &router->rules, &error, instance->config_file);
 	if (rc == -1) {
 		od_error(&instance->logger, "config", NULL, NULL,
 		         "%s", error.error);
@@ -109,17 +77,22 @@ od_instance_main(od_instance_t *instance, int argc, char **argv)
 		return -1;
 
 	/* validate rules */
-	rc = od_rules_validate(&router.rules, &instance->config, &instance->logger);
+	rc = od_rules_validate(&router->rules, &instance->config, &instance->logger);
 	if (rc == -1)
 		return -1;
 
 	/* configure logger */
-	od_logger_set_format(&instance->logger, instance->config.log_format);
+	rc = od_logger_set_format(&instance->logger, instance->config.log_format);
+	if (rc == -1) {
+		od_error(&instance->logger, "init", NULL, NULL,
+		         "failed to compile log_format");
+		return -1;
+	}
 	od_logger_set_debug(&instance->logger, instance->config.log_debug);
 	od_logger_set_stdout(&instance->logger, instance->config.log_to_stdout);
 
-	/* run as daemon */
-	if (instance->config.daemonize) {
+	/* run as daemon, embedded instance belongs to the application */
+	if (instance->config.daemonize && instance->embed == NULL) {
 		rc = od_daemonize();
 		if (rc == -1)
 			return -1;
@@ -138,6 +111,30 @@ od_instance_main(od_instance_t *instance, int argc, char **argv)
 		}
 	}
 
+	/* binary log */
+	if (instance->config.log_binary_file) {
+		rc = od_logger_open_binary(&instance->logger,
+		                           instance->config.log_binary_file);
+		if (rc == -1) {
+			od_error(&instance->logger, "init", NULL, NULL,
+			         "failed to open binary log file '%s'",
+			         instance->config.log_binary_file);
+			return -1;
+		}
+	}
+
+	/* workload capture */
+	if (instance->config.capture_file) {
+		rc = od_logger_open_capture(&instance->logger,
+		                            instance->config.capture_file);
+		if (rc == -1) {
+			od_error(&instance->logger, "init", NULL, NULL,
+			         "failed to open capture file '%s'",
+			         instance->config.capture_file);
+			return -1;
+		}
+	}
+
 	/* syslog */
 	if (instance->config.log_syslog) {
 		od_logger_open_syslog(&instance->logger,
@@ -156,7 +153,7 @@ od_instance_main(od_instance_t *instance, int argc, char **argv)
 
 	if (instance->config.log_config) {
 		od_config_print(&instance->config, &instance->logger);
-		od_rules_print(&router.rules, &instance->logger);
+		od_rules_print(&router->rules, &instance->logger);
 	}
 
 	/* set process priority */
@@ -171,22 +168,109 @@ od_instance_main(od_instance_t *instance, int argc, char **argv)
 
 	/* initialize machinarium */
 	machinarium_set_stack_size(instance->config.coroutine_stack_size);
+	machinarium_set_stack_hugepages(instance->config.coroutine_stack_hugepages);
+	machinarium_set_stack_watermark(instance->config.coroutine_stack_watermark);
+	machinarium_set_coroutine_accounting(instance->config.coroutine_accounting);
+	machinarium_set_poll_spin(instance->config.poll_spin);
 	machinarium_set_pool_size(instance->config.resolvers);
 	machinarium_set_coroutine_cache_size(instance->config.cache_coroutine);
 	machinarium_set_msg_cache_gc_size(instance->config.cache_msg_gc_size);
+	machinarium_set_msg_cache_class_limit(instance->config.cache_msg_class_limit);
+	od_cache_set_size(&od_cache_client, instance->config.cache_client);
+	od_cache_set_size(&od_cache_server, instance->config.cache_server);
+	od_lockstat.enabled = instance->config.lock_stats;
+	if (instance->config.poller) {
+		rc = machinarium_set_poller(instance->config.poller);
+		if (rc == -1) {
+			od_error(&instance->logger, "init", NULL, NULL,
+			         "poller '%s' is not supported, using epoll",
+			         instance->config.poller);
+		}
+	}
+	if (instance->config.resolver)
+		machinarium_set_resolver(instance->config.resolver);
+	if (instance->config.clock_source)
+		machinarium_set_clock(instance->config.clock_source);
+	machinarium_set_watchdog(instance->config.watchdog_stall, od_stall_report,
+	                         instance);
 	rc = machinarium_init();
 	if (rc == -1) {
 		od_error(&instance->logger, "init", NULL, NULL,
 		         "failed to init machinarium");
 		return -1;
 	}
+	if (instance->config.clock_source &&
+	    strcmp(instance->config.clock_source, machinarium_clock()) != 0) {
+		od_error(&instance->logger, "init", NULL, NULL,
+		         "clock_source '%s' is not stable, using %s",
+		         instance->config.clock_source, machinarium_clock());
+	}
+
+	/* start logger thread */
+	if (instance->config.log_async) {
+		rc = od_logger_open_async(&instance->logger,
+		                          instance->config.log_async_buffer,
+		                          instance->config.log_async_block);
+		if (rc == -1) {
+			od_error(&instance->logger, "init", NULL, NULL,
+			         "failed to start logger thread");
+			return -1;
+		}
+	}
 
 	/* create pid file */
 	if (instance->config.pid_file)
 		od_pid_create(&instance->pid, instance->config.pid_file);
 
 	/* start system machine thread */
-	rc = od_system_start(&system, &global);
+	return od_system_start(global->system, global);
+}
+
+int
+od_instance_main(od_instance_t *instance, int argc, char **argv)
+{
+	/* prepare system services */
+	od_system_t      system;
+	od_router_t      router;
+	od_cron_t        cron;
+	od_worker_pool_t worker_pool;
+	od_metrics_t     metrics;
+	od_global_t      global;
+
+	/* signals are handled by the system machine, threads created
+	 * later inherit the mask */
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGHUP);
+	sigaddset(&mask, SIGPIPE);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	od_log(&instance->logger, "startup", NULL, NULL, "Starting Odyssey");
+
+	od_system_init(&system);
+	od_router_init(&router);
+	od_cron_init(&cron);
+	od_worker_pool_init(&worker_pool);
+	od_metrics_init(&metrics);
+	od_global_init(&global, instance, &system, &router, &cron, &worker_pool,
+	               &metrics);
+
+	/* validate command line options */
+	if (argc != 2) {
+		od_usage(instance, argv[0]);
+		return -1;
+	}
+	if (strcmp(argv[1], "-h") == 0 ||
+	    strcmp(argv[1], "--help") == 0) {
+		od_usage(instance, argv[0]);
+		return 0;
+	}
+	instance->config_file = argv[1];
+
+	int rc;
+	rc = od_instance_start(instance, &global);
 	if (rc == -1)
 		return -1;
 
@@ -15,10 +15,12 @@ struct od_instance
 	od_logger_t  logger;
 	char        *config_file;
 	od_config_t  config;
+	void        *embed;
 };
 
 void od_instance_init(od_instance_t*);
 void od_instance_free(od_instance_t*);
+int  od_instance_start(od_instance_t*, od_global_t*);
 int  od_instance_main(od_instance_t*, int, char**);
 
 #endif /* ODYSSEY_INSTANCE_H */
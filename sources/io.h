@@ -11,6 +11,14 @@
 
 typedef struct od_io od_io_t;
 
+/* zlib level of compressed peer connections (see listen and
+ * storage compression option), favour speed */
+#define OD_IO_COMPRESSION_LEVEL 1
+
+/* socket buffers of unix socket connections, local relay is
+ * limited by them rather than by the network */
+#define OD_IO_UNIX_BUFSIZE (1024 * 1024)
+
 struct od_io
 {
 	od_readahead_t  readahead;
@@ -38,6 +46,17 @@ od_io_free(od_io_t *io)
 	    machine_cond_free(io->on_write);
 }
 
+static inline void
+od_io_reuse(od_io_t *io)
+{
+	/* release buffer, but keep conditions for the next connection */
+	od_readahead_free(&io->readahead);
+	od_readahead_init(&io->readahead);
+	io->io = NULL;
+	od_cache_cond_reset(io->on_read);
+	od_cache_cond_reset(io->on_write);
+}
+
 static inline char*
 od_io_error(od_io_t *io)
 {
@@ -45,19 +64,23 @@ od_io_error(od_io_t *io)
 }
 
 static inline int
-od_io_prepare(od_io_t *io, machine_io_t *io_obj, int readahead)
+od_io_prepare(od_io_t *io, machine_io_t *io_obj, int readahead, int ring)
 {
 	io->io = io_obj;
 	int rc;
-	rc = od_readahead_prepare(&io->readahead, readahead);
+	rc = od_readahead_prepare(&io->readahead, readahead, ring);
 	if (rc == -1)
 		return -1;
-	io->on_read = machine_cond_create();
-	if (io->on_read == NULL)
-		return -1;
-	io->on_write = machine_cond_create();
-	if (io->on_write == NULL)
-		return -1;
+	if (io->on_read == NULL) {
+		io->on_read = machine_cond_create();
+		if (io->on_read == NULL)
+			return -1;
+	}
+	if (io->on_write == NULL) {
+		io->on_write = machine_cond_create();
+		if (io->on_write == NULL)
+			return -1;
+	}
 	return 0;
 }
 
@@ -99,6 +122,8 @@ od_io_read_start(od_io_t *io)
 static inline int
 od_io_read_stop(od_io_t *io)
 {
+	if (io->io == NULL)
+		return -1;
 	return machine_read_stop(io->io);
 }
 
@@ -111,9 +136,52 @@ od_io_write_start(od_io_t *io)
 static inline int
 od_io_write_stop(od_io_t *io)
 {
+	if (io->io == NULL)
+		return -1;
 	return machine_write_stop(io->io);
 }
 
+static inline int
+od_io_read_more(od_io_t *io, uint32_t time_ms, int *read_started)
+{
+	/* read whatever is available into the readahead buffer */
+	int rc;
+	for (;;)
+	{
+		rc = machine_cond_wait(io->on_read, time_ms);
+		if (rc == -1)
+			return -1;
+
+		rc = od_readahead_ensure(&io->readahead);
+		if (rc == -1)
+			return -1;
+
+		int left;
+		left = od_readahead_left(&io->readahead);
+
+		rc = machine_read_raw(io->io, od_readahead_pos(&io->readahead), left);
+		if (rc <= 0) {
+			/* retry using read condition wait */
+			int errno_ = machine_errno();
+			if (errno_ == EAGAIN || errno_ == EWOULDBLOCK || errno_ == EINTR) {
+				if (! *read_started) {
+					rc = od_io_read_start(io);
+					if (rc == -1)
+						return -1;
+					*read_started = 1;
+				}
+				continue;
+			}
+			/* error or unexpected eof */
+			return -1;
+		}
+
+		od_readahead_pos_advance(&io->readahead, rc);
+		od_readahead_account(&io->readahead, rc, left);
+		return 0;
+	}
+}
+
 static inline int
 od_io_read(od_io_t *io, char *dest, int size, uint32_t time_ms)
 {
@@ -132,9 +200,10 @@ od_io_read(od_io_t *io, char *dest, int size, uint32_t time_ms)
 			size -= to_read;
 			pos  += to_read;
 			od_readahead_pos_read_advance(&io->readahead, to_read);
-		} else {
-			od_readahead_reuse(&io->readahead);
 		}
+		/* drained buffer is read from the start again */
+		if (od_readahead_unread(&io->readahead) == 0)
+			od_readahead_reuse(&io->readahead);
 
 		if (size == 0)
 			break;
@@ -142,35 +211,49 @@ od_io_read(od_io_t *io, char *dest, int size, uint32_t time_ms)
 		if (! read_started)
 			machine_cond_signal(io->on_read);
 
-		for (;;)
-		{
-			rc = machine_cond_wait(io->on_read, time_ms);
-			if (rc == -1)
-				return -1;
-
-			int left;
-			left = od_readahead_left(&io->readahead);
-
-			rc = machine_read_raw(io->io, od_readahead_pos(&io->readahead), left);
-			if (rc <= 0) {
-				/* retry using read condition wait */
-				int errno_ = machine_errno();
-				if (errno_ == EAGAIN || errno_ == EWOULDBLOCK || errno_ == EINTR) {
-					if (! read_started) {
-						rc = od_io_read_start(io);
-						if (rc == -1)
-							return -1;
-						read_started = 1;
-					}
-					continue;
-				}
-				/* error or unexpected eof */
-				return -1;
-			}
+		rc = od_io_read_more(io, time_ms, &read_started);
+		if (rc == -1)
+			return -1;
+	}
 
-			od_readahead_pos_advance(&io->readahead, rc);
-			break;
+	if (read_started) {
+		rc = od_io_read_stop(io);
+		if (rc == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+static inline int
+od_io_peek(od_io_t *io, int size, uint32_t time_ms, char **data)
+{
+	/* wait for size bytes of unread data in the readahead buffer
+	 * and point to them without consuming, returns 1 if they can
+	 * not fit into the buffer */
+	int read_started = 0;
+	int rc;
+	while (od_readahead_unread(&io->readahead) < size)
+	{
+		rc = od_readahead_ensure(&io->readahead);
+		if (rc == -1)
+			return -1;
+		od_readahead_t *readahead = &io->readahead;
+		if (readahead->pos_read + size > readahead->start + readahead->buf_size) {
+			if (size > readahead->buf_size) {
+				if (read_started)
+					od_io_read_stop(io);
+				return 1;
+			}
+			od_readahead_compact(readahead);
 		}
+
+		if (! read_started)
+			machine_cond_signal(io->on_read);
+
+		rc = od_io_read_more(io, time_ms, &read_started);
+		if (rc == -1)
+			return -1;
 	}
 
 	if (read_started) {
@@ -179,6 +262,7 @@ od_io_read(od_io_t *io, char *dest, int size, uint32_t time_ms)
 			return -1;
 	}
 
+	*data = od_readahead_pos_read(&io->readahead);
 	return 0;
 }
 
@@ -64,6 +64,10 @@ od_list_empty(od_list_t *list)
 	for (iterator = (list)->next; iterator != list; \
 	     iterator = (iterator)->next)
 
+#define od_list_foreach_reverse(list, iterator) \
+	for (iterator = (list)->prev; iterator != list; \
+	     iterator = (iterator)->prev)
+
 #define od_list_foreach_safe(list, iterator, safe) \
 	for (iterator = (list)->next; \
 	     iterator != list && (safe = iterator->next); \
@@ -0,0 +1,696 @@
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+static inline void
+od_listen_skip_space(char **pos, char *end)
+{
+	while (*pos < end && isspace((unsigned char)**pos))
+		(*pos)++;
+}
+
+static inline int
+od_listen_ident_char(char c)
+{
+	return isalnum((unsigned char)c) || c == '_' || c == '$' ||
+	       (unsigned char)c >= 0x80;
+}
+
+static inline int
+od_listen_keyword(char **pos, char *end, char *keyword, int len)
+{
+	if (end - *pos < len || strncasecmp(*pos, keyword, len) != 0)
+		return 0;
+	if (*pos + len < end && od_listen_ident_char((*pos)[len]))
+		return 0;
+	*pos += len;
+	return 1;
+}
+
+int
+od_listen_parse(char *query, int len, int *unlisten, char *name, int *name_len)
+{
+	/* single LISTEN channel, UNLISTEN channel or UNLISTEN * statement,
+	 * the channel name is folded as by the server. Anything else,
+	 * including comments, is left to the server */
+	char *pos = query;
+	char *end = query + len;
+	while (end > pos && (end[-1] == '\0' || end[-1] == ';' ||
+	                     isspace((unsigned char)end[-1])))
+		end--;
+	od_listen_skip_space(&pos, end);
+	if (od_listen_keyword(&pos, end, "listen", 6))
+		*unlisten = 0;
+	else
+	if (od_listen_keyword(&pos, end, "unlisten", 8))
+		*unlisten = 1;
+	else
+		return -1;
+	od_listen_skip_space(&pos, end);
+
+	int size = 0;
+	if (*unlisten && pos < end && *pos == '*') {
+		pos++;
+	} else
+	if (pos < end && *pos == '"') {
+		pos++;
+		for (;;) {
+			if (pos == end)
+				return -1;
+			if (*pos == '"') {
+				if (pos + 1 < end && pos[1] == '"') {
+					pos++;
+				} else {
+					pos++;
+					break;
+				}
+			}
+			if (size == OD_LISTEN_NAME_MAX - 1)
+				return -1;
+			name[size++] = *pos++;
+		}
+		if (size == 0)
+			return -1;
+	} else {
+		if (pos == end || isdigit((unsigned char)*pos) || *pos == '$' ||
+		    !od_listen_ident_char(*pos))
+			return -1;
+		while (pos < end && od_listen_ident_char(*pos)) {
+			if (size == OD_LISTEN_NAME_MAX - 1)
+				return -1;
+			name[size++] = tolower((unsigned char)*pos);
+			pos++;
+		}
+	}
+	od_listen_skip_space(&pos, end);
+	if (pos != end)
+		return -1;
+	name[size] = 0;
+	*name_len = size;
+	return 0;
+}
+
+static inline od_listen_channel_t*
+od_listen_channel_match(od_listen_t *hub, char *name, int name_len)
+{
+	od_list_t *i;
+	od_list_foreach(&hub->channels, i) {
+		od_listen_channel_t *channel;
+		channel = od_container_of(i, od_listen_channel_t, link);
+		if (channel->name_len == name_len &&
+		    memcmp(channel->name, name, name_len) == 0)
+			return channel;
+	}
+	return NULL;
+}
+
+static inline od_listen_sub_t*
+od_listen_sub_match(od_listen_channel_t *channel, od_client_t *client)
+{
+	od_list_t *i;
+	od_list_foreach(&channel->subs, i) {
+		od_listen_sub_t *sub;
+		sub = od_container_of(i, od_listen_sub_t, link);
+		if (sub->client == client)
+			return sub;
+	}
+	return NULL;
+}
+
+static inline void
+od_listen_wakeup(od_listen_t *hub)
+{
+	/* hub must be locked */
+	machine_msg_t *msg;
+	msg = machine_msg_create(0);
+	if (msg == NULL)
+		return;
+	machine_msg_set_type(msg, OD_MSG_LISTEN_CHANGE);
+	machine_channel_write(hub->channel, msg);
+}
+
+static inline void
+od_listen_reply(od_listen_sub_t *sub, int type)
+{
+	/* answer LISTEN of the waiting client */
+	machine_msg_t *msg;
+	msg = machine_msg_create(0);
+	if (msg == NULL) {
+		/* waiting client is disconnected instead */
+		od_client_kill(sub->client);
+		return;
+	}
+	machine_msg_set_type(msg, type);
+	machine_channel_write(sub->client->listen_channel, msg);
+}
+
+static inline void
+od_listen_fail(od_listen_t *hub)
+{
+	/* notifications of the lost connection are lost as well, so
+	 * subscribed clients are disconnected as in session pooling */
+	pthread_mutex_lock(&hub->lock);
+	od_list_t *i, *n;
+	od_list_foreach_safe(&hub->channels, i, n) {
+		od_listen_channel_t *channel;
+		channel = od_container_of(i, od_listen_channel_t, link);
+		od_list_t *j, *m;
+		od_list_foreach_safe(&channel->subs, j, m) {
+			od_listen_sub_t *sub;
+			sub = od_container_of(j, od_listen_sub_t, link);
+			if (sub->pending)
+				od_listen_reply(sub, OD_MSG_LISTEN_ERROR);
+			else
+				od_client_kill(sub->client);
+			free(sub);
+		}
+		free(channel);
+	}
+	od_list_init(&hub->channels);
+	hub->sent    = 0;
+	hub->running = 0;
+	pthread_mutex_unlock(&hub->lock);
+}
+
+static inline void
+od_listen_notify(od_listen_t *hub, char *data, int size)
+{
+	/* NotificationResponse: pid, channel and payload */
+	if (size < (int)sizeof(kiwi_header_t) + 4)
+		return;
+	char *name = data + sizeof(kiwi_header_t) + 4;
+	int name_len = strnlen(name, size - sizeof(kiwi_header_t) - 4);
+
+	pthread_mutex_lock(&hub->lock);
+	od_listen_channel_t *channel;
+	channel = od_listen_channel_match(hub, name, name_len);
+	if (channel == NULL) {
+		pthread_mutex_unlock(&hub->lock);
+		return;
+	}
+	od_list_t *i;
+	od_list_foreach(&channel->subs, i) {
+		od_listen_sub_t *sub;
+		sub = od_container_of(i, od_listen_sub_t, link);
+		if (sub->pending)
+			continue;
+		machine_msg_t *msg;
+		msg = machine_msg_create(size);
+		if (msg == NULL)
+			continue;
+		memcpy(machine_msg_data(msg), data, size);
+		machine_msg_set_type(msg, OD_MSG_LISTEN_NOTIFY);
+		machine_channel_write(sub->client->listen_channel, msg);
+		od_client_notify(sub->client);
+	}
+	pthread_mutex_unlock(&hub->lock);
+}
+
+static inline void
+od_listen_ready(od_listen_t *hub)
+{
+	/* statements sent by the hub are completed */
+	pthread_mutex_lock(&hub->lock);
+	od_list_t *i, *n;
+	od_list_foreach_safe(&hub->channels, i, n) {
+		od_listen_channel_t *channel;
+		channel = od_container_of(i, od_listen_channel_t, link);
+		switch (channel->state) {
+		case OD_LISTEN_SENT:
+		{
+			channel->state = OD_LISTEN_LISTENED;
+			od_list_t *j;
+			od_list_foreach(&channel->subs, j) {
+				od_listen_sub_t *sub;
+				sub = od_container_of(j, od_listen_sub_t, link);
+				if (! sub->pending)
+					continue;
+				sub->pending = 0;
+				od_listen_reply(sub, OD_MSG_LISTEN_ACK);
+			}
+			break;
+		}
+		case OD_LISTEN_UNLISTEN_SENT:
+			/* subscribed again meanwhile, listened by the
+			 * next batch */
+			channel->state = OD_LISTEN_IDLE;
+			break;
+		default:
+			break;
+		}
+	}
+	hub->sent = 0;
+	od_listen_wakeup(hub);
+	pthread_mutex_unlock(&hub->lock);
+}
+
+static void
+od_listen_reader(void *arg)
+{
+	od_listen_hub_t *listen_hub = arg;
+	od_listen_t *hub = listen_hub->listen;
+	od_client_t *client = listen_hub->client;
+	od_server_t *server = client->server;
+	od_instance_t *instance = server->global->instance;
+
+	for (;;)
+	{
+		machine_msg_t *msg;
+		msg = od_read(&server->io, UINT32_MAX);
+		if (msg == NULL) {
+			if (machine_cancelled())
+				return;
+			od_error(&instance->logger, "listen", client, server,
+			         "read error: %s",
+			         od_io_error(&server->io));
+			break;
+		}
+		char *data = machine_msg_data(msg);
+		int size = machine_msg_size(msg);
+		kiwi_be_type_t type = *data;
+
+		int rc = 0;
+		switch (type) {
+		case KIWI_BE_NOTIFICATION_RESPONSE:
+			od_listen_notify(hub, data, size);
+			break;
+		case KIWI_BE_READY_FOR_QUERY:
+			od_backend_ready(server, data, size);
+			od_listen_ready(hub);
+			break;
+		case KIWI_BE_ERROR_RESPONSE:
+			od_backend_error(server, "listen", data, size);
+			rc = -1;
+			break;
+		default:
+			break;
+		}
+		machine_msg_free(msg);
+		if (rc == -1)
+			break;
+	}
+
+	listen_hub->failed = 1;
+	listen_hub->reader_id = -1;
+	pthread_mutex_lock(&hub->lock);
+	od_listen_wakeup(hub);
+	pthread_mutex_unlock(&hub->lock);
+}
+
+static inline int
+od_listen_quote(machine_msg_t *msg, char *statement, od_listen_channel_t *channel)
+{
+	int rc;
+	rc = machine_msg_write(msg, statement, strlen(statement));
+	rc |= machine_msg_write(msg, " \"", 2);
+	int i;
+	for (i = 0; i < channel->name_len; i++) {
+		if (channel->name[i] == '"')
+			rc |= machine_msg_write(msg, "\"", 1);
+		rc |= machine_msg_write(msg, &channel->name[i], 1);
+	}
+	rc |= machine_msg_write(msg, "\";", 2);
+	return rc;
+}
+
+static inline int
+od_listen_apply(od_listen_hub_t *listen_hub)
+{
+	/* send LISTEN and UNLISTEN of changed channels in a single
+	 * query, returns 1 when the hub has to stop */
+	od_listen_t *hub = listen_hub->listen;
+	od_server_t *server = listen_hub->client->server;
+	od_instance_t *instance = server->global->instance;
+
+	machine_msg_t *query;
+	query = machine_msg_create(0);
+	if (query == NULL)
+		return -1;
+
+	pthread_mutex_lock(&hub->lock);
+	if (hub->sent) {
+		pthread_mutex_unlock(&hub->lock);
+		machine_msg_free(query);
+		return 0;
+	}
+	int count = 0;
+	int rc = 0;
+	od_list_t *i, *n;
+	od_list_foreach_safe(&hub->channels, i, n) {
+		od_listen_channel_t *channel;
+		channel = od_container_of(i, od_listen_channel_t, link);
+		if (channel->state == OD_LISTEN_IDLE && channel->count > 0) {
+			rc |= od_listen_quote(query, "LISTEN", channel);
+			channel->state = OD_LISTEN_SENT;
+			count++;
+		} else
+		if (channel->state == OD_LISTEN_LISTENED && channel->count == 0) {
+			rc |= od_listen_quote(query, "UNLISTEN", channel);
+			channel->state = OD_LISTEN_UNLISTEN_SENT;
+			count++;
+		} else
+		if (channel->state == OD_LISTEN_IDLE && channel->count == 0) {
+			od_list_unlink(&channel->link);
+			free(channel);
+		}
+	}
+	if (count == 0) {
+		int stop = od_list_empty(&hub->channels);
+		if (stop)
+			hub->running = 0;
+		pthread_mutex_unlock(&hub->lock);
+		machine_msg_free(query);
+		return stop;
+	}
+	hub->sent = 1;
+	pthread_mutex_unlock(&hub->lock);
+
+	rc |= machine_msg_write(query, "", 1);
+	if (rc == -1) {
+		machine_msg_free(query);
+		return -1;
+	}
+	od_debug(&instance->logger, "listen", listen_hub->client, server,
+	         "%s", machine_msg_data(query));
+
+	machine_msg_t *msg;
+	msg = kiwi_fe_write_query(NULL, machine_msg_data(query),
+	                          machine_msg_size(query));
+	machine_msg_free(query);
+	if (msg == NULL)
+		return -1;
+	od_server_sync_request(server, 1);
+	rc = od_write(&server->io, msg);
+	if (rc == -1) {
+		od_error(&instance->logger, "listen", listen_hub->client, server,
+		         "write error: %s",
+		         od_io_error(&server->io));
+		return -1;
+	}
+	return 0;
+}
+
+static void
+od_listen_main(void *arg)
+{
+	od_client_t *client = arg;
+	od_global_t *global = client->global;
+	od_instance_t *instance = global->instance;
+	od_router_t *router = global->router;
+	od_route_t *route = client->route;
+	od_listen_t *hub = &route->listen;
+	od_server_t *server = NULL;
+	int rc;
+
+	od_listen_hub_t listen_hub = {
+		.listen    = hub,
+		.client    = client,
+		.reader_id = -1,
+		.failed    = 0
+	};
+
+	/* attach the internal client, it keeps the route */
+	od_router_status_t status;
+	status = od_router_attach(router, &instance->config, client, false);
+	if (status != OD_ROUTER_OK)
+		goto unroute;
+	server = client->server;
+
+	if (server->io.io == NULL) {
+		rc = od_backend_connect(server, "listen", NULL);
+		if (rc == -1)
+			goto close;
+	}
+
+	listen_hub.reader_id = machine_coroutine_create(od_listen_reader,
+	                                                &listen_hub);
+	if (listen_hub.reader_id == -1)
+		goto close;
+
+	od_debug(&instance->logger, "listen", client, server, "started");
+
+	for (;;)
+	{
+		if (listen_hub.failed)
+			break;
+		rc = od_listen_apply(&listen_hub);
+		if (rc == -1) {
+			listen_hub.failed = 1;
+			break;
+		}
+		if (rc == 1)
+			break;
+		machine_msg_t *msg;
+		msg = machine_channel_read(hub->channel, UINT32_MAX);
+		if (msg)
+			machine_msg_free(msg);
+	}
+
+	if (listen_hub.reader_id != -1) {
+		machine_cancel(listen_hub.reader_id);
+		machine_join(listen_hub.reader_id);
+	}
+	if (od_io_read_active(&server->io))
+		od_io_read_stop(&server->io);
+
+	if (listen_hub.failed)
+		goto close;
+
+	od_debug(&instance->logger, "listen", client, server, "stopped");
+
+	/* every channel is unlistened */
+	rc = od_reset(server);
+	if (rc != 1) {
+		od_router_close(router, client);
+	} else {
+		od_router_detach(router, &instance->config, client);
+	}
+	od_router_unroute(router, client);
+	od_client_free(client);
+	return;
+
+close:
+	od_router_close(router, client);
+unroute:
+	od_error(&instance->logger, "listen", client, NULL,
+	         "notification hub failed");
+	od_listen_fail(hub);
+	od_router_unroute(router, client);
+	od_client_free(client);
+}
+
+static inline int
+od_listen_start(od_client_t *client)
+{
+	/* hub runs on the worker of the first subscriber, hub must
+	 * be locked */
+	od_instance_t *instance = client->global->instance;
+	od_router_t *router = client->global->router;
+	od_listen_t *hub = &((od_route_t*)client->route)->listen;
+
+	if (hub->channel == NULL) {
+		hub->channel = machine_channel_create(1);
+		if (hub->channel == NULL)
+			return -1;
+	}
+
+	/* internal client with the route of the subscriber */
+	od_client_t *listen_client;
+	listen_client = od_client_allocate();
+	if (listen_client == NULL)
+		return -1;
+	listen_client->global    = client->global;
+	listen_client->worker_id = client->worker_id;
+	od_id_generate(&listen_client->id, "l");
+	kiwi_var_set(&listen_client->startup.user, KIWI_VAR_UNDEF,
+	             client->startup.user.value,
+	             client->startup.user.value_len);
+	kiwi_var_set(&listen_client->startup.database, KIWI_VAR_UNDEF,
+	             client->startup.database.value,
+	             client->startup.database.value_len);
+	od_router_status_t status;
+	status = od_router_route(router, &instance->config, listen_client);
+	if (status != OD_ROUTER_OK) {
+		od_client_free(listen_client);
+		return -1;
+	}
+	if (listen_client->route != client->route) {
+		od_router_unroute(router, listen_client);
+		od_client_free(listen_client);
+		return -1;
+	}
+
+	int64_t coroutine_id;
+	coroutine_id = machine_coroutine_create(od_listen_main, listen_client);
+	if (coroutine_id == -1) {
+		od_router_unroute(router, listen_client);
+		od_client_free(listen_client);
+		return -1;
+	}
+	hub->running = 1;
+	return 0;
+}
+
+static inline od_status_t
+od_listen_wait(od_client_t *client)
+{
+	/* notifications of other channels may arrive first */
+	for (;;)
+	{
+		machine_msg_t *msg;
+		msg = machine_channel_read(client->listen_channel, UINT32_MAX);
+		if (msg == NULL)
+			return OD_ECLIENT_READ;
+		int type = machine_msg_type(msg);
+		if (type == OD_MSG_LISTEN_ACK) {
+			machine_msg_free(msg);
+			return OD_OK;
+		}
+		if (type == OD_MSG_LISTEN_ERROR) {
+			machine_msg_free(msg);
+			return OD_ESERVER_CONNECT;
+		}
+		int rc;
+		rc = od_write(&client->io, msg);
+		if (rc == -1)
+			return OD_ECLIENT_WRITE;
+	}
+}
+
+od_status_t
+od_listen_subscribe(od_client_t *client, char *name, int name_len)
+{
+	od_listen_t *hub = &((od_route_t*)client->route)->listen;
+
+	if (client->listen_channel == NULL) {
+		client->listen_channel = machine_channel_create(1);
+		if (client->listen_channel == NULL)
+			return OD_EOOM;
+	}
+
+	pthread_mutex_lock(&hub->lock);
+	od_listen_channel_t *channel;
+	channel = od_listen_channel_match(hub, name, name_len);
+	if (channel && od_listen_sub_match(channel, client)) {
+		pthread_mutex_unlock(&hub->lock);
+		return OD_OK;
+	}
+	od_listen_sub_t *sub;
+	sub = malloc(sizeof(*sub));
+	if (sub == NULL) {
+		pthread_mutex_unlock(&hub->lock);
+		return OD_EOOM;
+	}
+	if (channel == NULL) {
+		channel = malloc(sizeof(*channel));
+		if (channel == NULL) {
+			pthread_mutex_unlock(&hub->lock);
+			free(sub);
+			return OD_EOOM;
+		}
+		memcpy(channel->name, name, name_len + 1);
+		channel->name_len = name_len;
+		channel->state    = OD_LISTEN_IDLE;
+		channel->count    = 0;
+		od_list_init(&channel->subs);
+		od_list_append(&hub->channels, &channel->link);
+	}
+	sub->client  = client;
+	sub->channel = channel;
+	sub->pending = channel->state != OD_LISTEN_LISTENED;
+	od_list_init(&sub->link);
+	od_list_append(&channel->subs, &sub->link);
+	channel->count++;
+
+	int pending = sub->pending;
+	if (pending) {
+		int rc = 0;
+		if (hub->running)
+			od_listen_wakeup(hub);
+		else
+			rc = od_listen_start(client);
+		if (rc == -1) {
+			od_list_unlink(&sub->link);
+			free(sub);
+			channel->count--;
+			if (channel->count == 0) {
+				od_list_unlink(&channel->link);
+				free(channel);
+			}
+			pthread_mutex_unlock(&hub->lock);
+			return OD_ESERVER_CONNECT;
+		}
+	}
+	pthread_mutex_unlock(&hub->lock);
+
+	if (! pending)
+		return OD_OK;
+	return od_listen_wait(client);
+}
+
+void
+od_listen_unsubscribe(od_client_t *client, char *name, int name_len)
+{
+	/* all channels of the client unless name is set */
+	od_listen_t *hub = &((od_route_t*)client->route)->listen;
+	pthread_mutex_lock(&hub->lock);
+	int changed = 0;
+	od_list_t *i;
+	od_list_foreach(&hub->channels, i) {
+		od_listen_channel_t *channel;
+		channel = od_container_of(i, od_listen_channel_t, link);
+		if (name && (channel->name_len != name_len ||
+		             memcmp(channel->name, name, name_len) != 0))
+			continue;
+		od_listen_sub_t *sub;
+		sub = od_listen_sub_match(channel, client);
+		if (sub == NULL)
+			continue;
+		od_list_unlink(&sub->link);
+		free(sub);
+		channel->count--;
+		if (channel->count == 0)
+			changed = 1;
+	}
+	if (changed && hub->running)
+		od_listen_wakeup(hub);
+	pthread_mutex_unlock(&hub->lock);
+}
+
+od_status_t
+od_listen_deliver(od_client_t *client)
+{
+	/* write notifications received while the client was attached
+	 * or waiting for queries */
+	for (;;)
+	{
+		machine_msg_t *msg;
+		msg = machine_channel_read(client->listen_channel, 0);
+		if (msg == NULL)
+			return OD_OK;
+		if (machine_msg_type(msg) != OD_MSG_LISTEN_NOTIFY) {
+			machine_msg_free(msg);
+			continue;
+		}
+		int rc;
+		rc = od_write(&client->io, msg);
+		if (rc == -1)
+			return OD_ECLIENT_WRITE;
+	}
+}
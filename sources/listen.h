@@ -0,0 +1,105 @@
+#ifndef ODYSSEY_LISTEN_H
+#define ODYSSEY_LISTEN_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_listen_sub     od_listen_sub_t;
+typedef struct od_listen_channel od_listen_channel_t;
+typedef struct od_listen_hub     od_listen_hub_t;
+typedef struct od_listen         od_listen_t;
+
+/* Notification hub of a pool_listen route.
+ *
+ * LISTEN and UNLISTEN of idle clients are answered by odyssey and
+ * subscribe clients to channels of the route hub. The hub coroutine
+ * holds one server connection of the route, which LISTENs on the
+ * union of subscribed channels, and copies every NotificationResponse
+ * into the channel of each subscriber. Clients write them out on
+ * their own workers while not attached to a server.
+ *
+ * LISTEN is answered after the server LISTEN is completed, so a
+ * notification sent after the reply is never missed. The hub stops
+ * once the last channel is unlistened, clients subscribed to a lost
+ * hub connection are disconnected. */
+
+#define OD_LISTEN_NAME_MAX 64
+
+typedef enum
+{
+	OD_LISTEN_IDLE,
+	OD_LISTEN_SENT,
+	OD_LISTEN_LISTENED,
+	OD_LISTEN_UNLISTEN_SENT
+} od_listen_state_t;
+
+struct od_listen_sub
+{
+	od_client_t         *client;
+	od_listen_channel_t *channel;
+	int                  pending;
+	od_list_t            link;
+};
+
+struct od_listen_channel
+{
+	char               name[OD_LISTEN_NAME_MAX];
+	int                name_len;
+	od_listen_state_t  state;
+	int                count;
+	od_list_t          subs;
+	od_list_t          link;
+};
+
+/* hub coroutines of one server connection */
+struct od_listen_hub
+{
+	od_listen_t *listen;
+	od_client_t *client;
+	int64_t      reader_id;
+	int          failed;
+};
+
+struct od_listen
+{
+	pthread_mutex_t    lock;
+	int                running;
+	int                sent;
+	machine_channel_t *channel;
+	od_list_t          channels;
+};
+
+static inline void
+od_listen_init(od_listen_t *hub)
+{
+	pthread_mutex_init(&hub->lock, NULL);
+	hub->running = 0;
+	hub->sent    = 0;
+	hub->channel = NULL;
+	od_list_init(&hub->channels);
+}
+
+static inline void
+od_listen_free(od_listen_t *hub)
+{
+	/* route is freed without clients, so the hub is stopped */
+	od_list_t *i, *n;
+	od_list_foreach_safe(&hub->channels, i, n) {
+		od_listen_channel_t *channel;
+		channel = od_container_of(i, od_listen_channel_t, link);
+		free(channel);
+	}
+	if (hub->channel)
+		machine_channel_free(hub->channel);
+	pthread_mutex_destroy(&hub->lock);
+}
+
+int         od_listen_parse(char*, int, int*, char*, int*);
+od_status_t od_listen_subscribe(od_client_t*, char*, int);
+void        od_listen_unsubscribe(od_client_t*, char*, int);
+od_status_t od_listen_deliver(od_client_t*);
+
+#endif /* ODYSSEY_LISTEN_H */
@@ -0,0 +1,203 @@
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+od_lockstat_t od_lockstat =
+{
+	.enabled = 0,
+	.threads = NULL
+};
+
+static __thread od_lockstat_thread_t *od_lockstat_self = NULL;
+
+static char *od_lockstat_locks[] =
+{
+	[OD_LOCKSTAT_ROUTER] = "router",
+	[OD_LOCKSTAT_ROUTE]  = "route"
+};
+
+static char *od_lockstat_sites[] =
+{
+	[OD_LOCK_ROUTE]   = "route",
+	[OD_LOCK_ATTACH]  = "attach",
+	[OD_LOCK_DETACH]  = "detach",
+	[OD_LOCK_STAT]    = "stat",
+	[OD_LOCK_EXPIRE]  = "expire",
+	[OD_LOCK_GC]      = "gc",
+	[OD_LOCK_CONSOLE] = "console",
+	[OD_LOCK_RELOAD]  = "reload",
+	[OD_LOCK_OTHER]   = "other"
+};
+
+char*
+od_lockstat_lock_name(int lock)
+{
+	return od_lockstat_locks[lock];
+}
+
+char*
+od_lockstat_site_name(int site)
+{
+	return od_lockstat_sites[site];
+}
+
+static void
+od_lockstat_sites_free(od_lockstat_site_t sites[OD_LOCKSTAT_MAX][OD_LOCK_SITE_MAX])
+{
+	int i, j;
+	for (i = 0; i < OD_LOCKSTAT_MAX; i++) {
+		for (j = 0; j < OD_LOCK_SITE_MAX; j++) {
+			od_lockstat_site_t *site = &sites[i][j];
+			if (site->wait_hgram)
+				od_hgram_free(site->wait_hgram);
+			if (site->hold_hgram)
+				od_hgram_free(site->hold_hgram);
+		}
+	}
+}
+
+static int
+od_lockstat_sites_init(od_lockstat_site_t sites[OD_LOCKSTAT_MAX][OD_LOCK_SITE_MAX])
+{
+	memset(sites, 0, sizeof(od_lockstat_site_t) * OD_LOCKSTAT_MAX * OD_LOCK_SITE_MAX);
+	int i, j;
+	for (i = 0; i < OD_LOCKSTAT_MAX; i++) {
+		for (j = 0; j < OD_LOCK_SITE_MAX; j++) {
+			od_lockstat_site_t *site = &sites[i][j];
+			site->wait_hgram = od_hgram_allocate(OD_LOCKSTAT_HGRAM_PRECISION);
+			site->hold_hgram = od_hgram_allocate(OD_LOCKSTAT_HGRAM_PRECISION);
+			if (site->wait_hgram == NULL || site->hold_hgram == NULL) {
+				od_lockstat_sites_free(sites);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static inline od_lockstat_thread_t*
+od_lockstat_thread(void)
+{
+	od_lockstat_thread_t *thread = od_lockstat_self;
+	if (od_likely(thread))
+		return thread;
+	thread = malloc(sizeof(od_lockstat_thread_t));
+	if (thread == NULL)
+		return NULL;
+	if (od_lockstat_sites_init(thread->sites) == -1) {
+		free(thread);
+		return NULL;
+	}
+	thread->router_time = 0;
+	thread->router_site = OD_LOCK_OTHER;
+	od_lockstat_thread_t *head;
+	do {
+		head = od_lockstat.threads;
+		thread->next = head;
+	} while (! __sync_bool_compare_and_swap(&od_lockstat.threads, head, thread));
+	od_lockstat_self = thread;
+	return thread;
+}
+
+void
+od_lockstat_wait(od_lockstat_lock_t lock, od_lock_site_t site,
+                 uint64_t start, uint64_t now)
+{
+	od_lockstat_thread_t *thread = od_lockstat_thread();
+	if (thread == NULL)
+		return;
+	od_lockstat_site_t *stat = &thread->sites[lock][site];
+	uint64_t wait = now - start;
+	stat->count++;
+	stat->wait += wait;
+	od_hgram_add_data_point(stat->wait_hgram, wait);
+}
+
+void
+od_lockstat_hold(od_lockstat_lock_t lock, od_lock_site_t site,
+                 uint64_t acquired)
+{
+	od_lockstat_thread_t *thread = od_lockstat_thread();
+	if (thread == NULL)
+		return;
+	od_lockstat_site_t *stat = &thread->sites[lock][site];
+	uint64_t hold = od_lockstat_now() - acquired;
+	stat->hold += hold;
+	od_hgram_add_data_point(stat->hold_hgram, hold);
+}
+
+void
+od_lockstat_router_acquired(od_lock_site_t site, uint64_t start)
+{
+	/* router lock is not recursive, so a thread holds it
+	 * at most once and can keep the acquire time for unlock */
+	od_lockstat_thread_t *thread = od_lockstat_thread();
+	if (thread == NULL)
+		return;
+	uint64_t now = od_lockstat_now();
+	od_lockstat_wait(OD_LOCKSTAT_ROUTER, site, start, now);
+	thread->router_time = now;
+	thread->router_site = site;
+}
+
+void
+od_lockstat_router_released(void)
+{
+	od_lockstat_thread_t *thread = od_lockstat_self;
+	if (thread == NULL || thread->router_time == 0)
+		return;
+	od_lockstat_hold(OD_LOCKSTAT_ROUTER, thread->router_site,
+	                 thread->router_time);
+	thread->router_time = 0;
+}
+
+int
+od_lockstat_merge(od_lockstat_site_t sum[OD_LOCKSTAT_MAX][OD_LOCK_SITE_MAX])
+{
+	if (od_lockstat_sites_init(sum) == -1)
+		return -1;
+	od_lockstat_thread_t *thread = od_lockstat.threads;
+	for (; thread; thread = thread->next) {
+		int i, j;
+		for (i = 0; i < OD_LOCKSTAT_MAX; i++) {
+			for (j = 0; j < OD_LOCK_SITE_MAX; j++) {
+				od_lockstat_site_t *site = &thread->sites[i][j];
+				od_lockstat_site_t *dst  = &sum[i][j];
+				dst->count += site->count;
+				dst->wait  += site->wait;
+				dst->hold  += site->hold;
+				od_hgram_merge(dst->wait_hgram, site->wait_hgram);
+				od_hgram_merge(dst->hold_hgram, site->hold_hgram);
+			}
+		}
+	}
+	int i, j;
+	for (i = 0; i < OD_LOCKSTAT_MAX; i++) {
+		for (j = 0; j < OD_LOCK_SITE_MAX; j++) {
+			od_hgram_freeze(sum[i][j].wait_hgram, NULL, 0);
+			od_hgram_freeze(sum[i][j].hold_hgram, NULL, 0);
+		}
+	}
+	return 0;
+}
+
+void
+od_lockstat_merge_free(od_lockstat_site_t sum[OD_LOCKSTAT_MAX][OD_LOCK_SITE_MAX])
+{
+	od_lockstat_sites_free(sum);
+}
@@ -0,0 +1,85 @@
+#ifndef ODYSSEY_LOCKSTAT_H
+#define ODYSSEY_LOCKSTAT_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_lockstat_site   od_lockstat_site_t;
+typedef struct od_lockstat_thread od_lockstat_thread_t;
+typedef struct od_lockstat        od_lockstat_t;
+
+typedef enum
+{
+	OD_LOCKSTAT_ROUTER,
+	OD_LOCKSTAT_ROUTE,
+	OD_LOCKSTAT_MAX
+} od_lockstat_lock_t;
+
+/* operation which takes the lock */
+typedef enum
+{
+	OD_LOCK_ROUTE,
+	OD_LOCK_ATTACH,
+	OD_LOCK_DETACH,
+	OD_LOCK_STAT,
+	OD_LOCK_EXPIRE,
+	OD_LOCK_GC,
+	OD_LOCK_CONSOLE,
+	OD_LOCK_RELOAD,
+	OD_LOCK_OTHER,
+	OD_LOCK_SITE_MAX
+} od_lock_site_t;
+
+/* wait and hold times in nanoseconds */
+#define OD_LOCKSTAT_HGRAM_PRECISION 4
+
+struct od_lockstat_site
+{
+	uint64_t         count;
+	uint64_t         wait;
+	uint64_t         hold;
+	struct od_hgram *wait_hgram;
+	struct od_hgram *hold_hgram;
+};
+
+/* Counters are written by the owning thread only and merged
+ * by readers, threads are never removed from the list. */
+struct od_lockstat_thread
+{
+	od_lockstat_site_t    sites[OD_LOCKSTAT_MAX][OD_LOCK_SITE_MAX];
+	uint64_t              router_time;
+	int                   router_site;
+	od_lockstat_thread_t *next;
+};
+
+struct od_lockstat
+{
+	int                            enabled;
+	od_lockstat_thread_t *volatile threads;
+};
+
+extern od_lockstat_t od_lockstat;
+
+static inline uint64_t
+od_lockstat_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+char *od_lockstat_lock_name(int);
+char *od_lockstat_site_name(int);
+
+void od_lockstat_wait(od_lockstat_lock_t, od_lock_site_t, uint64_t, uint64_t);
+void od_lockstat_hold(od_lockstat_lock_t, od_lock_site_t, uint64_t);
+void od_lockstat_router_acquired(od_lock_site_t, uint64_t);
+void od_lockstat_router_released(void);
+
+int  od_lockstat_merge(od_lockstat_site_t[OD_LOCKSTAT_MAX][OD_LOCK_SITE_MAX]);
+void od_lockstat_merge_free(od_lockstat_site_t[OD_LOCKSTAT_MAX][OD_LOCK_SITE_MAX]);
+
+#endif /* ODYSSEY_LOCKSTAT_H */
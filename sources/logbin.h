@@ -0,0 +1,66 @@
+#ifndef ODYSSEY_LOGBIN_H
+#define ODYSSEY_LOGBIN_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+/* binary log is a magic string followed by records in host
+ * byte order. Format strings and contexts are written once
+ * per process as string records and referenced by id,
+ * message arguments are kept raw and rendered offline by
+ * odyssey-logdecode */
+
+#define OD_LOGBIN_MAGIC     "odylog01"
+#define OD_LOGBIN_MAGIC_LEN 8
+
+/* string id of a message which did not fit into string table
+ * or a format: text is the only string argument */
+#define OD_LOGBIN_INLINE    UINT32_MAX
+
+typedef struct od_logbin_record od_logbin_record_t;
+
+typedef enum
+{
+	OD_LOGBIN_START,
+	OD_LOGBIN_STRING,
+	OD_LOGBIN_MESSAGE
+} od_logbin_type_t;
+
+/* message arguments follow the record header, each one is
+ * a type byte and a value: int64_t, double, or uint32_t
+ * length followed by string bytes */
+typedef enum
+{
+	OD_LOGBIN_ARG_INT    = 'i',
+	OD_LOGBIN_ARG_DOUBLE = 'f',
+	OD_LOGBIN_ARG_STRING = 's'
+} od_logbin_arg_t;
+
+struct od_logbin_record
+{
+	uint32_t size;
+	uint16_t type;
+	uint16_t level;
+	uint32_t id;
+	uint32_t context;
+	uint32_t pid;
+	uint32_t argc;
+	uint64_t time;
+	uint64_t client;
+	uint64_t server;
+};
+
+/* client and server ids: prefix character and 48-bit seed */
+static inline uint64_t
+od_logbin_id(char *prefix, uint64_t a, uint64_t b)
+{
+	if (prefix == NULL)
+		return 0;
+	return ((uint64_t)(unsigned char)prefix[0] << 48) |
+	       ((b & 0xffff) << 32) | (a & 0xffffffff);
+}
+
+#endif /* ODYSSEY_LOGBIN_H */
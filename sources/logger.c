@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
@@ -16,9 +17,11 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <syslog.h>
 
@@ -60,6 +63,36 @@ od_log_level[] =
 	"info", "error", "debug", "fatal"
 };
 
+/* log line stored in ring, records are aligned to the header
+ * size so one always fits before the end of ring buffer */
+typedef struct
+{
+	uint32_t len;
+	uint32_t level;
+} od_logger_record_t;
+
+#define OD_LOGGER_RECORD_PAD    UINT32_MAX
+#define OD_LOGGER_RECORD_BINARY 0x100
+#define OD_LOGGER_RECORD_CAPTURE 0x200
+#define OD_LOGGER_IOV           256
+
+/* binary log string table slots, ids are slot numbers */
+#define OD_LOGGER_STRINGS       8192
+
+typedef struct
+{
+	od_logbin_record_t header;
+	char               data[1024];
+} od_logger_binary_t;
+
+static __thread od_logger_ring_t *od_logger_ring_self = NULL;
+static __thread int               od_logger_is_writer = 0;
+
+/* timestamp up to seconds, formatted once per second */
+static __thread time_t od_logger_time_sec = -1;
+static __thread char   od_logger_time[64];
+static __thread int    od_logger_time_len = 0;
+
 void
 od_logger_init(od_logger_t *logger, od_pid_t *pid)
 {
@@ -68,12 +101,133 @@ od_logger_init(od_logger_t *logger, od_pid_t *pid)
 	logger->log_stdout = 1;
 	logger->log_syslog = 0;
 	logger->format = NULL;
-	logger->format_len = 0;
+	logger->format_count = 0;
+	logger->format_text = NULL;
 	logger->fd = -1;
+	logger->async = 0;
+	logger->async_buffer = 0;
+	logger->async_block = 0;
+	logger->async_machine = -1;
+	logger->async_rings = NULL;
+	logger->async_dropped = 0;
+	pthread_mutex_init(&logger->async_lock, NULL);
+	logger->binary_fd = -1;
+	logger->binary_strings = NULL;
+	logger->capture_fd = -1;
 	/* set temporary format */
 	od_logger_set_format(logger, "%p %t %l (%c) %h %m\n");
 }
 
+int
+od_logger_set_format(od_logger_t *logger, char *format)
+{
+	/* every format character produces at most one token or
+	 * one character of text */
+	int len = strlen(format);
+	od_logger_token_t *tokens;
+	tokens = malloc(sizeof(od_logger_token_t) * (len + 1));
+	char *text = malloc(len + 1);
+	if (tokens == NULL || text == NULL) {
+		free(tokens);
+		free(text);
+		return -1;
+	}
+
+	od_logger_token_t *token = NULL;
+	int   count = 0;
+	char *text_pos = text;
+	char *format_pos = format;
+	char *format_end = format + len;
+	while (format_pos < format_end)
+	{
+		char chars[2];
+		int  chars_len = 0;
+		char type = 0;
+		if (*format_pos == '\\') {
+			format_pos++;
+			if (format_pos == format_end)
+				break;
+			switch (*format_pos) {
+			case '\\':
+				chars[0] = '\\';
+				chars_len = 1;
+				break;
+			case 'n':
+				chars[0] = '\n';
+				chars_len = 1;
+				break;
+			case 't':
+				chars[0] = '\t';
+				chars_len = 1;
+				break;
+			case 'r':
+				chars[0] = '\r';
+				chars_len = 1;
+				break;
+			default:
+				chars[0] = '\\';
+				chars[1] = *format_pos;
+				chars_len = 2;
+				break;
+			}
+		} else
+		if (*format_pos == '%') {
+			format_pos++;
+			if (format_pos == format_end)
+				break;
+			switch (*format_pos) {
+			case 'n': case 't': case 'p':
+			case 'i': case 's': case 'u':
+			case 'd': case 'c': case 'l':
+			case 'm': case 'M': case 'h':
+			case 'r':
+				type = *format_pos;
+				break;
+			case '%':
+				chars[0] = '%';
+				chars_len = 1;
+				break;
+			default:
+				chars[0] = '%';
+				chars[1] = *format_pos;
+				chars_len = 2;
+				break;
+			}
+		} else {
+			chars[0] = *format_pos;
+			chars_len = 1;
+		}
+		format_pos++;
+
+		if (type) {
+			token = &tokens[count++];
+			token->type     = type;
+			token->text     = NULL;
+			token->text_len = 0;
+			token = NULL;
+			continue;
+		}
+		/* merge text up to the next directive */
+		if (token == NULL) {
+			token = &tokens[count++];
+			token->type     = 0;
+			token->text     = text_pos;
+			token->text_len = 0;
+		}
+		memcpy(text_pos, chars, chars_len);
+		text_pos        += chars_len;
+		token->text_len += chars_len;
+	}
+
+	/* format is set during startup only */
+	free(logger->format);
+	free(logger->format_text);
+	logger->format       = tokens;
+	logger->format_count = count;
+	logger->format_text  = text;
+	return 0;
+}
+
 int
 od_logger_open(od_logger_t *logger, char *path)
 {
@@ -111,9 +265,19 @@ od_logger_open_syslog(od_logger_t *logger, char *ident, char *facility)
 void
 od_logger_close(od_logger_t *logger)
 {
+	if (logger->async) {
+		od_logger_flush(logger);
+		logger->async = 0;
+	}
 	if (logger->fd != -1)
 		close(logger->fd);
 	logger->fd = -1;
+	if (logger->binary_fd != -1)
+		close(logger->binary_fd);
+	logger->binary_fd = -1;
+	if (logger->capture_fd != -1)
+		close(logger->capture_fd);
+	logger->capture_fd = -1;
 }
 
 static char od_logger_escape_tab[256] =
@@ -158,6 +322,39 @@ od_logger_escape(char *dest, int size, char *fmt, va_list args)
 	return dst_pos - dest;
 }
 
+static inline int
+od_logger_copy(char *dest, char *dest_end, char *src, int src_len)
+{
+	int len = dest_end - dest;
+	if (len > src_len)
+		len = src_len;
+	memcpy(dest, src, len);
+	return len;
+}
+
+static inline int
+od_logger_timestamp(char *dest, char *dest_end)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	if (od_unlikely(tv.tv_sec != od_logger_time_sec)) {
+		struct tm tm;
+		localtime_r(&tv.tv_sec, &tm);
+		od_logger_time_len = strftime(od_logger_time, sizeof(od_logger_time),
+		                              "%d %b %H:%M:%S.", &tm);
+		od_logger_time_sec = tv.tv_sec;
+	}
+	char msec[3];
+	int  value = tv.tv_usec / 1000;
+	msec[0] = '0' + value / 100;
+	msec[1] = '0' + (value / 10) % 10;
+	msec[2] = '0' + value % 10;
+	int len;
+	len  = od_logger_copy(dest, dest_end, od_logger_time, od_logger_time_len);
+	len += od_logger_copy(dest + len, dest_end, msec, sizeof(msec));
+	return len;
+}
+
 __attribute__((hot)) static inline int
 od_logger_format(od_logger_t *logger, od_logger_level_t level,
                  char *context,
@@ -168,194 +365,819 @@ od_logger_format(od_logger_t *logger, od_logger_level_t level,
 {
 	char *dst_pos = output;
 	char *dst_end = output + output_len;
-	char *format_pos = logger->format;
-	char *format_end = logger->format + logger->format_len;
 	char  peer[128];
 
 	int len;
-	while (format_pos < format_end)
+	int i;
+	for (i = 0; i < logger->format_count; i++)
 	{
-		if (*format_pos == '\\') {
-			format_pos++;
-			if (od_unlikely(format_pos == format_end))
-				break;
-			if (od_unlikely((dst_end - dst_pos) < 1))
-				break;
-			switch (*format_pos) {
-			case '\\':
-				dst_pos[0] = '\\';
-				dst_pos   += 1;
-				break;
-			case 'n':
-				dst_pos[0] = '\n';
-				dst_pos   += 1;
-				break;
-			case 't':
-				dst_pos[0] = '\t';
-				dst_pos   += 1;
-				break;
-			case 'r':
-				dst_pos[0] = '\r';
-				dst_pos   += 1;
-				break;
-			default:
-				if (od_unlikely((dst_end - dst_pos) < 2))
-					break;
-				dst_pos[0] = '\\';
-				dst_pos[1] = *format_pos;
-				dst_pos   += 2;
-				break;
-			}
-		} else
-		if (*format_pos == '%') {
-			format_pos++;
-			if (od_unlikely(format_pos == format_end))
-				break;
-			switch (*format_pos) {
-			/* unixtime */
-			case 'n':
-			{
-				time_t tm = time(NULL);
-				len = od_snprintf(dst_pos, dst_end - dst_pos, "%lu", tm);
+		od_logger_token_t *token = &logger->format[i];
+		switch (token->type) {
+		/* text */
+		case 0:
+			len = od_logger_copy(dst_pos, dst_end, token->text, token->text_len);
+			dst_pos += len;
+			break;
+		/* unixtime */
+		case 'n':
+		{
+			time_t tm = time(NULL);
+			len = od_snprintf(dst_pos, dst_end - dst_pos, "%lu", tm);
+			dst_pos += len;
+			break;
+		}
+		/* timestamp */
+		case 't':
+			len = od_logger_timestamp(dst_pos, dst_end);
+			dst_pos += len;
+			break;
+		/* pid */
+		case 'p':
+			len = od_snprintf(dst_pos, dst_end - dst_pos, "%s", logger->pid->pid_sz);
+			dst_pos += len;
+			break;
+		/* client id */
+		case 'i':
+			if (client && client->id.id_prefix != NULL) {
+				len = od_snprintf(dst_pos, dst_end - dst_pos, "%s%.*s",
+				                  client->id.id_prefix,
+				                  (signed)sizeof(client->id.id), client->id.id);
 				dst_pos += len;
 				break;
 			}
-			/* timestamp */
-			case 't':
-			{
-				struct timeval tv;
-				gettimeofday(&tv, NULL);
-				len = strftime(dst_pos, dst_end - dst_pos, "%d %b %H:%M:%S.",
-				               localtime(&tv.tv_sec));
-				dst_pos += len;
-				len = od_snprintf(dst_pos, dst_end - dst_pos, "%03d",
-				                  (signed)tv.tv_usec / 1000);
+			len = od_snprintf(dst_pos, dst_end - dst_pos, "none");
+			dst_pos += len;
+			break;
+		/* server id */
+		case 's':
+			if (server && server->id.id_prefix != NULL) {
+				len = od_snprintf(dst_pos, dst_end - dst_pos, "%s%.*s",
+				                  server->id.id_prefix,
+				                  (signed)sizeof(server->id.id), server->id.id);
 				dst_pos += len;
 				break;
 			}
-			/* pid */
-			case 'p':
-				len = od_snprintf(dst_pos, dst_end - dst_pos, "%s", logger->pid->pid_sz);
+			len = od_snprintf(dst_pos, dst_end - dst_pos, "none");
+			dst_pos += len;
+			break;
+		/* user name */
+		case 'u':
+			if (client && client->startup.user.value_len) {
+				len = od_snprintf(dst_pos, dst_end - dst_pos, "%s",
+				                  client->startup.user.value);
 				dst_pos += len;
 				break;
-			/* client id */
-			case 'i':
-				if (client && client->id.id_prefix != NULL) {
-					len = od_snprintf(dst_pos, dst_end - dst_pos, "%s%.*s",
-					                  client->id.id_prefix,
-					                  (signed)sizeof(client->id.id), client->id.id);
-					dst_pos += len;
-					break;
-				}
-				len = od_snprintf(dst_pos, dst_end - dst_pos, "none");
-				dst_pos += len;
-				break;
-			/* server id */
-			case 's':
-				if (server && server->id.id_prefix != NULL) {
-					len = od_snprintf(dst_pos, dst_end - dst_pos, "%s%.*s",
-					                  server->id.id_prefix,
-					                  (signed)sizeof(server->id.id), server->id.id);
-					dst_pos += len;
-					break;
-				}
-				len = od_snprintf(dst_pos, dst_end - dst_pos, "none");
-				dst_pos += len;
-				break;
-			/* user name */
-			case 'u':
-				if (client && client->startup.user.value_len) {
-					len = od_snprintf(dst_pos, dst_end - dst_pos, client->startup.user.value);
-					dst_pos += len;
-					break;
-				}
-				len = od_snprintf(dst_pos, dst_end - dst_pos, "none");
-				dst_pos += len;
-				break;
-			/* database name */
-			case 'd':
-				if (client && client->startup.database.value_len) {
-					len = od_snprintf(dst_pos, dst_end - dst_pos, client->startup.database.value);
-					dst_pos += len;
-					break;
-				}
-				len = od_snprintf(dst_pos, dst_end - dst_pos, "none");
-				dst_pos += len;
-				break;
-			/* context */
-			case 'c':
-				len = od_snprintf(dst_pos, dst_end - dst_pos, "%s", context);
-				dst_pos += len;
-				break;
-			/* level */
-			case 'l':
-				len = od_snprintf(dst_pos, dst_end - dst_pos, "%s", od_log_level[level]);
-				dst_pos += len;
-				break;
-			/* message */
-			case 'm':
-				len = od_vsnprintf(dst_pos, dst_end - dst_pos, fmt, args);
-				dst_pos += len;
-				break;
-			/* message (escaped) */
-			case 'M':
-				len = od_logger_escape(dst_pos, dst_end - dst_pos, fmt, args);
+			}
+			len = od_snprintf(dst_pos, dst_end - dst_pos, "none");
+			dst_pos += len;
+			break;
+		/* database name */
+		case 'd':
+			if (client && client->startup.database.value_len) {
+				len = od_snprintf(dst_pos, dst_end - dst_pos, "%s",
+				                  client->startup.database.value);
 				dst_pos += len;
 				break;
-			/* client host */
-			case 'h':
-				if (client && client->io.io) {
-					od_getpeername(client->io.io, peer, sizeof(peer), 1, 0);
-					len = od_snprintf(dst_pos, dst_end - dst_pos, "%s", peer);
-					dst_pos += len;
-					break;
-				}
-				len = od_snprintf(dst_pos, dst_end - dst_pos, "none");
+			}
+			len = od_snprintf(dst_pos, dst_end - dst_pos, "none");
+			dst_pos += len;
+			break;
+		/* context */
+		case 'c':
+			len = od_snprintf(dst_pos, dst_end - dst_pos, "%s", context);
+			dst_pos += len;
+			break;
+		/* level */
+		case 'l':
+			len = od_snprintf(dst_pos, dst_end - dst_pos, "%s", od_log_level[level]);
+			dst_pos += len;
+			break;
+		/* message */
+		case 'm':
+		{
+			va_list message_args;
+			va_copy(message_args, args);
+			len = od_vsnprintf(dst_pos, dst_end - dst_pos, fmt, message_args);
+			va_end(message_args);
+			dst_pos += len;
+			break;
+		}
+		/* message (escaped) */
+		case 'M':
+		{
+			va_list message_args;
+			va_copy(message_args, args);
+			len = od_logger_escape(dst_pos, dst_end - dst_pos, fmt, message_args);
+			va_end(message_args);
+			dst_pos += len;
+			break;
+		}
+		/* client host */
+		case 'h':
+			if (client && client->io.io) {
+				od_getpeername(client->io.io, peer, sizeof(peer), 1, 0);
+				len = od_snprintf(dst_pos, dst_end - dst_pos, "%s", peer);
 				dst_pos += len;
 				break;
-			/* client port */
-			case 'r':
-				if (client && client->io.io) {
-					od_getpeername(client->io.io, peer, sizeof(peer), 0, 1);
-					len = od_snprintf(dst_pos, dst_end - dst_pos, "%s", peer);
-					dst_pos += len;
-					break;
-				}
-				len = od_snprintf(dst_pos, dst_end - dst_pos, "none");
+			}
+			len = od_snprintf(dst_pos, dst_end - dst_pos, "none");
+			dst_pos += len;
+			break;
+		/* client port */
+		case 'r':
+			if (client && client->io.io) {
+				od_getpeername(client->io.io, peer, sizeof(peer), 0, 1);
+				len = od_snprintf(dst_pos, dst_end - dst_pos, "%s", peer);
 				dst_pos += len;
 				break;
-			case '%':
-				if (od_unlikely((dst_end - dst_pos) < 1))
-					break;
-				dst_pos[0] = '%';
-				dst_pos   += 1;
-				break;
-			default:
-				if (od_unlikely((dst_end - dst_pos) < 2))
-					break;
-				dst_pos[0] = '%';
-				dst_pos[1] = *format_pos;
-				dst_pos   += 2;
-				break;
 			}
-		} else {
-			if (od_unlikely((dst_end - dst_pos) < 1))
-				break;
-			dst_pos[0] = *format_pos;
-			dst_pos   += 1;
+			len = od_snprintf(dst_pos, dst_end - dst_pos, "none");
+			dst_pos += len;
+			break;
 		}
-		format_pos++;
 	}
 	return dst_pos - output;
 }
 
+static inline void
+od_logger_write_sync(od_logger_t *logger, od_logger_level_t level,
+                     char *output, int len)
+{
+	int rc;
+	if (logger->fd != -1) {
+		rc = write(logger->fd, output, len);
+	}
+	if (logger->log_stdout) {
+		rc = write(STDOUT_FILENO, output, len);
+	}
+	if (logger->log_syslog) {
+		syslog(od_log_syslog_level[level], "%.*s", len, output);
+	}
+	(void)rc;
+}
+
+static inline void
+od_logger_report(od_logger_t *logger, od_logger_level_t level,
+                 char *context, char *fmt, ...)
+{
+	char output[1024];
+	int  len;
+	va_list args;
+	va_start(args, fmt);
+	len = od_logger_format(logger, level, context, NULL, NULL,
+	                       fmt, args, output, sizeof(output));
+	va_end(args);
+	od_logger_write_sync(logger, level, output, len);
+}
+
+static inline uint64_t
+od_logger_record_size(int len)
+{
+	uint64_t size = sizeof(od_logger_record_t) + len;
+	return (size + sizeof(od_logger_record_t) - 1) &
+	       ~(uint64_t)(sizeof(od_logger_record_t) - 1);
+}
+
+static inline od_logger_ring_t*
+od_logger_ring_of(od_logger_t *logger)
+{
+	if (od_likely(od_logger_ring_self))
+		return od_logger_ring_self;
+
+	/* logger thread and threads which failed to allocate
+	 * ring write directly */
+	if (od_logger_is_writer)
+		return NULL;
+	od_logger_is_writer = 1;
+
+	od_logger_ring_t *ring = malloc(sizeof(od_logger_ring_t));
+	if (ring == NULL)
+		return NULL;
+	ring->size = logger->async_buffer & ~(uint64_t)(sizeof(od_logger_record_t) - 1);
+	ring->data = malloc(ring->size);
+	if (ring->data == NULL) {
+		free(ring);
+		return NULL;
+	}
+	ring->head    = 0;
+	ring->tail    = 0;
+	ring->dropped = 0;
+
+	/* rings are never removed, so the list can be walked by
+	 * logger thread while new rings are added */
+	do {
+		ring->next = logger->async_rings;
+	} while (! __sync_bool_compare_and_swap(&logger->async_rings,
+	                                        ring->next, ring));
+
+	od_logger_is_writer = 0;
+	od_logger_ring_self = ring;
+	return ring;
+}
+
+__attribute__((hot)) static inline void
+od_logger_ring_write2(od_logger_t *logger, od_logger_ring_t *ring,
+                      uint32_t level,
+                      char *output, int len,
+                      char *output2, int len2)
+{
+	uint64_t size   = od_logger_record_size(len + len2);
+	uint64_t head   = ring->head;
+	uint64_t offset = head % ring->size;
+	uint64_t pad    = 0;
+	if (od_unlikely(ring->size - offset < size))
+		pad = ring->size - offset;
+
+	for (;;) {
+		uint64_t tail = od_atomic_u64_of(&ring->tail);
+		if (od_likely(ring->size - (head - tail) >= pad + size))
+			break;
+		if (! logger->async_block) {
+			od_atomic_u64_inc(&ring->dropped);
+			return;
+		}
+		/* wait for logger thread to write out the ring */
+		usleep(100);
+	}
+
+	od_logger_record_t *record;
+	if (od_unlikely(pad)) {
+		record = (od_logger_record_t*)(ring->data + offset);
+		record->len   = pad - sizeof(od_logger_record_t);
+		record->level = OD_LOGGER_RECORD_PAD;
+		head  += pad;
+		offset = 0;
+	}
+	record = (od_logger_record_t*)(ring->data + offset);
+	record->len   = len + len2;
+	record->level = level;
+	memcpy((char*)record + sizeof(od_logger_record_t), output, len);
+	if (len2 > 0)
+		memcpy((char*)record + sizeof(od_logger_record_t) + len,
+		       output2, len2);
+	od_atomic_u64_set(&ring->head, head + size);
+}
+
+static inline void
+od_logger_ring_write(od_logger_t *logger, od_logger_ring_t *ring,
+                     uint32_t level,
+                     char *output, int len)
+{
+	od_logger_ring_write2(logger, ring, level, output, len, NULL, 0);
+}
+
+static inline void
+od_logger_writev(od_logger_t *logger, struct iovec *iov, int count)
+{
+	if (count == 0)
+		return;
+	int rc;
+	if (logger->fd != -1) {
+		rc = writev(logger->fd, iov, count);
+	}
+	if (logger->log_stdout) {
+		rc = writev(STDOUT_FILENO, iov, count);
+	}
+	(void)rc;
+}
+
+static inline void
+od_logger_writev_binary(od_logger_t *logger, struct iovec *iov, int count)
+{
+	if (count == 0)
+		return;
+	int rc;
+	rc = writev(logger->binary_fd, iov, count);
+	(void)rc;
+}
+
+static inline void
+od_logger_writev_capture(od_logger_t *logger, struct iovec *iov, int count)
+{
+	if (count == 0)
+		return;
+	int rc;
+	rc = writev(logger->capture_fd, iov, count);
+	(void)rc;
+}
+
+static inline int
+od_logger_ring_drain(od_logger_t *logger, od_logger_ring_t *ring)
+{
+	struct iovec iov[OD_LOGGER_IOV];
+	struct iovec iov_binary[OD_LOGGER_IOV];
+	struct iovec iov_capture[OD_LOGGER_IOV];
+	int      count = 0;
+	int      count_binary = 0;
+	int      count_capture = 0;
+	int      records = 0;
+	uint64_t pos  = ring->tail;
+	uint64_t head = od_atomic_u64_of(&ring->head);
+	while (pos < head)
+	{
+		od_logger_record_t *record;
+		record = (od_logger_record_t*)(ring->data + pos % ring->size);
+		pos += od_logger_record_size(record->len);
+		if (record->level == OD_LOGGER_RECORD_PAD)
+			continue;
+		char *data = (char*)record + sizeof(od_logger_record_t);
+		records++;
+		if (record->level & OD_LOGGER_RECORD_CAPTURE) {
+			iov_capture[count_capture].iov_base = data;
+			iov_capture[count_capture].iov_len  = record->len;
+			count_capture++;
+		} else
+		if (record->level & OD_LOGGER_RECORD_BINARY) {
+			iov_binary[count_binary].iov_base = data;
+			iov_binary[count_binary].iov_len  = record->len;
+			count_binary++;
+		} else {
+			iov[count].iov_base = data;
+			iov[count].iov_len  = record->len;
+			count++;
+			if (logger->log_syslog)
+				syslog(od_log_syslog_level[record->level], "%.*s",
+				       (int)record->len, data);
+		}
+		if (count == OD_LOGGER_IOV || count_binary == OD_LOGGER_IOV ||
+		    count_capture == OD_LOGGER_IOV) {
+			od_logger_writev(logger, iov, count);
+			od_logger_writev_binary(logger, iov_binary, count_binary);
+			od_logger_writev_capture(logger, iov_capture, count_capture);
+			od_atomic_u64_set(&ring->tail, pos);
+			count = 0;
+			count_binary = 0;
+			count_capture = 0;
+		}
+	}
+	od_logger_writev(logger, iov, count);
+	od_logger_writev_binary(logger, iov_binary, count_binary);
+	od_logger_writev_capture(logger, iov_capture, count_capture);
+	od_atomic_u64_set(&ring->tail, pos);
+	return records;
+}
+
+static inline int
+od_logger_drain(od_logger_t *logger)
+{
+	int records = 0;
+	uint64_t dropped = 0;
+	pthread_mutex_lock(&logger->async_lock);
+	od_logger_ring_t *ring = logger->async_rings;
+	for (; ring; ring = ring->next) {
+		records += od_logger_ring_drain(logger, ring);
+		dropped += od_atomic_u64_of(&ring->dropped);
+	}
+	if (dropped > logger->async_dropped) {
+		od_logger_report(logger, OD_ERROR, "logger",
+		                 "log buffer is full, %" PRIu64 " messages dropped",
+		                 dropped - logger->async_dropped);
+		logger->async_dropped = dropped;
+	}
+	pthread_mutex_unlock(&logger->async_lock);
+	return records;
+}
+
+void
+od_logger_flush(od_logger_t *logger)
+{
+	if (! logger->async)
+		return;
+	od_logger_drain(logger);
+}
+
+static void
+od_logger_async(void *arg)
+{
+	od_logger_t *logger = arg;
+	od_logger_is_writer = 1;
+
+	/* poll rings often while there is something to write,
+	 * back off when idle */
+	uint32_t interval = 1;
+	for (;;) {
+		int records = od_logger_drain(logger);
+		if (records > 0) {
+			interval = 1;
+		} else
+		if (interval < 100) {
+			interval *= 2;
+		}
+		machine_sleep(interval);
+	}
+}
+
+int
+od_logger_open_async(od_logger_t *logger, int buffer, int block)
+{
+	logger->async_buffer = buffer;
+	logger->async_block  = block;
+	logger->async_machine = machine_create("logger", od_logger_async, logger);
+	if (logger->async_machine == -1)
+		return -1;
+	logger->async = 1;
+	return 0;
+}
+
+static inline uint64_t
+od_logger_time_us(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static inline void
+od_logger_binary_header(od_logger_t *logger, od_logbin_record_t *header,
+                        od_logbin_type_t type,
+                        od_logger_level_t level,
+                        uint32_t id)
+{
+	header->size    = sizeof(od_logbin_record_t);
+	header->type    = type;
+	header->level   = level;
+	header->id      = id;
+	header->context = OD_LOGBIN_INLINE;
+	header->pid     = logger->pid->pid;
+	header->argc    = 0;
+	header->time    = od_logger_time_us();
+	header->client  = 0;
+	header->server  = 0;
+}
+
+int
+od_logger_open_binary(od_logger_t *logger, char *path)
+{
+	logger->binary_strings = calloc(OD_LOGGER_STRINGS, sizeof(char*));
+	if (logger->binary_strings == NULL)
+		return -1;
+	logger->binary_fd = open(path, O_RDWR|O_CREAT|O_APPEND, 0644);
+	if (logger->binary_fd == -1)
+		return -1;
+	struct stat st;
+	int rc;
+	rc = fstat(logger->binary_fd, &st);
+	if (rc == -1)
+		return -1;
+
+	/* start record separates string ids of this process from
+	 * the ones already in the file */
+	char data[OD_LOGBIN_MAGIC_LEN + sizeof(od_logbin_record_t)];
+	int  len = 0;
+	if (st.st_size == 0) {
+		memcpy(data, OD_LOGBIN_MAGIC, OD_LOGBIN_MAGIC_LEN);
+		len = OD_LOGBIN_MAGIC_LEN;
+	}
+	od_logbin_record_t header;
+	od_logger_binary_header(logger, &header, OD_LOGBIN_START, OD_LOG, 0);
+	memcpy(data + len, &header, sizeof(header));
+	len += sizeof(header);
+	rc = write(logger->binary_fd, data, len);
+	if (rc != len)
+		return -1;
+	return 0;
+}
+
+static inline void
+od_logger_binary_write(od_logger_t *logger, od_logger_ring_t *ring,
+                       od_logger_level_t level,
+                       char *data, int len)
+{
+	if (ring) {
+		od_logger_ring_write(logger, ring, level | OD_LOGGER_RECORD_BINARY,
+		                     data, len);
+		return;
+	}
+	int rc;
+	rc = write(logger->binary_fd, data, len);
+	(void)rc;
+}
+
+int
+od_logger_open_capture(od_logger_t *logger, char *path)
+{
+	logger->capture_fd = open(path, O_RDWR|O_CREAT|O_APPEND, 0644);
+	if (logger->capture_fd == -1)
+		return -1;
+	struct stat st;
+	int rc;
+	rc = fstat(logger->capture_fd, &st);
+	if (rc == -1)
+		return -1;
+
+	/* start record separates captures of different runs */
+	char data[OD_CAPTURE_MAGIC_LEN + sizeof(od_capture_record_t)];
+	int  len = 0;
+	if (st.st_size == 0) {
+		memcpy(data, OD_CAPTURE_MAGIC, OD_CAPTURE_MAGIC_LEN);
+		len = OD_CAPTURE_MAGIC_LEN;
+	}
+	od_capture_record_t header;
+	memset(&header, 0, sizeof(header));
+	header.size = sizeof(header);
+	header.type = OD_CAPTURE_START;
+	header.time = od_logger_time_us();
+	memcpy(data + len, &header, sizeof(header));
+	len += sizeof(header);
+	rc = write(logger->capture_fd, data, len);
+	if (rc != len)
+		return -1;
+	return 0;
+}
+
+void
+od_logger_capture(od_logger_t *logger, od_capture_record_t *header,
+                  char *data, int len)
+{
+	header->size = sizeof(od_capture_record_t) + len;
+	header->time = od_logger_time_us();
+	od_logger_ring_t *ring = NULL;
+	if (logger->async)
+		ring = od_logger_ring_of(logger);
+	if (od_likely(ring)) {
+		od_logger_ring_write2(logger, ring, OD_LOG | OD_LOGGER_RECORD_CAPTURE,
+		                      (char*)header, sizeof(od_capture_record_t),
+		                      data, len);
+		return;
+	}
+	struct iovec iov[2];
+	iov[0].iov_base = header;
+	iov[0].iov_len  = sizeof(od_capture_record_t);
+	iov[1].iov_base = data;
+	iov[1].iov_len  = len;
+	od_logger_writev_capture(logger, iov, len > 0 ? 2 : 1);
+}
+
+static inline int
+od_logger_binary_put(char **pos, char *end, od_logbin_arg_t type,
+                     void *value, int size)
+{
+	if (od_unlikely(end - *pos < 1 + size))
+		return -1;
+	**pos = type;
+	memcpy(*pos + 1, value, size);
+	*pos += 1 + size;
+	return 0;
+}
+
+static inline int
+od_logger_binary_int(char **pos, char *end, int64_t value)
+{
+	return od_logger_binary_put(pos, end, OD_LOGBIN_ARG_INT,
+	                            &value, sizeof(value));
+}
+
+static inline int
+od_logger_binary_double(char **pos, char *end, double value)
+{
+	return od_logger_binary_put(pos, end, OD_LOGBIN_ARG_DOUBLE,
+	                            &value, sizeof(value));
+}
+
+static inline int
+od_logger_binary_string_arg(char **pos, char *end, char *string, int len)
+{
+	/* long strings are truncated to the rest of buffer */
+	int avail = end - *pos - 1 - (int)sizeof(uint32_t);
+	if (od_unlikely(avail < 0))
+		return -1;
+	if (len > avail)
+		len = avail;
+	uint32_t size = len;
+	**pos = OD_LOGBIN_ARG_STRING;
+	memcpy(*pos + 1, &size, sizeof(size));
+	memcpy(*pos + 1 + sizeof(size), string, len);
+	*pos += 1 + sizeof(size) + len;
+	return 0;
+}
+
+/* fetch arguments of printf conversions in format string,
+ * -1 on conversions which can not be stored */
+__attribute__((hot)) static inline int
+od_logger_binary_args(char *dest, int size, char *fmt, va_list args,
+                      uint32_t *argc)
+{
+	char *pos = dest;
+	char *end = dest + size;
+	char *fmt_pos = fmt;
+	int   rc = 0;
+	uint32_t count = 0;
+	while ((fmt_pos = strchr(fmt_pos, '%')) != NULL)
+	{
+		fmt_pos++;
+		if (*fmt_pos == '%') {
+			fmt_pos++;
+			continue;
+		}
+		/* flags and width */
+		while (*fmt_pos && strchr("-+ #0'", *fmt_pos))
+			fmt_pos++;
+		if (*fmt_pos == '*') {
+			rc |= od_logger_binary_int(&pos, end, va_arg(args, int));
+			count++;
+			fmt_pos++;
+		} else {
+			while (isdigit(*fmt_pos))
+				fmt_pos++;
+		}
+		/* precision */
+		int precision = -1;
+		if (*fmt_pos == '.') {
+			fmt_pos++;
+			if (*fmt_pos == '*') {
+				precision = va_arg(args, int);
+				rc |= od_logger_binary_int(&pos, end, precision);
+				count++;
+				fmt_pos++;
+			} else {
+				precision = 0;
+				while (isdigit(*fmt_pos))
+					precision = precision * 10 + (*fmt_pos++ - '0');
+			}
+		}
+		/* length, long long is 'q' */
+		char length = 0;
+		for (;;) {
+			switch (*fmt_pos) {
+			case 'h':
+				fmt_pos++;
+				continue;
+			case 'l':
+				length = (length == 'l') ? 'q' : 'l';
+				fmt_pos++;
+				continue;
+			case 'q': case 'j': case 'z': case 't': case 'L':
+				length = *fmt_pos;
+				fmt_pos++;
+				continue;
+			}
+			break;
+		}
+		int64_t value;
+		switch (*fmt_pos) {
+		case 'd': case 'i':
+			switch (length) {
+			case 'l': value = va_arg(args, long); break;
+			case 'q': value = va_arg(args, long long); break;
+			case 'j': value = va_arg(args, intmax_t); break;
+			case 'z': value = va_arg(args, ssize_t); break;
+			case 't': value = va_arg(args, ptrdiff_t); break;
+			default:  value = va_arg(args, int); break;
+			}
+			rc |= od_logger_binary_int(&pos, end, value);
+			break;
+		case 'u': case 'x': case 'X': case 'o':
+			switch (length) {
+			case 'l': value = va_arg(args, unsigned long); break;
+			case 'q': value = va_arg(args, unsigned long long); break;
+			case 'j': value = va_arg(args, uintmax_t); break;
+			case 'z': value = va_arg(args, size_t); break;
+			case 't': value = va_arg(args, ptrdiff_t); break;
+			default:  value = va_arg(args, unsigned int); break;
+			}
+			rc |= od_logger_binary_int(&pos, end, value);
+			break;
+		case 'c':
+			rc |= od_logger_binary_int(&pos, end, va_arg(args, int));
+			break;
+		case 'p':
+			value = (uintptr_t)va_arg(args, void*);
+			rc |= od_logger_binary_int(&pos, end, value);
+			break;
+		case 'e': case 'E': case 'f': case 'F':
+		case 'g': case 'G': case 'a': case 'A':
+			if (length == 'L')
+				rc |= od_logger_binary_double(&pos, end,
+				                              va_arg(args, long double));
+			else
+				rc |= od_logger_binary_double(&pos, end,
+				                              va_arg(args, double));
+			break;
+		case 's':
+		{
+			char *string = va_arg(args, char*);
+			if (string == NULL)
+				string = "(null)";
+			int len;
+			if (precision >= 0)
+				len = strnlen(string, precision);
+			else
+				len = strlen(string);
+			rc |= od_logger_binary_string_arg(&pos, end, string, len);
+			break;
+		}
+		default:
+			return -1;
+		}
+		if (rc == -1)
+			return -1;
+		count++;
+		fmt_pos++;
+	}
+	*argc = count;
+	return pos - dest;
+}
+
+/* id of a format string or context, written out as a string
+ * record on first use; strings are identified by address */
+static inline uint32_t
+od_logger_binary_string(od_logger_t *logger, od_logger_ring_t *ring,
+                        char *string)
+{
+	uint32_t hash = (uint32_t)((uintptr_t)string >> 3) * 2654435761u;
+	uint32_t i;
+	for (i = 0; i < OD_LOGGER_STRINGS; i++) {
+		uint32_t slot = (hash + i) % OD_LOGGER_STRINGS;
+		char *current = logger->binary_strings[slot];
+		if (od_likely(current == string))
+			return slot;
+		if (current != NULL)
+			continue;
+		if (! __sync_bool_compare_and_swap(&logger->binary_strings[slot],
+		                                   NULL, string)) {
+			if (logger->binary_strings[slot] == string)
+				return slot;
+			continue;
+		}
+		od_logger_binary_t record;
+		int len = strlen(string);
+		if (len > (int)sizeof(record.data))
+			len = sizeof(record.data);
+		od_logger_binary_header(logger, &record.header, OD_LOGBIN_STRING,
+		                        OD_LOG, slot);
+		memcpy(record.data, string, len);
+		record.header.size += len;
+		od_logger_binary_write(logger, ring, OD_LOG, (char*)&record,
+		                       record.header.size);
+		return slot;
+	}
+	return OD_LOGBIN_INLINE;
+}
+
+static inline void
+od_logger_binary(od_logger_t *logger, od_logger_ring_t *ring,
+                 od_logger_level_t level,
+                 char *context,
+                 od_client_t *client,
+                 od_server_t *server,
+                 char *fmt, va_list args)
+{
+	od_logger_binary_t record;
+	uint32_t id;
+	uint32_t context_id = OD_LOGBIN_INLINE;
+	uint32_t argc = 0;
+	int      len = -1;
+	id = od_logger_binary_string(logger, ring, fmt);
+	if (context)
+		context_id = od_logger_binary_string(logger, ring, context);
+	if (od_likely(id != OD_LOGBIN_INLINE)) {
+		va_list message_args;
+		va_copy(message_args, args);
+		len = od_logger_binary_args(record.data, sizeof(record.data),
+		                            fmt, message_args, &argc);
+		va_end(message_args);
+	}
+	if (od_unlikely(len == -1)) {
+		/* format the message now */
+		char text[512];
+		int  text_len;
+		va_list message_args;
+		va_copy(message_args, args);
+		text_len = od_vsnprintf(text, sizeof(text), fmt, message_args);
+		va_end(message_args);
+		char *pos = record.data;
+		od_logger_binary_string_arg(&pos, record.data + sizeof(record.data),
+		                            text, text_len);
+		id   = OD_LOGBIN_INLINE;
+		len  = pos - record.data;
+		argc = 1;
+	}
+	od_logger_binary_header(logger, &record.header, OD_LOGBIN_MESSAGE,
+	                        level, id);
+	record.header.context = context_id;
+	record.header.argc    = argc;
+	record.header.size   += len;
+	if (client)
+		record.header.client = od_logbin_id(client->id.id_prefix,
+		                                    client->id.id_a,
+		                                    client->id.id_b);
+	if (server)
+		record.header.server = od_logbin_id(server->id.id_prefix,
+		                                    server->id.id_a,
+		                                    server->id.id_b);
+	od_logger_binary_write(logger, ring, level, (char*)&record,
+	                       record.header.size);
+}
+
 void
 od_logger_write(od_logger_t *logger, od_logger_level_t level,
                 char *context,
                 void *client, void *server,
                 char *fmt, va_list args)
 {
-	if (logger->fd == -1 && !logger->log_stdout && !logger->log_syslog)
+	int is_text   = logger->fd != -1 || logger->log_stdout || logger->log_syslog;
+	int is_binary = logger->binary_fd != -1;
+	if (! is_text && ! is_binary)
 		return;
 
 	if (level == OD_DEBUG) {
@@ -375,19 +1197,29 @@ od_logger_write(od_logger_t *logger, od_logger_level_t level,
 			return;
 	}
 
+	od_logger_ring_t *ring = NULL;
+	if (logger->async) {
+		/* fatal error terminates process, write out everything
+		 * logged before it */
+		if (od_unlikely(level == OD_FATAL))
+			od_logger_drain(logger);
+		else
+			ring = od_logger_ring_of(logger);
+	}
+
+	if (is_binary)
+		od_logger_binary(logger, ring, level, context, client, server,
+		                 fmt, args);
+	if (! is_text)
+		return;
+
 	char output[1024];
 	int  len;
 	len = od_logger_format(logger, level, context, client, server,
 	                       fmt, args, output, sizeof(output));
-	int rc;
-	if (logger->fd != -1) {
-		rc = write(logger->fd, output, len);
-	}
-	if (logger->log_stdout) {
-		rc = write(STDOUT_FILENO, output, len);
-	}
-	if (logger->log_syslog) {
-		syslog(od_log_syslog_level[level], "%.*s", len, output);
+	if (od_likely(ring)) {
+		od_logger_ring_write(logger, ring, level, output, len);
+		return;
 	}
-	(void)rc;
+	od_logger_write_sync(logger, level, output, len);
 }
@@ -7,7 +7,9 @@
  * Scalable PostgreSQL connection pooler.
 */
 
-typedef struct od_logger od_logger_t;
+typedef struct od_logger_token od_logger_token_t;
+typedef struct od_logger_ring  od_logger_ring_t;
+typedef struct od_logger       od_logger_t;
 
 typedef enum
 {
@@ -17,15 +19,47 @@ typedef enum
 	OD_FATAL
 } od_logger_level_t;
 
+/* compiled log_format element: text or a format directive,
+ * identified by its character */
+struct od_logger_token
+{
+	char  type;
+	char *text;
+	int   text_len;
+};
+
+/* formatted log lines of a thread waiting for the logger
+ * thread, written by the owner thread only */
+struct od_logger_ring
+{
+	char             *data;
+	uint64_t          size;
+	od_atomic_u64_t   head;
+	od_atomic_u64_t   tail;
+	od_atomic_u64_t   dropped;
+	od_logger_ring_t *next;
+};
+
 struct od_logger
 {
-	od_pid_t *pid;
-	int       log_debug;
-	int       log_stdout;
-	int       log_syslog;
-	char     *format;
-	int       format_len;
-	int       fd;
+	od_pid_t                   *pid;
+	int                         log_debug;
+	int                         log_stdout;
+	int                         log_syslog;
+	od_logger_token_t          *format;
+	int                         format_count;
+	char                       *format_text;
+	int                         fd;
+	int                         async;
+	int                         async_buffer;
+	int                         async_block;
+	int64_t                     async_machine;
+	od_logger_ring_t * volatile async_rings;
+	uint64_t                    async_dropped;
+	pthread_mutex_t             async_lock;
+	int                         binary_fd;
+	char * volatile            *binary_strings;
+	int                         capture_fd;
 };
 
 void od_logger_init(od_logger_t*, od_pid_t*);
@@ -42,15 +76,14 @@ od_logger_set_stdout(od_logger_t *logger, int enable)
 	logger->log_stdout = enable;
 }
 
-static inline void
-od_logger_set_format(od_logger_t *logger, char *format)
-{
-	logger->format = format;
-	logger->format_len = strlen(format);
-}
-
+int  od_logger_set_format(od_logger_t*, char*);
 int  od_logger_open(od_logger_t*, char*);
 int  od_logger_open_syslog(od_logger_t*, char*, char*);
+int  od_logger_open_async(od_logger_t*, int, int);
+int  od_logger_open_binary(od_logger_t*, char*);
+int  od_logger_open_capture(od_logger_t*, char*);
+void od_logger_capture(od_logger_t*, od_capture_record_t*, char*, int);
+void od_logger_flush(od_logger_t*);
 void od_logger_close(od_logger_t*);
 void od_logger_write(od_logger_t*, od_logger_level_t,
                      char*,
@@ -10,6 +10,8 @@
 #define od_likely(EXPR)   __builtin_expect(!! (EXPR), 1)
 #define od_unlikely(EXPR) __builtin_expect(!! (EXPR), 0)
 
+#define od_always_inline  inline __attribute__((always_inline))
+
 #define od_container_of(N, T, F) \
 	((T*)((char*)(N) - __builtin_offsetof(T, F)))
 
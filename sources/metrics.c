@@ -0,0 +1,971 @@
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <errno.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+#define OD_METRICS_REQUEST_MAX 4096
+#define OD_METRICS_TIMEOUT     5000
+
+typedef struct
+{
+	char *name;
+	char *type;
+	char *help;
+} od_metrics_desc_t;
+
+static od_metrics_desc_t od_metrics_desc[OD_METRICS_MAX] =
+{
+	[OD_METRICS_CLIENTS] =
+		{ "odyssey_clients", "gauge", "Connected clients" },
+	[OD_METRICS_ROUTES] =
+		{ "odyssey_routes", "gauge", "Active routes" },
+	[OD_METRICS_WORKER_CLIENTS] =
+		{ "odyssey_worker_clients", "gauge", "Clients served by worker" },
+	[OD_METRICS_WORKER_CLIENTS_PROCESSED] =
+		{ "odyssey_worker_clients_processed", "counter",
+		  "Clients accepted by worker" },
+	[OD_METRICS_WORKER_MEMORY] =
+		{ "odyssey_worker_memory_bytes", "gauge",
+		  "Buffer memory of connections served by worker" },
+	[OD_METRICS_ROUTE_CLIENTS] =
+		{ "odyssey_route_clients", "gauge", "Clients of route" },
+	[OD_METRICS_ROUTE_CLIENTS_WAITING] =
+		{ "odyssey_route_clients_waiting", "gauge",
+		  "Clients waiting for a server connection" },
+	[OD_METRICS_ROUTE_SERVERS_ACTIVE] =
+		{ "odyssey_route_servers_active", "gauge",
+		  "Server connections in use" },
+	[OD_METRICS_ROUTE_SERVERS_IDLE] =
+		{ "odyssey_route_servers_idle", "gauge",
+		  "Idle server connections" },
+	[OD_METRICS_ROUTE_WAIT_MAX] =
+		{ "odyssey_route_wait_max_seconds", "gauge",
+		  "Longest current wait for a server connection" },
+	[OD_METRICS_ROUTE_WAIT] =
+		{ "odyssey_route_wait_seconds", "summary",
+		  "Time spent waiting for a server connection" },
+	[OD_METRICS_ROUTE_WAIT_TIMEOUTS] =
+		{ "odyssey_route_wait_timeouts", "counter",
+		  "Waits for a server connection which ended by pool_timeout" },
+	[OD_METRICS_ROUTE_WAIT_ROUTING] =
+		{ "odyssey_route_wait_routing", "counter",
+		  "Waits for a concurrent server connect, limited by server_max_routing" },
+	[OD_METRICS_ROUTE_CLIENTS_WAITING_PEAK] =
+		{ "odyssey_route_clients_waiting_peak", "gauge",
+		  "Longest wait queue during the last stats interval" },
+	[OD_METRICS_ROUTE_MEMORY] =
+		{ "odyssey_route_memory_bytes", "gauge",
+		  "Memory of route connections and statistics by kind" },
+	[OD_METRICS_ROUTE_POOL_LIMIT] =
+		{ "odyssey_route_pool_limit", "gauge",
+		  "Server connections in use allowed by pool_adaptive" },
+	[OD_METRICS_ROUTE_QUERY] =
+		{ "odyssey_route_query_duration_seconds", "summary",
+		  "Query duration, quantiles of the last stats interval" },
+	[OD_METRICS_ROUTE_TRANSACTION] =
+		{ "odyssey_route_transaction_duration_seconds", "summary",
+		  "Transaction duration, quantiles of the last stats interval" },
+	[OD_METRICS_ROUTE_QUERY_PHASE] =
+		{ "odyssey_route_query_phase_seconds", "summary",
+		  "Query time by query type, spent waiting for a server, on the "
+		  "server and waiting for the client to read replies" },
+	[OD_METRICS_ROUTE_RECV_CLIENT] =
+		{ "odyssey_route_client_received_bytes", "counter",
+		  "Bytes received from clients" },
+	[OD_METRICS_ROUTE_RECV_SERVER] =
+		{ "odyssey_route_server_received_bytes", "counter",
+		  "Bytes received from servers" },
+	[OD_METRICS_ROUTE_CPU] =
+		{ "odyssey_route_cpu_seconds", "counter",
+		  "Worker time spent running client coroutines" },
+	[OD_METRICS_ROUTE_CPU_WAIT] =
+		{ "odyssey_route_cpu_wait_seconds", "counter",
+		  "Time client coroutines were ready to run but waited for the worker" },
+	[OD_METRICS_ROUTE_SWITCHES] =
+		{ "odyssey_route_switches", "counter",
+		  "Switches to client coroutines" },
+	[OD_METRICS_ROUTE_RATE] =
+		{ "odyssey_route_rate", "gauge",
+		  "Queries, transactions, waits and received bytes per second, "
+		  "moving average of the window" },
+	[OD_METRICS_ROUTE_RATE_LATENCY] =
+		{ "odyssey_route_rate_latency_seconds", "gauge",
+		  "Average query, transaction and wait time, moving average "
+		  "of the window" },
+	[OD_METRICS_ROUTE_HOST_RTT] =
+		{ "odyssey_route_host_rtt_seconds", "gauge",
+		  "Smoothed round trip time and its variation of server "
+		  "connections by storage host, moving average of samples" },
+	[OD_METRICS_ROUTE_HOST_CWND] =
+		{ "odyssey_route_host_cwnd", "gauge",
+		  "Congestion window of the last sampled server connection "
+		  "by storage host, in segments" },
+	[OD_METRICS_ROUTE_HOST_RETRANS] =
+		{ "odyssey_route_host_retransmits", "counter",
+		  "Retransmitted segments of sampled server connections by "
+		  "storage host" },
+	[OD_METRICS_QUERY_FINGERPRINT] =
+		{ "odyssey_query_fingerprint_duration_seconds", "summary",
+		  "Query duration by normalized query, since start" },
+	[OD_METRICS_QUERY_FINGERPRINT_DROPPED] =
+		{ "odyssey_query_fingerprint_dropped", "counter",
+		  "Queries not counted since the fingerprint table was full" },
+	[OD_METRICS_TOP] =
+		{ "odyssey_top", "gauge",
+		  "Heavy hitter queries, client addresses and users by query count, "
+		  "bytes and time since start, approximate" },
+	[OD_METRICS_LOCK_WAIT] =
+		{ "odyssey_lock_wait_seconds", "summary",
+		  "Time spent waiting for the router and route locks by operation, "
+		  "since start" },
+	[OD_METRICS_LOCK_HOLD] =
+		{ "odyssey_lock_hold_seconds", "summary",
+		  "Time the router and route locks were held by operation, "
+		  "since start" },
+	[OD_METRICS_ACCEPT_DEPTH] =
+		{ "odyssey_accept_queue_depth", "gauge",
+		  "Accept queue depth of tcp listens, quantiles of samples "
+		  "since start" },
+	[OD_METRICS_ACCEPT_FULL] =
+		{ "odyssey_accept_queue_full", "counter",
+		  "Accept queue samples taken with a full queue" },
+	[OD_METRICS_ACCEPT_KERNEL] =
+		{ "odyssey_accept_listen", "counter",
+		  "Kernel ListenOverflows and ListenDrops of the host since start" },
+	[OD_METRICS_ACCEPT_LATENCY] =
+		{ "odyssey_accept_latency_seconds", "summary",
+		  "Accept to worker start and startup to authentication time, "
+		  "since start" }
+};
+
+void
+od_metrics_init(od_metrics_t *metrics)
+{
+	memset(metrics, 0, sizeof(*metrics));
+}
+
+static inline void
+od_metrics_write(od_metrics_t *metrics, od_metrics_family_t id,
+                 char *fmt, ...)
+{
+	char line[1024];
+	va_list args;
+	va_start(args, fmt);
+	int len = od_vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+	machine_msg_t *msg = metrics->family[id];
+	if (msg == NULL)
+		return;
+	if (machine_msg_write(msg, line, len) == -1) {
+		/* family is dropped from the snapshot */
+		machine_msg_free(msg);
+		metrics->family[id] = NULL;
+	}
+}
+
+static inline void
+od_metrics_escape(char *dest, int dest_size, char *src, int src_len)
+{
+	/* label value escaping */
+	int pos = 0;
+	int i;
+	for (i = 0; i < src_len && pos < dest_size - 3; i++) {
+		switch (src[i]) {
+		case '\\':
+		case '"':
+			dest[pos++] = '\\';
+			dest[pos++] = src[i];
+			break;
+		case '\n':
+			dest[pos++] = '\\';
+			dest[pos++] = 'n';
+			break;
+		default:
+			dest[pos++] = src[i];
+			break;
+		}
+	}
+	dest[pos] = 0;
+}
+
+int
+od_metrics_begin(od_metrics_t *metrics)
+{
+	int i;
+	for (i = 0; i < OD_METRICS_MAX; i++) {
+		metrics->family[i] = machine_msg_create(0);
+		if (metrics->family[i] == NULL)
+			goto error;
+	}
+	return 0;
+error:
+	for (i = 0; i < OD_METRICS_MAX; i++) {
+		if (metrics->family[i])
+			machine_msg_free(metrics->family[i]);
+		metrics->family[i] = NULL;
+	}
+	return -1;
+}
+
+static inline void
+od_metrics_summary(od_metrics_t *metrics, od_metrics_family_t id,
+                   char *labels, od_rule_t *rule,
+                   od_hgram_frozen_t *hgram, uint64_t count,
+                   uint64_t time_us)
+{
+	char *name = od_metrics_desc[id].name;
+	if (hgram) {
+		int i;
+		for (i = 0; i < rule->quantiles_count; i++) {
+			uint64_t value;
+			value = od_hgram_quantile(hgram, rule->quantiles[i]);
+			od_metrics_write(metrics, id,
+			                 "%s{%s,quantile=\"%g\"} %.6f\n",
+			                 name, labels, rule->quantiles[i],
+			                 value / 1000000.0);
+		}
+	}
+	od_metrics_write(metrics, id, "%s_sum{%s} %.6f\n",
+	                 name, labels, time_us / 1000000.0);
+	od_metrics_write(metrics, id, "%s_count{%s} %" PRIu64 "\n",
+	                 name, labels, count);
+}
+
+static inline void
+od_metrics_rates(od_metrics_t *metrics, char *labels, od_stat_rates_t *rates)
+{
+	struct {
+		char           *kind;
+		od_stat_rate_t  rate;
+		od_stat_rate_t  time;
+	} kinds[] = {
+		{ "query",       OD_STAT_RATE_QUERY,       OD_STAT_RATE_QUERY_TIME },
+		{ "transaction", OD_STAT_RATE_TX,          OD_STAT_RATE_TX_TIME    },
+		{ "wait",        OD_STAT_RATE_WAIT,        OD_STAT_RATE_WAIT_TIME  },
+		{ "recv_client", OD_STAT_RATE_RECV_CLIENT, OD_STAT_RATE_MAX        },
+		{ "recv_server", OD_STAT_RATE_RECV_SERVER, OD_STAT_RATE_MAX        }
+	};
+	int i;
+	size_t k;
+	for (i = 0; i < OD_STAT_WINDOW_MAX; i++) {
+		for (k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+			od_metrics_write(metrics, OD_METRICS_ROUTE_RATE,
+			                 "%s{%s,kind=\"%s\",window=\"%s\"} %.3f\n",
+			                 od_metrics_desc[OD_METRICS_ROUTE_RATE].name,
+			                 labels, kinds[k].kind, od_stat_window_name(i),
+			                 rates->rate[i][kinds[k].rate]);
+			if (kinds[k].time == OD_STAT_RATE_MAX)
+				continue;
+			double avg;
+			avg = od_stat_rates_avg(rates, i, kinds[k].time, kinds[k].rate);
+			od_metrics_write(metrics, OD_METRICS_ROUTE_RATE_LATENCY,
+			                 "%s{%s,kind=\"%s\",window=\"%s\"} %.6f\n",
+			                 od_metrics_desc[OD_METRICS_ROUTE_RATE_LATENCY].name,
+			                 labels, kinds[k].kind, od_stat_window_name(i),
+			                 avg / 1000000.0);
+		}
+	}
+}
+
+static inline void
+od_metrics_route_hosts(od_metrics_t *metrics, char *labels,
+                       od_rule_storage_t *storage,
+                       od_server_pool_endpoint_t *endpoints)
+{
+	/* TCP_INFO samples of tcp_info_interval */
+	int i;
+	for (i = 0; i < storage->endpoints_count; i++) {
+		od_server_pool_endpoint_t *endpoint = &endpoints[i];
+		if (endpoint->tcp_samples == 0)
+			continue;
+		char host_labels[800];
+		od_snprintf(host_labels, sizeof(host_labels),
+		            "%s,storage=\"%s\",host=\"%s\",port=\"%d\"",
+		            labels, storage->name, storage->endpoints[i].host,
+		            storage->endpoints[i].port);
+		od_metrics_write(metrics, OD_METRICS_ROUTE_HOST_RTT,
+		                 "%s{%s,kind=\"rtt\"} %.6f\n",
+		                 od_metrics_desc[OD_METRICS_ROUTE_HOST_RTT].name,
+		                 host_labels, endpoint->rtt / 1000000.0);
+		od_metrics_write(metrics, OD_METRICS_ROUTE_HOST_RTT,
+		                 "%s{%s,kind=\"rttvar\"} %.6f\n",
+		                 od_metrics_desc[OD_METRICS_ROUTE_HOST_RTT].name,
+		                 host_labels, endpoint->rttvar / 1000000.0);
+		od_metrics_write(metrics, OD_METRICS_ROUTE_HOST_CWND,
+		                 "%s{%s} %" PRIu32 "\n",
+		                 od_metrics_desc[OD_METRICS_ROUTE_HOST_CWND].name,
+		                 host_labels, endpoint->cwnd);
+		od_metrics_write(metrics, OD_METRICS_ROUTE_HOST_RETRANS,
+		                 "%s_total{%s} %" PRIu64 "\n",
+		                 od_metrics_desc[OD_METRICS_ROUTE_HOST_RETRANS].name,
+		                 host_labels, endpoint->retrans);
+	}
+}
+
+void
+od_metrics_route(od_metrics_t *metrics, od_route_t *route,
+                 od_stat_t *current, od_stat_t *avg)
+{
+	char database[256];
+	char user[256];
+	od_metrics_escape(database, sizeof(database), route->id.database,
+	                  route->id.database_len - 1);
+	od_metrics_escape(user, sizeof(user), route->id.user,
+	                  route->id.user_len - 1);
+	char labels[600];
+	od_snprintf(labels, sizeof(labels), "database=\"%s\",user=\"%s\"",
+	            database, user);
+
+	od_route_lock(route, OD_LOCK_STAT);
+	int      clients        = od_client_pool_total(&route->client_pool);
+	int      servers_active = route->server_pool.count_active;
+	int      servers_idle   = route->server_pool.count_idle;
+	int      count_waiters  = route->count_waiters;
+	int      waiters_peak   = route->count_waiters_peak;
+	uint64_t max_wait       = od_route_max_wait(route);
+	od_route_memory_t memory = route->memory;
+	int      pool_limit     = route->pool_limit;
+	od_stat_rates_t rates   = route->rates;
+	od_server_pool_endpoint_t endpoints[OD_RULE_STORAGE_ENDPOINTS_MAX];
+	memcpy(endpoints, route->server_pool.endpoints, sizeof(endpoints));
+	od_route_unlock(route);
+
+	od_metrics_write(metrics, OD_METRICS_ROUTE_CLIENTS,
+	                 "%s{%s} %d\n",
+	                 od_metrics_desc[OD_METRICS_ROUTE_CLIENTS].name,
+	                 labels, clients);
+	od_metrics_write(metrics, OD_METRICS_ROUTE_CLIENTS_WAITING,
+	                 "%s{%s} %d\n",
+	                 od_metrics_desc[OD_METRICS_ROUTE_CLIENTS_WAITING].name,
+	                 labels, count_waiters);
+	od_metrics_write(metrics, OD_METRICS_ROUTE_SERVERS_ACTIVE,
+	                 "%s{%s} %d\n",
+	                 od_metrics_desc[OD_METRICS_ROUTE_SERVERS_ACTIVE].name,
+	                 labels, servers_active);
+	od_metrics_write(metrics, OD_METRICS_ROUTE_SERVERS_IDLE,
+	                 "%s{%s} %d\n",
+	                 od_metrics_desc[OD_METRICS_ROUTE_SERVERS_IDLE].name,
+	                 labels, servers_idle);
+	od_metrics_write(metrics, OD_METRICS_ROUTE_WAIT_MAX,
+	                 "%s{%s} %.6f\n",
+	                 od_metrics_desc[OD_METRICS_ROUTE_WAIT_MAX].name,
+	                 labels, max_wait / 1000000.0);
+
+	od_metrics_write(metrics, OD_METRICS_ROUTE_CLIENTS_WAITING_PEAK,
+	                 "%s{%s} %d\n",
+	                 od_metrics_desc[OD_METRICS_ROUTE_CLIENTS_WAITING_PEAK].name,
+	                 labels, waiters_peak);
+
+	if (route->rule->pool_adaptive)
+		od_metrics_write(metrics, OD_METRICS_ROUTE_POOL_LIMIT,
+		                 "%s{%s} %d\n",
+		                 od_metrics_desc[OD_METRICS_ROUTE_POOL_LIMIT].name,
+		                 labels, pool_limit);
+
+	struct {
+		char     *kind;
+		uint64_t  value;
+	} kinds[] = {
+		{ "client_buffers", memory.client_buffers },
+		{ "server_buffers", memory.server_buffers },
+		{ "packets",        memory.packets        },
+		{ "pending",        memory.pending        },
+		{ "stats",          memory.stats          }
+	};
+	size_t k;
+	for (k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+		od_metrics_write(metrics, OD_METRICS_ROUTE_MEMORY,
+		                 "%s{%s,kind=\"%s\"} %" PRIu64 "\n",
+		                 od_metrics_desc[OD_METRICS_ROUTE_MEMORY].name,
+		                 labels, kinds[k].kind, kinds[k].value);
+	}
+
+	od_metrics_summary(metrics, OD_METRICS_ROUTE_WAIT, labels,
+	                   route->rule, avg->wait_hgram, current->count_wait,
+	                   current->wait_time);
+	od_metrics_write(metrics, OD_METRICS_ROUTE_WAIT_TIMEOUTS,
+	                 "%s_total{%s} %" PRIu64 "\n",
+	                 od_metrics_desc[OD_METRICS_ROUTE_WAIT_TIMEOUTS].name,
+	                 labels, current->count_wait_timeout);
+	od_metrics_write(metrics, OD_METRICS_ROUTE_WAIT_ROUTING,
+	                 "%s_total{%s} %" PRIu64 "\n",
+	                 od_metrics_desc[OD_METRICS_ROUTE_WAIT_ROUTING].name,
+	                 labels, current->count_wait_routing);
+	od_metrics_summary(metrics, OD_METRICS_ROUTE_QUERY, labels,
+	                   route->rule, avg->query_hgram,
+	                   current->count_query, current->query_time);
+	od_metrics_summary(metrics, OD_METRICS_ROUTE_TRANSACTION, labels,
+	                   route->rule, avg->transaction_hgram,
+	                   current->count_tx, current->tx_time);
+
+	int i, j;
+	for (i = 0; i < OD_STAT_QUERY_MAX; i++) {
+		for (j = 0; j < OD_STAT_PHASE_MAX; j++) {
+			char phase_labels[700];
+			od_snprintf(phase_labels, sizeof(phase_labels),
+			            "%s,type=\"%s\",phase=\"%s\"", labels,
+			            od_stat_query_type_name(i),
+			            od_stat_phase_name(j));
+			od_metrics_summary(metrics, OD_METRICS_ROUTE_QUERY_PHASE,
+			                   phase_labels, route->rule,
+			                   avg->type[i].hgram[j],
+			                   current->type[i].count,
+			                   current->type[i].time[j]);
+		}
+	}
+
+	od_metrics_write(metrics, OD_METRICS_ROUTE_RECV_CLIENT,
+	                 "%s_total{%s} %" PRIu64 "\n",
+	                 od_metrics_desc[OD_METRICS_ROUTE_RECV_CLIENT].name,
+	                 labels, current->recv_client);
+	od_metrics_write(metrics, OD_METRICS_ROUTE_RECV_SERVER,
+	                 "%s_total{%s} %" PRIu64 "\n",
+	                 od_metrics_desc[OD_METRICS_ROUTE_RECV_SERVER].name,
+	                 labels, current->recv_server);
+	od_metrics_rates(metrics, labels, &rates);
+	od_metrics_route_hosts(metrics, labels, od_route_storage(route),
+	                       endpoints);
+
+	/* coroutine accounting */
+	od_instance_t *instance = metrics->global->instance;
+	if (! instance->config.coroutine_accounting)
+		return;
+	od_metrics_write(metrics, OD_METRICS_ROUTE_CPU,
+	                 "%s_total{%s} %.6f\n",
+	                 od_metrics_desc[OD_METRICS_ROUTE_CPU].name,
+	                 labels, current->cpu_time / 1000000.0);
+	od_metrics_write(metrics, OD_METRICS_ROUTE_CPU_WAIT,
+	                 "%s_total{%s} %.6f\n",
+	                 od_metrics_desc[OD_METRICS_ROUTE_CPU_WAIT].name,
+	                 labels, current->cpu_wait / 1000000.0);
+	od_metrics_write(metrics, OD_METRICS_ROUTE_SWITCHES,
+	                 "%s_total{%s} %" PRIu64 "\n",
+	                 od_metrics_desc[OD_METRICS_ROUTE_SWITCHES].name,
+	                 labels, current->count_switch);
+}
+
+static inline void
+od_metrics_fingerprints(od_metrics_t *metrics)
+{
+	od_instance_t *instance = metrics->global->instance;
+	od_worker_pool_t *worker_pool = metrics->global->worker_pool;
+	od_fingerprints_t fingerprints;
+	od_fingerprints_init(&fingerprints);
+	int rc;
+	rc = od_worker_pool_fingerprints(worker_pool, &fingerprints,
+	                                 instance->config.query_fingerprint_max);
+	if (rc == -1) {
+		od_fingerprints_free(&fingerprints);
+		return;
+	}
+	char *name = od_metrics_desc[OD_METRICS_QUERY_FINGERPRINT].name;
+	double quantiles[] = { 0.5, 0.95, 0.99 };
+	int i;
+	for (i = 0; i < fingerprints.count; i++) {
+		od_fingerprint_t *fingerprint = &fingerprints.entries[i];
+		char query[OD_FINGERPRINT_TEXT * 2 + 1];
+		od_metrics_escape(query, sizeof(query), fingerprint->text,
+		                  fingerprint->text_len);
+		char labels[OD_FINGERPRINT_TEXT * 2 + 64];
+		od_snprintf(labels, sizeof(labels),
+		            "fingerprint=\"%016" PRIx64 "\",query=\"%s\"",
+		            fingerprint->hash, query);
+		size_t j;
+		for (j = 0; j < sizeof(quantiles) / sizeof(quantiles[0]); j++) {
+			uint64_t value;
+			value = od_hgram_quantile(fingerprint->hgram, quantiles[j]);
+			od_metrics_write(metrics, OD_METRICS_QUERY_FINGERPRINT,
+			                 "%s{%s,quantile=\"%g\"} %.6f\n",
+			                 name, labels, quantiles[j],
+			                 value / 1000000.0);
+		}
+		od_metrics_write(metrics, OD_METRICS_QUERY_FINGERPRINT,
+		                 "%s_sum{%s} %.6f\n",
+		                 name, labels, fingerprint->time / 1000000.0);
+		od_metrics_write(metrics, OD_METRICS_QUERY_FINGERPRINT,
+		                 "%s_count{%s} %" PRIu64 "\n",
+		                 name, labels, fingerprint->count);
+	}
+	od_metrics_write(metrics, OD_METRICS_QUERY_FINGERPRINT_DROPPED,
+	                 "%s_total %" PRIu64 "\n",
+	                 od_metrics_desc[OD_METRICS_QUERY_FINGERPRINT_DROPPED].name,
+	                 fingerprints.dropped);
+	od_fingerprints_free(&fingerprints);
+}
+
+static inline void
+od_metrics_top(od_metrics_t *metrics)
+{
+	od_instance_t *instance = metrics->global->instance;
+	od_worker_pool_t *worker_pool = metrics->global->worker_pool;
+	int size = instance->config.top_size;
+	od_top_t top;
+	od_top_init(&top);
+	int rc;
+	rc = od_worker_pool_top(worker_pool, &top, size);
+	if (rc == -1) {
+		od_top_free(&top);
+		return;
+	}
+	int i, j, k;
+	for (i = 0; i < OD_TOP_MAX; i++) {
+		for (j = 0; j < OD_TOP_WEIGHT_MAX; j++) {
+			od_top_summary_t *summary = &top.summary[i][j];
+			for (k = 0; k < summary->count && k < size; k++) {
+				od_top_entry_t *entry = &summary->entries[k];
+				char key[OD_TOP_TEXT * 2 + 1];
+				od_metrics_escape(key, sizeof(key), entry->text,
+				                  entry->text_len);
+				od_metrics_write(metrics, OD_METRICS_TOP,
+				                 "%s{type=\"%s\",by=\"%s\",key=\"%s\"} %" PRIu64 "\n",
+				                 od_metrics_desc[OD_METRICS_TOP].name,
+				                 od_top_type_name(i),
+				                 od_top_weight_name(j),
+				                 key, entry->value);
+			}
+		}
+	}
+	od_top_free(&top);
+}
+
+static inline void
+od_metrics_lock_summary(od_metrics_t *metrics, od_metrics_family_t id,
+                        char *labels, od_hgram_frozen_t *hgram,
+                        uint64_t count, uint64_t time_ns)
+{
+	char *name = od_metrics_desc[id].name;
+	double quantiles[] = { 0.5, 0.99 };
+	size_t i;
+	for (i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+		uint64_t value;
+		value = od_hgram_quantile(hgram, quantiles[i]);
+		od_metrics_write(metrics, id,
+		                 "%s{%s,quantile=\"%g\"} %.9f\n",
+		                 name, labels, quantiles[i],
+		                 value / 1000000000.0);
+	}
+	od_metrics_write(metrics, id, "%s_sum{%s} %.9f\n",
+	                 name, labels, time_ns / 1000000000.0);
+	od_metrics_write(metrics, id, "%s_count{%s} %" PRIu64 "\n",
+	                 name, labels, count);
+}
+
+static inline void
+od_metrics_locks(od_metrics_t *metrics)
+{
+	od_lockstat_site_t sum[OD_LOCKSTAT_MAX][OD_LOCK_SITE_MAX];
+	int rc;
+	rc = od_lockstat_merge(sum);
+	if (rc == -1)
+		return;
+	int i, j;
+	for (i = 0; i < OD_LOCKSTAT_MAX; i++) {
+		for (j = 0; j < OD_LOCK_SITE_MAX; j++) {
+			od_lockstat_site_t *stat = &sum[i][j];
+			if (stat->count == 0)
+				continue;
+			char labels[64];
+			od_snprintf(labels, sizeof(labels),
+			            "lock=\"%s\",site=\"%s\"",
+			            od_lockstat_lock_name(i),
+			            od_lockstat_site_name(j));
+			od_metrics_lock_summary(metrics, OD_METRICS_LOCK_WAIT, labels,
+			                        stat->wait_hgram, stat->count,
+			                        stat->wait);
+			od_metrics_lock_summary(metrics, OD_METRICS_LOCK_HOLD, labels,
+			                        stat->hold_hgram, stat->count,
+			                        stat->hold);
+		}
+	}
+	od_lockstat_merge_free(sum);
+}
+
+static inline void
+od_metrics_accept_summary(od_metrics_t *metrics, char *stage,
+                          od_hgram_frozen_t *hgram)
+{
+	char *name = od_metrics_desc[OD_METRICS_ACCEPT_LATENCY].name;
+	double quantiles[] = { 0.5, 0.99 };
+	size_t i;
+	for (i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+		uint64_t value;
+		value = od_hgram_quantile(hgram, quantiles[i]);
+		od_metrics_write(metrics, OD_METRICS_ACCEPT_LATENCY,
+		                 "%s{stage=\"%s\",quantile=\"%g\"} %.6f\n",
+		                 name, stage, quantiles[i], value / 1000000.0);
+	}
+	od_metrics_write(metrics, OD_METRICS_ACCEPT_LATENCY,
+	                 "%s_count{stage=\"%s\"} %" PRIu64 "\n",
+	                 name, stage, hgram->total);
+}
+
+static inline void
+od_metrics_accept(od_metrics_t *metrics)
+{
+	od_system_t *system = metrics->global->system;
+	od_backlog_t *backlog = &system->backlog;
+	pthread_mutex_lock(&backlog->lock);
+	od_list_t *i;
+	od_list_foreach(&backlog->listens, i) {
+		od_backlog_listen_t *listen;
+		listen = od_container_of(i, od_backlog_listen_t, link);
+		od_hgram_freeze(listen->hgram, NULL, 0);
+		double quantiles[] = { 0.5, 0.99, 1.0 };
+		size_t j;
+		for (j = 0; j < sizeof(quantiles) / sizeof(quantiles[0]); j++) {
+			uint64_t value;
+			value = od_hgram_quantile(listen->hgram, quantiles[j]);
+			if (quantiles[j] == 1.0)
+				value = listen->depth_max;
+			od_metrics_write(metrics, OD_METRICS_ACCEPT_DEPTH,
+			                 "%s{listen=\"%s:%d\",quantile=\"%g\"} %" PRIu64 "\n",
+			                 od_metrics_desc[OD_METRICS_ACCEPT_DEPTH].name,
+			                 listen->host, listen->port, quantiles[j], value);
+		}
+		od_metrics_write(metrics, OD_METRICS_ACCEPT_FULL,
+		                 "%s_total{listen=\"%s:%d\"} %" PRIu64 "\n",
+		                 od_metrics_desc[OD_METRICS_ACCEPT_FULL].name,
+		                 listen->host, listen->port, listen->full);
+	}
+	if (backlog->kernel) {
+		od_metrics_write(metrics, OD_METRICS_ACCEPT_KERNEL,
+		                 "%s_total{counter=\"overflows\"} %" PRIu64 "\n",
+		                 od_metrics_desc[OD_METRICS_ACCEPT_KERNEL].name,
+		                 backlog->overflows);
+		od_metrics_write(metrics, OD_METRICS_ACCEPT_KERNEL,
+		                 "%s_total{counter=\"drops\"} %" PRIu64 "\n",
+		                 od_metrics_desc[OD_METRICS_ACCEPT_KERNEL].name,
+		                 backlog->drops);
+	}
+	pthread_mutex_unlock(&backlog->lock);
+
+	od_hgram_frozen_t *accept;
+	od_hgram_frozen_t *login;
+	int rc;
+	rc = od_backlog_merge(metrics->global, &accept, &login);
+	if (rc == -1)
+		return;
+	od_metrics_accept_summary(metrics, "accept", accept);
+	od_metrics_accept_summary(metrics, "login", login);
+	od_hgram_free(accept);
+	od_hgram_free(login);
+}
+
+void
+od_metrics_end(od_metrics_t *metrics)
+{
+	od_router_t *router = metrics->global->router;
+	od_worker_pool_t *worker_pool = metrics->global->worker_pool;
+
+	od_metrics_write(metrics, OD_METRICS_CLIENTS, "%s %d\n",
+	                 od_metrics_desc[OD_METRICS_CLIENTS].name,
+	                 od_atomic_u32_of(&router->clients));
+	od_metrics_write(metrics, OD_METRICS_ROUTES, "%s %d\n",
+	                 od_metrics_desc[OD_METRICS_ROUTES].name,
+	                 od_atomic_u32_of(&router->route_pool.count));
+	int i;
+	for (i = 0; i < od_worker_pool_total(worker_pool); i++) {
+		od_worker_t *worker = od_worker_pool_get(worker_pool, i);
+		od_metrics_write(metrics, OD_METRICS_WORKER_CLIENTS,
+		                 "%s{worker=\"%d\"} %d\n",
+		                 od_metrics_desc[OD_METRICS_WORKER_CLIENTS].name,
+		                 worker->id,
+		                 od_atomic_u32_of(&worker->clients));
+		od_metrics_write(metrics, OD_METRICS_WORKER_CLIENTS_PROCESSED,
+		                 "%s_total{worker=\"%d\"} %" PRIu64 "\n",
+		                 od_metrics_desc[OD_METRICS_WORKER_CLIENTS_PROCESSED].name,
+		                 worker->id,
+		                 worker->clients_processed);
+		od_metrics_write(metrics, OD_METRICS_WORKER_MEMORY,
+		                 "%s{worker=\"%d\"} %" PRIu64 "\n",
+		                 od_metrics_desc[OD_METRICS_WORKER_MEMORY].name,
+		                 worker->id,
+		                 od_atomic_u64_of(&worker->memory));
+	}
+
+	od_instance_t *instance = metrics->global->instance;
+	if (instance->config.query_fingerprint)
+		od_metrics_fingerprints(metrics);
+	if (instance->config.top_size)
+		od_metrics_top(metrics);
+	if (od_lockstat.enabled)
+		od_metrics_locks(metrics);
+	if (instance->config.accept_stats_interval)
+		od_metrics_accept(metrics);
+
+	/* join families into the new snapshot */
+	machine_msg_t *snapshot;
+	snapshot = machine_msg_create(0);
+	for (i = 0; i < OD_METRICS_MAX; i++) {
+		machine_msg_t *family = metrics->family[i];
+		metrics->family[i] = NULL;
+		if (family == NULL)
+			continue;
+		if (snapshot) {
+			char header[256];
+			int  header_len;
+			header_len = od_snprintf(header, sizeof(header),
+			                         "# TYPE %s %s\n# HELP %s %s\n",
+			                         od_metrics_desc[i].name,
+			                         od_metrics_desc[i].type,
+			                         od_metrics_desc[i].name,
+			                         od_metrics_desc[i].help);
+			int rc;
+			rc = machine_msg_write(snapshot, header, header_len);
+			if (rc == 0)
+				rc = machine_msg_write(snapshot, machine_msg_data(family),
+				                       machine_msg_size(family));
+			if (rc == -1) {
+				machine_msg_free(snapshot);
+				snapshot = NULL;
+			}
+		}
+		machine_msg_free(family);
+	}
+	if (snapshot == NULL)
+		return;
+	if (machine_msg_write(snapshot, "# EOF\n", 6) == -1) {
+		machine_msg_free(snapshot);
+		return;
+	}
+	if (metrics->snapshot)
+		machine_msg_free(metrics->snapshot);
+	metrics->snapshot = snapshot;
+}
+
+static inline int
+od_metrics_read_request(machine_io_t *io, char *request, int size)
+{
+	machine_cond_t *on_read;
+	on_read = machine_cond_create();
+	if (on_read == NULL)
+		return -1;
+	int rc;
+	rc = machine_read_start(io, on_read);
+	if (rc == -1) {
+		machine_cond_free(on_read);
+		return -1;
+	}
+	int pos = 0;
+	for (;;)
+	{
+		rc = machine_read_raw(io, request + pos, size - pos - 1);
+		if (rc > 0) {
+			pos += rc;
+			request[pos] = 0;
+			if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+				break;
+			if (pos == size - 1) {
+				rc = -1;
+				break;
+			}
+			continue;
+		}
+		int errno_ = machine_errno();
+		if (rc == -1 && (errno_ == EAGAIN || errno_ == EWOULDBLOCK ||
+		                 errno_ == EINTR)) {
+			rc = machine_cond_wait(on_read, OD_METRICS_TIMEOUT);
+			if (rc == 0)
+				continue;
+		}
+		/* eof, error or timeout */
+		rc = -1;
+		break;
+	}
+	machine_read_stop(io);
+	machine_cond_free(on_read);
+	return rc == -1 ? -1 : pos;
+}
+
+static inline int
+od_metrics_reply(od_metrics_t *metrics, machine_io_t *io, char *request)
+{
+	char *status = "200 OK";
+	char *content_type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+	char *body = "# EOF\n";
+	int   body_size = 6;
+	if (metrics->snapshot) {
+		body = machine_msg_data(metrics->snapshot);
+		body_size = machine_msg_size(metrics->snapshot);
+	}
+
+	/* GET /metrics HTTP/1.1, query string is ignored */
+	if (strncmp(request, "GET ", 4) != 0) {
+		status = "405 Method Not Allowed";
+		body = NULL;
+	} else {
+		char *path = request + 4;
+		int   path_len = strcspn(path, " ?\r\n");
+		if (! ((path_len == 8 && memcmp(path, "/metrics", 8) == 0) ||
+		       (path_len == 1 && *path == '/'))) {
+			status = "404 Not Found";
+			body = NULL;
+		}
+	}
+	if (body == NULL) {
+		content_type = "text/plain";
+		body = status;
+		body_size = strlen(status);
+	}
+
+	char header[256];
+	int  header_len;
+	header_len = od_snprintf(header, sizeof(header),
+	                         "HTTP/1.1 %s\r\n"
+	                         "Content-Type: %s\r\n"
+	                         "Content-Length: %d\r\n"
+	                         "Connection: close\r\n\r\n",
+	                         status, content_type, body_size);
+
+	/* copy snapshot, it can be replaced while the reply is written */
+	machine_msg_t *msg;
+	msg = machine_msg_create(0);
+	if (msg == NULL)
+		return -1;
+	int rc;
+	rc = machine_msg_write(msg, header, header_len);
+	if (rc == 0)
+		rc = machine_msg_write(msg, body, body_size);
+	if (rc == -1) {
+		machine_msg_free(msg);
+		return -1;
+	}
+	return machine_write(io, msg, OD_METRICS_TIMEOUT);
+}
+
+typedef struct
+{
+	od_metrics_t *metrics;
+	machine_io_t *io;
+} od_metrics_client_t;
+
+static void
+od_metrics_client(void *arg)
+{
+	od_metrics_client_t *client = arg;
+	char request[OD_METRICS_REQUEST_MAX];
+	int rc;
+	machine_set_priority(MACHINE_PRIORITY_LOW);
+	rc = od_metrics_read_request(client->io, request, sizeof(request));
+	if (rc != -1)
+		od_metrics_reply(client->metrics, client->io, request);
+	machine_close(client->io);
+	machine_io_free(client->io);
+	free(client);
+}
+
+static void
+od_metrics_server(void *arg)
+{
+	od_metrics_t *metrics = arg;
+	od_instance_t *instance = metrics->global->instance;
+	machine_set_priority(MACHINE_PRIORITY_LOW);
+	for (;;)
+	{
+		machine_io_t *client_io;
+		int rc;
+		rc = machine_accept(metrics->io, &client_io, 64, 1, UINT32_MAX);
+		if (rc == -1) {
+			od_error(&instance->logger, "metrics", NULL, NULL,
+			         "accept failed: %s",
+			         machine_error(metrics->io));
+			if (machine_errno() == EADDRINUSE)
+				break;
+			continue;
+		}
+		od_metrics_client_t *client;
+		client = malloc(sizeof(od_metrics_client_t));
+		if (client == NULL) {
+			machine_close(client_io);
+			machine_io_free(client_io);
+			continue;
+		}
+		client->metrics = metrics;
+		client->io      = client_io;
+		int64_t coroutine_id;
+		coroutine_id = machine_coroutine_create(od_metrics_client, client);
+		if (coroutine_id == -1) {
+			machine_close(client_io);
+			machine_io_free(client_io);
+			free(client);
+		}
+	}
+}
+
+int
+od_metrics_start(od_metrics_t *metrics, od_global_t *global)
+{
+	od_instance_t *instance = global->instance;
+	metrics->global = global;
+	if (instance->config.metrics_port == 0)
+		return 0;
+
+	char *host = instance->config.metrics_host;
+	if (host == NULL)
+		host = "127.0.0.1";
+	char port[16];
+	od_snprintf(port, sizeof(port), "%d", instance->config.metrics_port);
+
+	struct addrinfo *ai = NULL;
+	int rc;
+	rc = machine_getaddrinfo(host, port, NULL, &ai, UINT32_MAX);
+	if (rc != 0) {
+		od_error(&instance->logger, "metrics", NULL, NULL,
+		         "failed to resolve %s:%s", host, port);
+		return -1;
+	}
+
+	machine_io_t *io;
+	io = machine_io_create();
+	if (io == NULL) {
+		freeaddrinfo(ai);
+		return -1;
+	}
+	od_system_t *system = global->system;
+	int fd;
+	fd = od_restart_take(&system->restart, ai->ai_addr);
+	if (fd != -1)
+		rc = machine_bind_fd(io, fd);
+	else
+		rc = machine_bind(io, ai->ai_addr);
+	freeaddrinfo(ai);
+	if (rc == -1) {
+		od_error(&instance->logger, "metrics", NULL, NULL,
+		         "bind to %s:%s failed: %s", host, port,
+		         machine_error(io));
+		machine_close(io);
+		machine_io_free(io);
+		return -1;
+	}
+	metrics->io = io;
+
+	int64_t coroutine_id;
+	coroutine_id = machine_coroutine_create(od_metrics_server, metrics);
+	if (coroutine_id == -1) {
+		od_error(&instance->logger, "metrics", NULL, NULL,
+		         "failed to start metrics coroutine");
+		metrics->io = NULL;
+		machine_close(io);
+		machine_io_free(io);
+		return -1;
+	}
+	od_log(&instance->logger, "metrics", NULL, NULL,
+	       "serving metrics on %s:%s", host, port);
+	return 0;
+}
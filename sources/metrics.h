@@ -0,0 +1,82 @@
+#ifndef ODYSSEY_METRICS_H
+#define ODYSSEY_METRICS_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_metrics od_metrics_t;
+
+typedef enum
+{
+	OD_METRICS_CLIENTS,
+	OD_METRICS_ROUTES,
+	OD_METRICS_WORKER_CLIENTS,
+	OD_METRICS_WORKER_CLIENTS_PROCESSED,
+	OD_METRICS_WORKER_MEMORY,
+	OD_METRICS_ROUTE_CLIENTS,
+	OD_METRICS_ROUTE_CLIENTS_WAITING,
+	OD_METRICS_ROUTE_SERVERS_ACTIVE,
+	OD_METRICS_ROUTE_SERVERS_IDLE,
+	OD_METRICS_ROUTE_WAIT_MAX,
+	OD_METRICS_ROUTE_WAIT,
+	OD_METRICS_ROUTE_WAIT_TIMEOUTS,
+	OD_METRICS_ROUTE_WAIT_ROUTING,
+	OD_METRICS_ROUTE_CLIENTS_WAITING_PEAK,
+	OD_METRICS_ROUTE_MEMORY,
+	OD_METRICS_ROUTE_POOL_LIMIT,
+	OD_METRICS_ROUTE_QUERY,
+	OD_METRICS_ROUTE_TRANSACTION,
+	OD_METRICS_ROUTE_QUERY_PHASE,
+	OD_METRICS_ROUTE_RECV_CLIENT,
+	OD_METRICS_ROUTE_RECV_SERVER,
+	OD_METRICS_ROUTE_CPU,
+	OD_METRICS_ROUTE_CPU_WAIT,
+	OD_METRICS_ROUTE_SWITCHES,
+	OD_METRICS_ROUTE_RATE,
+	OD_METRICS_ROUTE_RATE_LATENCY,
+	OD_METRICS_ROUTE_HOST_RTT,
+	OD_METRICS_ROUTE_HOST_CWND,
+	OD_METRICS_ROUTE_HOST_RETRANS,
+	OD_METRICS_QUERY_FINGERPRINT,
+	OD_METRICS_QUERY_FINGERPRINT_DROPPED,
+	OD_METRICS_TOP,
+	OD_METRICS_LOCK_WAIT,
+	OD_METRICS_LOCK_HOLD,
+	OD_METRICS_ACCEPT_DEPTH,
+	OD_METRICS_ACCEPT_FULL,
+	OD_METRICS_ACCEPT_KERNEL,
+	OD_METRICS_ACCEPT_LATENCY,
+	OD_METRICS_MAX
+} od_metrics_family_t;
+
+/* Metrics are rendered by cron into a text snapshot in
+ * OpenMetrics format, samples of every family are gathered
+ * separately during the routes pass and joined at the end.
+ *
+ * Cron and the http server both run on the housekeeping machine,
+ * scrapes only copy the last published snapshot. */
+struct od_metrics
+{
+	machine_io_t  *io;
+	machine_msg_t *snapshot;
+	machine_msg_t *family[OD_METRICS_MAX];
+	od_global_t   *global;
+};
+
+void od_metrics_init(od_metrics_t*);
+int  od_metrics_start(od_metrics_t*, od_global_t*);
+
+static inline int
+od_metrics_enabled(od_metrics_t *metrics)
+{
+	return metrics->io != NULL;
+}
+
+int  od_metrics_begin(od_metrics_t*);
+void od_metrics_route(od_metrics_t*, od_route_t*, od_stat_t*, od_stat_t*);
+void od_metrics_end(od_metrics_t*);
+
+#endif /* ODYSSEY_METRICS_H */
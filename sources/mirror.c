@@ -0,0 +1,449 @@
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+/* failed pool is not retried for a while, its queries are dropped */
+#define OD_MIRROR_RETRY_INTERVAL 1000
+
+typedef struct
+{
+	od_mirror_t       *mirror;
+	od_mirror_pool_t  *pool;
+	machine_channel_t *channel;
+	machine_msg_t     *request;
+	int                endpoint;
+	od_list_t          link;
+} od_mirror_conn_t;
+
+static inline od_mirror_request_t*
+od_mirror_request_of(machine_msg_t *msg, char **database, char **user,
+                     char **data)
+{
+	od_mirror_request_t *request = machine_msg_data(msg);
+	*database = (char*)request + sizeof(od_mirror_request_t);
+	*user     = *database + request->database_len;
+	*data     = *user + request->user_len;
+	return request;
+}
+
+void
+od_mirror_query(od_client_t *client, char *data, int size)
+{
+	od_instance_t *instance = client->global->instance;
+	od_system_t *system = client->global->system;
+	od_mirror_t *mirror = &system->mirror;
+	if (mirror->channel == NULL)
+		return;
+
+	/* the machine does not keep up, do not grow the queue */
+	if (od_atomic_u64_of(&mirror->queued) >=
+	    (uint64_t)instance->config.mirror_queue) {
+		od_atomic_u64_inc(&mirror->dropped);
+		return;
+	}
+
+	kiwi_var_t *user = &client->startup.user;
+	kiwi_var_t *database = &client->startup.database;
+	machine_msg_t *msg;
+	msg = machine_msg_create(sizeof(od_mirror_request_t) +
+	                         database->value_len + user->value_len + size);
+	if (msg == NULL)
+		return;
+	od_mirror_request_t *request = machine_msg_data(msg);
+	request->database_len = database->value_len;
+	request->user_len     = user->value_len;
+	request->size         = size;
+	char *pos = (char*)request + sizeof(od_mirror_request_t);
+	memcpy(pos, database->value, database->value_len);
+	pos += database->value_len;
+	memcpy(pos, user->value, user->value_len);
+	pos += user->value_len;
+	memcpy(pos, data, size);
+	od_atomic_u64_inc(&mirror->queued);
+	machine_channel_write(mirror->channel, msg);
+}
+
+static inline void
+od_mirror_pool_free(od_mirror_t *mirror, od_mirror_pool_t *pool)
+{
+	od_router_t *router = mirror->global->router;
+	pthread_mutex_lock(&mirror->lock);
+	od_list_unlink(&pool->link);
+	pthread_mutex_unlock(&mirror->lock);
+	if (pool->client) {
+		od_router_unroute(router, pool->client);
+		od_client_free(pool->client);
+	}
+	if (pool->latency)
+		od_hgram_free(pool->latency);
+	free(pool->database);
+	free(pool->user);
+	free(pool);
+}
+
+static inline int
+od_mirror_pool_route(od_mirror_t *mirror, od_mirror_pool_t *pool)
+{
+	od_instance_t *instance = mirror->global->instance;
+	od_router_t *router = mirror->global->router;
+
+	/* internal client authenticates mirror connections as the
+	 * route user, like health checks */
+	od_client_t *client;
+	client = od_client_allocate();
+	if (client == NULL)
+		return -1;
+	client->global = mirror->global;
+	od_id_generate(&client->id, "m");
+	kiwi_var_set(&client->startup.user, KIWI_VAR_UNDEF,
+	             pool->user, pool->user_len);
+	kiwi_var_set(&client->startup.database, KIWI_VAR_UNDEF,
+	             pool->database, pool->database_len);
+
+	od_router_status_t status;
+	status = od_router_route(router, &instance->config, client);
+	if (status != OD_ROUTER_OK) {
+		od_error(&instance->logger, "mirror", client, NULL,
+		         "failed to route %.*s.%.*s",
+		         pool->database_len, pool->database,
+		         pool->user_len, pool->user);
+		od_client_free(client);
+		return -1;
+	}
+	if (client->rule->storage_mirror == NULL) {
+		od_router_unroute(router, client);
+		od_client_free(client);
+		return -1;
+	}
+	pool->client = client;
+	return 0;
+}
+
+static inline od_mirror_pool_t*
+od_mirror_pool_create(od_mirror_t *mirror, char *database, int database_len,
+                      char *user, int user_len)
+{
+	od_mirror_pool_t *pool;
+	pool = calloc(1, sizeof(od_mirror_pool_t));
+	if (pool == NULL)
+		return NULL;
+	od_list_init(&pool->idle);
+	od_list_init(&pool->link);
+	pool->database = malloc(database_len + 1);
+	pool->user     = malloc(user_len + 1);
+	pool->latency  = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
+	if (pool->database == NULL || pool->user == NULL ||
+	    pool->latency == NULL) {
+		od_mirror_pool_free(mirror, pool);
+		return NULL;
+	}
+	memcpy(pool->database, database, database_len);
+	pool->database[database_len] = 0;
+	pool->database_len = database_len;
+	memcpy(pool->user, user, user_len);
+	pool->user[user_len] = 0;
+	pool->user_len = user_len;
+
+	/* a pool which failed to route is kept to drop queries
+	 * until the retry */
+	if (od_mirror_pool_route(mirror, pool) == -1)
+		pool->retry = machine_time_ms() + OD_MIRROR_RETRY_INTERVAL;
+
+	pthread_mutex_lock(&mirror->lock);
+	od_list_append(&mirror->pools, &pool->link);
+	pthread_mutex_unlock(&mirror->lock);
+	return pool;
+}
+
+static inline od_mirror_pool_t*
+od_mirror_pool_find(od_mirror_t *mirror, char *database, int database_len,
+                    char *user, int user_len)
+{
+	od_list_t *i;
+	od_list_foreach(&mirror->pools, i) {
+		od_mirror_pool_t *pool;
+		pool = od_container_of(i, od_mirror_pool_t, link);
+		if (pool->obsolete)
+			continue;
+		if (pool->database_len == database_len &&
+		    pool->user_len == user_len &&
+		    memcmp(pool->database, database, database_len) == 0 &&
+		    memcmp(pool->user, user, user_len) == 0)
+			return pool;
+	}
+	return NULL;
+}
+
+static inline void
+od_mirror_pool_obsolete(od_mirror_t *mirror, od_mirror_pool_t *pool)
+{
+	/* idle connections are stopped by an empty request, busy
+	 * ones stop after their query */
+	pool->obsolete = 1;
+	od_list_t *i, *n;
+	od_list_foreach_safe(&pool->idle, i, n) {
+		od_mirror_conn_t *conn;
+		conn = od_container_of(i, od_mirror_conn_t, link);
+		od_list_unlink(&conn->link);
+		od_list_init(&conn->link);
+		machine_msg_t *msg = machine_msg_create(0);
+		if (msg)
+			machine_channel_write(conn->channel, msg);
+	}
+	if (pool->count == 0)
+		od_mirror_pool_free(mirror, pool);
+}
+
+static inline void
+od_mirror_stat(od_mirror_t *mirror, od_mirror_pool_t *pool,
+               int error, uint64_t latency)
+{
+	pthread_mutex_lock(&mirror->lock);
+	if (error) {
+		pool->errors++;
+	} else {
+		pool->sent++;
+		pool->latency_sum += latency;
+		od_hgram_add_data_point(pool->latency, latency);
+	}
+	pthread_mutex_unlock(&mirror->lock);
+}
+
+static inline int
+od_mirror_send(od_mirror_t *mirror, od_mirror_pool_t *pool,
+               od_server_t *server, machine_msg_t *msg)
+{
+	od_instance_t *instance = mirror->global->instance;
+	char *database, *user, *data;
+	od_mirror_request_t *request;
+	request = od_mirror_request_of(msg, &database, &user, &data);
+
+	uint64_t start = machine_time_us();
+	machine_msg_t *query = machine_msg_create(request->size);
+	if (query == NULL)
+		return -1;
+	memcpy(machine_msg_data(query), data, request->size);
+	int rc;
+	rc = od_write(&server->io, query);
+	if (rc == -1) {
+		od_error(&instance->logger, "mirror", NULL, server,
+		         "write error: %s", od_io_error(&server->io));
+		return -1;
+	}
+
+	/* replies are discarded, errors of the shadow storage are
+	 * only counted */
+	int error = 0;
+	for (;;) {
+		machine_msg_t *reply;
+		reply = od_read(&server->io, OD_MIRROR_TIMEOUT);
+		if (reply == NULL) {
+			od_error(&instance->logger, "mirror", NULL, server,
+			         "read error: %s", od_io_error(&server->io));
+			return -1;
+		}
+		kiwi_be_type_t type = *(char*)machine_msg_data(reply);
+		machine_msg_free(reply);
+		if (type == KIWI_BE_ERROR_RESPONSE)
+			error = 1;
+		if (type == KIWI_BE_READY_FOR_QUERY)
+			break;
+	}
+	od_mirror_stat(mirror, pool, error, machine_time_us() - start);
+	return 0;
+}
+
+static void
+od_mirror_conn_main(void *arg)
+{
+	od_mirror_conn_t *conn = arg;
+	od_mirror_t *mirror = conn->mirror;
+	od_mirror_pool_t *pool = conn->pool;
+	od_rule_t *rule = pool->client->rule;
+
+	od_server_t server;
+	od_server_init(&server);
+	server.global = mirror->global;
+	server.route  = pool->client->route;
+	od_id_generate(&server.id, "s");
+
+	machine_msg_t *msg = conn->request;
+	int rc;
+	rc = od_backend_connect_endpoint(&server, "mirror", rule->storage_mirror,
+	                                 conn->endpoint, OD_MIRROR_TIMEOUT);
+	if (rc == -1)
+		pool->retry = machine_time_ms() + OD_MIRROR_RETRY_INTERVAL;
+	while (rc == 0 && msg) {
+		if (machine_msg_size(msg) == 0)
+			break;
+		rc = od_mirror_send(mirror, pool, &server, msg);
+		machine_msg_free(msg);
+		msg = NULL;
+		if (rc == -1 || pool->obsolete)
+			break;
+		od_list_append(&pool->idle, &conn->link);
+		msg = machine_channel_read(conn->channel, UINT32_MAX);
+	}
+	if (rc == -1)
+		od_mirror_stat(mirror, pool, 1, 0);
+	if (msg)
+		machine_msg_free(msg);
+
+	server.route = NULL;
+	od_backend_close_connection(&server);
+	od_backend_close(&server);
+
+	od_list_unlink(&conn->link);
+	machine_channel_free(conn->channel);
+	free(conn);
+	pool->count--;
+	if (pool->obsolete && pool->count == 0)
+		od_mirror_pool_free(mirror, pool);
+}
+
+static inline void
+od_mirror_dispatch(od_mirror_t *mirror, machine_msg_t *msg)
+{
+	char *database, *user, *data;
+	od_mirror_request_t *request;
+	request = od_mirror_request_of(msg, &database, &user, &data);
+
+	od_mirror_pool_t *pool;
+	pool = od_mirror_pool_find(mirror, database, request->database_len,
+	                           user, request->user_len);
+
+	/* route is taken again once its rule is reloaded */
+	if (pool && (pool->client == NULL || pool->client->rule->obsolete)) {
+		if (pool->client == NULL && machine_time_ms() < pool->retry)
+			goto drop;
+		od_mirror_pool_obsolete(mirror, pool);
+		pool = NULL;
+	}
+	if (pool == NULL) {
+		pool = od_mirror_pool_create(mirror, database, request->database_len,
+		                             user, request->user_len);
+		if (pool == NULL || pool->client == NULL)
+			goto drop;
+	}
+
+	/* idle connection takes the query */
+	if (! od_list_empty(&pool->idle)) {
+		od_mirror_conn_t *conn;
+		conn = od_container_of(pool->idle.next, od_mirror_conn_t, link);
+		od_list_unlink(&conn->link);
+		od_list_init(&conn->link);
+		machine_channel_write(conn->channel, msg);
+		return;
+	}
+
+	od_rule_t *rule = pool->client->rule;
+	if (pool->count >= rule->storage_mirror_pool_size ||
+	    machine_time_ms() < pool->retry)
+		goto drop;
+
+	od_mirror_conn_t *conn;
+	conn = malloc(sizeof(od_mirror_conn_t));
+	if (conn == NULL)
+		goto drop;
+	conn->mirror   = mirror;
+	conn->pool     = pool;
+	conn->request  = msg;
+	conn->endpoint = pool->count % rule->storage_mirror->endpoints_count;
+	od_list_init(&conn->link);
+	conn->channel = machine_channel_create(0);
+	if (conn->channel == NULL) {
+		free(conn);
+		goto drop;
+	}
+	pool->count++;
+	int64_t coroutine_id;
+	coroutine_id = machine_coroutine_create(od_mirror_conn_main, conn);
+	if (coroutine_id == -1) {
+		pool->count--;
+		machine_channel_free(conn->channel);
+		free(conn);
+		goto drop;
+	}
+	return;
+
+drop:
+	if (pool) {
+		pthread_mutex_lock(&mirror->lock);
+		pool->dropped++;
+		pthread_mutex_unlock(&mirror->lock);
+	} else {
+		od_atomic_u64_inc(&mirror->dropped);
+	}
+	machine_msg_free(msg);
+}
+
+static inline void
+od_mirror_report(od_mirror_t *mirror)
+{
+	od_instance_t *instance = mirror->global->instance;
+	uint64_t dropped = od_atomic_u64_of(&mirror->dropped);
+	if (dropped == mirror->dropped_reported)
+		return;
+	od_error(&instance->logger, "mirror", NULL, NULL,
+	         "mirror queue is full, %" PRIu64 " queries dropped",
+	         dropped - mirror->dropped_reported);
+	mirror->dropped_reported = dropped;
+}
+
+static void
+od_mirror(void *arg)
+{
+	od_mirror_t *mirror = arg;
+	for (;;) {
+		machine_msg_t *msg;
+		msg = machine_channel_read(mirror->channel, 1000);
+		if (msg == NULL) {
+			od_mirror_report(mirror);
+			continue;
+		}
+		od_atomic_u64_dec(&mirror->queued);
+		od_mirror_dispatch(mirror, msg);
+	}
+}
+
+int
+od_mirror_start(od_global_t *global)
+{
+	od_instance_t *instance = global->instance;
+	od_system_t *system = global->system;
+	od_mirror_t *mirror = &system->mirror;
+	mirror->global = global;
+	if (instance->config.mirror_queue == 0)
+		return 0;
+
+	mirror->channel = machine_channel_create(1);
+	if (mirror->channel == NULL) {
+		od_error(&instance->logger, "mirror", NULL, NULL,
+		         "failed to create mirror channel");
+		return -1;
+	}
+	mirror->machine = machine_create("mirror", od_mirror, mirror);
+	if (mirror->machine == -1) {
+		od_error(&instance->logger, "mirror", NULL, NULL,
+		         "failed to start mirror machine");
+		machine_channel_free(mirror->channel);
+		mirror->channel = NULL;
+		return -1;
+	}
+	return 0;
+}
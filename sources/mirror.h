@@ -0,0 +1,82 @@
+#ifndef ODYSSEY_MIRROR_H
+#define ODYSSEY_MIRROR_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_mirror_request od_mirror_request_t;
+typedef struct od_mirror_pool    od_mirror_pool_t;
+typedef struct od_mirror         od_mirror_t;
+
+/* Read-only simple queries of rules with storage_mirror are
+ * copied by workers into messages and queued to the mirror
+ * machine. It keeps its own connections to the shadow storage
+ * per database and user, authenticated as the route user, sends
+ * the queries there and records latency of the replies, which
+ * are discarded. Workers never wait: a full queue or a busy
+ * pool drops the query. */
+
+/* how long the shadow storage may take to answer */
+#define OD_MIRROR_TIMEOUT 30000
+
+/* larger queries are not mirrored */
+#define OD_MIRROR_QUERY_MAX 8192
+
+struct od_mirror_request
+{
+	int database_len;
+	int user_len;
+	int size;
+};
+
+struct od_mirror_pool
+{
+	char            *database;
+	int              database_len;
+	char            *user;
+	int              user_len;
+	od_client_t     *client;
+	od_list_t        idle;
+	int              count;
+	int              obsolete;
+	uint64_t         retry;
+	uint64_t         sent;
+	uint64_t         dropped;
+	uint64_t         errors;
+	uint64_t         latency_sum;
+	struct od_hgram *latency;
+	od_list_t        link;
+};
+
+struct od_mirror
+{
+	int64_t            machine;
+	machine_channel_t *channel;
+	od_atomic_u64_t    queued;
+	od_atomic_u64_t    dropped;
+	uint64_t           dropped_reported;
+	pthread_mutex_t    lock;
+	od_list_t          pools;
+	od_global_t       *global;
+};
+
+static inline void
+od_mirror_init(od_mirror_t *mirror)
+{
+	mirror->machine          = -1;
+	mirror->channel          = NULL;
+	mirror->queued           = 0;
+	mirror->dropped          = 0;
+	mirror->dropped_reported = 0;
+	pthread_mutex_init(&mirror->lock, NULL);
+	od_list_init(&mirror->pools);
+	mirror->global           = NULL;
+}
+
+int  od_mirror_start(od_global_t*);
+void od_mirror_query(od_client_t*, char*, int);
+
+#endif /* ODYSSEY_MIRROR_H */
@@ -10,7 +10,25 @@
 typedef enum
 {
 	OD_MSG_STAT,
-	OD_MSG_CLIENT_NEW
+	OD_MSG_CLIENT_NEW,
+	OD_MSG_CLIENT_MIGRATE,
+	OD_MSG_CLIENT_RELAY,
+	OD_MSG_CLIENT_MOVE,
+	OD_MSG_SERVER_NEW,
+	OD_MSG_SERVER_CLOSE,
+	OD_MSG_SERVER_CONNECT,
+	OD_MSG_SERVER_CHECK,
+	OD_MSG_PIPELINE_REQUEST,
+	OD_MSG_PIPELINE_REPLY,
+	OD_MSG_PIPELINE_DONE,
+	OD_MSG_PIPELINE_ERROR,
+	OD_MSG_LISTEN_CHANGE,
+	OD_MSG_LISTEN_NOTIFY,
+	OD_MSG_LISTEN_ACK,
+	OD_MSG_LISTEN_ERROR,
+	OD_MSG_WALRELAY_CHANGE,
+	OD_MSG_MUX_CONNECT,
+	OD_MSG_MUX_ACCEPT
 } od_msg_t;
 
 #endif /* ODYSSEY_MSG_H */
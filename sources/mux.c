@@ -0,0 +1,967 @@
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+typedef struct
+{
+	od_mux_t          *mux;
+	od_rule_storage_t *storage;
+	int                endpoint;
+	uint32_t           timeout;
+	machine_channel_t *reply;
+	machine_io_t      *io;
+	uint32_t           id;
+	int                rc;
+} od_mux_request_t;
+
+typedef struct
+{
+	od_mux_t           *mux;
+	od_config_listen_t *config;
+	machine_tls_t      *tls;
+	machine_io_t       *io;
+} od_mux_accept_t;
+
+static inline void
+od_mux_link_shutdown(od_mux_link_t *link)
+{
+	/* wake up the link reader, which closes the link */
+	shutdown(machine_fd(link->io), SHUT_RDWR);
+}
+
+static inline int
+od_mux_frame(od_mux_link_t *link, int type, uint32_t id, uint32_t len,
+             char *data, int size)
+{
+	if (link->failed)
+		return -1;
+	machine_msg_t *msg;
+	msg = machine_msg_create(OD_MUX_HEADER + size);
+	if (msg == NULL)
+		return -1;
+	char *pos = machine_msg_data(msg);
+	pos[0] = type;
+	id  = htonl(id);
+	len = htonl(len);
+	memcpy(pos + 1, &id, sizeof(id));
+	memcpy(pos + 5, &len, sizeof(len));
+	if (size > 0)
+		memcpy(pos + OD_MUX_HEADER, data, size);
+	machine_channel_write(link->out, msg);
+	return 0;
+}
+
+static inline od_mux_stream_t*
+od_mux_stream_find(od_mux_link_t *link, uint32_t id)
+{
+	od_list_t *i;
+	od_list_foreach(&link->streams[id % OD_MUX_BUCKETS], i) {
+		od_mux_stream_t *stream;
+		stream = od_container_of(i, od_mux_stream_t, link_bucket);
+		if (stream->id == id)
+			return stream;
+	}
+	return NULL;
+}
+
+static inline void
+od_mux_stream_push(od_mux_stream_t *stream, int type)
+{
+	machine_msg_t *msg;
+	msg = machine_msg_create(0);
+	if (msg == NULL)
+		return;
+	machine_msg_set_type(msg, type);
+	machine_channel_write(stream->in, msg);
+}
+
+static void
+od_mux_stream_reader(void *arg)
+{
+	od_mux_stream_t *stream = arg;
+	od_mux_link_t *link = stream->link;
+
+	/* forward data written to the local socket to the link,
+	 * no more than the window allowed by the peer */
+	machine_read_start(stream->io, stream->cond);
+	for (;;)
+	{
+		if (link->failed)
+			break;
+		if (stream->window <= 0) {
+			machine_cond_wait(stream->cond, UINT32_MAX);
+			if (machine_cancelled())
+				break;
+			continue;
+		}
+		int size = OD_MUX_CHUNK;
+		if (stream->window < size)
+			size = stream->window;
+		machine_msg_t *msg;
+		msg = machine_msg_create(OD_MUX_HEADER);
+		if (msg == NULL)
+			break;
+		char *data = machine_msg_reserve(msg, size);
+		if (data == NULL) {
+			machine_msg_free(msg);
+			break;
+		}
+		int rc;
+		rc = machine_read_raw(stream->io, data, size);
+		if (rc > 0) {
+			machine_msg_write(msg, NULL, rc);
+			char *pos = machine_msg_data(msg);
+			uint32_t id  = htonl(stream->id);
+			uint32_t len = htonl(rc);
+			pos[0] = OD_MUX_DATA;
+			memcpy(pos + 1, &id, sizeof(id));
+			memcpy(pos + 5, &len, sizeof(len));
+			stream->window -= rc;
+			machine_channel_write(link->out, msg);
+			continue;
+		}
+		machine_msg_free(msg);
+		if (rc == -1 && machine_errno() == EAGAIN) {
+			machine_cond_wait(stream->cond, UINT32_MAX);
+			if (machine_cancelled())
+				break;
+			continue;
+		}
+		/* local end is closed */
+		if (! stream->close_sent) {
+			stream->close_sent = 1;
+			od_mux_frame(link, OD_MUX_CLOSE, stream->id, 0, NULL, 0);
+		}
+		od_mux_stream_push(stream, OD_MUX_CLOSE);
+		break;
+	}
+	machine_read_stop(stream->io);
+}
+
+static void
+od_mux_stream_main(void *arg)
+{
+	od_mux_stream_t *stream = arg;
+	od_mux_link_t *link = stream->link;
+
+	stream->reader_id = machine_coroutine_create(od_mux_stream_reader, stream);
+
+	/* write data received from the link to the local socket and
+	 * return the window to the peer as it is consumed */
+	if (stream->reader_id != -1) {
+		for (;;)
+		{
+			machine_msg_t *msg;
+			msg = machine_channel_read(stream->in, UINT32_MAX);
+			if (msg == NULL)
+				break;
+			if (machine_msg_type(msg) == OD_MUX_CLOSE) {
+				machine_msg_free(msg);
+				break;
+			}
+			int size = machine_msg_size(msg);
+			int rc;
+			rc = machine_write(stream->io, msg, UINT32_MAX);
+			if (rc == -1)
+				break;
+			stream->consumed += size;
+			if (stream->consumed >= OD_MUX_WINDOW_SIZE / 4) {
+				od_mux_frame(link, OD_MUX_WINDOW, stream->id,
+				             stream->consumed, NULL, 0);
+				stream->consumed = 0;
+			}
+		}
+		machine_cancel(stream->reader_id);
+		machine_join(stream->reader_id);
+	}
+	if (! stream->close_sent)
+		od_mux_frame(link, OD_MUX_CLOSE, stream->id, 0, NULL, 0);
+
+	od_list_unlink(&stream->link_bucket);
+	link->streams_count--;
+	if (link->failed)
+		machine_cond_signal(link->cond);
+	else
+	if (link->obsolete && link->streams_count == 0)
+		od_mux_link_shutdown(link);
+
+	machine_close(stream->io);
+	machine_io_free(stream->io);
+	machine_channel_free(stream->in);
+	machine_cond_free(stream->cond);
+	free(stream);
+}
+
+static inline od_mux_stream_t*
+od_mux_stream_create(od_mux_link_t *link, uint32_t id, machine_io_t **remote)
+{
+	od_mux_stream_t *stream;
+	stream = malloc(sizeof(od_mux_stream_t));
+	if (stream == NULL)
+		return NULL;
+	stream->id         = id;
+	stream->link       = link;
+	stream->window     = OD_MUX_WINDOW_SIZE;
+	stream->consumed   = 0;
+	stream->close_sent = 0;
+	stream->reader_id  = -1;
+	od_list_init(&stream->link_bucket);
+	stream->in   = machine_channel_create(0);
+	stream->cond = machine_cond_create();
+	int rc = -1;
+	if (stream->in && stream->cond)
+		rc = machine_socketpair(&stream->io, remote);
+	if (rc == -1)
+		goto error;
+	rc = machine_io_attach(stream->io);
+	if (rc == -1) {
+		machine_close(*remote);
+		machine_io_free(*remote);
+		machine_close(stream->io);
+		machine_io_free(stream->io);
+		goto error;
+	}
+	od_list_append(&link->streams[id % OD_MUX_BUCKETS], &stream->link_bucket);
+	link->streams_count++;
+
+	int64_t coroutine_id;
+	coroutine_id = machine_coroutine_create(od_mux_stream_main, stream);
+	if (coroutine_id == -1) {
+		od_list_unlink(&stream->link_bucket);
+		link->streams_count--;
+		machine_close(*remote);
+		machine_io_free(*remote);
+		machine_close(stream->io);
+		machine_io_free(stream->io);
+		goto error;
+	}
+	return stream;
+error:
+	if (stream->in)
+		machine_channel_free(stream->in);
+	if (stream->cond)
+		machine_cond_free(stream->cond);
+	free(stream);
+	return NULL;
+}
+
+static inline void
+od_mux_stream_accept(od_mux_link_t *link, uint32_t id)
+{
+	od_global_t *global = link->mux->global;
+	od_instance_t *instance = global->instance;
+	od_router_t *router = global->router;
+	od_worker_pool_t *worker_pool = global->worker_pool;
+
+	if (od_mux_stream_find(link, id)) {
+		od_error(&instance->logger, "mux", NULL, NULL,
+		         "stream %" PRIu32 " is already open", id);
+		od_mux_link_shutdown(link);
+		return;
+	}
+	machine_io_t *io;
+	od_mux_stream_t *stream;
+	stream = od_mux_stream_create(link, id, &io);
+	if (stream == NULL) {
+		od_error(&instance->logger, "mux", NULL, NULL,
+		         "failed to create stream %" PRIu32, id);
+		od_mux_frame(link, OD_MUX_CLOSE, id, 0, NULL, 0);
+		return;
+	}
+
+	/* remote end is a new client of the listen */
+	od_client_t *client;
+	client = od_system_client(global, link->config, NULL, io);
+	if (client == NULL)
+		return;
+	client->mux = 1;
+	od_atomic_u32_inc(&router->clients_routing);
+	od_worker_pool_feed(worker_pool,
+	                    od_worker_pool_group(worker_pool, link->config->worker_group),
+	                    &client, 1);
+}
+
+static void
+od_mux_link_writer(void *arg)
+{
+	od_mux_link_t *link = arg;
+	for (;;)
+	{
+		machine_msg_t *msg;
+		msg = machine_channel_read(link->out, UINT32_MAX);
+		if (msg == NULL)
+			break;
+
+		/* coalesce pending frames into one write */
+		while (machine_msg_size(msg) < OD_MUX_CHUNK * 4) {
+			machine_msg_t *next;
+			next = machine_channel_read(link->out, 0);
+			if (next == NULL)
+				break;
+			int rc;
+			rc = machine_msg_write(msg, machine_msg_data(next),
+			                       machine_msg_size(next));
+			machine_msg_free(next);
+			if (rc == -1)
+				break;
+		}
+		int rc;
+		rc = machine_write(link->io, msg, UINT32_MAX);
+		if (rc == -1) {
+			link->failed = 1;
+			od_mux_link_shutdown(link);
+			break;
+		}
+	}
+}
+
+static inline char*
+od_mux_link_name(od_mux_link_t *link, char *name, int size)
+{
+	if (link->accepted) {
+		od_getpeername(link->io, name, size, 1, 1);
+		return name;
+	}
+	od_rule_storage_t *storage = link->storage;
+	if (link->endpoint >= 0)
+		od_snprintf(name, size, "%s:%d",
+		            storage->endpoints[link->endpoint].host,
+		            storage->endpoints[link->endpoint].port);
+	else
+		od_snprintf(name, size, "%s:%d",
+		            storage->host ? storage->host : "unix_socket",
+		            storage->port);
+	return name;
+}
+
+static void
+od_mux_link_main(void *arg)
+{
+	od_mux_link_t *link = arg;
+	od_instance_t *instance = link->mux->global->instance;
+
+	char name[128];
+	od_mux_link_name(link, name, sizeof(name));
+	od_log(&instance->logger, "mux", NULL, NULL,
+	       "link %s is ready", name);
+
+	for (;;)
+	{
+		machine_msg_t *msg;
+		msg = machine_read(link->io, OD_MUX_HEADER, UINT32_MAX);
+		if (msg == NULL)
+			break;
+		char *pos = machine_msg_data(msg);
+		int type = pos[0];
+		uint32_t id;
+		uint32_t len;
+		memcpy(&id, pos + 1, sizeof(id));
+		memcpy(&len, pos + 5, sizeof(len));
+		id  = ntohl(id);
+		len = ntohl(len);
+		machine_msg_free(msg);
+
+		od_mux_stream_t *stream;
+		int error = 0;
+		switch (type) {
+		case OD_MUX_DATA:
+			if (len == 0 || len > OD_MUX_CHUNK) {
+				error = 1;
+				break;
+			}
+			msg = machine_read(link->io, len, UINT32_MAX);
+			if (msg == NULL) {
+				error = 1;
+				break;
+			}
+			/* data of a stream closed locally is dropped */
+			stream = od_mux_stream_find(link, id);
+			if (stream == NULL) {
+				machine_msg_free(msg);
+				break;
+			}
+			machine_msg_set_type(msg, OD_MUX_DATA);
+			machine_channel_write(stream->in, msg);
+			break;
+		case OD_MUX_WINDOW:
+			stream = od_mux_stream_find(link, id);
+			if (stream) {
+				stream->window += len;
+				machine_cond_signal(stream->cond);
+			}
+			break;
+		case OD_MUX_OPEN:
+			if (! link->accepted) {
+				error = 1;
+				break;
+			}
+			od_mux_stream_accept(link, id);
+			break;
+		case OD_MUX_CLOSE:
+			stream = od_mux_stream_find(link, id);
+			if (stream) {
+				stream->close_sent = 1;
+				od_mux_stream_push(stream, OD_MUX_CLOSE);
+			}
+			break;
+		default:
+			error = 1;
+			break;
+		}
+		if (error) {
+			od_error(&instance->logger, "mux", NULL, NULL,
+			         "link %s: protocol error", name);
+			break;
+		}
+	}
+
+	/* no new streams are opened on the link, close the existing ones
+	 * and wait for them */
+	link->failed = 1;
+	od_list_unlink(&link->link);
+	machine_cancel(link->writer_id);
+	machine_join(link->writer_id);
+	od_log(&instance->logger, "mux", NULL, NULL,
+	       "link %s is closed (%d streams)", name, link->streams_count);
+
+	int i;
+	for (i = 0; i < OD_MUX_BUCKETS; i++) {
+		od_list_t *j;
+		od_list_foreach(&link->streams[i], j) {
+			od_mux_stream_t *stream;
+			stream = od_container_of(j, od_mux_stream_t, link_bucket);
+			stream->close_sent = 1;
+			od_mux_stream_push(stream, OD_MUX_CLOSE);
+			machine_cond_signal(stream->cond);
+		}
+	}
+	while (link->streams_count > 0)
+		machine_cond_wait(link->cond, UINT32_MAX);
+
+	machine_close(link->io);
+	machine_io_free(link->io);
+	machine_channel_free(link->out);
+	machine_cond_free(link->cond);
+	if (link->storage)
+		od_rules_storage_free(link->storage);
+	free(link);
+}
+
+static inline od_mux_link_t*
+od_mux_link_allocate(od_mux_t *mux)
+{
+	od_mux_link_t *link;
+	link = malloc(sizeof(od_mux_link_t));
+	if (link == NULL)
+		return NULL;
+	memset(link, 0, sizeof(od_mux_link_t));
+	link->mux      = mux;
+	link->endpoint = -1;
+	link->next_id  = 1;
+	link->writer_id = -1;
+	int i;
+	for (i = 0; i < OD_MUX_BUCKETS; i++)
+		od_list_init(&link->streams[i]);
+	od_list_init(&link->link);
+	link->out  = machine_channel_create(0);
+	link->cond = machine_cond_create();
+	if (link->out == NULL || link->cond == NULL) {
+		if (link->out)
+			machine_channel_free(link->out);
+		if (link->cond)
+			machine_cond_free(link->cond);
+		free(link);
+		return NULL;
+	}
+	return link;
+}
+
+static inline void
+od_mux_link_free(od_mux_link_t *link)
+{
+	od_list_unlink(&link->link);
+	if (link->io) {
+		machine_close(link->io);
+		machine_io_free(link->io);
+	}
+	machine_channel_free(link->out);
+	machine_cond_free(link->cond);
+	if (link->storage)
+		od_rules_storage_free(link->storage);
+	free(link);
+}
+
+static inline int
+od_mux_link_start(od_mux_link_t *link)
+{
+	link->writer_id = machine_coroutine_create(od_mux_link_writer, link);
+	if (link->writer_id == -1)
+		return -1;
+	int64_t coroutine_id;
+	coroutine_id = machine_coroutine_create(od_mux_link_main, link);
+	if (coroutine_id == -1) {
+		machine_cancel(link->writer_id);
+		machine_join(link->writer_id);
+		return -1;
+	}
+	link->ready = 1;
+	return 0;
+}
+
+static inline int
+od_mux_link_connect(od_mux_link_t *link, uint32_t timeout)
+{
+	od_global_t *global = link->mux->global;
+	od_instance_t *instance = global->instance;
+
+	/* connect and do tls handshake as with any other server */
+	od_server_t server;
+	od_server_init(&server);
+	server.global   = global;
+	server.endpoint = link->endpoint;
+	int rc;
+	rc = od_backend_connect_socket(&server, "mux", link->storage, timeout);
+	if (rc == 0) {
+		link->io = server.io.io;
+		server.io.io = NULL;
+	}
+	od_backend_close_connection(&server);
+	od_backend_close(&server);
+	if (rc == -1)
+		return -1;
+
+	machine_msg_t *msg;
+	msg = machine_msg_create(sizeof(uint32_t) * 2);
+	if (msg == NULL)
+		return -1;
+	uint32_t *request = machine_msg_data(msg);
+	request[0] = htonl(sizeof(uint32_t) * 2);
+	request[1] = htonl(OD_MUX_PROTOCOL);
+	rc = machine_write(link->io, msg, timeout);
+	if (rc == -1) {
+		od_error(&instance->logger, "mux", NULL, NULL,
+		         "write error: %s", machine_error(link->io));
+		return -1;
+	}
+	if (link->storage->compression) {
+		rc = machine_set_compression(link->io, OD_IO_COMPRESSION_LEVEL);
+		if (rc == -1) {
+			od_error(&instance->logger, "mux", NULL, NULL,
+			         "failed to enable compression: %s",
+			         machine_error(link->io));
+			return -1;
+		}
+	}
+	return od_mux_link_start(link);
+}
+
+static inline od_mux_link_t*
+od_mux_link_get(od_mux_t *mux, od_mux_request_t *request)
+{
+	od_rule_storage_t *storage = request->storage;
+	uint64_t time_start = machine_time_ms();
+	for (;;)
+	{
+		/* pick the link with least streams, open one more while
+		 * all existing are in use */
+		od_mux_link_t *best = NULL;
+		int count = 0;
+		od_list_t *i;
+		od_list_foreach(&mux->links, i) {
+			od_mux_link_t *link;
+			link = od_container_of(i, od_mux_link_t, link);
+			if (link->accepted || link->failed || link->obsolete)
+				continue;
+			if (link->endpoint != request->endpoint ||
+			    strcmp(link->storage->name, storage->name) != 0)
+				continue;
+			if (! od_rules_storage_compare(link->storage, storage)) {
+				/* storage is reconfigured */
+				link->obsolete = 1;
+				if (link->ready && link->streams_count == 0)
+					od_mux_link_shutdown(link);
+				continue;
+			}
+			count++;
+			if (! link->ready)
+				continue;
+			if (best == NULL || link->streams_count < best->streams_count)
+				best = link;
+		}
+		if (count < storage->mux_links &&
+		    (best == NULL || best->streams_count > 0))
+			break;
+		if (best)
+			return best;
+
+		/* all links are being connected */
+		if (machine_time_ms() - time_start >= request->timeout)
+			return NULL;
+		machine_sleep(1);
+	}
+
+	od_mux_link_t *link;
+	link = od_mux_link_allocate(mux);
+	if (link == NULL)
+		return NULL;
+	link->storage  = storage;
+	link->endpoint = request->endpoint;
+	request->storage = NULL;
+	od_list_append(&mux->links, &link->link);
+	int rc;
+	rc = od_mux_link_connect(link, request->timeout);
+	if (rc == -1) {
+		od_mux_link_free(link);
+		return NULL;
+	}
+	return link;
+}
+
+static void
+od_mux_open(void *arg)
+{
+	machine_msg_t *msg = arg;
+	od_mux_request_t *request = machine_msg_data(msg);
+	od_mux_t *mux = request->mux;
+
+	od_mux_link_t *link;
+	link = od_mux_link_get(mux, request);
+	if (link) {
+		uint32_t id = link->next_id++;
+		od_mux_stream_t *stream;
+		stream = od_mux_stream_create(link, id, &request->io);
+		if (stream) {
+			od_mux_frame(link, OD_MUX_OPEN, id, 0, NULL, 0);
+			request->id = id;
+			request->rc = 0;
+		}
+	}
+	machine_channel_write(request->reply, msg);
+}
+
+static inline int
+od_mux_link_handshake(od_mux_link_t *link, uint32_t timeout)
+{
+	od_instance_t *instance = link->mux->global->instance;
+	od_config_listen_t *config = link->config;
+	int is_tls = 0;
+	for (;;)
+	{
+		machine_msg_t *msg;
+		msg = machine_read(link->io, sizeof(uint32_t) * 2, timeout);
+		if (msg == NULL)
+			return -1;
+		uint32_t *request = machine_msg_data(msg);
+		uint32_t len  = ntohl(request[0]);
+		uint32_t code = ntohl(request[1]);
+		machine_msg_free(msg);
+		if (len != sizeof(uint32_t) * 2)
+			return -1;
+		if (code == OD_MUX_PROTOCOL)
+			break;
+		/* SSLRequest */
+		if (code != 80877103 || is_tls)
+			return -1;
+		int supported = link->tls && config->tls_mode != OD_CONFIG_TLS_DISABLE;
+		msg = machine_msg_create(sizeof(uint8_t));
+		if (msg == NULL)
+			return -1;
+		uint8_t *type = machine_msg_data(msg);
+		*type = supported ? 'S' : 'N';
+		int rc;
+		rc = machine_write(link->io, msg, timeout);
+		if (rc == -1)
+			return -1;
+		if (supported) {
+			rc = machine_set_tls(link->io, link->tls, timeout);
+			if (rc == -1) {
+				od_error(&instance->logger, "mux", NULL, NULL,
+				         "tls error: %s", machine_error(link->io));
+				return -1;
+			}
+			is_tls = 1;
+		}
+	}
+	switch (config->tls_mode) {
+	case OD_CONFIG_TLS_DISABLE:
+	case OD_CONFIG_TLS_ALLOW:
+		break;
+	default:
+		if (! is_tls) {
+			od_error(&instance->logger, "mux", NULL, NULL,
+			         "tls is required, closing link");
+			return -1;
+		}
+		break;
+	}
+	if (config->compression) {
+		int rc;
+		rc = machine_set_compression(link->io, OD_IO_COMPRESSION_LEVEL);
+		if (rc == -1)
+			return -1;
+	}
+	return 0;
+}
+
+static void
+od_mux_link_accept(void *arg)
+{
+	machine_msg_t *msg = arg;
+	od_mux_accept_t *accept = machine_msg_data(msg);
+	od_mux_t *mux = accept->mux;
+	od_instance_t *instance = mux->global->instance;
+
+	od_mux_link_t *link;
+	link = od_mux_link_allocate(mux);
+	if (link == NULL) {
+		machine_close(accept->io);
+		machine_io_free(accept->io);
+		machine_msg_free(msg);
+		return;
+	}
+	link->accepted = 1;
+	link->config   = accept->config;
+	link->tls      = accept->tls;
+	link->io       = accept->io;
+	machine_msg_free(msg);
+
+	int rc;
+	rc = machine_io_attach(link->io);
+	if (rc == 0)
+		rc = od_mux_link_handshake(link, link->config->client_login_timeout);
+	if (rc == 0) {
+		od_list_append(&mux->links, &link->link);
+		rc = od_mux_link_start(link);
+	}
+	if (rc == -1) {
+		char peer[128];
+		od_getpeername(link->io, peer, sizeof(peer), 1, 1);
+		od_error(&instance->logger, "mux", NULL, NULL,
+		         "failed to accept link from %s", peer);
+		od_mux_link_free(link);
+	}
+}
+
+static void
+od_mux(void *arg)
+{
+	od_mux_t *mux = arg;
+	od_instance_t *instance = mux->global->instance;
+	for (;;)
+	{
+		machine_msg_t *msg;
+		msg = machine_channel_read(mux->channel, UINT32_MAX);
+		if (msg == NULL)
+			break;
+		int64_t coroutine_id;
+		switch (machine_msg_type(msg)) {
+		case OD_MSG_MUX_CONNECT:
+			coroutine_id = machine_coroutine_create(od_mux_open, msg);
+			if (coroutine_id == -1) {
+				od_mux_request_t *request = machine_msg_data(msg);
+				machine_channel_write(request->reply, msg);
+			}
+			break;
+		case OD_MSG_MUX_ACCEPT:
+			coroutine_id = machine_coroutine_create(od_mux_link_accept, msg);
+			if (coroutine_id == -1) {
+				od_mux_accept_t *accept = machine_msg_data(msg);
+				machine_close(accept->io);
+				machine_io_free(accept->io);
+				machine_msg_free(msg);
+			}
+			break;
+		default:
+			assert(0);
+			break;
+		}
+		if (coroutine_id == -1)
+			od_error(&instance->logger, "mux", NULL, NULL,
+			         "failed to start coroutine");
+	}
+}
+
+static inline int
+od_mux_is_used(od_global_t *global)
+{
+	od_instance_t *instance = global->instance;
+	od_router_t *router = global->router;
+	od_list_t *i;
+	od_list_foreach(&instance->config.listen, i) {
+		od_config_listen_t *listen;
+		listen = od_container_of(i, od_config_listen_t, link);
+		if (listen->mux)
+			return 1;
+	}
+	int used = 0;
+	od_router_lock_read(router, OD_LOCK_OTHER);
+	od_list_foreach(&router->rules.rules, i) {
+		od_rule_t *rule;
+		rule = od_container_of(i, od_rule_t, link);
+		if (rule->obsolete)
+			continue;
+		if (rule->storage->storage_type == OD_RULE_STORAGE_MUX) {
+			used = 1;
+			break;
+		}
+	}
+	od_router_unlock(router);
+	return used;
+}
+
+int
+od_mux_start(od_global_t *global)
+{
+	od_instance_t *instance = global->instance;
+	od_system_t *system = global->system;
+	od_mux_t *mux = &system->mux;
+	if (mux->channel || ! od_mux_is_used(global))
+		return 0;
+	mux->global  = global;
+	mux->channel = machine_channel_create(1);
+	if (mux->channel == NULL) {
+		od_error(&instance->logger, "mux", NULL, NULL,
+		         "failed to create mux channel");
+		return -1;
+	}
+	mux->machine = machine_create("mux", od_mux, mux);
+	if (mux->machine == -1) {
+		od_error(&instance->logger, "mux", NULL, NULL,
+		         "failed to start mux machine");
+		machine_channel_free(mux->channel);
+		mux->channel = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+int
+od_mux_connect(od_server_t *server, char *context,
+               od_rule_storage_t *storage, uint32_t timeout)
+{
+	od_instance_t *instance = server->global->instance;
+	od_system_t *system = server->global->system;
+	od_mux_t *mux = &system->mux;
+	assert(server->io.io == NULL);
+
+	if (mux->channel == NULL) {
+		od_error(&instance->logger, context, server->client, server,
+		         "mux machine is not started");
+		return -1;
+	}
+	if (storage->endpoints_count > 0 && server->endpoint == -1) {
+		od_error(&instance->logger, context, server->client, server,
+		         "no storage host available for '%s'",
+		         storage->target_session_attrs ?
+		         storage->target_session_attrs : "any");
+		return -1;
+	}
+
+	/* ask the mux machine for a new stream, storage is copied since
+	 * links outlive the route */
+	machine_channel_t *reply;
+	reply = machine_channel_create(1);
+	if (reply == NULL)
+		return -1;
+	machine_msg_t *msg;
+	msg = machine_msg_create(sizeof(od_mux_request_t));
+	if (msg == NULL) {
+		machine_channel_free(reply);
+		return -1;
+	}
+	machine_msg_set_type(msg, OD_MSG_MUX_CONNECT);
+	od_mux_request_t *request = machine_msg_data(msg);
+	request->mux      = mux;
+	request->storage  = od_rules_storage_copy(storage);
+	request->endpoint = server->endpoint;
+	request->timeout  = timeout;
+	request->reply    = reply;
+	request->io       = NULL;
+	request->id       = 0;
+	request->rc       = -1;
+	if (request->storage == NULL) {
+		machine_msg_free(msg);
+		machine_channel_free(reply);
+		return -1;
+	}
+	machine_channel_write(mux->channel, msg);
+
+	/* mux machine always replies, connect is bound by the timeout */
+	msg = machine_channel_read(reply, UINT32_MAX);
+	machine_channel_free(reply);
+	request = machine_msg_data(msg);
+	if (request->storage)
+		od_rules_storage_free(request->storage);
+	int rc = request->rc;
+	machine_io_t *io = request->io;
+	uint32_t id = request->id;
+	machine_msg_free(msg);
+	if (rc == -1) {
+		od_error(&instance->logger, context, server->client, server,
+		         "failed to open mux stream to storage '%s'",
+		         storage->name);
+		return -1;
+	}
+
+	rc = od_io_prepare(&server->io, io, instance->config.readahead,
+	                   instance->config.readahead_ring);
+	if (rc == 0)
+		rc = machine_io_attach(io);
+	if (rc == -1) {
+		od_error(&instance->logger, context, NULL, server,
+		         "failed to set server io");
+		machine_close(io);
+		machine_io_free(io);
+		server->io.io = NULL;
+		return -1;
+	}
+	if (instance->config.log_session)
+		od_log(&instance->logger, context, server->client, server,
+		       "new server connection, mux stream %" PRIu32 " to storage '%s'",
+		       id, storage->name);
+	return 0;
+}
+
+int
+od_mux_accept(od_global_t *global, od_config_listen_t *config,
+              machine_tls_t *tls, machine_io_t *io)
+{
+	od_system_t *system = global->system;
+	od_mux_t *mux = &system->mux;
+	machine_msg_t *msg = NULL;
+	if (mux->channel)
+		msg = machine_msg_create(sizeof(od_mux_accept_t));
+	if (msg == NULL) {
+		machine_close(io);
+		machine_io_free(io);
+		return -1;
+	}
+	machine_msg_set_type(msg, OD_MSG_MUX_ACCEPT);
+	od_mux_accept_t *accept = machine_msg_data(msg);
+	accept->mux    = mux;
+	accept->config = config;
+	accept->tls    = tls;
+	accept->io     = io;
+	machine_channel_write(mux->channel, msg);
+	return 0;
+}
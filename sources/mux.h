@@ -0,0 +1,107 @@
+#ifndef ODYSSEY_MUX_H
+#define ODYSSEY_MUX_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_mux_stream od_mux_stream_t;
+typedef struct od_mux_link   od_mux_link_t;
+typedef struct od_mux        od_mux_t;
+
+/*
+ * Multiplexed links between odyssey instances.
+ *
+ * Server connections to a "mux" storage are logical streams carried by
+ * a few persistent links to the remote odyssey, which listens with
+ * "mux yes". Each stream is a local socket pair: one end is used by the
+ * server (or by the client on the accepting side) as any other socket,
+ * the other end is pumped to the link by the mux machine.
+ *
+ * Link starts with OD_MUX_PROTOCOL request, optionally preceded by
+ * SSLRequest. Then each frame is:
+ *
+ * type (1 byte), stream id (4 bytes), length (4 bytes), data
+ *
+ * Streams flow control is credit based: a peer sends no more than
+ * OD_MUX_WINDOW bytes of a stream until the receiver acknowledges
+ * them with a window frame.
+*/
+
+/* link request code, follows SSLRequest and CancelRequest codes */
+#define OD_MUX_PROTOCOL 80877110
+
+#define OD_MUX_OPEN   'O'
+#define OD_MUX_DATA   'D'
+#define OD_MUX_WINDOW 'W'
+#define OD_MUX_CLOSE  'C'
+
+#define OD_MUX_HEADER 9
+
+/* max data frame size and stream window in bytes */
+#define OD_MUX_CHUNK       16384
+#define OD_MUX_WINDOW_SIZE 262144
+
+/* number of stream hash buckets of a link */
+#define OD_MUX_BUCKETS 256
+
+struct od_mux_stream
+{
+	uint32_t        id;
+	od_mux_link_t  *link;
+	machine_io_t   *io;
+	machine_channel_t *in;
+	machine_cond_t *cond;
+	int64_t         window;
+	int64_t         consumed;
+	int             close_sent;
+	int64_t         reader_id;
+	od_list_t       link_bucket;
+};
+
+struct od_mux_link
+{
+	od_mux_t           *mux;
+	int                 accepted;
+	od_rule_storage_t  *storage;
+	int                 endpoint;
+	od_config_listen_t *config;
+	machine_tls_t      *tls;
+	machine_io_t       *io;
+	machine_channel_t  *out;
+	machine_cond_t     *cond;
+	int                 ready;
+	int                 failed;
+	int                 obsolete;
+	uint32_t            next_id;
+	int                 streams_count;
+	od_list_t           streams[OD_MUX_BUCKETS];
+	int64_t             writer_id;
+	od_list_t           link;
+};
+
+struct od_mux
+{
+	int64_t            machine;
+	machine_channel_t *channel;
+	od_list_t          links;
+	od_global_t       *global;
+};
+
+static inline void
+od_mux_init(od_mux_t *mux)
+{
+	mux->machine = -1;
+	mux->channel = NULL;
+	mux->global  = NULL;
+	od_list_init(&mux->links);
+}
+
+int od_mux_start(od_global_t*);
+int od_mux_connect(od_server_t*, char*, od_rule_storage_t*, uint32_t);
+int od_mux_accept(od_global_t*, od_config_listen_t*, machine_tls_t*,
+                  machine_io_t*);
+
+#endif /* ODYSSEY_MUX_H */
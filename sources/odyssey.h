@@ -9,56 +9,85 @@
 
 #include "sources/macro.h"
 #include "sources/build.h"
+#include "sources/trace.h"
 #include "sources/atomic.h"
 #include "sources/util.h"
 #include "sources/error.h"
 #include "sources/list.h"
+#include "sources/arena.h"
 #include "sources/pid.h"
 #include "sources/daemon.h"
 #include "sources/id.h"
+#include "sources/logbin.h"
+#include "sources/capture.h"
 #include "sources/logger.h"
 #include "sources/parser.h"
 
 #include "sources/config.h"
+#include "sources/auth_cache.h"
+#include "sources/query_cache.h"
+#include "sources/breaker.h"
 #include "sources/rules.h"
 #include "sources/config_reader.h"
 
 #include "sources/msg.h"
 #include "sources/global.h"
 #include "sources/stat.h"
+#include "sources/fingerprint.h"
+#include "sources/top.h"
 #include "sources/status.h"
+#include "sources/cache.h"
 #include "sources/readahead.h"
 #include "sources/io.h"
+#include "sources/spool.h"
 #include "sources/relay.h"
 #include "sources/dns.h"
 #include "sources/postgres.h"
 #include "sources/scram.h"
+#include "sources/prepared.h"
 #include "sources/server.h"
+#include "sources/server_cap.h"
 #include "sources/server_pool.h"
 #include "sources/client.h"
 #include "sources/client_pool.h"
 
+#include "sources/listen.h"
+#include "sources/walrelay.h"
+#include "sources/lockstat.h"
 #include "sources/route_id.h"
 #include "sources/route.h"
 #include "sources/route_pool.h"
 #include "sources/router_cancel.h"
+#include "sources/client_index.h"
 #include "sources/router.h"
 
 #include "sources/instance.h"
+#include "sources/stats_shm.h"
 #include "sources/cron.h"
+#include "sources/health.h"
+#include "sources/restart.h"
+#include "sources/cancel.h"
+#include "sources/mux.h"
+#include "sources/span.h"
+#include "sources/mirror.h"
+#include "sources/fleet.h"
+#include "sources/backlog.h"
 #include "sources/system.h"
+#include "sources/metrics.h"
 #include "sources/worker.h"
 #include "sources/worker_pool.h"
 #include "sources/tls.h"
 #include "sources/auth_query.h"
 #include "sources/auth.h"
-#include "sources/cancel.h"
 #include "sources/console.h"
 #include "sources/reset.h"
 #include "sources/pam.h"
 #include "sources/deploy.h"
+#include "sources/pipeline.h"
 #include "sources/frontend.h"
 #include "sources/backend.h"
+#include "sources/stall.h"
+#include "sources/embed.h"
 
 #include "sources/hgram.h"
 
@@ -16,8 +16,33 @@
 
 #include <security/pam_appl.h>
 
+#include <machinarium.h>
 #include <kiwi.h>
 #include <odyssey.h>
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+
+typedef struct od_pam_request od_pam_request_t;
+
+/* PAM modules may block for a long time (LDAP, RADIUS and such),
+ * so conversations are run by dedicated machines. Request is
+ * referenced by the client which waits for the reply and by
+ * the machine which processes it. */
+struct od_pam_request
+{
+	char              *service;
+	char              *user;
+	char              *password;
+	int                rc;
+	machine_channel_t *reply;
+	od_atomic_u32_t    refs;
+};
+
+static struct
+{
+	machine_channel_t *channel;
+	uint8_t            salt[16];
+} od_pam_pool;
 
 static int
 od_pam_conversation(int msgc,
@@ -59,18 +84,18 @@ od_pam_conversation(int msgc,
 	return rc;
 }
 
-int
-od_pam_auth(char *od_pam_service, kiwi_var_t *user, kiwi_password_t *password)
+static int
+od_pam_authenticate(char *service, char *user, char *password)
 {
 	struct pam_conv conv =
 	{
 		od_pam_conversation,
-		.appdata_ptr = (void *)password->password,
+		.appdata_ptr = (void *)password,
 	};
 
 	pam_handle_t *pamh = NULL;
 	int rc;
-	rc = pam_start(od_pam_service, user->value, &conv, &pamh);
+	rc = pam_start(service, user, &conv, &pamh);
 	if (rc != PAM_SUCCESS)
 		goto error;
 	
@@ -92,3 +117,177 @@ error:
 	pam_end(pamh, rc);
 	return -1;
 }
+
+static void
+od_pam_request_unref(od_pam_request_t *request)
+{
+	if (od_atomic_u32_dec(&request->refs) > 1)
+		return;
+	if (request->password) {
+		OPENSSL_cleanse(request->password, strlen(request->password));
+		free(request->password);
+	}
+	if (request->service)
+		free(request->service);
+	if (request->user)
+		free(request->user);
+	if (request->reply)
+		machine_channel_free(request->reply);
+	free(request);
+}
+
+static void
+od_pam_worker(void *arg)
+{
+	(void)arg;
+	for (;;)
+	{
+		machine_msg_t *msg;
+		msg = machine_channel_read(od_pam_pool.channel, UINT32_MAX);
+		if (msg == NULL)
+			break;
+		od_pam_request_t *request;
+		memcpy(&request, machine_msg_data(msg), sizeof(request));
+		machine_msg_free(msg);
+
+		request->rc = od_pam_authenticate(request->service, request->user,
+		                                  request->password);
+
+		/* wakeup waiting client */
+		msg = machine_msg_create(0);
+		if (msg)
+			machine_channel_write(request->reply, msg);
+		od_pam_request_unref(request);
+	}
+}
+
+int
+od_pam_start(od_global_t *global, int count)
+{
+	od_instance_t *instance = global->instance;
+
+	if (RAND_bytes(od_pam_pool.salt, sizeof(od_pam_pool.salt)) != 1) {
+		od_error(&instance->logger, "pam", NULL, NULL,
+		         "failed to generate cache salt");
+		return -1;
+	}
+
+	od_pam_pool.channel = machine_channel_create(1);
+	if (od_pam_pool.channel == NULL) {
+		od_error(&instance->logger, "pam", NULL, NULL,
+		         "failed to create pam channel");
+		return -1;
+	}
+
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		char name[32];
+		od_snprintf(name, sizeof(name), "pam: %d", i);
+		int64_t machine;
+		machine = machine_create(name, od_pam_worker, NULL);
+		if (machine == -1) {
+			od_error(&instance->logger, "pam", NULL, NULL,
+			         "failed to start pam worker");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static inline void
+od_pam_digest(uint8_t *digest, kiwi_password_t *password)
+{
+	scram_HMAC_ctx ctx;
+	scram_HMAC_init(&ctx, od_pam_pool.salt, sizeof(od_pam_pool.salt));
+	scram_HMAC_update(&ctx, password->password, strlen(password->password));
+	scram_HMAC_final(digest, &ctx);
+	OPENSSL_cleanse(&ctx, sizeof(ctx));
+}
+
+static int
+od_pam_call(char *service, kiwi_var_t *user, kiwi_password_t *password)
+{
+	/* pool is not started */
+	if (od_pam_pool.channel == NULL)
+		return od_pam_authenticate(service, user->value, password->password);
+
+	od_pam_request_t *request;
+	request = malloc(sizeof(od_pam_request_t));
+	if (request == NULL)
+		return -1;
+	request->service  = strdup(service);
+	request->user     = strdup(user->value);
+	request->password = strdup(password->password);
+	request->rc       = -1;
+	request->reply    = machine_channel_create(1);
+	request->refs     = 1;
+	if (request->service == NULL || request->user == NULL ||
+	    request->password == NULL || request->reply == NULL) {
+		od_pam_request_unref(request);
+		return -1;
+	}
+
+	machine_msg_t *msg;
+	msg = machine_msg_create(sizeof(request));
+	if (msg == NULL) {
+		od_pam_request_unref(request);
+		return -1;
+	}
+	memcpy(machine_msg_data(msg), &request, sizeof(request));
+	request->refs = 2;
+	machine_channel_write(od_pam_pool.channel, msg);
+
+	msg = machine_channel_read(request->reply, UINT32_MAX);
+	int rc = -1;
+	if (msg) {
+		rc = request->rc;
+		machine_msg_free(msg);
+	}
+	od_pam_request_unref(request);
+	return rc;
+}
+
+int
+od_pam_auth(od_global_t *global, od_rule_t *rule, kiwi_var_t *user,
+            kiwi_password_t *password)
+{
+	od_instance_t *instance = global->instance;
+
+	/* cache stores only a salted digest of the accepted password */
+	uint8_t digest[SCRAM_KEY_LEN];
+	int rc;
+	if (rule->auth_pam_cache_ttl > 0) {
+		od_pam_digest(digest, password);
+
+		kiwi_password_t cached;
+		kiwi_password_init(&cached);
+		rc = od_auth_cache_get(&rule->auth_pam_cache, user->value,
+		                       user->value_len, machine_time_ms(), &cached);
+		if (rc == 1) {
+			int match;
+			match = cached.password_len == SCRAM_KEY_LEN &&
+			        CRYPTO_memcmp(cached.password, digest, SCRAM_KEY_LEN) == 0;
+			kiwi_password_free(&cached);
+			if (match) {
+				od_debug(&instance->logger, "pam", NULL, NULL,
+				         "cache hit for '%s'", user->value);
+				return 0;
+			}
+		}
+	}
+
+	rc = od_pam_call(rule->auth_pam_service, user, password);
+	if (rc == -1)
+		return -1;
+
+	if (rule->auth_pam_cache_ttl > 0) {
+		kiwi_password_t value;
+		value.password     = (char*)digest;
+		value.password_len = SCRAM_KEY_LEN;
+		od_auth_cache_set(&rule->auth_pam_cache, user->value, user->value_len,
+		                  machine_time_ms() + (uint64_t)rule->auth_pam_cache_ttl * 1000,
+		                  OD_PAM_CACHE_MAX, &value);
+	}
+	return 0;
+}
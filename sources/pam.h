@@ -7,7 +7,10 @@
  * Scalable PostgreSQL connection pooler.
 */
 
-int
-od_pam_auth(char *od_pam_service, kiwi_var_t *user, kiwi_password_t *password);
+/* max number of cached results per rule */
+#define OD_PAM_CACHE_MAX 1000
+
+int od_pam_start(od_global_t*, int);
+int od_pam_auth(od_global_t*, od_rule_t*, kiwi_var_t*, kiwi_password_t*);
 
 #endif /* ODYSSEY_PAM_H */
@@ -173,6 +173,9 @@ od_keyword_match(od_keyword_t *list, od_token_t *token)
 	for (; current->name; current++) {
 		if (current->name_len != token->value.string.size)
 			continue;
+		/* keywords are lower case */
+		if (current->name[0] != tolower(token->value.string.pointer[0]))
+			continue;
 		if (strncasecmp(current->name, token->value.string.pointer,
 		                token->value.string.size) == 0)
 			return current;
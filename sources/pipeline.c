@@ -0,0 +1,507 @@
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+/*
+ * Request message is the reply channel of the requesting client
+ * followed by the request packets. The message is kept until the
+ * request is replied and is sent back as the error reply.
+*/
+
+static inline machine_channel_t*
+od_pipeline_request_channel(machine_msg_t *msg)
+{
+	machine_channel_t *channel;
+	memcpy(&channel, machine_msg_data(msg), sizeof(channel));
+	return channel;
+}
+
+static inline void
+od_pipeline_request_fail(machine_msg_t *msg)
+{
+	if (machine_msg_type(msg) != OD_MSG_PIPELINE_REQUEST) {
+		machine_msg_free(msg);
+		return;
+	}
+	machine_channel_t *channel = od_pipeline_request_channel(msg);
+	machine_msg_set_type(msg, OD_MSG_PIPELINE_ERROR);
+	machine_channel_write(channel, msg);
+}
+
+static inline void
+od_pipeline_free(od_pipeline_t *pipeline)
+{
+	if (pipeline->client)
+		od_client_free(pipeline->client);
+	if (pipeline->channel)
+		machine_channel_free(pipeline->channel);
+	if (pipeline->cond)
+		machine_cond_free(pipeline->cond);
+	free(pipeline->inflight);
+	free(pipeline);
+}
+
+static inline od_pipeline_t*
+od_pipeline_allocate(od_client_t *client)
+{
+	od_rule_t *rule = client->rule;
+	od_pipeline_t *pipeline;
+	pipeline = malloc(sizeof(*pipeline));
+	if (pipeline == NULL)
+		return NULL;
+	pipeline->vars_hash      = client->vars.hash;
+	pipeline->route          = client->route;
+	pipeline->client         = NULL;
+	pipeline->inflight_max   = rule->pool_pipeline_depth;
+	pipeline->inflight_head  = 0;
+	pipeline->inflight_count = 0;
+	pipeline->reader_id      = -1;
+	pipeline->failed         = 0;
+	pipeline->dirty          = 0;
+	od_list_init(&pipeline->link);
+	pipeline->inflight = malloc(sizeof(machine_msg_t*) * pipeline->inflight_max);
+	pipeline->channel  = machine_channel_create(1);
+	pipeline->cond     = machine_cond_create();
+	if (pipeline->inflight == NULL || pipeline->channel == NULL ||
+	    pipeline->cond == NULL) {
+		od_pipeline_free(pipeline);
+		return NULL;
+	}
+
+	/* internal client sends requests using session parameters
+	 * of the requesting client */
+	od_client_t *pipeline_client;
+	pipeline_client = od_client_allocate();
+	if (pipeline_client == NULL) {
+		od_pipeline_free(pipeline);
+		return NULL;
+	}
+	pipeline->client = pipeline_client;
+	pipeline_client->global    = client->global;
+	pipeline_client->worker_id = client->worker_id;
+	od_id_generate(&pipeline_client->id, "p");
+	kiwi_var_set(&pipeline_client->startup.user, KIWI_VAR_UNDEF,
+	             client->startup.user.value,
+	             client->startup.user.value_len);
+	kiwi_var_set(&pipeline_client->startup.database, KIWI_VAR_UNDEF,
+	             client->startup.database.value,
+	             client->startup.database.value_len);
+	int rc;
+	rc = kiwi_vars_copy(&pipeline_client->vars, &client->vars);
+	if (rc == -1) {
+		od_pipeline_free(pipeline);
+		return NULL;
+	}
+	return pipeline;
+}
+
+static inline void
+od_pipeline_unlink(od_pipeline_t *pipeline)
+{
+	/* requests are written to the channel under the route lock,
+	 * requests of unlinked pipeline can be drained */
+	od_route_t *route = pipeline->route;
+	od_route_lock(route, OD_LOCK_OTHER);
+	od_list_unlink(&pipeline->link);
+	od_route_unlock(route);
+
+	machine_msg_t *msg;
+	while ((msg = machine_channel_read(pipeline->channel, 0)))
+		od_pipeline_request_fail(msg);
+}
+
+static void
+od_pipeline_reader(void *arg)
+{
+	od_pipeline_t *pipeline = arg;
+	od_client_t *client = pipeline->client;
+	od_server_t *server = client->server;
+	od_instance_t *instance = server->global->instance;
+
+	machine_set_priority(MACHINE_PRIORITY_HIGH);
+	machine_msg_t *chunk = NULL;
+	for (;;)
+	{
+		machine_msg_t *msg;
+		msg = od_read(&server->io, UINT32_MAX);
+		if (msg == NULL) {
+			if (machine_cancelled())
+				break;
+			od_error(&instance->logger, "pipeline", client, server,
+			         "read error: %s",
+			         od_io_error(&server->io));
+			goto failed;
+		}
+		char *data = machine_msg_data(msg);
+		int size = machine_msg_size(msg);
+		kiwi_be_type_t type = *data;
+
+		switch (type) {
+		case KIWI_BE_READY_FOR_QUERY:
+			od_backend_ready(server, data, size);
+			if (server->is_transaction)
+				pipeline->dirty = 1;
+			break;
+		case KIWI_BE_PARAMETER_STATUS:
+			/* session state is changed by a request, it can not be
+			 * shared anymore */
+			pipeline->dirty = 1;
+			break;
+		default:
+			break;
+		}
+
+		if (pipeline->inflight_count == 0) {
+			/* asynchronous notice */
+			machine_msg_free(msg);
+			continue;
+		}
+
+		/* coalesce reply packets of the head request */
+		if (chunk == NULL) {
+			chunk = msg;
+		} else {
+			int rc;
+			rc = machine_msg_write(chunk, data, size);
+			machine_msg_free(msg);
+			if (rc == -1)
+				goto failed;
+		}
+		if (type != KIWI_BE_READY_FOR_QUERY &&
+		    machine_msg_size(chunk) < OD_PIPELINE_REPLY_CHUNK)
+			continue;
+
+		machine_msg_t *request;
+		request = pipeline->inflight[pipeline->inflight_head];
+		machine_channel_t *channel;
+		channel = od_pipeline_request_channel(request);
+		if (type != KIWI_BE_READY_FOR_QUERY) {
+			machine_msg_set_type(chunk, OD_MSG_PIPELINE_REPLY);
+			machine_channel_write(channel, chunk);
+			chunk = NULL;
+			continue;
+		}
+		machine_msg_set_type(chunk, OD_MSG_PIPELINE_DONE);
+		machine_channel_write(channel, chunk);
+		chunk = NULL;
+
+		machine_msg_free(request);
+		pipeline->inflight_head =
+			(pipeline->inflight_head + 1) % pipeline->inflight_max;
+		pipeline->inflight_count--;
+		machine_cond_signal(pipeline->cond);
+	}
+
+	if (chunk)
+		machine_msg_free(chunk);
+	return;
+
+failed:
+	if (chunk)
+		machine_msg_free(chunk);
+	pipeline->failed = 1;
+	pipeline->reader_id = -1;
+	machine_cond_signal(pipeline->cond);
+
+	/* wakeup writer waiting for requests */
+	machine_msg_t *msg;
+	msg = machine_msg_create(0);
+	if (msg) {
+		machine_msg_set_type(msg, OD_MSG_PIPELINE_ERROR);
+		machine_channel_write(pipeline->channel, msg);
+	}
+}
+
+static inline int
+od_pipeline_write(od_pipeline_t *pipeline, machine_msg_t *request)
+{
+	/* write the request and requests received since then to
+	 * server at once */
+	od_server_t *server = pipeline->client->server;
+	machine_msg_t *msg;
+	msg = machine_msg_create(0);
+	if (msg == NULL) {
+		od_pipeline_request_fail(request);
+		return -1;
+	}
+	int count = 0;
+	while (request)
+	{
+		if (machine_msg_type(request) == OD_MSG_PIPELINE_REQUEST) {
+			int rc;
+			rc = machine_msg_write(msg,
+			                       (char*)machine_msg_data(request) +
+			                       sizeof(machine_channel_t*),
+			                       machine_msg_size(request) -
+			                       sizeof(machine_channel_t*));
+			if (rc == -1) {
+				od_pipeline_request_fail(request);
+				machine_msg_free(msg);
+				return -1;
+			}
+			int pos;
+			pos = (pipeline->inflight_head + pipeline->inflight_count) %
+			      pipeline->inflight_max;
+			pipeline->inflight[pos] = request;
+			pipeline->inflight_count++;
+			count++;
+		} else {
+			machine_msg_free(request);
+		}
+		if (pipeline->inflight_count == pipeline->inflight_max)
+			break;
+		request = machine_channel_read(pipeline->channel, 0);
+	}
+	if (count == 0) {
+		machine_msg_free(msg);
+		return 0;
+	}
+	od_server_sync_request(server, count);
+	return od_write(&server->io, msg);
+}
+
+static void
+od_pipeline_main(void *arg)
+{
+	od_pipeline_t *pipeline = arg;
+	od_client_t *client = pipeline->client;
+	od_global_t *global = client->global;
+	od_instance_t *instance = global->instance;
+	od_router_t *router = global->router;
+	od_server_t *server = NULL;
+	int rc;
+
+	machine_set_priority(MACHINE_PRIORITY_HIGH);
+
+	/* route and attach the internal client */
+	od_router_status_t status;
+	status = od_router_route(router, &instance->config, client);
+	if (status != OD_ROUTER_OK)
+		goto unlink;
+	if (client->route != pipeline->route)
+		goto unroute;
+	status = od_router_attach(router, &instance->config, client, false);
+	if (status != OD_ROUTER_OK)
+		goto unroute;
+	server = client->server;
+
+	if (server->io.io == NULL) {
+		rc = od_backend_connect(server, "pipeline", NULL);
+		if (rc == -1)
+			goto failed;
+	}
+
+	/* configure server using client parameters */
+	rc = od_deploy(client, "pipeline");
+	if (rc == -1)
+		goto failed;
+	if (rc > 0) {
+		od_server_sync_request(server, rc);
+		rc = od_backend_ready_wait(server, "pipeline", rc, UINT32_MAX);
+		if (rc == -1)
+			goto failed;
+	}
+
+	pipeline->reader_id = machine_coroutine_create(od_pipeline_reader, pipeline);
+	if (pipeline->reader_id == -1)
+		goto failed;
+
+	od_debug(&instance->logger, "pipeline", client, server,
+	         "started, depth %d", pipeline->inflight_max);
+
+	for (;;)
+	{
+		if (pipeline->failed || pipeline->dirty)
+			break;
+		if (pipeline->inflight_count == pipeline->inflight_max) {
+			machine_cond_wait(pipeline->cond, UINT32_MAX);
+			continue;
+		}
+		machine_msg_t *request;
+		request = machine_channel_read(pipeline->channel, OD_PIPELINE_IDLE);
+		if (request == NULL) {
+			if (pipeline->inflight_count > 0)
+				continue;
+			break;
+		}
+		if (pipeline->failed || pipeline->dirty) {
+			od_pipeline_request_fail(request);
+			break;
+		}
+		rc = od_pipeline_write(pipeline, request);
+		if (rc == -1) {
+			od_error(&instance->logger, "pipeline", client, server,
+			         "write error: %s",
+			         od_io_error(&server->io));
+			pipeline->failed = 1;
+			break;
+		}
+	}
+
+	/* new requests are sent to another pipeline, wait for replies
+	 * to the sent ones */
+	od_pipeline_unlink(pipeline);
+	while (pipeline->inflight_count > 0 && !pipeline->failed)
+		machine_cond_wait(pipeline->cond, UINT32_MAX);
+
+	if (pipeline->reader_id != -1) {
+		machine_cancel(pipeline->reader_id);
+		machine_join(pipeline->reader_id);
+	}
+	if (od_io_read_active(&server->io))
+		od_io_read_stop(&server->io);
+
+	while (pipeline->inflight_count > 0) {
+		od_pipeline_request_fail(pipeline->inflight[pipeline->inflight_head]);
+		pipeline->inflight_head =
+			(pipeline->inflight_head + 1) % pipeline->inflight_max;
+		pipeline->inflight_count--;
+	}
+
+	if (pipeline->failed)
+		goto close;
+
+	od_debug(&instance->logger, "pipeline", client, server,
+	         "stopped%s", pipeline->dirty ? ", session state changed" : "");
+
+	/* cleanup server */
+	rc = od_reset(server);
+	if (rc != 1)
+		goto close;
+	od_router_detach(router, &instance->config, client);
+	od_router_unroute(router, client);
+	od_pipeline_free(pipeline);
+	return;
+
+failed:
+	od_pipeline_unlink(pipeline);
+close:
+	od_router_close(router, client);
+	od_router_unroute(router, client);
+	od_pipeline_free(pipeline);
+	return;
+
+unroute:
+	od_pipeline_unlink(pipeline);
+	od_router_unroute(router, client);
+	od_pipeline_free(pipeline);
+	return;
+
+unlink:
+	od_pipeline_unlink(pipeline);
+	od_pipeline_free(pipeline);
+}
+
+od_status_t
+od_pipeline_request(od_client_t *client, char *data, int size)
+{
+	/* returns OD_UNDEF if the request was not replied and has
+	 * to be sent to an attached server */
+	od_instance_t *instance = client->global->instance;
+	od_route_t *route = client->route;
+
+	if (client->pipeline_channel == NULL) {
+		client->pipeline_channel = machine_channel_create(1);
+		if (client->pipeline_channel == NULL)
+			return OD_EOOM;
+	}
+	machine_channel_t *channel = client->pipeline_channel;
+
+	machine_msg_t *msg;
+	msg = machine_msg_create(sizeof(channel) + size);
+	if (msg == NULL)
+		return OD_EOOM;
+	machine_msg_set_type(msg, OD_MSG_PIPELINE_REQUEST);
+	char *pos = machine_msg_data(msg);
+	memcpy(pos, &channel, sizeof(channel));
+	memcpy(pos + sizeof(channel), data, size);
+
+	/* find or create pipeline for the client parameters */
+	od_pipeline_t *pipeline = NULL;
+	int created = 0;
+	od_route_lock(route, OD_LOCK_OTHER);
+	od_list_t *i;
+	od_list_foreach(&route->pipelines, i) {
+		od_pipeline_t *current;
+		current = od_container_of(i, od_pipeline_t, link);
+		if (current->vars_hash == client->vars.hash) {
+			pipeline = current;
+			break;
+		}
+	}
+	if (pipeline == NULL) {
+		pipeline = od_pipeline_allocate(client);
+		if (pipeline == NULL) {
+			od_route_unlock(route);
+			machine_msg_free(msg);
+			return OD_UNDEF;
+		}
+		od_list_append(&route->pipelines, &pipeline->link);
+		created = 1;
+	}
+	machine_channel_write(pipeline->channel, msg);
+	od_route_unlock(route);
+
+	if (created) {
+		int64_t coroutine_id;
+		coroutine_id = machine_coroutine_create(od_pipeline_main, pipeline);
+		if (coroutine_id == -1) {
+			od_pipeline_unlink(pipeline);
+			od_pipeline_free(pipeline);
+		}
+	}
+
+	/* relay reply to client */
+	int replied = 0;
+	int write_failed = 0;
+	for (;;)
+	{
+		msg = machine_channel_read(channel, UINT32_MAX);
+		if (msg == NULL) {
+			/* client coroutine is cancelled on shutdown, the
+			 * channel is left to the pipeline */
+			client->pipeline_channel = NULL;
+			return OD_ECLIENT_READ;
+		}
+		int type = machine_msg_type(msg);
+		if (type == OD_MSG_PIPELINE_ERROR) {
+			machine_msg_free(msg);
+			if (write_failed)
+				return OD_ECLIENT_WRITE;
+			return replied ? OD_ESERVER_READ : OD_UNDEF;
+		}
+		replied = 1;
+		if (write_failed) {
+			machine_msg_free(msg);
+		} else {
+			int rc;
+			rc = od_write(&client->io, msg);
+			if (rc == -1)
+				write_failed = 1;
+		}
+		if (type == OD_MSG_PIPELINE_DONE)
+			break;
+	}
+	if (write_failed)
+		return OD_ECLIENT_WRITE;
+
+	if (instance->config.log_debug)
+		od_debug(&instance->logger, "main", client, NULL,
+		         "pipelined request replied");
+	return OD_OK;
+}
@@ -0,0 +1,48 @@
+#ifndef ODYSSEY_PIPELINE_H
+#define ODYSSEY_PIPELINE_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_pipeline od_pipeline_t;
+
+/* idle time in milliseconds before the pipeline returns
+ * its server connection to the pool */
+#define OD_PIPELINE_IDLE 1000
+
+/* largest request which can be pipelined */
+#define OD_PIPELINE_REQUEST_MAX 8192
+
+/* server replies are sent to clients in chunks of this size */
+#define OD_PIPELINE_REPLY_CHUNK 8192
+
+/*
+ * Requests of clients with the same session parameters are
+ * written to one server connection without waiting for the
+ * previous replies, replies are demultiplexed in the order of
+ * requests.
+*/
+
+struct od_pipeline
+{
+	uint64_t            vars_hash;
+	od_route_t         *route;
+	od_client_t        *client;
+	machine_channel_t  *channel;
+	machine_msg_t     **inflight;
+	int                 inflight_max;
+	int                 inflight_head;
+	int                 inflight_count;
+	machine_cond_t     *cond;
+	int64_t             reader_id;
+	int                 failed;
+	int                 dirty;
+	od_list_t           link;
+};
+
+od_status_t od_pipeline_request(od_client_t*, char*, int);
+
+#endif /* ODYSSEY_PIPELINE_H */
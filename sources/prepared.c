@@ -0,0 +1,304 @@
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+static inline int
+od_prepared_client_bucket(char *name, int name_len)
+{
+	uint64_t hash = od_prepared_hash(name, name_len);
+	return hash % OD_PREPARED_BUCKETS;
+}
+
+void
+od_prepared_client_free(od_prepared_client_t *client)
+{
+	if (client->buckets == NULL)
+		return;
+	int i;
+	for (i = 0; i < OD_PREPARED_BUCKETS; i++) {
+		od_prepared_t *prepared = client->buckets[i];
+		while (prepared) {
+			od_prepared_t *next = prepared->next;
+			free(prepared->name);
+			free(prepared->parse);
+			free(prepared);
+			prepared = next;
+		}
+	}
+	free(client->buckets);
+	client->buckets = NULL;
+	client->count   = 0;
+}
+
+od_prepared_t*
+od_prepared_client_find(od_prepared_client_t *client, char *name, int name_len)
+{
+	if (client->buckets == NULL)
+		return NULL;
+	od_prepared_t *prepared;
+	prepared = client->buckets[od_prepared_client_bucket(name, name_len)];
+	for (; prepared; prepared = prepared->next) {
+		if (prepared->name_len == name_len &&
+		    memcmp(prepared->name, name, name_len) == 0)
+			return prepared;
+	}
+	return NULL;
+}
+
+od_prepared_t*
+od_prepared_client_add(od_prepared_client_t *client, char *name, int name_len,
+                       uint64_t hash, char *parse, int parse_size)
+{
+	if (client->buckets == NULL) {
+		client->buckets = calloc(OD_PREPARED_BUCKETS, sizeof(od_prepared_t*));
+		if (client->buckets == NULL)
+			return NULL;
+	}
+
+	/* statement can be redefined after Close, which result
+	 * could not be seen yet */
+	od_prepared_client_remove(client, name, name_len);
+
+	od_prepared_t *prepared = malloc(sizeof(od_prepared_t));
+	if (prepared == NULL)
+		return NULL;
+	prepared->name = malloc(name_len);
+	prepared->parse = malloc(parse_size);
+	if (prepared->name == NULL || prepared->parse == NULL) {
+		free(prepared->name);
+		free(prepared->parse);
+		free(prepared);
+		return NULL;
+	}
+	memcpy(prepared->name, name, name_len);
+	memcpy(prepared->parse, parse, parse_size);
+	prepared->name_len   = name_len;
+	prepared->hash       = hash;
+	prepared->parse_size = parse_size;
+
+	int bucket = od_prepared_client_bucket(name, name_len);
+	prepared->next = client->buckets[bucket];
+	client->buckets[bucket] = prepared;
+	client->count++;
+	return prepared;
+}
+
+void
+od_prepared_client_remove(od_prepared_client_t *client, char *name, int name_len)
+{
+	if (client->buckets == NULL)
+		return;
+	od_prepared_t **pos;
+	pos = &client->buckets[od_prepared_client_bucket(name, name_len)];
+	for (; *pos; pos = &(*pos)->next) {
+		od_prepared_t *prepared = *pos;
+		if (prepared->name_len == name_len &&
+		    memcmp(prepared->name, name, name_len) == 0) {
+			*pos = prepared->next;
+			free(prepared->name);
+			free(prepared->parse);
+			free(prepared);
+			client->count--;
+			return;
+		}
+	}
+}
+
+static inline od_prepared_entry_t**
+od_prepared_server_bucket(od_prepared_server_t *server, uint64_t hash)
+{
+	return &server->buckets[hash % OD_PREPARED_SERVER_BUCKETS];
+}
+
+void
+od_prepared_server_reset(od_prepared_server_t *server)
+{
+	od_list_t *i, *n;
+	od_list_foreach_safe(&server->lru, i, n) {
+		od_prepared_entry_t *entry;
+		entry = od_container_of(i, od_prepared_entry_t, link);
+		free(entry);
+	}
+	od_list_init(&server->lru);
+	if (server->buckets)
+		memset(server->buckets, 0,
+		       sizeof(od_prepared_entry_t*) * OD_PREPARED_SERVER_BUCKETS);
+	server->count         = 0;
+	server->replies_head  = 0;
+	server->replies_count = 0;
+}
+
+void
+od_prepared_server_free(od_prepared_server_t *server)
+{
+	od_prepared_server_reset(server);
+	free(server->buckets);
+	free(server->replies);
+	od_prepared_server_init(server);
+}
+
+static inline od_prepared_entry_t**
+od_prepared_server_find(od_prepared_server_t *server, uint64_t hash)
+{
+	od_prepared_entry_t **pos;
+	pos = od_prepared_server_bucket(server, hash);
+	while (*pos && (*pos)->hash != hash)
+		pos = &(*pos)->next;
+	return pos;
+}
+
+int
+od_prepared_server_has(od_prepared_server_t *server, uint64_t hash)
+{
+	if (server->count == 0)
+		return 0;
+	od_prepared_entry_t *entry;
+	entry = *od_prepared_server_find(server, hash);
+	if (entry == NULL)
+		return 0;
+	/* statement is about to be used */
+	od_list_unlink(&entry->link);
+	od_list_push(&server->lru, &entry->link);
+	return 1;
+}
+
+int
+od_prepared_server_add(od_prepared_server_t *server, uint64_t hash,
+                       int max, uint64_t *evicted)
+{
+	*evicted = 0;
+	if (server->buckets == NULL) {
+		server->buckets = calloc(OD_PREPARED_SERVER_BUCKETS,
+		                         sizeof(od_prepared_entry_t*));
+		if (server->buckets == NULL)
+			return -1;
+	}
+	od_prepared_entry_t **pos;
+	pos = od_prepared_server_find(server, hash);
+	if (*pos)
+		return 0;
+
+	od_prepared_entry_t *entry;
+	if (max > 0 && server->count >= max) {
+		/* replace least recently used statement, it has to be
+		 * closed on server */
+		entry = od_container_of(server->lru.prev, od_prepared_entry_t, link);
+		*evicted = entry->hash;
+		od_prepared_server_remove(server, entry->hash);
+		pos = od_prepared_server_find(server, hash);
+	}
+
+	entry = malloc(sizeof(od_prepared_entry_t));
+	if (entry == NULL)
+		return -1;
+	entry->hash = hash;
+	entry->next = NULL;
+	*pos = entry;
+	od_list_push(&server->lru, &entry->link);
+	server->count++;
+	return 0;
+}
+
+void
+od_prepared_server_remove(od_prepared_server_t *server, uint64_t hash)
+{
+	if (server->count == 0)
+		return;
+	od_prepared_entry_t **pos;
+	pos = od_prepared_server_find(server, hash);
+	od_prepared_entry_t *entry = *pos;
+	if (entry == NULL)
+		return;
+	*pos = entry->next;
+	od_list_unlink(&entry->link);
+	free(entry);
+	server->count--;
+}
+
+int
+od_prepared_server_push(od_prepared_server_t *server, uint8_t type,
+                        od_prepared_action_t action,
+                        uint64_t hash, uint64_t batch)
+{
+	if (server->replies_count == server->replies_size) {
+		int size = 16;
+		if (server->replies_size > 0)
+			size = server->replies_size * 2;
+		od_prepared_reply_t *replies;
+		replies = malloc(sizeof(od_prepared_reply_t) * size);
+		if (replies == NULL)
+			return -1;
+		int i;
+		for (i = 0; i < server->replies_count; i++) {
+			int pos = (server->replies_head + i) % server->replies_size;
+			replies[i] = server->replies[pos];
+		}
+		free(server->replies);
+		server->replies      = replies;
+		server->replies_size = size;
+		server->replies_head = 0;
+	}
+	int pos = (server->replies_head + server->replies_count) % server->replies_size;
+	od_prepared_reply_t *reply = &server->replies[pos];
+	reply->type   = type;
+	reply->action = action;
+	reply->hash   = hash;
+	reply->batch  = batch;
+	server->replies_count++;
+	return 0;
+}
+
+static inline od_prepared_reply_t*
+od_prepared_server_pop(od_prepared_server_t *server)
+{
+	od_prepared_reply_t *reply = &server->replies[server->replies_head];
+	server->replies_head = (server->replies_head + 1) % server->replies_size;
+	server->replies_count--;
+	return reply;
+}
+
+od_prepared_action_t
+od_prepared_server_reply(od_prepared_server_t *server, uint8_t type)
+{
+	if (server->replies_count == 0)
+		return OD_PREPARED_REPLY_PASS;
+	/* replies arrive in order of the sent messages */
+	od_prepared_reply_t *reply = od_prepared_server_pop(server);
+	if (reply->type != type) {
+		server->replies_count = 0;
+		return OD_PREPARED_REPLY_PASS;
+	}
+	return reply->action;
+}
+
+void
+od_prepared_server_error(od_prepared_server_t *server, uint64_t batch)
+{
+	/* server skips messages until Sync after error, forget
+	 * statements which were not parsed */
+	while (server->replies_count > 0) {
+		od_prepared_reply_t *reply = &server->replies[server->replies_head];
+		if (reply->batch > batch)
+			break;
+		od_prepared_server_pop(server);
+		if (reply->type == KIWI_BE_PARSE_COMPLETE && reply->hash != 0 &&
+		    reply->action != OD_PREPARED_REPLY_REWRITE)
+			od_prepared_server_remove(server, reply->hash);
+	}
+}
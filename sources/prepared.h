@@ -0,0 +1,145 @@
+#ifndef ODYSSEY_PREPARED_H
+#define ODYSSEY_PREPARED_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_prepared        od_prepared_t;
+typedef struct od_prepared_client od_prepared_client_t;
+typedef struct od_prepared_reply  od_prepared_reply_t;
+typedef struct od_prepared_entry  od_prepared_entry_t;
+typedef struct od_prepared_server od_prepared_server_t;
+
+/* server statement name: prefix and 16 hex digits of the hash */
+#define OD_PREPARED_PREFIX    "odyssey_"
+#define OD_PREPARED_NAME_SIZE (sizeof(OD_PREPARED_PREFIX) + 16)
+
+/* statement which does not exist on server, used to produce
+ * a reply to Parse of already prepared statement */
+#define OD_PREPARED_NOOP      "odyssey_noop"
+
+#define OD_PREPARED_BUCKETS   64
+#define OD_PREPARED_SERVER_BUCKETS 256
+
+typedef enum
+{
+	OD_PREPARED_REPLY_PASS,
+	OD_PREPARED_REPLY_SKIP,
+	OD_PREPARED_REPLY_REWRITE
+} od_prepared_action_t;
+
+/* named statement prepared by client, parse is the client
+ * Parse message rewritten to use the server statement name */
+struct od_prepared
+{
+	char          *name;
+	int            name_len;
+	uint64_t       hash;
+	char          *parse;
+	int            parse_size;
+	od_prepared_t *next;
+};
+
+struct od_prepared_client
+{
+	od_prepared_t **buckets;
+	int             count;
+};
+
+/* expected ParseComplete or CloseComplete reply */
+struct od_prepared_reply
+{
+	uint8_t  type;
+	uint8_t  action;
+	uint64_t hash;
+	uint64_t batch;
+};
+
+/* statement prepared on server connection */
+struct od_prepared_entry
+{
+	uint64_t             hash;
+	od_prepared_entry_t *next;
+	od_list_t            link;
+};
+
+/* statements prepared on server connection, ordered by use,
+ * and queue of replies to the statement messages in flight */
+struct od_prepared_server
+{
+	od_prepared_entry_t **buckets;
+	int                   count;
+	od_list_t             lru;
+	od_prepared_reply_t  *replies;
+	int                   replies_size;
+	int                   replies_head;
+	int                   replies_count;
+};
+
+static inline uint64_t
+od_prepared_hash(char *data, int size)
+{
+	/* FNV-1a */
+	uint64_t hash = 14695981039346656037ULL;
+	int i;
+	for (i = 0; i < size; i++) {
+		hash ^= (uint8_t)data[i];
+		hash *= 1099511628211ULL;
+	}
+	/* zero is used for replies without statement */
+	if (hash == 0)
+		hash = 1;
+	return hash;
+}
+
+static inline void
+od_prepared_client_init(od_prepared_client_t *client)
+{
+	client->buckets = NULL;
+	client->count   = 0;
+}
+
+void od_prepared_client_free(od_prepared_client_t*);
+
+od_prepared_t*
+od_prepared_client_find(od_prepared_client_t*, char*, int);
+
+od_prepared_t*
+od_prepared_client_add(od_prepared_client_t*, char*, int, uint64_t, char*, int);
+
+void od_prepared_client_remove(od_prepared_client_t*, char*, int);
+
+static inline void
+od_prepared_server_init(od_prepared_server_t *server)
+{
+	server->buckets       = NULL;
+	server->count         = 0;
+	server->replies       = NULL;
+	server->replies_size  = 0;
+	server->replies_head  = 0;
+	server->replies_count = 0;
+	od_list_init(&server->lru);
+}
+
+void od_prepared_server_free(od_prepared_server_t*);
+void od_prepared_server_reset(od_prepared_server_t*);
+int  od_prepared_server_has(od_prepared_server_t*, uint64_t);
+int  od_prepared_server_add(od_prepared_server_t*, uint64_t, int, uint64_t*);
+void od_prepared_server_remove(od_prepared_server_t*, uint64_t);
+
+static inline int
+od_prepared_server_pending(od_prepared_server_t *server)
+{
+	return server->replies_count;
+}
+
+int  od_prepared_server_push(od_prepared_server_t*, uint8_t, od_prepared_action_t,
+                             uint64_t, uint64_t);
+od_prepared_action_t
+od_prepared_server_reply(od_prepared_server_t*, uint8_t);
+void od_prepared_server_error(od_prepared_server_t*, uint64_t);
+
+#endif /* ODYSSEY_PREPARED_H */
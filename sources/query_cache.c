@@ -0,0 +1,187 @@
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+void
+od_query_cache_init(od_query_cache_t *cache)
+{
+	cache->entries = NULL;
+	cache->count   = 0;
+	cache->hits    = 0;
+	cache->misses  = 0;
+	pthread_mutex_init(&cache->lock, NULL);
+}
+
+static inline void
+od_query_cache_entry_reset(od_query_cache_entry_t *entry)
+{
+	if (entry->reply)
+		free(entry->reply);
+	entry->reply      = NULL;
+	entry->reply_size = 0;
+	entry->expire     = 0;
+}
+
+void
+od_query_cache_free(od_query_cache_t *cache)
+{
+	int i;
+	for (i = 0; i < cache->count; i++) {
+		od_query_cache_entry_t *entry = &cache->entries[i];
+		od_query_cache_entry_reset(entry);
+		free(entry->query);
+	}
+	if (cache->entries)
+		free(cache->entries);
+	cache->entries = NULL;
+	cache->count   = 0;
+	pthread_mutex_destroy(&cache->lock);
+}
+
+static inline void
+od_query_cache_trim(char **query, char **end)
+{
+	/* surrounding whitespace and the statement terminator are not
+	 * part of the query */
+	while (*query < *end && (**query == 0 || isspace((unsigned char)**query)))
+		(*query)++;
+	while (*end > *query && ((*end)[-1] == 0 || (*end)[-1] == ';' ||
+	                         isspace((unsigned char)(*end)[-1])))
+		(*end)--;
+}
+
+int
+od_query_cache_prepare(od_query_cache_t *cache, char *queries)
+{
+	/* query_cache "select * from flags; select value from settings" */
+	if (cache->entries)
+		return 0;
+	cache->entries = calloc(OD_QUERY_CACHE_MAX, sizeof(od_query_cache_entry_t));
+	if (cache->entries == NULL)
+		return -1;
+	char *pos = queries;
+	char *end = queries + strlen(queries);
+	while (pos < end) {
+		char *item = pos;
+		char *item_end = memchr(pos, ';', end - pos);
+		if (item_end == NULL)
+			item_end = end;
+		pos = item_end + 1;
+		od_query_cache_trim(&item, &item_end);
+		if (item == item_end)
+			continue;
+		if (cache->count == OD_QUERY_CACHE_MAX)
+			return -1;
+		od_query_cache_entry_t *entry = &cache->entries[cache->count];
+		entry->query_len = item_end - item;
+		entry->query = strndup(item, entry->query_len);
+		if (entry->query == NULL)
+			return -1;
+		cache->count++;
+	}
+	if (cache->count == 0)
+		return -1;
+	return 0;
+}
+
+void
+od_query_cache_reset(od_query_cache_t *cache)
+{
+	pthread_mutex_lock(&cache->lock);
+	int i;
+	for (i = 0; i < cache->count; i++)
+		od_query_cache_entry_reset(&cache->entries[i]);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+int
+od_query_cache_match(od_query_cache_t *cache, char *query, int query_len)
+{
+	char *end = query + query_len;
+	od_query_cache_trim(&query, &end);
+	query_len = end - query;
+	int i;
+	for (i = 0; i < cache->count; i++) {
+		od_query_cache_entry_t *entry = &cache->entries[i];
+		if (entry->query_len == query_len &&
+		    memcmp(entry->query, query, query_len) == 0)
+			return i;
+	}
+	return -1;
+}
+
+machine_msg_t*
+od_query_cache_get(od_query_cache_t *cache, int id, uint64_t now)
+{
+	machine_msg_t *msg = NULL;
+	pthread_mutex_lock(&cache->lock);
+	od_query_cache_entry_t *entry = &cache->entries[id];
+	if (entry->reply && entry->expire <= now)
+		od_query_cache_entry_reset(entry);
+	if (entry->reply == NULL) {
+		cache->misses++;
+		pthread_mutex_unlock(&cache->lock);
+		return NULL;
+	}
+	msg = machine_msg_create(entry->reply_size);
+	if (msg)
+		memcpy(machine_msg_data(msg), entry->reply, entry->reply_size);
+	cache->hits++;
+	pthread_mutex_unlock(&cache->lock);
+	return msg;
+}
+
+int
+od_query_cache_set(od_query_cache_t *cache, int id, char *reply, int size,
+                   uint64_t expire)
+{
+	char *copy = malloc(size);
+	if (copy == NULL)
+		return -1;
+	memcpy(copy, reply, size);
+	pthread_mutex_lock(&cache->lock);
+	od_query_cache_entry_t *entry = &cache->entries[id];
+	od_query_cache_entry_reset(entry);
+	entry->reply      = copy;
+	entry->reply_size = size;
+	entry->expire     = expire;
+	pthread_mutex_unlock(&cache->lock);
+	return 0;
+}
+
+void
+od_query_cache_stat(od_query_cache_t *cache, int *count, int *size,
+                    uint64_t *hits, uint64_t *misses)
+{
+	*count = 0;
+	*size  = 0;
+	pthread_mutex_lock(&cache->lock);
+	int i;
+	for (i = 0; i < cache->count; i++) {
+		od_query_cache_entry_t *entry = &cache->entries[i];
+		if (entry->reply == NULL)
+			continue;
+		(*count)++;
+		*size += entry->reply_size;
+	}
+	*hits   = cache->hits;
+	*misses = cache->misses;
+	pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,51 @@
+#ifndef ODYSSEY_QUERY_CACHE_H
+#define ODYSSEY_QUERY_CACHE_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_query_cache_entry od_query_cache_entry_t;
+typedef struct od_query_cache       od_query_cache_t;
+
+/* queries of the query_cache list are separated by ';' */
+#define OD_QUERY_CACHE_MAX 64
+
+/* Replies to the configured simple queries, from RowDescription
+ * to CommandComplete, without ReadyForQuery.
+ *
+ * Query texts are set on rule validation and never change, replies
+ * are shared by all workers and protected by the mutex.
+*/
+
+struct od_query_cache_entry
+{
+	char     *query;
+	int       query_len;
+	char     *reply;
+	int       reply_size;
+	uint64_t  expire;
+};
+
+struct od_query_cache
+{
+	pthread_mutex_t         lock;
+	od_query_cache_entry_t *entries;
+	int                     count;
+	uint64_t                hits;
+	uint64_t                misses;
+};
+
+void od_query_cache_init(od_query_cache_t*);
+void od_query_cache_free(od_query_cache_t*);
+int  od_query_cache_prepare(od_query_cache_t*, char*);
+void od_query_cache_reset(od_query_cache_t*);
+int  od_query_cache_match(od_query_cache_t*, char*, int);
+machine_msg_t*
+     od_query_cache_get(od_query_cache_t*, int, uint64_t);
+int  od_query_cache_set(od_query_cache_t*, int, char*, int, uint64_t);
+void od_query_cache_stat(od_query_cache_t*, int*, int*, uint64_t*, uint64_t*);
+
+#endif /* ODYSSEY_QUERY_CACHE_H */
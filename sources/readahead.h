@@ -9,21 +9,52 @@
 
 typedef struct od_readahead od_readahead_t;
 
+/* Readahead buffer is taken from the machine message cache on read and
+ * can be returned back by od_readahead_release() when all data is
+ * consumed, so idle connections do not hold memory.
+ *
+ * Buffer size is doubled after OD_READAHEAD_GROW_READS sequential reads
+ * which filled it up to the end, and halved each time buffer is drained
+ * without such reads, staying within size_min and size_max.
+ *
+ * With ring enabled the buffer is mapped twice in a row. Data between
+ * start and pos stays contiguous across the buffer end, so consumed
+ * data is released by moving start instead of moving unread data to
+ * the front, and reads fill all free space at once. Linear buffers
+ * keep start at zero.
+*/
+
+#define OD_READAHEAD_GROW_READS 2
+
 struct od_readahead
 {
 	machine_msg_t *buf;
+	int            buf_size;
+	int            ring;
 	int            size;
+	int            size_min;
+	int            size_max;
+	int            start;
 	int            pos;
 	int            pos_read;
+	int            full_reads;
+	int            full;
 };
 
 static inline void
 od_readahead_init(od_readahead_t *readahead)
 {
-	readahead->buf      = NULL;
-	readahead->size     = 0;
-	readahead->pos      = 0;
-	readahead->pos_read = 0;
+	readahead->buf        = NULL;
+	readahead->buf_size   = 0;
+	readahead->ring       = 0;
+	readahead->size       = 0;
+	readahead->size_min   = 0;
+	readahead->size_max   = 0;
+	readahead->start      = 0;
+	readahead->pos        = 0;
+	readahead->pos_read   = 0;
+	readahead->full_reads = 0;
+	readahead->full       = 0;
 }
 
 static inline void
@@ -34,12 +65,62 @@ od_readahead_free(od_readahead_t *readahead)
 }
 
 static inline int
-od_readahead_prepare(od_readahead_t *readahead, int size)
+od_readahead_prepare(od_readahead_t *readahead, int size, int ring)
 {
-	readahead->size = size;
-	readahead->buf = machine_msg_create(size);
+	readahead->ring     = ring;
+	readahead->size     = size;
+	readahead->size_min = size;
+	readahead->size_max = size;
+	return 0;
+}
+
+static inline void
+od_readahead_set_bounds(od_readahead_t *readahead, int min, int max)
+{
+	if (min > 0)
+		readahead->size_min = min;
+	if (max > 0)
+		readahead->size_max = max;
+	if (readahead->size_max < readahead->size_min)
+		readahead->size_max = readahead->size_min;
+	if (readahead->size < readahead->size_min)
+		readahead->size = readahead->size_min;
+	if (readahead->size > readahead->size_max)
+		readahead->size = readahead->size_max;
+}
+
+static inline machine_msg_t*
+od_readahead_create(od_readahead_t *readahead, int size)
+{
+	if (readahead->ring) {
+		machine_msg_t *buf;
+		buf = machine_msg_create_ring(size);
+		if (buf)
+			return buf;
+		/* no memfd support, stay linear */
+		readahead->ring = 0;
+	}
+	return machine_msg_create(size);
+}
+
+static inline int
+od_readahead_size_of(od_readahead_t *readahead)
+{
+	/* actual size of a buffer allocated for the current size */
+	if (readahead->ring)
+		return machine_msg_ring_size(readahead->size);
+	return readahead->size;
+}
+
+static inline int
+od_readahead_ensure(od_readahead_t *readahead)
+{
+	if (readahead->buf)
+		return 0;
+	readahead->buf = od_readahead_create(readahead, readahead->size);
 	if (readahead->buf == NULL)
 		return -1;
+	readahead->buf_size = machine_msg_size(readahead->buf);
 	return 0;
 }
 
@@ -47,7 +128,7 @@ static inline int
 od_readahead_left(od_readahead_t *readahead)
 {
 	assert(readahead->buf);
-	return readahead->size - readahead->pos;
+	return readahead->start + readahead->buf_size - readahead->pos;
 }
 
 static inline int
@@ -80,19 +161,135 @@ od_readahead_pos_read_advance(od_readahead_t *readahead, int value)
 	readahead->pos_read += value;
 }
 
+static inline void
+od_readahead_account(od_readahead_t *readahead, int size, int left)
+{
+	if (size < left) {
+		readahead->full_reads = 0;
+		return;
+	}
+	readahead->full = 1;
+	readahead->full_reads++;
+	if (readahead->full_reads < OD_READAHEAD_GROW_READS)
+		return;
+	readahead->full_reads = 0;
+	if (readahead->size < readahead->size_max) {
+		readahead->size *= 2;
+		if (readahead->size > readahead->size_max)
+			readahead->size = readahead->size_max;
+	}
+}
+
+static inline void
+od_readahead_release(od_readahead_t *readahead)
+{
+	if (readahead->buf == NULL || od_readahead_unread(readahead) > 0)
+		return;
+	machine_msg_free(readahead->buf);
+	readahead->buf      = NULL;
+	readahead->buf_size = 0;
+	readahead->start    = 0;
+	readahead->pos      = 0;
+	readahead->pos_read = 0;
+}
+
+static inline void
+od_readahead_wrap(od_readahead_t *readahead)
+{
+	/* release consumed data of the ring buffer */
+	readahead->start = readahead->pos_read;
+	if (readahead->start < readahead->buf_size)
+		return;
+	readahead->start    -= readahead->buf_size;
+	readahead->pos      -= readahead->buf_size;
+	readahead->pos_read -= readahead->buf_size;
+}
+
+static inline machine_msg_t*
+od_readahead_detach(od_readahead_t *readahead)
+{
+	/* take the buffer away, unread data moves to a new one */
+	machine_msg_t *buf = readahead->buf;
+	int unread = od_readahead_unread(readahead);
+	if (unread > 0) {
+		int size = readahead->size;
+		if (size < unread)
+			size = readahead->buf_size;
+		machine_msg_t *next;
+		next = od_readahead_create(readahead, size);
+		if (next == NULL)
+			return NULL;
+		memcpy(machine_msg_data(next),
+		       (char*)machine_msg_data(buf) + readahead->pos_read, unread);
+		readahead->buf      = next;
+		readahead->buf_size = machine_msg_size(next);
+	} else {
+		readahead->buf      = NULL;
+		readahead->buf_size = 0;
+	}
+	readahead->start    = 0;
+	readahead->pos      = unread;
+	readahead->pos_read = 0;
+	return buf;
+}
+
+static inline void
+od_readahead_compact(od_readahead_t *readahead)
+{
+	if (readahead->ring) {
+		od_readahead_wrap(readahead);
+		return;
+	}
+	/* move unread data to the start of the buffer */
+	char *data = machine_msg_data(readahead->buf);
+	int unread = od_readahead_unread(readahead);
+	memmove(data, data + readahead->pos_read, unread);
+	readahead->pos      = unread;
+	readahead->pos_read = 0;
+}
+
 static inline void
 od_readahead_reuse(od_readahead_t *readahead)
 {
 	size_t unread = od_readahead_unread(readahead);
+	if (readahead->ring && unread > 0) {
+		/* unread data stays in place and wraps around */
+		od_readahead_wrap(readahead);
+		return;
+	}
 	if (unread > sizeof(sizeof(kiwi_header_t)))
 		return;
 	if (unread == 0) {
+		readahead->start    = 0;
 		readahead->pos      = 0;
 		readahead->pos_read = 0;
+		if (! readahead->full && readahead->size > readahead->size_min) {
+			readahead->size /= 2;
+			if (readahead->size < readahead->size_min)
+				readahead->size = readahead->size_min;
+		}
+		readahead->full = 0;
+		/* allocate buffer of the new size on next read */
+		if (readahead->buf_size != od_readahead_size_of(readahead))
+			od_readahead_release(readahead);
 		return;
 	}
 	/* save next packet header */
 	char *data = machine_msg_data(readahead->buf);
+	if (readahead->buf_size != readahead->size) {
+		/* resize buffer */
+		machine_msg_t *buf;
+		buf = machine_msg_create(readahead->size);
+		if (buf) {
+			memcpy(machine_msg_data(buf), data + readahead->pos_read, unread);
+			machine_msg_free(readahead->buf);
+			readahead->buf      = buf;
+			readahead->buf_size = readahead->size;
+			readahead->pos      = unread;
+			readahead->pos_read = 0;
+			return;
+		}
+	}
 	memmove(data, data + readahead->pos_read, unread);
 	readahead->pos      = unread;
 	readahead->pos_read = 0;
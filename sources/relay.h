@@ -12,13 +12,59 @@ typedef struct od_relay od_relay_t;
 typedef od_status_t (*od_relay_on_packet_t)(od_relay_t*, char *data, int size);
 typedef void        (*od_relay_on_read_t)(od_relay_t*, int size);
 
+/* packet body size left to relay, starting from which it is moved
+ * between sockets using splice(2) instead of readahead buffer */
+#define OD_RELAY_SPLICE_MIN 4096
+
+/* Reads from source are paused when data waiting for destination
+ * reaches the high watermark and resumed below the low one. Pending
+ * data of all relays is accounted in memory_total, while it is over
+ * memory_max, relays reaching the high watermark are stopped with
+ * OD_ERELAY_MEMORY. */
+
+/* Relay yields to other coroutines of the worker after read_budget
+ * bytes were read without the source running out of data, a large
+ * result does not hold the worker until it is relayed. */
+
+/* Raw relay does not look at packets at all, everything read is
+ * written as is, or spliced when splice is enabled. Relay can only
+ * be switched to raw mode on a packet boundary and stays raw. */
+
+/* With a spool set, data the destination did not take is moved to
+ * the spool once it reaches spool_threshold, everything relayed
+ * after goes to the spool until it is drained by the owner. */
+
 struct od_relay
 {
 	int                   packet;
 	int                   packet_skip;
 	machine_msg_t        *packet_full;
 	int                   packet_full_pos;
+	int                   packet_full_extended;
+	int                   packet_full_max;
+	int                   packet_full_limit;
+	int                   raw;
 	machine_iov_t        *iov;
+	int                   splice;
+	int                   splice_pipe[2];
+	int                   splice_pipe_size;
+	int                   splice_pending;
+	int                   coalesce;
+	int                   coalesce_flush;
+	int                   write_more;
+	uint64_t              write_wait_start;
+	uint64_t              write_wait_time;
+	int                   watermark_high;
+	int                   watermark_low;
+	int                   paused;
+	int                   memory;
+	od_atomic_u64_t      *memory_total;
+	uint64_t              memory_max;
+	int                   read_budget;
+	int                   read_count;
+	od_spool_t           *spool;
+	int                   spool_threshold;
+	uint64_t              packet_mask[4];
 	machine_cond_t       *base;
 	od_io_t              *src;
 	od_io_t              *dst;
@@ -32,6 +78,39 @@ struct od_relay
 
 static inline od_status_t od_relay_read(od_relay_t *relay);
 
+/* Packet mask is the set of packet types passed to the packet
+ * callback, other packets are relayed as is. All types are set
+ * by default. */
+static inline void
+od_relay_mask_all(od_relay_t *relay)
+{
+	memset(relay->packet_mask, 0xff, sizeof(relay->packet_mask));
+}
+
+static inline void
+od_relay_mask_clear(od_relay_t *relay)
+{
+	memset(relay->packet_mask, 0, sizeof(relay->packet_mask));
+}
+
+static inline void
+od_relay_mask_set(od_relay_t *relay, uint8_t type)
+{
+	relay->packet_mask[type >> 6] |= 1ULL << (type & 63);
+}
+
+static inline void
+od_relay_mask_unset(od_relay_t *relay, uint8_t type)
+{
+	relay->packet_mask[type >> 6] &= ~(1ULL << (type & 63));
+}
+
+static inline int
+od_relay_mask_has(od_relay_t *relay, uint8_t type)
+{
+	return (relay->packet_mask[type >> 6] >> (type & 63)) & 1;
+}
+
 static inline void
 od_relay_init(od_relay_t *relay, od_io_t *io)
 {
@@ -39,7 +118,32 @@ od_relay_init(od_relay_t *relay, od_io_t *io)
 	relay->packet_skip     = 0;
 	relay->packet_full     = NULL;
 	relay->packet_full_pos = 0;
+	relay->packet_full_extended = 0;
+	relay->packet_full_max = 0;
+	relay->packet_full_limit = 0;
+	relay->raw             = 0;
 	relay->iov             = NULL;
+	relay->splice          = 0;
+	relay->splice_pipe[0]  = -1;
+	relay->splice_pipe[1]  = -1;
+	relay->splice_pipe_size = 0;
+	relay->splice_pending  = 0;
+	relay->coalesce        = 0;
+	relay->coalesce_flush  = 0;
+	relay->write_more      = 0;
+	relay->write_wait_start = 0;
+	relay->write_wait_time = 0;
+	relay->watermark_high  = 0;
+	relay->watermark_low   = 0;
+	relay->paused          = 0;
+	relay->memory          = 0;
+	relay->memory_total    = NULL;
+	relay->memory_max      = 0;
+	relay->read_budget     = 0;
+	relay->read_count      = 0;
+	relay->spool           = NULL;
+	relay->spool_threshold = 0;
+	memset(relay->packet_mask, 0xff, sizeof(relay->packet_mask));
 	relay->base            = NULL;
 	relay->src             = io;
 	relay->dst             = NULL;
@@ -54,18 +158,50 @@ od_relay_init(od_relay_t *relay, od_io_t *io)
 static inline void
 od_relay_free(od_relay_t *relay)
 {
+	if (relay->memory_total && relay->memory > 0)
+		od_atomic_u64_sub(relay->memory_total, relay->memory);
 	if (relay->packet_full)
 		machine_msg_free(relay->packet_full);
 	if (relay->iov)
 		machine_iov_free(relay->iov);
+	if (relay->splice_pipe[0] != -1)
+		machine_pipe_free(relay->splice_pipe);
 }
 
 static inline bool
 od_relay_data_pending(od_relay_t *relay)
 {
-	char *current = od_readahead_pos_read(&relay->src->readahead);
-	char *end     = od_readahead_pos(&relay->src->readahead);
-	return current < end;
+	return od_readahead_unread(&relay->src->readahead) > 0;
+}
+
+static inline bool
+od_relay_iov_pending(od_relay_t *relay)
+{
+	return relay->iov && machine_iov_pending(relay->iov);
+}
+
+static inline bool
+od_relay_write_pending(od_relay_t *relay)
+{
+	return relay->splice_pending > 0 || od_relay_iov_pending(relay);
+}
+
+static inline void
+od_relay_release(od_relay_t *relay)
+{
+	/* return buffers of idle relay, they are allocated again
+	 * on next read */
+	if (relay->iov && ! machine_iov_pending(relay->iov)) {
+		machine_iov_free(relay->iov);
+		relay->iov = NULL;
+	}
+	if (relay->splice_pipe[0] != -1 && relay->splice_pending == 0) {
+		machine_pipe_free(relay->splice_pipe);
+		relay->splice_pipe[0]   = -1;
+		relay->splice_pipe[1]   = -1;
+		relay->splice_pipe_size = 0;
+	}
+	od_readahead_release(&relay->src->readahead);
 }
 
 static inline od_status_t
@@ -85,6 +221,7 @@ od_relay_start(od_relay_t *relay,
 	relay->on_read       = on_read;
 	relay->on_read_arg   = on_read_arg;
 	relay->base          = base;
+	relay->paused        = 0;
 
 	if (relay->iov == NULL)
 		relay->iov = machine_iov_create();
@@ -131,19 +268,80 @@ od_relay_detach(od_relay_t *relay)
 	relay->dst = NULL;
 }
 
+static inline void
+od_relay_account(od_relay_t *relay)
+{
+	if (relay->memory_total == NULL)
+		return;
+	int size = relay->splice_pending;
+	if (relay->iov)
+		size += machine_iov_size(relay->iov);
+	if (size > relay->memory)
+		od_atomic_u64_add(relay->memory_total, size - relay->memory);
+	else
+	if (size < relay->memory)
+		od_atomic_u64_sub(relay->memory_total, relay->memory - size);
+	relay->memory = size;
+}
+
 static inline int
 od_relay_stop(od_relay_t *relay)
 {
 	od_relay_detach(relay);
 	od_io_read_stop(relay->src);
+	/* pooled server io must not wakeup the client it is released by */
+	if (relay->src->on_read)
+		machine_cond_propagate(relay->src->on_read, NULL);
+	if (relay->src->on_write)
+		machine_cond_propagate(relay->src->on_write, NULL);
+	relay->paused = 0;
+	relay->spool  = NULL;
+	od_relay_account(relay);
 	return 0;
 }
 
+/* Packets larger than the readahead buffer are relayed in chunks,
+ * only packets inspected by the callback are collected in full.
+ * Collected packets are limited by packet_full_limit, larger ones
+ * are streamed as well and the callback sees only their start,
+ * relay->packet is left to relay then. Parse messages are always
+ * collected, since statements are kept by query.
+ *
+ * Callback can replace the start of a streamed packet with its own
+ * messages and return OD_REPLACE, the rest is relayed as is. */
+static inline int
+od_relay_packet_partial(od_relay_t *relay)
+{
+	return relay->packet > 0;
+}
+
 static inline int
-od_relay_full_packet_required(char *data)
+od_relay_full_packet_required(od_relay_t *relay, char *data)
 {
 	kiwi_header_t *header;
 	header = (kiwi_header_t*)data;
+	uint32_t total;
+	total = sizeof(uint8_t) + kiwi_read_size(data, sizeof(kiwi_header_t));
+	/* client statement messages are rewritten */
+	if (relay->packet_full_extended) {
+		if (header->type == KIWI_FE_PARSE)
+			return 1;
+		if (relay->packet_full_limit > 0 &&
+		    total > (uint32_t)relay->packet_full_limit)
+			return 0;
+		if (header->type == KIWI_FE_BIND     ||
+		    header->type == KIWI_FE_DESCRIBE ||
+		    header->type == KIWI_FE_CLOSE)
+			return 1;
+	}
+	if (relay->packet_full_limit > 0 &&
+	    total > (uint32_t)relay->packet_full_limit)
+		return 0;
+	/* replies to a cached query are collected as whole packets */
+	if (relay->packet_full_max > 0) {
+		if (total <= (uint32_t)relay->packet_full_max)
+			return 1;
+	}
 	if (header->type == KIWI_BE_PARAMETER_STATUS ||
 	    header->type == KIWI_BE_READY_FOR_QUERY  ||
 	    header->type == KIWI_BE_ERROR_RESPONSE)
@@ -151,6 +349,19 @@ od_relay_full_packet_required(char *data)
 	return 0;
 }
 
+/* packets after which server waits for client, coalesced
+ * replies are written right away */
+static inline void
+od_relay_coalesce_point(od_relay_t *relay, char *data)
+{
+	kiwi_header_t *header;
+	header = (kiwi_header_t*)data;
+	if (header->type == KIWI_BE_READY_FOR_QUERY  ||
+	    header->type == KIWI_BE_COPY_IN_RESPONSE ||
+	    header->type == KIWI_BE_COPY_BOTH_RESPONSE)
+		relay->coalesce_flush = 1;
+}
+
 static inline od_status_t
 od_relay_on_packet_msg(od_relay_t *relay, machine_msg_t *msg)
 {
@@ -179,8 +390,9 @@ static inline od_status_t
 od_relay_on_packet(od_relay_t *relay, char *data, int size)
 {
 	int rc;
-	od_status_t status;
-	status = relay->on_packet(relay, data, size);
+	od_status_t status = OD_OK;
+	if (od_relay_mask_has(relay, *data))
+		status = relay->on_packet(relay, data, size);
 	switch (status) {
 	case OD_OK:
 	case OD_DETACH:
@@ -192,6 +404,9 @@ od_relay_on_packet(od_relay_t *relay, char *data, int size)
 		relay->packet_skip = 1;
 		status = OD_OK;
 		break;
+	case OD_REPLACE:
+		status = OD_OK;
+		break;
 	default:
 		break;
 	}
@@ -210,6 +425,9 @@ od_relay_process(od_relay_t *relay, int *progress, char *data, int size)
 		if (size < (int)sizeof(kiwi_header_t))
 			return OD_UNDEF;
 
+		if (relay->coalesce)
+			od_relay_coalesce_point(relay, data);
+
 		int body;
 		body = kiwi_read_size(data, sizeof(kiwi_header_t));
 		body -= sizeof(uint32_t);
@@ -225,7 +443,7 @@ od_relay_process(od_relay_t *relay, int *progress, char *data, int size)
 		relay->packet      = total - size;
 		relay->packet_skip = 0;
 
-		rc = od_relay_full_packet_required(data);
+		rc = od_relay_full_packet_required(relay, data);
 		if (! rc)
 			return od_relay_on_packet(relay, data, size);
 
@@ -269,15 +487,61 @@ od_relay_process(od_relay_t *relay, int *progress, char *data, int size)
 	return OD_OK;
 }
 
+/* size of a run of complete packets at the buffer start,
+ * which are not passed to the packet callback */
+static inline int
+od_relay_scan(od_relay_t *relay, char *data, int size)
+{
+	char *pos = data;
+	char *end = data + size;
+	while (end - pos >= (int)sizeof(kiwi_header_t) &&
+	       ! od_relay_mask_has(relay, *pos))
+	{
+		int total;
+		total = sizeof(uint8_t) + kiwi_read_size(pos, sizeof(kiwi_header_t));
+		if (end - pos < total)
+			break;
+		pos += total;
+	}
+	return pos - data;
+}
+
 static inline od_status_t
 od_relay_pipeline(od_relay_t *relay)
 {
+	if (! od_relay_data_pending(relay))
+		return OD_OK;
+	if (relay->iov == NULL) {
+		relay->iov = machine_iov_create();
+		if (relay->iov == NULL)
+			return OD_EOOM;
+	}
 	char *current = od_readahead_pos_read(&relay->src->readahead);
 	char *end     = od_readahead_pos(&relay->src->readahead);
 	while (current < end)
 	{
 		int progress;
 		int rc;
+		if (relay->raw) {
+			rc = machine_iov_add_pointer(relay->iov, current, end - current);
+			if (rc == -1)
+				return OD_EOOM;
+			od_readahead_pos_read_advance(&relay->src->readahead, end - current);
+			break;
+		}
+		/* relay runs of uninspected packets, such as result set
+		 * rows, with a single iov entry */
+		if (relay->packet == 0) {
+			progress = od_relay_scan(relay, current, end - current);
+			if (progress > 0) {
+				rc = machine_iov_add_pointer(relay->iov, current, progress);
+				if (rc == -1)
+					return OD_EOOM;
+				current += progress;
+				od_readahead_pos_read_advance(&relay->src->readahead, progress);
+				continue;
+			}
+		}
 		rc = od_relay_process(relay, &progress, current, end - current);
 		current += progress;
 		od_readahead_pos_read_advance(&relay->src->readahead, progress);
@@ -293,6 +557,9 @@ od_relay_pipeline(od_relay_t *relay)
 static inline od_status_t
 od_relay_read(od_relay_t *relay)
 {
+	if (od_readahead_ensure(&relay->src->readahead) == -1)
+		return OD_EOOM;
+
 	int to_read;
 	to_read = od_readahead_left(&relay->src->readahead);
 	if (to_read == 0)
@@ -306,13 +573,128 @@ od_relay_read(od_relay_t *relay)
 	if (rc <= 0) {
 		/* retry */
 		int errno_ = machine_errno();
-		if (errno_ == EAGAIN || errno_ == EWOULDBLOCK || errno_ == EINTR)
+		if (errno_ == EAGAIN || errno_ == EWOULDBLOCK || errno_ == EINTR) {
+			relay->read_count = 0;
 			return OD_OK;
+		}
 		/* error or eof */
 		return relay->error_read;
 	}
+	/* short read drains the socket, relay waits for data next */
+	if (rc < to_read)
+		relay->read_count = 0;
+	else
+		relay->read_count += rc;
 
 	od_readahead_pos_advance(&relay->src->readahead, rc);
+	od_readahead_account(&relay->src->readahead, rc, to_read);
+	od_trace2(relay__read, relay, rc);
+
+	/* update recv stats */
+	relay->on_read(relay, rc);
+
+	return OD_OK;
+}
+
+/* Keep reading into the readahead buffer after the first read,
+ * until a packet after which server waits for client, buffer end or
+ * until socket has no more data. Small replies are written with a
+ * single call instead of one per read. */
+static inline od_status_t
+od_relay_coalesce(od_relay_t *relay)
+{
+	od_readahead_t *readahead = &relay->src->readahead;
+	while (! relay->coalesce_flush)
+	{
+		if (od_readahead_left(readahead) == 0) {
+			/* rest of the packet follows */
+			relay->write_more = relay->packet > 0;
+			break;
+		}
+		int pos = readahead->pos;
+		int rc;
+		rc = od_relay_read(relay);
+		if (rc != OD_OK) {
+			/* write buffered data first, error is returned
+			 * by the next read */
+			machine_cond_signal(relay->src->on_read);
+			break;
+		}
+		if (readahead->pos == pos)
+			break;
+		rc = od_relay_pipeline(relay);
+		if (rc != OD_OK)
+			return rc;
+	}
+	return OD_OK;
+}
+
+static inline int
+od_relay_splice_ready(od_relay_t *relay)
+{
+	if (! relay->splice || relay->splice_pipe_size == -1)
+		return 0;
+
+	/* only bodies of large packets, which are not inspected,
+	 * or everything in raw mode */
+	if (! relay->raw &&
+	    (relay->packet < OD_RELAY_SPLICE_MIN ||
+	     relay->packet_full || relay->packet_skip))
+		return 0;
+
+	/* buffered data must be written first */
+	if (od_relay_data_pending(relay) || od_relay_iov_pending(relay))
+		return 0;
+	if (relay->spool && od_spool_pending(relay->spool))
+		return 0;
+	if (relay->splice_pipe_size > 0 &&
+	    relay->splice_pending == relay->splice_pipe_size)
+		return 0;
+
+	return machine_io_can_splice(relay->src->io, 0) &&
+	       machine_io_can_splice(relay->dst->io, 1);
+}
+
+static inline od_status_t
+od_relay_splice_read(od_relay_t *relay)
+{
+	int rc;
+	if (relay->splice_pipe[0] == -1) {
+		rc = machine_pipe_create(relay->splice_pipe);
+		if (rc == -1) {
+			/* fallback to buffered relay */
+			relay->splice_pipe[0]   = -1;
+			relay->splice_pipe[1]   = -1;
+			relay->splice_pipe_size = -1;
+			return OD_OK;
+		}
+		relay->splice_pipe_size = rc;
+	}
+
+	int to_read = relay->packet;
+	if (relay->raw || to_read > relay->splice_pipe_size - relay->splice_pending)
+		to_read = relay->splice_pipe_size - relay->splice_pending;
+
+	rc = machine_splice_read_raw(relay->src->io, relay->splice_pipe[1],
+	                             to_read);
+	if (rc <= 0) {
+		/* retry */
+		int errno_ = machine_errno();
+		if (errno_ == EAGAIN || errno_ == EWOULDBLOCK || errno_ == EINTR) {
+			relay->read_count = 0;
+			return OD_OK;
+		}
+		/* error or eof */
+		return relay->error_read;
+	}
+	if (rc < to_read)
+		relay->read_count = 0;
+	else
+		relay->read_count += rc;
+
+	if (! relay->raw)
+		relay->packet -= rc;
+	relay->splice_pending += rc;
 
 	/* update recv stats */
 	relay->on_read(relay, rc);
@@ -320,16 +702,67 @@ od_relay_read(od_relay_t *relay)
 	return OD_OK;
 }
 
+static inline void
+od_relay_reuse(od_relay_t *relay)
+{
+	/* zero-copy sends may still read the drained buffer, it is
+	 * kept by the destination io until the kernel releases it
+	 * and the next read takes a fresh one */
+	od_readahead_t *readahead = &relay->src->readahead;
+	if (relay->dst && readahead->buf &&
+	    machine_zerocopy_pending(relay->dst->io) > 0) {
+		machine_msg_t *buf;
+		buf = od_readahead_detach(readahead);
+		if (buf)
+			machine_zerocopy_hold(relay->dst->io, buf);
+	}
+	od_readahead_reuse(readahead);
+}
+
+static inline od_status_t
+od_relay_spool(od_relay_t *relay)
+{
+	int rc;
+	rc = od_spool_move(relay->spool, relay->iov);
+	if (rc == -1)
+		return relay->error_write;
+	return OD_OK;
+}
+
 static inline od_status_t
 od_relay_write(od_relay_t *relay)
 {
 	assert(relay->dst);
 
-	if (! machine_iov_pending(relay->iov))
+	int rc;
+
+	/* spliced data always precedes buffered one */
+	if (relay->splice_pending > 0) {
+		rc = machine_splice_write_raw(relay->dst->io, relay->splice_pipe[0],
+		                              relay->splice_pending);
+		if (rc < 0) {
+			/* retry or error */
+			int errno_ = machine_errno();
+			if (errno_ == EAGAIN || errno_ == EWOULDBLOCK || errno_ == EINTR)
+				return OD_OK;
+			return relay->error_write;
+		}
+		od_trace2(relay__write, relay, rc);
+		relay->splice_pending -= rc;
+		if (relay->splice_pending > 0)
+			return OD_OK;
+	}
+
+	if (! od_relay_iov_pending(relay))
 		return OD_OK;
 
-	int rc;
-	rc = machine_writev_raw(relay->dst->io, relay->iov);
+	if (relay->spool && od_spool_pending(relay->spool))
+		return od_relay_spool(relay);
+
+	if (relay->write_more)
+		rc = machine_writev_raw_more(relay->dst->io, relay->iov);
+	else
+		rc = machine_writev_raw(relay->dst->io, relay->iov);
 	if (rc < 0) {
 		/* retry or error */
 		int errno_ = machine_errno();
@@ -337,7 +770,54 @@ od_relay_write(od_relay_t *relay)
 			return OD_OK;
 		return relay->error_write;
 	}
+	od_trace2(relay__write, relay, rc);
 
+	/* destination does not keep up */
+	if (relay->spool &&
+	    machine_iov_size(relay->iov) >= relay->spool_threshold)
+		return od_relay_spool(relay);
+
+	return OD_OK;
+}
+
+static inline int
+od_relay_read_room(od_relay_t *relay)
+{
+	od_readahead_t *readahead = &relay->src->readahead;
+	return readahead->buf == NULL || od_readahead_left(readahead) > 0;
+}
+
+static inline od_status_t
+od_relay_backpressure(od_relay_t *relay)
+{
+	od_relay_account(relay);
+	int rc;
+	if (relay->paused) {
+		/* pending data is written down to the low watermark and
+		 * readahead buffer has room for the next read */
+		if (od_relay_write_pending(relay) &&
+		    (relay->memory > relay->watermark_low || ! od_relay_read_room(relay)))
+			return OD_OK;
+		rc = od_io_read_start(relay->src);
+		if (rc == -1)
+			return relay->error_read;
+		relay->paused = 0;
+		return OD_OK;
+	}
+	if (! od_relay_write_pending(relay))
+		return OD_OK;
+	int full;
+	full = relay->watermark_high > 0 && relay->memory >= relay->watermark_high;
+	if (! full && od_relay_read_room(relay))
+		return OD_OK;
+	/* relays holding the most data are shed first */
+	if (full && relay->memory_max > 0 &&
+	    od_atomic_u64_of(relay->memory_total) > relay->memory_max)
+		return OD_ERELAY_MEMORY;
+	rc = od_io_read_stop(relay->src);
+	if (rc == -1)
+		return relay->error_read;
+	relay->paused = 1;
 	return OD_OK;
 }
 
@@ -354,19 +834,41 @@ od_relay_step(od_relay_t *relay)
 			return OD_ATTACH;
 		}
 
-		rc = od_relay_read(relay);
-		if (rc != OD_OK)
-			return rc;
-
-		rc = od_relay_pipeline(relay);
-		if (rc != OD_OK)
-			return rc;
+		if (od_relay_splice_ready(relay)) {
+			rc = od_relay_splice_read(relay);
+			if (rc != OD_OK)
+				return rc;
+		} else {
+			relay->coalesce_flush = 0;
+			relay->write_more = 0;
+
+			/* data read before attach goes first, the next read may
+			 * already return eof */
+			rc = od_relay_pipeline(relay);
+			if (rc != OD_OK)
+				return rc;
+
+			rc = od_relay_read(relay);
+			if (rc != OD_OK)
+				return rc;
+
+			rc = od_relay_pipeline(relay);
+			if (rc != OD_OK)
+				return rc;
+
+			if (relay->coalesce && ! relay->splice) {
+				rc = od_relay_coalesce(relay);
+				if (rc != OD_OK)
+					return rc;
+			}
+
+			if (! od_relay_iov_pending(relay))
+				od_relay_reuse(relay);
+		}
 
-		if (machine_iov_pending(relay->iov)) {
+		if (od_relay_write_pending(relay)) {
 			/* try to optimize write path and handle it right-away */
 			machine_cond_signal(relay->dst->on_write);
-		} else {
-			od_readahead_reuse(&relay->src->readahead);
 		}
 	}
 
@@ -380,25 +882,43 @@ od_relay_step(od_relay_t *relay)
 		if (rc != OD_OK)
 			return rc;
 
-		if (! machine_iov_pending(relay->iov))
+		if (! od_relay_write_pending(relay))
 		{
+			if (relay->write_wait_start) {
+				relay->write_wait_time += machine_time_us() -
+				                          relay->write_wait_start;
+				relay->write_wait_start = 0;
+			}
+
 			rc = od_io_write_stop(relay->dst);
 			if (rc == -1)
 				return relay->error_write;
 
-			od_readahead_reuse(&relay->src->readahead);
+			od_relay_reuse(relay);
 
 			rc = od_io_read_start(relay->src);
 			if (rc == -1)
 				return relay->error_read;
+			relay->paused = 0;
 		} else {
+			/* destination does not keep up, time spent waiting
+			 * for it is accounted in write_wait_time */
+			if (! relay->write_wait_start)
+				relay->write_wait_start = machine_time_us();
+
 			rc = od_io_write_start(relay->dst);
 			if (rc == -1)
 				return relay->error_write;
 		}
 	}
 
-	return OD_OK;
+	if (relay->read_budget > 0 && relay->read_count >= relay->read_budget) {
+		relay->read_count = 0;
+		od_trace1(relay__yield, relay);
+		machine_sleep(0);
+	}
+
+	return od_relay_backpressure(relay);
 }
 
 static inline od_status_t
@@ -407,15 +927,16 @@ od_relay_flush(od_relay_t *relay)
 	if (relay->dst == NULL)
 		return OD_OK;
 
-	if (! machine_iov_pending(relay->iov))
+	if (! od_relay_write_pending(relay))
 		return OD_OK;
+	od_trace1(relay__flush, relay);
 
 	int rc;
 	rc = od_relay_write(relay);
 	if (rc != OD_OK)
 		return rc;
 
-	if (! machine_iov_pending(relay->iov))
+	if (! od_relay_write_pending(relay))
 		return OD_OK;
 
 	rc = od_io_write_start(relay->dst);
@@ -424,7 +945,7 @@ od_relay_flush(od_relay_t *relay)
 
 	for (;;)
 	{
-		if (! machine_iov_pending(relay->iov))
+		if (! od_relay_write_pending(relay))
 			break;
 
 		machine_cond_wait(relay->dst->on_write, UINT32_MAX);
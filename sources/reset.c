@@ -18,11 +18,130 @@
 #include <kiwi.h>
 #include <odyssey.h>
 
+static inline int
+od_reset_find(char *pos, char *end, char *word, int len)
+{
+	/* case insensitive search of a lower case word */
+	for (; end - pos >= len; pos++) {
+		int i = 0;
+		while (i < len && (pos[i] | 0x20) == word[i])
+			i++;
+		if (i == len)
+			return 1;
+	}
+	return 0;
+}
+
+void
+od_reset_track(od_server_t *server, char *query, uint32_t query_len)
+{
+	/* query is a single statement, maybe ended by ';' */
+	char *end = query + query_len;
+	while (end > query && (end[-1] == 0 || end[-1] == ';' ||
+	                       kiwi_query_is_space(end[-1])))
+		end--;
+	if (memchr(query, ';', end - query)) {
+		server->is_dirty |= OD_RESET_ALL;
+		return;
+	}
+
+	int state = 0;
+	switch (kiwi_query_classify(query, end - query)) {
+	case KIWI_QUERY_SELECT:
+	case KIWI_QUERY_INSERT:
+	case KIWI_QUERY_UPDATE:
+	case KIWI_QUERY_DELETE:
+	case KIWI_QUERY_WITH:
+	case KIWI_QUERY_VALUES:
+	case KIWI_QUERY_COPY:
+		/* functions changing the session and SELECT INTO TEMP */
+		if (od_reset_find(query, end, "advisory", 8))
+			state |= OD_RESET_ADVISORY;
+		if (od_reset_find(query, end, "set_config", 10))
+			state |= OD_RESET_SET;
+		if (od_reset_find(query, end, "temp", 4))
+			state |= OD_RESET_TEMP;
+		break;
+	case KIWI_QUERY_SHOW:
+	case KIWI_QUERY_BEGIN:
+	case KIWI_QUERY_START:
+	case KIWI_QUERY_COMMIT:
+	case KIWI_QUERY_END:
+	case KIWI_QUERY_ROLLBACK:
+	case KIWI_QUERY_ABORT:
+	case KIWI_QUERY_SAVEPOINT:
+	case KIWI_QUERY_RELEASE:
+	case KIWI_QUERY_EXECUTE:
+	case KIWI_QUERY_NOTIFY:
+	case KIWI_QUERY_DISCARD:
+		break;
+	case KIWI_QUERY_SET:
+	case KIWI_QUERY_RESET:
+		state = OD_RESET_SET;
+		break;
+	case KIWI_QUERY_PREPARE:
+	case KIWI_QUERY_DEALLOCATE:
+		state = OD_RESET_PREPARE;
+		break;
+	case KIWI_QUERY_LISTEN:
+	case KIWI_QUERY_UNLISTEN:
+		state = OD_RESET_LISTEN;
+		break;
+	case KIWI_QUERY_CREATE:
+		/* other objects outlive the session */
+		if (od_reset_find(query, end, "temp", 4))
+			state = OD_RESET_TEMP;
+		break;
+	case KIWI_QUERY_DECLARE:
+		/* cursors without hold are closed by the transaction end */
+		if (od_reset_find(query, end, "hold", 4))
+			state = OD_RESET_HOLD;
+		break;
+	default:
+		state = OD_RESET_ALL;
+		break;
+	}
+	server->is_dirty |= state;
+}
+
+static inline machine_msg_t*
+od_reset_query(machine_msg_t *msg, char *query, int *count)
+{
+	/* every query is replied by its own ReadyForQuery */
+	machine_msg_t *batch;
+	batch = kiwi_fe_write_query(msg, query, strlen(query) + 1);
+	if (batch == NULL) {
+		if (msg)
+			machine_msg_free(msg);
+		return NULL;
+	}
+	(*count)++;
+	return batch;
+}
+
 int
 od_reset(od_server_t *server)
 {
 	od_instance_t *instance = server->global->instance;
 	od_route_t *route = server->route;
+	od_trace1(reset__start, server->id.id_a);
+	if (server->client)
+		od_client_wait(server->client, OD_CLIENT_WAIT_RESET);
+
+	/* storage host role has changed, for example after failover */
+	if (server->endpoint != -1 &&
+	    ! od_rules_storage_endpoint_usable(od_route_storage(route), server->endpoint)) {
+		od_log(&instance->logger, "reset", server->client, server,
+		       "storage host is not suitable anymore, closing");
+		goto drop;
+	}
+
+	/* state of passthrough session is unknown */
+	if (server->is_passthrough) {
+		od_log(&instance->logger, "reset", server->client, server,
+		       "passthrough session, closing");
+		goto drop;
+	}
 
 	/* server left in copy mode */
 	if (server->is_copy) {
@@ -31,6 +150,13 @@ od_reset(od_server_t *server)
 		goto drop;
 	}
 
+	/* extended query batch is not finished by Sync */
+	if (server->sync_pending) {
+		od_log(&instance->logger, "reset", server->client, server,
+		       "in extended query batch, closing");
+		goto drop;
+	}
+
 	/* support route rollback off */
 	if (! route->rule->pool_rollback) {
 		if (server->is_transaction) {
@@ -100,7 +226,8 @@ od_reset(od_server_t *server)
 			       wait_try_cancel);
 			wait_try_cancel++;
 			rc = od_cancel(server->global,
-			               route->rule->storage, &server->key,
+			               od_route_storage(route), server->endpoint,
+			               &server->key,
 			               &server->id);
 			if (rc == -1)
 				goto error;
@@ -112,32 +239,106 @@ od_reset(od_server_t *server)
 	od_debug(&instance->logger, "reset", server->client, server,
 	         "synchronized");
 
+	/* replies to the statement messages are consumed by the wait,
+	 * server statements can not be tracked anymore */
+	if (od_prepared_server_pending(&server->prepared) > 0) {
+		od_log(&instance->logger, "reset", server->client, server,
+		       "prepared statements replies are lost, closing");
+		goto drop;
+	}
+
 	/* send rollback in case server has an active
-	 * transaction running */
+	 * transaction running and DISCARD ALL in a single
+	 * round trip */
+	machine_msg_t *msg = NULL;
+	int count = 0;
 	if (route->rule->pool_rollback) {
 		if (server->is_transaction) {
-			char query_rlb[] = "ROLLBACK";
-			rc = od_backend_query(server, "reset-rollback", query_rlb,
-			                      sizeof(query_rlb), wait_timeout);
-			if (rc == -1)
+			msg = od_reset_query(msg, "ROLLBACK", &count);
+			if (msg == NULL)
 				goto error;
-			assert(! server->is_transaction);
 		}
 	}
 
-	/* send DISCARD ALL */
+	/* skip DISCARD ALL if server is not used since the last one,
+	 * tracked state is reset by the narrower queries */
+	int discard = 0;
 	if (route->rule->pool_discard) {
-		char query_discard[] = "DISCARD ALL";
-		rc = od_backend_query(server, "reset-discard", query_discard,
-		                      sizeof(query_discard), wait_timeout);
+		discard = server->is_dirty;
+		if (! route->rule->pool_discard_track && discard)
+			discard = OD_RESET_ALL;
+	}
+	if (discard & OD_RESET_ALL) {
+		discard = OD_RESET_ALL;
+		msg = od_reset_query(msg, "DISCARD ALL", &count);
+		if (msg == NULL)
+			goto error;
+	}
+	if (discard & OD_RESET_HOLD) {
+		msg = od_reset_query(msg, "CLOSE ALL", &count);
+		if (msg == NULL)
+			goto error;
+	}
+	if (discard & OD_RESET_SET) {
+		msg = od_reset_query(msg, "SET SESSION AUTHORIZATION DEFAULT", &count);
+		if (msg == NULL)
+			goto error;
+		msg = od_reset_query(msg, "RESET ALL", &count);
+		if (msg == NULL)
+			goto error;
+	}
+	if (discard & OD_RESET_PREPARE) {
+		msg = od_reset_query(msg, "DEALLOCATE ALL", &count);
+		if (msg == NULL)
+			goto error;
+	}
+	if (discard & OD_RESET_LISTEN) {
+		msg = od_reset_query(msg, "UNLISTEN *", &count);
+		if (msg == NULL)
+			goto error;
+	}
+	if (discard & OD_RESET_ADVISORY) {
+		msg = od_reset_query(msg, "SELECT pg_advisory_unlock_all()", &count);
+		if (msg == NULL)
+			goto error;
+	}
+	if (discard & OD_RESET_TEMP) {
+		msg = od_reset_query(msg, "DISCARD TEMP", &count);
+		if (msg == NULL)
+			goto error;
+	}
+
+	if (count > 0) {
+		rc = od_write(&server->io, msg);
+		if (rc == -1) {
+			od_error(&instance->logger, "reset", server->client, server,
+			         "write error: %s",
+			         od_io_error(&server->io));
+			goto error;
+		}
+		od_server_sync_request(server, count);
+		rc = od_backend_ready_wait(server, "reset", count, wait_timeout);
 		if (rc == -1)
 			goto error;
+		assert(! server->is_transaction);
+		if (discard & (OD_RESET_ALL|OD_RESET_SET)) {
+			/* extra parameters are not reported on reset */
+			kiwi_vars_extra_reset(&server->vars);
+			server->deploy_hash = 0;
+		}
+		if (discard & (OD_RESET_ALL|OD_RESET_PREPARE))
+			od_prepared_server_reset(&server->prepared);
+		if (discard)
+			server->is_dirty = 0;
 	}
 
 	/* ready */
+	od_trace2(reset__done, server->id.id_a, 1);
 	return  1;
 drop:
+	od_trace2(reset__done, server->id.id_a, 0);
 	return  0;
 error:
+	od_trace2(reset__done, server->id.id_a, -1);
 	return -1;
 }
@@ -7,6 +7,23 @@
  * Scalable PostgreSQL connection pooler.
 */
 
-int od_reset(od_server_t*);
+/* Session state a client may leave on the server, kept in
+ * is_dirty of the server. With pool_discard_track queries are
+ * classified by their leading keyword and only the state they may
+ * leave is reset, anything else asks for DISCARD ALL. */
+
+typedef enum
+{
+	OD_RESET_ALL      = 1 << 0,
+	OD_RESET_SET      = 1 << 1,
+	OD_RESET_PREPARE  = 1 << 2,
+	OD_RESET_LISTEN   = 1 << 3,
+	OD_RESET_TEMP     = 1 << 4,
+	OD_RESET_ADVISORY = 1 << 5,
+	OD_RESET_HOLD     = 1 << 6
+} od_reset_state_t;
+
+int  od_reset(od_server_t*);
+void od_reset_track(od_server_t*, char*, uint32_t);
 
 #endif /* ODYSSEY_RESET_H */
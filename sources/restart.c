@@ -0,0 +1,386 @@
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+/* Online restart.
+ *
+ * The running process listens on online_restart_socket. New process
+ * connects to it on start and receives all listen sockets of the old
+ * one by SCM_RIGHTS, uses them instead of binding its own and replies
+ * with one byte when it is ready to accept. The old process then stops
+ * accepting and disconnects its clients as soon as they are idle, so no
+ * connection attempt is refused during the upgrade.
+*/
+
+static inline int
+od_restart_sockaddr_init(struct sockaddr_un *sa, char *path)
+{
+	memset(sa, 0, sizeof(*sa));
+	sa->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sa->sun_path))
+		return -1;
+	strcpy(sa->sun_path, path);
+	return 0;
+}
+
+int
+od_restart_receive(od_global_t *global)
+{
+	od_instance_t *instance = global->instance;
+	od_system_t *system = global->system;
+	od_restart_t *restart = &system->restart;
+	char *path = instance->config.online_restart_socket;
+	if (path == NULL)
+		return 0;
+
+	struct sockaddr_un sa;
+	int rc;
+	rc = od_restart_sockaddr_init(&sa, path);
+	if (rc == -1) {
+		od_error(&instance->logger, "restart", NULL, NULL,
+		         "online_restart_socket path is too long");
+		return -1;
+	}
+
+	int fd;
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+	rc = connect(fd, (struct sockaddr*)&sa, sizeof(sa));
+	if (rc == -1) {
+		/* no running process, bind as usual */
+		close(fd);
+		return 0;
+	}
+
+	struct timeval tv = { OD_RESTART_TIMEOUT / 1000, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	char byte;
+	struct iovec iov = { &byte, 1 };
+	char control[CMSG_SPACE(sizeof(int) * OD_RESTART_FDS_MAX)];
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov        = &iov;
+	msg.msg_iovlen     = 1;
+	msg.msg_control    = control;
+	msg.msg_controllen = sizeof(control);
+	rc = recvmsg(fd, &msg, 0);
+	if (rc <= 0) {
+		od_error(&instance->logger, "restart", NULL, NULL,
+		         "failed to receive listen sockets from '%s': %s",
+		         path, rc == 0 ? "connection closed" : strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	struct cmsghdr *cmsg;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		if (count > OD_RESTART_FDS_MAX - restart->fds_count)
+			count = OD_RESTART_FDS_MAX - restart->fds_count;
+		memcpy(restart->fds + restart->fds_count, CMSG_DATA(cmsg),
+		       sizeof(int) * count);
+		restart->fds_count += count;
+	}
+	restart->conn = fd;
+
+	od_log(&instance->logger, "restart", NULL, NULL,
+	       "received %d listen sockets from the running process",
+	       restart->fds_count);
+	return restart->fds_count;
+}
+
+static inline int
+od_restart_match(int fd, struct sockaddr *sa)
+{
+	struct sockaddr_storage ss;
+	socklen_t ss_len = sizeof(ss);
+	int rc;
+	rc = getsockname(fd, (struct sockaddr*)&ss, &ss_len);
+	if (rc == -1)
+		return 0;
+	if (ss.ss_family != sa->sa_family)
+		return 0;
+	switch (sa->sa_family) {
+	case AF_INET: {
+		struct sockaddr_in *a = (struct sockaddr_in*)&ss;
+		struct sockaddr_in *b = (struct sockaddr_in*)sa;
+		return a->sin_port == b->sin_port &&
+		       a->sin_addr.s_addr == b->sin_addr.s_addr;
+	}
+	case AF_INET6: {
+		struct sockaddr_in6 *a = (struct sockaddr_in6*)&ss;
+		struct sockaddr_in6 *b = (struct sockaddr_in6*)sa;
+		return a->sin6_port == b->sin6_port &&
+		       memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr)) == 0;
+	}
+	case AF_UNIX: {
+		struct sockaddr_un *a = (struct sockaddr_un*)&ss;
+		struct sockaddr_un *b = (struct sockaddr_un*)sa;
+		return strcmp(a->sun_path, b->sun_path) == 0;
+	}
+	}
+	return 0;
+}
+
+int
+od_restart_take(od_restart_t *restart, struct sockaddr *sa)
+{
+	int i;
+	for (i = 0; i < restart->fds_count; i++) {
+		int fd = restart->fds[i];
+		if (fd == -1)
+			continue;
+		if (! od_restart_match(fd, sa))
+			continue;
+		restart->fds[i] = -1;
+		return fd;
+	}
+	return -1;
+}
+
+void
+od_restart_done(od_global_t *global)
+{
+	od_instance_t *instance = global->instance;
+	od_system_t *system = global->system;
+	od_restart_t *restart = &system->restart;
+	if (restart->conn == -1)
+		return;
+
+	/* listen addresses removed from the configuration */
+	int unused = 0;
+	int i;
+	for (i = 0; i < restart->fds_count; i++) {
+		if (restart->fds[i] == -1)
+			continue;
+		close(restart->fds[i]);
+		restart->fds[i] = -1;
+		unused++;
+	}
+	if (unused > 0)
+		od_log(&instance->logger, "restart", NULL, NULL,
+		       "closed %d inherited sockets not used by the configuration",
+		       unused);
+
+	/* let the running process stop accepting */
+	char byte = 1;
+	int rc;
+	rc = write(restart->conn, &byte, 1);
+	if (rc != 1)
+		od_error(&instance->logger, "restart", NULL, NULL,
+		         "failed to notify the running process: %s",
+		         strerror(errno));
+	close(restart->conn);
+	restart->conn = -1;
+	restart->fds_count = 0;
+}
+
+static inline int
+od_restart_send(od_global_t *global, machine_io_t *io)
+{
+	od_instance_t *instance = global->instance;
+	od_system_t *system = global->system;
+
+	int fds[OD_RESTART_FDS_MAX];
+	int fds_count = 0;
+	od_list_t *i;
+	od_list_foreach(&system->servers, i) {
+		od_system_server_t *server;
+		server = od_container_of(i, od_system_server_t, link);
+		if (fds_count == OD_RESTART_FDS_MAX)
+			break;
+		fds[fds_count++] = machine_fd(server->io);
+	}
+	od_metrics_t *metrics = global->metrics;
+	if (od_metrics_enabled(metrics) && fds_count < OD_RESTART_FDS_MAX)
+		fds[fds_count++] = machine_fd(metrics->io);
+
+	char byte = 0;
+	struct iovec iov = { &byte, 1 };
+	char control[CMSG_SPACE(sizeof(int) * OD_RESTART_FDS_MAX)];
+	memset(control, 0, sizeof(control));
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov        = &iov;
+	msg.msg_iovlen     = 1;
+	msg.msg_control    = control;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds_count);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type  = SCM_RIGHTS;
+	cmsg->cmsg_len   = CMSG_LEN(sizeof(int) * fds_count);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fds_count);
+
+	int rc;
+	rc = sendmsg(machine_fd(io), &msg, MSG_NOSIGNAL);
+	if (rc != 1) {
+		od_error(&instance->logger, "restart", NULL, NULL,
+		         "failed to pass listen sockets: %s", strerror(errno));
+		return -1;
+	}
+	od_log(&instance->logger, "restart", NULL, NULL,
+	       "passed %d listen sockets to the new process", fds_count);
+
+	/* wait for the new process to start accepting */
+	machine_msg_t *reply;
+	reply = machine_read(io, 1, OD_RESTART_TIMEOUT);
+	if (reply == NULL) {
+		od_error(&instance->logger, "restart", NULL, NULL,
+		         "new process has not started: %s",
+		         machine_error(io));
+		return -1;
+	}
+	machine_msg_free(reply);
+	return 0;
+}
+
+static inline int
+od_restart_drain_cb(od_client_t *client, void **argv)
+{
+	(void)argv;
+	od_client_restart(client);
+	return 0;
+}
+
+static inline int
+od_restart_drain_route_cb(od_route_t *route, void **argv)
+{
+	(void)argv;
+	od_route_lock(route, OD_LOCK_OTHER);
+	od_client_pool_foreach(&route->client_pool, OD_CLIENT_ACTIVE,
+	                       od_restart_drain_cb, NULL);
+	od_client_pool_foreach(&route->client_pool, OD_CLIENT_PENDING,
+	                       od_restart_drain_cb, NULL);
+	od_client_pool_foreach(&route->client_pool, OD_CLIENT_QUEUE,
+	                       od_restart_drain_cb, NULL);
+	od_route_unlock(route);
+	return 0;
+}
+
+static inline void
+od_restart_drain(od_global_t *global)
+{
+	od_instance_t *instance = global->instance;
+	od_router_t *router = global->router;
+	for (;;) {
+		uint32_t clients;
+		clients = od_atomic_u32_of(&router->clients) +
+		          od_atomic_u32_of(&router->clients_routing);
+		if (clients == 0)
+			break;
+		/* clients which are not idle yet are asked again */
+		od_router_foreach(router, od_restart_drain_route_cb, NULL);
+		machine_sleep(1000);
+	}
+	od_log(&instance->logger, "restart", NULL, NULL,
+	       "all clients disconnected, shutting down");
+	od_system_cleanup(global->system);
+	exit(0);
+}
+
+static void
+od_restart_server(void *arg)
+{
+	od_global_t *global = arg;
+	od_instance_t *instance = global->instance;
+	od_system_t *system = global->system;
+	char *path = instance->config.online_restart_socket;
+
+	struct sockaddr_un sa;
+	int rc;
+	rc = od_restart_sockaddr_init(&sa, path);
+	if (rc == -1) {
+		od_error(&instance->logger, "restart", NULL, NULL,
+		         "online_restart_socket path is too long");
+		return;
+	}
+
+	machine_io_t *io;
+	io = machine_io_create();
+	if (io == NULL)
+		return;
+	unlink(path);
+	rc = machine_bind(io, (struct sockaddr*)&sa);
+	if (rc == -1) {
+		od_error(&instance->logger, "restart", NULL, NULL,
+		         "bind to '%s' failed: %s", path, machine_error(io));
+		machine_io_free(io);
+		return;
+	}
+	chmod(path, 0600);
+
+	for (;;)
+	{
+		machine_io_t *client_io;
+		rc = machine_accept(io, &client_io, 1, 1, UINT32_MAX);
+		if (rc == -1) {
+			od_error(&instance->logger, "restart", NULL, NULL,
+			         "accept failed: %s", machine_error(io));
+			if (machine_errno() == EADDRINUSE)
+				break;
+			continue;
+		}
+		od_log(&instance->logger, "restart", NULL, NULL,
+		       "online restart requested");
+		rc = od_restart_send(global, client_io);
+		machine_close(client_io);
+		machine_io_free(client_io);
+		if (rc == 0)
+			break;
+	}
+
+	/* socket file belongs to the new process now */
+	machine_close(io);
+	machine_io_free(io);
+	if (rc == -1)
+		return;
+
+	od_atomic_u32_inc(&system->restart.draining);
+	od_log(&instance->logger, "restart", NULL, NULL,
+	       "new process accepts connections, draining clients");
+	od_restart_drain(global);
+}
+
+int
+od_restart_start(od_global_t *global)
+{
+	od_instance_t *instance = global->instance;
+	if (instance->config.online_restart_socket == NULL)
+		return 0;
+	int64_t coroutine_id;
+	coroutine_id = machine_coroutine_create(od_restart_server, global);
+	if (coroutine_id == -1) {
+		od_error(&instance->logger, "restart", NULL, NULL,
+		         "failed to start online restart coroutine");
+		return -1;
+	}
+	return 0;
+}
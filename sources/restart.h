@@ -0,0 +1,45 @@
+#ifndef ODYSSEY_RESTART_H
+#define ODYSSEY_RESTART_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_restart od_restart_t;
+
+/* listen sockets passed to the new process */
+#define OD_RESTART_FDS_MAX 128
+
+/* time to wait for the new process to start listening */
+#define OD_RESTART_TIMEOUT 10000
+
+struct od_restart
+{
+	int             fds[OD_RESTART_FDS_MAX];
+	int             fds_count;
+	int             conn;
+	od_atomic_u32_t draining;
+};
+
+static inline void
+od_restart_init(od_restart_t *restart)
+{
+	restart->fds_count = 0;
+	restart->conn      = -1;
+	restart->draining  = 0;
+}
+
+static inline int
+od_restart_is_draining(od_restart_t *restart)
+{
+	return od_atomic_u32_of(&restart->draining) > 0;
+}
+
+int  od_restart_receive(od_global_t*);
+int  od_restart_take(od_restart_t*, struct sockaddr*);
+void od_restart_done(od_global_t*);
+int  od_restart_start(od_global_t*);
+
+#endif /* ODYSSEY_RESTART_H */
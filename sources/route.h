@@ -7,21 +7,103 @@
  * Scalable PostgreSQL connection pooler.
 */
 
-typedef struct od_route od_route_t;
+typedef struct od_route_waiter od_route_waiter_t;
+typedef struct od_route        od_route_t;
+
+/* client waiting for a server connection, lives on the
+ * waiting coroutine stack */
+struct od_route_waiter
+{
+	od_client_t       *client;
+	od_server_t       *server;
+	machine_channel_t *channel;
+	int                granted;
+	int                foreign;
+	int                batch;
+	uint64_t           time_start;
+	od_list_t          link;
+};
+
+/* Memory of route connections, updated by cron each stats interval.
+ * Client and server buffers are readahead buffers, packets are
+ * messages collected in full by relays. Pending is data waiting to
+ * be written, mostly pointing into readahead buffers, so it is not
+ * part of the total. */
+typedef struct
+{
+	uint64_t client_buffers;
+	uint64_t server_buffers;
+	uint64_t packets;
+	uint64_t pending;
+	uint64_t stats;
+} od_route_memory_t;
+
+/* ParameterStatus message of a cached server parameter within the
+ * route params block, type is set for parameters tracked in client
+ * vars, which are sent with client values instead */
+typedef struct
+{
+	kiwi_var_type_t type;
+	int             offset;
+	int             size;
+} od_route_param_t;
+
+static inline uint64_t
+od_route_memory_total(od_route_memory_t *memory)
+{
+	return memory->client_buffers + memory->server_buffers +
+	       memory->packets + memory->stats;
+}
 
 struct od_route
 {
 	od_rule_t          *rule;
 	od_route_id_t       id;
-	od_stat_t           stats;
+	od_stat_slot_t     *stats;
+	int                 stats_count;
 	od_stat_t           stats_prev;
-	int                 stats_mark;
+	od_stat_rates_t     rates;
+	od_atomic_u32_t     refs;
 	od_server_pool_t    server_pool;
 	od_client_pool_t    client_pool;
 	kiwi_params_lock_t  params;
-	machine_channel_t  *wait_bus;
+	char               *params_data;
+	int                 params_size;
+	od_route_param_t   *params_index;
+	int                 params_count;
+	od_list_t           waiters;
+	od_list_t           waiters_batch;
+	int                 count_waiters;
+	int                 count_waiters_batch;
+	int                 batch_skip;
+	int                 count_waiters_max;
+	int                 count_waiters_peak;
+	uint64_t            codel_min;
+	uint64_t            codel_time;
+	int                 codel_overload;
 	pthread_mutex_t     lock;
+	od_lock_site_t      lock_site;
+	uint64_t            lock_time;
+	uint32_t            hash;
+	int                 foreign_waiters;
+	int                 count_replace;
+	int                 paused;
+	int                 pool_limit;
+	int                 pool_slow_start;
+	double              pool_latency;
+	uint64_t            pool_count;
+	uint64_t            pool_time;
+	od_atomic_u64_t     log_query_count;
+	od_atomic_u64_t     log_query_tokens;
+	od_atomic_u64_t     log_query_time;
+	od_atomic_u64_t     pool_rate_tokens;
+	od_atomic_u64_t     pool_rate_time;
+	od_list_t           pipelines;
+	od_listen_t         listen;
+	od_walrelay_t       walrelay;
+	od_route_memory_t   memory;
 	od_list_t           link;
+	od_list_t           link_gc;
 };
 
 static inline void
@@ -31,13 +113,49 @@ od_route_init(od_route_t *route)
 	od_route_id_init(&route->id);
 	od_server_pool_init(&route->server_pool);
 	od_client_pool_init(&route->client_pool);
-	route->stats_mark = 0;
-	od_stat_init(&route->stats);
+	route->refs = 0;
+	route->stats = NULL;
+	route->stats_count = 0;
 	od_stat_init(&route->stats_prev);
+	od_stat_rates_init(&route->rates);
 	kiwi_params_lock_init(&route->params);
+	route->params_data = NULL;
+	route->params_size = 0;
+	route->params_index = NULL;
+	route->params_count = 0;
 	od_list_init(&route->link);
-	route->wait_bus = NULL;
+	od_list_init(&route->link_gc);
+	route->hash = 0;
+	route->foreign_waiters = 0;
+	route->count_replace = 0;
+	route->paused = 0;
+	route->pool_limit = 0;
+	route->pool_slow_start = 1;
+	route->pool_latency = 0;
+	route->pool_count = 0;
+	route->pool_time = 0;
+	route->count_waiters = 0;
+	route->count_waiters_batch = 0;
+	route->batch_skip = 0;
+	route->count_waiters_max = 0;
+	route->count_waiters_peak = 0;
+	route->codel_min = UINT64_MAX;
+	route->codel_time = 0;
+	route->codel_overload = 0;
+	route->log_query_count = 0;
+	route->log_query_tokens = 0;
+	route->log_query_time = 0;
+	route->pool_rate_tokens = 0;
+	route->pool_rate_time = 0;
+	memset(&route->memory, 0, sizeof(route->memory));
+	od_list_init(&route->waiters);
+	od_list_init(&route->waiters_batch);
+	od_list_init(&route->pipelines);
+	od_listen_init(&route->listen);
+	od_walrelay_init(&route->walrelay);
 	pthread_mutex_init(&route->lock, NULL);
+	route->lock_site = OD_LOCK_OTHER;
+	route->lock_time = 0;
 }
 
 static inline void
@@ -46,86 +164,200 @@ od_route_free(od_route_t *route)
 	od_route_id_free(&route->id);
 	od_server_pool_free(&route->server_pool);
 	kiwi_params_lock_free(&route->params);
-	if (route->wait_bus)
-		machine_channel_free(route->wait_bus);
-	if (route->stats.transaction_hgram)
-	    free(route->stats.transaction_hgram);
-	if (route->stats.query_hgram)
-	    free(route->stats.query_hgram);
+	if (route->params_data)
+		free(route->params_data);
+	if (route->params_index)
+		free(route->params_index);
+	if (route->stats) {
+		int i;
+		for (i = 0; i < route->stats_count; i++)
+			od_stat_free(&route->stats[i].stat);
+		free(route->stats);
+	}
+	od_stat_free(&route->stats_prev);
+	od_listen_free(&route->listen);
+	od_walrelay_free(&route->walrelay);
 	pthread_mutex_destroy(&route->lock);
 	free(route);
 }
 
+static inline int
+od_route_params_prepare(od_route_t *route, kiwi_vars_t *vars)
+{
+	/* encode ParameterStatus messages of cached server parameters
+	 * once, route params are set only once */
+	pthread_mutex_lock(&route->params.lock);
+	if (route->params_data || route->params.params.count == 0) {
+		pthread_mutex_unlock(&route->params.lock);
+		return 0;
+	}
+	int count = route->params.params.count;
+	od_route_param_t *index;
+	index = malloc(sizeof(od_route_param_t) * count);
+	if (index == NULL) {
+		pthread_mutex_unlock(&route->params.lock);
+		return -1;
+	}
+	machine_msg_t *msg = NULL;
+	kiwi_param_t *param = route->params.params.list;
+	int i = 0;
+	for (; param && i < count; param = param->next, i++) {
+		index[i].type   = kiwi_vars_find(vars, kiwi_param_name(param),
+		                                 param->name_len);
+		index[i].offset = msg ? machine_msg_size(msg) : 0;
+		msg = kiwi_be_write_parameter_status(msg, kiwi_param_name(param),
+		                                     param->name_len,
+		                                     kiwi_param_value(param),
+		                                     param->value_len);
+		if (msg == NULL) {
+			free(index);
+			pthread_mutex_unlock(&route->params.lock);
+			return -1;
+		}
+		index[i].size = machine_msg_size(msg) - index[i].offset;
+	}
+	char *data = malloc(machine_msg_size(msg));
+	if (data == NULL) {
+		machine_msg_free(msg);
+		free(index);
+		pthread_mutex_unlock(&route->params.lock);
+		return -1;
+	}
+	memcpy(data, machine_msg_data(msg), machine_msg_size(msg));
+	route->params_size  = machine_msg_size(msg);
+	route->params_index = index;
+	route->params_count = i;
+	route->params_data  = data;
+	machine_msg_free(msg);
+	pthread_mutex_unlock(&route->params.lock);
+	return 0;
+}
+
 static inline od_route_t*
-od_route_allocate(int is_shared)
+od_route_allocate(int workers)
 {
 	od_route_t *route = malloc(sizeof(*route));
 	if (route == NULL)
 		return NULL;
 	od_route_init(route);
-	route->wait_bus = machine_channel_create(is_shared);
-	if (route->wait_bus == NULL) {
+	int rc;
+	rc = od_server_pool_prepare(&route->server_pool, workers);
+	if (rc == -1) {
+		od_route_free(route);
+		return NULL;
+	}
+	/* stats slot per worker */
+	void *stats;
+	rc = posix_memalign(&stats, OD_STAT_CACHELINE,
+	                    sizeof(od_stat_slot_t) * workers);
+	if (rc != 0) {
 		od_route_free(route);
 		return NULL;
 	}
+	route->stats = stats;
+	route->stats_count = workers;
+	int i;
+	for (i = 0; i < workers; i++)
+		od_stat_init(&route->stats[i].stat);
 	return route;
 }
 
-static inline void
-od_route_lock(od_route_t *route)
+static inline od_stat_t*
+od_route_stat(od_route_t *route, int worker_id)
 {
-	pthread_mutex_lock(&route->lock);
+	if (worker_id < 0)
+		worker_id = 0;
+	return &route->stats[worker_id % route->stats_count].stat;
 }
 
-static inline void
-od_route_unlock(od_route_t *route)
+static inline int
+od_route_stat_hgram_prepare(od_route_t *route, int precision)
 {
-	pthread_mutex_unlock(&route->lock);
+	/* histograms of every worker and the counters seen by the
+	 * previous stats update */
+	int rc;
+	rc = od_stat_hgram_prepare(&route->stats_prev, precision);
+	if (rc == -1)
+		return -1;
+	int i;
+	for (i = 0; i < route->stats_count; i++) {
+		rc = od_stat_hgram_prepare(&route->stats[i].stat, precision);
+		if (rc == -1)
+			return -1;
+	}
+	return 0;
 }
 
-static inline int
-od_route_is_dynamic(od_route_t *route)
+static inline od_hgram_frozen_t*
+od_route_stat_hgram(od_route_t *route, size_t offset, int prev_update)
 {
-	return route->rule->db_is_default || route->rule->user_is_default;
+	/* merge histograms of all workers into the histogram of
+	 * the interval since the previous update, offset selects
+	 * the histogram within od_stat_t */
+	od_hgram_t *prev = od_stat_hgram_of(&route->stats_prev, offset);
+	od_hgram_frozen_t *frozen;
+	frozen = od_hgram_allocate(prev->precision);
+	if (frozen == NULL)
+		return NULL;
+	int i;
+	for (i = 0; i < route->stats_count; i++) {
+		od_stat_t *stat = &route->stats[i].stat;
+		od_hgram_merge(frozen, od_stat_hgram_of(stat, offset));
+	}
+	od_hgram_freeze(frozen, prev, prev_update);
+	return frozen;
 }
 
-static inline int
-od_route_match_compare_client_cb(od_client_t *client, void **argv)
+static inline void
+od_route_stat_sum(od_route_t *route, od_stat_t *sum)
 {
-	return od_id_cmp(&client->id, argv[0]);
+	int i;
+	for (i = 0; i < route->stats_count; i++)
+		od_stat_sum(sum, &route->stats[i].stat);
 }
 
-static inline od_client_t*
-od_route_match_client(od_route_t *route, od_id_t *id)
+static inline void
+od_route_lock(od_route_t *route, od_lock_site_t site)
 {
-	void *argv[] = { id };
-	od_client_t *match;
-	match = od_client_pool_foreach(&route->client_pool, OD_CLIENT_ACTIVE,
-	                               od_route_match_compare_client_cb,
-	                               argv);
-	if (match)
-		return match;
-	match = od_client_pool_foreach(&route->client_pool, OD_CLIENT_QUEUE,
-	                               od_route_match_compare_client_cb,
-	                               argv);
-	if (match)
-		return match;
-	match = od_client_pool_foreach(&route->client_pool, OD_CLIENT_PENDING,
-	                               od_route_match_compare_client_cb,
-	                               argv);
-	if (match)
-		return match;
-
-	return NULL;
+	if (od_likely(! od_lockstat.enabled)) {
+		pthread_mutex_lock(&route->lock);
+		return;
+	}
+	uint64_t start = od_lockstat_now();
+	pthread_mutex_lock(&route->lock);
+	uint64_t now = od_lockstat_now();
+	od_lockstat_wait(OD_LOCKSTAT_ROUTE, site, start, now);
+	route->lock_site = site;
+	route->lock_time = now;
 }
 
 static inline void
-od_route_kill_client(od_route_t *route, od_id_t *id)
+od_route_unlock(od_route_t *route)
+{
+	if (od_unlikely(od_lockstat.enabled) && route->lock_time) {
+		od_lockstat_hold(OD_LOCKSTAT_ROUTE, route->lock_site,
+		                 route->lock_time);
+		route->lock_time = 0;
+	}
+	pthread_mutex_unlock(&route->lock);
+}
+
+static inline od_rule_storage_t*
+od_route_storage(od_route_t *route)
+{
+	/* read-only routes connect to storage_read of the rule */
+	if (route->id.read_only)
+		return route->rule->storage_read;
+	/* sharded routes connect to the shard picked by router */
+	if (route->rule->storage_shards)
+		return route->rule->storage_shards[route->id.shard];
+	return route->rule->storage;
+}
+
+static inline int
+od_route_is_dynamic(od_route_t *route)
 {
-	od_client_t *client;
-	client = od_route_match_client(route, id);
-	if (client)
-		od_client_kill(client);
+	return route->rule->db_is_default || route->rule->user_is_default;
 }
 
 static inline int
@@ -147,11 +379,36 @@ od_route_kill_client_pool(od_route_t *route)
 	                       od_route_kill_cb, NULL);
 }
 
+static inline void
+od_route_waiter_init(od_route_waiter_t *waiter, od_client_t *client)
+{
+	waiter->client     = client;
+	waiter->server     = NULL;
+	waiter->channel    = client->wait_channel;
+	waiter->granted    = 0;
+	waiter->foreign    = 0;
+	waiter->batch      = 0;
+	waiter->time_start = 0;
+	od_list_init(&waiter->link);
+}
+
 static inline int
-od_route_wait(od_route_t *route, uint32_t time_ms)
+od_route_waiter_grant(od_route_waiter_t *waiter)
 {
 	machine_msg_t *msg;
-	msg = machine_channel_read(route->wait_bus, time_ms);
+	msg = machine_msg_create(0);
+	if (msg == NULL)
+		return -1;
+	waiter->granted = 1;
+	machine_channel_write(waiter->channel, msg);
+	return 0;
+}
+
+static inline int
+od_route_waiter_wait(od_route_waiter_t *waiter, uint32_t time_ms)
+{
+	machine_msg_t *msg;
+	msg = machine_channel_read(waiter->channel, time_ms);
 	if (msg) {
 		machine_msg_free(msg);
 		return 0;
@@ -159,15 +416,346 @@ od_route_wait(od_route_t *route, uint32_t time_ms)
 	return -1;
 }
 
+static inline void
+od_route_enqueue(od_route_t *route, od_route_waiter_t *waiter)
+{
+	/* woken up waiter which did not get a server keeps its place
+	 * in the queue of its class */
+	od_list_t *queue = &route->waiters;
+	if (waiter->batch) {
+		queue = &route->waiters_batch;
+		route->count_waiters_batch++;
+	}
+	if (waiter->time_start == 0) {
+		waiter->time_start = machine_time_us();
+		od_list_append(queue, &waiter->link);
+	} else {
+		od_list_push(queue, &waiter->link);
+	}
+	route->count_waiters++;
+	if (route->count_waiters > route->count_waiters_max)
+		route->count_waiters_max = route->count_waiters;
+	if (waiter->foreign)
+		route->foreign_waiters++;
+}
+
+static inline void
+od_route_dequeue(od_route_t *route, od_route_waiter_t *waiter)
+{
+	od_list_unlink(&waiter->link);
+	od_list_init(&waiter->link);
+	route->count_waiters--;
+	if (waiter->batch)
+		route->count_waiters_batch--;
+	if (waiter->foreign)
+		route->foreign_waiters--;
+}
+
+static inline od_route_waiter_t*
+od_route_next_waiter(od_route_t *route)
+{
+	/* interactive waiters are served first, but a batch waiter is
+	 * served after every pool_batch_weight interactive ones */
+	if (route->count_waiters == 0)
+		return NULL;
+	od_list_t *queue = &route->waiters;
+	if (route->count_waiters_batch == route->count_waiters ||
+	    (route->count_waiters_batch > 0 &&
+	     route->batch_skip >= route->rule->pool_batch_weight))
+		queue = &route->waiters_batch;
+	return od_container_of(queue->next, od_route_waiter_t, link);
+}
+
+static inline void
+od_route_codel(od_route_t *route, uint64_t time_start)
+{
+	/* CoDel state of the wait queue, route must be locked: the queue
+	 * is overloaded while the shortest wait of each interval stays
+	 * above pool_codel_target, clients which did not queue have
+	 * no start time */
+	od_rule_t *rule = route->rule;
+	if (! rule->pool_codel_target)
+		return;
+	uint64_t now = machine_time_us();
+	uint64_t wait_time = 0;
+	if (time_start && now > time_start)
+		wait_time = now - time_start;
+	if (wait_time < route->codel_min)
+		route->codel_min = wait_time;
+	if (now - route->codel_time < rule->pool_codel_interval * 1000ull)
+		return;
+	route->codel_overload = route->codel_min > rule->pool_codel_target * 1000ull;
+	route->codel_min = UINT64_MAX;
+	route->codel_time = now;
+}
+
+static inline uint64_t
+od_route_codel_deadline(od_route_t *route, od_route_waiter_t *waiter,
+                        uint64_t deadline)
+{
+	/* waiters of an overloaded queue are shed after the target
+	 * instead of pool_timeout, route must be locked */
+	if (! route->codel_overload)
+		return deadline;
+	uint64_t shed;
+	shed = waiter->time_start + route->rule->pool_codel_target * 1000ull;
+	if (deadline == 0 || shed < deadline)
+		return shed;
+	return deadline;
+}
+
+static inline void
+od_route_serve(od_route_t *route, od_route_waiter_t *waiter)
+{
+	/* waiter is given a server or a chance to connect */
+	od_route_dequeue(route, waiter);
+	od_route_codel(route, waiter->time_start);
+	if (waiter->batch)
+		route->batch_skip = 0;
+	else
+	if (route->count_waiters_batch > 0)
+		route->batch_skip++;
+}
+
 static inline int
 od_route_signal(od_route_t *route)
 {
-	machine_msg_t *msg;
-	msg = machine_msg_create(0);
-	if (msg == NULL)
+	/* wakeup the oldest waiter to retry, route must be locked */
+	od_route_waiter_t *waiter;
+	waiter = od_route_next_waiter(route);
+	if (waiter == NULL)
+		return 0;
+	/* waiter may leave as soon as it is granted */
+	od_route_serve(route, waiter);
+	int rc;
+	rc = od_route_waiter_grant(waiter);
+	if (rc == -1) {
+		od_route_enqueue(route, waiter);
 		return -1;
-	machine_channel_write(route->wait_bus, msg);
+	}
 	return 0;
 }
 
+static inline int
+od_route_pool_room(od_route_t *route)
+{
+	/* servers in use are bounded by the adaptive limit, route
+	 * must be locked */
+	if (! route->rule->pool_adaptive)
+		return 1;
+	return route->server_pool.count_active < route->pool_limit;
+}
+
+static inline void
+od_route_pool_adapt(od_route_t *route)
+{
+	/* run by cron each second with the average server time of the
+	 * queries of that second. Latency is compared with the lowest one
+	 * seen, which slowly follows latency measured without queueing,
+	 * when the pool is not saturated or is at its minimum, to forget
+	 * old minimums. While latency stays within 1.5 of it and clients
+	 * wait, the limit doubles until the first rise and grows by
+	 * sqrt(limit) from then on, a rise shrinks it in proportion */
+	od_rule_t *rule = route->rule;
+	od_stat_t stat;
+	od_stat_init(&stat);
+	od_route_stat_sum(route, &stat);
+	uint64_t count = 0;
+	uint64_t time = 0;
+	int i;
+	for (i = 0; i < OD_STAT_QUERY_MAX; i++) {
+		count += stat.type[i].count;
+		time  += stat.type[i].time[OD_STAT_PHASE_SERVER];
+	}
+	uint64_t count_diff = count - route->pool_count;
+	uint64_t time_diff  = time - route->pool_time;
+	route->pool_count = count;
+	route->pool_time  = time;
+	if (count_diff == 0 || time_diff == 0)
+		return;
+
+	od_route_lock(route, OD_LOCK_STAT);
+	int limit = route->pool_limit;
+	int min = rule->pool_min_size > 0 ? rule->pool_min_size : 1;
+	int demand = route->count_waiters > 0 ||
+	             route->server_pool.count_active >= limit;
+
+	double latency = (double)time_diff / count_diff;
+	if (route->pool_latency == 0 || latency < route->pool_latency)
+		route->pool_latency = latency;
+	else if (! demand || limit <= min)
+		route->pool_latency += (latency - route->pool_latency) / 16;
+	double gradient = 1.5 * route->pool_latency / latency;
+
+	if (gradient < 1.0) {
+		if (gradient < 0.5)
+			gradient = 0.5;
+		limit = limit * gradient;
+		route->pool_slow_start = 0;
+	} else if (demand) {
+		if (route->pool_slow_start) {
+			limit *= 2;
+		} else {
+			int queue = 1;
+			while ((queue + 1) * (queue + 1) <= limit)
+				queue++;
+			limit += queue;
+		}
+	}
+	if (limit < min)
+		limit = min;
+	if (limit > rule->pool_size)
+		limit = rule->pool_size;
+
+	/* waiters retry for the room added */
+	int room = limit - route->pool_limit;
+	route->pool_limit = limit;
+	for (; room > 0 && od_route_next_waiter(route); room--)
+		od_route_signal(route);
+	od_route_unlock(route);
+}
+
+static inline uint64_t
+od_route_max_wait(od_route_t *route)
+{
+	/* route must be locked */
+	uint64_t time_start = 0;
+	od_route_waiter_t *waiter;
+	if (! od_list_empty(&route->waiters)) {
+		waiter = od_container_of(route->waiters.next, od_route_waiter_t, link);
+		time_start = waiter->time_start;
+	}
+	if (! od_list_empty(&route->waiters_batch)) {
+		waiter = od_container_of(route->waiters_batch.next, od_route_waiter_t, link);
+		if (time_start == 0 || waiter->time_start < time_start)
+			time_start = waiter->time_start;
+	}
+	if (time_start == 0)
+		return 0;
+	uint64_t now = machine_time_us();
+	if (now <= time_start)
+		return 0;
+	return now - time_start;
+}
+
+static inline int
+od_route_take(od_atomic_u64_t *bucket, od_atomic_u64_t *bucket_time,
+              uint64_t rate)
+{
+	/* token bucket of rate tokens refilled every second,
+	 * shared by all workers */
+	uint64_t now  = machine_time_us();
+	uint64_t last = od_atomic_u64_of(bucket_time);
+	uint64_t refill = 0;
+	if (now > last)
+		refill = (now - last) * rate / 1000000;
+	if (refill > 0) {
+		uint64_t time = last + refill * 1000000 / rate;
+		if (refill > rate || last == 0)
+			time = now;
+		if (__sync_bool_compare_and_swap(bucket_time, last, time)) {
+			uint64_t tokens;
+			do {
+				tokens = od_atomic_u64_of(bucket);
+			} while (! __sync_bool_compare_and_swap(bucket, tokens,
+			           tokens + refill > rate ? rate : tokens + refill));
+		}
+	}
+	for (;;) {
+		uint64_t tokens = od_atomic_u64_of(bucket);
+		if (tokens == 0)
+			return 0;
+		if (__sync_bool_compare_and_swap(bucket, tokens, tokens - 1))
+			return 1;
+	}
+}
+
+static inline int
+od_route_log_query(od_route_t *route)
+{
+	/* decide whether the query should be logged, before
+	 * anything is formatted */
+	od_rule_t *rule = route->rule;
+	if (rule->log_query_sample > 1) {
+		uint64_t n;
+		if (rule->log_query_sample_random)
+			n = machine_lrand48();
+		else
+			n = od_atomic_u64_inc(&route->log_query_count);
+		if (n % rule->log_query_sample)
+			return 0;
+	}
+	if (rule->log_query_rate > 0)
+		return od_route_take(&route->log_query_tokens,
+		                     &route->log_query_time,
+		                     rule->log_query_rate);
+	return 1;
+}
+
+static inline void
+od_route_memory_io(od_route_memory_t *memory, uint64_t *buffers,
+                   od_io_t *io, od_relay_t *relay,
+                   uint64_t *workers, int workers_count, int worker_id)
+{
+	/* fields are owned by the worker, values are approximate */
+	uint64_t size = io->readahead.buf_size + relay->packet_full_pos;
+	*buffers += io->readahead.buf_size;
+	memory->packets += relay->packet_full_pos;
+	memory->pending += relay->memory;
+	if (worker_id >= 0 && worker_id < workers_count)
+		workers[worker_id] += size;
+}
+
+static inline int
+od_route_memory_client_cb(od_client_t *client, void **argv)
+{
+	od_route_memory_t *memory = argv[0];
+	od_route_memory_io(memory, &memory->client_buffers,
+	                   &client->io, &client->relay,
+	                   argv[1], *(int*)argv[2], client->worker_id);
+	return 0;
+}
+
+static inline int
+od_route_memory_server_cb(od_server_t *server, void **argv)
+{
+	od_route_memory_t *memory = argv[0];
+	od_route_memory_io(memory, &memory->server_buffers,
+	                   &server->io, &server->relay,
+	                   argv[1], *(int*)argv[2], server->io_worker);
+	return 0;
+}
+
+static inline void
+od_route_memory_update(od_route_t *route, uint64_t *workers,
+                       int workers_count)
+{
+	/* buffers are added to the totals of their workers */
+	od_route_memory_t memory;
+	memset(&memory, 0, sizeof(memory));
+
+	memory.stats = sizeof(od_stat_slot_t) * route->stats_count;
+	od_hgram_t *hgram = route->stats_prev.query_hgram;
+	if (hgram) {
+		int count = 3 + OD_STAT_QUERY_MAX * OD_STAT_PHASE_MAX;
+		memory.stats += (uint64_t)(route->stats_count + 1) * count *
+		                (sizeof(od_hgram_t) + hgram->count * sizeof(uint32_t));
+	}
+
+	void *argv[] = { &memory, workers, &workers_count };
+	od_route_lock(route, OD_LOCK_STAT);
+	od_client_pool_foreach(&route->client_pool, OD_CLIENT_ACTIVE,
+	                       od_route_memory_client_cb, argv);
+	od_client_pool_foreach(&route->client_pool, OD_CLIENT_QUEUE,
+	                       od_route_memory_client_cb, argv);
+	od_client_pool_foreach(&route->client_pool, OD_CLIENT_PENDING,
+	                       od_route_memory_client_cb, argv);
+	od_server_pool_foreach(&route->server_pool, OD_SERVER_ACTIVE,
+	                       od_route_memory_server_cb, argv);
+	od_server_pool_foreach(&route->server_pool, OD_SERVER_IDLE,
+	                       od_route_memory_server_cb, argv);
+	route->memory = memory;
+	od_route_unlock(route);
+}
+
 #endif /* ODYSSEY_ROUTE_H */
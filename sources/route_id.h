@@ -17,7 +17,8 @@ struct od_route_id
 	int   database_len;
 	bool  physical_rep;
 	bool  logical_rep;
-
+	bool  read_only;
+	int   shard;
 };
 
 static inline void
@@ -29,6 +30,8 @@ od_route_id_init(od_route_id_t *id)
 	id->database_len = 0;
 	id->physical_rep = false;
 	id->logical_rep = false;
+	id->read_only = false;
+	id->shard = 0;
 }
 
 static inline void
@@ -58,9 +61,32 @@ od_route_id_copy(od_route_id_t *dest, od_route_id_t *id)
 	dest->user_len = id->user_len;
 	dest->physical_rep = id->physical_rep;
 	dest->logical_rep = id->logical_rep;
+	dest->read_only = id->read_only;
+	dest->shard = id->shard;
 	return 0;
 }
 
+static inline uint32_t
+od_route_id_hash(od_route_id_t *id)
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261U;
+	int i;
+	for (i = 0; i < id->database_len; i++) {
+		hash ^= (uint8_t)id->database[i];
+		hash *= 16777619U;
+	}
+	for (i = 0; i < id->user_len; i++) {
+		hash ^= (uint8_t)id->user[i];
+		hash *= 16777619U;
+	}
+	hash ^= id->physical_rep | (id->logical_rep << 1) | (id->read_only << 2);
+	hash *= 16777619U;
+	hash ^= (uint32_t)id->shard;
+	hash *= 16777619U;
+	return hash;
+}
+
 static inline int
 od_route_id_compare(od_route_id_t *a, od_route_id_t *b)
 {
@@ -68,7 +94,9 @@ od_route_id_compare(od_route_id_t *a, od_route_id_t *b)
 	    a->user_len == b->user_len) {
 		if (memcmp(a->database, b->database, a->database_len) == 0 &&
 		    memcmp(a->user, b->user, a->user_len) == 0 &&
-			a->logical_rep == b->logical_rep)
+			a->logical_rep == b->logical_rep &&
+		    a->read_only == b->read_only &&
+		    a->shard == b->shard)
 		    if (a->physical_rep == b->physical_rep)
 			    return 1;
 	}
@@ -20,37 +20,110 @@ typedef int (*od_route_pool_stat_database_cb_t)
 
 typedef int (*od_route_pool_cb_t)(od_route_t*, void**);
 
-typedef struct od_route_pool od_route_pool_t;
+typedef struct od_route_pool_shard od_route_pool_shard_t;
+typedef struct od_route_pool       od_route_pool_t;
+
+/* Routes are kept in a hash table keyed on route id and rule.
+ *
+ * Table is split into shards, each protected by its own lock,
+ * so concurrent logins to different routes do not serialize.
+*/
+
+#define OD_ROUTE_POOL_SHARDS  16
+#define OD_ROUTE_POOL_BUCKETS 256
+
+struct od_route_pool_shard
+{
+	pthread_mutex_t lock;
+	od_list_t       buckets[OD_ROUTE_POOL_BUCKETS];
+};
 
 struct od_route_pool
 {
-	od_list_t list;
-	int       count;
+	od_route_pool_shard_t shards[OD_ROUTE_POOL_SHARDS];
+	od_atomic_u32_t       count;
 };
 
 static inline void
 od_route_pool_init(od_route_pool_t *pool)
 {
-	od_list_init(&pool->list);
+	int i, j;
+	for (i = 0; i < OD_ROUTE_POOL_SHARDS; i++) {
+		od_route_pool_shard_t *shard = &pool->shards[i];
+		pthread_mutex_init(&shard->lock, NULL);
+		for (j = 0; j < OD_ROUTE_POOL_BUCKETS; j++)
+			od_list_init(&shard->buckets[j]);
+	}
 	pool->count = 0;
 }
 
 static inline void
 od_route_pool_free(od_route_pool_t *pool)
 {
-	od_list_t *i, *n;
-	od_list_foreach_safe(&pool->list, i, n) {
-		od_route_t *route;
-		route = od_container_of(i, od_route_t, link);
-		od_route_free(route);
+	int i, j;
+	for (i = 0; i < OD_ROUTE_POOL_SHARDS; i++) {
+		od_route_pool_shard_t *shard = &pool->shards[i];
+		for (j = 0; j < OD_ROUTE_POOL_BUCKETS; j++) {
+			od_list_t *k, *n;
+			od_list_foreach_safe(&shard->buckets[j], k, n) {
+				od_route_t *route;
+				route = od_container_of(k, od_route_t, link);
+				od_route_free(route);
+			}
+		}
+		pthread_mutex_destroy(&shard->lock);
 	}
 }
 
+static inline uint32_t
+od_route_pool_hash(od_route_id_t *id, od_rule_t *rule)
+{
+	uint32_t hash;
+	hash = od_route_id_hash(id);
+	uintptr_t ptr = (uintptr_t)rule;
+	hash ^= (uint32_t)(ptr ^ (ptr >> 32));
+	hash *= 0x9e3779b1;
+	return hash ^ (hash >> 16);
+}
+
+static inline od_route_pool_shard_t*
+od_route_pool_shard(od_route_pool_t *pool, uint32_t hash)
+{
+	return &pool->shards[hash % OD_ROUTE_POOL_SHARDS];
+}
+
+static inline od_list_t*
+od_route_pool_bucket(od_route_pool_t *pool, uint32_t hash)
+{
+	od_route_pool_shard_t *shard;
+	shard = od_route_pool_shard(pool, hash);
+	return &shard->buckets[(hash / OD_ROUTE_POOL_SHARDS) % OD_ROUTE_POOL_BUCKETS];
+}
+
+static inline void
+od_route_pool_lock(od_route_pool_shard_t *shard)
+{
+	pthread_mutex_lock(&shard->lock);
+}
+
+static inline void
+od_route_pool_unlock(od_route_pool_shard_t *shard)
+{
+	pthread_mutex_unlock(&shard->lock);
+}
+
+static inline int
+od_route_pool_count(od_route_pool_t *pool)
+{
+	return od_atomic_u32_of(&pool->count);
+}
+
+/* shard of the route hash must be locked */
 static inline od_route_t*
-od_route_pool_new(od_route_pool_t *pool, int is_shared, od_route_id_t *id,
-                  od_rule_t *rule)
+od_route_pool_new(od_route_pool_t *pool, int workers, uint32_t hash,
+                  od_route_id_t *id, od_rule_t *rule)
 {
-	od_route_t *route = od_route_allocate(is_shared);
+	od_route_t *route = od_route_allocate(workers);
 	if (route == NULL)
 		return NULL;
 	int rc;
@@ -60,129 +133,251 @@ od_route_pool_new(od_route_pool_t *pool, int is_shared, od_route_id_t *id,
 		return NULL;
 	}
 	route->rule = rule;
+	route->hash = hash;
+	route->pool_limit = rule->pool_min_size > 0 ? rule->pool_min_size : 1;
 	if (rule->quantiles_count) {
-		route->stats.transaction_hgram = malloc(sizeof(od_hgram_t));
-		od_hgram_init(route->stats.transaction_hgram);
-		route->stats.query_hgram = malloc(sizeof(od_hgram_t));
-		od_hgram_init(route->stats.query_hgram);
+		rc = od_route_stat_hgram_prepare(route, rule->quantiles_precision);
+		if (rc == -1) {
+			od_route_free(route);
+			return NULL;
+		}
 	}
-	od_list_append(&pool->list, &route->link);
-	pool->count++;
+	od_list_append(od_route_pool_bucket(pool, hash), &route->link);
+	od_atomic_u32_inc(&pool->count);
 	return route;
 }
 
-static inline int
-od_route_pool_foreach(od_route_pool_t *pool, od_route_pool_cb_t callback,
-                      void **argv)
+/* shard of the route must be locked */
+static inline void
+od_route_pool_unlink(od_route_pool_t *pool, od_route_t *route)
 {
-	od_list_t *i, *n;
-	od_list_foreach_safe(&pool->list, i, n) {
-		od_route_t *route;
-		route = od_container_of(i, od_route_t, link);
-		int rc;
-		rc = callback(route, argv);
-		if (rc == -1)
-			return -1;
-		if (rc)
-			return 1;
-	}
-	return 0;
+	assert(od_atomic_u32_of(&pool->count) > 0);
+	od_atomic_u32_dec(&pool->count);
+	od_list_unlink(&route->link);
 }
 
+/* shard of the route hash must be locked */
 static inline od_route_t*
-od_route_pool_match(od_route_pool_t *pool, od_route_id_t *key,
+od_route_pool_match(od_route_pool_t *pool, uint32_t hash, od_route_id_t *key,
                     od_rule_t *rule)
 {
+	od_list_t *bucket;
+	bucket = od_route_pool_bucket(pool, hash);
 	od_list_t *i;
-	od_list_foreach(&pool->list, i) {
+	od_list_foreach(bucket, i) {
 		od_route_t *route;
 		route = od_container_of(i, od_route_t, link);
-		if (route->rule == rule && od_route_id_compare(&route->id, key))
+		if (route->hash == hash && route->rule == rule &&
+		    od_route_id_compare(&route->id, key))
 			return route;
 	}
 	return NULL;
 }
 
-static inline void
-od_route_pool_stat(od_route_pool_t *pool,
-                   uint64_t prev_time_us,
-                   int prev_update,
-                   od_route_pool_stat_cb_t callback,
-                   void **argv)
+static inline int
+od_route_pool_foreach(od_route_pool_t *pool, od_route_pool_cb_t callback,
+                      void **argv)
 {
-	od_list_t *i;
-	od_list_foreach(&pool->list, i)
+	int i, j;
+	for (i = 0; i < OD_ROUTE_POOL_SHARDS; i++)
 	{
-		od_route_t *route;
-		route = od_container_of(i, od_route_t, link);
+		od_route_pool_shard_t *shard = &pool->shards[i];
+		od_route_pool_lock(shard);
+		for (j = 0; j < OD_ROUTE_POOL_BUCKETS; j++)
+		{
+			od_list_t *k, *n;
+			od_list_foreach_safe(&shard->buckets[j], k, n) {
+				od_route_t *route;
+				route = od_container_of(k, od_route_t, link);
+				int rc;
+				rc = callback(route, argv);
+				if (rc == -1) {
+					od_route_pool_unlock(shard);
+					return -1;
+				}
+				if (rc) {
+					od_route_pool_unlock(shard);
+					return 1;
+				}
+			}
+		}
+		od_route_pool_unlock(shard);
+	}
+	return 0;
+}
 
-		od_stat_t current;
-		od_stat_init(&current);
-		od_stat_copy(&current, &route->stats);
+static inline void
+od_route_pool_stat_route(od_route_t *route,
+                         uint64_t prev_time_us,
+                         int prev_update,
+                         od_route_pool_stat_cb_t callback,
+                         void **argv)
+{
+	od_stat_t current;
+	od_stat_init(&current);
+	od_route_stat_sum(route, &current);
 
-		/* calculate average */
-		od_stat_t avg;
-		od_stat_init(&avg);
-		if (route->stats.transaction_hgram) {
-			avg.transaction_hgram = malloc(sizeof(od_hgram_frozen_t));
-			od_hgram_freeze(route->stats.transaction_hgram, avg.transaction_hgram);
-		}
-		if (route->stats.query_hgram) {
-			avg.query_hgram = malloc(sizeof(od_hgram_frozen_t));
-			od_hgram_freeze(route->stats.query_hgram, avg.query_hgram);
+	/* decaying rates are updated every second */
+	od_route_lock(route, OD_LOCK_STAT);
+	od_stat_rates_update(&route->rates, &current, machine_time_us());
+	od_route_unlock(route);
+	if (! prev_update && callback == NULL)
+		return;
+
+	/* calculate average and quantiles of the interval */
+	od_stat_t avg;
+	od_stat_init(&avg);
+	int i, j;
+	if (route->stats_prev.query_hgram) {
+		avg.transaction_hgram =
+			od_route_stat_hgram(route, __builtin_offsetof(od_stat_t, transaction_hgram),
+			                    prev_update);
+		avg.query_hgram =
+			od_route_stat_hgram(route, __builtin_offsetof(od_stat_t, query_hgram),
+			                    prev_update);
+		avg.wait_hgram =
+			od_route_stat_hgram(route, __builtin_offsetof(od_stat_t, wait_hgram),
+			                    prev_update);
+		for (i = 0; i < OD_STAT_QUERY_MAX; i++) {
+			for (j = 0; j < OD_STAT_PHASE_MAX; j++) {
+				avg.type[i].hgram[j] =
+					od_route_stat_hgram(route, __builtin_offsetof(od_stat_t, type[i].hgram[j]),
+					                    prev_update);
+			}
 		}
+	}
 
-		od_stat_average(&avg, &current, &route->stats_prev, prev_time_us);
+	od_stat_average(&avg, &current, &route->stats_prev, prev_time_us);
 
-		/* update route stats */
-		if (prev_update)
-			od_stat_update(&route->stats_prev, &current);
+	/* update route stats and close the interval of the wait
+	 * queue depth peak */
+	if (prev_update) {
+		od_stat_update(&route->stats_prev, &current);
+		od_route_lock(route, OD_LOCK_STAT);
+		route->count_waiters_peak = route->count_waiters_max;
+		route->count_waiters_max  = route->count_waiters;
+		od_route_unlock(route);
+	}
 
-		if (callback)
-			callback(route, &current, &avg, argv);
+	if (callback)
+		callback(route, &current, &avg, argv);
 
-		if (avg.query_hgram)
-			free(avg.query_hgram);
-		if (avg.transaction_hgram)
-			free(avg.transaction_hgram);
-	}
+	od_stat_free(&avg);
 }
 
-static inline void
-od_route_pool_stat_database_mark(od_route_pool_t *pool,
-                                 char *database,
-                                 int   database_len,
-                                 od_stat_t *current,
-                                 od_stat_t *prev)
+/* Stats readers pin routes under the shard locks and walk them
+ * afterwards without any lock held, pinned routes are not freed
+ * by gc. */
+
+static inline od_route_t**
+od_route_pool_pin(od_route_pool_t *pool, int *count)
 {
-	od_list_t *i;
-	od_list_foreach(&pool->list, i)
+	int size = od_route_pool_count(pool) + 16;
+	od_route_t **routes = malloc(sizeof(od_route_t*) * size);
+	if (routes == NULL)
+		return NULL;
+	int pos = 0;
+	int i, j;
+	for (i = 0; i < OD_ROUTE_POOL_SHARDS; i++)
 	{
-		od_route_t *route;
-		route = od_container_of(i, od_route_t, link);
-		if (route->stats_mark)
-			continue;
-		if (route->id.database_len != database_len)
-			continue;
-		if (memcmp(route->id.database, database, database_len) != 0)
-			continue;
+		od_route_pool_shard_t *shard = &pool->shards[i];
+		od_route_pool_lock(shard);
+		for (j = 0; j < OD_ROUTE_POOL_BUCKETS; j++)
+		{
+			od_list_t *k;
+			od_list_foreach(&shard->buckets[j], k) {
+				od_route_t *route;
+				route = od_container_of(k, od_route_t, link);
+				if (pos == size) {
+					/* routes were added since the count was taken */
+					od_route_t **grown;
+					grown = realloc(routes, sizeof(od_route_t*) * size * 2);
+					if (grown == NULL)
+						goto done;
+					routes = grown;
+					size *= 2;
+				}
+				od_atomic_u32_inc(&route->refs);
+				routes[pos++] = route;
+			}
+		}
+done:
+		od_route_pool_unlock(shard);
+	}
+	*count = pos;
+	return routes;
+}
 
-		od_stat_sum(current, &route->stats);
-		od_stat_sum(prev, &route->stats_prev);
+static inline void
+od_route_pool_unpin(od_route_t **routes, int count)
+{
+	int i;
+	for (i = 0; i < count; i++)
+		od_atomic_u32_dec(&routes[i]->refs);
+	free(routes);
+}
 
-		route->stats_mark++;
-	}
+static inline void
+od_route_pool_stat(od_route_pool_t *pool,
+                   uint64_t prev_time_us,
+                   int prev_update,
+                   od_route_pool_stat_cb_t callback,
+                   void **argv)
+{
+	int count;
+	od_route_t **routes = od_route_pool_pin(pool, &count);
+	if (routes == NULL)
+		return;
+	int i;
+	for (i = 0; i < count; i++)
+		od_route_pool_stat_route(routes[i], prev_time_us, prev_update,
+		                         callback, argv);
+	od_route_pool_unpin(routes, count);
 }
 
 static inline void
-od_route_pool_stat_unmark(od_route_pool_t *pool)
+od_route_pool_memory(od_route_pool_t *pool, uint64_t *workers,
+                     int workers_count)
+{
+	int count;
+	od_route_t **routes = od_route_pool_pin(pool, &count);
+	if (routes == NULL)
+		return;
+	int i;
+	for (i = 0; i < count; i++)
+		od_route_memory_update(routes[i], workers, workers_count);
+	od_route_pool_unpin(routes, count);
+}
+
+typedef struct
 {
 	od_route_t *route;
-	od_list_t *i;
-	od_list_foreach(&pool->list, i) {
-		route = od_container_of(i, od_route_t, link);
-		route->stats_mark = 0;
-	}
+	od_stat_t   current;
+	od_stat_t   prev;
+} od_route_pool_stat_database_t;
+
+static inline int
+od_route_pool_stat_database_cmp(const void *a, const void *b)
+{
+	od_route_t *ra = ((od_route_pool_stat_database_t*)a)->route;
+	od_route_t *rb = ((od_route_pool_stat_database_t*)b)->route;
+	int len = ra->id.database_len;
+	if (len > rb->id.database_len)
+		len = rb->id.database_len;
+	int rc = memcmp(ra->id.database, rb->id.database, len);
+	if (rc != 0)
+		return rc;
+	return ra->id.database_len - rb->id.database_len;
+}
+
+static inline uint32_t
+od_route_pool_stat_database_hash(od_route_t *route)
+{
+	uint32_t hash = 2166136261U;
+	int i;
+	for (i = 0; i < route->id.database_len; i++)
+		hash = (hash ^ (uint8_t)route->id.database[i]) * 16777619U;
+	return hash;
 }
 
 static inline int
@@ -191,40 +386,81 @@ od_route_pool_stat_database(od_route_pool_t *pool,
                             uint64_t prev_time_us,
                             void **argv)
 {
-	od_route_t *route;
-	od_list_t *i;
-	od_list_foreach(&pool->list, i)
+	int count;
+	od_route_t **routes = od_route_pool_pin(pool, &count);
+	if (routes == NULL)
+		return -1;
+
+	/* group routes by database in a single pass, only databases
+	 * are sorted for the output */
+	uint32_t size = 16;
+	while (size < (uint32_t)count * 2)
+		size *= 2;
+	int *slots = malloc(sizeof(int) * size);
+	od_route_pool_stat_database_t *databases;
+	databases = malloc(sizeof(od_route_pool_stat_database_t) * (count + 1));
+	if (slots == NULL || databases == NULL) {
+		free(slots);
+		free(databases);
+		od_route_pool_unpin(routes, count);
+		return -1;
+	}
+	memset(slots, 0xff, sizeof(int) * size);
+
+	int databases_count = 0;
+	int i;
+	for (i = 0; i < count; i++)
 	{
-		route = od_container_of(i, od_route_t, link);
-		if (route->stats_mark)
-			continue;
+		od_route_t *route = routes[i];
+		uint32_t slot = od_route_pool_stat_database_hash(route) & (size - 1);
+		od_route_pool_stat_database_t *database;
+		for (;;) {
+			if (slots[slot] == -1) {
+				database = &databases[databases_count];
+				database->route = route;
+				od_stat_init(&database->current);
+				od_stat_init(&database->prev);
+				slots[slot] = databases_count++;
+				break;
+			}
+			database = &databases[slots[slot]];
+			if (database->route->id.database_len == route->id.database_len &&
+			    !memcmp(database->route->id.database, route->id.database,
+			            route->id.database_len))
+				break;
+			slot = (slot + 1) & (size - 1);
+		}
 
 		/* gather current and previous cron stats */
-		od_stat_t current;
-		od_stat_t prev;
-		od_stat_init(&current);
-		od_stat_init(&prev);
-		od_route_pool_stat_database_mark(pool,
-		                                 route->id.database,
-		                                 route->id.database_len,
-		                                 &current, &prev);
+		od_route_stat_sum(route, &database->current);
+		od_stat_sum(&database->prev, &route->stats_prev);
+	}
+	free(slots);
+
+	qsort(databases, databases_count, sizeof(od_route_pool_stat_database_t),
+	      od_route_pool_stat_database_cmp);
+
+	int rc = 0;
+	for (i = 0; i < databases_count; i++)
+	{
+		od_route_pool_stat_database_t *database = &databases[i];
 
 		/* calculate average */
 		od_stat_t avg;
 		od_stat_init(&avg);
-		od_stat_average(&avg, &current, &prev, prev_time_us);
+		od_stat_average(&avg, &database->current, &database->prev,
+		                prev_time_us);
 
-		int rc;
-		rc = callback(route->id.database, route->id.database_len - 1,
-		              &current, &avg, argv);
-		if (rc == -1) {
-			od_route_pool_stat_unmark(pool);
-			return -1;
-		}
+		rc = callback(database->route->id.database,
+		              database->route->id.database_len - 1,
+		              &database->current, &avg, argv);
+		if (rc == -1)
+			break;
 	}
 
-	od_route_pool_stat_unmark(pool);
-	return 0;
+	free(databases);
+	od_route_pool_unpin(routes, count);
+	return rc;
 }
 
 #endif /* ODYSSEY_ROUTE_POOL_H */
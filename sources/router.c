@@ -22,12 +22,26 @@
 void
 od_router_init(od_router_t *router)
 {
-	pthread_mutex_init(&router->lock, NULL);
+	pthread_rwlock_init(&router->lock, NULL);
 	od_rules_init(&router->rules);
 	od_route_pool_init(&router->route_pool);
 	router->clients = 0;
 	router->clients_routing = 0;
+	router->login_time = 0;
+	router->relay_memory = 0;
 	router->servers_routing = 0;
+	router->count_routing_waiters = 0;
+	od_list_init(&router->routing_waiters);
+	pthread_mutex_init(&router->lock_routing, NULL);
+	pthread_mutex_init(&router->lock_caps, NULL);
+	od_list_init(&router->caps);
+	od_router_cancel_index_init(&router->cancel_index);
+	od_client_index_init(&router->client_index);
+	pthread_mutex_init(&router->lock_gc, NULL);
+	od_list_init(&router->gc);
+	router->count_gc = 0;
+	od_list_init(&router->paused);
+	router->count_paused = 0;
 }
 
 void
@@ -35,7 +49,24 @@ od_router_free(od_router_t *router)
 {
 	od_route_pool_free(&router->route_pool);
 	od_rules_free(&router->rules);
-	pthread_mutex_destroy(&router->lock);
+	pthread_mutex_destroy(&router->lock_routing);
+	od_router_cancel_index_free(&router->cancel_index);
+	od_client_index_free(&router->client_index);
+	pthread_mutex_destroy(&router->lock_gc);
+	od_list_t *i, *n;
+	od_list_foreach_safe(&router->caps, i, n) {
+		od_server_cap_t *cap;
+		cap = od_container_of(i, od_server_cap_t, link);
+		od_server_cap_free(cap);
+	}
+	pthread_mutex_destroy(&router->lock_caps);
+	od_list_foreach_safe(&router->paused, i, n) {
+		od_router_pause_t *pause;
+		pause = od_container_of(i, od_router_pause_t, link);
+		free(pause->database);
+		free(pause);
+	}
+	pthread_rwlock_destroy(&router->lock);
 }
 
 inline int
@@ -43,21 +74,19 @@ od_router_foreach(od_router_t *router,
                   od_route_pool_cb_t callback,
                   void **argv)
 {
-	od_router_lock(router);
-	int rc;
-	rc = od_route_pool_foreach(&router->route_pool, callback, argv);
-	od_router_unlock(router);
-	return rc;
+	return od_route_pool_foreach(&router->route_pool, callback, argv);
 }
 
 static inline int
 od_router_kill_clients_cb(od_route_t *route, void **argv)
 {
-	(void)argv;
+	od_router_t *router = argv[0];
 	if (! route->rule->obsolete)
 		return 0;
-	od_route_lock(route);
+	od_route_lock(route, OD_LOCK_RELOAD);
 	od_route_kill_client_pool(route);
+	/* freed by gc once clients and servers are gone */
+	od_router_gc_add(router, route);
 	od_route_unlock(route);
 	return 0;
 }
@@ -65,20 +94,36 @@ od_router_kill_clients_cb(od_route_t *route, void **argv)
 int
 od_router_reconfigure(od_router_t *router, od_rules_t *rules)
 {
-	od_router_lock(router);
+	od_router_lock(router, OD_LOCK_RELOAD);
 
 	int updates;
 	updates = od_rules_merge(&router->rules, rules);
 
 	if (updates > 0) {
+		void *argv[] = { router };
 		od_route_pool_foreach(&router->route_pool, od_router_kill_clients_cb,
-		                      NULL);
+		                      argv);
 	}
 
 	od_router_unlock(router);
 	return updates;
 }
 
+static inline int
+od_router_cap_preempt(od_route_t *route)
+{
+	/* a server of the route over its share of server_max is
+	 * closed for a route below its share, route must be locked */
+	od_server_cap_t *cap = route->server_pool.cap;
+	if (cap == NULL || od_atomic_u32_of(&cap->preempt) == 0)
+		return 0;
+	int max = od_route_storage(route)->server_max;
+	int total = od_server_pool_total(&route->server_pool);
+	if (total <= od_server_cap_share(cap, max, total))
+		return 0;
+	return od_server_cap_preempt(cap);
+}
+
 static inline int
 od_router_expire_server_cb(od_server_t *server, void **argv)
 {
@@ -102,18 +147,16 @@ od_router_expire_server_tick_cb(od_server_t *server, void **argv)
 	od_list_t *expire_list = argv[0];
 	int *count = argv[1];
 
-	/* advance idle time for 1 sec */
-	if (server->idle_time < route->rule->pool_ttl) {
-		server->idle_time++;
-		return 0;
-	}
-
 	/*
 	 * Do not expire more servers than we are allowed to connect at one time
 	 * This avoids need to re-launch lot of connections together
 	 */
-	if (*count > route->rule->storage->server_max_routing)
-		return 0;
+	if (*count > od_route_storage(route)->server_max_routing)
+		return 1;
+
+	/* keep pool_min_size servers until replacements are opened */
+	if (od_server_pool_total(&route->server_pool) <= route->rule->pool_min_size)
+		return 1;
 
 	/* remove server for server pool */
 	od_server_pool_set(&route->server_pool, server, OD_SERVER_UNDEF);
@@ -125,10 +168,108 @@ od_router_expire_server_tick_cb(od_server_t *server, void **argv)
 	return 0;
 }
 
+static inline int
+od_router_expire_server_host_cb(od_server_t *server, void **argv)
+{
+	od_route_t *route = server->route;
+
+	/* host role has changed, for example after failover */
+	if (server->endpoint == -1)
+		return 0;
+	if (od_rules_storage_endpoint_usable(od_route_storage(route), server->endpoint))
+		return 0;
+	/* reopen it to a suitable host in background */
+	if (! route->rule->obsolete)
+		route->count_replace++;
+	return od_router_expire_server_cb(server, argv);
+}
+
+static inline int
+od_router_expire_server_lifetime_cb(od_server_t *server, void **argv)
+{
+	/* close no more idle servers than reopened on the next tick */
+	od_route_t *route = server->route;
+	int *count = argv[1];
+	int max_routing = od_route_storage(route)->server_max_routing;
+	if (*count > max_routing || route->count_replace >= max_routing)
+		return 1;
+	if (! od_server_recycle(server, machine_time_us()))
+		return 0;
+	/* reopen it in background */
+	if (! route->rule->obsolete)
+		route->count_replace++;
+	return od_router_expire_server_cb(server, argv);
+}
+
+static inline int
+od_router_expire_server_pause_cb(od_server_t *server, void **argv)
+{
+	/* reopened by prewarm after resume */
+	od_route_t *route = server->route;
+	route->count_replace++;
+	return od_router_expire_server_cb(server, argv);
+}
+
+static inline int
+od_router_expire_server_reserve_cb(od_server_t *server, void **argv)
+{
+	/* reserve servers idle for pool_reserve_timeout are closed, so
+	 * the pool shrinks back to pool_size once a burst is over */
+	od_route_t *route = server->route;
+	od_rule_t *rule = route->rule;
+	if (od_server_pool_total(&route->server_pool) <= rule->pool_size)
+		return 1;
+	uint64_t now = machine_time_us();
+	if (server->idle_since == 0 || now < server->idle_since ||
+	    now - server->idle_since < rule->pool_reserve_timeout * 1000ull)
+		return 0;
+	return od_router_expire_server_cb(server, argv);
+}
+
+static inline int
+od_router_expire_server_preempt_cb(od_server_t *server, void **argv)
+{
+	if (! od_router_cap_preempt(server->route))
+		return 1;
+	return od_router_expire_server_cb(server, argv);
+}
+
+static inline int
+od_router_expire_hosts_cb(od_route_t *route, void **argv)
+{
+	if (! od_rules_storage_health_check(od_route_storage(route)))
+		return 0;
+	od_route_lock(route, OD_LOCK_EXPIRE);
+	od_server_pool_foreach(&route->server_pool,
+	                       OD_SERVER_IDLE,
+	                       od_router_expire_server_host_cb,
+	                       argv);
+	od_route_unlock(route);
+	return 0;
+}
+
 static inline int
 od_router_expire_cb(od_route_t *route, void **argv)
 {
-	od_route_lock(route);
+	od_route_lock(route, OD_LOCK_EXPIRE);
+
+	/* paused routes are left without servers */
+	if (route->paused) {
+		od_server_pool_foreach(&route->server_pool,
+		                       OD_SERVER_IDLE,
+		                       od_router_expire_server_pause_cb,
+		                       argv);
+		od_route_unlock(route);
+		return 0;
+	}
+
+	/* expire servers of hosts no longer suitable for the route */
+	if (od_rules_storage_health_check(od_route_storage(route))) {
+		od_server_pool_foreach(&route->server_pool,
+		                       OD_SERVER_IDLE,
+		                       od_router_expire_server_host_cb,
+		                       argv);
+	}
 
 	/* expire by config obsoletion */
 	if (route->rule->obsolete && !od_client_pool_total(&route->client_pool))
@@ -142,20 +283,55 @@ od_router_expire_cb(od_route_t *route, void **argv)
 		return 0;
 	}
 
+	/* idle servers over server_lifetime */
+	if (route->rule->server_lifetime) {
+		od_server_pool_foreach(&route->server_pool,
+		                       OD_SERVER_IDLE,
+		                       od_router_expire_server_lifetime_cb,
+		                       argv);
+	}
+
+	/* reserve servers over pool_size */
+	if (route->rule->pool_reserve_size > 0 && route->rule->pool_size > 0) {
+		od_server_pool_foreach(&route->server_pool,
+		                       OD_SERVER_IDLE,
+		                       od_router_expire_server_reserve_cb,
+		                       argv);
+	}
+
+	/* idle servers preempted for routes below their share */
+	if (route->server_pool.cap) {
+		od_server_pool_foreach(&route->server_pool,
+		                       OD_SERVER_IDLE,
+		                       od_router_expire_server_preempt_cb,
+		                       argv);
+	}
+
 	if (! route->rule->pool_ttl) {
 		od_route_unlock(route);
 		return 0;
 	}
 
-	od_server_pool_foreach(&route->server_pool,
-	                       OD_SERVER_IDLE,
-	                       od_router_expire_server_tick_cb,
-	                       argv);
+	/* only servers idle for pool_ttl seconds are visited */
+	od_server_pool_foreach_expired(&route->server_pool,
+	                               machine_time_us(),
+	                               route->rule->pool_ttl,
+	                               od_router_expire_server_tick_cb,
+	                               argv);
 
 	od_route_unlock(route);
 	return 0;
 }
 
+int
+od_router_expire_hosts(od_router_t *router, od_list_t *expire_list)
+{
+	int count = 0;
+	void *argv[] = { expire_list, &count };
+	od_router_foreach(router, od_router_expire_hosts_cb, argv);
+	return count;
+}
+
 int
 od_router_expire(od_router_t *router, od_list_t *expire_list)
 {
@@ -166,174 +342,1100 @@ od_router_expire(od_router_t *router, od_list_t *expire_list)
 }
 
 static inline int
-od_router_gc_cb(od_route_t *route, void **argv)
+od_router_gc_route(od_router_t *router, od_route_t *route)
 {
-	od_route_pool_t *pool = argv[0];
-	od_route_lock(route);
-
-	if (od_server_pool_total(&route->server_pool) > 0 ||
-	    od_client_pool_total(&route->client_pool) > 0)
-		goto done;
-
-	if (!od_route_is_dynamic(route) && !route->rule->obsolete)
-		goto done;
-
-	/* remove route from route pool */
-	assert(pool->count > 0);
-	pool->count--;
-	od_list_unlink(&route->link);
+	/* route and its route pool shard must be locked */
+	if (! od_router_gc_candidate(route)) {
+		/* queued again when its last client leaves */
+		od_router_gc_remove(router, route);
+		return 0;
+	}
 
-	od_route_unlock(route);
+	/* kept queued while servers are closed, or while it is pinned
+	 * by stats reader or by clients moving between the rule routes */
+	if (od_server_pool_total(&route->server_pool) > 0)
+		return 0;
+	if (od_atomic_u32_of(&route->refs) > 0)
+		return 0;
 
-	/* unref route rule and free route object */
-	od_rules_unref(route->rule);
-	od_route_free(route);
-	return 0;
-done:
-	od_route_unlock(route);
-	return 0;
+	od_router_gc_remove(router, route);
+	od_route_pool_unlink(&router->route_pool, route);
+	return 1;
 }
 
 void
 od_router_gc(od_router_t *router)
 {
-	void *argv[] = { &router->route_pool };
-	od_router_foreach(router, od_router_gc_cb, argv);
-}
+	/* queued routes are visited at most once per call and within
+	 * the time budget, so a reload obsoleting many routes does not
+	 * hold the router lock for long, the rest of them is freed on
+	 * next calls */
+	od_router_lock(router, OD_LOCK_GC);
+	uint64_t deadline = machine_time_us() + OD_ROUTER_GC_BUDGET;
+	pthread_mutex_lock(&router->lock_gc);
+	int count = router->count_gc;
+	pthread_mutex_unlock(&router->lock_gc);
+
+	for (; count > 0; count--) {
+		/* visited route goes to the tail of the queue, only gc
+		 * removes routes from the pool and frees them */
+		pthread_mutex_lock(&router->lock_gc);
+		if (od_list_empty(&router->gc)) {
+			pthread_mutex_unlock(&router->lock_gc);
+			break;
+		}
+		od_route_t *route;
+		route = od_container_of(router->gc.next, od_route_t, link_gc);
+		od_list_unlink(&route->link_gc);
+		od_list_append(&router->gc, &route->link_gc);
+		pthread_mutex_unlock(&router->lock_gc);
+
+		od_route_pool_shard_t *shard;
+		shard = od_route_pool_shard(&router->route_pool, route->hash);
+		od_route_pool_lock(shard);
+		od_route_lock(route, OD_LOCK_GC);
+		int unlinked;
+		unlinked = od_router_gc_route(router, route);
+		od_route_unlock(route);
+		od_route_pool_unlock(shard);
 
-void
-od_router_stat(od_router_t *router,
-               uint64_t prev_time_us,
-               int prev_update,
-               od_route_pool_stat_cb_t callback,
-               void **argv)
-{
-	od_router_lock(router);
-	od_route_pool_stat(&router->route_pool, prev_time_us, prev_update,
-	                   callback, argv);
+		if (unlinked) {
+			/* unref route rule and free route object */
+			od_rules_unref(route->rule);
+			od_route_free(route);
+		}
+		if (machine_time_us() >= deadline)
+			break;
+	}
+
+	/* free obsolete rules unreferenced by routes and clients */
+	od_rules_gc(&router->rules);
 	od_router_unlock(router);
 }
 
-od_router_status_t
-od_router_route(od_router_t *router, od_config_t *config, od_client_t *client)
+static inline od_server_cap_t*
+od_router_cap(od_router_t *router, char *name)
 {
-	kiwi_be_startup_t *startup = &client->startup;
-
-	/* match route */
-	assert(startup->database.value_len);
-	assert(startup->user.value_len);
-
-	od_router_lock(router);
-
-	/* match latest version of route rule */
-	od_rule_t *rule;
-	rule = od_rules_forward(&router->rules, startup->database.value,
-	                        startup->user.value);
-	if (rule == NULL) {
-		od_router_unlock(router);
-		return OD_ROUTER_ERROR_NOT_FOUND;
+	/* server_max of storages, kept until shutdown */
+	pthread_mutex_lock(&router->lock_caps);
+	od_list_t *i;
+	od_list_foreach(&router->caps, i) {
+		od_server_cap_t *cap;
+		cap = od_container_of(i, od_server_cap_t, link);
+		if (strcmp(cap->name, name) == 0) {
+			pthread_mutex_unlock(&router->lock_caps);
+			return cap;
+		}
 	}
+	od_server_cap_t *cap = od_server_cap_allocate(name);
+	if (cap)
+		od_list_append(&router->caps, &cap->link);
+	pthread_mutex_unlock(&router->lock_caps);
+	return cap;
+}
 
-	/* force settings required by route */
-	od_route_id_t id = {
-		.database     = startup->database.value,
-		.user         = startup->user.value,
-		.database_len = startup->database.value_len,
-		.user_len     = startup->user.value_len,
-		.physical_rep = false,
-		.logical_rep = false
-	};
-	if (rule->storage_db) {
-		id.database = rule->storage_db;
-		id.database_len = strlen(rule->storage_db) + 1;
-	}
-	if (rule->storage_user) {
-		id.user = rule->storage_user;
-		id.user_len = strlen(rule->storage_user) + 1;
-	}
-	if (startup->replication.value_len != 0) {
-		if (strcmp(startup->replication.value, "database") == 0)
-		    id.logical_rep = true;
-		else if (!parse_bool(startup->replication.value, &id.physical_rep))
-		    return OD_ROUTER_ERROR_REPLICATION;
-	}
+static inline od_route_t*
+od_router_match(od_router_t *router, od_config_t *config, od_route_id_t *id,
+                od_rule_t *rule, int *created)
+{
+	/* match or create dynamic route, returns locked route */
+	uint32_t hash;
+	hash = od_route_pool_hash(id, rule);
+	od_route_pool_shard_t *shard;
+	shard = od_route_pool_shard(&router->route_pool, hash);
+	od_route_pool_lock(shard);
 
-	/* match or create dynamic route */
 	od_route_t *route;
-	route = od_route_pool_match(&router->route_pool, &id, rule);
+	route = od_route_pool_match(&router->route_pool, hash, id, rule);
 	if (route == NULL) {
-		int is_shared;
-		is_shared = od_config_is_multi_workers(config);
-		route = od_route_pool_new(&router->route_pool, is_shared, &id, rule);
+		int workers = 1;
+		if (od_config_is_multi_workers(config))
+			workers = config->workers_max;
+		route = od_route_pool_new(&router->route_pool, workers, hash, id, rule);
 		if (route == NULL) {
-			od_router_unlock(router);
-			return OD_ROUTER_ERROR;
+			od_route_pool_unlock(shard);
+			return NULL;
 		}
+		if (created)
+			*created = 1;
+		/* servers are accounted in server_max of the storage */
+		od_rule_storage_t *storage = od_route_storage(route);
+		if (storage && storage->server_max > 0)
+			route->server_pool.cap = od_router_cap(router, storage->name);
+		od_route_lock(route, OD_LOCK_ROUTE);
+		od_route_pool_unlock(shard);
+		/* freed by gc if no client is routed to it */
+		if (od_router_gc_candidate(route))
+			od_router_gc_add(router, route);
+		return route;
 	}
-	od_rules_ref(rule);
 
-	od_route_lock(route);
+	od_route_lock(route, OD_LOCK_ROUTE);
+	od_route_pool_unlock(shard);
+	return route;
+}
+
+static inline int
+od_router_pause_match(od_router_t *router, od_route_t *route)
+{
+	/* router must be locked, console routes are never paused */
+	if (route->rule->storage->storage_type == OD_RULE_STORAGE_LOCAL)
+		return 0;
+	od_list_t *i;
+	od_list_foreach(&router->paused, i) {
+		od_router_pause_t *pause;
+		pause = od_container_of(i, od_router_pause_t, link);
+		if (pause->database == NULL ||
+		    strcmp(pause->database, route->id.database) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+void
+od_router_prewarm_routes(od_router_t *router, od_config_t *config)
+{
+	/* create routes of static rules which keep servers warm, so
+	 * connections are ready before the first client arrives */
+	od_router_lock_read(router, OD_LOCK_OTHER);
+	od_list_t *i;
+	od_list_foreach(&router->rules.rules, i) {
+		od_rule_t *rule;
+		rule = od_container_of(i, od_rule_t, link);
+		if (rule->obsolete || rule->pool_min_size == 0)
+			continue;
+		if (rule->db_is_default || rule->user_is_default)
+			continue;
+		if (rule->storage->storage_type == OD_RULE_STORAGE_LOCAL)
+			continue;
+		od_route_id_t id = {
+			.database     = rule->db_name,
+			.user         = rule->user_name,
+			.database_len = strlen(rule->db_name) + 1,
+			.user_len     = strlen(rule->user_name) + 1,
+			.physical_rep = false,
+			.logical_rep  = false
+		};
+		if (rule->storage_db) {
+			id.database = rule->storage_db;
+			id.database_len = strlen(rule->storage_db) + 1;
+		}
+		if (rule->storage_user) {
+			id.user = rule->storage_user;
+			id.user_len = strlen(rule->storage_user) + 1;
+		}
+		/* route keeps rule reference until gc */
+		od_rules_ref(rule);
+		int created = 0;
+		od_route_t *route;
+		route = od_router_match(router, config, &id, rule, &created);
+		if (route) {
+			if (created)
+				route->paused = od_router_pause_match(router, route);
+			od_route_unlock(route);
+		}
+		if (! created)
+			od_rules_unref(rule);
+	}
 	od_router_unlock(router);
+}
 
-	/* ensure route client_max limit */
-	if (rule->client_max_set &&
-	    od_client_pool_total(&route->client_pool) >= rule->client_max) {
+static inline int
+od_router_prewarm_expiring_cb(od_server_t *server, void **argv)
+{
+	(void)server;
+	int *count = argv[0];
+	(*count)++;
+	return 0;
+}
+
+static inline int
+od_router_prewarm_cb(od_route_t *route, void **argv)
+{
+	od_global_t *global = argv[0];
+	od_server_t **servers = argv[1];
+	int *count = argv[2];
+	int *count_max = argv[3];
+
+	od_rule_t *rule = route->rule;
+	if ((rule->pool_min_size == 0 && route->count_replace == 0) ||
+	    rule->obsolete)
+		return 0;
+	if (route->id.physical_rep || route->id.logical_rep)
+		return 0;
+
+	od_route_lock(route, OD_LOCK_OTHER);
+	if (route->paused) {
 		od_route_unlock(route);
-		od_router_lock(router);
-		od_rules_unref(rule);
-		od_router_unlock(router);
-		return OD_ROUTER_ERROR_LIMIT_ROUTE;
+		return 0;
 	}
 
-	/* add client to route client pool */
-	od_client_pool_set(&route->client_pool, client, OD_CLIENT_PENDING);
-	client->rule  = rule;
-	client->route = route;
+	/* replace idle servers which will be expired on the next
+	 * tick in advance */
+	int total = od_server_pool_total(&route->server_pool);
+	int expiring = 0;
+	if (rule->pool_ttl) {
+		void *argv_expiring[] = { &expiring };
+		od_server_pool_foreach_expired(&route->server_pool,
+		                               machine_time_us(),
+		                               rule->pool_ttl - 1,
+		                               od_router_prewarm_expiring_cb,
+		                               argv_expiring);
+	}
+	int need = rule->pool_min_size - (total - expiring);
+	/* servers closed on storage host role change, the rest of
+	 * them is opened on next ticks */
+	int replace = route->count_replace;
+	if (rule->pool_size > 0 && replace > rule->pool_size - total)
+		replace = rule->pool_size - total;
+	route->count_replace = replace;
+	if (need < replace)
+		need = replace;
+	if (rule->pool_size > 0 && need > rule->pool_size - total)
+		need = rule->pool_size - total;
+	if (need > od_route_storage(route)->server_max_routing)
+		need = od_route_storage(route)->server_max_routing;
+	/* only unused server_max of the storage is taken */
+	od_server_cap_t *cap = route->server_pool.cap;
+	if (cap) {
+		int room = od_route_storage(route)->server_max -
+		           (int)od_atomic_u32_of(&cap->count);
+		if (need > room)
+			need = room;
+	}
+
+	for (; need > 0 && *count < *count_max; need--) {
+		od_server_t *server;
+		server = od_server_allocate();
+		if (server == NULL)
+			break;
+		od_id_generate(&server->id, "s");
+		server->global = global;
+		server->route  = route;
+		/* account the connection in progress in the pool */
+		od_server_pool_set(&route->server_pool, server, OD_SERVER_ACTIVE);
+		servers[(*count)++] = server;
+		if (route->count_replace > 0)
+			route->count_replace--;
+	}
 
 	od_route_unlock(route);
-	return OD_ROUTER_OK;
+	return 0;
+}
+
+int
+od_router_prewarm(od_router_t *router, od_global_t *global,
+                  od_server_t **servers, int count_max)
+{
+	int count = 0;
+	void *argv[] = { global, servers, &count, &count_max };
+	od_router_foreach(router, od_router_prewarm_cb, argv);
+	return count;
+}
+
+static inline int
+od_router_adapt_cb(od_route_t *route, void **argv)
+{
+	(void)argv;
+	if (route->rule->pool_adaptive && ! route->rule->obsolete)
+		od_route_pool_adapt(route);
+	return 0;
 }
 
 void
-od_router_unroute(od_router_t *router, od_client_t *client)
+od_router_adapt(od_router_t *router)
 {
-	(void)router;
-	/* detach client from route */
-	assert(client->route);
-	assert(client->server == NULL);
+	od_router_foreach(router, od_router_adapt_cb, NULL);
+}
 
-	od_route_t *route = client->route;
-	od_route_lock(route);
-	od_client_pool_set(&route->client_pool, client, OD_CLIENT_UNDEF);
-	client->route = NULL;
+static inline void
+od_router_pause_route(od_router_t *router, od_route_t *route)
+{
+	/* route created by a client, a concurrent resume either has
+	 * already updated the list or will visit the route */
+	if (! od_atomic_u32_of(&router->count_paused))
+		return;
+	od_router_lock_read(router, OD_LOCK_RELOAD);
+	od_route_lock(route, OD_LOCK_RELOAD);
+	route->paused = od_router_pause_match(router, route);
 	od_route_unlock(route);
+	od_router_unlock(router);
 }
 
-od_router_status_t
-od_router_attach(od_router_t *router, od_config_t *config, od_client_t *client,
-                 bool wait_for_idle)
+static inline int
+od_router_pause_cb(od_route_t *route, void **argv)
 {
-	(void)router;
-	od_route_t *route = client->route;
-	assert(route != NULL);
+	od_router_t *router = argv[0];
+	od_route_lock(route, OD_LOCK_RELOAD);
+	int paused = od_router_pause_match(router, route);
+	if (route->paused != paused) {
+		/* queued clients retry: on pause they wait again without
+		 * pool_timeout, on resume they are released and servers
+		 * closed by the pause are reopened by prewarm */
+		route->paused = paused;
+		int count = route->count_waiters;
+		while (count-- > 0)
+			od_route_signal(route);
+	}
+	od_route_unlock(route);
+	return 0;
+}
 
-	od_route_lock(route);
+int
+od_router_pause(od_router_t *router, char *database)
+{
+	od_router_pause_t *pause;
+	pause = malloc(sizeof(od_router_pause_t));
+	if (pause == NULL)
+		return -1;
+	pause->database = NULL;
+	if (database) {
+		pause->database = strdup(database);
+		if (pause->database == NULL) {
+			free(pause);
+			return -1;
+		}
+	}
+	od_list_init(&pause->link);
 
-	/* enqueue client (pending -> queue) */
-	od_client_pool_set(&route->client_pool, client, OD_CLIENT_QUEUE);
+	od_router_lock(router, OD_LOCK_RELOAD);
+	od_list_append(&router->paused, &pause->link);
+	od_atomic_u32_inc(&router->count_paused);
+	void *argv[] = { router };
+	od_router_foreach(router, od_router_pause_cb, argv);
+	od_router_unlock(router);
+	return 0;
+}
+
+int
+od_router_resume(od_router_t *router, char *database)
+{
+	/* resume without database resumes everything */
+	int count = 0;
+	od_router_lock(router, OD_LOCK_RELOAD);
+	od_list_t *i, *n;
+	od_list_foreach_safe(&router->paused, i, n) {
+		od_router_pause_t *pause;
+		pause = od_container_of(i, od_router_pause_t, link);
+		if (database && (pause->database == NULL ||
+		                 strcmp(pause->database, database) != 0))
+			continue;
+		od_list_unlink(&pause->link);
+		od_atomic_u32_dec(&router->count_paused);
+		free(pause->database);
+		free(pause);
+		count++;
+	}
+	void *argv[] = { router };
+	od_router_foreach(router, od_router_pause_cb, argv);
+	od_router_unlock(router);
+	return count;
+}
+
+static inline int
+od_router_pause_servers_cb(od_route_t *route, void **argv)
+{
+	int *count = argv[0];
+	od_route_lock(route, OD_LOCK_RELOAD);
+	if (route->paused)
+		*count += od_server_pool_total(&route->server_pool);
+	od_route_unlock(route);
+	return 0;
+}
+
+int
+od_router_pause_servers(od_router_t *router)
+{
+	/* servers left on paused routes, active ones are closed when
+	 * their clients detach, idle ones by expire */
+	int count = 0;
+	void *argv[] = { &count };
+	od_router_foreach(router, od_router_pause_servers_cb, argv);
+	return count;
+}
+
+static inline int
+od_router_check_server_cb(od_server_t *server, void **argv)
+{
+	od_route_t *route = server->route;
+	od_server_t **servers = argv[0];
+	int *count = argv[1];
+	int *count_max = argv[2];
+	if (*count == *count_max)
+		return 0;
+	if (++server->idle_check < route->rule->pool_check_idle)
+		return 0;
+	server->idle_check = 0;
+
+	/* keep it out of the idle list while validated */
+	od_server_pool_set(&route->server_pool, server, OD_SERVER_ACTIVE);
+	servers[(*count)++] = server;
+	return 0;
+}
+
+static inline int
+od_router_check_cb(od_route_t *route, void **argv)
+{
+	od_rule_t *rule = route->rule;
+	if (! rule->pool_check_idle || rule->obsolete)
+		return 0;
+	if (route->id.physical_rep || route->id.logical_rep)
+		return 0;
+	od_route_lock(route, OD_LOCK_OTHER);
+	od_server_pool_foreach(&route->server_pool,
+	                       OD_SERVER_IDLE,
+	                       od_router_check_server_cb,
+	                       argv);
+	od_route_unlock(route);
+	return 0;
+}
+
+int
+od_router_check(od_router_t *router, od_server_t **servers, int count_max)
+{
+	int count = 0;
+	void *argv[] = { servers, &count, &count_max };
+	od_router_foreach(router, od_router_check_cb, argv);
+	return count;
+}
+
+void
+od_router_stat(od_router_t *router,
+               uint64_t prev_time_us,
+               int prev_update,
+               od_route_pool_stat_cb_t callback,
+               void **argv)
+{
+	od_route_pool_stat(&router->route_pool, prev_time_us, prev_update,
+	                   callback, argv);
+}
+
+static inline int
+od_router_shard_jump(uint64_t key, int buckets)
+{
+	/* jump consistent hash, adding a shard moves only 1/n of keys */
+	int64_t b = -1;
+	int64_t j = 0;
+	while (j < buckets) {
+		b = j;
+		key = key * 2862933555777941757ULL + 1;
+		j = (b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1));
+	}
+	return b;
+}
+
+static inline int
+od_router_shard(od_rule_t *rule, od_client_t *client)
+{
+	kiwi_be_startup_t *startup = &client->startup;
+	char *key;
+	int   key_len;
+	switch (rule->shard_key) {
+	case OD_RULE_SHARD_USER_SUFFIX:
+	{
+		/* tenant is the part of user name after the last dot,
+		 * such as app.tenant */
+		key = startup->user.value;
+		key_len = startup->user.value_len - 1;
+		int pos = key_len;
+		while (pos > 0 && key[pos - 1] != '.')
+			pos--;
+		key += pos;
+		key_len -= pos;
+		break;
+	}
+	case OD_RULE_SHARD_PARAMETER:
+	{
+		char *name = rule->shard_parameter;
+		int name_len = strlen(name) + 1;
+		kiwi_var_t *var;
+		kiwi_var_type_t type;
+		type = kiwi_vars_find(&client->vars, name, name_len);
+		if (type != KIWI_VAR_UNDEF)
+			var = kiwi_vars_get(&client->vars, type);
+		else
+			var = kiwi_vars_extra_find(&client->vars, name, name_len);
+		if (var == NULL || var->value_len <= 1)
+			return -1;
+		key = var->value;
+		key_len = var->value_len - 1;
+		break;
+	}
+	default:
+		key = startup->database.value;
+		key_len = startup->database.value_len - 1;
+		break;
+	}
+
+	/* FNV-1a */
+	uint64_t hash = 14695981039346656037ULL;
+	int i;
+	for (i = 0; i < key_len; i++) {
+		hash ^= (uint8_t)key[i];
+		hash *= 1099511628211ULL;
+	}
+	return od_router_shard_jump(hash, rule->storage_shards_count);
+}
+
+od_router_status_t
+od_router_route(od_router_t *router, od_config_t *config, od_client_t *client)
+{
+	kiwi_be_startup_t *startup = &client->startup;
+
+	/* match route */
+	assert(startup->database.value_len);
+	assert(startup->user.value_len);
+
+	od_router_lock_read(router, OD_LOCK_ROUTE);
+
+	/* match latest version of route rule */
+	od_rule_t *rule;
+	rule = od_rules_forward(&router->rules, startup->database.value,
+	                        startup->user.value);
+	if (rule == NULL) {
+		od_router_unlock(router);
+		return OD_ROUTER_ERROR_NOT_FOUND;
+	}
+	od_rules_ref(rule);
+
+	/* pool_shared rule routes are matched by the rule which owns
+	 * the shared server pool. Client keeps reference of its rule,
+	 * a created route keeps its own one of the pool rule */
+	od_rule_t *pool_rule = rule->pool_share;
+	od_rules_ref(pool_rule);
+	od_router_unlock(router);
+
+	/* force settings required by route */
+	od_route_id_t id = {
+		.database     = startup->database.value,
+		.user         = startup->user.value,
+		.database_len = startup->database.value_len,
+		.user_len     = startup->user.value_len,
+		.physical_rep = false,
+		.logical_rep = false
+	};
+	if (rule->storage_db) {
+		id.database = rule->storage_db;
+		id.database_len = strlen(rule->storage_db) + 1;
+	}
+	if (rule->storage_user) {
+		id.user = rule->storage_user;
+		id.user_len = strlen(rule->storage_user) + 1;
+	}
+	if (startup->replication.value_len != 0) {
+		if (strcmp(startup->replication.value, "database") == 0)
+		    id.logical_rep = true;
+		else if (!parse_bool(startup->replication.value, &id.physical_rep)) {
+			od_rules_unref(pool_rule);
+			od_rules_unref(rule);
+			return OD_ROUTER_ERROR_REPLICATION;
+		}
+	}
+
+	/* each shard of the rule is a route with its own server pool */
+	if (pool_rule->storage_shards) {
+		id.shard = od_router_shard(pool_rule, client);
+		if (id.shard == -1) {
+			od_rules_unref(pool_rule);
+			od_rules_unref(rule);
+			return OD_ROUTER_ERROR_SHARD;
+		}
+	}
+
+	/* match or create dynamic route */
+	int created = 0;
+	od_route_t *route;
+	route = od_router_match(router, config, &id, pool_rule, &created);
+	if (route == NULL) {
+		od_rules_unref(pool_rule);
+		od_rules_unref(rule);
+		return OD_ROUTER_ERROR;
+	}
+	if (! created)
+		od_rules_unref(pool_rule);
+
+	/* ensure route client_max limit */
+	if (rule->client_max_set &&
+	    od_client_pool_total(&route->client_pool) >= rule->client_max) {
+		od_route_unlock(route);
+		od_rules_unref(rule);
+		return OD_ROUTER_ERROR_LIMIT_ROUTE;
+	}
+
+	/* ensure route memory_max limit, accounted by cron */
+	if (rule->memory_max &&
+	    od_route_memory_total(&route->memory) >= (uint64_t)rule->memory_max) {
+		od_route_unlock(route);
+		od_rules_unref(rule);
+		return OD_ROUTER_ERROR_LIMIT_MEMORY;
+	}
+
+	/* add client to route client pool */
+	od_client_pool_set(&route->client_pool, client, OD_CLIENT_PENDING);
+	client->rule  = rule;
+	client->route = route;
+
+	od_route_unlock(route);
+	od_trace3(route, client->id.id_a, id.database, id.user);
+	od_client_index_add(&router->client_index, client);
+	if (created)
+		od_router_pause_route(router, route);
+
+	/* read-only statements are routed to the storage_read pool */
+	if (rule->storage_read && !id.physical_rep && !id.logical_rep) {
+		/* route keeps rule reference until gc, client holds
+		 * its own one */
+		od_rules_ref(pool_rule);
+		id.read_only = true;
+		created = 0;
+		od_route_t *route_read;
+		route_read = od_router_match(router, config, &id, pool_rule, &created);
+		if (! created)
+			od_rules_unref(pool_rule);
+		if (route_read == NULL)
+			return OD_ROUTER_OK;
+		/* both routes are pinned while client moves between them */
+		od_atomic_u32_inc(&route_read->refs);
+		od_route_unlock(route_read);
+		if (created)
+			od_router_pause_route(router, route_read);
+		od_atomic_u32_inc(&route->refs);
+		client->route_write = route;
+		client->route_read  = route_read;
+	}
+	return OD_ROUTER_OK;
+}
+
+void
+od_router_reroute(od_router_t *router, od_client_t *client, od_route_t *route)
+{
+	/* move idle client to another route of its rule */
+	assert(client->server == NULL);
+	od_route_t *current = client->route;
+	if (current == route)
+		return;
+	od_route_lock(current, OD_LOCK_ROUTE);
+	od_client_pool_set(&current->client_pool, client, OD_CLIENT_UNDEF);
+	if (od_router_gc_candidate(current))
+		od_router_gc_add(router, current);
+	od_route_unlock(current);
+
+	od_route_lock(route, OD_LOCK_ROUTE);
+	od_client_pool_set(&route->client_pool, client, OD_CLIENT_PENDING);
+	client->route = route;
+	od_route_unlock(route);
+}
+
+void
+od_router_unroute(od_router_t *router, od_client_t *client)
+{
+	/* detach client from route */
+	assert(client->route);
+	assert(client->server == NULL);
+	od_client_index_remove(&router->client_index, client);
+
+	od_route_t *route = client->route;
+	od_route_lock(route, OD_LOCK_ROUTE);
+	od_client_pool_set(&route->client_pool, client, OD_CLIENT_UNDEF);
+	client->route = NULL;
+	if (od_router_gc_candidate(route))
+		od_router_gc_add(router, route);
+	od_route_unlock(route);
+
+	/* rule stays allocated until the next gc pass */
+	od_rules_unref(client->rule);
+
+	if (client->route_read) {
+		od_route_t *route_write = client->route_write;
+		od_route_t *route_read  = client->route_read;
+		od_atomic_u32_dec(&route_write->refs);
+		od_atomic_u32_dec(&route_read->refs);
+		client->route_write = NULL;
+		client->route_read  = NULL;
+	}
+}
+
+/* number of idle servers checked for matching client parameters */
+#define OD_ROUTER_IDLE_MATCH_MAX 16
+
+static inline od_server_t*
+od_router_next_idle(od_route_t *route, od_client_t *client)
+{
+	od_server_pool_t *pool = &route->server_pool;
+
+	/* prefer servers released on the client worker. Idle lists are
+	 * ordered by release time: affinity looks for recent servers
+	 * already configured for the client parameters, lifo takes the
+	 * newest one and lets the rest expire by pool_ttl, fifo takes
+	 * the oldest one to spread the load */
+	od_rule_pool_select_t select = route->rule->pool_select;
+	od_server_pool_local_t *local;
+	local = od_server_pool_local(pool, client->worker_id);
+	od_server_t *server;
+	od_list_t *i;
+	if (select == OD_RULE_POOL_SELECT_AFFINITY) {
+		int scan = 0;
+		od_list_foreach(&local->idle, i) {
+			if (scan++ == OD_ROUTER_IDLE_MATCH_MAX)
+				break;
+			server = od_container_of(i, od_server_t, link);
+			if (server->deploy_hash == client->vars.hash)
+				return server;
+		}
+	}
+	if (select == OD_RULE_POOL_SELECT_FIFO)
+		server = od_server_pool_last_local(pool, client->worker_id);
+	else
+		server = od_server_pool_next_local(pool, client->worker_id);
+	if (server)
+		return server;
+	if (pool->count_idle == 0)
+		return NULL;
+
+	/* borrow from sibling workers, skip idle servers kept
+	 * attached to their worker loop */
+	int id;
+	for (id = 0; id < pool->count_local; id++) {
+		if (&pool->local[id] == local)
+			continue;
+		if (select == OD_RULE_POOL_SELECT_FIFO) {
+			od_list_foreach_reverse(&pool->local[id].idle, i) {
+				server = od_container_of(i, od_server_t, link);
+				if (server->io_worker == -1)
+					return server;
+			}
+			continue;
+		}
+		od_list_foreach(&pool->local[id].idle, i) {
+			server = od_container_of(i, od_server_t, link);
+			if (server->io_worker == -1)
+				return server;
+		}
+	}
+	return NULL;
+}
+
+static inline int
+od_router_wait_routing(od_router_t *router, od_route_waiter_t *waiter,
+                       uint32_t max_routing, uint32_t time_ms)
+{
+	/* wait for a concurrent server connection to finish */
+	pthread_mutex_lock(&router->lock_routing);
+	od_atomic_u32_inc(&router->count_routing_waiters);
+	if (od_atomic_u32_of(&router->servers_routing) < max_routing) {
+		od_atomic_u32_dec(&router->count_routing_waiters);
+		pthread_mutex_unlock(&router->lock_routing);
+		return 0;
+	}
+	od_list_append(&router->routing_waiters, &waiter->link);
+	pthread_mutex_unlock(&router->lock_routing);
+
+	int rc;
+	rc = od_route_waiter_wait(waiter, time_ms);
+
+	pthread_mutex_lock(&router->lock_routing);
+	if (waiter->granted) {
+		/* woken up concurrently with timeout */
+		if (rc == -1)
+			od_route_waiter_wait(waiter, 0);
+		waiter->granted = 0;
+		rc = 0;
+	} else {
+		od_list_unlink(&waiter->link);
+		od_atomic_u32_dec(&router->count_routing_waiters);
+	}
+	od_list_init(&waiter->link);
+	pthread_mutex_unlock(&router->lock_routing);
+	return rc;
+}
+
+void
+od_router_routing_done(od_router_t *router)
+{
+	od_atomic_u32_dec(&router->servers_routing);
+	if (od_atomic_u32_of(&router->count_routing_waiters) == 0)
+		return;
+
+	/* wakeup all waiters: the one which gets the slot may find an
+	 * idle server instead and never start a connection, so the
+	 * rest would wait for a wakeup which never comes */
+	pthread_mutex_lock(&router->lock_routing);
+	while (! od_list_empty(&router->routing_waiters)) {
+		od_route_waiter_t *waiter;
+		waiter = od_container_of(router->routing_waiters.next,
+		                         od_route_waiter_t, link);
+		od_list_unlink(&waiter->link);
+		od_list_init(&waiter->link);
+		if (od_route_waiter_grant(waiter) == -1) {
+			od_list_push(&router->routing_waiters, &waiter->link);
+			break;
+		}
+		od_atomic_u32_dec(&router->count_routing_waiters);
+	}
+	pthread_mutex_unlock(&router->lock_routing);
+}
+
+static inline uint32_t
+od_router_wait_left(uint64_t deadline)
+{
+	if (deadline == 0)
+		return UINT32_MAX;
+	uint64_t now = machine_time_us();
+	if (now >= deadline)
+		return 0;
+	return (deadline - now) / 1000;
+}
+
+static inline void
+od_router_attach_server(od_route_t *route, od_client_t *client,
+                        od_server_t *server)
+{
+	/* route must be locked */
+	od_server_pool_set(&route->server_pool, server, OD_SERVER_ACTIVE);
+	od_client_pool_set(&route->client_pool, client, OD_CLIENT_ACTIVE);
+
+	client->server     = server;
+	server->client     = client;
+	server->idle_since = 0;
+	server->idle_check = 0;
+	server->key_client = client->key;
+
+	od_router_t *router = client->global->router;
+	od_router_cancel_index_add(&router->cancel_index, server);
+}
+
+static inline int
+od_router_wait_rate(od_route_t *route, uint64_t deadline,
+                    uint64_t *wait_start)
+{
+	/* pool_rate: clients over the rate wait for the next token */
+	uint64_t rate = route->rule->pool_rate;
+	uint32_t interval = 1000 / rate;
+	if (interval == 0)
+		interval = 1;
+	for (;;) {
+		if (od_route_take(&route->pool_rate_tokens, &route->pool_rate_time,
+		                  rate))
+			return 0;
+		uint32_t left = od_router_wait_left(deadline);
+		if (left == 0)
+			return -1;
+		if (! *wait_start)
+			*wait_start = machine_time_us();
+		machine_sleep(left < interval ? left : interval);
+	}
+}
+
+static inline int
+od_router_quota_take(od_rule_t *rule, od_route_waiter_t *waiter,
+                     uint64_t deadline, uint64_t *wait_start)
+{
+	/* pool_active_max: wait for a free slot of the rule, slots are
+	 * handed to waiters in FIFO order */
+	pthread_mutex_lock(&rule->quota_lock);
+	if (rule->quota_active < od_rules_quota_max(rule) &&
+	    od_list_empty(&rule->quota_waiters)) {
+		rule->quota_active++;
+		pthread_mutex_unlock(&rule->quota_lock);
+		return 0;
+	}
+	od_list_append(&rule->quota_waiters, &waiter->link);
+	pthread_mutex_unlock(&rule->quota_lock);
+	if (! *wait_start)
+		*wait_start = machine_time_us();
+
+	int rc;
+	rc = od_route_waiter_wait(waiter, od_router_wait_left(deadline));
+
+	pthread_mutex_lock(&rule->quota_lock);
+	if (waiter->granted) {
+		/* slot is passed to us by the releasing client */
+		if (rc == -1)
+			od_route_waiter_wait(waiter, 0);
+		waiter->granted = 0;
+		pthread_mutex_unlock(&rule->quota_lock);
+		return 0;
+	}
+	od_list_unlink(&waiter->link);
+	od_list_init(&waiter->link);
+	pthread_mutex_unlock(&rule->quota_lock);
+	return -1;
+}
+
+static inline void
+od_router_quota_put(od_client_t *client)
+{
+	if (! client->quota)
+		return;
+	client->quota = 0;
+	od_route_t *route = client->route;
+	od_rule_t *rule = route->rule;
+	pthread_mutex_lock(&rule->quota_lock);
+	/* slot is not passed on while the fleet share is exceeded */
+	while (rule->quota_active <= od_rules_quota_max(rule) &&
+	       ! od_list_empty(&rule->quota_waiters)) {
+		od_route_waiter_t *waiter;
+		waiter = od_container_of(rule->quota_waiters.next,
+		                         od_route_waiter_t, link);
+		od_list_unlink(&waiter->link);
+		od_list_init(&waiter->link);
+		if (od_route_waiter_grant(waiter) == 0) {
+			pthread_mutex_unlock(&rule->quota_lock);
+			return;
+		}
+		/* waiter will time out */
+	}
+	rule->quota_active--;
+	pthread_mutex_unlock(&rule->quota_lock);
+}
+
+void
+od_router_quota_grant(od_rule_t *rule)
+{
+	/* hand slots of a grown limit to waiters, quota_lock must
+	 * be held */
+	while (rule->quota_active < od_rules_quota_max(rule) &&
+	       ! od_list_empty(&rule->quota_waiters)) {
+		od_route_waiter_t *waiter;
+		waiter = od_container_of(rule->quota_waiters.next,
+		                         od_route_waiter_t, link);
+		od_list_unlink(&waiter->link);
+		od_list_init(&waiter->link);
+		if (od_route_waiter_grant(waiter) == 0)
+			rule->quota_active++;
+	}
+}
+
+static inline int
+od_router_is_batch(od_client_t *client)
+{
+	/* clients with application_name starting with pool_batch
+	 * are queued as batch traffic */
+	od_rule_t *rule = client->rule;
+	if (rule->pool_batch == NULL)
+		return 0;
+	kiwi_var_t *var;
+	var = kiwi_vars_get(&client->vars, KIWI_VAR_APPLICATION_NAME);
+	if (var == NULL || var->value_len == 0)
+		return rule->pool_batch_len == 0;
+	int len = var->value_len - 1;
+	if (len < rule->pool_batch_len)
+		return 0;
+	return memcmp(var->value, rule->pool_batch, rule->pool_batch_len) == 0;
+}
+
+static inline int
+od_router_pool_capacity(od_route_t *route, bool reserve)
+{
+	/* up to pool_reserve_size servers over pool_size are opened for
+	 * clients queued for pool_reserve_timeout, route must be locked */
+	od_rule_t *rule = route->rule;
+	if (rule->pool_size == 0)
+		return 1;
+	int limit = rule->pool_size;
+	if (reserve)
+		limit += rule->pool_reserve_size;
+	return od_server_pool_total(&route->server_pool) < limit;
+}
+
+static inline int
+od_router_cap_capacity(od_route_t *route)
+{
+	/* 1 if the storage has room for a new server, 0 if the route
+	 * holds its share of a full storage, -1 if it is below its
+	 * share and has to preempt a server of another route; route
+	 * must be locked */
+	od_server_cap_t *cap = route->server_pool.cap;
+	if (cap == NULL)
+		return 1;
+	int max = od_route_storage(route)->server_max;
+	if (od_server_cap_room(cap, max))
+		return 1;
+	int total = od_server_pool_total(&route->server_pool);
+	if (total < od_server_cap_share(cap, max, total))
+		return -1;
+	return 0;
+}
+
+static inline int
+od_router_wait_cap(od_server_cap_t *cap, int max, od_route_waiter_t *waiter,
+                   uint32_t time_ms)
+{
+	/* ask for a preemption and wait for a server of the storage
+	 * to close */
+	pthread_mutex_lock(&cap->lock);
+	od_atomic_u32_inc(&cap->count_waiters);
+	if (od_server_cap_room(cap, max)) {
+		od_atomic_u32_dec(&cap->count_waiters);
+		pthread_mutex_unlock(&cap->lock);
+		return 0;
+	}
+	od_atomic_u32_inc(&cap->preempt);
+	od_list_append(&cap->waiters, &waiter->link);
+	pthread_mutex_unlock(&cap->lock);
+
+	int rc;
+	rc = od_route_waiter_wait(waiter, time_ms);
+
+	pthread_mutex_lock(&cap->lock);
+	if (waiter->granted) {
+		/* woken up concurrently with timeout */
+		if (rc == -1)
+			od_route_waiter_wait(waiter, 0);
+		waiter->granted = 0;
+		rc = 0;
+	} else {
+		od_list_unlink(&waiter->link);
+		od_atomic_u32_dec(&cap->count_waiters);
+	}
+	od_list_init(&waiter->link);
+	pthread_mutex_unlock(&cap->lock);
+	return rc;
+}
+
+static od_router_status_t
+od_router_attach_pool(od_router_t *router, od_config_t *config,
+                      od_client_t *client, bool wait_for_idle,
+                      uint64_t deadline, uint64_t wait_start)
+{
+	od_route_t *route = client->route;
+
+	od_route_waiter_t waiter;
+	od_route_waiter_init(&waiter, client);
+	waiter.foreign = od_config_is_multi_workers(config) &&
+	                 !od_worker_pool_is_route_affine(client->global->worker_pool, client);
+	waiter.batch = od_router_is_batch(client);
+
+	uint64_t wait_time = 0;
+
+	od_route_lock(route, OD_LOCK_ATTACH);
+
+	/* enqueue client (pending -> queue) */
+	od_client_pool_set(&route->client_pool, client, OD_CLIENT_QUEUE);
 
 	/* get client server from route server pool */
 	bool restart_read = false;
+	bool read_stopped = false;
+	bool connect_started = false;
+	bool retry = false;
+	bool reserve = false;
 	od_server_t *server;
-	int busyloop_sleep = 0;
-	int busyloop_retry = 0;
 	for (;;)
 	{
-		server = od_server_pool_next(&route->server_pool, OD_SERVER_IDLE);
-		if (server)
-			goto attach;
+		/* waiters are served in FIFO order, a newcomer may take an
+		 * idle server only if nobody is queued, a woken up waiter
+		 * takes it before the queue */
+		if (! route->paused &&
+		    (route->count_waiters == 0 || retry) && od_route_pool_room(route)) {
+			server = od_router_next_idle(route, client);
+			if (server)
+				goto attach;
+		}
 
-		if (wait_for_idle)
+		if (route->paused)
+		{
+			/* clients of paused route are queued until resume */
+		} else if (wait_for_idle)
 		{
 			/* special case, when we are interested only in an idle connection
 			 * and do not want to start a new one */
@@ -341,53 +1443,172 @@ od_router_attach(od_router_t *router, od_config_t *config, od_client_t *client,
 				od_route_unlock(route);
 				return OD_ROUTER_ERROR_TIMEDOUT;
 			}
-		} else
+		} else if (! connect_started)
 		{
 			/* Maybe start new connection, if pool_size is zero */
 			/* Maybe start new connection, if we still have capacity for it */
-			if (route->rule->pool_size == 0 || od_server_pool_total(&route->server_pool) < route->rule->pool_size) {
-				if (od_atomic_u32_of(&router->servers_routing)	>= (uint32_t) route->rule->storage->server_max_routing) {
-					// concurrent server connection in progress.
+			int capacity = 0;
+			if (od_router_pool_capacity(route, reserve) &&
+			    od_route_pool_room(route))
+				capacity = od_router_cap_capacity(route);
+			if (capacity == -1) {
+				/* server_max of the storage is used by other routes */
+				od_server_cap_t *cap = route->server_pool.cap;
+				int max = od_route_storage(route)->server_max;
+				od_route_unlock(route);
+				if (! wait_start)
+					wait_start = machine_time_us();
+				int rc;
+				rc = od_router_wait_cap(cap, max, &waiter,
+				                        od_router_wait_left(deadline));
+				od_route_lock(route, OD_LOCK_ATTACH);
+				if (rc == -1) {
 					od_route_unlock(route);
-					machine_sleep(busyloop_sleep);
-					busyloop_retry++;
-					if (busyloop_retry > 10)
-						busyloop_sleep = 1;
-					od_route_lock(route);
-					continue;
+					od_stat_wait_timeout(od_route_stat(route, client->worker_id));
+					return OD_ROUTER_ERROR_TIMEDOUT;
 				}
-				else {
+				continue;
+			}
+			if (capacity == 1) {
+				uint32_t max_routing;
+				max_routing = od_route_storage(route)->server_max_routing;
+				if (od_atomic_u32_of(&router->servers_routing) < max_routing) {
 					// We are allowed to spun new server connection
-					break;
+					if (! config->server_connect_async ||
+					    kiwi_params_lock_count(&route->params) == 0)
+						break;
+
+					/* connect in background and wait in the queue for
+					 * the first server connection released to us */
+					server = od_server_allocate();
+					if (server == NULL) {
+						od_route_unlock(route);
+						return OD_ROUTER_ERROR;
+					}
+					od_id_generate(&server->id, "s");
+					server->global      = client->global;
+					server->route       = route;
+					server->pool_worker = client->worker_id;
+					od_server_pool_set(&route->server_pool, server, OD_SERVER_ACTIVE);
+					od_atomic_u32_inc(&router->servers_routing);
+					connect_started = true;
+					od_route_unlock(route);
+					int rc;
+					rc = od_worker_pool_connect(client->global->worker_pool, server);
+					if (rc == -1) {
+						od_router_routing_done(router);
+						od_router_drop(router, server);
+						return OD_ROUTER_ERROR;
+					}
+					od_route_lock(route, OD_LOCK_ATTACH);
+					continue;
 				}
+
+				// concurrent server connection in progress.
+				od_route_unlock(route);
+				od_stat_t *stat = od_route_stat(route, client->worker_id);
+				od_stat_wait_routing(stat);
+				if (! wait_start)
+					wait_start = machine_time_us();
+				int rc;
+				rc = od_router_wait_routing(router, &waiter, max_routing,
+				                            od_router_wait_left(deadline));
+				od_route_lock(route, OD_LOCK_ATTACH);
+				if (rc == -1) {
+					od_route_unlock(route);
+					od_stat_wait_timeout(stat);
+					return OD_ROUTER_ERROR_TIMEDOUT;
+				}
+				continue;
 			}
 		}
 
 		/*
 		 * unsubscribe from pending client read events during the time we wait
-		 * for an available server
+		 * for an available server, internal clients have no connection
 		 */
-		restart_read = restart_read || (bool) od_io_read_active(&client->io);
-		od_route_unlock(route);
+		if (! read_stopped && client->io.io) {
+			restart_read = (bool) od_io_read_active(&client->io);
+			read_stopped = true;
+			od_route_unlock(route);
+			int rc = od_io_read_stop(&client->io);
+			if (rc == -1)
+				return OD_ROUTER_ERROR;
+			od_route_lock(route, OD_LOCK_ATTACH);
+			continue;
+		}
 
-		int rc = od_io_read_stop(&client->io);
-		if (rc == -1)
-			return OD_ROUTER_ERROR;
+		/* foreign waiters ask owner of the route to detach
+		 * servers on release */
+		od_route_enqueue(route, &waiter);
+		uint64_t wait_deadline = 0;
+		uint64_t pause_start = 0;
+		if (route->paused)
+			pause_start = machine_time_us();
+		else
+			wait_deadline = od_route_codel_deadline(route, &waiter, deadline);
+
+		/* wake up to open a reserve server once queued for
+		 * pool_reserve_timeout */
+		bool reserve_wait = false;
+		if (! route->paused && ! reserve && ! wait_for_idle &&
+		    route->rule->pool_reserve_size > 0 && route->rule->pool_size > 0) {
+			uint64_t reserve_deadline;
+			reserve_deadline = waiter.time_start +
+			                   route->rule->pool_reserve_timeout * 1000ull;
+			if (wait_deadline == 0 || reserve_deadline < wait_deadline) {
+				wait_deadline = reserve_deadline;
+				reserve_wait  = true;
+			}
+		}
+		od_route_unlock(route);
+		if (! wait_start)
+			wait_start = waiter.time_start;
 
 		/*
-		 * Wait wakeup condition for pool_timeout milliseconds.
-		 *
-		 * The condition triggered when a server connection
-		 * put into idle state by DETACH events.
+		 * Wait until a detached server connection is handed to us,
+		 * or a closed one frees space in the pool.
 		 */
-		uint32_t timeout = route->rule->pool_timeout;
-		if (timeout == 0)
-			timeout = UINT32_MAX;
-		rc = od_route_wait(route, timeout);
-		if (rc == -1)
-			return OD_ROUTER_ERROR_TIMEDOUT;
+		int rc;
+		rc = od_route_waiter_wait(&waiter, od_router_wait_left(wait_deadline));
+
+		/* time of pause is not counted in pool_timeout */
+		if (pause_start && deadline)
+			deadline += machine_time_us() - pause_start;
 
-		od_route_lock(route);
+		/* server is already attached to the client by detach */
+		if (rc == 0 && waiter.server) {
+			server = waiter.server;
+			goto attached;
+		}
+
+		od_route_lock(route, OD_LOCK_ATTACH);
+		if (waiter.granted) {
+			/* woken up concurrently with timeout */
+			if (rc == -1)
+				od_route_waiter_wait(&waiter, 0);
+			waiter.granted = 0;
+			if (waiter.server) {
+				server = waiter.server;
+				od_route_unlock(route);
+				goto attached;
+			}
+			retry = true;
+			continue;
+		}
+		if (reserve_wait) {
+			/* keeps its place in the queue if the reserve is used up */
+			od_route_dequeue(route, &waiter);
+			reserve = true;
+			connect_started = false;
+			retry = true;
+			continue;
+		}
+		od_route_dequeue(route, &waiter);
+		od_route_codel(route, waiter.time_start);
+		od_route_unlock(route);
+		od_stat_wait_timeout(od_route_stat(route, client->worker_id));
+		return OD_ROUTER_ERROR_TIMEDOUT;
 	}
 
 	od_route_unlock(route);
@@ -400,22 +1621,30 @@ od_router_attach(od_router_t *router, od_config_t *config, od_client_t *client,
 	server->global = client->global;
 	server->route  = route;
 
-	od_route_lock(route);
+	od_route_lock(route, OD_LOCK_ATTACH);
 
 attach:
-	od_server_pool_set(&route->server_pool, server, OD_SERVER_ACTIVE);
-	od_client_pool_set(&route->client_pool, client, OD_CLIENT_ACTIVE);
-
-	client->server     = server;
-	server->client     = client;
-	server->idle_time  = 0;
-	server->key_client = client->key;
-
+	/* clients served without queueing end an overload */
+	if (waiter.time_start == 0)
+		od_route_codel(route, 0);
+	od_router_attach_server(route, client, server);
 	od_route_unlock(route);
 
+attached:
+	/* time in queue, including waits for server_max_routing */
+	if (wait_start) {
+		wait_time = machine_time_us() - wait_start;
+		od_stat_wait(od_route_stat(route, client->worker_id), wait_time);
+	}
+	od_trace3(attach, client->id.id_a, server->id.id_a, wait_time);
+
 	/* attach server io to clients machine context */
-	if (server->io.io && od_config_is_multi_workers(config))
+	if (server->io_worker != -1) {
+		/* still attached to this worker since the last use */
+		server->io_worker = -1;
+	} else if (server->io.io && od_config_is_multi_workers(config)) {
 		od_io_attach(&server->io);
+	}
 
 	/* maybe restore read events subscription */
 	if (restart_read)
@@ -424,111 +1653,324 @@ attach:
 	return OD_ROUTER_OK;
 }
 
+od_router_status_t
+od_router_attach(od_router_t *router, od_config_t *config, od_client_t *client,
+                 bool wait_for_idle)
+{
+	od_route_t *route = client->route;
+	assert(route != NULL);
+	od_client_wait(client, OD_CLIENT_WAIT_POOL);
+
+	if (client->wait_channel == NULL) {
+		/* fleet machine hands quota slots to waiters too */
+		int is_shared;
+		is_shared = od_config_is_multi_workers(config) || config->fleet_port;
+		client->wait_channel = machine_channel_create(is_shared);
+		if (client->wait_channel == NULL)
+			return OD_ROUTER_ERROR;
+	}
+
+	/* wait for pool_timeout milliseconds in total */
+	uint64_t wait_start = 0;
+	uint64_t deadline = 0;
+	if (route->rule->pool_timeout)
+		deadline = machine_time_us() + route->rule->pool_timeout * 1000ull;
+
+	/* clients over pool_rate or pool_active_max are queued */
+	od_rule_t *rule = route->rule;
+	int rc;
+	if (rule->pool_rate > 0) {
+		rc = od_router_wait_rate(route, deadline, &wait_start);
+		if (rc == -1) {
+			od_stat_wait_timeout(od_route_stat(route, client->worker_id));
+			return OD_ROUTER_ERROR_TIMEDOUT;
+		}
+	}
+	if ((rule->pool_active_max > 0 || rule->pool_fleet_max > 0) &&
+	    ! client->quota) {
+		od_route_waiter_t waiter;
+		od_route_waiter_init(&waiter, client);
+		rc = od_router_quota_take(rule, &waiter, deadline, &wait_start);
+		if (rc == -1) {
+			od_stat_wait_timeout(od_route_stat(route, client->worker_id));
+			return OD_ROUTER_ERROR_TIMEDOUT;
+		}
+		client->quota = 1;
+	}
+
+	od_router_status_t status;
+	status = od_router_attach_pool(router, config, client, wait_for_idle,
+	                               deadline, wait_start);
+	if (status != OD_ROUTER_OK)
+		od_router_quota_put(client);
+	return status;
+}
+
+static inline void
+od_router_put(od_route_t *route, od_server_t *server)
+{
+	/* hand the server directly to the oldest waiter, which may
+	 * leave as soon as it is granted; route must be locked */
+	od_route_waiter_t *waiter;
+	waiter = od_route_next_waiter(route);
+	/* servers above the adaptive limit are kept idle */
+	if (waiter && route->rule->pool_adaptive && ! server->connect_failed &&
+	    route->server_pool.count_active > route->pool_limit)
+		waiter = NULL;
+	if (waiter) {
+		od_client_t *waiter_client = waiter->client;
+		od_route_serve(route, waiter);
+		od_router_attach_server(route, waiter_client, server);
+		waiter->server = server;
+		int rc;
+		rc = od_route_waiter_grant(waiter);
+		if (rc == 0)
+			return;
+		od_router_t *router = waiter_client->global->router;
+		od_router_cancel_index_remove(&router->cancel_index, server);
+		waiter->server = NULL;
+		waiter_client->server = NULL;
+		server->client = NULL;
+		od_client_pool_set(&route->client_pool, waiter_client, OD_CLIENT_QUEUE);
+		od_route_enqueue(route, waiter);
+	}
+	od_server_pool_set(&route->server_pool, server, OD_SERVER_IDLE);
+}
+
+static inline int
+od_router_replace(od_router_t *router, od_client_t *client)
+{
+	/* connect a server in background in place of a recycled one,
+	 * if the pool has room for it */
+	od_route_t *route = client->route;
+	od_rule_t *rule = route->rule;
+	od_route_lock(route, OD_LOCK_ATTACH);
+	if (route->paused) {
+		/* opened by prewarm after resume */
+		route->count_replace++;
+		od_route_unlock(route);
+		return 0;
+	}
+	if (rule->obsolete ||
+	    (rule->pool_size > 0 &&
+	     od_server_pool_total(&route->server_pool) >= rule->pool_size) ||
+	    od_router_cap_capacity(route) != 1) {
+		od_route_unlock(route);
+		return -1;
+	}
+	uint32_t max_routing = od_route_storage(route)->server_max_routing;
+	if (od_atomic_u32_of(&router->servers_routing) >= max_routing) {
+		/* opened by prewarm on the next tick */
+		route->count_replace++;
+		od_route_unlock(route);
+		return 0;
+	}
+	od_server_t *server = od_server_allocate();
+	if (server == NULL) {
+		od_route_unlock(route);
+		return -1;
+	}
+	od_id_generate(&server->id, "s");
+	server->global      = client->global;
+	server->route       = route;
+	server->pool_worker = client->worker_id;
+	od_server_pool_set(&route->server_pool, server, OD_SERVER_ACTIVE);
+	od_atomic_u32_inc(&router->servers_routing);
+	od_route_unlock(route);
+	int rc;
+	rc = od_worker_pool_connect(client->global->worker_pool, server);
+	if (rc == -1) {
+		od_router_routing_done(router);
+		od_router_drop(router, server);
+		return -1;
+	}
+	return 0;
+}
+
 void
 od_router_detach(od_router_t *router, od_config_t *config, od_client_t *client)
 {
-	(void)router;
 	od_route_t *route = client->route;
 	assert(route != NULL);
 
-	/* detach from current machine event loop */
+	/* close server over server_lifetime or of a paused route, its
+	 * replacement is started first when the pool has room, otherwise
+	 * after the close */
 	od_server_t *server = client->server;
-	if (od_config_is_multi_workers(config))
-		od_io_detach(&server->io);
+	uint64_t now = machine_time_us();
+	if (route->paused || od_server_recycle(server, now)) {
+		od_trace2(detach, client->id.id_a, server->id.id_a);
+		int rc = od_router_replace(router, client);
+		od_router_close(router, client);
+		if (rc == -1)
+			od_router_replace(router, client);
+		return;
+	}
 
-	od_route_lock(route);
+	/* sample network of the storage host on the way to the pool */
+	od_rule_storage_t *storage = od_route_storage(route);
+	od_server_pool_tcp_t tcp;
+	int tcp_sampled = 0;
+	if (server->endpoint >= 0 &&
+	    od_server_pool_endpoint_tcp_due(&route->server_pool, server->endpoint,
+	                                    storage->tcp_info_interval, now))
+		tcp_sampled = od_backend_tcp_info(server, &tcp) == 0;
+
+	/* detach from current machine event loop, keep it attached if
+	 * the server will be reused by the same worker */
+	od_trace2(detach, client->id.id_a, server->id.id_a);
+	od_route_lock(route, OD_LOCK_DETACH);
+	if (tcp_sampled)
+		od_server_pool_endpoint_tcp(&route->server_pool, server->endpoint,
+		                            &tcp, now);
+
+	/* hand the slot to a route below its share of server_max */
+	if (od_route_next_waiter(route) == NULL && od_router_cap_preempt(route)) {
+		od_route_unlock(route);
+		od_router_close(router, client);
+		return;
+	}
+	if (od_config_is_multi_workers(config)) {
+		od_route_waiter_t *waiter;
+		waiter = od_route_next_waiter(route);
+		int keep;
+		if (waiter)
+			keep = waiter->client->worker_id == client->worker_id;
+		else
+			keep = route->foreign_waiters == 0 &&
+			       od_worker_pool_is_route_affine(client->global->worker_pool, client);
+		if (keep) {
+			server->io_worker = client->worker_id;
+		} else {
+			od_route_unlock(route);
+			od_io_detach(&server->io);
+			od_route_lock(route, OD_LOCK_DETACH);
+		}
+	}
 
+	od_router_cancel_index_remove(&router->cancel_index, server);
 	client->server = NULL;
 	server->client = NULL;
-	od_server_pool_set(&route->server_pool, server, OD_SERVER_IDLE);
+	server->pool_worker = client->worker_id;
 	od_client_pool_set(&route->client_pool, client, OD_CLIENT_PENDING);
 
-	int signal = route->client_pool.count_queue > 0;
+	od_router_put(route, server);
 	od_route_unlock(route);
 
-	/* notify waiters */
-	if (signal)
-		od_route_signal(route);
+	od_router_quota_put(client);
 }
 
 void
-od_router_close(od_router_t *router, od_client_t *client)
+od_router_release(od_router_t *router, od_config_t *config, od_server_t *server)
 {
+	/* put server connected in background to the pool, or hand
+	 * a failed one to a waiter which reports the error */
+	od_route_t *route = server->route;
+	od_route_lock(route, OD_LOCK_DETACH);
+	if (od_config_is_multi_workers(config) && server->io.io) {
+		od_route_waiter_t *waiter;
+		waiter = od_route_next_waiter(route);
+		if (waiter && waiter->client->worker_id == server->pool_worker) {
+			server->io_worker = server->pool_worker;
+		} else {
+			od_route_unlock(route);
+			od_io_detach(&server->io);
+			od_route_lock(route, OD_LOCK_DETACH);
+		}
+	}
+	if (route->paused) {
+		/* route has been paused while connecting */
+		if (! server->connect_failed)
+			route->count_replace++;
+		od_route_unlock(route);
+		od_router_drop(router, server);
+		return;
+	}
+	if (! server->connect_failed) {
+		od_router_put(route, server);
+		od_route_unlock(route);
+		return;
+	}
+	if (od_route_next_waiter(route))
+		od_router_put(route, server);
+	if (server->client) {
+		od_route_unlock(route);
+		return;
+	}
+	/* nobody took it, keep it out of the idle list */
+	od_server_pool_set(&route->server_pool, server, OD_SERVER_ACTIVE);
+	od_route_unlock(route);
+	od_router_drop(router, server);
+}
+
+void
+od_router_drop(od_router_t *router, od_server_t *server)
+{
+	/* close server which has no client attached */
 	(void)router;
+	od_route_t *route = server->route;
+	od_backend_close_connection(server);
+
+	od_route_lock(route, OD_LOCK_DETACH);
+	od_server_pool_set(&route->server_pool, server, OD_SERVER_UNDEF);
+	server->route = NULL;
+	od_route_signal(route);
+	od_route_unlock(route);
+
+	assert(server->io.io == NULL);
+	od_server_free(server);
+}
+
+void
+od_router_close(od_router_t *router, od_client_t *client)
+{
 	od_route_t *route = client->route;
 	assert(route != NULL);
 
 	od_server_t *server = client->server;
 	od_backend_close_connection(server);
 
-	od_route_lock(route);
+	od_route_lock(route, OD_LOCK_DETACH);
 
+	od_router_cancel_index_remove(&router->cancel_index, server);
 	od_client_pool_set(&route->client_pool, client, OD_CLIENT_PENDING);
 	od_server_pool_set(&route->server_pool, server, OD_SERVER_UNDEF);
 	client->server = NULL;
 	server->client = NULL;
 	server->route  = NULL;
 
+	/* pool has space for a new server connection now */
+	od_route_signal(route);
+
 	od_route_unlock(route);
 
+	od_router_quota_put(client);
+
 	assert(server->io.io == NULL);
 	od_server_free(server);
 }
 
-static inline int
-od_router_cancel_cmp(od_server_t *server, void **argv)
-{
-	return kiwi_key_cmp(&server->key_client, argv[0]);
-}
-
-static inline int
-od_router_cancel_cb(od_route_t *route, void **argv)
-{
-	od_route_lock(route);
-
-	od_server_t *server;
-	server = od_server_pool_foreach(&route->server_pool, OD_SERVER_ACTIVE,
-	                                od_router_cancel_cmp, argv);
-	if (server)
-	{
-		od_router_cancel_t *cancel = argv[1];
-		cancel->id     = server->id;
-		cancel->key    = server->key;
-		cancel->storage = od_rules_storage_copy(route->rule->storage);
-		od_route_unlock(route);
-		if (cancel->storage == NULL)
-			return -1;
-		return 1;
-	}
-
-	od_route_unlock(route);
-	return 0;
-}
-
 od_router_status_t
 od_router_cancel(od_router_t *router, kiwi_key_t *key, od_router_cancel_t *cancel)
 {
 	/* match server by client forged key */
-	void *argv[] = { key, cancel };
 	int rc;
-	rc = od_router_foreach(router, od_router_cancel_cb, argv);
+	rc = od_router_cancel_index_find(&router->cancel_index, key, cancel);
 	if (rc <= 0)
 		return OD_ROUTER_ERROR_NOT_FOUND;
 	return OD_ROUTER_OK;
 }
 
 static inline int
-od_router_kill_cb(od_route_t *route, void **argv)
+od_router_kill_cb(od_client_t *client, void **argv)
 {
-	od_route_lock(route);
-	od_route_kill_client(route, argv[0]);
-	od_route_unlock(route);
+	(void)argv;
+	od_client_kill(client);
 	return 0;
 }
 
 void
 od_router_kill(od_router_t *router, od_id_t *id)
 {
-	void *argv[] = { id };
-	od_router_foreach(router, od_router_kill_cb, argv);
+	od_client_index_find(&router->client_index, id, od_router_kill_cb, NULL);
 }
@@ -7,7 +7,8 @@
  * Scalable PostgreSQL connection pooler.
 */
 
-typedef struct od_router od_router_t;
+typedef struct od_router       od_router_t;
+typedef struct od_router_pause od_router_pause_t;
 
 typedef enum
 {
@@ -16,39 +17,144 @@ typedef enum
 	OD_ROUTER_ERROR_NOT_FOUND,
 	OD_ROUTER_ERROR_LIMIT,
 	OD_ROUTER_ERROR_LIMIT_ROUTE,
+	OD_ROUTER_ERROR_LIMIT_MEMORY,
 	OD_ROUTER_ERROR_TIMEDOUT,
-	OD_ROUTER_ERROR_REPLICATION
+	OD_ROUTER_ERROR_REPLICATION,
+	OD_ROUTER_ERROR_SHARD
 } od_router_status_t;
 
+/* paused database, all of them if database is not set */
+struct od_router_pause
+{
+	char      *database;
+	od_list_t  link;
+};
+
 struct od_router
 {
-	pthread_mutex_t lock;
-	od_rules_t      rules;
-	od_route_pool_t route_pool;
-	od_atomic_u32_t clients;
-	od_atomic_u32_t clients_routing;
-	od_atomic_u32_t servers_routing;
+	pthread_rwlock_t lock;
+	od_rules_t       rules;
+	od_route_pool_t  route_pool;
+	od_atomic_u32_t  clients;
+	od_atomic_u32_t  clients_routing;
+	od_atomic_u64_t  login_time;
+	od_atomic_u64_t  relay_memory;
+	od_atomic_u32_t  servers_routing;
+	pthread_mutex_t  lock_routing;
+	od_list_t        routing_waiters;
+	od_atomic_u32_t  count_routing_waiters;
+	pthread_mutex_t  lock_caps;
+	od_list_t        caps;
+	od_router_cancel_index_t cancel_index;
+	od_client_index_t client_index;
+	pthread_mutex_t  lock_gc;
+	od_list_t        gc;
+	int              count_gc;
+	od_list_t        paused;
+	od_atomic_u32_t  count_paused;
 };
 
+/* Router lock protects rules and the paused list. Routes are protected by the
+ * route pool shard locks.
+ *
+ * Routes which may be freed, dynamic ones left without clients
+ * and routes of obsolete rules, are queued on the gc list, so
+ * gc does not scan the whole route pool. Lock of the gc list is
+ * taken after the route lock. */
+
+#define OD_ROUTER_GC_BUDGET 1000
+
+static inline void
+od_router_gc_add(od_router_t *router, od_route_t *route)
+{
+	/* route must be locked */
+	pthread_mutex_lock(&router->lock_gc);
+	if (od_list_empty(&route->link_gc)) {
+		od_list_append(&router->gc, &route->link_gc);
+		router->count_gc++;
+	}
+	pthread_mutex_unlock(&router->lock_gc);
+}
+
+static inline void
+od_router_gc_remove(od_router_t *router, od_route_t *route)
+{
+	/* route must be locked */
+	pthread_mutex_lock(&router->lock_gc);
+	if (! od_list_empty(&route->link_gc)) {
+		od_list_unlink(&route->link_gc);
+		od_list_init(&route->link_gc);
+		router->count_gc--;
+	}
+	pthread_mutex_unlock(&router->lock_gc);
+}
+
+static inline int
+od_router_gc_candidate(od_route_t *route)
+{
+	/* route must be locked */
+	if (od_client_pool_total(&route->client_pool) > 0)
+		return 0;
+	return od_route_is_dynamic(route) || route->rule->obsolete;
+}
+
 static inline void
-od_router_lock(od_router_t *router)
+od_router_login_account(od_router_t *router, uint64_t time_us)
 {
-	pthread_mutex_lock(&router->lock);
+	/* moving average of accept to routing time of recent logins,
+	 * updates racing between workers can be lost */
+	uint64_t avg = od_atomic_u64_of(&router->login_time);
+	od_atomic_u64_set(&router->login_time, avg - avg / 8 + time_us / 8);
+}
+
+static inline void
+od_router_lock(od_router_t *router, od_lock_site_t site)
+{
+	if (od_likely(! od_lockstat.enabled)) {
+		pthread_rwlock_wrlock(&router->lock);
+		return;
+	}
+	uint64_t start = od_lockstat_now();
+	pthread_rwlock_wrlock(&router->lock);
+	od_lockstat_router_acquired(site, start);
+}
+
+static inline void
+od_router_lock_read(od_router_t *router, od_lock_site_t site)
+{
+	if (od_likely(! od_lockstat.enabled)) {
+		pthread_rwlock_rdlock(&router->lock);
+		return;
+	}
+	uint64_t start = od_lockstat_now();
+	pthread_rwlock_rdlock(&router->lock);
+	od_lockstat_router_acquired(site, start);
 }
 
 static inline void
 od_router_unlock(od_router_t *router)
 {
-	pthread_mutex_unlock(&router->lock);
+	if (od_unlikely(od_lockstat.enabled))
+		od_lockstat_router_released();
+	pthread_rwlock_unlock(&router->lock);
 }
 
 void od_router_init(od_router_t*);
 void od_router_free(od_router_t*);
 int  od_router_reconfigure(od_router_t*, od_rules_t*);
 int  od_router_expire(od_router_t*, od_list_t*);
+int  od_router_expire_hosts(od_router_t*, od_list_t*);
 void od_router_gc(od_router_t*);
+void od_router_prewarm_routes(od_router_t*, od_config_t*);
+int  od_router_prewarm(od_router_t*, od_global_t*, od_server_t**, int);
+void od_router_adapt(od_router_t*);
+int  od_router_check(od_router_t*, od_server_t**, int);
 void od_router_stat(od_router_t*, uint64_t, int, od_route_pool_stat_cb_t, void**);
 int  od_router_foreach(od_router_t*, od_route_pool_cb_t, void**);
+int  od_router_pause(od_router_t*, char*);
+int  od_router_pause_servers(od_router_t*);
+int  od_router_resume(od_router_t*, char*);
+void od_router_quota_grant(od_rule_t*);
 
 od_router_status_t
 od_router_route(od_router_t*, od_config_t*, od_client_t*);
@@ -56,6 +162,9 @@ od_router_route(od_router_t*, od_config_t*, od_client_t*);
 void
 od_router_unroute(od_router_t*, od_client_t*);
 
+void
+od_router_reroute(od_router_t*, od_client_t*, od_route_t*);
+
 od_router_status_t
 od_router_attach(od_router_t*, od_config_t*, od_client_t*, bool);
 
@@ -65,6 +174,15 @@ od_router_detach(od_router_t*, od_config_t*, od_client_t*);
 void
 od_router_close(od_router_t*, od_client_t*);
 
+void
+od_router_release(od_router_t*, od_config_t*, od_server_t*);
+
+void
+od_router_drop(od_router_t*, od_server_t*);
+
+void
+od_router_routing_done(od_router_t*);
+
 od_router_status_t
 od_router_cancel(od_router_t*, kiwi_key_t*, od_router_cancel_t*);
 
@@ -11,6 +11,7 @@ typedef struct
 {
 	od_id_t            id;
 	od_rule_storage_t *storage;
+	int                endpoint;
 	kiwi_key_t         key;
 } od_router_cancel_t;
 
@@ -18,6 +19,7 @@ static inline void
 od_router_cancel_init(od_router_cancel_t *cancel)
 {
 	cancel->storage = NULL;
+	cancel->endpoint = -1;
 	kiwi_key_init(&cancel->key);
 }
 
@@ -28,4 +30,99 @@ od_router_cancel_free(od_router_cancel_t *cancel)
 		od_rules_storage_free(cancel->storage);
 }
 
+/* Servers attached to clients are indexed by the client key, so
+ * cancel requests are matched without scanning routes. Buckets are
+ * protected by shard locks, taken with the route lock held.
+*/
+
+#define OD_ROUTER_CANCEL_BUCKETS 16384
+#define OD_ROUTER_CANCEL_SHARDS  64
+
+typedef struct
+{
+	pthread_mutex_t locks[OD_ROUTER_CANCEL_SHARDS];
+	od_list_t       buckets[OD_ROUTER_CANCEL_BUCKETS];
+} od_router_cancel_index_t;
+
+static inline void
+od_router_cancel_index_init(od_router_cancel_index_t *index)
+{
+	int i;
+	for (i = 0; i < OD_ROUTER_CANCEL_SHARDS; i++)
+		pthread_mutex_init(&index->locks[i], NULL);
+	for (i = 0; i < OD_ROUTER_CANCEL_BUCKETS; i++)
+		od_list_init(&index->buckets[i]);
+}
+
+static inline void
+od_router_cancel_index_free(od_router_cancel_index_t *index)
+{
+	int i;
+	for (i = 0; i < OD_ROUTER_CANCEL_SHARDS; i++)
+		pthread_mutex_destroy(&index->locks[i]);
+}
+
+static inline uint32_t
+od_router_cancel_index_hash(kiwi_key_t *key)
+{
+	return (key->key ^ (key->key_pid * 2654435761U)) &
+	       (OD_ROUTER_CANCEL_BUCKETS - 1);
+}
+
+static inline pthread_mutex_t*
+od_router_cancel_index_lock(od_router_cancel_index_t *index, uint32_t hash)
+{
+	return &index->locks[hash & (OD_ROUTER_CANCEL_SHARDS - 1)];
+}
+
+static inline void
+od_router_cancel_index_add(od_router_cancel_index_t *index,
+                           od_server_t *server)
+{
+	uint32_t hash = od_router_cancel_index_hash(&server->key_client);
+	pthread_mutex_t *lock = od_router_cancel_index_lock(index, hash);
+	pthread_mutex_lock(lock);
+	od_list_append(&index->buckets[hash], &server->link_cancel);
+	pthread_mutex_unlock(lock);
+}
+
+static inline void
+od_router_cancel_index_remove(od_router_cancel_index_t *index,
+                              od_server_t *server)
+{
+	uint32_t hash = od_router_cancel_index_hash(&server->key_client);
+	pthread_mutex_t *lock = od_router_cancel_index_lock(index, hash);
+	pthread_mutex_lock(lock);
+	od_list_unlink(&server->link_cancel);
+	od_list_init(&server->link_cancel);
+	pthread_mutex_unlock(lock);
+}
+
+static inline int
+od_router_cancel_index_find(od_router_cancel_index_t *index, kiwi_key_t *key,
+                            od_router_cancel_t *cancel)
+{
+	/* server can not be detached or freed while it is indexed */
+	uint32_t hash = od_router_cancel_index_hash(key);
+	pthread_mutex_t *lock = od_router_cancel_index_lock(index, hash);
+	pthread_mutex_lock(lock);
+	od_list_t *i;
+	od_list_foreach(&index->buckets[hash], i) {
+		od_server_t *server;
+		server = od_container_of(i, od_server_t, link_cancel);
+		if (! kiwi_key_cmp(&server->key_client, key))
+			continue;
+		cancel->id       = server->id;
+		cancel->key      = server->key;
+		cancel->endpoint = server->endpoint;
+		cancel->storage  = od_rules_storage_copy(od_route_storage(server->route));
+		pthread_mutex_unlock(lock);
+		if (cancel->storage == NULL)
+			return -1;
+		return 1;
+	}
+	pthread_mutex_unlock(lock);
+	return 0;
+}
+
 #endif /* ODYSSEY_ROUTER_CANCEL_H */
@@ -23,6 +23,12 @@ od_rules_init(od_rules_t *rules)
 {
 	od_list_init(&rules->storages);
 	od_list_init(&rules->rules);
+	rules->storages_index = NULL;
+	rules->storages_index_size = 0;
+	rules->index = NULL;
+	rules->index_size = 0;
+	rules->index_count = 0;
+	rules->index_default = NULL;
 }
 
 static inline void
@@ -37,6 +43,10 @@ od_rules_free(od_rules_t *rules)
 		rule = od_container_of(i, od_rule_t, link);
 		od_rules_rule_free(rule);
 	}
+	if (rules->index)
+		free(rules->index);
+	if (rules->storages_index)
+		free(rules->storages_index);
 }
 
 static inline od_rule_storage_t*
@@ -47,6 +57,10 @@ od_rules_storage_allocate(void)
 	if (storage == NULL)
 		return NULL;
 	memset(storage, 0, sizeof(*storage));
+	storage->mux_links = 2;
+	storage->breaker_backoff = 1000;
+	storage->breaker_backoff_max = 30000;
+	od_breaker_init(&storage->breaker);
 	od_list_init(&storage->link);
 	return storage;
 }
@@ -60,6 +74,20 @@ od_rules_storage_free(od_rule_storage_t *storage)
 		free(storage->type);
 	if (storage->host)
 		free(storage->host);
+	if (storage->endpoints) {
+		int i;
+		for (i = 0; i < storage->endpoints_count; i++)
+			free(storage->endpoints[i].host);
+		free(storage->endpoints);
+	}
+	if (storage->load_balance)
+		free(storage->load_balance);
+	if (storage->target_session_attrs)
+		free(storage->target_session_attrs);
+	if (storage->health_check_db)
+		free(storage->health_check_db);
+	if (storage->health_check_user)
+		free(storage->health_check_user);
 	if (storage->tls)
 		free(storage->tls);
 	if (storage->tls_ca_file)
@@ -70,6 +98,9 @@ od_rules_storage_free(od_rule_storage_t *storage)
 		free(storage->tls_cert_file);
 	if (storage->tls_protocols)
 		free(storage->tls_protocols);
+	if (storage->tls_handler)
+		machine_tls_free(storage->tls_handler);
+	od_breaker_free(&storage->breaker);
 	od_list_unlink(&storage->link);
 	free(storage);
 }
@@ -85,19 +116,6 @@ od_rules_storage_add(od_rules_t *rules)
 	return storage;
 }
 
-od_rule_storage_t*
-od_rules_storage_match(od_rules_t *rules, char *name)
-{
-	od_list_t *i;
-	od_list_foreach(&rules->storages, i) {
-		od_rule_storage_t *storage;
-		storage = od_container_of(i, od_rule_storage_t, link);
-		if (strcmp(storage->name, name) == 0)
-			return storage;
-	}
-	return NULL;
-}
-
 od_rule_storage_t*
 od_rules_storage_copy(od_rule_storage_t *storage)
 {
@@ -108,6 +126,25 @@ od_rules_storage_copy(od_rule_storage_t *storage)
 	copy->storage_type = storage->storage_type;
 	copy->name = strdup(storage->name);
 	copy->server_max_routing = storage->server_max_routing;
+	copy->server_max = storage->server_max;
+	copy->cancel_rate = storage->cancel_rate;
+	copy->breaker_threshold = storage->breaker_threshold;
+	copy->breaker_backoff = storage->breaker_backoff;
+	copy->breaker_backoff_max = storage->breaker_backoff_max;
+	copy->tls_ktls = storage->tls_ktls;
+	copy->tls_async = storage->tls_async;
+	copy->tls_direct = storage->tls_direct;
+	copy->compression = storage->compression;
+	copy->mux_links = storage->mux_links;
+	copy->sndbuf = storage->sndbuf;
+	copy->rcvbuf = storage->rcvbuf;
+	copy->tcp_notsent_lowat = storage->tcp_notsent_lowat;
+	copy->tcp_user_timeout = storage->tcp_user_timeout;
+	copy->tcp_quickack = storage->tcp_quickack;
+	copy->tcp_fastopen_connect = storage->tcp_fastopen_connect;
+	copy->busy_poll = storage->busy_poll;
+	copy->zerocopy_threshold = storage->zerocopy_threshold;
+	copy->tcp_info_interval = storage->tcp_info_interval;
 	if (copy->name == NULL)
 		goto error;
 	copy->type = strdup(storage->type);
@@ -119,6 +156,47 @@ od_rules_storage_copy(od_rule_storage_t *storage)
 			goto error;
 	}
 	copy->port = storage->port;
+	if (storage->endpoints_count > 0) {
+		copy->endpoints = malloc(sizeof(od_rule_storage_endpoint_t) *
+		                         storage->endpoints_count);
+		if (copy->endpoints == NULL)
+			goto error;
+		int i;
+		for (i = 0; i < storage->endpoints_count; i++) {
+			copy->endpoints[i] = storage->endpoints[i];
+			copy->endpoints[i].host = strdup(storage->endpoints[i].host);
+			if (copy->endpoints[i].host == NULL)
+				goto error;
+			copy->endpoints_count++;
+		}
+	}
+	copy->lb = storage->lb;
+	if (storage->load_balance) {
+		copy->load_balance = strdup(storage->load_balance);
+		if (copy->load_balance == NULL)
+			goto error;
+	}
+	copy->target = storage->target;
+	if (storage->target_session_attrs) {
+		copy->target_session_attrs = strdup(storage->target_session_attrs);
+		if (copy->target_session_attrs == NULL)
+			goto error;
+	}
+	copy->health_check_interval = storage->health_check_interval;
+	copy->health_check_timeout = storage->health_check_timeout;
+	copy->health_check_max_lag = storage->health_check_max_lag;
+	copy->health_check_max_rtt = storage->health_check_max_rtt;
+	if (storage->health_check_db) {
+		copy->health_check_db = strdup(storage->health_check_db);
+		if (copy->health_check_db == NULL)
+			goto error;
+	}
+	if (storage->health_check_user) {
+		copy->health_check_user = strdup(storage->health_check_user);
+		if (copy->health_check_user == NULL)
+			goto error;
+	}
+	copy->health_check_time = storage->health_check_time;
 	copy->tls_mode = storage->tls_mode;
 	if (storage->tls) {
 		copy->tls = strdup(storage->tls);
@@ -195,15 +273,48 @@ od_rules_add(od_rules_t *rules)
 		return NULL;
 	memset(rule, 0, sizeof(*rule));
 	rule->pool_size = 0;
+	rule->pool_min_size = 0;
 	rule->pool_timeout = 0;
+	rule->pool_reserve_size = 0;
+	rule->pool_reserve_timeout = 5000;
+	rule->pool_codel_target = 0;
+	rule->pool_codel_interval = 100;
 	rule->pool_discard = 1;
 	rule->pool_cancel = 1;
 	rule->pool_rollback = 1;
+	rule->pool_prepared_statements = 0;
+	rule->pool_prepared_statements_max = 0;
+	rule->pool_pipeline = 0;
+	rule->pool_pipeline_depth = 16;
+	rule->pool_batch_weight = 4;
+	rule->pool_wal_relay_size = 64 * 1024 * 1024;
+	rule->pool_share = rule;
+	rule->log_query_sample = 0;
+	rule->log_query_sample_random = 0;
+	rule->capture_sample = 0;
+	rule->storage_mirror_sample = 1;
+	rule->storage_mirror_pool_size = 4;
+	rule->log_query_rate = 0;
+	rule->log_query_min_duration = 0;
+	rule->query_cache = NULL;
+	rule->query_cache_ttl = 0;
+	rule->query_cache_size = 65536;
+	od_query_cache_init(&rule->query_cache_replies);
+	rule->quantiles_precision = OD_HGRAM_PRECISION_DEFAULT;
 	rule->obsolete = 0;
 	rule->mark = 0;
 	rule->refs = 0;
 	rule->auth_common_name_default = 0;
 	rule->auth_common_names_count = 0;
+	rule->auth_query_cache_ttl = 0;
+	rule->auth_query_cache_negative_ttl = 0;
+	rule->auth_query_cache_max = 1000;
+	od_auth_cache_init(&rule->auth_query_cache);
+	rule->auth_pam_cache_ttl = 0;
+	od_auth_cache_init(&rule->auth_pam_cache);
+	pthread_mutex_init(&rule->quota_lock, NULL);
+	rule->quota_active = 0;
+	od_list_init(&rule->quota_waiters);
 	od_list_init(&rule->auth_common_names);
 	od_list_init(&rule->link);
 	od_list_append(&rules->rules, &rule->link);
@@ -227,6 +338,10 @@ od_rules_rule_free(od_rule_t *rule)
 		free(rule->auth_query_db);
 	if (rule->auth_query_user)
 		free(rule->auth_query_user);
+	od_auth_cache_free(&rule->auth_query_cache);
+	if (rule->auth_pam_service)
+		free(rule->auth_pam_service);
+	od_auth_cache_free(&rule->auth_pam_cache);
 	if (rule->storage)
 		od_rules_storage_free(rule->storage);
 	if (rule->storage_name)
@@ -237,14 +352,60 @@ od_rules_rule_free(od_rule_t *rule)
 		free(rule->storage_user);
 	if (rule->storage_password)
 		free(rule->storage_password);
+	if (rule->server_password_md5)
+		free(rule->server_password_md5);
+	if (rule->server_password_sasl)
+		free(rule->server_password_sasl);
+	if (rule->storage_read)
+		od_rules_storage_free(rule->storage_read);
+	if (rule->storage_read_name)
+		free(rule->storage_read_name);
+	if (rule->storage_mirror)
+		od_rules_storage_free(rule->storage_mirror);
+	if (rule->storage_mirror_name)
+		free(rule->storage_mirror_name);
+	if (rule->worker_group)
+		free(rule->worker_group);
+	if (rule->storage_read_exclude)
+		free(rule->storage_read_exclude);
+	if (rule->storage_read_patterns) {
+		int j;
+		for (j = 0; j < rule->storage_read_patterns_count; j++)
+			free(rule->storage_read_patterns[j]);
+		free(rule->storage_read_patterns);
+	}
+	if (rule->storage_shards) {
+		int j;
+		for (j = 0; j < rule->storage_shards_count; j++)
+			od_rules_storage_free(rule->storage_shards[j]);
+		free(rule->storage_shards);
+	}
+	if (rule->storage_shards_names)
+		free(rule->storage_shards_names);
+	if (rule->shard_key_sz)
+		free(rule->shard_key_sz);
+	if (rule->shard_parameter)
+		free(rule->shard_parameter);
+	if (rule->query_cache)
+		free(rule->query_cache);
+	if (rule->pool_wal_relay_dir)
+		free(rule->pool_wal_relay_dir);
+	od_query_cache_free(&rule->query_cache_replies);
 	if (rule->pool_sz)
 		free(rule->pool_sz);
+	if (rule->pool_select_sz)
+		free(rule->pool_select_sz);
+	if (rule->pool_batch)
+		free(rule->pool_batch);
+	if (rule->quantiles)
+		free(rule->quantiles);
 	od_list_t *i, *n;
 	od_list_foreach_safe(&rule->auth_common_names, i, n) {
 		od_rule_auth_t *auth;
 		auth = od_container_of(i, od_rule_auth_t, link);
 		od_rules_auth_free(auth);
 	}
+	pthread_mutex_destroy(&rule->quota_lock);
 	od_list_unlink(&rule->link);
 	free(rule);
 }
@@ -252,22 +413,40 @@ od_rules_rule_free(od_rule_t *rule)
 void
 od_rules_ref(od_rule_t *rule)
 {
-	rule->refs++;
+	od_atomic_u32_inc(&rule->refs);
 }
 
 void
 od_rules_unref(od_rule_t *rule)
 {
-	assert(rule->refs > 0);
-	rule->refs--;
-	if (! rule->obsolete)
-		return;
-	if (rule->refs == 0)
+	/* obsolete rule is freed by od_rules_gc(), so references are
+	 * dropped without the router lock */
+	assert(od_atomic_u32_of(&rule->refs) > 0);
+	od_atomic_u32_dec(&rule->refs);
+}
+
+int
+od_rules_gc(od_rules_t *rules)
+{
+	/* called under the router lock. References are taken only
+	 * under it, from the index or the list which skip obsolete
+	 * rules, or from a holder of another reference, so an unused
+	 * obsolete rule stays unused */
+	int count = 0;
+	od_list_t *i, *n;
+	od_list_foreach_safe(&rules->rules, i, n) {
+		od_rule_t *rule;
+		rule = od_container_of(i, od_rule_t, link);
+		if (! rule->obsolete || od_atomic_u32_of(&rule->refs) > 0)
+			continue;
 		od_rules_rule_free(rule);
+		count++;
+	}
+	return count;
 }
 
-od_rule_t*
-od_rules_forward(od_rules_t *rules, char *db_name, char *user_name)
+static inline od_rule_t*
+od_rules_forward_scan(od_rules_t *rules, char *db_name, char *user_name)
 {
 	od_rule_t *rule_db_user = NULL;
 	od_rule_t *rule_db_default = NULL;
@@ -308,37 +487,236 @@ od_rules_forward(od_rules_t *rules, char *db_name, char *user_name)
 	return rule_default_default;
 }
 
-od_rule_t*
-od_rules_match(od_rules_t *rules, char *db_name, char *user_name)
+static inline uint32_t
+od_rules_index_hash(char *db_name, char *user_name)
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261U;
+	char *pos;
+	if (db_name) {
+		for (pos = db_name; *pos; pos++) {
+			hash ^= (uint8_t)*pos;
+			hash *= 16777619U;
+		}
+	}
+	hash ^= 0xff;
+	hash *= 16777619U;
+	if (user_name) {
+		for (pos = user_name; *pos; pos++) {
+			hash ^= (uint8_t)*pos;
+			hash *= 16777619U;
+		}
+	}
+	return hash;
+}
+
+static inline int
+od_rules_storage_index(od_rules_t *rules)
 {
+	/* storages are looked up by name for every rule on validation */
+	int count = 0;
 	od_list_t *i;
-	od_list_foreach(&rules->rules, i) {
-		od_rule_t *rule;
-		rule = od_container_of(i, od_rule_t, link);
-		if (strcmp(rule->db_name, db_name) == 0 &&
-		    strcmp(rule->user_name, user_name) == 0)
-			return rule;
+	od_list_foreach(&rules->storages, i)
+		count++;
+
+	int size = 64;
+	while (size < count * 2)
+		size *= 2;
+	od_rule_storage_t **index;
+	index = calloc(size, sizeof(od_rule_storage_t*));
+	if (index == NULL)
+		return -1;
+
+	/* first storage wins on redefinition, same as for the list scan */
+	od_list_foreach(&rules->storages, i)
+	{
+		od_rule_storage_t *storage;
+		storage = od_container_of(i, od_rule_storage_t, link);
+		storage->index_next = NULL;
+		od_rule_storage_t **link;
+		link = &index[od_rules_index_hash(storage->name, NULL) & (size - 1)];
+		while (*link)
+			link = &(*link)->index_next;
+		*link = storage;
+	}
+
+	rules->storages_index = index;
+	rules->storages_index_size = size;
+	return 0;
+}
+
+od_rule_storage_t*
+od_rules_storage_match(od_rules_t *rules, char *name)
+{
+	if (rules->storages_index) {
+		uint32_t hash = od_rules_index_hash(name, NULL);
+		od_rule_storage_t *storage;
+		storage = rules->storages_index[hash & (rules->storages_index_size - 1)];
+		for (; storage; storage = storage->index_next) {
+			if (strcmp(storage->name, name) == 0)
+				return storage;
+		}
+		return NULL;
+	}
+	od_list_t *i;
+	od_list_foreach(&rules->storages, i) {
+		od_rule_storage_t *storage;
+		storage = od_container_of(i, od_rule_storage_t, link);
+		if (strcmp(storage->name, name) == 0)
+			return storage;
 	}
 	return NULL;
 }
 
+static inline int
+od_rules_index_compare(od_rule_t *rule, char *db_name, char *user_name)
+{
+	if (rule->db_is_default != (db_name == NULL))
+		return 0;
+	if (rule->user_is_default != (user_name == NULL))
+		return 0;
+	if (db_name && strcmp(rule->db_name, db_name) != 0)
+		return 0;
+	if (user_name && strcmp(rule->user_name, user_name) != 0)
+		return 0;
+	return 1;
+}
+
 static inline od_rule_t*
-od_rules_match_active(od_rules_t *rules, char *db_name, char *user_name)
+od_rules_index_find(od_rules_t *rules, char *db_name, char *user_name)
+{
+	uint32_t hash;
+	hash = od_rules_index_hash(db_name, user_name);
+	od_rule_t *rule;
+	rule = rules->index[hash & (rules->index_size - 1)];
+	for (; rule; rule = rule->index_next) {
+		if (rule->index_hash == hash &&
+		    od_rules_index_compare(rule, db_name, user_name))
+			return rule;
+	}
+	return NULL;
+}
+
+static inline void
+od_rules_index_insert(od_rules_t *rules, od_rule_t *rule)
+{
+	rule->index_next = NULL;
+	if (rule->db_is_default && rule->user_is_default) {
+		rules->index_default = rule;
+		return;
+	}
+	char *db_name   = rule->db_is_default ? NULL : rule->db_name;
+	char *user_name = rule->user_is_default ? NULL : rule->user_name;
+	rule->index_hash = od_rules_index_hash(db_name, user_name);
+
+	/* later rule wins, same as for the list scan */
+	od_rule_t **link = &rules->index[rule->index_hash & (rules->index_size - 1)];
+	for (; *link; link = &(*link)->index_next) {
+		if ((*link)->index_hash == rule->index_hash &&
+		    od_rules_index_compare(*link, db_name, user_name)) {
+			rule->index_next = (*link)->index_next;
+			(*link)->index_next = NULL;
+			*link = rule;
+			return;
+		}
+	}
+	*link = rule;
+	rules->index_count++;
+}
+
+int
+od_rules_index(od_rules_t *rules)
+{
+	if (rules->index) {
+		free(rules->index);
+		rules->index = NULL;
+		rules->index_size = 0;
+	}
+	rules->index_count = 0;
+	rules->index_default = NULL;
+
+	int count = 0;
+	od_list_t *i;
+	od_list_foreach(&rules->rules, i)
+		count++;
+
+	int size = 64;
+	while (size < count * 2)
+		size *= 2;
+	rules->index = calloc(size, sizeof(od_rule_t*));
+	if (rules->index == NULL)
+		return -1;
+	rules->index_size = size;
+
+	od_list_foreach(&rules->rules, i)
+	{
+		od_rule_t *rule;
+		rule = od_container_of(i, od_rule_t, link);
+		rule->index_next = NULL;
+		if (rule->obsolete)
+			continue;
+		od_rules_index_insert(rules, rule);
+	}
+	return 0;
+}
+
+int
+od_rules_index_add(od_rules_t *rules, od_rule_t *rule)
+{
+	/* rule is already in the list, the index is rebuilt
+	 * when it is half full */
+	if (rules->index == NULL ||
+	    (rules->index_count + 1) * 2 > rules->index_size)
+		return od_rules_index(rules);
+	od_rules_index_insert(rules, rule);
+	return 0;
+}
+
+od_rule_t*
+od_rules_forward(od_rules_t *rules, char *db_name, char *user_name)
+{
+	if (rules->index == NULL)
+		return od_rules_forward_scan(rules, db_name, user_name);
+
+	od_rule_t *rule;
+	rule = od_rules_index_find(rules, db_name, user_name);
+	if (rule)
+		return rule;
+
+	rule = od_rules_index_find(rules, db_name, NULL);
+	if (rule)
+		return rule;
+
+	rule = od_rules_index_find(rules, NULL, user_name);
+	if (rule)
+		return rule;
+
+	return rules->index_default;
+}
+
+od_rule_t*
+od_rules_match(od_rules_t *rules, char *db_name, char *user_name)
 {
+	/* active rule defined exactly for the database and user,
+	 * NULL name stands for default */
+	if (rules->index) {
+		if (db_name == NULL && user_name == NULL)
+			return rules->index_default;
+		return od_rules_index_find(rules, db_name, user_name);
+	}
 	od_list_t *i;
 	od_list_foreach(&rules->rules, i) {
 		od_rule_t *rule;
 		rule = od_container_of(i, od_rule_t, link);
 		if (rule->obsolete)
 			continue;
-		if (strcmp(rule->db_name, db_name) == 0 &&
-		    strcmp(rule->user_name, user_name) == 0)
+		if (od_rules_index_compare(rule, db_name, user_name))
 			return rule;
 	}
 	return NULL;
 }
 
-static inline int
+int
 od_rules_storage_compare(od_rule_storage_t *a, od_rule_storage_t *b)
 {
 	/* type */
@@ -349,6 +727,16 @@ od_rules_storage_compare(od_rule_storage_t *a, od_rule_storage_t *b)
 	if (a->server_max_routing != b->server_max_routing)
 		return 0;
 
+	/* server_max */
+	if (a->server_max != b->server_max)
+		return 0;
+
+	/* breaker */
+	if (a->breaker_threshold != b->breaker_threshold ||
+	    a->breaker_backoff != b->breaker_backoff ||
+	    a->breaker_backoff_max != b->breaker_backoff_max)
+		return 0;
+
 	/* host */
 	if (a->host && b->host) {
 		if (strcmp(a->host, b->host) != 0)
@@ -362,6 +750,39 @@ od_rules_storage_compare(od_rule_storage_t *a, od_rule_storage_t *b)
 	if (a->port != b->port)
 		return 0;
 
+	/* load_balance */
+	if (a->lb != b->lb)
+		return 0;
+
+	/* target_session_attrs */
+	if (a->target != b->target)
+		return 0;
+
+	/* health checks */
+	if (a->health_check_interval != b->health_check_interval ||
+	    a->health_check_timeout  != b->health_check_timeout  ||
+	    a->health_check_max_lag  != b->health_check_max_lag  ||
+	    a->health_check_max_rtt  != b->health_check_max_rtt)
+		return 0;
+
+	/* health_check_db */
+	if (a->health_check_db && b->health_check_db) {
+		if (strcmp(a->health_check_db, b->health_check_db) != 0)
+			return 0;
+	} else
+	if (a->health_check_db || b->health_check_db) {
+		return 0;
+	}
+
+	/* health_check_user */
+	if (a->health_check_user && b->health_check_user) {
+		if (strcmp(a->health_check_user, b->health_check_user) != 0)
+			return 0;
+	} else
+	if (a->health_check_user || b->health_check_user) {
+		return 0;
+	}
+
 	/* tls_mode */
 	if (a->tls_mode != b->tls_mode)
 		return 0;
@@ -402,77 +823,44 @@ od_rules_storage_compare(od_rule_storage_t *a, od_rule_storage_t *b)
 		return 0;
 	}
 
-	return 1;
-}
-
-int
-od_rules_rule_compare(od_rule_t *a, od_rule_t *b)
-{
-	/* db default */
-	if (a->db_is_default != b->db_is_default)
-		return 0;
-
-	/* user default */
-	if (a->user_is_default != b->user_is_default)
-		return 0;
-
-	/* password */
-	if (a->password && b->password) {
-		if (strcmp(a->password, b->password) != 0)
-			return 0;
-	} else
-	if (a->password || b->password) {
-		return 0;
-	}
-
-	/* auth */
-	if (a->auth_mode != b->auth_mode)
+	/* tls_ktls */
+	if (a->tls_ktls != b->tls_ktls)
 		return 0;
 
-	/* auth query */
-	if (a->auth_query && b->auth_query) {
-		if (strcmp(a->auth_query, b->auth_query) != 0)
-			return 0;
-	} else
-	if (a->auth_query || b->auth_query) {
+	/* tls_async */
+	if (a->tls_async != b->tls_async)
 		return 0;
-	}
 
-	/* auth query db */
-	if (a->auth_query_db && b->auth_query_db) {
-		if (strcmp(a->auth_query_db, b->auth_query_db) != 0)
-			return 0;
-	} else
-	if (a->auth_query_db || b->auth_query_db) {
+	/* tls_direct */
+	if (a->tls_direct != b->tls_direct)
 		return 0;
-	}
 
-	/* auth query user */
-	if (a->auth_query_user && b->auth_query_user) {
-		if (strcmp(a->auth_query_user, b->auth_query_user) != 0)
-			return 0;
-	} else
-	if (a->auth_query_user || b->auth_query_user) {
+	/* compression */
+	if (a->compression != b->compression)
 		return 0;
-	}
 
-	/* auth common name default */
-	if (a->auth_common_name_default != b->auth_common_name_default)
+	/* mux_links */
+	if (a->mux_links != b->mux_links)
 		return 0;
 
-	/* auth common names count */
-	if (a->auth_common_names_count != b->auth_common_names_count)
+	/* socket options */
+	if (a->sndbuf != b->sndbuf ||
+	    a->rcvbuf != b->rcvbuf ||
+	    a->tcp_notsent_lowat != b->tcp_notsent_lowat ||
+	    a->tcp_user_timeout != b->tcp_user_timeout ||
+	    a->tcp_quickack != b->tcp_quickack ||
+	    a->tcp_fastopen_connect != b->tcp_fastopen_connect ||
+	    a->busy_poll != b->busy_poll ||
+	    a->zerocopy_threshold != b->zerocopy_threshold ||
+	    a->tcp_info_interval != b->tcp_info_interval)
 		return 0;
 
-	/* compare auth common names */
-	od_list_t *i;
-	od_list_foreach(&a->auth_common_names, i) {
-		od_rule_auth_t *auth;
-		auth = od_container_of(i, od_rule_auth_t, link);
-		if (! od_rules_auth_find(b, auth->common_name))
-			return 0;
-	}
+	return 1;
+}
 
+static inline int
+od_rules_rule_compare_pool(od_rule_t *a, od_rule_t *b)
+{
 	/* storage */
 	if (strcmp(a->storage_name, b->storage_name) != 0)
 		return 0;
@@ -507,32 +895,217 @@ od_rules_rule_compare(od_rule_t *a, od_rule_t *b)
 		return 0;
 	}
 
-	/* pool */
-	if (a->pool != b->pool)
+	/* storage_read */
+	if (a->storage_read && b->storage_read) {
+		if (strcmp(a->storage_read_name, b->storage_read_name) != 0)
+			return 0;
+		if (! od_rules_storage_compare(a->storage_read, b->storage_read))
+			return 0;
+	} else
+	if (a->storage_read || b->storage_read) {
 		return 0;
+	}
 
-	/* pool_size */
-	if (a->pool_size != b->pool_size)
+	/* storage_read_exclude */
+	if (a->storage_read_exclude && b->storage_read_exclude) {
+		if (strcmp(a->storage_read_exclude, b->storage_read_exclude) != 0)
+			return 0;
+	} else
+	if (a->storage_read_exclude || b->storage_read_exclude) {
 		return 0;
+	}
 
-	/* pool_timeout */
-	if (a->pool_timeout != b->pool_timeout)
+	/* storage_mirror */
+	if (a->storage_mirror && b->storage_mirror) {
+		if (strcmp(a->storage_mirror_name, b->storage_mirror_name) != 0)
+			return 0;
+		if (! od_rules_storage_compare(a->storage_mirror, b->storage_mirror))
+			return 0;
+	} else
+	if (a->storage_mirror || b->storage_mirror) {
 		return 0;
+	}
 
-	/* pool_ttl */
-	if (a->pool_ttl != b->pool_ttl)
+	/* storage_mirror_sample */
+	if (a->storage_mirror_sample != b->storage_mirror_sample)
 		return 0;
 
-	/* pool_discard */
-	if (a->pool_discard != b->pool_discard)
+	/* storage_mirror_pool_size */
+	if (a->storage_mirror_pool_size != b->storage_mirror_pool_size)
 		return 0;
 
-	/* pool_cancel */
-	if (a->pool_cancel != b->pool_cancel)
+	/* storage_shards */
+	if (a->storage_shards_count != b->storage_shards_count)
 		return 0;
+	int j;
+	for (j = 0; j < a->storage_shards_count; j++) {
+		if (! od_rules_storage_compare(a->storage_shards[j],
+		                               b->storage_shards[j]))
+			return 0;
+	}
+	if (a->storage_shards_count) {
+		if (a->shard_key != b->shard_key)
+			return 0;
+		if (a->shard_key == OD_RULE_SHARD_PARAMETER &&
+		    strcmp(a->shard_parameter, b->shard_parameter) != 0)
+			return 0;
+	}
 
-	/* pool_rollback*/
-	if (a->pool_rollback != b->pool_rollback)
+	/* pool */
+	if (a->pool != b->pool)
+		return 0;
+
+	/* pool_size */
+	if (a->pool_size != b->pool_size)
+		return 0;
+
+	/* pool_min_size */
+	if (a->pool_min_size != b->pool_min_size)
+		return 0;
+
+	/* pool_select */
+	if (a->pool_select != b->pool_select)
+		return 0;
+
+	/* pool_timeout */
+	if (a->pool_timeout != b->pool_timeout)
+		return 0;
+
+	/* pool_reserve_size */
+	if (a->pool_reserve_size != b->pool_reserve_size)
+		return 0;
+
+	/* pool_reserve_timeout */
+	if (a->pool_reserve_timeout != b->pool_reserve_timeout)
+		return 0;
+
+	/* pool_codel_target */
+	if (a->pool_codel_target != b->pool_codel_target)
+		return 0;
+
+	/* pool_codel_interval */
+	if (a->pool_codel_interval != b->pool_codel_interval)
+		return 0;
+
+	/* pool_ttl */
+	if (a->pool_ttl != b->pool_ttl)
+		return 0;
+
+	/* server_lifetime */
+	if (a->server_lifetime != b->server_lifetime)
+		return 0;
+
+	/* pool_check_idle */
+	if (a->pool_check_idle != b->pool_check_idle)
+		return 0;
+
+	/* pool_rate */
+	if (a->pool_rate != b->pool_rate)
+		return 0;
+
+	/* pool_active_max */
+	if (a->pool_active_max != b->pool_active_max)
+		return 0;
+
+	/* pool_fleet_max */
+	if (a->pool_fleet_max != b->pool_fleet_max)
+		return 0;
+
+	/* pool_batch */
+	if (a->pool_batch && b->pool_batch) {
+		if (strcmp(a->pool_batch, b->pool_batch) != 0)
+			return 0;
+	} else
+	if (a->pool_batch || b->pool_batch) {
+		return 0;
+	}
+
+	/* pool_batch_weight */
+	if (a->pool_batch_weight != b->pool_batch_weight)
+		return 0;
+
+	/* pool_shared */
+	if (a->pool_shared != b->pool_shared)
+		return 0;
+
+	/* client_idle_timeout */
+	if (a->client_idle_timeout != b->client_idle_timeout)
+		return 0;
+
+	/* client_idle_in_transaction_timeout */
+	if (a->client_idle_in_transaction_timeout !=
+	    b->client_idle_in_transaction_timeout)
+		return 0;
+
+	/* query_timeout */
+	if (a->query_timeout != b->query_timeout)
+		return 0;
+
+	/* pool_discard */
+	if (a->pool_discard != b->pool_discard)
+		return 0;
+
+	/* pool_discard_track */
+	if (a->pool_discard_track != b->pool_discard_track)
+		return 0;
+
+	/* pool_listen */
+	if (a->pool_listen != b->pool_listen)
+		return 0;
+
+	/* pool_wal_relay */
+	if (a->pool_wal_relay != b->pool_wal_relay)
+		return 0;
+	if (a->pool_wal_relay_size != b->pool_wal_relay_size)
+		return 0;
+	if (a->pool_wal_relay_dir && b->pool_wal_relay_dir) {
+		if (strcmp(a->pool_wal_relay_dir, b->pool_wal_relay_dir) != 0)
+			return 0;
+	} else
+	if (a->pool_wal_relay_dir || b->pool_wal_relay_dir) {
+		return 0;
+	}
+
+	/* readahead bounds */
+	if (a->readahead_min != b->readahead_min)
+		return 0;
+	if (a->readahead_max != b->readahead_max)
+		return 0;
+
+	/* pool_cancel */
+	if (a->pool_cancel != b->pool_cancel)
+		return 0;
+
+	/* pool_rollback*/
+	if (a->pool_rollback != b->pool_rollback)
+		return 0;
+
+	/* pool_track_set */
+	if (a->pool_track_set != b->pool_track_set)
+		return 0;
+
+	/* pool_passthrough */
+	if (a->pool_passthrough != b->pool_passthrough)
+		return 0;
+
+	/* pool_adaptive */
+	if (a->pool_adaptive != b->pool_adaptive)
+		return 0;
+
+	/* pool_prepared_statements */
+	if (a->pool_prepared_statements != b->pool_prepared_statements)
+		return 0;
+
+	/* pool_prepared_statements_max */
+	if (a->pool_prepared_statements_max != b->pool_prepared_statements_max)
+		return 0;
+
+	/* pool_pipeline */
+	if (a->pool_pipeline != b->pool_pipeline)
+		return 0;
+
+	/* pool_pipeline_depth */
+	if (a->pool_pipeline_depth != b->pool_pipeline_depth)
 		return 0;
 
 	/* client_fwd_error */
@@ -543,9 +1116,200 @@ od_rules_rule_compare(od_rule_t *a, od_rule_t *b)
 	if (a->client_max != b->client_max)
 		return 0;
 
+	/* memory_max */
+	if (a->memory_max != b->memory_max)
+		return 0;
+
+	/* log_query_sample */
+	if (a->log_query_sample != b->log_query_sample)
+		return 0;
+
+	/* log_query_sample_random */
+	if (a->log_query_sample_random != b->log_query_sample_random)
+		return 0;
+
+	/* capture_sample */
+	if (a->capture_sample != b->capture_sample)
+		return 0;
+
+	/* worker_group */
+	if (a->worker_group && b->worker_group) {
+		if (strcmp(a->worker_group, b->worker_group) != 0)
+			return 0;
+	} else
+	if (a->worker_group || b->worker_group) {
+		return 0;
+	}
+
+	/* log_query_rate */
+	if (a->log_query_rate != b->log_query_rate)
+		return 0;
+
+	/* log_query_min_duration */
+	if (a->log_query_min_duration != b->log_query_min_duration)
+		return 0;
+
+	/* query_cache */
+	if (a->query_cache && b->query_cache) {
+		if (strcmp(a->query_cache, b->query_cache) != 0)
+			return 0;
+	} else
+	if (a->query_cache || b->query_cache) {
+		return 0;
+	}
+
+	/* query_cache_ttl */
+	if (a->query_cache_ttl != b->query_cache_ttl)
+		return 0;
+
+	/* query_cache_size */
+	if (a->query_cache_size != b->query_cache_size)
+		return 0;
+
+	/* quantiles */
+	if (a->quantiles_count != b->quantiles_count)
+		return 0;
+	if (a->quantiles_count &&
+	    memcmp(a->quantiles, b->quantiles,
+	           sizeof(double) * a->quantiles_count) != 0)
+		return 0;
+
+	/* quantiles_precision */
+	if (a->quantiles_precision != b->quantiles_precision)
+		return 0;
+
 	return 1;
 }
 
+int
+od_rules_rule_compare(od_rule_t *a, od_rule_t *b)
+{
+	/* db default */
+	if (a->db_is_default != b->db_is_default)
+		return 0;
+
+	/* user default */
+	if (a->user_is_default != b->user_is_default)
+		return 0;
+
+	/* password */
+	if (a->password && b->password) {
+		if (strcmp(a->password, b->password) != 0)
+			return 0;
+	} else
+	if (a->password || b->password) {
+		return 0;
+	}
+
+	/* auth */
+	if (a->auth_mode != b->auth_mode)
+		return 0;
+
+	/* auth query */
+	if (a->auth_query && b->auth_query) {
+		if (strcmp(a->auth_query, b->auth_query) != 0)
+			return 0;
+	} else
+	if (a->auth_query || b->auth_query) {
+		return 0;
+	}
+
+	/* auth query db */
+	if (a->auth_query_db && b->auth_query_db) {
+		if (strcmp(a->auth_query_db, b->auth_query_db) != 0)
+			return 0;
+	} else
+	if (a->auth_query_db || b->auth_query_db) {
+		return 0;
+	}
+
+	/* auth query user */
+	if (a->auth_query_user && b->auth_query_user) {
+		if (strcmp(a->auth_query_user, b->auth_query_user) != 0)
+			return 0;
+	} else
+	if (a->auth_query_user || b->auth_query_user) {
+		return 0;
+	}
+
+	/* auth query cache */
+	if (a->auth_query_cache_ttl != b->auth_query_cache_ttl)
+		return 0;
+	if (a->auth_query_cache_negative_ttl != b->auth_query_cache_negative_ttl)
+		return 0;
+	if (a->auth_query_cache_max != b->auth_query_cache_max)
+		return 0;
+
+	/* auth pam service */
+	if (a->auth_pam_service && b->auth_pam_service) {
+		if (strcmp(a->auth_pam_service, b->auth_pam_service) != 0)
+			return 0;
+	} else
+	if (a->auth_pam_service || b->auth_pam_service) {
+		return 0;
+	}
+
+	/* auth pam cache */
+	if (a->auth_pam_cache_ttl != b->auth_pam_cache_ttl)
+		return 0;
+
+	/* auth common name default */
+	if (a->auth_common_name_default != b->auth_common_name_default)
+		return 0;
+
+	/* auth common names count */
+	if (a->auth_common_names_count != b->auth_common_names_count)
+		return 0;
+
+	/* compare auth common names */
+	od_list_t *i;
+	od_list_foreach(&a->auth_common_names, i) {
+		od_rule_auth_t *auth;
+		auth = od_container_of(i, od_rule_auth_t, link);
+		if (! od_rules_auth_find(b, auth->common_name))
+			return 0;
+	}
+
+	return od_rules_rule_compare_pool(a, b);
+}
+
+static inline void
+od_rules_share(od_rules_t *rules)
+{
+	/* pool_shared rules with the same storage and pool settings use
+	 * the first of them to match routes, so their clients get the
+	 * same server pool when storage database and user are equal */
+	od_list_t *i, *j;
+	od_list_foreach(&rules->rules, i) {
+		od_rule_t *rule;
+		rule = od_container_of(i, od_rule_t, link);
+		rule->pool_share = rule;
+		if (rule->obsolete || ! rule->pool_shared)
+			continue;
+		if (rule->storage->storage_type == OD_RULE_STORAGE_LOCAL)
+			continue;
+		od_list_foreach(&rules->rules, j) {
+			if (j == i)
+				break;
+			od_rule_t *share;
+			share = od_container_of(j, od_rule_t, link);
+			if (share->obsolete || share->pool_share != share ||
+			    ! share->pool_shared)
+				continue;
+			if (! od_rules_rule_compare_pool(share, rule))
+				continue;
+			/* server authentication falls back to user password */
+			if (rule->storage_password == NULL &&
+			    (share->password || rule->password) &&
+			    (share->password == NULL || rule->password == NULL ||
+			     strcmp(share->password, rule->password) != 0))
+				continue;
+			rule->pool_share = share;
+			break;
+		}
+	}
+}
+
 __attribute__((hot)) int
 od_rules_merge(od_rules_t *rules, od_rules_t *src)
 {
@@ -562,7 +1326,8 @@ od_rules_merge(od_rules_t *rules, od_rules_t *src)
 		count_mark++;
 	}
 
-	/* select new rules */
+	/* select new rules, origins are looked up by the index which
+	 * is not updated until all rules are merged */
 	od_list_t *n;
 	od_list_foreach_safe(&src->rules, i, n)
 	{
@@ -571,11 +1336,16 @@ od_rules_merge(od_rules_t *rules, od_rules_t *src)
 
 		/* find and compare origin rule */
 		od_rule_t *origin;
-		origin = od_rules_match_active(rules, rule->db_name, rule->user_name);
+		origin = od_rules_match(rules,
+		                        rule->db_is_default ? NULL : rule->db_name,
+		                        rule->user_is_default ? NULL : rule->user_name);
 		if (origin) {
 			if (od_rules_rule_compare(origin, rule)) {
 				origin->mark = 0;
 				count_mark--;
+				/* credentials could be changed, drop cached results */
+				od_auth_cache_reset(&origin->auth_query_cache);
+				od_auth_cache_reset(&origin->auth_pam_cache);
 				continue;
 			}
 
@@ -584,132 +1354,871 @@ od_rules_merge(od_rules_t *rules, od_rules_t *src)
 			/* add new version */
 		}
 
-		od_list_unlink(&rule->link);
-		od_list_init(&rule->link);
-		od_list_append(&rules->rules, &rule->link);
-		count_new++;
-	}
+		od_list_unlink(&rule->link);
+		od_list_init(&rule->link);
+		od_list_append(&rules->rules, &rule->link);
+		count_new++;
+	}
+
+	/* try to free obsolete schemes, which are unused by any
+	 * rule at the moment */
+	if (count_mark > 0) {
+		od_list_foreach_safe(&rules->rules, i, n) {
+			od_rule_t *rule;
+			rule = od_container_of(i, od_rule_t, link);
+
+			int is_obsolete = rule->obsolete || rule->mark;
+			rule->mark = 0;
+			rule->obsolete = is_obsolete;
+
+			if (is_obsolete && od_atomic_u32_of(&rule->refs) == 0) {
+				od_rules_rule_free(rule);
+				count_deleted++;
+				count_mark--;
+			}
+		}
+	}
+
+	/* rebuild rules index, list scan is used on failure */
+	od_rules_index(rules);
+
+	od_rules_share(rules);
+
+	return count_new + count_mark + count_deleted;
+}
+
+static inline int
+od_rules_storage_endpoint_parse(od_rule_storage_endpoint_t *endpoint,
+                                char *item, int default_port)
+{
+	/* host[:port][@weight], ipv6 address can be put in brackets
+	 * to specify port: [::1]:5432 */
+	endpoint->port   = default_port;
+	endpoint->weight = 1;
+
+	char *weight = strrchr(item, '@');
+	if (weight) {
+		*weight++ = 0;
+		char *end;
+		long value = strtol(weight, &end, 10);
+		if (*end || value <= 0 || value > INT32_MAX)
+			return -1;
+		endpoint->weight = value;
+	}
+
+	char *host = item;
+	char *port = NULL;
+	if (*host == '[') {
+		host++;
+		char *end = strchr(host, ']');
+		if (end == NULL)
+			return -1;
+		*end++ = 0;
+		if (*end == ':')
+			port = end + 1;
+		else
+		if (*end)
+			return -1;
+	} else {
+		/* more than one colon is an ipv6 address without port */
+		char *colon = strchr(host, ':');
+		if (colon && strchr(colon + 1, ':') == NULL) {
+			*colon = 0;
+			port = colon + 1;
+		}
+	}
+	if (*host == 0)
+		return -1;
+	if (port) {
+		char *end;
+		long value = strtol(port, &end, 10);
+		if (*end || value <= 0 || value > 65535)
+			return -1;
+		endpoint->port = value;
+	}
+	endpoint->host = strdup(host);
+	if (endpoint->host == NULL)
+		return -1;
+	return 0;
+}
+
+static inline int
+od_rules_storage_endpoints_parse(od_rule_storage_t *storage, od_logger_t *logger)
+{
+	/* host "replica1:5432@2, replica2:5432@1" */
+	char *hosts = strdup(storage->host);
+	if (hosts == NULL)
+		return -1;
+	storage->endpoints = malloc(sizeof(od_rule_storage_endpoint_t) *
+	                            OD_RULE_STORAGE_ENDPOINTS_MAX);
+	if (storage->endpoints == NULL) {
+		free(hosts);
+		return -1;
+	}
+	char *pos = hosts;
+	char *item;
+	while ((item = strsep(&pos, ",")) != NULL) {
+		while (isspace(*item))
+			item++;
+		char *end = item + strlen(item);
+		while (end > item && isspace(end[-1]))
+			*--end = 0;
+		if (storage->endpoints_count == OD_RULE_STORAGE_ENDPOINTS_MAX) {
+			od_error(logger, "rules", NULL, NULL,
+			         "storage '%s': too many hosts, max is %d",
+			         storage->name, OD_RULE_STORAGE_ENDPOINTS_MAX);
+			free(hosts);
+			return -1;
+		}
+		od_rule_storage_endpoint_t *endpoint;
+		endpoint = &storage->endpoints[storage->endpoints_count];
+		if (od_rules_storage_endpoint_parse(endpoint, item, storage->port) == -1) {
+			od_error(logger, "rules", NULL, NULL,
+			         "storage '%s': bad host '%s'",
+			         storage->name, item);
+			free(hosts);
+			return -1;
+		}
+		storage->endpoints_count++;
+	}
+	free(hosts);
+	return 0;
+}
+
+static inline int
+od_rules_storage_read_parse(od_rule_t *rule)
+{
+	/* storage_read_exclude "nextval, for update" */
+	char *exclude = rule->storage_read_exclude;
+	if (exclude == NULL)
+		exclude = OD_RULE_STORAGE_READ_EXCLUDE;
+	char *patterns = strdup(exclude);
+	if (patterns == NULL)
+		return -1;
+	int max = 1;
+	char *c;
+	for (c = patterns; *c; c++)
+		if (*c == ',')
+			max++;
+	rule->storage_read_patterns = malloc(sizeof(char*) * max);
+	if (rule->storage_read_patterns == NULL) {
+		free(patterns);
+		return -1;
+	}
+	char *pos = patterns;
+	char *item;
+	while ((item = strsep(&pos, ",")) != NULL) {
+		while (isspace(*item))
+			item++;
+		char *end = item + strlen(item);
+		while (end > item && isspace(end[-1]))
+			*--end = 0;
+		if (*item == 0)
+			continue;
+		for (c = item; *c; c++)
+			*c = tolower(*c);
+		char *pattern = strdup(item);
+		if (pattern == NULL) {
+			free(patterns);
+			return -1;
+		}
+		rule->storage_read_patterns[rule->storage_read_patterns_count++] = pattern;
+	}
+	free(patterns);
+	return 0;
+}
+
+static inline int
+od_rules_storage_shards_parse(od_rules_t *rules, od_rule_t *rule,
+                              od_logger_t *logger)
+{
+	/* storage_shards "shard0, shard1, shard2" */
+	char *names = strdup(rule->storage_shards_names);
+	if (names == NULL)
+		return -1;
+	int max = 1;
+	char *c;
+	for (c = names; *c; c++)
+		if (*c == ',')
+			max++;
+	rule->storage_shards = malloc(sizeof(od_rule_storage_t*) * max);
+	if (rule->storage_shards == NULL) {
+		free(names);
+		return -1;
+	}
+	char *pos = names;
+	char *item;
+	while ((item = strsep(&pos, ",")) != NULL) {
+		while (isspace(*item))
+			item++;
+		char *end = item + strlen(item);
+		while (end > item && isspace(end[-1]))
+			*--end = 0;
+		if (*item == 0)
+			continue;
+		od_rule_storage_t *storage;
+		storage = od_rules_storage_match(rules, item);
+		if (storage == NULL) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': no rule storage '%s' found",
+			         rule->db_name, rule->user_name, item);
+			free(names);
+			return -1;
+		}
+		if (storage->storage_type != OD_RULE_STORAGE_REMOTE) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': storage_shards requires remote storages",
+			         rule->db_name, rule->user_name);
+			free(names);
+			return -1;
+		}
+		storage = od_rules_storage_copy(storage);
+		if (storage == NULL) {
+			free(names);
+			return -1;
+		}
+		rule->storage_shards[rule->storage_shards_count++] = storage;
+	}
+	free(names);
+	if (rule->storage_shards_count == 0) {
+		od_error(logger, "rules", NULL, NULL,
+		         "rule '%s.%s': storage_shards is empty",
+		         rule->db_name, rule->user_name);
+		return -1;
+	}
+
+	/* shard_key */
+	rule->shard_key = OD_RULE_SHARD_DATABASE;
+	if (rule->shard_key_sz) {
+		if (strcmp(rule->shard_key_sz, "user_suffix") == 0) {
+			rule->shard_key = OD_RULE_SHARD_USER_SUFFIX;
+		} else
+		if (strcmp(rule->shard_key_sz, "parameter") == 0) {
+			rule->shard_key = OD_RULE_SHARD_PARAMETER;
+		} else
+		if (strcmp(rule->shard_key_sz, "database") != 0) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': unknown shard_key",
+			         rule->db_name, rule->user_name);
+			return -1;
+		}
+	}
+	if (rule->shard_key == OD_RULE_SHARD_PARAMETER &&
+	    rule->shard_parameter == NULL) {
+		od_error(logger, "rules", NULL, NULL,
+		         "rule '%s.%s': shard_key 'parameter' requires shard_parameter",
+		         rule->db_name, rule->user_name);
+		return -1;
+	}
+	return 0;
+}
+
+static inline int
+od_rules_server_password(od_rule_t *rule)
+{
+	/* md5 of password and user, and SASLprep of password, are the
+	 * same for every server connection of the rule */
+	char *password = rule->storage_password;
+	int   password_len = rule->storage_password_len;
+	if (password == NULL) {
+		password = rule->password;
+		password_len = rule->password_len;
+	}
+	if (password == NULL)
+		return 0;
+	char *user = rule->user_name;
+	int   user_len = rule->user_name_len;
+	if (rule->storage_user) {
+		user = rule->storage_user;
+		user_len = rule->storage_user_len;
+	}
+
+	rule->server_password_md5 = malloc(35 + 1);
+	if (rule->server_password_md5 == NULL)
+		return -1;
+	if (password_len == 35 && memcmp(password, "md5", 3) == 0) {
+		memcpy(rule->server_password_md5, password, 35);
+	} else {
+		uint8_t digest[16];
+		kiwi_md5_t ctx;
+		kiwi_md5_init(&ctx);
+		kiwi_md5_update(&ctx, password, password_len);
+		kiwi_md5_update(&ctx, user, user_len);
+		kiwi_md5_final(&ctx, digest);
+		memcpy(rule->server_password_md5, "md5", 3);
+		kiwi_md5_tostring(rule->server_password_md5 + 3, digest);
+	}
+	rule->server_password_md5[35] = 0;
+
+	rule->server_password_sasl = od_scram_prepare_password(password);
+	if (rule->server_password_sasl == NULL)
+		return -1;
+	return 0;
+}
+
+int
+od_rules_validate(od_rules_t *rules, od_config_t *config, od_logger_t *logger)
+{
+	/* storages */
+	od_list_t *i;
+	od_list_foreach(&rules->storages, i)
+	{
+		od_rule_storage_t *storage;
+		storage = od_container_of(i, od_rule_storage_t, link);
+		if (storage->server_max_routing == 0)
+			storage->server_max_routing = config->workers_max;
+		if (storage->server_max < 0) {
+			od_error(logger, "rules", NULL, NULL,
+			         "storage '%s': bad server_max",
+			         storage->name);
+			return -1;
+		}
+		if (storage->cancel_rate < 0) {
+			od_error(logger, "rules", NULL, NULL,
+			         "storage '%s': bad cancel_rate",
+			         storage->name);
+			return -1;
+		}
+		if (storage->breaker_threshold < 0 ||
+		    storage->breaker_backoff < 0 ||
+		    storage->breaker_backoff_max < storage->breaker_backoff) {
+			od_error(logger, "rules", NULL, NULL,
+			         "storage '%s': bad breaker_threshold or breaker_backoff",
+			         storage->name);
+			return -1;
+		}
+		if (storage->type == NULL) {
+			od_error(logger, "rules", NULL, NULL,
+			         "storage '%s': no type is specified",
+			         storage->name);
+			return -1;
+		}
+		if (strcmp(storage->type, "remote") == 0) {
+			storage->storage_type = OD_RULE_STORAGE_REMOTE;
+		} else
+		if (strcmp(storage->type, "local") == 0) {
+			storage->storage_type = OD_RULE_STORAGE_LOCAL;
+		} else
+		if (strcmp(storage->type, "mux") == 0) {
+			storage->storage_type = OD_RULE_STORAGE_MUX;
+		} else {
+			od_error(logger, "rules", NULL, NULL, "unknown storage type");
+			return -1;
+		}
+		if (storage->compression &&
+		    storage->storage_type == OD_RULE_STORAGE_LOCAL) {
+			od_error(logger, "rules", NULL, NULL,
+			         "storage '%s': compression requires remote storage",
+			         storage->name);
+			return -1;
+		}
+		if (storage->mux_links < 1) {
+			od_error(logger, "rules", NULL, NULL,
+			         "storage '%s': bad mux_links",
+			         storage->name);
+			return -1;
+		}
+		if (storage->sndbuf < 0 || storage->rcvbuf < 0 ||
+		    storage->tcp_notsent_lowat < 0 || storage->tcp_user_timeout < 0 ||
+		    storage->busy_poll < 0 || storage->zerocopy_threshold < 0 ||
+		    storage->tcp_info_interval < 0) {
+			od_error(logger, "rules", NULL, NULL,
+			         "storage '%s': bad socket options",
+			         storage->name);
+			return -1;
+		}
+		if (storage->storage_type != OD_RULE_STORAGE_LOCAL) {
+			if (storage->host == NULL) {
+				if (config->unix_socket_dir == NULL) {
+					od_error(logger, "rules", NULL, NULL,
+					         "storage '%s': no host specified and unix_socket_dir is not set",
+					         storage->name);
+					return -1;
+				}
+			} else {
+				if (od_rules_storage_endpoints_parse(storage, logger) == -1)
+					return -1;
+			}
+		}
+		if (storage->load_balance) {
+			if (strcmp(storage->load_balance, "least_connections") == 0) {
+				storage->lb = OD_RULE_LB_LEAST_CONNECTIONS;
+			} else
+			if (strcmp(storage->load_balance, "latency") == 0) {
+				storage->lb = OD_RULE_LB_LATENCY;
+			} else {
+				od_error(logger, "rules", NULL, NULL,
+				         "storage '%s': unknown load_balance mode",
+				         storage->name);
+				return -1;
+			}
+		}
+		if (storage->target_session_attrs) {
+			if (strcmp(storage->target_session_attrs, "any") == 0) {
+				storage->target = OD_RULE_TARGET_ANY;
+			} else
+			if (strcmp(storage->target_session_attrs, "read-write") == 0) {
+				storage->target = OD_RULE_TARGET_READ_WRITE;
+			} else
+			if (strcmp(storage->target_session_attrs, "read-only") == 0) {
+				storage->target = OD_RULE_TARGET_READ_ONLY;
+			} else {
+				od_error(logger, "rules", NULL, NULL,
+				         "storage '%s': unknown target_session_attrs",
+				         storage->name);
+				return -1;
+			}
+		}
+		/* host role is only known from health checks */
+		if (storage->target != OD_RULE_TARGET_ANY &&
+		    storage->health_check_interval == 0)
+			storage->health_check_interval = 1;
+		if (storage->health_check_interval > 0) {
+			if (storage->host == NULL) {
+				od_error(logger, "rules", NULL, NULL,
+				         "storage '%s': health checks require host",
+				         storage->name);
+				return -1;
+			}
+			if (storage->health_check_db == NULL ||
+			    storage->health_check_user == NULL) {
+				od_error(logger, "rules", NULL, NULL,
+				         "storage '%s': health_check_db and health_check_user required",
+				         storage->name);
+				return -1;
+			}
+			if (storage->health_check_timeout == 0)
+				storage->health_check_timeout = 1000;
+			if (storage->health_check_max_rtt < 0) {
+				od_error(logger, "rules", NULL, NULL,
+				         "storage '%s': bad health_check_max_rtt",
+				         storage->name);
+				return -1;
+			}
+		}
+		if (storage->tls) {
+			if (strcmp(storage->tls, "disable") == 0) {
+				storage->tls_mode = OD_RULE_TLS_DISABLE;
+			} else
+			if (strcmp(storage->tls, "allow") == 0) {
+				storage->tls_mode = OD_RULE_TLS_ALLOW;
+			} else
+			if (strcmp(storage->tls, "require") == 0) {
+				storage->tls_mode = OD_RULE_TLS_REQUIRE;
+			} else
+			if (strcmp(storage->tls, "verify_ca") == 0) {
+				storage->tls_mode = OD_RULE_TLS_VERIFY_CA;
+			} else
+			if (strcmp(storage->tls, "verify_full") == 0) {
+				storage->tls_mode = OD_RULE_TLS_VERIFY_FULL;
+			} else {
+				od_error(logger, "rules", NULL, NULL, "unknown storage tls mode");
+				return -1;
+			}
+		}
+		/* direct tls has no plain text fallback */
+		if (storage->tls_direct && (storage->tls_mode == OD_RULE_TLS_DISABLE ||
+		                            storage->tls_mode == OD_RULE_TLS_ALLOW)) {
+			od_error(logger, "rules", NULL, NULL,
+			         "storage '%s': tls_direct requires tls 'require' or stricter",
+			         storage->name);
+			return -1;
+		}
+	}
+
+	int rc;
+	rc = od_rules_storage_index(rules);
+	if (rc == -1) {
+		od_error(logger, "rules", NULL, NULL,
+		         "failed to allocate storages index");
+		return -1;
+	}
+
+	/* rules */
+	od_list_foreach(&rules->rules, i)
+	{
+		od_rule_t *rule;
+		rule = od_container_of(i, od_rule_t, link);
+
+		/* sharded rules use the first shard as the rule storage,
+		 * unless storage is set */
+		if (rule->storage_shards_names) {
+			if (od_rules_storage_shards_parse(rules, rule, logger) == -1)
+				return -1;
+			if (rule->storage_name == NULL) {
+				rule->storage_name = strdup(rule->storage_shards[0]->name);
+				if (rule->storage_name == NULL)
+					return -1;
+			}
+		}
+
+		/* match storage and make a copy of in the user rules */
+		if (rule->storage_name == NULL) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': no rule storage is specified",
+			         rule->db_name, rule->user_name);
+			return -1;
+		}
+		od_rule_storage_t *storage;
+		storage = od_rules_storage_match(rules, rule->storage_name);
+		if (storage == NULL) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': no rule storage '%s' found",
+			         rule->db_name, rule->user_name, rule->storage_name);
+			return -1;
+		}
+		rule->storage = od_rules_storage_copy(storage);
+		if (rule->storage == NULL)
+			return -1;
+
+		if (od_rules_server_password(rule) == -1)
+			return -1;
+
+		/* storage for read-only statements */
+		if (rule->storage_read_name) {
+			storage = od_rules_storage_match(rules, rule->storage_read_name);
+			if (storage == NULL) {
+				od_error(logger, "rules", NULL, NULL,
+				         "rule '%s.%s': no rule storage '%s' found",
+				         rule->db_name, rule->user_name,
+				         rule->storage_read_name);
+				return -1;
+			}
+			if (storage->storage_type != OD_RULE_STORAGE_REMOTE ||
+			    rule->storage->storage_type != OD_RULE_STORAGE_REMOTE) {
+				od_error(logger, "rules", NULL, NULL,
+				         "rule '%s.%s': storage_read requires remote storages",
+				         rule->db_name, rule->user_name);
+				return -1;
+			}
+			rule->storage_read = od_rules_storage_copy(storage);
+			if (rule->storage_read == NULL)
+				return -1;
+			if (od_rules_storage_read_parse(rule) == -1)
+				return -1;
+			if (rule->storage_shards) {
+				od_error(logger, "rules", NULL, NULL,
+				         "rule '%s.%s': storage_read can not be used with storage_shards",
+				         rule->db_name, rule->user_name);
+				return -1;
+			}
+		}
+
+		/* shadow storage for mirrored queries */
+		if (rule->storage_mirror_name) {
+			storage = od_rules_storage_match(rules, rule->storage_mirror_name);
+			if (storage == NULL) {
+				od_error(logger, "rules", NULL, NULL,
+				         "rule '%s.%s': no rule storage '%s' found",
+				         rule->db_name, rule->user_name,
+				         rule->storage_mirror_name);
+				return -1;
+			}
+			if (storage->storage_type != OD_RULE_STORAGE_REMOTE ||
+			    rule->storage->storage_type != OD_RULE_STORAGE_REMOTE) {
+				od_error(logger, "rules", NULL, NULL,
+				         "rule '%s.%s': storage_mirror requires remote storages",
+				         rule->db_name, rule->user_name);
+				return -1;
+			}
+			if (rule->storage_mirror_sample < 1 ||
+			    rule->storage_mirror_pool_size < 1) {
+				od_error(logger, "rules", NULL, NULL,
+				         "rule '%s.%s': bad storage_mirror_sample or "
+				         "storage_mirror_pool_size",
+				         rule->db_name, rule->user_name);
+				return -1;
+			}
+			if (config->mirror_queue == 0)
+				od_log(logger, "rules", NULL, NULL,
+				       "rule '%s.%s': storage_mirror is not used, "
+				       "mirror_queue is not set",
+				       rule->db_name, rule->user_name);
+			rule->storage_mirror = od_rules_storage_copy(storage);
+			if (rule->storage_mirror == NULL)
+				return -1;
+			/* same read-only statements as for storage_read */
+			if (rule->storage_read_patterns == NULL &&
+			    od_rules_storage_read_parse(rule) == -1)
+				return -1;
+		}
+
+		/* pooling mode */
+		if (! rule->pool_sz) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': pooling mode is not set",
+			         rule->db_name, rule->user_name);
+			return -1;
+		}
+		if (strcmp(rule->pool_sz, "session") == 0) {
+			rule->pool = OD_RULE_POOL_SESSION;
+		} else
+		if (strcmp(rule->pool_sz, "transaction") == 0) {
+			rule->pool = OD_RULE_POOL_TRANSACTION;
+		} else
+		if (strcmp(rule->pool_sz, "statement") == 0) {
+			rule->pool = OD_RULE_POOL_STATEMENT;
+		} else {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': unknown pooling mode",
+			         rule->db_name, rule->user_name);
+			return -1;
+		}
+
+		/* idle server selection */
+		rule->pool_select = OD_RULE_POOL_SELECT_AFFINITY;
+		if (rule->pool_select_sz) {
+			if (strcmp(rule->pool_select_sz, "lifo") == 0) {
+				rule->pool_select = OD_RULE_POOL_SELECT_LIFO;
+			} else
+			if (strcmp(rule->pool_select_sz, "fifo") == 0) {
+				rule->pool_select = OD_RULE_POOL_SELECT_FIFO;
+			} else
+			if (strcmp(rule->pool_select_sz, "affinity") != 0) {
+				od_error(logger, "rules", NULL, NULL,
+				         "rule '%s.%s': unknown pool_select",
+				         rule->db_name, rule->user_name);
+				return -1;
+			}
+		}
+
+		if (rule->storage_read && ! od_rules_pool_transaction(rule)) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': storage_read requires transaction pooling",
+			         rule->db_name, rule->user_name);
+			return -1;
+		}
+
+		/* pool_min_size */
+		if (rule->pool_min_size < 0 ||
+		    (rule->pool_size > 0 && rule->pool_min_size > rule->pool_size)) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': bad pool_min_size",
+			         rule->db_name, rule->user_name);
+			return -1;
+		}
+
+		/* pool_reserve_size */
+		if (rule->pool_reserve_size < 0 || rule->pool_reserve_timeout < 0) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': bad pool_reserve_size or pool_reserve_timeout",
+			         rule->db_name, rule->user_name);
+			return -1;
+		}
+
+		/* server_lifetime */
+		if (rule->server_lifetime < 0) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': bad server_lifetime",
+			         rule->db_name, rule->user_name);
+			return -1;
+		}
+
+		/* pool_codel_target */
+		if (rule->pool_codel_target < 0 ||
+		    (rule->pool_codel_target > 0 && rule->pool_codel_interval <= 0)) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': bad pool_codel_target or pool_codel_interval",
+			         rule->db_name, rule->user_name);
+			return -1;
+		}
+
+		/* pool_adaptive */
+		if (rule->pool_adaptive && rule->pool_size == 0) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': pool_adaptive requires pool_size",
+			         rule->db_name, rule->user_name);
+			return -1;
+		}
 
-	/* try to free obsolete schemes, which are unused by any
-	 * rule at the moment */
-	if (count_mark > 0) {
-		od_list_foreach_safe(&rules->rules, i, n) {
-			od_rule_t *rule;
-			rule = od_container_of(i, od_rule_t, link);
+		/* client idle timeouts */
+		if (rule->client_idle_timeout < 0 ||
+		    rule->client_idle_in_transaction_timeout < 0) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': bad client_idle_timeout or "
+			         "client_idle_in_transaction_timeout",
+			         rule->db_name, rule->user_name);
+			return -1;
+		}
 
-			int is_obsolete = rule->obsolete || rule->mark;
-			rule->mark = 0;
-			rule->obsolete = is_obsolete;
+		/* query_timeout */
+		if (rule->query_timeout < 0) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': bad query_timeout",
+			         rule->db_name, rule->user_name);
+			return -1;
+		}
 
-			if (is_obsolete && rule->refs == 0) {
-				od_rules_rule_free(rule);
-				count_deleted++;
-				count_mark--;
-			}
+		/* pool_check_idle */
+		if (rule->pool_check_idle < 0) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': bad pool_check_idle",
+			         rule->db_name, rule->user_name);
+			return -1;
 		}
-	}
 
-	return count_new + count_mark + count_deleted;
-}
+		/* pool_rate */
+		if (rule->pool_rate < 0) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': bad pool_rate",
+			         rule->db_name, rule->user_name);
+			return -1;
+		}
 
-int
-od_rules_validate(od_rules_t *rules, od_config_t *config, od_logger_t *logger)
-{
-	/* storages */
-	od_list_t *i;
-	od_list_foreach(&rules->storages, i)
-	{
-		od_rule_storage_t *storage;
-		storage = od_container_of(i, od_rule_storage_t, link);
-		if (storage->server_max_routing == 0)
-			storage->server_max_routing = config->workers;
-		if (storage->type == NULL) {
+		/* pool_active_max */
+		if (rule->pool_active_max < 0) {
 			od_error(logger, "rules", NULL, NULL,
-			         "storage '%s': no type is specified",
-			         storage->name);
+			         "rule '%s.%s': bad pool_active_max",
+			         rule->db_name, rule->user_name);
 			return -1;
 		}
-		if (strcmp(storage->type, "remote") == 0) {
-			storage->storage_type = OD_RULE_STORAGE_REMOTE;
-		} else
-		if (strcmp(storage->type, "local") == 0) {
-			storage->storage_type = OD_RULE_STORAGE_LOCAL;
-		} else {
-			od_error(logger, "rules", NULL, NULL, "unknown storage type");
+
+		/* pool_fleet_max, the static share is used until peers
+		 * report their demand */
+		if (rule->pool_fleet_max < 0) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': bad pool_fleet_max",
+			         rule->db_name, rule->user_name);
 			return -1;
 		}
-		if (storage->storage_type == OD_RULE_STORAGE_REMOTE) {
-			if (storage->host == NULL) {
-				if (config->unix_socket_dir == NULL) {
-					od_error(logger, "rules", NULL, NULL,
-					         "storage '%s': no host specified and unix_socket_dir is not set",
-					         storage->name);
-					return -1;
-				}
+		if (rule->pool_fleet_max > 0) {
+			if (config->fleet_port == 0) {
+				od_error(logger, "rules", NULL, NULL,
+				         "rule '%s.%s': pool_fleet_max requires fleet_port",
+				         rule->db_name, rule->user_name);
+				return -1;
 			}
-		}
-		if (storage->tls) {
-			if (strcmp(storage->tls, "disable") == 0) {
-				storage->tls_mode = OD_RULE_TLS_DISABLE;
-			} else
-			if (strcmp(storage->tls, "allow") == 0) {
-				storage->tls_mode = OD_RULE_TLS_ALLOW;
-			} else
-			if (strcmp(storage->tls, "require") == 0) {
-				storage->tls_mode = OD_RULE_TLS_REQUIRE;
-			} else
-			if (strcmp(storage->tls, "verify_ca") == 0) {
-				storage->tls_mode = OD_RULE_TLS_VERIFY_CA;
-			} else
-			if (strcmp(storage->tls, "verify_full") == 0) {
-				storage->tls_mode = OD_RULE_TLS_VERIFY_FULL;
-			} else {
-				od_error(logger, "rules", NULL, NULL, "unknown storage tls mode");
+			int members = od_fleet_members(config->fleet_peers);
+			if (rule->pool_fleet_max < members) {
+				od_error(logger, "rules", NULL, NULL,
+				         "rule '%s.%s': pool_fleet_max is less than fleet size",
+				         rule->db_name, rule->user_name);
 				return -1;
 			}
+			rule->quota_fleet = rule->pool_fleet_max / members;
 		}
-	}
 
-	/* rules */
-	od_list_foreach(&rules->rules, i)
-	{
-		od_rule_t *rule;
-		rule = od_container_of(i, od_rule_t, link);
+		/* pool_batch_weight */
+		if (rule->pool_batch_weight < 1) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': bad pool_batch_weight",
+			         rule->db_name, rule->user_name);
+			return -1;
+		}
+		if (rule->pool_batch)
+			rule->pool_batch_len = strlen(rule->pool_batch);
 
-		/* match storage and make a copy of in the user rules */
-		if (rule->storage_name == NULL) {
+		/* pool_prepared_statements_max */
+		if (rule->pool_prepared_statements_max < 0) {
 			od_error(logger, "rules", NULL, NULL,
-			         "rule '%s.%s': no rule storage is specified",
+			         "rule '%s.%s': bad pool_prepared_statements_max",
 			         rule->db_name, rule->user_name);
 			return -1;
 		}
-		od_rule_storage_t *storage;
-		storage = od_rules_storage_match(rules, rule->storage_name);
-		if (storage == NULL) {
+
+		/* pool_listen */
+		if (rule->pool_listen && ! od_rules_pool_transaction(rule)) {
 			od_error(logger, "rules", NULL, NULL,
-			         "rule '%s.%s': no rule storage '%s' found",
-			         rule->db_name, rule->user_name, rule->storage_name);
+			         "rule '%s.%s': pool_listen requires transaction pooling",
+			         rule->db_name, rule->user_name);
 			return -1;
 		}
-		rule->storage = od_rules_storage_copy(storage);
-		if (rule->storage == NULL)
+
+		/* pool_wal_relay */
+		if (rule->pool_wal_relay &&
+		    rule->pool_wal_relay_size < OD_WALRELAY_SIZE_MIN) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': pool_wal_relay_size must be at least %d",
+			         rule->db_name, rule->user_name, OD_WALRELAY_SIZE_MIN);
 			return -1;
+		}
 
-		/* pooling mode */
-		if (! rule->pool_sz) {
+		/* pool_pipeline */
+		if (rule->pool_pipeline && ! od_rules_pool_transaction(rule)) {
 			od_error(logger, "rules", NULL, NULL,
-			         "rule '%s.%s': pooling mode is not set",
+			         "rule '%s.%s': pool_pipeline requires transaction pooling",
 			         rule->db_name, rule->user_name);
 			return -1;
 		}
-		if (strcmp(rule->pool_sz, "session") == 0) {
-			rule->pool = OD_RULE_POOL_SESSION;
-		} else
-		if (strcmp(rule->pool_sz, "transaction") == 0) {
-			rule->pool = OD_RULE_POOL_TRANSACTION;
-		} else {
+		if (rule->pool_pipeline_depth < 1) {
 			od_error(logger, "rules", NULL, NULL,
-			         "rule '%s.%s': unknown pooling mode",
+			         "rule '%s.%s': bad pool_pipeline_depth",
+			         rule->db_name, rule->user_name);
+			return -1;
+		}
+
+		/* query logging */
+		if (rule->log_query_sample < 0 || rule->log_query_rate < 0 ||
+		    rule->log_query_min_duration < 0) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': bad log_query_sample, log_query_rate "
+			         "or log_query_min_duration",
+			         rule->db_name, rule->user_name);
+			return -1;
+		}
+		if (rule->capture_sample < 0) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': bad capture_sample",
+			         rule->db_name, rule->user_name);
+			return -1;
+		}
+		if (rule->worker_group &&
+		    ! od_config_worker_group_exists(config, rule->worker_group)) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': worker_group '%s' is not defined",
+			         rule->db_name, rule->user_name, rule->worker_group);
+			return -1;
+		}
+
+		/* query cache */
+		if (rule->query_cache) {
+			if (rule->query_cache_ttl <= 0) {
+				od_error(logger, "rules", NULL, NULL,
+				         "rule '%s.%s': bad query_cache_ttl",
+				         rule->db_name, rule->user_name);
+				return -1;
+			}
+			if (rule->query_cache_size <= 0) {
+				od_error(logger, "rules", NULL, NULL,
+				         "rule '%s.%s': bad query_cache_size",
+				         rule->db_name, rule->user_name);
+				return -1;
+			}
+			if (od_query_cache_prepare(&rule->query_cache_replies,
+			                           rule->query_cache) == -1) {
+				od_error(logger, "rules", NULL, NULL,
+				         "rule '%s.%s': bad query_cache, up to %d queries "
+				         "separated by ';' are expected",
+				         rule->db_name, rule->user_name,
+				         OD_QUERY_CACHE_MAX);
+				return -1;
+			}
+		}
+
+		/* quantiles_precision */
+		if (rule->quantiles_precision < 1 ||
+		    rule->quantiles_precision > OD_HGRAM_PRECISION_MAX) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': quantiles_precision must be "
+			         "within 1 and %d",
+			         rule->db_name, rule->user_name,
+			         OD_HGRAM_PRECISION_MAX);
+			return -1;
+		}
+
+		/* readahead bounds */
+		if (rule->readahead_min < 0 || rule->readahead_max < 0 ||
+		    (rule->readahead_max > 0 &&
+		     rule->readahead_min > rule->readahead_max)) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': bad readahead_min or readahead_max",
+			         rule->db_name, rule->user_name);
+			return -1;
+		}
+
+		if (rule->memory_max < 0) {
+			od_error(logger, "rules", NULL, NULL,
+			         "rule '%s.%s': bad memory_max",
 			         rule->db_name, rule->user_name);
 			return -1;
 		}
@@ -738,6 +2247,13 @@ od_rules_validate(od_rules_t *rules, od_config_t *config, od_logger_t *logger)
 				return -1;
 			}
 
+			if (rule->auth_pam_cache_ttl < 0) {
+				od_error(logger, "rules", NULL, NULL,
+				         "rule '%s.%s': bad auth_pam_cache_ttl",
+				         rule->db_name, rule->user_name);
+				return -1;
+			}
+
 			if (rule->password == NULL &&
 			    rule->auth_query == NULL &&
 			    rule->auth_pam_service == NULL) {
@@ -767,6 +2283,9 @@ od_rules_validate(od_rules_t *rules, od_config_t *config, od_logger_t *logger)
 		} else
 		if (strcmp(rule->auth, "cert") == 0) {
 			rule->auth_mode = OD_RULE_AUTH_CERT;
+		} else
+		if (strcmp(rule->auth, "peer") == 0) {
+			rule->auth_mode = OD_RULE_AUTH_PEER;
 		} else {
 			od_error(logger, "rules", NULL, NULL,
 			         "rule '%s.%s': has unknown authentication mode",
@@ -788,6 +2307,19 @@ od_rules_validate(od_rules_t *rules, od_config_t *config, od_logger_t *logger)
 				         rule->db_name, rule->user_name);
 				return -1;
 			}
+			if (rule->auth_query_cache_ttl < 0 ||
+			    rule->auth_query_cache_negative_ttl < 0) {
+				od_error(logger, "rules", NULL, NULL,
+				         "rule '%s.%s': bad auth_query_cache ttl",
+				         rule->db_name, rule->user_name);
+				return -1;
+			}
+			if (rule->auth_query_cache_max <= 0) {
+				od_error(logger, "rules", NULL, NULL,
+				         "rule '%s.%s': bad auth_query_cache_max",
+				         rule->db_name, rule->user_name);
+				return -1;
+			}
 		}
 	}
 
@@ -799,6 +2331,21 @@ od_rules_validate(od_rules_t *rules, od_config_t *config, od_logger_t *logger)
 		od_rules_storage_free(storage);
 	}
 	od_list_init(&rules->storages);
+	free(rules->storages_index);
+	rules->storages_index = NULL;
+	rules->storages_index_size = 0;
+
+	/* rules index is built while parsing */
+	if (rules->index == NULL) {
+		rc = od_rules_index(rules);
+		if (rc == -1) {
+			od_error(logger, "rules", NULL, NULL,
+			         "failed to allocate rules index");
+			return -1;
+		}
+	}
+
+	od_rules_share(rules);
 	return 0;
 }
 
@@ -841,31 +2388,149 @@ od_rules_print(od_rules_t *rules, od_logger_t *logger)
 		if (rule->auth_query_user)
 			od_log(logger, "rules", NULL, NULL,
 			       "  auth_query_user  %s", rule->auth_query_user);
+		if (rule->auth_query && rule->auth_query_cache_ttl) {
+			od_log(logger, "rules", NULL, NULL,
+			       "  auth_query_cache_ttl %d", rule->auth_query_cache_ttl);
+			od_log(logger, "rules", NULL, NULL,
+			       "  auth_query_cache_negative_ttl %d",
+			       rule->auth_query_cache_negative_ttl);
+			od_log(logger, "rules", NULL, NULL,
+			       "  auth_query_cache_max %d", rule->auth_query_cache_max);
+		}
+		if (rule->auth_pam_service)
+			od_log(logger, "rules", NULL, NULL,
+			       "  auth_pam_service %s", rule->auth_pam_service);
+		if (rule->auth_pam_service && rule->auth_pam_cache_ttl)
+			od_log(logger, "rules", NULL, NULL,
+			       "  auth_pam_cache_ttl %d", rule->auth_pam_cache_ttl);
 		od_log(logger, "rules", NULL, NULL,
 		       "  pool             %s", rule->pool_sz);
 		od_log(logger, "rules", NULL, NULL,
 		       "  pool_size        %d", rule->pool_size);
+		od_log(logger, "rules", NULL, NULL,
+		       "  pool_min_size    %d", rule->pool_min_size);
+		if (rule->pool_select_sz)
+			od_log(logger, "rules", NULL, NULL,
+			       "  pool_select      %s", rule->pool_select_sz);
 		od_log(logger, "rules", NULL, NULL,
 		       "  pool_timeout     %d", rule->pool_timeout);
+		if (rule->pool_reserve_size)
+			od_log(logger, "rules", NULL, NULL,
+			       "  pool_reserve     %d/%d", rule->pool_reserve_size,
+			       rule->pool_reserve_timeout);
+		if (rule->pool_codel_target)
+			od_log(logger, "rules", NULL, NULL,
+			       "  pool_codel       %d/%d", rule->pool_codel_target,
+			       rule->pool_codel_interval);
 		od_log(logger, "rules", NULL, NULL,
 		       "  pool_ttl         %d", rule->pool_ttl);
+		if (rule->server_lifetime)
+			od_log(logger, "rules", NULL, NULL,
+			       "  server_lifetime  %d", rule->server_lifetime);
+		if (rule->pool_check_idle)
+			od_log(logger, "rules", NULL, NULL,
+			       "  pool_check_idle  %d", rule->pool_check_idle);
+		if (rule->pool_rate)
+			od_log(logger, "rules", NULL, NULL,
+			       "  pool_rate        %d", rule->pool_rate);
+		if (rule->pool_active_max)
+			od_log(logger, "rules", NULL, NULL,
+			       "  pool_active_max  %d", rule->pool_active_max);
+		if (rule->pool_fleet_max)
+			od_log(logger, "rules", NULL, NULL,
+			       "  pool_fleet_max   %d", rule->pool_fleet_max);
+		if (rule->pool_batch)
+			od_log(logger, "rules", NULL, NULL,
+			       "  pool_batch       '%s' (weight %d)",
+			       rule->pool_batch, rule->pool_batch_weight);
+		if (rule->pool_shared)
+			od_log(logger, "rules", NULL, NULL,
+			       "  pool_shared      yes");
 		od_log(logger, "rules", NULL, NULL,
 		       "  pool_discard     %s",
 			   rule->pool_discard ? "yes" : "no");
+		if (rule->pool_discard_track)
+			od_log(logger, "rules", NULL, NULL,
+			       "  pool_discard_track yes");
+		if (rule->pool_listen)
+			od_log(logger, "rules", NULL, NULL,
+			       "  pool_listen      yes");
+		if (rule->pool_wal_relay)
+			od_log(logger, "rules", NULL, NULL,
+			       "  pool_wal_relay   %" PRId64 "%s%s", rule->pool_wal_relay_size,
+			       rule->pool_wal_relay_dir ? " " : "",
+			       rule->pool_wal_relay_dir ? rule->pool_wal_relay_dir : "");
 		od_log(logger, "rules", NULL, NULL,
 		       "  pool_cancel      %s",
 			   rule->pool_cancel ? "yes" : "no");
 		od_log(logger, "rules", NULL, NULL,
 		       "  pool_rollback    %s",
 			   rule->pool_rollback ? "yes" : "no");
+		if (rule->pool_track_set)
+			od_log(logger, "rules", NULL, NULL,
+			       "  pool_track_set   yes");
+		if (rule->pool_passthrough)
+			od_log(logger, "rules", NULL, NULL,
+			       "  pool_passthrough yes");
+		if (rule->pool_adaptive)
+			od_log(logger, "rules", NULL, NULL,
+			       "  pool_adaptive    yes");
+		od_log(logger, "rules", NULL, NULL,
+		       "  pool_prepared_statements %s",
+			   rule->pool_prepared_statements ? "yes" : "no");
+		if (rule->pool_prepared_statements_max)
+			od_log(logger, "rules", NULL, NULL,
+			       "  pool_prepared_statements_max %d",
+			       rule->pool_prepared_statements_max);
+		if (rule->pool_pipeline)
+			od_log(logger, "rules", NULL, NULL,
+			       "  pool_pipeline    yes (depth %d)",
+			       rule->pool_pipeline_depth);
+		if (rule->readahead_min)
+			od_log(logger, "rules", NULL, NULL,
+			       "  readahead_min    %d", rule->readahead_min);
+		if (rule->readahead_max)
+			od_log(logger, "rules", NULL, NULL,
+			       "  readahead_max    %d", rule->readahead_max);
 		if (rule->client_max_set)
 			od_log(logger, "rules", NULL, NULL,
 			       "  client_max       %d", rule->client_max);
+		if (rule->memory_max)
+			od_log(logger, "rules", NULL, NULL,
+			       "  memory_max       %" PRId64, rule->memory_max);
+		if (rule->client_idle_timeout)
+			od_log(logger, "rules", NULL, NULL,
+			       "  client_idle_timeout %d", rule->client_idle_timeout);
+		if (rule->client_idle_in_transaction_timeout)
+			od_log(logger, "rules", NULL, NULL,
+			       "  client_idle_in_transaction_timeout %d",
+			       rule->client_idle_in_transaction_timeout);
+		if (rule->query_timeout)
+			od_log(logger, "rules", NULL, NULL,
+			       "  query_timeout    %d", rule->query_timeout);
 		od_log(logger, "rules", NULL, NULL,
 		       "  client_fwd_error %s",
 		       od_rules_yes_no(rule->client_fwd_error));
 		od_log(logger, "rules", NULL, NULL,
 		       "  storage          %s", rule->storage_name);
+		if (rule->storage_read)
+			od_log(logger, "rules", NULL, NULL,
+			       "  storage_read     %s", rule->storage_read_name);
+		if (rule->storage_mirror)
+			od_log(logger, "rules", NULL, NULL,
+			       "  storage_mirror   %s (1/%d, pool %d)",
+			       rule->storage_mirror_name,
+			       rule->storage_mirror_sample,
+			       rule->storage_mirror_pool_size);
+		if (rule->storage_shards) {
+			od_log(logger, "rules", NULL, NULL,
+			       "  storage_shards   %s", rule->storage_shards_names);
+			od_log(logger, "rules", NULL, NULL,
+			       "  shard_key        %s%s%s",
+			       rule->shard_key_sz ? rule->shard_key_sz : "database",
+			       rule->shard_parameter ? " " : "",
+			       rule->shard_parameter ? rule->shard_parameter : "");
+		}
 		od_log(logger, "rules", NULL, NULL,
 		       "  type             %s", rule->storage->type);
 		od_log(logger, "rules", NULL, NULL,
@@ -873,6 +2538,18 @@ od_rules_print(od_rules_t *rules, od_logger_t *logger)
 		       rule->storage->host ? rule->storage->host : "<unix socket>");
 		od_log(logger, "rules", NULL, NULL,
 		       "  port             %d", rule->storage->port);
+		if (rule->storage->load_balance)
+			od_log(logger, "rules", NULL, NULL,
+			       "  load_balance     %s", rule->storage->load_balance);
+		if (rule->storage->target_session_attrs)
+			od_log(logger, "rules", NULL, NULL,
+			       "  target_session_attrs %s", rule->storage->target_session_attrs);
+		if (od_rules_storage_health_check(rule->storage))
+			od_log(logger, "rules", NULL, NULL,
+			       "  health_check     %s.%s every %d sec",
+			       rule->storage->health_check_db,
+			       rule->storage->health_check_user,
+			       rule->storage->health_check_interval);
 		if (rule->storage->tls)
 			od_log(logger, "rules", NULL, NULL,
 			       "  tls              %s", rule->storage->tls);
@@ -888,6 +2565,54 @@ od_rules_print(od_rules_t *rules, od_logger_t *logger)
 		if (rule->storage->tls_protocols)
 			od_log(logger, "rules", NULL, NULL,
 			       "  tls_protocols    %s", rule->storage->tls_protocols);
+		if (rule->storage->tls)
+			od_log(logger, "rules", NULL, NULL,
+			       "  tls_ktls         %s",
+			       od_rules_yes_no(rule->storage->tls_ktls));
+		if (rule->storage->tls_async)
+			od_log(logger, "rules", NULL, NULL,
+			       "  tls_async        yes");
+		if (rule->storage->tls_direct)
+			od_log(logger, "rules", NULL, NULL,
+			       "  tls_direct       yes");
+		if (rule->storage->compression)
+			od_log(logger, "rules", NULL, NULL,
+			       "  compression      yes");
+		if (rule->storage->storage_type == OD_RULE_STORAGE_MUX)
+			od_log(logger, "rules", NULL, NULL,
+			       "  mux_links        %d", rule->storage->mux_links);
+		if (rule->storage->sndbuf)
+			od_log(logger, "rules", NULL, NULL,
+			       "  sndbuf           %d", rule->storage->sndbuf);
+		if (rule->storage->rcvbuf)
+			od_log(logger, "rules", NULL, NULL,
+			       "  rcvbuf           %d", rule->storage->rcvbuf);
+		if (rule->storage->tcp_notsent_lowat)
+			od_log(logger, "rules", NULL, NULL,
+			       "  tcp_notsent_lowat%d", rule->storage->tcp_notsent_lowat);
+		if (rule->storage->tcp_user_timeout)
+			od_log(logger, "rules", NULL, NULL,
+			       "  tcp_user_timeout %d", rule->storage->tcp_user_timeout);
+		if (rule->storage->tcp_quickack)
+			od_log(logger, "rules", NULL, NULL,
+			       "  tcp_quickack     yes");
+		if (rule->storage->tcp_fastopen_connect)
+			od_log(logger, "rules", NULL, NULL,
+			       "  tcp_fastopen_connect yes");
+		if (rule->storage->busy_poll)
+			od_log(logger, "rules", NULL, NULL,
+			       "  busy_poll        %d", rule->storage->busy_poll);
+		if (rule->storage->zerocopy_threshold)
+			od_log(logger, "rules", NULL, NULL,
+			       "  zerocopy_threshold %d",
+			       rule->storage->zerocopy_threshold);
+		if (rule->storage->tcp_info_interval)
+			od_log(logger, "rules", NULL, NULL,
+			       "  tcp_info_interval %d",
+			       rule->storage->tcp_info_interval);
+		if (rule->storage->server_max)
+			od_log(logger, "rules", NULL, NULL,
+			       "  server_max       %d", rule->storage->server_max);
 		if (rule->storage_db)
 			od_log(logger, "rules", NULL, NULL,
 			       "  storage_db       %s", rule->storage_db);
@@ -897,6 +2622,35 @@ od_rules_print(od_rules_t *rules, od_logger_t *logger)
 		od_log(logger, "rules", NULL, NULL,
 		       "  log_debug        %s",
 		       od_rules_yes_no(rule->log_debug));
+		if (rule->log_query_sample > 1)
+			od_log(logger, "rules", NULL, NULL,
+			       "  log_query_sample %d%s", rule->log_query_sample,
+			       rule->log_query_sample_random ? " (random)" : "");
+		if (rule->log_query_rate)
+			od_log(logger, "rules", NULL, NULL,
+			       "  log_query_rate   %d", rule->log_query_rate);
+		if (rule->capture_sample)
+			od_log(logger, "rules", NULL, NULL,
+			       "  capture_sample   %d", rule->capture_sample);
+		if (rule->worker_group)
+			od_log(logger, "rules", NULL, NULL,
+			       "  worker_group     %s", rule->worker_group);
+		if (rule->log_query_min_duration)
+			od_log(logger, "rules", NULL, NULL,
+			       "  log_query_min_duration %d",
+			       rule->log_query_min_duration);
+		if (rule->query_cache) {
+			od_log(logger, "rules", NULL, NULL,
+			       "  query_cache      %s", rule->query_cache);
+			od_log(logger, "rules", NULL, NULL,
+			       "  query_cache_ttl  %d", rule->query_cache_ttl);
+			od_log(logger, "rules", NULL, NULL,
+			       "  query_cache_size %d", rule->query_cache_size);
+		}
+		if (rule->quantiles_count)
+			od_log(logger, "rules", NULL, NULL,
+			       "  quantiles        %d (precision %d)",
+			       rule->quantiles_count, rule->quantiles_precision);
 		od_log(logger, "rules", NULL, NULL, "");
 	}
 }
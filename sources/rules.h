@@ -8,6 +8,7 @@
 */
 
 typedef struct od_rule_storage od_rule_storage_t;
+typedef struct od_rule_storage_endpoint od_rule_storage_endpoint_t;
 typedef struct od_rule_auth    od_rule_auth_t;
 typedef struct od_rule         od_rule_t;
 typedef struct od_rules        od_rules_t;
@@ -29,21 +30,72 @@ typedef enum
 	OD_RULE_AUTH_CLEAR_TEXT,
 	OD_RULE_AUTH_MD5,
 	OD_RULE_AUTH_SCRAM_SHA_256,
-	OD_RULE_AUTH_CERT
+	OD_RULE_AUTH_CERT,
+	OD_RULE_AUTH_PEER
 } od_rule_auth_type_t;
 
 typedef enum
 {
 	OD_RULE_POOL_SESSION,
-	OD_RULE_POOL_TRANSACTION
+	OD_RULE_POOL_TRANSACTION,
+	OD_RULE_POOL_STATEMENT
 } od_rule_pool_type_t;
 
+typedef enum
+{
+	OD_RULE_POOL_SELECT_AFFINITY,
+	OD_RULE_POOL_SELECT_LIFO,
+	OD_RULE_POOL_SELECT_FIFO
+} od_rule_pool_select_t;
+
+typedef enum
+{
+	OD_RULE_SHARD_DATABASE,
+	OD_RULE_SHARD_USER_SUFFIX,
+	OD_RULE_SHARD_PARAMETER
+} od_rule_shard_key_t;
+
 typedef enum
 {
 	OD_RULE_STORAGE_REMOTE,
 	OD_RULE_STORAGE_LOCAL,
+	OD_RULE_STORAGE_MUX
 } od_rule_storage_type_t;
 
+typedef enum
+{
+	OD_RULE_LB_LEAST_CONNECTIONS,
+	OD_RULE_LB_LATENCY
+} od_rule_lb_t;
+
+typedef enum
+{
+	OD_RULE_TARGET_ANY,
+	OD_RULE_TARGET_READ_WRITE,
+	OD_RULE_TARGET_READ_ONLY
+} od_rule_target_t;
+
+typedef enum
+{
+	OD_RULE_HOST_UNKNOWN,
+	OD_RULE_HOST_DOWN,
+	OD_RULE_HOST_PRIMARY,
+	OD_RULE_HOST_STANDBY
+} od_rule_host_state_t;
+
+#define OD_RULE_STORAGE_ENDPOINTS_MAX 16
+
+struct od_rule_storage_endpoint
+{
+	char                 *host;
+	int                   port;
+	int                   weight;
+	/* updated by health checks */
+	od_rule_host_state_t  state;
+	int                   lag;
+	uint32_t              rtt;
+};
+
 struct od_rule_storage
 {
 	char                   *name;
@@ -51,28 +103,118 @@ struct od_rule_storage
 	od_rule_storage_type_t  storage_type;
 	char                   *host;
 	int                     port;
+	od_rule_storage_endpoint_t *endpoints;
+	int                     endpoints_count;
+	od_rule_lb_t            lb;
+	char                   *load_balance;
+	od_rule_target_t        target;
+	char                   *target_session_attrs;
+	int                     health_check_interval;
+	int                     health_check_timeout;
+	int                     health_check_max_lag;
+	int                     health_check_max_rtt;
+	char                   *health_check_db;
+	char                   *health_check_user;
+	uint64_t                health_check_time;
 	od_rule_tls_t           tls_mode;
 	char                   *tls;
 	char                   *tls_ca_file;
 	char                   *tls_key_file;
 	char                   *tls_cert_file;
 	char                   *tls_protocols;
+	int                     tls_ktls;
+	int                     tls_async;
+	int                     tls_direct;
+	int                     compression;
+	int                     mux_links;
+	int                     sndbuf;
+	int                     rcvbuf;
+	int                     tcp_notsent_lowat;
+	int                     tcp_user_timeout;
+	int                     tcp_quickack;
+	int                     tcp_fastopen_connect;
+	int                     busy_poll;
+	int                     zerocopy_threshold;
+	int                     tcp_info_interval;
 	int                     server_max_routing;
+	int                     server_max;
+	int                     cancel_rate;
+	int                     breaker_threshold;
+	int                     breaker_backoff;
+	int                     breaker_backoff_max;
+	od_breaker_t            breaker;
+	machine_tls_t          *tls_handler;
+	od_rule_storage_t      *index_next;
 	od_list_t               link;
 };
 
+static inline int
+od_rules_storage_health_check(od_rule_storage_t *storage)
+{
+	return storage->endpoints_count > 0 && storage->health_check_interval > 0;
+}
+
+static inline int
+od_rules_storage_endpoint_slow(od_rule_storage_t *storage,
+                               od_rule_storage_endpoint_t *endpoint)
+{
+	/* round trip of the last health check connection, in microseconds */
+	return storage->health_check_max_rtt > 0 &&
+	       endpoint->rtt > (uint32_t)storage->health_check_max_rtt * 1000;
+}
+
+static inline int
+od_rules_storage_endpoint_usable(od_rule_storage_t *storage, int id)
+{
+	/* host state is known only when health checks are enabled */
+	if (! od_rules_storage_health_check(storage))
+		return 1;
+	od_rule_storage_endpoint_t *endpoint = &storage->endpoints[id];
+	switch (endpoint->state) {
+	case OD_RULE_HOST_UNKNOWN:
+		return storage->target == OD_RULE_TARGET_ANY;
+	case OD_RULE_HOST_DOWN:
+		return 0;
+	case OD_RULE_HOST_PRIMARY:
+		return storage->target != OD_RULE_TARGET_READ_ONLY;
+	case OD_RULE_HOST_STANDBY:
+		if (storage->target == OD_RULE_TARGET_READ_WRITE)
+			return 0;
+		if (storage->health_check_max_lag > 0 &&
+		    endpoint->lag > storage->health_check_max_lag)
+			return 0;
+		if (od_rules_storage_endpoint_slow(storage, endpoint))
+			return 0;
+		return 1;
+	}
+	return 0;
+}
+
 struct od_rule_auth
 {
 	char      *common_name;
 	od_list_t  link;
 };
 
+/* statements with side effects which must not be routed to
+ * storage_read, unless storage_read_exclude is set */
+#define OD_RULE_STORAGE_READ_EXCLUDE \
+	"nextval,setval,lastval,currval,pg_advisory,pg_try_advisory," \
+	"txid_current,for update,for share,for no key update,for key share,into"
+
 struct od_rule
 {
 	/* versioning */
 	int                     mark;
 	int                     obsolete;
-	int                     refs;
+	od_atomic_u32_t         refs;
+	/* pool_active_max slots, shared by all routes of the rule */
+	pthread_mutex_t         quota_lock;
+	int                     quota_active;
+	od_list_t               quota_waiters;
+	/* pool_fleet_max share of this instance and demand of the fleet */
+	int                     quota_fleet;
+	int                     quota_fleet_demand;
 	/* id */
 	char                   *db_name;
 	int                     db_name_len;
@@ -86,7 +228,13 @@ struct od_rule
 	char                   *auth_query;
 	char                   *auth_query_db;
 	char                   *auth_pam_service;
+	int                     auth_pam_cache_ttl;
+	od_auth_cache_t         auth_pam_cache;
 	char                   *auth_query_user;
+	int                     auth_query_cache_ttl;
+	int                     auth_query_cache_negative_ttl;
+	int                     auth_query_cache_max;
+	od_auth_cache_t         auth_query_cache;
 	int                     auth_common_name_default;
 	od_list_t               auth_common_names;
 	int                     auth_common_names_count;
@@ -101,36 +249,140 @@ struct od_rule
 	int                     storage_user_len;
 	char                   *storage_password;
 	int                     storage_password_len;
+	/* server authentication material, derived on config load */
+	char                   *server_password_md5;
+	char                   *server_password_sasl;
+	od_rule_storage_t      *storage_read;
+	char                   *storage_read_name;
+	char                   *storage_read_exclude;
+	char                  **storage_read_patterns;
+	int                     storage_read_patterns_count;
+	/* shadow storage for a share of read-only queries */
+	od_rule_storage_t      *storage_mirror;
+	char                   *storage_mirror_name;
+	int                     storage_mirror_sample;
+	int                     storage_mirror_pool_size;
+	/* shards, route storage is picked by consistent hash of shard_key */
+	od_rule_storage_t     **storage_shards;
+	int                     storage_shards_count;
+	char                   *storage_shards_names;
+	char                   *shard_key_sz;
+	od_rule_shard_key_t     shard_key;
+	char                   *shard_parameter;
 	/* pool */
 	od_rule_pool_type_t     pool;
 	char                   *pool_sz;
 	int                     pool_size;
+	int                     pool_min_size;
+	char                   *pool_select_sz;
+	od_rule_pool_select_t   pool_select;
 	int                     pool_timeout;
+	int                     pool_reserve_size;
+	int                     pool_reserve_timeout;
+	int                     pool_codel_target;
+	int                     pool_codel_interval;
 	int                     pool_ttl;
+	int                     server_lifetime;
+	int                     pool_check_idle;
+	int                     pool_rate;
+	int                     pool_active_max;
+	int                     pool_fleet_max;
+	char                   *pool_batch;
+	int                     pool_batch_len;
+	int                     pool_batch_weight;
+	int                     pool_shared;
+	od_rule_t              *pool_share;
 	int                     pool_discard;
+	int                     pool_discard_track;
+	int                     pool_listen;
+	int                     pool_wal_relay;
+	int64_t                 pool_wal_relay_size;
+	char                   *pool_wal_relay_dir;
 	int                     pool_cancel;
 	int                     pool_rollback;
+	int                     pool_track_set;
+	int                     pool_passthrough;
+	int                     pool_adaptive;
+	int                     pool_prepared_statements;
+	int                     pool_prepared_statements_max;
+	int                     pool_pipeline;
+	int                     pool_pipeline_depth;
+	/* io */
+	int                     readahead_min;
+	int                     readahead_max;
 	/* misc */
 	int                     client_fwd_error;
 	int                     application_name_add_host;
 	int                     client_max_set;
 	int                     client_max;
+	int64_t                 memory_max;
+	int                     client_idle_timeout;
+	int                     client_idle_in_transaction_timeout;
+	int                     query_timeout;
+	/* query cache */
+	char                   *query_cache;
+	int                     query_cache_ttl;
+	int                     query_cache_size;
+	od_query_cache_t        query_cache_replies;
 	int                     log_debug;
+	int                     log_query_sample;
+	int                     log_query_sample_random;
+	int                     log_query_rate;
+	int                     log_query_min_duration;
+	int                     capture_sample;
+	char                   *worker_group;
 	double                 *quantiles;
 	int                     quantiles_count;
+	int                     quantiles_precision;
+	/* index */
+	uint32_t                index_hash;
+	od_rule_t              *index_next;
 	od_list_t               link;
 };
 
+static inline int
+od_rules_pool_transaction(od_rule_t *rule)
+{
+	/* server is returned to the pool between transactions,
+	 * statement pooling is transaction pooling without
+	 * transaction blocks */
+	return rule->pool == OD_RULE_POOL_TRANSACTION ||
+	       rule->pool == OD_RULE_POOL_STATEMENT;
+}
+
+static inline int
+od_rules_quota_max(od_rule_t *rule)
+{
+	/* the smaller of pool_active_max and the fleet share,
+	 * quota_lock must be held */
+	int max = rule->pool_active_max;
+	if (rule->pool_fleet_max > 0 && (max == 0 || rule->quota_fleet < max))
+		max = rule->quota_fleet;
+	return max;
+}
+
+/* Active rules are indexed by hash of database and user name,
+ * default database or user are hashed as empty names.
+*/
+
 struct od_rules
 {
-	od_list_t storages;
-	od_list_t rules;
+	od_list_t   storages;
+	od_rule_storage_t **storages_index;
+	int         storages_index_size;
+	od_list_t   rules;
+	od_rule_t **index;
+	int         index_size;
+	int         index_count;
+	od_rule_t  *index_default;
 };
 
 void od_rules_init(od_rules_t*);
 void od_rules_free(od_rules_t*);
 int  od_rules_validate(od_rules_t*, od_config_t*, od_logger_t*);
 int  od_rules_merge(od_rules_t*, od_rules_t*);
+int  od_rules_index(od_rules_t*);
+int  od_rules_index_add(od_rules_t*, od_rule_t*);
 void od_rules_print(od_rules_t*, od_logger_t*);
 
 /* rule */
@@ -138,6 +390,7 @@ od_rule_t*
 od_rules_add(od_rules_t*);
 void od_rules_ref(od_rule_t*);
 void od_rules_unref(od_rule_t*);
+int  od_rules_gc(od_rules_t*);
 int  od_rules_compare(od_rule_t*, od_rule_t*);
 
 od_rule_t*
@@ -158,6 +411,8 @@ od_rules_storage_copy(od_rule_storage_t*);
 
 void od_rules_storage_free(od_rule_storage_t*);
 
+int  od_rules_storage_compare(od_rule_storage_t*, od_rule_storage_t*);
+
 /* auth */
 od_rule_auth_t*
 od_rules_auth_add(od_rule_t*);
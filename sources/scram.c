@@ -6,6 +6,7 @@
 */
 
 #include <ctype.h>
+#include <pthread.h>
 #include <machinarium.h>
 #include <kiwi.h>
 #include <odyssey.h>
@@ -78,6 +79,127 @@ read_any_attribute(char **data, char *attribute_ptr)
 	return begin;
 }
 
+/* Cache of keys derived from salted password.
+ *
+ * PBKDF2 is the most expensive part of SCRAM authentication, keys
+ * depend only on password, salt and iterations. Entries are
+ * looked up by HMAC-SHA-256 digest of these values, so cache never
+ * keeps passwords. Cache has a fixed size, least recently used entries
+ * are replaced and zeroed.
+*/
+
+#define OD_SCRAM_CACHE_SIZE    1024
+#define OD_SCRAM_CACHE_BUCKETS 1024
+
+typedef struct od_scram_cache_entry od_scram_cache_entry_t;
+
+struct od_scram_cache_entry
+{
+	uint8_t                 digest[SCRAM_KEY_LEN];
+	char                    salt[64];
+	int                     iterations;
+	uint8_t                 client_key[SCRAM_KEY_LEN];
+	uint8_t                 stored_key[SCRAM_KEY_LEN];
+	uint8_t                 server_key[SCRAM_KEY_LEN];
+	od_scram_cache_entry_t *next;
+	od_list_t               link;
+};
+
+static struct
+{
+	pthread_mutex_t         lock;
+	int                     count;
+	od_list_t               lru;
+	od_scram_cache_entry_t *buckets[OD_SCRAM_CACHE_BUCKETS];
+	od_scram_cache_entry_t  entries[OD_SCRAM_CACHE_SIZE];
+} od_scram_cache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.lru  = { &od_scram_cache.lru, &od_scram_cache.lru }
+};
+
+static inline void
+od_scram_cache_digest(uint8_t *digest, char type, const char *user,
+                      const char *password, const char *salt, int salt_len,
+                      int iterations)
+{
+	scram_HMAC_ctx ctx;
+	scram_HMAC_init(&ctx, (const uint8_t*)password, strlen(password));
+	scram_HMAC_update(&ctx, &type, 1);
+	if (user)
+		scram_HMAC_update(&ctx, user, strlen(user) + 1);
+	scram_HMAC_update(&ctx, salt, salt_len);
+	scram_HMAC_update(&ctx, (const char*)&iterations, sizeof(iterations));
+	scram_HMAC_final(digest, &ctx);
+	OPENSSL_cleanse(&ctx, sizeof(ctx));
+}
+
+static inline od_scram_cache_entry_t**
+od_scram_cache_bucket(uint8_t *digest)
+{
+	uint32_t hash;
+	memcpy(&hash, digest, sizeof(hash));
+	return &od_scram_cache.buckets[hash % OD_SCRAM_CACHE_BUCKETS];
+}
+
+static int
+od_scram_cache_get(uint8_t *digest, od_scram_cache_entry_t *result)
+{
+	pthread_mutex_lock(&od_scram_cache.lock);
+	od_scram_cache_entry_t *entry;
+	entry = *od_scram_cache_bucket(digest);
+	for (; entry; entry = entry->next) {
+		if (memcmp(entry->digest, digest, SCRAM_KEY_LEN) == 0)
+			break;
+	}
+	if (entry) {
+		memcpy(result, entry, sizeof(*entry));
+		od_list_unlink(&entry->link);
+		od_list_push(&od_scram_cache.lru, &entry->link);
+	}
+	pthread_mutex_unlock(&od_scram_cache.lock);
+	return entry != NULL;
+}
+
+static void
+od_scram_cache_set(od_scram_cache_entry_t *value)
+{
+	pthread_mutex_lock(&od_scram_cache.lock);
+
+	od_scram_cache_entry_t **pos;
+	pos = od_scram_cache_bucket(value->digest);
+	od_scram_cache_entry_t *entry;
+	for (entry = *pos; entry; entry = entry->next) {
+		if (memcmp(entry->digest, value->digest, SCRAM_KEY_LEN) == 0) {
+			/* set by concurrent login */
+			pthread_mutex_unlock(&od_scram_cache.lock);
+			return;
+		}
+	}
+
+	if (od_scram_cache.count < OD_SCRAM_CACHE_SIZE) {
+		entry = &od_scram_cache.entries[od_scram_cache.count];
+		od_scram_cache.count++;
+	} else {
+		/* replace least recently used entry */
+		entry = od_container_of(od_scram_cache.lru.prev,
+		                        od_scram_cache_entry_t, link);
+		od_list_unlink(&entry->link);
+		od_scram_cache_entry_t **prev;
+		prev = od_scram_cache_bucket(entry->digest);
+		while (*prev != entry)
+			prev = &(*prev)->next;
+		*prev = entry->next;
+		OPENSSL_cleanse(entry, sizeof(*entry));
+	}
+
+	memcpy(entry, value, sizeof(*entry));
+	entry->next = *pos;
+	*pos = entry;
+	od_list_push(&od_scram_cache.lru, &entry->link);
+
+	pthread_mutex_unlock(&od_scram_cache.lock);
+}
+
 int
 od_scram_parse_verifier(od_scram_state_t *scram_state, char *verifier)
 {
@@ -91,7 +213,7 @@ od_scram_parse_verifier(od_scram_state_t *scram_state, char *verifier)
 	char *stored_key = NULL;
 	char *server_key = NULL;
 
-	value = strdup(verifier);
+	value = od_scram_strdup(scram_state, verifier);
 	if (value == NULL)
 		return -1;
 
@@ -127,24 +249,24 @@ od_scram_parse_verifier(od_scram_state_t *scram_state, char *verifier)
 
 	int salt_raw_len = strlen(salt_raw);
 	int salt_dst_len = pg_b64_dec_len(salt_raw_len);
-	salt = malloc(salt_dst_len);
+	salt = od_scram_alloc(scram_state, salt_dst_len);
 	if (salt == NULL)
 		goto error;
 
 	int salt_len = od_b64_decode(salt_raw, salt_raw_len, salt, salt_dst_len);
-	free(salt);
+	od_scram_release(scram_state, salt);
 
 	if (salt_len < 0)
 		goto error;
 
-	scram_state->salt = strdup(salt_raw);
+	scram_state->salt = od_scram_strdup(scram_state, salt_raw);
 
 	if (scram_state->salt == NULL)
 		goto error;
 
 	int stored_key_raw_len = strlen(stored_key_raw);
 	int stored_key_dst_len = pg_b64_dec_len(stored_key_raw_len);
-	stored_key = malloc(stored_key_dst_len);
+	stored_key = od_scram_alloc(scram_state, stored_key_dst_len);
 	if (stored_key == NULL)
 		goto error;
 
@@ -157,7 +279,7 @@ od_scram_parse_verifier(od_scram_state_t *scram_state, char *verifier)
 
 	int server_key_raw_len = strlen(server_key_raw);
 	int server_key_dst_len = pg_b64_dec_len(server_key_raw_len);
-	server_key = malloc(server_key_dst_len);
+	server_key = od_scram_alloc(scram_state, server_key_dst_len);
 	if (server_key == NULL)
 		goto error;
 
@@ -168,24 +290,26 @@ od_scram_parse_verifier(od_scram_state_t *scram_state, char *verifier)
 
 	memcpy(scram_state->server_key, server_key, SCRAM_KEY_LEN);
 
-	free(stored_key);
-	free(server_key);
-	free(value);
+	od_scram_release(scram_state, stored_key);
+	od_scram_release(scram_state, server_key);
+	od_scram_release(scram_state, value);
 
 	return 0;
 
 	error:
 
-	free(stored_key);
-	free(server_key);
-	free(value);
+	od_scram_release(scram_state, stored_key);
+	od_scram_release(scram_state, server_key);
+	od_scram_release(scram_state, value);
+	od_scram_release(scram_state, scram_state->salt);
 	scram_state->salt = NULL;
 
 	return -1;
 }
 
 int
-od_scram_init_from_plain_password(od_scram_state_t *scram_state, char *plain_password)
+od_scram_init_from_plain_password(od_scram_state_t *scram_state, char *user,
+                                  char *plain_password)
 {
 	char *prep_password = NULL;
 
@@ -199,26 +323,40 @@ od_scram_init_from_plain_password(od_scram_state_t *scram_state, char *plain_pas
 	else
 		password = plain_password;
 
-	char salt[SCRAM_DEFAULT_SALT_LEN];
-	RAND_bytes((uint8_t*) salt, sizeof(salt));
-
-	scram_state->iterations = SCRAM_DEFAULT_ITERATIONS;
+	/* salt is generated once per user and password, reuse keys
+	 * derived for previous logins */
+	od_scram_cache_entry_t entry;
+	od_scram_cache_digest(entry.digest, 'f', user, password, NULL, 0,
+	                      SCRAM_DEFAULT_ITERATIONS);
+	if (! od_scram_cache_get(entry.digest, &entry)) {
+		char salt[SCRAM_DEFAULT_SALT_LEN];
+		RAND_bytes((uint8_t*) salt, sizeof(salt));
+
+		int base64_salt_len = od_b64_encode(salt, sizeof(salt),
+		                                    entry.salt, sizeof(entry.salt));
+		entry.salt[base64_salt_len] = '\0';
+		entry.iterations = SCRAM_DEFAULT_ITERATIONS;
+
+		uint8_t salted_password[SCRAM_KEY_LEN];
+		scram_SaltedPassword(password, salt, sizeof(salt),
+		                     entry.iterations, salted_password);
+		scram_ClientKey(salted_password, entry.client_key);
+		scram_H(entry.client_key, SCRAM_KEY_LEN, entry.stored_key);
+		scram_ServerKey(salted_password, entry.server_key);
+		OPENSSL_cleanse(salted_password, sizeof(salted_password));
+
+		od_scram_cache_set(&entry);
+	}
 
-	int salt_dst_len = pg_b64_enc_len(sizeof(salt)) + 1;
-	scram_state->salt = malloc(salt_dst_len);
-	if (!scram_state->salt)
+	scram_state->iterations = entry.iterations;
+	scram_state->salt = od_scram_strdup(scram_state, entry.salt);
+	if (scram_state->salt == NULL) {
+		OPENSSL_cleanse(&entry, sizeof(entry));
 		goto error;
-
-	int base64_salt_len = od_b64_encode(salt, sizeof(salt),
-										scram_state->salt, salt_dst_len);
-	scram_state->salt[base64_salt_len] = '\0';
-
-	uint8_t salted_password[SCRAM_KEY_LEN];
-	scram_SaltedPassword(password, salt, sizeof(salt), 
-		                 scram_state->iterations, salted_password);
-	scram_ClientKey(salted_password, scram_state->stored_key);
-	scram_H(scram_state->stored_key, SCRAM_KEY_LEN, scram_state->stored_key);
-	scram_ServerKey(salted_password, scram_state->server_key);
+	}
+	memcpy(scram_state->stored_key, entry.stored_key, SCRAM_KEY_LEN);
+	memcpy(scram_state->server_key, entry.server_key, SCRAM_KEY_LEN);
+	OPENSSL_cleanse(&entry, sizeof(entry));
 
 	if (prep_password)
 		free(prep_password);
@@ -333,42 +471,55 @@ read_server_first_message(od_scram_state_t *scram_state, char *auth_data,
 	return -1;
 }
 
-static int 
-calculate_client_proof(od_scram_state_t *scram_state,
-				   	   const char *password,
-				   	   const char *salt,
-				   	   int iterations,
-				   	   const char *client_final_message,
-				   	   uint8_t *client_proof)
+char*
+od_scram_prepare_password(char *password)
 {
+	/* passwords which are not valid UTF-8 are used as is */
 	char *prepared_password = NULL;
 	pg_saslprep_rc rc = pg_saslprep(password, &prepared_password);
-
 	if (rc == SASLPREP_OOM)
-		return -1;
-
+		return NULL;
 	if (rc != SASLPREP_SUCCESS)
 		prepared_password = strdup(password);
+	return prepared_password;
+}
 
-	if (prepared_password == NULL)
-		return -1;
-
-	scram_state->salted_password = malloc(SCRAM_KEY_LEN);
-	if (scram_state->salted_password == NULL)
-		goto error;
-
-	scram_HMAC_ctx ctx;
-
-	scram_SaltedPassword(prepared_password,
-						salt, strlen(salt), iterations,
-			     		scram_state->salted_password);
+static int 
+calculate_client_proof(od_scram_state_t *scram_state,
+				   	   const char *prepared_password,
+				   	   const char *salt,
+				   	   int iterations,
+				   	   const char *client_final_message,
+				   	   uint8_t *client_proof)
+{
+	/* keys depend only on password, salt and iterations,
+	 * which are the same for repeated logins to a server */
+	od_scram_cache_entry_t entry;
+	od_scram_cache_digest(entry.digest, 'b', NULL, prepared_password,
+	                      salt, strlen(salt), iterations);
+	if (! od_scram_cache_get(entry.digest, &entry)) {
+		uint8_t salted_password[SCRAM_KEY_LEN];
+		scram_SaltedPassword(prepared_password,
+		                     salt, strlen(salt), iterations,
+		                     salted_password);
+		entry.salt[0] = '\0';
+		entry.iterations = iterations;
+		scram_ClientKey(salted_password, entry.client_key);
+		scram_H(entry.client_key, SCRAM_KEY_LEN, entry.stored_key);
+		scram_ServerKey(salted_password, entry.server_key);
+		OPENSSL_cleanse(salted_password, sizeof(salted_password));
+
+		od_scram_cache_set(&entry);
+	}
 
 	uint8_t	client_key[SCRAM_KEY_LEN];
-	scram_ClientKey(scram_state->salted_password, client_key);
+	memcpy(client_key, entry.client_key, SCRAM_KEY_LEN);
+	memcpy(scram_state->stored_key, entry.stored_key, SCRAM_KEY_LEN);
+	memcpy(scram_state->server_key, entry.server_key, SCRAM_KEY_LEN);
+	OPENSSL_cleanse(&entry, sizeof(entry));
 
-	uint8_t	stored_key[SCRAM_KEY_LEN];
-	scram_H(client_key, SCRAM_KEY_LEN, stored_key);
-	scram_HMAC_init(&ctx, stored_key, SCRAM_KEY_LEN);
+	scram_HMAC_ctx ctx;
+	scram_HMAC_init(&ctx, scram_state->stored_key, SCRAM_KEY_LEN);
 
 	scram_HMAC_update(&ctx, scram_state->client_first_message,
 			  		  strlen(scram_state->client_first_message));
@@ -384,14 +535,8 @@ calculate_client_proof(od_scram_state_t *scram_state,
 
 	for (int i = 0; i < SCRAM_KEY_LEN; i++)
 		client_proof[i] = client_key[i] ^ client_signature[i];
-
-	free(prepared_password);
+	OPENSSL_cleanse(client_key, sizeof(client_key));
 	return 0;
-
-	error:
-
-	free(prepared_password);
-	return -1;
 }
 
 static char*
@@ -413,7 +558,7 @@ calculate_server_signature(od_scram_state_t *scram_state)
 	scram_HMAC_final(server_signature, &ctx);
 
 	int base64_signature_dst_len = pg_b64_enc_len(SCRAM_KEY_LEN) + 1;
-	char *base64_signature = malloc(base64_signature_dst_len);
+	char *base64_signature = od_scram_alloc(scram_state, base64_signature_dst_len);
 	if (base64_signature == NULL)
 		return NULL;
 
@@ -450,6 +595,7 @@ od_scram_create_client_final_message(od_scram_state_t *scram_state,
 	rc = calculate_client_proof(scram_state, 
 							   	password, salt, iterations, 
 							   	result, client_proof);
+	free(salt);
 	if (rc == -1)
 		goto error;
 
@@ -519,10 +665,7 @@ od_scram_verify_server_signature(od_scram_state_t *scram_state, char *auth_data)
 		return -1;
 
 	scram_HMAC_ctx ctx;
-
-	uint8_t server_key[SCRAM_KEY_LEN];
-	scram_ServerKey(scram_state->salted_password, server_key);
-	scram_HMAC_init(&ctx, server_key, SCRAM_KEY_LEN);
+	scram_HMAC_init(&ctx, scram_state->server_key, SCRAM_KEY_LEN);
 
 	scram_HMAC_update(&ctx, scram_state->client_first_message,
 			  		  strlen(scram_state->client_first_message));
@@ -571,7 +714,7 @@ od_scram_read_client_first_message(od_scram_state_t *scram_state, char *auth_dat
 	if (*auth_data == 'm') // todo: mandatory extensions
 		return -5;
 
-	char *client_first_message = strdup(auth_data);
+	char *client_first_message = od_scram_strdup(scram_state, auth_data);
 	if (client_first_message == NULL)
 		return -1;
 
@@ -585,7 +728,7 @@ od_scram_read_client_first_message(od_scram_state_t *scram_state, char *auth_dat
 		if (*ptr < 0x21 || *ptr > 0x7E || *ptr == ',')
 			goto error;
 
-	client_nonce = strdup(client_nonce);
+	client_nonce = od_scram_strdup(scram_state, client_nonce);
 	if (client_nonce == NULL)
 		goto error;
 
@@ -599,7 +742,7 @@ od_scram_read_client_first_message(od_scram_state_t *scram_state, char *auth_dat
 
 	error:
 
-	free(client_first_message);
+	od_scram_release(scram_state, client_first_message);
 
 	return -1;
 }
@@ -613,7 +756,7 @@ od_scram_read_client_final_message(od_scram_state_t *scram_state, char *auth_dat
 	char *base64_prof;
 	char *proof = NULL;
 
-	char *auth_data_copy = strdup(auth_data);
+	char *auth_data_copy = od_scram_strdup(scram_state, auth_data);
 	if (auth_data_copy == NULL)
 		goto error;
 
@@ -637,7 +780,7 @@ od_scram_read_client_final_message(od_scram_state_t *scram_state, char *auth_dat
 		goto error;
 
 	int base64_proof_len = strlen(base64_prof);
-	proof = malloc(pg_b64_dec_len(base64_proof_len));
+	proof = od_scram_alloc(scram_state, pg_b64_dec_len(base64_proof_len));
 	if (proof == NULL)
 		goto error;
 
@@ -646,7 +789,8 @@ od_scram_read_client_final_message(od_scram_state_t *scram_state, char *auth_dat
 	if (*auth_data != '\0')
 		goto error;
 
-	scram_state->client_final_message = malloc(proof_start - input_start + 1);
+	scram_state->client_final_message =
+		od_scram_alloc(scram_state, proof_start - input_start + 1);
 	if (!scram_state->client_final_message)
 		goto error;
 
@@ -655,12 +799,14 @@ od_scram_read_client_final_message(od_scram_state_t *scram_state, char *auth_dat
 
 	*final_nonce_ptr = client_final_nonce;
 	*proof_ptr = proof;
+	od_scram_release(scram_state, auth_data_copy);
 
 	return 0;
 
 	error:
 
-	free(proof);
+	od_scram_release(scram_state, auth_data_copy);
+	od_scram_release(scram_state, proof);
 
 	return -1;
 }
@@ -675,7 +821,7 @@ od_scram_create_server_first_message(od_scram_state_t *scram_state)
 
 	int server_nonce_len = pg_b64_enc_len(SCRAM_RAW_NONCE_LEN) + 1;
 
-	scram_state->server_nonce = malloc(server_nonce_len);
+	scram_state->server_nonce = od_scram_alloc(scram_state, server_nonce_len);
 	if (scram_state->server_nonce == NULL)
 		goto error;
 
@@ -688,7 +834,7 @@ od_scram_create_server_first_message(od_scram_state_t *scram_state)
 		          strlen(scram_state->server_nonce) +
 		          strlen(scram_state->salt);
 
-	result = malloc(size);
+	result = od_scram_alloc(scram_state, size + 1);
 
 	if (!result)
 		goto error;
@@ -703,8 +849,8 @@ od_scram_create_server_first_message(od_scram_state_t *scram_state)
 
 	error:
 
-	free(scram_state->server_nonce);
-	free(scram_state->server_first_message);
+	od_scram_release(scram_state, scram_state->server_nonce);
+	scram_state->server_nonce = NULL;
 
 	return NULL;
 }
@@ -770,23 +916,24 @@ od_scram_create_server_final_message(od_scram_state_t *scram_state)
 		return NULL;
 
 	size_t size = strlen("v=") + strlen(signature);
-	char *result = malloc(size);
+	char *result = od_scram_alloc(scram_state, size + 1);
 	if (result == NULL)
 		goto error;
 
 	snprintf(result, size + 1, "v=%s", signature);
 
-	free(signature);
-
 	machine_msg_t* msg = kiwi_be_write_authentication_sasl_final(NULL, result, size);
 	if (msg == NULL)
 		goto error;
 
+	od_scram_release(scram_state, signature);
+	od_scram_release(scram_state, result);
 	return msg;
 
 	error:
 
-	free(result);
+	od_scram_release(scram_state, signature);
+	od_scram_release(scram_state, result);
 
 	return NULL;
 }
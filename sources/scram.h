@@ -26,12 +26,14 @@ struct od_scram_state
 	char *server_nonce;
 	char *server_first_message;
 
-	uint8_t	*salted_password;
 	int iterations;
 	char *salt;
 
 	uint8_t stored_key[32];
 	uint8_t server_key[32];
+
+	/* frontend state lives in the client login arena */
+	od_arena_t *arena;
 };
 
 static inline void
@@ -40,15 +42,41 @@ od_scram_state_init(od_scram_state_t *state)
 	memset(state, 0, sizeof(*state));
 }
 
+static inline void*
+od_scram_alloc(od_scram_state_t *state, size_t size)
+{
+	if (state->arena)
+		return od_arena_alloc(state->arena, size);
+	return malloc(size);
+}
+
+static inline char*
+od_scram_strdup(od_scram_state_t *state, const char *string)
+{
+	if (state->arena)
+		return od_arena_strdup(state->arena, string);
+	return strdup(string);
+}
+
+static inline void
+od_scram_release(od_scram_state_t *state, void *ptr)
+{
+	if (state->arena == NULL)
+		free(ptr);
+}
+
 static inline void
 od_scram_state_free(od_scram_state_t *state)
 {
+	if (state->arena) {
+		memset(state, 0, sizeof(*state));
+		return;
+	}
 	free(state->client_nonce);
 	free(state->client_first_message);
 	free(state->client_final_message);
 	free(state->server_nonce);
 	free(state->server_first_message);
-	free(state->salted_password);
 	free(state->salt);
 
 	memset(state, 0, sizeof(*state));
@@ -57,6 +85,10 @@ od_scram_state_free(od_scram_state_t *state)
 machine_msg_t*
 od_scram_create_client_first_message(od_scram_state_t *scram_state);
 
+char*
+od_scram_prepare_password(char *password);
+
+/* password is prepared by od_scram_prepare_password() */
 machine_msg_t*
 od_scram_create_client_final_message(od_scram_state_t *scram_state,
 									 char *password, char *auth_data);
@@ -81,7 +113,8 @@ int
 od_scram_parse_verifier(od_scram_state_t *scram_state, char *verifier);
 
 int
-od_scram_init_from_plain_password(od_scram_state_t *scram_state, char *plain_password);
+od_scram_init_from_plain_password(od_scram_state_t *scram_state, char *user,
+                                  char *plain_password);
 
 int
 od_scram_read_client_first_message(od_scram_state_t *scram_state, char *auth_data);
@@ -18,28 +18,43 @@ typedef enum
 
 struct od_server
 {
+	/* fields used by relay, attach and detach come first, auth
+	 * state and vars are only touched on connect and reset */
 	od_server_state_t  state;
-	od_scram_state_t   scram_state;
-	od_id_t            id;
-	machine_tls_t     *tls;
-	od_io_t            io;
-	od_relay_t         relay;
-	int                is_allocated;
 	int                is_transaction;
 	int                is_copy;
+	int                is_dirty;
+	int                is_passthrough;
+	int                sync_pending;
 	int                deploy_sync;
-	od_stat_state_t    stats_state;
 	uint64_t           sync_request;
 	uint64_t           sync_reply;
-	int                idle_time;
-	kiwi_key_t         key;
-	kiwi_key_t         key_client;
-	kiwi_vars_t        vars;
-	machine_msg_t     *error_connect;
 	void              *client;
 	void              *route;
 	od_global_t       *global;
 	od_list_t          link;
+	uint64_t           idle_since;
+	uint64_t           lifetime_end;
+	int                idle_check;
+	int                io_worker;
+	int                pool_worker;
+	od_io_t            io;
+	od_relay_t         relay;
+	od_stat_state_t    stats_state;
+	machine_tls_t     *tls;
+	int                is_allocated;
+	int                connect_failed;
+	int                endpoint;
+	uint64_t           tcp_retrans;
+	uint64_t           deploy_hash;
+	od_prepared_server_t prepared;
+	machine_msg_t     *error_connect;
+	od_id_t            id;
+	kiwi_key_t         key;
+	kiwi_key_t         key_client;
+	od_list_t          link_cancel;
+	od_scram_state_t   scram_state;
+	kiwi_vars_t        vars;
 };
 
 static inline void
@@ -50,29 +65,62 @@ od_server_init(od_server_t *server)
 	server->client         = NULL;
 	server->global         = NULL;
 	server->tls            = NULL;
-	server->idle_time      = 0;
+	server->idle_since     = 0;
+	server->lifetime_end   = 0;
+	server->idle_check     = 0;
+	server->io_worker      = -1;
+	server->pool_worker    = 0;
+	server->connect_failed = 0;
+	server->endpoint       = -1;
+	server->tcp_retrans    = 0;
 	server->is_allocated   = 0;
 	server->is_transaction = 0;
 	server->is_copy        = 0;
+	server->is_dirty       = 0;
+	server->is_passthrough = 0;
 	server->deploy_sync    = 0;
+	server->sync_pending   = 0;
 	server->sync_request   = 0;
 	server->sync_reply     = 0;
 	server->error_connect  = NULL;
+	server->deploy_hash    = 0;
 	od_stat_state_init(&server->stats_state);
 	od_scram_state_init(&server->scram_state);
 	kiwi_key_init(&server->key);
 	kiwi_key_init(&server->key_client);
 	kiwi_vars_init(&server->vars);
+	od_prepared_server_init(&server->prepared);
 	od_io_init(&server->io);
 	od_relay_init(&server->relay, &server->io);
 	od_list_init(&server->link);
+	od_list_init(&server->link_cancel);
 	memset(&server->id, 0, sizeof(server->id));
 }
 
+static inline int
+od_server_recycle(od_server_t *server, uint64_t now)
+{
+	/* server_lifetime is over */
+	return server->lifetime_end && now >= server->lifetime_end;
+}
+
 static inline od_server_t*
 od_server_allocate(void)
 {
-	od_server_t *server = malloc(sizeof(*server));
+	od_server_t *server;
+	od_list_t *cached = od_cache_pop(&od_cache_server);
+	if (cached) {
+		/* reuse conditions of the cached server */
+		server = od_container_of(cached, od_server_t, link);
+		machine_cond_t *on_read  = server->io.on_read;
+		machine_cond_t *on_write = server->io.on_write;
+		od_server_init(server);
+		server->io.on_read  = on_read;
+		server->io.on_write = on_write;
+		server->is_allocated = 1;
+		return server;
+	}
+	server = malloc(sizeof(*server));
 	if (server == NULL)
 		return NULL;
 	od_server_init(server);
@@ -83,6 +131,14 @@ od_server_allocate(void)
 static inline void
 od_server_free(od_server_t *server)
 {
+	od_relay_free(&server->relay);
+	od_io_reuse(&server->io);
+	kiwi_vars_free(&server->vars);
+	od_prepared_server_free(&server->prepared);
+	if (server->is_allocated &&
+	    od_cache_push(&od_cache_server, &server->link) == 0)
+		return;
+	od_io_free(&server->io);
 	if (server->is_allocated)
 		free(server);
 }
@@ -111,4 +167,13 @@ od_server_synchronized(od_server_t *server)
 	return server->sync_request == server->sync_reply;
 }
 
+static inline int
+od_server_idle_time(od_server_t *server, uint64_t now)
+{
+	/* seconds since the server was released to the idle pool */
+	if (server->idle_since == 0 || now < server->idle_since)
+		return 0;
+	return (now - server->idle_since) / 1000000;
+}
+
 #endif /* ODYSSEY_SERVER_H */
@@ -0,0 +1,89 @@
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+od_server_cap_t*
+od_server_cap_allocate(char *name)
+{
+	od_server_cap_t *cap = malloc(sizeof(od_server_cap_t));
+	if (cap == NULL)
+		return NULL;
+	memset(cap, 0, sizeof(od_server_cap_t));
+	cap->name = strdup(name);
+	if (cap->name == NULL) {
+		free(cap);
+		return NULL;
+	}
+	pthread_mutex_init(&cap->lock, NULL);
+	od_list_init(&cap->waiters);
+	od_list_init(&cap->link);
+	return cap;
+}
+
+void
+od_server_cap_free(od_server_cap_t *cap)
+{
+	pthread_mutex_destroy(&cap->lock);
+	free(cap->name);
+	free(cap);
+}
+
+void
+od_server_cap_close(od_server_cap_t *cap, int total)
+{
+	/* total servers of the route after the close */
+	od_atomic_u32_dec(&cap->count);
+	if (total == 0)
+		od_atomic_u32_dec(&cap->routes);
+	if (od_atomic_u32_of(&cap->count_waiters) == 0)
+		return;
+
+	/* wakeup all waiters, the first one to retry takes the room
+	 * and the rest queue again */
+	pthread_mutex_lock(&cap->lock);
+	while (! od_list_empty(&cap->waiters)) {
+		od_route_waiter_t *waiter;
+		waiter = od_container_of(cap->waiters.next, od_route_waiter_t, link);
+		od_list_unlink(&waiter->link);
+		od_list_init(&waiter->link);
+		if (od_route_waiter_grant(waiter) == -1) {
+			od_list_push(&cap->waiters, &waiter->link);
+			break;
+		}
+		od_atomic_u32_dec(&cap->count_waiters);
+	}
+	pthread_mutex_unlock(&cap->lock);
+}
+
+int
+od_server_cap_preempt(od_server_cap_t *cap)
+{
+	/* take one preemption asked by a route below its share,
+	 * requests are dropped once nobody waits */
+	for (;;) {
+		uint32_t preempt = od_atomic_u32_of(&cap->preempt);
+		if (preempt == 0)
+			return 0;
+		if (od_atomic_u32_of(&cap->count_waiters) == 0) {
+			__sync_bool_compare_and_swap(&cap->preempt, preempt, 0);
+			return 0;
+		}
+		if (__sync_bool_compare_and_swap(&cap->preempt, preempt, preempt - 1))
+			return 1;
+	}
+}
@@ -0,0 +1,73 @@
+#ifndef ODYSSEY_SERVER_CAP_H
+#define ODYSSEY_SERVER_CAP_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_server_cap od_server_cap_t;
+
+/* Storage server_max, shared by all routes connecting to the storage
+ * of the same name.
+ *
+ * Every route holding servers of the storage is guaranteed an equal
+ * share of server_max. A route may open servers over its share while
+ * the storage has room, borrowing capacity unused by other routes.
+ * Once the storage is full, a route below its share asks to preempt
+ * a server and waits: idle servers of routes over their share are
+ * closed on detach or by expire, and waiters are woken up when any
+ * server of the storage is closed.
+ *
+ * Counters are updated by server pools of the routes, under the
+ * route lock. Lock of the waiters list is taken after the route
+ * lock. */
+
+struct od_server_cap
+{
+	char            *name;
+	od_atomic_u32_t  count;
+	od_atomic_u32_t  routes;
+	od_atomic_u32_t  preempt;
+	pthread_mutex_t  lock;
+	od_list_t        waiters;
+	od_atomic_u32_t  count_waiters;
+	od_list_t        link;
+};
+
+static inline int
+od_server_cap_share(od_server_cap_t *cap, int max, int total)
+{
+	/* share of a route holding total servers, counting the
+	 * route itself if it has none yet */
+	uint32_t routes = od_atomic_u32_of(&cap->routes);
+	if (total == 0)
+		routes++;
+	int share = max / (int)routes;
+	if (share == 0)
+		share = 1;
+	return share;
+}
+
+static inline int
+od_server_cap_room(od_server_cap_t *cap, int max)
+{
+	return od_atomic_u32_of(&cap->count) < (uint32_t)max;
+}
+
+static inline void
+od_server_cap_open(od_server_cap_t *cap, int total)
+{
+	/* total servers of the route before the open */
+	od_atomic_u32_inc(&cap->count);
+	if (total == 0)
+		od_atomic_u32_inc(&cap->routes);
+}
+
+od_server_cap_t *od_server_cap_allocate(char*);
+void             od_server_cap_free(od_server_cap_t*);
+void             od_server_cap_close(od_server_cap_t*, int);
+int              od_server_cap_preempt(od_server_cap_t*);
+
+#endif /* ODYSSEY_SERVER_CAP_H */
@@ -9,38 +9,142 @@
 
 typedef struct od_server_pool od_server_pool_t;
 
+typedef struct od_server_pool_local od_server_pool_local_t;
+
 typedef int (*od_server_pool_cb_t)(od_server_t*, void**);
 
-struct od_server_pool
+/* idle servers last released by clients of one worker */
+struct od_server_pool_local
 {
-	od_list_t active;
 	od_list_t idle;
-	int       count_active;
 	int       count_idle;
 };
 
+/* TCP_INFO sample of a server connection, times in microseconds,
+ * retransmits since the previous sample of the connection */
+typedef struct
+{
+	uint32_t rtt;
+	uint32_t rttvar;
+	uint32_t cwnd;
+	uint32_t retrans;
+} od_server_pool_tcp_t;
+
+/* server connections opened to one storage host */
+typedef struct
+{
+	int      count;
+	uint64_t connect_time;
+	int      connect_errors;
+	uint64_t connect_error_time;
+	uint64_t tcp_time;
+	uint64_t tcp_samples;
+	uint32_t rtt;
+	uint32_t rttvar;
+	uint32_t cwnd;
+	uint64_t retrans;
+} od_server_pool_endpoint_t;
+
+struct od_server_pool
+{
+	od_list_t               active;
+	od_server_pool_local_t  local_default;
+	od_server_pool_local_t *local;
+	int                     count_local;
+	int                     count_active;
+	int                     count_idle;
+	od_server_pool_endpoint_t endpoints[OD_RULE_STORAGE_ENDPOINTS_MAX];
+	od_server_cap_t        *cap;
+};
+
+static inline void
+od_server_pool_local_init(od_server_pool_local_t *local)
+{
+	local->count_idle = 0;
+	od_list_init(&local->idle);
+}
+
 static inline void
 od_server_pool_init(od_server_pool_t *pool)
 {
 	pool->count_active = 0;
 	pool->count_idle   = 0;
-	od_list_init(&pool->idle);
+	pool->count_local  = 1;
+	pool->local        = &pool->local_default;
+	pool->cap          = NULL;
+	memset(pool->endpoints, 0, sizeof(pool->endpoints));
+	od_server_pool_local_init(&pool->local_default);
 	od_list_init(&pool->active);
 }
 
+static inline int
+od_server_pool_prepare(od_server_pool_t *pool, int count)
+{
+	/* one idle sub-pool per worker */
+	assert(pool->count_idle == 0);
+	if (count <= 1)
+		return 0;
+	od_server_pool_local_t *local;
+	local = malloc(sizeof(od_server_pool_local_t) * count);
+	if (local == NULL)
+		return -1;
+	int i;
+	for (i = 0; i < count; i++)
+		od_server_pool_local_init(&local[i]);
+	pool->local = local;
+	pool->count_local = count;
+	return 0;
+}
+
 static inline void
 od_server_pool_free(od_server_pool_t *pool)
 {
 	od_server_t *server;
 	od_list_t *i, *n;
-	od_list_foreach_safe(&pool->idle, i, n) {
-		server = od_container_of(i, od_server_t, link);
-		od_server_free(server);
+	int id;
+	for (id = 0; id < pool->count_local; id++) {
+		od_list_foreach_safe(&pool->local[id].idle, i, n) {
+			server = od_container_of(i, od_server_t, link);
+			od_server_free(server);
+		}
 	}
 	od_list_foreach_safe(&pool->active, i, n) {
 		server = od_container_of(i, od_server_t, link);
 		od_server_free(server);
 	}
+	if (pool->local != &pool->local_default)
+		free(pool->local);
+}
+
+static inline od_server_pool_local_t*
+od_server_pool_local(od_server_pool_t *pool, int worker_id)
+{
+	if (worker_id < 0)
+		worker_id = 0;
+	return &pool->local[worker_id % pool->count_local];
+}
+
+static inline void
+od_server_pool_idle_insert(od_server_pool_local_t *local,
+                           od_server_t *server)
+{
+	/* idle list is ordered by release time, the newest server is
+	 * at the head and the oldest one at the tail. A server coming
+	 * back from the idle check keeps its release time, it is put
+	 * next to servers of the same age found from the tail */
+	if (server->idle_since == 0) {
+		server->idle_since = machine_time_us();
+		od_list_push(&local->idle, &server->link);
+		return;
+	}
+	od_list_t *i = local->idle.prev;
+	while (i != &local->idle) {
+		od_server_t *next = od_container_of(i, od_server_t, link);
+		if (next->idle_since >= server->idle_since)
+			break;
+		i = i->prev;
+	}
+	od_list_push(i, &server->link);
 }
 
 static inline void
@@ -49,10 +153,19 @@ od_server_pool_set(od_server_pool_t *pool, od_server_t *server,
 {
 	if (server->state == state)
 		return;
+	/* servers are accounted in storage server_max on open and close */
+	int cap_close = 0;
+	if (pool->cap) {
+		if (server->state == OD_SERVER_UNDEF)
+			od_server_cap_open(pool->cap, pool->count_active + pool->count_idle);
+		else if (state == OD_SERVER_UNDEF)
+			cap_close = 1;
+	}
 	switch (server->state) {
 	case OD_SERVER_UNDEF:
 		break;
 	case OD_SERVER_IDLE:
+		od_server_pool_local(pool, server->pool_worker)->count_idle--;
 		pool->count_idle--;
 		break;
 	case OD_SERVER_ACTIVE:
@@ -60,11 +173,19 @@ od_server_pool_set(od_server_pool_t *pool, od_server_t *server,
 		break;
 	}
 	od_list_t *target = NULL;
+	od_server_pool_local_t *local = NULL;
 	switch (state) {
 	case OD_SERVER_UNDEF:
+		/* connection to the storage host is gone */
+		if (server->endpoint >= 0) {
+			pool->endpoints[server->endpoint].count--;
+			server->endpoint = -1;
+		}
 		break;
 	case OD_SERVER_IDLE:
-		target = &pool->idle;
+		local = od_server_pool_local(pool, server->pool_worker);
+		target = &local->idle;
+		local->count_idle++;
 		pool->count_idle++;
 		break;
 	case OD_SERVER_ACTIVE:
@@ -74,9 +195,13 @@ od_server_pool_set(od_server_pool_t *pool, od_server_t *server,
 	}
 	od_list_unlink(&server->link);
 	od_list_init(&server->link);
-	if (target)
+	if (local)
+		od_server_pool_idle_insert(local, server);
+	else if (target)
 		od_list_push(target, &server->link);
 	server->state = state;
+	if (cap_close)
+		od_server_cap_close(pool->cap, pool->count_active + pool->count_idle);
 }
 
 static inline od_server_t*
@@ -86,9 +211,17 @@ od_server_pool_next(od_server_pool_t *pool, od_server_state_t state)
 	od_list_t *target = NULL;
 	switch (state) {
 	case OD_SERVER_IDLE:
-		target_count = pool->count_idle;
-		target = &pool->idle;
+	{
+		int id;
+		for (id = 0; id < pool->count_local; id++) {
+			if (pool->local[id].count_idle == 0)
+				continue;
+			target_count = pool->local[id].count_idle;
+			target = &pool->local[id].idle;
+			break;
+		}
 		break;
+	}
 	case OD_SERVER_ACTIVE:
 		target_count = pool->count_active;
 		target = &pool->active;
@@ -105,19 +238,31 @@ od_server_pool_next(od_server_pool_t *pool, od_server_state_t state)
 }
 
 static inline od_server_t*
-od_server_pool_foreach(od_server_pool_t *pool, od_server_state_t state,
-                       od_server_pool_cb_t callback,
-                       void **argv)
+od_server_pool_next_local(od_server_pool_t *pool, int worker_id)
+{
+	od_server_pool_local_t *local;
+	local = od_server_pool_local(pool, worker_id);
+	if (local->count_idle == 0)
+		return NULL;
+	return od_container_of(local->idle.next, od_server_t, link);
+}
+
+static inline od_server_t*
+od_server_pool_last_local(od_server_pool_t *pool, int worker_id)
+{
+	/* idle server released the longest time ago */
+	od_server_pool_local_t *local;
+	local = od_server_pool_local(pool, worker_id);
+	if (local->count_idle == 0)
+		return NULL;
+	return od_container_of(local->idle.prev, od_server_t, link);
+}
+
+static inline od_server_t*
+od_server_pool_foreach_list(od_list_t *target,
+                            od_server_pool_cb_t callback,
+                            void **argv)
 {
-	od_list_t *target = NULL;
-	switch (state) {
-	case OD_SERVER_IDLE:   target = &pool->idle;
-		break;
-	case OD_SERVER_ACTIVE: target = &pool->active;
-		break;
-	case OD_SERVER_UNDEF:  assert(0);
-		break;
-	}
 	od_server_t *server;
 	od_list_t *i, *n;
 	od_list_foreach_safe(target, i, n) {
@@ -131,6 +276,161 @@ od_server_pool_foreach(od_server_pool_t *pool, od_server_state_t state,
 	return NULL;
 }
 
+static inline od_server_t*
+od_server_pool_foreach(od_server_pool_t *pool, od_server_state_t state,
+                       od_server_pool_cb_t callback,
+                       void **argv)
+{
+	od_server_t *server = NULL;
+	int id;
+	switch (state) {
+	case OD_SERVER_IDLE:
+		for (id = 0; id < pool->count_local; id++) {
+			server = od_server_pool_foreach_list(&pool->local[id].idle,
+			                                     callback, argv);
+			if (server)
+				break;
+		}
+		break;
+	case OD_SERVER_ACTIVE:
+		server = od_server_pool_foreach_list(&pool->active, callback, argv);
+		break;
+	case OD_SERVER_UNDEF:
+		assert(0);
+		break;
+	}
+	return server;
+}
+
+static inline od_server_t*
+od_server_pool_foreach_expired(od_server_pool_t *pool, uint64_t now,
+                               int ttl,
+                               od_server_pool_cb_t callback,
+                               void **argv)
+{
+	/* walk idle servers from the oldest one, stop on the first
+	 * server idle for less than ttl seconds */
+	int id;
+	for (id = 0; id < pool->count_local; id++) {
+		od_list_t *target = &pool->local[id].idle;
+		od_list_t *i = target->prev;
+		while (i != target) {
+			od_server_t *server = od_container_of(i, od_server_t, link);
+			i = i->prev;
+			if (od_server_idle_time(server, now) < ttl)
+				break;
+			int rc;
+			rc = callback(server, argv);
+			if (rc)
+				return server;
+		}
+	}
+	return NULL;
+}
+
+/* a host which failed to connect is skipped for a while, unless all of them did */
+#define OD_SERVER_POOL_ENDPOINT_RETRY 1000000
+
+static inline int
+od_server_pool_endpoint_select(od_server_pool_t *pool,
+                               od_rule_storage_t *storage,
+                               uint64_t now)
+{
+	/* network round trip replaces connect time once every host
+	 * has been sampled, so hosts are compared by the same measure */
+	int use_rtt = storage->lb == OD_RULE_LB_LATENCY;
+	int i;
+	for (i = 0; i < storage->endpoints_count && use_rtt; i++)
+		use_rtt = pool->endpoints[i].rtt > 0;
+
+	int pass;
+	for (pass = 0; pass < 2; pass++) {
+		int    best = -1;
+		double best_score = 0;
+		for (i = 0; i < storage->endpoints_count; i++) {
+			od_server_pool_endpoint_t *endpoint = &pool->endpoints[i];
+			if (! od_rules_storage_endpoint_usable(storage, i))
+				continue;
+			if (pass == 0 && endpoint->connect_errors > 0 &&
+			    now - endpoint->connect_error_time < OD_SERVER_POOL_ENDPOINT_RETRY)
+				continue;
+			/* spread connections in proportion to the host weight,
+			 * scaled by the average connect time in latency mode.
+			 * host without connect time measured yet goes first */
+			double score = endpoint->count + 1;
+			if (use_rtt)
+				score *= endpoint->rtt + 4 * endpoint->rttvar;
+			else
+			if (storage->lb == OD_RULE_LB_LATENCY)
+				score *= endpoint->connect_time;
+			score /= storage->endpoints[i].weight;
+			if (best == -1 || score < best_score) {
+				best = i;
+				best_score = score;
+			}
+		}
+		if (best != -1) {
+			pool->endpoints[best].count++;
+			return best;
+		}
+	}
+	return -1;
+}
+
+static inline void
+od_server_pool_endpoint_connected(od_server_pool_t *pool, int id,
+                                  uint64_t connect_time)
+{
+	od_server_pool_endpoint_t *endpoint = &pool->endpoints[id];
+	/* moving average */
+	if (endpoint->connect_time == 0)
+		endpoint->connect_time = connect_time;
+	else
+		endpoint->connect_time = (endpoint->connect_time * 7 + connect_time) / 8;
+	if (endpoint->connect_time == 0)
+		endpoint->connect_time = 1;
+	endpoint->connect_errors = 0;
+}
+
+static inline int
+od_server_pool_endpoint_tcp_due(od_server_pool_t *pool, int id,
+                                int interval, uint64_t now)
+{
+	/* one server connection of the host is sampled per interval,
+	 * read without the route lock */
+	return interval > 0 &&
+	       now - pool->endpoints[id].tcp_time >= (uint64_t)interval * 1000;
+}
+
+static inline void
+od_server_pool_endpoint_tcp(od_server_pool_t *pool, int id,
+                            od_server_pool_tcp_t *sample, uint64_t now)
+{
+	od_server_pool_endpoint_t *endpoint = &pool->endpoints[id];
+	/* moving average, as the connect time */
+	if (endpoint->tcp_samples == 0) {
+		endpoint->rtt    = sample->rtt;
+		endpoint->rttvar = sample->rttvar;
+	} else {
+		endpoint->rtt    = (endpoint->rtt * 7ull + sample->rtt) / 8;
+		endpoint->rttvar = (endpoint->rttvar * 7ull + sample->rttvar) / 8;
+	}
+	if (endpoint->rtt == 0)
+		endpoint->rtt = 1;
+	endpoint->cwnd     = sample->cwnd;
+	endpoint->retrans += sample->retrans;
+	endpoint->tcp_time = now;
+	endpoint->tcp_samples++;
+}
+
+static inline void
+od_server_pool_endpoint_failed(od_server_pool_t *pool, int id, uint64_t now)
+{
+	od_server_pool_endpoint_t *endpoint = &pool->endpoints[id];
+	endpoint->connect_errors++;
+	endpoint->connect_error_time = now;
+}
+
 static inline int
 od_server_pool_total(od_server_pool_t *pool)
 {
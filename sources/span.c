@@ -0,0 +1,463 @@
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+/* traceparent: version-trace_id-parent_id-flags */
+#define OD_SPAN_TRACEPARENT 55
+
+static inline int
+od_span_hex(char chr)
+{
+	if (chr >= '0' && chr <= '9')
+		return chr - '0';
+	if (chr >= 'a' && chr <= 'f')
+		return chr - 'a' + 10;
+	return -1;
+}
+
+static inline int
+od_span_hex_read(char *pos, uint8_t *dest, int size)
+{
+	/* all zero ids are invalid */
+	int zero = 1;
+	int i;
+	for (i = 0; i < size; i++) {
+		int hi = od_span_hex(pos[i * 2]);
+		int lo = od_span_hex(pos[i * 2 + 1]);
+		if (hi == -1 || lo == -1)
+			return -1;
+		dest[i] = hi << 4 | lo;
+		if (dest[i])
+			zero = 0;
+	}
+	return zero ? -1 : 0;
+}
+
+static inline int
+od_span_traceparent(char *pos, od_span_trace_t *trace)
+{
+	if (pos[2] != '-' || pos[35] != '-' || pos[52] != '-')
+		return -1;
+	/* version ff is invalid */
+	int hi = od_span_hex(pos[0]);
+	int lo = od_span_hex(pos[1]);
+	if (hi == -1 || lo == -1 || (hi == 0xf && lo == 0xf))
+		return -1;
+	if (od_span_hex_read(pos + 3, trace->trace_id, 16) == -1)
+		return -1;
+	if (od_span_hex_read(pos + 36, trace->parent_id, 8) == -1)
+		return -1;
+	int flags = od_span_hex(pos[54]);
+	if (od_span_hex(pos[53]) == -1 || flags == -1)
+		return -1;
+	/* only traces sampled by the caller are recorded */
+	if (! (flags & 1))
+		return -1;
+	return 0;
+}
+
+int
+od_span_trace_parse(char *value, int value_len, od_span_trace_t *trace)
+{
+	/* traceparent may be a part of the value, such as
+	 * application_name "app 00-...-01" */
+	int len = strnlen(value, value_len);
+	int i;
+	for (i = 0; i + OD_SPAN_TRACEPARENT <= len; i++) {
+		if (i > 0 && od_span_hex(value[i - 1]) != -1)
+			continue;
+		if (od_span_traceparent(value + i, trace) == 0)
+			return 0;
+	}
+	return -1;
+}
+
+static inline kiwi_var_t*
+od_span_var(od_client_t *client, char *name)
+{
+	int name_len = strlen(name) + 1;
+	kiwi_var_type_t type;
+	type = kiwi_vars_find(&client->vars, name, name_len);
+	if (type != KIWI_VAR_UNDEF)
+		return kiwi_vars_get(&client->vars, type);
+	return kiwi_vars_extra_find(&client->vars, name, name_len);
+}
+
+void
+od_span_begin(od_client_t *client, uint64_t start)
+{
+	od_instance_t *instance = client->global->instance;
+	od_system_t *system = client->global->system;
+	od_spans_t *spans = &system->spans;
+
+	/* sampling is decided once per transaction */
+	client->span_skip = 1;
+	if (spans->channel == NULL)
+		return;
+
+	char *name = instance->config.span_parameter;
+	if (name == NULL)
+		name = "application_name";
+	kiwi_var_t *var;
+	var = od_span_var(client, name);
+	if (var == NULL || var->value_len == 0)
+		return;
+	od_span_trace_t trace;
+	if (od_span_trace_parse(var->value, var->value_len, &trace) == -1)
+		return;
+	int rate = instance->config.span_sample_rate;
+	if (rate < 100 && machine_lrand48() % 100 >= rate)
+		return;
+
+	machine_msg_t *msg;
+	msg = machine_msg_create(sizeof(od_span_tx_t));
+	if (msg == NULL)
+		return;
+	od_span_tx_t *tx = machine_msg_data(msg);
+	memset(tx, 0, sizeof(od_span_tx_t));
+	tx->trace = trace;
+	tx->start = start;
+	client->span      = msg;
+	client->span_skip = 0;
+}
+
+void
+od_span_end(od_client_t *client, uint64_t end)
+{
+	client->span_skip = 0;
+	machine_msg_t *msg = client->span;
+	if (msg == NULL)
+		return;
+	client->span = NULL;
+
+	od_instance_t *instance = client->global->instance;
+	od_system_t *system = client->global->system;
+	od_spans_t *spans = &system->spans;
+
+	/* the machine does not keep up, do not grow the queue */
+	if (od_atomic_u64_of(&spans->queued) >=
+	    (uint64_t)instance->config.span_queue) {
+		od_atomic_u64_inc(&spans->dropped);
+		machine_msg_free(msg);
+		return;
+	}
+
+	od_span_tx_t *tx = machine_msg_data(msg);
+	tx->end = end;
+	od_route_t *route = client->route;
+	od_snprintf(tx->database, sizeof(tx->database), "%.*s",
+	            route->id.database_len, route->id.database);
+	od_snprintf(tx->user, sizeof(tx->user), "%.*s",
+	            route->id.user_len, route->id.user);
+	od_atomic_u64_inc(&spans->queued);
+	machine_channel_write(spans->channel, msg);
+}
+
+static inline void
+od_spans_hex(char *dest, uint8_t *data, int size)
+{
+	static const char *hex = "0123456789abcdef";
+	int i;
+	for (i = 0; i < size; i++) {
+		dest[i * 2]     = hex[data[i] >> 4];
+		dest[i * 2 + 1] = hex[data[i] & 0x0f];
+	}
+	dest[size * 2] = 0;
+}
+
+static inline void
+od_spans_json_string(char *dest, int size, char *src)
+{
+	/* names are escaped, control characters are dropped */
+	int pos = 0;
+	for (; *src && pos < size - 2; src++) {
+		unsigned char chr = *src;
+		if (chr < 0x20)
+			continue;
+		if (chr == '"' || chr == '\\')
+			dest[pos++] = '\\';
+		dest[pos++] = chr;
+	}
+	dest[pos] = 0;
+}
+
+static inline uint64_t
+od_spans_id(void)
+{
+	uint64_t id;
+	id = (uint64_t)machine_lrand48() << 32 | (uint64_t)machine_lrand48();
+	return id ? id : 1;
+}
+
+static char od_spans_prefix[] =
+	"{\"resourceSpans\":[{\"resource\":{\"attributes\":["
+	"{\"key\":\"service.name\",\"value\":{\"stringValue\":\"odyssey\"}}]},"
+	"\"scopeSpans\":[{\"scope\":{\"name\":\"odyssey\"},\"spans\":[";
+
+static char od_spans_suffix[] = "]}]}]}";
+
+static inline void
+od_spans_flush(od_spans_t *spans)
+{
+	if (spans->buf_spans == 0)
+		return;
+	memcpy(spans->buf + spans->buf_len, od_spans_suffix,
+	       sizeof(od_spans_suffix) - 1);
+	spans->buf_len += sizeof(od_spans_suffix) - 1;
+	/* lost datagrams are not retried, like the collector may
+	 * drop them itself */
+	ssize_t rc = send(spans->fd, spans->buf, spans->buf_len, MSG_DONTWAIT);
+	(void)rc;
+	spans->buf_len   = 0;
+	spans->buf_spans = 0;
+}
+
+static inline void
+od_spans_add(od_spans_t *spans, od_span_tx_t *tx, char *name, int kind,
+             uint64_t id, uint64_t parent, uint64_t start, uint64_t end,
+             char *attributes)
+{
+	char trace_id[33];
+	char span_id[17];
+	char parent_id[17];
+	od_spans_hex(trace_id, tx->trace.trace_id, 16);
+	uint8_t bytes[8];
+	int i;
+	for (i = 0; i < 8; i++)
+		bytes[i] = id >> (56 - i * 8);
+	od_spans_hex(span_id, bytes, 8);
+	if (parent) {
+		for (i = 0; i < 8; i++)
+			bytes[i] = parent >> (56 - i * 8);
+		od_spans_hex(parent_id, bytes, 8);
+	} else {
+		od_spans_hex(parent_id, tx->trace.parent_id, 8);
+	}
+	if (end < start)
+		end = start;
+
+	char span[1024];
+	int len;
+	len = od_snprintf(span, sizeof(span),
+	                  "%s{\"traceId\":\"%s\",\"spanId\":\"%s\","
+	                  "\"parentSpanId\":\"%s\",\"name\":\"%s\",\"kind\":%d,"
+	                  "\"startTimeUnixNano\":\"%" PRIu64 "000\","
+	                  "\"endTimeUnixNano\":\"%" PRIu64 "000\""
+	                  "%s}",
+	                  spans->buf_spans ? "," : "",
+	                  trace_id, span_id, parent_id, name, kind,
+	                  start + spans->clock_offset,
+	                  end + spans->clock_offset,
+	                  attributes);
+	int room = OD_SPAN_DATAGRAM - (int)sizeof(od_spans_suffix);
+	if (spans->buf_spans && spans->buf_len + len > room) {
+		od_spans_flush(spans);
+		/* first span of a datagram has no separator */
+		memmove(span, span + 1, len);
+		len--;
+	}
+	if (spans->buf_spans == 0) {
+		memcpy(spans->buf, od_spans_prefix, sizeof(od_spans_prefix) - 1);
+		spans->buf_len = sizeof(od_spans_prefix) - 1;
+	}
+	memcpy(spans->buf + spans->buf_len, span, len);
+	spans->buf_len += len;
+	spans->buf_spans++;
+}
+
+static inline void
+od_spans_export(od_spans_t *spans, od_span_tx_t *tx)
+{
+	/* span times are taken from the monotonic clock of workers */
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	spans->clock_offset = (int64_t)(ts.tv_sec * 1000000 + ts.tv_nsec / 1000) -
+	                      (int64_t)machine_time_us();
+
+	char database[OD_SPAN_NAME * 2];
+	char user[OD_SPAN_NAME * 2];
+	od_spans_json_string(database, sizeof(database), tx->database);
+	od_spans_json_string(user, sizeof(user), tx->user);
+	char attributes[512];
+	od_snprintf(attributes, sizeof(attributes),
+	            ",\"attributes\":["
+	            "{\"key\":\"db.system\",\"value\":{\"stringValue\":\"postgresql\"}},"
+	            "{\"key\":\"db.name\",\"value\":{\"stringValue\":\"%s\"}},"
+	            "{\"key\":\"db.user\",\"value\":{\"stringValue\":\"%s\"}},"
+	            "{\"key\":\"odyssey.queries\",\"value\":{\"intValue\":\"%d\"}}]",
+	            database, user, tx->queries);
+
+	uint64_t root = od_spans_id();
+	od_spans_add(spans, tx, "transaction", 2, root, 0,
+	             tx->start, tx->end, attributes);
+	uint64_t query_start = 0;
+	if (tx->attach_end) {
+		od_spans_add(spans, tx, "pool_wait", 1, od_spans_id(), root,
+		             tx->attach_start, tx->attach_end, "");
+		query_start = tx->attach_end;
+	}
+	if (tx->deploy_end && tx->deploy_end > tx->attach_end) {
+		od_spans_add(spans, tx, "deploy", 1, od_spans_id(), root,
+		             tx->attach_end, tx->deploy_end, "");
+		query_start = tx->deploy_end;
+	}
+
+	int count = tx->queries;
+	if (count > OD_SPAN_QUERIES)
+		count = OD_SPAN_QUERIES;
+	int i;
+	for (i = 0; i < count; i++) {
+		od_span_query_t *query = &tx->query[i];
+		if (query->end == 0)
+			continue;
+		/* the server runs deploy first */
+		uint64_t start = query->start;
+		if (start < query_start)
+			start = query_start;
+		uint64_t response = query->response ? query->response : query->end;
+		od_spans_add(spans, tx, "execute", 3, od_spans_id(), root,
+		             start, response, "");
+		if (query->response)
+			od_spans_add(spans, tx, "transfer", 1, od_spans_id(), root,
+			             query->response, query->end, "");
+	}
+}
+
+static inline void
+od_spans_report(od_spans_t *spans)
+{
+	od_instance_t *instance = spans->global->instance;
+	uint64_t dropped = od_atomic_u64_of(&spans->dropped);
+	if (dropped == spans->dropped_reported)
+		return;
+	od_error(&instance->logger, "spans", NULL, NULL,
+	         "span queue is full, %" PRIu64 " transactions dropped",
+	         dropped - spans->dropped_reported);
+	spans->dropped_reported = dropped;
+}
+
+static void
+od_spans_exporter(void *arg)
+{
+	od_spans_t *spans = arg;
+	uint64_t flush_time = 0;
+	for (;;) {
+		/* spans wait for a full datagram at most the flush interval */
+		uint32_t timeout = UINT32_MAX;
+		if (spans->buf_spans) {
+			uint64_t now = machine_time_ms();
+			timeout = 0;
+			if (flush_time > now)
+				timeout = flush_time - now;
+		}
+		machine_msg_t *msg;
+		msg = machine_channel_read(spans->channel, timeout);
+		if (msg == NULL) {
+			od_spans_flush(spans);
+			od_spans_report(spans);
+			continue;
+		}
+		od_atomic_u64_dec(&spans->queued);
+		if (spans->buf_spans == 0)
+			flush_time = machine_time_ms() + OD_SPAN_FLUSH_INTERVAL;
+		od_spans_export(spans, machine_msg_data(msg));
+		machine_msg_free(msg);
+	}
+}
+
+int
+od_spans_start(od_global_t *global)
+{
+	od_instance_t *instance = global->instance;
+	od_system_t *system = global->system;
+	od_spans_t *spans = &system->spans;
+	spans->global = global;
+	if (instance->config.span_port == 0)
+		return 0;
+
+	char *host = instance->config.span_host;
+	if (host == NULL)
+		host = "127.0.0.1";
+	char port[16];
+	od_snprintf(port, sizeof(port), "%d", instance->config.span_port);
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_DGRAM;
+	struct addrinfo *ai = NULL;
+	int rc;
+	rc = machine_getaddrinfo(host, port, &hints, &ai, UINT32_MAX);
+	if (rc != 0) {
+		od_error(&instance->logger, "spans", NULL, NULL,
+		         "failed to resolve %s:%s", host, port);
+		return -1;
+	}
+	spans->fd = socket(ai->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (spans->fd == -1) {
+		freeaddrinfo(ai);
+		od_error(&instance->logger, "spans", NULL, NULL,
+		         "failed to create socket: %s", strerror(errno));
+		return -1;
+	}
+	/* connected socket only sends to the collector */
+	rc = connect(spans->fd, ai->ai_addr, ai->ai_addrlen);
+	freeaddrinfo(ai);
+	if (rc == -1) {
+		od_error(&instance->logger, "spans", NULL, NULL,
+		         "failed to connect to %s:%s: %s", host, port,
+		         strerror(errno));
+		goto error;
+	}
+
+	spans->buf = malloc(OD_SPAN_DATAGRAM);
+	if (spans->buf == NULL)
+		goto error;
+	spans->channel = machine_channel_create(1);
+	if (spans->channel == NULL) {
+		od_error(&instance->logger, "spans", NULL, NULL,
+		         "failed to create spans channel");
+		goto error;
+	}
+	spans->machine = machine_create("spans", od_spans_exporter, spans);
+	if (spans->machine == -1) {
+		od_error(&instance->logger, "spans", NULL, NULL,
+		         "failed to start spans machine");
+		machine_channel_free(spans->channel);
+		spans->channel = NULL;
+		goto error;
+	}
+	od_log(&instance->logger, "spans", NULL, NULL,
+	       "exporting spans to %s:%s", host, port);
+	return 0;
+
+error:
+	if (spans->buf) {
+		free(spans->buf);
+		spans->buf = NULL;
+	}
+	close(spans->fd);
+	spans->fd = -1;
+	return -1;
+}
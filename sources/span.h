@@ -0,0 +1,170 @@
+#ifndef ODYSSEY_SPAN_H
+#define ODYSSEY_SPAN_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_span_trace od_span_trace_t;
+typedef struct od_span_query od_span_query_t;
+typedef struct od_span_tx    od_span_tx_t;
+typedef struct od_spans      od_spans_t;
+
+/* Transactions of sampled traces are exported as spans.
+ *
+ * Trace context is a W3C traceparent found in the client
+ * variable named by span_parameter, it is looked up once a
+ * transaction starts, so both a startup option and SET inside
+ * a session work. The client records times of the transaction
+ * into a message, which is queued to the spans machine once the
+ * transaction is finished. The machine renders spans in OTLP
+ * JSON and sends them in UDP datagrams, workers do no I/O. */
+
+/* queries of a transaction recorded as spans, the rest is counted */
+#define OD_SPAN_QUERIES 8
+
+#define OD_SPAN_NAME 64
+
+/* datagram size and how long spans may wait for a full datagram */
+#define OD_SPAN_DATAGRAM       8192
+#define OD_SPAN_FLUSH_INTERVAL 100
+
+struct od_span_trace
+{
+	uint8_t trace_id[16];
+	uint8_t parent_id[8];
+};
+
+struct od_span_query
+{
+	uint64_t start;
+	uint64_t response;
+	uint64_t end;
+};
+
+struct od_span_tx
+{
+	od_span_trace_t trace;
+	uint64_t        start;
+	uint64_t        end;
+	uint64_t        attach_start;
+	uint64_t        attach_end;
+	uint64_t        deploy_end;
+	int             queries;
+	int             query_open;
+	od_span_query_t query[OD_SPAN_QUERIES];
+	char            database[OD_SPAN_NAME];
+	char            user[OD_SPAN_NAME];
+};
+
+struct od_spans
+{
+	int64_t            machine;
+	machine_channel_t *channel;
+	od_atomic_u64_t    queued;
+	od_atomic_u64_t    dropped;
+	uint64_t           dropped_reported;
+	int                fd;
+	char              *buf;
+	int                buf_len;
+	int                buf_spans;
+	int64_t            clock_offset;
+	od_global_t       *global;
+};
+
+static inline void
+od_spans_init(od_spans_t *spans)
+{
+	spans->machine          = -1;
+	spans->channel          = NULL;
+	spans->queued           = 0;
+	spans->dropped          = 0;
+	spans->dropped_reported = 0;
+	spans->fd               = -1;
+	spans->buf              = NULL;
+	spans->buf_len          = 0;
+	spans->buf_spans        = 0;
+	spans->clock_offset     = 0;
+	spans->global           = NULL;
+}
+
+int  od_spans_start(od_global_t*);
+int  od_span_trace_parse(char*, int, od_span_trace_t*);
+void od_span_begin(od_client_t*, uint64_t);
+void od_span_end(od_client_t*, uint64_t);
+
+static inline od_span_tx_t*
+od_span_of(od_client_t *client)
+{
+	if (client->span == NULL)
+		return NULL;
+	return machine_msg_data(client->span);
+}
+
+static inline void
+od_span_attach(od_client_t *client, uint64_t start, uint64_t end)
+{
+	od_span_tx_t *tx = od_span_of(client);
+	if (tx == NULL)
+		return;
+	tx->attach_start = start;
+	tx->attach_end   = end;
+}
+
+static inline void
+od_span_deploy(od_client_t *client)
+{
+	od_span_tx_t *tx = od_span_of(client);
+	if (tx == NULL)
+		return;
+	tx->deploy_end = machine_time_us();
+}
+
+static inline void
+od_span_query_start(od_client_t *client)
+{
+	/* transaction of session pool starts with its first query,
+	 * or it starts with attach */
+	if (client->span == NULL && !client->span_skip)
+		od_span_begin(client, machine_time_us());
+	od_span_tx_t *tx = od_span_of(client);
+	if (tx == NULL || tx->query_open)
+		return;
+	tx->query_open = 1;
+	if (tx->queries < OD_SPAN_QUERIES) {
+		od_span_query_t *query = &tx->query[tx->queries];
+		query->start    = machine_time_us();
+		query->response = 0;
+		query->end      = 0;
+	}
+	tx->queries++;
+}
+
+static inline void
+od_span_query_response(od_client_t *client)
+{
+	od_span_tx_t *tx = od_span_of(client);
+	if (tx == NULL || !tx->query_open || tx->queries > OD_SPAN_QUERIES)
+		return;
+	od_span_query_t *query = &tx->query[tx->queries - 1];
+	if (query->response == 0)
+		query->response = machine_time_us();
+}
+
+static inline void
+od_span_query_end(od_client_t *client, int transaction_end)
+{
+	uint64_t now = machine_time_us();
+	od_span_tx_t *tx = od_span_of(client);
+	if (tx && tx->query_open) {
+		tx->query_open = 0;
+		if (tx->queries <= OD_SPAN_QUERIES)
+			tx->query[tx->queries - 1].end = now;
+	}
+	if (transaction_end)
+		od_span_end(client, now);
+}
+
+#endif /* ODYSSEY_SPAN_H */
@@ -0,0 +1,215 @@
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+/* O_TMPFILE */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+static inline od_spool_chunk_t*
+od_spool_chunk_allocate(od_spool_t *spool)
+{
+	od_spool_chunk_t *chunk;
+	chunk = malloc(sizeof(od_spool_chunk_t) + OD_SPOOL_CHUNK);
+	if (chunk == NULL)
+		return NULL;
+	chunk->start = 0;
+	chunk->end   = 0;
+	od_list_init(&chunk->link);
+	od_list_append(&spool->chunks, &chunk->link);
+	spool->memory += OD_SPOOL_CHUNK;
+	return chunk;
+}
+
+static inline void
+od_spool_chunk_free(od_spool_t *spool, od_spool_chunk_t *chunk)
+{
+	od_list_unlink(&chunk->link);
+	spool->memory -= OD_SPOOL_CHUNK;
+	free(chunk);
+}
+
+void
+od_spool_free(od_spool_t *spool)
+{
+	od_list_t *i, *n;
+	od_list_foreach_safe(&spool->chunks, i, n) {
+		od_spool_chunk_t *chunk;
+		chunk = od_container_of(i, od_spool_chunk_t, link);
+		od_spool_chunk_free(spool, chunk);
+	}
+	if (spool->fd != -1)
+		close(spool->fd);
+	if (spool->stage)
+		free(spool->stage);
+	od_spool_init(spool);
+}
+
+static inline int
+od_spool_open(od_spool_t *spool)
+{
+	char *dir = spool->dir;
+	if (dir == NULL)
+		dir = "/tmp";
+	int fd = -1;
+#ifdef O_TMPFILE
+	fd = open(dir, O_TMPFILE | O_RDWR, 0600);
+#endif
+	if (fd == -1) {
+		/* filesystem without O_TMPFILE */
+		char path[PATH_MAX];
+		od_snprintf(path, sizeof(path), "%s/odyssey.spool.XXXXXX", dir);
+		fd = mkstemp(path);
+		if (fd == -1)
+			return -1;
+		unlink(path);
+	}
+	spool->stage = malloc(OD_SPOOL_CHUNK);
+	if (spool->stage == NULL) {
+		close(fd);
+		return -1;
+	}
+	spool->fd = fd;
+	return 0;
+}
+
+static inline int
+od_spool_tail(od_spool_t *spool, od_spool_chunk_t **chunk)
+{
+	/* memory is used while the file has no data */
+	*chunk = NULL;
+	if (spool->file_read < spool->file_write)
+		return 0;
+	if (! od_list_empty(&spool->chunks)) {
+		od_spool_chunk_t *tail;
+		tail = od_container_of(spool->chunks.prev, od_spool_chunk_t, link);
+		if (tail->end < OD_SPOOL_CHUNK) {
+			*chunk = tail;
+			return 0;
+		}
+	}
+	if (spool->memory + OD_SPOOL_CHUNK > spool->memory_max)
+		return 0;
+	*chunk = od_spool_chunk_allocate(spool);
+	if (*chunk == NULL)
+		return -1;
+	return 0;
+}
+
+int
+od_spool_move(od_spool_t *spool, machine_iov_t *iov)
+{
+	while (machine_iov_pending(iov))
+	{
+		od_spool_chunk_t *chunk;
+		int rc;
+		rc = od_spool_tail(spool, &chunk);
+		if (rc == -1)
+			return -1;
+		if (chunk) {
+			rc = machine_iov_read(iov, chunk->data + chunk->end,
+			                      OD_SPOOL_CHUNK - chunk->end);
+			chunk->end += rc;
+		} else {
+			if (spool->fd == -1 && od_spool_open(spool) == -1)
+				return -1;
+			rc = machine_iov_read(iov, spool->stage, OD_SPOOL_CHUNK);
+			int pos = 0;
+			while (pos < rc) {
+				ssize_t written;
+				written = pwrite(spool->fd, spool->stage + pos, rc - pos,
+				                 spool->file_write + pos);
+				if (written == -1) {
+					if (errno == EINTR)
+						continue;
+					return -1;
+				}
+				pos += written;
+			}
+			spool->file_write += rc;
+		}
+		spool->size  += rc;
+		spool->total += rc;
+	}
+	return 0;
+}
+
+static inline int
+od_spool_load(od_spool_t *spool)
+{
+	/* memory chunks are drained, the file is read back */
+	od_spool_chunk_t *chunk;
+	chunk = od_spool_chunk_allocate(spool);
+	if (chunk == NULL)
+		return -1;
+	uint64_t left = spool->file_write - spool->file_read;
+	int size = OD_SPOOL_CHUNK;
+	if (left < (uint64_t)size)
+		size = left;
+	while (chunk->end < size) {
+		ssize_t rc;
+		rc = pread(spool->fd, chunk->data + chunk->end, size - chunk->end,
+		           spool->file_read + chunk->end);
+		if (rc == -1 && errno == EINTR)
+			continue;
+		if (rc <= 0)
+			return -1;
+		chunk->end += rc;
+	}
+	spool->file_read += size;
+	if (spool->file_read == spool->file_write) {
+		spool->file_read  = 0;
+		spool->file_write = 0;
+		if (ftruncate(spool->fd, 0) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+int
+od_spool_write(od_spool_t *spool, machine_io_t *io)
+{
+	/* write until the destination would block */
+	while (spool->size > 0)
+	{
+		if (od_list_empty(&spool->chunks) && od_spool_load(spool) == -1)
+			return -1;
+		od_spool_chunk_t *chunk;
+		chunk = od_container_of(spool->chunks.next, od_spool_chunk_t, link);
+		int size = chunk->end - chunk->start;
+		int rc;
+		rc = machine_write_raw(io, chunk->data + chunk->start, size);
+		if (rc < 0) {
+			int errno_ = machine_errno();
+			if (errno_ == EAGAIN || errno_ == EWOULDBLOCK || errno_ == EINTR)
+				return 0;
+			return -1;
+		}
+		chunk->start += rc;
+		spool->size  -= rc;
+		if (rc < size)
+			return 0;
+		od_spool_chunk_free(spool, chunk);
+	}
+	return 0;
+}
@@ -0,0 +1,75 @@
+#ifndef ODYSSEY_SPOOL_H
+#define ODYSSEY_SPOOL_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_spool_chunk od_spool_chunk_t;
+typedef struct od_spool       od_spool_t;
+
+/* Spool of a client, enabled by relay_spool.
+ *
+ * When a client does not keep up with a result, the rest of it is
+ * moved from the server relay into the spool, so the server is read
+ * at full speed and released on ReadyForQuery. The client is then
+ * written from the spool.
+ *
+ * Data is kept in memory chunks up to memory_max, the rest is
+ * appended to an unlinked temporary file in dir. While the file
+ * has data, everything spooled goes to the file, so the order is
+ * kept, chunks are written first and the file is read back once
+ * they are drained. */
+
+#define OD_SPOOL_CHUNK 65536
+
+struct od_spool_chunk
+{
+	int       start;
+	int       end;
+	od_list_t link;
+	char      data[];
+};
+
+struct od_spool
+{
+	od_list_t  chunks;
+	int        memory;
+	int        memory_max;
+	char      *dir;
+	int        fd;
+	char      *stage;
+	uint64_t   file_read;
+	uint64_t   file_write;
+	uint64_t   size;
+	uint64_t   total;
+};
+
+static inline void
+od_spool_init(od_spool_t *spool)
+{
+	od_list_init(&spool->chunks);
+	spool->memory     = 0;
+	spool->memory_max = 0;
+	spool->dir        = NULL;
+	spool->fd         = -1;
+	spool->stage      = NULL;
+	spool->file_read  = 0;
+	spool->file_write = 0;
+	spool->size       = 0;
+	spool->total      = 0;
+}
+
+static inline int
+od_spool_pending(od_spool_t *spool)
+{
+	return spool->size > 0;
+}
+
+void od_spool_free(od_spool_t*);
+int  od_spool_move(od_spool_t*, machine_iov_t*);
+int  od_spool_write(od_spool_t*, machine_io_t*);
+
+#endif /* ODYSSEY_SPOOL_H */
@@ -0,0 +1,118 @@
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <execinfo.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+static inline void*
+od_stall_pointer(machine_coroutine_t function)
+{
+	/* ISO C has no conversion of function to object pointers */
+	union {
+		machine_coroutine_t function;
+		void               *pointer;
+	} address;
+	address.pointer  = NULL;
+	address.function = function;
+	return address.pointer;
+}
+
+static inline od_client_t*
+od_stall_client(machine_stall_t *stall)
+{
+	/* coroutines of clients take the client as argument */
+	machine_coroutine_t function = stall->function;
+	if (function == od_frontend ||
+	    function == od_frontend_resume ||
+	    function == od_frontend_relay ||
+	    function == od_frontend_move)
+		return stall->function_arg;
+	return NULL;
+}
+
+void
+od_stall_function(machine_coroutine_t function, char *name, int name_size)
+{
+	/* kind of the well known coroutines, symbol for the rest */
+	if (function == od_frontend ||
+	    function == od_frontend_resume ||
+	    function == od_frontend_relay ||
+	    function == od_frontend_move) {
+		od_snprintf(name, name_size, "frontend");
+		return;
+	}
+	if (function == od_cron) {
+		od_snprintf(name, name_size, "cron");
+		return;
+	}
+	if (function == od_system_server) {
+		od_snprintf(name, name_size, "server");
+		return;
+	}
+	void *pointer = od_stall_pointer(function);
+	od_snprintf(name, name_size, "%p", pointer);
+	if (function == NULL)
+		return;
+	char **symbol = backtrace_symbols(&pointer, 1);
+	if (symbol) {
+		od_snprintf(name, name_size, "%s", symbol[0]);
+		free(symbol);
+	}
+}
+
+void
+od_stall_report(machine_stall_t *stall, void *arg)
+{
+	/* called on the watchdog thread, client is read without
+	 * locks while its coroutine is still stalled */
+	od_instance_t *instance = arg;
+	od_client_t *client = od_stall_client(stall);
+	od_server_t *server = NULL;
+	if (client)
+		server = client->server;
+
+	char function[128] = "loop";
+	if (stall->function) {
+		void *pointer = od_stall_pointer(stall->function);
+		char **symbol = backtrace_symbols(&pointer, 1);
+		if (symbol) {
+			od_snprintf(function, sizeof(function), "%s", symbol[0]);
+			free(symbol);
+		}
+	}
+	od_error(&instance->logger, "watchdog", client, server,
+	         "%s loop stalled for %" PRIu64 " ms, coroutine %" PRIu64 " (%s)",
+	         stall->machine_name, stall->duration_us / 1000,
+	         stall->coroutine_id, function);
+
+	if (stall->frames_count == 0) {
+		od_error(&instance->logger, "watchdog", client, server,
+		         "backtrace is not available");
+		return;
+	}
+	char **symbols;
+	symbols = backtrace_symbols(stall->frames, stall->frames_count);
+	int i;
+	for (i = 0; i < stall->frames_count; i++) {
+		if (symbols)
+			od_error(&instance->logger, "watchdog", client, server,
+			         "#%d %s", i, symbols[i]);
+		else
+			od_error(&instance->logger, "watchdog", client, server,
+			         "#%d %p", i, stall->frames[i]);
+	}
+	free(symbols);
+}
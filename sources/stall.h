@@ -0,0 +1,13 @@
+#ifndef ODYSSEY_STALL_H
+#define ODYSSEY_STALL_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+void od_stall_function(machine_coroutine_t, char*, int);
+void od_stall_report(machine_stall_t*, void*);
+
+#endif /* ODYSSEY_STALL_H */
@@ -10,12 +10,49 @@
 */
 
 typedef struct od_stat_state od_stat_state_t;
+typedef struct od_stat_query od_stat_query_t;
 typedef struct od_stat       od_stat_t;
+typedef struct od_stat_slot  od_stat_slot_t;
+typedef struct od_stat_rates od_stat_rates_t;
+
+#define OD_STAT_CACHELINE 64
+
+/* query kind, classified by the first client message of a
+ * query, COPY is recognized by the server reply */
+typedef enum
+{
+	OD_STAT_QUERY_SIMPLE,
+	OD_STAT_QUERY_EXTENDED,
+	OD_STAT_QUERY_COPY,
+	OD_STAT_QUERY_FUNCTION,
+	OD_STAT_QUERY_MAX
+} od_stat_query_type_t;
+
+/* query time is split into the wait for a server connection,
+ * time on the server and time the replies waited for the client
+ * to read them */
+typedef enum
+{
+	OD_STAT_PHASE_WAIT,
+	OD_STAT_PHASE_SERVER,
+	OD_STAT_PHASE_CLIENT,
+	OD_STAT_PHASE_MAX
+} od_stat_phase_t;
 
 struct od_stat_state
 {
-	uint64_t query_time_start;
-	uint64_t tx_time_start;
+	uint64_t             query_time_start;
+	uint64_t             tx_time_start;
+	od_stat_query_type_t query_type;
+	uint64_t             wait_time;
+	uint64_t             client_time_start;
+};
+
+struct od_stat_query
+{
+	od_atomic_u64_t count;
+	od_atomic_u64_t time[OD_STAT_PHASE_MAX];
+	od_hgram_t     *hgram[OD_STAT_PHASE_MAX];
 };
 
 struct od_stat
@@ -26,8 +63,63 @@ struct od_stat
 	od_atomic_u64_t tx_time;
 	od_atomic_u64_t recv_server;
 	od_atomic_u64_t recv_client;
+	od_atomic_u64_t count_wait;
+	od_atomic_u64_t wait_time;
+	od_atomic_u64_t count_wait_timeout;
+	od_atomic_u64_t count_wait_routing;
+	od_atomic_u64_t cpu_time;
+	od_atomic_u64_t cpu_wait;
+	od_atomic_u64_t count_switch;
 	od_hgram_t     *transaction_hgram;
 	od_hgram_t     *query_hgram;
+	od_hgram_t     *wait_hgram;
+	od_stat_query_t type[OD_STAT_QUERY_MAX];
+};
+
+/* counters of which decaying rates are kept, times are
+ * divided by the matching count to get average latency */
+typedef enum
+{
+	OD_STAT_RATE_QUERY,
+	OD_STAT_RATE_QUERY_TIME,
+	OD_STAT_RATE_TX,
+	OD_STAT_RATE_TX_TIME,
+	OD_STAT_RATE_WAIT,
+	OD_STAT_RATE_WAIT_TIME,
+	OD_STAT_RATE_RECV_CLIENT,
+	OD_STAT_RATE_RECV_SERVER,
+	OD_STAT_RATE_MAX
+} od_stat_rate_t;
+
+typedef enum
+{
+	OD_STAT_WINDOW_1S,
+	OD_STAT_WINDOW_10S,
+	OD_STAT_WINDOW_1M,
+	OD_STAT_WINDOW_5M,
+	OD_STAT_WINDOW_MAX
+} od_stat_window_t;
+
+/* Per second rates of route counters, updated by cron every
+ * second as exponential moving averages with the mean age of
+ * the window, like load average. Windows shorter than two cron
+ * intervals hold the last interval. */
+struct od_stat_rates
+{
+	uint64_t time_us;
+	uint64_t prev[OD_STAT_RATE_MAX];
+	double   rate[OD_STAT_WINDOW_MAX][OD_STAT_RATE_MAX];
+};
+
+#define od_stat_hgram_of(stat, offset) \
+	(*(od_hgram_t**)((char*)(stat) + (offset)))
+
+/* route stats updated by a single worker, slots of different
+ * workers never share a cache line */
+struct od_stat_slot
+{
+	od_stat_t stat;
+	uint8_t   pad[OD_STAT_CACHELINE - sizeof(od_stat_t) % OD_STAT_CACHELINE];
 };
 
 static inline void
@@ -42,19 +134,81 @@ od_stat_init(od_stat_t *stat)
 	memset(stat, 0, sizeof(*stat));
 }
 
+static inline int
+od_stat_hgram_prepare(od_stat_t *stat, int precision)
+{
+	stat->transaction_hgram = od_hgram_allocate(precision);
+	if (stat->transaction_hgram == NULL)
+		return -1;
+	stat->query_hgram = od_hgram_allocate(precision);
+	if (stat->query_hgram == NULL)
+		return -1;
+	stat->wait_hgram = od_hgram_allocate(precision);
+	if (stat->wait_hgram == NULL)
+		return -1;
+	int i, j;
+	for (i = 0; i < OD_STAT_QUERY_MAX; i++) {
+		for (j = 0; j < OD_STAT_PHASE_MAX; j++) {
+			stat->type[i].hgram[j] = od_hgram_allocate(precision);
+			if (stat->type[i].hgram[j] == NULL)
+				return -1;
+		}
+	}
+	return 0;
+}
+
 static inline void
-od_stat_query_start(od_stat_state_t *state)
+od_stat_free(od_stat_t *stat)
 {
-	if (! state->query_time_start)
+	if (stat->transaction_hgram)
+		od_hgram_free(stat->transaction_hgram);
+	if (stat->query_hgram)
+		od_hgram_free(stat->query_hgram);
+	if (stat->wait_hgram)
+		od_hgram_free(stat->wait_hgram);
+	int i, j;
+	for (i = 0; i < OD_STAT_QUERY_MAX; i++) {
+		for (j = 0; j < OD_STAT_PHASE_MAX; j++) {
+			if (stat->type[i].hgram[j])
+				od_hgram_free(stat->type[i].hgram[j]);
+		}
+	}
+}
+
+static inline void
+od_stat_add(od_atomic_u64_t *counter, uint64_t value)
+{
+	/* counter has a single writer, readers only load it */
+	*counter += value;
+}
+
+static inline void
+od_stat_query_start(od_stat_state_t *state, od_stat_query_type_t type,
+                    uint64_t client_time)
+{
+	if (! state->query_time_start) {
 		state->query_time_start = machine_time_us();
+		state->query_type = type;
+		state->client_time_start = client_time;
+	}
 
 	if (! state->tx_time_start)
 		state->tx_time_start = machine_time_us();
 }
 
+static inline void
+od_stat_query_phase(od_stat_query_t *query, od_stat_phase_t phase,
+                    uint64_t time_us)
+{
+	od_stat_add(&query->time[phase], time_us);
+	if (query->hgram[phase])
+		od_hgram_add_data_point(query->hgram[phase], time_us);
+}
+
 static inline void
 od_stat_query_end(od_stat_t *stat, od_stat_state_t *state,
                   int in_transaction,
+                  uint64_t client_time,
                   int64_t *query_time)
 {
 	int64_t diff;
@@ -62,12 +216,23 @@ od_stat_query_end(od_stat_t *stat, od_stat_state_t *state,
 		diff = machine_time_us() - state->query_time_start;
 		if (diff > 0) {
 			*query_time = diff;
-			od_atomic_u64_add(&stat->query_time, diff);
-			od_atomic_u64_inc(&stat->count_query);
+			od_stat_add(&stat->query_time, diff);
+			od_stat_add(&stat->count_query, 1);
 			if (stat->query_hgram)
 			    od_hgram_add_data_point(stat->query_hgram, diff);
+
+			/* time replies were blocked on the client socket */
+			client_time -= state->client_time_start;
+			if (client_time > (uint64_t)diff)
+				client_time = diff;
+			od_stat_query_t *query = &stat->type[state->query_type];
+			od_stat_add(&query->count, 1);
+			od_stat_query_phase(query, OD_STAT_PHASE_WAIT, state->wait_time);
+			od_stat_query_phase(query, OD_STAT_PHASE_SERVER, diff - client_time);
+			od_stat_query_phase(query, OD_STAT_PHASE_CLIENT, client_time);
 		}
 		state->query_time_start = 0;
+		state->wait_time = 0;
 	}
 
 	if (in_transaction)
@@ -76,8 +241,8 @@ od_stat_query_end(od_stat_t *stat, od_stat_state_t *state,
 	if (state->tx_time_start) {
 		diff = machine_time_us() - state->tx_time_start;
 		if (diff > 0) {
-			od_atomic_u64_add(&stat->tx_time, diff);
-			od_atomic_u64_inc(&stat->count_tx);
+			od_stat_add(&stat->tx_time, diff);
+			od_stat_add(&stat->count_tx, 1);
 			if (stat->transaction_hgram)
 				od_hgram_add_data_point(stat->transaction_hgram, diff);
 		}
@@ -88,13 +253,43 @@ od_stat_query_end(od_stat_t *stat, od_stat_state_t *state,
 static inline void
 od_stat_recv_server(od_stat_t *stat, uint64_t bytes)
 {
-	od_atomic_u64_add(&stat->recv_server, bytes);
+	od_stat_add(&stat->recv_server, bytes);
 }
 
 static inline void
 od_stat_recv_client(od_stat_t *stat, uint64_t bytes)
 {
-	od_atomic_u64_add(&stat->recv_client, bytes);
+	od_stat_add(&stat->recv_client, bytes);
+}
+
+static inline void
+od_stat_wait(od_stat_t *stat, uint64_t time_us)
+{
+	od_stat_add(&stat->count_wait, 1);
+	od_stat_add(&stat->wait_time, time_us);
+	if (stat->wait_hgram)
+		od_hgram_add_data_point(stat->wait_hgram, time_us);
+}
+
+static inline void
+od_stat_wait_timeout(od_stat_t *stat)
+{
+	od_stat_add(&stat->count_wait_timeout, 1);
+}
+
+static inline void
+od_stat_wait_routing(od_stat_t *stat)
+{
+	od_stat_add(&stat->count_wait_routing, 1);
+}
+
+static inline void
+od_stat_cpu(od_stat_t *stat, uint64_t time_us, uint64_t wait_us,
+            uint64_t count_switch)
+{
+	od_stat_add(&stat->cpu_time, time_us);
+	od_stat_add(&stat->cpu_wait, wait_us);
+	od_stat_add(&stat->count_switch, count_switch);
 }
 
 static inline void
@@ -106,6 +301,19 @@ od_stat_copy(od_stat_t *dst, od_stat_t *src)
 	dst->tx_time     = od_atomic_u64_of(&src->tx_time);
 	dst->recv_client = od_atomic_u64_of(&src->recv_client);
 	dst->recv_server = od_atomic_u64_of(&src->recv_server);
+	dst->count_wait  = od_atomic_u64_of(&src->count_wait);
+	dst->wait_time   = od_atomic_u64_of(&src->wait_time);
+	dst->count_wait_timeout = od_atomic_u64_of(&src->count_wait_timeout);
+	dst->count_wait_routing = od_atomic_u64_of(&src->count_wait_routing);
+	dst->cpu_time     = od_atomic_u64_of(&src->cpu_time);
+	dst->cpu_wait     = od_atomic_u64_of(&src->cpu_wait);
+	dst->count_switch = od_atomic_u64_of(&src->count_switch);
+	int i, j;
+	for (i = 0; i < OD_STAT_QUERY_MAX; i++) {
+		dst->type[i].count = od_atomic_u64_of(&src->type[i].count);
+		for (j = 0; j < OD_STAT_PHASE_MAX; j++)
+			dst->type[i].time[j] = od_atomic_u64_of(&src->type[i].time[j]);
+	}
 }
 
 static inline void
@@ -117,6 +325,19 @@ od_stat_sum(od_stat_t *sum, od_stat_t *stat)
 	sum->tx_time     += od_atomic_u64_of(&stat->tx_time);
 	sum->recv_client += od_atomic_u64_of(&stat->recv_client);
 	sum->recv_server += od_atomic_u64_of(&stat->recv_server);
+	sum->count_wait  += od_atomic_u64_of(&stat->count_wait);
+	sum->wait_time   += od_atomic_u64_of(&stat->wait_time);
+	sum->count_wait_timeout += od_atomic_u64_of(&stat->count_wait_timeout);
+	sum->count_wait_routing += od_atomic_u64_of(&stat->count_wait_routing);
+	sum->cpu_time     += od_atomic_u64_of(&stat->cpu_time);
+	sum->cpu_wait     += od_atomic_u64_of(&stat->cpu_wait);
+	sum->count_switch += od_atomic_u64_of(&stat->count_switch);
+	int i, j;
+	for (i = 0; i < OD_STAT_QUERY_MAX; i++) {
+		sum->type[i].count += od_atomic_u64_of(&stat->type[i].count);
+		for (j = 0; j < OD_STAT_PHASE_MAX; j++)
+			sum->type[i].time[j] += od_atomic_u64_of(&stat->type[i].time[j]);
+	}
 }
 
 static inline void
@@ -138,6 +359,19 @@ od_stat_update(od_stat_t *dst, od_stat_t *stat)
 	od_stat_update_of(&dst->tx_time, &stat->tx_time);
 	od_stat_update_of(&dst->recv_client, &stat->recv_client);
 	od_stat_update_of(&dst->recv_server, &stat->recv_server);
+	od_stat_update_of(&dst->count_wait, &stat->count_wait);
+	od_stat_update_of(&dst->wait_time, &stat->wait_time);
+	od_stat_update_of(&dst->count_wait_timeout, &stat->count_wait_timeout);
+	od_stat_update_of(&dst->count_wait_routing, &stat->count_wait_routing);
+	od_stat_update_of(&dst->cpu_time, &stat->cpu_time);
+	od_stat_update_of(&dst->cpu_wait, &stat->cpu_wait);
+	od_stat_update_of(&dst->count_switch, &stat->count_switch);
+	int i, j;
+	for (i = 0; i < OD_STAT_QUERY_MAX; i++) {
+		od_stat_update_of(&dst->type[i].count, &stat->type[i].count);
+		for (j = 0; j < OD_STAT_PHASE_MAX; j++)
+			od_stat_update_of(&dst->type[i].time[j], &stat->type[i].time[j]);
+	}
 }
 
 static inline void
@@ -178,6 +412,145 @@ od_stat_average(od_stat_t *avg, od_stat_t *current, od_stat_t *prev,
 	avg->recv_server =
 		((od_atomic_u64_of(&current->recv_server) -
 		  od_atomic_u64_of(&prev->recv_server)) * interval_usec) / interval_us;
+
+	uint64_t count_wait;
+	count_wait  = od_atomic_u64_of(&current->count_wait) -
+	              od_atomic_u64_of(&prev->count_wait);
+
+	avg->count_wait = (count_wait * interval_usec) / interval_us;
+
+	if (count_wait > 0) {
+		avg->wait_time = (od_atomic_u64_of(&current->wait_time) -
+		                  od_atomic_u64_of(&prev->wait_time)) / count_wait;
+	}
+
+	/* rare events, counted per interval instead of per second */
+	avg->count_wait_timeout = od_atomic_u64_of(&current->count_wait_timeout) -
+	                          od_atomic_u64_of(&prev->count_wait_timeout);
+	avg->count_wait_routing = od_atomic_u64_of(&current->count_wait_routing) -
+	                          od_atomic_u64_of(&prev->count_wait_routing);
+
+	/* coroutine run and wait time in usec per second */
+	avg->cpu_time =
+		((od_atomic_u64_of(&current->cpu_time) -
+		  od_atomic_u64_of(&prev->cpu_time)) * interval_usec) / interval_us;
+	avg->cpu_wait =
+		((od_atomic_u64_of(&current->cpu_wait) -
+		  od_atomic_u64_of(&prev->cpu_wait)) * interval_usec) / interval_us;
+	avg->count_switch =
+		((od_atomic_u64_of(&current->count_switch) -
+		  od_atomic_u64_of(&prev->count_switch)) * interval_usec) / interval_us;
+
+	/* queries/sec and average time of each phase by query type */
+	int i, j;
+	for (i = 0; i < OD_STAT_QUERY_MAX; i++) {
+		uint64_t count;
+		count = od_atomic_u64_of(&current->type[i].count) -
+		        od_atomic_u64_of(&prev->type[i].count);
+		avg->type[i].count = (count * interval_usec) / interval_us;
+		if (count == 0)
+			continue;
+		for (j = 0; j < OD_STAT_PHASE_MAX; j++) {
+			avg->type[i].time[j] =
+				(od_atomic_u64_of(&current->type[i].time[j]) -
+				 od_atomic_u64_of(&prev->type[i].time[j])) / count;
+		}
+	}
+}
+
+static inline int
+od_stat_window_seconds(od_stat_window_t window)
+{
+	static const int seconds[OD_STAT_WINDOW_MAX] = { 1, 10, 60, 300 };
+	return seconds[window];
+}
+
+static inline char*
+od_stat_window_name(od_stat_window_t window)
+{
+	switch (window) {
+	case OD_STAT_WINDOW_1S:  return "1s";
+	case OD_STAT_WINDOW_10S: return "10s";
+	case OD_STAT_WINDOW_1M:  return "1m";
+	case OD_STAT_WINDOW_5M:  return "5m";
+	default: break;
+	}
+	return "unknown";
+}
+
+static inline void
+od_stat_rates_init(od_stat_rates_t *rates)
+{
+	memset(rates, 0, sizeof(*rates));
+}
+
+static inline void
+od_stat_rates_update(od_stat_rates_t *rates, od_stat_t *current,
+                     uint64_t time_us)
+{
+	uint64_t values[OD_STAT_RATE_MAX] = {
+		[OD_STAT_RATE_QUERY]       = current->count_query,
+		[OD_STAT_RATE_QUERY_TIME]  = current->query_time,
+		[OD_STAT_RATE_TX]          = current->count_tx,
+		[OD_STAT_RATE_TX_TIME]     = current->tx_time,
+		[OD_STAT_RATE_WAIT]        = current->count_wait,
+		[OD_STAT_RATE_WAIT_TIME]   = current->wait_time,
+		[OD_STAT_RATE_RECV_CLIENT] = current->recv_client,
+		[OD_STAT_RATE_RECV_SERVER] = current->recv_server
+	};
+	int i, j;
+	if (rates->time_us && time_us > rates->time_us) {
+		double interval = (time_us - rates->time_us) / 1000000.0;
+		for (i = 0; i < OD_STAT_WINDOW_MAX; i++) {
+			/* weight of the interval for the mean age of the window */
+			double window = od_stat_window_seconds(i);
+			double alpha = 1.0;
+			if (interval * 2 < window)
+				alpha = interval / (window + interval);
+			for (j = 0; j < OD_STAT_RATE_MAX; j++) {
+				double rate = (values[j] - rates->prev[j]) / interval;
+				rates->rate[i][j] += alpha * (rate - rates->rate[i][j]);
+			}
+		}
+	}
+	memcpy(rates->prev, values, sizeof(values));
+	rates->time_us = time_us;
+}
+
+static inline double
+od_stat_rates_avg(od_stat_rates_t *rates, od_stat_window_t window,
+                  od_stat_rate_t time, od_stat_rate_t count)
+{
+	/* average latency of the window in usec */
+	double rate = rates->rate[window][count];
+	if (rate <= 0)
+		return 0;
+	return rates->rate[window][time] / rate;
+}
+
+static inline char*
+od_stat_query_type_name(od_stat_query_type_t type)
+{
+	switch (type) {
+	case OD_STAT_QUERY_SIMPLE:   return "simple";
+	case OD_STAT_QUERY_EXTENDED: return "extended";
+	case OD_STAT_QUERY_COPY:     return "copy";
+	case OD_STAT_QUERY_FUNCTION: return "function";
+	default: break;
+	}
+	return "unknown";
+}
+
+static inline char*
+od_stat_phase_name(od_stat_phase_t phase)
+{
+	switch (phase) {
+	case OD_STAT_PHASE_WAIT:   return "wait";
+	case OD_STAT_PHASE_SERVER: return "server";
+	case OD_STAT_PHASE_CLIENT: return "client";
+	default: break;
+	}
+	return "unknown";
 }
 
 #endif /* ODYSSEY_STAT_H */
@@ -0,0 +1,188 @@
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+void
+od_stats_shm_init(od_stats_shm_t *shm)
+{
+	memset(shm, 0, sizeof(*shm));
+}
+
+int
+od_stats_shm_open(od_stats_shm_t *shm, char *path, int workers, int routes)
+{
+	size_t size = sizeof(od_stats_shm_header_t) +
+	              sizeof(od_stats_shm_worker_t) * workers +
+	              sizeof(od_stats_shm_route_t) * routes;
+
+	/* new file is renamed into place once it is ready */
+	char path_tmp[PATH_MAX];
+	od_snprintf(path_tmp, sizeof(path_tmp), "%s.%d", path, (int)getpid());
+	int fd = open(path_tmp, O_RDWR|O_CREAT|O_TRUNC, 0640);
+	if (fd == -1)
+		return -1;
+	int rc;
+	rc = ftruncate(fd, size);
+	if (rc == -1)
+		goto error;
+	void *data;
+	data = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+		goto error;
+	close(fd);
+
+	shm->data    = data;
+	shm->size    = size;
+	shm->header  = data;
+	shm->workers = (od_stats_shm_worker_t*)(shm->data + sizeof(od_stats_shm_header_t));
+	shm->routes  = (od_stats_shm_route_t*)(shm->workers + workers);
+
+	od_stats_shm_header_t *header = shm->header;
+	header->magic       = OD_STATS_SHM_MAGIC;
+	header->version     = OD_STATS_SHM_VERSION;
+	header->header_size = sizeof(od_stats_shm_header_t);
+	header->worker_size = sizeof(od_stats_shm_worker_t);
+	header->worker_max  = workers;
+	header->route_size  = sizeof(od_stats_shm_route_t);
+	header->route_max   = routes;
+	header->pid         = getpid();
+
+	rc = rename(path_tmp, path);
+	if (rc == -1) {
+		int errno_save = errno;
+		munmap(data, size);
+		od_stats_shm_init(shm);
+		unlink(path_tmp);
+		errno = errno_save;
+		return -1;
+	}
+	return 0;
+error:;
+	int errno_save = errno;
+	close(fd);
+	unlink(path_tmp);
+	errno = errno_save;
+	return -1;
+}
+
+void
+od_stats_shm_begin(od_stats_shm_t *shm)
+{
+	shm->routes_count   = 0;
+	shm->routes_dropped = 0;
+}
+
+static inline void
+od_stats_shm_name(char *dest, char *name, int name_len)
+{
+	/* names are zero terminated, longer ones are cut */
+	if (name_len >= OD_STATS_SHM_NAME)
+		name_len = OD_STATS_SHM_NAME - 1;
+	memcpy(dest, name, name_len);
+	memset(dest + name_len, 0, OD_STATS_SHM_NAME - name_len);
+}
+
+void
+od_stats_shm_route(od_stats_shm_t *shm, od_route_t *route, od_stat_t *current)
+{
+	if ((uint32_t)shm->routes_count == shm->header->route_max) {
+		shm->routes_dropped++;
+		return;
+	}
+	od_stats_shm_route_t *record = &shm->routes[shm->routes_count++];
+
+	od_route_lock(route, OD_LOCK_STAT);
+	int      clients         = od_client_pool_total(&route->client_pool);
+	int      clients_waiting = route->count_waiters;
+	int      servers_active  = route->server_pool.count_active;
+	int      servers_idle    = route->server_pool.count_idle;
+	uint64_t wait_max        = od_route_max_wait(route);
+	od_route_unlock(route);
+
+	od_stats_shm_write_begin(&record->seq);
+	od_stats_shm_name(record->database, route->id.database,
+	                  route->id.database_len - 1);
+	od_stats_shm_name(record->user, route->id.user,
+	                  route->id.user_len - 1);
+	record->clients            = clients;
+	record->clients_waiting    = clients_waiting;
+	record->servers_active     = servers_active;
+	record->servers_idle       = servers_idle;
+	record->wait_max           = wait_max;
+	record->count_wait         = current->count_wait;
+	record->wait_time          = current->wait_time;
+	record->count_wait_timeout = current->count_wait_timeout;
+	record->count_query        = current->count_query;
+	record->query_time         = current->query_time;
+	record->count_tx           = current->count_tx;
+	record->tx_time            = current->tx_time;
+	record->recv_client        = current->recv_client;
+	record->recv_server        = current->recv_server;
+	od_stats_shm_write_end(&record->seq);
+}
+
+void
+od_stats_shm_end(od_stats_shm_t *shm, od_global_t *global)
+{
+	od_router_t *router = global->router;
+	od_worker_pool_t *worker_pool = global->worker_pool;
+
+	/* records of removed routes */
+	int i;
+	for (i = shm->routes_count; i < shm->routes_used; i++) {
+		od_stats_shm_route_t *record = &shm->routes[i];
+		od_stats_shm_write_begin(&record->seq);
+		memset((char*)record + sizeof(record->seq), 0,
+		       sizeof(*record) - sizeof(record->seq));
+		od_stats_shm_write_end(&record->seq);
+	}
+	shm->routes_used = shm->routes_count;
+
+	od_stats_shm_header_t *header = shm->header;
+	int workers = od_worker_pool_total(worker_pool);
+	if ((uint32_t)workers > header->worker_max)
+		workers = header->worker_max;
+	for (i = 0; i < workers; i++) {
+		od_worker_t *worker = od_worker_pool_get(worker_pool, i);
+		od_stats_shm_worker_t *record = &shm->workers[i];
+		od_stats_shm_write_begin(&record->seq);
+		record->id                = worker->id;
+		record->handshake         = worker->handshake;
+		record->clients           = od_atomic_u32_of(&worker->clients);
+		record->clients_processed = worker->clients_processed;
+		record->memory            = od_atomic_u64_of(&worker->memory);
+		od_stats_shm_write_end(&record->seq);
+	}
+
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	od_stats_shm_write_begin(&header->seq);
+	header->update_time     = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+	header->clients         = od_atomic_u32_of(&router->clients);
+	header->clients_routing = od_atomic_u32_of(&router->clients_routing);
+	header->workers         = workers;
+	header->routes          = shm->routes_count;
+	header->routes_dropped  = shm->routes_dropped;
+	od_stats_shm_write_end(&header->seq);
+}
@@ -0,0 +1,123 @@
+#ifndef ODYSSEY_STATS_SHM_H
+#define ODYSSEY_STATS_SHM_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_stats_shm_header od_stats_shm_header_t;
+typedef struct od_stats_shm_worker od_stats_shm_worker_t;
+typedef struct od_stats_shm_route  od_stats_shm_route_t;
+typedef struct od_stats_shm        od_stats_shm_t;
+
+/* Stats segment is a file mapped by odyssey and external readers.
+ * The header is followed by worker_max worker records at header_size
+ * and route_max route records after them. Sizes are read from the
+ * header, so fields can be appended without changing the version.
+ *
+ * Every record, including the header, starts with a sequence number
+ * which is odd while cron rewrites it. Readers copy a record between
+ * two reads of an equal even sequence number. Cron publishes the
+ * segment once a second, counters are totals since start and times are
+ * in microseconds. Route records are written in no particular order,
+ * records with an empty database are not used.
+ *
+ * Segment is created as a new file and renamed into place, so an
+ * online restart does not share it with the previous process. */
+
+#define OD_STATS_SHM_MAGIC   0x5453444f /* "ODST" */
+#define OD_STATS_SHM_VERSION 1
+#define OD_STATS_SHM_NAME    64
+
+struct od_stats_shm_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t worker_size;
+	uint32_t worker_max;
+	uint32_t route_size;
+	uint32_t route_max;
+	uint32_t reserved;
+	uint64_t seq;
+	uint64_t pid;
+	uint64_t update_time;
+	uint64_t clients;
+	uint64_t clients_routing;
+	uint64_t workers;
+	uint64_t routes;
+	uint64_t routes_dropped;
+};
+
+struct od_stats_shm_worker
+{
+	uint64_t seq;
+	uint64_t id;
+	uint64_t handshake;
+	uint64_t clients;
+	uint64_t clients_processed;
+	uint64_t memory;
+};
+
+struct od_stats_shm_route
+{
+	uint64_t seq;
+	char     database[OD_STATS_SHM_NAME];
+	char     user[OD_STATS_SHM_NAME];
+	uint64_t clients;
+	uint64_t clients_waiting;
+	uint64_t servers_active;
+	uint64_t servers_idle;
+	uint64_t wait_max;
+	uint64_t count_wait;
+	uint64_t wait_time;
+	uint64_t count_wait_timeout;
+	uint64_t count_query;
+	uint64_t query_time;
+	uint64_t count_tx;
+	uint64_t tx_time;
+	uint64_t recv_client;
+	uint64_t recv_server;
+};
+
+struct od_stats_shm
+{
+	char                  *data;
+	size_t                 size;
+	od_stats_shm_header_t *header;
+	od_stats_shm_worker_t *workers;
+	od_stats_shm_route_t  *routes;
+	int                    routes_count;
+	int                    routes_used;
+	uint64_t               routes_dropped;
+};
+
+void od_stats_shm_init(od_stats_shm_t*);
+int  od_stats_shm_open(od_stats_shm_t*, char*, int, int);
+void od_stats_shm_begin(od_stats_shm_t*);
+void od_stats_shm_route(od_stats_shm_t*, od_route_t*, od_stat_t*);
+void od_stats_shm_end(od_stats_shm_t*, od_global_t*);
+
+static inline int
+od_stats_shm_enabled(od_stats_shm_t *shm)
+{
+	return shm->data != NULL;
+}
+
+static inline void
+od_stats_shm_write_begin(uint64_t *seq)
+{
+	/* single writer, odd sequence marks the record as changing */
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void
+od_stats_shm_write_end(uint64_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* ODYSSEY_STATS_SHM_H */
@@ -12,8 +12,10 @@ typedef enum
 	OD_UNDEF,
 	OD_OK,
 	OD_SKIP,
+	OD_REPLACE,
 	OD_ATTACH,
 	OD_DETACH,
+	OD_MIGRATE,
 	OD_STOP,
 	OD_EOOM,
 	OD_EATTACH,
@@ -22,7 +24,14 @@ typedef enum
 	OD_ESERVER_READ,
 	OD_ESERVER_WRITE,
 	OD_ECLIENT_READ,
-	OD_ECLIENT_WRITE
+	OD_ECLIENT_WRITE,
+	OD_ECLIENT_IDLE,
+	OD_ECLIENT_IDLE_IN_TRANSACTION,
+	OD_EQUERY_TIMEOUT,
+	OD_ECLIENT_RESTART,
+	OD_ERELAY_MEMORY,
+	OD_EWALRELAY,
+	OD_ESTATEMENT_TRANSACTION
 } od_status_t;
 
 static inline char *
@@ -35,10 +44,14 @@ od_status_to_str(od_status_t status){
 			return "OD_OK";
 		case OD_SKIP:
 			return "OD_SKIP";
+		case OD_REPLACE:
+			return "OD_REPLACE";
 		case OD_ATTACH:
 			return "OD_UNDEF";
 		case OD_DETACH:
 			return "OD_DETACH";
+		case OD_MIGRATE:
+			return "OD_MIGRATE";
 		case OD_STOP:
 			return "OD_STOP";
 		case OD_EOOM:
@@ -57,6 +70,20 @@ od_status_to_str(od_status_t status){
 			return "OD_ECLIENT_READ";
 		case OD_ECLIENT_WRITE:
 			return "OD_ECLIENT_WRITE";
+		case OD_ECLIENT_IDLE:
+			return "OD_ECLIENT_IDLE";
+		case OD_ECLIENT_IDLE_IN_TRANSACTION:
+			return "OD_ECLIENT_IDLE_IN_TRANSACTION";
+		case OD_EQUERY_TIMEOUT:
+			return "OD_EQUERY_TIMEOUT";
+		case OD_ECLIENT_RESTART:
+			return "OD_ECLIENT_RESTART";
+		case OD_ERELAY_MEMORY:
+			return "OD_ERELAY_MEMORY";
+		case OD_EWALRELAY:
+			return "OD_EWALRELAY";
+		case OD_ESTATEMENT_TRANSACTION:
+			return "OD_ESTATEMENT_TRANSACTION";
 	}
 	return "unkonown";
 }
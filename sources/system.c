@@ -23,21 +23,160 @@
 #include <kiwi.h>
 #include <odyssey.h>
 
+static inline uint32_t
+od_system_routing_slots(od_global_t *global)
+{
+	od_instance_t *instance = global->instance;
+	od_router_t *router = global->router;
+
+	/* Number of clients in startup, handshake and routing is limited by
+	 * client_max_routing. When recent logins take longer than
+	 * client_overload_latency, workers are short of cpu: the limit is
+	 * lowered in proportion, so fewer logins share the cpu and
+	 * finish in time. At least one login is always let in. */
+	uint64_t limit = instance->config.client_max_routing;
+	uint64_t latency = (uint64_t)instance->config.client_overload_latency * 1000;
+	if (latency > 0) {
+		uint64_t login_time = od_atomic_u64_of(&router->login_time);
+		if (login_time > latency) {
+			limit = limit * latency / login_time;
+			if (limit == 0)
+				limit = 1;
+		}
+	}
+	uint32_t routing = od_atomic_u32_of(&router->clients_routing);
+	if (routing >= limit)
+		return 0;
+	return limit - routing;
+}
+
 static inline void
+od_system_server_reject(od_system_server_t *server, machine_io_t *client_io,
+                        machine_msg_t *error)
+{
+	/* refuse connection before any startup or TLS work. Drop data sent
+	 * by the client so far, so close does not reset the connection
+	 * before the error is delivered */
+	int fd = machine_fd(client_io);
+	char buf[512];
+	while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+		;
+	if (error)
+		send(fd, machine_msg_data(error), machine_msg_size(error),
+		     MSG_DONTWAIT | MSG_NOSIGNAL);
+	machine_close(client_io);
+	machine_io_free(client_io);
+	od_cron_t *cron = server->global->cron;
+	od_atomic_u64_inc(&cron->overload_rejects);
+}
+
+od_client_t*
+od_system_client(od_global_t *global, od_config_listen_t *config,
+                 machine_tls_t *tls, machine_io_t *client_io)
+{
+	od_instance_t *instance = global->instance;
+
+	/* set network options, socket options of the listen are
+	 * inherited on accept */
+	if (config->host) {
+		machine_set_nodelay(client_io, instance->config.nodelay);
+		if (instance->config.keepalive > 0)
+			machine_set_keepalive(client_io, 1, instance->config.keepalive);
+	}
+
+	machine_notify_t *notify;
+	notify = machine_notify_create();
+	if (notify == NULL) {
+		od_error(&instance->logger, "server", NULL, NULL,
+		         "failed to allocate client notify object");
+		machine_close(client_io);
+		machine_io_free(client_io);
+		return NULL;
+	}
+
+	/* allocate new client */
+	od_client_t *client = od_client_allocate();
+	if (client == NULL) {
+		od_error(&instance->logger, "server", NULL, NULL,
+		         "failed to allocate client object");
+		machine_notify_free(notify);
+		machine_close(client_io);
+		machine_io_free(client_io);
+		return NULL;
+	}
+	od_id_generate(&client->id, "c");
+	od_trace1(client__accept, client->id.id_a);
+	int rc;
+	rc = od_io_prepare(&client->io, client_io, instance->config.readahead,
+	                   instance->config.readahead_ring);
+	if (rc == -1) {
+		od_error(&instance->logger, "server", NULL, NULL,
+		         "failed to allocate client io object");
+		machine_notify_free(notify);
+		machine_close(client_io);
+		machine_io_free(client_io);
+		od_client_free(client);
+		return NULL;
+	}
+	client->rule          = NULL;
+	client->config_listen = config;
+	client->tls           = tls;
+	client->time_accept   = machine_time_us();
+	client->notify        = notify;
+	return client;
+}
+
+void
 od_system_server(void *arg)
 {
 	od_system_server_t *server = arg;
 	od_instance_t *instance = server->global->instance;
 	od_router_t *router = server->global->router;
+	od_worker_pool_t *worker_pool = server->global->worker_pool;
+
+	/* wake up periodically to stop accepting on online restart */
+	uint32_t timeout = UINT32_MAX;
+	if (instance->config.online_restart_socket)
+		timeout = 1000;
+
+	/* on overload new connections are either left in the kernel
+	 * backlog, or accepted and refused right away */
+	int reject = instance->config.client_overload &&
+	             strcmp(instance->config.client_overload, "reject") == 0;
+	machine_msg_t *reject_msg = NULL;
+	if (reject) {
+		char message[] = "too many connections";
+		reject_msg = kiwi_be_write_error_fatal(NULL, KIWI_TOO_MANY_CONNECTIONS,
+		                                       message, sizeof(message) - 1);
+	}
 
 	for (;;)
 	{
+		/* accept pending connections in batches, but no more than
+		 * clients allowed to be routed */
+		int count = OD_WORKER_POOL_FEED_MAX;
+		if (! reject && ! server->config->mux) {
+			uint32_t slots;
+			while ((slots = od_system_routing_slots(server->global)) == 0)
+				machine_sleep(1);
+			if (slots < (uint32_t)count)
+				count = slots;
+		}
+
 		/* accepted client io is not attached to epoll context yet */
-		machine_io_t *client_io;
+		machine_io_t *client_io[OD_WORKER_POOL_FEED_MAX];
 		int rc;
-		rc = machine_accept(server->io, &client_io, server->config->backlog,
-		                    0, UINT32_MAX);
+		rc = machine_accept_batch(server->io, client_io, count,
+		                          server->config->backlog, 0, timeout);
 		if (rc == -1) {
+			if (od_system_is_draining(server->global)) {
+				/* listen socket is used by the new process, server
+				 * object is kept in the system list until exit */
+				machine_close(server->io);
+				break;
+			}
+			if (machine_errno() == ETIMEDOUT)
+				continue;
 			od_error(&instance->logger, "server", NULL, NULL,
 			         "accept failed: %s",
 			         machine_error(server->io));
@@ -47,77 +186,68 @@ od_system_server(void *arg)
 			continue;
 		}
 
-		/* set network options */
-		machine_set_nodelay(client_io, instance->config.nodelay);
-		if (instance->config.keepalive > 0)
-			machine_set_keepalive(client_io, 1, instance->config.keepalive);
-
-		machine_io_t *notify_io;
-		notify_io = machine_io_create();
-		if (notify_io == NULL) {
-			od_error(&instance->logger, "server", NULL, NULL,
-			         "failed to allocate client io notify object");
-			machine_close(client_io);
-			machine_io_free(client_io);
+		od_client_t *clients[OD_WORKER_POOL_FEED_MAX];
+		int clients_count = 0;
+		int i;
+		if (server->config->mux) {
+			/* connections are links of other odyssey instances,
+			 * their streams become clients of the listen */
+			for (i = 0; i < rc; i++)
+				od_mux_accept(server->global, server->config, server->tls,
+				              client_io[i]);
 			continue;
 		}
-		rc = machine_eventfd(notify_io);
-		if (rc == -1) {
-			od_error(&instance->logger, "server", NULL, NULL,
-			         "failed to get eventfd for client: %s",
-			         machine_error(client_io));
-			machine_close(notify_io);
-			machine_close(client_io);
-			machine_io_free(client_io);
-			continue;
+		for (i = 0; i < rc; i++)
+		{
+			if (reject && od_system_routing_slots(server->global) == 0) {
+				od_system_server_reject(server, client_io[i], reject_msg);
+				continue;
+			}
+			od_client_t *client;
+			client = od_system_client(server->global, server->config,
+			                          server->tls, client_io[i]);
+			if (client == NULL)
+				continue;
+
+			od_atomic_u32_inc(&router->clients_routing);
+			od_worker_t *worker = server->worker;
+			if (worker && worker_pool->handshake_count == 0 &&
+			    od_worker_pool_is_active(worker_pool, worker->id)) {
+				/* accepted by the worker itself, start client right away */
+				od_atomic_u32_inc(&worker->clients);
+				od_worker_client_start(worker, client);
+				continue;
+			}
+			clients[clients_count] = client;
+			clients_count++;
 		}
 
-		/* allocate new client */
-		od_client_t *client = od_client_allocate();
-		if (client == NULL) {
-			od_error(&instance->logger, "server", NULL, NULL,
-			         "failed to allocate client object");
-			machine_close(client_io);
-			machine_io_free(client_io);
-			continue;
-		}
-		od_id_generate(&client->id, "c");
-		rc = od_io_prepare(&client->io, client_io, instance->config.readahead);
-		if (rc == -1) {
-			od_error(&instance->logger, "server", NULL, NULL,
-			         "failed to allocate client io object");
-			machine_close(client_io);
-			machine_io_free(client_io);
-			od_client_free(client);
-			continue;
-		}
-		client->rule          = NULL;
-		client->config_listen = server->config;
-		client->tls           = server->tls;
-		client->time_accept   = 0;
-		client->notify_io     = notify_io;
-		if (instance->config.log_session)
-			client->time_accept = machine_time_us();
-
-		/* create new client event and pass it to worker pool */
-		machine_msg_t *msg;
-		msg = machine_msg_create(sizeof(od_client_t*));
-		machine_msg_set_type(msg, OD_MSG_CLIENT_NEW);
-		memcpy(machine_msg_data(msg), &client, sizeof(od_client_t*));
-
-		od_worker_pool_t *worker_pool = server->global->worker_pool;
-		od_atomic_u32_inc(&router->clients_routing);
-		od_worker_pool_feed(worker_pool, msg);
-		while (od_atomic_u32_of(&router->clients_routing)
-				>= (uint32_t) instance->config.client_max_routing) {
-			machine_sleep(1);
-		}
+		/* pass new clients to workers of the listen group */
+		if (clients_count > 0)
+			od_worker_pool_feed(worker_pool,
+			                    od_worker_pool_group(worker_pool,
+			                                         server->config->worker_group),
+			                    clients, clients_count);
 	}
+
+	if (reject_msg)
+		machine_msg_free(reject_msg);
 }
 
-static inline int
-od_system_server_start(od_system_t *system, od_config_listen_t *config,
-                       struct addrinfo *addr)
+static inline void
+od_system_server_free(od_system_server_t *server)
+{
+	od_list_unlink(&server->link);
+	if (server->tls)
+		machine_tls_free(server->tls);
+	machine_close(server->io);
+	machine_io_free(server->io);
+	free(server);
+}
+
+static inline od_system_server_t*
+od_system_server_create(od_system_t *system, od_config_listen_t *config,
+                        struct addrinfo *addr, od_worker_t *worker)
 {
 	od_instance_t *instance = system->global->instance;
 	od_system_server_t *server;
@@ -125,12 +255,14 @@ od_system_server_start(od_system_t *system, od_config_listen_t *config,
 	if (server == NULL) {
 		od_error(&instance->logger, "system", NULL, NULL,
 		         "failed to allocate system server object");
-		return -1;
+		return NULL;
 	}
 	server->config = config;
 	server->addr   = addr;
 	server->io     = NULL;
+	od_list_init(&server->link);
 	server->tls    = NULL;
+	server->worker = worker;
 	server->global = system->global;
 
 	/* create server tls */
@@ -140,7 +272,7 @@ od_system_server_start(od_system_t *system, od_config_listen_t *config,
 			od_error(&instance->logger, "server", NULL, NULL,
 			         "failed to create tls handler");
 			free(server);
-			return -1;
+			return NULL;
 		}
 	}
 
@@ -152,7 +284,7 @@ od_system_server_start(od_system_t *system, od_config_listen_t *config,
 		if (server->tls)
 			machine_tls_free(server->tls);
 		free(server);
-		return -1;
+		return NULL;
 	}
 
 	char addr_name[PATH_MAX];
@@ -176,20 +308,44 @@ od_system_server_start(od_system_t *system, od_config_listen_t *config,
 		strncpy(saddr_un.sun_path, addr_name, addr_name_len);
 	}
 
-	/* bind */
+	/* share listen address between workers */
+	if (worker)
+		machine_set_reuseport(server->io, 1);
+
+	/* socket options of accepted clients, listen without host
+	 * is a unix socket */
+	int sndbuf = config->sndbuf;
+	int rcvbuf = config->rcvbuf;
+	if (server->addr) {
+		machine_set_notsent_lowat(server->io, config->tcp_notsent_lowat);
+		machine_set_user_timeout(server->io, config->tcp_user_timeout);
+		machine_set_quickack(server->io, config->tcp_quickack);
+		machine_set_fastopen(server->io, config->tcp_fastopen);
+	} else {
+		if (sndbuf == 0)
+			sndbuf = OD_IO_UNIX_BUFSIZE;
+		if (rcvbuf == 0)
+			rcvbuf = OD_IO_UNIX_BUFSIZE;
+	}
+	machine_set_bufsize(server->io, sndbuf, rcvbuf);
+	machine_set_busy_poll(server->io, config->busy_poll);
+	machine_set_zerocopy(server->io, config->zerocopy_threshold);
+
+	/* bind, or take over listen socket of the previous process */
 	int rc;
-	rc = machine_bind(server->io, saddr);
+	int fd;
+	fd = od_restart_take(&system->restart, saddr);
+	if (fd != -1)
+		rc = machine_bind_fd(server->io, fd);
+	else
+		rc = machine_bind(server->io, saddr);
 	if (rc == -1) {
 		od_error(&instance->logger, "server", NULL, NULL,
 		         "bind to '%s' failed: %s",
 		         addr_name,
 		         machine_error(server->io));
-		if (server->tls)
-			machine_tls_free(server->tls);
-		machine_close(server->io);
-		machine_io_free(server->io);
-		free(server);
-		return -1;
+		od_system_server_free(server);
+		return NULL;
 	}
 
 	/* chmod */
@@ -210,19 +366,153 @@ od_system_server_start(od_system_t *system, od_config_listen_t *config,
 		}
 	}
 
+	od_list_append(&system->servers, &server->link);
+
+	if (worker)
+		od_log(&instance->logger, "server", NULL, NULL,
+		       "listening on %s (worker %d)%s", addr_name, worker->id,
+		       fd != -1 ? ", inherited" : "");
+	else
+		od_log(&instance->logger, "server", NULL, NULL,
+		       "listening on %s%s", addr_name,
+		       fd != -1 ? ", inherited" : "");
+	return server;
+}
+
+static inline void
+od_system_server_steer(od_system_t *system, od_system_server_t **servers,
+                       int count)
+{
+	od_instance_t *instance = system->global->instance;
+	int worker_cpus[OD_CONFIG_CPUS_MAX];
+	int worker_cpus_count;
+	worker_cpus_count = od_config_cpus_parse(instance->config.worker_cpus,
+	                                         worker_cpus,
+	                                         OD_CONFIG_CPUS_MAX);
+	if (worker_cpus_count <= 0 || count == 0)
+		return;
+
+	/* sockets join the reuseport group in order of listen, the
+	 * group program maps cpu of a connection to the socket index */
+	int cpus[count];
+	int rc;
+	int i;
+	for (i = 0; i < count; i++) {
+		od_system_server_t *server = servers[i];
+		od_worker_t *worker = server->worker;
+		cpus[i] = worker_cpus[worker->id % worker_cpus_count];
+		rc = machine_listen(server->io, server->config->backlog);
+		if (rc == -1) {
+			od_error(&instance->logger, "server", NULL, NULL,
+			         "listen failed: %s", machine_error(server->io));
+			return;
+		}
+		rc = machine_set_incoming_cpu(server->io, cpus[i]);
+		if (rc == -1)
+			od_error(&instance->logger, "server", NULL, NULL,
+			         "failed to set incoming cpu: %s",
+			         machine_error(server->io));
+	}
+	rc = machine_set_reuseport_cpu(servers[0]->io, cpus, count);
+	if (rc == -1) {
+		od_error(&instance->logger, "server", NULL, NULL,
+		         "failed to attach reuseport cpu program: %s",
+		         machine_error(servers[0]->io));
+		return;
+	}
 	od_log(&instance->logger, "server", NULL, NULL,
-	       "listening on %s", addr_name);
+	       "connections are steered to workers by cpu");
+}
+
+static inline int
+od_system_server_start_workers(od_system_t *system, od_config_listen_t *config,
+                               struct addrinfo *addr)
+{
+	od_instance_t *instance = system->global->instance;
+	od_worker_pool_t *worker_pool = system->global->worker_pool;
+	od_system_server_t *servers[worker_pool->count_max];
+	int count = 0;
+
+	/* sockets of the listen group workers, or of all remaining
+	 * workers including the ones started for resize */
+	od_worker_group_t *group;
+	group = od_worker_pool_group(worker_pool, config->worker_group);
+	int start = worker_pool->groups_workers;
+	int end   = worker_pool->count_max;
+	if (group) {
+		start = group->start;
+		end   = group->start + group->count;
+	}
+	int i;
+	for (i = start; i < end; i++)
+	{
+		od_worker_t *worker = &worker_pool->pool[i];
+		od_system_server_t *server;
+		server = od_system_server_create(system, config, addr, worker);
+		if (server == NULL)
+			continue;
+		servers[count++] = server;
+	}
+	if (instance->config.reuseport_cpu)
+		od_system_server_steer(system, servers, count);
+
+	int started = 0;
+	for (i = 0; i < count; i++)
+	{
+		od_system_server_t *server = servers[i];
+		od_worker_t *worker = server->worker;
+
+		/* server io will be attached to the worker machine */
+		int rc;
+		rc = machine_io_detach(server->io);
+		if (rc == -1) {
+			od_error(&instance->logger, "server", NULL, NULL,
+			         "failed to detach server io: %s",
+			         machine_error(server->io));
+			od_system_server_free(server);
+			continue;
+		}
+
+		machine_msg_t *msg;
+		msg = machine_msg_create(sizeof(od_system_server_t*));
+		if (msg == NULL) {
+			od_error(&instance->logger, "server", NULL, NULL,
+			         "failed to allocate server message");
+			od_system_server_free(server);
+			continue;
+		}
+		machine_msg_set_type(msg, OD_MSG_SERVER_NEW);
+		memcpy(machine_msg_data(msg), &server, sizeof(od_system_server_t*));
+		machine_channel_write(worker->task_channel, msg);
+		started++;
+	}
+	if (started == 0)
+		return -1;
+	return 0;
+}
+
+static inline int
+od_system_server_start(od_system_t *system, od_config_listen_t *config,
+                       struct addrinfo *addr)
+{
+	od_instance_t *instance = system->global->instance;
+
+	/* accept tcp connections by workers */
+	if (addr && instance->config.reuseport &&
+	    od_config_is_multi_workers(&instance->config))
+		return od_system_server_start_workers(system, config, addr);
+
+	od_system_server_t *server;
+	server = od_system_server_create(system, config, addr, NULL);
+	if (server == NULL)
+		return -1;
 
 	int64_t coroutine_id;
 	coroutine_id = machine_coroutine_create(od_system_server, server);
 	if (coroutine_id == -1) {
 		od_error(&instance->logger, "system", NULL, NULL,
 		         "failed to start server coroutine");
-		if (server->tls)
-			machine_tls_free(server->tls);
-		machine_close(server->io);
-		machine_io_free(server->io);
-		free(server);
+		od_system_server_free(server);
 		return -1;
 	}
 	return 0;
@@ -293,7 +583,7 @@ od_system_listen(od_system_t *system)
 	return binded;
 }
 
-static inline void
+void
 od_system_cleanup(od_system_t *system)
 {
 	od_instance_t *instance = system->global->instance;
@@ -301,6 +591,9 @@ od_system_cleanup(od_system_t *system)
 	od_list_t *i;
 	od_list_foreach(&instance->config.listen, i)
 	{
+		/* unix sockets are used by the new process */
+		if (od_restart_is_draining(&system->restart))
+			break;
 		od_config_listen_t *listen;
 		listen = od_container_of(i, od_config_listen_t, link);
 		if (listen->host)
@@ -312,6 +605,70 @@ od_system_cleanup(od_system_t *system)
 		            listen->port);
 		unlink(path);
 	}
+
+	/* write out log messages before exit */
+	od_logger_flush(&instance->logger);
+}
+
+static inline int
+od_system_workers_drain_cb(od_client_t *client, void **argv)
+{
+	od_worker_pool_t *worker_pool = argv[0];
+	if (od_worker_pool_is_removed(worker_pool, client->worker_id))
+		od_client_migrate(client);
+	return 0;
+}
+
+static inline int
+od_system_workers_drain_route_cb(od_route_t *route, void **argv)
+{
+	od_route_lock(route, OD_LOCK_OTHER);
+	od_client_pool_foreach(&route->client_pool, OD_CLIENT_ACTIVE,
+	                       od_system_workers_drain_cb, argv);
+	od_client_pool_foreach(&route->client_pool, OD_CLIENT_PENDING,
+	                       od_system_workers_drain_cb, argv);
+	od_client_pool_foreach(&route->client_pool, OD_CLIENT_QUEUE,
+	                       od_system_workers_drain_cb, argv);
+	od_route_unlock(route);
+	return 0;
+}
+
+static inline void
+od_system_workers_resize(od_system_t *system)
+{
+	od_instance_t *instance = system->global->instance;
+	od_router_t *router = system->global->router;
+	od_worker_pool_t *worker_pool = system->global->worker_pool;
+
+	/* workers beyond the started pool need a restart */
+	int count = instance->config.workers;
+	if (count > worker_pool->count_max) {
+		od_error(&instance->logger, "config", NULL, NULL,
+		         "workers %d exceed workers_max %d, using %d",
+		         count, worker_pool->count_max, worker_pool->count_max);
+		count = worker_pool->count_max;
+		instance->config.workers = count;
+	}
+	if (count <= worker_pool->groups_workers) {
+		od_error(&instance->logger, "config", NULL, NULL,
+		         "workers %d do not exceed %d workers of worker_groups, using %d",
+		         count, worker_pool->groups_workers,
+		         worker_pool->groups_workers + 1);
+		count = worker_pool->groups_workers + 1;
+		instance->config.workers = count;
+	}
+	int current = od_worker_pool_count(worker_pool);
+	if (count == current)
+		return;
+	od_worker_pool_resize(worker_pool, count);
+	od_log(&instance->logger, "config", NULL, NULL,
+	       "workers changed from %d to %d", current, count);
+	if (count > current)
+		return;
+
+	/* clients of removed workers are moved between transactions */
+	void *argv[] = { worker_pool };
+	od_router_foreach(router, od_system_workers_drain_route_cb, argv);
 }
 
 static inline void
@@ -352,6 +709,7 @@ od_system_config_reload(od_system_t *system)
 	rc = od_rules_validate(&rules, &config, &instance->logger);
 	od_config_reload(&instance->config, &config);
 	od_config_free(&config);
+	od_system_workers_resize(system);
 	if (rc == -1) {
 		od_rules_free(&rules);
 		return;
@@ -376,6 +734,9 @@ od_system_config_reload(od_system_t *system)
 	od_log(&instance->logger, "rules", NULL, NULL,
 	       "%d routes created/deleted and scheduled for removal",
 	       updates);
+
+	/* mux storage could be added */
+	od_mux_start(system->global);
 }
 
 static inline void
@@ -426,48 +787,199 @@ od_system_signal_handler(void *arg)
 	}
 }
 
-static inline void
-od_system(void *arg)
+static inline int
+od_system_housekeeping_start(od_system_t *system)
 {
-	od_system_t *system = arg;
 	od_instance_t *instance = system->global->instance;
 
 	/* start cron coroutine */
 	od_cron_t *cron = system->global->cron;
 	int rc;
 	rc = od_cron_start(cron, system->global);
+	if (rc == -1)
+		return -1;
+
+	/* start storage health checks */
+	rc = od_health_start(system->global);
+	if (rc == -1)
+		return -1;
+
+	/* start signal handler coroutine, signals of embedded instance
+	 * belong to the application */
+	if (instance->embed == NULL) {
+		int64_t coroutine_id;
+		coroutine_id = machine_coroutine_create(od_system_signal_handler, system);
+		if (coroutine_id == -1) {
+			od_error(&instance->logger, "system", NULL, NULL,
+			         "failed to start signal handler");
+			return -1;
+		}
+	}
+
+	/* start metrics http server */
+	od_metrics_start(system->global->metrics, system->global);
+	return 0;
+}
+
+static inline void
+od_system_housekeeping(void *arg)
+{
+	od_system_t *system = arg;
+	int rc;
+	rc = od_system_housekeeping_start(system);
+	machine_msg_t *msg;
+	msg = machine_msg_create(sizeof(int));
+	if (msg == NULL)
+		return;
+	memcpy(machine_msg_data(msg), &rc, sizeof(int));
+	machine_channel_write(system->housekeeping_ready, msg);
+}
+
+static inline int
+od_system_housekeeping_run(od_system_t *system)
+{
+	od_instance_t *instance = system->global->instance;
+
+	/* Cron, health checks, config reload and the metrics server run
+	 * on a separate machine, so their ticks do not delay accepts.
+	 *
+	 * System machine waits for them to start, since the metrics
+	 * server takes its socket from the previous process. */
+	system->housekeeping_ready = machine_channel_create(1);
+	if (system->housekeeping_ready == NULL)
+		return -1;
+	system->housekeeping = machine_create("housekeeping",
+	                                      od_system_housekeeping, system);
+	if (system->housekeeping == -1) {
+		od_error(&instance->logger, "system", NULL, NULL,
+		         "failed to create housekeeping thread");
+		return -1;
+	}
+	machine_msg_t *msg;
+	msg = machine_channel_read(system->housekeeping_ready, UINT32_MAX);
+	if (msg == NULL)
+		return -1;
+	int rc;
+	memcpy(&rc, machine_msg_data(msg), sizeof(int));
+	machine_msg_free(msg);
+	return rc;
+}
+
+static inline void
+od_system(void *arg)
+{
+	od_system_t *system = arg;
+	od_instance_t *instance = system->global->instance;
+
+	/* start cancel dispatcher */
+	int rc;
+	rc = od_cancel_start(system->global);
+	if (rc == -1)
+		return;
+
+	/* start spans exporter */
+	rc = od_spans_start(system->global);
+	if (rc == -1)
+		return;
+
+	/* start shadow traffic mirror */
+	rc = od_mirror_start(system->global);
+	if (rc == -1)
+		return;
+
+	/* start fleet pool limit exchange */
+	rc = od_fleet_start(system->global);
+	if (rc == -1)
+		return;
+
+	/* start dns cache refresh */
+	rc = od_dns_cache_start(system->global);
 	if (rc == -1)
 		return;
 
+	/* start multiplexed links machine */
+	rc = od_mux_start(system->global);
+	if (rc == -1)
+		return;
+
+#ifdef PAM_FOUND
+	/* start pam authentication machines */
+	rc = od_pam_start(system->global, instance->config.pam_workers);
+	if (rc == -1)
+		return;
+#endif
+
 	/* start worker threads */
 	od_worker_pool_t *worker_pool = system->global->worker_pool;
-	rc = od_worker_pool_start(worker_pool, system->global, instance->config.workers);
+	rc = od_worker_pool_start(worker_pool, system->global, instance->config.workers,
+	                          instance->config.workers_max);
 	if (rc == -1)
 		return;
 
-	/* start signal handler coroutine */
-	int64_t coroutine_id;
-	coroutine_id = machine_coroutine_create(od_system_signal_handler, system);
-	if (coroutine_id == -1) {
-		od_error(&instance->logger, "system", NULL, NULL,
-		         "failed to start signal handler");
-		return;
+	/* bind system machine after workers are created, so they do not
+	 * inherit its affinity */
+	if (instance->config.system_cpus) {
+		int cpus[OD_CONFIG_CPUS_MAX];
+		int count;
+		count = od_config_cpus_parse(instance->config.system_cpus, cpus,
+		                             OD_CONFIG_CPUS_MAX);
+		rc = machine_set_affinity(cpus, count);
+		if (rc == -1)
+			od_error(&instance->logger, "system", NULL, NULL,
+			         "failed to set system affinity to cpus %s: %s",
+			         instance->config.system_cpus,
+			         strerror(machine_errno()));
 	}
 
+	/* take listen sockets from the running process, if any */
+	od_restart_receive(system->global);
+
+	/* start cron, health checks, signal handler and metrics */
+	rc = od_system_housekeeping_run(system);
+	if (rc == -1)
+		return;
+
 	/* start listen servers */
 	rc = od_system_listen(system);
-	if (rc == 0) {
+	if (rc == 0 && ! od_list_empty(&instance->config.listen)) {
 		od_error(&instance->logger, "system", NULL, NULL,
 		         "failed to bind any listen address");
 		exit(1);
 	}
+
+	/* start accept queue sampling */
+	rc = od_backlog_start(system->global);
+	if (rc == -1)
+		return;
+
+	/* start in-process client endpoint */
+	if (instance->embed) {
+		rc = od_embed_serve(instance->embed);
+		if (rc == -1)
+			exit(1);
+	}
+
+	/* let the previous process drain and accept online restart */
+	od_restart_done(system->global);
+	od_restart_start(system->global);
 }
 
 void
 od_system_init(od_system_t *system)
 {
 	system->machine = -1;
+	system->housekeeping = -1;
+	system->housekeeping_ready = NULL;
 	system->global  = NULL;
+	od_list_init(&system->servers);
+	od_restart_init(&system->restart);
+	od_cancel_init(&system->cancel);
+	od_dns_cache_init(&system->dns);
+	od_mux_init(&system->mux);
+	od_spans_init(&system->spans);
+	od_mirror_init(&system->mirror);
+	od_fleet_init(&system->fleet);
+	od_backlog_init(&system->backlog);
 }
 
 int
@@ -475,6 +987,19 @@ od_system_start(od_system_t *system, od_global_t *global)
 {
 	system->global = global;
 	od_instance_t *instance = global->instance;
+
+	/* crypto engine is set for the process, before any tls context */
+	if (instance->config.tls_engine) {
+		int rc;
+		rc = machine_tls_engine_load(instance->config.tls_engine);
+		if (rc == -1) {
+			od_error(&instance->logger, "system", NULL, NULL,
+			         "failed to load tls engine '%s'",
+			         instance->config.tls_engine);
+			return -1;
+		}
+	}
+
 	system->machine = machine_create("system", od_system, system);
 	if (system->machine == -1) {
 		od_error(&instance->logger, "system", NULL, NULL,
@@ -16,16 +16,40 @@ struct od_system_server
 	machine_tls_t      *tls;
 	od_config_listen_t *config;
 	struct addrinfo    *addr;
+	void               *worker;
 	od_global_t        *global;
+	od_list_t           link;
 };
 
 struct od_system
 {
-	int64_t      machine;
-	od_global_t *global;
+	int64_t            machine;
+	int64_t            housekeeping;
+	machine_channel_t *housekeeping_ready;
+	od_global_t       *global;
+	od_list_t          servers;
+	od_restart_t       restart;
+	od_cancel_t        cancel;
+	od_dns_cache_t     dns;
+	od_mux_t           mux;
+	od_spans_t         spans;
+	od_mirror_t        mirror;
+	od_fleet_t         fleet;
+	od_backlog_t       backlog;
 };
 
+static inline int
+od_system_is_draining(od_global_t *global)
+{
+	od_system_t *system = global->system;
+	return od_restart_is_draining(&system->restart);
+}
+
 void od_system_init(od_system_t*);
 int  od_system_start(od_system_t*, od_global_t*);
+void od_system_server(void*);
+od_client_t *od_system_client(od_global_t*, od_config_listen_t*,
+                              machine_tls_t*, machine_io_t*);
+void od_system_cleanup(od_system_t*);
 
 #endif /* ODYSSEY_SYSTEM_H */
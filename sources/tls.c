@@ -18,6 +18,18 @@
 #include <kiwi.h>
 #include <odyssey.h>
 
+static inline void
+od_tls_debug_ktls(od_logger_t *logger, od_client_t *client,
+                  od_server_t *server, machine_io_t *io)
+{
+	int ktls = machine_io_is_ktls(io);
+	if (! ktls)
+		return;
+	od_debug(logger, "tls", client, server, "kernel offload: send %s, recv %s",
+	         (ktls & MACHINE_KTLS_SEND) ? "yes" : "no",
+	         (ktls & MACHINE_KTLS_RECV) ? "yes" : "no");
+}
+
 machine_tls_t*
 od_tls_frontend(od_config_listen_t *config)
 {
@@ -54,6 +66,38 @@ od_tls_frontend(od_config_listen_t *config)
 			return NULL;
 		}
 	}
+	/* clients offering application protocols must offer postgresql */
+	rc = machine_tls_set_alpn(tls, OD_TLS_ALPN);
+	if (rc == -1) {
+		machine_tls_free(tls);
+		return NULL;
+	}
+	rc = machine_tls_set_session_cache(tls, config->tls_session_cache,
+	                                   config->tls_session_timeout);
+	if (rc == -1) {
+		machine_tls_free(tls);
+		return NULL;
+	}
+	rc = machine_tls_set_verify_cache(tls, config->tls_verify_cache,
+	                                  config->tls_verify_timeout);
+	if (rc == -1) {
+		machine_tls_free(tls);
+		return NULL;
+	}
+	if (config->tls_ktls) {
+		rc = machine_tls_set_ktls(tls, 1);
+		if (rc == -1) {
+			machine_tls_free(tls);
+			return NULL;
+		}
+	}
+	if (config->tls_async) {
+		rc = machine_tls_set_async(tls, 1);
+		if (rc == -1) {
+			machine_tls_free(tls);
+			return NULL;
+		}
+	}
 	rc = machine_tls_create_context(tls, 0);
 	if (rc == -1) {
 		machine_tls_free(tls);
@@ -62,18 +106,58 @@ od_tls_frontend(od_config_listen_t *config)
 	return tls;
 }
 
+int
+od_tls_frontend_direct(od_client_t *client,
+                       od_logger_t *logger,
+                       od_config_listen_t *config,
+                       machine_tls_t *tls)
+{
+	/* tls handshake sent without SSLRequest, detected by the first
+	 * byte of tls handshake record, startup packets start with
+	 * a zero length byte */
+	if (tls == NULL || client->mux)
+		return 0;
+	char type;
+	ssize_t rc;
+	rc = machine_peek(client->io.io, &type, 1, config->client_login_timeout);
+	if (rc != 1 || type != 0x16)
+		return 0;
+	od_debug(logger, "tls", client, NULL, "direct");
+
+	rc = machine_set_tls(client->io.io, tls, config->client_login_timeout);
+	if (rc == -1) {
+		od_error(logger, "tls", client, NULL, "error: %s, login time %d us",
+		         od_io_error(&client->io), machine_time_us() - client->time_accept);
+		return -1;
+	}
+	/* protects from connections of other protocols */
+	if (! machine_io_is_alpn(client->io.io)) {
+		od_error(logger, "tls", client, NULL,
+		         "direct connection without application protocol, closing");
+		return -1;
+	}
+	od_debug(logger, "tls", client, NULL, "ok");
+	od_tls_debug_ktls(logger, client, NULL, client->io.io);
+	return 1;
+}
+
 int
 od_tls_frontend_accept(od_client_t *client,
                        od_logger_t *logger,
                        od_config_listen_t *config,
                        machine_tls_t *tls)
 {
+	/* streams of mux links are protected by the link */
+	od_config_tls_t tls_mode = config->tls_mode;
+	if (client->mux)
+		tls_mode = OD_CONFIG_TLS_DISABLE;
+
 	if (client->startup.is_ssl_request)
 	{
 		od_debug(logger, "tls", client, NULL, "ssl request");
 
 		int rc;
-		if (config->tls_mode == OD_CONFIG_TLS_DISABLE) {
+		if (tls_mode == OD_CONFIG_TLS_DISABLE) {
 			/* not supported 'N' */
 			machine_msg_t *msg;
 			msg = machine_msg_create(sizeof(uint8_t));
@@ -111,6 +195,7 @@ od_tls_frontend_accept(od_client_t *client,
 			return -1;
 		}
 		od_debug(logger, "tls", client, NULL, "ok");
+		od_tls_debug_ktls(logger, client, NULL, client->io.io);
 		return 0;
 	}
 
@@ -118,7 +203,7 @@ od_tls_frontend_accept(od_client_t *client,
 	if (client->startup.is_cancel)
 		return 0;
 
-	switch (config->tls_mode) {
+	switch (tls_mode) {
 	case OD_CONFIG_TLS_DISABLE:
 	case OD_CONFIG_TLS_ALLOW:
 		break;
@@ -167,6 +252,27 @@ od_tls_backend(od_rule_storage_t *storage)
 			return NULL;
 		}
 	}
+	if (storage->tls_ktls) {
+		rc = machine_tls_set_ktls(tls, 1);
+		if (rc == -1) {
+			machine_tls_free(tls);
+			return NULL;
+		}
+	}
+	if (storage->tls_async) {
+		rc = machine_tls_set_async(tls, 1);
+		if (rc == -1) {
+			machine_tls_free(tls);
+			return NULL;
+		}
+	}
+	if (storage->tls_direct) {
+		rc = machine_tls_set_alpn(tls, OD_TLS_ALPN);
+		if (rc == -1) {
+			machine_tls_free(tls);
+			return NULL;
+		}
+	}
 	rc = machine_tls_create_context(tls, 1);
 	if (rc == -1) {
 		machine_tls_free(tls);
@@ -182,12 +288,30 @@ od_tls_backend_connect(od_server_t *server,
 {
 	od_debug(logger, "tls", NULL, server, "init");
 
+	/* handshake without SSLRequest round trip */
+	int rc;
+	if (storage->tls_direct) {
+		rc = machine_set_tls(server->io.io, server->tls, UINT32_MAX);
+		if (rc == -1) {
+			od_error(logger, "tls", NULL, server, "error: %s",
+			         od_io_error(&server->io));
+			return -1;
+		}
+		if (! machine_io_is_alpn(server->io.io)) {
+			od_error(logger, "tls", NULL, server,
+			         "direct connection without application protocol, closing");
+			return -1;
+		}
+		od_debug(logger, "tls", NULL, server, "direct ok");
+		od_tls_debug_ktls(logger, NULL, server, server->io.io);
+		return 0;
+	}
+
 	/* SSL Request */
 	machine_msg_t *msg;
 	msg = kiwi_fe_write_ssl_request(NULL);
 	if (msg == NULL)
 		return -1;
-	int rc;
 	rc = od_write(&server->io, msg);
 	if (rc == -1) {
 		od_error(logger, "tls", NULL, server, "write error: %s",
@@ -215,6 +339,7 @@ od_tls_backend_connect(od_server_t *server,
 			return -1;
 		}
 		od_debug(logger, "tls", NULL, server, "ok");
+		od_tls_debug_ktls(logger, NULL, server, server->io.io);
 		break;
 	case 'N':
 		/* not supported */
@@ -7,9 +7,16 @@
  * Scalable PostgreSQL connection pooler.
 */
 
+/* application protocol of direct tls connections */
+#define OD_TLS_ALPN "postgresql"
+
 machine_tls_t*
 od_tls_frontend(od_config_listen_t*);
 
+int
+od_tls_frontend_direct(od_client_t*, od_logger_t*, od_config_listen_t*,
+                       machine_tls_t*);
+
 int
 od_tls_frontend_accept(od_client_t*, od_logger_t*, od_config_listen_t*,
                        machine_tls_t*);
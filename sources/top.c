@@ -0,0 +1,177 @@
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+static char *od_top_type_names[OD_TOP_MAX] =
+{
+	[OD_TOP_QUERY]  = "query",
+	[OD_TOP_CLIENT] = "client",
+	[OD_TOP_USER]   = "user"
+};
+
+static char *od_top_weight_names[OD_TOP_WEIGHT_MAX] =
+{
+	[OD_TOP_COUNT] = "count",
+	[OD_TOP_BYTES] = "bytes",
+	[OD_TOP_TIME]  = "time"
+};
+
+char*
+od_top_type_name(od_top_type_t type)
+{
+	return od_top_type_names[type];
+}
+
+char*
+od_top_weight_name(od_top_weight_t weight)
+{
+	return od_top_weight_names[weight];
+}
+
+void
+od_top_init(od_top_t *top)
+{
+	pthread_mutex_init(&top->lock, NULL);
+	top->size = 0;
+	memset(top->summary, 0, sizeof(top->summary));
+}
+
+int
+od_top_prepare(od_top_t *top, int size)
+{
+	int i, j;
+	for (i = 0; i < OD_TOP_MAX; i++) {
+		for (j = 0; j < OD_TOP_WEIGHT_MAX; j++) {
+			od_top_summary_t *summary = &top->summary[i][j];
+			summary->entries = calloc(size, sizeof(od_top_entry_t));
+			if (summary->entries == NULL)
+				return -1;
+			summary->size = size;
+		}
+	}
+	top->size = size;
+	return 0;
+}
+
+void
+od_top_free(od_top_t *top)
+{
+	int i, j;
+	for (i = 0; i < OD_TOP_MAX; i++) {
+		for (j = 0; j < OD_TOP_WEIGHT_MAX; j++) {
+			if (top->summary[i][j].entries)
+				free(top->summary[i][j].entries);
+		}
+	}
+	pthread_mutex_destroy(&top->lock);
+}
+
+static inline void
+od_top_summary_add(od_top_summary_t *summary, uint64_t key,
+                   char *text, int text_len, uint64_t value,
+                   uint64_t error)
+{
+	/* the key or the entry with the smallest value, in one pass */
+	od_top_entry_t *min = NULL;
+	int i;
+	for (i = 0; i < summary->count; i++) {
+		od_top_entry_t *entry = &summary->entries[i];
+		if (entry->key == key) {
+			entry->value += value;
+			entry->error += error;
+			return;
+		}
+		if (min == NULL || entry->value < min->value)
+			min = entry;
+	}
+	od_top_entry_t *entry;
+	if (summary->count < summary->size) {
+		entry = &summary->entries[summary->count++];
+		entry->value = value;
+		entry->error = error;
+	} else {
+		entry = min;
+		entry->error = min->value + error;
+		entry->value = min->value + value;
+	}
+	if (text_len > OD_TOP_TEXT)
+		text_len = OD_TOP_TEXT;
+	entry->key = key;
+	memcpy(entry->text, text, text_len);
+	entry->text_len = text_len;
+}
+
+void
+od_top_add(od_top_t *top, od_top_type_t type, uint64_t key,
+           char *text, int text_len, uint64_t weights[OD_TOP_WEIGHT_MAX])
+{
+	pthread_mutex_lock(&top->lock);
+	int i;
+	for (i = 0; i < OD_TOP_WEIGHT_MAX; i++) {
+		if (weights[i] == 0)
+			continue;
+		od_top_summary_add(&top->summary[type][i], key, text, text_len,
+		                   weights[i], 0);
+	}
+	pthread_mutex_unlock(&top->lock);
+}
+
+void
+od_top_merge(od_top_t *dest, od_top_t *src)
+{
+	/* dest has room for the entries of every merged summary, so
+	 * values of a key are summed with their errors */
+	pthread_mutex_lock(&src->lock);
+	int i, j, k;
+	for (i = 0; i < OD_TOP_MAX; i++) {
+		for (j = 0; j < OD_TOP_WEIGHT_MAX; j++) {
+			od_top_summary_t *summary = &src->summary[i][j];
+			for (k = 0; k < summary->count; k++) {
+				od_top_entry_t *entry = &summary->entries[k];
+				od_top_summary_add(&dest->summary[i][j], entry->key,
+				                   entry->text, entry->text_len,
+				                   entry->value, entry->error);
+			}
+		}
+	}
+	pthread_mutex_unlock(&src->lock);
+}
+
+static int
+od_top_cmp(const void *a, const void *b)
+{
+	const od_top_entry_t *ea = a;
+	const od_top_entry_t *eb = b;
+	if (ea->value == eb->value)
+		return 0;
+	return ea->value < eb->value ? 1 : -1;
+}
+
+void
+od_top_sort(od_top_t *top)
+{
+	int i, j;
+	for (i = 0; i < OD_TOP_MAX; i++) {
+		for (j = 0; j < OD_TOP_WEIGHT_MAX; j++) {
+			od_top_summary_t *summary = &top->summary[i][j];
+			qsort(summary->entries, summary->count, sizeof(od_top_entry_t),
+			      od_top_cmp);
+		}
+	}
+}
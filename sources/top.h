@@ -0,0 +1,94 @@
+#ifndef ODYSSEY_TOP_H
+#define ODYSSEY_TOP_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_top_entry   od_top_entry_t;
+typedef struct od_top_summary od_top_summary_t;
+typedef struct od_top         od_top_t;
+
+/* start of the key text kept for display */
+#define OD_TOP_TEXT 64
+
+typedef enum
+{
+	OD_TOP_QUERY,
+	OD_TOP_CLIENT,
+	OD_TOP_USER,
+	OD_TOP_MAX
+} od_top_type_t;
+
+typedef enum
+{
+	OD_TOP_COUNT,
+	OD_TOP_BYTES,
+	OD_TOP_TIME,
+	OD_TOP_WEIGHT_MAX
+} od_top_weight_t;
+
+/* Heavy hitters of every key type by every weight are tracked with
+ * the space-saving algorithm in a fixed number of entries: a key
+ * which is not tracked replaces the smallest entry and inherits its
+ * value as the error bound. A key is reported with value between
+ * value - error and value, keys with weight over 1/size of the total
+ * are always tracked.
+ *
+ * Every worker has its own summaries, updated by the worker and
+ * merged by readers under the lock. */
+
+struct od_top_entry
+{
+	uint64_t key;
+	uint64_t value;
+	uint64_t error;
+	char     text[OD_TOP_TEXT];
+	int      text_len;
+};
+
+struct od_top_summary
+{
+	od_top_entry_t *entries;
+	int             count;
+	int             size;
+};
+
+struct od_top
+{
+	pthread_mutex_t  lock;
+	int              size;
+	od_top_summary_t summary[OD_TOP_MAX][OD_TOP_WEIGHT_MAX];
+};
+
+void od_top_init(od_top_t*);
+int  od_top_prepare(od_top_t*, int);
+void od_top_free(od_top_t*);
+void od_top_add(od_top_t*, od_top_type_t, uint64_t, char*, int,
+                uint64_t[OD_TOP_WEIGHT_MAX]);
+void od_top_merge(od_top_t*, od_top_t*);
+void od_top_sort(od_top_t*);
+
+char *od_top_type_name(od_top_type_t);
+char *od_top_weight_name(od_top_weight_t);
+
+static inline int
+od_top_enabled(od_top_t *top)
+{
+	return top->size > 0;
+}
+
+static inline uint64_t
+od_top_key(char *text, int text_len)
+{
+	/* fnv-1a */
+	uint64_t hash = 14695981039346656037ULL;
+	int i;
+	for (i = 0; i < text_len; i++)
+		hash = (hash ^ (uint8_t)text[i]) * 1099511628211ULL;
+	return hash;
+}
+
+#endif /* ODYSSEY_TOP_H */
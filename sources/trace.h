@@ -0,0 +1,38 @@
+#ifndef ODYSSEY_TRACE_H
+#define ODYSSEY_TRACE_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+/* USDT tracepoints (provider "odyssey").
+ *
+ * Each probe compiles into a single nop plus an ELF note,
+ * arguments are only evaluated into registers, so an
+ * untraced probe costs nothing measurable. Without
+ * USE_USDT the probes are compiled out entirely. */
+
+#ifdef OD_USDT
+#include <sys/sdt.h>
+
+#define od_trace(name) \
+	DTRACE_PROBE(odyssey, name)
+#define od_trace1(name, a) \
+	DTRACE_PROBE1(odyssey, name, a)
+#define od_trace2(name, a, b) \
+	DTRACE_PROBE2(odyssey, name, a, b)
+#define od_trace3(name, a, b, c) \
+	DTRACE_PROBE3(odyssey, name, a, b, c)
+#define od_trace4(name, a, b, c, d) \
+	DTRACE_PROBE4(odyssey, name, a, b, c, d)
+#else
+#define od_trace(name)
+#define od_trace1(name, a)
+#define od_trace2(name, a, b)
+#define od_trace3(name, a, b, c)
+#define od_trace4(name, a, b, c, d)
+#endif
+
+#endif /* ODYSSEY_TRACE_H */
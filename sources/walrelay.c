@@ -0,0 +1,1316 @@
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+/* XLogData: CopyData header, 'w', start, end and send time */
+#define OD_WALRELAY_XLOGDATA    (sizeof(kiwi_header_t) + 1 + 3 * sizeof(uint64_t))
+/* seconds between the unix and postgres epochs */
+#define OD_WALRELAY_EPOCH       946684800ULL
+#define OD_WALRELAY_STATUS_TIME 10000
+#define OD_WALRELAY_WRITE_MAX   (1024 * 1024)
+
+static inline uint64_t
+od_walrelay_read64(char *pos)
+{
+	uint64_t value = 0;
+	int i;
+	for (i = 0; i < 8; i++)
+		value = (value << 8) | (uint8_t)pos[i];
+	return value;
+}
+
+static inline void
+od_walrelay_write64(char *pos, uint64_t value)
+{
+	int i;
+	for (i = 7; i >= 0; i--) {
+		pos[i] = value & 0xff;
+		value >>= 8;
+	}
+}
+
+static inline uint64_t
+od_walrelay_align(uint64_t size)
+{
+	return (size + 7) & ~7ULL;
+}
+
+static inline void
+od_walrelay_skip_space(char **pos, char *end)
+{
+	while (*pos < end && isspace((unsigned char)**pos))
+		(*pos)++;
+}
+
+static inline int
+od_walrelay_keyword(char **pos, char *end, char *keyword, int len)
+{
+	if (end - *pos < len || strncasecmp(*pos, keyword, len) != 0)
+		return 0;
+	if (*pos + len < end &&
+	    (isalnum((unsigned char)(*pos)[len]) || (*pos)[len] == '_'))
+		return 0;
+	*pos += len;
+	return 1;
+}
+
+static inline int
+od_walrelay_hex(char **pos, char *end, uint32_t *value)
+{
+	int digits = 0;
+	*value = 0;
+	while (*pos < end && isxdigit((unsigned char)**pos)) {
+		if (digits == 8)
+			return -1;
+		char c = tolower((unsigned char)**pos);
+		*value = (*value << 4) | (isdigit((unsigned char)c) ? c - '0' : c - 'a' + 10);
+		digits++;
+		(*pos)++;
+	}
+	return digits > 0 ? 0 : -1;
+}
+
+static inline int
+od_walrelay_lsn(char **pos, char *end, uint64_t *lsn)
+{
+	uint32_t hi, lo;
+	if (od_walrelay_hex(pos, end, &hi) == -1)
+		return -1;
+	if (*pos == end || **pos != '/')
+		return -1;
+	(*pos)++;
+	if (od_walrelay_hex(pos, end, &lo) == -1)
+		return -1;
+	*lsn = ((uint64_t)hi << 32) | lo;
+	return 0;
+}
+
+int
+od_walrelay_parse(char *query, int len, int *start, uint64_t *lsn, uint32_t *tli)
+{
+	/* IDENTIFY_SYSTEM or START_REPLICATION [PHYSICAL] lsn
+	 * [TIMELINE tli]. Slots, logical replication and anything else
+	 * are left to the server */
+	char *pos = query;
+	char *end = query + len;
+	while (end > pos && (end[-1] == '\0' || end[-1] == ';' ||
+	                     isspace((unsigned char)end[-1])))
+		end--;
+	od_walrelay_skip_space(&pos, end);
+	if (od_walrelay_keyword(&pos, end, "identify_system", 15)) {
+		od_walrelay_skip_space(&pos, end);
+		if (pos != end)
+			return -1;
+		*start = 0;
+		return 0;
+	}
+	if (! od_walrelay_keyword(&pos, end, "start_replication", 17))
+		return -1;
+	od_walrelay_skip_space(&pos, end);
+	if (od_walrelay_keyword(&pos, end, "physical", 8))
+		od_walrelay_skip_space(&pos, end);
+	if (od_walrelay_lsn(&pos, end, lsn) == -1 || *lsn == 0)
+		return -1;
+	od_walrelay_skip_space(&pos, end);
+	*tli = 0;
+	if (od_walrelay_keyword(&pos, end, "timeline", 8)) {
+		od_walrelay_skip_space(&pos, end);
+		int digits = 0;
+		while (pos < end && isdigit((unsigned char)*pos)) {
+			if (digits == 9)
+				return -1;
+			*tli = *tli * 10 + (*pos - '0');
+			digits++;
+			pos++;
+		}
+		if (digits == 0)
+			return -1;
+		od_walrelay_skip_space(&pos, end);
+	}
+	if (pos != end)
+		return -1;
+	*start = 1;
+	return 0;
+}
+
+static inline int
+od_walrelay_ring_create(od_walrelay_t *relay, od_rule_t *rule)
+{
+	/* the ring is kept in the page cache of an unlinked file of
+	 * pool_wal_relay_dir, or in anonymous memory */
+	uint64_t size = rule->pool_wal_relay_size;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	int fd = -1;
+	if (rule->pool_wal_relay_dir) {
+		char path[PATH_MAX];
+		od_snprintf(path, sizeof(path), "%s/odyssey-wal-XXXXXX",
+		            rule->pool_wal_relay_dir);
+		fd = mkstemp(path);
+		if (fd == -1)
+			return -1;
+		unlink(path);
+		if (ftruncate(fd, size) == -1) {
+			close(fd);
+			return -1;
+		}
+		flags = MAP_SHARED;
+	}
+	char *ring;
+	ring = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+	if (fd != -1)
+		close(fd);
+	if (ring == MAP_FAILED)
+		return -1;
+	relay->ring      = ring;
+	relay->ring_size = size;
+	return 0;
+}
+
+void
+od_walrelay_free(od_walrelay_t *relay)
+{
+	/* route is freed without clients, so the relay is stopped */
+	if (relay->identify_desc)
+		machine_msg_free(relay->identify_desc);
+	if (relay->ring)
+		munmap(relay->ring, relay->ring_size);
+	if (relay->channel)
+		machine_channel_free(relay->channel);
+	pthread_rwlock_destroy(&relay->lock);
+}
+
+static inline void
+od_walrelay_wakeup(od_walrelay_t *relay)
+{
+	machine_msg_t *msg;
+	msg = machine_msg_create(0);
+	if (msg == NULL)
+		return;
+	machine_msg_set_type(msg, OD_MSG_WALRELAY_CHANGE);
+	machine_channel_write(relay->channel, msg);
+}
+
+static inline void
+od_walrelay_notify(od_walrelay_t *relay, od_walrelay_sub_state_t state)
+{
+	/* wakeup clients waiting in the state, relay must be locked
+	 * for write */
+	od_list_t *i;
+	od_list_foreach(&relay->subs, i) {
+		od_walrelay_sub_t *sub;
+		sub = od_container_of(i, od_walrelay_sub_t, link);
+		if (sub->state != state)
+			continue;
+		if (state == OD_WALRELAY_SUB_STREAM) {
+			if (! sub->waiting)
+				continue;
+			sub->waiting = 0;
+		} else {
+			sub->ready = 1;
+		}
+		od_client_notify(sub->client);
+	}
+}
+
+static inline void
+od_walrelay_reset(od_walrelay_t *relay)
+{
+	/* relay must be locked for write */
+	relay->running    = 0;
+	relay->identified = 0;
+	relay->streaming  = 0;
+	relay->reply      = 0;
+	relay->start_lsn  = 0;
+}
+
+static inline void
+od_walrelay_fail(od_walrelay_t *relay)
+{
+	/* waiting clients get a server connection of their own, the
+	 * streaming ones are disconnected */
+	pthread_rwlock_wrlock(&relay->lock);
+	od_list_t *i;
+	od_list_foreach(&relay->subs, i) {
+		od_walrelay_sub_t *sub;
+		sub = od_container_of(i, od_walrelay_sub_t, link);
+		switch (sub->state) {
+		case OD_WALRELAY_SUB_STREAM:
+			od_client_kill(sub->client);
+			break;
+		case OD_WALRELAY_SUB_IDENTIFY:
+		case OD_WALRELAY_SUB_START:
+			sub->ready = 1;
+			od_client_notify(sub->client);
+			break;
+		default:
+			break;
+		}
+		sub->state = OD_WALRELAY_SUB_FALLBACK;
+	}
+	od_walrelay_reset(relay);
+	pthread_rwlock_unlock(&relay->lock);
+}
+
+static inline void
+od_walrelay_evict(od_walrelay_t *relay, uint64_t tail)
+{
+	/* oldest records are dropped until the ring has room up to
+	 * tail, relay must be locked for write */
+	uint64_t size = relay->ring_size;
+	while (tail - relay->head > size) {
+		uint64_t offset = relay->head % size;
+		od_walrelay_record_t *record;
+		record = (od_walrelay_record_t*)(relay->ring + offset);
+		if (offset + sizeof(*record) > size || record->size == 0) {
+			relay->head += size - offset;
+			continue;
+		}
+		if (record->wal)
+			relay->lsn_head = record->lsn + record->size - record->wal;
+		relay->head += od_walrelay_align(sizeof(*record) + record->size);
+	}
+
+	/* clients behind the ring are disconnected */
+	od_list_t *i;
+	od_list_foreach(&relay->subs, i) {
+		od_walrelay_sub_t *sub;
+		sub = od_container_of(i, od_walrelay_sub_t, link);
+		if (sub->state != OD_WALRELAY_SUB_STREAM || sub->lagged)
+			continue;
+		if (sub->pos >= relay->head)
+			continue;
+		sub->lagged = 1;
+		od_client_notify(sub->client);
+	}
+}
+
+static inline int
+od_walrelay_append(od_walrelay_hub_t *hub, kiwi_header_t *header, uint32_t size)
+{
+	/* CopyData of the stream is read directly into the ring */
+	od_walrelay_t *relay = hub->relay;
+	od_server_t *server = hub->client->server;
+	od_instance_t *instance = server->global->instance;
+
+	uint32_t packet_size = sizeof(kiwi_header_t) + size;
+	uint64_t need;
+	need = od_walrelay_align(sizeof(od_walrelay_record_t) + packet_size);
+	if (need > relay->ring_size / 4) {
+		od_error(&instance->logger, "walrelay", hub->client, server,
+		         "packet of %" PRIu32 " bytes is too large for pool_wal_relay_size",
+		         packet_size);
+		return -1;
+	}
+
+	pthread_rwlock_wrlock(&relay->lock);
+	uint64_t offset = relay->tail % relay->ring_size;
+	uint64_t skip = 0;
+	if (offset + need > relay->ring_size)
+		skip = relay->ring_size - offset;
+	od_walrelay_evict(relay, relay->tail + skip + need);
+	if (skip > 0) {
+		/* records are contiguous, the end of the ring is skipped */
+		if (skip >= sizeof(od_walrelay_record_t)) {
+			od_walrelay_record_t *mark;
+			mark = (od_walrelay_record_t*)(relay->ring + offset);
+			mark->size = 0;
+			mark->wal  = 0;
+			mark->lsn  = 0;
+		}
+		relay->tail += skip;
+		offset = 0;
+	}
+	pthread_rwlock_unlock(&relay->lock);
+
+	/* space past the tail is not read by clients */
+	od_walrelay_record_t *record;
+	record = (od_walrelay_record_t*)(relay->ring + offset);
+	char *packet = (char*)(record + 1);
+	memcpy(packet, header, sizeof(kiwi_header_t));
+	int rc;
+	rc = od_io_read(&server->io, packet + sizeof(kiwi_header_t), size, UINT32_MAX);
+	if (rc == -1) {
+		if (! machine_cancelled())
+			od_error(&instance->logger, "walrelay", hub->client, server,
+			         "read error: %s",
+			         od_io_error(&server->io));
+		return -1;
+	}
+	record->size = packet_size;
+	record->wal  = 0;
+	record->lsn  = 0;
+
+	char *payload = packet + sizeof(kiwi_header_t);
+	int reply = 0;
+	if (packet_size >= OD_WALRELAY_XLOGDATA && *payload == 'w') {
+		record->wal = OD_WALRELAY_XLOGDATA;
+		record->lsn = od_walrelay_read64(payload + 1);
+	} else
+	if (size >= 1 + 2 * sizeof(uint64_t) + 1 && *payload == 'k') {
+		/* keepalive is relayed as well, its reply is sent by the
+		 * relay on behalf of all clients */
+		record->lsn = od_walrelay_read64(payload + 1);
+		reply = payload[1 + 2 * sizeof(uint64_t)];
+	}
+
+	pthread_rwlock_wrlock(&relay->lock);
+	relay->tail += need;
+	if (record->wal)
+		relay->lsn_tail = record->lsn + packet_size - record->wal;
+	if (reply)
+		relay->reply = 1;
+	od_walrelay_notify(relay, OD_WALRELAY_SUB_STREAM);
+	pthread_rwlock_unlock(&relay->lock);
+
+	if (reply)
+		od_walrelay_wakeup(relay);
+	return 0;
+}
+
+static void
+od_walrelay_reader(void *arg)
+{
+	od_walrelay_hub_t *hub = arg;
+	od_client_t *client = hub->client;
+	od_server_t *server = client->server;
+	od_instance_t *instance = server->global->instance;
+
+	for (;;)
+	{
+		kiwi_header_t header;
+		int rc;
+		rc = od_io_read(&server->io, (char*)&header, sizeof(header), UINT32_MAX);
+		if (rc == -1) {
+			if (machine_cancelled())
+				return;
+			od_error(&instance->logger, "walrelay", client, server,
+			         "read error: %s",
+			         od_io_error(&server->io));
+			break;
+		}
+		uint32_t size;
+		rc = kiwi_validate_header((char*)&header, sizeof(header), &size);
+		if (rc == -1) {
+			od_error(&instance->logger, "walrelay", client, server,
+			         "bad server packet");
+			break;
+		}
+		size -= sizeof(uint32_t);
+
+		if (header.type == KIWI_BE_COPY_DATA) {
+			rc = od_walrelay_append(hub, &header, size);
+			if (rc == -1) {
+				if (machine_cancelled())
+					return;
+				break;
+			}
+			continue;
+		}
+
+		/* error or end of the timeline ends the stream */
+		machine_msg_t *msg;
+		msg = machine_msg_create(sizeof(header) + size);
+		if (msg == NULL)
+			break;
+		char *data = machine_msg_data(msg);
+		memcpy(data, &header, sizeof(header));
+		rc = od_io_read(&server->io, data + sizeof(header), size, UINT32_MAX);
+		if (rc == 0) {
+			if (header.type == KIWI_BE_ERROR_RESPONSE)
+				od_backend_error(server, "walrelay", data, sizeof(header) + size);
+			else
+				od_error(&instance->logger, "walrelay", client, server,
+				         "stream ended by %s",
+				         kiwi_be_type_to_string(header.type));
+		}
+		machine_msg_free(msg);
+		if (rc == -1 && machine_cancelled())
+			return;
+		break;
+	}
+
+	hub->failed = 1;
+	hub->reader_id = -1;
+	od_walrelay_wakeup(hub->relay);
+}
+
+static inline int
+od_walrelay_identify_row(char *data, uint32_t size, char *systemid,
+                         uint32_t *timeline, uint64_t *xlogpos)
+{
+	/* systemid, timeline and xlogpos columns */
+	char *pos = data + sizeof(kiwi_header_t);
+	uint32_t pos_size = size - sizeof(kiwi_header_t);
+	uint16_t count;
+	if (kiwi_read16(&count, &pos, &pos_size) == -1 || count < 3)
+		return -1;
+	int i;
+	for (i = 0; i < 3; i++) {
+		char value[OD_WALRELAY_SYSTEMID_MAX];
+		uint32_t len;
+		if (kiwi_read32(&len, &pos, &pos_size) == -1)
+			return -1;
+		if (len >= sizeof(value) || len > pos_size)
+			return -1;
+		memcpy(value, pos, len);
+		value[len] = 0;
+		pos += len;
+		pos_size -= len;
+		char *value_pos = value;
+		switch (i) {
+		case 0:
+			memcpy(systemid, value, len + 1);
+			break;
+		case 1:
+			*timeline = strtoul(value, NULL, 10);
+			break;
+		case 2:
+			if (od_walrelay_lsn(&value_pos, value + len, xlogpos) == -1)
+				return -1;
+			break;
+		}
+	}
+	return 0;
+}
+
+static inline int
+od_walrelay_identify_server(od_walrelay_hub_t *hub)
+{
+	od_walrelay_t *relay = hub->relay;
+	od_client_t *client = hub->client;
+	od_server_t *server = client->server;
+	od_instance_t *instance = server->global->instance;
+
+	machine_msg_t *msg;
+	msg = kiwi_fe_write_query(NULL, "IDENTIFY_SYSTEM", 16);
+	if (msg == NULL)
+		return -1;
+	od_server_sync_request(server, 1);
+	int rc;
+	rc = od_write(&server->io, msg);
+	if (rc == -1) {
+		od_error(&instance->logger, "walrelay", client, server,
+		         "write error: %s",
+		         od_io_error(&server->io));
+		return -1;
+	}
+
+	machine_msg_t *desc = NULL;
+	char systemid[OD_WALRELAY_SYSTEMID_MAX];
+	uint32_t timeline = 0;
+	uint64_t xlogpos = 0;
+	int row = -1;
+	for (;;)
+	{
+		msg = od_read(&server->io, UINT32_MAX);
+		if (msg == NULL) {
+			od_error(&instance->logger, "walrelay", client, server,
+			         "read error: %s",
+			         od_io_error(&server->io));
+			goto error;
+		}
+		char *data = machine_msg_data(msg);
+		int size = machine_msg_size(msg);
+		kiwi_be_type_t type = *data;
+		switch (type) {
+		case KIWI_BE_ROW_DESCRIPTION:
+			if (desc)
+				machine_msg_free(desc);
+			desc = msg;
+			continue;
+		case KIWI_BE_DATA_ROW:
+			row = od_walrelay_identify_row(data, size, systemid, &timeline,
+			                               &xlogpos);
+			break;
+		case KIWI_BE_ERROR_RESPONSE:
+			od_backend_error(server, "walrelay", data, size);
+			machine_msg_free(msg);
+			goto error;
+		case KIWI_BE_READY_FOR_QUERY:
+			od_backend_ready(server, data, size);
+			machine_msg_free(msg);
+			goto done;
+		default:
+			break;
+		}
+		machine_msg_free(msg);
+	}
+
+done:
+	if (desc == NULL || row == -1) {
+		od_error(&instance->logger, "walrelay", client, server,
+		         "unexpected IDENTIFY_SYSTEM reply");
+		goto error;
+	}
+	od_debug(&instance->logger, "walrelay", client, server,
+	         "system %s, timeline %" PRIu32 ", position %X/%X",
+	         systemid, timeline,
+	         (uint32_t)(xlogpos >> 32), (uint32_t)xlogpos);
+
+	pthread_rwlock_wrlock(&relay->lock);
+	if (relay->identify_desc)
+		machine_msg_free(relay->identify_desc);
+	relay->identify_desc = desc;
+	memcpy(relay->systemid, systemid, sizeof(systemid));
+	relay->timeline   = timeline;
+	relay->xlogpos    = xlogpos;
+	relay->identified = 1;
+	od_walrelay_notify(relay, OD_WALRELAY_SUB_IDENTIFY);
+	od_walrelay_notify(relay, OD_WALRELAY_SUB_START);
+	pthread_rwlock_unlock(&relay->lock);
+	return 0;
+
+error:
+	if (desc)
+		machine_msg_free(desc);
+	return -1;
+}
+
+static inline int
+od_walrelay_stream(od_walrelay_hub_t *hub, uint64_t start_lsn, uint32_t timeline)
+{
+	od_walrelay_t *relay = hub->relay;
+	od_client_t *client = hub->client;
+	od_server_t *server = client->server;
+	od_instance_t *instance = server->global->instance;
+	od_route_t *route = client->route;
+	int rc;
+
+	if (relay->ring == NULL) {
+		pthread_rwlock_wrlock(&relay->lock);
+		rc = od_walrelay_ring_create(relay, route->rule);
+		pthread_rwlock_unlock(&relay->lock);
+		if (rc == -1) {
+			od_error(&instance->logger, "walrelay", client, server,
+			         "failed to create ring of %" PRIi64 " bytes: %s",
+			         route->rule->pool_wal_relay_size, strerror(errno));
+			return -1;
+		}
+	}
+
+	char query[128];
+	int query_len;
+	query_len = od_snprintf(query, sizeof(query),
+	                        "START_REPLICATION PHYSICAL %X/%X TIMELINE %" PRIu32,
+	                        (uint32_t)(start_lsn >> 32), (uint32_t)start_lsn,
+	                        timeline);
+	od_debug(&instance->logger, "walrelay", client, server, "%s", query);
+	machine_msg_t *msg;
+	msg = kiwi_fe_write_query(NULL, query, query_len + 1);
+	if (msg == NULL)
+		return -1;
+	rc = od_write(&server->io, msg);
+	if (rc == -1) {
+		od_error(&instance->logger, "walrelay", client, server,
+		         "write error: %s",
+		         od_io_error(&server->io));
+		return -1;
+	}
+
+	for (;;)
+	{
+		msg = od_read(&server->io, UINT32_MAX);
+		if (msg == NULL) {
+			od_error(&instance->logger, "walrelay", client, server,
+			         "read error: %s",
+			         od_io_error(&server->io));
+			return -1;
+		}
+		char *data = machine_msg_data(msg);
+		int size = machine_msg_size(msg);
+		kiwi_be_type_t type = *data;
+		if (type == KIWI_BE_COPY_BOTH_RESPONSE) {
+			machine_msg_free(msg);
+			break;
+		}
+		if (type == KIWI_BE_ERROR_RESPONSE) {
+			od_backend_error(server, "walrelay", data, size);
+			machine_msg_free(msg);
+			return -1;
+		}
+		machine_msg_free(msg);
+	}
+
+	pthread_rwlock_wrlock(&relay->lock);
+	relay->head      = 0;
+	relay->tail      = 0;
+	relay->lsn_head  = start_lsn;
+	relay->lsn_tail  = start_lsn;
+	relay->streaming = 1;
+	od_walrelay_notify(relay, OD_WALRELAY_SUB_START);
+	pthread_rwlock_unlock(&relay->lock);
+	return 0;
+}
+
+static inline int
+od_walrelay_status(od_walrelay_hub_t *hub)
+{
+	/* standby status of the relay: received position, and flush
+	 * position reached by every streaming client */
+	od_walrelay_t *relay = hub->relay;
+	od_server_t *server = hub->client->server;
+	od_instance_t *instance = server->global->instance;
+
+	pthread_rwlock_rdlock(&relay->lock);
+	uint64_t write_lsn = relay->lsn_tail;
+	uint64_t flush_lsn = UINT64_MAX;
+	od_list_t *i;
+	od_list_foreach(&relay->subs, i) {
+		od_walrelay_sub_t *sub;
+		sub = od_container_of(i, od_walrelay_sub_t, link);
+		if (sub->state != OD_WALRELAY_SUB_STREAM)
+			continue;
+		uint64_t lsn = od_atomic_u64_of(&sub->flush_lsn);
+		if (lsn < flush_lsn)
+			flush_lsn = lsn;
+	}
+	pthread_rwlock_unlock(&relay->lock);
+	if (flush_lsn == UINT64_MAX)
+		flush_lsn = 0;
+
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	uint64_t now;
+	now = (tv.tv_sec - OD_WALRELAY_EPOCH) * 1000000ULL + tv.tv_usec;
+
+	int offset;
+	machine_msg_t *msg;
+	msg = kiwi_write_begin(NULL, KIWI_FE_COPY_DATA, &offset);
+	if (msg == NULL)
+		return -1;
+	int size = 1 + 4 * sizeof(uint64_t) + 1;
+	char *pos;
+	pos = machine_msg_reserve(msg, size);
+	if (pos == NULL) {
+		machine_msg_free(msg);
+		return -1;
+	}
+	pos[0] = 'r';
+	od_walrelay_write64(pos + 1,  write_lsn);
+	od_walrelay_write64(pos + 9,  flush_lsn);
+	od_walrelay_write64(pos + 17, flush_lsn);
+	od_walrelay_write64(pos + 25, now);
+	pos[33] = 0;
+	machine_msg_write(msg, NULL, size);
+	kiwi_write_end(msg, offset);
+
+	int rc;
+	rc = od_write(&server->io, msg);
+	if (rc == -1) {
+		od_error(&instance->logger, "walrelay", hub->client, server,
+		         "write error: %s",
+		         od_io_error(&server->io));
+		return -1;
+	}
+	return 0;
+}
+
+static inline int
+od_walrelay_stopped(od_walrelay_t *relay)
+{
+	/* relay stops with the last client */
+	pthread_rwlock_wrlock(&relay->lock);
+	int stop = relay->count == 0;
+	if (stop)
+		od_walrelay_reset(relay);
+	pthread_rwlock_unlock(&relay->lock);
+	return stop;
+}
+
+static void
+od_walrelay_main(void *arg)
+{
+	od_client_t *client = arg;
+	od_global_t *global = client->global;
+	od_instance_t *instance = global->instance;
+	od_router_t *router = global->router;
+	od_route_t *route = client->route;
+	od_walrelay_t *relay = &route->walrelay;
+	od_server_t *server = NULL;
+	machine_msg_t *msg;
+	int rc;
+
+	od_walrelay_hub_t hub = {
+		.relay     = relay,
+		.client    = client,
+		.reader_id = -1,
+		.failed    = 0
+	};
+
+	/* attach the internal client, it keeps the route */
+	od_router_status_t status;
+	status = od_router_attach(router, &instance->config, client, false);
+	if (status != OD_ROUTER_OK)
+		goto unroute;
+	server = client->server;
+
+	if (server->io.io == NULL) {
+		rc = od_backend_connect(server, "walrelay", NULL);
+		if (rc == -1)
+			goto close;
+	}
+
+	rc = od_walrelay_identify_server(&hub);
+	if (rc == -1)
+		goto close;
+
+	/* stream from the earliest position of the first clients */
+	uint64_t start_lsn;
+	uint32_t timeline;
+	for (;;)
+	{
+		if (od_walrelay_stopped(relay))
+			goto stop;
+		pthread_rwlock_rdlock(&relay->lock);
+		start_lsn = relay->start_lsn;
+		timeline  = relay->timeline;
+		pthread_rwlock_unlock(&relay->lock);
+		if (start_lsn)
+			break;
+		msg = machine_channel_read(relay->channel, UINT32_MAX);
+		if (msg)
+			machine_msg_free(msg);
+	}
+
+	rc = od_walrelay_stream(&hub, start_lsn, timeline);
+	if (rc == -1)
+		goto close;
+
+	hub.reader_id = machine_coroutine_create(od_walrelay_reader, &hub);
+	if (hub.reader_id == -1)
+		goto close;
+
+	od_debug(&instance->logger, "walrelay", client, server, "started");
+
+	uint64_t status_time = 0;
+	for (;;)
+	{
+		if (hub.failed)
+			break;
+		if (od_walrelay_stopped(relay))
+			break;
+		pthread_rwlock_wrlock(&relay->lock);
+		int reply = relay->reply;
+		relay->reply = 0;
+		pthread_rwlock_unlock(&relay->lock);
+		uint64_t now = machine_time_ms();
+		if (reply || now - status_time >= OD_WALRELAY_STATUS_TIME) {
+			rc = od_walrelay_status(&hub);
+			if (rc == -1) {
+				hub.failed = 1;
+				break;
+			}
+			status_time = now;
+		}
+		msg = machine_channel_read(relay->channel, OD_WALRELAY_STATUS_TIME);
+		if (msg)
+			machine_msg_free(msg);
+	}
+
+	if (hub.reader_id != -1) {
+		machine_cancel(hub.reader_id);
+		machine_join(hub.reader_id);
+	}
+	if (od_io_read_active(&server->io))
+		od_io_read_stop(&server->io);
+
+	if (hub.failed)
+		goto close;
+
+stop:
+	od_debug(&instance->logger, "walrelay", client, server, "stopped");
+
+	/* replication connection is not reused */
+	od_router_close(router, client);
+	od_router_unroute(router, client);
+	od_client_free(client);
+	return;
+
+close:
+	od_router_close(router, client);
+unroute:
+	od_error(&instance->logger, "walrelay", client, NULL,
+	         "wal relay failed");
+	od_walrelay_fail(relay);
+	od_router_unroute(router, client);
+	od_client_free(client);
+}
+
+static inline int
+od_walrelay_run(od_client_t *client)
+{
+	/* relay runs on the worker of the first client, relay must be
+	 * locked for write */
+	od_instance_t *instance = client->global->instance;
+	od_router_t *router = client->global->router;
+	od_walrelay_t *relay = &((od_route_t*)client->route)->walrelay;
+
+	/* internal client with the route of the replication client */
+	od_client_t *relay_client;
+	relay_client = od_client_allocate();
+	if (relay_client == NULL)
+		return -1;
+	relay_client->global    = client->global;
+	relay_client->worker_id = client->worker_id;
+	od_id_generate(&relay_client->id, "w");
+	kiwi_var_set(&relay_client->startup.user, KIWI_VAR_UNDEF,
+	             client->startup.user.value,
+	             client->startup.user.value_len);
+	kiwi_var_set(&relay_client->startup.database, KIWI_VAR_UNDEF,
+	             client->startup.database.value,
+	             client->startup.database.value_len);
+	kiwi_var_set(&relay_client->startup.replication, KIWI_VAR_UNDEF,
+	             "on", 3);
+	od_router_status_t status;
+	status = od_router_route(router, &instance->config, relay_client);
+	if (status != OD_ROUTER_OK) {
+		od_client_free(relay_client);
+		return -1;
+	}
+	if (relay_client->route != client->route) {
+		od_router_unroute(router, relay_client);
+		od_client_free(relay_client);
+		return -1;
+	}
+
+	int64_t coroutine_id;
+	coroutine_id = machine_coroutine_create(od_walrelay_main, relay_client);
+	if (coroutine_id == -1) {
+		od_router_unroute(router, relay_client);
+		od_client_free(relay_client);
+		return -1;
+	}
+	relay->running = 1;
+	return 0;
+}
+
+static inline od_walrelay_sub_t*
+od_walrelay_subscribe(od_client_t *client)
+{
+	od_walrelay_t *relay = &((od_route_t*)client->route)->walrelay;
+	if (client->wal_sub)
+		return client->wal_sub;
+
+	od_walrelay_sub_t *sub;
+	sub = malloc(sizeof(*sub));
+	if (sub == NULL)
+		return NULL;
+	memset(sub, 0, sizeof(*sub));
+	sub->client = client;
+	sub->state  = OD_WALRELAY_SUB_IDLE;
+	od_list_init(&sub->link);
+
+	pthread_rwlock_wrlock(&relay->lock);
+	if (relay->channel == NULL) {
+		relay->channel = machine_channel_create(1);
+		if (relay->channel == NULL) {
+			pthread_rwlock_unlock(&relay->lock);
+			free(sub);
+			return NULL;
+		}
+	}
+	if (! relay->running) {
+		int rc;
+		rc = od_walrelay_run(client);
+		if (rc == -1) {
+			pthread_rwlock_unlock(&relay->lock);
+			free(sub);
+			return NULL;
+		}
+	}
+	od_list_append(&relay->subs, &sub->link);
+	relay->count++;
+	pthread_rwlock_unlock(&relay->lock);
+
+	client->wal_sub = sub;
+	return sub;
+}
+
+void
+od_walrelay_unsubscribe(od_client_t *client)
+{
+	od_walrelay_sub_t *sub = client->wal_sub;
+	if (sub == NULL)
+		return;
+	od_walrelay_t *relay = &((od_route_t*)client->route)->walrelay;
+	pthread_rwlock_wrlock(&relay->lock);
+	od_list_unlink(&sub->link);
+	relay->count--;
+	if (relay->count == 0 && relay->running)
+		od_walrelay_wakeup(relay);
+	pthread_rwlock_unlock(&relay->lock);
+	if (sub->writing)
+		od_io_write_stop(&client->io);
+	free(sub);
+	client->wal_sub = NULL;
+}
+
+od_status_t
+od_walrelay_identify(od_client_t *client)
+{
+	/* IDENTIFY_SYSTEM is answered from the reply received by the
+	 * relay, with the position it has reached since */
+	od_walrelay_t *relay = &((od_route_t*)client->route)->walrelay;
+	od_walrelay_sub_t *sub;
+	sub = od_walrelay_subscribe(client);
+	if (sub == NULL)
+		return OD_ESERVER_CONNECT;
+
+	pthread_rwlock_wrlock(&relay->lock);
+	if (sub->state == OD_WALRELAY_SUB_FALLBACK) {
+		pthread_rwlock_unlock(&relay->lock);
+		return OD_ESERVER_CONNECT;
+	}
+	if (! relay->identified) {
+		sub->state = OD_WALRELAY_SUB_IDENTIFY;
+		pthread_rwlock_unlock(&relay->lock);
+		return OD_SKIP;
+	}
+	sub->state = OD_WALRELAY_SUB_IDLE;
+	machine_msg_t *stream;
+	stream = machine_msg_create(0);
+	if (stream == NULL) {
+		pthread_rwlock_unlock(&relay->lock);
+		return OD_EOOM;
+	}
+	int rc;
+	rc = machine_msg_write(stream, machine_msg_data(relay->identify_desc),
+	                       machine_msg_size(relay->identify_desc));
+	char systemid[OD_WALRELAY_SYSTEMID_MAX];
+	memcpy(systemid, relay->systemid, sizeof(systemid));
+	uint32_t timeline = relay->timeline;
+	uint64_t xlogpos = relay->xlogpos;
+	if (relay->streaming && relay->lsn_tail > xlogpos)
+		xlogpos = relay->lsn_tail;
+	pthread_rwlock_unlock(&relay->lock);
+	if (rc == -1)
+		goto error;
+
+	char lsn[32];
+	int lsn_len;
+	lsn_len = od_snprintf(lsn, sizeof(lsn), "%X/%X",
+	                      (uint32_t)(xlogpos >> 32), (uint32_t)xlogpos);
+	int offset;
+	machine_msg_t *msg;
+	msg = kiwi_be_write_data_row(stream, &offset);
+	if (msg == NULL)
+		goto error;
+	rc  = kiwi_be_write_data_row_add(stream, offset, systemid, strlen(systemid));
+	rc |= kiwi_be_write_data_row_add_u64(stream, offset, timeline);
+	rc |= kiwi_be_write_data_row_add(stream, offset, lsn, lsn_len);
+	rc |= kiwi_be_write_data_row_add(stream, offset, NULL, -1);
+	if (rc == -1)
+		goto error;
+	msg = kiwi_be_write_complete(stream, "IDENTIFY_SYSTEM", 16);
+	if (msg == NULL)
+		goto error;
+	msg = kiwi_be_write_ready(stream, 'I');
+	if (msg == NULL)
+		goto error;
+	rc = od_write(&client->io, stream);
+	if (rc == -1)
+		return OD_ECLIENT_WRITE;
+	return OD_OK;
+error:
+	machine_msg_free(stream);
+	return OD_EOOM;
+}
+
+od_status_t
+od_walrelay_start(od_client_t *client, uint64_t lsn, uint32_t tli)
+{
+	/* START_REPLICATION is served from the ring while the position
+	 * is not dropped from it */
+	od_walrelay_t *relay = &((od_route_t*)client->route)->walrelay;
+	od_walrelay_sub_t *sub;
+	sub = od_walrelay_subscribe(client);
+	if (sub == NULL)
+		return OD_ESERVER_CONNECT;
+
+	pthread_rwlock_wrlock(&relay->lock);
+	if (sub->state == OD_WALRELAY_SUB_FALLBACK)
+		goto fallback;
+	if (relay->identified && tli && tli != relay->timeline)
+		goto fallback;
+	if (! relay->streaming) {
+		/* the relay streams from the earliest position requested
+		 * before it is started */
+		sub->state = OD_WALRELAY_SUB_START;
+		if (relay->identified &&
+		    (relay->start_lsn == 0 || lsn < relay->start_lsn)) {
+			relay->start_lsn = lsn;
+			od_walrelay_wakeup(relay);
+		}
+		pthread_rwlock_unlock(&relay->lock);
+		return OD_SKIP;
+	}
+	if (lsn < relay->lsn_head)
+		goto fallback;
+	sub->state     = OD_WALRELAY_SUB_STREAM;
+	sub->start_lsn = lsn;
+	sub->start_tli = tli;
+	sub->pos       = relay->head;
+	sub->offset    = 0;
+	sub->head_size = 0;
+	sub->waiting   = 0;
+	sub->lagged    = 0;
+	od_atomic_u64_set(&sub->flush_lsn, 0);
+	pthread_rwlock_unlock(&relay->lock);
+
+	/* CopyBothResponse, stream is written by od_walrelay_step() */
+	int offset;
+	machine_msg_t *msg;
+	msg = kiwi_write_begin(NULL, KIWI_BE_COPY_BOTH_RESPONSE, &offset);
+	if (msg == NULL)
+		return OD_EOOM;
+	char *pos;
+	pos = machine_msg_reserve(msg, 3);
+	if (pos == NULL) {
+		machine_msg_free(msg);
+		return OD_EOOM;
+	}
+	memset(pos, 0, 3);
+	machine_msg_write(msg, NULL, 3);
+	kiwi_write_end(msg, offset);
+	int rc;
+	rc = od_write(&client->io, msg);
+	if (rc == -1)
+		return OD_ECLIENT_WRITE;
+	machine_cond_signal(client->cond);
+	return OD_OK;
+
+fallback:
+	sub->state = OD_WALRELAY_SUB_FALLBACK;
+	pthread_rwlock_unlock(&relay->lock);
+	return OD_ESERVER_CONNECT;
+}
+
+static inline int
+od_walrelay_position(od_walrelay_sub_t *sub, od_walrelay_record_t *record,
+                     char *packet)
+{
+	/* the first packet sent starts at the requested position,
+	 * returns 1 if the packet precedes it */
+	if (! record->wal)
+		return 0;
+	uint64_t len = record->size - record->wal;
+	if (record->lsn + len <= sub->start_lsn)
+		return 1;
+	if (record->lsn < sub->start_lsn) {
+		uint64_t skip = sub->start_lsn - record->lsn;
+		char *pos = sub->head;
+		kiwi_write8(&pos, KIWI_BE_COPY_DATA);
+		kiwi_write32(&pos, OD_WALRELAY_XLOGDATA - sizeof(uint8_t) + len - skip);
+		kiwi_write8(&pos, 'w');
+		od_walrelay_write64(pos, sub->start_lsn);
+		pos += sizeof(uint64_t);
+		/* end of wal and send time of the packet */
+		memcpy(pos, packet + sizeof(kiwi_header_t) + 1 + sizeof(uint64_t),
+		       2 * sizeof(uint64_t));
+		pos += 2 * sizeof(uint64_t);
+		sub->head_size = pos - sub->head;
+		sub->offset = record->wal + skip;
+	}
+	sub->start_lsn = 0;
+	return 0;
+}
+
+od_status_t
+od_walrelay_step(od_client_t *client)
+{
+	/* write packets from the ring to the client socket until it
+	 * is full or the client is caught up */
+	od_walrelay_sub_t *sub = client->wal_sub;
+	od_walrelay_t *relay = &((od_route_t*)client->route)->walrelay;
+
+	pthread_rwlock_rdlock(&relay->lock);
+	if (sub->state != OD_WALRELAY_SUB_STREAM) {
+		int ready = sub->ready;
+		sub->ready = 0;
+		pthread_rwlock_unlock(&relay->lock);
+		/* retry the pending command */
+		if (ready)
+			machine_cond_signal(client->io.on_read);
+		return OD_OK;
+	}
+	if (sub->lagged || sub->pos < relay->head) {
+		sub->lagged = 1;
+		pthread_rwlock_unlock(&relay->lock);
+		return OD_EWALRELAY;
+	}
+
+	uint64_t size = relay->ring_size;
+	od_status_t status = OD_OK;
+	int written = 0;
+	int blocked = 0;
+	while (sub->pos < relay->tail && written < OD_WALRELAY_WRITE_MAX)
+	{
+		uint64_t offset = sub->pos % size;
+		od_walrelay_record_t *record;
+		record = (od_walrelay_record_t*)(relay->ring + offset);
+		if (offset + sizeof(*record) > size || record->size == 0) {
+			sub->pos += size - offset;
+			continue;
+		}
+		char *packet = (char*)(record + 1);
+		if (sub->start_lsn && sub->offset == 0 && sub->head_size == 0) {
+			if (od_walrelay_position(sub, record, packet)) {
+				sub->pos += od_walrelay_align(sizeof(*record) + record->size);
+				continue;
+			}
+		}
+
+		ssize_t rc;
+		if (sub->head_size > 0) {
+			rc = machine_write_raw(client->io.io, sub->head, sub->head_size);
+			if (rc > 0) {
+				written += rc;
+				sub->head_size -= rc;
+				memmove(sub->head, sub->head + rc, sub->head_size);
+				continue;
+			}
+		} else {
+			rc = machine_write_raw(client->io.io, packet + sub->offset,
+			                       record->size - sub->offset);
+			if (rc > 0) {
+				written += rc;
+				sub->offset += rc;
+				if (sub->offset == record->size) {
+					sub->pos += od_walrelay_align(sizeof(*record) + record->size);
+					sub->offset = 0;
+				}
+				continue;
+			}
+		}
+		int errno_ = machine_errno();
+		if (errno_ == EAGAIN || errno_ == EWOULDBLOCK || errno_ == EINTR)
+			blocked = 1;
+		else
+			status = OD_ECLIENT_WRITE;
+		break;
+	}
+	int caught_up = sub->pos == relay->tail;
+	if (caught_up)
+		sub->waiting = 1;
+	pthread_rwlock_unlock(&relay->lock);
+
+	if (status != OD_OK)
+		return status;
+	if (blocked) {
+		if (! sub->writing) {
+			if (od_io_write_start(&client->io) == -1)
+				return OD_ECLIENT_WRITE;
+			sub->writing = 1;
+		}
+		return OD_OK;
+	}
+	if (sub->writing) {
+		od_io_write_stop(&client->io);
+		sub->writing = 0;
+	}
+	/* continue on the next iteration once the write budget is
+	 * used up */
+	if (! caught_up)
+		machine_cond_signal(client->cond);
+	return OD_OK;
+}
+
+void
+od_walrelay_feedback(od_client_t *client, char *data, int size)
+{
+	/* standby status update of the client, hot standby feedback is
+	 * not forwarded */
+	od_walrelay_sub_t *sub = client->wal_sub;
+	if (size < (int)(sizeof(kiwi_header_t) + 1 + 2 * sizeof(uint64_t)))
+		return;
+	char *payload = data + sizeof(kiwi_header_t);
+	if (*payload != 'r')
+		return;
+	od_atomic_u64_set(&sub->flush_lsn,
+	                  od_walrelay_read64(payload + 1 + sizeof(uint64_t)));
+}
+
+od_status_t
+od_walrelay_stop(od_client_t *client)
+{
+	/* CopyDone of the client ends streaming, the packet in progress
+	 * is completed first */
+	od_walrelay_sub_t *sub = client->wal_sub;
+	od_walrelay_t *relay = &((od_route_t*)client->route)->walrelay;
+
+	machine_msg_t *stream;
+	stream = machine_msg_create(0);
+	if (stream == NULL)
+		return OD_EOOM;
+	int rc = 0;
+	pthread_rwlock_wrlock(&relay->lock);
+	if (sub->lagged || sub->pos < relay->head) {
+		sub->lagged = 1;
+		pthread_rwlock_unlock(&relay->lock);
+		machine_msg_free(stream);
+		return OD_EWALRELAY;
+	}
+	if (sub->head_size > 0 || sub->offset > 0) {
+		od_walrelay_record_t *record;
+		record = (od_walrelay_record_t*)(relay->ring + sub->pos % relay->ring_size);
+		char *packet = (char*)(record + 1);
+		if (sub->head_size > 0)
+			rc |= machine_msg_write(stream, sub->head, sub->head_size);
+		rc |= machine_msg_write(stream, packet + sub->offset,
+		                        record->size - sub->offset);
+	}
+	sub->state     = OD_WALRELAY_SUB_IDLE;
+	sub->head_size = 0;
+	sub->offset    = 0;
+	sub->waiting   = 0;
+	pthread_rwlock_unlock(&relay->lock);
+	if (sub->writing) {
+		od_io_write_stop(&client->io);
+		sub->writing = 0;
+	}
+	if (rc == -1) {
+		machine_msg_free(stream);
+		return OD_EOOM;
+	}
+
+	int offset;
+	machine_msg_t *msg;
+	msg = kiwi_write_begin(stream, KIWI_BE_COPY_DONE, &offset);
+	if (msg == NULL)
+		goto error;
+	kiwi_write_end(stream, offset);
+	msg = kiwi_be_write_complete(stream, "START_REPLICATION", 18);
+	if (msg == NULL)
+		goto error;
+	msg = kiwi_be_write_ready(stream, 'I');
+	if (msg == NULL)
+		goto error;
+	rc = od_write(&client->io, stream);
+	if (rc == -1)
+		return OD_ECLIENT_WRITE;
+	return OD_OK;
+error:
+	machine_msg_free(stream);
+	return OD_EOOM;
+}
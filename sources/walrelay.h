@@ -0,0 +1,142 @@
+#ifndef ODYSSEY_WALRELAY_H
+#define ODYSSEY_WALRELAY_H
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+typedef struct od_walrelay_record od_walrelay_record_t;
+typedef struct od_walrelay_sub    od_walrelay_sub_t;
+typedef struct od_walrelay_hub    od_walrelay_hub_t;
+typedef struct od_walrelay        od_walrelay_t;
+
+/* WAL stream fan-out of a pool_wal_relay physical replication route.
+ *
+ * IDENTIFY_SYSTEM and START_REPLICATION of replication clients are
+ * answered by odyssey. The relay coroutine holds one replication
+ * connection of the route, streams from the earliest position
+ * requested by the clients which started it and stores every CopyData
+ * packet of the stream in a bounded ring. Each client writes the
+ * packets to its socket directly from the ring, on its own worker and
+ * at its own pace, and its standby status replies are folded into the
+ * one sent upstream.
+ *
+ * Clients asking for a slot, another timeline or a position which is
+ * not in the ring anymore get a server connection of their own as
+ * before. Clients which fall behind the ring or stream from a lost
+ * relay connection are disconnected and reconnect as replicas do. */
+
+#define OD_WALRELAY_SYSTEMID_MAX 32
+#define OD_WALRELAY_SIZE_MIN     (1024 * 1024)
+
+typedef enum
+{
+	OD_WALRELAY_SUB_IDLE,
+	OD_WALRELAY_SUB_IDENTIFY,
+	OD_WALRELAY_SUB_START,
+	OD_WALRELAY_SUB_STREAM,
+	OD_WALRELAY_SUB_FALLBACK
+} od_walrelay_sub_state_t;
+
+/* ring entry, the CopyData packet follows */
+struct od_walrelay_record
+{
+	uint32_t size;
+	uint32_t wal;
+	uint64_t lsn;
+};
+
+struct od_walrelay_sub
+{
+	od_client_t            *client;
+	od_walrelay_sub_state_t state;
+	uint64_t                start_lsn;
+	uint32_t                start_tli;
+	uint64_t                pos;
+	uint32_t                offset;
+	char                    head[32];
+	int                     head_size;
+	int                     ready;
+	int                     waiting;
+	int                     writing;
+	int                     lagged;
+	od_atomic_u64_t         flush_lsn;
+	od_list_t               link;
+};
+
+/* relay coroutines of one replication connection */
+struct od_walrelay_hub
+{
+	od_walrelay_t *relay;
+	od_client_t   *client;
+	int64_t        reader_id;
+	int            failed;
+};
+
+struct od_walrelay
+{
+	pthread_rwlock_t   lock;
+	int                running;
+	int                identified;
+	int                streaming;
+	int                reply;
+	machine_channel_t *channel;
+	machine_msg_t     *identify_desc;
+	char               systemid[OD_WALRELAY_SYSTEMID_MAX];
+	uint32_t           timeline;
+	uint64_t           xlogpos;
+	uint64_t           start_lsn;
+	uint64_t           lsn_head;
+	uint64_t           lsn_tail;
+	char              *ring;
+	uint64_t           ring_size;
+	uint64_t           head;
+	uint64_t           tail;
+	int                count;
+	od_list_t          subs;
+};
+
+static inline void
+od_walrelay_init(od_walrelay_t *relay)
+{
+	/* clients write from the ring under the read lock, the relay
+	 * must not starve while appending */
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr,
+	                              PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&relay->lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+	relay->running       = 0;
+	relay->identified    = 0;
+	relay->streaming     = 0;
+	relay->reply         = 0;
+	relay->channel       = NULL;
+	relay->identify_desc = NULL;
+	relay->systemid[0]   = 0;
+	relay->timeline      = 0;
+	relay->xlogpos       = 0;
+	relay->start_lsn     = 0;
+	relay->lsn_head      = 0;
+	relay->lsn_tail      = 0;
+	relay->ring          = NULL;
+	relay->ring_size     = 0;
+	relay->head          = 0;
+	relay->tail          = 0;
+	relay->count         = 0;
+	od_list_init(&relay->subs);
+}
+
+void od_walrelay_free(od_walrelay_t*);
+
+int         od_walrelay_parse(char*, int, int*, uint64_t*, uint32_t*);
+od_status_t od_walrelay_identify(od_client_t*);
+od_status_t od_walrelay_start(od_client_t*, uint64_t, uint32_t);
+od_status_t od_walrelay_stop(od_client_t*);
+void        od_walrelay_feedback(od_client_t*, char*, int);
+od_status_t od_walrelay_step(od_client_t*);
+void        od_walrelay_unsubscribe(od_client_t*);
+
+#endif /* ODYSSEY_WALRELAY_H */
@@ -18,40 +18,273 @@
 #include <kiwi.h>
 #include <odyssey.h>
 
+int
+od_worker_client_start(od_worker_t *worker, od_client_t *client)
+{
+	od_instance_t *instance = worker->global->instance;
+	client->global = worker->global;
+	client->worker_clients = &worker->clients;
+	client->worker_id = worker->id;
+
+	/* accept queue to worker latency */
+	if (worker->accept_hgram)
+		od_hgram_add_data_point(worker->accept_hgram,
+		                        machine_time_us() - client->time_accept);
+
+	int64_t coroutine_id;
+	coroutine_id = machine_coroutine_create(od_frontend, client);
+	if (coroutine_id == -1) {
+		od_error(&instance->logger, "worker", client, NULL,
+		         "failed to create coroutine");
+		od_io_close(&client->io);
+		od_client_free(client);
+		return -1;
+	}
+	client->coroutine_id = coroutine_id;
+
+	worker->clients_processed++;
+	return 0;
+}
+
+static inline void
+od_worker_client_resume(od_worker_t *worker, od_client_t *client,
+                        machine_coroutine_t function)
+{
+	od_instance_t *instance = worker->global->instance;
+	od_router_t *router = worker->global->router;
+	client->worker_clients = &worker->clients;
+	client->worker_id = worker->id;
+
+	int64_t coroutine_id;
+	coroutine_id = machine_coroutine_create(function, client);
+	if (coroutine_id == -1) {
+		od_error(&instance->logger, "worker", client, NULL,
+		         "failed to create coroutine");
+		od_router_unroute(router, client);
+		od_atomic_u32_dec(&router->clients);
+		od_io_close(&client->io);
+		machine_notify_free(client->notify);
+		od_client_free(client);
+		return;
+	}
+	client->coroutine_id = coroutine_id;
+}
+
+static inline void
+od_worker_server_close(od_worker_t *worker, od_server_t *server)
+{
+	/* expired server connection kept attached to the worker loop */
+	od_instance_t *instance = worker->global->instance;
+	od_debug(&instance->logger, "expire", NULL, server,
+	         "closing idle server connection (%d secs)",
+	         od_server_idle_time(server, machine_time_us()));
+	od_backend_close_connection(server);
+	od_backend_close(server);
+}
+
+static void
+od_worker_server_connect_main(void *arg)
+{
+	od_server_t *server = arg;
+	od_instance_t *instance = server->global->instance;
+	od_router_t *router = server->global->router;
+
+	/* connection is accounted in servers_routing by the caller */
+	int rc;
+	rc = od_backend_connect(server, "connect", NULL);
+	od_router_routing_done(router);
+	if (rc == -1) {
+		od_error(&instance->logger, "connect", NULL, server,
+		         "failed to open server connection");
+		/* leave the error to a waiting client, as if it has
+		 * tried to connect by itself */
+		server->connect_failed = 1;
+	}
+	od_router_release(router, &instance->config, server);
+}
+
+static inline void
+od_worker_server_connect(od_worker_t *worker, od_server_t *server)
+{
+	od_instance_t *instance = worker->global->instance;
+	int64_t coroutine_id;
+	coroutine_id = machine_coroutine_create(od_worker_server_connect_main, server);
+	if (coroutine_id == -1) {
+		od_error(&instance->logger, "connect", NULL, server,
+		         "failed to start connect coroutine");
+		od_router_routing_done(worker->global->router);
+		server->connect_failed = 1;
+		od_router_release(worker->global->router, &instance->config, server);
+	}
+}
+
+static void
+od_worker_server_check_main(void *arg)
+{
+	od_server_t *server = arg;
+	od_instance_t *instance = server->global->instance;
+	od_router_t *router = server->global->router;
+
+	if (server->io_worker != -1)
+		server->io_worker = -1;
+	else if (od_config_is_multi_workers(&instance->config))
+		od_io_attach(&server->io);
+
+	/* empty query is answered without touching any data */
+	char query[] = "";
+	int rc;
+	rc = od_backend_query(server, "check", query, sizeof(query),
+	                      OD_WORKER_SERVER_CHECK_TIMEOUT);
+	if (rc == -1) {
+		od_log(&instance->logger, "check", NULL, server,
+		       "idle server connection is not alive, closing");
+		od_router_drop(router, server);
+		return;
+	}
+	od_router_release(router, &instance->config, server);
+}
+
+static inline void
+od_worker_server_check(od_worker_t *worker, od_server_t *server)
+{
+	od_instance_t *instance = worker->global->instance;
+	int64_t coroutine_id;
+	coroutine_id = machine_coroutine_create(od_worker_server_check_main, server);
+	if (coroutine_id == -1) {
+		od_error(&instance->logger, "check", NULL, server,
+		         "failed to start check coroutine");
+		od_router_release(worker->global->router, &instance->config, server);
+	}
+}
+
+static inline void
+od_worker_set_affinity(od_worker_t *worker)
+{
+	od_instance_t *instance = worker->global->instance;
+	int cpus[OD_CONFIG_CPUS_MAX];
+	int count;
+	count = od_config_cpus_parse(instance->config.worker_cpus, cpus,
+	                             OD_CONFIG_CPUS_MAX);
+	if (count <= 0)
+		return;
+	int cpu = cpus[worker->id % count];
+	int rc;
+	rc = machine_set_affinity(&cpu, 1);
+	if (rc == -1) {
+		od_error(&instance->logger, "worker", NULL, NULL,
+		         "failed to set worker[%d] affinity to cpu %d: %s",
+		         worker->id, cpu, strerror(machine_errno()));
+		return;
+	}
+	od_log(&instance->logger, "worker", NULL, NULL,
+	       "worker[%d] is bound to cpu %d", worker->id, cpu);
+}
+
 static inline void
 od_worker(void *arg)
 {
 	od_worker_t *worker = arg;
 	od_instance_t *instance = worker->global->instance;
 
+	/* bind worker thread before it allocates any memory, handshake
+	 * workers are left to the scheduler */
+	if (instance->config.worker_cpus && !worker->handshake &&
+	    od_config_is_multi_workers(&instance->config))
+		od_worker_set_affinity(worker);
+
+	worker->loop_stat_time = machine_time_ms();
 	for (;;)
 	{
 		machine_msg_t *msg;
-		msg = machine_channel_read(worker->task_channel, UINT32_MAX);
-		if (msg == NULL)
+		msg = machine_channel_read(worker->task_channel,
+		                           OD_WORKER_LOOP_STAT_INTERVAL);
+		uint64_t now = machine_time_ms();
+		if (now - worker->loop_stat_time >= OD_WORKER_LOOP_STAT_INTERVAL) {
+			machine_stat_loop(&worker->loop_stat);
+			machine_stat_io(&worker->io_stat);
+			worker->loop_stat_time = now;
+		}
+		if (msg == NULL) {
+			if (machine_timedout())
+				continue;
 			break;
+		}
 
 		od_msg_t msg_type;
 		msg_type = machine_msg_type(msg);
 		switch (msg_type) {
 		case OD_MSG_CLIENT_NEW:
+		{
+			/* batch of clients accepted at once */
+			od_client_t **clients = machine_msg_data(msg);
+			int count = machine_msg_size(msg) / sizeof(od_client_t*);
+			int i;
+			for (i = 0; i < count; i++)
+				od_worker_client_start(worker, clients[i]);
+			break;
+		}
+		case OD_MSG_CLIENT_MIGRATE:
 		{
 			od_client_t *client;
 			client = *(od_client_t**)machine_msg_data(msg);
-			client->global = worker->global;
-
+			od_worker_client_resume(worker, client, od_frontend_resume);
+			break;
+		}
+		case OD_MSG_CLIENT_RELAY:
+		{
+			od_client_t *client;
+			client = *(od_client_t**)machine_msg_data(msg);
+			od_worker_client_resume(worker, client, od_frontend_relay);
+			break;
+		}
+		case OD_MSG_CLIENT_MOVE:
+		{
+			od_client_t *client;
+			client = *(od_client_t**)machine_msg_data(msg);
+			od_worker_client_resume(worker, client, od_frontend_move);
+			break;
+		}
+		case OD_MSG_SERVER_CLOSE:
+		{
+			od_server_t *server;
+			server = *(od_server_t**)machine_msg_data(msg);
+			od_worker_server_close(worker, server);
+			break;
+		}
+		case OD_MSG_SERVER_CONNECT:
+		{
+			od_server_t *server;
+			server = *(od_server_t**)machine_msg_data(msg);
+			od_worker_server_connect(worker, server);
+			break;
+		}
+		case OD_MSG_SERVER_CHECK:
+		{
+			od_server_t *server;
+			server = *(od_server_t**)machine_msg_data(msg);
+			od_worker_server_check(worker, server);
+			break;
+		}
+		case OD_MSG_SERVER_NEW:
+		{
+			/* accept connections on the worker own listen socket */
+			od_system_server_t *server;
+			server = *(od_system_server_t**)machine_msg_data(msg);
+			int rc;
+			rc = machine_io_attach(server->io);
+			if (rc == -1) {
+				od_error(&instance->logger, "worker", NULL, NULL,
+				         "failed to attach server io: %s",
+				         machine_error(server->io));
+				break;
+			}
 			int64_t coroutine_id;
-			coroutine_id = machine_coroutine_create(od_frontend, client);
+			coroutine_id = machine_coroutine_create(od_system_server, server);
 			if (coroutine_id == -1) {
-				od_error(&instance->logger, "worker", client, NULL,
-				         "failed to create coroutine");
-				od_io_close(&client->io);
-				od_client_free(client);
-				break;
+				od_error(&instance->logger, "worker", NULL, NULL,
+				         "failed to start server coroutine");
+				machine_io_detach(server->io);
 			}
-			client->coroutine_id = coroutine_id;
-
-			worker->clients_processed++;
 			break;
 		}
 		case OD_MSG_STAT:
@@ -62,23 +295,75 @@ od_worker(void *arg)
 			uint64_t msg_cache_count = 0;
 			uint64_t msg_cache_gc_count = 0;
 			uint64_t msg_cache_size = 0;
+			uint64_t msg_remote_count = 0;
+			uint64_t msg_returned_count = 0;
 			machine_stat(&count_coroutine,
 			             &count_coroutine_cache,
 			             &msg_allocated,
 			             &msg_cache_count,
 			             &msg_cache_gc_count,
-			             &msg_cache_size);
+			             &msg_cache_size,
+			             &msg_remote_count,
+			             &msg_returned_count);
 			od_log(&instance->logger, "stats", NULL, NULL,
-			       "worker[%d]: msg (%" PRIu64 " allocated, %" PRIu64 " cached, %" PRIu64 " freed, %" PRIu64 " cache_size), "
-			       "coroutines (%" PRIu64 " active, %"PRIu64 " cached), clients_processed: %" PRIu64,
+			       "worker[%d]: msg (%" PRIu64 " allocated, %" PRIu64 " cached, %" PRIu64 " freed, %" PRIu64 " cache_size, "
+			       "%" PRIu64 " remote freed, %" PRIu64 " returned), "
+			       "coroutines (%" PRIu64 " active, %"PRIu64 " cached), clients_processed: %" PRIu64 ", clients: %" PRIu32,
 			       worker->id,
 			       msg_allocated,
 			       msg_cache_count,
 			       msg_cache_gc_count,
 			       msg_cache_size,
+			       msg_remote_count,
+			       msg_returned_count,
 			       count_coroutine,
 			       count_coroutine_cache,
-			       worker->clients_processed);
+			       worker->clients_processed,
+			       od_atomic_u32_of(&worker->clients));
+			machine_loop_stat_t *loop_stat = &worker->loop_stat;
+			od_log(&instance->logger, "stats", NULL, NULL,
+			       "worker[%d]: loop (%" PRIu64 " steps, max %" PRIu64 " events, "
+			       "max %" PRIu64 " ready), step (avg %" PRIu64 ", p99 %" PRIu64 ", max %" PRIu64 " usec), "
+			       "timer lag (avg %" PRIu64 ", p99 %" PRIu64 ", max %" PRIu64 " usec), "
+			       "spin (%" PRIu64 " usec, %" PRIu64 " of %" PRIu64 " hit), "
+			       "%" PRIu64 " wakeups of %" PRIu64 " sleeps",
+			       worker->id,
+			       loop_stat->count_step,
+			       loop_stat->events_max,
+			       loop_stat->ready_max,
+			       loop_stat->step_avg_us,
+			       loop_stat->step_p99_us,
+			       loop_stat->step_max_us,
+			       loop_stat->lag_avg_us,
+			       loop_stat->lag_p99_us,
+			       loop_stat->lag_max_us,
+			       loop_stat->spin_us,
+			       loop_stat->count_spin_hit,
+			       loop_stat->count_spin,
+			       loop_stat->count_wakeup,
+			       loop_stat->count_sleep);
+			int id;
+			for (id = 0;; id++) {
+				uint64_t class_size;
+				int rc;
+				rc = machine_stat_msg_class(id, &class_size,
+				                            &msg_allocated,
+				                            &msg_cache_gc_count,
+				                            &msg_cache_count,
+				                            &msg_cache_size);
+				if (rc == -1)
+					break;
+				if (msg_allocated == 0)
+					continue;
+				od_log(&instance->logger, "stats", NULL, NULL,
+				       "worker[%d]: msg_cache_%" PRIu64 " (%" PRIu64 " allocated, %" PRIu64 " cached, %" PRIu64 " freed, %" PRIu64 " cache_size)",
+				       worker->id,
+				       class_size,
+				       msg_allocated,
+				       msg_cache_count,
+				       msg_cache_gc_count,
+				       msg_cache_size);
+			}
 			break;
 		}
 		default:
@@ -97,8 +382,18 @@ od_worker_init(od_worker_t *worker, od_global_t *global, int id)
 {
 	worker->machine = -1;
 	worker->id = id;
+	worker->handshake = 0;
 	worker->global = global;
 	worker->clients_processed = 0;
+	worker->clients = 0;
+	worker->memory = 0;
+	memset(&worker->loop_stat, 0, sizeof(worker->loop_stat));
+	memset(&worker->io_stat, 0, sizeof(worker->io_stat));
+	worker->loop_stat_time = 0;
+	od_fingerprints_init(&worker->fingerprints);
+	od_top_init(&worker->top);
+	worker->accept_hgram = NULL;
+	worker->login_hgram = NULL;
 }
 
 int
@@ -109,6 +404,36 @@ od_worker_start(od_worker_t *worker)
 	int is_shared;
 	is_shared = od_config_is_multi_workers(&instance->config);
 
+	/* queries are relayed by relay workers only */
+	if (instance->config.query_fingerprint && !worker->handshake) {
+		int rc;
+		rc = od_fingerprints_prepare(&worker->fingerprints,
+		                             instance->config.query_fingerprint_max);
+		if (rc == -1) {
+			od_error(&instance->logger, "worker", NULL, NULL,
+			         "failed to allocate query fingerprints");
+			return -1;
+		}
+	}
+	if (instance->config.top_size > 0 && !worker->handshake) {
+		int rc;
+		rc = od_top_prepare(&worker->top, instance->config.top_size);
+		if (rc == -1) {
+			od_error(&instance->logger, "worker", NULL, NULL,
+			         "failed to allocate top summaries");
+			return -1;
+		}
+	}
+	if (instance->config.accept_stats_interval > 0 && !worker->accept_hgram) {
+		worker->accept_hgram = od_hgram_allocate(OD_BACKLOG_HGRAM_PRECISION);
+		worker->login_hgram  = od_hgram_allocate(OD_BACKLOG_HGRAM_PRECISION);
+		if (worker->accept_hgram == NULL || worker->login_hgram == NULL) {
+			od_error(&instance->logger, "worker", NULL, NULL,
+			         "failed to allocate accept histograms");
+			return -1;
+		}
+	}
+
 	worker->task_channel = machine_channel_create(is_shared);
 	if (worker->task_channel == NULL) {
 		od_error(&instance->logger, "worker", NULL, NULL,
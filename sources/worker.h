@@ -13,12 +13,29 @@ struct od_worker
 {
 	int64_t            machine;
 	int                id;
+	int                handshake;
 	machine_channel_t *task_channel;
 	uint64_t           clients_processed;
+	od_atomic_u32_t    clients;
+	od_atomic_u64_t    memory;
+	machine_loop_stat_t loop_stat;
+	machine_io_stat_t  io_stat;
+	uint64_t           loop_stat_time;
+	od_fingerprints_t  fingerprints;
+	od_top_t           top;
+	struct od_hgram   *accept_hgram;
+	struct od_hgram   *login_hgram;
 	od_global_t       *global;
 };
 
+/* event loop and io stats are published by the worker once a second */
+#define OD_WORKER_LOOP_STAT_INTERVAL 1000
+
+/* idle server validation reply timeout, in milliseconds */
+#define OD_WORKER_SERVER_CHECK_TIMEOUT 1000
+
 void od_worker_init(od_worker_t*, od_global_t*, int);
 int  od_worker_start(od_worker_t*);
+int  od_worker_client_start(od_worker_t*, od_client_t*);
 
 #endif /* ODYSSEY_WORKER_H */
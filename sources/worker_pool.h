@@ -7,32 +7,122 @@
  * Scalable PostgreSQL connection pooler.
 */
 
-typedef struct od_worker_pool od_worker_pool_t;
+typedef struct od_worker_group od_worker_group_t;
+typedef struct od_worker_pool  od_worker_pool_t;
+
+/* New clients are passed to the worker with the least number of
+ * clients, ties are resolved in round robin order. Client counter of a
+ * worker is increased right away, so a burst of accepted clients is
+ * spread before workers start them.
+ *
+ * In route placement mode clients are moved after routing to the worker
+ * which owns the route, so its server connections stay attached to one
+ * worker event loop.
+ *
+ * With handshake workers, new clients are started on a separate pool
+ * of workers which completes TLS handshake, routing and authentication,
+ * and then moves the authenticated client to a relay worker. Login bursts
+ * do not add latency to established clients.
+ *
+ * Pool is started with 'workers_max' relay workers, of which first 'count'
+ * receive new clients. The count can be changed on config reload: clients
+ * of removed workers are moved to active ones between transactions, and
+ * listen sockets of removed workers pass accepted clients on.
+ *
+ * Worker groups take the first relay workers, in order of
+ * 'worker_groups', and are fixed on start. Clients of a listen or a
+ * rule with a group are placed only within it, the rule group wins
+ * after routing. Other clients use the remaining workers, which are
+ * the ones resized on reload. */
+
+/* max number of clients passed by one od_worker_pool_feed() call */
+#define OD_WORKER_POOL_FEED_MAX 16
+
+typedef enum
+{
+	OD_WORKER_POOL_LEAST_LOADED,
+	OD_WORKER_POOL_ROUND_ROBIN,
+	OD_WORKER_POOL_ROUTE
+} od_worker_pool_placement_t;
+
+struct od_worker_group
+{
+	char name[OD_CONFIG_WORKER_GROUP_NAME];
+	int  start;
+	int  count;
+	int  round_robin;
+};
 
 struct od_worker_pool
 {
-	od_worker_t *pool;
-	int          round_robin;
-	int          count;
+	od_worker_t                *pool;
+	od_worker_pool_placement_t  placement;
+	int                         round_robin;
+	od_worker_group_t           groups[OD_CONFIG_WORKER_GROUPS_MAX];
+	int                         groups_count;
+	int                         groups_workers;
+	od_atomic_u32_t             count;
+	int                         count_max;
+	od_worker_t                *handshake;
+	int                         handshake_round_robin;
+	int                         handshake_count;
+	od_atomic_u32_t             relay_round_robin;
 };
 
 static inline void
 od_worker_pool_init(od_worker_pool_t *pool)
 {
 	pool->count       = 0;
+	pool->count_max   = 0;
+	pool->placement   = OD_WORKER_POOL_LEAST_LOADED;
 	pool->round_robin = 0;
 	pool->pool        = NULL;
+	pool->groups_count   = 0;
+	pool->groups_workers = 0;
+	pool->handshake   = NULL;
+	pool->handshake_round_robin = 0;
+	pool->handshake_count = 0;
+	pool->relay_round_robin = 0;
 }
 
 static inline int
-od_worker_pool_start(od_worker_pool_t *pool, od_global_t *global, int count)
+od_worker_pool_start(od_worker_pool_t *pool, od_global_t *global, int count,
+                     int count_max)
 {
-	pool->pool = malloc(sizeof(od_worker_t) * count);
+	od_instance_t *instance = global->instance;
+	char *placement = instance->config.client_placement;
+	if (placement && strcmp(placement, "round_robin") == 0)
+		pool->placement = OD_WORKER_POOL_ROUND_ROBIN;
+	if (placement && strcmp(placement, "route") == 0)
+		pool->placement = OD_WORKER_POOL_ROUTE;
+
+	if (instance->config.worker_groups) {
+		od_config_worker_group_t groups[OD_CONFIG_WORKER_GROUPS_MAX];
+		int groups_count;
+		groups_count = od_config_worker_groups_parse(instance->config.worker_groups,
+		                                             groups,
+		                                             OD_CONFIG_WORKER_GROUPS_MAX);
+		if (groups_count == -1)
+			return -1;
+		int i;
+		for (i = 0; i < groups_count; i++) {
+			od_worker_group_t *group = &pool->groups[i];
+			memcpy(group->name, groups[i].name, sizeof(group->name));
+			group->start       = pool->groups_workers;
+			group->count       = groups[i].count;
+			group->round_robin = 0;
+			pool->groups_workers += group->count;
+		}
+		pool->groups_count = groups_count;
+	}
+
+	pool->pool = malloc(sizeof(od_worker_t) * count_max);
 	if (pool->pool == NULL)
 		return -1;
 	pool->count = count;
+	pool->count_max = count_max;
 	int i;
-	for (i = 0; i < count; i++) {
+	for (i = 0; i < count_max; i++) {
 		od_worker_t *worker = &pool->pool[i];
 		od_worker_init(worker, global, i);
 		int rc;
@@ -40,22 +130,311 @@ od_worker_pool_start(od_worker_pool_t *pool, od_global_t *global, int count)
 		if (rc == -1)
 			return -1;
 	}
+
+	int handshake_count = instance->config.handshake_workers;
+	if (handshake_count == 0)
+		return 0;
+	pool->handshake = malloc(sizeof(od_worker_t) * handshake_count);
+	if (pool->handshake == NULL)
+		return -1;
+	pool->handshake_count = handshake_count;
+	for (i = 0; i < handshake_count; i++) {
+		od_worker_t *worker = &pool->handshake[i];
+		od_worker_init(worker, global, count_max + i);
+		worker->handshake = 1;
+		int rc;
+		rc = od_worker_start(worker);
+		if (rc == -1)
+			return -1;
+	}
 	return 0;
 }
 
+static inline int
+od_worker_pool_total(od_worker_pool_t *pool)
+{
+	return pool->count_max + pool->handshake_count;
+}
+
+static inline od_worker_t*
+od_worker_pool_get(od_worker_pool_t *pool, int id)
+{
+	/* relay workers are followed by handshake workers */
+	if (id < pool->count_max)
+		return &pool->pool[id];
+	return &pool->handshake[id - pool->count_max];
+}
+
+static inline int
+od_worker_pool_count(od_worker_pool_t *pool)
+{
+	/* changed by the housekeeping machine on reload */
+	return od_atomic_u32_of(&pool->count);
+}
+
 static inline void
-od_worker_pool_feed(od_worker_pool_t *pool, machine_msg_t *msg)
+od_worker_pool_resize(od_worker_pool_t *pool, int count)
+{
+	assert(count > 0 && count <= pool->count_max);
+	od_atomic_u32_set(&pool->count, count);
+}
+
+static inline int
+od_worker_pool_is_active(od_worker_pool_t *pool, int worker_id)
+{
+	return worker_id >= 0 && worker_id < od_worker_pool_count(pool);
+}
+
+static inline int
+od_worker_pool_is_removed(od_worker_pool_t *pool, int worker_id)
+{
+	return worker_id >= od_worker_pool_count(pool) &&
+	       worker_id < pool->count_max;
+}
+
+static inline od_worker_group_t*
+od_worker_pool_group(od_worker_pool_t *pool, char *name)
+{
+	/* groups added on reload are unknown until restart, their
+	 * clients use the remaining workers */
+	if (name == NULL)
+		return NULL;
+	int i;
+	for (i = 0; i < pool->groups_count; i++) {
+		if (strcmp(pool->groups[i].name, name) == 0)
+			return &pool->groups[i];
+	}
+	return NULL;
+}
+
+static inline od_worker_group_t*
+od_worker_pool_group_of(od_worker_pool_t *pool, od_client_t *client)
+{
+	od_worker_group_t *group = NULL;
+	if (client->rule)
+		group = od_worker_pool_group(pool, client->rule->worker_group);
+	if (group == NULL && client->config_listen)
+		group = od_worker_pool_group(pool, client->config_listen->worker_group);
+	return group;
+}
+
+static inline int
+od_worker_pool_range(od_worker_pool_t *pool, od_worker_group_t *group,
+                     int *count)
+{
+	/* first worker and number of workers of the group, NULL is the
+	 * group of remaining workers */
+	if (group) {
+		*count = group->count;
+		return group->start;
+	}
+	*count = od_worker_pool_count(pool) - pool->groups_workers;
+	return pool->groups_workers;
+}
+
+static inline int
+od_worker_pool_is_member(od_worker_pool_t *pool, od_worker_group_t *group,
+                         int worker_id)
+{
+	int count;
+	int start = od_worker_pool_range(pool, group, &count);
+	return worker_id >= start && worker_id < start + count;
+}
+
+static inline od_worker_t*
+od_worker_pool_next(od_worker_t *workers, int count, int *round_robin,
+                    int least_loaded)
 {
-	int next = pool->round_robin;
-	if (pool->round_robin >= pool->count) {
-		pool->round_robin = 0;
+	/* counter is read once, workers with per-worker listen sockets
+	 * feed the pool concurrently */
+	int next = *round_robin;
+	if (next >= count)
 		next = 0;
+	*round_robin = next + 1;
+
+	if (least_loaded) {
+		uint32_t min = od_atomic_u32_of(&workers[next].clients);
+		int i;
+		for (i = 1; i < count && min > 0; i++) {
+			int id = (next + i) % count;
+			uint32_t clients = od_atomic_u32_of(&workers[id].clients);
+			if (clients < min) {
+				min = clients;
+				next = id;
+			}
+		}
 	}
-	pool->round_robin++;
+	return &workers[next];
+}
 
-	od_worker_t *worker;
-	worker = &pool->pool[next];
+static inline void
+od_worker_pool_feed(od_worker_pool_t *pool, od_worker_group_t *group,
+                    od_client_t **clients, int count)
+{
+	/* clients passed to the same worker share one message */
+	od_worker_t   *workers[OD_WORKER_POOL_FEED_MAX];
+	machine_msg_t *msgs[OD_WORKER_POOL_FEED_MAX];
+	int            workers_count = 0;
+	assert(count <= OD_WORKER_POOL_FEED_MAX);
+	int  group_count;
+	int  group_start = od_worker_pool_range(pool, group, &group_count);
+	int *round_robin = group ? &group->round_robin : &pool->round_robin;
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		od_worker_t *worker;
+		if (pool->handshake_count > 0)
+			worker = od_worker_pool_next(pool->handshake, pool->handshake_count,
+			                             &pool->handshake_round_robin, 1);
+		else
+			worker = od_worker_pool_next(pool->pool + group_start, group_count,
+			                             round_robin,
+			                             pool->placement != OD_WORKER_POOL_ROUND_ROBIN);
+		od_atomic_u32_inc(&worker->clients);
+
+		int j;
+		for (j = 0; j < workers_count; j++)
+			if (workers[j] == worker)
+				break;
+		if (j == workers_count) {
+			msgs[j] = machine_msg_create(0);
+			machine_msg_set_type(msgs[j], OD_MSG_CLIENT_NEW);
+			workers[j] = worker;
+			workers_count++;
+		}
+		machine_msg_write(msgs[j], &clients[i], sizeof(od_client_t*));
+	}
+	for (i = 0; i < workers_count; i++)
+		machine_channel_write(workers[i]->task_channel, msgs[i]);
+}
+
+static inline od_worker_t*
+od_worker_pool_route(od_worker_pool_t *pool, od_route_t *route)
+{
+	/* route is owned by a worker of the rule group */
+	od_worker_group_t *group;
+	group = od_worker_pool_group(pool, route->rule->worker_group);
+	int count;
+	int start = od_worker_pool_range(pool, group, &count);
+	return &pool->pool[start + route->hash % count];
+}
+
+static inline int
+od_worker_pool_is_handshake(od_worker_pool_t *pool, od_client_t *client)
+{
+	return client->worker_id >= pool->count_max;
+}
+
+static inline od_worker_t*
+od_worker_pool_pick(od_worker_pool_t *pool, od_worker_group_t *group)
+{
+	/* can be called by workers concurrently */
+	int count;
+	int start = od_worker_pool_range(pool, group, &count);
+	int round_robin;
+	round_robin = od_atomic_u32_inc(&pool->relay_round_robin) % count;
+	return od_worker_pool_next(pool->pool + start, count, &round_robin,
+	                           pool->placement != OD_WORKER_POOL_ROUND_ROBIN);
+}
+
+static inline od_worker_t*
+od_worker_pool_relay(od_worker_pool_t *pool, od_client_t *client)
+{
+	/* relay worker for a client authenticated by a handshake worker,
+	 * moved from a removed worker or routed outside of its group */
+	if (pool->placement == OD_WORKER_POOL_ROUTE)
+		return od_worker_pool_route(pool, client->route);
+	return od_worker_pool_pick(pool, od_worker_pool_group_of(pool, client));
+}
+
+static inline int
+od_worker_pool_connect(od_worker_pool_t *pool, od_server_t *server)
+{
+	/* server connection is established by the worker which
+	 * owns its idle sub-pool */
+	machine_msg_t *msg;
+	msg = machine_msg_create(sizeof(od_server_t*));
+	if (msg == NULL)
+		return -1;
+	machine_msg_set_type(msg, OD_MSG_SERVER_CONNECT);
+	memcpy(machine_msg_data(msg), &server, sizeof(od_server_t*));
+	int id = server->pool_worker < 0 ? 0 : server->pool_worker;
+	od_worker_t *worker = od_worker_pool_get(pool, id % od_worker_pool_total(pool));
 	machine_channel_write(worker->task_channel, msg);
+	return 0;
+}
+
+static inline int
+od_worker_pool_check(od_worker_pool_t *pool, od_server_t *server)
+{
+	/* idle server kept attached to a worker loop is validated by
+	 * that worker */
+	machine_msg_t *msg;
+	msg = machine_msg_create(sizeof(od_server_t*));
+	if (msg == NULL)
+		return -1;
+	machine_msg_set_type(msg, OD_MSG_SERVER_CHECK);
+	memcpy(machine_msg_data(msg), &server, sizeof(od_server_t*));
+	int id = server->io_worker;
+	if (id == -1)
+		id = server->pool_worker < 0 ? 0 : server->pool_worker;
+	od_worker_t *worker = od_worker_pool_get(pool, id % od_worker_pool_total(pool));
+	machine_channel_write(worker->task_channel, msg);
+	return 0;
+}
+
+static inline int
+od_worker_pool_is_route_affine(od_worker_pool_t *pool, od_client_t *client)
+{
+	if (pool->placement != OD_WORKER_POOL_ROUTE || client->worker_id == -1)
+		return 0;
+	od_worker_t *worker;
+	worker = od_worker_pool_route(pool, client->route);
+	return worker->id == client->worker_id;
+}
+
+static inline int
+od_worker_pool_fingerprints(od_worker_pool_t *pool, od_fingerprints_t *dest,
+                            int max)
+{
+	/* merge tables of all workers, sorted by total time */
+	int total = od_worker_pool_total(pool);
+	int rc;
+	rc = od_fingerprints_prepare(dest, max * total);
+	if (rc == -1)
+		return -1;
+	int i;
+	for (i = 0; i < total; i++) {
+		od_worker_t *worker = od_worker_pool_get(pool, i);
+		if (! od_fingerprints_enabled(&worker->fingerprints))
+			continue;
+		rc = od_fingerprints_merge(dest, &worker->fingerprints);
+		if (rc == -1)
+			return -1;
+	}
+	od_fingerprints_sort(dest);
+	for (i = 0; i < dest->count; i++)
+		od_hgram_freeze(dest->entries[i].hgram, NULL, 0);
+	return 0;
+}
+
+static inline int
+od_worker_pool_top(od_worker_pool_t *pool, od_top_t *dest, int size)
+{
+	/* merge summaries of all workers, sorted by value */
+	int total = od_worker_pool_total(pool);
+	int rc;
+	rc = od_top_prepare(dest, size * total);
+	if (rc == -1)
+		return -1;
+	int i;
+	for (i = 0; i < total; i++) {
+		od_worker_t *worker = od_worker_pool_get(pool, i);
+		if (od_top_enabled(&worker->top))
+			od_top_merge(dest, &worker->top);
+	}
+	od_top_sort(dest);
+	return 0;
 }
 
 #endif /* ODYSSEY_WORKER_POOL_H */
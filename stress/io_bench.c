@@ -0,0 +1,419 @@
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+/* machinarium io throughput benchmarks.
+ *
+ * Every benchmark streams a fixed amount of data over a loopback
+ * tcp connection, the way the 10mb read tests do, with the reader
+ * and the writer either in the same machine or in two machines.
+ * Messages are written one by one or as iov batches and read one
+ * message at a time. Syscalls are the read and write ones of the
+ * process, taken from /proc/self/io. */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include <machinarium.h>
+#include <sources/hgram.h>
+
+typedef struct {
+	char *name;
+	int   tls;
+	int   size;
+	int   iov;
+	int   machines;
+} io_bench_t;
+
+typedef struct {
+	int      total_mb;
+	char    *filter;
+	char    *tls_dir;
+} io_bench_config_t;
+
+typedef struct {
+	io_bench_t        *bench;
+	io_bench_config_t *config;
+	int                port;
+	uint64_t           count;
+	uint64_t           time_ns;
+	uint64_t           syscalls;
+	od_hgram_t        *hgram;
+	int                error;
+} io_bench_run_t;
+
+static inline uint64_t
+io_bench_time_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * (uint64_t)1000000000 + t.tv_nsec;
+}
+
+static uint64_t
+io_bench_syscalls(void)
+{
+	FILE *file = fopen("/proc/self/io", "r");
+	if (file == NULL)
+		return 0;
+	uint64_t total = 0;
+	char line[128];
+	while (fgets(line, sizeof(line), file)) {
+		uint64_t value;
+		if (sscanf(line, "syscr: %" SCNu64, &value) == 1 ||
+		    sscanf(line, "syscw: %" SCNu64, &value) == 1)
+			total += value;
+	}
+	fclose(file);
+	return total;
+}
+
+static machine_tls_t*
+io_bench_tls(io_bench_run_t *run, int client)
+{
+	char path[256];
+	machine_tls_t *tls = machine_tls_create();
+	if (tls == NULL)
+		return NULL;
+	int rc;
+	rc = machine_tls_set_verify(tls, "none");
+	if (rc == -1)
+		goto error;
+	snprintf(path, sizeof(path), "%s/ca.crt", run->config->tls_dir);
+	rc = machine_tls_set_ca_file(tls, path);
+	if (rc == -1)
+		goto error;
+	snprintf(path, sizeof(path), "%s/%s.crt", run->config->tls_dir,
+	         client ? "client" : "server");
+	rc = machine_tls_set_cert_file(tls, path);
+	if (rc == -1)
+		goto error;
+	snprintf(path, sizeof(path), "%s/%s.key", run->config->tls_dir,
+	         client ? "client" : "server");
+	rc = machine_tls_set_key_file(tls, path);
+	if (rc == -1)
+		goto error;
+	rc = machine_tls_create_context(tls, client);
+	if (rc == -1)
+		goto error;
+	return tls;
+error:
+	machine_tls_free(tls);
+	return NULL;
+}
+
+static int
+io_bench_write_iov(machine_io_t *io, machine_cond_t *cond, char *data,
+                   io_bench_t *bench, uint64_t count)
+{
+	machine_iov_t *iov = machine_iov_create();
+	if (iov == NULL)
+		return -1;
+	int rc = machine_write_start(io, cond);
+	if (rc == -1)
+		goto done;
+	uint64_t sent = 0;
+	while (sent < count) {
+		int i;
+		for (i = 0; i < bench->iov && sent < count; i++, sent++) {
+			rc = machine_iov_add_pointer(iov, data, bench->size);
+			if (rc == -1)
+				goto done;
+		}
+		while (machine_iov_pending(iov)) {
+			rc = machine_writev_raw(io, iov);
+			if (rc > 0)
+				continue;
+			int errno_ = machine_errno();
+			if (rc == -1 && (errno_ == EAGAIN || errno_ == EWOULDBLOCK ||
+			                 errno_ == EINTR)) {
+				machine_cond_wait(cond, UINT32_MAX);
+				continue;
+			}
+			rc = -1;
+			goto done;
+		}
+	}
+	rc = 0;
+done:
+	machine_write_stop(io);
+	machine_iov_free(iov);
+	return rc;
+}
+
+static void
+io_bench_writer(void *arg)
+{
+	io_bench_run_t *run = arg;
+	io_bench_t *bench = run->bench;
+	machine_io_t *io = machine_io_create();
+	machine_cond_t *cond = machine_cond_create();
+	char *data = malloc(bench->size);
+	machine_tls_t *tls = NULL;
+	if (io == NULL || cond == NULL || data == NULL)
+		goto error;
+	memset(data, 'x', bench->size);
+
+	struct sockaddr_in sa;
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = inet_addr("127.0.0.1");
+	sa.sin_port = htons(run->port);
+	int rc;
+	rc = machine_connect(io, (struct sockaddr*)&sa, UINT32_MAX);
+	if (rc == -1)
+		goto error;
+	if (bench->tls) {
+		tls = io_bench_tls(run, 1);
+		if (tls == NULL)
+			goto error;
+		rc = machine_set_tls(io, tls, UINT32_MAX);
+		if (rc == -1)
+			goto error;
+	}
+
+	if (bench->iov > 0) {
+		rc = io_bench_write_iov(io, cond, data, bench, run->count);
+		if (rc == -1)
+			goto error;
+	} else {
+		uint64_t i;
+		for (i = 0; i < run->count; i++) {
+			machine_msg_t *msg;
+			msg = machine_msg_create(bench->size);
+			if (msg == NULL)
+				goto error;
+			memcpy(machine_msg_data(msg), data, bench->size);
+			rc = machine_write(io, msg, UINT32_MAX);
+			if (rc == -1)
+				goto error;
+		}
+	}
+
+	/* closing with unread data, like tls session tickets, resets
+	 * the connection, so wait for the reader to close first */
+	for (;;) {
+		machine_msg_t *msg;
+		msg = machine_read(io, 1, UINT32_MAX);
+		if (msg == NULL)
+			break;
+		machine_msg_free(msg);
+	}
+	goto done;
+error:
+	printf("%s: writer error: %s\n", bench->name,
+	       io ? machine_error(io) : "out of memory");
+	run->error = 1;
+done:
+	if (io) {
+		machine_close(io);
+		machine_io_free(io);
+	}
+	if (tls)
+		machine_tls_free(tls);
+	if (cond)
+		machine_cond_free(cond);
+	free(data);
+}
+
+static void
+io_bench_reader(void *arg)
+{
+	io_bench_run_t *run = arg;
+	io_bench_t *bench = run->bench;
+	machine_io_t *server = machine_io_create();
+	machine_io_t *io = NULL;
+	machine_tls_t *tls = NULL;
+	int64_t writer = -1;
+	if (server == NULL)
+		goto error;
+
+	struct sockaddr_in sa;
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = inet_addr("127.0.0.1");
+	sa.sin_port = 0;
+	int rc;
+	rc = machine_bind(server, (struct sockaddr*)&sa);
+	if (rc == -1)
+		goto error;
+	int sa_len = sizeof(sa);
+	rc = machine_getsockname(server, (struct sockaddr*)&sa, &sa_len);
+	if (rc == -1)
+		goto error;
+	run->port = ntohs(sa.sin_port);
+
+	if (bench->machines == 1)
+		writer = machine_coroutine_create(io_bench_writer, run);
+	else
+		writer = machine_create("io_bench_writer", io_bench_writer, run);
+	if (writer == -1)
+		goto error;
+
+	rc = machine_accept(server, &io, 16, 1, UINT32_MAX);
+	if (rc == -1)
+		goto error;
+	if (bench->tls) {
+		tls = io_bench_tls(run, 0);
+		if (tls == NULL)
+			goto error;
+		rc = machine_set_tls(io, tls, UINT32_MAX);
+		if (rc == -1)
+			goto error;
+	}
+
+	uint64_t syscalls = io_bench_syscalls();
+	uint64_t start = io_bench_time_ns();
+	uint64_t last = start;
+	uint64_t i;
+	for (i = 0; i < run->count; i++) {
+		machine_msg_t *msg;
+		msg = machine_read(io, bench->size, UINT32_MAX);
+		if (msg == NULL)
+			goto error;
+		machine_msg_free(msg);
+		uint64_t now = io_bench_time_ns();
+		od_hgram_add_data_point(run->hgram, now - last);
+		last = now;
+	}
+	run->time_ns = last - start;
+	run->syscalls = io_bench_syscalls() - syscalls;
+	goto done;
+error:
+	printf("%s: reader error: %s\n", bench->name,
+	       io ? machine_error(io) : machine_error(server));
+	run->error = 1;
+done:
+	if (io) {
+		machine_close(io);
+		machine_io_free(io);
+	}
+	if (server) {
+		machine_close(server);
+		machine_io_free(server);
+	}
+	if (tls)
+		machine_tls_free(tls);
+	if (writer != -1) {
+		if (bench->machines == 1)
+			machine_join(writer);
+		else
+			machine_wait(writer);
+	}
+}
+
+static io_bench_t io_benches[] = {
+	{ "plain_64",               0, 64,      0,  1 },
+	{ "plain_1k",               0, 1024,    0,  1 },
+	{ "plain_16k",              0, 16384,   0,  1 },
+	{ "plain_1m",               0, 1 << 20, 0,  1 },
+	{ "plain_iov16_1k",         0, 1024,    16, 1 },
+	{ "plain_iov64_256",        0, 256,     64, 1 },
+	{ "plain_64_mt",            0, 64,      0,  2 },
+	{ "plain_16k_mt",           0, 16384,   0,  2 },
+	{ "plain_1m_mt",            0, 1 << 20, 0,  2 },
+	{ "plain_iov16_1k_mt",      0, 1024,    16, 2 },
+	{ "tls_1k",                 1, 1024,    0,  1 },
+	{ "tls_16k",                1, 16384,   0,  1 },
+	{ "tls_1m",                 1, 1 << 20, 0,  1 },
+	{ "tls_iov16_1k",           1, 1024,    16, 1 },
+	{ "tls_16k_mt",             1, 16384,   0,  2 },
+	{ "tls_1m_mt",              1, 1 << 20, 0,  2 },
+	{ NULL, 0, 0, 0, 0 }
+};
+
+static void
+io_bench_run(io_bench_t *bench, io_bench_config_t *config)
+{
+	io_bench_run_t run;
+	memset(&run, 0, sizeof(run));
+	run.bench  = bench;
+	run.config = config;
+	run.count  = (uint64_t)config->total_mb * 1024 * 1024 / bench->size;
+	if (run.count == 0)
+		run.count = 1;
+	run.hgram = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
+	if (run.hgram == NULL)
+		return;
+
+	int64_t reader;
+	reader = machine_create("io_bench_reader", io_bench_reader, &run);
+	if (reader != -1)
+		machine_wait(reader);
+	if (reader == -1 || run.error) {
+		od_hgram_free(run.hgram);
+		return;
+	}
+
+	uint64_t time_ns = run.time_ns ? run.time_ns : 1;
+	double mb = (double)run.count * bench->size / (1024 * 1024);
+	od_hgram_freeze(run.hgram, NULL, 0);
+	printf("%-20s %8d %4d %8d %10.3f %12.1f %10.2f %10.2f %10.2f\n",
+	       bench->name, bench->size, bench->iov, bench->machines,
+	       mb * 1024 * 1024 / time_ns,
+	       run.syscalls / mb,
+	       od_hgram_quantile(run.hgram, 0.5) / 1000.0,
+	       od_hgram_quantile(run.hgram, 0.99) / 1000.0,
+	       od_hgram_quantile(run.hgram, 0.999) / 1000.0);
+	od_hgram_free(run.hgram);
+}
+
+int main(int argc, char *argv[])
+{
+	io_bench_config_t config;
+	config.total_mb = 256;
+	config.filter   = NULL;
+	config.tls_dir  = "test/machinarium";
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:f:d:")) != -1) {
+		switch (opt) {
+			/* data size */
+			case 'n':
+				config.total_mb = atoi(optarg);
+				break;
+				/* filter */
+			case 'f':
+				config.filter = optarg;
+				break;
+				/* tls certificates */
+			case 'd':
+				config.tls_dir = optarg;
+				break;
+			default:
+				printf("machinarium io benchmarks.\n\n");
+				printf("usage: %s [nfd]\n", argv[0]);
+				printf("  \n");
+				printf("  -n <mb>         data streamed by every benchmark\n");
+				printf("  -f <name>       run benchmarks matching name\n");
+				printf("  -d <dir>        directory of the test tls certificates\n");
+				return 1;
+		}
+	}
+	if (config.total_mb <= 0) {
+		printf("invalid arguments\n");
+		return 1;
+	}
+
+	machinarium_init();
+
+	printf("%-20s %8s %4s %8s %10s %12s %10s %10s %10s\n", "benchmark",
+	       "size", "iov", "machines", "GB/sec", "syscalls/MB", "p50 usec",
+	       "p99 usec", "p999 usec");
+	io_bench_t *bench = io_benches;
+	for (; bench->name; bench++) {
+		if (config.filter && strstr(bench->name, config.filter) == NULL)
+			continue;
+		io_bench_run(bench, &config);
+	}
+
+	machinarium_free();
+	return 0;
+}
@@ -0,0 +1,524 @@
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+/* kiwi protocol encode/decode microbenchmarks.
+ *
+ * Every benchmark runs its operation over a message mix close to
+ * what a pooler sees: startup packets of libpq/JDBC clients, the
+ * ParameterStatus burst after authentication, errors with detail
+ * and hint, result sets of RowDescription and DataRow messages. */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+
+typedef struct {
+	char     *name;
+	uint64_t (*function)(int);
+} kiwi_bench_t;
+
+static volatile uint64_t kiwi_bench_sink;
+
+static inline uint64_t
+kiwi_bench_time_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * (uint64_t)1000000000 + t.tv_nsec;
+}
+
+/* startup */
+
+static kiwi_fe_arg_t kiwi_bench_startup_argv[] = {
+	{"user",                 5},  {"app_user",                     9},
+	{"database",             9},  {"orders",                       7},
+	{"application_name",    17},  {"PostgreSQL JDBC Driver",      23},
+	{"client_encoding",     16},  {"UTF8",                         5},
+	{"DateStyle",           10},  {"ISO",                          4},
+	{"TimeZone",             9},  {"Europe/Moscow",               14},
+	{"extra_float_digits",  19},  {"3",                            2},
+	{"search_path",         12},  {"public",                       7}
+};
+
+#define KIWI_BENCH_STARTUP_ARGC \
+	(int)(sizeof(kiwi_bench_startup_argv) / sizeof(kiwi_fe_arg_t))
+
+static uint64_t
+kiwi_bench_startup_write(int count)
+{
+	uint64_t bytes = 0;
+	int i;
+	for (i = 0; i < count; i++) {
+		machine_msg_t *msg;
+		msg = kiwi_fe_write_startup_message(NULL, KIWI_BENCH_STARTUP_ARGC,
+		                                    kiwi_bench_startup_argv);
+		bytes += machine_msg_size(msg);
+		machine_msg_free(msg);
+	}
+	return bytes;
+}
+
+static uint64_t
+kiwi_bench_startup_read(int count)
+{
+	machine_msg_t *msg;
+	msg = kiwi_fe_write_startup_message(NULL, KIWI_BENCH_STARTUP_ARGC,
+	                                    kiwi_bench_startup_argv);
+	uint64_t bytes = 0;
+	int i;
+	for (i = 0; i < count; i++) {
+		kiwi_be_startup_t startup;
+		kiwi_vars_t vars;
+		kiwi_be_startup_init(&startup);
+		kiwi_vars_init(&vars);
+		kiwi_be_read_startup(machine_msg_data(msg), machine_msg_size(msg),
+		                     &startup, &vars, "search_path");
+		kiwi_bench_sink += vars.hash;
+		kiwi_vars_free(&vars);
+		bytes += machine_msg_size(msg);
+	}
+	machine_msg_free(msg);
+	return bytes;
+}
+
+/* parameter status, as sent by PostgreSQL after authentication */
+
+static char *kiwi_bench_parameters[] = {
+	"application_name",              "PostgreSQL JDBC Driver",
+	"client_encoding",               "UTF8",
+	"DateStyle",                     "ISO, MDY",
+	"default_transaction_read_only", "off",
+	"in_hot_standby",                "off",
+	"integer_datetimes",             "on",
+	"IntervalStyle",                 "postgres",
+	"is_superuser",                  "off",
+	"server_encoding",               "UTF8",
+	"server_version",                "16.2",
+	"session_authorization",         "app_user",
+	"standard_conforming_strings",   "on",
+	"TimeZone",                      "Europe/Moscow"
+};
+
+#define KIWI_BENCH_PARAMETERS \
+	(int)(sizeof(kiwi_bench_parameters) / sizeof(char*) / 2)
+
+static machine_msg_t*
+kiwi_bench_parameters_write(void)
+{
+	machine_msg_t *msg = NULL;
+	int i;
+	for (i = 0; i < KIWI_BENCH_PARAMETERS; i++) {
+		char *name  = kiwi_bench_parameters[i * 2];
+		char *value = kiwi_bench_parameters[i * 2 + 1];
+		msg = kiwi_be_write_parameter_status(msg, name, strlen(name) + 1,
+		                                     value, strlen(value) + 1);
+	}
+	return msg;
+}
+
+static uint64_t
+kiwi_bench_parameter_status_write(int count)
+{
+	uint64_t bytes = 0;
+	int i;
+	for (i = 0; i < count; i++) {
+		machine_msg_t *msg = kiwi_bench_parameters_write();
+		bytes += machine_msg_size(msg);
+		machine_msg_free(msg);
+	}
+	return bytes;
+}
+
+static uint64_t
+kiwi_bench_parameter_status_read(int count)
+{
+	machine_msg_t *msg = kiwi_bench_parameters_write();
+	char *data = machine_msg_data(msg);
+	uint32_t data_size = machine_msg_size(msg);
+	uint64_t bytes = 0;
+	int i;
+	for (i = 0; i < count; i++) {
+		kiwi_vars_t vars;
+		kiwi_vars_init(&vars);
+		uint32_t pos = 0;
+		while (pos < data_size) {
+			uint32_t size;
+			kiwi_validate_header(data + pos, sizeof(kiwi_header_t), &size);
+			size += 1;
+			char *name;
+			uint32_t name_len;
+			char *value;
+			uint32_t value_len;
+			int rc;
+			rc = kiwi_fe_read_parameter(data + pos, size, &name, &name_len,
+			                            &value, &value_len);
+			if (rc == -1)
+				break;
+			kiwi_vars_update(&vars, name, name_len, value, value_len);
+			pos += size;
+		}
+		kiwi_bench_sink += vars.hash;
+		kiwi_vars_free(&vars);
+		bytes += data_size;
+	}
+	machine_msg_free(msg);
+	return bytes;
+}
+
+/* error response */
+
+static char kiwi_bench_error_message[] =
+	"duplicate key value violates unique constraint \"orders_pkey\"";
+static char kiwi_bench_error_detail[] =
+	"Key (id)=(1048576) already exists.";
+static char kiwi_bench_error_hint[] =
+	"Use ON CONFLICT to update the existing row.";
+
+static machine_msg_t*
+kiwi_bench_error_write_one(void)
+{
+	return kiwi_be_write_error_as(NULL, "ERROR", KIWI_UNIQUE_VIOLATION,
+	                              kiwi_bench_error_detail,
+	                              sizeof(kiwi_bench_error_detail) - 1,
+	                              kiwi_bench_error_hint,
+	                              sizeof(kiwi_bench_error_hint) - 1,
+	                              kiwi_bench_error_message,
+	                              sizeof(kiwi_bench_error_message) - 1);
+}
+
+static uint64_t
+kiwi_bench_error_write(int count)
+{
+	uint64_t bytes = 0;
+	int i;
+	for (i = 0; i < count; i++) {
+		machine_msg_t *msg = kiwi_bench_error_write_one();
+		bytes += machine_msg_size(msg);
+		machine_msg_free(msg);
+	}
+	return bytes;
+}
+
+static uint64_t
+kiwi_bench_error_read(int count)
+{
+	machine_msg_t *msg = kiwi_bench_error_write_one();
+	uint64_t bytes = 0;
+	int i;
+	for (i = 0; i < count; i++) {
+		kiwi_fe_error_t error;
+		int rc;
+		rc = kiwi_fe_read_error(machine_msg_data(msg), machine_msg_size(msg),
+		                        &error);
+		if (rc == -1)
+			break;
+		kiwi_bench_sink += (uintptr_t)error.message;
+		bytes += machine_msg_size(msg);
+	}
+	machine_msg_free(msg);
+	return bytes;
+}
+
+/* result set: 8 columns of mixed types, 100 rows */
+
+#define KIWI_BENCH_COLUMNS 8
+#define KIWI_BENCH_ROWS    100
+
+static char *kiwi_bench_columns[KIWI_BENCH_COLUMNS] = {
+	"id", "customer_id", "status", "amount",
+	"currency", "created_at", "updated_at", "comment"
+};
+
+static char *kiwi_bench_values[KIWI_BENCH_COLUMNS] = {
+	"1048576", "73311", "shipped", "1299.90",
+	"RUB", "2024-03-01 12:34:56.789+03", "2024-03-02 08:00:00+03",
+	"leave at the door, call before delivery"
+};
+
+static int kiwi_bench_types[KIWI_BENCH_COLUMNS] = {
+	20, 20, 25, 1700, 25, 1184, 1184, 25
+};
+
+static machine_msg_t*
+kiwi_bench_row_description_write_one(machine_msg_t *msg)
+{
+	int offset;
+	msg = kiwi_be_write_row_description(msg, &offset);
+	if (msg == NULL)
+		return NULL;
+	int i;
+	for (i = 0; i < KIWI_BENCH_COLUMNS; i++)
+		kiwi_be_write_row_description_add(msg, offset, kiwi_bench_columns[i],
+		                                  strlen(kiwi_bench_columns[i]),
+		                                  16384, i + 1, kiwi_bench_types[i],
+		                                  -1, -1, 0);
+	return msg;
+}
+
+static machine_msg_t*
+kiwi_bench_data_rows_write(machine_msg_t *msg)
+{
+	int row;
+	for (row = 0; row < KIWI_BENCH_ROWS; row++) {
+		int offset;
+		msg = kiwi_be_write_data_row(msg, &offset);
+		if (msg == NULL)
+			return NULL;
+		int i;
+		for (i = 0; i < KIWI_BENCH_COLUMNS; i++) {
+			/* every fifth comment is NULL */
+			if (i == KIWI_BENCH_COLUMNS - 1 && row % 5 == 0) {
+				kiwi_be_write_data_row_add(msg, offset, NULL, -1);
+				continue;
+			}
+			kiwi_be_write_data_row_add(msg, offset, kiwi_bench_values[i],
+			                           strlen(kiwi_bench_values[i]));
+		}
+	}
+	return msg;
+}
+
+static uint64_t
+kiwi_bench_row_description_write(int count)
+{
+	uint64_t bytes = 0;
+	int i;
+	for (i = 0; i < count; i++) {
+		machine_msg_t *msg = kiwi_bench_row_description_write_one(NULL);
+		bytes += machine_msg_size(msg);
+		machine_msg_free(msg);
+	}
+	return bytes;
+}
+
+static uint64_t
+kiwi_bench_data_row_write(int count)
+{
+	uint64_t bytes = 0;
+	int i;
+	for (i = 0; i < count; i++) {
+		machine_msg_t *msg = kiwi_bench_data_rows_write(NULL);
+		bytes += machine_msg_size(msg);
+		machine_msg_free(msg);
+	}
+	return bytes;
+}
+
+/* numeric columns, as in console SHOW results */
+
+static machine_msg_t*
+kiwi_bench_numbers_write(machine_msg_t *msg, int formatted)
+{
+	int row;
+	for (row = 0; row < KIWI_BENCH_ROWS; row++) {
+		int offset;
+		msg = kiwi_be_write_data_row(msg, &offset);
+		if (msg == NULL)
+			return NULL;
+		uint64_t value = 1000003ULL * (row + 1);
+		int i;
+		for (i = 0; i < KIWI_BENCH_COLUMNS; i++, value *= 31) {
+			if (formatted) {
+				char data[32];
+				int data_len;
+				data_len = snprintf(data, sizeof(data), "%" PRIu64, value);
+				kiwi_be_write_data_row_add(msg, offset, data, data_len);
+				continue;
+			}
+			kiwi_be_write_data_row_add_u64(msg, offset, value);
+		}
+	}
+	return msg;
+}
+
+static uint64_t
+kiwi_bench_data_row_numbers_snprintf(int count)
+{
+	uint64_t bytes = 0;
+	int i;
+	for (i = 0; i < count; i++) {
+		machine_msg_t *msg = kiwi_bench_numbers_write(NULL, 1);
+		bytes += machine_msg_size(msg);
+		machine_msg_free(msg);
+	}
+	return bytes;
+}
+
+static uint64_t
+kiwi_bench_data_row_numbers_write(int count)
+{
+	uint64_t bytes = 0;
+	int i;
+	for (i = 0; i < count; i++) {
+		machine_msg_t *msg = kiwi_bench_numbers_write(NULL, 0);
+		bytes += machine_msg_size(msg);
+		machine_msg_free(msg);
+	}
+	return bytes;
+}
+
+static uint64_t
+kiwi_bench_result_scan(int count)
+{
+	/* split the result into packets the way the relay does,
+	 * by validating every header */
+	machine_msg_t *msg;
+	msg = kiwi_bench_row_description_write_one(NULL);
+	msg = kiwi_bench_data_rows_write(msg);
+	msg = kiwi_be_write_complete(msg, "SELECT 100", 11);
+	msg = kiwi_be_write_ready(msg, 'I');
+	char *data = machine_msg_data(msg);
+	uint32_t data_size = machine_msg_size(msg);
+	uint64_t bytes = 0;
+	int i;
+	for (i = 0; i < count; i++) {
+		uint32_t pos = 0;
+		while (pos < data_size) {
+			uint32_t size;
+			kiwi_validate_header(data + pos, sizeof(kiwi_header_t), &size);
+			kiwi_bench_sink += data[pos];
+			pos += size + 1;
+		}
+		bytes += data_size;
+	}
+	machine_msg_free(msg);
+	return bytes;
+}
+
+/* leading keyword of queries, as checked by read-only routing */
+
+static char *kiwi_bench_queries[] = {
+	"SELECT id, name FROM users WHERE id = $1",
+	"  select count(*) from orders",
+	"/* app:checkout */ SELECT * FROM carts WHERE user_id = 42",
+	"-- report\nselect sum(total) from orders",
+	"BEGIN",
+	"COMMIT",
+	"insert into events values (1, 2, 3)",
+	"UPDATE users SET seen = now() WHERE id = 7",
+	"SET application_name = 'worker'",
+	"DISCARD ALL",
+	"savepoint sp1",
+	"DEALLOCATE ALL",
+	"selected_rows_are_not_select"
+};
+
+#define KIWI_BENCH_QUERIES \
+	(int)(sizeof(kiwi_bench_queries) / sizeof(kiwi_bench_queries[0]))
+
+static uint64_t
+kiwi_bench_query_classify(int count)
+{
+	uint32_t lens[KIWI_BENCH_QUERIES];
+	int i;
+	for (i = 0; i < KIWI_BENCH_QUERIES; i++)
+		lens[i] = strlen(kiwi_bench_queries[i]);
+	uint64_t bytes = 0;
+	for (i = 0; i < count; i++) {
+		int id = i % KIWI_BENCH_QUERIES;
+		kiwi_bench_sink += kiwi_query_classify(kiwi_bench_queries[id], lens[id]);
+		bytes += lens[id];
+	}
+	return bytes;
+}
+
+static kiwi_bench_t kiwi_benches[] = {
+	{ "startup_write",          kiwi_bench_startup_write          },
+	{ "startup_read",           kiwi_bench_startup_read           },
+	{ "parameter_status_write", kiwi_bench_parameter_status_write },
+	{ "parameter_status_read",  kiwi_bench_parameter_status_read  },
+	{ "error_write",            kiwi_bench_error_write            },
+	{ "error_read",             kiwi_bench_error_read             },
+	{ "row_description_write",  kiwi_bench_row_description_write  },
+	{ "data_row_write",         kiwi_bench_data_row_write         },
+	{ "data_row_numbers_snprintf", kiwi_bench_data_row_numbers_snprintf },
+	{ "data_row_numbers_write", kiwi_bench_data_row_numbers_write },
+	{ "result_scan",            kiwi_bench_result_scan            },
+	{ "query_classify",         kiwi_bench_query_classify         },
+	{ NULL, NULL }
+};
+
+typedef struct {
+	int   count;
+	char *filter;
+} kiwi_bench_config_t;
+
+static void
+kiwi_bench_main(void *arg)
+{
+	kiwi_bench_config_t *config = arg;
+	printf("%-26s %12s %14s %10s %10s\n", "benchmark", "iterations",
+	       "ops/sec", "ns/op", "MB/sec");
+	kiwi_bench_t *bench = kiwi_benches;
+	for (; bench->name; bench++) {
+		if (config->filter && strstr(bench->name, config->filter) == NULL)
+			continue;
+		/* warm up message cache and branch predictors */
+		bench->function(config->count / 10 + 1);
+
+		uint64_t start = kiwi_bench_time_ns();
+		uint64_t bytes = bench->function(config->count);
+		uint64_t time_ns = kiwi_bench_time_ns() - start;
+		if (time_ns == 0)
+			time_ns = 1;
+		printf("%-26s %12d %14.0f %10.1f %10.1f\n", bench->name,
+		       config->count,
+		       config->count * 1000000000.0 / time_ns,
+		       (double)time_ns / config->count,
+		       bytes * 1000000000.0 / time_ns / (1024 * 1024));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	kiwi_bench_config_t config;
+	config.count  = 1000000;
+	config.filter = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:f:")) != -1) {
+		switch (opt) {
+			/* iterations */
+			case 'n':
+				config.count = atoi(optarg);
+				break;
+				/* filter */
+			case 'f':
+				config.filter = optarg;
+				break;
+			default:
+				printf("kiwi protocol benchmarks.\n\n");
+				printf("usage: %s [nf]\n", argv[0]);
+				printf("  \n");
+				printf("  -n <count>      iterations of every benchmark\n");
+				printf("  -f <name>       run benchmarks matching name\n");
+				return 1;
+		}
+	}
+	if (config.count <= 0) {
+		printf("invalid arguments\n");
+		return 1;
+	}
+
+	machinarium_init();
+
+	int64_t machine;
+	machine = machine_create("kiwi_bench", kiwi_bench_main, &config);
+
+	machine_wait(machine);
+
+	machinarium_free();
+	return 0;
+}
@@ -0,0 +1,651 @@
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <sources/list.h>
+#include <sources/cache.h>
+#include <sources/readahead.h>
+#include <sources/io.h>
+#include <sources/hgram.h>
+#include <sources/capture.h>
+
+typedef struct replay_machine replay_machine_t;
+
+/* captured client session, messages point into the file */
+typedef struct replay_session replay_session_t;
+
+struct replay_session {
+	uint64_t id;
+	char *database;
+	char *user;
+	uint64_t start;
+	od_capture_record_t **messages;
+	int messages_count;
+	int messages_allocated;
+	int closed;
+	replay_machine_t *machine;
+	replay_session_t *next_hash;
+};
+
+typedef struct {
+	char *file;
+	char *dbname;
+	char *user;
+	char *host;
+	char *port;
+	double speed;
+	int machines;
+	char *data;
+	uint64_t data_size;
+	replay_session_t *sessions;
+	int sessions_count;
+	uint64_t time_base;
+	uint64_t replay_start;
+	struct addrinfo *ai;
+} replay_t;
+
+/* latencies are kept per machine as in odyssey_stress */
+typedef struct {
+	od_hgram_t *hgram;
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+} replay_latency_t;
+
+struct replay_machine {
+	int id;
+	int64_t machine_id;
+	replay_latency_t query;
+	replay_latency_t lag;
+	uint64_t sessions;
+	uint64_t connect_errors;
+	uint64_t errors;
+	uint64_t skipped;
+	uint64_t messages;
+};
+
+#define REPLAY_HASH 4096
+
+static replay_t replay;
+static replay_session_t *replay_hash[REPLAY_HASH];
+static replay_latency_t replay_query;
+static replay_latency_t replay_lag;
+
+static inline uint64_t
+replay_time_us(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * (uint64_t)1000000 + t.tv_nsec / 1000;
+}
+
+static inline int
+replay_latency_init(replay_latency_t *latency)
+{
+	memset(latency, 0, sizeof(*latency));
+	latency->hgram = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
+	if (latency->hgram == NULL)
+		return -1;
+	return 0;
+}
+
+static inline void
+replay_latency_add(replay_latency_t *latency, uint64_t value)
+{
+	od_hgram_add_data_point(latency->hgram, value);
+	latency->count++;
+	latency->sum += value;
+	if (value > latency->max)
+		latency->max = value;
+}
+
+static inline void
+replay_latency_merge(replay_latency_t *dst, replay_latency_t *src)
+{
+	od_hgram_merge(dst->hgram, src->hgram);
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+static inline uint64_t
+replay_latency_quantile(replay_latency_t *latency, double quantile)
+{
+	od_hgram_freeze(latency->hgram, NULL, 0);
+	uint64_t value = od_hgram_quantile(latency->hgram, quantile);
+	return value > latency->max ? latency->max : value;
+}
+
+static void
+replay_print_latency(char *name, replay_latency_t *latency)
+{
+	static double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	static char  *names[] = { "p50", "p90", "p99", "p999" };
+	printf("%s (usec): avg %" PRIu64, name,
+	       latency->count ? latency->sum / latency->count : 0);
+	int i;
+	for (i = 0; i < 4; i++)
+		printf(", %s %" PRIu64, names[i],
+		       replay_latency_quantile(latency, quantiles[i]));
+	printf(", max %" PRIu64 "\n", latency->max);
+}
+
+static replay_session_t*
+replay_session_find(uint64_t id)
+{
+	replay_session_t *session = replay_hash[id % REPLAY_HASH];
+	for (; session; session = session->next_hash)
+		if (session->id == id && ! session->closed)
+			return session;
+	return NULL;
+}
+
+static int
+replay_session_add(replay_session_t *session, od_capture_record_t *record)
+{
+	if (session->messages_count == session->messages_allocated) {
+		int allocated = session->messages_allocated * 2;
+		if (allocated == 0)
+			allocated = 16;
+		od_capture_record_t **messages;
+		messages = realloc(session->messages, sizeof(void*) * allocated);
+		if (messages == NULL)
+			return -1;
+		session->messages = messages;
+		session->messages_allocated = allocated;
+	}
+	session->messages[session->messages_count++] = record;
+	return 0;
+}
+
+static int
+replay_load(void)
+{
+	int fd = open(replay.file, O_RDONLY);
+	if (fd == -1) {
+		printf("failed to open %s\n", replay.file);
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+	replay.data_size = st.st_size;
+	replay.data = malloc(replay.data_size + 1);
+	if (replay.data == NULL) {
+		close(fd);
+		return -1;
+	}
+	uint64_t pos = 0;
+	while (pos < replay.data_size) {
+		ssize_t rc = read(fd, replay.data + pos, replay.data_size - pos);
+		if (rc <= 0)
+			break;
+		pos += rc;
+	}
+	close(fd);
+	if (pos != replay.data_size ||
+	    replay.data_size < OD_CAPTURE_MAGIC_LEN ||
+	    memcmp(replay.data, OD_CAPTURE_MAGIC, OD_CAPTURE_MAGIC_LEN) != 0) {
+		printf("%s is not a capture file\n", replay.file);
+		return -1;
+	}
+
+	/* two passes: count sessions, then link their messages */
+	int pass;
+	for (pass = 0; pass < 2; pass++) {
+		int count = 0;
+		memset(replay_hash, 0, sizeof(replay_hash));
+		pos = OD_CAPTURE_MAGIC_LEN;
+		while (pos + sizeof(od_capture_record_t) <= replay.data_size) {
+			od_capture_record_t *record;
+			record = (od_capture_record_t*)(replay.data + pos);
+			if (record->size < sizeof(od_capture_record_t) ||
+			    pos + record->size > replay.data_size)
+				break;
+			pos += record->size;
+
+			replay_session_t *session;
+			switch (record->type) {
+			case OD_CAPTURE_START:
+				/* session ids of a new run may repeat */
+				if (pass == 1) {
+					int i;
+					for (i = 0; i < count; i++)
+						replay.sessions[i].closed = 1;
+				}
+				break;
+			case OD_CAPTURE_SESSION:
+				if (pass == 0) {
+					count++;
+					break;
+				}
+				session = &replay.sessions[count++];
+				session->id    = record->session;
+				session->start = record->time;
+				char *names = (char*)record + sizeof(od_capture_record_t);
+				int   names_len = record->size - sizeof(od_capture_record_t);
+				session->database = names;
+				session->user = memchr(names, 0, names_len);
+				if (session->user == NULL || session->user + 1 >= names + names_len) {
+					session->closed = 1;
+					break;
+				}
+				session->user++;
+				if (replay.time_base == 0 || record->time < replay.time_base)
+					replay.time_base = record->time;
+				session->next_hash = replay_hash[session->id % REPLAY_HASH];
+				replay_hash[session->id % REPLAY_HASH] = session;
+				break;
+			case OD_CAPTURE_MESSAGE:
+			case OD_CAPTURE_TRUNCATED:
+				if (pass == 0)
+					break;
+				session = replay_session_find(record->session);
+				if (session && replay_session_add(session, record) == -1)
+					return -1;
+				break;
+			case OD_CAPTURE_END:
+				if (pass == 0)
+					break;
+				session = replay_session_find(record->session);
+				if (session)
+					session->closed = 1;
+				break;
+			}
+		}
+		if (pass == 0) {
+			replay.sessions_count = count;
+			replay.sessions = calloc(count ? count : 1, sizeof(replay_session_t));
+			if (replay.sessions == NULL)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+/* wait for the captured time of the event, scaled by speed */
+static inline uint64_t
+replay_schedule(replay_machine_t *machine, uint64_t time)
+{
+	uint64_t now = replay_time_us();
+	if (replay.speed <= 0)
+		return now;
+	uint64_t at = replay.replay_start +
+	              (uint64_t)((time - replay.time_base) / replay.speed);
+	if (at > now) {
+		machine_sleep((at - now + 999) / 1000);
+		return at;
+	}
+	replay_latency_add(&machine->lag, now - at);
+	return at;
+}
+
+static int
+replay_session_connect(replay_session_t *session, od_io_t *io)
+{
+	od_io_init(io);
+	int rc;
+	rc = od_io_prepare(io, machine_io_create(), 8192, 0);
+	if (rc == -1 || io->io == NULL)
+		return -1;
+	machine_set_nodelay(io->io, 1);
+	rc = machine_connect(io->io, replay.ai->ai_addr, UINT32_MAX);
+	if (rc == -1) {
+		printf("session %" PRIx64 ": failed to connect: %s\n",
+		       session->id, od_io_error(io));
+		return -1;
+	}
+
+	char *user = replay.user ? replay.user : session->user;
+	char *database = replay.dbname ? replay.dbname : session->database;
+	kiwi_fe_arg_t argv[] = {
+		{"user",     5},
+		{user,       strlen(user) + 1},
+		{"database", 9},
+		{database,   strlen(database) + 1}
+	};
+	machine_msg_t *msg;
+	msg = kiwi_fe_write_startup_message(NULL, 4, argv);
+	if (msg == NULL)
+		return -1;
+	rc = od_write(io, msg);
+	if (rc == -1)
+		return -1;
+	for (;;) {
+		msg = od_read(io, UINT32_MAX);
+		if (msg == NULL)
+			return -1;
+		kiwi_be_type_t type = *(char*)machine_msg_data(msg);
+		if (type == KIWI_BE_ERROR_RESPONSE) {
+			printf("session %" PRIx64 ": error response: %s\n",
+			       session->id, (char*)machine_msg_data(msg) + 5);
+			machine_msg_free(msg);
+			return -1;
+		}
+		machine_msg_free(msg);
+		if (type == KIWI_BE_READY_FOR_QUERY)
+			return 0;
+	}
+}
+
+/* read replies up to ReadyForQuery, copy data was not captured
+ * so COPY FROM STDIN is cancelled */
+static int
+replay_session_wait(replay_machine_t *machine, od_io_t *io)
+{
+	for (;;) {
+		machine_msg_t *msg;
+		msg = od_read(io, UINT32_MAX);
+		if (msg == NULL)
+			return -1;
+		kiwi_be_type_t type = *(char*)machine_msg_data(msg);
+		machine_msg_free(msg);
+		switch (type) {
+		case KIWI_BE_ERROR_RESPONSE:
+			machine->errors++;
+			break;
+		case KIWI_BE_COPY_IN_RESPONSE:
+			msg = kiwi_fe_write_copy_fail(NULL, "replay", 7);
+			if (msg == NULL || od_write(io, msg) == -1)
+				return -1;
+			break;
+		case KIWI_BE_COPY_BOTH_RESPONSE:
+			return -1;
+		case KIWI_BE_READY_FOR_QUERY:
+			return 0;
+		default:
+			break;
+		}
+	}
+}
+
+static void
+replay_session_main(void *arg)
+{
+	replay_session_t *session = arg;
+	replay_machine_t *machine = session->machine;
+
+	od_io_t io;
+	int rc;
+	rc = replay_session_connect(session, &io);
+	if (rc == -1) {
+		machine->connect_errors++;
+		if (io.io) {
+			od_io_close(&io);
+			od_io_free(&io);
+		}
+		return;
+	}
+	machine->sessions++;
+
+	int i;
+	for (i = 0; i < session->messages_count; i++) {
+		od_capture_record_t *record = session->messages[i];
+		char *data = (char*)record + sizeof(od_capture_record_t);
+		int   size = record->size - sizeof(od_capture_record_t);
+		if (record->type == OD_CAPTURE_TRUNCATED) {
+			machine->skipped++;
+			continue;
+		}
+		kiwi_fe_type_t type = *data;
+		if (type == KIWI_FE_TERMINATE)
+			break;
+		if (type == KIWI_FE_COPY_DATA || type == KIWI_FE_COPY_DONE ||
+		    type == KIWI_FE_COPY_FAIL) {
+			machine->skipped++;
+			continue;
+		}
+
+		uint64_t start_time;
+		start_time = replay_schedule(machine, record->time);
+
+		machine_msg_t *msg = machine_msg_create(size);
+		if (msg == NULL)
+			break;
+		memcpy(machine_msg_data(msg), data, size);
+		rc = od_write(&io, msg);
+		if (rc == -1)
+			break;
+		machine->messages++;
+
+		/* latency is measured from the scheduled time, so
+		 * a target which cannot keep up is not hidden */
+		if (type == KIWI_FE_QUERY || type == KIWI_FE_SYNC) {
+			rc = replay_session_wait(machine, &io);
+			if (rc == -1)
+				break;
+			uint64_t now = replay_time_us();
+			replay_latency_add(&machine->query,
+			                   now > start_time ? now - start_time : 0);
+		}
+	}
+
+	machine_msg_t *msg;
+	msg = kiwi_fe_write_terminate(NULL);
+	if (msg)
+		od_write(&io, msg);
+	od_io_close(&io);
+	od_io_free(&io);
+}
+
+static inline void
+replay_machine_main(void *arg)
+{
+	replay_machine_t *machine = arg;
+
+	/* sessions are spread over the machines round robin and
+	 * started at their captured time */
+	int count = 0;
+	int i;
+	for (i = machine->id; i < replay.sessions_count; i += replay.machines)
+		count++;
+	int64_t *ids = calloc(count ? count : 1, sizeof(int64_t));
+	if (ids == NULL)
+		return;
+	int created = 0;
+	for (i = machine->id; i < replay.sessions_count; i += replay.machines) {
+		replay_session_t *session = &replay.sessions[i];
+		if (session->messages_count == 0)
+			continue;
+		session->machine = machine;
+		replay_schedule(machine, session->start);
+		ids[created] = machine_coroutine_create(replay_session_main, session);
+		if (ids[created] != -1)
+			created++;
+	}
+	for (i = 0; i < created; i++)
+		machine_join(ids[i]);
+	free(ids);
+}
+
+static int
+replay_session_cmp(const void *a_ptr, const void *b_ptr)
+{
+	const replay_session_t *a = a_ptr;
+	const replay_session_t *b = b_ptr;
+	if (a->start < b->start)
+		return -1;
+	return a->start > b->start;
+}
+
+static inline void
+replay_main(void *arg)
+{
+	(void)arg;
+	int rc;
+	rc = machine_getaddrinfo(replay.host, replay.port, NULL, &replay.ai,
+	                         UINT32_MAX);
+	if (rc == -1) {
+		printf("failed to resolve host\n");
+		return;
+	}
+
+	replay_machine_t *machines;
+	machines = calloc(replay.machines, sizeof(replay_machine_t));
+	if (machines == NULL)
+		return;
+
+	replay.replay_start = replay_time_us();
+	int created = 0;
+	int i;
+	for (i = 0; i < replay.machines; i++) {
+		replay_machine_t *machine = &machines[i];
+		machine->id = i;
+		if (replay_latency_init(&machine->query) == -1 ||
+		    replay_latency_init(&machine->lag) == -1)
+			break;
+		machine->machine_id = machine_create("replay", replay_machine_main,
+		                                     machine);
+		if (machine->machine_id == -1)
+			break;
+		created++;
+	}
+	for (i = 0; i < created; i++)
+		machine_wait(machines[i].machine_id);
+	double duration = (replay_time_us() - replay.replay_start) / 1000000.0;
+
+	uint64_t sessions = 0, connect_errors = 0, errors = 0;
+	uint64_t messages = 0, skipped = 0;
+	for (i = 0; i < replay.machines; i++) {
+		replay_machine_t *machine = &machines[i];
+		sessions       += machine->sessions;
+		connect_errors += machine->connect_errors;
+		errors         += machine->errors;
+		messages       += machine->messages;
+		skipped        += machine->skipped;
+		if (machine->query.hgram) {
+			replay_latency_merge(&replay_query, &machine->query);
+			od_hgram_free(machine->query.hgram);
+		}
+		if (machine->lag.hgram) {
+			replay_latency_merge(&replay_lag, &machine->lag);
+			od_hgram_free(machine->lag.hgram);
+		}
+	}
+
+	printf("\n");
+	printf("duration:    %.2f secs\n", duration);
+	printf("sessions:    %" PRIu64 " (%" PRIu64 " connect errors)\n",
+	       sessions, connect_errors);
+	printf("messages:    %" PRIu64 " (%" PRIu64 " skipped)\n",
+	       messages, skipped);
+	printf("requests:    %" PRIu64 " (%" PRIu64 " errors), %.2f/sec\n",
+	       replay_query.count, errors, replay_query.count / duration);
+	replay_print_latency("request latency", &replay_query);
+	replay_print_latency("schedule lag", &replay_lag);
+
+	free(machines);
+	freeaddrinfo(replay.ai);
+}
+
+int main(int argc, char *argv[])
+{
+	memset(&replay, 0, sizeof(replay));
+	replay.host = "localhost";
+	replay.port = "6432";
+	replay.speed = 1.0;
+	replay.machines = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "f:d:u:h:p:x:T:")) != -1) {
+		switch (opt) {
+			/* capture file */
+			case 'f':
+				replay.file = optarg;
+				break;
+				/* database */
+			case 'd':
+				replay.dbname = optarg;
+				break;
+				/* user */
+			case 'u':
+				replay.user = optarg;
+				break;
+				/* host */
+			case 'h':
+				replay.host = optarg;
+				break;
+				/* port */
+			case 'p':
+				replay.port = optarg;
+				break;
+				/* speed */
+			case 'x':
+				replay.speed = atof(optarg);
+				break;
+				/* threads */
+			case 'T':
+				replay.machines = atoi(optarg);
+				break;
+			default:
+				printf("Odyssey workload replay.\n\n");
+				printf("usage: %s -f <file> [duhpxT]\n", argv[0]);
+				printf("  \n");
+				printf("  -f <file>       capture file (capture_file)\n");
+				printf("  -d <database>   database name, captured one by default\n");
+				printf("  -u <user>       user name, captured one by default\n");
+				printf("  -h <host>       server address\n");
+				printf("  -p <port>       server port\n");
+				printf("  -x <speed>      time scale, 2 replays twice as fast,\n");
+				printf("                  0 without waits\n");
+				printf("  -T <threads>    number of load generating threads\n");
+				return 1;
+		}
+	}
+	if (replay.file == NULL || replay.machines <= 0 || replay.speed < 0) {
+		printf("invalid arguments\n");
+		return 1;
+	}
+
+	if (replay_load() == -1)
+		return 1;
+	qsort(replay.sessions, replay.sessions_count, sizeof(replay_session_t),
+	      replay_session_cmp);
+
+	printf("Odyssey workload replay.\n\n");
+	printf("file:        %s\n", replay.file);
+	printf("sessions:    %d\n", replay.sessions_count);
+	printf("threads:     %d\n", replay.machines);
+	printf("host:        %s\n", replay.host);
+	printf("port:        %s\n", replay.port);
+	if (replay.speed > 0)
+		printf("speed:       %.2fx\n", replay.speed);
+	else
+		printf("speed:       no waits\n");
+
+	if (replay_latency_init(&replay_query) == -1 ||
+	    replay_latency_init(&replay_lag) == -1)
+		return 1;
+
+	machinarium_init();
+
+	int64_t machine;
+	machine = machine_create("replay", replay_main, NULL);
+	machine_wait(machine);
+
+	machinarium_free();
+
+	od_hgram_free(replay_query.hgram);
+	od_hgram_free(replay_lag.hgram);
+	free(replay.sessions);
+	free(replay.data);
+	return 0;
+}
@@ -1,4 +1,3 @@
-
 /*
  * Odyssey.
  *
@@ -18,16 +17,38 @@
 
 #include <machinarium.h>
 #include <kiwi.h>
+#include <sources/list.h>
+#include <sources/cache.h>
 #include <sources/readahead.h>
 #include <sources/io.h>
+#include <sources/hgram.h>
+
+typedef enum {
+	STRESS_SIMPLE,
+	STRESS_EXTENDED,
+	STRESS_PREPARED
+} stress_protocol_t;
+
+static char *stress_protocol_names[] = {
+	"simple",
+	"extended",
+	"prepared"
+};
 
-#include "histogram.h"
+typedef struct stress_machine stress_machine_t;
 
 typedef struct {
 	int id;
+	int idle;
+	stress_machine_t *machine;
 	od_io_t io;
-	int coroutine_id;
-	int processed;
+	int64_t coroutine_id;
+	uint64_t processed;
+	uint64_t errors;
+	uint64_t recv_bytes;
+	uint64_t connects;
+	uint64_t connect_errors;
+	uint64_t schedule;
 } stress_client_t;
 
 typedef struct {
@@ -35,48 +56,141 @@ typedef struct {
 	char *user;
 	char *host;
 	char *port;
+	char *query;
+	char *json;
 	int time_to_run;
+	int machines;
 	int clients;
+	int idle;
+	int rate;
+	int batch;
+	int churn;
+	int tls;
+	stress_protocol_t protocol;
+	machine_tls_t *tls_ctx;
+	struct addrinfo *ai;
 } stress_t;
 
+/* Latencies are kept in usec in log-linear histograms, every
+ * machine has its own ones shared by its client coroutines without
+ * locking, they are merged when the run is over. */
+typedef struct {
+	od_hgram_t *hgram;
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+} stress_latency_t;
+
+/* clients are spread over the machines round robin */
+struct stress_machine {
+	int id;
+	int64_t machine_id;
+	stress_client_t *clients;
+	stress_latency_t query;
+	stress_latency_t connect;
+};
+
 static stress_t stress;
-static od_histogram_t stress_histogram;
+static stress_latency_t stress_query;
+static stress_latency_t stress_connect;
+static int stress_ready;
+static int stress_start;
 static int stress_run;
 
+static inline int
+stress_running(void)
+{
+	return __atomic_load_n(&stress_run, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t
+stress_time_us(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * (uint64_t)1000000 + t.tv_nsec / 1000;
+}
+
+static inline int
+stress_latency_init(stress_latency_t *latency)
+{
+	memset(latency, 0, sizeof(*latency));
+	latency->hgram = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
+	if (latency->hgram == NULL)
+		return -1;
+	return 0;
+}
+
 static inline void
-stress_client_main(void *arg) {
-	stress_client_t *client = arg;
+stress_latency_add(stress_latency_t *latency, uint64_t value)
+{
+	od_hgram_add_data_point(latency->hgram, value);
+	latency->count++;
+	latency->sum += value;
+	if (value > latency->max)
+		latency->max = value;
+}
 
-	/* create client io */
-	od_io_prepare(&client->io, machine_io_create(), 8192);
-	if (client->io.io == NULL) {
-		printf("client %d: failed to create io\n", client->id);
-		return;
-	}
+static inline void
+stress_latency_merge(stress_latency_t *dst, stress_latency_t *src)
+{
+	od_hgram_merge(dst->hgram, src->hgram);
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
 
-	machine_set_nodelay(client->io.io, 1);
-	machine_set_keepalive(client->io.io, 1, 7200);
+static inline uint64_t
+stress_latency_quantile(stress_latency_t *latency, double quantile)
+{
+	od_hgram_freeze(latency->hgram, NULL, 0);
+	uint64_t value = od_hgram_quantile(latency->hgram, quantile);
+	/* middle of the bucket can be above the largest value */
+	return value > latency->max ? latency->max : value;
+}
+
+static double stress_quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+static char  *stress_quantile_names[] = { "p50", "p90", "p99", "p999" };
+
+#define STRESS_QUANTILES \
+	(int)(sizeof(stress_quantiles) / sizeof(stress_quantiles[0]))
 
-	/* resolve host */
-	struct addrinfo *ai = NULL;
+static int
+stress_client_startup(stress_client_t *client)
+{
+	machine_msg_t *msg;
 	int rc;
-	rc = machine_getaddrinfo(stress.host, stress.port, NULL, &ai, UINT32_MAX);
-	if (rc == -1) {
-		printf("client %d: failed to resolve host\n", client->id);
-		return;
-	}
 
-	/* connect */
-	rc = machine_connect(client->io.io, ai->ai_addr, UINT32_MAX);
-	freeaddrinfo(ai);
-	if (rc == -1) {
-		printf("client %d: failed to connect\n", client->id);
-		return;
+	if (stress.tls) {
+		msg = kiwi_fe_write_ssl_request(NULL);
+		if (msg == NULL)
+			return -1;
+		rc = od_write(&client->io, msg);
+		if (rc == -1) {
+			printf("client %d: write error: %s\n", client->id,
+			       od_io_error(&client->io));
+			return -1;
+		}
+		char type;
+		rc = od_io_read(&client->io, &type, 1, UINT32_MAX);
+		if (rc == -1) {
+			printf("client %d: read error: %s\n", client->id,
+			       od_io_error(&client->io));
+			return -1;
+		}
+		if (type != 'S') {
+			printf("client %d: tls is not supported\n", client->id);
+			return -1;
+		}
+		rc = machine_set_tls(client->io.io, stress.tls_ctx, UINT32_MAX);
+		if (rc == -1) {
+			printf("client %d: tls error: %s\n", client->id,
+			       od_io_error(&client->io));
+			return -1;
+		}
 	}
 
-	printf("client %d: connected\n", client->id);
-
-	/* handle client startup */
 	kiwi_fe_arg_t argv[] = {
 			{"user",        5},
 			{stress.user,   strlen(stress.user) + 1},
@@ -84,140 +198,457 @@ stress_client_main(void *arg) {
 			{stress.dbname, strlen(stress.dbname) + 1}
 	};
 
-	machine_msg_t *msg;
 	msg = kiwi_fe_write_startup_message(NULL, 4, argv);
 	if (msg == NULL)
-		return;
+		return -1;
 
-	rc = od_write(&client->io, msg);
-	if (rc == -1) {
-		printf("client %d: write error: %s\n", client->id,
-		       machine_error(client->io.io));
-		return;
+	/* prepare the statement once per connection */
+	if (stress.protocol == STRESS_PREPARED) {
+		msg = kiwi_fe_write_parse(msg, "stress", 7, stress.query,
+		                          strlen(stress.query) + 1, 0, NULL);
+		if (msg == NULL)
+			return -1;
+		msg = kiwi_fe_write_sync(msg);
+		if (msg == NULL)
+			return -1;
 	}
 
-	rc = machine_write_stop(client->io.io);
+	rc = od_write(&client->io, msg);
 	if (rc == -1) {
 		printf("client %d: write error: %s\n", client->id,
-		       machine_error(client->io.io));
-		return;
+		       od_io_error(&client->io));
+		return -1;
 	}
 
-	while (1) {
+	int ready = 0;
+	int ready_expected = 1;
+	if (stress.protocol == STRESS_PREPARED)
+		ready_expected = 2;
+	while (ready < ready_expected) {
 		msg = od_read(&client->io, UINT32_MAX);
 		if (msg == NULL) {
-			printf("read error");
-			return;
+			printf("client %d: read error: %s\n", client->id,
+			       od_io_error(&client->io));
+			return -1;
 		}
 		kiwi_be_type_t type = *(char *) machine_msg_data(msg);
-
 		if (type == KIWI_BE_ERROR_RESPONSE) {
-			printf("Error response: %s\n", (char*)machine_msg_data(msg) + 5);
-			return;
+			printf("client %d: error response: %s\n", client->id,
+			       (char*)machine_msg_data(msg) + 5);
+			machine_msg_free(msg);
+			return -1;
 		}
 		machine_msg_free(msg);
-
 		if (type == KIWI_BE_READY_FOR_QUERY)
-			break;
+			ready++;
 	}
+	return 0;
+}
 
-	printf("client %d: ready\n", client->id);
+static int
+stress_client_connect(stress_client_t *client)
+{
+	uint64_t start_time = stress_time_us();
 
-	char query[] = "select generate_series(1,10,1)";
+	od_io_init(&client->io);
+	int rc;
+	rc = od_io_prepare(&client->io, machine_io_create(), 8192, 0);
+	if (rc == -1 || client->io.io == NULL) {
+		printf("client %d: failed to create io\n", client->id);
+		return -1;
+	}
 
-	/* oltp */
-	while (stress_run) {
-		int start_time = od_histogram_time_us();
+	machine_set_nodelay(client->io.io, 1);
+	machine_set_keepalive(client->io.io, 1, 7200);
 
-		/* request */
-		msg = kiwi_fe_write_query(NULL, query, sizeof(query));
+	rc = machine_connect(client->io.io, stress.ai->ai_addr, UINT32_MAX);
+	if (rc == -1) {
+		printf("client %d: failed to connect: %s\n", client->id,
+		       od_io_error(&client->io));
+		return -1;
+	}
+
+	rc = stress_client_startup(client);
+	if (rc == -1)
+		return -1;
+
+	client->connects++;
+	stress_latency_add(&client->machine->connect, stress_time_us() - start_time);
+	return 0;
+}
+
+static void
+stress_client_close(stress_client_t *client, int terminate)
+{
+	if (client->io.io == NULL)
+		return;
+	if (terminate) {
+		machine_msg_t *msg;
+		msg = kiwi_fe_write_terminate(NULL);
+		if (msg)
+			od_write(&client->io, msg);
+	}
+	od_io_close(&client->io);
+	od_io_free(&client->io);
+}
+
+static machine_msg_t*
+stress_client_request(void)
+{
+	machine_msg_t *msg = NULL;
+	int query_len = strlen(stress.query) + 1;
+	char *stmt = "";
+	int stmt_len = 1;
+	if (stress.protocol == STRESS_PREPARED) {
+		stmt = "stress";
+		stmt_len = 7;
+	}
+	int i;
+	for (i = 0; i < stress.batch; i++) {
+		switch (stress.protocol) {
+		case STRESS_SIMPLE:
+			msg = kiwi_fe_write_query(msg, stress.query, query_len);
+			break;
+		case STRESS_EXTENDED:
+			msg = kiwi_fe_write_parse(msg, "", 1, stress.query,
+			                          query_len, 0, NULL);
+			if (msg == NULL)
+				return NULL;
+			/* fallthrough */
+		case STRESS_PREPARED:
+			msg = kiwi_fe_write_bind(msg, "", 1, stmt, stmt_len,
+			                         0, NULL, 0, NULL, 0, NULL, NULL);
+			if (msg == NULL)
+				return NULL;
+			msg = kiwi_fe_write_execute(msg, "", 1, 0);
+			if (msg == NULL)
+				return NULL;
+			msg = kiwi_fe_write_sync(msg);
+			break;
+		}
 		if (msg == NULL)
-			return;
-		rc = od_write(&client->io, msg);
+			return NULL;
+	}
+	return msg;
+}
+
+static int
+stress_client_batch(stress_client_t *client)
+{
+	/* in open loop mode the latency is measured from the time
+	 * the batch was scheduled, so a stalled server is not
+	 * hidden by the client waiting for it */
+	uint64_t start_time;
+	if (stress.rate > 0) {
+		uint64_t now = stress_time_us();
+		if (client->schedule > now)
+			machine_sleep((client->schedule - now + 999) / 1000);
+		if (! stress_running())
+			return 0;
+		start_time = client->schedule;
+		client->schedule += (uint64_t)stress.clients * stress.batch * 1000000 /
+		                    stress.rate;
+	} else {
+		start_time = stress_time_us();
+	}
+
+	machine_msg_t *msg;
+	msg = stress_client_request();
+	if (msg == NULL)
+		return -1;
+	int rc;
+	rc = od_write(&client->io, msg);
+	if (rc == -1) {
+		printf("client %d: write error: %s\n", client->id,
+		       od_io_error(&client->io));
+		return -1;
+	}
+
+	/* every query of the batch ends with ReadyForQuery */
+	int ready = 0;
+	while (ready < stress.batch) {
+		msg = od_read(&client->io, UINT32_MAX);
+		if (msg == NULL) {
+			printf("client %d: read error: %s\n", client->id,
+			       od_io_error(&client->io));
+			return -1;
+		}
+		char type = *(char *) machine_msg_data(msg);
+		client->recv_bytes += machine_msg_size(msg);
+		machine_msg_free(msg);
+
+		if (type == KIWI_BE_ERROR_RESPONSE) {
+			client->errors++;
+			continue;
+		}
+		if (type == KIWI_BE_READY_FOR_QUERY) {
+			/* timers may fire slightly ahead of the schedule */
+			uint64_t now = stress_time_us();
+			stress_latency_add(&client->machine->query,
+			                   now > start_time ? now - start_time : 0);
+			client->processed++;
+			ready++;
+		}
+	}
+	return 0;
+}
+
+static inline void
+stress_client_main(void *arg)
+{
+	stress_client_t *client = arg;
+
+	/* spread arrivals of the clients over the first interval */
+	if (stress.rate > 0)
+		client->schedule = stress_time_us() +
+		                   (uint64_t)client->id * stress.batch * 1000000 / stress.rate;
+
+	while (stress_running()) {
+		int rc;
+		rc = stress_client_connect(client);
 		if (rc == -1) {
-			printf("client %d: write error: %s\n", client->id,
-			       machine_error(client->io.io));
+			client->connect_errors++;
+			stress_client_close(client, 0);
+			/* churn mode keeps on connecting */
+			if (! stress.churn)
+				return;
+			machine_sleep(100);
+			continue;
+		}
+
+		/* idle clients only hold the connection */
+		if (client->idle) {
+			while (stress_running())
+				machine_sleep(100);
+			stress_client_close(client, 1);
 			return;
 		}
-		/* no flush */
-
-		/* reply */
-		for (;;) {
-			msg = od_read(&client->io, INT32_MAX);
-			if (msg == NULL) {
-				printf("client %d: read error: %s\n", client->id,
-				       machine_error(client->io.io));
-				return;
-			}
-			char type = *(char *) machine_msg_data(msg);
-			machine_msg_free(msg);
 
-			if (type == KIWI_BE_ERROR_RESPONSE)
+		int count = 0;
+		while (stress_running()) {
+			rc = stress_client_batch(client);
+			if (rc == -1)
 				break;
-
-			if (type == KIWI_BE_READY_FOR_QUERY) {
-				int execution_time = od_histogram_time_us() - start_time;
-				od_histogram_add(&stress_histogram, execution_time);
-				client->processed++;
+			count += stress.batch;
+			if (stress.churn && count >= stress.churn)
 				break;
-			}
 		}
+		stress_client_close(client, rc == 0);
+		if (rc == -1 && ! stress.churn)
+			return;
 	}
+}
 
-	/* finish */
-	msg = kiwi_fe_write_terminate(NULL);
-	if (msg == NULL)
-		return;
-	rc = od_write(&client->io, msg);
-	if (rc == -1) {
-		printf("client %d: write error: %s\n", client->id,
-		       machine_error(client->io.io));
+static void
+stress_print_latency(char *name, stress_latency_t *latency)
+{
+	printf("%s latency (usec): avg %" PRIu64, name,
+	       latency->count ? latency->sum / latency->count : 0);
+	int i;
+	for (i = 0; i < STRESS_QUANTILES; i++)
+		printf(", %s %" PRIu64, stress_quantile_names[i],
+		       stress_latency_quantile(latency, stress_quantiles[i]));
+	printf(", max %" PRIu64 "\n", latency->max);
+}
+
+static void
+stress_json_latency(FILE *out, char *name, stress_latency_t *latency)
+{
+	fprintf(out, "  \"%s\": {\"count\": %" PRIu64 ", \"avg_us\": %" PRIu64,
+	        name, latency->count,
+	        latency->count ? latency->sum / latency->count : 0);
+	int i;
+	for (i = 0; i < STRESS_QUANTILES; i++)
+		fprintf(out, ", \"%s_us\": %" PRIu64, stress_quantile_names[i],
+		        stress_latency_quantile(latency, stress_quantiles[i]));
+	fprintf(out, ", \"max_us\": %" PRIu64 "}", latency->max);
+}
+
+static void
+stress_report(stress_client_t *clients, double duration)
+{
+	uint64_t processed      = 0;
+	uint64_t errors         = 0;
+	uint64_t recv_bytes     = 0;
+	uint64_t connects       = 0;
+	uint64_t connect_errors = 0;
+	int i;
+	for (i = 0; i < stress.clients + stress.idle; i++) {
+		processed      += clients[i].processed;
+		errors         += clients[i].errors;
+		recv_bytes     += clients[i].recv_bytes;
+		connects       += clients[i].connects;
+		connect_errors += clients[i].connect_errors;
+	}
+
+	printf("\n");
+	printf("duration:    %.2f secs\n", duration);
+	printf("queries:     %" PRIu64 " (%" PRIu64 " errors)\n", processed, errors);
+	printf("connects:    %" PRIu64 " (%" PRIu64 " errors)\n", connects, connect_errors);
+	printf("throughput:  %.2f queries/sec, %.2f connects/sec\n",
+	       processed / duration, connects / duration);
+	printf("received:    %.2f MB/sec\n", recv_bytes / duration / (1024 * 1024));
+	stress_print_latency("query", &stress_query);
+	stress_print_latency("connect", &stress_connect);
+
+	if (stress.json == NULL)
 		return;
+	FILE *out = stdout;
+	if (strcmp(stress.json, "-") != 0) {
+		out = fopen(stress.json, "w");
+		if (out == NULL) {
+			printf("failed to open %s\n", stress.json);
+			return;
+		}
 	}
+	fprintf(out, "{\n");
+	fprintf(out, "  \"threads\": %d, \"clients\": %d, \"idle\": %d, \"rate\": %d, \"batch\": %d, \"churn\": %d,\n",
+	        stress.machines, stress.clients, stress.idle, stress.rate, stress.batch, stress.churn);
+	fprintf(out, "  \"tls\": %s, \"protocol\": \"%s\",\n",
+	        stress.tls ? "true" : "false",
+	        stress_protocol_names[stress.protocol]);
+	fprintf(out, "  \"duration\": %.3f,\n", duration);
+	fprintf(out, "  \"queries\": %" PRIu64 ", \"errors\": %" PRIu64 ",\n",
+	        processed, errors);
+	fprintf(out, "  \"connects\": %" PRIu64 ", \"connect_errors\": %" PRIu64 ",\n",
+	        connects, connect_errors);
+	fprintf(out, "  \"qps\": %.2f, \"cps\": %.2f, \"recv_bytes\": %" PRIu64 ",\n",
+	        processed / duration, connects / duration, recv_bytes);
+	stress_json_latency(out, "query", &stress_query);
+	fprintf(out, ",\n");
+	stress_json_latency(out, "connect", &stress_connect);
+	fprintf(out, "\n}\n");
+	if (out != stdout)
+		fclose(out);
+}
 
-	machine_close(client->io.io);
-	printf("client %d: done (%d processed)\n", client->id, client->processed);
+static inline void
+stress_machine_main(void *arg)
+{
+	stress_machine_t *machine = arg;
+	int total = stress.clients + stress.idle;
+
+	/* clients start on every machine at once */
+	__atomic_add_fetch(&stress_ready, 1, __ATOMIC_SEQ_CST);
+	while (! __atomic_load_n(&stress_start, __ATOMIC_SEQ_CST))
+		machine_sleep(1);
+
+	int i;
+	for (i = machine->id; i < total; i += stress.machines) {
+		stress_client_t *client = &machine->clients[i];
+		client->coroutine_id = machine_coroutine_create(stress_client_main, client);
+	}
+	for (i = machine->id; i < total; i += stress.machines)
+		machine_join(machine->clients[i].coroutine_id);
 }
 
 static inline void
-stress_main(void *arg) {
+stress_main(void *arg)
+{
 	stress_t *stress = arg;
 
+	/* resolve host once for every connection */
+	int rc;
+	rc = machine_getaddrinfo(stress->host, stress->port, NULL, &stress->ai,
+	                         UINT32_MAX);
+	if (rc == -1) {
+		printf("failed to resolve host\n");
+		return;
+	}
+
+	if (stress->tls) {
+		stress->tls_ctx = machine_tls_create();
+		if (stress->tls_ctx == NULL)
+			return;
+		machine_tls_set_verify(stress->tls_ctx, "none");
+		rc = machine_tls_create_context(stress->tls_ctx, 1);
+		if (rc == -1) {
+			printf("failed to create tls context\n");
+			return;
+		}
+	}
+
+	int total = stress->clients + stress->idle;
 	stress_client_t *clients;
-	clients = calloc(stress->clients, sizeof(stress_client_t));
+	clients = calloc(total, sizeof(stress_client_t));
 	if (clients == NULL)
 		return;
+	stress_machine_t *machines;
+	machines = calloc(stress->machines, sizeof(stress_machine_t));
+	if (machines == NULL) {
+		free(clients);
+		return;
+	}
 
-	stress_run = 1;
-
-	/* create workers */
-	int i = 0;
-	for (; i < stress->clients; i++) {
+	int i;
+	for (i = 0; i < total; i++) {
 		stress_client_t *client = &clients[i];
 		client->id = i;
-		client->coroutine_id = machine_coroutine_create(stress_client_main, client);
+		client->idle = i >= stress->clients;
+		client->machine = &machines[i % stress->machines];
 	}
 
-	/* give time for work */
-	machine_sleep(stress->time_to_run * 1000);
+	/* create load machines */
+	int created = 0;
+	for (i = 0; i < stress->machines; i++) {
+		stress_machine_t *machine = &machines[i];
+		machine->id = i;
+		machine->clients = clients;
+		if (stress_latency_init(&machine->query) == -1 ||
+		    stress_latency_init(&machine->connect) == -1)
+			break;
+		machine->machine_id = machine_create("stresser", stress_machine_main,
+		                                     machine);
+		if (machine->machine_id == -1)
+			break;
+		created++;
+	}
 
-	stress_run = 0;
+	if (created == stress->machines) {
+		while (__atomic_load_n(&stress_ready, __ATOMIC_SEQ_CST) < created)
+			machine_sleep(1);
+		__atomic_store_n(&stress_run, 1, __ATOMIC_SEQ_CST);
+	} else {
+		printf("failed to create load machines\n");
+	}
+	uint64_t start_time = stress_time_us();
+	__atomic_store_n(&stress_start, 1, __ATOMIC_SEQ_CST);
 
-	/* wait for completion and calculate stats */
-	for (i = 0; i < stress->clients; i++) {
-		stress_client_t *client = &clients[i];
-		machine_join(client->coroutine_id);
-		if (client->io.io)
-			machine_io_free(client->io.io);
+	/* give time for work */
+	if (stress_running())
+		machine_sleep(stress->time_to_run * 1000);
+
+	__atomic_store_n(&stress_run, 0, __ATOMIC_SEQ_CST);
+	double duration = (stress_time_us() - start_time) / 1000000.0;
+
+	/* wait for completion and merge stats of the machines */
+	for (i = 0; i < created; i++)
+		machine_wait(machines[i].machine_id);
+	for (i = 0; i < stress->machines; i++) {
+		stress_machine_t *machine = &machines[i];
+		if (machine->query.hgram) {
+			stress_latency_merge(&stress_query, &machine->query);
+			od_hgram_free(machine->query.hgram);
+		}
+		if (machine->connect.hgram) {
+			stress_latency_merge(&stress_connect, &machine->connect);
+			od_hgram_free(machine->connect.hgram);
+		}
 	}
-	free(clients);
 
 	/* result */
-	od_histogram_print(&stress_histogram, stress->clients, stress->time_to_run);
+	if (created == stress->machines)
+		stress_report(clients, duration);
+
+	free(machines);
+	free(clients);
+	freeaddrinfo(stress->ai);
+	if (stress->tls_ctx)
+		machine_tls_free(stress->tls_ctx);
 }
 
-int main(int argc, char *argv[]) {
-	od_histogram_init(&stress_histogram);
+int main(int argc, char *argv[])
+{
 	memset(&stress, 0, sizeof(stress));
 	stress_run = 0;
 	char *user = getenv("USER");
@@ -227,11 +658,15 @@ int main(int argc, char *argv[]) {
 	stress.dbname = user;
 	stress.host = "localhost";
 	stress.port = "6432";
+	stress.query = "select generate_series(1,10,1)";
 	stress.time_to_run = 5;
+	stress.machines = 1;
 	stress.clients = 10;
+	stress.batch = 1;
+	stress.protocol = STRESS_SIMPLE;
 
 	int opt;
-	while ((opt = getopt(argc, argv, "d:u:h:p:t:c:")) != -1) {
+	while ((opt = getopt(argc, argv, "d:u:h:p:t:T:c:i:q:r:b:C:m:sj:")) != -1) {
 		switch (opt) {
 			/* database */
 			case 'd':
@@ -253,33 +688,111 @@ int main(int argc, char *argv[]) {
 			case 't':
 				stress.time_to_run = atoi(optarg);
 				break;
+				/* threads */
+			case 'T':
+				stress.machines = atoi(optarg);
+				break;
 				/* clients */
 			case 'c':
 				stress.clients = atoi(optarg);
 				break;
+				/* idle clients */
+			case 'i':
+				stress.idle = atoi(optarg);
+				break;
+				/* query */
+			case 'q':
+				stress.query = optarg;
+				break;
+				/* open loop rate */
+			case 'r':
+				stress.rate = atoi(optarg);
+				break;
+				/* pipeline batch */
+			case 'b':
+				stress.batch = atoi(optarg);
+				break;
+				/* churn */
+			case 'C':
+				stress.churn = atoi(optarg);
+				break;
+				/* protocol */
+			case 'm':
+				if (strcmp(optarg, "simple") == 0)
+					stress.protocol = STRESS_SIMPLE;
+				else
+				if (strcmp(optarg, "extended") == 0)
+					stress.protocol = STRESS_EXTENDED;
+				else
+				if (strcmp(optarg, "prepared") == 0)
+					stress.protocol = STRESS_PREPARED;
+				else {
+					printf("unknown protocol: %s\n", optarg);
+					return 1;
+				}
+				break;
+				/* tls */
+			case 's':
+				stress.tls = 1;
+				break;
+				/* json */
+			case 'j':
+				stress.json = optarg;
+				break;
 			default:
 				printf("PostgreSQL benchmarking.\n\n");
-				printf("usage: %s [duhptc]\n", argv[0]);
+				printf("usage: %s [duhptTciqrbCmsj]\n", argv[0]);
 				printf("  \n");
 				printf("  -d <database>   database name\n");
 				printf("  -u <user>       user name\n");
 				printf("  -h <host>       server address\n");
 				printf("  -p <port>       server port\n");
 				printf("  -t <time>       time to run (seconds)\n");
+				printf("  -T <threads>    number of load generating threads\n");
 				printf("  -c <clients>    number of clients\n");
+				printf("  -i <clients>    number of extra idle clients\n");
+				printf("  -q <query>      query to run\n");
+				printf("  -r <rate>       open loop, total queries per second\n");
+				printf("  -b <batch>      queries pipelined per round trip\n");
+				printf("  -C <count>      reconnect after count queries\n");
+				printf("  -m <protocol>   simple, extended or prepared\n");
+				printf("  -s              use tls\n");
+				printf("  -j <file>       write json results, - for stdout\n");
 				return 1;
 		}
 	}
+	if (stress.clients <= 0 || stress.machines <= 0 || stress.idle < 0 || stress.batch <= 0 ||
+	    stress.rate < 0 || stress.churn < 0) {
+		printf("invalid arguments\n");
+		return 1;
+	}
 
 	printf("PostgreSQL benchmarking.\n\n");
 	printf("time to run: %d secs\n", stress.time_to_run);
+	printf("threads:     %d\n", stress.machines);
 	printf("clients:     %d\n", stress.clients);
+	if (stress.idle > 0)
+		printf("idle:        %d\n", stress.idle);
 	printf("database:    %s\n", stress.dbname);
 	printf("user:        %s\n", stress.user);
 	printf("host:        %s\n", stress.host);
 	printf("port:        %s\n", stress.port);
+	printf("query:       %s\n", stress.query);
+	printf("protocol:    %s\n", stress_protocol_names[stress.protocol]);
+	printf("tls:         %s\n", stress.tls ? "on" : "off");
+	if (stress.rate > 0)
+		printf("rate:        %d queries/sec (open loop)\n", stress.rate);
+	else
+		printf("rate:        closed loop\n");
+	printf("batch:       %d\n", stress.batch);
+	if (stress.churn > 0)
+		printf("churn:       reconnect every %d queries\n", stress.churn);
 	printf("\n");
 
+	if (stress_latency_init(&stress_query) == -1 ||
+	    stress_latency_init(&stress_connect) == -1)
+		return 1;
+
 	machinarium_init();
 
 	int64_t machine;
@@ -288,5 +801,8 @@ int main(int argc, char *argv[]) {
 	machine_wait(machine);
 
 	machinarium_free();
+
+	od_hgram_free(stress_query.hgram);
+	od_hgram_free(stress_connect.hgram);
 	return 0;
 }
@@ -0,0 +1,670 @@
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+/* router benchmarks without network io.
+ *
+ * Router is built from a generated config of N database rules,
+ * every route gets M idle fake servers, eventfds which are never
+ * read or written, so handoffs between workers still register
+ * them in the epoll of the new worker as real servers do. Clients
+ * of K worker machines run attach/detach cycles, holding the
+ * server over one yield, and optionally route and unroute on each
+ * cycle. Latency is the time of one cycle.
+ *
+ * Lock hold and wait times are taken by the pthread wrappers
+ * below, the bench is linked with --wrap of the pthread mutex and
+ * rwlock calls. Every lock taken on the worker machines is
+ * counted, router locks and the machinarium ones taken by
+ * handoffs. Timing adds two clock reads to every lock, so it is
+ * enabled by -l only. */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+typedef struct {
+	char *name;
+	int   route;
+	int   hot;
+} router_bench_t;
+
+typedef struct {
+	int   routes;
+	int   servers;
+	int   workers;
+	int   clients;
+	int   time_sec;
+	int   locks;
+	char *filter;
+} router_bench_config_t;
+
+#define ROUTER_BENCH_LOCK_DEPTH 16
+
+typedef struct {
+	void     *lock;
+	uint64_t  time;
+} router_bench_held_t;
+
+typedef struct {
+	od_hgram_t          *hold;
+	od_hgram_t          *wait;
+	int                  depth;
+	router_bench_held_t  held[ROUTER_BENCH_LOCK_DEPTH];
+} router_bench_locks_t;
+
+typedef struct router_bench_run router_bench_run_t;
+
+typedef struct {
+	router_bench_run_t   *run;
+	int                   id;
+	uint64_t              count;
+	od_hgram_t           *hgram;
+	router_bench_locks_t  locks;
+	int                   error;
+} router_bench_worker_t;
+
+typedef struct {
+	router_bench_worker_t *worker;
+	od_client_t           *client;
+	int64_t                coroutine;
+} router_bench_client_t;
+
+struct router_bench_run {
+	router_bench_t        *bench;
+	router_bench_config_t *config;
+	char                  *config_file;
+	od_instance_t         *instance;
+	od_config_t            od_config;
+	od_router_t            router;
+	od_worker_pool_t       worker_pool;
+	od_global_t            global;
+	machine_io_t         **servers;
+	int                    servers_count;
+	router_bench_worker_t *workers;
+	od_atomic_u32_t        stop;
+	uint64_t               time_ns;
+	int                    error;
+};
+
+static __thread router_bench_locks_t *router_bench_locks = NULL;
+
+static inline uint64_t
+router_bench_time_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * (uint64_t)1000000000 + t.tv_nsec;
+}
+
+int __real_pthread_mutex_lock(pthread_mutex_t*);
+int __real_pthread_mutex_unlock(pthread_mutex_t*);
+int __real_pthread_rwlock_rdlock(pthread_rwlock_t*);
+int __real_pthread_rwlock_wrlock(pthread_rwlock_t*);
+int __real_pthread_rwlock_unlock(pthread_rwlock_t*);
+
+static inline void
+router_bench_lock_taken(void *lock, uint64_t start)
+{
+	router_bench_locks_t *locks = router_bench_locks;
+	uint64_t now = router_bench_time_ns();
+	od_hgram_add_data_point(locks->wait, now - start);
+	if (locks->depth == ROUTER_BENCH_LOCK_DEPTH)
+		return;
+	locks->held[locks->depth].lock = lock;
+	locks->held[locks->depth].time = now;
+	locks->depth++;
+}
+
+static inline void
+router_bench_lock_released(void *lock)
+{
+	/* locks are not always released in reverse order */
+	router_bench_locks_t *locks = router_bench_locks;
+	int i;
+	for (i = locks->depth - 1; i >= 0; i--) {
+		if (locks->held[i].lock != lock)
+			continue;
+		od_hgram_add_data_point(locks->hold,
+		                        router_bench_time_ns() - locks->held[i].time);
+		locks->depth--;
+		memmove(&locks->held[i], &locks->held[i + 1],
+		        (locks->depth - i) * sizeof(router_bench_held_t));
+		return;
+	}
+}
+
+int
+__wrap_pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+	if (router_bench_locks == NULL)
+		return __real_pthread_mutex_lock(mutex);
+	uint64_t start = router_bench_time_ns();
+	int rc = __real_pthread_mutex_lock(mutex);
+	if (rc == 0)
+		router_bench_lock_taken(mutex, start);
+	return rc;
+}
+
+int
+__wrap_pthread_mutex_unlock(pthread_mutex_t *mutex)
+{
+	if (router_bench_locks)
+		router_bench_lock_released(mutex);
+	return __real_pthread_mutex_unlock(mutex);
+}
+
+int
+__wrap_pthread_rwlock_rdlock(pthread_rwlock_t *rwlock)
+{
+	if (router_bench_locks == NULL)
+		return __real_pthread_rwlock_rdlock(rwlock);
+	uint64_t start = router_bench_time_ns();
+	int rc = __real_pthread_rwlock_rdlock(rwlock);
+	if (rc == 0)
+		router_bench_lock_taken(rwlock, start);
+	return rc;
+}
+
+int
+__wrap_pthread_rwlock_wrlock(pthread_rwlock_t *rwlock)
+{
+	if (router_bench_locks == NULL)
+		return __real_pthread_rwlock_wrlock(rwlock);
+	uint64_t start = router_bench_time_ns();
+	int rc = __real_pthread_rwlock_wrlock(rwlock);
+	if (rc == 0)
+		router_bench_lock_taken(rwlock, start);
+	return rc;
+}
+
+int
+__wrap_pthread_rwlock_unlock(pthread_rwlock_t *rwlock)
+{
+	if (router_bench_locks)
+		router_bench_lock_released(rwlock);
+	return __real_pthread_rwlock_unlock(rwlock);
+}
+
+static char*
+router_bench_config_write(router_bench_config_t *config)
+{
+	static char path[] = "/tmp/odyssey_router_bench.XXXXXX";
+	int fd = mkstemp(path);
+	if (fd == -1)
+		return NULL;
+	FILE *file = fdopen(fd, "w");
+	if (file == NULL) {
+		close(fd);
+		unlink(path);
+		return NULL;
+	}
+	fprintf(file, "workers %d\n", config->workers);
+	fprintf(file, "log_to_stdout yes\n");
+	fprintf(file, "storage \"bench\" {\n"
+	              "\ttype \"remote\"\n"
+	              "\thost \"127.0.0.1\"\n"
+	              "\tport 5432\n"
+	              "}\n");
+	int i;
+	for (i = 0; i < config->routes; i++) {
+		fprintf(file, "database \"db%d\" {\n"
+		              "\tuser \"bench\" {\n"
+		              "\t\tauthentication \"none\"\n"
+		              "\t\tstorage \"bench\"\n"
+		              "\t\tpool \"transaction\"\n"
+		              "\t\tpool_size %d\n"
+		              "\t\tpool_timeout 0\n"
+		              "\t}\n"
+		              "}\n", i, config->servers);
+	}
+	fclose(file);
+	return path;
+}
+
+static od_client_t*
+router_bench_client(router_bench_run_t *run, int worker_id, int route_id)
+{
+	od_client_t *client = od_client_allocate();
+	if (client == NULL)
+		return NULL;
+	client->global    = &run->global;
+	client->worker_id = worker_id;
+	od_id_generate(&client->id, "c");
+	char database[32];
+	int len = od_snprintf(database, sizeof(database), "db%d", route_id);
+	kiwi_var_set(&client->startup.user, KIWI_VAR_UNDEF, "bench", 6);
+	kiwi_var_set(&client->startup.database, KIWI_VAR_UNDEF, database,
+	             len + 1);
+	return client;
+}
+
+static int
+router_bench_prepare(router_bench_run_t *run)
+{
+	router_bench_config_t *config = run->config;
+	od_config_init(&run->od_config);
+	od_router_init(&run->router);
+	od_worker_pool_init(&run->worker_pool);
+	od_global_init(&run->global, run->instance, NULL, &run->router, NULL,
+	               &run->worker_pool, NULL);
+
+	od_error_t error;
+	od_error_init(&error);
+	int rc;
+	rc = od_config_reader_import(&run->od_config, &run->router.rules, &error,
+	                             run->config_file);
+	if (rc == -1) {
+		printf("%s: config: %s\n", run->bench->name, error.error);
+		return -1;
+	}
+	rc = od_config_validate(&run->od_config, &run->instance->logger);
+	if (rc == -1)
+		return -1;
+	rc = od_rules_validate(&run->router.rules, &run->od_config,
+	                       &run->instance->logger);
+	if (rc == -1)
+		return -1;
+
+	/* route of every rule with its idle servers */
+	run->servers = calloc(config->routes * config->servers,
+	                      sizeof(machine_io_t*));
+	if (run->servers == NULL)
+		return -1;
+	int i;
+	for (i = 0; i < config->routes; i++) {
+		od_client_t *client = router_bench_client(run, 0, i);
+		if (client == NULL)
+			return -1;
+		od_router_status_t status;
+		status = od_router_route(&run->router, &run->od_config, client);
+		if (status != OD_ROUTER_OK) {
+			od_client_free(client);
+			return -1;
+		}
+		od_route_t *route = client->route;
+		int j;
+		for (j = 0; j < config->servers; j++) {
+			machine_io_t *io = machine_io_create();
+			if (io == NULL)
+				break;
+			run->servers[run->servers_count++] = io;
+			rc = machine_eventfd(io);
+			if (rc == -1)
+				break;
+			od_server_t *server = od_server_allocate();
+			if (server == NULL)
+				break;
+			od_id_generate(&server->id, "s");
+			server->global      = &run->global;
+			server->route       = route;
+			server->pool_worker = j % config->workers;
+			server->io.io       = io;
+			od_route_lock(route, OD_LOCK_OTHER);
+			od_server_pool_set(&route->server_pool, server, OD_SERVER_IDLE);
+			od_route_unlock(route);
+		}
+		od_router_unroute(&run->router, client);
+		od_client_free(client);
+		if (j < config->servers) {
+			printf("%s: failed to create servers\n", run->bench->name);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void
+router_bench_cleanup(router_bench_run_t *run)
+{
+	/* servers left idle are freed by the route, their eventfds are
+	 * closed here */
+	int i;
+	for (i = 0; i < run->servers_count; i++) {
+		machine_close(run->servers[i]);
+		machine_io_free(run->servers[i]);
+	}
+	free(run->servers);
+	od_router_free(&run->router);
+	od_config_free(&run->od_config);
+}
+
+static inline int
+router_bench_cycle(router_bench_run_t *run, od_client_t *client)
+{
+	od_router_t *router = &run->router;
+	od_config_t *config = &run->od_config;
+	od_router_status_t status;
+	if (run->bench->route) {
+		status = od_router_route(router, config, client);
+		if (status != OD_ROUTER_OK)
+			return -1;
+	}
+	status = od_router_attach(router, config, client, false);
+	if (status != OD_ROUTER_OK) {
+		if (run->bench->route)
+			od_router_unroute(router, client);
+		return -1;
+	}
+	/* transaction of the client */
+	machine_sleep(0);
+	od_router_detach(router, config, client);
+	if (run->bench->route)
+		od_router_unroute(router, client);
+	return 0;
+}
+
+static void
+router_bench_client_main(void *arg)
+{
+	router_bench_client_t *bench_client = arg;
+	od_client_t *client = bench_client->client;
+	router_bench_worker_t *worker = bench_client->worker;
+	router_bench_run_t *run = worker->run;
+	if (! run->bench->route) {
+		od_router_status_t status;
+		status = od_router_route(&run->router, &run->od_config, client);
+		if (status != OD_ROUTER_OK) {
+			worker->error = 1;
+			return;
+		}
+	}
+	while (! od_atomic_u32_of(&run->stop)) {
+		uint64_t start = router_bench_time_ns();
+		int rc = router_bench_cycle(run, client);
+		if (rc == -1) {
+			worker->error = 1;
+			break;
+		}
+		od_hgram_add_data_point(worker->hgram, router_bench_time_ns() - start);
+		worker->count++;
+	}
+	if (! run->bench->route)
+		od_router_unroute(&run->router, client);
+}
+
+static void
+router_bench_worker(void *arg)
+{
+	router_bench_worker_t *worker = arg;
+	router_bench_run_t *run = worker->run;
+	router_bench_config_t *config = run->config;
+	if (config->locks)
+		router_bench_locks = &worker->locks;
+
+	router_bench_client_t *clients;
+	clients = calloc(config->clients, sizeof(router_bench_client_t));
+	if (clients == NULL) {
+		worker->error = 1;
+		goto done;
+	}
+	int i;
+	for (i = 0; i < config->clients; i++) {
+		router_bench_client_t *client = &clients[i];
+		client->worker    = worker;
+		client->coroutine = -1;
+		int route_id = 0;
+		if (! run->bench->hot)
+			route_id = (worker->id * config->clients + i) % config->routes;
+		client->client = router_bench_client(run, worker->id, route_id);
+		if (client->client == NULL) {
+			worker->error = 1;
+			break;
+		}
+		client->coroutine = machine_coroutine_create(router_bench_client_main,
+		                                             client);
+		if (client->coroutine == -1) {
+			worker->error = 1;
+			break;
+		}
+	}
+	if (worker->error)
+		od_atomic_u32_set(&run->stop, 1);
+	for (i = 0; i < config->clients; i++) {
+		router_bench_client_t *client = &clients[i];
+		if (client->coroutine != -1)
+			machine_join(client->coroutine);
+		if (client->client)
+			od_client_free(client->client);
+	}
+	free(clients);
+done:
+	router_bench_locks = NULL;
+}
+
+static void
+router_bench_main(void *arg)
+{
+	router_bench_run_t *run = arg;
+	router_bench_config_t *config = run->config;
+	int rc;
+	rc = router_bench_prepare(run);
+	if (rc == -1) {
+		run->error = 1;
+		goto done;
+	}
+
+	int64_t *machines = calloc(config->workers, sizeof(int64_t));
+	if (machines == NULL) {
+		run->error = 1;
+		goto done;
+	}
+	uint64_t start = router_bench_time_ns();
+	int i;
+	for (i = 0; i < config->workers; i++)
+		machines[i] = machine_create("router_bench_worker",
+		                             router_bench_worker,
+		                             &run->workers[i]);
+	machine_sleep(config->time_sec * 1000);
+	od_atomic_u32_set(&run->stop, 1);
+	for (i = 0; i < config->workers; i++) {
+		if (machines[i] == -1) {
+			run->error = 1;
+			continue;
+		}
+		machine_wait(machines[i]);
+		if (run->workers[i].error)
+			run->error = 1;
+	}
+	run->time_ns = router_bench_time_ns() - start;
+	free(machines);
+done:
+	router_bench_cleanup(run);
+}
+
+static router_bench_t router_benches[] = {
+	{ "attach",       0, 0 },
+	{ "attach_hot",   0, 1 },
+	{ "route",        1, 0 },
+	{ "route_hot",    1, 1 },
+	{ NULL, 0, 0 }
+};
+
+static void
+router_bench_run(router_bench_t *bench, router_bench_config_t *config,
+                 char *config_file, od_instance_t *instance)
+{
+	router_bench_run_t run;
+	memset(&run, 0, sizeof(run));
+	run.bench       = bench;
+	run.config      = config;
+	run.config_file = config_file;
+	run.instance    = instance;
+
+	run.workers = calloc(config->workers, sizeof(router_bench_worker_t));
+	od_hgram_t *hgram = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
+	od_hgram_t *hold  = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
+	od_hgram_t *wait  = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
+	if (run.workers == NULL || hgram == NULL || hold == NULL || wait == NULL)
+		goto done;
+	int i;
+	for (i = 0; i < config->workers; i++) {
+		router_bench_worker_t *worker = &run.workers[i];
+		worker->run        = &run;
+		worker->id         = i;
+		worker->hgram      = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
+		worker->locks.hold = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
+		worker->locks.wait = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
+		if (worker->hgram == NULL || worker->locks.hold == NULL ||
+		    worker->locks.wait == NULL)
+			goto done;
+	}
+
+	int64_t id;
+	id = machine_create("router_bench", router_bench_main, &run);
+	if (id != -1)
+		machine_wait(id);
+	if (id == -1 || run.error) {
+		printf("%s: failed\n", bench->name);
+		goto done;
+	}
+
+	uint64_t count = 0;
+	for (i = 0; i < config->workers; i++) {
+		router_bench_worker_t *worker = &run.workers[i];
+		count += worker->count;
+		od_hgram_merge(hgram, worker->hgram);
+		od_hgram_merge(hold, worker->locks.hold);
+		od_hgram_merge(wait, worker->locks.wait);
+	}
+	od_hgram_freeze(hgram, NULL, 0);
+	od_hgram_freeze(hold, NULL, 0);
+	od_hgram_freeze(wait, NULL, 0);
+	uint64_t time_ns = run.time_ns ? run.time_ns : 1;
+	printf("%-12s %12.0f %10.2f %10.2f %10.2f",
+	       bench->name, count * 1000000000.0 / time_ns,
+	       od_hgram_quantile(hgram, 0.5) / 1000.0,
+	       od_hgram_quantile(hgram, 0.99) / 1000.0,
+	       od_hgram_quantile(hgram, 0.999) / 1000.0);
+	if (config->locks)
+		printf(" %10.2f %10.2f %10.2f\n",
+		       od_hgram_quantile(hold, 0.5) / 1000.0,
+		       od_hgram_quantile(hold, 0.99) / 1000.0,
+		       od_hgram_quantile(wait, 0.99) / 1000.0);
+	else
+		printf("\n");
+done:
+	if (run.workers) {
+		for (i = 0; i < config->workers; i++) {
+			router_bench_worker_t *worker = &run.workers[i];
+			if (worker->hgram)
+				od_hgram_free(worker->hgram);
+			if (worker->locks.hold)
+				od_hgram_free(worker->locks.hold);
+			if (worker->locks.wait)
+				od_hgram_free(worker->locks.wait);
+		}
+		free(run.workers);
+	}
+	if (hgram)
+		od_hgram_free(hgram);
+	if (hold)
+		od_hgram_free(hold);
+	if (wait)
+		od_hgram_free(wait);
+}
+
+int main(int argc, char *argv[])
+{
+	router_bench_config_t config;
+	config.routes   = 16;
+	config.servers  = 8;
+	config.workers  = 4;
+	config.clients  = 16;
+	config.time_sec = 5;
+	config.locks    = 0;
+	config.filter   = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "r:s:w:c:t:lf:")) != -1) {
+		switch (opt) {
+			/* routes */
+			case 'r':
+				config.routes = atoi(optarg);
+				break;
+				/* servers */
+			case 's':
+				config.servers = atoi(optarg);
+				break;
+				/* workers */
+			case 'w':
+				config.workers = atoi(optarg);
+				break;
+				/* clients */
+			case 'c':
+				config.clients = atoi(optarg);
+				break;
+				/* time */
+			case 't':
+				config.time_sec = atoi(optarg);
+				break;
+				/* lock timing */
+			case 'l':
+				config.locks = 1;
+				break;
+				/* filter */
+			case 'f':
+				config.filter = optarg;
+				break;
+			default:
+				printf("odyssey router benchmarks.\n\n");
+				printf("usage: %s [rswctlf]\n", argv[0]);
+				printf("  \n");
+				printf("  -r <routes>     number of routes\n");
+				printf("  -s <servers>    servers of every route\n");
+				printf("  -w <workers>    number of worker machines\n");
+				printf("  -c <clients>    clients of every worker\n");
+				printf("  -t <time>       time of every benchmark in seconds\n");
+				printf("  -l              report lock hold and wait times\n");
+				printf("  -f <name>       run benchmarks matching name\n");
+				return 1;
+		}
+	}
+	if (config.routes <= 0 || config.servers <= 0 || config.workers <= 0 ||
+	    config.clients <= 0 || config.time_sec <= 0) {
+		printf("invalid arguments\n");
+		return 1;
+	}
+
+	od_instance_t instance;
+	od_instance_init(&instance);
+	char *config_file = router_bench_config_write(&config);
+	if (config_file == NULL) {
+		printf("failed to write config file\n");
+		od_instance_free(&instance);
+		return 1;
+	}
+
+	machinarium_init();
+
+	printf("routes %d, servers per route %d, workers %d, clients per worker %d\n",
+	       config.routes, config.servers, config.workers, config.clients);
+	printf("%-12s %12s %10s %10s %10s", "benchmark", "ops/sec",
+	       "p50 usec", "p99 usec", "p999 usec");
+	if (config.locks)
+		printf(" %10s %10s %10s", "hold p50", "hold p99", "wait p99");
+	printf("\n");
+	router_bench_t *bench = router_benches;
+	for (; bench->name; bench++) {
+		if (config.filter && strstr(bench->name, config.filter) == NULL)
+			continue;
+		router_bench_run(bench, &config, config_file, &instance);
+	}
+
+	machinarium_free();
+	unlink(config_file);
+	od_instance_free(&instance);
+	return 0;
+}
@@ -0,0 +1,71 @@
+
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+/* size and layout report of per connection structures: every
+ * client and server connection costs one od_client_t or
+ * od_server_t, hot fields are expected to stay in the first
+ * cache lines */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <machinarium.h>
+#include <kiwi.h>
+#include <odyssey.h>
+
+#define OD_CACHE_LINE 64
+
+static void
+od_struct_size(char *name, size_t size)
+{
+	printf("%-24s %6zu bytes %4zu cache lines\n", name, size,
+	       (size + OD_CACHE_LINE - 1) / OD_CACHE_LINE);
+}
+
+static void
+od_struct_field(char *name, size_t offset, size_t size)
+{
+	printf("  %-22s %6zu +%-5zu line %zu\n", name, offset, size,
+	       offset / OD_CACHE_LINE);
+}
+
+#define od_struct_field_of(type, field) \
+	od_struct_field(#field, offsetof(type, field), \
+	                sizeof(((type*)0)->field))
+
+int
+main(void)
+{
+	od_struct_size("od_client_t", sizeof(od_client_t));
+	od_struct_field_of(od_client_t, state);
+	od_struct_field_of(od_client_t, server);
+	od_struct_field_of(od_client_t, route);
+	od_struct_field_of(od_client_t, link_pool);
+	od_struct_field_of(od_client_t, io);
+	od_struct_field_of(od_client_t, relay);
+	od_struct_field_of(od_client_t, startup);
+	od_struct_field_of(od_client_t, vars);
+
+	od_struct_size("od_server_t", sizeof(od_server_t));
+	od_struct_field_of(od_server_t, state);
+	od_struct_field_of(od_server_t, client);
+	od_struct_field_of(od_server_t, link);
+	od_struct_field_of(od_server_t, io);
+	od_struct_field_of(od_server_t, relay);
+	od_struct_field_of(od_server_t, scram_state);
+	od_struct_field_of(od_server_t, vars);
+
+	od_struct_size("od_io_t", sizeof(od_io_t));
+	od_struct_size("od_relay_t", sizeof(od_relay_t));
+	od_struct_size("kiwi_be_startup_t", sizeof(kiwi_be_startup_t));
+	od_struct_size("kiwi_vars_t", sizeof(kiwi_vars_t));
+	return 0;
+}
@@ -0,0 +1,103 @@
+#include <machinarium.h>
+#include <odyssey_test.h>
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#define TEST_CLIENTS 4
+
+static void
+server(void *arg)
+{
+	(void)arg;
+	machine_io_t *server = machine_io_create();
+	test(server != NULL);
+
+	struct sockaddr_in sa;
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = inet_addr("127.0.0.1");
+	sa.sin_port = htons(7791);
+	int rc;
+	rc = machine_bind(server, (struct sockaddr*)&sa);
+	test(rc == 0);
+
+	/* start listen */
+	machine_io_t *clients[8];
+	rc = machine_accept_batch(server, clients, 8, 16, 1, 1);
+	test(rc == -1);
+	test(machine_errno() == ETIMEDOUT);
+
+	/* wait for all clients to connect */
+	machine_sleep(100);
+
+	rc = machine_accept_batch(server, clients, 8, 16, 1, UINT32_MAX);
+	test(rc == TEST_CLIENTS);
+
+	int i;
+	for (i = 0; i < rc; i++) {
+		machine_close(clients[i]);
+		machine_io_free(clients[i]);
+	}
+
+	rc = machine_close(server);
+	test(rc == 0);
+	machine_io_free(server);
+}
+
+static void
+client(void *arg)
+{
+	(void)arg;
+	machine_sleep(10);
+
+	machine_io_t *client = machine_io_create();
+	test(client != NULL);
+
+	struct sockaddr_in sa;
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = inet_addr("127.0.0.1");
+	sa.sin_port = htons(7791);
+	int rc;
+	rc = machine_connect(client, (struct sockaddr*)&sa, UINT32_MAX);
+	test(rc == 0);
+
+	machine_msg_t *msg;
+	msg = machine_read(client, 1, UINT32_MAX);
+	/* eof */
+	test(msg == NULL);
+
+	rc = machine_close(client);
+	test(rc == 0);
+	machine_io_free(client);
+}
+
+static void
+test_cs(void *arg)
+{
+	(void)arg;
+	int rc;
+	rc = machine_coroutine_create(server, NULL);
+	test(rc != -1);
+
+	int i;
+	for (i = 0; i < TEST_CLIENTS; i++) {
+		rc = machine_coroutine_create(client, NULL);
+		test(rc != -1);
+	}
+}
+
+void
+machinarium_test_accept_batch(void)
+{
+	machinarium_init();
+
+	int id;
+	id = machine_create("test", test_cs, NULL);
+	test(id != -1);
+
+	int rc;
+	rc = machine_wait(id);
+	test(rc != -1);
+
+	machinarium_free();
+}
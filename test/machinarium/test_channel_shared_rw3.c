@@ -0,0 +1,94 @@
+
+#include <machinarium.h>
+#include <odyssey_test.h>
+
+/* producers and consumers on different machines, consumers use short
+ * timeouts, so wakeups race with timedout reads */
+
+#define TEST_MACHINES 4
+#define TEST_MESSAGES 20000
+
+static machine_channel_t *channel;
+
+static int count_read = 0;
+static int count_done = 0;
+
+static void
+test_producer(void *arg)
+{
+	(void)arg;
+	int i = 0;
+	for (; i < TEST_MESSAGES; i++) {
+		machine_msg_t *msg;
+		msg = machine_msg_create(0);
+		test(msg != NULL);
+		machine_channel_write(channel, msg);
+		if ((i % 64) == 0)
+			machine_sleep(0);
+	}
+}
+
+static void
+test_consumer_coroutine(void *arg)
+{
+	(void)arg;
+	while (__atomic_load_n(&count_done, __ATOMIC_SEQ_CST) < TEST_MACHINES)
+	{
+		machine_msg_t *msg;
+		msg = machine_channel_read(channel, 1);
+		if (msg == NULL)
+			continue;
+		machine_msg_free(msg);
+		if (__atomic_add_fetch(&count_read, 1, __ATOMIC_SEQ_CST) ==
+		    TEST_MACHINES * TEST_MESSAGES)
+			__atomic_store_n(&count_done, TEST_MACHINES, __ATOMIC_SEQ_CST);
+	}
+}
+
+static void
+test_consumer(void *arg)
+{
+	(void)arg;
+	int64_t a, b;
+	a = machine_coroutine_create(test_consumer_coroutine, NULL);
+	test(a != -1);
+	b = machine_coroutine_create(test_consumer_coroutine, NULL);
+	test(b != -1);
+	machine_join(a);
+	machine_join(b);
+}
+
+void
+machinarium_test_channel_shared_rw3(void)
+{
+	machinarium_init();
+
+	channel = machine_channel_create(1);
+	test(channel != NULL);
+
+	int64_t consumers[TEST_MACHINES];
+	int64_t producers[TEST_MACHINES];
+	int i;
+	for (i = 0; i < TEST_MACHINES; i++) {
+		consumers[i] = machine_create("consumer", test_consumer, NULL);
+		test(consumers[i] != -1);
+	}
+	for (i = 0; i < TEST_MACHINES; i++) {
+		producers[i] = machine_create("producer", test_producer, NULL);
+		test(producers[i] != -1);
+	}
+
+	int rc;
+	for (i = 0; i < TEST_MACHINES; i++) {
+		rc = machine_wait(producers[i]);
+		test(rc != -1);
+	}
+	for (i = 0; i < TEST_MACHINES; i++) {
+		rc = machine_wait(consumers[i]);
+		test(rc != -1);
+	}
+	test(count_read == TEST_MACHINES * TEST_MESSAGES);
+
+	machine_channel_free(channel);
+	machinarium_free();
+}
@@ -0,0 +1,71 @@
+#include <machinarium.h>
+#include <odyssey_test.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t
+test_monotonic_us(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000ULL + t.tv_nsec / 1000;
+}
+
+static void
+test_clock_coroutine(void *arg)
+{
+	uint64_t accuracy_us = *(uint64_t*)arg;
+
+	/* machine time follows the monotonic clock */
+	uint64_t start = machine_time_us();
+	uint64_t diff = test_monotonic_us() - start;
+	test(diff <= accuracy_us || start - test_monotonic_us() <= accuracy_us);
+
+	machine_sleep(50);
+	uint64_t now = machine_time_us();
+	test(now >= start);
+	test(now - start >= 50 * 1000 - accuracy_us);
+	test(now - start < 1000 * 1000);
+	diff = test_monotonic_us() - now;
+	test(diff <= accuracy_us || now - test_monotonic_us() <= accuracy_us);
+	machine_stop();
+}
+
+static void
+test_clock(char *name, uint64_t accuracy_us)
+{
+	int rc;
+	rc = machinarium_set_clock(name);
+	test(rc == 0);
+	machinarium_init();
+
+	/* tsc falls back to monotonic if not stable */
+	char *source = machinarium_clock();
+	if (strcmp(name, "tsc") == 0) {
+		test(strcmp(source, "tsc") == 0 || strcmp(source, "monotonic") == 0);
+	} else {
+		test(strcmp(source, name) == 0);
+	}
+
+	int64_t id;
+	id = machine_create("test", test_clock_coroutine, &accuracy_us);
+	test(id != -1);
+	rc = machine_wait(id);
+	test(rc != -1);
+	machinarium_free();
+}
+
+void
+machinarium_test_clock(void)
+{
+	int rc;
+	rc = machinarium_set_clock("unknown");
+	test(rc == -1);
+
+	test_clock("monotonic", 1000);
+	test_clock("coarse", 20 * 1000);
+	test_clock("tsc", 1000);
+
+	rc = machinarium_set_clock("monotonic");
+	test(rc == 0);
+}
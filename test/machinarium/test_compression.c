@@ -0,0 +1,166 @@
+#include <machinarium.h>
+#include <odyssey_test.h>
+
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#define TEST_SIZE (1024 * 1024)
+
+static int compression = 1;
+
+static void
+fill(char *buf, int size)
+{
+	int i = 0;
+	for (; i < size; i++)
+		buf[i] = (i / 7) % 113;
+}
+
+static void
+server(void *arg)
+{
+	(void)arg;
+	machine_io_t *server = machine_io_create();
+	test(server != NULL);
+
+	struct sockaddr_in sa;
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = inet_addr("127.0.0.1");
+	sa.sin_port = htons(7778);
+	int rc;
+	rc = machine_bind(server, (struct sockaddr*)&sa);
+	test(rc == 0);
+
+	machine_io_t *client;
+	rc = machine_accept(server, &client, 16, 0, UINT32_MAX);
+	test(rc == 0);
+
+	rc = machine_io_attach(client);
+	test(rc == 0);
+
+	rc = machine_set_compression(client, 1);
+	if (rc == -1) {
+		/* built without zlib */
+		test(machine_errno() == ENOTSUP);
+		compression = 0;
+	} else {
+		test(machine_io_is_compressed(client));
+		rc = machine_set_compression(client, 1);
+		test(rc == -1);
+	}
+
+	/* small message */
+	machine_msg_t *msg;
+	msg = machine_msg_create(0);
+	test(msg != NULL);
+	rc = machine_msg_write(msg, "hello world", 11);
+	test(rc == 0);
+	rc = machine_write(client, msg, UINT32_MAX);
+	test(rc == 0);
+
+	/* large message, compressed in several chunks */
+	msg = machine_msg_create(TEST_SIZE);
+	test(msg != NULL);
+	fill(machine_msg_data(msg), TEST_SIZE);
+	rc = machine_write(client, msg, UINT32_MAX);
+	test(rc == 0);
+
+	/* reply */
+	msg = machine_read(client, 4, UINT32_MAX);
+	test(msg != NULL);
+	test(memcmp(machine_msg_data(msg), "done", 4) == 0);
+	machine_msg_free(msg);
+
+	rc = machine_close(client);
+	test(rc == 0);
+	machine_io_free(client);
+
+	rc = machine_close(server);
+	test(rc == 0);
+	machine_io_free(server);
+}
+
+static void
+client(void *arg)
+{
+	(void)arg;
+	machine_io_t *client = machine_io_create();
+	test(client != NULL);
+
+	struct sockaddr_in sa;
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = inet_addr("127.0.0.1");
+	sa.sin_port = htons(7778);
+	int rc;
+	rc = machine_connect(client, (struct sockaddr*)&sa, UINT32_MAX);
+	test(rc == 0);
+
+	rc = machine_set_compression(client, 1);
+	test(rc == 0 || ! compression);
+
+	machine_msg_t *msg;
+	msg = machine_read(client, 5, UINT32_MAX);
+	test(msg != NULL);
+	test(memcmp(machine_msg_data(msg), "hello", 5) == 0);
+	machine_msg_free(msg);
+
+	/* rest of the first message is left decompressed, while
+	 * the socket may have nothing to read */
+	msg = machine_read(client, 6, UINT32_MAX);
+	test(msg != NULL);
+	test(memcmp(machine_msg_data(msg), " world", 6) == 0);
+	machine_msg_free(msg);
+
+	char *expected = malloc(TEST_SIZE);
+	test(expected != NULL);
+	fill(expected, TEST_SIZE);
+	msg = machine_read(client, TEST_SIZE, UINT32_MAX);
+	test(msg != NULL);
+	test(memcmp(machine_msg_data(msg), expected, TEST_SIZE) == 0);
+	machine_msg_free(msg);
+	free(expected);
+
+	msg = machine_msg_create(0);
+	test(msg != NULL);
+	rc = machine_msg_write(msg, "done", 4);
+	test(rc == 0);
+	rc = machine_write(client, msg, UINT32_MAX);
+	test(rc == 0);
+
+	/* eof */
+	msg = machine_read(client, 1, UINT32_MAX);
+	test(msg == NULL);
+
+	rc = machine_close(client);
+	test(rc == 0);
+	machine_io_free(client);
+}
+
+static void
+test_cs(void *arg)
+{
+	(void)arg;
+	int rc;
+	rc = machine_coroutine_create(server, NULL);
+	test(rc != -1);
+
+	rc = machine_coroutine_create(client, NULL);
+	test(rc != -1);
+}
+
+void
+machinarium_test_compression(void)
+{
+	machinarium_init();
+
+	int id;
+	id = machine_create("test", test_cs, NULL);
+	test(id != -1);
+
+	int rc;
+	rc = machine_wait(id);
+	test(rc != -1);
+
+	machinarium_free();
+}
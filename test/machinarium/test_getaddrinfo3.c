@@ -0,0 +1,73 @@
+#include <machinarium.h>
+#include <odyssey_test.h>
+
+#include <string.h>
+#include <arpa/inet.h>
+
+static void
+test_gai_numeric(void *arg)
+{
+	(void)arg;
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *res = NULL;
+	int rc = machine_getaddrinfo("127.0.0.1", "5432", &hints, &res, 0);
+	test(rc == 0);
+	test(res != NULL);
+	test(res->ai_family == AF_INET);
+	struct sockaddr_in *sin = (struct sockaddr_in*)res->ai_addr;
+	test(ntohs(sin->sin_port) == 5432);
+	freeaddrinfo(res);
+}
+
+static void
+test_gai_hosts(void *arg)
+{
+	(void)arg;
+	struct addrinfo *res = NULL;
+	int rc = machine_getaddrinfo("localhost", "http", NULL, &res, UINT32_MAX);
+	if (rc < 0) {
+		printf("failed to resolve address\n");
+	} else {
+		test(res != NULL);
+		if (res)
+			freeaddrinfo(res);
+	}
+}
+
+static void
+test_gai(void *arg)
+{
+	(void)arg;
+	int rc;
+	rc = machine_coroutine_create(test_gai_numeric, NULL);
+	test(rc != -1);
+
+	rc = machine_coroutine_create(test_gai_hosts, NULL);
+	test(rc != -1);
+}
+
+void
+machinarium_test_getaddrinfo3(void)
+{
+	int rc;
+	rc = machinarium_set_resolver("unknown");
+	test(rc == -1);
+	rc = machinarium_set_resolver("async");
+	test(rc == 0);
+
+	machinarium_init();
+
+	int id;
+	id = machine_create("test", test_gai, NULL);
+	test(id != -1);
+
+	rc = machine_wait(id);
+	test(rc != -1);
+
+	machinarium_free();
+
+	rc = machinarium_set_resolver("thread");
+	test(rc == 0);
+}
@@ -0,0 +1,81 @@
+
+#include <machinarium.h>
+#include <odyssey_test.h>
+#include <sys/socket.h>
+#include <string.h>
+#include <unistd.h>
+
+/* iov size is the number of bytes left to write, partial writes
+ * advance it */
+
+static char buf[1 << 20];
+static char dest[65536];
+
+static void
+test_writer(void *arg)
+{
+	(void)arg;
+	int fds[2];
+	int rc;
+	rc = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	test(rc == 0);
+
+	machine_io_t *io;
+	io = machine_io_create();
+	test(io != NULL);
+	rc = machine_bind_fd(io, fds[0]);
+	test(rc == 0);
+
+	machine_iov_t *iov;
+	iov = machine_iov_create();
+	test(iov != NULL);
+	test(machine_iov_size(iov) == 0);
+
+	machine_msg_t *msg;
+	msg = machine_msg_create(100);
+	test(msg != NULL);
+	rc = machine_iov_add(iov, msg);
+	test(rc == 0);
+	rc = machine_iov_add_pointer(iov, buf, sizeof(buf));
+	test(rc == 0);
+	test(machine_iov_size(iov) == 100 + (int)sizeof(buf));
+
+	int left = machine_iov_size(iov);
+	int partial = 0;
+	while (machine_iov_pending(iov)) {
+		rc = machine_writev_raw(io, iov);
+		if (rc > 0) {
+			left -= rc;
+			partial += machine_iov_pending(iov);
+			test(machine_iov_size(iov) == left);
+			continue;
+		}
+		test(machine_errno() == EAGAIN);
+		rc = read(fds[1], dest, sizeof(dest));
+		test(rc > 0);
+	}
+	test(partial > 0);
+	test(left == 0);
+	test(machine_iov_size(iov) == 0);
+
+	machine_iov_free(iov);
+	machine_close(io);
+	machine_io_free(io);
+	close(fds[1]);
+}
+
+void
+machinarium_test_iov_size(void)
+{
+	machinarium_init();
+
+	int id;
+	id = machine_create("test", test_writer, NULL);
+	test(id != -1);
+
+	int rc;
+	rc = machine_wait(id);
+	test(rc != -1);
+
+	machinarium_free();
+}
@@ -0,0 +1,101 @@
+#include <machinarium.h>
+#include <odyssey_test.h>
+
+/* messages allocated by one machine and freed by another are
+ * returned to the cache of the allocating machine */
+
+#define TEST_BATCH  64
+#define TEST_ROUNDS 50
+
+static machine_channel_t *data;
+static machine_channel_t *ack;
+
+static void
+test_stat(uint64_t *allocated, uint64_t *remote, uint64_t *returned)
+{
+	uint64_t count_coroutine, count_coroutine_cache;
+	uint64_t count, count_gc, size;
+	machine_stat(&count_coroutine, &count_coroutine_cache, allocated,
+	             &count, &count_gc, &size, remote, returned);
+}
+
+static void
+test_producer(void *arg)
+{
+	(void)arg;
+	int i = 0;
+	for (; i < TEST_ROUNDS; i++) {
+		int j = 0;
+		for (; j < TEST_BATCH; j++) {
+			machine_msg_t *msg;
+			msg = machine_msg_create(100);
+			test(msg != NULL);
+			machine_channel_write(data, msg);
+		}
+		machine_msg_t *msg;
+		msg = machine_channel_read(ack, UINT32_MAX);
+		test(msg != NULL);
+		machine_msg_free(msg);
+	}
+
+	uint64_t allocated, remote, returned;
+	test_stat(&allocated, &remote, &returned);
+	test(returned > 0);
+	test(allocated < TEST_BATCH * TEST_ROUNDS / 2);
+}
+
+static void
+test_consumer(void *arg)
+{
+	(void)arg;
+	int i = 0;
+	for (; i < TEST_ROUNDS; i++) {
+		int j = 0;
+		for (; j < TEST_BATCH; j++) {
+			machine_msg_t *msg;
+			msg = machine_channel_read(data, UINT32_MAX);
+			test(msg != NULL);
+			machine_msg_free(msg);
+		}
+		machine_msg_t *msg;
+		msg = machine_msg_create(0);
+		test(msg != NULL);
+		machine_channel_write(ack, msg);
+	}
+
+	uint64_t allocated, remote, returned;
+	test_stat(&allocated, &remote, &returned);
+	test(remote > 0);
+}
+
+void
+machinarium_test_msg_cache_remote(void)
+{
+	machinarium_set_msg_cache_gc_size(64 * 1024);
+	machinarium_init();
+
+	data = machine_channel_create(1);
+	test(data != NULL);
+	ack = machine_channel_create(1);
+	test(ack != NULL);
+
+	int64_t consumer;
+	consumer = machine_create("consumer", test_consumer, NULL);
+	test(consumer != -1);
+
+	int64_t producer;
+	producer = machine_create("producer", test_producer, NULL);
+	test(producer != -1);
+
+	int rc;
+	rc = machine_wait(producer);
+	test(rc != -1);
+	rc = machine_wait(consumer);
+	test(rc != -1);
+
+	machine_channel_free(data);
+	machine_channel_free(ack);
+
+	machinarium_free();
+	machinarium_set_msg_cache_gc_size(0);
+}
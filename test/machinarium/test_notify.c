@@ -0,0 +1,92 @@
+
+#include <machinarium.h>
+#include <odyssey_test.h>
+
+/* notify signaled by another machine wakes up the waiter, signals
+ * sent while stopped are delivered on start */
+
+#define TEST_SIGNALS 10000
+
+static machine_notify_t *notify;
+static int count_signaled = 0;
+static int count_read = 0;
+
+static void
+test_signaler(void *arg)
+{
+	(void)arg;
+	int i = 0;
+	for (; i < TEST_SIGNALS; i++) {
+		machine_notify_signal(notify);
+		__atomic_add_fetch(&count_signaled, 1, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&count_read, __ATOMIC_SEQ_CST) <= i)
+			machine_sleep(0);
+	}
+}
+
+static void
+test_waiter(void *arg)
+{
+	(void)arg;
+	machine_cond_t *cond;
+	cond = machine_cond_create();
+	test(cond != NULL);
+
+	/* pending signal */
+	machine_notify_signal(notify);
+	machine_notify_start(notify, cond);
+	int rc;
+	rc = machine_cond_wait(cond, 1000);
+	test(rc == 0);
+	test(machine_notify_read(notify) == 1);
+	test(machine_notify_read(notify) == 0);
+
+	/* signaled while stopped */
+	machine_notify_stop(notify);
+	machine_notify_signal(notify);
+	rc = machine_cond_wait(cond, 10);
+	test(rc == -1);
+	machine_notify_start(notify, cond);
+	rc = machine_cond_wait(cond, 1000);
+	test(rc == 0);
+	test(machine_notify_read(notify) == 1);
+
+	int64_t id;
+	id = machine_create("signaler", test_signaler, NULL);
+	test(id != -1);
+
+	while (count_read < TEST_SIGNALS) {
+		rc = machine_cond_wait(cond, 1000);
+		test(rc == 0);
+		if (! machine_notify_read(notify))
+			continue;
+		__atomic_add_fetch(&count_read, 1, __ATOMIC_SEQ_CST);
+	}
+
+	rc = machine_wait(id);
+	test(rc != -1);
+	test(count_signaled == TEST_SIGNALS);
+
+	machine_notify_stop(notify);
+	machine_cond_free(cond);
+}
+
+void
+machinarium_test_notify(void)
+{
+	machinarium_init();
+
+	notify = machine_notify_create();
+	test(notify != NULL);
+
+	int64_t id;
+	id = machine_create("waiter", test_waiter, NULL);
+	test(id != -1);
+
+	int rc;
+	rc = machine_wait(id);
+	test(rc != -1);
+
+	machine_notify_free(notify);
+	machinarium_free();
+}
@@ -0,0 +1,85 @@
+#include <machinarium.h>
+#include <odyssey_test.h>
+
+#define TEST_ROUNDS 200
+
+static machine_channel_t *ping;
+static machine_channel_t *pong;
+
+static void
+test_pong(void *arg)
+{
+	(void)arg;
+	int i = 0;
+	for (; i < TEST_ROUNDS; i++) {
+		machine_msg_t *msg;
+		msg = machine_channel_read(ping, UINT32_MAX);
+		test(msg != NULL);
+		machine_channel_write(pong, msg);
+	}
+}
+
+static void
+test_ping(void *arg)
+{
+	(void)arg;
+	machine_loop_stat_t stat;
+	machine_stat_loop(&stat);
+
+	int i = 0;
+	for (; i < TEST_ROUNDS; i++) {
+		machine_msg_t *msg;
+		msg = machine_msg_create(0);
+		test(msg != NULL);
+		machine_msg_set_type(msg, i);
+		machine_channel_write(ping, msg);
+		msg = machine_channel_read(pong, UINT32_MAX);
+		test(msg != NULL);
+		test(machine_msg_type(msg) == i);
+		machine_msg_free(msg);
+	}
+
+	/* spin is bounded by the next timer */
+	uint64_t start = machine_time_ms();
+	machine_sleep(20);
+	test(machine_time_ms() - start >= 20);
+
+	machine_stat_loop(&stat);
+	test(stat.count_spin > 0);
+	test(stat.count_spin_hit > 0);
+	test(stat.count_spin_hit <= stat.count_spin);
+	test(stat.count_wakeup <= stat.count_sleep);
+	test(stat.spin_us > 0);
+}
+
+void
+machinarium_test_poll_spin(void)
+{
+	machinarium_set_poll_spin(1000);
+	machinarium_init();
+
+	ping = machine_channel_create(1);
+	test(ping != NULL);
+	pong = machine_channel_create(1);
+	test(pong != NULL);
+
+	int64_t a;
+	a = machine_create("pong", test_pong, NULL);
+	test(a != -1);
+
+	int64_t b;
+	b = machine_create("ping", test_ping, NULL);
+	test(b != -1);
+
+	int rc;
+	rc = machine_wait(b);
+	test(rc != -1);
+	rc = machine_wait(a);
+	test(rc != -1);
+
+	machine_channel_free(ping);
+	machine_channel_free(pong);
+
+	machinarium_free();
+	machinarium_set_poll_spin(0);
+}
@@ -0,0 +1,112 @@
+#include <machinarium.h>
+#include <odyssey_test.h>
+
+static int seq;
+
+static int order_high;
+static int order_normal;
+static int order_low;
+
+static void
+test_coroutine_high(void *arg)
+{
+	(void)arg;
+	machine_set_priority(MACHINE_PRIORITY_HIGH);
+	machine_sleep(0);
+	order_high = seq++;
+}
+
+static void
+test_coroutine_normal(void *arg)
+{
+	(void)arg;
+	machine_sleep(0);
+	order_normal = seq++;
+}
+
+static void
+test_coroutine_low(void *arg)
+{
+	(void)arg;
+	machine_set_priority(MACHINE_PRIORITY_LOW);
+	machine_sleep(0);
+	order_low = seq++;
+}
+
+static void
+test_order(void *arg)
+{
+	(void)arg;
+	int rc;
+	rc = machine_set_priority(MACHINE_PRIORITY_LOW + 1);
+	test(rc == -1);
+
+	/* woken up at once, run by priority not by creation order */
+	seq = 0;
+	int64_t a, b, c;
+	a = machine_coroutine_create(test_coroutine_low, NULL);
+	test(a != -1);
+	b = machine_coroutine_create(test_coroutine_normal, NULL);
+	test(b != -1);
+	c = machine_coroutine_create(test_coroutine_high, NULL);
+	test(c != -1);
+	machine_join(a);
+	machine_join(b);
+	machine_join(c);
+	test(order_high == 0);
+	test(order_normal == 1);
+	test(order_low == 2);
+	machine_stop();
+}
+
+static void
+test_coroutine_busy(void *arg)
+{
+	(void)arg;
+	machine_set_priority(MACHINE_PRIORITY_HIGH);
+	machine_sleep(0);
+	seq++;
+}
+
+static void
+test_starvation(void *arg)
+{
+	(void)arg;
+
+	/* low priority coroutine is not run last behind a long
+	 * queue of high priority ones */
+	seq = 0;
+	int64_t low;
+	low = machine_coroutine_create(test_coroutine_low, NULL);
+	test(low != -1);
+	int i = 0;
+	for (; i < 200; i++) {
+		int64_t id;
+		id = machine_coroutine_create(test_coroutine_busy, NULL);
+		test(id != -1);
+	}
+	machine_join(low);
+	test(order_low < 200);
+	machine_sleep(0);
+	machine_stop();
+}
+
+void
+machinarium_test_priority(void)
+{
+	machinarium_init();
+
+	int64_t id;
+	id = machine_create("test", test_order, NULL);
+	test(id != -1);
+	int rc;
+	rc = machine_wait(id);
+	test(rc != -1);
+
+	id = machine_create("test", test_starvation, NULL);
+	test(id != -1);
+	rc = machine_wait(id);
+	test(rc != -1);
+
+	machinarium_free();
+}
@@ -0,0 +1,142 @@
+#include <machinarium.h>
+#include <odyssey_test.h>
+
+#include <string.h>
+#include <arpa/inet.h>
+
+static void
+server(void *arg)
+{
+	(void)arg;
+	machine_io_t *server = machine_io_create();
+	test(server != NULL);
+
+	struct sockaddr_in sa;
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = inet_addr("127.0.0.1");
+	sa.sin_port = htons(7778);
+	int rc;
+	rc = machine_bind(server, (struct sockaddr*)&sa);
+	test(rc == 0);
+
+	machine_io_t *client;
+	rc = machine_accept(server, &client, 16, 1, UINT32_MAX);
+	test(rc == 0);
+
+	machine_cond_t *on_read = machine_cond_create();
+	test(on_read != NULL);
+
+	/* data arrived while read was stopped is reported on start */
+	machine_sleep(50);
+	rc = machine_read_start(client, on_read);
+	test(rc == 0);
+	rc = machine_cond_wait(on_read, UINT32_MAX);
+	test(rc == 0);
+	char buf[16];
+	ssize_t size;
+	size = machine_read_raw(client, buf, 1);
+	test(size == 1);
+	test(buf[0] == 'a');
+
+	/* data left unread is reported again */
+	rc = machine_cond_wait(on_read, UINT32_MAX);
+	test(rc == 0);
+	size = machine_read_raw(client, buf, sizeof(buf));
+	test(size == 2);
+	test(memcmp(buf, "bc", 2) == 0);
+
+	/* drained, toggles of interest report nothing */
+	rc = machine_read_stop(client);
+	test(rc == 0);
+	rc = machine_read_start(client, on_read);
+	test(rc == 0);
+	rc = machine_cond_wait(on_read, 10);
+	test(rc == -1);
+	test(machine_timedout());
+
+	/* new data */
+	rc = machine_cond_wait(on_read, UINT32_MAX);
+	test(rc == 0);
+	size = machine_read_raw(client, buf, sizeof(buf));
+	test(size == 1);
+	test(buf[0] == 'd');
+	rc = machine_read_stop(client);
+	test(rc == 0);
+
+	machine_cond_free(on_read);
+
+	rc = machine_close(client);
+	test(rc == 0);
+	machine_io_free(client);
+
+	rc = machine_close(server);
+	test(rc == 0);
+	machine_io_free(server);
+}
+
+static void
+client(void *arg)
+{
+	(void)arg;
+	machine_io_t *client = machine_io_create();
+	test(client != NULL);
+
+	struct sockaddr_in sa;
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = inet_addr("127.0.0.1");
+	sa.sin_port = htons(7778);
+	int rc;
+	rc = machine_connect(client, (struct sockaddr*)&sa, UINT32_MAX);
+	test(rc == 0);
+
+	machine_msg_t *msg;
+	msg = machine_msg_create(0);
+	test(msg != NULL);
+	rc = machine_msg_write(msg, "abc", 3);
+	test(rc == 0);
+	rc = machine_write(client, msg, UINT32_MAX);
+	test(rc == 0);
+
+	machine_sleep(100);
+
+	msg = machine_msg_create(0);
+	test(msg != NULL);
+	rc = machine_msg_write(msg, "d", 1);
+	test(rc == 0);
+	rc = machine_write(client, msg, UINT32_MAX);
+	test(rc == 0);
+
+	machine_sleep(50);
+
+	rc = machine_close(client);
+	test(rc == 0);
+	machine_io_free(client);
+}
+
+static void
+test_cs(void *arg)
+{
+	(void)arg;
+	int rc;
+	rc = machine_coroutine_create(server, NULL);
+	test(rc != -1);
+
+	rc = machine_coroutine_create(client, NULL);
+	test(rc != -1);
+}
+
+void
+machinarium_test_read_edge(void)
+{
+	machinarium_init();
+
+	int id;
+	id = machine_create("test", test_cs, NULL);
+	test(id != -1);
+
+	int rc;
+	rc = machine_wait(id);
+	test(rc != -1);
+
+	machinarium_free();
+}
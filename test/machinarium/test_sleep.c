@@ -55,3 +55,52 @@ machinarium_test_sleep_random(void)
 
 	machinarium_free();
 }
+
+static int sleep_order[8];
+static int sleep_order_count = 0;
+
+static void
+coroutine_order_sleep(void *arg)
+{
+	int interval = (intptr_t)arg;
+	uint64_t start = machine_time_ms();
+	machine_sleep(interval);
+	test(machine_time_ms() - start >= (uint64_t)interval);
+	sleep_order[sleep_order_count++] = interval;
+}
+
+static void
+coroutine_order(void *arg)
+{
+	(void)arg;
+	int intervals[] = { 300, 5, 900, 70, 0, 140, 90, 40 };
+	int i;
+	for (i = 0; i < 8; i++) {
+		int64_t rc;
+		rc = machine_coroutine_create(coroutine_order_sleep,
+		                              (void*)(intptr_t)intervals[i]);
+		test(rc != -1);
+	}
+	while (sleep_order_count < 8)
+		machine_sleep(10);
+	test(sleep_order[0] == 0);
+	for (i = 1; i < 8; i++)
+		test(sleep_order[i - 1] <= sleep_order[i]);
+	machine_stop();
+}
+
+void
+machinarium_test_sleep_order(void)
+{
+	machinarium_init();
+
+	int id;
+	id = machine_create("test", coroutine_order, NULL);
+	test(id != -1);
+
+	int rc;
+	rc = machine_wait(id);
+	test(rc != -1);
+
+	machinarium_free();
+}
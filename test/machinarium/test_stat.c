@@ -2,6 +2,53 @@
 #include <machinarium.h>
 #include <odyssey_test.h>
 #include <unistd.h>
+#include <time.h>
+
+static void
+test_accounting_coroutine(void *arg)
+{
+	(void)arg;
+	uint64_t time_run, time_wait, count_switch;
+	int rc;
+	rc = machine_stat_coroutine(&time_run, &time_wait, &count_switch);
+	test(rc == 0);
+	test(count_switch == 1);
+
+	/* sleep is not accounted as run time */
+	machine_sleep(50);
+	rc = machine_stat_coroutine(&time_run, &time_wait, &count_switch);
+	test(rc == 0);
+	test(count_switch == 2);
+	test(time_run < 50 * 1000);
+
+	/* machine time is cached until the next loop step */
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((now.tv_sec - start.tv_sec) * 1000000 +
+	         (now.tv_nsec - start.tv_nsec) / 1000 < 20 * 1000);
+	rc = machine_stat_coroutine(&time_run, &time_wait, &count_switch);
+	test(rc == 0);
+	test(time_run >= 20 * 1000);
+}
+
+static void
+test_accounting(void *arg)
+{
+	(void)arg;
+	uint64_t time_run, time_wait, count_switch;
+	int rc;
+	rc = machine_stat_coroutine(&time_run, &time_wait, &count_switch);
+	test(rc == 0);
+
+	int64_t id;
+	id = machine_coroutine_create(test_accounting_coroutine, NULL);
+	test(id != -1);
+	rc = machine_join(id);
+	test(rc == 0);
+	machine_stop();
+}
 
 #if 0
 static void
@@ -85,4 +132,15 @@ machinarium_test_stat(void)
 #endif
 
 	machinarium_free();
+
+	machinarium_set_coroutine_accounting(1);
+	machinarium_init();
+	int64_t id;
+	id = machine_create("test", test_accounting, NULL);
+	test(id != -1);
+	int rc;
+	rc = machine_wait(id);
+	test(rc != -1);
+	machinarium_free();
+	machinarium_set_coroutine_accounting(0);
 }
@@ -0,0 +1,195 @@
+#include <machinarium.h>
+#include <odyssey_test.h>
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#define TEST_TOTAL (8 * 1024 * 1024)
+
+static inline char
+pattern(int pos)
+{
+	return (char)((pos * 7) % 251);
+}
+
+static void
+server(void *arg)
+{
+	(void)arg;
+	machine_io_t *server = machine_io_create();
+	test(server != NULL);
+
+	int rc;
+	struct sockaddr_in sa;
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = inet_addr("127.0.0.1");
+	sa.sin_port = htons(7778);
+	rc = machine_bind(server, (struct sockaddr*)&sa);
+	test(rc == 0);
+
+	machine_io_t *client;
+	rc = machine_accept(server, &client, 16, 1, UINT32_MAX);
+	test(rc == 0);
+
+	machine_tls_t *tls;
+	tls = machine_tls_create();
+	rc = machine_tls_set_verify(tls, "none");
+	test(rc == 0);
+	rc = machine_tls_set_ca_file(tls, "./machinarium/ca.crt");
+	test(rc == 0);
+	rc = machine_tls_set_cert_file(tls, "./machinarium/server.crt");
+	test(rc == 0);
+	rc = machine_tls_set_key_file(tls, "./machinarium/server.key");
+	test(rc == 0);
+	rc = machine_tls_create_context(tls,0);
+	test(rc == 0);
+	rc = machine_set_tls(client, tls, UINT32_MAX);
+	if (rc == -1) {
+		printf("%s\n", machine_error(client));
+		test(rc == 0);
+	}
+
+	machine_cond_t *on_write = machine_cond_create();
+	test(on_write != NULL);
+	rc = machine_write_start(client, on_write);
+	test(rc == 0);
+
+	machine_iov_t *iov = machine_iov_create();
+	test(iov != NULL);
+
+	/* batches of small and large messages, slow reader makes
+	 * writes stop in the middle of a batch */
+	int sizes[] = { 5, 120, 1, 40000, 700, 16384, 3, 90000, 16383, 64 };
+	int sizes_count = sizeof(sizes) / sizeof(sizes[0]);
+	int pos = 0;
+	int i = 0;
+	while (pos < TEST_TOTAL)
+	{
+		int batch = 0;
+		for (; batch < 32 && pos < TEST_TOTAL; batch++, i++) {
+			int size = sizes[i % sizes_count];
+			if (size > TEST_TOTAL - pos)
+				size = TEST_TOTAL - pos;
+			machine_msg_t *msg;
+			msg = machine_msg_create(size);
+			test(msg != NULL);
+			char *data = machine_msg_data(msg);
+			int j = 0;
+			for (; j < size; j++)
+				data[j] = pattern(pos + j);
+			pos += size;
+			rc = machine_iov_add(iov, msg);
+			test(rc == 0);
+		}
+		while (machine_iov_pending(iov)) {
+			rc = machine_writev_raw(client, iov);
+			if (rc == -1) {
+				test(machine_errno() == EAGAIN);
+				rc = machine_cond_wait(on_write, UINT32_MAX);
+				test(rc == 0);
+			}
+		}
+	}
+
+	rc = machine_write_stop(client);
+	test(rc == 0);
+	machine_iov_free(iov);
+	machine_cond_free(on_write);
+
+	rc = machine_close(client);
+	test(rc == 0);
+	machine_io_free(client);
+
+	rc = machine_close(server);
+	test(rc == 0);
+	machine_io_free(server);
+
+	machine_tls_free(tls);
+}
+
+static void
+client(void *arg)
+{
+	(void)arg;
+	machine_io_t *client = machine_io_create();
+	test(client != NULL);
+
+	int rc;
+	struct sockaddr_in sa;
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = inet_addr("127.0.0.1");
+	sa.sin_port = htons(7778);
+	rc = machine_connect(client, (struct sockaddr*)&sa, UINT32_MAX);
+	test(rc == 0);
+
+	machine_tls_t *tls;
+	tls = machine_tls_create();
+	rc = machine_tls_set_verify(tls, "none");
+	test(rc == 0);
+	rc = machine_tls_set_ca_file(tls, "./machinarium/ca.crt");
+	test(rc == 0);
+	rc = machine_tls_set_cert_file(tls, "./machinarium/client.crt");
+	test(rc == 0);
+	rc = machine_tls_set_key_file(tls, "./machinarium/client.key");
+	test(rc == 0);
+	rc = machine_tls_create_context(tls,1);
+	test(rc == 0);
+	rc = machine_set_tls(client, tls, UINT32_MAX);
+	if (rc == -1) {
+		printf("%s\n", machine_error(client));
+		test(rc == 0);
+	}
+
+	int pos = 0;
+	int chunk = 0;
+	while (1)
+	{
+		machine_msg_t *msg;
+		msg = machine_read(client, 4096, UINT32_MAX);
+		if (msg == NULL)
+			break;
+		char *data = machine_msg_data(msg);
+		int j = 0;
+		for (; j < 4096; j++)
+			test(data[j] == pattern(pos + j));
+		machine_msg_free(msg);
+		pos += 4096;
+		if ((++chunk % 256) == 0)
+			machine_sleep(1);
+	}
+	test(pos == TEST_TOTAL);
+
+	rc = machine_close(client);
+	test(rc == 0);
+	machine_io_free(client);
+
+	machine_tls_free(tls);
+}
+
+static void
+test_cs(void *arg)
+{
+	(void)arg;
+	int rc;
+	rc = machine_coroutine_create(server, NULL);
+	test(rc != -1);
+
+	rc = machine_coroutine_create(client, NULL);
+	test(rc != -1);
+}
+
+void
+machinarium_test_tls_writev(void)
+{
+	machinarium_init();
+
+	int id;
+	id = machine_create("test", test_cs, NULL);
+	test(id != -1);
+
+	int rc;
+	rc = machine_wait(id);
+	test(rc != -1);
+
+	machinarium_free();
+}
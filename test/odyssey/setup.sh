@@ -64,6 +64,11 @@ if test $PGVERSION -ge 10; then
     }
 fi
 
+psql -c "create user reload_user;" db >> $SETUP_LOG 2>&1 || {
+    echo "ERROR: users creation failed, examine the $SETUP_LOG"
+    exit 1
+}
+
 # Start odyssey
 $ODYSSEY $ODYSSEY_CONFIG >> $SETUP_LOG 2>&1 || {
     echo "ERROR: start odyssey failed, examine the $SETUP_LOG"
@@ -1,6 +1,6 @@
 #include <machinarium.h>
 #include <odyssey_test.h>
-#include <assert.h>
+#include <stdlib.h>
 #include <lrand48.h>
 #include "sources/hgram.h"
 
@@ -8,12 +8,20 @@ void hgram_forward_test();
 
 void hgram_backward_test();
 
-int hgram_random_test();
+void hgram_accuracy_test(int precision);
 
-// Currently we are linking without lm
-static int myround(double x)
+void hgram_window_test();
+
+void hgram_throughput_test();
+
+static od_hgram_frozen_t*
+hgram_freeze(od_hgram_t *hgram)
 {
-	return x + 0.5;
+	od_hgram_frozen_t *f = od_hgram_allocate(hgram->precision);
+	test(f != NULL);
+	od_hgram_merge(f, hgram);
+	od_hgram_freeze(f, NULL, 0);
+	return f;
 }
 
 void
@@ -24,69 +32,170 @@ machinarium_test_hgram(void)
 
 	hgram_forward_test();
 	hgram_backward_test();
-
-	int fails = 0;
-	for (int i=0;i<20;i++)
-		fails += hgram_random_test();
-
-	// fails approx 1/1000, so suppress flaps to impossible
-	assert(fails <= 3);
+	hgram_accuracy_test(OD_HGRAM_PRECISION_DEFAULT);
+	hgram_accuracy_test(1);
+	hgram_accuracy_test(OD_HGRAM_PRECISION_MAX);
+	hgram_window_test();
+	hgram_throughput_test();
 
 	machinarium_free();
 }
 
-int hgram_random_test()
+static int
+cmp_u64(const void *a, const void *b)
 {
-	od_hgram_t hgram;
-	od_hgram_frozen_t f;
-	od_hgram_init(&hgram);
+	uint64_t x = *(uint64_t*)a;
+	uint64_t y = *(uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+void hgram_accuracy_test(int precision)
+{
+	od_hgram_t *hgram = od_hgram_allocate(precision);
+	test(hgram != NULL);
+
+	/* values spread over several orders of magnitude */
+	const int count = 100000;
+	uint64_t *values = malloc(sizeof(uint64_t) * count);
+	test(values != NULL);
+	for (int i = 0; i < count; i++) {
+		values[i] = machine_lrand48() % (1 << (machine_lrand48() % 30));
+		od_hgram_add_data_point(hgram, values[i]);
+	}
+	qsort(values, count, sizeof(uint64_t), cmp_u64);
+
+	od_hgram_frozen_t *f = hgram_freeze(hgram);
+	test(f->total == (uint64_t)count);
+
+	double quantiles[] = { 0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99, 0.999, 1 };
+	for (size_t i = 0; i < sizeof(quantiles) / sizeof(double); i++) {
+		uint64_t exact = values[(int)(count * quantiles[i] + 0.5) - 1];
+		uint64_t value = od_hgram_quantile(f, quantiles[i]);
+		uint64_t error = value > exact ? value - exact : exact - value;
+		/* bucket width is within 1/2^precision of the value */
+		test(error <= exact >> precision);
+	}
+
+	od_hgram_free(f);
+	od_hgram_free(hgram);
+	free(values);
+}
 
-	for (int i = 0; i < 100000; i++) {
-		od_hgram_add_data_point(&hgram, machine_lrand48() % 10000);
+void hgram_window_test()
+{
+	/* two writers merged, quantiles of the last interval only */
+	od_hgram_t *a = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
+	od_hgram_t *b = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
+	od_hgram_t *prev = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
+	od_hgram_frozen_t *f;
+	for (int i = 1; i <= 50; i++) {
+		od_hgram_add_data_point(a, i);
+		od_hgram_add_data_point(b, 50 + i);
 	}
 
-	od_hgram_freeze(&hgram, &f);
+	f = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
+	od_hgram_merge(f, a);
+	od_hgram_merge(f, b);
+	od_hgram_freeze(f, prev, 1);
+	test(f->total == 100);
+	test(od_hgram_quantile(f, 0.5) == 50);
+	test(od_hgram_quantile(f, 0.3) == 30);
+	od_hgram_free(f);
+
+	for (int i = 0; i < 100; i++)
+		od_hgram_add_data_point(a, 1000);
+
+	f = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
+	od_hgram_merge(f, a);
+	od_hgram_merge(f, b);
+	od_hgram_freeze(f, prev, 1);
+	test(f->total == 100);
+	uint64_t value = od_hgram_quantile(f, 0.01);
+	test(value >= 1000 - (1000 >> OD_HGRAM_PRECISION_DEFAULT));
+	test(value <= 1000 + (1000 >> OD_HGRAM_PRECISION_DEFAULT));
+	od_hgram_free(f);
+
+	/* nothing added since the last interval */
+	f = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
+	od_hgram_merge(f, a);
+	od_hgram_merge(f, b);
+	od_hgram_freeze(f, prev, 1);
+	test(f->total == 0);
+	test(od_hgram_quantile(f, 0.5) == 0);
+	od_hgram_free(f);
+
+	od_hgram_free(prev);
+	od_hgram_free(b);
+	od_hgram_free(a);
+}
 
-	int result = 0;
-	if(myround(od_hgram_quantile(&f, 0.8) / 2000.0) != 4)
-		result++;
-	if(myround(od_hgram_quantile(&f, 0.6) / 2000.0) != 3)
-		result++;
-	if(myround(od_hgram_quantile(&f, 0.4) / 2000.0) != 2)
-		result++;
+static void
+hgram_writer(void *arg)
+{
+	od_hgram_t *hgram = arg;
+	for (int i = 0; i < 1000000; i++)
+		od_hgram_add_data_point(hgram, i);
+}
 
-	return result;
+void hgram_throughput_test()
+{
+	/* every writer owns its histogram */
+	od_hgram_t *hgram[4];
+	int64_t id[4];
+	for (int i = 0; i < 4; i++) {
+		hgram[i] = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
+		id[i] = machine_create("hgram", hgram_writer, hgram[i]);
+		test(id[i] != -1);
+	}
+	for (int i = 0; i < 4; i++) {
+		int rc = machine_wait(id[i]);
+		test(rc != -1);
+	}
+
+	od_hgram_frozen_t *f = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
+	for (int i = 0; i < 4; i++) {
+		od_hgram_merge(f, hgram[i]);
+		od_hgram_free(hgram[i]);
+	}
+	od_hgram_freeze(f, NULL, 0);
+	test(f->total == 4000000);
+	uint64_t value = od_hgram_quantile(f, 0.5);
+	test(value >= 500000 - (500000 >> OD_HGRAM_PRECISION_DEFAULT));
+	test(value <= 500000 + (500000 >> OD_HGRAM_PRECISION_DEFAULT));
+	od_hgram_free(f);
 }
 
 void hgram_backward_test()
 {
-	od_hgram_t hgram;
-	od_hgram_frozen_t f;
-	od_hgram_init(&hgram);
+	od_hgram_t *hgram = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
 
 	for (int i = 0; i < 100; i++) {
-		od_hgram_add_data_point(&hgram, 100 - i);
+		od_hgram_add_data_point(hgram, 100 - i);
 	}
 
-	od_hgram_freeze(&hgram, &f);
+	od_hgram_frozen_t *f = hgram_freeze(hgram);
 
-	assert(od_hgram_quantile(&f, 0.7) == 70);
-	assert(od_hgram_quantile(&f, 0.5) == 50);
-	assert(od_hgram_quantile(&f, 0.3) == 30);
+	test(od_hgram_quantile(f, 0.7) == 70);
+	test(od_hgram_quantile(f, 0.5) == 50);
+	test(od_hgram_quantile(f, 0.3) == 30);
+
+	od_hgram_free(f);
+	od_hgram_free(hgram);
 }
 
 void hgram_forward_test()
 {
-	od_hgram_t hgram;
-	od_hgram_frozen_t f;
-	od_hgram_init(&hgram);
+	od_hgram_t *hgram = od_hgram_allocate(OD_HGRAM_PRECISION_DEFAULT);
 
 	for (int i = 1; i <= 100; i++) {
-		od_hgram_add_data_point(&hgram, i);
+		od_hgram_add_data_point(hgram, i);
 	}
-	od_hgram_freeze(&hgram, &f);
+	od_hgram_frozen_t *f = hgram_freeze(hgram);
+
+	test(od_hgram_quantile(f, 0.7) == 70);
+	test(od_hgram_quantile(f, 0.5) == 50);
+	test(od_hgram_quantile(f, 0.3) == 30);
 
-	assert(od_hgram_quantile(&f, 0.7) == 70);
-	assert(od_hgram_quantile(&f, 0.5) == 50);
-	assert(od_hgram_quantile(&f, 0.3) == 30);
+	od_hgram_free(f);
+	od_hgram_free(hgram);
 }
@@ -0,0 +1,27 @@
+source ${0%/*}/environment.sh
+
+ODYSSEY_PID=`cat $ODYSSEY_PID_FILE`
+
+# route a client of a rule which is not shared and disconnect it
+psql -h $ODYSSEY_HOST -p $ODYSSEY_PORT -U reload_user -c "SELECT 1" db > /dev/null 2>&1 || {
+    echo "ERROR: failed to connect before reload"
+    exit 1
+}
+
+# reload with the rule changed, the route outlives the obsolete rule
+# until its server expires and it is collected by gc
+cp $ODYSSEY_CONFIG $TEST_DATA/config.orig
+sed -i 's/pool_size 1$/pool_size 2/' $ODYSSEY_CONFIG
+kill -HUP $ODYSSEY_PID
+sleep 3
+cp $TEST_DATA/config.orig $ODYSSEY_CONFIG
+
+kill -0 $ODYSSEY_PID > /dev/null 2>&1 || {
+    echo "ERROR: odyssey exited after reload and route gc"
+    exit 1
+}
+
+psql -h $ODYSSEY_HOST -p $ODYSSEY_PORT -U reload_user -c "SELECT 1" db > /dev/null 2>&1 || {
+    echo "ERROR: failed to connect after reload"
+    exit 1
+}
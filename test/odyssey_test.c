@@ -22,10 +22,13 @@ extern void machinarium_test_config(void);
 extern void machinarium_test_context_switch(void);
 extern void machinarium_test_sleep(void);
 extern void machinarium_test_sleep_random(void);
+extern void machinarium_test_sleep_order(void);
 extern void machinarium_test_sleep_yield(void);
 extern void machinarium_test_sleep_cancel0(void);
 extern void machinarium_test_join(void);
 extern void machinarium_test_condition0(void);
+extern void machinarium_test_notify(void);
+extern void machinarium_test_iov_size(void);
 extern void machinarium_test_eventfd0(void);
 extern void machinarium_test_stat(void);
 extern void machinarium_test_signal0(void);
@@ -43,6 +46,7 @@ extern void machinarium_test_channel_shared_create(void);
 extern void machinarium_test_channel_shared_rw0(void);
 extern void machinarium_test_channel_shared_rw1(void);
 extern void machinarium_test_channel_shared_rw2(void);
+extern void machinarium_test_channel_shared_rw3(void);
 extern void machinarium_test_sleeplock(void);
 extern void machinarium_test_producer_consumer0(void);
 extern void machinarium_test_producer_consumer1(void);
@@ -54,9 +58,11 @@ extern void machinarium_test_connect_cancel0(void);
 extern void machinarium_test_connect_cancel1(void);
 extern void machinarium_test_accept_timeout(void);
 extern void machinarium_test_accept_cancel(void);
+extern void machinarium_test_accept_batch(void);
 extern void machinarium_test_getaddrinfo0(void);
 extern void machinarium_test_getaddrinfo1(void);
 extern void machinarium_test_getaddrinfo2(void);
+extern void machinarium_test_getaddrinfo3(void);
 extern void machinarium_test_client_server0(void);
 extern void machinarium_test_client_server1(void);
 extern void machinarium_test_client_server2(void);
@@ -66,7 +72,15 @@ extern void machinarium_test_read_10mb1(void);
 extern void machinarium_test_read_10mb2(void);
 extern void machinarium_test_read_timeout(void);
 extern void machinarium_test_read_cancel(void);
+extern void machinarium_test_peek(void);
+extern void machinarium_test_read_edge(void);
 extern void machinarium_test_read_var(void);
+extern void machinarium_test_io_uring(void);
+extern void machinarium_test_compression(void);
+extern void machinarium_test_poll_spin(void);
+extern void machinarium_test_priority(void);
+extern void machinarium_test_clock(void);
+extern void machinarium_test_msg_cache_remote(void);
 extern void machinarium_test_tls0(void);
 extern void machinarium_test_tls_unix_socket(void);
 extern void machinarium_test_tls_read_10mb0(void);
@@ -74,6 +88,8 @@ extern void machinarium_test_tls_read_10mb1(void);
 extern void machinarium_test_tls_read_10mb2(void);
 extern void machinarium_test_tls_read_multithread(void);
 extern void machinarium_test_tls_read_var(void);
+extern void machinarium_test_tls_writev(void);
+extern void machinarium_test_tls_async(void);
 extern void machinarium_test_hgram(void);
 
 int main(int argc, char *argv[])
@@ -87,10 +103,13 @@ int main(int argc, char *argv[])
 	odyssey_test(machinarium_test_context_switch);
 	odyssey_test(machinarium_test_sleep);
 	odyssey_test(machinarium_test_sleep_random);
+	odyssey_test(machinarium_test_sleep_order);
 	odyssey_test(machinarium_test_sleep_yield);
 	odyssey_test(machinarium_test_sleep_cancel0);
 	odyssey_test(machinarium_test_join);
 	odyssey_test(machinarium_test_condition0);
+	odyssey_test(machinarium_test_notify);
+	odyssey_test(machinarium_test_iov_size);
 	odyssey_test(machinarium_test_eventfd0);
 	odyssey_test(machinarium_test_stat);
 	odyssey_test(machinarium_test_signal0);
@@ -108,6 +127,7 @@ int main(int argc, char *argv[])
 	odyssey_test(machinarium_test_channel_shared_rw0);
 	odyssey_test(machinarium_test_channel_shared_rw1);
 	odyssey_test(machinarium_test_channel_shared_rw2);
+	odyssey_test(machinarium_test_channel_shared_rw3);
 	odyssey_test(machinarium_test_sleeplock);
 	odyssey_test(machinarium_test_producer_consumer0);
 	odyssey_test(machinarium_test_producer_consumer1);
@@ -119,9 +139,11 @@ int main(int argc, char *argv[])
 	odyssey_test(machinarium_test_connect_cancel1);
 	odyssey_test(machinarium_test_accept_timeout);
 	odyssey_test(machinarium_test_accept_cancel);
+	odyssey_test(machinarium_test_accept_batch);
 	odyssey_test(machinarium_test_getaddrinfo0);
 	odyssey_test(machinarium_test_getaddrinfo1);
 	odyssey_test(machinarium_test_getaddrinfo2);
+	odyssey_test(machinarium_test_getaddrinfo3);
 	odyssey_test(machinarium_test_client_server0);
 	odyssey_test(machinarium_test_client_server1);
 	odyssey_test(machinarium_test_client_server2);
@@ -131,7 +153,15 @@ int main(int argc, char *argv[])
 	odyssey_test(machinarium_test_read_10mb2);
 	odyssey_test(machinarium_test_read_timeout);
 	odyssey_test(machinarium_test_read_cancel);
+	odyssey_test(machinarium_test_peek);
+	odyssey_test(machinarium_test_read_edge);
 	odyssey_test(machinarium_test_read_var);
+	odyssey_test(machinarium_test_io_uring);
+	odyssey_test(machinarium_test_compression);
+	odyssey_test(machinarium_test_poll_spin);
+	odyssey_test(machinarium_test_priority);
+	odyssey_test(machinarium_test_clock);
+	odyssey_test(machinarium_test_msg_cache_remote);
 	odyssey_test(machinarium_test_tls0);
 	odyssey_test(machinarium_test_tls_unix_socket);
 	odyssey_test(machinarium_test_tls_read_10mb0);
@@ -139,11 +169,14 @@ int main(int argc, char *argv[])
 	odyssey_test(machinarium_test_tls_read_10mb2);
 	odyssey_test(machinarium_test_tls_read_multithread);
 	odyssey_test(machinarium_test_tls_read_var);
+	odyssey_test(machinarium_test_tls_writev);
+	odyssey_test(machinarium_test_tls_async);
 	odyssey_test(machinarium_test_hgram);
 
 	odyssey_shell_test("odyssey/setup");
 	odyssey_shell_test("odyssey/test_scram_backend");
 	odyssey_shell_test("odyssey/test_scram_frontend");
+	odyssey_shell_test("odyssey/test_reload");
 	odyssey_shell_test("odyssey/teardown");
 
 	return 0;
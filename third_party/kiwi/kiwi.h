@@ -13,6 +13,7 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <string.h>
+#include <ctype.h>
 #include <pthread.h>
 #include <assert.h>
 #include <machinarium.h>
@@ -27,6 +28,7 @@
 #include "kiwi/var.h"
 #include "kiwi/param.h"
 #include "kiwi/param_lock.h"
+#include "kiwi/query.h"
 #include "kiwi/fe_read.h"
 #include "kiwi/be_read.h"
 #include "kiwi/fe_write.h"
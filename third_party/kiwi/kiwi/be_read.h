@@ -34,7 +34,7 @@ kiwi_be_startup_init(kiwi_be_startup_t *su)
 
 static inline int
 kiwi_be_read_options(kiwi_be_startup_t *su, char *pos, uint32_t pos_size,
-                     kiwi_vars_t *vars)
+                     kiwi_vars_t *vars, char *track)
 {
 	for (;;)
 	{
@@ -66,7 +66,12 @@ kiwi_be_read_options(kiwi_be_startup_t *su, char *pos, uint32_t pos_size,
 		if (name_size == 12 && !memcmp(name, "replication", 12))
 			kiwi_var_set(&su->replication, KIWI_VAR_UNDEF, value, value_size);
 		else
-			kiwi_vars_update(vars, name, name_size, value, value_size);
+		if (kiwi_vars_update(vars, name, name_size, value, value_size) == -1 &&
+		    kiwi_vars_is_tracked(track, name, name_size)) {
+			rc = kiwi_vars_extra_set(vars, name, name_size, value, value_size);
+			if (kiwi_unlikely(rc == -1))
+				return -1;
+		}
 	}
 
 	/* user is mandatory */
@@ -89,7 +94,8 @@ kiwi_be_read_options(kiwi_be_startup_t *su, char *pos, uint32_t pos_size,
 #define PG_PROTOCOL_EARLIEST	PG_PROTOCOL(2,0)
 
 KIWI_API static inline int
-kiwi_be_read_startup(char *data, uint32_t size, kiwi_be_startup_t *su, kiwi_vars_t *vars)
+kiwi_be_read_startup(char *data, uint32_t size, kiwi_be_startup_t *su,
+                     kiwi_vars_t *vars, char *track)
 {
 	uint32_t pos_size = size;
 	char *pos = data;
@@ -107,7 +113,7 @@ kiwi_be_read_startup(char *data, uint32_t size, kiwi_be_startup_t *su, kiwi_vars
 	/* StartupMessage */
 	case PG_PROTOCOL_LATEST:
 		su->is_cancel = 0;
-		rc = kiwi_be_read_options(su, pos, pos_size, vars);
+		rc = kiwi_be_read_options(su, pos, pos_size, vars, track);
 		if (kiwi_unlikely(rc == -1))
 			return -1;
 		break;
@@ -204,7 +210,8 @@ kiwi_be_read_parse(char *data, uint32_t size, char **name, uint32_t *name_len,
 
 KIWI_API static inline int
 kiwi_be_read_authentication_sasl_initial(char *data, uint32_t size, 
-					      		   		 char **mechanism, char **auth_data)
+					      		   		 char **mechanism, char **auth_data,
+					      		   		 uint32_t *auth_data_len)
 {
 	kiwi_header_t *header = (kiwi_header_t*)data;
 	uint32_t len;
@@ -222,10 +229,11 @@ kiwi_be_read_authentication_sasl_initial(char *data, uint32_t size,
 	if (kiwi_unlikely(rc == -1))
 		return -1;
 
-	uint32_t auth_data_len;
-	rc = kiwi_read32(&auth_data_len, &pos, &pos_size);
+	rc = kiwi_read32(auth_data_len, &pos, &pos_size);
 	if (kiwi_unlikely(rc == -1))
 		return -1;
+	if (kiwi_unlikely(*auth_data_len > pos_size))
+		return -1;
 
 	*auth_data = pos;
 
@@ -234,7 +242,7 @@ kiwi_be_read_authentication_sasl_initial(char *data, uint32_t size,
 
 KIWI_API static inline int
 kiwi_be_read_authentication_sasl(char *data, uint32_t size, 
-						         char **auth_data)
+						         char **auth_data, uint32_t *auth_data_len)
 {
 	kiwi_header_t *header = (kiwi_header_t*)data;
 	uint32_t len;
@@ -245,6 +253,7 @@ kiwi_be_read_authentication_sasl(char *data, uint32_t size,
 		return -1;
 
 	*auth_data = kiwi_header_data(header);
+	*auth_data_len = len;
 
 	return 0;
 }
@@ -510,6 +510,24 @@ kiwi_be_write_data_row(machine_msg_t *msg, int *begin_offset)
 	return msg;
 }
 
+static inline void
+kiwi_be_write_data_row_count(machine_msg_t *msg, int begin_offset, int size)
+{
+	char *pos;
+	kiwi_header_t *header;
+	header = (kiwi_header_t*)((char*)machine_msg_data(msg) + begin_offset);
+	uint32_t pos_size = sizeof(uint32_t) + sizeof(uint16_t);
+	pos = (char*)&header->len;
+	uint32_t total_size;
+	uint16_t count;
+	kiwi_read32(&total_size, &pos, &pos_size);
+	kiwi_read16(&count, &pos, &pos_size);
+	total_size += size;
+	count++;
+	kiwi_write32to((char*)&header->len, total_size);
+	kiwi_write16to((char*)&header->len + sizeof(uint32_t), count);
+}
+
 KIWI_API static inline int
 kiwi_be_write_data_row_add(machine_msg_t *msg, int begin_offset,
                            char *data, int32_t len)
@@ -528,19 +546,55 @@ kiwi_be_write_data_row_add(machine_msg_t *msg, int begin_offset,
 	if (! is_null)
 		kiwi_write(&pos, data, len);
 
-	kiwi_header_t *header;
-	header = (kiwi_header_t*)((char*)machine_msg_data(msg) + begin_offset);
-	uint32_t pos_size = sizeof(uint32_t) + sizeof(uint16_t);
-	pos = (char*)&header->len;
-	uint32_t total_size;
-	uint16_t count;
-	kiwi_read32(&total_size, &pos, &pos_size);
-	kiwi_read16(&count, &pos, &pos_size);
-	total_size += size;
-	count++;
-	kiwi_write32to((char*)&header->len, total_size);
-	kiwi_write16to((char*)&header->len + sizeof(uint32_t), count);
+	kiwi_be_write_data_row_count(msg, begin_offset, size);
+	return 0;
+}
+
+static inline int
+kiwi_be_write_data_row_add_number(machine_msg_t *msg, int begin_offset,
+                                  uint64_t value, int negative)
+{
+	/* digits are formatted directly into the message */
+	int len = 1 + negative;
+	uint64_t left = value;
+	while (left >= 10) {
+		left /= 10;
+		len++;
+	}
+	int size = sizeof(uint32_t) + len;
+	char *pos;
+	pos = machine_msg_reserve(msg, size);
+	if (kiwi_unlikely(pos == NULL))
+		return -1;
+	kiwi_write32(&pos, len);
+	if (negative)
+		*pos = '-';
+	char *digit = pos + len;
+	do {
+		*--digit = '0' + value % 10;
+		value /= 10;
+	} while (value > 0);
+	machine_msg_write(msg, NULL, size);
+
+	kiwi_be_write_data_row_count(msg, begin_offset, size);
 	return 0;
 }
 
+KIWI_API static inline int
+kiwi_be_write_data_row_add_u64(machine_msg_t *msg, int begin_offset,
+                               uint64_t value)
+{
+	return kiwi_be_write_data_row_add_number(msg, begin_offset, value, 0);
+}
+
+KIWI_API static inline int
+kiwi_be_write_data_row_add_i64(machine_msg_t *msg, int begin_offset,
+                               int64_t value)
+{
+	if (value < 0)
+		return kiwi_be_write_data_row_add_number(msg, begin_offset,
+		                                         -(uint64_t)value, 1);
+	return kiwi_be_write_data_row_add_number(msg, begin_offset, value, 0);
+}
+
 #endif /* KIWI_BE_WRITE_H */
@@ -284,6 +284,7 @@
 #define KIWI_CRASH_SHUTDOWN "57P02"
 #define KIWI_CANNOT_CONNECT_NOW "57P03"
 #define KIWI_DATABASE_DROPPED "57P04"
+#define KIWI_IDLE_SESSION_TIMEOUT "57P05"
 
 /* Class 58 - System Error "errors external to PostgreSQL itself" */
 #define KIWI_SYSTEM_ERROR "58000"
@@ -107,6 +107,24 @@ kiwi_fe_write_terminate(machine_msg_t *msg)
 	return msg;
 }
 
+KIWI_API static inline machine_msg_t*
+kiwi_fe_write_copy_fail(machine_msg_t *msg, char *message, int len)
+{
+	int size = sizeof(kiwi_header_t) + len;
+	int offset = 0;
+	if (msg)
+		offset = machine_msg_size(msg);
+	msg = machine_msg_create_or_advance(msg, size);
+	if (kiwi_unlikely(msg == NULL))
+		return NULL;
+	char *pos;
+	pos = (char*)machine_msg_data(msg) + offset;
+	kiwi_write8(&pos, KIWI_FE_COPY_FAIL);
+	kiwi_write32(&pos, sizeof(uint32_t) + len);
+	kiwi_write(&pos, message, len);
+	return msg;
+}
+
 KIWI_API static inline machine_msg_t*
 kiwi_fe_write_password(machine_msg_t *msg, char *password, int len)
 {
@@ -161,7 +179,7 @@ kiwi_fe_write_parse(machine_msg_t *msg,
 	char *pos;
 	pos = (char*)machine_msg_data(msg) + offset;
 	kiwi_write8(&pos, KIWI_FE_PARSE);
-	kiwi_write32(&pos, sizeof(uint32_t) + size);
+	kiwi_write32(&pos, size - sizeof(uint8_t));
 	kiwi_write(&pos, operator_name, operator_len);
 	kiwi_write(&pos, query, query_len);
 	kiwi_write16(&pos, typec);
@@ -202,7 +220,7 @@ kiwi_fe_write_bind(machine_msg_t *msg,
 	pos = (char*)machine_msg_data(msg) + offset;
 
 	kiwi_write8(&pos, KIWI_FE_BIND);
-	kiwi_write32(&pos, sizeof(uint32_t) + size);
+	kiwi_write32(&pos, size - sizeof(uint8_t));
 	kiwi_write(&pos, portal_name, portal_len);
 	kiwi_write(&pos, operator_name, operator_len);
 	kiwi_write16(&pos, argc_call_types);
@@ -234,7 +252,26 @@ kiwi_fe_write_describe(machine_msg_t *msg, uint8_t type, char *name, int name_le
 	char *pos;
 	pos = (char*)machine_msg_data(msg) + offset;
 	kiwi_write8(&pos, KIWI_FE_DESCRIBE);
-	kiwi_write32(&pos, sizeof(uint32_t) + size);
+	kiwi_write32(&pos, sizeof(uint32_t) + sizeof(type) + name_len);
+	kiwi_write8(&pos, type);
+	kiwi_write(&pos, name, name_len);
+	return msg;
+}
+
+KIWI_API static inline machine_msg_t*
+kiwi_fe_write_close(machine_msg_t *msg, uint8_t type, char *name, int name_len)
+{
+	int size = sizeof(kiwi_header_t) + sizeof(type) + name_len;
+	int offset = 0;
+	if (msg)
+		offset = machine_msg_size(msg);
+	msg = machine_msg_create_or_advance(msg, size);
+	if (kiwi_unlikely(msg == NULL))
+		return NULL;
+	char *pos;
+	pos = (char*)machine_msg_data(msg) + offset;
+	kiwi_write8(&pos, KIWI_FE_CLOSE);
+	kiwi_write32(&pos, sizeof(uint32_t) + sizeof(type) + name_len);
 	kiwi_write8(&pos, type);
 	kiwi_write(&pos, name, name_len);
 	return msg;
@@ -253,7 +290,7 @@ kiwi_fe_write_execute(machine_msg_t *msg, char *portal, int portal_len, uint32_t
 	char *pos;
 	pos = (char*)machine_msg_data(msg) + offset;
 	kiwi_write8(&pos, KIWI_FE_EXECUTE);
-	kiwi_write32(&pos, sizeof(uint32_t) + size);
+	kiwi_write32(&pos, size - sizeof(uint8_t));
 	kiwi_write(&pos, portal, portal_len);
 	kiwi_write32(&pos, limit);
 	return msg;
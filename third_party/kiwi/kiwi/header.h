@@ -20,6 +20,7 @@ typedef enum
 	KIWI_FE_DESCRIBE         = 'D',
 	KIWI_FE_EXECUTE          = 'E',
 	KIWI_FE_SYNC             = 'S',
+	KIWI_FE_FLUSH            = 'H',
 	KIWI_FE_CLOSE            = 'C',
 	KIWI_FE_COPY_DATA        = 'd',
 	KIWI_FE_COPY_DONE        = 'c',
@@ -80,6 +81,7 @@ kiwi_fe_type_to_string(int type)
 	case KIWI_FE_DESCRIBE:         return "Describe";
 	case KIWI_FE_EXECUTE:          return "Execute";
 	case KIWI_FE_SYNC:             return "Sync";
+	case KIWI_FE_FLUSH:            return "Flush";
 	case KIWI_FE_CLOSE:            return "Close";
 	case KIWI_FE_COPY_DATA:        return "CopyData";
 	case KIWI_FE_COPY_DONE:        return "CopyDone";
@@ -221,4 +221,35 @@ kiwi_validate_header(char *data, uint32_t data_size, uint32_t *size)
 	return -1;
 }
 
+/* Messages of unknown size are written in place: begin
+ * appends the header, the body is written into
+ * machine_msg_reserve() space and committed with
+ * machine_msg_write(msg, NULL, size), end sets the length. */
+
+static inline machine_msg_t*
+kiwi_write_begin(machine_msg_t *msg, uint8_t type, int *begin_offset)
+{
+	int offset = 0;
+	if (msg)
+		offset = machine_msg_size(msg);
+	*begin_offset = offset;
+	msg = machine_msg_create_or_advance(msg, sizeof(kiwi_header_t));
+	if (kiwi_unlikely(msg == NULL))
+		return NULL;
+	char *pos;
+	pos = (char*)machine_msg_data(msg) + offset;
+	kiwi_write8(&pos, type);
+	kiwi_write32(&pos, sizeof(uint32_t));
+	return msg;
+}
+
+static inline void
+kiwi_write_end(machine_msg_t *msg, int begin_offset)
+{
+	kiwi_header_t *header;
+	header = (kiwi_header_t*)((char*)machine_msg_data(msg) + begin_offset);
+	uint32_t len = machine_msg_size(msg) - begin_offset - sizeof(uint8_t);
+	kiwi_write32to((char*)&header->len, len);
+}
+
 #endif /* KIWI_IO_H */
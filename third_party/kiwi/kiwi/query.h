@@ -0,0 +1,370 @@
+#ifndef KIWI_QUERY_H
+#define KIWI_QUERY_H
+
+/*
+ * kiwi.
+ *
+ * postgreSQL protocol interaction library.
+*/
+
+/* Classification of a query by its leading keyword.
+ *
+ * Leading whitespace and comments are skipped, the keyword is
+ * loaded into a 64-bit word, lowercased and compared with the
+ * keyword constants at once, so classification does not depend
+ * on the query length. */
+
+typedef enum
+{
+	KIWI_QUERY_UNKNOWN,
+	KIWI_QUERY_SELECT,
+	KIWI_QUERY_INSERT,
+	KIWI_QUERY_UPDATE,
+	KIWI_QUERY_DELETE,
+	KIWI_QUERY_WITH,
+	KIWI_QUERY_VALUES,
+	KIWI_QUERY_COPY,
+	KIWI_QUERY_SET,
+	KIWI_QUERY_RESET,
+	KIWI_QUERY_SHOW,
+	KIWI_QUERY_BEGIN,
+	KIWI_QUERY_START,
+	KIWI_QUERY_COMMIT,
+	KIWI_QUERY_END,
+	KIWI_QUERY_ROLLBACK,
+	KIWI_QUERY_ABORT,
+	KIWI_QUERY_SAVEPOINT,
+	KIWI_QUERY_RELEASE,
+	KIWI_QUERY_PREPARE,
+	KIWI_QUERY_EXECUTE,
+	KIWI_QUERY_DEALLOCATE,
+	KIWI_QUERY_DISCARD,
+	KIWI_QUERY_LISTEN,
+	KIWI_QUERY_UNLISTEN,
+	KIWI_QUERY_NOTIFY,
+	KIWI_QUERY_CREATE,
+	KIWI_QUERY_DECLARE
+} kiwi_query_type_t;
+
+#define KIWI_QUERY_KEYWORD_MAX 10
+
+#define KIWI_QUERY_WORD(a, b, c, d, e, f, g, h) \
+	((uint64_t)(a)       | (uint64_t)(b) << 8  | \
+	 (uint64_t)(c) << 16 | (uint64_t)(d) << 24 | \
+	 (uint64_t)(e) << 32 | (uint64_t)(f) << 40 | \
+	 (uint64_t)(g) << 48 | (uint64_t)(h) << 56)
+
+static inline int
+kiwi_query_is_space(char c)
+{
+	return c == ' ' || c == '\n' || c == '\t' || c == '\r' ||
+	       c == '\f' || c == '\v';
+}
+
+static inline int
+kiwi_query_is_letter(char c)
+{
+	return (uint8_t)((c | 0x20) - 'a') < 26;
+}
+
+static inline int
+kiwi_query_is_ident(char c)
+{
+	return kiwi_query_is_letter(c) || (uint8_t)(c - '0') < 10 ||
+	       c == '_' || c == '$' || (uint8_t)c >= 0x80;
+}
+
+KIWI_API static inline char*
+kiwi_query_skip(char *query, char *end)
+{
+	/* skip whitespace, line comments and nested block comments */
+	while (query < end) {
+		if (kiwi_query_is_space(*query)) {
+			query++;
+			continue;
+		}
+		if (end - query < 2)
+			break;
+		if (query[0] == '-' && query[1] == '-') {
+			query += 2;
+			while (query < end && *query != '\n')
+				query++;
+			continue;
+		}
+		if (query[0] == '/' && query[1] == '*') {
+			int depth = 1;
+			query += 2;
+			while (query < end && depth > 0) {
+				if (end - query >= 2 && query[0] == '*' && query[1] == '/') {
+					depth--;
+					query += 2;
+				} else
+				if (end - query >= 2 && query[0] == '/' && query[1] == '*') {
+					depth++;
+					query += 2;
+				} else {
+					query++;
+				}
+			}
+			continue;
+		}
+		break;
+	}
+	return query;
+}
+
+static inline uint64_t
+kiwi_query_load(char *pos, int len)
+{
+	uint64_t word = 0;
+	memcpy(&word, pos, len > 8 ? 8 : len);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	/* only letters are loaded, setting 0x20 lowercases them */
+	uint64_t mask = len >= 8 ? UINT64_MAX : ((uint64_t)1 << (len * 8)) - 1;
+	return (word | 0x2020202020202020ULL) & mask;
+}
+
+KIWI_API static inline kiwi_query_type_t
+kiwi_query_classify(char *query, uint32_t query_len)
+{
+	char *end = query + query_len;
+	char *pos = kiwi_query_skip(query, end);
+
+	/* keyword must be followed by a non-identifier character */
+	int len = 0;
+	while (pos + len < end && len <= KIWI_QUERY_KEYWORD_MAX &&
+	       kiwi_query_is_letter(pos[len]))
+		len++;
+	if (len < 3 || len > KIWI_QUERY_KEYWORD_MAX)
+		return KIWI_QUERY_UNKNOWN;
+	if (pos + len < end && kiwi_query_is_ident(pos[len]))
+		return KIWI_QUERY_UNKNOWN;
+
+	uint64_t word = kiwi_query_load(pos, len);
+	uint64_t tail = 0;
+	if (len > 8)
+		tail = kiwi_query_load(pos + 8, len - 8);
+
+	switch (len) {
+	case 3:
+		if (word == KIWI_QUERY_WORD('s', 'e', 't', 0, 0, 0, 0, 0))
+			return KIWI_QUERY_SET;
+		if (word == KIWI_QUERY_WORD('e', 'n', 'd', 0, 0, 0, 0, 0))
+			return KIWI_QUERY_END;
+		break;
+	case 4:
+		if (word == KIWI_QUERY_WORD('w', 'i', 't', 'h', 0, 0, 0, 0))
+			return KIWI_QUERY_WITH;
+		if (word == KIWI_QUERY_WORD('s', 'h', 'o', 'w', 0, 0, 0, 0))
+			return KIWI_QUERY_SHOW;
+		if (word == KIWI_QUERY_WORD('c', 'o', 'p', 'y', 0, 0, 0, 0))
+			return KIWI_QUERY_COPY;
+		break;
+	case 5:
+		if (word == KIWI_QUERY_WORD('b', 'e', 'g', 'i', 'n', 0, 0, 0))
+			return KIWI_QUERY_BEGIN;
+		if (word == KIWI_QUERY_WORD('s', 't', 'a', 'r', 't', 0, 0, 0))
+			return KIWI_QUERY_START;
+		if (word == KIWI_QUERY_WORD('r', 'e', 's', 'e', 't', 0, 0, 0))
+			return KIWI_QUERY_RESET;
+		if (word == KIWI_QUERY_WORD('a', 'b', 'o', 'r', 't', 0, 0, 0))
+			return KIWI_QUERY_ABORT;
+		break;
+	case 6:
+		if (word == KIWI_QUERY_WORD('s', 'e', 'l', 'e', 'c', 't', 0, 0))
+			return KIWI_QUERY_SELECT;
+		if (word == KIWI_QUERY_WORD('i', 'n', 's', 'e', 'r', 't', 0, 0))
+			return KIWI_QUERY_INSERT;
+		if (word == KIWI_QUERY_WORD('u', 'p', 'd', 'a', 't', 'e', 0, 0))
+			return KIWI_QUERY_UPDATE;
+		if (word == KIWI_QUERY_WORD('d', 'e', 'l', 'e', 't', 'e', 0, 0))
+			return KIWI_QUERY_DELETE;
+		if (word == KIWI_QUERY_WORD('c', 'o', 'm', 'm', 'i', 't', 0, 0))
+			return KIWI_QUERY_COMMIT;
+		if (word == KIWI_QUERY_WORD('v', 'a', 'l', 'u', 'e', 's', 0, 0))
+			return KIWI_QUERY_VALUES;
+		if (word == KIWI_QUERY_WORD('l', 'i', 's', 't', 'e', 'n', 0, 0))
+			return KIWI_QUERY_LISTEN;
+		if (word == KIWI_QUERY_WORD('n', 'o', 't', 'i', 'f', 'y', 0, 0))
+			return KIWI_QUERY_NOTIFY;
+		if (word == KIWI_QUERY_WORD('c', 'r', 'e', 'a', 't', 'e', 0, 0))
+			return KIWI_QUERY_CREATE;
+		break;
+	case 7:
+		if (word == KIWI_QUERY_WORD('d', 'i', 's', 'c', 'a', 'r', 'd', 0))
+			return KIWI_QUERY_DISCARD;
+		if (word == KIWI_QUERY_WORD('p', 'r', 'e', 'p', 'a', 'r', 'e', 0))
+			return KIWI_QUERY_PREPARE;
+		if (word == KIWI_QUERY_WORD('e', 'x', 'e', 'c', 'u', 't', 'e', 0))
+			return KIWI_QUERY_EXECUTE;
+		if (word == KIWI_QUERY_WORD('r', 'e', 'l', 'e', 'a', 's', 'e', 0))
+			return KIWI_QUERY_RELEASE;
+		if (word == KIWI_QUERY_WORD('d', 'e', 'c', 'l', 'a', 'r', 'e', 0))
+			return KIWI_QUERY_DECLARE;
+		break;
+	case 8:
+		if (word == KIWI_QUERY_WORD('r', 'o', 'l', 'l', 'b', 'a', 'c', 'k'))
+			return KIWI_QUERY_ROLLBACK;
+		if (word == KIWI_QUERY_WORD('u', 'n', 'l', 'i', 's', 't', 'e', 'n'))
+			return KIWI_QUERY_UNLISTEN;
+		break;
+	case 9:
+		if (word == KIWI_QUERY_WORD('s', 'a', 'v', 'e', 'p', 'o', 'i', 'n') &&
+		    tail == 't')
+			return KIWI_QUERY_SAVEPOINT;
+		break;
+	case 10:
+		if (word == KIWI_QUERY_WORD('d', 'e', 'a', 'l', 'l', 'o', 'c', 'a') &&
+		    tail == KIWI_QUERY_WORD('t', 'e', 0, 0, 0, 0, 0, 0))
+			return KIWI_QUERY_DEALLOCATE;
+		break;
+	}
+	return KIWI_QUERY_UNKNOWN;
+}
+
+/* SET or RESET of a session parameter, name and value are zero
+ * terminated and their lengths include the zero, as in kiwi_var_t.
+ * RESET ALL has an empty name. */
+
+typedef struct
+{
+	kiwi_query_type_t type;
+	char              name[KIWI_MAX_VAR_SIZE];
+	int               name_len;
+	char              value[KIWI_MAX_VAR_SIZE];
+	int               value_len;
+} kiwi_query_set_t;
+
+static inline char*
+kiwi_query_read_name(char *pos, char *end, char *name, int *name_len)
+{
+	/* lowercased identifier, custom parameters are qualified */
+	int len = 0;
+	while (pos < end && (kiwi_query_is_ident(*pos) || *pos == '.')) {
+		if (len == KIWI_MAX_VAR_SIZE - 1)
+			return NULL;
+		name[len++] = tolower(*pos++);
+	}
+	if (len == 0)
+		return NULL;
+	name[len++] = 0;
+	*name_len = len;
+	return pos;
+}
+
+static inline char*
+kiwi_query_read_value(char *pos, char *end, char *value, int *value_len)
+{
+	/* quoted string or a bare word, list items are joined by
+	 * comma as the server does */
+	int len = *value_len;
+	for (;;) {
+		if (pos < end && *pos == '\'') {
+			pos++;
+			for (;;) {
+				if (pos == end)
+					return NULL;
+				if (*pos == '\'') {
+					if (end - pos < 2 || pos[1] != '\'')
+						break;
+					pos++;
+				}
+				if (len == KIWI_MAX_VAR_SIZE - 1)
+					return NULL;
+				value[len++] = *pos++;
+			}
+			pos++;
+		} else {
+			char *start = pos;
+			while (pos < end && (kiwi_query_is_ident(*pos) || *pos == '.' ||
+			                     *pos == '-' || *pos == '+')) {
+				if (len == KIWI_MAX_VAR_SIZE - 1)
+					return NULL;
+				value[len++] = *pos++;
+			}
+			if (pos == start)
+				return NULL;
+		}
+		pos = kiwi_query_skip(pos, end);
+		if (pos == end || *pos != ',')
+			break;
+		pos = kiwi_query_skip(pos + 1, end);
+		if (len + 2 > KIWI_MAX_VAR_SIZE - 1)
+			return NULL;
+		value[len++] = ',';
+		value[len++] = ' ';
+	}
+	*value_len = len;
+	return pos;
+}
+
+KIWI_API static inline int
+kiwi_query_read_set(char *query, uint32_t query_len, kiwi_query_set_t *set)
+{
+	/* SET [SESSION] name {TO | =} value
+	 * RESET {name | ALL}
+	 *
+	 * returns -1 for anything else, including SET LOCAL and the
+	 * special forms like SET TIME ZONE, and for several statements */
+	char *end = query + query_len;
+	while (end > query && end[-1] == 0)
+		end--;
+	char *pos = kiwi_query_skip(query, end);
+	set->type = kiwi_query_classify(pos, end - pos);
+	if (set->type != KIWI_QUERY_SET && set->type != KIWI_QUERY_RESET)
+		return -1;
+	pos += set->type == KIWI_QUERY_SET ? 3 : 5;
+	pos = kiwi_query_skip(pos, end);
+	pos = kiwi_query_read_name(pos, end, set->name, &set->name_len);
+	if (pos == NULL)
+		return -1;
+	set->value_len = 0;
+
+	if (set->type == KIWI_QUERY_RESET) {
+		if (set->name_len == 4 && !memcmp(set->name, "all", 4))
+			set->name_len = 0;
+	} else {
+		if (set->name_len == 6 && !memcmp(set->name, "local", 6))
+			return -1;
+		if (set->name_len == 8 && !memcmp(set->name, "session", 8)) {
+			pos = kiwi_query_skip(pos, end);
+			pos = kiwi_query_read_name(pos, end, set->name, &set->name_len);
+			if (pos == NULL)
+				return -1;
+		}
+		pos = kiwi_query_skip(pos, end);
+		if (pos < end && *pos == '=') {
+			pos++;
+		} else
+		if (end - pos >= 2 && (pos[0] | 0x20) == 't' && (pos[1] | 0x20) == 'o' &&
+		    (end - pos == 2 || !kiwi_query_is_ident(pos[2]))) {
+			pos += 2;
+		} else {
+			return -1;
+		}
+		pos = kiwi_query_skip(pos, end);
+		char *value = pos;
+		pos = kiwi_query_read_value(pos, end, set->value, &set->value_len);
+		if (pos == NULL)
+			return -1;
+		if (*value != '\'' && set->value_len == 7 &&
+		    !strncasecmp(set->value, "default", 7)) {
+			set->type = KIWI_QUERY_RESET;
+			set->value_len = 0;
+		} else {
+			set->value[set->value_len++] = 0;
+		}
+	}
+
+	/* single statement */
+	pos = kiwi_query_skip(pos, end);
+	if (pos < end && *pos == ';')
+		pos = kiwi_query_skip(pos + 1, end);
+	if (pos != end)
+		return -1;
+	return 0;
+}
+
+#endif /* KIWI_QUERY_H */
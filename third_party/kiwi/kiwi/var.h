@@ -19,7 +19,8 @@ typedef enum {
 	KIWI_VAR_STANDARD_CONFORMING_STRINGS,
 	KIWI_VAR_APPLICATION_NAME,
 	KIWI_VAR_MAX,
-	KIWI_VAR_UNDEF
+	KIWI_VAR_UNDEF,
+	KIWI_VAR_EXTRA
 } kiwi_var_type_t;
 
 struct kiwi_var
@@ -33,9 +34,16 @@ struct kiwi_var
 
 struct kiwi_vars
 {
-	kiwi_var_t vars[KIWI_VAR_MAX];
+	kiwi_var_t  vars[KIWI_VAR_MAX];
+	kiwi_var_t *extra;
+	int         extra_size;
+	int         extra_count;
+	uint64_t    hash;
 };
 
+/* hash of a vars set with all variables undefined */
+#define KIWI_VARS_HASH_SEED 14695981039346656037ULL
+
 static inline void
 kiwi_var_init(kiwi_var_t *var, char *name, int name_len)
 {
@@ -73,6 +81,21 @@ kiwi_var_compare(kiwi_var_t *a, kiwi_var_t *b)
 	return memcmp(a->value, b->value, a->value_len) == 0;
 }
 
+static inline uint64_t
+kiwi_var_hash(kiwi_var_t *var)
+{
+	if (var->type == KIWI_VAR_UNDEF)
+		return 0;
+	/* FNV-1a */
+	uint64_t hash = 14695981039346656037ULL;
+	int i;
+	for (i = 0; i < var->name_len; i++)
+		hash = (hash ^ (unsigned char)var->name[i]) * 1099511628211ULL;
+	for (i = 0; i < var->value_len; i++)
+		hash = (hash ^ (unsigned char)var->value[i]) * 1099511628211ULL;
+	return hash;
+}
+
 static inline kiwi_var_t*
 kiwi_vars_of(kiwi_vars_t *vars, kiwi_var_type_t type)
 {
@@ -98,18 +121,187 @@ kiwi_vars_init(kiwi_vars_t *vars)
 	kiwi_var_init(&vars->vars[KIWI_VAR_STANDARD_CONFORMING_STRINGS],
 	              "standard_conforming_strings", 28);
 	kiwi_var_init(&vars->vars[KIWI_VAR_APPLICATION_NAME], "application_name", 17);
+	vars->extra       = NULL;
+	vars->extra_size  = 0;
+	vars->extra_count = 0;
+	vars->hash        = KIWI_VARS_HASH_SEED;
+}
+
+static inline void
+kiwi_vars_free(kiwi_vars_t *vars)
+{
+	int i;
+	for (i = 0; i < vars->extra_size; i++)
+		free(vars->extra[i].name);
+	free(vars->extra);
+	vars->extra       = NULL;
+	vars->extra_size  = 0;
+	vars->extra_count = 0;
+}
+
+/*
+ * Extra variables are tracked in addition to the fixed set,
+ * in an open addressing table keyed by the lower case name.
+ * Slots are never removed, unset variables keep their name,
+ * empty slots have no name.
+*/
+
+static inline uint32_t
+kiwi_vars_extra_hash(char *name, int name_len)
+{
+	uint32_t hash = 2166136261U;
+	int i;
+	for (i = 0; i < name_len; i++)
+		hash = (hash ^ (unsigned char)tolower(name[i])) * 16777619U;
+	return hash;
+}
+
+static inline kiwi_var_t*
+kiwi_vars_extra_slot(kiwi_var_t *table, int size, char *name, int name_len)
+{
+	/* returns matching or first empty slot */
+	uint32_t mask = size - 1;
+	uint32_t pos = kiwi_vars_extra_hash(name, name_len) & mask;
+	for (;;) {
+		kiwi_var_t *var = &table[pos];
+		if (var->name == NULL)
+			return var;
+		if (var->name_len == name_len &&
+		    !strncasecmp(var->name, name, name_len))
+			return var;
+		pos = (pos + 1) & mask;
+	}
+}
+
+static inline kiwi_var_t*
+kiwi_vars_extra_find(kiwi_vars_t *vars, char *name, int name_len)
+{
+	if (vars->extra_count == 0)
+		return NULL;
+	kiwi_var_t *var;
+	var = kiwi_vars_extra_slot(vars->extra, vars->extra_size, name, name_len);
+	if (var->name == NULL)
+		return NULL;
+	return var;
+}
+
+static inline int
+kiwi_vars_extra_grow(kiwi_vars_t *vars)
+{
+	int size = vars->extra_size ? vars->extra_size * 2 : 8;
+	kiwi_var_t *table = calloc(size, sizeof(kiwi_var_t));
+	if (table == NULL)
+		return -1;
+	int i;
+	for (i = 0; i < vars->extra_size; i++) {
+		kiwi_var_t *var = &vars->extra[i];
+		if (var->name == NULL)
+			continue;
+		kiwi_var_t *slot;
+		slot = kiwi_vars_extra_slot(table, size, var->name, var->name_len);
+		*slot = *var;
+	}
+	free(vars->extra);
+	vars->extra      = table;
+	vars->extra_size = size;
+	return 0;
+}
+
+static inline kiwi_var_t*
+kiwi_vars_extra_add(kiwi_vars_t *vars, char *name, int name_len)
+{
+	kiwi_var_t *var;
+	var = kiwi_vars_extra_find(vars, name, name_len);
+	if (var)
+		return var;
+	/* keep load factor below 1/2 */
+	if ((vars->extra_count + 1) * 2 > vars->extra_size) {
+		if (kiwi_vars_extra_grow(vars) == -1)
+			return NULL;
+	}
+	var = kiwi_vars_extra_slot(vars->extra, vars->extra_size, name, name_len);
+	char *copy = malloc(name_len);
+	if (copy == NULL)
+		return NULL;
+	int i;
+	for (i = 0; i < name_len; i++)
+		copy[i] = tolower(name[i]);
+	kiwi_var_init(var, copy, name_len);
+	vars->extra_count++;
+	return var;
+}
+
+static inline int
+kiwi_vars_extra_set(kiwi_vars_t *vars, char *name, int name_len,
+                    char *value, int value_len)
+{
+	kiwi_var_t *var;
+	var = kiwi_vars_extra_add(vars, name, name_len);
+	if (var == NULL)
+		return -1;
+	vars->hash -= kiwi_var_hash(var);
+	int rc;
+	rc = kiwi_var_set(var, KIWI_VAR_EXTRA, value, value_len);
+	vars->hash += kiwi_var_hash(var);
+	return rc;
+}
+
+static inline void
+kiwi_vars_extra_unset(kiwi_vars_t *vars, kiwi_var_t *var)
+{
+	vars->hash -= kiwi_var_hash(var);
+	kiwi_var_unset(var);
+}
+
+static inline void
+kiwi_vars_extra_reset(kiwi_vars_t *vars)
+{
+	int i;
+	for (i = 0; i < vars->extra_size; i++)
+		if (vars->extra[i].type == KIWI_VAR_EXTRA)
+			kiwi_vars_extra_unset(vars, &vars->extra[i]);
+}
+
+static inline int
+kiwi_vars_is_tracked(char *track, char *name, int name_len)
+{
+	/* track is a comma or space separated list of names,
+	 * name_len includes the trailing zero */
+	if (track == NULL || name_len <= 1)
+		return 0;
+	int len = name_len - 1;
+	char *pos = track;
+	while (*pos) {
+		while (*pos == ',' || *pos == ' ')
+			pos++;
+		char *start = pos;
+		while (*pos && *pos != ',' && *pos != ' ')
+			pos++;
+		if (pos - start == len && !strncasecmp(start, name, len))
+			return 1;
+	}
+	return 0;
 }
 
 static inline int
 kiwi_vars_set(kiwi_vars_t *vars, kiwi_var_type_t type, char *value, int value_len)
 {
-	return kiwi_var_set(kiwi_vars_of(vars, type), type, value, value_len);
+	/* keep the vars hash up to date, it is a sum of
+	 * the defined variables hashes */
+	kiwi_var_t *var = kiwi_vars_of(vars, type);
+	vars->hash -= kiwi_var_hash(var);
+	int rc;
+	rc = kiwi_var_set(var, type, value, value_len);
+	vars->hash += kiwi_var_hash(var);
+	return rc;
 }
 
 static inline void
 kiwi_vars_unset(kiwi_vars_t *vars, kiwi_var_type_t type)
 {
-	kiwi_var_unset(kiwi_vars_of(vars, type));
+	kiwi_var_t *var = kiwi_vars_of(vars, type);
+	vars->hash -= kiwi_var_hash(var);
+	kiwi_var_unset(var);
 }
 
 static inline kiwi_var_type_t
@@ -133,8 +325,11 @@ kiwi_vars_update(kiwi_vars_t *vars, char *name, int name_len,
 {
 	kiwi_var_type_t type;
 	type = kiwi_vars_find(vars, name, name_len);
-	if (type == KIWI_VAR_UNDEF)
-		return -1;
+	if (type == KIWI_VAR_UNDEF) {
+		if (! kiwi_vars_extra_find(vars, name, name_len))
+			return -1;
+		return kiwi_vars_extra_set(vars, name, name_len, value, value_len);
+	}
 	kiwi_vars_set(vars, type, value, value_len);
 	return 0;
 }
@@ -145,13 +340,44 @@ kiwi_vars_update_both(kiwi_vars_t *a, kiwi_vars_t *b, char *name, int name_len,
 {
 	kiwi_var_type_t type;
 	type = kiwi_vars_find(a, name, name_len);
-	if (type == KIWI_VAR_UNDEF)
-		return -1;
+	if (type == KIWI_VAR_UNDEF) {
+		if (! kiwi_vars_extra_find(a, name, name_len) &&
+		    ! kiwi_vars_extra_find(b, name, name_len))
+			return -1;
+		if (kiwi_vars_extra_set(a, name, name_len, value, value_len) == -1)
+			return -1;
+		return kiwi_vars_extra_set(b, name, name_len, value, value_len);
+	}
 	kiwi_vars_set(a, type, value, value_len);
 	kiwi_vars_set(b, type, value, value_len);
 	return 0;
 }
 
+static inline int
+kiwi_vars_copy(kiwi_vars_t *dst, kiwi_vars_t *src)
+{
+	/* dst is expected to be initialized and to have no variables
+	 * defined */
+	int i;
+	for (i = 0; i < KIWI_VAR_MAX; i++) {
+		kiwi_var_t *var = &src->vars[i];
+		if (var->type == KIWI_VAR_UNDEF)
+			continue;
+		kiwi_vars_set(dst, var->type, var->value, var->value_len);
+	}
+	for (i = 0; i < src->extra_size; i++) {
+		kiwi_var_t *var = &src->extra[i];
+		if (var->type != KIWI_VAR_EXTRA)
+			continue;
+		int rc;
+		rc = kiwi_vars_extra_set(dst, var->name, var->name_len,
+		                         var->value, var->value_len);
+		if (rc == -1)
+			return -1;
+	}
+	return 0;
+}
+
 static inline int
 kiwi_enquote(char *src, char *dst, int dst_len)
 {
@@ -166,7 +392,7 @@ kiwi_enquote(char *src, char *dst, int dst_len)
 			*pos++ = '\'';
 		else
 		if (*src == '\\') {
-			*dst++ = '\\';
+			*pos++ = '\\';
 		}
 		*pos++ = *src++;
 	}
@@ -177,6 +403,47 @@ kiwi_enquote(char *src, char *dst, int dst_len)
 	return (int)(pos - dst);
 }
 
+static inline int
+kiwi_vars_write_set(kiwi_var_t *var, char *query, int pos, int query_len)
+{
+	/* SET key=quoted_value; */
+	int size = 4 + (var->name_len - 1) + 1 + 1;
+	if (query_len - pos < size)
+		return -1;
+	memcpy(query + pos, "SET ", 4);
+	pos += 4;
+	memcpy(query + pos, var->name, var->name_len - 1);
+	pos += var->name_len - 1;
+	memcpy(query + pos, "=", 1);
+	pos += 1;
+	int quote_len;
+	quote_len = kiwi_enquote(var->value, query + pos, query_len - pos);
+	if (quote_len == -1)
+		return -1;
+	pos += quote_len;
+	if (query_len - pos < 1)
+		return -1;
+	memcpy(query + pos, ";", 1);
+	pos += 1;
+	return pos;
+}
+
+static inline int
+kiwi_vars_write_reset(kiwi_var_t *var, char *query, int pos, int query_len)
+{
+	/* RESET key; */
+	int size = 6 + (var->name_len - 1) + 1;
+	if (query_len - pos < size)
+		return -1;
+	memcpy(query + pos, "RESET ", 6);
+	pos += 6;
+	memcpy(query + pos, var->name, var->name_len - 1);
+	pos += var->name_len - 1;
+	memcpy(query + pos, ";", 1);
+	pos += 1;
+	return pos;
+}
+
 __attribute__((hot)) static inline int
 kiwi_vars_cas(kiwi_vars_t *client, kiwi_vars_t *server,
               char *query, int query_len)
@@ -194,24 +461,48 @@ kiwi_vars_cas(kiwi_vars_t *client, kiwi_vars_t *server,
 		server_var = kiwi_vars_of(server, type);
 		if (kiwi_var_compare(var, server_var))
 			continue;
+		pos = kiwi_vars_write_set(var, query, pos, query_len);
+		if (pos == -1)
+			return -1;
+	}
 
-		/* SET key=quoted_value; */
-		int size = 4 + (var->name_len - 1) + 1 + 1;
-		if (query_len < size)
+	/* extra variables are usually not reported by server,
+	 * so server state is updated as the query is sent */
+	int i;
+	for (i = 0; i < client->extra_size; i++)
+	{
+		kiwi_var_t *var = &client->extra[i];
+		if (var->type != KIWI_VAR_EXTRA)
+			continue;
+		kiwi_var_t *server_var;
+		server_var = kiwi_vars_extra_find(server, var->name, var->name_len);
+		if (server_var && kiwi_var_compare(var, server_var))
+			continue;
+		pos = kiwi_vars_write_set(var, query, pos, query_len);
+		if (pos == -1)
+			return -1;
+		int rc;
+		rc = kiwi_vars_extra_set(server, var->name, var->name_len,
+		                         var->value, var->value_len);
+		if (rc == -1)
 			return -1;
-		memcpy(query + pos, "SET ", 4);
-		pos += 4;
-		memcpy(query + pos, var->name, var->name_len - 1);
-		pos += var->name_len - 1;
-		memcpy(query + pos, "=", 1);
-		pos += 1;
-		int quote_len;
-		quote_len = kiwi_enquote(var->value, query + pos, query_len - pos);
-		if (quote_len == -1)
+	}
+
+	/* reset extra variables left by previous clients */
+	for (i = 0; i < server->extra_size; i++)
+	{
+		kiwi_var_t *server_var = &server->extra[i];
+		if (server_var->type != KIWI_VAR_EXTRA)
+			continue;
+		kiwi_var_t *var;
+		var = kiwi_vars_extra_find(client, server_var->name,
+		                           server_var->name_len);
+		if (var && var->type == KIWI_VAR_EXTRA)
+			continue;
+		pos = kiwi_vars_write_reset(server_var, query, pos, query_len);
+		if (pos == -1)
 			return -1;
-		pos += quote_len;
-		memcpy(query + pos, ";", 1);
-		pos += 1;
+		kiwi_vars_extra_unset(server, server_var);
 	}
 
 	return pos;
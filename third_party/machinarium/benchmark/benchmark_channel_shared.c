@@ -5,32 +5,39 @@
  * Cooperative multitasking engine.
 */
 
+/*
+ * Many producer threads write into a single shared channel,
+ * which is read by one consumer. This is how workers and
+ * route wait bus are used.
+*/
+
+#include <inttypes.h>
 #include <machinarium.h>
 
-static int ops = 0;
+#define BENCHMARK_TIME_MS  1000
+#define BENCHMARK_INFLIGHT 4096
+#define BENCHMARK_BATCH    64
 
-static void
-benchmark_reader(void *arg)
-{
-	machine_channel_t *q = arg;
-	while (machine_active()) {
-		machine_msg_t *msg;
-		msg = machine_channel_read(q, UINT32_MAX);
-		if (msg)
-			machine_msg_free(msg);
-		ops++;
-	}
-}
+static machine_channel_t *channel;
+static volatile int producers_stop;
+static int inflight;
 
 static void
 benchmark_writer(void *arg)
 {
-	machine_channel_t *q = arg;
-	while (machine_active()) {
-		machine_msg_t *msg;
-		msg = machine_msg_create(0, 0);
-		machine_channel_write(q, msg);
-		ops++;
+	(void)arg;
+	while (! producers_stop) {
+		if (__sync_fetch_and_add(&inflight, 0) > BENCHMARK_INFLIGHT) {
+			machine_sleep(0);
+			continue;
+		}
+		int i;
+		for (i = 0; i < BENCHMARK_BATCH; i++) {
+			machine_msg_t *msg;
+			msg = machine_msg_create(0);
+			__sync_fetch_and_add(&inflight, 1);
+			machine_channel_write(channel, msg);
+		}
 		machine_sleep(0);
 	}
 }
@@ -38,32 +45,53 @@ benchmark_writer(void *arg)
 static void
 benchmark_runner(void *arg)
 {
-	printf("benchmark started.\n");
+	int producers = *(int*)arg;
 
-	machine_channel_t *q;
-	q = machine_channel_create(1);
+	channel = machine_channel_create(1);
+	producers_stop = 0;
+	inflight = 0;
 
-	int r = machine_coroutine_create(benchmark_reader, q);
-	int w = machine_coroutine_create(benchmark_writer, q);
+	int id[producers];
+	int i;
+	for (i = 0; i < producers; i++)
+		id[i] = machine_create("benchmark_writer", benchmark_writer, NULL);
 
-	machine_sleep(1000);
-	machine_stop();
-	machine_cancel(r);
-	machine_join(r);
-	machine_join(w);
+	uint64_t ops = 0;
+	uint64_t start = machine_time_ms();
+	for (;;) {
+		machine_msg_t *msg;
+		msg = machine_channel_read(channel, 100);
+		if (msg) {
+			machine_msg_free(msg);
+			__sync_fetch_and_sub(&inflight, 1);
+			ops++;
+		}
+		if (machine_time_ms() - start >= BENCHMARK_TIME_MS)
+			break;
+	}
 
-	machine_channel_free(q);
+	producers_stop = 1;
+	for (i = 0; i < producers; i++)
+		machine_wait(id[i]);
 
-	printf("done.\n");
-	printf("channel operations %d in 1 sec.\n", ops);
+	machine_channel_free(channel);
+
+	printf("%2d producers: %" PRIu64 " messages in 1 sec.\n", producers, ops);
 }
 
 int
 main(int argc, char *argv[])
 {
+	(void)argc;
+	(void)argv;
 	machinarium_init();
-	int id = machine_create("benchmark_channel", benchmark_runner, NULL);
-	machine_wait(id);
+	printf("benchmark started.\n");
+	int producers;
+	for (producers = 2; producers <= 64; producers *= 2) {
+		int id = machine_create("benchmark_channel", benchmark_runner, &producers);
+		machine_wait(id);
+	}
+	printf("done.\n");
 	machinarium_free();
 	return 0;
 }
@@ -6,42 +6,150 @@
 */
 
 /*
- * This example shows coroutine context switch (yield)
- * performance done in one second.
+ * This example measures coroutine context switch performance:
+ * raw mm_context_swap() between two contexts, scheduler yield
+ * and coroutine create with join.
+ *
+ * usage: benchmark_csw [seconds] [min switches/sec]
+ *
+ * Exits with 1 if the scheduler yield rate is below the given
+ * minimum, so it can be used as a regression check.
 */
 
 #include <machinarium.h>
+#include <machinarium_private.h>
+
+static int duration = 1;
 
-static int csw = 0;
+static uint64_t yields = 0;
+
+static mm_context_t context_main;
+static mm_context_t context_peer;
+
+static inline uint64_t
+now_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void
+report(char *name, uint64_t switches, uint64_t time_ns)
+{
+	printf("%-10s %12" PRIu64 " switches/sec, %6.1f ns per switch\n",
+	       name,
+	       (uint64_t)(switches * 1000000000ULL / time_ns),
+	       (double)time_ns / switches);
+}
+
+static void
+benchmark_peer(void *arg)
+{
+	(void)arg;
+	for (;;)
+		mm_context_swap(&context_peer, &context_main);
+}
+
+static void
+benchmark_swap(void)
+{
+	mm_contextstack_arena_t arena;
+	mm_contextstack_arena_init(&arena, 64 * 1024, sysconf(_SC_PAGESIZE), 0);
+	mm_contextstack_t stack;
+	int rc;
+	rc = mm_contextstack_create(&stack, &arena);
+	if (rc == -1) {
+		printf("failed to create stack\n");
+		exit(1);
+	}
+	mm_context_create(&context_peer, &stack, benchmark_peer, NULL);
+
+	/* each round is a switch there and back */
+	uint64_t rounds = 0;
+	uint64_t start = now_ns();
+	uint64_t deadline = start + duration * 1000000000ULL;
+	uint64_t now;
+	do {
+		int i;
+		for (i = 0; i < 10000; i++)
+			mm_context_swap(&context_main, &context_peer);
+		rounds += 10000;
+		now = now_ns();
+	} while (now < deadline);
+	report("swap", rounds * 2, now - start);
+
+	mm_contextstack_free(&stack);
+	mm_contextstack_arena_free(&arena);
+}
 
 static void
 benchmark_worker(void *arg)
 {
-	printf("worker started.\n");
+	(void)arg;
 	while (machine_active()) {
-		csw++;
+		yields++;
 		machine_sleep(0);
 	}
-	printf("worker done.\n");
+}
+
+static void
+benchmark_noop(void *arg)
+{
+	(void)arg;
 }
 
 static void
 benchmark_runner(void *arg)
 {
-	printf("benchmark started.\n");
+	(void)arg;
+
+	/* worker yields back to the loop, with two switches each */
+	uint64_t start = now_ns();
 	machine_coroutine_create(benchmark_worker, NULL);
-	machine_sleep(1000);
-	printf("done.\n");
-	printf("context switches %d in 1 sec.\n", csw);
+	machine_sleep(duration * 1000);
+	report("yield", yields * 2, now_ns() - start);
+
+	/* coroutine create and join */
+	uint64_t count = 0;
+	start = now_ns();
+	uint64_t deadline = start + duration * 1000000000ULL;
+	uint64_t now;
+	do {
+		int64_t id;
+		id = machine_coroutine_create(benchmark_noop, NULL);
+		machine_join(id);
+		count++;
+		now = now_ns();
+	} while (now < deadline);
+	printf("%-10s %12" PRIu64 " coroutines/sec\n", "create",
+	       (uint64_t)(count * 1000000000ULL / (now - start)));
+
 	machine_stop();
 }
 
 int
 main(int argc, char *argv[])
 {
+	if (argc > 1)
+		duration = atoi(argv[1]);
+	if (duration <= 0)
+		duration = 1;
+	uint64_t min = 0;
+	if (argc > 2)
+		min = strtoull(argv[2], NULL, 10);
+
+	benchmark_swap();
+
 	machinarium_init();
 	int id = machine_create("benchmark_csw", benchmark_runner, NULL);
 	machine_wait(id);
 	machinarium_free();
+
+	uint64_t rate = yields * 2 / duration;
+	if (min && rate < min) {
+		printf("yield rate %" PRIu64 " is below %" PRIu64 "\n", rate, min);
+		return 1;
+	}
 	return 0;
 }
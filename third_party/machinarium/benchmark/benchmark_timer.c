@@ -0,0 +1,170 @@
+
+/*
+ * machinarium.
+ *
+ * Cooperative multitasking engine.
+*/
+
+/*
+ * This example compares timer wheel used by mm_clock_t with
+ * the sorted timers array used previously.
+ *
+ * Each round restarts every timer with a new random interval, which
+ * is what read timeouts and pool waits do under connection storms.
+*/
+
+#include <machinarium.h>
+#include <machinarium_private.h>
+
+#define TIMERS 20000
+#define ROUNDS 20
+
+typedef struct
+{
+	mm_buf_t timers;
+	int      count;
+	uint64_t time_ms;
+} array_clock_t;
+
+static int
+array_cmp(mm_timer_t *a, mm_timer_t *b)
+{
+	if (a->timeout == b->timeout)
+		return (a == b) ? 0 : ((a > b) ? 1 : -1);
+	return (a->timeout > b->timeout) ? 1 : -1;
+}
+
+static int
+array_position(mm_timer_t **list, int count, mm_timer_t *timer)
+{
+	int low = 0, high = count;
+	while (low < high) {
+		int med = low + (high - low) / 2;
+		int cmp = array_cmp(timer, list[med]);
+		if (cmp == 0)
+			return med;
+		if (cmp > 0)
+			low = med + 1;
+		else
+			high = med;
+	}
+	return low;
+}
+
+static void
+array_add(array_clock_t *clock, mm_timer_t *timer)
+{
+	mm_buf_ensure(&clock->timers, sizeof(mm_timer_t*));
+	mm_timer_t **list = (mm_timer_t**)clock->timers.start;
+	mm_buf_advance(&clock->timers, sizeof(mm_timer_t*));
+	timer->timeout = clock->time_ms + timer->interval;
+	timer->active = 1;
+	int pos = array_position(list, clock->count, timer);
+	memmove(list + pos + 1, list + pos,
+	        sizeof(mm_timer_t*) * (clock->count - pos));
+	list[pos] = timer;
+	clock->count++;
+}
+
+static void
+array_del(array_clock_t *clock, mm_timer_t *timer)
+{
+	mm_timer_t **list = (mm_timer_t**)clock->timers.start;
+	int pos = array_position(list, clock->count, timer);
+	memmove(list + pos, list + pos + 1,
+	        sizeof(mm_timer_t*) * (clock->count - pos - 1));
+	clock->timers.pos -= sizeof(mm_timer_t*);
+	clock->count--;
+	timer->active = 0;
+}
+
+static void
+benchmark_timer_cb(mm_timer_t *timer)
+{
+	(void)timer;
+}
+
+static uint64_t
+benchmark_time_us(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000ULL + t.tv_nsec / 1000;
+}
+
+static mm_timer_t timers[TIMERS];
+static uint32_t   intervals[ROUNDS][TIMERS];
+
+static uint64_t
+benchmark_array(void)
+{
+	array_clock_t clock;
+	memset(&clock, 0, sizeof(clock));
+	mm_buf_init(&clock.timers);
+	clock.time_ms = 1;
+	int i, j;
+	for (i = 0; i < TIMERS; i++) {
+		mm_timer_init(&timers[i], benchmark_timer_cb, NULL, intervals[0][i]);
+		array_add(&clock, &timers[i]);
+	}
+	uint64_t start = benchmark_time_us();
+	for (j = 1; j < ROUNDS; j++) {
+		clock.time_ms++;
+		for (i = 0; i < TIMERS; i++) {
+			array_del(&clock, &timers[i]);
+			timers[i].interval = intervals[j][i];
+			array_add(&clock, &timers[i]);
+		}
+	}
+	uint64_t time = benchmark_time_us() - start;
+	mm_buf_free(&clock.timers);
+	return time;
+}
+
+static uint64_t
+benchmark_wheel(void)
+{
+	mm_clock_t clock;
+	mm_clock_init(&clock);
+	clock.time_ms = 1;
+	int i, j;
+	for (i = 0; i < TIMERS; i++) {
+		mm_timer_init(&timers[i], benchmark_timer_cb, NULL, intervals[0][i]);
+		mm_clock_timer_add(&clock, &timers[i]);
+	}
+	uint64_t start = benchmark_time_us();
+	for (j = 1; j < ROUNDS; j++) {
+		clock.time_ms++;
+		mm_clock_step(&clock);
+		for (i = 0; i < TIMERS; i++) {
+			mm_clock_timer_del(&clock, &timers[i]);
+			timers[i].interval = intervals[j][i];
+			mm_clock_timer_add(&clock, &timers[i]);
+		}
+	}
+	uint64_t time = benchmark_time_us() - start;
+	mm_clock_free(&clock);
+	return time;
+}
+
+int
+main(int argc, char *argv[])
+{
+	(void)argc;
+	(void)argv;
+	int i, j;
+	srand(0);
+	for (j = 0; j < ROUNDS; j++)
+		for (i = 0; i < TIMERS; i++)
+			intervals[j][i] = 1000 + rand() % 60000;
+
+	uint64_t ops = (uint64_t)(ROUNDS - 1) * TIMERS;
+	uint64_t time_array = benchmark_array();
+	uint64_t time_wheel = benchmark_wheel();
+	printf("%d timers, %" PRIu64 " restarts\n", TIMERS, ops);
+	printf("sorted array: %" PRIu64 " usec (%" PRIu64 " restarts/sec)\n",
+	       time_array, ops * 1000000 / (time_array + 1));
+	printf("timer wheel:  %" PRIu64 " usec (%" PRIu64 " restarts/sec)\n",
+	       time_wheel, ops * 1000000 / (time_wheel + 1));
+	return 0;
+}
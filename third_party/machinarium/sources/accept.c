@@ -19,9 +19,76 @@ mm_accept_on_read_cb(mm_fd_t *handle)
 	mm_scheduler_wakeup(&mm_self->scheduler, call->coroutine);
 }
 
+static inline int
+mm_accept_client(mm_io_t *io, int fd, int attach, machine_io_t **client)
+{
+	*client = machine_io_create();
+	if (*client == NULL) {
+		close(fd);
+		mm_errno_set(ENOMEM);
+		return -1;
+	}
+	mm_io_t *client_io;
+	client_io = (mm_io_t*)*client;
+	client_io->is_unix_socket = io->is_unix_socket;
+	client_io->opt_nodelay = io->opt_nodelay;
+	client_io->opt_keepalive = io->opt_keepalive;
+	client_io->opt_keepalive_delay = io->opt_keepalive_delay;
+	client_io->opt_sndbuf = io->opt_sndbuf;
+	client_io->opt_rcvbuf = io->opt_rcvbuf;
+	client_io->opt_notsent_lowat = io->opt_notsent_lowat;
+	client_io->opt_user_timeout = io->opt_user_timeout;
+	client_io->opt_quickack = io->opt_quickack;
+	client_io->opt_busy_poll = io->opt_busy_poll;
+	client_io->opt_zerocopy = io->opt_zerocopy;
+	client_io->accepted = 1;
+	client_io->connected = 1;
+	int rc;
+	rc = mm_io_socket_set_accepted(client_io, fd);
+	if (rc == -1) {
+		machine_close(*client);
+		machine_io_free(*client);
+		*client = NULL;
+		return -1;
+	}
+	if (attach) {
+		rc = machine_io_attach((machine_io_t*)client_io);
+		if (rc == -1) {
+			machine_close(*client);
+			machine_io_free(*client);
+			*client = NULL;
+			return -1;
+		}
+	}
+	return 0;
+}
+
 MACHINE_API int
-machine_accept(machine_io_t *obj, machine_io_t **client,
-               int backlog, int attach, uint32_t time_ms)
+machine_listen(machine_io_t *obj, int backlog)
+{
+	/* listen before the first accept, so sockets join their
+	 * reuseport group in a known order */
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_errno_set(0);
+	if (io->fd == -1) {
+		mm_errno_set(EBADF);
+		return -1;
+	}
+	if (io->accept_listen)
+		return 0;
+	int rc;
+	rc = mm_socket_listen(io->fd, backlog);
+	if (rc == -1) {
+		mm_errno_set(errno);
+		return -1;
+	}
+	io->accept_listen = 1;
+	return 0;
+}
+
+MACHINE_API int
+machine_accept_batch(machine_io_t *obj, machine_io_t **clients, int count,
+                     int backlog, int attach, uint32_t time_ms)
 {
 	mm_io_t *io = mm_cast(mm_io_t*, obj);
 	mm_machine_t *machine = mm_self;
@@ -54,66 +121,74 @@ machine_accept(machine_io_t *obj, machine_io_t **client,
 		io->accept_listen = 1;
 	}
 
-	/* subscribe for accept event */
-	rc = mm_loop_read(&machine->loop, &io->handle,
-	                  mm_accept_on_read_cb,
-	                  io);
-	if (rc == -1) {
-		mm_errno_set(errno);
-		return -1;
-	}
+	/* drain pending connections first, wait for accept event
+	 * only when the backlog is empty */
+	int accepted = 0;
+	for (;;)
+	{
+		while (accepted < count)
+		{
+			int fd;
+			fd = mm_socket_accept(io->fd, NULL, NULL);
+			if (fd == -1) {
+				if (errno == EINTR || errno == ECONNABORTED)
+					continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					mm_fd_drained(&io->handle, MM_R);
+					break;
+				}
+				/* report error on the next call */
+				if (accepted > 0)
+					return accepted;
+				mm_errno_set(errno);
+				return -1;
+			}
+			rc = mm_accept_client(io, fd, attach, &clients[accepted]);
+			if (rc == -1) {
+				if (accepted > 0)
+					return accepted;
+				return -1;
+			}
+			accepted++;
+		}
+		if (accepted > 0)
+			return accepted;
 
-	/* wait for completion */
-	mm_call(&io->call, MM_CALL_ACCEPT, time_ms);
+		/* subscribe for accept event */
+		rc = mm_loop_read(&machine->loop, &io->handle,
+		                  mm_accept_on_read_cb,
+		                  io);
+		if (rc == -1) {
+			mm_errno_set(errno);
+			return -1;
+		}
 
-	rc = mm_loop_read_stop(&machine->loop, &io->handle);
-	if (rc == -1) {
-		mm_errno_set(errno);
-		return -1;
-	}
+		/* wait for completion */
+		mm_call(&io->call, MM_CALL_ACCEPT, time_ms);
 
-	rc = io->call.status;
-	if (rc != 0) {
-		mm_errno_set(rc);
-		return -1;
-	}
+		rc = mm_loop_read_stop(&machine->loop, &io->handle);
+		if (rc == -1) {
+			mm_errno_set(errno);
+			return -1;
+		}
 
-	/* setup client io */
-	*client = machine_io_create();
-	if (client == NULL) {
-		mm_errno_set(ENOMEM);
-		return -1;
-	}
-	mm_io_t *client_io;
-	client_io = (mm_io_t*)*client;
-	client_io->is_unix_socket = io->is_unix_socket;
-	client_io->opt_nodelay = io->opt_nodelay;
-	client_io->opt_keepalive = io->opt_keepalive;
-	client_io->opt_keepalive_delay = io->opt_keepalive_delay;
-	client_io->accepted = 1;
-	client_io->connected = 1;
-	rc = mm_socket_accept(io->fd, NULL, NULL);
-	if (rc == -1) {
-		mm_errno_set(errno);
-		machine_io_free(*client);
-		*client = NULL;
-		return -1;
+		rc = io->call.status;
+		if (rc != 0) {
+			mm_errno_set(rc);
+			return -1;
+		}
 	}
-	rc = mm_io_socket_set(client_io, rc);
+}
+
+MACHINE_API int
+machine_accept(machine_io_t *obj, machine_io_t **client,
+               int backlog, int attach, uint32_t time_ms)
+{
+	int rc;
+	rc = machine_accept_batch(obj, client, 1, backlog, attach, time_ms);
 	if (rc == -1) {
-		machine_close(*client);
-		machine_io_free(*client);
 		*client = NULL;
 		return -1;
 	}
-	if (attach) {
-		rc = machine_io_attach((machine_io_t*)client_io);
-		if (rc == -1) {
-			machine_close(*client);
-			machine_io_free(*client);
-			*client = NULL;
-			return -1;
-		}
-	}
 	return 0;
 }
@@ -26,6 +26,13 @@ machine_bind(machine_io_t *obj, struct sockaddr *sa)
 		mm_errno_set(errno);
 		goto error;
 	}
+	if (io->opt_reuseport) {
+		rc = mm_socket_set_reuseport(io->fd, 1);
+		if (rc == -1) {
+			mm_errno_set(errno);
+			goto error;
+		}
+	}
 	if (sa->sa_family == AF_INET6) {
 		rc = mm_socket_set_ipv6only(io->fd, 1);
 		if (rc == -1) {
@@ -33,6 +40,13 @@ machine_bind(machine_io_t *obj, struct sockaddr *sa)
 			goto error;
 		}
 	}
+	if (io->opt_fastopen > 0 && ! io->is_unix_socket) {
+		rc = mm_socket_set_fastopen(io->fd, io->opt_fastopen);
+		if (rc == -1) {
+			mm_errno_set(errno);
+			goto error;
+		}
+	}
 	rc = mm_socket_bind(io->fd, sa);
 	if (rc == -1) {
 		mm_errno_set(errno);
@@ -50,3 +64,38 @@ error:
 	io->handle.fd = -1;
 	return -1;
 }
+
+MACHINE_API int
+machine_bind_fd(machine_io_t *obj, int fd)
+{
+	/* use socket bound by another process */
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_errno_set(0);
+	if (io->connected || io->fd != -1) {
+		mm_errno_set(EINPROGRESS);
+		return -1;
+	}
+	struct sockaddr_storage sa;
+	socklen_t sa_len = sizeof(sa);
+	int rc;
+	rc = getsockname(fd, (struct sockaddr*)&sa, &sa_len);
+	if (rc == -1) {
+		mm_errno_set(errno);
+		close(fd);
+		return -1;
+	}
+	if (sa.ss_family == AF_UNIX)
+		io->is_unix_socket = 1;
+	rc = mm_io_socket_set(io, fd);
+	if (rc == -1)
+		goto error;
+	rc = machine_io_attach(obj);
+	if (rc == -1)
+		goto error;
+	return 0;
+error:
+	close(io->fd);
+	io->fd = -1;
+	io->handle.fd = -1;
+	return -1;
+}
@@ -64,10 +64,18 @@ mm_buf_ensure(mm_buf_t *buf, int size)
 {
 	if (buf->end - buf->pos >= size)
 		return 0;
+	/* keep capacity a power of two, so buffers fit message
+	 * cache size classes and repeated small writes do not realloc */
 	int sz = mm_buf_size(buf) * 2;
 	int actual = mm_buf_used(buf) + size;
-	if (actual > sz)
+	if (actual > sz) {
 		sz = actual;
+		if (actual <= (1 << 30)) {
+			sz = 1;
+			while (sz < actual)
+				sz <<= 1;
+		}
+	}
 	char *p;
 	p = realloc(buf->start, sz);
 	if (p == NULL)
@@ -8,101 +8,175 @@
 #include <machinarium.h>
 #include <machinarium_private.h>
 
+static inline void
+mm_channel_push(mm_channel_t *channel, mm_list_t *node)
+{
+	__atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+	mm_list_t *prev;
+	prev = __atomic_exchange_n(&channel->head, node, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+static inline mm_msg_t*
+mm_channel_pop(mm_channel_t *channel)
+{
+	/* must be called by a single consumer at a time */
+	for (;;) {
+		mm_list_t *tail = channel->tail;
+		mm_list_t *next;
+		next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+		if (tail == &channel->stub) {
+			if (next == NULL) {
+				if (__atomic_load_n(&channel->head, __ATOMIC_SEQ_CST) == tail)
+					return NULL;
+				/* writer is between exchange and link */
+				MM_SLEEPLOCK_BACKOFF;
+				continue;
+			}
+			channel->tail = next;
+			tail = next;
+			next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+		}
+		if (next) {
+			channel->tail = next;
+			return mm_container_of(tail, mm_msg_t, link);
+		}
+		if (__atomic_load_n(&channel->head, __ATOMIC_SEQ_CST) != tail) {
+			MM_SLEEPLOCK_BACKOFF;
+			continue;
+		}
+		/* last message, put stub back to detach it */
+		mm_channel_push(channel, &channel->stub);
+		next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+		if (next) {
+			channel->tail = next;
+			return mm_container_of(tail, mm_msg_t, link);
+		}
+		MM_SLEEPLOCK_BACKOFF;
+	}
+}
+
+static inline int
+mm_channel_signal(mm_channel_t *channel)
+{
+	/* wakeup first sleeping reader, channel must be locked */
+	if (channel->readers_count == 0)
+		return 0;
+	mm_channelrd_t *reader;
+	reader = mm_container_of(channel->readers.next, mm_channelrd_t, link);
+	reader->signaled = 1;
+	mm_list_unlink(&reader->link);
+	__atomic_sub_fetch(&channel->readers_count, 1, __ATOMIC_SEQ_CST);
+	return mm_eventmgr_signal(&reader->event);
+}
+
 void mm_channel_init(mm_channel_t *channel)
 {
 	channel->type.is_shared = 1;
-	mm_sleeplock_init(&channel->lock);
-
-	mm_list_init(&channel->msg_list);
-	channel->msg_list_count = 0;
+	channel->stub.next = NULL;
+	channel->stub.prev = NULL;
+	channel->head = &channel->stub;
+	channel->tail = &channel->stub;
 
+	mm_sleeplock_init(&channel->lock);
 	mm_list_init(&channel->readers);
 	channel->readers_count = 0;
 }
 
 void mm_channel_free(mm_channel_t *channel)
 {
-	if (channel->msg_list_count == 0)
-		return;
-	mm_list_t *i, *n;
-	mm_list_foreach_safe(&channel->msg_list, i, n) {
-		mm_msg_t *msg = mm_container_of(i, mm_msg_t, link);
+	mm_msg_t *msg;
+	while ((msg = mm_channel_pop(channel)))
 		mm_msg_unref(&mm_self->msg_cache, msg);
-	}
 }
 
 void mm_channel_write(mm_channel_t *channel, mm_msg_t *msg)
 {
-	mm_sleeplock_lock(&channel->lock);
+	mm_channel_push(channel, &msg->link);
 
-	if (channel->readers_count)
-	{
-		mm_channelrd_t *reader;
-		reader = mm_container_of(channel->readers.next, mm_channelrd_t, link);
-		reader->result = msg;
-		mm_list_unlink(&reader->link);
-		channel->readers_count--;
-		int event_mgr_fd;
-		event_mgr_fd = mm_eventmgr_signal(&reader->event);
-		mm_sleeplock_unlock(&channel->lock);
-		if (event_mgr_fd > 0)
-			mm_eventmgr_wakeup(event_mgr_fd);
+	/* woken up reader drains the queue by itself, so only
+	 * the first writer after reader went to sleep has to
+	 * pay for the lock and eventfd write */
+	if (__atomic_load_n(&channel->readers_count, __ATOMIC_SEQ_CST) == 0)
 		return;
-	}
-
-	mm_list_append(&channel->msg_list, &msg->link);
-	channel->msg_list_count++;
 
+	mm_sleeplock_lock(&channel->lock);
+	int event_mgr_fd;
+	event_mgr_fd = mm_channel_signal(channel);
 	mm_sleeplock_unlock(&channel->lock);
+	if (event_mgr_fd > 0)
+		mm_eventmgr_wakeup(event_mgr_fd);
 }
 
 mm_msg_t*
 mm_channel_read(mm_channel_t *channel, uint32_t time_ms)
 {
-	/* try to get first message, if no other readers are
-	 * waiting, otherwise put reader in the wait
-	 * channel */
-	mm_sleeplock_lock(&channel->lock);
+	uint64_t deadline = 0;
+	if (time_ms != UINT32_MAX)
+		deadline = mm_self->loop.clock.time_ms + time_ms;
 
-	mm_list_t *next;
-	if (channel->msg_list_count > 0 && channel->readers_count == 0)
-	{
-		next = mm_list_pop(&channel->msg_list);
-		channel->msg_list_count--;
-		mm_sleeplock_unlock(&channel->lock);
-		return mm_container_of(next, mm_msg_t, link);
-	}
-
-	/* put reader into channel and register event */
 	mm_channelrd_t reader;
-	reader.result = NULL;
-	mm_list_init(&reader.link);
-	mm_eventmgr_add(&mm_self->event_mgr, &reader.event);
-
-	mm_list_append(&channel->readers, &reader.link);
-	channel->readers_count++;
-
-	mm_sleeplock_unlock(&channel->lock);
+	mm_msg_t *msg;
+	for (;;)
+	{
+		mm_sleeplock_lock(&channel->lock);
+
+		msg = mm_channel_pop(channel);
+		if (msg) {
+			mm_sleeplock_unlock(&channel->lock);
+			return msg;
+		}
+
+		/* put reader into channel, then check queue again to
+		 * not miss a writer which did not see the reader */
+		reader.signaled = 0;
+		mm_list_init(&reader.link);
+		mm_list_append(&channel->readers, &reader.link);
+		__atomic_add_fetch(&channel->readers_count, 1, __ATOMIC_SEQ_CST);
+
+		msg = mm_channel_pop(channel);
+		if (msg) {
+			mm_list_unlink(&reader.link);
+			__atomic_sub_fetch(&channel->readers_count, 1, __ATOMIC_SEQ_CST);
+			mm_sleeplock_unlock(&channel->lock);
+			return msg;
+		}
+
+		/* writers signal reader only under the lock */
+		mm_eventmgr_add(&mm_self->event_mgr, &reader.event);
 
-	/* wait for cancel, timedout or writer event */
-	mm_eventmgr_wait(&mm_self->event_mgr, &reader.event, time_ms);
+		mm_sleeplock_unlock(&channel->lock);
 
-	mm_sleeplock_lock(&channel->lock);
+		/* wait for cancel, timedout or writer event */
+		int complete;
+		complete = mm_eventmgr_wait(&mm_self->event_mgr, &reader.event, time_ms);
+
+		mm_sleeplock_lock(&channel->lock);
+
+		if (! reader.signaled) {
+			assert(channel->readers_count > 0);
+			__atomic_sub_fetch(&channel->readers_count, 1, __ATOMIC_SEQ_CST);
+			mm_list_unlink(&reader.link);
+		}
+
+		/* timedout or cancel */
+		if (! complete || reader.event.call.status != 0) {
+			/* pass wakeup to the next reader */
+			int event_mgr_fd = 0;
+			if (reader.signaled)
+				event_mgr_fd = mm_channel_signal(channel);
+			mm_sleeplock_unlock(&channel->lock);
+			if (event_mgr_fd > 0)
+				mm_eventmgr_wakeup(event_mgr_fd);
+			return NULL;
+		}
 
-	if (! reader.result) {
-		assert(channel->readers_count > 0);
-		channel->readers_count--;
-		mm_list_unlink(&reader.link);
-	}
-
-	mm_sleeplock_unlock(&channel->lock);
+		mm_sleeplock_unlock(&channel->lock);
 
-	/* timedout or cancel */
-	if (reader.event.call.status != 0) {
-		if (reader.result)
-			mm_msg_unref(&mm_self->msg_cache, reader.result);
-		return NULL;
+		/* message might be taken by other reader */
+		if (time_ms != UINT32_MAX) {
+			uint64_t now = mm_self->loop.clock.time_ms;
+			time_ms = (now >= deadline) ? 0 : deadline - now;
+		}
 	}
-
-	return reader.result;
 }
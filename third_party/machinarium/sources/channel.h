@@ -10,19 +10,31 @@
 typedef struct mm_channelrd mm_channelrd_t;
 typedef struct mm_channel   mm_channel_t;
 
+#define MM_CHANNEL_CACHELINE 64
+
 struct mm_channelrd
 {
 	mm_event_t  event;
-	mm_msg_t   *result;
+	int         signaled;
 	mm_list_t   link;
 };
 
+/* Shared channel.
+ *
+ * Messages are kept in intrusive multi-producer/single-consumer
+ * queue (msg->link.next is used as the queue link). Writers never
+ * take the lock unless there are sleeping readers. Readers are
+ * serialized by the lock, which also protects readers list.
+*/
+
 struct mm_channel
 {
 	mm_channeltype_t type;
+	mm_list_t       *head;
+	char             pad_head[MM_CHANNEL_CACHELINE];
+	mm_list_t       *tail;
+	mm_list_t        stub;
 	mm_sleeplock_t   lock;
-	mm_list_t        msg_list;
-	int              msg_list_count;
 	mm_list_t        readers;
 	int              readers_count;
 };
@@ -8,26 +8,29 @@
 #include <machinarium.h>
 #include <machinarium_private.h>
 
-static int
-mm_clock_cmp(mm_timer_t *a, mm_timer_t *b)
+#define MM_CLOCK_WHEEL_OVERFLOW (-1)
+#define MM_CLOCK_WHEEL_EXPIRED  (-2)
+
+static inline uint64_t
+mm_clock_wheel_span(int level)
 {
-	if (a->timeout == b->timeout) {
-		if (a->seq == b->seq) {
-			assert(a == b);
-			return 0;
-		}
-		return (a->seq > b->seq) ? 1 : -1;
-	} else if (a->timeout > b->timeout) {
-		return 1;
-	}
-	return -1;
+	return 1ULL << (MM_CLOCK_WHEEL_BITS * level);
 }
 
 void mm_clock_init(mm_clock_t *clock)
 {
-	mm_buf_init(&clock->timers);
+	int level;
+	int slot;
+	for (level = 0; level < MM_CLOCK_WHEEL_LEVELS; level++) {
+		clock->wheel_map[level] = 0;
+		for (slot = 0; slot < MM_CLOCK_WHEEL_SIZE; slot++)
+			mm_list_init(&clock->wheel[level][slot]);
+	}
+	mm_list_init(&clock->wheel_overflow);
+	mm_list_init(&clock->wheel_expired);
+	clock->wheel_time = 0;
 	clock->timers_count = 0;
-	clock->timers_seq = 0;
+	clock->stat = NULL;
 	clock->active = 0;
 	clock->time_ms = 0;
 	clock->time_ns = 0;
@@ -37,61 +40,159 @@ void mm_clock_init(mm_clock_t *clock)
 
 void mm_clock_free(mm_clock_t *clock)
 {
-	mm_buf_free(&clock->timers);
+	(void)clock;
+}
+
+static inline void
+mm_clock_wheel_add(mm_clock_t *clock, mm_timer_t *timer)
+{
+	/* time of the timer expiration is already processed */
+	uint64_t expire = timer->timeout;
+	if (expire < clock->wheel_time) {
+		timer->slot = MM_CLOCK_WHEEL_EXPIRED;
+		mm_list_append(&clock->wheel_expired, &timer->link);
+		return;
+	}
+	/* pick the lowest level where all higher bits of the
+	 * expiration time match the wheel time, so the slot is
+	 * always ahead of the one being processed */
+	uint64_t diff = expire ^ clock->wheel_time;
+	int level = 0;
+	for (; level < MM_CLOCK_WHEEL_LEVELS; level++) {
+		if ((diff >> (MM_CLOCK_WHEEL_BITS * (level + 1))) == 0)
+			break;
+	}
+	if (level == MM_CLOCK_WHEEL_LEVELS) {
+		timer->slot = MM_CLOCK_WHEEL_OVERFLOW;
+		mm_list_append(&clock->wheel_overflow, &timer->link);
+		return;
+	}
+	int slot;
+	slot = (expire >> (MM_CLOCK_WHEEL_BITS * level)) & MM_CLOCK_WHEEL_MASK;
+	timer->slot = level * MM_CLOCK_WHEEL_SIZE + slot;
+	mm_list_append(&clock->wheel[level][slot], &timer->link);
+	clock->wheel_map[level] |= 1ULL << slot;
+}
+
+static inline void
+mm_clock_wheel_del(mm_clock_t *clock, mm_timer_t *timer)
+{
+	mm_list_unlink(&timer->link);
+	mm_list_init(&timer->link);
+	if (timer->slot < 0)
+		return;
+	int level = timer->slot / MM_CLOCK_WHEEL_SIZE;
+	int slot  = timer->slot % MM_CLOCK_WHEEL_SIZE;
+	mm_list_t *list = &clock->wheel[level][slot];
+	if (list->next == list)
+		clock->wheel_map[level] &= ~(1ULL << slot);
 }
 
-// Binary search routine for timer in sorted array.
-// We expect that there is at most only one occurrence of timer in list.
-// If there is not timer in list, we must return first index greater than timer.
-static int mm_clock_get_insert_position(mm_timer_t **list, int count, mm_timer_t *timer)
+static inline void
+mm_clock_wheel_move(mm_list_t *list, mm_list_t *source)
 {
-    int low = 0, high = count;
-    while (low < high)
-    {
-        int med = low + (high - low) / 2;
-        int cmp = mm_clock_cmp(timer, list[med]);
-        if (cmp == 0)
-	        return med;
-        if (cmp > 0) {
-            low = med + 1;
-        } else {
-            high = med;
-        }
-    }
-    return low;
+	mm_list_init(list);
+	if (source->next == source)
+		return;
+	list->next = source->next;
+	list->prev = source->prev;
+	list->next->prev = list;
+	list->prev->next = list;
+	mm_list_init(source);
 }
 
-static int mm_clock_list_is_sorted(mm_timer_t **list, int count)
+static inline int
+mm_clock_wheel_expire(mm_clock_t *clock, mm_list_t *source)
 {
-	for (int i = 1; i < count; i++) {
-		if (mm_clock_cmp(list[i-1], list[i]) >= 0) {
-			return 0;
+	mm_list_t list;
+	mm_clock_wheel_move(&list, source);
+	int timers_hit = 0;
+	while (list.next != &list) {
+		mm_timer_t *timer;
+		timer = mm_container_of(list.next, mm_timer_t, link);
+		mm_list_unlink(&timer->link);
+		mm_list_init(&timer->link);
+		timer->active = 0;
+		clock->timers_count--;
+		/* how late the timer fires */
+		if (clock->stat) {
+			uint64_t lag = 0;
+			if (clock->time_us > timer->timeout * 1000)
+				lag = clock->time_us - timer->timeout * 1000;
+			mm_loopstat_lag(clock->stat, lag);
 		}
+		timer->callback(timer);
+		timers_hit++;
+	}
+	return timers_hit;
+}
+
+/* move timers of the current slot of a higher level down to the
+ * lower levels */
+static inline void
+mm_clock_wheel_cascade(mm_clock_t *clock, mm_list_t *source)
+{
+	mm_list_t list;
+	mm_clock_wheel_move(&list, source);
+	while (list.next != &list) {
+		mm_timer_t *timer;
+		timer = mm_container_of(list.next, mm_timer_t, link);
+		mm_list_unlink(&timer->link);
+		mm_clock_wheel_add(clock, timer);
+	}
+}
+
+static inline void
+mm_clock_wheel_advance(mm_clock_t *clock)
+{
+	uint64_t now = clock->wheel_time;
+	int level = 1;
+	for (; level < MM_CLOCK_WHEEL_LEVELS; level++) {
+		if (now & (mm_clock_wheel_span(level) - 1))
+			return;
+		int slot;
+		slot = (now >> (MM_CLOCK_WHEEL_BITS * level)) & MM_CLOCK_WHEEL_MASK;
+		clock->wheel_map[level] &= ~(1ULL << slot);
+		mm_clock_wheel_cascade(clock, &clock->wheel[level][slot]);
+	}
+	if (now & (mm_clock_wheel_span(MM_CLOCK_WHEEL_LEVELS) - 1))
+		return;
+	mm_clock_wheel_cascade(clock, &clock->wheel_overflow);
+}
+
+/* find the next time when the wheel has to be processed */
+static inline uint64_t
+mm_clock_wheel_next(mm_clock_t *clock)
+{
+	uint64_t now = clock->wheel_time;
+	uint64_t map = clock->wheel_map[0];
+	if (map) {
+		int idx = now & MM_CLOCK_WHEEL_MASK;
+		uint64_t ahead = map & (~0ULL << idx);
+		if (ahead)
+			return (now & ~(uint64_t)MM_CLOCK_WHEEL_MASK) + __builtin_ctzll(ahead);
+		return (now | MM_CLOCK_WHEEL_MASK) + 1;
+	}
+	int level = 1;
+	for (; level < MM_CLOCK_WHEEL_LEVELS; level++) {
+		if (clock->wheel_map[level])
+			break;
 	}
-	return 1;
+	/* cascade happens on the level boundary, which might be
+	 * the current time as well */
+	uint64_t span = mm_clock_wheel_span(level) - 1;
+	return (now + span) & ~span;
 }
 
 int mm_clock_timer_add(mm_clock_t *clock, mm_timer_t *timer)
 {
-	int count = clock->timers_count;
-	int rc;
-	rc = mm_buf_ensure(&clock->timers, sizeof(mm_timer_t*));
-	if (rc == -1)
-		return -1;
-	mm_timer_t **list;
-	list = (mm_timer_t**)clock->timers.start;
-	mm_buf_advance(&clock->timers, sizeof(mm_timer_t*));
-	timer->seq = clock->timers_seq++;
+	if (clock->timers_count == 0)
+		clock->wheel_time = clock->time_ms;
 	timer->timeout = clock->time_ms + timer->interval;
 	timer->active = 1;
 	timer->clock = clock;
-	int insert_position = mm_clock_get_insert_position(list, count, timer);
-	// We are last, or insert position is after us
-	assert((insert_position == count) || mm_clock_cmp(list[insert_position], timer) > 0);
-	memmove(list + insert_position + 1, list + insert_position, sizeof(mm_timer_t*) * (count - insert_position));
-	list[insert_position] = timer;
-	clock->timers_count = count + 1;
-	assert(mm_clock_list_is_sorted(list, clock->timers_count));
+	mm_clock_wheel_add(clock, timer);
+	clock->timers_count++;
 	return 0;
 }
 
@@ -100,72 +201,194 @@ int mm_clock_timer_del(mm_clock_t *clock, mm_timer_t *timer)
 	if (!timer->active)
 		return -1;
 	assert(clock->timers_count >= 1);
-	mm_timer_t **list;
-	list = (mm_timer_t**)clock->timers.start;
-	int i = mm_clock_get_insert_position(list, clock->timers_count, timer);
-	// We should find timer
-	assert(list[i] == timer);
-	for (; i < clock->timers_count; i++) {
-		if (list[i] != timer)
-			continue;
-		memmove(list + i, list + i + 1, sizeof(mm_timer_t*) * (clock->timers_count - i - 1));
-		clock->timers.pos -= sizeof(mm_timer_t*);
-		clock->timers_count -= 1;
-		break;
-	}
-	assert(mm_clock_list_is_sorted(list, clock->timers_count));
+	mm_clock_wheel_del(clock, timer);
+	clock->timers_count--;
 	timer->active = 0;
 	return 0;
 }
 
-mm_timer_t*
-mm_clock_timer_min(mm_clock_t *clock)
+int mm_clock_timeout(mm_clock_t *clock)
 {
 	if (clock->timers_count == 0)
-		return NULL;
-	mm_timer_t**list;
-	list = (mm_timer_t**) clock->timers.start;
-	return list[0];
+		return -1;
+	if (clock->wheel_expired.next != &clock->wheel_expired)
+		return 0;
+	uint64_t next = mm_clock_wheel_next(clock);
+	if (next <= clock->time_ms)
+		return 0;
+	uint64_t diff = next - clock->time_ms;
+	if (diff > INT32_MAX)
+		return INT32_MAX;
+	return diff;
 }
 
 int mm_clock_step(mm_clock_t *clock)
 {
-	if (clock->timers_count == 0)
-		return 0;
-	mm_timer_t**list;
-	list = (mm_timer_t**) clock->timers.start;
-	int timers_hit = 0;
-	int i = 0;
-	for (; i < clock->timers_count; i++) {
-		mm_timer_t*timer = list[i];
-		if (timer->timeout > clock->time_ms)
+	int timers_hit;
+	timers_hit = mm_clock_wheel_expire(clock, &clock->wheel_expired);
+	while (clock->timers_count > 0 &&
+	       clock->wheel_time <= clock->time_ms)
+	{
+		mm_clock_wheel_advance(clock);
+
+		uint64_t now = clock->wheel_time;
+		int slot = now & MM_CLOCK_WHEEL_MASK;
+		mm_list_t list;
+		mm_clock_wheel_move(&list, &clock->wheel[0][slot]);
+		clock->wheel_map[0] &= ~(1ULL << slot);
+
+		/* timers started by callbacks are scheduled after
+		 * the current slot */
+		clock->wheel_time = now + 1;
+		timers_hit += mm_clock_wheel_expire(clock, &list);
+
+		/* skip empty slots */
+		if (clock->timers_count == 0)
 			break;
-		timer->callback(timer);
-		timer->active = 0;
-		timers_hit++;
-	}
-	if (!timers_hit)
-		return 0;
-	int timers_left = clock->timers_count - timers_hit;
-	if (timers_left == 0) {
-		mm_buf_reset(&clock->timers);
-		clock->timers_count = 0;
-		return timers_hit;
+		uint64_t next = mm_clock_wheel_next(clock);
+		if (next > clock->time_ms + 1)
+			next = clock->time_ms + 1;
+		clock->wheel_time = next;
 	}
-	memmove(list, list + timers_hit, sizeof(mm_timer_t*) * timers_left);
-	clock->timers.pos -= sizeof(mm_timer_t*) * timers_hit;
-	clock->timers_count -= timers_hit;
+	if (clock->timers_count == 0)
+		clock->active = 0;
 	return timers_hit;
 }
 
-static uint64_t
-mm_clock_gettime(void)
+/*
+ * Time source of mm_clock_gettime(), set once by machinarium_init().
+ *
+ * TSC (cntvct on aarch64) ticks are converted to CLOCK_MONOTONIC
+ * nanoseconds as base + (ticks - ticks_base) * mult / 2^32. The
+ * counter is used only if the kernel itself trusts it as clocksource,
+ * so it is invariant and synchronized between cpus.
+*/
+
+typedef struct
+{
+	int       source;
+	clockid_t clock_id;
+	uint64_t  ticks_base;
+	uint64_t  ns_base;
+	uint64_t  mult;
+} mm_clocksource_t;
+
+static mm_clocksource_t mm_clocksource =
+{
+	.source   = MM_CLOCK_MONOTONIC,
+	.clock_id = CLOCK_MONOTONIC
+};
+
+static inline uint64_t
+mm_clock_monotonic(clockid_t clock_id)
 {
 	struct timespec t;
-	clock_gettime(CLOCK_MONOTONIC, &t);
+	clock_gettime(clock_id, &t);
 	return t.tv_sec * (uint64_t) 1e9 + t.tv_nsec;
 }
 
+#if defined(__x86_64__) || defined(__aarch64__)
+static inline uint64_t
+mm_clock_ticks(void)
+{
+#if defined(__x86_64__)
+	uint32_t lo, hi;
+	__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t)hi << 32) | lo;
+#else
+	uint64_t ticks;
+	__asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (ticks));
+	return ticks;
+#endif
+}
+
+static inline int
+mm_clock_ticks_stable(void)
+{
+	char name[64];
+	int fd;
+	fd = open("/sys/devices/system/clocksource/clocksource0/current_clocksource",
+	          O_RDONLY);
+	if (fd == -1)
+		return 0;
+	int rc;
+	rc = read(fd, name, sizeof(name) - 1);
+	close(fd);
+	if (rc <= 0)
+		return 0;
+	name[rc] = 0;
+#if defined(__x86_64__)
+	return strncmp(name, "tsc", 3) == 0;
+#else
+	return strncmp(name, "arch_sys_counter", 16) == 0;
+#endif
+}
+
+static int
+mm_clock_ticks_calibrate(mm_clocksource_t *cs)
+{
+	if (! mm_clock_ticks_stable())
+		return -1;
+#if defined(__x86_64__)
+	/* measure the counter frequency against the monotonic clock */
+	uint64_t ns_start = mm_clock_monotonic(CLOCK_MONOTONIC);
+	uint64_t ticks_start = mm_clock_ticks();
+	struct timespec pause = { 0, 10 * 1000000 };
+	nanosleep(&pause, NULL);
+	uint64_t ns = mm_clock_monotonic(CLOCK_MONOTONIC);
+	uint64_t ticks = mm_clock_ticks();
+	if (ticks <= ticks_start || ns <= ns_start)
+		return -1;
+	cs->mult = ((ns - ns_start) << 32) / (ticks - ticks_start);
+#else
+	uint64_t freq;
+	__asm__ __volatile__ ("mrs %0, cntfrq_el0" : "=r" (freq));
+	if (freq == 0)
+		return -1;
+	cs->mult = (1000000000ULL << 32) / freq;
+	uint64_t ns = mm_clock_monotonic(CLOCK_MONOTONIC);
+	uint64_t ticks = mm_clock_ticks();
+#endif
+	cs->ns_base = ns;
+	cs->ticks_base = ticks;
+	return 0;
+}
+#endif
+
+int mm_clock_source_init(int source)
+{
+	mm_clocksource_t *cs = &mm_clocksource;
+	cs->source = MM_CLOCK_MONOTONIC;
+	cs->clock_id = CLOCK_MONOTONIC;
+	switch (source) {
+	case MM_CLOCK_COARSE:
+		cs->source = MM_CLOCK_COARSE;
+		cs->clock_id = CLOCK_MONOTONIC_COARSE;
+		break;
+	case MM_CLOCK_TSC:
+#if defined(__x86_64__) || defined(__aarch64__)
+		if (mm_clock_ticks_calibrate(cs) == 0)
+			cs->source = MM_CLOCK_TSC;
+#endif
+		break;
+	}
+	return cs->source;
+}
+
+uint64_t
+mm_clock_gettime(void)
+{
+	mm_clocksource_t *cs = &mm_clocksource;
+#if defined(__x86_64__) || defined(__aarch64__)
+	if (cs->source == MM_CLOCK_TSC) {
+		uint64_t ticks = mm_clock_ticks() - cs->ticks_base;
+		return cs->ns_base +
+		       (uint64_t)(((unsigned __int128)ticks * cs->mult) >> 32);
+	}
+#endif
+	return mm_clock_monotonic(cs->clock_id);
+}
+
 void mm_clock_update(mm_clock_t *clock)
 {
 	if (clock->time_cached)
@@ -9,28 +9,51 @@
 
 typedef struct mm_clock mm_clock_t;
 
+/* Timers are stored in a hierarchical timer wheel with 1 ms
+ * resolution. Each level slot covers 64 slots of the previous level,
+ * timers which expire later than the last level are kept in the
+ * overflow list, already expired timers are kept in the expired
+ * list. */
+#define MM_CLOCK_WHEEL_BITS   6
+#define MM_CLOCK_WHEEL_SIZE   (1 << MM_CLOCK_WHEEL_BITS)
+#define MM_CLOCK_WHEEL_MASK   (MM_CLOCK_WHEEL_SIZE - 1)
+#define MM_CLOCK_WHEEL_LEVELS 4
+
 struct mm_clock
 {
-	int      active;
-	int      time_cached;
-	uint64_t time_ms;
-	uint64_t time_us;
-	uint64_t time_ns;
-	mm_buf_t timers;
-	int      timers_count;
-	int      timers_seq;
+	int       active;
+	int       time_cached;
+	uint64_t  time_ms;
+	uint64_t  time_us;
+	uint64_t  time_ns;
+	uint64_t  wheel_time;
+	uint64_t  wheel_map[MM_CLOCK_WHEEL_LEVELS];
+	mm_list_t wheel[MM_CLOCK_WHEEL_LEVELS][MM_CLOCK_WHEEL_SIZE];
+	mm_list_t wheel_overflow;
+	mm_list_t wheel_expired;
+	int       timers_count;
+	mm_loopstat_t *stat;
+};
+
+/* mm_clock_gettime() time source */
+enum
+{
+	MM_CLOCK_MONOTONIC,
+	MM_CLOCK_COARSE,
+	MM_CLOCK_TSC
 };
 
+int  mm_clock_source_init(int);
+
 void mm_clock_init(mm_clock_t*);
 void mm_clock_free(mm_clock_t*);
 void mm_clock_update(mm_clock_t*);
+uint64_t mm_clock_gettime(void);
 int  mm_clock_step(mm_clock_t*);
+int  mm_clock_timeout(mm_clock_t*);
 int  mm_clock_timer_add(mm_clock_t*, mm_timer_t*);
 int  mm_clock_timer_del(mm_clock_t*, mm_timer_t*);
 
-mm_timer_t*
-mm_clock_timer_min(mm_clock_t*);
-
 static inline void
 mm_clock_reset(mm_clock_t *clock)
 {
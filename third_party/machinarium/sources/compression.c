@@ -0,0 +1,300 @@
+/*
+ * machinarium.
+ *
+ * cooperative multitasking engine.
+*/
+
+#include <machinarium.h>
+#include <machinarium_private.h>
+
+/*
+ * zlib stream compression of the connection data.
+ *
+ * Each write is compressed with a sync flush, so the peer can
+ * decompress it without waiting for more data. Compressed data
+ * is sent over the tls connection, if it is active.
+ *
+ * Write of the compressed data can be partial, in that case write
+ * returns EAGAIN and has to be retried with the same data, as in
+ * tls.
+*/
+
+#ifdef HAVE_ZLIB
+
+static inline int
+mm_compression_read_raw(mm_io_t *io, char *buf, int size)
+{
+	if (mm_tls_is_active(io))
+		return mm_tls_read(io, buf, size);
+	return mm_socket_read(io->fd, buf, size);
+}
+
+static inline int
+mm_compression_write_raw(mm_io_t *io, char *buf, int size)
+{
+	if (mm_tls_is_active(io))
+		return mm_tls_write(io, buf, size);
+	return mm_socket_write(io->fd, buf, size);
+}
+
+int
+mm_compression_create(mm_io_t *io, int level)
+{
+	mm_compression_t *compression;
+	compression = malloc(sizeof(*compression));
+	if (compression == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memset(compression, 0, sizeof(*compression));
+	compression->in = malloc(MM_COMPRESSION_READ_BUF);
+	if (compression->in == NULL) {
+		free(compression);
+		errno = ENOMEM;
+		return -1;
+	}
+	int rc;
+	rc = deflateInit(&compression->deflate, level);
+	if (rc != Z_OK) {
+		free(compression->in);
+		free(compression);
+		errno = EINVAL;
+		return -1;
+	}
+	rc = inflateInit(&compression->inflate);
+	if (rc != Z_OK) {
+		deflateEnd(&compression->deflate);
+		free(compression->in);
+		free(compression);
+		errno = ENOMEM;
+		return -1;
+	}
+	io->compression = compression;
+	return 0;
+}
+
+void
+mm_compression_free(mm_io_t *io)
+{
+	mm_compression_t *compression = io->compression;
+	if (compression == NULL)
+		return;
+	deflateEnd(&compression->deflate);
+	inflateEnd(&compression->inflate);
+	free(compression->in);
+	free(compression->out);
+	free(compression);
+	io->compression = NULL;
+}
+
+int
+mm_compression_read_pending(mm_io_t *io)
+{
+	mm_compression_t *compression = io->compression;
+	return compression->inflate.avail_in > 0 ||
+	       compression->inflate_pending;
+}
+
+int
+mm_compression_read(mm_io_t *io, char *buf, int size)
+{
+	mm_compression_t *compression = io->compression;
+	z_stream *stream = &compression->inflate;
+	int total = 0;
+	for (;;)
+	{
+		if (stream->avail_in > 0 || compression->inflate_pending) {
+			stream->next_out  = (Bytef*)buf + total;
+			stream->avail_out = size - total;
+			int rc;
+			rc = inflate(stream, Z_SYNC_FLUSH);
+			if (rc != Z_OK && rc != Z_BUF_ERROR) {
+				errno = EPROTO;
+				return -1;
+			}
+			total = size - stream->avail_out;
+			/* more output can be buffered by zlib */
+			compression->inflate_pending = stream->avail_out == 0;
+			if (total == size)
+				return total;
+		}
+
+		/* read more compressed data, until the socket has none */
+		int rc;
+		rc = mm_compression_read_raw(io, compression->in,
+		                             MM_COMPRESSION_READ_BUF);
+		if (rc <= 0) {
+			if (total > 0)
+				return total;
+			return rc;
+		}
+		stream->next_in  = (Bytef*)compression->in;
+		stream->avail_in = rc;
+	}
+}
+
+static inline int
+mm_compression_reserve(mm_compression_t *compression, int size)
+{
+	if (compression->out_allocated - compression->out_size >= size)
+		return 0;
+	int allocated = compression->out_size + size;
+	char *out = realloc(compression->out, allocated);
+	if (out == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	compression->out = out;
+	compression->out_allocated = allocated;
+	return 0;
+}
+
+static inline int
+mm_compression_deflate(mm_compression_t *compression, char *buf, int size,
+                       int flush)
+{
+	z_stream *stream = &compression->deflate;
+	stream->next_in  = (Bytef*)buf;
+	stream->avail_in = size;
+	int rc;
+	rc = mm_compression_reserve(compression, deflateBound(stream, size) + 16);
+	if (rc == -1)
+		return -1;
+	for (;;)
+	{
+		stream->next_out  = (Bytef*)compression->out + compression->out_size;
+		stream->avail_out = compression->out_allocated - compression->out_size;
+		rc = deflate(stream, flush);
+		if (rc != Z_OK && rc != Z_BUF_ERROR) {
+			errno = EPROTO;
+			return -1;
+		}
+		compression->out_size = compression->out_allocated - stream->avail_out;
+		if (stream->avail_out > 0)
+			break;
+		rc = mm_compression_reserve(compression, 4096);
+		if (rc == -1)
+			return -1;
+	}
+	return 0;
+}
+
+static inline int
+mm_compression_flush(mm_io_t *io)
+{
+	/* return number of the compressed bytes consumed, or -1 */
+	mm_compression_t *compression = io->compression;
+	while (compression->out_pos < compression->out_size)
+	{
+		int rc;
+		rc = mm_compression_write_raw(io, compression->out + compression->out_pos,
+		                              compression->out_size - compression->out_pos);
+		if (rc <= 0)
+			return -1;
+		compression->out_pos += rc;
+	}
+	compression->out_pos  = 0;
+	compression->out_size = 0;
+	int consumed = compression->out_consumed;
+	compression->out_consumed = 0;
+	return consumed;
+}
+
+int
+mm_compression_write(mm_io_t *io, char *buf, int size)
+{
+	mm_compression_t *compression = io->compression;
+	if (compression->out_size == 0) {
+		if (size > MM_COMPRESSION_WRITE_MAX)
+			size = MM_COMPRESSION_WRITE_MAX;
+		int rc;
+		rc = mm_compression_deflate(compression, buf, size, Z_SYNC_FLUSH);
+		if (rc == -1)
+			return -1;
+		compression->out_consumed = size;
+	}
+	return mm_compression_flush(io);
+}
+
+int
+mm_compression_writev(mm_io_t *io, struct iovec *iov, int count)
+{
+	mm_compression_t *compression = io->compression;
+	if (compression->out_size == 0) {
+		int size = 0;
+		int i;
+		for (i = 0; i < count && size < MM_COMPRESSION_WRITE_MAX; i++) {
+			int len = iov[i].iov_len;
+			if (len > MM_COMPRESSION_WRITE_MAX - size)
+				len = MM_COMPRESSION_WRITE_MAX - size;
+			size += len;
+			/* flush once, after the last buffer */
+			int flush = Z_NO_FLUSH;
+			if (i == count - 1 || size == MM_COMPRESSION_WRITE_MAX)
+				flush = Z_SYNC_FLUSH;
+			int rc;
+			rc = mm_compression_deflate(compression, iov[i].iov_base, len,
+			                            flush);
+			if (rc == -1)
+				return -1;
+		}
+		compression->out_consumed = size;
+	}
+	return mm_compression_flush(io);
+}
+
+#else
+
+int
+mm_compression_create(mm_io_t *io, int level)
+{
+	(void)io;
+	(void)level;
+	errno = ENOTSUP;
+	return -1;
+}
+
+void
+mm_compression_free(mm_io_t *io)
+{
+	(void)io;
+}
+
+int
+mm_compression_read_pending(mm_io_t *io)
+{
+	(void)io;
+	return 0;
+}
+
+int
+mm_compression_read(mm_io_t *io, char *buf, int size)
+{
+	(void)io;
+	(void)buf;
+	(void)size;
+	errno = ENOTSUP;
+	return -1;
+}
+
+int
+mm_compression_write(mm_io_t *io, char *buf, int size)
+{
+	(void)io;
+	(void)buf;
+	(void)size;
+	errno = ENOTSUP;
+	return -1;
+}
+
+int
+mm_compression_writev(mm_io_t *io, struct iovec *iov, int count)
+{
+	(void)io;
+	(void)iov;
+	(void)count;
+	errno = ENOTSUP;
+	return -1;
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef MM_COMPRESSION_H
+#define MM_COMPRESSION_H
+
+/*
+ * machinarium.
+ *
+ * cooperative multitasking engine.
+*/
+
+/* largest input compressed by a single write */
+#define MM_COMPRESSION_WRITE_MAX (64 * 1024)
+
+/* read buffer of compressed data */
+#define MM_COMPRESSION_READ_BUF (16 * 1024)
+
+#ifdef HAVE_ZLIB
+struct mm_compression
+{
+	z_stream  deflate;
+	z_stream  inflate;
+	int       inflate_pending;
+	char     *in;
+	char     *out;
+	int       out_pos;
+	int       out_size;
+	int       out_allocated;
+	int       out_consumed;
+};
+#endif
+
+static inline int
+mm_compression_is_active(mm_io_t *io) {
+	return io->compression != NULL;
+}
+
+int  mm_compression_create(mm_io_t*, int);
+void mm_compression_free(mm_io_t*);
+int  mm_compression_read_pending(mm_io_t*);
+int  mm_compression_read(mm_io_t*, char*, int);
+int  mm_compression_write(mm_io_t*, char*, int);
+int  mm_compression_writev(mm_io_t*, struct iovec*, int);
+
+#endif /* MM_COMPRESSION_H */
@@ -40,6 +40,16 @@ mm_connect(mm_io_t *io, struct sockaddr *sa, uint32_t time_ms)
 	if (rc == -1)
 		goto error;
 
+	/* with a fast open cookie, connect completes at once and
+	 * SYN is sent with the data of the first write */
+	if (io->opt_fastopen_connect && ! io->is_unix_socket) {
+		rc = mm_socket_set_fastopen_connect(io->fd, 1);
+		if (rc == -1) {
+			mm_errno_set(errno);
+			goto error;
+		}
+	}
+
 	/* start connection */
 	rc = mm_socket_connect(io->fd, sa);
 	if (rc == 0) {
@@ -110,6 +120,39 @@ machine_connect(machine_io_t *obj, struct sockaddr *sa, uint32_t time_ms)
 	return 0;
 }
 
+MACHINE_API int
+machine_connect_fd(machine_io_t *obj, int fd)
+{
+	/* use socket connected elsewhere, like an end of socketpair
+	 * passed by another thread. It is attached by the caller */
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_errno_set(0);
+	if (io->connected || io->fd != -1) {
+		mm_errno_set(EINPROGRESS);
+		return -1;
+	}
+	struct sockaddr_storage sa;
+	socklen_t sa_len = sizeof(sa);
+	int rc;
+	rc = getsockname(fd, (struct sockaddr*)&sa, &sa_len);
+	if (rc == -1) {
+		mm_errno_set(errno);
+		close(fd);
+		return -1;
+	}
+	if (sa.ss_family == AF_UNIX)
+		io->is_unix_socket = 1;
+	rc = mm_io_socket_set(io, fd);
+	if (rc == -1) {
+		close(io->fd);
+		io->fd = -1;
+		io->handle.fd = -1;
+		return -1;
+	}
+	io->connected = 1;
+	return 0;
+}
+
 MACHINE_API int
 machine_connected(machine_io_t *obj)
 {
@@ -8,41 +8,48 @@
 #include <machinarium.h>
 #include <machinarium_private.h>
 
-typedef struct {
-	mm_context_t *context_runner;
-	mm_context_t *context;
-	mm_context_function_t function;
-	void *arg;
-} mm_runner_t;
-
-static __thread mm_runner_t runner;
-
-static void
-mm_context_runner(void)
-{
-	/* save argument */
-	volatile mm_runner_t runner_arg = runner;
-
-	/* return to mm_context_create() */
-	mm_context_swap(runner_arg.context, runner_arg.context_runner);
+/*
+ * New context starts in mm_context_entry by the first swap into it:
+ * function and argument are restored from the saved callee-saved
+ * registers, so creation costs no context switch. On x86 the entry
+ * stack is 16 bytes aligned before the call.
+*/
 
-	runner_arg.function(runner_arg.arg);
-	abort();
-}
+void mm_context_entry(void);
 
 static inline void**
-mm_context_prepare(mm_contextstack_t *stack)
+mm_context_prepare(mm_contextstack_t *stack,
+                   mm_context_function_t function, void *arg)
 {
 	void **sp;
 	sp = (void**)(stack->pointer + stack->size);
-	*--sp = NULL;
-	*--sp = (void*)mm_context_runner;
 #if __amd64
+	*--sp = NULL;
+	*--sp = NULL;
+	*--sp = (void*)mm_context_entry;
 	sp -= 6;
-	memset(sp, 0, sizeof(void*) * 6);
-#else
+	sp[0] = NULL;            /* r15 */
+	sp[1] = NULL;            /* r14 */
+	sp[2] = arg;             /* r13 */
+	sp[3] = (void*)function; /* r12 */
+	sp[4] = (void*)abort;    /* rbx */
+	sp[5] = NULL;            /* rbp */
+#elif __i386
 	sp -= 4;
 	memset(sp, 0, sizeof(void*) * 4);
+	*--sp = (void*)mm_context_entry;
+	sp -= 4;
+	sp[0] = (void*)function; /* edi */
+	sp[1] = arg;             /* esi */
+	sp[2] = (void*)abort;    /* ebx */
+	sp[3] = NULL;            /* ebp */
+#elif __aarch64__
+	sp -= 20;
+	memset(sp, 0, sizeof(void*) * 20);
+	sp[8]  = (void*)function; /* x19 */
+	sp[9]  = arg;             /* x20 */
+	sp[10] = (void*)abort;    /* x21 */
+	sp[19] = (void*)mm_context_entry; /* x30 */
 #endif
 	return sp;
 }
@@ -52,30 +59,39 @@ mm_context_create(mm_context_t *context, mm_contextstack_t *stack,
                   void (*function)(void*),
                   void *arg)
 {
-	/* must be first */
-	mm_context_t context_runner;
-
-	/* prepare context runner */
-	runner.context_runner = &context_runner;
-	runner.context = context;
-	runner.function = function;
-	runner.arg = arg;
-
-	/* prepare context */
-	context->sp = mm_context_prepare(stack);
-
-	/* execute runner: pass function and argument */
-	mm_context_swap(&context_runner, context);
+	context->sp = mm_context_prepare(stack, function, arg);
 }
 
-#if !defined(__amd64) && !defined(__i386)
+#if !defined(__amd64) && !defined(__i386) && !defined(__aarch64__)
 #  error unsupported architecture
 #endif
 
+/* function must not return, abort() otherwise */
+asm (
+	"\t.text\n"
+	"\t.globl mm_context_entry\n"
+	"\t.type mm_context_entry,%function\n"
+	"mm_context_entry:\n"
+	#if __amd64
+	"\tmovq %r13, %rdi\n"
+	"\tcallq *%r12\n"
+	"\tcallq *%rbx\n"
+	#elif __i386
+	"\tsubl $12, %esp\n"
+	"\tpushl %esi\n"
+	"\tcall *%edi\n"
+	"\tcall *%ebx\n"
+	#elif __aarch64__
+	"\tmov x0, x20\n"
+	"\tblr x19\n"
+	"\tblr x21\n"
+	#endif
+);
+
 asm (
 	"\t.text\n"
 	"\t.globl mm_context_swap\n"
-	"\t.type x,@function\n"
+	"\t.type mm_context_swap,%function\n"
 	"mm_context_swap:\n"
 	#if __amd64
 	"\tpushq %rbp\n"
@@ -105,5 +121,34 @@ asm (
 	"\tpopl %ebx\n"
 	"\tpopl %ebp\n"
 	"\tret\n"
+	#elif __aarch64__
+	/* x19-x30 and the low halves of v8-v15 are callee-saved */
+	"\tsub sp, sp, #160\n"
+	"\tstp d8, d9, [sp, #0]\n"
+	"\tstp d10, d11, [sp, #16]\n"
+	"\tstp d12, d13, [sp, #32]\n"
+	"\tstp d14, d15, [sp, #48]\n"
+	"\tstp x19, x20, [sp, #64]\n"
+	"\tstp x21, x22, [sp, #80]\n"
+	"\tstp x23, x24, [sp, #96]\n"
+	"\tstp x25, x26, [sp, #112]\n"
+	"\tstp x27, x28, [sp, #128]\n"
+	"\tstp x29, x30, [sp, #144]\n"
+	"\tmov x9, sp\n"
+	"\tstr x9, [x0]\n"
+	"\tldr x9, [x1]\n"
+	"\tmov sp, x9\n"
+	"\tldp d8, d9, [sp, #0]\n"
+	"\tldp d10, d11, [sp, #16]\n"
+	"\tldp d12, d13, [sp, #32]\n"
+	"\tldp d14, d15, [sp, #48]\n"
+	"\tldp x19, x20, [sp, #64]\n"
+	"\tldp x21, x22, [sp, #80]\n"
+	"\tldp x23, x24, [sp, #96]\n"
+	"\tldp x25, x26, [sp, #112]\n"
+	"\tldp x27, x28, [sp, #128]\n"
+	"\tldp x29, x30, [sp, #144]\n"
+	"\tadd sp, sp, #160\n"
+	"\tret\n"
 	#endif
 );
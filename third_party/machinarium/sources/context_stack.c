@@ -12,18 +12,133 @@
 #  include <valgrind/valgrind.h>
 #endif
 
-int mm_contextstack_create(mm_contextstack_t *stack, size_t size, size_t size_guard)
-{
-	char *base;
-	base = mmap(0, size_guard + size, PROT_READ|PROT_WRITE|PROT_EXEC,
-	            MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
-	if (base == MAP_FAILED)
-		return -1;
-	mprotect(base, size_guard, PROT_NONE);
-	base += size_guard;
-	stack->pointer = base;
-	stack->size = size;
-	stack->size_guard = size_guard;
+void mm_contextstack_arena_init(mm_contextstack_arena_t *arena,
+                                size_t size,
+                                size_t page_size,
+                                int hugepages)
+{
+	arena->size = size;
+	arena->size_guard = page_size;
+	arena->page_size = page_size;
+	arena->hugepages = hugepages;
+	arena->watermark = 0;
+	if (hugepages)
+		arena->size_guard = 0;
+	arena->count_chunks = 0;
+	mm_list_init(&arena->chunks);
+}
+
+static inline void
+mm_contextstack_chunk_free(mm_contextstack_arena_t *arena,
+                           mm_contextstack_chunk_t *chunk)
+{
+	mm_list_unlink(&chunk->link);
+	munmap(chunk->base, chunk->size);
+	free(chunk);
+	arena->count_chunks--;
+}
+
+void mm_contextstack_arena_free(mm_contextstack_arena_t *arena)
+{
+	mm_list_t *i, *n;
+	mm_list_foreach_safe(&arena->chunks, i, n) {
+		mm_contextstack_chunk_t *chunk;
+		chunk = mm_container_of(i, mm_contextstack_chunk_t, link);
+		mm_contextstack_chunk_free(arena, chunk);
+	}
+}
+
+static inline char*
+mm_contextstack_chunk_map(size_t size, int hugepages)
+{
+	int flags = MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE;
+	if (! hugepages) {
+		char *base;
+		base = mmap(0, size, PROT_READ|PROT_WRITE|PROT_EXEC, flags, -1, 0);
+		if (base == MAP_FAILED)
+			return NULL;
+		return base;
+	}
+
+	/* map with a spare huge page and trim it to get aligned chunk */
+	size_t align = MM_CONTEXTSTACK_HUGEPAGE;
+	char *map;
+	map = mmap(0, size + align, PROT_READ|PROT_WRITE|PROT_EXEC, flags, -1, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+	char *base = (char*)(((uintptr_t)map + align - 1) & ~(uintptr_t)(align - 1));
+	if (base != map)
+		munmap(map, base - map);
+	size_t tail = (map + size + align) - (base + size);
+	if (tail > 0)
+		munmap(base + size, tail);
+#ifdef MADV_HUGEPAGE
+	madvise(base, size, MADV_HUGEPAGE);
+#endif
+	return base;
+}
+
+static inline mm_contextstack_chunk_t*
+mm_contextstack_chunk_create(mm_contextstack_arena_t *arena)
+{
+	mm_contextstack_chunk_t *chunk;
+	chunk = malloc(sizeof(mm_contextstack_chunk_t));
+	if (chunk == NULL)
+		return NULL;
+	size_t slot_size = arena->size_guard + arena->size;
+	chunk->size = slot_size * MM_CONTEXTSTACK_CHUNK;
+	if (arena->hugepages) {
+		size_t align = MM_CONTEXTSTACK_HUGEPAGE;
+		chunk->size = (chunk->size + align - 1) & ~(align - 1);
+	}
+	chunk->base = mm_contextstack_chunk_map(chunk->size, arena->hugepages);
+	if (chunk->base == NULL) {
+		free(chunk);
+		return NULL;
+	}
+	int i;
+	for (i = 0; i < MM_CONTEXTSTACK_CHUNK; i++) {
+		if (arena->size_guard > 0)
+			mprotect(chunk->base + slot_size * i, arena->size_guard, PROT_NONE);
+		chunk->free[i] = MM_CONTEXTSTACK_CHUNK - i - 1;
+	}
+	chunk->count_used = 0;
+	chunk->count_free = MM_CONTEXTSTACK_CHUNK;
+	mm_list_init(&chunk->link);
+	mm_list_push(&arena->chunks, &chunk->link);
+	arena->count_chunks++;
+	return chunk;
+}
+
+int mm_contextstack_create(mm_contextstack_t *stack, mm_contextstack_arena_t *arena)
+{
+	/* chunks with free slots are kept in front of the list */
+	mm_contextstack_chunk_t *chunk = NULL;
+	if (arena->chunks.next != &arena->chunks) {
+		chunk = mm_container_of(arena->chunks.next, mm_contextstack_chunk_t, link);
+		if (chunk->count_free == 0)
+			chunk = NULL;
+	}
+	if (chunk == NULL) {
+		chunk = mm_contextstack_chunk_create(arena);
+		if (chunk == NULL)
+			return -1;
+	}
+	int slot = chunk->free[--chunk->count_free];
+	chunk->count_used++;
+	if (chunk->count_free == 0) {
+		mm_list_unlink(&chunk->link);
+		mm_list_append(&arena->chunks, &chunk->link);
+	}
+
+	size_t slot_size = arena->size_guard + arena->size;
+	stack->pointer = chunk->base + slot_size * slot + arena->size_guard;
+	stack->size = arena->size;
+	stack->size_guard = arena->size_guard;
+	stack->arena = arena;
+	stack->chunk = chunk;
+	stack->slot = slot;
+	stack->used = 0;
 #ifdef HAVE_VALGRIND
 	stack->valgrind_stack =
 		VALGRIND_STACK_REGISTER(stack->pointer, stack->pointer + stack->size);
@@ -31,13 +146,117 @@ int mm_contextstack_create(mm_contextstack_t *stack, size_t size, size_t size_gu
 	return 0;
 }
 
+static inline char*
+mm_contextstack_lowest(mm_contextstack_t *stack)
+{
+	mm_contextstack_arena_t *arena = stack->arena;
+	char *start = stack->pointer;
+	char *end = stack->pointer + stack->size;
+
+	/* skip pages which were never touched */
+	if (! arena->hugepages) {
+		unsigned char vec[256];
+		size_t pages = stack->size / arena->page_size;
+		size_t page = 0;
+		while (page < pages) {
+			size_t count = pages - page;
+			if (count > sizeof(vec))
+				count = sizeof(vec);
+			int rc;
+			rc = mincore(start + page * arena->page_size,
+			             count * arena->page_size, vec);
+			if (rc == -1)
+				break;
+			size_t i = 0;
+			while (i < count && ! (vec[i] & 1))
+				i++;
+			page += i;
+			if (i < count)
+				break;
+		}
+		start += page * arena->page_size;
+	}
+
+	uintptr_t *pos = (uintptr_t*)start;
+	while ((char*)pos < end && *pos == 0)
+		pos++;
+	return (char*)pos;
+}
+
+size_t mm_contextstack_used(mm_contextstack_t *stack)
+{
+	if (stack->pointer == NULL || ! stack->arena->watermark)
+		return stack->used;
+	size_t used = stack->pointer + stack->size - mm_contextstack_lowest(stack);
+	if (used > stack->used)
+		stack->used = used;
+	return stack->used;
+}
+
+void mm_contextstack_release(mm_contextstack_t *stack)
+{
+	mm_contextstack_arena_t *arena = stack->arena;
+	if (arena->watermark) {
+		/* paint what the next coroutine may find as used */
+		char *end = stack->pointer + stack->size;
+		char *lowest = end - arena->page_size;
+		if (arena->hugepages || stack->size <= arena->page_size)
+			lowest = mm_contextstack_lowest(stack);
+		if (lowest < stack->pointer)
+			lowest = stack->pointer;
+		memset(lowest, 0, end - lowest);
+		stack->used = 0;
+	}
+	if (arena->hugepages)
+		return;
+	/* keep the topmost page, it is touched first on reuse */
+	if (stack->size <= arena->page_size)
+		return;
+	madvise(stack->pointer, stack->size - arena->page_size, MADV_DONTNEED);
+}
+
+int mm_contextstack_shrink(mm_contextstack_t *stack, void *sp)
+{
+	mm_contextstack_arena_t *arena = stack->arena;
+	if (stack->pointer == NULL || arena->hugepages)
+		return 0;
+	uintptr_t start = (uintptr_t)stack->pointer;
+	uintptr_t top = (uintptr_t)sp;
+	if (top < start || top >= start + stack->size)
+		return 0;
+	/* leave a page below stack pointer for the madvise call itself */
+	uintptr_t end = (top & ~(uintptr_t)(arena->page_size - 1)) - arena->page_size;
+	if (end <= start)
+		return 0;
+	/* pages given back read as zeroes, keep the usage seen so far */
+	mm_contextstack_used(stack);
+	int rc;
+	rc = madvise(stack->pointer, end - start, MADV_DONTNEED);
+	if (rc == -1)
+		return 0;
+	return end - start;
+}
+
 void mm_contextstack_free(mm_contextstack_t *stack)
 {
 	if (stack->pointer == NULL)
 		return;
+	mm_contextstack_arena_t *arena = stack->arena;
 #ifdef HAVE_VALGRIND
 	VALGRIND_STACK_DEREGISTER(stack->valgrind_stack);
 #endif
-	char *base = stack->pointer - stack->size_guard;
-	munmap(base, stack->size_guard + stack->size);
+	mm_contextstack_chunk_t *chunk = stack->chunk;
+	chunk->free[chunk->count_free++] = stack->slot;
+	chunk->count_used--;
+
+	/* keep one spare chunk, unmap the rest once they are unused */
+	if (chunk->count_used == 0 && arena->count_chunks > 1) {
+		mm_contextstack_chunk_free(arena, chunk);
+		stack->pointer = NULL;
+		return;
+	}
+	mm_contextstack_release(stack);
+	stack->pointer = NULL;
+	mm_list_unlink(&chunk->link);
+	mm_list_push(&arena->chunks, &chunk->link);
 }
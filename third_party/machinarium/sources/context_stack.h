@@ -7,19 +7,71 @@
  * cooperative multitasking engine.
 */
 
-typedef struct mm_contextstack mm_contextstack_t;
+typedef struct mm_contextstack_chunk mm_contextstack_chunk_t;
+typedef struct mm_contextstack_arena mm_contextstack_arena_t;
+typedef struct mm_contextstack       mm_contextstack_t;
+
+/* Coroutine stacks are carved out of large per-machine mmap chunks,
+ * MM_CONTEXTSTACK_CHUNK stacks each, every stack preceded by a guard.
+ * Memory is committed by the kernel on first touch and given back by
+ * mm_contextstack_release() when a stack is returned to the cache.
+ *
+ * In huge pages mode chunks are aligned to MM_CONTEXTSTACK_HUGEPAGE,
+ * stacks have no guards and are never released, so chunks stay
+ * eligible for transparent huge pages.
+ *
+ * With watermark set, stacks are kept painted with zeroes: released
+ * pages read back as zeroes, the kept top page (or the used part in
+ * huge pages mode) is cleared on release. Stack usage is the distance
+ * from the top to the lowest non-zero word, searched from the lowest
+ * resident page, so untouched pages are never faulted in.
+*/
+
+#define MM_CONTEXTSTACK_CHUNK    64
+#define MM_CONTEXTSTACK_HUGEPAGE (2 * 1024 * 1024)
+
+struct mm_contextstack_chunk
+{
+	char      *base;
+	size_t     size;
+	int        count_used;
+	int        count_free;
+	int        free[MM_CONTEXTSTACK_CHUNK];
+	mm_list_t  link;
+};
+
+struct mm_contextstack_arena
+{
+	size_t     size;
+	size_t     size_guard;
+	size_t     page_size;
+	int        hugepages;
+	int        watermark;
+	int        count_chunks;
+	mm_list_t  chunks;
+};
 
 struct mm_contextstack
 {
-	char   *pointer;
-	size_t  size;
-	size_t  size_guard;
+	char                    *pointer;
+	size_t                   size;
+	size_t                   size_guard;
+	mm_contextstack_arena_t *arena;
+	mm_contextstack_chunk_t *chunk;
+	int                      slot;
+	size_t                   used;
 #ifdef HAVE_VALGRIND
-	int     valgrind_stack;
+	int                      valgrind_stack;
 #endif
 };
 
-int  mm_contextstack_create(mm_contextstack_t*, size_t, size_t);
+void mm_contextstack_arena_init(mm_contextstack_arena_t*, size_t, size_t, int);
+void mm_contextstack_arena_free(mm_contextstack_arena_t*);
+
+int  mm_contextstack_create(mm_contextstack_t*, mm_contextstack_arena_t*);
+void mm_contextstack_release(mm_contextstack_t*);
+int  mm_contextstack_shrink(mm_contextstack_t*, void*);
+size_t mm_contextstack_used(mm_contextstack_t*);
 void mm_contextstack_free(mm_contextstack_t*);
 
 #endif /* MM_CONTEXT_STACK_H */
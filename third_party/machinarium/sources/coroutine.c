@@ -13,6 +13,7 @@ void mm_coroutine_init(mm_coroutine_t *coroutine)
 	memset(coroutine, 0, sizeof(mm_coroutine_t));
 	coroutine->id = UINT64_MAX;
 	coroutine->state = MM_CNEW;
+	coroutine->priority = MACHINE_PRIORITY_NORMAL;
 	coroutine->errno_ = 0;
 	coroutine->call_ptr = NULL;
 	mm_list_init(&coroutine->joiners);
@@ -21,7 +22,7 @@ void mm_coroutine_init(mm_coroutine_t *coroutine)
 }
 
 mm_coroutine_t*
-mm_coroutine_allocate(int stack_size, int stack_size_guard)
+mm_coroutine_allocate(mm_contextstack_arena_t *arena)
 {
 	mm_coroutine_t *coroutine;
 	coroutine = malloc(sizeof(mm_coroutine_t));
@@ -29,7 +30,7 @@ mm_coroutine_allocate(int stack_size, int stack_size_guard)
 		return NULL;
 	mm_coroutine_init(coroutine);
 	int rc;
-	rc = mm_contextstack_create(&coroutine->stack, stack_size, stack_size_guard);
+	rc = mm_contextstack_create(&coroutine->stack, arena);
 	if (rc == -1) {
 		free(coroutine);
 		return NULL;
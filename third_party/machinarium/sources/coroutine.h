@@ -24,6 +24,7 @@ struct mm_coroutine
 	uint64_t            id;
 	mm_coroutinestate_t state;
 	int                 cancel;
+	int                 priority;
 	int                 errno_;
 	mm_function_t       function;
 	void               *function_arg;
@@ -31,13 +32,17 @@ struct mm_coroutine
 	mm_context_t        context;
 	mm_coroutine_t     *resume;
 	void               *call_ptr;
+	uint64_t            time_run;
+	uint64_t            time_wait;
+	uint64_t            time_ready;
+	uint64_t            count_switch;
 	mm_list_t           joiners;
 	mm_list_t           link_join;
 	mm_list_t           link;
 };
 
 mm_coroutine_t*
-mm_coroutine_allocate(int, int);
+mm_coroutine_allocate(mm_contextstack_arena_t*);
 
 void mm_coroutine_init(mm_coroutine_t*);
 void mm_coroutine_free(mm_coroutine_t*);
@@ -9,15 +9,13 @@
 #include <machinarium_private.h>
 
 void mm_coroutine_cache_init(mm_coroutine_cache_t *cache,
-                             int stack_size,
-                             int stack_size_guard,
+                             mm_contextstack_arena_t *arena,
                              int limit)
 {
 	mm_list_init(&cache->list);
 	cache->count_free = 0;
 	cache->count_total = 0;
-	cache->stack_size = stack_size;
-	cache->stack_size_guard = stack_size_guard;
+	cache->arena = arena;
 	cache->limit = limit;
 }
 
@@ -51,7 +49,7 @@ mm_coroutine_cache_pop(mm_coroutine_cache_t *cache)
 	}
 	cache->count_total++;
 
-	coroutine = mm_coroutine_allocate(cache->stack_size, cache->stack_size_guard);
+	coroutine = mm_coroutine_allocate(cache->arena);
 	if (coroutine == NULL)
 		cache->count_total--;
 	return coroutine;
@@ -60,11 +58,15 @@ mm_coroutine_cache_pop(mm_coroutine_cache_t *cache)
 void mm_coroutine_cache_push(mm_coroutine_cache_t *cache, mm_coroutine_t *coroutine)
 {
 	assert(coroutine->state == MM_CFREE);
+	if (cache->arena->watermark)
+		mm_stackstat_add(&machinarium.stack_stat, coroutine->function,
+		                 mm_contextstack_used(&coroutine->stack));
 	if (cache->count_free >= cache->limit) {
 		cache->count_total--;
 		mm_coroutine_free(coroutine);
 		return;
 	}
+	mm_contextstack_release(&coroutine->stack);
 	mm_list_init(&coroutine->link);
 	mm_list_append(&cache->list, &coroutine->link);
 	cache->count_free++;
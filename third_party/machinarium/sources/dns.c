@@ -29,6 +29,12 @@ machine_getaddrinfo(char *addr, char *service,
                     struct addrinfo **res,
                     uint32_t time_ms)
 {
+	if (machinarium.config.resolver == MM_RESOLVER_ASYNC) {
+		int rc;
+		rc = mm_resolver_getaddrinfo(addr, service, hints, res, time_ms);
+		if (rc != MM_RESOLVER_FALLBACK)
+			return rc;
+	}
 	mm_getaddrinfo_t gai = {
 		.addr = addr,
 		.service = service,
@@ -72,3 +78,20 @@ machine_getpeername(machine_io_t *obj, struct sockaddr *sa, int *salen)
 	*salen = slen;
 	return 0;
 }
+
+MACHINE_API int
+machine_getpeereid(machine_io_t *obj, uid_t *uid, gid_t *gid)
+{
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_errno_set(0);
+	if (! io->is_unix_socket) {
+		mm_errno_set(ENOTSUP);
+		return -1;
+	}
+	int rc = mm_socket_getpeereid(io->fd, uid, gid);
+	if (rc < 0) {
+		mm_errno_set(errno);
+		return -1;
+	}
+	return 0;
+}
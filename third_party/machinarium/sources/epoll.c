@@ -16,6 +16,7 @@ struct mm_epoll_t {
 	struct epoll_event *list;
 	int                 size;
 	int                 count;
+	mm_list_t           ready;
 };
 
 static mm_poll_t*
@@ -28,6 +29,7 @@ mm_epoll_create(void)
 	epoll->poll.iface = &mm_epoll_if;
 	epoll->count = 0;
 	epoll->size  = 1024;
+	mm_list_init(&epoll->ready);
 	int size = sizeof(struct epoll_event) * epoll->size;
 	epoll->list  = malloc(size);
 	if (epoll->list == NULL) {
@@ -64,20 +66,92 @@ mm_epoll_shutdown(mm_poll_t *poll)
 	return 0;
 }
 
+static inline int
+mm_epoll_pending(mm_fd_t *fd)
+{
+	/* ready in a direction of interest */
+	int mask = 0;
+	if (fd->on_read)
+		mask |= MM_R;
+	if (fd->on_write)
+		mask |= MM_W;
+	return fd->ready & fd->mask & mask;
+}
+
+static inline void
+mm_epoll_ready(mm_epoll_t *epoll, mm_fd_t *fd)
+{
+	if (fd->link_ready.next != &fd->link_ready)
+		return;
+	mm_list_append(&epoll->ready, &fd->link_ready);
+}
+
+static inline void
+mm_epoll_unready(mm_fd_t *fd)
+{
+	mm_list_unlink(&fd->link_ready);
+	mm_list_init(&fd->link_ready);
+}
+
+static inline int
+mm_epoll_dispatch(mm_epoll_t *epoll)
+{
+	/* edge-triggered fds stay queued until drained or out of
+	 * interest. Queue is moved aside and taken one fd at a time,
+	 * since callbacks may change interest in or delete any fd */
+	if (epoll->ready.next == &epoll->ready)
+		return 0;
+	mm_list_t list;
+	list.next = epoll->ready.next;
+	list.prev = epoll->ready.prev;
+	list.next->prev = &list;
+	list.prev->next = &list;
+	mm_list_init(&epoll->ready);
+	int count = 0;
+	while (list.next != &list) {
+		mm_fd_t *fd;
+		fd = mm_container_of(list.next, mm_fd_t, link_ready);
+		mm_epoll_unready(fd);
+		int pending = mm_epoll_pending(fd);
+		if (! pending)
+			continue;
+		mm_epoll_ready(epoll, fd);
+		if (pending & MM_R)
+			fd->on_read(fd);
+		if (mm_epoll_pending(fd) & MM_W)
+			fd->on_write(fd);
+		count++;
+	}
+	return count;
+}
+
 static int
 mm_epoll_step(mm_poll_t *poll, int timeout)
 {
 	mm_epoll_t *epoll = (mm_epoll_t*)poll;
 	if (epoll->count == 0)
 		return 0;
+	/* do not sleep while ready fds are left undrained */
+	if (epoll->ready.next != &epoll->ready)
+		timeout = 0;
 	int count;
 	count = epoll_wait(epoll->fd, epoll->list, epoll->count, timeout);
+	mm_iostat_poll(&mm_self->loop.iostat, count);
 	if (count <= 0)
-		return 0;
+		return mm_epoll_dispatch(epoll);
 	int i = 0;
 	while (i < count) {
 		struct epoll_event *ev = &epoll->list[i];
 		mm_fd_t *fd = ev->data.ptr;
+		if (fd->edge) {
+			if (ev->events & (EPOLLIN|EPOLLRDHUP|EPOLLERR|EPOLLHUP))
+				fd->ready |= MM_R;
+			if (ev->events & (EPOLLOUT|EPOLLERR|EPOLLHUP))
+				fd->ready |= MM_W;
+			mm_epoll_ready(epoll, fd);
+			i++;
+			continue;
+		}
 		if (fd->on_read) {
 			if (ev->events & EPOLLIN)
 				fd->on_read(fd);
@@ -91,6 +165,7 @@ mm_epoll_step(mm_poll_t *poll, int timeout)
 		}
 		i++;
 	}
+	mm_epoll_dispatch(epoll);
 	return count;
 }
 
@@ -109,10 +184,17 @@ mm_epoll_add(mm_poll_t *poll, mm_fd_t *fd, int mask)
 	struct epoll_event ev;
 	ev.events = 0;
 	fd->mask = mask;
-	if (fd->mask & MM_R)
-		ev.events |= EPOLLIN;
-	if (fd->mask & MM_W)
-		ev.events |= EPOLLOUT;
+	fd->ready = 0;
+	mm_list_init(&fd->link_ready);
+	if (fd->edge) {
+		/* current readiness is reported on the first step */
+		ev.events = EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET;
+	} else {
+		if (fd->mask & MM_R)
+			ev.events |= EPOLLIN;
+		if (fd->mask & MM_W)
+			ev.events |= EPOLLOUT;
+	}
 	ev.data.ptr = fd;
 	int rc = epoll_ctl(epoll->fd, EPOLL_CTL_ADD, fd->fd, &ev);
 	if (rc == -1)
@@ -125,6 +207,14 @@ static inline int
 mm_epoll_modify(mm_poll_t *poll, mm_fd_t *fd, int mask)
 {
 	mm_epoll_t *epoll = (mm_epoll_t*)poll;
+	if (fd->edge) {
+		/* interest of edge-triggered fd costs no syscall, fd
+		 * left ready is dispatched on the next step */
+		fd->mask = mask;
+		if (mm_epoll_pending(fd))
+			mm_epoll_ready(epoll, fd);
+		return 0;
+	}
 	struct epoll_event ev;
 	ev.events = 0;
 	if (mask & MM_R)
@@ -152,7 +242,7 @@ mm_epoll_read(mm_poll_t *poll,
 		mask &= ~MM_R;
 	fd->on_read = on_read;
 	fd->on_read_arg = arg;
-	if (mask == fd->mask)
+	if (mask == fd->mask && !fd->edge)
 		return 0;
 	return mm_epoll_modify(poll, fd, mask);
 }
@@ -170,7 +260,7 @@ mm_epoll_write(mm_poll_t *poll,
 		mask &= ~MM_W;
 	fd->on_write = on_write;
 	fd->on_write_arg = arg;
-	if (mask == fd->mask)
+	if (mask == fd->mask && !fd->edge)
 		return 0;
 	return mm_epoll_modify(poll, fd, mask);
 }
@@ -185,12 +275,12 @@ mm_epoll_read_write(mm_poll_t *poll,
 	if (enable)
 		mask |= MM_W|MM_R;
 	else
-		mask &= ~MM_W|MM_R;
+		mask &= ~(MM_W|MM_R);
 	fd->on_write = on_event;
 	fd->on_write_arg = arg;
 	fd->on_read = on_event;
 	fd->on_read_arg = arg;
-	if (mask == fd->mask)
+	if (mask == fd->mask && !fd->edge)
 		return 0;
 	return mm_epoll_modify(poll, fd, mask);
 }
@@ -207,6 +297,9 @@ mm_epoll_del(mm_poll_t *poll, mm_fd_t *fd)
 		ev.events |= EPOLLOUT;
 	ev.data.ptr = fd;
 	fd->mask = 0;
+	fd->ready = 0;
+	if (fd->link_ready.next)
+		mm_epoll_unready(fd);
 	fd->on_write = NULL;
 	fd->on_write_arg = NULL;
 	fd->on_read = NULL;
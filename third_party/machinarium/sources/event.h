@@ -21,7 +21,8 @@ struct mm_event
 	mm_eventstate_t  state;
 	mm_call_t        call;
 	void            *event_mgr;
-	mm_list_t        link;
+	mm_event_t      *next;
+	void           (*on_ready)(mm_event_t*);
 };
 
 #endif /* MM_EVENT_H */
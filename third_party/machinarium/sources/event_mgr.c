@@ -8,6 +8,38 @@
 #include <machinarium.h>
 #include <machinarium_private.h>
 
+static inline int
+mm_eventmgr_dispatch(mm_eventmgr_t *mgr, mm_event_t *self)
+{
+	/* take all signaled events, wake them up in signal order */
+	mm_event_t *list;
+	list = __atomic_exchange_n(&mgr->ready, NULL, __ATOMIC_ACQUIRE);
+	mm_event_t *next;
+	mm_event_t *fifo = NULL;
+	while (list) {
+		next = list->next;
+		list->next = fifo;
+		fifo = list;
+		list = next;
+	}
+	int found = 0;
+	while (fifo) {
+		next = fifo->next;
+		if (fifo == self) {
+			found = 1;
+		} else
+		if (fifo->on_ready) {
+			/* reusable event, it rearms itself */
+			fifo->on_ready(fifo);
+		} else {
+			fifo->state = MM_EVENT_ACTIVE;
+			mm_scheduler_wakeup(&mm_self->scheduler, fifo->call.coroutine);
+		}
+		fifo = next;
+	}
+	return found;
+}
+
 static void
 mm_eventmgr_on_read(mm_fd_t *handle)
 {
@@ -20,35 +52,12 @@ mm_eventmgr_on_read(mm_fd_t *handle)
 	assert(rc == sizeof(id));
 
 	/* wakeup event waiters */
-	mm_sleeplock_lock(&mgr->lock);
-
-	if (! mgr->count_ready) {
-		mm_sleeplock_unlock(&mgr->lock);
-		return;
-	}
-
-	mm_list_t *i;
-	mm_list_foreach(&mgr->list_ready, i) {
-		mm_event_t *event;
-		event = mm_container_of(i, mm_event_t, link);
-		assert(event->state == MM_EVENT_READY);
-		event->state = MM_EVENT_ACTIVE;
-		mm_scheduler_wakeup(&mm_self->scheduler, event->call.coroutine);
-	}
-	mm_list_init(&mgr->list_ready);
-	mgr->count_ready = 0;
-
-	mm_sleeplock_unlock(&mgr->lock);
+	mm_eventmgr_dispatch(mgr, NULL);
 }
 
 int mm_eventmgr_init(mm_eventmgr_t *mgr, mm_loop_t *loop)
 {
-	mm_sleeplock_init(&mgr->lock);
-
-	mm_list_init(&mgr->list_ready);
-	mm_list_init(&mgr->list_wait);
-	mgr->count_ready = 0;
-	mgr->count_wait = 0;
+	mgr->ready = NULL;
 
 	memset(&mgr->fd, 0, sizeof(mgr->fd));
 	mgr->fd.fd = mm_socket_eventfd(0);
@@ -82,17 +91,10 @@ void mm_eventmgr_free(mm_eventmgr_t *mgr, mm_loop_t *loop)
 
 void mm_eventmgr_add(mm_eventmgr_t *mgr, mm_event_t *event)
 {
-	mm_list_init(&event->link);
-	event->state = MM_EVENT_WAIT;
+	event->next = NULL;
 	event->event_mgr = mgr;
-
-	/* add event to wait list */
-	mm_sleeplock_lock(&mgr->lock);
-
-	mm_list_append(&mgr->list_wait, &event->link);
-	mgr->count_wait++;
-
-	mm_sleeplock_unlock(&mgr->lock);
+	event->on_ready = NULL;
+	__atomic_store_n(&event->state, MM_EVENT_WAIT, __ATOMIC_RELEASE);
 }
 
 int mm_eventmgr_wait(mm_eventmgr_t *mgr, mm_event_t *event, uint32_t time_ms)
@@ -100,56 +102,57 @@ int mm_eventmgr_wait(mm_eventmgr_t *mgr, mm_event_t *event, uint32_t time_ms)
 	/* wait for event */
 	mm_call(&event->call, MM_CALL_EVENT, time_ms);
 
-	/* maybe remove from wait list */
-	mm_sleeplock_lock(&mgr->lock);
+	/* not signaled: timedout or cancelled */
+	mm_eventstate_t state = MM_EVENT_WAIT;
+	if (__atomic_compare_exchange_n(&event->state, &state, MM_EVENT_NONE, 0,
+	                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return 0;
 
 	int complete = 0;
-	switch (event->state) {
-	case MM_EVENT_WAIT:
-		mm_list_unlink(&event->link);
-		mgr->count_wait--;
-		break;
+	switch (state) {
 	case MM_EVENT_READY:
-		mm_list_unlink(&event->link);
-		mgr->count_ready--;
+		/* signaled, but not dispatched yet. The signaler refers to
+		 * the event until it is pushed to the ready stack */
+		mm_eventmgr_cancel(mgr, event);
 		break;
 	case MM_EVENT_ACTIVE:
 		complete = 1;
 		break;
-	case MM_EVENT_NONE:
+	default:
 		assert(0);
 		break;
 	}
 	event->state = MM_EVENT_NONE;
-
-	mm_sleeplock_unlock(&mgr->lock);
 	return complete;
 }
 
-int mm_eventmgr_signal(mm_event_t *event)
+void mm_eventmgr_cancel(mm_eventmgr_t *mgr, mm_event_t *event)
 {
-	mm_eventmgr_t *mgr = event->event_mgr;
+	/* take signaled event out of the ready stack, it is pushed
+	 * right after the signaler sets it ready */
+	while (! mm_eventmgr_dispatch(mgr, event))
+		MM_SLEEPLOCK_BACKOFF;
+}
 
-	mm_sleeplock_lock(&mgr->lock);
+int mm_eventmgr_signal(mm_event_t *event)
+{
+	mm_eventstate_t state = MM_EVENT_WAIT;
+	if (! __atomic_compare_exchange_n(&event->state, &state, MM_EVENT_READY, 0,
+	                                  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return 0;
 
-	if (event->state == MM_EVENT_NONE ||
-	    event->state == MM_EVENT_ACTIVE) {
-		mm_sleeplock_unlock(&mgr->lock);
+	/* event can be freed by the owner as soon as it is pushed */
+	mm_eventmgr_t *mgr = event->event_mgr;
+	mm_event_t *head = __atomic_load_n(&mgr->ready, __ATOMIC_RELAXED);
+	do {
+		event->next = head;
+	} while (! __atomic_compare_exchange_n(&mgr->ready, &head, event, 1,
+	                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	/* only the first event after a drain wakes up the machine */
+	if (head)
 		return 0;
-	}
-	int fd = 0;
-	if (mgr->count_ready == 0)
-		fd = mgr->fd.fd;
-	assert(event->state == MM_EVENT_WAIT);
-	mm_list_unlink(&event->link);
-	mgr->count_wait--;
-
-	event->state = MM_EVENT_READY;
-	mm_list_append(&mgr->list_ready, &event->link);
-	mgr->count_ready++;
-
-	mm_sleeplock_unlock(&mgr->lock);
-	return fd;
+	return mgr->fd.fd;
 }
 
 void mm_eventmgr_wakeup(int fd)
@@ -9,20 +9,22 @@
 
 typedef struct mm_eventmgr_t mm_eventmgr_t;
 
+/* Signaled events are pushed to the lock-free ready stack by any
+ * thread and taken all at once by the owner machine. Only a push to
+ * the empty stack writes the eventfd, so the machine is woken up
+ * once per drain, however many events it gets meanwhile. */
+
 struct mm_eventmgr_t
 {
-	mm_fd_t        fd;
-	mm_sleeplock_t lock;
-	mm_list_t      list_ready;
-	mm_list_t      list_wait;
-	int            count_ready;
-	int            count_wait;
+	mm_fd_t     fd;
+	mm_event_t *ready;
 };
 
 int  mm_eventmgr_init(mm_eventmgr_t*, mm_loop_t*);
 void mm_eventmgr_free(mm_eventmgr_t*, mm_loop_t*);
 void mm_eventmgr_add(mm_eventmgr_t*, mm_event_t*);
 int  mm_eventmgr_wait(mm_eventmgr_t*, mm_event_t*, uint32_t);
+void mm_eventmgr_cancel(mm_eventmgr_t*, mm_event_t*);
 int  mm_eventmgr_signal(mm_event_t*);
 void mm_eventmgr_wakeup(int);
 
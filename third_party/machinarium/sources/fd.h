@@ -17,14 +17,29 @@ enum
 
 typedef void (*mm_fd_callback_t)(mm_fd_t*);
 
+/* Edge-triggered fds are registered once for both directions,
+ * mask is the interest kept in userspace. Readiness reported by the
+ * poller is kept in ready until the owner drains the fd, that is gets
+ * EAGAIN or a short read or write. */
+
 struct mm_fd
 {
 	int               fd;
 	int               mask;
+	int               edge;
+	int               ready;
+	mm_list_t         link_ready;
 	mm_fd_callback_t  on_read;
 	void             *on_read_arg;
 	mm_fd_callback_t  on_write;
 	void             *on_write_arg;
+	void             *poll_data;
 };
 
+static inline void
+mm_fd_drained(mm_fd_t *fd, int mask)
+{
+	fd->ready &= ~mask;
+}
+
 #endif /* MM_FD_H */
@@ -25,6 +25,19 @@ machine_tls_create(void)
 	tls->ca_file   = NULL;
 	tls->cert_file = NULL;
 	tls->key_file  = NULL;
+	tls->session_cache_size = SSL_SESSION_CACHE_MAX_SIZE_DEFAULT;
+	tls->session_timeout    = 300;
+	tls->verify_cache_size    = 0;
+	tls->verify_cache_timeout = 300;
+	tls->verify_cache         = NULL;
+	tls->ktls               = 0;
+	tls->async              = 0;
+	tls->alpn      = NULL;
+	tls->alpn_len  = 0;
+	tls->session   = NULL;
+	tls->tls_ctx   = NULL;
+	pthread_mutex_init(&tls->session_lock, NULL);
+	pthread_mutex_init(&tls->verify_cache_lock, NULL);
 	return (machine_tls_t*)tls;
 }
 
@@ -49,6 +62,13 @@ machine_tls_create_context(machine_tls_t* obj, int is_client) {
 	SSL_CTX_set_mode(ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 	SSL_CTX_set_mode(ctx, SSL_MODE_RELEASE_BUFFERS);
 
+#ifdef MM_TLS_KTLS
+	/* let openssl move record encryption to the kernel after
+	 * handshake, if negotiated cipher is supported by it */
+	if (tls->ktls)
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
 	/* verify mode */
 	int verify = 0;
 	switch (tls->verify) {
@@ -64,6 +84,10 @@ machine_tls_create_context(machine_tls_t* obj, int is_client) {
 	}
 	SSL_CTX_set_verify(ctx, verify, NULL);
 	SSL_CTX_set_verify_depth(ctx, 6);
+	if (! is_client && tls->verify != MM_TLS_NONE && tls->verify_cache_size > 0) {
+		if (mm_tls_context_verify_cache(tls, ctx) == -1)
+			goto error;
+	}
 
 	/* cert file */
 	int rc;
@@ -99,6 +123,17 @@ machine_tls_create_context(machine_tls_t* obj, int is_client) {
 		}
 	}
 
+	/* application protocol, required from clients which offer any */
+	if (tls->alpn) {
+		if (is_client) {
+			rc = SSL_CTX_set_alpn_protos(ctx, tls->alpn, tls->alpn_len);
+			if (rc != 0)
+				goto error;
+		} else {
+			SSL_CTX_set_alpn_select_cb(ctx, mm_tls_alpn_select_cb, tls);
+		}
+	}
+
 	/* ocsp */
 
 	/* set ciphers */
@@ -108,22 +143,14 @@ machine_tls_create_context(machine_tls_t* obj, int is_client) {
 		// mm_tls_error(io, 0, "SSL_CTX_set_cipher_list()");
 		goto error;
 	}
-	if (! is_client ) {
-		unsigned char sid[SSL_MAX_SSL_SESSION_ID_LENGTH];
-		if (!RAND_bytes(sid, sizeof(sid))) {
-			//mm_tls_error(io, 0, "failed to generate session id");
-			goto error;
-		}
-		if (!SSL_CTX_set_session_id_context(ctx, sid, sizeof(sid))) {
-			//mm_tls_error(io, 0, "failed to set session id context");
-			goto error;
-		}
-
-
+	if (! is_client )
 		SSL_CTX_set_options(ctx, SSL_OP_CIPHER_SERVER_PREFERENCE);
-	}
 
+	/* session cache and tickets */
 	tls->tls_ctx = ctx;
+	rc = mm_tls_context_sessions(tls, is_client);
+	if (rc == -1)
+		goto error;
 
 	return 0;
 error:
@@ -133,6 +160,92 @@ error:
 	return -1;
 }
 
+MACHINE_API int
+machine_tls_set_session_cache(machine_tls_t *obj, int size, int timeout)
+{
+	mm_tls_t *tls = mm_cast(mm_tls_t*, obj);
+	if (size < 0 || timeout <= 0)
+		return -1;
+	tls->session_cache_size = size;
+	tls->session_timeout    = timeout;
+	return 0;
+}
+
+MACHINE_API int
+machine_tls_set_verify_cache(machine_tls_t *obj, int size, int timeout)
+{
+	mm_tls_t *tls = mm_cast(mm_tls_t*, obj);
+	if (size < 0 || timeout <= 0)
+		return -1;
+	tls->verify_cache_size    = size;
+	tls->verify_cache_timeout = timeout;
+	return 0;
+}
+
+MACHINE_API int
+machine_tls_set_ktls(machine_tls_t *obj, int enable)
+{
+	mm_tls_t *tls = mm_cast(mm_tls_t*, obj);
+#ifdef MM_TLS_KTLS
+	tls->ktls = enable;
+	return 0;
+#else
+	tls->ktls = 0;
+	return enable ? -1 : 0;
+#endif
+}
+
+MACHINE_API int
+machine_tls_set_async(machine_tls_t *obj, int enable)
+{
+	mm_tls_t *tls = mm_cast(mm_tls_t*, obj);
+#ifdef MM_TLS_ASYNC
+	tls->async = enable;
+	return 0;
+#else
+	tls->async = 0;
+	return enable ? -1 : 0;
+#endif
+}
+
+MACHINE_API int
+machine_tls_engine_load(char *name)
+{
+	/* called before machines are created */
+	return mm_tls_engine_load(name);
+}
+
+MACHINE_API int
+machine_tls_set_alpn(machine_tls_t *obj, char *protocol)
+{
+	mm_tls_t *tls = mm_cast(mm_tls_t*, obj);
+	mm_errno_set(0);
+	/* protocol list in wire format: length prefixed name */
+	size_t len = strlen(protocol);
+	if (len == 0 || len > 255) {
+		mm_errno_set(EINVAL);
+		return -1;
+	}
+	unsigned char *alpn = malloc(len + 1);
+	if (alpn == NULL) {
+		mm_errno_set(ENOMEM);
+		return -1;
+	}
+	alpn[0] = len;
+	memcpy(alpn + 1, protocol, len);
+	if (tls->alpn)
+		free(tls->alpn);
+	tls->alpn = alpn;
+	tls->alpn_len = len + 1;
+	return 0;
+}
+
+MACHINE_API void
+machine_tls_rotate_tickets(void)
+{
+	mm_tls_ticket_rotate();
+}
+
 MACHINE_API void
 machine_tls_free(machine_tls_t *obj)
 {
@@ -150,9 +263,17 @@ machine_tls_free(machine_tls_t *obj)
 		free(tls->cert_file);
 	if (tls->key_file)
 		free(tls->key_file);
-	free(tls);
+	if (tls->alpn)
+		free(tls->alpn);
+	if (tls->session)
+		SSL_SESSION_free(tls->session);
 	if (tls->tls_ctx)
 		SSL_CTX_free(tls->tls_ctx);
+	if (tls->verify_cache)
+		free(tls->verify_cache);
+	pthread_mutex_destroy(&tls->session_lock);
+	pthread_mutex_destroy(&tls->verify_cache_lock);
+	free(tls);
 }
 
 MACHINE_API int
@@ -280,6 +401,43 @@ machine_set_tls(machine_io_t *obj, machine_tls_t *tls, uint32_t timeout)
 	return mm_tls_handshake(io, timeout);
 }
 
+MACHINE_API int
+machine_set_compression(machine_io_t *obj, int level)
+{
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_errno_set(0);
+	if (io->compression) {
+		mm_errno_set(EINPROGRESS);
+		return -1;
+	}
+	int rc;
+	rc = mm_compression_create(io, level);
+	if (rc == -1) {
+		mm_errno_set(errno);
+		return -1;
+	}
+	return 0;
+}
+
+MACHINE_API int
+machine_io_is_compressed(machine_io_t *obj)
+{
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	return mm_compression_is_active(io);
+}
+
+static void
+mm_io_zerocopy_free(mm_io_t *io)
+{
+	mm_list_t *i, *n;
+	mm_list_foreach_safe(&io->zerocopy_hold, i, n) {
+		mm_msg_t *msg;
+		msg = mm_container_of(i, mm_msg_t, link);
+		machine_msg_free((machine_msg_t*)msg);
+	}
+	mm_list_init(&io->zerocopy_hold);
+}
+
 MACHINE_API machine_io_t*
 machine_io_create(void)
 {
@@ -291,6 +449,7 @@ machine_io_create(void)
 	}
 	memset(io, 0, sizeof(*io));
 	io->fd = -1;
+	mm_list_init(&io->zerocopy_hold);
 	mm_tls_init(io);
 	return (machine_io_t*)io;
 }
@@ -301,6 +460,8 @@ machine_io_free(machine_io_t *obj)
 	mm_io_t *io = mm_cast(mm_io_t*, obj);
 	mm_errno_set(0);
 	mm_tls_free(io);
+	mm_compression_free(io);
+	mm_io_zerocopy_free(io);
 	free(io);
 }
 
@@ -361,6 +522,228 @@ machine_set_keepalive(machine_io_t *obj, int enable, int delay)
 	return 0;
 }
 
+MACHINE_API int
+machine_set_reuseport(machine_io_t *obj, int enable)
+{
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_errno_set(0);
+	io->opt_reuseport = enable;
+	if (io->fd != -1) {
+		int rc;
+		rc = mm_socket_set_reuseport(io->fd, enable);
+		if (rc == -1) {
+			mm_errno_set(errno);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+MACHINE_API int
+machine_set_reuseport_cpu(machine_io_t *obj, int *cpus, int count)
+{
+	/* program is shared by the reuseport group of the socket,
+	 * set it after all sockets of the group are listening */
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_errno_set(0);
+	if (io->fd == -1) {
+		mm_errno_set(EBADF);
+		return -1;
+	}
+	int rc;
+	rc = mm_socket_set_reuseport_cpu(io->fd, cpus, count);
+	if (rc == -1) {
+		mm_errno_set(errno);
+		return -1;
+	}
+	return 0;
+}
+
+MACHINE_API int
+machine_set_incoming_cpu(machine_io_t *obj, int cpu)
+{
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_errno_set(0);
+	if (io->fd == -1) {
+		mm_errno_set(EBADF);
+		return -1;
+	}
+	int rc;
+	rc = mm_socket_set_incoming_cpu(io->fd, cpu);
+	if (rc == -1) {
+		mm_errno_set(errno);
+		return -1;
+	}
+	return 0;
+}
+
+MACHINE_API int
+machine_set_bufsize(machine_io_t *obj, int sndbuf, int rcvbuf)
+{
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_errno_set(0);
+	io->opt_sndbuf = sndbuf;
+	io->opt_rcvbuf = rcvbuf;
+	if (io->fd != -1) {
+		int rc;
+		rc = 0;
+		if (sndbuf > 0)
+			rc = mm_socket_set_sndbuf(io->fd, sndbuf);
+		if (rc == 0 && rcvbuf > 0)
+			rc = mm_socket_set_rcvbuf(io->fd, rcvbuf);
+		if (rc == -1) {
+			mm_errno_set(errno);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+MACHINE_API int
+machine_set_notsent_lowat(machine_io_t *obj, int size)
+{
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_errno_set(0);
+	io->opt_notsent_lowat = size;
+	if (io->fd != -1) {
+		int rc;
+		rc = mm_socket_set_notsent_lowat(io->fd, size);
+		if (rc == -1) {
+			mm_errno_set(errno);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+MACHINE_API int
+machine_set_user_timeout(machine_io_t *obj, int timeout)
+{
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_errno_set(0);
+	io->opt_user_timeout = timeout;
+	if (io->fd != -1) {
+		int rc;
+		rc = mm_socket_set_user_timeout(io->fd, timeout);
+		if (rc == -1) {
+			mm_errno_set(errno);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+MACHINE_API int
+machine_set_quickack(machine_io_t *obj, int enable)
+{
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_errno_set(0);
+	io->opt_quickack = enable;
+	if (io->fd != -1) {
+		int rc;
+		rc = mm_socket_set_quickack(io->fd, enable);
+		if (rc == -1) {
+			mm_errno_set(errno);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+MACHINE_API int
+machine_set_busy_poll(machine_io_t *obj, int usec)
+{
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_errno_set(0);
+	io->opt_busy_poll = usec;
+	if (io->fd != -1) {
+		int rc;
+		rc = mm_socket_set_busy_poll(io->fd, usec);
+		if (rc == -1) {
+			mm_errno_set(errno);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+MACHINE_API int
+machine_set_fastopen(machine_io_t *obj, int queue)
+{
+	/* applied to listen sockets on bind */
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_errno_set(0);
+	io->opt_fastopen = queue;
+	return 0;
+}
+
+MACHINE_API int
+machine_set_fastopen_connect(machine_io_t *obj, int enable)
+{
+	/* applied to tcp sockets on connect */
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_errno_set(0);
+	io->opt_fastopen_connect = enable;
+	return 0;
+}
+
+MACHINE_API int
+machine_set_zerocopy(machine_io_t *obj, int threshold)
+{
+	/* writes of at least threshold bytes are sent with
+	 * MSG_ZEROCOPY, zero disables */
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_errno_set(0);
+	io->opt_zerocopy = threshold;
+	if (io->fd != -1 && threshold > 0 && ! io->zerocopy &&
+	    ! io->is_unix_socket) {
+		int rc;
+		rc = mm_socket_set_zerocopy(io->fd, 1);
+		if (rc == -1) {
+			mm_errno_set(errno);
+			return -1;
+		}
+		io->zerocopy = 1;
+	}
+	return 0;
+}
+
+MACHINE_API int
+machine_zerocopy_pending(machine_io_t *obj)
+{
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_io_zerocopy_reap(io);
+	return io->zerocopy_sent - io->zerocopy_done;
+}
+
+MACHINE_API void
+machine_zerocopy_hold(machine_io_t *obj, machine_msg_t *obj_msg)
+{
+	/* message is freed once all zero-copy sends made so far
+	 * are completed */
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_msg_t *msg = mm_cast(mm_msg_t*, obj_msg);
+	if (io->zerocopy_sent == io->zerocopy_done) {
+		machine_msg_free(obj_msg);
+		return;
+	}
+	mm_list_append(&io->zerocopy_hold, &msg->link);
+}
+
+void mm_io_zerocopy_reap(mm_io_t *io)
+{
+	if (io->zerocopy_sent == io->zerocopy_done || io->fd == -1)
+		return;
+	int copied = 0;
+	mm_socket_zerocopy_reap(io->fd, &io->zerocopy_done, &copied);
+	/* kernel copied the data anyway (loopback or unsupported
+	 * device), so pinning pages only adds notification cost */
+	if (copied)
+		io->opt_zerocopy = 0;
+	if (io->zerocopy_sent == io->zerocopy_done)
+		mm_io_zerocopy_free(io);
+}
+
 MACHINE_API int
 machine_io_attach(machine_io_t *obj)
 {
@@ -370,6 +753,9 @@ machine_io_attach(machine_io_t *obj)
 		mm_errno_set(EINPROGRESS);
 		return -1;
 	}
+	/* socket stays registered while attached, interest toggles
+	 * of read and write start and stop make no syscalls */
+	io->handle.edge = 1;
 	int rc;
 	rc = mm_loop_add(&mm_self->loop, &io->handle, 0);
 	if (rc == -1) {
@@ -399,6 +785,98 @@ machine_io_detach(machine_io_t *obj)
 	return 0;
 }
 
+MACHINE_API int
+machine_io_is_ktls(machine_io_t *obj)
+{
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	int flags = 0;
+	if (io->tls_ktls_send)
+		flags |= MACHINE_KTLS_SEND;
+	if (io->tls_ktls_recv)
+		flags |= MACHINE_KTLS_RECV;
+	return flags;
+}
+
+MACHINE_API int
+machine_io_is_alpn(machine_io_t *obj)
+{
+	/* application protocol has been negotiated by tls handshake */
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	if (! mm_tls_is_active(io))
+		return 0;
+	const unsigned char *data = NULL;
+	unsigned int len = 0;
+	SSL_get0_alpn_selected(io->tls_ssl, &data, &len);
+	return len > 0;
+}
+
+MACHINE_API int
+machine_io_can_splice(machine_io_t *obj, int write)
+{
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	if (mm_compression_is_active(io))
+		return 0;
+	if (! mm_tls_is_active(io))
+		return 1;
+	/* with kernel tls offload socket carries plain data */
+	if (write)
+		return io->tls_ktls_send;
+	return io->tls_ktls_recv && !mm_tls_read_pending(io);
+}
+
+MACHINE_API int
+machine_pipe_create(int *fds)
+{
+	mm_errno_set(0);
+	int rc;
+	rc = mm_socket_pipe(fds);
+	if (rc == -1)
+		mm_errno_set(errno);
+	return rc;
+}
+
+MACHINE_API int
+machine_socketpair(machine_io_t **a, machine_io_t **b)
+{
+	mm_errno_set(0);
+	int fds[2];
+	int rc;
+	rc = mm_socket_pair(fds);
+	if (rc == -1) {
+		mm_errno_set(errno);
+		return -1;
+	}
+	mm_io_t *ends[2] = { NULL, NULL };
+	int i;
+	for (i = 0; i < 2; i++) {
+		ends[i] = (mm_io_t*)machine_io_create();
+		if (ends[i] == NULL)
+			goto error;
+		ends[i]->is_unix_socket = 1;
+		rc = mm_io_socket_set_accepted(ends[i], fds[i]);
+		if (rc == -1)
+			goto error;
+		ends[i]->connected = 1;
+	}
+	*a = (machine_io_t*)ends[0];
+	*b = (machine_io_t*)ends[1];
+	return 0;
+error:
+	for (i = 0; i < 2; i++)
+		if (ends[i])
+			machine_io_free((machine_io_t*)ends[i]);
+	close(fds[0]);
+	close(fds[1]);
+	return -1;
+}
+
+MACHINE_API void
+machine_pipe_free(int *fds)
+{
+	close(fds[0]);
+	close(fds[1]);
+}
+
 MACHINE_API int
 machine_io_verify(machine_io_t *obj, char *common_name)
 {
@@ -415,14 +893,22 @@ machine_io_verify(machine_io_t *obj, char *common_name)
 
 int mm_io_socket_set(mm_io_t *io, int fd)
 {
-	io->fd = fd;
 	int rc;
-	rc = mm_socket_set_nosigpipe(io->fd, 1);
+	rc = mm_socket_set_nonblock(fd, 1);
 	if (rc == -1) {
 		mm_errno_set(errno);
+		io->fd = fd;
 		return -1;
 	}
-	rc = mm_socket_set_nonblock(io->fd, 1);
+	return mm_io_socket_set_accepted(io, fd);
+}
+
+int mm_io_socket_set_accepted(mm_io_t *io, int fd)
+{
+	/* socket is accepted with SOCK_NONBLOCK */
+	io->fd = fd;
+	int rc;
+	rc = mm_socket_set_nosigpipe(io->fd, 1);
 	if (rc == -1) {
 		mm_errno_set(errno);
 		return -1;
@@ -442,6 +928,54 @@ int mm_io_socket_set(mm_io_t *io, int fd)
 				return -1;
 			}
 		}
+		if (io->opt_notsent_lowat > 0) {
+			rc = mm_socket_set_notsent_lowat(io->fd, io->opt_notsent_lowat);
+			if (rc == -1) {
+				mm_errno_set(errno);
+				return -1;
+			}
+		}
+		if (io->opt_user_timeout > 0) {
+			rc = mm_socket_set_user_timeout(io->fd, io->opt_user_timeout);
+			if (rc == -1) {
+				mm_errno_set(errno);
+				return -1;
+			}
+		}
+		if (io->opt_quickack) {
+			rc = mm_socket_set_quickack(io->fd, 1);
+			if (rc == -1) {
+				mm_errno_set(errno);
+				return -1;
+			}
+		}
+	}
+	if (io->opt_sndbuf > 0) {
+		rc = mm_socket_set_sndbuf(io->fd, io->opt_sndbuf);
+		if (rc == -1) {
+			mm_errno_set(errno);
+			return -1;
+		}
+	}
+	if (io->opt_rcvbuf > 0) {
+		rc = mm_socket_set_rcvbuf(io->fd, io->opt_rcvbuf);
+		if (rc == -1) {
+			mm_errno_set(errno);
+			return -1;
+		}
+	}
+	if (io->opt_busy_poll > 0) {
+		rc = mm_socket_set_busy_poll(io->fd, io->opt_busy_poll);
+		if (rc == -1) {
+			mm_errno_set(errno);
+			return -1;
+		}
+	}
+	if (io->opt_zerocopy > 0 && ! io->is_unix_socket) {
+		/* kernels without SO_ZEROCOPY keep copying writes */
+		rc = mm_socket_set_zerocopy(io->fd, 1);
+		if (rc == 0)
+			io->zerocopy = 1;
 	}
 	io->handle.fd = io->fd;
 	return 0;
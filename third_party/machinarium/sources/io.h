@@ -7,8 +7,9 @@
  * cooperative multitasking engine.
 */
 
-typedef struct mm_tls mm_tls_t;
-typedef struct mm_io  mm_io_t;
+typedef struct mm_tls         mm_tls_t;
+typedef struct mm_io          mm_io_t;
+typedef struct mm_compression mm_compression_t;
 
 typedef enum
 {
@@ -17,6 +18,13 @@ typedef enum
 	MM_TLS_PEER_STRICT
 } mm_tlsverify_t;
 
+/* verified client certificate, by sha256 of its der encoding */
+typedef struct
+{
+	unsigned char digest[32];
+	time_t        expire;
+} mm_tls_verified_t;
+
 struct mm_tls
 {
 	mm_tlsverify_t     verify;
@@ -26,6 +34,18 @@ struct mm_tls
 	char              *ca_file;
 	char              *cert_file;
 	char              *key_file;
+	int                session_cache_size;
+	int                session_timeout;
+	int                verify_cache_size;
+	int                verify_cache_timeout;
+	pthread_mutex_t    verify_cache_lock;
+	mm_tls_verified_t *verify_cache;
+	int                ktls;
+	int                async;
+	unsigned char     *alpn;
+	int                alpn_len;
+	pthread_mutex_t    session_lock;
+	SSL_SESSION       *session;
 	SSL_CTX           *tls_ctx;
 };
 
@@ -39,11 +59,35 @@ struct mm_io
 	int             opt_nodelay;
 	int             opt_keepalive;
 	int             opt_keepalive_delay;
+	int             opt_reuseport;
+	int             opt_sndbuf;
+	int             opt_rcvbuf;
+	int             opt_notsent_lowat;
+	int             opt_user_timeout;
+	int             opt_quickack;
+	int             opt_busy_poll;
+	int             opt_fastopen;
+	int             opt_fastopen_connect;
+	int             opt_zerocopy;
+	/* zerocopy */
+	int             zerocopy;
+	uint32_t        zerocopy_sent;
+	uint32_t        zerocopy_done;
+	mm_list_t       zerocopy_hold;
 	/* tls */
 	mm_tls_t       *tls;
 	SSL            *tls_ssl;
+	int             tls_ktls_send;
+	int             tls_ktls_recv;
+	mm_fd_t         tls_async_handle;
+	int             tls_async_wait;
+	char           *tls_stage;
+	int             tls_stage_pending;
+	int             tls_stage_used;
 	int             tls_error;
 	char            tls_error_msg[128];
+	/* compression */
+	mm_compression_t *compression;
 	/* connect */
 	int             connected;
 	/* accept */
@@ -56,6 +100,8 @@ struct mm_io
 };
 
 int mm_io_socket_set(mm_io_t*, int);
+int mm_io_socket_set_accepted(mm_io_t*, int);
 int mm_io_socket(mm_io_t*, struct sockaddr*);
+void mm_io_zerocopy_reap(mm_io_t*);
 
 #endif /* MM_IO_H */
@@ -0,0 +1,64 @@
+#ifndef MM_IO_STAT_H
+#define MM_IO_STAT_H
+
+/*
+ * machinarium.
+ *
+ * cooperative multitasking engine.
+*/
+
+/* Counters are updated by the machine only and never reset,
+ * readers take differences. */
+typedef machine_io_stat_t mm_iostat_t;
+
+static inline int
+mm_iostat_eagain(int errno_)
+{
+	return errno_ == EAGAIN || errno_ == EWOULDBLOCK;
+}
+
+static inline void
+mm_iostat_read(mm_iostat_t *stat, ssize_t rc)
+{
+	stat->count_read++;
+	if (rc > 0)
+		stat->bytes_read += rc;
+	else if (rc == -1 && mm_iostat_eagain(errno))
+		stat->count_read_eagain++;
+}
+
+static inline void
+mm_iostat_write(mm_iostat_t *stat, ssize_t rc, size_t size, int vector)
+{
+	if (vector)
+		stat->count_writev++;
+	else
+		stat->count_write++;
+	if (rc > 0) {
+		stat->bytes_write += rc;
+		if ((size_t)rc < size)
+			stat->count_write_partial++;
+	} else if (rc == -1 && mm_iostat_eagain(errno)) {
+		stat->count_write_eagain++;
+	}
+}
+
+static inline void
+mm_iostat_splice(mm_iostat_t *stat, ssize_t rc)
+{
+	stat->count_splice++;
+	if (rc > 0)
+		stat->bytes_splice += rc;
+}
+
+static inline void
+mm_iostat_poll(mm_iostat_t *stat, int events)
+{
+	stat->count_poll++;
+	if (events > 0)
+		stat->count_poll_events += events;
+	else
+		stat->count_poll_empty++;
+}
+
+#endif /* MM_IO_STAT_H */
@@ -0,0 +1,540 @@
+
+/*
+ * machinarium.
+ *
+ * cooperative multitasking engine.
+*/
+
+#include <machinarium.h>
+#include <machinarium_private.h>
+
+#ifdef HAVE_IO_URING
+
+/*
+ * io_uring poll backend.
+ *
+ * Readiness is tracked by one-shot IORING_OP_POLL_ADD requests which are
+ * armed separately for read and write and re-armed after each completion,
+ * which gives epoll level-triggered semantics. Submission queue entries are
+ * only queued by add/read/write/del calls and are submitted together with
+ * the completion wait, so each loop step costs a single io_uring_enter().
+*/
+
+typedef struct mm_iouring    mm_iouring_t;
+typedef struct mm_iouring_fd mm_iouring_fd_t;
+
+enum
+{
+	MM_IOURING_DATA_IGNORE  = 0,
+	MM_IOURING_DATA_TIMEOUT = 1
+};
+
+struct mm_iouring_fd
+{
+	mm_fd_t *fd;
+	int      dir;
+	int      inflight;
+	int      cancel;
+	int      dispatch;
+	/* removed pairs waiting for completions, first slot only */
+	mm_list_t link;
+};
+
+struct mm_iouring
+{
+	mm_poll_t                poll;
+	int                      fd;
+	int                      count;
+	int                      pending;
+	unsigned                 sq_entries;
+	unsigned                *sq_head;
+	unsigned                *sq_tail;
+	unsigned                *sq_mask;
+	unsigned                *sq_array;
+	struct io_uring_sqe     *sqes;
+	unsigned                *cq_head;
+	unsigned                *cq_tail;
+	unsigned                *cq_mask;
+	struct io_uring_cqe     *cqes;
+	void                    *sq_ring;
+	size_t                   sq_ring_size;
+	void                    *cq_ring;
+	size_t                   cq_ring_size;
+	size_t                   sqes_size;
+	struct __kernel_timespec timeout;
+	mm_list_t                removed;
+};
+
+static inline int
+mm_iouring_setup(unsigned entries, struct io_uring_params *params)
+{
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static inline int
+mm_iouring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                 unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+	               NULL, 0);
+}
+
+static int
+mm_iouring_flush(mm_iouring_t *ring)
+{
+	while (ring->pending > 0) {
+		int rc;
+		rc = mm_iouring_enter(ring->fd, ring->pending, 0, 0);
+		if (rc == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		ring->pending -= rc;
+	}
+	return 0;
+}
+
+static struct io_uring_sqe*
+mm_iouring_sqe(mm_iouring_t *ring)
+{
+	unsigned head;
+	unsigned tail = *ring->sq_tail;
+	head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if ((tail - head) >= ring->sq_entries) {
+		/* submission queue is full */
+		int rc = mm_iouring_flush(ring);
+		if (rc == -1)
+			return NULL;
+		head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		if ((tail - head) >= ring->sq_entries)
+			return NULL;
+	}
+	unsigned idx = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[idx] = idx;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->pending++;
+	return sqe;
+}
+
+static inline int
+mm_iouring_arm(mm_iouring_t *ring, mm_iouring_fd_t *slot, int dir)
+{
+	struct io_uring_sqe *sqe = mm_iouring_sqe(ring);
+	if (sqe == NULL)
+		return -1;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = slot->fd->fd;
+	sqe->poll32_events = (dir == 0) ? POLLIN : POLLOUT;
+	sqe->user_data = (uint64_t)(uintptr_t)slot;
+	slot->inflight = 1;
+	slot->cancel = 0;
+	return 0;
+}
+
+static inline int
+mm_iouring_cancel(mm_iouring_t *ring, mm_iouring_fd_t *slot)
+{
+	if (! slot->inflight || slot->cancel)
+		return 0;
+	struct io_uring_sqe *sqe = mm_iouring_sqe(ring);
+	if (sqe == NULL)
+		return -1;
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)(uintptr_t)slot;
+	sqe->user_data = MM_IOURING_DATA_IGNORE;
+	slot->cancel = 1;
+	return 0;
+}
+
+static inline int
+mm_iouring_slot_free(mm_iouring_fd_t *slots)
+{
+	if (slots[0].inflight || slots[0].dispatch ||
+	    slots[1].inflight || slots[1].dispatch)
+		return 0;
+	mm_list_unlink(&slots[0].link);
+	free(slots);
+	return 1;
+}
+
+static inline int
+mm_iouring_update(mm_iouring_t *ring, mm_iouring_fd_t *slots, int dir,
+                  int enable)
+{
+	mm_iouring_fd_t *slot = &slots[dir];
+	if (enable) {
+		/* cancelled or handled requests are re-armed on completion */
+		if (slot->inflight || slot->dispatch)
+			return 0;
+		return mm_iouring_arm(ring, slot, dir);
+	}
+	return mm_iouring_cancel(ring, slot);
+}
+
+static mm_poll_t*
+mm_iouring_create(void)
+{
+	mm_iouring_t *ring;
+	ring = malloc(sizeof(mm_iouring_t));
+	if (ring == NULL)
+		return NULL;
+	memset(ring, 0, sizeof(*ring));
+	ring->poll.iface = &mm_iouring_if;
+	mm_list_init(&ring->removed);
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ring->fd = mm_iouring_setup(1024, &params);
+	if (ring->fd == -1) {
+		free(ring);
+		return NULL;
+	}
+
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ|PROT_WRITE,
+	                     MAP_SHARED|MAP_POPULATE, ring->fd,
+	                     IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED)
+		goto error;
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ|PROT_WRITE,
+		                     MAP_SHARED|MAP_POPULATE, ring->fd,
+		                     IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) {
+			ring->cq_ring = NULL;
+			goto error;
+		}
+	}
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ|PROT_WRITE,
+	                  MAP_SHARED|MAP_POPULATE, ring->fd,
+	                  IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto error;
+	}
+
+	char *sq = ring->sq_ring;
+	ring->sq_entries = params.sq_entries;
+	ring->sq_head    = (unsigned*)(sq + params.sq_off.head);
+	ring->sq_tail    = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask    = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_array   = (unsigned*)(sq + params.sq_off.array);
+	char *cq = ring->cq_ring;
+	ring->cq_head    = (unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail    = (unsigned*)(cq + params.cq_off.tail);
+	ring->cq_mask    = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes       = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	return &ring->poll;
+
+error:
+	if (ring->sq_ring != MAP_FAILED) {
+		if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+			munmap(ring->cq_ring, ring->cq_ring_size);
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	}
+	close(ring->fd);
+	free(ring);
+	return NULL;
+}
+
+static void
+mm_iouring_free(mm_poll_t *poll)
+{
+	free(poll);
+}
+
+static int
+mm_iouring_shutdown(mm_poll_t *poll)
+{
+	mm_iouring_t *ring = (mm_iouring_t*)poll;
+	if (ring->fd == -1)
+		return 0;
+	/* completions of removed fds will never be reaped now */
+	mm_list_t *i, *n;
+	mm_list_foreach_safe(&ring->removed, i, n) {
+		mm_iouring_fd_t *slots;
+		slots = mm_container_of(i, mm_iouring_fd_t, link);
+		free(slots);
+	}
+	mm_list_init(&ring->removed);
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+	ring->fd = -1;
+	return 0;
+}
+
+static inline void
+mm_iouring_complete(mm_iouring_t *ring, struct io_uring_cqe *cqe)
+{
+	if (cqe->user_data == MM_IOURING_DATA_IGNORE ||
+	    cqe->user_data == MM_IOURING_DATA_TIMEOUT)
+		return;
+
+	/* user_data points to the read or write slot of the pair
+	 * referenced by mm_fd_t->poll_data */
+	mm_iouring_fd_t *slot = (mm_iouring_fd_t*)(uintptr_t)cqe->user_data;
+	mm_iouring_fd_t *slots = slot - slot->dir;
+	int dir = slot->dir;
+	slot->inflight = 0;
+	slot->cancel = 0;
+
+	/* fd is removed, free the pair on its last completion */
+	mm_fd_t *fd = slot->fd;
+	if (fd == NULL) {
+		mm_iouring_slot_free(slots);
+		return;
+	}
+
+	int mask = (dir == 0) ? MM_R : MM_W;
+	if (! (fd->mask & mask))
+		return;
+
+	if (cqe->res != -ECANCELED) {
+		slot->dispatch = 1;
+		if (dir == 0) {
+			if (fd->on_read)
+				fd->on_read(fd);
+		} else {
+			if (fd->on_write)
+				fd->on_write(fd);
+		}
+		slot->dispatch = 0;
+		/* fd could be removed by the callback */
+		if (slot->fd == NULL) {
+			mm_iouring_slot_free(slots);
+			return;
+		}
+		if (! (fd->mask & mask))
+			return;
+		/* poll error is reported once, the callback sees it by
+		 * the following read or write. Direction is armed again
+		 * only when it is modified */
+		if (cqe->res < 0)
+			return;
+	}
+	mm_iouring_arm(ring, slot, dir);
+}
+
+static int
+mm_iouring_step(mm_poll_t *poll, int timeout)
+{
+	mm_iouring_t *ring = (mm_iouring_t*)poll;
+	if (ring->count == 0 && ring->pending == 0)
+		return 0;
+
+	unsigned head = *ring->cq_head;
+	unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+	/* submit all queued requests and wait for completions by the
+	 * single system call */
+	unsigned min_complete = 0;
+	unsigned flags = 0;
+	if (head == tail && timeout != 0) {
+		if (timeout > 0) {
+			struct io_uring_sqe *sqe = mm_iouring_sqe(ring);
+			if (sqe) {
+				ring->timeout.tv_sec  = timeout / 1000;
+				ring->timeout.tv_nsec = (timeout % 1000) * 1000000;
+				sqe->opcode = IORING_OP_TIMEOUT;
+				sqe->fd = -1;
+				sqe->addr = (uint64_t)(uintptr_t)&ring->timeout;
+				sqe->len = 1;
+				/* complete on first event or timeout */
+				sqe->off = 1;
+				sqe->user_data = MM_IOURING_DATA_TIMEOUT;
+			}
+		}
+		min_complete = 1;
+		flags = IORING_ENTER_GETEVENTS;
+	}
+	int rc;
+	rc = mm_iouring_enter(ring->fd, ring->pending, min_complete, flags);
+	if (rc == -1) {
+		if (errno != EINTR && errno != EBUSY && errno != EAGAIN)
+			return -1;
+	} else {
+		ring->pending -= rc;
+	}
+
+	int count = 0;
+	head = *ring->cq_head;
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+		struct io_uring_cqe *cqe;
+		cqe = &ring->cqes[head & *ring->cq_mask];
+		struct io_uring_cqe event = *cqe;
+		head++;
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+		mm_iouring_complete(ring, &event);
+		count++;
+	}
+	mm_iostat_poll(&mm_self->loop.iostat, count);
+	return count;
+}
+
+static int
+mm_iouring_add(mm_poll_t *poll, mm_fd_t *fd, int mask)
+{
+	mm_iouring_t *ring = (mm_iouring_t*)poll;
+	mm_iouring_fd_t *slots;
+	slots = malloc(sizeof(mm_iouring_fd_t) * 2);
+	if (slots == NULL)
+		return -1;
+	memset(slots, 0, sizeof(mm_iouring_fd_t) * 2);
+	slots[0].fd = fd;
+	slots[1].fd = fd;
+	slots[1].dir = 1;
+	mm_list_init(&slots[0].link);
+	fd->poll_data = slots;
+	fd->mask = mask;
+	int rc;
+	if (mask & MM_R) {
+		rc = mm_iouring_update(ring, slots, 0, 1);
+		if (rc == -1)
+			goto error;
+	}
+	if (mask & MM_W) {
+		rc = mm_iouring_update(ring, slots, 1, 1);
+		if (rc == -1)
+			goto error;
+	}
+	ring->count++;
+	return 0;
+error:
+	fd->poll_data = NULL;
+	fd->mask = 0;
+	free(slots);
+	return -1;
+}
+
+static inline int
+mm_iouring_modify(mm_poll_t *poll, mm_fd_t *fd, int mask)
+{
+	mm_iouring_t *ring = (mm_iouring_t*)poll;
+	mm_iouring_fd_t *slots = fd->poll_data;
+	int rc;
+	fd->mask = mask;
+	rc = mm_iouring_update(ring, slots, 0, mask & MM_R);
+	if (rc == -1)
+		return -1;
+	return mm_iouring_update(ring, slots, 1, mask & MM_W);
+}
+
+static int
+mm_iouring_read(mm_poll_t *poll,
+                mm_fd_t *fd,
+                mm_fd_callback_t on_read, void *arg,
+                int enable)
+{
+	int mask = fd->mask;
+	if (enable)
+		mask |= MM_R;
+	else
+		mask &= ~MM_R;
+	fd->on_read = on_read;
+	fd->on_read_arg = arg;
+	if (mask == fd->mask)
+		return 0;
+	return mm_iouring_modify(poll, fd, mask);
+}
+
+static int
+mm_iouring_write(mm_poll_t *poll,
+                 mm_fd_t *fd,
+                 mm_fd_callback_t on_write, void *arg,
+                 int enable)
+{
+	int mask = fd->mask;
+	if (enable)
+		mask |= MM_W;
+	else
+		mask &= ~MM_W;
+	fd->on_write = on_write;
+	fd->on_write_arg = arg;
+	if (mask == fd->mask)
+		return 0;
+	return mm_iouring_modify(poll, fd, mask);
+}
+
+static int
+mm_iouring_read_write(mm_poll_t *poll,
+                      mm_fd_t *fd,
+                      mm_fd_callback_t on_event, void *arg,
+                      int enable)
+{
+	int mask = fd->mask;
+	if (enable)
+		mask |= MM_W|MM_R;
+	else
+		mask &= ~(MM_W|MM_R);
+	fd->on_write = on_event;
+	fd->on_write_arg = arg;
+	fd->on_read = on_event;
+	fd->on_read_arg = arg;
+	if (mask == fd->mask)
+		return 0;
+	return mm_iouring_modify(poll, fd, mask);
+}
+
+static int
+mm_iouring_del(mm_poll_t *poll, mm_fd_t *fd)
+{
+	mm_iouring_t *ring = (mm_iouring_t*)poll;
+	mm_iouring_fd_t *slots = fd->poll_data;
+	fd->mask = 0;
+	fd->on_write = NULL;
+	fd->on_write_arg = NULL;
+	fd->on_read = NULL;
+	fd->on_read_arg = NULL;
+	fd->poll_data = NULL;
+	ring->count--;
+	assert(ring->count >= 0);
+	if (slots == NULL)
+		return 0;
+	/* slots are freed on the last pending completion */
+	int rc;
+	rc  = mm_iouring_cancel(ring, &slots[0]);
+	rc |= mm_iouring_cancel(ring, &slots[1]);
+	slots[0].fd = NULL;
+	slots[1].fd = NULL;
+	if (! mm_iouring_slot_free(slots))
+		mm_list_append(&ring->removed, &slots[0].link);
+	/* file descriptor is going to be closed right after, make sure
+	 * kernel has seen the removal */
+	if (mm_iouring_flush(ring) == -1)
+		rc = -1;
+	return rc;
+}
+
+mm_pollif_t mm_iouring_if =
+{
+	.name       = "io_uring",
+	.create     = mm_iouring_create,
+	.free       = mm_iouring_free,
+	.shutdown   = mm_iouring_shutdown,
+	.step       = mm_iouring_step,
+	.add        = mm_iouring_add,
+	.read       = mm_iouring_read,
+	.write      = mm_iouring_write,
+	.read_write = mm_iouring_read_write,
+	.del        = mm_iouring_del
+};
+
+#endif /* HAVE_IO_URING */
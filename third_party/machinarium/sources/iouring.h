@@ -0,0 +1,14 @@
+#ifndef MM_IOURING_H
+#define MM_IOURING_H
+
+/*
+ * machinarium.
+ *
+ * cooperative multitasking engine.
+*/
+
+#ifdef HAVE_IO_URING
+extern mm_pollif_t mm_iouring_if;
+#endif
+
+#endif /* MM_IOURING_H */
@@ -56,3 +56,32 @@ machine_iov_pending(machine_iov_t *obj)
 	mm_iov_t *iov = mm_cast(mm_iov_t*, obj);
 	return mm_iov_pending(iov);
 }
+
+MACHINE_API int
+machine_iov_size(machine_iov_t *obj)
+{
+	mm_iov_t *iov = mm_cast(mm_iov_t*, obj);
+	return iov->size;
+}
+
+MACHINE_API int
+machine_iov_read(machine_iov_t *obj, void *buf, int size)
+{
+	/* copy pending data out, it is consumed as if written */
+	mm_iov_t *iov = mm_cast(mm_iov_t*, obj);
+	struct iovec *iovec = mm_iov_pos(iov);
+	int count = iov->iov_count;
+	int pos = 0;
+	while (count > 0 && pos < size) {
+		int len = iovec->iov_len;
+		if (len > size - pos)
+			len = size - pos;
+		memcpy((char*)buf + pos, iovec->iov_base, len);
+		pos += len;
+		iovec++;
+		count--;
+	}
+	if (pos > 0)
+		mm_iov_advance(iov, pos);
+	return pos;
+}
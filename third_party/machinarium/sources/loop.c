@@ -8,14 +8,43 @@
 #include <machinarium.h>
 #include <machinarium_private.h>
 
+static mm_pollif_t *mm_loop_pollers[] =
+{
+	&mm_epoll_if,
+#ifdef HAVE_IO_URING
+	&mm_iouring_if,
+#endif
+	NULL
+};
+
+mm_pollif_t *mm_loop_poll_of(char *name)
+{
+	int i = 0;
+	for (; mm_loop_pollers[i]; i++) {
+		if (strcmp(mm_loop_pollers[i]->name, name) == 0)
+			return mm_loop_pollers[i];
+	}
+	return NULL;
+}
+
 int mm_loop_init(mm_loop_t *loop)
 {
-	loop->poll = mm_epoll_if.create();
+	mm_pollif_t *iface = machinarium.config.poller;
+	if (iface == NULL)
+		iface = &mm_epoll_if;
+	loop->poll = iface->create();
+	/* io_uring can be disabled or unsupported by the kernel */
+	if (loop->poll == NULL && iface != &mm_epoll_if)
+		loop->poll = mm_epoll_if.create();
 	if (loop->poll == NULL)
 		return -1;
 	mm_clock_init(&loop->clock);
 	mm_clock_update(&loop->clock);
+	mm_loopstat_init(&loop->stat, loop->clock.time_ns);
+	loop->clock.stat = &loop->stat;
+	memset(&loop->iostat, 0, sizeof(loop->iostat));
 	memset(&loop->idle, 0, sizeof(loop->idle));
+	loop->time_busy = 0;
 	return 0;
 }
 
@@ -30,6 +59,98 @@ int mm_loop_shutdown(mm_loop_t *loop)
 	return 0;
 }
 
+void mm_loop_stat(mm_loop_t *loop, machine_loop_stat_t *result)
+{
+	mm_loopstat_t *stat = &loop->stat;
+	memset(result, 0, sizeof(*result));
+	uint64_t now = mm_clock_gettime();
+	result->interval_us  = (now - stat->time_start) / 1000;
+	result->count_step   = stat->count_step;
+	result->count_events = stat->count_events;
+	result->events_max   = stat->events_max;
+	result->ready_max    = stat->ready_max;
+	result->step_max_us  = stat->step_max;
+	result->count_lag    = stat->count_lag;
+	result->lag_max_us   = stat->lag_max;
+	result->count_spin     = stat->count_spin;
+	result->count_spin_hit = stat->count_spin_hit;
+	result->spin_us        = stat->spin_time / 1000;
+	result->count_sleep    = stat->count_sleep;
+	result->count_wakeup   = stat->count_wakeup;
+	if (stat->count_step > 0) {
+		result->ready_avg   = stat->ready_sum / stat->count_step;
+		result->step_avg_us = stat->step_time / stat->count_step;
+		result->step_p99_us =
+			mm_loopstat_hgram_quantile(stat->step_hgram, stat->count_step,
+			                           0.99, stat->step_max);
+	}
+	if (stat->count_lag > 0) {
+		result->lag_avg_us = stat->lag_time / stat->count_lag;
+		result->lag_p99_us =
+			mm_loopstat_hgram_quantile(stat->lag_hgram, stat->count_lag,
+			                           0.99, stat->lag_max);
+	}
+
+	/* start the next interval, keep the current step going */
+	uint64_t time_poll = stat->time_poll;
+	int poll_events = stat->poll_events;
+	mm_loopstat_init(stat, now);
+	stat->time_poll = time_poll;
+	stat->poll_events = poll_events;
+}
+
+static inline int
+mm_loop_spin(mm_loop_t *loop, int *timeout)
+{
+	/* spin on non-blocking poll before going to sleep, but no
+	 * longer than the next timer. Yield between polls, so spinning
+	 * does not starve other threads sharing the cpu */
+	mm_loopstat_t *stat = &loop->stat;
+	uint64_t spin = machinarium.config.poll_spin;
+	if (*timeout > 0 && spin > (uint64_t)*timeout * 1000)
+		spin = (uint64_t)*timeout * 1000;
+	uint64_t start = mm_clock_gettime();
+	uint64_t deadline = start + spin * 1000;
+	uint64_t now;
+	int rc;
+	stat->count_spin++;
+	for (;;) {
+		rc = loop->poll->iface->step(loop->poll, 0);
+		now = mm_clock_gettime();
+		if (rc != 0 || now >= deadline)
+			break;
+		sched_yield();
+	}
+	stat->spin_time += now - start;
+	if (rc > 0)
+		stat->count_spin_hit++;
+	if (*timeout > 0) {
+		*timeout -= (now - start) / 1000000;
+		if (*timeout < 0)
+			*timeout = 0;
+	}
+	return rc;
+}
+
+static inline int
+mm_loop_poll(mm_loop_t *loop, int timeout)
+{
+	mm_loopstat_t *stat = &loop->stat;
+	int rc;
+	if (machinarium.config.poll_spin > 0 && timeout != 0) {
+		rc = mm_loop_spin(loop, &timeout);
+		if (rc != 0 || timeout == 0)
+			return rc;
+	}
+	if (timeout == 0)
+		return loop->poll->iface->step(loop->poll, 0);
+	stat->count_sleep++;
+	rc = loop->poll->iface->step(loop->poll, timeout);
+	if (rc > 0)
+		stat->count_wakeup++;
+	return rc;
+}
+
 int mm_loop_step(mm_loop_t *loop)
 {
 	/* update clock time */
@@ -47,23 +168,31 @@ int mm_loop_step(mm_loop_t *loop)
 
 	/* get minimal timer timeout */
 	int timeout = UINT32_MAX;
-	mm_timer_t *next;
-	next = mm_clock_timer_min(&loop->clock);
-	if (next) {
-		int64_t diff = next->timeout - loop->clock.time_ms;
-		if (diff <= 0)
-			timeout = 0;
-		else
-			timeout = diff;
-	}
+	int next;
+	next = mm_clock_timeout(&loop->clock);
+	if (next >= 0)
+		timeout = next;
 
 	/* run timers */
 	mm_clock_step(&loop->clock);
 
+	/* time since the previous poll returned, spent running
+	 * woken up coroutines and timers */
+	mm_loopstat_t *stat = &loop->stat;
+	if (stat->time_poll) {
+		uint64_t now = mm_clock_gettime();
+		mm_loopstat_step(stat, (now - stat->time_poll) / 1000,
+		                 stat->poll_events);
+	}
+
 	/* poll for events */
-	rc = loop->poll->iface->step(loop->poll, timeout);
+	loop->time_busy = 0;
+	rc = mm_loop_poll(loop, timeout);
 	if (rc == -1)
 		return -1;
+	stat->poll_events = rc;
+	stat->time_poll = mm_clock_gettime();
+	loop->time_busy = stat->time_poll;
 
 	return 0;
 }
@@ -11,14 +11,21 @@ typedef struct mm_loop mm_loop_t;
 
 struct mm_loop
 {
-	mm_clock_t clock;
-	mm_idle_t  idle;
-	mm_poll_t *poll;
+	mm_clock_t    clock;
+	mm_idle_t     idle;
+	mm_poll_t    *poll;
+	mm_loopstat_t stat;
+	mm_iostat_t   iostat;
+	/* time the last poll returned, zero while in poll */
+	volatile uint64_t time_busy;
 };
 
+mm_pollif_t *mm_loop_poll_of(char*);
+
 int mm_loop_init(mm_loop_t*);
 int mm_loop_shutdown(mm_loop_t*);
 int mm_loop_step(mm_loop_t*);
+void mm_loop_stat(mm_loop_t*, machine_loop_stat_t*);
 
 static inline void
 mm_loop_set_idle(mm_loop_t *loop, mm_idle_callback_t cb, void *arg)
@@ -0,0 +1,113 @@
+#ifndef MM_LOOP_STAT_H
+#define MM_LOOP_STAT_H
+
+/*
+ * machinarium.
+ *
+ * cooperative multitasking engine.
+*/
+
+typedef struct mm_loopstat mm_loopstat_t;
+
+/* Durations are kept in power of two histograms of usec,
+ * bucket i counts values in [2^(i-1), 2^i). Stats are
+ * collected for the interval since the last read. */
+#define MM_LOOPSTAT_HGRAM 32
+
+struct mm_loopstat
+{
+	uint64_t time_start;
+	uint64_t time_poll;
+	int      poll_events;
+	uint64_t count_step;
+	uint64_t count_events;
+	uint64_t events_max;
+	uint64_t ready_sum;
+	uint64_t ready_max;
+	uint64_t step_time;
+	uint64_t step_max;
+	uint32_t step_hgram[MM_LOOPSTAT_HGRAM];
+	uint64_t count_lag;
+	uint64_t lag_time;
+	uint64_t lag_max;
+	uint32_t lag_hgram[MM_LOOPSTAT_HGRAM];
+	uint64_t count_spin;
+	uint64_t count_spin_hit;
+	uint64_t spin_time;
+	uint64_t count_sleep;
+	uint64_t count_wakeup;
+};
+
+static inline void
+mm_loopstat_init(mm_loopstat_t *stat, uint64_t now_ns)
+{
+	memset(stat, 0, sizeof(*stat));
+	stat->time_start = now_ns;
+}
+
+static inline void
+mm_loopstat_hgram_add(uint32_t *hgram, uint64_t value_us)
+{
+	int bucket = 0;
+	if (value_us > 0)
+		bucket = 64 - __builtin_clzll(value_us);
+	if (bucket >= MM_LOOPSTAT_HGRAM)
+		bucket = MM_LOOPSTAT_HGRAM - 1;
+	hgram[bucket]++;
+}
+
+static inline uint64_t
+mm_loopstat_hgram_quantile(uint32_t *hgram, uint64_t count, double quantile,
+                           uint64_t max)
+{
+	/* upper bound of the bucket, but never above the maximum */
+	uint64_t rank = (uint64_t)(count * quantile + 0.5);
+	if (rank == 0)
+		rank = 1;
+	uint64_t total = 0;
+	int i;
+	for (i = 0; i < MM_LOOPSTAT_HGRAM; i++) {
+		total += hgram[i];
+		if (total >= rank)
+			break;
+	}
+	if (i == 0)
+		return 0;
+	uint64_t value = (1ULL << i) - 1;
+	return value > max ? max : value;
+}
+
+static inline void
+mm_loopstat_ready(mm_loopstat_t *stat, int ready)
+{
+	stat->ready_sum += ready;
+	if ((uint64_t)ready > stat->ready_max)
+		stat->ready_max = ready;
+}
+
+static inline void
+mm_loopstat_step(mm_loopstat_t *stat, uint64_t time_us, int events)
+{
+	stat->count_step++;
+	stat->step_time += time_us;
+	if (time_us > stat->step_max)
+		stat->step_max = time_us;
+	mm_loopstat_hgram_add(stat->step_hgram, time_us);
+	if (events > 0) {
+		stat->count_events += events;
+		if ((uint64_t)events > stat->events_max)
+			stat->events_max = events;
+	}
+}
+
+static inline void
+mm_loopstat_lag(mm_loopstat_t *stat, uint64_t time_us)
+{
+	stat->count_lag++;
+	stat->lag_time += time_us;
+	if (time_us > stat->lag_max)
+		stat->lag_max = time_us;
+	mm_loopstat_hgram_add(stat->lag_hgram, time_us);
+}
+
+#endif /* MM_LOOP_STAT_H */
@@ -33,17 +33,97 @@ typedef void (*machine_coroutine_t)(void *arg);
 /* library handles */
 
 typedef struct machine_cond_private    machine_cond_t;
+typedef struct machine_notify_private  machine_notify_t;
 typedef struct machine_msg_private     machine_msg_t;
 typedef struct machine_channel_private machine_channel_t;
 typedef struct machine_tls_private     machine_tls_t;
 typedef struct machine_iov_private     machine_iov_t;
 typedef struct machine_io_private      machine_io_t;
 
+/* event loop stats of a machine */
+
+typedef struct
+{
+	uint64_t interval_us;
+	uint64_t count_step;
+	uint64_t count_events;
+	uint64_t events_max;
+	uint64_t ready_avg;
+	uint64_t ready_max;
+	uint64_t step_avg_us;
+	uint64_t step_p99_us;
+	uint64_t step_max_us;
+	uint64_t count_lag;
+	uint64_t lag_avg_us;
+	uint64_t lag_p99_us;
+	uint64_t lag_max_us;
+	uint64_t count_spin;
+	uint64_t count_spin_hit;
+	uint64_t spin_us;
+	uint64_t count_sleep;
+	uint64_t count_wakeup;
+} machine_loop_stat_t;
+
+/* socket io counters of a machine since its start, tls and
+ * compressed io count a call as one read or write */
+
+typedef struct
+{
+	uint64_t count_read;
+	uint64_t count_read_eagain;
+	uint64_t bytes_read;
+	uint64_t count_write;
+	uint64_t count_writev;
+	uint64_t count_write_eagain;
+	uint64_t count_write_partial;
+	uint64_t bytes_write;
+	uint64_t count_splice;
+	uint64_t bytes_splice;
+	uint64_t count_poll;
+	uint64_t count_poll_empty;
+	uint64_t count_poll_events;
+} machine_io_stat_t;
+
+/* loop stall of a machine reported by the watchdog thread:
+ * coroutine which was running and frames of its stack */
+
+#define MACHINE_STALL_FRAMES 32
+
+typedef struct
+{
+	uint64_t             machine_id;
+	char                 machine_name[16];
+	uint64_t             duration_us;
+	uint64_t             coroutine_id;
+	machine_coroutine_t  function;
+	void                *function_arg;
+	int                  frames_count;
+	void                *frames[MACHINE_STALL_FRAMES];
+} machine_stall_t;
+
+typedef void (*machine_stall_cb_t)(machine_stall_t*, void *arg);
+
+/* stack usage of finished coroutines by function, in bytes */
+
+typedef struct
+{
+	machine_coroutine_t function;
+	uint64_t            count;
+	uint64_t            used_sum;
+	uint64_t            used_max;
+} machine_stack_stat_t;
+
 /* configuration */
 
 MACHINE_API void
 machinarium_set_stack_size(int size);
 
+MACHINE_API void
+machinarium_set_stack_hugepages(int enable);
+
+MACHINE_API void
+machinarium_set_stack_watermark(int enable);
+
 MACHINE_API void
 machinarium_set_pool_size(int size);
 
@@ -53,6 +133,30 @@ machinarium_set_coroutine_cache_size(int size);
 MACHINE_API void
 machinarium_set_msg_cache_gc_size(int size);
 
+MACHINE_API void
+machinarium_set_msg_cache_class_limit(int limit);
+
+MACHINE_API void
+machinarium_set_coroutine_accounting(int enable);
+
+MACHINE_API int
+machinarium_set_poller(char *name);
+
+MACHINE_API void
+machinarium_set_poll_spin(int usec);
+
+MACHINE_API int
+machinarium_set_resolver(char *name);
+
+MACHINE_API int
+machinarium_set_clock(char *name);
+
+MACHINE_API char*
+machinarium_clock(void);
+
+MACHINE_API void
+machinarium_set_watchdog(int threshold_ms, machine_stall_cb_t, void *arg);
+
 /* main */
 
 MACHINE_API int
@@ -90,7 +194,31 @@ machine_stat(uint64_t *coroutine_count,
              uint64_t *msg_allocated,
              uint64_t *msg_cache_count,
              uint64_t *msg_cache_gc_count,
-             uint64_t *msg_cache_size);
+             uint64_t *msg_cache_size,
+             uint64_t *msg_remote_count,
+             uint64_t *msg_returned_count);
+
+MACHINE_API void
+machine_stat_loop(machine_loop_stat_t *stat);
+
+MACHINE_API void
+machine_stat_io(machine_io_stat_t *stat);
+
+MACHINE_API int
+machine_stat_stack(machine_stack_stat_t *stats, int max);
+
+MACHINE_API int
+machine_stat_coroutine(uint64_t *time_run_us,
+                       uint64_t *time_wait_us,
+                       uint64_t *count_switch);
+
+MACHINE_API int
+machine_stat_msg_class(int id,
+                       uint64_t *class_size,
+                       uint64_t *msg_allocated,
+                       uint64_t *msg_cache_gc_count,
+                       uint64_t *msg_cache_count,
+                       uint64_t *msg_cache_size);
 
 /* signals */
 
@@ -102,12 +230,18 @@ machine_signal_wait(uint32_t time_ms);
 
 /* coroutine */
 
+MACHINE_API int
+machine_set_affinity(int *cpus, int count);
+
 MACHINE_API int64_t
 machine_coroutine_create(machine_coroutine_t, void *arg);
 
 MACHINE_API void
 machine_sleep(uint32_t time_ms);
 
+MACHINE_API int
+machine_stack_release(void);
+
 MACHINE_API int
 machine_join(uint64_t coroutine_id);
 
@@ -117,6 +251,13 @@ machine_cancel(uint64_t coroutine_id);
 MACHINE_API int
 machine_cancelled(void);
 
+#define MACHINE_PRIORITY_HIGH   0
+#define MACHINE_PRIORITY_NORMAL 1
+#define MACHINE_PRIORITY_LOW    2
+
+MACHINE_API int
+machine_set_priority(int priority);
+
 MACHINE_API int
 machine_timedout(void);
 
@@ -143,6 +284,26 @@ machine_cond_try(machine_cond_t*);
 MACHINE_API int
 machine_cond_wait(machine_cond_t*, uint32_t time_ms);
 
+/* notify */
+
+MACHINE_API machine_notify_t*
+machine_notify_create(void);
+
+MACHINE_API void
+machine_notify_free(machine_notify_t*);
+
+MACHINE_API void
+machine_notify_start(machine_notify_t*, machine_cond_t*);
+
+MACHINE_API void
+machine_notify_stop(machine_notify_t*);
+
+MACHINE_API void
+machine_notify_signal(machine_notify_t*);
+
+MACHINE_API int
+machine_notify_read(machine_notify_t*);
+
 /* msg */
 
 MACHINE_API machine_msg_t*
@@ -151,6 +312,12 @@ machine_msg_create(int reserve);
 MACHINE_API machine_msg_t*
 machine_msg_create_or_advance(machine_msg_t*, int size);
 
+MACHINE_API machine_msg_t*
+machine_msg_create_ring(int size);
+
+MACHINE_API int
+machine_msg_ring_size(int size);
+
 MACHINE_API void
 machine_msg_free(machine_msg_t*);
 
@@ -169,6 +336,9 @@ machine_msg_size(machine_msg_t*);
 MACHINE_API int
 machine_msg_write(machine_msg_t*, void *buf, int size);
 
+MACHINE_API void*
+machine_msg_reserve(machine_msg_t*, int size);
+
 /* channel */
 
 MACHINE_API machine_channel_t*
@@ -215,6 +385,27 @@ machine_tls_set_cert_file(machine_tls_t*, char*);
 MACHINE_API int
 machine_tls_set_key_file(machine_tls_t*, char*);
 
+MACHINE_API int
+machine_tls_set_session_cache(machine_tls_t*, int size, int timeout);
+
+MACHINE_API int
+machine_tls_set_verify_cache(machine_tls_t*, int size, int timeout);
+
+MACHINE_API int
+machine_tls_set_ktls(machine_tls_t*, int enable);
+
+MACHINE_API int
+machine_tls_set_alpn(machine_tls_t*, char *protocol);
+
+MACHINE_API int
+machine_tls_set_async(machine_tls_t*, int enable);
+
+MACHINE_API int
+machine_tls_engine_load(char *name);
+
+MACHINE_API void
+machine_tls_rotate_tickets(void);
+
 /* io control */
 
 MACHINE_API machine_io_t*
@@ -241,12 +432,80 @@ machine_set_nodelay(machine_io_t*, int enable);
 MACHINE_API int
 machine_set_keepalive(machine_io_t*, int enable, int delay);
 
+MACHINE_API int
+machine_set_reuseport(machine_io_t*, int enable);
+
+MACHINE_API int
+machine_set_reuseport_cpu(machine_io_t*, int *cpus, int count);
+
+MACHINE_API int
+machine_set_incoming_cpu(machine_io_t*, int cpu);
+
+MACHINE_API int
+machine_set_bufsize(machine_io_t*, int sndbuf, int rcvbuf);
+
+MACHINE_API int
+machine_set_notsent_lowat(machine_io_t*, int size);
+
+MACHINE_API int
+machine_set_user_timeout(machine_io_t*, int timeout);
+
+MACHINE_API int
+machine_set_quickack(machine_io_t*, int enable);
+
+MACHINE_API int
+machine_set_busy_poll(machine_io_t*, int usec);
+
+MACHINE_API int
+machine_set_fastopen(machine_io_t*, int queue);
+
+MACHINE_API int
+machine_set_fastopen_connect(machine_io_t*, int enable);
+
+MACHINE_API int
+machine_set_zerocopy(machine_io_t*, int threshold);
+
+MACHINE_API int
+machine_zerocopy_pending(machine_io_t*);
+
+MACHINE_API void
+machine_zerocopy_hold(machine_io_t*, machine_msg_t*);
+
 MACHINE_API int
 machine_set_tls(machine_io_t*, machine_tls_t*, uint32_t);
 
 MACHINE_API int
 machine_io_verify(machine_io_t*, char *common_name);
 
+MACHINE_API int
+machine_set_compression(machine_io_t*, int level);
+
+MACHINE_API int
+machine_io_is_compressed(machine_io_t*);
+
+#define MACHINE_KTLS_SEND 1
+#define MACHINE_KTLS_RECV 2
+
+MACHINE_API int
+machine_io_is_ktls(machine_io_t*);
+
+MACHINE_API int
+machine_io_is_alpn(machine_io_t*);
+
+MACHINE_API int
+machine_io_can_splice(machine_io_t*, int write);
+
+/* pipe */
+
+MACHINE_API int
+machine_pipe_create(int *fds);
+
+MACHINE_API void
+machine_pipe_free(int *fds);
+
+MACHINE_API int
+machine_socketpair(machine_io_t **a, machine_io_t **b);
+
 /* dns */
 
 MACHINE_API int
@@ -255,6 +514,9 @@ machine_getsockname(machine_io_t*, struct sockaddr*, int*);
 MACHINE_API int
 machine_getpeername(machine_io_t*, struct sockaddr*, int*);
 
+MACHINE_API int
+machine_getpeereid(machine_io_t*, uid_t*, gid_t*);
+
 MACHINE_API int
 machine_getaddrinfo(char *addr, char *service,
                     struct addrinfo *hints,
@@ -266,15 +528,28 @@ machine_getaddrinfo(char *addr, char *service,
 MACHINE_API int
 machine_connect(machine_io_t*, struct sockaddr*, uint32_t time_ms);
 
+MACHINE_API int
+machine_connect_fd(machine_io_t*, int fd);
+
 MACHINE_API int
 machine_connected(machine_io_t*);
 
 MACHINE_API int
 machine_bind(machine_io_t*, struct sockaddr*);
 
+MACHINE_API int
+machine_bind_fd(machine_io_t*, int fd);
+
+MACHINE_API int
+machine_listen(machine_io_t*, int backlog);
+
 MACHINE_API int
 machine_accept(machine_io_t*, machine_io_t**, int backlog, int attach, uint32_t time_ms);
 
+MACHINE_API int
+machine_accept_batch(machine_io_t*, machine_io_t**, int count, int backlog,
+                     int attach, uint32_t time_ms);
+
 MACHINE_API int
 machine_eventfd(machine_io_t*);
 
@@ -298,6 +573,12 @@ machine_iov_add(machine_iov_t*, machine_msg_t*);
 MACHINE_API int
 machine_iov_pending(machine_iov_t*);
 
+MACHINE_API int
+machine_iov_size(machine_iov_t*);
+
+MACHINE_API int
+machine_iov_read(machine_iov_t*, void*, int);
+
 /* read */
 
 MACHINE_API int
@@ -312,9 +593,15 @@ machine_read_stop(machine_io_t*);
 MACHINE_API ssize_t
 machine_read_raw(machine_io_t*, void*, size_t);
 
+MACHINE_API ssize_t
+machine_splice_read_raw(machine_io_t*, int pipe_fd, size_t);
+
 MACHINE_API machine_msg_t*
 machine_read(machine_io_t*, size_t, uint32_t time_ms);
 
+MACHINE_API ssize_t
+machine_peek(machine_io_t*, void*, size_t, uint32_t time_ms);
+
 /* write */
 
 MACHINE_API int
@@ -329,6 +616,12 @@ machine_write_raw(machine_io_t*, void*, size_t);
 MACHINE_API ssize_t
 machine_writev_raw(machine_io_t*, machine_iov_t*);
 
+MACHINE_API ssize_t
+machine_writev_raw_more(machine_io_t*, machine_iov_t*);
+
+MACHINE_API ssize_t
+machine_splice_write_raw(machine_io_t*, int pipe_fd, size_t);
+
 MACHINE_API int
 machine_write(machine_io_t*, machine_msg_t*, uint32_t time_ms);
 
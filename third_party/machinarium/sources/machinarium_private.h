@@ -20,6 +20,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/mman.h>
@@ -32,6 +33,11 @@
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/signalfd.h>
+#include <sys/poll.h>
+#include <sys/syscall.h>
+#include <execinfo.h>
+#include <linux/filter.h>
+#include <linux/errqueue.h>
 
 #include <openssl/opensslv.h>
 #include <openssl/ssl.h>
@@ -40,8 +46,25 @@
 #include <openssl/conf.h>
 #include <openssl/bio.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#include <openssl/provider.h>
+#endif
 
 #include "build.h"
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #include "macro.h"
 #include "util.h"
 #include "sleep_lock.h"
@@ -51,10 +74,13 @@
 #include "fd.h"
 #include "poll.h"
 #include "timer.h"
+#include "loop_stat.h"
+#include "io_stat.h"
 #include "clock.h"
 #include "idle.h"
 #include "loop.h"
 #include "epoll.h"
+#include "iouring.h"
 #include "socket.h"
 
 #include "context_stack.h"
@@ -70,6 +96,7 @@
 #include "cond.h"
 #include "event.h"
 #include "event_mgr.h"
+#include "notify.h"
 
 #include "msg.h"
 #include "msg_cache.h"
@@ -79,14 +106,18 @@
 
 #include "task.h"
 #include "task_mgr.h"
+#include "resolver.h"
 
 #include "machine.h"
 #include "machine_mgr.h"
+#include "watchdog.h"
+#include "stack_stat.h"
 #include "mm.h"
 
 #include "iov.h"
 #include "io.h"
 #include "tls.h"
+#include "compression.h"
 
 #include "lrand48.h"
 
@@ -14,7 +14,13 @@ static int
 mm_idle_cb(mm_idle_t *handle)
 {
 	(void)handle;
+	mm_loopstat_ready(&mm_self->loop.stat, mm_self->scheduler.count_ready);
 	mm_scheduler_run(&mm_self->scheduler, &mm_self->coroutine_cache);
+
+	/* return messages of other machines before the loop sleeps */
+	if (mm_self->msg_cache.remote_count > 0 &&
+	    mm_self->scheduler.count_ready == 0)
+		mm_msgcache_flush(&mm_self->msg_cache);
 	return mm_scheduler_online(&mm_self->scheduler);
 }
 
@@ -29,6 +35,7 @@ machine_free(mm_machine_t *machine)
 	mm_signalmgr_free(&machine->signal_mgr, &machine->loop);
 	mm_loop_shutdown(&machine->loop);
 	mm_scheduler_free(&machine->scheduler);
+	mm_contextstack_arena_free(&machine->stack_arena);
 }
 
 static void*
@@ -50,6 +57,11 @@ machine_main(void *arg)
 	id = machine_coroutine_create(machine->main, machine->main_arg);
 	(void)id;
 
+	/* loop stalls are reported without frames, if the alternate
+	 * signal stack can not be allocated */
+	if (machinarium.config.watchdog_ms > 0)
+		mm_watchdog_attach(machine);
+
 	/* run main loop */
 	machine->online = 1;
 	for (;;) {
@@ -59,6 +71,7 @@ machine_main(void *arg)
 	}
 
 	machine->online = 0;
+	mm_watchdog_detach(machine);
 	machine_free(machine);
 	return NULL;
 }
@@ -75,6 +88,9 @@ machine_create(char *name, machine_coroutine_t function, void *arg)
 	machine->main = function;
 	machine->main_arg = arg;
 	machine->name = NULL;
+	machine->stall_state = MM_STALL_IDLE;
+	machine->stall_reported = 0;
+	machine->stall_stack = NULL;
 	if (name) {
 		machine->name = strdup(name);
 		if (machine->name == NULL) {
@@ -87,10 +103,16 @@ machine_create(char *name, machine_coroutine_t function, void *arg)
 	mm_msgcache_init(&machine->msg_cache);
 	mm_msgcache_set_gc_watermark(&machine->msg_cache,
 	                              machinarium.config.msg_cache_gc_size);
+	mm_msgcache_set_class_limit(&machine->msg_cache,
+	                            machinarium.config.msg_cache_class_limit);
 
+	mm_contextstack_arena_init(&machine->stack_arena,
+	                           machinarium.config.stack_size * machinarium.config.page_size,
+	                           machinarium.config.page_size,
+	                           machinarium.config.stack_hugepages);
+	machine->stack_arena.watermark = machinarium.config.stack_watermark;
 	mm_coroutine_cache_init(&machine->coroutine_cache,
-	                        machinarium.config.stack_size * machinarium.config.page_size,
-	                        machinarium.config.page_size,
+	                        &machine->stack_arena,
 	                        machinarium.config.coroutine_cache_size);
 
 	mm_scheduler_init(&machine->scheduler);
@@ -118,7 +140,7 @@ machine_create(char *name, machine_coroutine_t function, void *arg)
 		return -1;
 	}
 	mm_machinemgr_add(&machinarium.machine_mgr, machine);
-	rc = mm_thread_create(&machine->thread, PTHREAD_STACK_MIN, machine_main, machine);
+	rc = mm_thread_create(&machine->thread, MM_MACHINE_STACK_SIZE, machine_main, machine);
 	if (rc == -1) {
 		mm_machinemgr_delete(&machinarium.machine_mgr, machine);
 		mm_eventmgr_free(&machine->event_mgr, &machine->loop);
@@ -133,12 +155,18 @@ machine_create(char *name, machine_coroutine_t function, void *arg)
 MACHINE_API int
 machine_wait(uint64_t machine_id)
 {
+	/* machine stays registered until its thread is joined, so
+	 * messages it allocated are still returned to its cache */
+	mm_machinemgr_t *mgr = &machinarium.machine_mgr;
 	mm_machine_t *machine;
-	machine = mm_machinemgr_delete_by_id(&machinarium.machine_mgr, machine_id);
+	mm_machinemgr_lock(mgr);
+	machine = mm_machinemgr_find(mgr, machine_id);
+	mm_machinemgr_unlock(mgr);
 	if (machine == NULL)
 		return -1;
 	int rc;
 	rc = mm_thread_join(&machine->thread);
+	mm_machinemgr_delete(mgr, machine);
 	if (machine->name)
 		free(machine->name);
 	free(machine);
@@ -163,6 +191,31 @@ machine_stop(void)
 	mm_self->online = 0;
 }
 
+MACHINE_API int
+machine_set_affinity(int *cpus, int count)
+{
+	/* memory is allocated by the machine thread itself, so the first
+	 * touch policy keeps it local to the node of these cpus */
+	mm_errno_set(0);
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	int i;
+	for (i = 0; i < count; i++) {
+		if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE) {
+			mm_errno_set(EINVAL);
+			return -1;
+		}
+		CPU_SET(cpus[i], &set);
+	}
+	int rc;
+	rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (rc != 0) {
+		mm_errno_set(rc);
+		return -1;
+	}
+	return 0;
+}
+
 MACHINE_API int64_t
 machine_coroutine_create(machine_coroutine_t function, void *arg)
 {
@@ -177,6 +230,16 @@ machine_coroutine_create(machine_coroutine_t function, void *arg)
 	return coroutine->id;
 }
 
+MACHINE_API int
+machine_stack_release(void)
+{
+	/* unused part of the stack is below any local variable */
+	mm_coroutine_t *current;
+	current = mm_scheduler_current(&mm_self->scheduler);
+	char marker;
+	return mm_contextstack_shrink(&current->stack, &marker);
+}
+
 MACHINE_API void
 machine_sleep(uint32_t time_ms)
 {
@@ -226,6 +289,28 @@ machine_cancelled(void)
 	return coroutine->cancel > 0;
 }
 
+MACHINE_API int
+machine_set_priority(int priority)
+{
+	if (priority < MACHINE_PRIORITY_HIGH || priority > MACHINE_PRIORITY_LOW) {
+		mm_errno_set(EINVAL);
+		return -1;
+	}
+	mm_coroutine_t *coroutine;
+	coroutine = mm_scheduler_current(&mm_self->scheduler);
+	if (coroutine == NULL)
+		return -1;
+	/* move to the new queue, if already woken up */
+	if (coroutine->state == MM_CREADY) {
+		mm_scheduler_set(&mm_self->scheduler, coroutine, MM_CACTIVE);
+		coroutine->priority = priority;
+		mm_scheduler_set(&mm_self->scheduler, coroutine, MM_CREADY);
+		return 0;
+	}
+	coroutine->priority = priority;
+	return 0;
+}
+
 MACHINE_API int
 machine_timedout(void)
 {
@@ -258,12 +343,70 @@ machine_stat(uint64_t *coroutine_count,
              uint64_t *msg_allocated,
              uint64_t *msg_cache_count,
              uint64_t *msg_cache_gc_count,
-             uint64_t *msg_cache_size)
+             uint64_t *msg_cache_size,
+             uint64_t *msg_remote_count,
+             uint64_t *msg_returned_count)
 {
 	mm_coroutine_cache_stat(&mm_self->coroutine_cache,
 	                        coroutine_count,
 	                        coroutine_cache_count);
 
 	mm_msgcache_stat(&mm_self->msg_cache, msg_allocated, msg_cache_gc_count,
-	                 msg_cache_count, msg_cache_size);
+	                 msg_cache_count, msg_cache_size, msg_remote_count,
+	                 msg_returned_count);
+}
+
+MACHINE_API void
+machine_stat_loop(machine_loop_stat_t *stat)
+{
+	/* stats of the interval since the previous call */
+	mm_loop_stat(&mm_self->loop, stat);
+}
+
+MACHINE_API void
+machine_stat_io(machine_io_stat_t *stat)
+{
+	/* counters since the machine start */
+	*stat = mm_self->loop.iostat;
+}
+
+MACHINE_API int
+machine_stat_stack(machine_stack_stat_t *stats, int max)
+{
+	/* all machines since start */
+	if (! machinarium.config.stack_watermark)
+		return -1;
+	return mm_stackstat_copy(&machinarium.stack_stat, stats, max);
+}
+
+MACHINE_API int
+machine_stat_coroutine(uint64_t *time_run_us,
+                       uint64_t *time_wait_us,
+                       uint64_t *count_switch)
+{
+	mm_scheduler_t *scheduler = &mm_self->scheduler;
+	if (! scheduler->accounting)
+		return -1;
+	/* include the current slice of the calling coroutine */
+	mm_coroutine_t *current = mm_scheduler_current(scheduler);
+	uint64_t now = mm_clock_gettime();
+	current->time_run += now - scheduler->time_switch;
+	scheduler->time_switch = now;
+	*time_run_us  = current->time_run / 1000;
+	*time_wait_us = current->time_wait / 1000;
+	*count_switch = current->count_switch;
+	return 0;
+}
+
+MACHINE_API int
+machine_stat_msg_class(int id,
+                       uint64_t *class_size,
+                       uint64_t *msg_allocated,
+                       uint64_t *msg_cache_gc_count,
+                       uint64_t *msg_cache_count,
+                       uint64_t *msg_cache_size)
+{
+	return mm_msgcache_class_stat(&mm_self->msg_cache, id, class_size,
+	                              msg_allocated, msg_cache_gc_count,
+	                              msg_cache_count, msg_cache_size);
 }
@@ -9,21 +9,31 @@
 
 typedef struct mm_machine mm_machine_t;
 
+/* machine thread stack is used by event callbacks, tls handshake
+ * callback needs more than PTHREAD_STACK_MIN for private key
+ * operations */
+#define MM_MACHINE_STACK_SIZE (1024 * 1024)
+
 struct mm_machine
 {
-	int                  online;
-	uint64_t             id;
-	char                *name;
-	machine_coroutine_t  main;
-	void                *main_arg;
-	mm_thread_t          thread;
-	mm_scheduler_t       scheduler;
-	mm_signalmgr_t       signal_mgr;
-	mm_eventmgr_t        event_mgr;
-	mm_msgcache_t        msg_cache;
-	mm_coroutine_cache_t coroutine_cache;
-	mm_loop_t            loop;
-	mm_list_t            link;
+	int                     online;
+	uint64_t                id;
+	char                   *name;
+	machine_coroutine_t     main;
+	void                   *main_arg;
+	mm_thread_t             thread;
+	mm_scheduler_t          scheduler;
+	mm_signalmgr_t          signal_mgr;
+	mm_eventmgr_t           event_mgr;
+	mm_msgcache_t           msg_cache;
+	mm_contextstack_arena_t stack_arena;
+	mm_coroutine_cache_t    coroutine_cache;
+	mm_loop_t               loop;
+	volatile int            stall_state;
+	uint64_t                stall_reported;
+	machine_stall_t         stall;
+	void                   *stall_stack;
+	mm_list_t               link;
 };
 
 extern __thread mm_machine_t *mm_self;
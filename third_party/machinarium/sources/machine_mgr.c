@@ -65,3 +65,17 @@ mm_machinemgr_delete_by_id(mm_machinemgr_t *mgr, uint64_t id)
 	pthread_spin_unlock(&mgr->lock);
 	return NULL;
 }
+
+mm_machine_t*
+mm_machinemgr_find(mm_machinemgr_t *mgr, uint64_t id)
+{
+	/* machine is not freed while the lock is held */
+	mm_list_t *i;
+	mm_list_foreach(&mgr->list, i) {
+		mm_machine_t *machine;
+		machine = mm_container_of(i, mm_machine_t, link);
+		if (machine->id == id)
+			return machine;
+	}
+	return NULL;
+}
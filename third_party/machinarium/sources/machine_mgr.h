@@ -24,5 +24,19 @@ void mm_machinemgr_add(mm_machinemgr_t*, mm_machine_t*);
 void mm_machinemgr_delete(mm_machinemgr_t*, mm_machine_t*);
 mm_machine_t*
 mm_machinemgr_delete_by_id(mm_machinemgr_t*, uint64_t);
+mm_machine_t*
+mm_machinemgr_find(mm_machinemgr_t*, uint64_t);
+
+static inline void
+mm_machinemgr_lock(mm_machinemgr_t *mgr)
+{
+	pthread_spin_lock(&mgr->lock);
+}
+
+static inline void
+mm_machinemgr_unlock(mm_machinemgr_t *mgr)
+{
+	pthread_spin_unlock(&mgr->lock);
+}
 
 #endif /* MM_MACHINE_MGR_H */
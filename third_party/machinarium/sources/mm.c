@@ -9,9 +9,20 @@
 #include <machinarium_private.h>
 
 static int machinarium_stack_size = 0;
+static int machinarium_stack_hugepages = 0;
+static int machinarium_stack_watermark = 0;
 static int machinarium_pool_size = 0;
 static int machinarium_coroutine_cache_size = 0;
 static int machinarium_msg_cache_gc_size = 0;
+static int machinarium_msg_cache_class_limit = 0;
+static int machinarium_coroutine_accounting = 0;
+static mm_pollif_t *machinarium_poller = NULL;
+static int machinarium_poll_spin = 0;
+static int machinarium_clock_source = MM_CLOCK_MONOTONIC;
+static int machinarium_resolver = MM_RESOLVER_THREAD;
+static int machinarium_watchdog_ms = 0;
+static machine_stall_cb_t machinarium_watchdog_cb = NULL;
+static void *machinarium_watchdog_arg = NULL;
 static int machinarium_initialized = 0;
 mm_t       machinarium;
 
@@ -27,6 +38,18 @@ machinarium_set_stack_size(int size)
 	machinarium_stack_size = size;
 }
 
+MACHINE_API void
+machinarium_set_stack_hugepages(int enable)
+{
+	machinarium_stack_hugepages = enable;
+}
+
+MACHINE_API void
+machinarium_set_stack_watermark(int enable)
+{
+	machinarium_stack_watermark = enable;
+}
+
 MACHINE_API void
 machinarium_set_pool_size(int size)
 {
@@ -45,6 +68,88 @@ machinarium_set_msg_cache_gc_size(int size)
 	machinarium_msg_cache_gc_size = size;
 }
 
+MACHINE_API void
+machinarium_set_msg_cache_class_limit(int limit)
+{
+	machinarium_msg_cache_class_limit = limit;
+}
+
+MACHINE_API void
+machinarium_set_coroutine_accounting(int enable)
+{
+	machinarium_coroutine_accounting = enable;
+}
+
+MACHINE_API int
+machinarium_set_poller(char *name)
+{
+	mm_pollif_t *iface;
+	iface = mm_loop_poll_of(name);
+	if (iface == NULL)
+		return -1;
+	machinarium_poller = iface;
+	return 0;
+}
+
+MACHINE_API void
+machinarium_set_poll_spin(int usec)
+{
+	machinarium_poll_spin = usec;
+}
+
+MACHINE_API int
+machinarium_set_clock(char *name)
+{
+	if (strcmp(name, "monotonic") == 0) {
+		machinarium_clock_source = MM_CLOCK_MONOTONIC;
+		return 0;
+	}
+	if (strcmp(name, "coarse") == 0) {
+		machinarium_clock_source = MM_CLOCK_COARSE;
+		return 0;
+	}
+	if (strcmp(name, "tsc") == 0) {
+		machinarium_clock_source = MM_CLOCK_TSC;
+		return 0;
+	}
+	return -1;
+}
+
+MACHINE_API char*
+machinarium_clock(void)
+{
+	switch (machinarium.config.clock_source) {
+	case MM_CLOCK_COARSE:
+		return "coarse";
+	case MM_CLOCK_TSC:
+		return "tsc";
+	}
+	return "monotonic";
+}
+
+MACHINE_API int
+machinarium_set_resolver(char *name)
+{
+	if (strcmp(name, "thread") == 0) {
+		machinarium_resolver = MM_RESOLVER_THREAD;
+		return 0;
+	}
+	if (strcmp(name, "async") == 0) {
+		machinarium_resolver = MM_RESOLVER_ASYNC;
+		return 0;
+	}
+	return -1;
+}
+
+MACHINE_API void
+machinarium_set_watchdog(int threshold_ms, machine_stall_cb_t callback,
+                         void *arg)
+{
+	machinarium_watchdog_ms  = threshold_ms;
+	machinarium_watchdog_cb  = callback;
+	machinarium_watchdog_arg = arg;
+}
+
 MACHINE_API int
 machinarium_init(void)
 {
@@ -57,16 +162,41 @@ machinarium_init(void)
 	if (machinarium_pool_size == 0)
 		machinarium_pool_size = 1;
 
+	if (machinarium_poller == NULL)
+		machinarium_poller = &mm_epoll_if;
+
 	machinarium.config.page_size            = machinarium_page_size();
 	machinarium.config.stack_size           = machinarium_stack_size;
+	machinarium.config.stack_hugepages      = machinarium_stack_hugepages;
+	machinarium.config.stack_watermark      = machinarium_stack_watermark;
 	machinarium.config.pool_size            = machinarium_pool_size;
 	machinarium.config.coroutine_cache_size = machinarium_coroutine_cache_size;
 	machinarium.config.msg_cache_gc_size    = machinarium_msg_cache_gc_size;
+	machinarium.config.msg_cache_class_limit = machinarium_msg_cache_class_limit;
+	machinarium.config.coroutine_accounting = machinarium_coroutine_accounting;
+	machinarium.config.poller               = machinarium_poller;
+	machinarium.config.poll_spin            = machinarium_poll_spin;
+	machinarium.config.resolver             = machinarium_resolver;
+	machinarium.config.clock_source         =
+		mm_clock_source_init(machinarium_clock_source);
 
 	mm_machinemgr_init(&machinarium.machine_mgr);
+	mm_stackstat_init(&machinarium.stack_stat);
 	mm_tls_engine_init();
 	mm_taskmgr_init(&machinarium.task_mgr);
 	mm_taskmgr_start(&machinarium.task_mgr, machinarium.config.pool_size);
+
+	machinarium.config.watchdog_ms = 0;
+	mm_watchdog_init(&machinarium.watchdog);
+	if (machinarium_watchdog_ms > 0 && machinarium_watchdog_cb) {
+		int rc;
+		rc = mm_watchdog_start(&machinarium.watchdog,
+		                       machinarium_watchdog_ms,
+		                       machinarium_watchdog_cb,
+		                       machinarium_watchdog_arg);
+		if (rc == 0)
+			machinarium.config.watchdog_ms = machinarium_watchdog_ms;
+	}
 	machinarium_initialized = 1;
 	return 0;
 }
@@ -76,6 +206,7 @@ machinarium_free(void)
 {
 	if (! machinarium_initialized)
 		return;
+	mm_watchdog_stop(&machinarium.watchdog);
 	mm_taskmgr_stop(&machinarium.task_mgr);
 	mm_machinemgr_free(&machinarium.machine_mgr);
 	mm_tls_engine_free();
@@ -12,11 +12,20 @@ typedef struct mm        mm_t;
 
 struct mm_config
 {
-	int page_size;
-	int stack_size;
-	int pool_size;
-	int coroutine_cache_size;
-	int msg_cache_gc_size;
+	int          page_size;
+	int          stack_size;
+	int          stack_hugepages;
+	int          pool_size;
+	int          coroutine_cache_size;
+	int          msg_cache_gc_size;
+	int          msg_cache_class_limit;
+	int          coroutine_accounting;
+	mm_pollif_t *poller;
+	int          poll_spin;
+	int          resolver;
+	int          clock_source;
+	int          watchdog_ms;
+	int          stack_watermark;
 };
 
 struct mm
@@ -24,6 +33,8 @@ struct mm
 	mm_config_t     config;
 	mm_machinemgr_t machine_mgr;
 	mm_taskmgr_t    task_mgr;
+	mm_watchdog_t   watchdog;
+	mm_stackstat_t  stack_stat;
 };
 
 extern mm_t machinarium;
@@ -11,7 +11,7 @@
 MACHINE_API machine_msg_t*
 machine_msg_create(int reserve)
 {
-	mm_msg_t *msg = mm_msgcache_pop(&mm_self->msg_cache);
+	mm_msg_t *msg = mm_msgcache_pop(&mm_self->msg_cache, reserve);
 	if (msg == NULL)
 		return NULL;
 	msg->type = 0;
@@ -27,6 +27,63 @@ machine_msg_create(int reserve)
 	return (machine_msg_t*)msg;
 }
 
+MACHINE_API int
+machine_msg_ring_size(int size)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	return (size + page - 1) / page * page;
+}
+
+MACHINE_API machine_msg_t*
+machine_msg_create_ring(int size)
+{
+	/* pages of the buffer are mapped twice in a row, so data
+	 * wrapping around its end is still contiguous. Message
+	 * bypasses the cache and is unmapped on free */
+#if defined(SYS_memfd_create) && defined(MFD_CLOEXEC)
+	size = machine_msg_ring_size(size);
+	mm_msg_t *msg = malloc(sizeof(mm_msg_t));
+	if (msg == NULL) {
+		mm_errno_set(ENOMEM);
+		return NULL;
+	}
+	int fd;
+	fd = syscall(SYS_memfd_create, "machinarium-ring", MFD_CLOEXEC);
+	if (fd == -1)
+		goto error;
+	if (ftruncate(fd, size) == -1)
+		goto error_close;
+	char *data;
+	data = mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data == MAP_FAILED)
+		goto error_close;
+	if (mmap(data, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+	         fd, 0) == MAP_FAILED ||
+	    mmap(data + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+	         fd, 0) == MAP_FAILED) {
+		munmap(data, size * 2);
+		goto error_close;
+	}
+	close(fd);
+	mm_msg_init(msg, 0);
+	msg->ring       = 1;
+	msg->data.start = data;
+	msg->data.pos   = data + size;
+	msg->data.end   = data + size;
+	return (machine_msg_t*)msg;
+error_close:
+	close(fd);
+error:
+	mm_errno_set(errno);
+	free(msg);
+	return NULL;
+#else
+	(void)size;
+	mm_errno_set(ENOSYS);
+	return NULL;
+#endif
+}
+
 MACHINE_API machine_msg_t*
 machine_msg_create_or_advance(machine_msg_t *obj, int size)
 {
@@ -45,6 +102,11 @@ MACHINE_API void
 machine_msg_free(machine_msg_t *obj)
 {
 	mm_msg_t *msg = mm_cast(mm_msg_t*, obj);
+	if (msg->ring) {
+		munmap(msg->data.start, mm_buf_size(&msg->data) * 2);
+		free(msg);
+		return;
+	}
 	mm_msgcache_push(&mm_self->msg_cache, msg);
 }
 
@@ -91,3 +153,16 @@ machine_msg_write(machine_msg_t *obj, void *buf, int size)
 	rc = mm_buf_add(&msg->data, buf, size);
 	return rc;
 }
+
+MACHINE_API void*
+machine_msg_reserve(machine_msg_t *obj, int size)
+{
+	/* free space at the end of the message, to be
+	 * committed by machine_msg_write(msg, NULL, size) */
+	mm_msg_t *msg = mm_cast(mm_msg_t*, obj);
+	int rc;
+	rc = mm_buf_ensure(&msg->data, size);
+	if (rc == -1)
+		return NULL;
+	return msg->data.pos;
+}
@@ -14,6 +14,7 @@ struct mm_msg
 	uint16_t  refs;
 	uint64_t  machine_id;
 	int       type;
+	int       ring;
 	mm_buf_t  data;
 	mm_list_t link;
 };
@@ -23,6 +24,7 @@ mm_msg_init(mm_msg_t *msg, int type)
 {
 	msg->refs = 0;
 	msg->type = type;
+	msg->ring = 0;
 	msg->machine_id = 0;
 	mm_buf_init(&msg->data);
 	mm_list_init(&msg->link);
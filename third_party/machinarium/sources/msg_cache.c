@@ -1,4 +1,3 @@
-
 /*
  * machinarium.
  *
@@ -10,46 +9,257 @@
 
 void mm_msgcache_init(mm_msgcache_t *cache)
 {
-	mm_list_init(&cache->list);
+	int i;
+	for (i = 0; i < MM_MSGCACHE_CLASSES; i++) {
+		mm_msgcache_class_t *class = &cache->classes[i];
+		mm_list_init(&class->list);
+		class->count = 0;
+		class->count_allocated = 0;
+		class->count_gc = 0;
+		class->size = 0;
+	}
 	cache->count = 0;
 	cache->count_allocated = 0;
 	cache->count_gc = 0;
 	cache->size = 0;
 	cache->gc_watermark = 0;
+	cache->class_limit = 0;
+	cache->returned = NULL;
+	cache->closed = 0;
+	cache->remote_count = 0;
+	cache->count_remote = 0;
+	cache->count_returned = 0;
 }
 
-void mm_msgcache_free(mm_msgcache_t *cache)
+static inline void
+mm_msgcache_chain_free(mm_list_t *chain)
 {
-	mm_list_t *i, *n;
-	mm_list_foreach_safe(&cache->list, i, n) {
-		mm_msg_t *msg = mm_container_of(i, mm_msg_t, link);
+	while (chain) {
+		mm_msg_t *msg = mm_container_of(chain, mm_msg_t, link);
+		chain = chain->next;
 		mm_buf_free(&msg->data);
 		free(msg);
 	}
 }
 
+void mm_msgcache_free(mm_msgcache_t *cache)
+{
+	/* batches of other machines are returned, messages returned to
+	 * this cache from now on are freed by the sender */
+	mm_msgcache_flush(cache);
+	mm_machinemgr_lock(&machinarium.machine_mgr);
+	cache->closed = 1;
+	mm_list_t *returned = cache->returned;
+	cache->returned = NULL;
+	mm_machinemgr_unlock(&machinarium.machine_mgr);
+	mm_msgcache_chain_free(returned);
+
+	int id;
+	for (id = 0; id < MM_MSGCACHE_CLASSES; id++) {
+		mm_list_t *i, *n;
+		mm_list_foreach_safe(&cache->classes[id].list, i, n) {
+			mm_msg_t *msg = mm_container_of(i, mm_msg_t, link);
+			mm_buf_free(&msg->data);
+			free(msg);
+		}
+	}
+}
+
 void mm_msgcache_stat(mm_msgcache_t *cache,
                       uint64_t *count_allocated,
                       uint64_t *count_gc,
                       uint64_t *count,
-                      uint64_t *size)
+                      uint64_t *size,
+                      uint64_t *count_remote,
+                      uint64_t *count_returned)
 {
 	*count_allocated = cache->count_allocated;
 	*count_gc = cache->count_gc;
 	*count = cache->count;
 	*size  = cache->size;
+	*count_remote = cache->count_remote;
+	*count_returned = cache->count_returned;
+}
+
+int mm_msgcache_class_stat(mm_msgcache_t *cache, int id,
+                           uint64_t *class_size,
+                           uint64_t *count_allocated,
+                           uint64_t *count_gc,
+                           uint64_t *count,
+                           uint64_t *size)
+{
+	if (id < 0 || id >= MM_MSGCACHE_CLASSES)
+		return -1;
+	mm_msgcache_class_t *class = &cache->classes[id];
+	*class_size = mm_msgcache_class_size(id);
+	*count_allocated = class->count_allocated;
+	*count_gc = class->count_gc;
+	*count = class->count;
+	*size  = class->size;
+	return 0;
+}
+
+/* smallest class which fits the reserve, -1 if it is too large */
+static inline int
+mm_msgcache_class_of_reserve(int reserve)
+{
+	int id = 0;
+	while (id < MM_MSGCACHE_CLASSES) {
+		if (reserve <= mm_msgcache_class_size(id))
+			return id;
+		id++;
+	}
+	return -1;
+}
+
+/* largest class which the buffer fits, -1 if it is too large */
+static inline int
+mm_msgcache_class_of_buf(int size)
+{
+	int id = 0;
+	while (id < MM_MSGCACHE_CLASSES - 1) {
+		if (size < mm_msgcache_class_size(id + 1))
+			return id;
+		id++;
+	}
+	if (size < mm_msgcache_class_size(id) * 2)
+		return id;
+	return -1;
+}
+
+static inline void
+mm_msgcache_remote_flush(mm_msgcache_t *cache, int slot)
+{
+	mm_msgcache_remote_t *remote = &cache->remote[slot];
+
+	/* owner is looked up under the machine manager lock, so it is
+	 * not freed while the batch is pushed to its stack */
+	mm_machinemgr_t *mgr = &machinarium.machine_mgr;
+	mm_machinemgr_lock(mgr);
+	mm_machine_t *owner;
+	owner = mm_machinemgr_find(mgr, remote->machine_id);
+	int pushed = 0;
+	if (owner && ! owner->msg_cache.closed) {
+		mm_list_t **returned = &owner->msg_cache.returned;
+		mm_list_t *head = __atomic_load_n(returned, __ATOMIC_RELAXED);
+		do {
+			remote->tail->next = head;
+		} while (! __atomic_compare_exchange_n(returned, &head, remote->head, 1,
+		                                       __ATOMIC_RELEASE,
+		                                       __ATOMIC_RELAXED));
+		pushed = 1;
+	}
+	mm_machinemgr_unlock(mgr);
+
+	if (pushed) {
+		cache->count_remote += remote->count;
+	} else {
+		cache->count_gc += remote->count;
+		mm_msgcache_chain_free(remote->head);
+	}
+
+	/* keep batches packed */
+	cache->remote_count--;
+	if (slot != cache->remote_count)
+		*remote = cache->remote[cache->remote_count];
+}
+
+void mm_msgcache_flush(mm_msgcache_t *cache)
+{
+	while (cache->remote_count > 0)
+		mm_msgcache_remote_flush(cache, cache->remote_count - 1);
+}
+
+static inline void
+mm_msgcache_remote_push(mm_msgcache_t *cache, mm_msg_t *msg)
+{
+	int slot;
+	for (slot = 0; slot < cache->remote_count; slot++)
+		if (cache->remote[slot].machine_id == msg->machine_id)
+			break;
+	if (slot == cache->remote_count) {
+		if (cache->remote_count == MM_MSGCACHE_REMOTE)
+			mm_msgcache_remote_flush(cache, 0);
+		slot = cache->remote_count++;
+		mm_msgcache_remote_t *remote = &cache->remote[slot];
+		remote->machine_id = msg->machine_id;
+		remote->head  = NULL;
+		remote->tail  = NULL;
+		remote->count = 0;
+	}
+	mm_msgcache_remote_t *remote = &cache->remote[slot];
+	msg->link.next = NULL;
+	if (remote->head == NULL)
+		remote->head = &msg->link;
+	else
+		remote->tail->next = &msg->link;
+	remote->tail = &msg->link;
+	remote->count++;
+	if (remote->count >= MM_MSGCACHE_REMOTE_BATCH)
+		mm_msgcache_remote_flush(cache, slot);
+}
+
+static inline void
+mm_msgcache_cache(mm_msgcache_t *cache, mm_msg_t *msg, int id)
+{
+	int size = mm_buf_size(&msg->data);
+	if (id == -1)
+		goto gc;
+
+	mm_msgcache_class_t *class = &cache->classes[id];
+	if (cache->class_limit > 0 && class->count >= (uint64_t)cache->class_limit) {
+		class->count_gc++;
+		goto gc;
+	}
+	mm_list_append(&class->list, &msg->link);
+	class->count++;
+	class->size += size;
+	cache->count++;
+	cache->size += size;
+	return;
+
+gc:
+	cache->count_gc++;
+	mm_buf_free(&msg->data);
+	free(msg);
+}
+
+static inline void
+mm_msgcache_take(mm_msgcache_t *cache)
+{
+	/* messages freed by other machines */
+	mm_list_t *chain;
+	chain = __atomic_exchange_n(&cache->returned, NULL, __ATOMIC_ACQUIRE);
+	while (chain) {
+		mm_msg_t *msg = mm_container_of(chain, mm_msg_t, link);
+		chain = chain->next;
+		cache->count_returned++;
+		int id = mm_msgcache_class_of_buf(mm_buf_size(&msg->data));
+		mm_msgcache_cache(cache, msg, id);
+	}
 }
 
 mm_msg_t*
-mm_msgcache_pop(mm_msgcache_t *cache)
+mm_msgcache_pop(mm_msgcache_t *cache, int reserve)
 {
 	mm_msg_t *msg = NULL;
-	if (cache->count > 0) {
-		mm_list_t *first = mm_list_pop(&cache->list);
-		cache->count--;
-		msg = mm_container_of(first, mm_msg_t, link);
-		cache->size -= mm_buf_size(&msg->data);
-		goto init;
+	int id = mm_msgcache_class_of_reserve(reserve);
+	if (id >= 0) {
+		mm_msgcache_class_t *class = &cache->classes[id];
+		if (class->count == 0 &&
+		    __atomic_load_n(&cache->returned, __ATOMIC_RELAXED))
+			mm_msgcache_take(cache);
+		if (class->count > 0) {
+			mm_list_t *first = mm_list_pop(&class->list);
+			msg = mm_container_of(first, mm_msg_t, link);
+			int size = mm_buf_size(&msg->data);
+			class->count--;
+			class->size -= size;
+			cache->count--;
+			cache->size -= size;
+			goto init;
+		}
+		class->count_allocated++;
 	}
 	cache->count_allocated++;
 
@@ -61,22 +271,32 @@ init:
 	msg->machine_id = mm_self->id;
 	msg->refs       = 0;
 	msg->type       = 0;
+	msg->ring       = 0;
 	mm_buf_reset(&msg->data);
 	mm_list_init(&msg->link);
+
+	/* allocate whole class at once to avoid reallocs on writes */
+	if (id >= 0) {
+		int rc;
+		rc = mm_buf_ensure(&msg->data, mm_msgcache_class_size(id));
+		if (rc == -1) {
+			mm_buf_free(&msg->data);
+			free(msg);
+			return NULL;
+		}
+	}
 	return msg;
 }
 
 void mm_msgcache_push(mm_msgcache_t *cache, mm_msg_t *msg)
 {
-	if (msg->machine_id != mm_self->id ||
-	    mm_buf_size(&msg->data) > cache->gc_watermark) {
-		cache->count_gc++;
-		mm_buf_free(&msg->data);
-		free(msg);
+	int size = mm_buf_size(&msg->data);
+	int id = -1;
+	if (size <= cache->gc_watermark)
+		id = mm_msgcache_class_of_buf(size);
+	if (id != -1 && msg->machine_id != mm_self->id) {
+		mm_msgcache_remote_push(cache, msg);
 		return;
 	}
-
-	mm_list_append(&cache->list, &msg->link);
-	cache->count++;
-	cache->size += mm_buf_size(&msg->data);
+	mm_msgcache_cache(cache, msg, id);
 }
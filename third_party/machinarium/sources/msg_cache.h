@@ -7,24 +7,71 @@
  * cooperative multitasking engine.
 */
 
-typedef struct mm_msgcache mm_msgcache_t;
+typedef struct mm_msgcache_class  mm_msgcache_class_t;
+typedef struct mm_msgcache_remote mm_msgcache_remote_t;
+typedef struct mm_msgcache        mm_msgcache_t;
 
-struct mm_msgcache
+/* Messages are cached in power-of-two size classes starting from
+ * MM_MSGCACHE_CLASS_MIN bytes, so a message always gets a buffer which
+ * fits its reserve and small messages never pin large buffers.
+ *
+ * A message freed by another machine is returned to the cache of the
+ * machine which allocated it. Such frees are collected in per owner
+ * batches and pushed to the owner's lock-free return stack, which the
+ * owner takes when a class runs out of cached messages.
+*/
+
+#define MM_MSGCACHE_CLASS_SHIFT  8
+#define MM_MSGCACHE_CLASS_MIN    (1 << MM_MSGCACHE_CLASS_SHIFT)
+#define MM_MSGCACHE_CLASSES      13
+
+#define MM_MSGCACHE_REMOTE       8
+#define MM_MSGCACHE_REMOTE_BATCH 32
+
+struct mm_msgcache_class
 {
 	mm_list_t list;
 	uint64_t  count;
 	uint64_t  count_allocated;
 	uint64_t  count_gc;
 	uint64_t  size;
-	int       gc_watermark;
+};
+
+struct mm_msgcache_remote
+{
+	uint64_t   machine_id;
+	mm_list_t *head;
+	mm_list_t *tail;
+	int        count;
+};
+
+struct mm_msgcache
+{
+	mm_msgcache_class_t  classes[MM_MSGCACHE_CLASSES];
+	uint64_t             count;
+	uint64_t             count_allocated;
+	uint64_t             count_gc;
+	uint64_t             size;
+	int                  gc_watermark;
+	int                  class_limit;
+	mm_list_t           *returned;
+	int                  closed;
+	mm_msgcache_remote_t remote[MM_MSGCACHE_REMOTE];
+	int                  remote_count;
+	uint64_t             count_remote;
+	uint64_t             count_returned;
 };
 
 void mm_msgcache_init(mm_msgcache_t*);
 void mm_msgcache_free(mm_msgcache_t*);
-void mm_msgcache_stat(mm_msgcache_t*, uint64_t*, uint64_t*, uint64_t*, uint64_t*);
+void mm_msgcache_flush(mm_msgcache_t*);
+void mm_msgcache_stat(mm_msgcache_t*, uint64_t*, uint64_t*, uint64_t*, uint64_t*,
+                      uint64_t*, uint64_t*);
+int  mm_msgcache_class_stat(mm_msgcache_t*, int, uint64_t*, uint64_t*,
+                            uint64_t*, uint64_t*, uint64_t*);
 
 mm_msg_t*
-mm_msgcache_pop(mm_msgcache_t*);
+mm_msgcache_pop(mm_msgcache_t*, int);
 
 void mm_msgcache_push(mm_msgcache_t*, mm_msg_t*);
 
@@ -34,6 +81,18 @@ mm_msgcache_set_gc_watermark(mm_msgcache_t *cache, int wm)
 	cache->gc_watermark = wm;
 }
 
+static inline void
+mm_msgcache_set_class_limit(mm_msgcache_t *cache, int limit)
+{
+	cache->class_limit = limit;
+}
+
+static inline int
+mm_msgcache_class_size(int id)
+{
+	return MM_MSGCACHE_CLASS_MIN << id;
+}
+
 static inline void
 mm_msg_ref(mm_msg_t *msg)
 {
@@ -0,0 +1,92 @@
+
+/*
+ * machinarium.
+ *
+ * cooperative multitasking engine.
+*/
+
+#include <machinarium.h>
+#include <machinarium_private.h>
+
+static void
+mm_notify_on_ready(mm_event_t *event)
+{
+	/* rearm before the condition is signaled, so signals sent
+	 * meanwhile are not lost */
+	mm_notify_t *notify = (mm_notify_t*)event;
+	__atomic_store_n(&event->state, MM_EVENT_WAIT, __ATOMIC_SEQ_CST);
+	mm_cond_signal(notify->cond, &mm_self->scheduler);
+}
+
+MACHINE_API machine_notify_t*
+machine_notify_create(void)
+{
+	mm_notify_t *notify = malloc(sizeof(mm_notify_t));
+	if (notify == NULL) {
+		mm_errno_set(ENOMEM);
+		return NULL;
+	}
+	memset(notify, 0, sizeof(mm_notify_t));
+	notify->event.state = MM_EVENT_NONE;
+	return (machine_notify_t*)notify;
+}
+
+MACHINE_API void
+machine_notify_free(machine_notify_t *obj)
+{
+	machine_notify_stop(obj);
+	free(obj);
+}
+
+MACHINE_API void
+machine_notify_start(machine_notify_t *obj, machine_cond_t *cond)
+{
+	mm_notify_t *notify = mm_cast(mm_notify_t*, obj);
+	machine_notify_stop(obj);
+	notify->cond = mm_cast(mm_cond_t*, cond);
+	notify->event.event_mgr = &mm_self->event_mgr;
+	notify->event.on_ready  = mm_notify_on_ready;
+	notify->event.next      = NULL;
+	__atomic_store_n(&notify->event.state, MM_EVENT_WAIT, __ATOMIC_SEQ_CST);
+
+	/* signaled while stopped */
+	if (__atomic_load_n(&notify->pending, __ATOMIC_SEQ_CST))
+		mm_cond_signal(notify->cond, &mm_self->scheduler);
+}
+
+MACHINE_API void
+machine_notify_stop(machine_notify_t *obj)
+{
+	/* must be called by the machine which started it */
+	mm_notify_t *notify = mm_cast(mm_notify_t*, obj);
+	mm_eventstate_t state = MM_EVENT_WAIT;
+	if (! __atomic_compare_exchange_n(&notify->event.state, &state,
+	                                  MM_EVENT_NONE, 0,
+	                                  __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+		if (state == MM_EVENT_NONE)
+			return;
+		assert(state == MM_EVENT_READY);
+		mm_eventmgr_cancel(notify->event.event_mgr, &notify->event);
+		__atomic_store_n(&notify->event.state, MM_EVENT_NONE, __ATOMIC_SEQ_CST);
+	}
+	notify->cond = NULL;
+	notify->event.event_mgr = NULL;
+}
+
+MACHINE_API void
+machine_notify_signal(machine_notify_t *obj)
+{
+	mm_notify_t *notify = mm_cast(mm_notify_t*, obj);
+	__atomic_store_n(&notify->pending, 1, __ATOMIC_SEQ_CST);
+	int event_mgr_fd;
+	event_mgr_fd = mm_eventmgr_signal(&notify->event);
+	if (event_mgr_fd > 0)
+		mm_eventmgr_wakeup(event_mgr_fd);
+}
+
+MACHINE_API int
+machine_notify_read(machine_notify_t *obj)
+{
+	mm_notify_t *notify = mm_cast(mm_notify_t*, obj);
+	return __atomic_exchange_n(&notify->pending, 0, __ATOMIC_SEQ_CST);
+}
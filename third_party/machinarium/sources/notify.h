@@ -0,0 +1,28 @@
+#ifndef MM_NOTIFY_H
+#define MM_NOTIFY_H
+
+/*
+ * machinarium.
+ *
+ * cooperative multitasking engine.
+*/
+
+typedef struct mm_notify mm_notify_t;
+
+/* Notification of a coroutine by any thread without a file
+ * descriptor of its own.
+ *
+ * Started notify is a reusable event of the owner machine event
+ * manager, signal pushes it to the ready stack and the owner
+ * signals the condition on dispatch. Signals of a stopped notify
+ * are kept pending until it is started again, possibly by another
+ * machine. */
+
+struct mm_notify
+{
+	mm_event_t  event;
+	mm_cond_t  *cond;
+	int         pending;
+};
+
+#endif /* MM_NOTIFY_H */
@@ -28,6 +28,8 @@ mm_read_start(mm_io_t *io, machine_cond_t *on_read)
 	*/
 	if (mm_tls_is_active(io) && mm_tls_read_pending(io))
 		mm_cond_signal((mm_cond_t*)io->on_read, &mm_self->scheduler);
+	if (mm_compression_is_active(io) && mm_compression_read_pending(io))
+		mm_cond_signal((mm_cond_t*)io->on_read, &mm_self->scheduler);
 
 	int rc;
 	rc = mm_loop_read(&machine->loop, &io->handle, mm_read_cb, io);
@@ -87,16 +89,53 @@ machine_read_raw(machine_io_t *obj, void *buf, size_t size)
 	mm_io_t *io = mm_cast(mm_io_t*, obj);
 	mm_errno_set(0);
 	ssize_t rc;
+	if (mm_compression_is_active(io)) {
+		rc = mm_compression_read(io, buf, size);
+		/* decompressed data left in zlib does not generate
+		 * poller events */
+		if (rc > 0 && io->on_read && mm_compression_read_pending(io))
+			mm_cond_signal((mm_cond_t*)io->on_read, &mm_self->scheduler);
+	} else
 	if (mm_tls_is_active(io))
 		rc = mm_tls_read(io, buf, size);
-	else
+	else {
 		rc = mm_socket_read(io->fd, buf, size);
+		/* short read drained the socket */
+		if (rc > 0 && (size_t)rc < size)
+			mm_fd_drained(&io->handle, MM_R);
+	}
+	mm_iostat_read(&mm_self->loop.iostat, rc);
 	if (rc > 0) {
 		return rc;
 	}
 	if (rc < 0) {
 		int errno_ = errno;
 		mm_errno_set(errno_);
+		if (errno_ == EAGAIN || errno_ == EWOULDBLOCK)
+			mm_fd_drained(&io->handle, MM_R);
+		if (errno_ == EAGAIN || errno_ == EWOULDBLOCK || errno_ == EINTR)
+			return -1;
+	}
+	/* error of eof */
+	io->connected = 0;
+	return rc;
+}
+
+MACHINE_API ssize_t
+machine_splice_read_raw(machine_io_t *obj, int pipe_fd, size_t size)
+{
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_errno_set(0);
+	ssize_t rc;
+	rc = mm_socket_splice(io->fd, pipe_fd, size);
+	mm_iostat_splice(&mm_self->loop.iostat, rc);
+	if (rc > 0)
+		return rc;
+	if (rc < 0) {
+		int errno_ = errno;
+		mm_errno_set(errno_);
+		if (errno_ == EAGAIN || errno_ == EWOULDBLOCK)
+			mm_fd_drained(&io->handle, MM_R);
 		if (errno_ == EAGAIN || errno_ == EWOULDBLOCK || errno_ == EINTR)
 			return -1;
 	}
@@ -183,6 +222,60 @@ machine_read(machine_io_t *obj, size_t size, uint32_t time_ms)
 	return msg;
 }
 
+MACHINE_API ssize_t
+machine_peek(machine_io_t *obj, void *buf, size_t size, uint32_t time_ms)
+{
+	/* wait for data and read it without consuming, data buffered
+	 * by tls or compression is not visible */
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_errno_set(0);
+
+	if (! io->attached || ! io->connected) {
+		mm_errno_set(ENOTCONN);
+		return -1;
+	}
+	if (io->on_read || mm_tls_is_active(io) ||
+	    mm_compression_is_active(io)) {
+		mm_errno_set(EINPROGRESS);
+		return -1;
+	}
+
+	mm_cond_t on_read;
+	mm_cond_init(&on_read);
+	int read_started = 0;
+	ssize_t rc;
+	for (;;)
+	{
+		rc = mm_socket_peek(io->fd, buf, size);
+		if (rc > 0)
+			break;
+		if (rc == 0) {
+			/* eof */
+			io->connected = 0;
+			break;
+		}
+		int errno_ = errno;
+		if (errno_ != EAGAIN && errno_ != EWOULDBLOCK && errno_ != EINTR) {
+			mm_errno_set(errno_);
+			break;
+		}
+		if (errno_ != EINTR)
+			mm_fd_drained(&io->handle, MM_R);
+		if (! read_started) {
+			rc = mm_read_start(io, (machine_cond_t*)&on_read);
+			if (rc == -1)
+				return -1;
+			read_started = 1;
+		}
+		rc = machine_cond_wait((machine_cond_t*)&on_read, time_ms);
+		if (rc == -1)
+			break;
+	}
+	if (read_started)
+		mm_read_stop(io);
+	return rc;
+}
+
 MACHINE_API int
 machine_read_active(machine_io_t *obj)
 {
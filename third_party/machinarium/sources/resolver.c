@@ -0,0 +1,519 @@
+
+/*
+ * machinarium.
+ *
+ * cooperative multitasking engine.
+*/
+
+#include <machinarium.h>
+#include <machinarium_private.h>
+
+/*
+ * Asynchronous DNS resolver.
+ *
+ * Queries nameservers of resolv.conf over UDP from the calling
+ * coroutine, waiting for replies in the machine event loop. Anything
+ * which needs libc name service logic (numeric hosts excluded) is left
+ * to getaddrinfo() of the task manager: names without dots which are
+ * subject to search domains, names listed in hosts, truncated replies
+ * and canonical name requests.
+*/
+
+#define MM_RESOLVER_SERVERS_MAX 3
+#define MM_RESOLVER_ADDRS_MAX   16
+#define MM_RESOLVER_NAME_MAX    255
+#define MM_RESOLVER_PORT        53
+
+#define MM_RESOLVER_TYPE_A      1
+#define MM_RESOLVER_TYPE_AAAA   28
+#define MM_RESOLVER_CLASS_IN    1
+
+typedef struct
+{
+	struct sockaddr_storage servers[MM_RESOLVER_SERVERS_MAX];
+	socklen_t               servers_len[MM_RESOLVER_SERVERS_MAX];
+	int                     servers_count;
+	uint32_t                timeout;
+	int                     attempts;
+} mm_resolver_conf_t;
+
+enum
+{
+	MM_RESOLVER_PENDING,
+	MM_RESOLVER_ANSWERED,
+	MM_RESOLVER_NXDOMAIN,
+	MM_RESOLVER_FAILED,
+	MM_RESOLVER_TRUNCATED
+};
+
+typedef struct
+{
+	uint16_t type;
+	uint16_t id;
+	int      state;
+	int      addrs_count;
+	uint8_t  addrs[MM_RESOLVER_ADDRS_MAX][16];
+} mm_resolver_query_t;
+
+typedef struct
+{
+	mm_fd_t   handle;
+	mm_call_t call;
+	int       ready;
+} mm_resolver_wait_t;
+
+static void
+mm_resolver_conf(mm_resolver_conf_t *conf)
+{
+	/* libc defaults */
+	conf->servers_count = 0;
+	conf->timeout  = 5000;
+	conf->attempts = 2;
+
+	FILE *file = fopen("/etc/resolv.conf", "r");
+	if (file == NULL)
+		return;
+	char line[512];
+	while (fgets(line, sizeof(line), file)) {
+		char *save = NULL;
+		char *key = strtok_r(line, " \t\r\n", &save);
+		if (key == NULL)
+			continue;
+		if (strcmp(key, "nameserver") == 0) {
+			char *value = strtok_r(NULL, " \t\r\n", &save);
+			if (value == NULL || conf->servers_count == MM_RESOLVER_SERVERS_MAX)
+				continue;
+			struct sockaddr_storage *sa = &conf->servers[conf->servers_count];
+			memset(sa, 0, sizeof(*sa));
+			struct sockaddr_in  *sin  = (struct sockaddr_in*)sa;
+			struct sockaddr_in6 *sin6 = (struct sockaddr_in6*)sa;
+			if (inet_pton(AF_INET, value, &sin->sin_addr) == 1) {
+				sin->sin_family = AF_INET;
+				sin->sin_port   = htons(MM_RESOLVER_PORT);
+				conf->servers_len[conf->servers_count++] = sizeof(*sin);
+			} else
+			if (inet_pton(AF_INET6, value, &sin6->sin6_addr) == 1) {
+				sin6->sin6_family = AF_INET6;
+				sin6->sin6_port   = htons(MM_RESOLVER_PORT);
+				conf->servers_len[conf->servers_count++] = sizeof(*sin6);
+			}
+			continue;
+		}
+		if (strcmp(key, "options") == 0) {
+			char *value;
+			while ((value = strtok_r(NULL, " \t\r\n", &save))) {
+				if (strncmp(value, "timeout:", 8) == 0) {
+					int timeout = atoi(value + 8);
+					if (timeout > 30)
+						timeout = 30;
+					if (timeout > 0)
+						conf->timeout = timeout * 1000;
+				} else
+				if (strncmp(value, "attempts:", 9) == 0) {
+					int attempts = atoi(value + 9);
+					if (attempts > 5)
+						attempts = 5;
+					if (attempts > 0)
+						conf->attempts = attempts;
+				}
+			}
+		}
+	}
+	fclose(file);
+}
+
+static int
+mm_resolver_in_hosts(char *name)
+{
+	FILE *file = fopen("/etc/hosts", "r");
+	if (file == NULL)
+		return 0;
+	int found = 0;
+	char line[1024];
+	while (! found && fgets(line, sizeof(line), file)) {
+		char *comment = strchr(line, '#');
+		if (comment)
+			*comment = 0;
+		char *save = NULL;
+		/* skip address */
+		char *token = strtok_r(line, " \t\r\n", &save);
+		if (token == NULL)
+			continue;
+		while ((token = strtok_r(NULL, " \t\r\n", &save))) {
+			if (strcasecmp(token, name) == 0) {
+				found = 1;
+				break;
+			}
+		}
+	}
+	fclose(file);
+	return found;
+}
+
+static int
+mm_resolver_query_write(uint8_t *buf, char *name, uint16_t id, uint16_t type)
+{
+	/* header, recursion desired */
+	int pos = 0;
+	buf[pos++] = id >> 8;
+	buf[pos++] = id & 0xff;
+	buf[pos++] = 0x01;
+	buf[pos++] = 0x00;
+	buf[pos++] = 0;
+	buf[pos++] = 1;
+	memset(buf + pos, 0, 6);
+	pos += 6;
+
+	/* question */
+	char *label = name;
+	while (*label) {
+		char *end = strchr(label, '.');
+		int len = end ? (int)(end - label) : (int)strlen(label);
+		if (len == 0 || len > 63)
+			return -1;
+		buf[pos++] = len;
+		memcpy(buf + pos, label, len);
+		pos += len;
+		if (end == NULL)
+			break;
+		label = end + 1;
+	}
+	buf[pos++] = 0;
+	buf[pos++] = type >> 8;
+	buf[pos++] = type & 0xff;
+	buf[pos++] = 0;
+	buf[pos++] = MM_RESOLVER_CLASS_IN;
+	return pos;
+}
+
+static int
+mm_resolver_skip_name(uint8_t *buf, int size, int pos)
+{
+	while (pos < size) {
+		uint8_t len = buf[pos];
+		if (len == 0)
+			return pos + 1;
+		if ((len & 0xc0) == 0xc0)
+			return (pos + 2 <= size) ? pos + 2 : -1;
+		if (len & 0xc0)
+			return -1;
+		pos += len + 1;
+	}
+	return -1;
+}
+
+static inline uint16_t
+mm_resolver_u16(uint8_t *buf)
+{
+	return (buf[0] << 8) | buf[1];
+}
+
+static void
+mm_resolver_reply(mm_resolver_query_t *queries, int count,
+                  uint8_t *buf, int size)
+{
+	if (size < 12)
+		return;
+	uint16_t id    = mm_resolver_u16(buf);
+	uint16_t flags = mm_resolver_u16(buf + 2);
+	mm_resolver_query_t *query = NULL;
+	int i;
+	for (i = 0; i < count; i++) {
+		if (queries[i].id == id && queries[i].state == MM_RESOLVER_PENDING) {
+			query = &queries[i];
+			break;
+		}
+	}
+	if (query == NULL || ! (flags & 0x8000))
+		return;
+
+	/* question must match the query */
+	int pos = 12;
+	int qdcount = mm_resolver_u16(buf + 4);
+	int ancount = mm_resolver_u16(buf + 6);
+	if (qdcount != 1)
+		return;
+	pos = mm_resolver_skip_name(buf, size, pos);
+	if (pos == -1 || pos + 4 > size)
+		return;
+	if (mm_resolver_u16(buf + pos) != query->type)
+		return;
+	pos += 4;
+
+	if (flags & 0x0200) {
+		query->state = MM_RESOLVER_TRUNCATED;
+		return;
+	}
+	int rcode = flags & 0x000f;
+	if (rcode == 3) {
+		query->state = MM_RESOLVER_NXDOMAIN;
+		return;
+	}
+	if (rcode != 0) {
+		query->state = MM_RESOLVER_FAILED;
+		return;
+	}
+
+	/* addresses of the answer, cname records are skipped */
+	int addr_size = (query->type == MM_RESOLVER_TYPE_A) ? 4 : 16;
+	for (i = 0; i < ancount; i++) {
+		pos = mm_resolver_skip_name(buf, size, pos);
+		if (pos == -1 || pos + 10 > size)
+			break;
+		uint16_t type  = mm_resolver_u16(buf + pos);
+		uint16_t class = mm_resolver_u16(buf + pos + 2);
+		uint16_t len   = mm_resolver_u16(buf + pos + 8);
+		pos += 10;
+		if (pos + len > size)
+			break;
+		if (type == query->type && class == MM_RESOLVER_CLASS_IN &&
+		    len == addr_size && query->addrs_count < MM_RESOLVER_ADDRS_MAX) {
+			memcpy(query->addrs[query->addrs_count], buf + pos, len);
+			query->addrs_count++;
+		}
+		pos += len;
+	}
+	query->state = MM_RESOLVER_ANSWERED;
+}
+
+static void
+mm_resolver_on_read_cb(mm_fd_t *handle)
+{
+	mm_resolver_wait_t *wait = handle->on_read_arg;
+	wait->ready = 1;
+	mm_call_t *call = &wait->call;
+	if (! mm_call_is_active(call) || mm_call_is_aborted(call))
+		return;
+	mm_scheduler_wakeup(&mm_self->scheduler, call->coroutine);
+}
+
+static int
+mm_resolver_pending(mm_resolver_query_t *queries, int count)
+{
+	int i;
+	for (i = 0; i < count; i++)
+		if (queries[i].state == MM_RESOLVER_PENDING)
+			return 1;
+	return 0;
+}
+
+/* returns -1 on coroutine cancel, otherwise 0 */
+static int
+mm_resolver_ask(struct sockaddr *server, socklen_t server_len, char *name,
+                mm_resolver_query_t *queries, int count, uint64_t deadline)
+{
+	mm_machine_t *machine = mm_self;
+	int fd = mm_socket(server->sa_family, SOCK_DGRAM, 0);
+	if (fd == -1)
+		return 0;
+	int rc;
+	rc = mm_socket_set_nonblock(fd, 1);
+	if (rc == -1 || connect(fd, server, server_len) == -1) {
+		close(fd);
+		return 0;
+	}
+
+	/* queries are resent to the next server */
+	int i;
+	for (i = 0; i < count; i++) {
+		if (queries[i].state == MM_RESOLVER_ANSWERED)
+			continue;
+		queries[i].state = MM_RESOLVER_PENDING;
+		queries[i].id = machine_lrand48() & 0xffff;
+		uint8_t buf[12 + MM_RESOLVER_NAME_MAX + 2 + 4];
+		int size = mm_resolver_query_write(buf, name, queries[i].id,
+		                                   queries[i].type);
+		if (size == -1 || send(fd, buf, size, 0) != size)
+			queries[i].state = MM_RESOLVER_FAILED;
+	}
+
+	mm_resolver_wait_t wait;
+	memset(&wait, 0, sizeof(wait));
+	wait.handle.fd = fd;
+	rc = mm_loop_add(&machine->loop, &wait.handle, 0);
+	if (rc == -1) {
+		close(fd);
+		return 0;
+	}
+	rc = mm_loop_read(&machine->loop, &wait.handle, mm_resolver_on_read_cb, &wait);
+	if (rc == -1) {
+		rc = 0;
+		goto done;
+	}
+
+	while (mm_resolver_pending(queries, count)) {
+		if (! wait.ready) {
+			uint64_t now = machine_time_ms();
+			if (now >= deadline)
+				break;
+			mm_call(&wait.call, MM_CALL_EVENT, deadline - now);
+			if (wait.call.status == ECANCELED) {
+				rc = -1;
+				break;
+			}
+			if (wait.call.timedout)
+				break;
+		}
+		wait.ready = 0;
+		for (;;) {
+			uint8_t buf[4096];
+			ssize_t size = recv(fd, buf, sizeof(buf), 0);
+			if (size == -1) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+					break;
+				/* server is unreachable */
+				for (i = 0; i < count; i++)
+					if (queries[i].state == MM_RESOLVER_PENDING)
+						queries[i].state = MM_RESOLVER_FAILED;
+				break;
+			}
+			mm_resolver_reply(queries, count, buf, size);
+		}
+	}
+	if (rc != -1)
+		rc = 0;
+
+done:
+	mm_loop_delete(&machine->loop, &wait.handle);
+	close(fd);
+	return rc;
+}
+
+static int
+mm_resolver_result(char *service, struct addrinfo *hints,
+                   mm_resolver_query_t *queries, int count,
+                   struct addrinfo **res)
+{
+	/* let libc allocate the result, so it is freed by freeaddrinfo() */
+	struct addrinfo numeric;
+	memset(&numeric, 0, sizeof(numeric));
+	if (hints) {
+		numeric.ai_flags    = hints->ai_flags;
+		numeric.ai_socktype = hints->ai_socktype;
+		numeric.ai_protocol = hints->ai_protocol;
+	}
+	numeric.ai_flags |= AI_NUMERICHOST;
+
+	struct addrinfo *head = NULL;
+	struct addrinfo **tail = &head;
+	int i, j;
+	for (i = 0; i < count; i++) {
+		mm_resolver_query_t *query = &queries[i];
+		int family = (query->type == MM_RESOLVER_TYPE_A) ? AF_INET : AF_INET6;
+		numeric.ai_family = family;
+		for (j = 0; j < query->addrs_count; j++) {
+			char addr[INET6_ADDRSTRLEN];
+			inet_ntop(family, query->addrs[j], addr, sizeof(addr));
+			struct addrinfo *ai = NULL;
+			int rc;
+			rc = mm_socket_getaddrinfo(addr, service, &numeric, &ai);
+			if (rc != 0) {
+				if (head)
+					freeaddrinfo(head);
+				return rc;
+			}
+			*tail = ai;
+			while (ai->ai_next)
+				ai = ai->ai_next;
+			tail = &ai->ai_next;
+		}
+	}
+	if (head == NULL)
+		return EAI_NONAME;
+	*res = head;
+	return 0;
+}
+
+int
+mm_resolver_getaddrinfo(char *addr, char *service,
+                        struct addrinfo *hints,
+                        struct addrinfo **res,
+                        uint32_t time_ms)
+{
+	if (addr == NULL)
+		return MM_RESOLVER_FALLBACK;
+	if (hints && (hints->ai_flags & AI_CANONNAME))
+		return MM_RESOLVER_FALLBACK;
+
+	/* numeric hosts do not block */
+	struct in6_addr numeric;
+	if (inet_pton(AF_INET, addr, &numeric) == 1 ||
+	    inet_pton(AF_INET6, addr, &numeric) == 1 ||
+	    strchr(addr, '%'))
+		return mm_socket_getaddrinfo(addr, service, hints, res);
+
+	int family = hints ? hints->ai_family : AF_UNSPEC;
+	if (family != AF_UNSPEC && family != AF_INET && family != AF_INET6)
+		return MM_RESOLVER_FALLBACK;
+
+	char name[MM_RESOLVER_NAME_MAX + 1];
+	int len = strlen(addr);
+	if (len == 0 || len > MM_RESOLVER_NAME_MAX)
+		return MM_RESOLVER_FALLBACK;
+	memcpy(name, addr, len + 1);
+	if (name[len - 1] == '.')
+		name[len - 1] = 0;
+	if (strchr(name, '.') == NULL)
+		return MM_RESOLVER_FALLBACK;
+	if (mm_resolver_in_hosts(name))
+		return MM_RESOLVER_FALLBACK;
+
+	mm_resolver_conf_t conf;
+	mm_resolver_conf(&conf);
+	if (conf.servers_count == 0)
+		return MM_RESOLVER_FALLBACK;
+
+	mm_resolver_query_t queries[2];
+	int count = 0;
+	memset(queries, 0, sizeof(queries));
+	if (family == AF_UNSPEC || family == AF_INET)
+		queries[count++].type = MM_RESOLVER_TYPE_A;
+	if (family == AF_UNSPEC || family == AF_INET6)
+		queries[count++].type = MM_RESOLVER_TYPE_AAAA;
+
+	/* task manager does not limit resolve time either, zero timeout
+	 * leaves it to resolv.conf timeout and attempts */
+	uint64_t start = machine_time_ms();
+	uint64_t deadline = UINT64_MAX;
+	if (time_ms != 0 && time_ms != UINT32_MAX)
+		deadline = start + time_ms;
+
+	int attempt;
+	int i;
+	for (attempt = 0; attempt < conf.attempts; attempt++) {
+		for (i = 0; i < conf.servers_count; i++) {
+			uint64_t now = machine_time_ms();
+			if (now >= deadline) {
+				mm_errno_set(ETIMEDOUT);
+				return -1;
+			}
+			uint64_t ask_deadline = now + conf.timeout;
+			if (ask_deadline > deadline)
+				ask_deadline = deadline;
+			int rc;
+			rc = mm_resolver_ask((struct sockaddr*)&conf.servers[i],
+			                     conf.servers_len[i], name, queries, count,
+			                     ask_deadline);
+			if (rc == -1) {
+				mm_errno_set(ECANCELED);
+				return -1;
+			}
+			int answered = 0;
+			int j;
+			for (j = 0; j < count; j++) {
+				switch (queries[j].state) {
+				case MM_RESOLVER_TRUNCATED:
+					return MM_RESOLVER_FALLBACK;
+				case MM_RESOLVER_NXDOMAIN:
+					return EAI_NONAME;
+				case MM_RESOLVER_ANSWERED:
+					answered++;
+					break;
+				}
+			}
+			if (answered == count)
+				return mm_resolver_result(service, hints, queries, count, res);
+		}
+	}
+	return EAI_AGAIN;
+}
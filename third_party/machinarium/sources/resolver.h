@@ -0,0 +1,22 @@
+#ifndef MM_RESOLVER_H
+#define MM_RESOLVER_H
+
+/*
+ * machinarium.
+ *
+ * cooperative multitasking engine.
+*/
+
+typedef enum
+{
+	MM_RESOLVER_THREAD,
+	MM_RESOLVER_ASYNC
+} mm_resolver_t;
+
+/* request has to be resolved by getaddrinfo() of the task manager */
+#define MM_RESOLVER_FALLBACK (-2)
+
+int mm_resolver_getaddrinfo(char*, char*, struct addrinfo*,
+                            struct addrinfo**, uint32_t);
+
+#endif /* MM_RESOLVER_H */
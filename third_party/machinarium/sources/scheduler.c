@@ -38,11 +38,20 @@ mm_scheduler_main(void *arg)
 
 int mm_scheduler_init(mm_scheduler_t *scheduler)
 {
-	mm_list_init(&scheduler->list_ready);
+	int i;
+	for (i = 0; i < MM_SCHEDULER_PRIORITIES; i++) {
+		mm_list_init(&scheduler->list_ready[i]);
+		scheduler->count_ready_priority[i] = 0;
+		scheduler->count_starve[i] = 0;
+	}
 	mm_list_init(&scheduler->list_active);
 	scheduler->id_seq       = 0;
 	scheduler->count_ready  = 0;
 	scheduler->count_active = 0;
+	scheduler->accounting   = machinarium.config.coroutine_accounting;
+	scheduler->time_switch  = 0;
+	if (scheduler->accounting)
+		scheduler->time_switch = mm_clock_gettime();
 	mm_coroutine_init(&scheduler->main);
 	scheduler->current      = &scheduler->main;
 	return 0;
@@ -52,9 +61,12 @@ void mm_scheduler_free(mm_scheduler_t *scheduler)
 {
 	mm_coroutine_t *coroutine;
 	mm_list_t *i, *p;
-	mm_list_foreach_safe(&scheduler->list_ready, i, p) {
-		coroutine = mm_container_of(i, mm_coroutine_t, link);
-		mm_coroutine_free(coroutine);
+	int priority;
+	for (priority = 0; priority < MM_SCHEDULER_PRIORITIES; priority++) {
+		mm_list_foreach_safe(&scheduler->list_ready[priority], i, p) {
+			coroutine = mm_container_of(i, mm_coroutine_t, link);
+			mm_coroutine_free(coroutine);
+		}
 	}
 	mm_list_foreach_safe(&scheduler->list_active, i, p) {
 		coroutine = mm_container_of(i, mm_coroutine_t, link);
@@ -62,12 +74,34 @@ void mm_scheduler_free(mm_scheduler_t *scheduler)
 	}
 }
 
+static inline mm_coroutine_t*
+mm_scheduler_next(mm_scheduler_t *scheduler)
+{
+	/* highest priority queue, unless a lower one waited too long */
+	int next = -1;
+	int i;
+	for (i = 0; i < MM_SCHEDULER_PRIORITIES; i++) {
+		if (! scheduler->count_ready_priority[i])
+			continue;
+		if (next == -1 ||
+		    scheduler->count_starve[i] >= MM_SCHEDULER_STARVATION)
+			next = i;
+	}
+	for (i = 0; i < MM_SCHEDULER_PRIORITIES; i++) {
+		if (i == next || ! scheduler->count_ready_priority[i])
+			scheduler->count_starve[i] = 0;
+		else
+			scheduler->count_starve[i]++;
+	}
+	return mm_container_of(scheduler->list_ready[next].next, mm_coroutine_t, link);
+}
+
 void mm_scheduler_run(mm_scheduler_t *scheduler, mm_coroutine_cache_t *cache)
 {
 	while (scheduler->count_ready > 0)
 	{
 		mm_coroutine_t *coroutine;
-		coroutine = mm_container_of(scheduler->list_ready.next, mm_coroutine_t, link);
+		coroutine = mm_scheduler_next(scheduler);
 		mm_scheduler_set(&mm_self->scheduler, coroutine, MM_CACTIVE);
 		mm_scheduler_call(&mm_self->scheduler, coroutine);
 		if (coroutine->state == MM_CFREE)
@@ -83,9 +117,14 @@ void mm_scheduler_new(mm_scheduler_t *scheduler,
 	mm_list_init(&coroutine->link_join);
 	mm_list_init(&coroutine->joiners);
 	coroutine->cancel = 0;
+	coroutine->priority = MACHINE_PRIORITY_NORMAL;
 	coroutine->id = scheduler->id_seq++;
 	coroutine->function = function;
 	coroutine->function_arg = arg;
+	coroutine->time_run = 0;
+	coroutine->time_wait = 0;
+	coroutine->time_ready = 0;
+	coroutine->count_switch = 0;
 	mm_context_create(&coroutine->context,
 	                  &coroutine->stack, mm_scheduler_main, coroutine);
 	mm_scheduler_set(scheduler, coroutine, MM_CREADY);
@@ -96,10 +135,13 @@ mm_scheduler_find(mm_scheduler_t *scheduler, uint64_t id)
 {
 	mm_coroutine_t *coroutine;
 	mm_list_t *i;
-	mm_list_foreach(&scheduler->list_ready, i) {
-		coroutine = mm_container_of(i, mm_coroutine_t, link);
-		if (coroutine->id == id)
-			return coroutine;
+	int priority;
+	for (priority = 0; priority < MM_SCHEDULER_PRIORITIES; priority++) {
+		mm_list_foreach(&scheduler->list_ready[priority], i) {
+			coroutine = mm_container_of(i, mm_coroutine_t, link);
+			if (coroutine->id == id)
+				return coroutine;
+		}
 	}
 	mm_list_foreach(&scheduler->list_active, i) {
 		coroutine = mm_container_of(i, mm_coroutine_t, link);
@@ -120,6 +162,7 @@ void mm_scheduler_set(mm_scheduler_t *scheduler, mm_coroutine_t *coroutine,
 		break;
 	case MM_CREADY:
 		scheduler->count_ready--;
+		scheduler->count_ready_priority[coroutine->priority]--;
 		break;
 	case MM_CACTIVE:
 		scheduler->count_active--;
@@ -131,8 +174,11 @@ void mm_scheduler_set(mm_scheduler_t *scheduler, mm_coroutine_t *coroutine,
 	case MM_CFREE:
 		break;
 	case MM_CREADY:
-		target = &scheduler->list_ready;
+		target = &scheduler->list_ready[coroutine->priority];
 		scheduler->count_ready++;
+		scheduler->count_ready_priority[coroutine->priority]++;
+		if (scheduler->accounting)
+			coroutine->time_ready = mm_clock_gettime();
 		break;
 	case MM_CACTIVE:
 		target = &scheduler->list_active;
@@ -146,10 +192,29 @@ void mm_scheduler_set(mm_scheduler_t *scheduler, mm_coroutine_t *coroutine,
 	coroutine->state = state;
 }
 
+/* Charge the time since the last switch to the coroutine
+ * which gives up the cpu. Time between a wakeup and the
+ * switch to a coroutine is accounted as its wait time. */
+static inline void
+mm_scheduler_account(mm_scheduler_t *scheduler, mm_coroutine_t *current,
+                     mm_coroutine_t *next)
+{
+	uint64_t now = mm_clock_gettime();
+	current->time_run += now - scheduler->time_switch;
+	scheduler->time_switch = now;
+	if (next->time_ready) {
+		next->time_wait += now - next->time_ready;
+		next->time_ready = 0;
+	}
+	next->count_switch++;
+}
+
 void mm_scheduler_call(mm_scheduler_t *scheduler, mm_coroutine_t *coroutine)
 {
 	mm_coroutine_t *resume = scheduler->current;
 	assert(resume != NULL);
+	if (scheduler->accounting)
+		mm_scheduler_account(scheduler, resume, coroutine);
 	coroutine->resume = resume;
 	scheduler->current = coroutine;
 	mm_context_swap(&resume->context, &coroutine->context);
@@ -160,6 +225,8 @@ void mm_scheduler_yield(mm_scheduler_t *scheduler)
 	mm_coroutine_t *current = scheduler->current;
 	mm_coroutine_t *resume = current->resume;
 	assert(resume != NULL);
+	if (scheduler->accounting)
+		mm_scheduler_account(scheduler, current, resume);
 	scheduler->current = resume;
 	mm_context_swap(&current->context, &resume->context);
 }
@@ -9,15 +9,25 @@
 
 typedef struct mm_scheduler mm_scheduler_t;
 
+/* Ready coroutines are queued by priority and run highest
+ * first. A waiting lower priority queue is served once per
+ * MM_SCHEDULER_STARVATION coroutines run ahead of it. */
+#define MM_SCHEDULER_PRIORITIES 3
+#define MM_SCHEDULER_STARVATION 64
+
 struct mm_scheduler
 {
 	mm_coroutine_t *current;
 	mm_coroutine_t  main;
 	int             count_ready;
 	int             count_active;
-	mm_list_t       list_ready;
+	mm_list_t       list_ready[MM_SCHEDULER_PRIORITIES];
+	int             count_ready_priority[MM_SCHEDULER_PRIORITIES];
+	int             count_starve[MM_SCHEDULER_PRIORITIES];
 	mm_list_t       list_active;
 	uint64_t        id_seq;
+	int             accounting;
+	uint64_t        time_switch;
 };
 
 static inline mm_coroutine_t*
@@ -62,6 +62,122 @@ int mm_socket_set_keepalive(int fd, int enable, int delay)
 	return 0;
 }
 
+int mm_socket_set_sndbuf(int fd, int size)
+{
+	int rc;
+	rc = setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	return rc;
+}
+
+int mm_socket_set_rcvbuf(int fd, int size)
+{
+	int rc;
+	rc = setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	return rc;
+}
+
+int mm_socket_set_notsent_lowat(int fd, int size)
+{
+#if defined(TCP_NOTSENT_LOWAT)
+	int rc;
+	rc = setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &size,
+	                sizeof(size));
+	return rc;
+#else
+	(void)fd;
+	(void)size;
+	errno = ENOPROTOOPT;
+	return -1;
+#endif
+}
+
+int mm_socket_set_user_timeout(int fd, int timeout)
+{
+#if defined(TCP_USER_TIMEOUT)
+	int rc;
+	rc = setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout,
+	                sizeof(timeout));
+	return rc;
+#else
+	(void)fd;
+	(void)timeout;
+	errno = ENOPROTOOPT;
+	return -1;
+#endif
+}
+
+int mm_socket_set_quickack(int fd, int enable)
+{
+#if defined(TCP_QUICKACK)
+	int rc;
+	rc = setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &enable,
+	                sizeof(enable));
+	return rc;
+#else
+	(void)fd;
+	(void)enable;
+	errno = ENOPROTOOPT;
+	return -1;
+#endif
+}
+
+int mm_socket_set_busy_poll(int fd, int usec)
+{
+#if defined(SO_BUSY_POLL)
+	int rc;
+	rc = setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+	return rc;
+#else
+	(void)fd;
+	(void)usec;
+	errno = ENOPROTOOPT;
+	return -1;
+#endif
+}
+
+int mm_socket_set_fastopen(int fd, int queue)
+{
+#if defined(TCP_FASTOPEN)
+	int rc;
+	rc = setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &queue, sizeof(queue));
+	return rc;
+#else
+	(void)fd;
+	(void)queue;
+	errno = ENOPROTOOPT;
+	return -1;
+#endif
+}
+
+int mm_socket_set_fastopen_connect(int fd, int enable)
+{
+#if defined(TCP_FASTOPEN_CONNECT)
+	int rc;
+	rc = setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &enable,
+	                sizeof(enable));
+	return rc;
+#else
+	(void)fd;
+	(void)enable;
+	errno = ENOPROTOOPT;
+	return -1;
+#endif
+}
+
+int mm_socket_set_zerocopy(int fd, int enable)
+{
+#if defined(SO_ZEROCOPY)
+	int rc;
+	rc = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable));
+	return rc;
+#else
+	(void)fd;
+	(void)enable;
+	errno = ENOPROTOOPT;
+	return -1;
+#endif
+}
+
 int mm_socket_set_nosigpipe(int fd, int enable)
 {
 #if defined(SO_NOSIGPIPE)
@@ -84,6 +200,74 @@ int mm_socket_set_reuseaddr(int fd, int enable)
 	return rc;
 }
 
+int mm_socket_set_reuseport(int fd, int enable)
+{
+	int rc;
+	rc = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable,
+	                sizeof(enable));
+	return rc;
+}
+
+int mm_socket_set_incoming_cpu(int fd, int cpu)
+{
+#if defined(SO_INCOMING_CPU)
+	int rc;
+	rc = setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu));
+	return rc;
+#else
+	(void)fd;
+	(void)cpu;
+	errno = ENOPROTOOPT;
+	return -1;
+#endif
+}
+
+int mm_socket_set_reuseport_cpu(int fd, int *cpus, int count)
+{
+#if defined(SO_ATTACH_REUSEPORT_CBPF)
+	/* select socket of reuseport group by the cpu handling the
+	 * packet: cpus[i] is the cpu of i-th socket of the group,
+	 * other cpus are spread by modulo */
+	int size = 1 + count * 2 + 2;
+	if (count <= 0 || size > BPF_MAXINSNS) {
+		errno = EINVAL;
+		return -1;
+	}
+	struct sock_filter *code;
+	code = malloc(sizeof(struct sock_filter) * size);
+	if (code == NULL)
+		return -1;
+	struct sock_filter *pos = code;
+	*pos++ = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+	                                      SKF_AD_OFF + SKF_AD_CPU);
+	int i;
+	for (i = 0; i < count; i++) {
+		*pos++ = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K,
+		                                      cpus[i], 0, 1);
+		*pos++ = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, i);
+	}
+	*pos++ = (struct sock_filter)BPF_STMT(BPF_ALU|BPF_MOD|BPF_K, count);
+	*pos++ = (struct sock_filter)BPF_STMT(BPF_RET|BPF_A, 0);
+	struct sock_fprog prog = {
+		.len    = size,
+		.filter = code
+	};
+	int rc;
+	rc = setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+	                sizeof(prog));
+	int errno_save = errno;
+	free(code);
+	errno = errno_save;
+	return rc;
+#else
+	(void)fd;
+	(void)cpus;
+	(void)count;
+	errno = ENOPROTOOPT;
+	return -1;
+#endif
+}
+
 int mm_socket_set_ipv6only(int fd, int enable)
 {
 	int rc;
@@ -154,7 +338,7 @@ int mm_socket_listen(int fd, int backlog)
 int mm_socket_accept(int fd, struct sockaddr *sa, socklen_t *slen)
 {
 	int rc;
-	rc = accept(fd, sa, slen);
+	rc = accept4(fd, sa, slen, SOCK_NONBLOCK|SOCK_CLOEXEC);
 	return rc;
 }
 
@@ -162,6 +346,9 @@ int mm_socket_write(int fd, void *buf, int size)
 {
 	int rc;
 	rc = write(fd, buf, size);
+	/* fast open connect is not established yet */
+	if (rc == -1 && errno == EINPROGRESS)
+		errno = EAGAIN;
 	return rc;
 }
 
@@ -169,9 +356,98 @@ int mm_socket_writev(int fd, struct iovec *iov, int iovc)
 {
 	int rc;
 	rc = writev(fd, iov, iovc);
+	/* fast open connect is not established yet */
+	if (rc == -1 && errno == EINPROGRESS)
+		errno = EAGAIN;
 	return rc;
 }
 
+int mm_socket_writev_more(int fd, struct iovec *iov, int iovc)
+{
+	/* hint kernel that more data follows, so the partial
+	 * segment is sent together with the next write */
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov    = iov;
+	msg.msg_iovlen = iovc;
+	int rc;
+	rc = sendmsg(fd, &msg, MSG_MORE | MSG_NOSIGNAL);
+	if (rc == -1 && errno == EINPROGRESS)
+		errno = EAGAIN;
+	return rc;
+}
+
+int mm_socket_writev_zerocopy(int fd, struct iovec *iov, int iovc, int more)
+{
+#if defined(MSG_ZEROCOPY)
+	/* pages of the iov are sent by reference and must stay
+	 * unchanged until completion is read from the error queue */
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov    = iov;
+	msg.msg_iovlen = iovc;
+	int flags = MSG_ZEROCOPY | MSG_NOSIGNAL;
+	if (more)
+		flags |= MSG_MORE;
+	int rc;
+	rc = sendmsg(fd, &msg, flags);
+	if (rc == -1 && errno == EINPROGRESS)
+		errno = EAGAIN;
+	return rc;
+#else
+	(void)fd;
+	(void)iov;
+	(void)iovc;
+	(void)more;
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+int mm_socket_zerocopy_reap(int fd, uint32_t *done, int *copied)
+{
+#if defined(SO_EE_ORIGIN_ZEROCOPY)
+	/* each notification reports a range of completed zero-copy
+	 * sends, numbered from zero per socket */
+	int count = 0;
+	for (;;) {
+		char control[128];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control    = control;
+		msg.msg_controllen = sizeof(control);
+		int rc;
+		rc = recvmsg(fd, &msg, MSG_ERRQUEUE);
+		if (rc == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return count;
+			return -1;
+		}
+		struct cmsghdr *cmsg;
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (! ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+			       (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)))
+				continue;
+			struct sock_extended_err *ee;
+			ee = (struct sock_extended_err*)CMSG_DATA(cmsg);
+			if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			if ((int32_t)(ee->ee_data + 1 - *done) > 0)
+				*done = ee->ee_data + 1;
+			if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				*copied = 1;
+			count++;
+		}
+	}
+#else
+	(void)fd;
+	(void)done;
+	(void)copied;
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
 int mm_socket_read(int fd, void *buf, int size)
 {
 	int rc;
@@ -179,6 +455,43 @@ int mm_socket_read(int fd, void *buf, int size)
 	return rc;
 }
 
+int mm_socket_peek(int fd, void *buf, int size)
+{
+	int rc;
+	rc = recv(fd, buf, size, MSG_PEEK);
+	return rc;
+}
+
+int mm_socket_splice(int fd_in, int fd_out, int size)
+{
+	int rc;
+	rc = splice(fd_in, NULL, fd_out, NULL, size,
+	            SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+	return rc;
+}
+
+int mm_socket_pipe(int *fds)
+{
+	int rc;
+	rc = pipe2(fds, O_NONBLOCK|O_CLOEXEC);
+	if (rc == -1)
+		return -1;
+	rc = fcntl(fds[0], F_GETPIPE_SZ);
+	if (rc == -1) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	return rc;
+}
+
+int mm_socket_pair(int *fds)
+{
+	int rc;
+	rc = socketpair(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0, fds);
+	return rc;
+}
+
 int mm_socket_getsockname(int fd, struct sockaddr *sa, socklen_t *salen)
 {
 	int rc;
@@ -193,6 +506,23 @@ int mm_socket_getpeername(int fd, struct sockaddr *sa, socklen_t *salen)
 	return rc;
 }
 
+int mm_socket_getpeereid(int fd, uid_t *uid, gid_t *gid)
+{
+#if defined(SO_PEERCRED)
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	int rc;
+	rc = getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len);
+	if (rc == -1)
+		return -1;
+	*uid = cred.uid;
+	*gid = cred.gid;
+	return 0;
+#else
+	return getpeereid(fd, uid, gid);
+#endif
+}
+
 int mm_socket_getaddrinfo(char *node,
                           char *service,
                           struct addrinfo *hints,
@@ -12,9 +12,21 @@ int mm_socket_eventfd(unsigned int);
 int mm_socket_set_nonblock(int, int);
 int mm_socket_set_nodelay(int, int);
 int mm_socket_set_keepalive(int, int, int);
+int mm_socket_set_sndbuf(int, int);
+int mm_socket_set_rcvbuf(int, int);
+int mm_socket_set_notsent_lowat(int, int);
+int mm_socket_set_user_timeout(int, int);
+int mm_socket_set_quickack(int, int);
+int mm_socket_set_busy_poll(int, int);
+int mm_socket_set_fastopen(int, int);
+int mm_socket_set_fastopen_connect(int, int);
+int mm_socket_set_zerocopy(int, int);
 int mm_socket_set_nosigpipe(int, int);
 int mm_socket_set_reuseaddr(int, int);
+int mm_socket_set_reuseport(int, int);
 int mm_socket_set_ipv6only(int, int);
+int mm_socket_set_incoming_cpu(int, int);
+int mm_socket_set_reuseport_cpu(int, int*, int);
 int mm_socket_error(int);
 int mm_socket_connect(int, struct sockaddr*);
 int mm_socket_bind(int, struct sockaddr*);
@@ -22,9 +34,17 @@ int mm_socket_listen(int, int);
 int mm_socket_accept(int, struct sockaddr*, socklen_t*);
 int mm_socket_write(int, void*, int);
 int mm_socket_writev(int, struct iovec*, int);
+int mm_socket_writev_more(int, struct iovec*, int);
+int mm_socket_writev_zerocopy(int, struct iovec*, int, int);
+int mm_socket_zerocopy_reap(int, uint32_t*, int*);
 int mm_socket_read(int, void*, int);
+int mm_socket_peek(int, void*, int);
+int mm_socket_splice(int, int, int);
+int mm_socket_pipe(int*);
+int mm_socket_pair(int*);
 int mm_socket_getsockname(int, struct sockaddr*, socklen_t*);
 int mm_socket_getpeername(int, struct sockaddr*, socklen_t*);
+int mm_socket_getpeereid(int, uid_t*, gid_t*);
 int mm_socket_getaddrinfo(char*, char*, struct addrinfo*,
                           struct addrinfo**);
 
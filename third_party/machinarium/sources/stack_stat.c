@@ -0,0 +1,57 @@
+
+/*
+ * machinarium.
+ *
+ * cooperative multitasking engine.
+*/
+
+#include <machinarium.h>
+#include <machinarium_private.h>
+
+void mm_stackstat_init(mm_stackstat_t *stat)
+{
+	mm_sleeplock_init(&stat->lock);
+	stat->count = 0;
+	memset(stat->functions, 0, sizeof(stat->functions));
+}
+
+void mm_stackstat_add(mm_stackstat_t *stat, machine_coroutine_t function,
+                      size_t used)
+{
+	mm_sleeplock_lock(&stat->lock);
+	machine_stack_stat_t *entry = NULL;
+	int i;
+	for (i = 0; i < stat->count; i++) {
+		if (stat->functions[i].function == function) {
+			entry = &stat->functions[i];
+			break;
+		}
+	}
+	if (entry == NULL) {
+		if (stat->count < MM_STACKSTAT_MAX - 1) {
+			entry = &stat->functions[stat->count++];
+			entry->function = function;
+		} else {
+			entry = &stat->functions[MM_STACKSTAT_MAX - 1];
+			entry->function = NULL;
+			stat->count = MM_STACKSTAT_MAX;
+		}
+	}
+	entry->count++;
+	entry->used_sum += used;
+	if (used > entry->used_max)
+		entry->used_max = used;
+	mm_sleeplock_unlock(&stat->lock);
+}
+
+int mm_stackstat_copy(mm_stackstat_t *stat, machine_stack_stat_t *stats,
+                      int max)
+{
+	mm_sleeplock_lock(&stat->lock);
+	int count = stat->count;
+	if (count > max)
+		count = max;
+	memcpy(stats, stat->functions, sizeof(machine_stack_stat_t) * count);
+	mm_sleeplock_unlock(&stat->lock);
+	return count;
+}
@@ -0,0 +1,29 @@
+#ifndef MM_STACK_STAT_H
+#define MM_STACK_STAT_H
+
+/*
+ * machinarium.
+ *
+ * cooperative multitasking engine.
+*/
+
+typedef struct mm_stackstat mm_stackstat_t;
+
+/* Stack usage of finished coroutines by coroutine function, shared
+ * by all machines. Functions over the limit are counted in the last
+ * entry with no function. */
+
+#define MM_STACKSTAT_MAX 64
+
+struct mm_stackstat
+{
+	mm_sleeplock_t       lock;
+	int                  count;
+	machine_stack_stat_t functions[MM_STACKSTAT_MAX];
+};
+
+void mm_stackstat_init(mm_stackstat_t*);
+void mm_stackstat_add(mm_stackstat_t*, machine_coroutine_t, size_t);
+int  mm_stackstat_copy(mm_stackstat_t*, machine_stack_stat_t*, int);
+
+#endif /* MM_STACK_STAT_H */
@@ -16,10 +16,11 @@ struct mm_timer
 	int                  active;
 	uint64_t             timeout;
 	uint32_t             interval;
-	int                  seq;
+	int                  slot;
 	mm_timer_callback_t  callback;
 	void                *arg;
 	void                *clock;
+	mm_list_t            link;
 };
 
 static inline void
@@ -29,10 +30,11 @@ mm_timer_init(mm_timer_t *timer, mm_timer_callback_t cb, void *arg,
 	timer->active = 0;
 	timer->interval = interval;
 	timer->timeout = 0;
-	timer->seq = 0;
+	timer->slot = -1;
 	timer->callback = cb;
 	timer->arg = arg;
 	timer->clock = NULL;
+	mm_list_init(&timer->link);
 }
 
 #endif /* MM_TIMER_H */
@@ -57,6 +57,320 @@ mm_tls_lock_free(void)
 
 #endif
 
+/* Session ticket keys are shared by all server contexts, so any
+ * worker machine can resume a session started by another one or
+ * by a context created before reload.
+ *
+ * Current key is used to issue tickets, previous key is kept to
+ * accept and renew tickets issued before rotation.
+*/
+
+typedef struct
+{
+	unsigned char name[16];
+	unsigned char aes_key[32];
+	unsigned char hmac_key[32];
+} mm_tls_ticket_key_t;
+
+static struct
+{
+	pthread_rwlock_t    lock;
+	mm_tls_ticket_key_t keys[2];
+	int                 current;
+} mm_tls_tickets;
+
+static void
+mm_tls_ticket_key_generate(mm_tls_ticket_key_t *key)
+{
+	if (RAND_bytes((unsigned char*)key, sizeof(*key)) != 1)
+		abort();
+}
+
+static void
+mm_tls_tickets_init(void)
+{
+	pthread_rwlock_init(&mm_tls_tickets.lock, NULL);
+	mm_tls_ticket_key_generate(&mm_tls_tickets.keys[0]);
+	mm_tls_ticket_key_generate(&mm_tls_tickets.keys[1]);
+	mm_tls_tickets.current = 0;
+}
+
+static void
+mm_tls_tickets_free(void)
+{
+	OPENSSL_cleanse(mm_tls_tickets.keys, sizeof(mm_tls_tickets.keys));
+	pthread_rwlock_destroy(&mm_tls_tickets.lock);
+}
+
+void
+mm_tls_ticket_rotate(void)
+{
+	mm_tls_ticket_key_t key;
+	mm_tls_ticket_key_generate(&key);
+	pthread_rwlock_wrlock(&mm_tls_tickets.lock);
+	int next = !mm_tls_tickets.current;
+	memcpy(&mm_tls_tickets.keys[next], &key, sizeof(key));
+	mm_tls_tickets.current = next;
+	pthread_rwlock_unlock(&mm_tls_tickets.lock);
+	OPENSSL_cleanse(&key, sizeof(key));
+}
+
+#if !USE_BORINGSSL && (OPENSSL_VERSION_NUMBER >= 0x30000000L)
+typedef EVP_MAC_CTX mm_tls_hmac_ctx_t;
+
+static inline int
+mm_tls_ticket_hmac_init(EVP_MAC_CTX *hctx, mm_tls_ticket_key_t *key)
+{
+	OSSL_PARAM params[3];
+	params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+	                                              key->hmac_key,
+	                                              sizeof(key->hmac_key));
+	params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+	                                             "sha256", 0);
+	params[2] = OSSL_PARAM_construct_end();
+	return EVP_MAC_CTX_set_params(hctx, params);
+}
+#else
+typedef HMAC_CTX mm_tls_hmac_ctx_t;
+
+static inline int
+mm_tls_ticket_hmac_init(HMAC_CTX *hctx, mm_tls_ticket_key_t *key)
+{
+	return HMAC_Init_ex(hctx, key->hmac_key, sizeof(key->hmac_key),
+	                    EVP_sha256(), NULL);
+}
+#endif
+
+static int
+mm_tls_ticket_cb(SSL *ssl, unsigned char *name, unsigned char *iv,
+                 EVP_CIPHER_CTX *ectx, mm_tls_hmac_ctx_t *hctx, int enc)
+{
+	(void)ssl;
+	int rc = -1;
+	pthread_rwlock_rdlock(&mm_tls_tickets.lock);
+	mm_tls_ticket_key_t *key;
+	if (enc) {
+		key = &mm_tls_tickets.keys[mm_tls_tickets.current];
+		memcpy(name, key->name, sizeof(key->name));
+		if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1)
+			goto done;
+		if (! EVP_EncryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, key->aes_key, iv))
+			goto done;
+		if (! mm_tls_ticket_hmac_init(hctx, key))
+			goto done;
+		rc = 1;
+		goto done;
+	}
+
+	/* find key used to issue the ticket */
+	int i;
+	for (i = 0; i < 2; i++) {
+		key = &mm_tls_tickets.keys[i];
+		if (memcmp(name, key->name, sizeof(key->name)) == 0)
+			break;
+	}
+	if (i == 2) {
+		/* unknown or expired key, do full handshake */
+		rc = 0;
+		goto done;
+	}
+	if (! mm_tls_ticket_hmac_init(hctx, key))
+		goto done;
+	if (! EVP_DecryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, key->aes_key, iv))
+		goto done;
+	/* always ask to renew: tickets issued by a resumed TLSv1.3
+	 * session are not resumable otherwise */
+	rc = 2;
+done:
+	pthread_rwlock_unlock(&mm_tls_tickets.lock);
+	return rc;
+}
+
+int
+mm_tls_alpn_select_cb(SSL *ssl, const unsigned char **out, unsigned char *outlen,
+                      const unsigned char *in, unsigned int inlen, void *arg)
+{
+	/* clients offering application protocols must offer ours */
+	(void)ssl;
+	mm_tls_t *tls = arg;
+	unsigned char *selected;
+	int rc;
+	rc = SSL_select_next_proto(&selected, outlen, tls->alpn, tls->alpn_len,
+	                           in, inlen);
+	if (rc != OPENSSL_NPN_NEGOTIATED)
+		return SSL_TLSEXT_ERR_ALERT_FATAL;
+	*out = selected;
+	return SSL_TLSEXT_ERR_OK;
+}
+
+static int
+mm_tls_session_new_cb(SSL *ssl, SSL_SESSION *session)
+{
+	mm_tls_t *tls = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+	/* keep a copy, since the connection session is marked as
+	 * not resumable when it is closed without shutdown */
+	SSL_SESSION *copy = SSL_SESSION_dup(session);
+	if (copy == NULL)
+		return 0;
+	pthread_mutex_lock(&tls->session_lock);
+	if (tls->session)
+		SSL_SESSION_free(tls->session);
+	tls->session = copy;
+	pthread_mutex_unlock(&tls->session_lock);
+	return 0;
+}
+
+static inline int
+mm_tls_context_id(mm_tls_t *tls, unsigned char *id, unsigned int *id_len)
+{
+	/* contexts created with the same settings share session id context,
+	 * which allows to resume sessions between them */
+	EVP_MD_CTX *ctx = EVP_MD_CTX_create();
+	if (ctx == NULL)
+		return -1;
+	int rc = EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+	if (rc)
+		rc = EVP_DigestUpdate(ctx, &tls->verify, sizeof(tls->verify));
+	char *options[] = {
+		tls->protocols, tls->ca_path, tls->ca_file,
+		tls->cert_file, tls->key_file
+	};
+	unsigned int i;
+	for (i = 0; rc && i < sizeof(options) / sizeof(options[0]); i++) {
+		char *option = options[i] ? options[i] : "";
+		rc = EVP_DigestUpdate(ctx, option, strlen(option) + 1);
+	}
+	if (rc)
+		rc = EVP_DigestFinal_ex(ctx, id, id_len);
+	EVP_MD_CTX_destroy(ctx);
+	return rc ? 0 : -1;
+}
+
+int
+mm_tls_context_sessions(mm_tls_t *tls, int is_client)
+{
+	SSL_CTX *ctx = tls->tls_ctx;
+	SSL_CTX_set_app_data(ctx, tls);
+
+	if (is_client) {
+		/* keep last session to resume next connections */
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT|
+		                                    SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(ctx, mm_tls_session_new_cb);
+		return 0;
+	}
+
+	unsigned char id[EVP_MAX_MD_SIZE];
+	unsigned int  id_len;
+	if (mm_tls_context_id(tls, id, &id_len) == -1)
+		return -1;
+	if (id_len > SSL_MAX_SID_CTX_LENGTH)
+		id_len = SSL_MAX_SID_CTX_LENGTH;
+	if (! SSL_CTX_set_session_id_context(ctx, id, id_len))
+		return -1;
+
+	if (tls->session_cache_size == 0) {
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+		SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+		return 0;
+	}
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_sess_set_cache_size(ctx, tls->session_cache_size);
+	SSL_CTX_set_timeout(ctx, tls->session_timeout);
+#if !USE_BORINGSSL && (OPENSSL_VERSION_NUMBER >= 0x30000000L)
+	SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, mm_tls_ticket_cb);
+#else
+	SSL_CTX_set_tlsext_ticket_key_cb(ctx, mm_tls_ticket_cb);
+#endif
+	return 0;
+}
+
+/* Chain verification of client certificates is cached by the
+ * sha256 of the leaf certificate, per context, so a client which
+ * reconnects with the same certificate after its session is gone
+ * skips the chain walk and signature checks. Entries expire after
+ * the cache timeout and never after notAfter of the certificate.
+ * The cache is direct mapped: an entry is replaced by the next
+ * certificate of the same slot. */
+
+#if USE_BORINGSSL || (OPENSSL_VERSION_NUMBER >= 0x10100000L)
+
+static inline mm_tls_verified_t*
+mm_tls_verify_cache_slot(mm_tls_t *tls, unsigned char *digest)
+{
+	uint32_t hash;
+	memcpy(&hash, digest, sizeof(hash));
+	return &tls->verify_cache[hash % tls->verify_cache_size];
+}
+
+static int
+mm_tls_verify_cache_cb(X509_STORE_CTX *store, void *arg)
+{
+	mm_tls_t *tls = arg;
+	X509 *cert = X509_STORE_CTX_get0_cert(store);
+	unsigned char digest[32];
+	unsigned int digest_len = 0;
+	if (cert == NULL ||
+	    ! X509_digest(cert, EVP_sha256(), digest, &digest_len) ||
+	    digest_len != sizeof(digest))
+		return X509_verify_cert(store);
+
+	time_t now = time(NULL);
+	mm_tls_verified_t *slot;
+	slot = mm_tls_verify_cache_slot(tls, digest);
+	pthread_mutex_lock(&tls->verify_cache_lock);
+	int hit = slot->expire > now &&
+	          memcmp(slot->digest, digest, sizeof(digest)) == 0;
+	pthread_mutex_unlock(&tls->verify_cache_lock);
+	if (hit)
+		return 1;
+
+	int rc = X509_verify_cert(store);
+	if (rc != 1)
+		return rc;
+
+	int days;
+	int secs;
+	if (! ASN1_TIME_diff(&days, &secs, NULL, X509_get0_notAfter(cert)))
+		return rc;
+	time_t left = (time_t)days * 86400 + secs;
+	if (left <= 0)
+		return rc;
+	if (left > tls->verify_cache_timeout)
+		left = tls->verify_cache_timeout;
+	pthread_mutex_lock(&tls->verify_cache_lock);
+	memcpy(slot->digest, digest, sizeof(digest));
+	slot->expire = now + left;
+	pthread_mutex_unlock(&tls->verify_cache_lock);
+	return rc;
+}
+
+int
+mm_tls_context_verify_cache(mm_tls_t *tls, SSL_CTX *ctx)
+{
+	if (tls->verify_cache)
+		free(tls->verify_cache);
+	tls->verify_cache = calloc(tls->verify_cache_size,
+	                           sizeof(mm_tls_verified_t));
+	if (tls->verify_cache == NULL)
+		return -1;
+	SSL_CTX_set_cert_verify_callback(ctx, mm_tls_verify_cache_cb, tls);
+	return 0;
+}
+
+#else
+
+int
+mm_tls_context_verify_cache(mm_tls_t *tls, SSL_CTX *ctx)
+{
+	/* verification is not cached by old openssl */
+	(void)tls;
+	(void)ctx;
+	return 0;
+}
+
+#endif
+
 void
 mm_tls_engine_init(void)
 {
@@ -65,11 +379,13 @@ mm_tls_engine_init(void)
 #if !USE_BORINGSSL && (OPENSSL_VERSION_NUMBER < 0x10100000L)
 	mm_tls_lock_init();
 #endif
+	mm_tls_tickets_init();
 }
 
 void
 mm_tls_engine_free(void)
 {
+	mm_tls_tickets_free();
 #if !USE_BORINGSSL && (OPENSSL_VERSION_NUMBER < 0x10100000L)
 	mm_tls_lock_free();
 	ERR_remove_state(getpid());
@@ -87,6 +403,41 @@ mm_tls_engine_free(void)
 	ERR_free_strings();
 }
 
+int
+mm_tls_engine_load(char *name)
+{
+#if USE_BORINGSSL
+	(void)name;
+	return -1;
+#elif OPENSSL_VERSION_NUMBER >= 0x30000000L
+	/* engines are providers since openssl 3: algorithms of the
+	 * loaded one are preferred, default ones are kept for the rest */
+	if (OSSL_PROVIDER_load(NULL, name) == NULL)
+		return -1;
+	if (OSSL_PROVIDER_load(NULL, "default") == NULL)
+		return -1;
+	char query[128];
+	mm_snprintf(query, sizeof(query), "?provider=%s", name);
+	if (! EVP_set_default_properties(NULL, query))
+		return -1;
+	return 0;
+#else
+	ENGINE *engine = ENGINE_by_id(name);
+	if (engine == NULL)
+		return -1;
+	if (! ENGINE_init(engine)) {
+		ENGINE_free(engine);
+		return -1;
+	}
+	/* functional reference of init is kept for the process */
+	int rc = ENGINE_set_default(engine, ENGINE_METHOD_ALL);
+	ENGINE_free(engine);
+	if (! rc)
+		return -1;
+	return 0;
+#endif
+}
+
 void
 mm_tls_init(mm_io_t *io)
 {
@@ -98,6 +449,8 @@ mm_tls_free(mm_io_t *io)
 {
 	if (io->tls_ssl)
 		SSL_free(io->tls_ssl);
+	if (io->tls_stage)
+		free(io->tls_stage);
 }
 
 void
@@ -194,6 +547,20 @@ mm_tls_prepare(mm_io_t *io)
 		}
 	}
 
+#ifdef MM_TLS_ASYNC
+	/* only handshakes are paused, records are processed as usual */
+	if (io->tls->async)
+		SSL_set_mode(ssl, SSL_MODE_ASYNC);
+#endif
+
+	/* resume previous session */
+	if (! io->accepted) {
+		pthread_mutex_lock(&io->tls->session_lock);
+		if (io->tls->session)
+			SSL_set_session(ssl, io->tls->session);
+		pthread_mutex_unlock(&io->tls->session_lock);
+	}
+
 	/* set socket */
 	rc = SSL_set_rfd(ssl, io->fd);
 	if (rc == -1) {
@@ -320,6 +687,58 @@ error:
 }
 
 
+#ifdef MM_TLS_ASYNC
+static void mm_tls_handshake_cb(mm_fd_t*);
+
+static void
+mm_tls_handshake_async_cb(mm_fd_t *handle)
+{
+	/* crypto job is ready to be resumed by the next handshake call */
+	mm_machine_t *machine = mm_self;
+	mm_io_t *io = handle->on_read_arg;
+	mm_loop_delete(&machine->loop, &io->tls_async_handle);
+	io->tls_async_wait = 0;
+	int rc;
+	rc = mm_loop_read_write(&machine->loop, &io->handle, mm_tls_handshake_cb, io);
+	if (rc == -1) {
+		mm_errno_set(errno);
+		io->call.status = -1;
+		mm_scheduler_wakeup(&machine->scheduler, io->call.coroutine);
+		return;
+	}
+	mm_tls_handshake_cb(&io->handle);
+}
+
+static inline int
+mm_tls_handshake_async(mm_io_t *io)
+{
+	/* wait for the notification of the engine instead of the
+	 * socket, so paused handshake is not retried on every event */
+	mm_machine_t *machine = mm_self;
+	OSSL_ASYNC_FD fd;
+	size_t count = 0;
+	SSL_get_all_async_fds(io->tls_ssl, NULL, &count);
+	if (count != 1)
+		return 0;
+	SSL_get_all_async_fds(io->tls_ssl, &fd, &count);
+	int rc;
+	rc = mm_loop_read_write_stop(&machine->loop, &io->handle);
+	if (rc == -1)
+		return -1;
+	memset(&io->tls_async_handle, 0, sizeof(io->tls_async_handle));
+	io->tls_async_handle.fd = fd;
+	rc = mm_loop_add(&machine->loop, &io->tls_async_handle, 0);
+	if (rc == -1)
+		return -1;
+	io->tls_async_wait = 1;
+	rc = mm_loop_read(&machine->loop, &io->tls_async_handle,
+	                  mm_tls_handshake_async_cb, io);
+	if (rc == -1)
+		return -1;
+	return 0;
+}
+#endif
+
 static void
 mm_tls_handshake_cb(mm_fd_t *handle)
 {
@@ -337,8 +756,26 @@ mm_tls_handshake_cb(mm_fd_t *handle)
 	if (rc <= 0)
 	{
 		int error = SSL_get_error(io->tls_ssl, rc);
-		if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+		if (error == SSL_ERROR_WANT_READ) {
+			mm_fd_drained(&io->handle, MM_R);
+			return;
+		}
+		if (error == SSL_ERROR_WANT_WRITE) {
+			mm_fd_drained(&io->handle, MM_W);
 			return;
+		}
+#ifdef MM_TLS_ASYNC
+		/* no free job is retried on the next socket event */
+		if (error == SSL_ERROR_WANT_ASYNC_JOB)
+			return;
+		if (error == SSL_ERROR_WANT_ASYNC) {
+			if (mm_tls_handshake_async(io) == 0)
+				return;
+			mm_errno_set(errno);
+			call->status = -1;
+			goto done;
+		}
+#endif
 		if (io->connected)
 			mm_tls_error(io, rc, "SSL_connect()");
 		else
@@ -375,6 +812,12 @@ mm_tls_handshake(mm_io_t *io, uint32_t timeout)
 	/* wait for completion */
 	mm_call(&io->call, MM_CALL_HANDSHAKE, timeout);
 
+#ifdef MM_TLS_ASYNC
+	if (io->tls_async_wait) {
+		mm_loop_delete(&machine->loop, &io->tls_async_handle);
+		io->tls_async_wait = 0;
+	}
+#endif
 	rc = mm_loop_read_write_stop(&machine->loop, &io->handle);
 	if (rc == -1) {
 		mm_errno_set(errno);
@@ -384,6 +827,10 @@ mm_tls_handshake(mm_io_t *io, uint32_t timeout)
 	if (io->call.status != 0)
 		return -1;
 
+#ifdef MM_TLS_ASYNC
+	SSL_clear_mode(io->tls_ssl, SSL_MODE_ASYNC);
+#endif
+
 	if (is_client)
 	{
 		if (io->tls->server) {
@@ -392,12 +839,18 @@ mm_tls_handshake(mm_io_t *io, uint32_t timeout)
 				return -1;
 		}
 
+		/* result is set even when verification is disabled */
 		rc = SSL_get_verify_result(io->tls_ssl);
-		if (rc != X509_V_OK) {
+		if (io->tls->verify != MM_TLS_NONE && rc != X509_V_OK) {
 			mm_tls_error(io, 0, "SSL_get_verify_result()");
 			return -1;
 		}
 	}
+
+	/* records are encrypted by the kernel, application data
+	 * can be written to the socket directly */
+	io->tls_ktls_send = BIO_get_ktls_send(SSL_get_wbio(io->tls_ssl));
+	io->tls_ktls_recv = BIO_get_ktls_recv(SSL_get_rbio(io->tls_ssl));
 	return 0;
 }
 
@@ -405,6 +858,8 @@ int
 mm_tls_write(mm_io_t *io, char *buf, int size)
 {
 	mm_tls_error_reset(io);
+	if (io->tls_ktls_send)
+		return mm_socket_write(io->fd, buf, size);
 	int rc;
 	rc = SSL_write(io->tls_ssl, buf, size);
 	if (rc > 0)
@@ -422,25 +877,60 @@ int
 mm_tls_writev(mm_io_t *io, struct iovec *iov, int n)
 {
 	mm_tls_error_reset(io);
-
-	int size = mm_iov_size_of(iov, n);
-	char *buffer = malloc(size);
-	if (buffer == NULL) {
-		errno = ENOMEM;
-		return -1;
+	if (io->tls_ktls_send)
+		return mm_socket_writev(io->fd, iov, n);
+
+	char *buf;
+	int size;
+	if (io->tls_stage_pending > 0) {
+		/* SSL_write() interrupted by WANT_READ or WANT_WRITE must be
+		 * retried with the same data, which stays at the iov head
+		 * until it is reported as written */
+		size = io->tls_stage_pending;
+		buf = io->tls_stage_used ? io->tls_stage : iov->iov_base;
+	} else
+	if (n == 1 || iov->iov_len >= MM_TLS_RECORD_SIZE) {
+		/* write large buffer as is */
+		size = iov->iov_len;
+		if (iov->iov_len > INT_MAX)
+			size = INT_MAX;
+		buf = iov->iov_base;
+		io->tls_stage_used = 0;
+	} else {
+		/* gather small buffers, staging buffer is kept by io */
+		if (io->tls_stage == NULL) {
+			io->tls_stage = malloc(MM_TLS_STAGE_SIZE);
+			if (io->tls_stage == NULL) {
+				errno = ENOMEM;
+				return -1;
+			}
+		}
+		size = 0;
+		int i = 0;
+		for (; i < n && size < MM_TLS_STAGE_SIZE; i++) {
+			int len = iov[i].iov_len;
+			if (len > MM_TLS_STAGE_SIZE - size)
+				len = MM_TLS_STAGE_SIZE - size;
+			memcpy(io->tls_stage + size, iov[i].iov_base, len);
+			size += len;
+		}
+		buf = io->tls_stage;
+		io->tls_stage_used = 1;
 	}
-	mm_iovcpy(buffer, iov, n);
 
 	int rc;
-	rc = SSL_write(io->tls_ssl, buffer, size);
-	free(buffer);
-	if (rc > 0)
+	rc = SSL_write(io->tls_ssl, buf, size);
+	if (rc > 0) {
+		io->tls_stage_pending = 0;
 		return rc;
+	}
 	int error = SSL_get_error(io->tls_ssl, rc);
 	if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+		io->tls_stage_pending = size;
 		errno = EAGAIN;
 		return -1;
 	}
+	io->tls_stage_pending = 0;
 	mm_tls_error(io, rc, "SSL_write()");
 	return -1;
 }
@@ -7,14 +7,38 @@
  * cooperative multitasking engine.
 */
 
+/* kernel tls offload */
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+#  define MM_TLS_KTLS 1
+#endif
+
+/* handshakes paused while an engine or provider computes */
+#if !USE_BORINGSSL && defined(SSL_MODE_ASYNC) && !defined(OPENSSL_NO_ASYNC)
+#  define MM_TLS_ASYNC 1
+#endif
+
+/* max size of a tls record payload */
+#define MM_TLS_RECORD_SIZE 16384
+
+/* small buffers of a writev are gathered into a staging buffer of
+ * this size, so they are sent in full records */
+#define MM_TLS_STAGE_SIZE (4 * MM_TLS_RECORD_SIZE)
+
 void mm_tls_engine_init(void);
 void mm_tls_engine_free(void);
+int  mm_tls_engine_load(char*);
 
 static inline int
 mm_tls_is_active(mm_io_t *io) {
 	return io->tls_ssl != NULL;
 }
 
+void mm_tls_ticket_rotate(void);
+int  mm_tls_context_sessions(mm_tls_t*, int);
+int  mm_tls_context_verify_cache(mm_tls_t*, SSL_CTX*);
+int  mm_tls_alpn_select_cb(SSL*, const unsigned char**, unsigned char*,
+                           const unsigned char*, unsigned int, void*);
+
 void mm_tls_init(mm_io_t*);
 void mm_tls_free(mm_io_t*);
 void mm_tls_error_reset(mm_io_t*);
@@ -0,0 +1,208 @@
+
+/*
+ * machinarium.
+ *
+ * cooperative multitasking engine.
+*/
+
+#include <machinarium.h>
+#include <machinarium_private.h>
+
+static void
+mm_watchdog_on_signal(int signo, siginfo_t *info, void *context)
+{
+	(void)signo;
+	(void)info;
+	(void)context;
+	mm_machine_t *machine = mm_self;
+	if (machine == NULL || machine->stall_state != MM_STALL_REQUEST)
+		return;
+	int errno_ = errno;
+	machine_stall_t *stall = &machine->stall;
+	mm_coroutine_t *coroutine;
+	coroutine = mm_scheduler_current(&machine->scheduler);
+	stall->coroutine_id = 0;
+	stall->function     = NULL;
+	stall->function_arg = NULL;
+	if (coroutine && coroutine != &machine->scheduler.main) {
+		stall->coroutine_id = coroutine->id;
+		stall->function     = coroutine->function;
+		stall->function_arg = coroutine->function_arg;
+	}
+	/* unwinds from the alternate stack through the signal
+	 * frame into the stack of the coroutine */
+	stall->frames_count = backtrace(stall->frames, MACHINE_STALL_FRAMES);
+	__sync_synchronize();
+	machine->stall_state = MM_STALL_READY;
+	errno = errno_;
+}
+
+static inline void
+mm_watchdog_sleep(uint64_t ns)
+{
+	struct timespec ts;
+	ts.tv_sec  = ns / 1000000000ull;
+	ts.tv_nsec = ns % 1000000000ull;
+	nanosleep(&ts, NULL);
+}
+
+static inline void
+mm_watchdog_capture(mm_machine_t *machine, uint64_t duration_ns,
+                    machine_stall_t *stall)
+{
+	machine->stall_state = MM_STALL_REQUEST;
+	__sync_synchronize();
+	int rc;
+	rc = pthread_kill(machine->thread.id, SIGRTMIN);
+
+	/* wait for the handler a bit, a thread which does not
+	 * respond is reported without frames */
+	int i;
+	for (i = 0; rc == 0 && i < 100; i++) {
+		if (machine->stall_state == MM_STALL_READY)
+			break;
+		mm_watchdog_sleep(100000);
+	}
+	if (rc == 0 && machine->stall_state == MM_STALL_READY) {
+		__sync_synchronize();
+		*stall = machine->stall;
+	} else {
+		memset(stall, 0, sizeof(*stall));
+	}
+	machine->stall_state = MM_STALL_IDLE;
+
+	stall->machine_id = machine->id;
+	memset(stall->machine_name, 0, sizeof(stall->machine_name));
+	if (machine->name)
+		strncpy(stall->machine_name, machine->name,
+		        sizeof(stall->machine_name) - 1);
+	stall->duration_us = duration_ns / 1000;
+}
+
+static void*
+mm_watchdog_main(void *arg)
+{
+	mm_watchdog_t *watchdog = arg;
+	mm_machinemgr_t *mgr = &machinarium.machine_mgr;
+	pthread_setname_np(pthread_self(), "watchdog");
+
+	/* check twice per threshold, so a stall is caught before
+	 * it is 1.5 thresholds long */
+	uint64_t interval = watchdog->threshold_ns / 2;
+	machine_stall_t stalls[MM_WATCHDOG_BATCH];
+	while (! watchdog->stop)
+	{
+		mm_watchdog_sleep(interval);
+		int count = 0;
+		uint64_t now = mm_clock_gettime();
+		mm_machinemgr_lock(mgr);
+		mm_list_t *i;
+		mm_list_foreach(&mgr->list, i) {
+			mm_machine_t *machine;
+			machine = mm_container_of(i, mm_machine_t, link);
+			if (! machine->online || machine->stall_stack == NULL)
+				continue;
+			/* zero while the loop sleeps in poll */
+			uint64_t busy = machine->loop.time_busy;
+			if (busy == 0 || busy == machine->stall_reported ||
+			    now < busy || now - busy < watchdog->threshold_ns)
+				continue;
+			machine->stall_reported = busy;
+			mm_watchdog_capture(machine, now - busy, &stalls[count]);
+			if (++count == MM_WATCHDOG_BATCH)
+				break;
+		}
+		mm_machinemgr_unlock(mgr);
+
+		int j;
+		for (j = 0; j < count; j++)
+			watchdog->callback(&stalls[j], watchdog->arg);
+	}
+	return NULL;
+}
+
+void
+mm_watchdog_init(mm_watchdog_t *watchdog)
+{
+	memset(watchdog, 0, sizeof(*watchdog));
+}
+
+int
+mm_watchdog_start(mm_watchdog_t *watchdog, int threshold_ms,
+                  machine_stall_cb_t callback, void *arg)
+{
+	watchdog->threshold_ns = (uint64_t)threshold_ms * 1000000;
+	watchdog->callback     = callback;
+	watchdog->arg          = arg;
+	watchdog->stop         = 0;
+
+	/* first backtrace() call loads the unwinder, which is not
+	 * safe in the signal handler */
+	void *frame;
+	backtrace(&frame, 1);
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = mm_watchdog_on_signal;
+	action.sa_flags     = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	int rc;
+	rc = sigaction(SIGRTMIN, &action, NULL);
+	if (rc == -1)
+		return -1;
+
+	/* watchdog thread does not take signals of the process */
+	sigset_t mask, mask_prev;
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &mask_prev);
+	rc = pthread_create(&watchdog->thread, NULL, mm_watchdog_main, watchdog);
+	pthread_sigmask(SIG_SETMASK, &mask_prev, NULL);
+	if (rc != 0)
+		return -1;
+	watchdog->active = 1;
+	return 0;
+}
+
+void
+mm_watchdog_stop(mm_watchdog_t *watchdog)
+{
+	if (! watchdog->active)
+		return;
+	watchdog->stop = 1;
+	pthread_join(watchdog->thread, NULL);
+	watchdog->active = 0;
+}
+
+int
+mm_watchdog_attach(mm_machine_t *machine)
+{
+	/* alternate stack is per thread, coroutine stacks are too
+	 * small to unwind on */
+	stack_t stack;
+	stack.ss_sp = malloc(MM_WATCHDOG_STACK_SIZE);
+	if (stack.ss_sp == NULL)
+		return -1;
+	stack.ss_size  = MM_WATCHDOG_STACK_SIZE;
+	stack.ss_flags = 0;
+	int rc;
+	rc = sigaltstack(&stack, NULL);
+	if (rc == -1) {
+		free(stack.ss_sp);
+		return -1;
+	}
+	machine->stall_stack = stack.ss_sp;
+	return 0;
+}
+
+void
+mm_watchdog_detach(mm_machine_t *machine)
+{
+	if (machine->stall_stack == NULL)
+		return;
+	stack_t stack;
+	memset(&stack, 0, sizeof(stack));
+	stack.ss_flags = SS_DISABLE;
+	sigaltstack(&stack, NULL);
+	free(machine->stall_stack);
+	machine->stall_stack = NULL;
+}
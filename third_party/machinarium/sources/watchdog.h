@@ -0,0 +1,48 @@
+#ifndef MM_WATCHDOG_H
+#define MM_WATCHDOG_H
+
+/*
+ * machinarium.
+ *
+ * cooperative multitasking engine.
+*/
+
+typedef struct mm_watchdog mm_watchdog_t;
+
+/* Watchdog thread looks for machines which have not returned
+ * to poll for longer than the threshold. Stalled machine thread
+ * is interrupted by a signal, its handler takes the current
+ * coroutine and its backtrace on the alternate signal stack.
+ *
+ * Each stall is reported once, by the callback called on the
+ * watchdog thread. */
+
+#define MM_WATCHDOG_STACK_SIZE (64 * 1024)
+
+/* machines stalled at once reported per pass */
+#define MM_WATCHDOG_BATCH 8
+
+enum
+{
+	MM_STALL_IDLE,
+	MM_STALL_REQUEST,
+	MM_STALL_READY
+};
+
+struct mm_watchdog
+{
+	int                 active;
+	volatile int        stop;
+	pthread_t           thread;
+	uint64_t            threshold_ns;
+	machine_stall_cb_t  callback;
+	void               *arg;
+};
+
+void mm_watchdog_init(mm_watchdog_t*);
+int  mm_watchdog_start(mm_watchdog_t*, int, machine_stall_cb_t, void*);
+void mm_watchdog_stop(mm_watchdog_t*);
+int  mm_watchdog_attach(mm_machine_t*);
+void mm_watchdog_detach(mm_machine_t*);
+
+#endif /* MM_WATCHDOG_H */
@@ -79,22 +79,32 @@ machine_write_raw(machine_io_t *obj, void *buf, size_t size)
 	mm_io_t *io = mm_cast(mm_io_t*, obj);
 	mm_errno_set(0);
 	ssize_t rc;
+	if (mm_compression_is_active(io))
+		rc = mm_compression_write(io, buf, size);
+	else
 	if (mm_tls_is_active(io))
 		rc = mm_tls_write(io, buf, size);
-	else
+	else {
 		rc = mm_socket_write(io->fd, buf, size);
+		/* short write filled the socket buffer */
+		if (rc > 0 && (size_t)rc < size)
+			mm_fd_drained(&io->handle, MM_W);
+	}
+	mm_iostat_write(&mm_self->loop.iostat, rc, size, 0);
 	if (rc > 0)
 		return rc;
 	int errno_ = errno;
 	mm_errno_set(errno_);
+	if (errno_ == EAGAIN || errno_ == EWOULDBLOCK)
+		mm_fd_drained(&io->handle, MM_W);
 	if (errno_ == EAGAIN || errno_ == EWOULDBLOCK || errno_ == EINTR)
 		return -1;
 	io->connected = 0;
 	return -1;
 }
 
-MACHINE_API ssize_t
-machine_writev_raw(machine_io_t *obj, machine_iov_t *obj_iov)
+static inline ssize_t
+mm_writev_raw(machine_io_t *obj, machine_iov_t *obj_iov, int more)
 {
 	mm_io_t *io = mm_cast(mm_io_t*, obj);
 	mm_iov_t *iov = mm_cast(mm_iov_t*, obj_iov);
@@ -103,19 +113,92 @@ machine_writev_raw(machine_io_t *obj, machine_iov_t *obj_iov)
 		return 0;
 	struct iovec *iovec = mm_iov_pos(iov);
 	int iov_to_write = iov->iov_count;
-	if (iov_to_write > IOV_MAX)
+	size_t size = iov->size;
+	if (iov_to_write > IOV_MAX) {
 		iov_to_write = IOV_MAX;
+		size = mm_iov_size_of(iovec, iov_to_write);
+	}
+	/* completions of zero-copy sends raise EPOLLERR, which is
+	 * reported once per edge only for attached sockets */
+	int zerocopy = 0;
+	if (io->zerocopy && io->handle.edge) {
+		mm_io_zerocopy_reap(io);
+		zerocopy = io->opt_zerocopy > 0 &&
+		           size >= (size_t)io->opt_zerocopy;
+	}
 	ssize_t rc;
+	if (mm_compression_is_active(io))
+		rc = mm_compression_writev(io, iovec, iov_to_write);
+	else
 	if (mm_tls_is_active(io))
 		rc = mm_tls_writev(io, iovec, iov_to_write);
+	else
+	if (zerocopy) {
+		rc = mm_socket_writev_zerocopy(io->fd, iovec, iov_to_write, more);
+		if (rc > 0)
+			io->zerocopy_sent++;
+		else
+		if (rc == -1 && errno == ENOBUFS) {
+			/* out of pinned memory quota, copy instead */
+			if (more)
+				rc = mm_socket_writev_more(io->fd, iovec, iov_to_write);
+			else
+				rc = mm_socket_writev(io->fd, iovec, iov_to_write);
+		}
+	} else
+	if (more)
+		rc = mm_socket_writev_more(io->fd, iovec, iov_to_write);
 	else
 		rc = mm_socket_writev(io->fd, iovec, iov_to_write);
+	mm_iostat_write(&mm_self->loop.iostat, rc, size, 1);
 	if (rc > 0) {
+		/* messages of the drained iov are kept until the kernel
+		 * releases pages of pending zero-copy sends */
+		if (rc == iov->size && io->zerocopy_sent != io->zerocopy_done) {
+			mm_list_t *i, *n;
+			mm_list_foreach_safe(&iov->msg_list, i, n)
+				mm_list_append(&io->zerocopy_hold, i);
+			mm_list_init(&iov->msg_list);
+		}
 		mm_iov_advance(iov, rc);
 		return rc;
 	}
 	int errno_ = errno;
 	mm_errno_set(errno_);
+	if (errno_ == EAGAIN || errno_ == EWOULDBLOCK)
+		mm_fd_drained(&io->handle, MM_W);
+	if (errno_ == EAGAIN || errno_ == EWOULDBLOCK || errno_ == EINTR)
+		return -1;
+	io->connected = 0;
+	return -1;
+}
+
+MACHINE_API ssize_t
+machine_writev_raw(machine_io_t *obj, machine_iov_t *obj_iov)
+{
+	return mm_writev_raw(obj, obj_iov, 0);
+}
+
+MACHINE_API ssize_t
+machine_writev_raw_more(machine_io_t *obj, machine_iov_t *obj_iov)
+{
+	return mm_writev_raw(obj, obj_iov, 1);
+}
+
+MACHINE_API ssize_t
+machine_splice_write_raw(machine_io_t *obj, int pipe_fd, size_t size)
+{
+	mm_io_t *io = mm_cast(mm_io_t*, obj);
+	mm_errno_set(0);
+	ssize_t rc;
+	rc = mm_socket_splice(pipe_fd, io->fd, size);
+	mm_iostat_splice(&mm_self->loop.iostat, rc);
+	if (rc > 0)
+		return rc;
+	int errno_ = errno;
+	mm_errno_set(errno_);
+	if (errno_ == EAGAIN || errno_ == EWOULDBLOCK)
+		mm_fd_drained(&io->handle, MM_W);
 	if (errno_ == EAGAIN || errno_ == EWOULDBLOCK || errno_ == EINTR)
 		return -1;
 	io->connected = 0;
@@ -0,0 +1,488 @@
+/*
+ * Odyssey.
+ *
+ * Scalable PostgreSQL connection pooler.
+*/
+
+/*
+ * odyssey-logdecode: render binary log written by log_binary_file
+ * as text lines in the default log_format:
+ *
+ * %p %t %l [%i %s] (%c) %m
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "sources/logbin.h"
+
+typedef struct
+{
+	uint32_t pid;
+	char   **strings;
+	uint32_t strings_count;
+} logdecode_session_t;
+
+typedef struct
+{
+	logdecode_session_t *sessions;
+	int                  sessions_count;
+	int                  sessions_visible;
+} logdecode_t;
+
+typedef struct
+{
+	char     type;
+	int64_t  value;
+	double   value_double;
+	char    *string;
+} logdecode_arg_t;
+
+static char*
+logdecode_level[] =
+{
+	"info", "error", "debug", "fatal"
+};
+
+/* string ids are valid within a process run, which starts
+ * with a start record. Both passes create sessions in the
+ * same order, so the second one only walks the list again */
+static logdecode_session_t*
+logdecode_session(logdecode_t *decoder, uint32_t pid, int is_start)
+{
+	int i;
+	if (! is_start) {
+		for (i = decoder->sessions_visible - 1; i >= 0; i--)
+			if (decoder->sessions[i].pid == pid)
+				return &decoder->sessions[i];
+	}
+	if (decoder->sessions_visible < decoder->sessions_count)
+		return &decoder->sessions[decoder->sessions_visible++];
+
+	logdecode_session_t *sessions;
+	sessions = realloc(decoder->sessions, sizeof(logdecode_session_t) *
+	                   (decoder->sessions_count + 1));
+	if (sessions == NULL) {
+		fprintf(stderr, "odyssey-logdecode: out of memory\n");
+		exit(1);
+	}
+	decoder->sessions = sessions;
+	logdecode_session_t *session = &sessions[decoder->sessions_count];
+	session->pid = pid;
+	session->strings = NULL;
+	session->strings_count = 0;
+	decoder->sessions_count++;
+	decoder->sessions_visible = decoder->sessions_count;
+	return session;
+}
+
+static void
+logdecode_session_add(logdecode_session_t *session, uint32_t id,
+                      char *data, int len)
+{
+	if (id >= session->strings_count) {
+		uint32_t count = id + 1;
+		char **strings = realloc(session->strings, sizeof(char*) * count);
+		if (strings == NULL) {
+			fprintf(stderr, "odyssey-logdecode: out of memory\n");
+			exit(1);
+		}
+		memset(strings + session->strings_count, 0,
+		       sizeof(char*) * (count - session->strings_count));
+		session->strings = strings;
+		session->strings_count = count;
+	}
+	free(session->strings[id]);
+	session->strings[id] = strndup(data, len);
+}
+
+static char*
+logdecode_session_string(logdecode_session_t *session, uint32_t id)
+{
+	if (id >= session->strings_count)
+		return NULL;
+	return session->strings[id];
+}
+
+static void
+logdecode_id(char *dest, uint64_t id)
+{
+	if (id == 0) {
+		strcpy(dest, "none");
+		return;
+	}
+	/* same encoding as od_id_generate() */
+	uint32_t a = id & 0xffffffff;
+	uint16_t b = (id >> 32) & 0xffff;
+	char seed[6];
+	memcpy(seed + 0, &a, 4);
+	memcpy(seed + 4, &b, 2);
+	static const char *hex = "0123456789abcdef";
+	int q, w = 0;
+	dest[w++] = (char)(id >> 48);
+	for (q = 0; q < 6; q++) {
+		dest[w++] = hex[(seed[q] >> 4) & 0x0F];
+		dest[w++] = hex[(seed[q]     ) & 0x0F];
+	}
+	dest[w] = 0;
+}
+
+static int
+logdecode_args(logdecode_arg_t *argv, int argv_max,
+               char *data, int size, char *strings)
+{
+	char *pos = data;
+	char *end = data + size;
+	int   argc = 0;
+	while (pos < end && argc < argv_max)
+	{
+		logdecode_arg_t *arg = &argv[argc];
+		arg->type = *pos++;
+		switch (arg->type) {
+		case OD_LOGBIN_ARG_INT:
+			if (end - pos < (int)sizeof(int64_t))
+				return -1;
+			memcpy(&arg->value, pos, sizeof(int64_t));
+			pos += sizeof(int64_t);
+			break;
+		case OD_LOGBIN_ARG_DOUBLE:
+			if (end - pos < (int)sizeof(double))
+				return -1;
+			memcpy(&arg->value_double, pos, sizeof(double));
+			pos += sizeof(double);
+			break;
+		case OD_LOGBIN_ARG_STRING:
+		{
+			uint32_t len;
+			if (end - pos < (int)sizeof(len))
+				return -1;
+			memcpy(&len, pos, sizeof(len));
+			pos += sizeof(len);
+			if (end - pos < (int)len)
+				return -1;
+			/* strings is at least as large as the record */
+			memcpy(strings, pos, len);
+			strings[len] = 0;
+			arg->string = strings;
+			strings += len + 1;
+			pos += len;
+			break;
+		}
+		default:
+			return -1;
+		}
+		argc++;
+	}
+	return argc;
+}
+
+#define logdecode_printf(out, spec, stars, star, value) \
+	do { \
+		if ((stars) == 0) \
+			fprintf(out, spec, value); \
+		else \
+		if ((stars) == 1) \
+			fprintf(out, spec, (star)[0], value); \
+		else \
+			fprintf(out, spec, (star)[0], (star)[1], value); \
+	} while (0)
+
+/* print format string with decoded arguments, length
+ * modifiers are replaced by the stored argument types */
+static void
+logdecode_render(FILE *out, char *fmt, logdecode_arg_t *argv, int argc)
+{
+	int   arg = 0;
+	char *pos = fmt;
+	while (*pos)
+	{
+		if (*pos != '%') {
+			fputc(*pos++, out);
+			continue;
+		}
+		pos++;
+		if (*pos == '%') {
+			fputc('%', out);
+			pos++;
+			continue;
+		}
+		char spec[32];
+		int  spec_len = 0;
+		int  star[2];
+		int  stars = 0;
+		spec[spec_len++] = '%';
+		while (*pos && strchr("-+ #0'", *pos) && spec_len < 16)
+			spec[spec_len++] = *pos++;
+		if (*pos == '*') {
+			spec[spec_len++] = *pos++;
+			star[stars++] = (arg < argc) ? argv[arg++].value : 0;
+		} else {
+			while (isdigit(*pos) && spec_len < 20)
+				spec[spec_len++] = *pos++;
+		}
+		if (*pos == '.') {
+			spec[spec_len++] = *pos++;
+			if (*pos == '*') {
+				spec[spec_len++] = *pos++;
+				star[stars++] = (arg < argc) ? argv[arg++].value : 0;
+			} else {
+				while (isdigit(*pos) && spec_len < 26)
+					spec[spec_len++] = *pos++;
+			}
+		}
+		while (*pos && strchr("hlqjztL", *pos))
+			pos++;
+		char conv = *pos;
+		if (conv == 0)
+			break;
+		pos++;
+		if (conv == 'n')
+			continue;
+		if (arg >= argc) {
+			fputs("(missing)", out);
+			continue;
+		}
+		logdecode_arg_t *value = &argv[arg++];
+		switch (conv) {
+		case 'd': case 'i': case 'u':
+		case 'x': case 'X': case 'o':
+			if (value->type != OD_LOGBIN_ARG_INT)
+				break;
+			spec[spec_len++] = 'l';
+			spec[spec_len++] = 'l';
+			spec[spec_len++] = conv;
+			spec[spec_len] = 0;
+			logdecode_printf(out, spec, stars, star, (long long)value->value);
+			continue;
+		case 'c':
+			if (value->type != OD_LOGBIN_ARG_INT)
+				break;
+			spec[spec_len++] = conv;
+			spec[spec_len] = 0;
+			logdecode_printf(out, spec, stars, star, (int)value->value);
+			continue;
+		case 'p':
+			if (value->type != OD_LOGBIN_ARG_INT)
+				break;
+			spec[spec_len++] = conv;
+			spec[spec_len] = 0;
+			logdecode_printf(out, spec, stars, star,
+			                 (void*)(uintptr_t)value->value);
+			continue;
+		case 'e': case 'E': case 'f': case 'F':
+		case 'g': case 'G': case 'a': case 'A':
+			if (value->type != OD_LOGBIN_ARG_DOUBLE)
+				break;
+			spec[spec_len++] = conv;
+			spec[spec_len] = 0;
+			logdecode_printf(out, spec, stars, star, value->value_double);
+			continue;
+		case 's':
+			if (value->type != OD_LOGBIN_ARG_STRING)
+				break;
+			spec[spec_len++] = conv;
+			spec[spec_len] = 0;
+			logdecode_printf(out, spec, stars, star, value->string);
+			continue;
+		}
+		fputs("(bad argument)", out);
+	}
+}
+
+static void
+logdecode_message(FILE *out, logdecode_session_t *session,
+                  od_logbin_record_t *record, char *data, int size)
+{
+	char timestamp[64];
+	time_t sec = record->time / 1000000;
+	struct tm tm;
+	localtime_r(&sec, &tm);
+	strftime(timestamp, sizeof(timestamp), "%d %b %H:%M:%S", &tm);
+
+	char client[16];
+	char server[16];
+	logdecode_id(client, record->client);
+	logdecode_id(server, record->server);
+
+	char *context = NULL;
+	if (record->context != OD_LOGBIN_INLINE)
+		context = logdecode_session_string(session, record->context);
+
+	char *level = "unknown";
+	if (record->level < sizeof(logdecode_level) / sizeof(logdecode_level[0]))
+		level = logdecode_level[record->level];
+
+	fprintf(out, "%u %s.%03d %s [%s %s] (%s) ",
+	        record->pid, timestamp, (int)((record->time / 1000) % 1000),
+	        level, client, server, context ? context : "none");
+
+	logdecode_arg_t argv[256];
+	char strings[size + 1];
+	int argc;
+	argc = logdecode_args(argv, 256, data, size, strings);
+	if (argc == -1) {
+		fputs("(bad record)\n", out);
+		return;
+	}
+	if (record->id == OD_LOGBIN_INLINE) {
+		if (argc == 1 && argv[0].type == OD_LOGBIN_ARG_STRING)
+			fputs(argv[0].string, out);
+		fputc('\n', out);
+		return;
+	}
+	char *fmt = logdecode_session_string(session, record->id);
+	if (fmt == NULL) {
+		fprintf(out, "(unknown format %u)\n", record->id);
+		return;
+	}
+	logdecode_render(out, fmt, argv, argc);
+	fputc('\n', out);
+}
+
+static int
+logdecode_pass(logdecode_t *decoder, char *name, char *data, size_t size,
+               FILE *out)
+{
+	decoder->sessions_visible = 0;
+	char *pos = data + OD_LOGBIN_MAGIC_LEN;
+	char *end = data + size;
+	while (pos < end)
+	{
+		od_logbin_record_t record;
+		if ((size_t)(end - pos) < sizeof(record)) {
+			fprintf(stderr, "odyssey-logdecode: %s: truncated record\n", name);
+			return -1;
+		}
+		memcpy(&record, pos, sizeof(record));
+		if (record.size < sizeof(record) ||
+		    record.size > (size_t)(end - pos)) {
+			fprintf(stderr, "odyssey-logdecode: %s: bad record size\n", name);
+			return -1;
+		}
+		char *payload = pos + sizeof(record);
+		int   payload_size = record.size - sizeof(record);
+		pos += record.size;
+
+		logdecode_session_t *session;
+		switch (record.type) {
+		case OD_LOGBIN_START:
+			session = logdecode_session(decoder, record.pid, 1);
+			break;
+		case OD_LOGBIN_STRING:
+			session = logdecode_session(decoder, record.pid, 0);
+			if (out == NULL)
+				logdecode_session_add(session, record.id, payload,
+				                      payload_size);
+			break;
+		case OD_LOGBIN_MESSAGE:
+			session = logdecode_session(decoder, record.pid, 0);
+			if (out)
+				logdecode_message(out, session, &record, payload,
+				                  payload_size);
+			break;
+		}
+	}
+	return 0;
+}
+
+static char*
+logdecode_read(int fd, size_t *size)
+{
+	size_t len = 0;
+	size_t allocated = 1 << 20;
+	char *data = malloc(allocated);
+	if (data == NULL)
+		return NULL;
+	for (;;) {
+		if (len == allocated) {
+			allocated *= 2;
+			char *next = realloc(data, allocated);
+			if (next == NULL) {
+				free(data);
+				return NULL;
+			}
+			data = next;
+		}
+		ssize_t rc = read(fd, data + len, allocated - len);
+		if (rc == -1) {
+			free(data);
+			return NULL;
+		}
+		if (rc == 0)
+			break;
+		len += rc;
+	}
+	*size = len;
+	return data;
+}
+
+static int
+logdecode_file(char *name)
+{
+	int fd = STDIN_FILENO;
+	if (strcmp(name, "-") != 0) {
+		fd = open(name, O_RDONLY);
+		if (fd == -1) {
+			perror(name);
+			return -1;
+		}
+	}
+	size_t size;
+	char *data = logdecode_read(fd, &size);
+	if (fd != STDIN_FILENO)
+		close(fd);
+	if (data == NULL) {
+		perror(name);
+		return -1;
+	}
+	if (size < OD_LOGBIN_MAGIC_LEN ||
+	    memcmp(data, OD_LOGBIN_MAGIC, OD_LOGBIN_MAGIC_LEN) != 0) {
+		fprintf(stderr, "odyssey-logdecode: %s: not a binary log\n", name);
+		free(data);
+		return -1;
+	}
+
+	/* strings of a process may follow its first messages when
+	 * written by different threads, collect them first */
+	logdecode_t decoder;
+	memset(&decoder, 0, sizeof(decoder));
+	logdecode_pass(&decoder, name, data, size, NULL);
+	int rc;
+	rc = logdecode_pass(&decoder, name, data, size, stdout);
+
+	int i;
+	for (i = 0; i < decoder.sessions_count; i++) {
+		logdecode_session_t *session = &decoder.sessions[i];
+		uint32_t j;
+		for (j = 0; j < session->strings_count; j++)
+			free(session->strings[j]);
+		free(session->strings);
+	}
+	free(decoder.sessions);
+	free(data);
+	return rc;
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc > 1 && (strcmp(argv[1], "-h") == 0 ||
+	                 strcmp(argv[1], "--help") == 0)) {
+		printf("usage: odyssey-logdecode [file ...]\n");
+		return 0;
+	}
+	if (argc == 1)
+		return logdecode_file("-") == -1;
+	int rc = 0;
+	int i;
+	for (i = 1; i < argc; i++)
+		if (logdecode_file(argv[i]) == -1)
+			rc = 1;
+	return rc;
+}